@@ -42,16 +42,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include "nrf_cli.h"
-#include "nrf_drv_saadc.h"
 #include "nrf_log.h"
-
-static void saadc_callback(nrf_drv_saadc_evt_t const * p_event)
-{
-    if (p_event->type == NRF_DRV_SAADC_EVT_DONE)
-    {
-        //
-    }
-}
+#include "battery_monitor.h"
 
 static void cmd_adc(nrf_cli_t const * p_cli, size_t argc, char **argv)
 {
@@ -69,12 +61,8 @@ static void cmd_adc(nrf_cli_t const * p_cli, size_t argc, char **argv)
 
 static void cmd_adc_sample(nrf_cli_t const * p_cli, size_t argc, char **argv)
 {
-	ret_code_t err_code;
-	nrf_drv_saadc_config_t saadc_config = NRF_DRV_SAADC_DEFAULT_CONFIG;
-    nrf_saadc_channel_config_t channel_config =
-        NRF_DRV_SAADC_DEFAULT_CHANNEL_CONFIG_SE(NRF_SAADC_INPUT_DISABLED);
-
-    nrf_saadc_value_t adc_value;
+    nrf_saadc_input_t input;
+    uint16_t mv;
 
     if ((argc == 1) || nrf_cli_help_requested(p_cli))
     {
@@ -90,7 +78,7 @@ static void cmd_adc_sample(nrf_cli_t const * p_cli, size_t argc, char **argv)
 
     if(!strcmp(argv[1], "vdd") || !strcmp(argv[1], "Vdd") || !strcmp(argv[1], "VDD"))
     {
-    	channel_config.pin_p    = NRF_SAADC_INPUT_VDD;
+    	input = NRF_SAADC_INPUT_VDD;
     }
     else
     {
@@ -101,36 +89,49 @@ static void cmd_adc_sample(nrf_cli_t const * p_cli, size_t argc, char **argv)
 			return;
     	}
 
-    	channel_config.pin_p = ain + 1; // NRF_SAADC_INPUT_AINn = ain(0..7) + 1
+    	input = (nrf_saadc_input_t) (ain + 1); // NRF_SAADC_INPUT_AINn = ain(0..7) + 1
     }
 
-    /* Burst enabled to oversample the SAADC. */
-    channel_config.burst    = NRF_SAADC_BURST_ENABLED;
-    channel_config.acq_time = NRF_SAADC_ACQTIME_40US;
-
-    err_code = nrf_drv_saadc_init(&saadc_config, saadc_callback);
-    APP_ERROR_CHECK(err_code);
+    // The battery monitor owns the SAADC, it holds its sampling for the one conversion.
+    if (battery_monitor_sample(input, &mv) < 0)
+    {
+    	nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "Conversion failed\r\n");
+    	return;
+    }
 
-    err_code = nrf_drv_saadc_channel_init(0, &channel_config);
-    APP_ERROR_CHECK(err_code);
+    if(input == NRF_SAADC_INPUT_VDD)
+    {
+    	nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "VDD: %d\r\n", mv);
+    }
+    else
+    {
+    	nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "AIN%s: %d\r\n", argv[1], mv);
+    }
+}
 
-    err_code = nrf_drv_saadc_sample_convert(0, &adc_value);
-    APP_ERROR_CHECK(err_code);
+static void cmd_adc_battery(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    uint8_t percent = battery_monitor_percent();
 
-    if(channel_config.pin_p == NRF_SAADC_INPUT_VDD)
+    if (nrf_cli_help_requested(p_cli))
     {
-    	nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "VDD: %d\r\n", adc_value*3600/1024);
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
     }
-    else
+
+    if (percent == BATTERY_MONITOR_PERCENT_UNKNOWN)
     {
-    	nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "AIN%s: %d\r\n", argv[1], adc_value*3600/1024);
+        nrf_cli_fprintf(p_cli, NRF_CLI_WARNING, "No reading yet\r\n");
+        return;
     }
 
-    nrf_drv_saadc_uninit();
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "Battery: %d mV, %d%%%s\r\n", battery_monitor_mv(), percent,
+                    battery_monitor_low() ? ", low" : "");
 }
 
 NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_sub_adc)
 {
+    NRF_CLI_CMD(battery, NULL, "'adc battery' Prints the battery monitor's last reading", cmd_adc_battery),
     NRF_CLI_CMD(sample, NULL, "'adc sample {0..7,vdd}' Executes a single ADC conversion. Unit: mV", cmd_adc_sample),
     NRF_CLI_SUBCMD_SET_END
 };
@@ -0,0 +1,491 @@
+//-------------------------------------------
+// Title: cli_imu_cmds.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: CLI commands for the PCB Revision 1 sensor stack, so the
+// drivers can be tuned and profiled over the UART, RTT or BLE CLI without
+// flashing a dedicated test program
+//   imu stream <rate>      adxl372 and icm20649 samples as IMU,ax,ay,az,gx,gy,gz log lines
+//   imu stats              stream and capture pipeline counters, profiler probes
+//   flash bench            erase, program and read timing of the last flash sector
+//   flash dump <event>     header and records of a stored event
+//   spi freq <dev> <hz>    burst frequency of the accel, gyro or flash spi
+// note: flash bench erases the last 64KB sector as test/perf_bench does,
+// an event stored there is lost
+//-------------------------------------------
+#include <stdlib.h>
+#include <string.h>
+#include "nrf_cli.h"
+#include "nrf_log.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "app_error.h"
+
+#include "cli_imu_cmds.h"
+#include "spi_driver.h"
+#include "adxl372.h"
+#include "icm20649.h"
+#include "mt25ql256aba.h"
+#include "event_store.h"
+#include "impact_record.h"
+#include "record_reader.h"
+#include "timebase.h"
+#include "profiler.h"
+
+#define IMU_STREAM_MAX_RATE_HZ      100 //one log line per sample, the uart cli does not keep up with more
+#define FLASH_BENCH_ADDRESS         MT25QL256ABA_BENCH_ADDRESS
+#define FLASH_BENCH_PAGES           16
+#define FLASH_BENCH_LENGTH          (FLASH_BENCH_PAGES*MT25QL256ABA_PAGE_SIZE)
+#define FLASH_DUMP_RECORDS          16 //records printed when no count is given
+
+typedef enum {
+    CLI_SPI_ACCEL,
+    CLI_SPI_GYRO,
+    CLI_SPI_FLASH,
+    CLI_SPI_COUNT
+} cli_spi_dev_t;
+
+typedef struct {
+    uint32_t hz;
+    nrf_drv_spi_frequency_t freq;
+} cli_spi_freq_t;
+
+static const cli_spi_freq_t m_spi_freqs[] = {
+    {125000, NRF_DRV_SPI_FREQ_125K}, {250000, NRF_DRV_SPI_FREQ_250K}, {500000, NRF_DRV_SPI_FREQ_500K},
+    {1000000, NRF_DRV_SPI_FREQ_1M}, {2000000, NRF_DRV_SPI_FREQ_2M}, {4000000, NRF_DRV_SPI_FREQ_4M},
+    {8000000, NRF_DRV_SPI_FREQ_8M}};
+static char const * const m_spi_names[CLI_SPI_COUNT] = {"accel", "gyro", "flash"};
+//icm20649 sensor registers are rated up to 7 MHz
+static const uint32_t m_spi_max_hz[CLI_SPI_COUNT] = {8000000, 4000000, 8000000};
+
+//accel and flash share spi instance 0, the burst frequencies are kept here so
+//they survive the switch between the two, see spi_instance_init
+static nrf_drv_spi_frequency_t m_burst_freq[CLI_SPI_COUNT] = {
+    SPI_ACCEL_BURST_FREQ, SPI_GYRO_BURST_FREQ, SPI_FLASH_BURST_FREQ};
+
+APP_TIMER_DEF(m_stream_timer_id);
+static volatile uint32_t m_stream_pending; //timer ticks not yet sampled
+static uint32_t m_stream_rate_hz;
+static uint32_t m_stream_samples;
+static uint32_t m_stream_missed;
+
+static pipeline_stats_t const *m_p_stats;
+static event_store_t m_event_store;
+static uint8_t m_buf[FLASH_BENCH_LENGTH]; //flash bench pages
+
+static void spi_accel_init(void)
+{
+    ret_code_t err_code = spi_instance_init(&accel_spi, &accel_spi_config, m_burst_freq[CLI_SPI_ACCEL]);
+    APP_ERROR_CHECK(err_code);
+}
+
+static void spi_gyro_init(void)
+{
+    ret_code_t err_code = spi_instance_init(&gyro_spi, &gyro_spi_config, m_burst_freq[CLI_SPI_GYRO]);
+    APP_ERROR_CHECK(err_code);
+}
+
+static void spi_flash_init(void)
+{
+    ret_code_t err_code = spi_instance_init(&flash_spi, &flash_spi_config, m_burst_freq[CLI_SPI_FLASH]);
+    APP_ERROR_CHECK(err_code);
+}
+
+//the commands run in the cli task, the accel is always selected in between them
+static void spi_switch_to_flash_from_accel(void)
+{
+    spi_instance_uninit(&accel_spi);
+    spi_flash_init();
+}
+
+static void spi_switch_to_accel_from_flash(void)
+{
+    spi_instance_uninit(&flash_spi);
+    spi_accel_init();
+}
+
+static void stream_timeout_handler(void * p_context)
+{
+    UNUSED_PARAMETER(p_context);
+    m_stream_pending++;
+}
+
+void cli_imu_init(pipeline_stats_t const *stats)
+{
+    m_p_stats = stats;
+
+    spi_accel_init();
+    spi_gyro_init();
+    adxl372_default_init();
+    icm20649_default_init();
+
+    APP_ERROR_CHECK(app_timer_create(&m_stream_timer_id, APP_TIMER_MODE_REPEATED, stream_timeout_handler));
+}
+
+/*
+ * Reads and logs one sample per stream timer tick. Ticks that came in while
+ * the idle loop was busy are counted as missed, not sampled late
+ */
+void cli_imu_process(void)
+{
+    adxl372_accel_data_t accel;
+    icm20649_data_t gyro;
+    uint32_t pending;
+
+    if (m_stream_pending == 0)
+        return;
+
+    CRITICAL_REGION_ENTER();
+    pending = m_stream_pending;
+    m_stream_pending = 0;
+    CRITICAL_REGION_EXIT();
+
+    adxl372_get_accel_data(&accel);
+    icm20649_read_gyro_accel_data(&gyro);
+    m_stream_samples++;
+    m_stream_missed += pending - 1;
+
+    NRF_LOG_RAW_INFO("IMU,%d,%d,%d,%d,%d,%d\r\n", accel.x, accel.y, accel.z, gyro.gyro_x, gyro.gyro_y, gyro.gyro_z);
+}
+
+static bool parse_uint(char const * str, uint32_t * p_value)
+{
+    char * end;
+
+    *p_value = strtoul(str, &end, 0);
+
+    return (*str != '\0' && *end == '\0');
+}
+
+static uint32_t elapsed_rate(uint32_t bytes, uint32_t elapsed_us)
+{
+    if (elapsed_us == 0)
+        return 0;
+
+    return (uint32_t) (((uint64_t) bytes * 1000000) / elapsed_us);
+}
+
+static void cmd_imu(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    if ((argc == 1) || nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s %s: command not found\r\n", argv[0], argv[1]);
+}
+
+static void cmd_imu_stream(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    uint32_t rate;
+
+    if ((argc != 2) || nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    if (!parse_uint(argv[1], &rate) || rate > IMU_STREAM_MAX_RATE_HZ)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "Invalid rate: %s (0 to %d Hz)\r\n", argv[1], IMU_STREAM_MAX_RATE_HZ);
+        return;
+    }
+
+    APP_ERROR_CHECK(app_timer_stop(m_stream_timer_id));
+    m_stream_pending = 0;
+    m_stream_rate_hz = rate;
+    if (rate == 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "Stream stopped after %u samples\r\n", m_stream_samples);
+        return;
+    }
+
+    m_stream_samples = 0;
+    m_stream_missed = 0;
+    APP_ERROR_CHECK(app_timer_start(m_stream_timer_id,
+                                    ROUNDED_DIV(APP_TIMER_CLOCK_FREQ, rate*(APP_TIMER_CONFIG_RTC_FREQUENCY + 1)), NULL));
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "Streaming IMU,ax,ay,az,gx,gy,gz at %u Hz, 'imu stream 0' stops\r\n", rate);
+}
+
+static void cmd_imu_stats(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "stream: %u Hz, %u samples, %u missed\r\n",
+                    m_stream_rate_hz, m_stream_samples, m_stream_missed);
+
+    if (m_p_stats != NULL)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "captures: %u, samples: %u, dropped: %u, fifo overruns: %u\r\n",
+                        m_p_stats->captures, m_p_stats->samples_captured,
+                        m_p_stats->samples_dropped, m_p_stats->fifo_overruns);
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "rate: %u Hz last, %u Hz min\r\n",
+                        m_p_stats->last_rate_hz, m_p_stats->min_rate_hz);
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "commits: %u, %u ms last, %u ms max, %u erase stalls\r\n",
+                        m_p_stats->commits, m_p_stats->last_commit_ms,
+                        m_p_stats->max_commit_ms, m_p_stats->erase_stalls);
+    }
+
+#if PROFILER_ENABLED
+    //the probes go to the log, the cli prints it as well
+    profiler_dump();
+#endif
+}
+
+static void cmd_flash(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    if ((argc == 1) || nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s %s: command not found\r\n", argv[0], argv[1]);
+}
+
+/*
+ * Erase, program and read back FLASH_BENCH_ADDRESS, every program and erase
+ * is timed until the write in progress flag clears
+ * @return 0 if success otherwise -1
+ */
+static int8_t flash_bench(nrf_cli_t const * p_cli)
+{
+    uint32_t start;
+    uint32_t elapsed;
+    uint32_t i;
+    int8_t ret;
+
+    start = timebase_now_us();
+    ret = mt25ql256aba_erase_block(FLASH_BENCH_ADDRESS, MT25QL256ABA_SECTOR_SIZE);
+    if (ret < 0)
+        return ret;
+    mt25ql256aba_check_write_in_progress_flag();
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "sector erase: %u us\r\n", timebase_since_us(start));
+
+    start = timebase_now_us();
+    ret = mt25ql256aba_erase_block(FLASH_BENCH_ADDRESS, MT25QL256ABA_SUBSECTOR_4KB_SIZE);
+    if (ret < 0)
+        return ret;
+    mt25ql256aba_check_write_in_progress_flag();
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "subsector erase: %u us\r\n", timebase_since_us(start));
+
+    for (i = 0; i < MT25QL256ABA_PAGE_SIZE; i++)
+        m_buf[i] = i;
+    start = timebase_now_us();
+    for (i = 0; i < FLASH_BENCH_PAGES; i++)
+    {
+        ret = mt25ql256aba_page_program(FLASH_BENCH_ADDRESS + i*MT25QL256ABA_PAGE_SIZE, m_buf, MT25QL256ABA_PAGE_SIZE);
+        if (ret < 0)
+            return ret;
+        mt25ql256aba_check_write_in_progress_flag();
+    }
+    elapsed = timebase_since_us(start);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "page program: %u us, %u B/s\r\n",
+                    elapsed/FLASH_BENCH_PAGES, elapsed_rate(FLASH_BENCH_LENGTH, elapsed));
+
+    start = timebase_now_us();
+    ret = mt25ql256aba_read(FLASH_BENCH_ADDRESS, m_buf, FLASH_BENCH_LENGTH);
+    if (ret < 0)
+        return ret;
+    elapsed = timebase_since_us(start);
+    for (i = 0; i < ARRAY_SIZE(m_spi_freqs); i++)
+    {
+        if (m_spi_freqs[i].freq == m_burst_freq[CLI_SPI_FLASH])
+            break;
+    }
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "read at %u Hz: %u B/s\r\n",
+                    (i < ARRAY_SIZE(m_spi_freqs)) ? m_spi_freqs[i].hz : 0, elapsed_rate(FLASH_BENCH_LENGTH, elapsed));
+
+    return 0;
+}
+
+static void cmd_flash_bench(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    int8_t ret;
+
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    spi_switch_to_flash_from_accel();
+    timebase_start();
+    ret = flash_bench(p_cli);
+    timebase_stop();
+    spi_switch_to_accel_from_flash();
+
+    if (ret < 0)
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "Flash bench failed: %d\r\n", ret);
+}
+
+/*
+ * Prints the header of an event and up to num_records of its records as
+ * index, delta, adxl372 x, y, z, icm20649 accel x, y, z and gyro x, y, z counts
+ * @return 0 if success, -1 on spi error, -2 or -3 if the event can't be read
+ */
+static int8_t flash_dump(nrf_cli_t const * p_cli, uint32_t id, uint32_t num_records)
+{
+    static record_reader_t reader;
+    event_store_header_t const *header = &reader.header;
+    impact_record_t record;
+    adxl372_accel_data_t accel;
+    icm20649_data_t icm;
+    uint32_t i;
+    uint8_t delta;
+    int8_t ret;
+
+    ret = record_reader_open(&reader, &m_event_store, id);
+    if (ret < 0)
+        return ret;
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "event %u: %u.%06u s since 1970 UTC%s\r\n", header->id,
+                    header->time.s, header->time.us & EVENT_STORE_TIME_US_MASK,
+                    (header->time.us & EVENT_STORE_TIME_SYNCED) ? ", synced" : "");
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%u samples of %u bytes, encoding %u, location %u, crc %s\r\n",
+                    header->sample_count, header->sample_size, header->encoding, header->summary.location,
+                    (event_store_verify(&m_event_store, id) == 0) ? "ok" : "bad");
+
+    if (!record_reader_has_records(&reader))
+        return 0; //not impact records, the header is all there is to print
+
+    for (i = 0; i < num_records && (ret = record_reader_next(&reader, &record)) > 0; i++)
+    {
+        impact_record_unpack(&record, &accel, &icm, &delta);
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%u,%u,%d,%d,%d,%d,%d,%d,%d,%d,%d\r\n", i, delta,
+                        accel.x, accel.y, accel.z, icm.accel_x, icm.accel_y, icm.accel_z,
+                        icm.gyro_x, icm.gyro_y, icm.gyro_z);
+    }
+
+    //a record that does not decode is a corrupt event
+    if (ret < 0)
+        return (ret == -2) ? -3 : ret;
+    return 0;
+}
+
+static void cmd_flash_dump(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    uint32_t id;
+    uint32_t num_records = FLASH_DUMP_RECORDS;
+    int8_t ret;
+
+    if ((argc < 2) || (argc > 3) || nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    if (!parse_uint(argv[1], &id) || (argc == 3 && !parse_uint(argv[2], &num_records)))
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "Unknown parameters\r\n");
+        return;
+    }
+
+    spi_switch_to_flash_from_accel();
+    ret = event_store_init(&m_event_store);
+    if (ret == 0)
+        ret = flash_dump(p_cli, id, num_records);
+    spi_switch_to_accel_from_flash();
+
+    if (ret == -2)
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "No event %u, %u stored\r\n", id, event_store_count(&m_event_store));
+    else if (ret < 0)
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "Event %u can't be read: %d\r\n", id, ret);
+}
+
+static void cmd_spi(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    if ((argc == 1) || nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s %s: command not found\r\n", argv[0], argv[1]);
+}
+
+static void cmd_spi_freq(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    uint32_t hz;
+    uint8_t dev;
+    uint8_t i;
+
+    if ((argc < 2) || (argc > 3) || nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    for (dev = 0; dev < CLI_SPI_COUNT; dev++)
+    {
+        if (!strcmp(argv[1], m_spi_names[dev]))
+            break;
+    }
+    if (dev == CLI_SPI_COUNT)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "Unknown device: %s (Should be accel, gyro or flash)\r\n", argv[1]);
+        return;
+    }
+
+    if (argc == 2)
+    {
+        for (i = 0; i < ARRAY_SIZE(m_spi_freqs); i++)
+        {
+            if (m_spi_freqs[i].freq == m_burst_freq[dev])
+                nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%s burst frequency: %u Hz\r\n", argv[1], m_spi_freqs[i].hz);
+        }
+        return;
+    }
+
+    if (!parse_uint(argv[2], &hz))
+        hz = 0;
+    for (i = 0; i < ARRAY_SIZE(m_spi_freqs); i++)
+    {
+        if (m_spi_freqs[i].hz == hz)
+            break;
+    }
+    if (i == ARRAY_SIZE(m_spi_freqs) || hz > m_spi_max_hz[dev])
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "Invalid frequency: %s (125000 to %u Hz in powers of 2)\r\n",
+                        argv[2], m_spi_max_hz[dev]);
+        return;
+    }
+
+    m_burst_freq[dev] = m_spi_freqs[i].freq;
+    //the flash instance is not initialized, spi_flash_init applies it
+    if (dev == CLI_SPI_ACCEL)
+        spi_set_burst_frequency(&accel_spi, m_burst_freq[dev]);
+    else if (dev == CLI_SPI_GYRO)
+        spi_set_burst_frequency(&gyro_spi, m_burst_freq[dev]);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%s burst frequency: %u Hz\r\n", argv[1], hz);
+}
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_sub_imu)
+{
+    NRF_CLI_CMD(stream, NULL, "'imu stream {rate}' logs sensor samples at up to 100 Hz, 0 stops", cmd_imu_stream),
+    NRF_CLI_CMD(stats,  NULL, "'imu stats' prints the stream and capture pipeline counters", cmd_imu_stats),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+NRF_CLI_CMD_REGISTER(imu, &m_sub_imu, "Commands for the adxl372 and icm20649", cmd_imu);
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_sub_flash)
+{
+    NRF_CLI_CMD(bench, NULL, "'flash bench' times erase, program and read, erases the last sector", cmd_flash_bench),
+    NRF_CLI_CMD(dump,  NULL, "'flash dump {event} [records]' prints a stored event", cmd_flash_dump),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+NRF_CLI_CMD_REGISTER(flash, &m_sub_flash, "Commands for the mt25ql256aba event store", cmd_flash);
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_sub_spi)
+{
+    NRF_CLI_CMD(freq, NULL, "'spi freq {accel,gyro,flash} [hz]' reads or sets a burst frequency", cmd_spi_freq),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+NRF_CLI_CMD_REGISTER(spi, &m_sub_spi, "Commands for the sensor spi buses", cmd_spi);
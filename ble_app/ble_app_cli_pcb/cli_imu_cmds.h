@@ -0,0 +1,14 @@
+#ifndef CLI_IMU_CMDS_H
+#define CLI_IMU_CMDS_H
+
+#include "pipeline_stats.h"
+
+/* CLI access to the PCB Revision 1 sensor stack: the imu, flash and spi
+ * commands. cli_imu_init() brings up the spi instances and the sensors,
+ * cli_imu_process() has to be called from the idle loop to run the imu stream.
+ * stats is printed by 'imu stats', NULL if the firmware has no capture pipeline */
+void cli_imu_init(pipeline_stats_t const *stats);
+
+void cli_imu_process(void);
+
+#endif //CLI_IMU_CMDS_H
@@ -58,7 +58,7 @@
 #include "ble_bas.h"
 #include "ble_dis.h"
 #include "boards.h"
-#include "sensorsim.h"
+#include "battery_monitor.h"
 #include "nrf_sdh.h"
 #include "nrf_sdh_soc.h"
 #include "nrf_sdh_ble.h"
@@ -87,6 +87,9 @@
 #include "nrf_log_ctrl.h"
 #include "nrf_log_backend_flash.h"
 
+#include "cli_imu_cmds.h"
+#include "profiler.h"
+
 
 #define DEVICE_NAME                     "Nordic_CLI"                                /**< Name of device. Will be included in the advertising data. */
 #define MANUFACTURER_NAME               "NordicSemiconductor"                       /**< Manufacturer. Will be passed to Device Information Service. */
@@ -97,11 +100,6 @@
 #define APP_BLE_OBSERVER_PRIO           3                                           /**< Application's BLE observer priority. You shouldn't need to modify this value. */
 #define APP_BLE_CONN_CFG_TAG            1                                           /**< A tag identifying the SoftDevice BLE configuration. */
 
-#define BATTERY_LEVEL_MEAS_INTERVAL      APP_TIMER_TICKS(2000)                      /**< Battery level measurement interval (ticks). */
-#define MIN_BATTERY_LEVEL                81                                         /**< Minimum simulated battery level. */
-#define MAX_BATTERY_LEVEL                100                                        /**< Maximum simulated 7battery level. */
-#define BATTERY_LEVEL_INCREMENT          1                                          /**< Increment between each simulated battery level measurement. */
-
 #define MIN_CONN_INTERVAL                MSEC_TO_UNITS(400, UNIT_1_25_MS)           /**< Minimum acceptable connection interval (0.4 seconds). */
 #define MAX_CONN_INTERVAL                MSEC_TO_UNITS(650, UNIT_1_25_MS)           /**< Maximum acceptable connection interval (0.65 second). */
 #define SLAVE_LATENCY                    0                                          /**< Slave latency. */
@@ -126,7 +124,6 @@ BLE_BAS_DEF(m_bas);
 NRF_BLE_GATT_DEF(m_gatt);                                                           /**< GATT module instance. */
 NRF_BLE_QWR_DEF(m_qwr);                                                             /**< Context for the Queued Write module.*/
 BLE_ADVERTISING_DEF(m_advertising);                                                 /**< Advertising module instance. */
-APP_TIMER_DEF(m_battery_timer_id);                                                  /**< Battery timer. */
 
 NRF_CLI_RTT_DEF(cli_rtt);
 NRF_CLI_UART_DEF(cli_uart,0 , 256, 16);
@@ -140,9 +137,6 @@ NRF_LOG_BACKEND_CRASHLOG_DEF(m_crash_log_backend);
 
 static uint16_t  m_conn_handle = BLE_CONN_HANDLE_INVALID;                           /**< Handle of the current connection. */
 
-static sensorsim_cfg_t   m_battery_sim_cfg;                                         /**< Battery Level sensor simulator configuration. */
-static sensorsim_state_t m_battery_sim_state;                                       /**< Battery Level sensor simulator state. */
-
 task_id_t m_ble_console_task_id;
 
 static ble_uuid_t m_adv_uuids[] =                                                   /**< Universally unique service identifiers. */
@@ -579,24 +573,26 @@ static void buttons_leds_init(bool * p_erase_bonds)
 }
 
 
-/**@brief Function for handling the Battery measurement timer timeout.
+/**@brief Function for handling a new battery reading.
  *
- * @details This function will be called each time the battery level measurement timer expires.
+ * @details Called from the SAADC interrupt by the battery monitor each time a buffer of samples
+ *          is in, the level is notified to the peer if it has enabled notifications.
  *
- * @param[in] p_context  Pointer used for passing some arbitrary information (context) from the
- *                       app_start_timer() call to the timeout handler.
+ * @param[in] mv       Battery voltage in mV.
+ * @param[in] percent  Battery level in percent.
  */
-static void battery_level_meas_timeout_handler(void * p_context)
+static void battery_level_update_handler(uint16_t mv, uint8_t percent)
 {
-    UNUSED_PARAMETER(p_context);
+    UNUSED_PARAMETER(mv);
 
     ret_code_t err_code;
-    uint8_t  battery_level;
 
-    battery_level = (uint8_t)sensorsim_measure(&m_battery_sim_state, &m_battery_sim_cfg);
-
-    //NRF_LOG_INFO("Battery level update: %d", battery_level);
-    err_code = ble_bas_battery_level_update(&m_bas, battery_level, BLE_CONN_HANDLE_ALL);
+    // A board without a VBAT input never has a level to report.
+    if (percent == BATTERY_MONITOR_PERCENT_UNKNOWN)
+    {
+        return;
+    }
+    err_code = ble_bas_battery_level_update(&m_bas, percent, BLE_CONN_HANDLE_ALL);
     if ((err_code != NRF_SUCCESS) &&
         (err_code != NRF_ERROR_INVALID_STATE) &&
         (err_code != NRF_ERROR_RESOURCES) &&
@@ -608,35 +604,17 @@ static void battery_level_meas_timeout_handler(void * p_context)
     }
 }
 
-/**@brief Function for initialization of ticker for periodical battery measurement.
+/**@brief Function for initializing the battery measurement.
+ *
+ * @details The RTC triggers the SAADC through PPI, the CPU only hears of it once a buffer of
+ *          samples is averaged.
  */
 static void battery_measurement_init(void)
 {
-    ret_code_t err_code;
-
-    m_battery_sim_cfg.min          = MIN_BATTERY_LEVEL;
-    m_battery_sim_cfg.max          = MAX_BATTERY_LEVEL;
-    m_battery_sim_cfg.incr         = BATTERY_LEVEL_INCREMENT;
-    m_battery_sim_cfg.start_at_max = true;
-
-    sensorsim_init(&m_battery_sim_state, &m_battery_sim_cfg);
-
-    // Create timers.
-    err_code = app_timer_create(&m_battery_timer_id,
-                                APP_TIMER_MODE_REPEATED,
-                                battery_level_meas_timeout_handler);
-    APP_ERROR_CHECK(err_code);
-}
-
-/**@brief Function for starting batter measurement timers.
- */
-static void battery_measurement_start(void)
-{
-    ret_code_t err_code;
-
-    // Start application timers.
-    err_code = app_timer_start(m_battery_timer_id, BATTERY_LEVEL_MEAS_INTERVAL, NULL);
-    APP_ERROR_CHECK(err_code);
+    if (battery_monitor_init(battery_level_update_handler) < 0)
+    {
+        APP_ERROR_HANDLER(NRF_ERROR_INTERNAL);
+    }
 }
 
 /**
@@ -671,13 +649,13 @@ void idle_task(void * p_context)
 {
 
     bool erase_bonds = (bool)p_context;
-    battery_measurement_start();
 
     advertising_start(erase_bonds);
 
     // Enter main loop.
     for (;;)
     {
+        cli_imu_process();
         if (NRF_LOG_PROCESS() == false)
         {
             nrf_pwr_mgmt_run();
@@ -756,6 +734,12 @@ int main(void)
 
     battery_measurement_init();
 
+#if PROFILER_ENABLED
+    profiler_init();
+#endif
+    // Sensors for the imu, flash and spi commands, no capture pipeline here.
+    cli_imu_init(NULL);
+
     APP_ERROR_CHECK(nrf_cli_ble_uart_service_init());
 
     NRF_LOG_INFO("BLE CLI example started.");
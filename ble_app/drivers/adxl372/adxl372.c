@@ -1,66 +1,341 @@
 //-------------------------------------------
 // Title: adxl372.c
 // Author: UBC Capstone Team 48 - 2019/2020
-// Description: This is verison of the adxl372 is depreciated and is used 
-// for running older breadboard prototype test programs. Please see adxl372_pcb
+// Description: adxl372 driver for every board, the spi instance, pins, bus
+// profile and interrupt pins come from the board header (board_config)
 //-------------------------------------------
 #include "adxl372.h"
-#include "spi_driver.h"
 #include "nrf_delay.h"
+#include "app_error.h"
+#include "profiler.h"
+#include "sensor_int.h"
+
+const nrf_drv_spi_t accel_spi = NRF_DRV_SPI_INSTANCE(ACCEL_SPI_INSTANCE);  
+
+nrf_drv_spi_config_t const accel_spi_config = {
+        .ss_pin       = SPI_ACCEL_CS_PIN, //driven by spi_driver only, so fifo bursts can span several transfers
+        .miso_pin     = SPI_ACCEL_MISO_PIN,
+        .mosi_pin     = SPI_ACCEL_MOSI_PIN,
+        .sck_pin      = SPI_ACCEL_SCK_PIN,
+        .irq_priority = SPI_IRQ_PRIORITY,
+        .orc          = 0xFF,
+        .frequency    = SPI_ACCEL_CONFIG_FREQ,
+        .mode         = NRF_DRV_SPI_MODE_0,
+        .bit_order    = NRF_DRV_SPI_BIT_ORDER_MSB_FIRST,
+    };
+
+static volatile bool m_int_pending[2] = {false}; /**< Set by the INT1/INT2 GPIOTE events. */
+
+static adxl372_int_callback_t m_int_callback = NULL; /**< Also called by the INT1/INT2 GPIOTE events if set. */
+
+__ALIGN(4) static uint8_t m_fifo_buf[ADXL_FIFO_SIZE*2]; /**< Raw fifo burst, the byte clocked in with the read address is skipped, word aligned for the loads of adxl372_fifo_unpack. */
+
+/*
+ * Converts a 2 byte data or fifo entry (12 bit left justified) to signed counts,
+ * the low nibble holds the series start bit in fifo entries
+ */
+static int16_t adxl372_entry_to_counts(uint8_t const *entry)
+{
+    return (int16_t)((entry[0] << 8) | (entry[1] & 0xF0)) >> 4;
+}
+
+/* adxl372_default_init, full bandwidth measurement with the fifo bypassed,
+ * the offsets are filled in at init */
+static const adxl372_config_t m_default_config = {
+    .fifo_samples = ADXL372_FIFO_SAMPLES_RESET, //the fifo is bypassed
+    .fifo_ctl     = ADXL372_FIFO_CTL_VAL(1, BYPASSED, XYZ_FIFO),
+    .int1_map     = 0,
+    .int2_map     = 0,
+    .timing       = ADXL372_TIMING_VAL(ODR_6400HZ, WUR_52MS),
+    .measure      = ADXL372_MEASURE_VAL(BW_3200HZ, LOW_NOISE, DEF, false),
+    .power_ctl    = ADXL372_POWER_CTL_VAL(FULL_BW_MEASUREMENT, true, true, FILTER_SETTLE_16, ADXL_INSTAON_LOW_THRESH),
+};
+
+/* adxl372_default_init_fifo_mode and _fifo_int_mode, the offsets and fifo fields are filled in at init */
+static const adxl372_config_t m_default_fifo_config = {
+    .timing       = ADXL372_TIMING_VAL(ODR_6400HZ, WUR_52MS),
+    .measure      = ADXL372_MEASURE_VAL(BW_3200HZ, NORMAL_NOISE, DEF, false),
+    .power_ctl    = ADXL372_POWER_CTL_VAL(FULL_BW_MEASUREMENT, true, true, FILTER_SETTLE_16, ADXL_INSTAON_LOW_THRESH),
+};
+
+/* Shadow of the configuration registers OFFSET_X..POWER_CTL. The driver is
+ * their only writer, so once a register is known (written, read, or set by a
+ * soft reset) adxl372_write_mask works from the copy instead of reading it.
+ * POWER_CTL holds the mode last written, not the instant on or autosleep state */
+#define ADXL372_SHADOW_FIRST    ADI_ADXL372_OFFSET_X
+#define ADXL372_SHADOW_COUNT    (ADI_ADXL372_POWER_CTL - ADI_ADXL372_OFFSET_X + 1)
+
+/* OFFSET_X..OFFSET_Z of every default image, the board's own trims once
+ * adxl372_set_offset_trim has been given them */
+static uint8_t m_offset_trim[3] = ADXL372_DEFAULT_OFFSET_TRIM;
+
+static uint8_t m_shadow[ADXL372_SHADOW_COUNT];
+static uint32_t m_shadow_valid = 0; /**< bit per register of m_shadow, none known before the first reset */
+
+STATIC_ASSERT(ADXL372_SHADOW_COUNT <= 32);
+
+/* Every MASK keeps the bits outside its field, which has to be one run starting at its POS */
+#define ADXL372_FIELD_OK(mask, pos)     (((uint8_t) ~(mask) >> (pos)) != 0 && \
+                                         ((uint8_t) ~(mask) & ((1U << (pos)) - 1)) == 0 && \
+                                         ((((uint8_t) ~(mask) >> (pos)) + 1) & ((uint8_t) ~(mask) >> (pos))) == 0)
+STATIC_ASSERT(ADXL372_FIELD_OK(MEASURE_AUTOSLEEP_MASK, MEASURE_AUTOSLEEP_POS));
+STATIC_ASSERT(ADXL372_FIELD_OK(MEASURE_BANDWIDTH_MASK, MEASURE_BANDWIDTH_POS));
+STATIC_ASSERT(ADXL372_FIELD_OK(MEASURE_ACTPROC_MASK, MEASURE_ACTPROC_POS));
+STATIC_ASSERT(ADXL372_FIELD_OK(MEASURE_LOW_NOISE_MASK, MEASURE_LOW_NOISE_POS));
+STATIC_ASSERT(ADXL372_FIELD_OK(TIMING_ODR_MASK, TIMING_ODR_POS));
+STATIC_ASSERT(ADXL372_FIELD_OK(TIMING_WUR_MASK, TIMING_WUR_POS));
+STATIC_ASSERT(ADXL372_FIELD_OK(TIMING_EXT_CLK_MASK, TIMING_EXT_CLK_POS));
+STATIC_ASSERT(ADXL372_FIELD_OK(TIMING_EXT_SYNC_MASK, TIMING_EXT_SYNC_POS));
+STATIC_ASSERT(ADXL372_FIELD_OK(PWRCTRL_OPMODE_MASK, PWRCTRL_OPMODE_POS));
+STATIC_ASSERT(ADXL372_FIELD_OK(PWRCTRL_HPF_DISABLE_MASK, PWRCTRL_HPF_DISABLE_POS));
+STATIC_ASSERT(ADXL372_FIELD_OK(PWRCTRL_LPF_DISABLE_MASK, PWRCTRL_LPF_DISABLE_POS));
+STATIC_ASSERT(ADXL372_FIELD_OK(PWRCTRL_INSTON_THRESH_MASK, INSTAON_THRESH_POS));
+STATIC_ASSERT(ADXL372_FIELD_OK(PWRCTRL_FILTER_SETTLE_MASK, PWRCTRL_FILTER_SETTLE_POS));
+/* the thresholds of an event are written X_H to Z_L in one burst */
+STATIC_ASSERT(ADI_ADXL372_Z_THRESH_ACT_L - ADI_ADXL372_X_THRESH_ACT_H == 5);
+STATIC_ASSERT(ADI_ADXL372_Z_THRESH_ACT2_L - ADI_ADXL372_X_THRESH_ACT2_H == 5);
+STATIC_ASSERT(ADI_ADXL372_Z_THRESH_INACT_L - ADI_ADXL372_X_THRESH_INACT_H == 5);
+
+static bool adxl372_is_shadowed(uint8_t reg_addr)
+{
+    return reg_addr >= ADXL372_SHADOW_FIRST && reg_addr < ADXL372_SHADOW_FIRST + ADXL372_SHADOW_COUNT;
+}
+
+/*
+ * Records num_bytes registers from reg_addr on as known, or as unknown after a failed write
+ */
+static void adxl372_shadow_update(uint8_t reg_addr, uint8_t const *reg_data, uint8_t num_bytes, bool known)
+{
+    uint8_t i;
+
+    for (i = 0; i < num_bytes; i++, reg_addr++)
+    {
+        if (!adxl372_is_shadowed(reg_addr))
+            continue;
+        if (known)
+        {
+            m_shadow[reg_addr - ADXL372_SHADOW_FIRST] = reg_data[i];
+            m_shadow_valid |= 1UL << (reg_addr - ADXL372_SHADOW_FIRST);
+        }
+        else
+        {
+            m_shadow_valid &= ~(1UL << (reg_addr - ADXL372_SHADOW_FIRST));
+        }
+    }
+}
+
+/*
+ * Sets the shadow to the register defaults after a soft reset, all zero but FIFO_SAMPLES
+ */
+static void adxl372_shadow_reset(void)
+{
+    memset(m_shadow, 0, sizeof(m_shadow));
+    m_shadow[ADI_ADXL372_FIFO_SAMPLES - ADXL372_SHADOW_FIRST] = ADXL372_FIFO_SAMPLES_RESET;
+    m_shadow_valid = (ADXL372_SHADOW_COUNT < 32) ? (1UL << ADXL372_SHADOW_COUNT) - 1 : 0xFFFFFFFF;
+}
+
+/*
+ * Sets the offset trims the default images are written with from now on, e.g.
+ * the per board calibration kept in the internal flash. The device keeps its
+ * trims until a configuration image is applied
+ * @param offset - OFFSET_X, OFFSET_Y, OFFSET_Z, figure 36 user offset trim profile
+ * @return 0 if success otherwise -2 if a trim does not fit its 4 bits, the trims are unchanged
+ */
+int8_t adxl372_set_offset_trim(uint8_t const offset[3])
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        if (offset[i] > ADXL372_OFFSET_TRIM_MAX)
+            return -2;
+    }
+
+    memcpy(m_offset_trim, offset, sizeof(m_offset_trim));
+    return 0;
+}
+
+/*
+ * @return the offset trims the default images are written with
+ */
+uint8_t const *adxl372_offset_trim(void)
+{
+    return m_offset_trim;
+}
 
 void adxl372_default_init (void)
 {
-    /*
-    GPIO for INT1 pin and INT2 pin,
-    gpio_init();
-    */
+    adxl372_config_t config = m_default_config;
 
-    //initialize device settings
-    /* set up measurement mode */
+    memcpy(config.offset, m_offset_trim, sizeof(config.offset));
     adxl372_reset();
-    adxl372_set_op_mode(STAND_BY);
-    //Please refer to figure 36 User offset trim profile for more info
-    //For ADXL372 Vs=3.3V, x_offset = 0, y_offset=2, z_offset=5 
-    adxl372_set_x_offset(0);
-    adxl372_set_y_offset(2); //+10 LSB
-    adxl372_set_z_offset(5); //+35 LSB
-    adxl372_set_hpf_disable(true);
-    adxl372_set_lpf_disable(true);
-    adxl372_set_bandwidth(BW_3200HZ);
-    adxl372_set_odr(ODR_6400HZ);
-    adxl372_set_filter_settle(FILTER_SETTLE_16);
-    adxl372_write_mask(ADI_ADXL372_MEASURE, MEASURE_LOW_NOISE_MASK, MEASURE_LOW_NOISE_POS, LOW_NOISE);
-    adxl372_set_op_mode(FULL_BW_MEASUREMENT);
-
+    adxl372_apply_config(NULL, &config);
 }
 
 
 void adxl372_default_init_fifo_mode(struct adxl372_device *dev, uint16_t num_samples)
 {
-    //initialize device settings
+    adxl372_config_t config = m_default_fifo_config;
 
-    /* set up measurement mode */
+    memcpy(config.offset, m_offset_trim, sizeof(config.offset));
+    //the fifo stays bypassed if num_samples does not fit
+    adxl372_config_set_fifo(&config, num_samples, OLDEST_SAVED, XYZ_FIFO);
     adxl372_reset();
-    adxl372_set_op_mode(STAND_BY);
-    adxl372_configure_fifo(dev, num_samples, OLDEST_SAVED, XYZ_FIFO);
-    //Please refer to figure 36 User offset trim profile for more info
-    //For ADXL372 Vs=3.3V, x_offset = 0, y_offset=2, z_offset=5 
-    adxl372_set_x_offset(0);
-    adxl372_set_y_offset(2); //+10 LSB
-    adxl372_set_z_offset(5); //+35 LSB
-    adxl372_set_hpf_disable(true);
-    adxl372_set_lpf_disable(true);
-    adxl372_set_bandwidth(BW_3200HZ);
-    adxl372_set_odr(ODR_6400HZ);
-    adxl372_set_filter_settle(FILTER_SETTLE_16);
-    //adxl372_set_instaon_threshold(ADXL_INSTAON_HIGH_THRESH); //sets to 30g
-    //adxl372_write_mask(ADI_ADXL372_MEASURE, MEASURE_LOW_NOISE_MASK, MEASURE_LOW_NOISE_POS, LOW_NOISE);
-    adxl372_set_op_mode(FULL_BW_MEASUREMENT);
-    //nrf_delay_ms(16);
-    //adxl372_set_op_mode(INSTANT_ON);
+    adxl372_apply_config(dev, &config);
 }
 
 
+/*
+ * Same as adxl372_default_init_fifo_mode but streams the fifo continuously
+ * and maps the FIFO watermark (FIFO_FULL) to INT1 so the samples can be
+ * drained in one burst instead of polling the status register per sample
+ * @param watermark - number of FIFO entries before INT1 is asserted
+ */
+void adxl372_default_init_fifo_int_mode(struct adxl372_device *dev, uint16_t watermark)
+{
+    adxl372_config_t config;
+
+    adxl372_config_fifo_int_default(&config, watermark);
+    adxl372_reset();
+    adxl372_apply_config(dev, &config);
+}
+
+/*
+ * Fills in the image adxl372_default_init_fifo_int_mode writes, so the rate or
+ * the thresholds can be changed before adxl372_apply_config
+ * @param watermark - number of FIFO entries before INT1 is asserted
+ * @return 0 if success otherwise -2 if watermark is out of range, the fifo is then bypassed
+ */
+int8_t adxl372_config_fifo_int_default(adxl372_config_t *config, uint16_t watermark)
+{
+    *config = m_default_fifo_config;
+    memcpy(config->offset, m_offset_trim, sizeof(config->offset));
+    config->int1_map = INT_MAP_FIFO_FULL_MSK;
+    return adxl372_config_set_fifo(config, watermark, STREAMED, XYZ_FIFO);
+}
+
+/*
+ * Fills in an image for a window held by the adxl372 itself: the fifo runs in
+ * triggered mode, keeps the newest pre_samples until an activity event, then
+ * fills up behind it and stops, so the whole window waits for one drain. The
+ * activity is mapped to INT1, its thresholds and timer are not part of the
+ * image (adxl372_set_activity_threshold). Applying the image again after the
+ * drain empties the fifo and arms the next event
+ * @param pre_samples - xyz samples kept from before the event, less than ADXL_FIFO_MAX_SAMPLES
+ * @return 0 if success otherwise -2 if pre_samples is out of range, the fifo is then bypassed
+ */
+int8_t adxl372_config_triggered_fifo(adxl372_config_t *config, uint16_t pre_samples)
+{
+    *config = m_default_fifo_config;
+    memcpy(config->offset, m_offset_trim, sizeof(config->offset));
+    config->int1_map = INT_MAP_ACT_MSK;
+    if (pre_samples >= ADXL_FIFO_MAX_SAMPLES)
+        return -2;
+    return adxl372_config_set_fifo(config, pre_samples*3, TRIGGERED, XYZ_FIFO);
+}
+
+/*
+ * Sets the output data rate and the low pass bandwidth of a configuration image
+ * @return 0 if success otherwise -2 if the bandwidth is above half the rate, config is unchanged
+ */
+int8_t adxl372_config_set_rate(adxl372_config_t *config, adxl372_odr_t odr, adxl372_bw_t bw)
+{
+    //BW_200HZ << n is half of ODR_400HZ << n
+    if (odr > ODR_6400HZ || (uint8_t) bw > (uint8_t) odr)
+        return -2;
+
+    config->timing = (config->timing & TIMING_ODR_MASK) | (odr << TIMING_ODR_POS);
+    config->measure = (config->measure & MEASURE_BANDWIDTH_MASK) | (bw << MEASURE_BANDWIDTH_POS);
+    return 0;
+}
+
+/*
+ * Sets looped activity processing with autosleep in a configuration image: once
+ * the inactivity is detected the adxl372 drops to WAKE_UP on its own, watches for
+ * the activity at the wake up rate and goes back to the mode of the image when
+ * it sees it, without the host. The thresholds and timers are not part of the
+ * image, see adxl372_set_activity_threshold and adxl372_set_inactivity_threshold
+ * @return 0 if success otherwise -2 if the wake up rate is invalid, config is unchanged
+ */
+int8_t adxl372_config_set_autosleep(adxl372_config_t *config, adxl372_wakeup_rate_t wur)
+{
+    if (wur > WUR_24576MS)
+        return -2;
+
+    config->timing = (config->timing & TIMING_WUR_MASK) | (wur << TIMING_WUR_POS);
+    config->measure = (config->measure & MEASURE_ACTPROC_MASK & MEASURE_AUTOSLEEP_MASK)
+                      | (LOOPED << MEASURE_ACTPROC_POS) | (1 << MEASURE_AUTOSLEEP_POS);
+    return 0;
+}
+
+/*
+ * Sets the external sync in a configuration image: the adxl372 takes a sample on
+ * each rising edge of INT2 instead of at its own output data rate, so the samples
+ * follow the host's clock. The edges have to come no faster than the ODR of the
+ * image, the filters are still set by it, and INT2 can't be mapped to an interrupt
+ */
+void adxl372_config_set_ext_sync(adxl372_config_t *config, bool enable)
+{
+    config->timing = (config->timing & TIMING_EXT_SYNC_MASK) | (enable << TIMING_EXT_SYNC_POS);
+    if (enable)
+        config->int2_map = 0;
+}
+
+/*
+ * Fills in the fifo fields of a configuration image, see adxl372_configure_fifo
+ * @param fifo_samples - fifo entries, 1 to 512
+ * @return 0 if success otherwise -2 if fifo_samples is out of range, config is unchanged
+ */
+int8_t adxl372_config_set_fifo(adxl372_config_t *config, uint16_t fifo_samples, adxl372_fifo_mode_t fifo_mode, adxl372_fifo_format_t fifo_format)
+{
+    if (fifo_samples == 0 || fifo_samples > ADXL_FIFO_SIZE)
+        return -2;
+
+    config->fifo_samples = ADXL372_FIFO_SAMPLES_VAL(fifo_samples);
+    config->fifo_ctl = ADXL372_FIFO_CTL_VAL(fifo_samples, fifo_mode, fifo_format);
+    return 0;
+}
+
+/*
+ * Writes a whole configuration image: standby, then one burst over the offsets
+ * and one over FIFO_SAMPLES..POWER_CTL, queued as one batch with a single wait.
+ * Replaces the read-modify-write setters at bring up and on mode switches
+ * @param dev - gets the fifo configuration of the image, may be NULL
+ * @return 0 if success otherwise -1
+ */
+int8_t adxl372_apply_config(struct adxl372_device *dev, adxl372_config_t const *config)
+{
+    //EasyDMA only reads from ram, the image may be in flash
+    uint8_t standby[2] = {ADI_ADXL372_POWER_CTL << 1, config->power_ctl & PWRCTRL_OPMODE_MASK};
+    uint8_t offsets[1 + sizeof(config->offset)] = {ADI_ADXL372_OFFSET_X << 1};
+    uint8_t ctl[1 + ADXL372_CTL_REG_COUNT] = {ADI_ADXL372_FIFO_SAMPLES << 1};
+    spi_xfer_t xfers[3] = {
+        {.cs_pin = SPI_ACCEL_CS_PIN, .p_tx_buf = standby, .tx_length = sizeof(standby)},
+        {.cs_pin = SPI_ACCEL_CS_PIN, .p_tx_buf = offsets, .tx_length = sizeof(offsets)},
+        {.cs_pin = SPI_ACCEL_CS_PIN, .p_tx_buf = ctl, .tx_length = sizeof(ctl)},
+    };
+    uint16_t samples;
+
+    memcpy(&offsets[1], config->offset, sizeof(config->offset));
+    memcpy(&ctl[1], &config->fifo_samples, ADXL372_CTL_REG_COUNT);
+
+    if (spi_perform_batch(&accel_spi, xfers, ARRAY_SIZE(xfers)) < 0)
+    {
+        adxl372_shadow_update(ADI_ADXL372_OFFSET_X, &offsets[1], sizeof(config->offset), false);
+        adxl372_shadow_update(ADI_ADXL372_FIFO_SAMPLES, &ctl[1], ADXL372_CTL_REG_COUNT, false);
+        return -1;
+    }
+    adxl372_shadow_update(ADI_ADXL372_OFFSET_X, &offsets[1], sizeof(config->offset), true);
+    adxl372_shadow_update(ADI_ADXL372_FIFO_SAMPLES, &ctl[1], ADXL372_CTL_REG_COUNT, true);
+
+    if (dev != NULL)
+    {
+        samples = (config->fifo_samples | ((config->fifo_ctl >> FIFO_CTL_SAMP8_POS) & 0x1) << 8) + 1;
+        dev->fifo_config.samples = samples;
+        dev->fifo_config.mode = (adxl372_fifo_mode_t)((config->fifo_ctl >> FIFO_CTL_MODE_POS) & 0x3);
+        dev->fifo_config.format = (adxl372_fifo_format_t)((config->fifo_ctl >> FIFO_CTL_FORMAT_POS) & 0x7);
+    }
+    return 0;
+}
+
 /*
  * Read register from adxl372
  * @param reg_addr - register address
@@ -75,17 +350,18 @@ int8_t adxl372_read_reg( uint8_t reg_addr, uint8_t *reg_data)
 
     read_addr = ((reg_addr & 0xFF) << 1) | ADXL_SPI_RNW; //set R/W bit to 1 for reading
 
-    ret = spi_write_and_read(SPI_ADXL372_CS_PIN, &read_addr, 1, buf, 2);
+    ret = spi_write_and_read(&accel_spi, SPI_ACCEL_CS_PIN, &read_addr, 1, buf, 2);
     if (ret < 0)
         return ret;
     
     *reg_data = buf[1];
+    adxl372_shadow_update(reg_addr, reg_data, 1, true);
 
     return ret;
 }
 
 /*
- * Write to an adxl372 register
+ * Write to an adxl372 register, the shadow follows the configuration registers
  * @param reg_addr - The register address to write to
  * @param reg_data - The register data to send to
  * @return 0 if success otherwise -1
@@ -94,15 +370,31 @@ int8_t adxl372_write_reg(uint8_t reg_addr, uint8_t reg_data)
 {
     uint8_t tx_buf[2]; // write address + write data
     uint8_t rx_buf[2]; 
+    int8_t ret;
 
     tx_buf[0] = (reg_addr & 0xFF) << 1; //addr is 7-bits
     tx_buf[1] = reg_data;
 
-    return spi_write_and_read(SPI_ADXL372_CS_PIN, tx_buf, 2, rx_buf, 2);
+    ret = spi_write_and_read(&accel_spi, SPI_ACCEL_CS_PIN, tx_buf, 2, rx_buf, 2);
+
+    if (reg_addr == ADI_ADXL372_SRESET)
+    {
+        if (ret < 0)
+            m_shadow_valid = 0;
+        else
+            adxl372_shadow_reset();
+    }
+    else
+    {
+        adxl372_shadow_update(reg_addr, &reg_data, 1, ret == 0);
+    }
+
+    return ret;
 }
 
 /*
  * Read multiple bytes from an adxl372 register
+ * The bytes are DMAed straight into reg_data, it must be in ram
  * @param reg_addr - The register address to read from
  * @param reg_data - The register data to send to
  * @return 0 if success otherwise -1
@@ -110,32 +402,72 @@ int8_t adxl372_write_reg(uint8_t reg_addr, uint8_t reg_data)
 int8_t adxl372_multibyte_read_reg( uint8_t reg_addr, uint8_t* reg_data, uint8_t num_bytes) 
 {
     uint8_t read_addr;
-    uint8_t rx_buf[256]; 
-    int8_t ret;
-    
-    if(num_bytes > 255)
-        return -1;
 
     read_addr = (reg_addr << 1) | 0x01; //set R bit to 1
-    memset(rx_buf, 0x00, num_bytes + 1);
 
-    ret = spi_write_and_read(SPI_ADXL372_CS_PIN, &read_addr, 1, rx_buf, num_bytes + 1 );
-    if (ret < 0)
-        return ret;
-    
-    memcpy(reg_data, &rx_buf[1], num_bytes);
+    return spi_write_then_read(&accel_spi, SPI_ACCEL_CS_PIN, &read_addr, 1, reg_data, num_bytes, true);
+}
+
+/*
+ * Writes consecutive adxl372 registers in one transaction, the address
+ * increments after each byte, the shadow follows the configuration registers
+ * @param num_bytes - up to ADXL372_WRITE_BURST_MAX, not across SRESET
+ * @return 0 if success otherwise -1, or -2 if num_bytes is out of range
+ */
+int8_t adxl372_multibyte_write_reg(uint8_t reg_addr, uint8_t const *reg_data, uint8_t num_bytes)
+{
+    uint8_t tx_buf[1 + ADXL372_WRITE_BURST_MAX];
+    uint8_t rx_buf[1 + ADXL372_WRITE_BURST_MAX];
+    int8_t ret;
+
+    if (num_bytes == 0 || num_bytes > ADXL372_WRITE_BURST_MAX)
+        return -2;
+
+    tx_buf[0] = reg_addr << 1;
+    memcpy(&tx_buf[1], reg_data, num_bytes);
+    ret = spi_write_and_read(&accel_spi, SPI_ACCEL_CS_PIN, tx_buf, 1 + num_bytes, rx_buf, 1 + num_bytes);
+    adxl372_shadow_update(reg_addr, reg_data, num_bytes, ret == 0);
 
     return ret;
 }
 
+/*
+ * Writes the six threshold registers of an event from its X_H on, one burst
+ * instead of a transaction per register. Only X has the referenced bit
+ */
+static void adxl372_write_thresholds(uint8_t x_thresh_h, uint16_t thresh, bool referenced, bool enable)
+{
+    uint8_t regs[6];
+    uint8_t axis;
+
+    for (axis = 0; axis < 3; axis++)
+    {
+        regs[2*axis] = ADXL372_THRESH_H_VAL(thresh);
+        regs[2*axis + 1] = ADXL372_THRESH_L_VAL(thresh, referenced && axis == 0, enable);
+    }
+    (void) adxl372_multibyte_write_reg(x_thresh_h, regs, sizeof(regs));
+}
+
+/*
+ * Changes the bits of a register outside mask. A shadowed register is one
+ * write, e.g. adxl372_set_op_mode, any other is read first
+ * @return 0 if success otherwise -1
+ */
 int8_t adxl372_write_mask(uint8_t reg_addr, uint32_t mask, uint32_t pos, uint8_t val)
 {
     uint8_t reg_data;
     int ret;
 
-    ret = adxl372_read_reg(reg_addr, &reg_data);
-    if (ret < 0)
-        return ret;
+    if (adxl372_is_shadowed(reg_addr) && (m_shadow_valid & (1UL << (reg_addr - ADXL372_SHADOW_FIRST))))
+    {
+        reg_data = m_shadow[reg_addr - ADXL372_SHADOW_FIRST];
+    }
+    else
+    {
+        ret = adxl372_read_reg(reg_addr, &reg_data);
+        if (ret < 0)
+            return ret;
+    }
 
     //modifies the bit in the specified position
     reg_data &= mask;                  
@@ -170,6 +502,25 @@ void adxl372_set_wakeup_rate(adxl372_wakeup_rate_t wur)
     adxl372_write_mask(ADI_ADXL372_TIMING, TIMING_WUR_MASK, TIMING_WUR_POS, wur);
 }
 
+/*
+ * Runs the conversions from a clock on INT1 instead of the internal oscillator,
+ * in standby. INT1 can't be mapped to an interrupt while it is set
+ */
+void adxl372_set_ext_clk(bool enable)
+{
+    adxl372_set_op_mode(STAND_BY);
+    adxl372_write_mask(ADI_ADXL372_TIMING, TIMING_EXT_CLK_MASK, TIMING_EXT_CLK_POS, enable);
+}
+
+/*
+ * Takes a sample on each rising edge of INT2, in standby, see adxl372_config_set_ext_sync
+ */
+void adxl372_set_ext_sync(bool enable)
+{
+    adxl372_set_op_mode(STAND_BY);
+    adxl372_write_mask(ADI_ADXL372_TIMING, TIMING_EXT_SYNC_MASK, TIMING_EXT_SYNC_POS, enable);
+}
+
 void adxl372_set_bandwidth(adxl372_bw_t bw)
 {
     adxl372_write_mask(ADI_ADXL372_MEASURE, MEASURE_BANDWIDTH_MASK, MEASURE_BANDWIDTH_POS, bw);
@@ -193,40 +544,19 @@ void adxl372_set_instaon_threshold(adxl372_instaon_thresh_t mode)
 void adxl372_set_activity_threshold(uint16_t  thresh, bool referenced, bool enable)
 {
     adxl372_set_op_mode(STAND_BY);
-
-    adxl372_write_reg(ADI_ADXL372_X_THRESH_ACT_H, thresh >> 3);
-    adxl372_write_reg(ADI_ADXL372_X_THRESH_ACT_L, 
-                        (thresh << 5) | (referenced << 1) | enable);
-    adxl372_write_reg(ADI_ADXL372_Y_THRESH_ACT_H, thresh >> 3);
-    adxl372_write_reg(ADI_ADXL372_Y_THRESH_ACT_L, (thresh << 5) | enable);
-    adxl372_write_reg(ADI_ADXL372_Z_THRESH_ACT_H, thresh >> 3);
-    adxl372_write_reg(ADI_ADXL372_Z_THRESH_ACT_L, (thresh << 5) | enable);
+    adxl372_write_thresholds(ADI_ADXL372_X_THRESH_ACT_H, thresh, referenced, enable);
 }
 
 void adxl372_set_activity2_threshold(uint16_t  thresh, bool referenced, bool enable)
 {
     adxl372_set_op_mode(STAND_BY);
-    adxl372_write_reg(ADI_ADXL372_X_THRESH_ACT2_H, thresh >> 3);
-    adxl372_write_reg(ADI_ADXL372_X_THRESH_ACT2_L,
-                        (thresh << 5) | (referenced << 1) | enable);
-    adxl372_write_reg( ADI_ADXL372_Y_THRESH_ACT2_H, thresh >> 3);
-    adxl372_write_reg(ADI_ADXL372_Y_THRESH_ACT2_L, (thresh << 5) | enable);
-    adxl372_write_reg(ADI_ADXL372_Z_THRESH_ACT2_H, thresh >> 3);
-    adxl372_write_reg(ADI_ADXL372_Z_THRESH_ACT2_L, (thresh << 5) | enable);
-
+    adxl372_write_thresholds(ADI_ADXL372_X_THRESH_ACT2_H, thresh, referenced, enable);
 }
 
 void adxl372_set_inactivity_threshold(uint16_t thresh, bool referenced, bool enable)
 {
-    adxl372_set_op_mode(STAND_BY); 
-
-    adxl372_write_reg(ADI_ADXL372_X_THRESH_INACT_H, thresh >> 3);
-    adxl372_write_reg(ADI_ADXL372_X_THRESH_INACT_L,
-                        (thresh << 5) | (referenced << 1) | enable);
-    adxl372_write_reg(ADI_ADXL372_Y_THRESH_INACT_H, thresh >> 3);
-    adxl372_write_reg(ADI_ADXL372_Y_THRESH_INACT_L, (thresh << 5) | enable);
-    adxl372_write_reg(ADI_ADXL372_Z_THRESH_INACT_H, thresh >> 3);
-    adxl372_write_reg(ADI_ADXL372_Z_THRESH_INACT_L, (thresh << 5) | enable);
+    adxl372_set_op_mode(STAND_BY);
+    adxl372_write_thresholds(ADI_ADXL372_X_THRESH_INACT_H, thresh, referenced, enable);
 }
 
 void adxl372_set_activity_time(uint8_t time)
@@ -234,10 +564,14 @@ void adxl372_set_activity_time(uint8_t time)
     adxl372_write_reg(ADI_ADXL372_TIME_ACT, time);
 }
 
-void adxl372_set_inactivity_time(uint8_t time)
+/*
+ * @param time - TIME_INACT_H:TIME_INACT_L, in periods of the inactivity timer
+ */
+void adxl372_set_inactivity_time(uint16_t time)
 {
-    adxl372_write_reg(ADI_ADXL372_TIME_INACT_H, time >> 8);
-    adxl372_write_reg(ADI_ADXL372_TIME_INACT_L, time & 0xFF);
+    uint8_t regs[2] = {time >> 8, time & 0xFF};
+
+    (void) adxl372_multibyte_write_reg(ADI_ADXL372_TIME_INACT_H, regs, sizeof(regs));
 }
 
 void adxl372_set_filter_settle(adxl372_filter_settle_t mode)
@@ -245,6 +579,17 @@ void adxl372_set_filter_settle(adxl372_filter_settle_t mode)
     adxl372_write_mask(ADI_ADXL372_POWER_CTL, PWRCTRL_FILTER_SETTLE_MASK, PWRCTRL_FILTER_SETTLE_POS, mode);
 }
 
+/*
+ * Maps status events to the INT1 and INT2 pins (see INT_MAP_*_MSK)
+ * pins are active high unless INT_MAP_LOW_MSK is set
+ */
+void adxl372_set_interrupts(uint8_t int1_map, uint8_t int2_map)
+{
+    uint8_t regs[2] = {int1_map, int2_map};
+
+    (void) adxl372_multibyte_write_reg(ADI_ADXL372_INT1_MAP, regs, sizeof(regs));
+}
+
 /*
  *  Gets the device ID 
  *  @return device ID of adxl372
@@ -257,6 +602,61 @@ uint8_t adxl372_get_dev_ID(void)
     return device_ID;
 }
 
+/*
+ * Reads the three id registers in one burst, the quick check of a warm boot
+ * @return 0 if success otherwise -1 if the spi failed or -2 if an id is wrong
+ */
+int8_t adxl372_check_id(void)
+{
+    uint8_t read_addr = (ADI_ADXL372_ADI_DEVID << 1) | ADXL_SPI_RNW;
+    uint8_t buf[1 + ADXL372_ID_LENGTH]; //dummy byte, ADI_DEVID, MST_DEVID, DEVID
+    int8_t ret;
+
+    ret = spi_write_and_read(&accel_spi, SPI_ACCEL_CS_PIN, &read_addr, 1, buf, sizeof(buf));
+    if (ret < 0)
+        return ret;
+
+    return adxl372_id_check(&buf[1]);
+}
+
+/*
+ * Queues the burst read of the three id registers without blocking, e.g. to
+ * check the adxl372 while the other buses are checked
+ * @param p_xfer - descriptor, must stay valid until the callback
+ * @param p_rx_buf - ADXL372_ID_LENGTH bytes, for adxl372_id_check
+ * @return 0 if queued otherwise -1
+ */
+int8_t adxl372_queue_id_read(spi_xfer_t *p_xfer, uint8_t *p_rx_buf, spi_xfer_callback_t callback, void *p_context)
+{
+    static uint8_t read_addr = (ADI_ADXL372_ADI_DEVID << 1) | ADXL_SPI_RNW; //in ram for EasyDMA
+
+    p_xfer->cs_pin = SPI_ACCEL_CS_PIN;
+    p_xfer->p_tx_buf = &read_addr;
+    p_xfer->tx_length = 1;
+    p_xfer->rx_skip = 1;
+    p_xfer->p_rx_buf = p_rx_buf;
+    p_xfer->rx_length = ADXL372_ID_LENGTH;
+    p_xfer->callback = callback;
+    p_xfer->p_context = p_context;
+    p_xfer->burst = false;
+
+    return spi_queue_xfer(&accel_spi, p_xfer);
+}
+
+/*
+ * @param p_ids - ADI_DEVID, MST_DEVID and DEVID as read
+ * @return 0 if they are the adxl372 ones otherwise -2
+ */
+int8_t adxl372_id_check(uint8_t const *p_ids)
+{
+    if (p_ids[0] != ADI_ADXL372_ADI_DEVID_VAL || p_ids[1] != ADI_ADXL372_MST_DEVID_VAL || p_ids[2] != ADI_ADXL372_DEVID_VAL)
+    {
+        NRF_LOG_ERROR("adxl372 ids 0x%x 0x%x 0x%x", p_ids[0], p_ids[1], p_ids[2]);
+        return -2;
+    }
+    return 0;
+}
+
 uint8_t adxl372_get_status_reg(void)
 {
     uint8_t status_reg = 0;
@@ -286,38 +686,92 @@ void adxl372_get_highest_peak_accel_data(adxl372_accel_data_t* max_peak)
     
     adxl372_multibyte_read_reg(ADI_ADXL372_X_MAXPEAK_H, buf, 6);
 
-    // shift the MSB by 8 bits to make space for LSB (12bit left justified)
-    max_peak->x = (buf[0] << 8) | buf[1]; 
-    max_peak->y = (buf[2] << 8) | buf[3];
-    max_peak->z = (buf[4] << 8) | buf[5];
+    adxl372_parse_accel_data(buf, max_peak);
+}
 
-    max_peak->x = (max_peak->x /16) *100;
-    max_peak->y = (max_peak->y /16) *100;
-    max_peak->z = (max_peak->z /16) *100;
+/*
+ * Reads the MAXPEAK registers as they are, without waiting for a sample as
+ * adxl372_get_highest_peak_accel_data does, so it works in standby and right
+ * after an instant on wake up. The read starts the peaks over
+ * @return 0 if success otherwise -1
+ */
+int8_t adxl372_read_max_peak(adxl372_accel_data_t *p_max_peak)
+{
+    uint8_t buf[6];
+
+    if (adxl372_multibyte_read_reg(ADI_ADXL372_X_MAXPEAK_H, buf, sizeof(buf)) < 0)
+        return -1;
 
+    adxl372_parse_accel_data(buf, p_max_peak);
+    return 0;
 }
 
+/*
+ * Time from the switch to full bandwidth measurement, by a write or an
+ * instant on wake up, until the samples have settled, per the FILTER_SETTLE
+ * bit written last. From the shadow, the 370 ms of the reset value if unknown
+ */
+uint16_t adxl372_filter_settle_ms(void)
+{
+    uint8_t power_ctl = 0;
+
+    if (m_shadow_valid & (1UL << (ADI_ADXL372_POWER_CTL - ADXL372_SHADOW_FIRST)))
+        power_ctl = m_shadow[ADI_ADXL372_POWER_CTL - ADXL372_SHADOW_FIRST];
+
+    return (((power_ctl & ~PWRCTRL_FILTER_SETTLE_MASK) >> PWRCTRL_FILTER_SETTLE_POS) == FILTER_SETTLE_16) ?
+           ADXL372_FILTER_SETTLE_16_MS : ADXL372_FILTER_SETTLE_370_MS;
+}
+
+PROFILER_PROBE_DEF(m_get_accel_data_probe, "adxl372_get_accel_data");
+
 void adxl372_get_accel_data(adxl372_accel_data_t *accel_data)
 {
     uint8_t status;
     uint8_t buf[6];
+    PROFILER_START(m_get_accel_data_probe);
 
     do{
         status = adxl372_get_status_reg();
         status = status & 0x1; // check first bit(data ready)
     }while((!status & DATA_RDY)); //loop while status = 0
 
-    adxl372_multibyte_read_reg(ADI_ADXL372_X_DATA_H, buf, 6);
+    adxl372_multibyte_read_reg(ADI_ADXL372_X_DATA_H, buf, ADXL_ACCEL_DATA_LENGTH);
 
-    // shift the MSB by 8 bits to make space for LSB (12bit left justified)
-    accel_data->x = (buf[0] << 8) | (buf[1] & 0xF0); 
-    accel_data->y = (buf[2] << 8) | (buf[3] & 0xF0);
-    accel_data->z = (buf[4] << 8) | (buf[5] & 0xF0);
+    adxl372_parse_accel_data(buf, accel_data);
+    PROFILER_STOP(m_get_accel_data_probe);
+}
+
+/*
+ * Queues a read of the x/y/z data registers without blocking or waiting on DATA_RDY
+ * @param p_xfer - descriptor, must stay valid until the callback
+ * @param p_rx_buf - ADXL_ACCEL_DATA_LENGTH bytes, for adxl372_parse_accel_data
+ * @return 0 if queued otherwise -1
+ */
+int8_t adxl372_queue_accel_read(spi_xfer_t *p_xfer, uint8_t *p_rx_buf, spi_xfer_callback_t callback, void *p_context)
+{
+    static uint8_t read_addr = (ADI_ADXL372_X_DATA_H << 1) | ADXL_SPI_RNW; //in ram for EasyDMA
+
+    p_xfer->cs_pin = SPI_ACCEL_CS_PIN;
+    p_xfer->p_tx_buf = &read_addr;
+    p_xfer->tx_length = 1;
+    p_xfer->rx_skip = 1;
+    p_xfer->p_rx_buf = p_rx_buf;
+    p_xfer->rx_length = ADXL_ACCEL_DATA_LENGTH;
+    p_xfer->callback = callback;
+    p_xfer->p_context = p_context;
+    p_xfer->burst = true;
+
+    return spi_queue_xfer(&accel_spi, p_xfer);
+}
 
-    //convert from 12 bit to 16bit and then to mg
-    accel_data->x = (accel_data->x /16) *100;
-    accel_data->y = (accel_data->y /16) *100;
-    accel_data->z = (accel_data->z /16) *100;
+/*
+ * Converts the raw x/y/z data registers to counts, see ADXL372_COUNTS_TO_MG
+ */
+void adxl372_parse_accel_data(uint8_t const *p_raw, adxl372_accel_data_t *accel_data)
+{
+    accel_data->x = adxl372_entry_to_counts(&p_raw[0]);
+    accel_data->y = adxl372_entry_to_counts(&p_raw[2]);
+    accel_data->z = adxl372_entry_to_counts(&p_raw[4]);
 }
 
 //Please refer to figure 36 User offset trim profile for more info
@@ -340,9 +794,19 @@ void adxl372_set_z_offset(uint8_t offset)
 
 void adxl372_reset(void)
 {
-    adxl372_set_op_mode(STAND_BY);
+    adxl372_reset_start();
+    nrf_delay_ms(ADXL372_RESET_MS);
+}
+
+/*
+ * Sends the soft reset without waiting, the caller leaves ADXL372_RESET_MS
+ * before the next access, e.g. asleep on a timer
+ */
+void adxl372_reset_start(void)
+{
+    //the soft reset clears the rest of POWER_CTL, no need to read it first
+    adxl372_write_reg(ADI_ADXL372_POWER_CTL, STAND_BY << PWRCTRL_OPMODE_POS);
     adxl372_write_reg(ADI_ADXL372_SRESET, ADI_ADXL372_RESET_CODE);
-    nrf_delay_ms(1);
 }
 
 int32_t adxl372_configure_fifo (struct adxl372_device *dev, uint16_t fifo_samples, adxl372_fifo_mode_t fifo_mode, adxl372_fifo_format_t fifo_format)
@@ -373,58 +837,545 @@ int32_t adxl372_configure_fifo (struct adxl372_device *dev, uint16_t fifo_sample
     return 1;
 }
 
-int8_t adxl372_get_fifo_data(struct adxl372_device *dev, adxl372_accel_data_t *samples)
+/* order the axes are stored in the fifo for each adxl372_fifo_format_t, 0 = x, 1 = y, 2 = z */
+static const uint8_t m_fifo_axis_map[8][3] = {
+    [XYZ_FIFO]      = {0, 1, 2},
+    [X_FIFO]        = {0},
+    [Y_FIFO]        = {1},
+    [XY_FIFO]       = {0, 1},
+    [Z_FIFO]        = {2},
+    [XZ_FIFO]       = {0, 2},
+    [YZ_FIFO]       = {1, 2},
+    [XYZ_PEAK_FIFO] = {0, 1, 2},
+};
+
+/*
+ * Returns the number of axes stored per sample for a fifo format
+ */
+static uint8_t adxl372_fifo_format_axes(adxl372_fifo_format_t format)
 {
-    uint8_t fifo_status;
-    uint8_t buf[1024];
-    fifo_status = adxl372_get_status_reg();
-    int8_t ret;
-   
-    //checks fifo overun status
-    if(fifo_status & FIFO_OVR)
-        return -1; //fifo overrun
+    switch(format)
+    {
+        case X_FIFO:
+        case Y_FIFO:
+        case Z_FIFO:
+            return 1;
+        case XY_FIFO:
+        case XZ_FIFO:
+        case YZ_FIFO:
+            return 2;
+        default:
+            return 3;
+    }
+}
+
+
+/*
+ * Counts a fifo overrun, keeps the activity bits and works out how many entries to read from
+ * STATUS_1, STATUS_2, FIFO_ENTRIES_2, FIFO_ENTRIES_1
+ * @return whole samples worth of entries, at most max_samples
+ */
+RAMFUNC static uint16_t adxl372_fifo_entries_to_read(struct adxl372_device *dev, uint8_t const *status_buf, uint16_t max_samples)
+{
+    uint8_t axes = adxl372_fifo_format_axes(dev->fifo_config.format);
+    uint16_t entries;
+
+    if(status_buf[0] & FIFO_OVR)
+        dev->fifo_overruns++;
+    //read along with the entries, so the activity bits come for free with every drain
+    dev->activity_status |= status_buf[1];
+
+    entries = ((status_buf[2] & 0x03) << 8) | status_buf[3];
+    if (entries > ADXL_FIFO_SIZE)
+        entries = ADXL_FIFO_SIZE;
+    if (entries > max_samples*axes)
+        entries = max_samples*axes;
+    entries -= entries % axes; // only read whole samples
+
+    return entries;
+}
+
+/*
+ * Unpacks fifo entries one byte pair at a time, for every fifo format. A sample
+ * starts on an entry with the series start bit, entries before it or a sample cut
+ * short by another series start are dropped so the axes never get misaligned.
+ * The reference of the adxl372_fifo_unpack kernel, e.g. in test/perf_bench
+ * @param p_raw - entries*2 bytes as read from FIFO_DATA
+ * @param samples - axes not in the fifo format are set to 0
+ * @return number of samples
+ */
+uint16_t adxl372_fifo_unpack_scalar(adxl372_fifo_format_t format, uint8_t const *p_raw, uint16_t entries,
+                                    adxl372_accel_data_t *samples)
+{
+    uint8_t axes = adxl372_fifo_format_axes(format);
+    uint16_t num_samples = 0;
+    uint16_t i = 0;
 
-    if(dev->fifo_config.mode != BYPASSED)
+    while (i + axes <= entries)
     {
-        if( (fifo_status & FIFO_FULL) ) //(fifo_status & FIFO_RDY) || 
+        uint8_t const *entry = &p_raw[i*2];
+        int16_t xyz[3] = {0}; //axes not in the fifo format stay 0
+        uint8_t axis;
+
+        if (!(entry[1] & FIFO_SERIES_START_MSK))
         {
-            // FIFO holds 512 Samples,
-            // Each sample is 2 bytes
-            // TODO: if fifo sample is 512 we must do multibyte 4 times since max num_byte is 255
-            //for(int i = 0; i < dev->fifo_config.samples*2; i+=255)
-            ret = adxl372_multibyte_read_reg(ADI_ADXL372_FIFO_DATA, buf, dev->fifo_config.samples*2);
-            if (ret < 0)
-                return ret;
-        
-            for (int i = 0; i< dev->fifo_config.samples*2; i +=6)
-            {
-                samples->x = (buf[i+0] << 8) | (buf[i+1] & 0xF0); 
-                samples->y = (buf[i+2] << 8) | (buf[i+3] & 0xF0); 
-                samples->z = (buf[i+4] << 8) | (buf[i+5] & 0xF0); 
-
-                //convert from 12 bit to 16bit and then to mg
-                samples->x = (samples->x/16)*100;
-                samples->y = (samples->y/16)*100;
-                samples->z = (samples->z/16)*100;
-                samples++; 
-            }
+            i++; //resync on the next series start
+            continue;
+        }
 
+        for (axis = 0; axis < axes; axis++)
+        {
+            //a series start inside the sample means entries were lost
+            if (axis > 0 && (entry[axis*2 + 1] & FIFO_SERIES_START_MSK))
+                break;
+            xyz[m_fifo_axis_map[format][axis]] = adxl372_entry_to_counts(&entry[axis*2]);
         }
-        else
+        if (axis < axes)
         {
-            return -3;//ERROR fifo no ready
+            i += axis;
+            continue;
         }
+
+        samples->x = xyz[0];
+        samples->y = xyz[1];
+        samples->z = xyz[2];
+        samples++;
+        num_samples++;
+        i += axes;
     }
-    else
+
+    return num_samples;
+}
+
+//the two entries of a REV16 word as counts, the flags in the low nibble shift out
+#define ADXL372_WORD_LO_COUNTS(word)    ((int16_t)((int32_t)((word) << 16) >> 20))
+#define ADXL372_WORD_HI_COUNTS(word)    ((int16_t)((int32_t)(word) >> 20))
+//series start bits of the three words of two xyz samples, on x of each
+#define ADXL372_XYZ_SERIES_MSK          ((FIFO_SERIES_START_MSK << 16) | FIFO_SERIES_START_MSK)
+#define ADXL372_XYZ_SERIES_W0           FIFO_SERIES_START_MSK
+#define ADXL372_XYZ_SERIES_W1           (FIFO_SERIES_START_MSK << 16)
+
+/*
+ * Two fifo entries in one load, the memcpy compiles to a single LDR
+ */
+static inline uint32_t adxl372_load_word(uint8_t const *p_raw)
+{
+    uint32_t word;
+
+    memcpy(&word, p_raw, sizeof(word));
+    return word;
+}
+
+/*
+ * Unpacks a burst of whole xyz samples, two samples from three word loads:
+ * REV16 brings both big endian entries of a word to native order at once and
+ * one arithmetic shift each takes them to counts. The series start bits are
+ * checked on the way, all of a burst at once
+ * @param entries - a multiple of 3
+ * @return false if a series start is out of place, the samples are then of no use
+ */
+RAMFUNC static bool adxl372_fifo_unpack_xyz(uint8_t const *p_raw, uint16_t entries, adxl372_accel_data_t *samples)
+{
+    uint32_t misplaced = 0;
+    uint16_t pairs = entries/6;
+    uint32_t w0, w1, w2;
+
+    for (uint16_t i = 0; i < pairs; i++)
+    {
+        w0 = __REV16(adxl372_load_word(&p_raw[0]));
+        w1 = __REV16(adxl372_load_word(&p_raw[4]));
+        w2 = __REV16(adxl372_load_word(&p_raw[8]));
+        p_raw += 12;
+        misplaced |= ((w0 ^ ADXL372_XYZ_SERIES_W0) | (w1 ^ ADXL372_XYZ_SERIES_W1) | w2) & ADXL372_XYZ_SERIES_MSK;
+
+        samples[0].x = ADXL372_WORD_LO_COUNTS(w0);
+        samples[0].y = ADXL372_WORD_HI_COUNTS(w0);
+        samples[0].z = ADXL372_WORD_LO_COUNTS(w1);
+        samples[1].x = ADXL372_WORD_HI_COUNTS(w1);
+        samples[1].y = ADXL372_WORD_LO_COUNTS(w2);
+        samples[1].z = ADXL372_WORD_HI_COUNTS(w2);
+        samples += 2;
+    }
+    if (entries - pairs*6 == 3)
+    {
+        //an odd sample, its z alone in the low half
+        w0 = __REV16(adxl372_load_word(&p_raw[0]));
+        w1 = __REV16((uint32_t) (p_raw[5] << 8 | p_raw[4]));
+        misplaced |= ((w0 ^ ADXL372_XYZ_SERIES_W0) | w1) & ADXL372_XYZ_SERIES_MSK;
+
+        samples[0].x = ADXL372_WORD_LO_COUNTS(w0);
+        samples[0].y = ADXL372_WORD_HI_COUNTS(w0);
+        samples[0].z = ADXL372_WORD_LO_COUNTS(w1);
+    }
+
+    return misplaced == 0;
+}
+
+/*
+ * Unpacks fifo entries to counts. A burst of whole xyz samples with every
+ * series start in place, the usual drain, takes the adxl372_fifo_unpack_xyz
+ * kernel, anything else (other formats, entries lost to an overrun) the
+ * byte at a time adxl372_fifo_unpack_scalar with its resync
+ * @param p_raw - entries*2 bytes as read from FIFO_DATA
+ * @param samples - axes not in the fifo format are set to 0
+ * @return number of samples
+ */
+RAMFUNC uint16_t adxl372_fifo_unpack(adxl372_fifo_format_t format, uint8_t const *p_raw, uint16_t entries,
+                             adxl372_accel_data_t *samples)
+{
+    if ((format == XYZ_FIFO || format == XYZ_PEAK_FIFO) && entries % 3 == 0
+        && adxl372_fifo_unpack_xyz(p_raw, entries, samples))
     {
+        return entries/3;
+    }
+
+    return adxl372_fifo_unpack_scalar(format, p_raw, entries, samples);
+}
+
+PROFILER_PROBE_DEF(m_fifo_unpack_probe, "adxl372_fifo_unpack");
+
+/*
+ * Unpacks the entries burst read into m_fifo_buf, see adxl372_get_fifo_data
+ * @return number of samples
+ */
+RAMFUNC static uint16_t adxl372_fifo_parse(struct adxl372_device *dev, uint16_t entries, adxl372_accel_data_t *samples)
+{
+    uint16_t num_samples;
+
+    PROFILER_START(m_fifo_unpack_probe);
+    num_samples = adxl372_fifo_unpack(dev->fifo_config.format, m_fifo_buf, entries, samples);
+    PROFILER_STOP(m_fifo_unpack_probe);
+
+    return num_samples;
+}
+
+/*
+ * Drains every complete sample in the fifo with one cs assertion.
+ * Each sample starts with the series start bit set on its first axis, entries
+ * before the first series start belong to a sample that was partially read
+ * earlier and are dropped so the axes never get misaligned.
+ * The count comes from FIFO_ENTRIES, not FIFO_FULL or the watermark, so the fifo
+ * can be drained at any time: a few samples for latency or a watermark's worth
+ * for fewer transactions.
+ * A fifo overrun is counted in dev->fifo_overruns and the remaining data is still read
+ * @param samples - output buffer, axes not in the fifo format are set to 0
+ * @param max_samples - size of the output buffer in samples
+ * @return number of samples read, -2 if bypassed, -3 if no complete sample is ready
+ *         otherwise -1 on a spi error
+ */
+int16_t adxl372_get_fifo_data(struct adxl372_device *dev, adxl372_accel_data_t *samples, uint16_t max_samples)
+{
+    uint8_t status_buf[4]; //STATUS_1, STATUS_2, FIFO_ENTRIES_2, FIFO_ENTRIES_1
+    uint8_t read_addr;
+    uint16_t entries;
+    int8_t ret;
+
+    if(dev->fifo_config.mode == BYPASSED)
         return -2; //ERROR in bypass mode
+
+    ret = adxl372_multibyte_read_reg(ADI_ADXL372_STATUS_1, status_buf, sizeof(status_buf));
+    if (ret < 0)
+        return ret;
+
+    entries = adxl372_fifo_entries_to_read(dev, status_buf, max_samples);
+    if (entries < adxl372_fifo_format_axes(dev->fifo_config.format))
+        return -3; //ERROR fifo not ready
+
+    read_addr = (ADI_ADXL372_FIFO_DATA << 1) | ADXL_SPI_RNW;
+    ret = spi_write_then_read(&accel_spi, SPI_ACCEL_CS_PIN, &read_addr, 1, m_fifo_buf, entries*2, true);
+    if (ret < 0)
+        return ret;
+
+    return adxl372_fifo_parse(dev, entries, samples);
+}
+
+/*
+ * Second stage of adxl372_queue_fifo_read, the fifo data is in m_fifo_buf
+ */
+RAMFUNC static void adxl372_fifo_data_done(int8_t result, void *p_context)
+{
+    adxl372_fifo_read_t *p_read = (adxl372_fifo_read_t *) p_context;
+
+    if (result < 0)
+    {
+        p_read->callback(-1, p_read->p_context);
+        return;
     }
+    p_read->callback(adxl372_fifo_parse(p_read->dev, p_read->entries, p_read->samples), p_read->p_context);
+}
 
+/*
+ * First stage of adxl372_queue_fifo_read, queues the data burst once the entry count is known
+ */
+RAMFUNC static void adxl372_fifo_status_done(int8_t result, void *p_context)
+{
+    static uint8_t read_addr = (ADI_ADXL372_FIFO_DATA << 1) | ADXL_SPI_RNW; //in ram for EasyDMA
+    adxl372_fifo_read_t *p_read = (adxl372_fifo_read_t *) p_context;
+    spi_xfer_t *p_xfer = &p_read->xfer;
+
+    if (result < 0)
+    {
+        p_read->callback(-1, p_read->p_context);
+        return;
+    }
+
+    p_read->entries = adxl372_fifo_entries_to_read(p_read->dev, p_read->status_buf, p_read->max_samples);
+    if (p_read->entries < adxl372_fifo_format_axes(p_read->dev->fifo_config.format))
+    {
+        p_read->callback(-3, p_read->p_context); //fifo not ready
+        return;
+    }
+
+    p_xfer->p_tx_buf = &read_addr;
+    p_xfer->p_rx_buf = m_fifo_buf;
+    p_xfer->rx_length = p_read->entries*2;
+    p_xfer->callback = adxl372_fifo_data_done;
+    if (spi_queue_xfer(&accel_spi, p_xfer) < 0)
+    {
+        p_read->callback(-1, p_read->p_context);
+    }
+}
+
+/*
+ * Queues the same drain as adxl372_get_fifo_data without blocking, so the fifo can be
+ * read from an interrupt (e.g. the adxl372_int_set_callback callback). The status and
+ * the data are read as two queued transfers and the samples are unpacked in the spi
+ * interrupt before the callback. Only one read may be in flight, the raw burst
+ * shares m_fifo_buf with adxl372_get_fifo_data
+ * @param p_read - descriptor, must stay valid until the callback
+ * @param samples - output buffer of max_samples, must stay valid until the callback
+ * @param callback - called from the spi interrupt with the adxl372_get_fifo_data result
+ * @return 0 if queued, -2 if bypassed otherwise -1
+ */
+RAMFUNC int8_t adxl372_queue_fifo_read(adxl372_fifo_read_t *p_read, struct adxl372_device *dev, adxl372_accel_data_t *samples,
+                               uint16_t max_samples, adxl372_fifo_callback_t callback, void *p_context)
+{
+    static uint8_t read_addr = (ADI_ADXL372_STATUS_1 << 1) | ADXL_SPI_RNW; //in ram for EasyDMA
+    spi_xfer_t *p_xfer = &p_read->xfer;
+
+    if(dev->fifo_config.mode == BYPASSED)
+        return -2; //ERROR in bypass mode
+
+    p_read->dev = dev;
+    p_read->samples = samples;
+    p_read->max_samples = max_samples;
+    p_read->callback = callback;
+    p_read->p_context = p_context;
+
+    p_xfer->cs_pin = SPI_ACCEL_CS_PIN;
+    p_xfer->p_tx_buf = &read_addr;
+    p_xfer->tx_length = 1;
+    p_xfer->rx_skip = 1;
+    p_xfer->p_rx_buf = p_read->status_buf;
+    p_xfer->rx_length = sizeof(p_read->status_buf);
+    p_xfer->callback = adxl372_fifo_status_done;
+    p_xfer->p_context = p_read;
+    p_xfer->burst = true;
+
+    return spi_queue_xfer(&accel_spi, p_xfer);
+}
+
+/*
+ *  Gets the number of valid entries in the FIFO
+ *  @return number of entries (one entry per axis)
+ */
+uint16_t adxl372_get_fifo_entries(void)
+{
+    uint8_t buf[2] = {0};
+
+    adxl372_multibyte_read_reg(ADI_ADXL372_FIFO_ENTRIES_2, buf, 2);
+
+    return ((buf[0] & 0x03) << 8) | buf[1];
+}
+
+static uint32_t adxl372_int_pin_number(adxl372_int_pin_t int_pin)
+{
+    return (int_pin == ADXL_INT1) ? ADXL_INT1_PIN : ADXL_INT2_PIN;
+}
+
+static void adxl372_int_handler(uint32_t pin)
+{
+    adxl372_int_pin_t int_pin;
+
+    // the blocking reads can't run here since the spi transfer completes in an
+    // interrupt of the same priority, the fifo is drained from thread context
+    // or by an adxl372_queue_fifo_read from the callback
+    if (pin == ADXL_INT1_PIN)
+        int_pin = ADXL_INT1;
+    else if (pin == ADXL_INT2_PIN)
+        int_pin = ADXL_INT2;
+    else
+        return;
+
+    m_int_pending[int_pin] = true;
+    if (m_int_callback != NULL)
+        m_int_callback(int_pin);
+}
+
+/*
+ * Sets a function the INT1/INT2 GPIOTE events call after marking the interrupt pending,
+ * from the GPIOTE interrupt. NULL removes it
+ */
+void adxl372_int_set_callback(adxl372_int_callback_t callback)
+{
+    m_int_callback = callback;
+}
 
+/*
+ * Configures ADXL_INT1_PIN or ADXL_INT2_PIN as a sensor_int line on the low
+ * power GPIOTE PORT event, so the interrupt also wakes the cpu from System ON sleep.
+ * Map the events with adxl372_set_interrupts() and wait on
+ * adxl372_int_pending() with __WFE()
+ */
+void adxl372_int_init(adxl372_int_pin_t int_pin)
+{
+    m_int_pending[int_pin] = false;
+    APP_ERROR_CHECK_BOOL(sensor_int_add(adxl372_int_pin_number(int_pin), true, NRF_GPIO_PIN_PULLDOWN,
+                                        adxl372_int_handler) == 0);
+}
+
+/*
+ * Moves the line to a GPIOTE IN channel while the timing of its edge matters,
+ * its event can go through PPI to a task, e.g. a TIMER capture that latches the
+ * instant of the interrupt with no cpu involved, or back to the PORT event.
+ * Thread context, check adxl372_int_pending() afterwards
+ * @return the address of the IN event, 0 on the PORT event or with no channel free
+ */
+uint32_t adxl372_int_precise(adxl372_int_pin_t int_pin, bool precise)
+{
+    return sensor_int_precise(adxl372_int_pin_number(int_pin), precise);
+}
+
+/*
+ * The pin level is checked as well since the sense event only fires on
+ * a rising edge and the pin stays high while the event is still active
+ * (e.g. the fifo watermark is still reached)
+ */
+bool adxl372_int_pending(adxl372_int_pin_t int_pin)
+{
+    return m_int_pending[int_pin] || nrf_gpio_pin_read(adxl372_int_pin_number(int_pin));
+}
+
+/*
+ * Call before servicing the event (e.g. before draining the fifo)
+ */
+void adxl372_int_clear(adxl372_int_pin_t int_pin)
+{
+    m_int_pending[int_pin] = false;
+}
+
+/*
+ * Puts the adxl372 to rest in INSTANT_ON or WAKE_UP mode until activity.
+ * In INSTANT_ON the device switches itself to full bandwidth measurement when
+ * the instant on threshold (adxl372_set_instaon_threshold) is exceeded,
+ * in WAKE_UP it samples at the wake up rate against the activity threshold.
+ * Map INT_MAP_ACT_MSK/INT_MAP_AWAKE_MSK to an int pin to wake the cpu.
+ * The fifo, odr and bandwidth written before are kept through the rest, so
+ * after a WAKE_UP the shadowed op mode write to FULL_BW_MEASUREMENT is the
+ * only one and an INSTANT_ON needs none; the samples come
+ * adxl372_filter_settle_ms() after the switch
+ */
+void adxl372_arm_activity_wakeup(adxl372_op_mode_t mode)
+{
+    adxl372_set_op_mode(STAND_BY);
+    // clears the activity status so the next event asserts the pin again
+    adxl372_get_activity_status_reg();
+    adxl372_set_op_mode(mode);
+}
+
+/*
+ * Starts the device's own self test or ends it, measurement mode running.
+ * It takes ADXL372_SELF_TEST_MS, the samples meanwhile are deflected, see
+ * adxl372_self_test_result(). SELF_TEST is not shadowed, the status bits
+ * are the device's
+ * @return 0 if success otherwise -1
+ */
+int8_t adxl372_self_test_set(bool enable)
+{
+    return adxl372_write_reg(ADI_ADXL372_SELF_TEST, enable ? SELF_TEST_ST_MSK : 0);
+}
+
+/*
+ * Reads the outcome of the self test started by adxl372_self_test_set()
+ * @param p_done - the test ran to the end, p_pass is only valid then
+ * @return 0 if success otherwise -1
+ */
+int8_t adxl372_self_test_result(bool *p_done, bool *p_pass)
+{
+    uint8_t reg_data;
+
+    if (adxl372_read_reg(ADI_ADXL372_SELF_TEST, &reg_data) < 0)
+        return -1;
+
+    *p_done = (reg_data & SELF_TEST_ST_DONE_MSK) != 0;
+    *p_pass = (reg_data & SELF_TEST_USER_ST_MSK) != 0;
     return 0;
 }
 
-void adxl372_set_interrupts(void)
+/*
+ * Self test, reads the ids and checks a write to POWER_CTL, the device is
+ * left reset in standby
+ * @return 0 if success otherwise -1 if the spi failed or -2 if a value is wrong
+ */
+int8_t adxl372_test(void)
 {
-    //TODO once we have INT1 and INT2 pins setup
+    int8_t ret = 0;
+    uint8_t device_id = 0;
+    uint8_t mst_devid = 0;
+    uint8_t devid = 0;
+
+    NRF_LOG_INFO("-----------------------------");
+    NRF_LOG_INFO("adxl372 test measurement mode");
+    nrf_delay_ms(100);
+
+    adxl372_reset();
+
+    //--------------------READ TEST---------------------//
+    ret |= adxl372_read_reg(ADI_ADXL372_ADI_DEVID, &device_id);
+    ret |= adxl372_read_reg( ADI_ADXL372_MST_DEVID, &mst_devid);
+    ret |= adxl372_read_reg(ADI_ADXL372_DEVID, &devid);
+    if (ret < 0)
+    {
+        NRF_LOG_ERROR("SPI WRITE READ FAIL");
+        return -1;
+    }
+
+    NRF_LOG_INFO("adi device id = 0x%x (0xAD)", device_id);
+    NRF_LOG_INFO("mst device id2 = 0x%x (0x1D)", mst_devid);
+    NRF_LOG_INFO("mems id = 0x%x (0xFA)(372 octal)", devid);
+    if(device_id != ADI_ADXL372_ADI_DEVID_VAL || mst_devid != ADI_ADXL372_MST_DEVID_VAL || devid != ADI_ADXL372_DEVID_VAL)
+    {
+        NRF_LOG_ERROR("ADXL READ TEST FAIL");
+        return -2;
+    }
+    NRF_LOG_INFO("ADXL READ TEST PASS");
+    // ==========================================
+
+    // Write TEST 
+    uint8_t p_reg;
+    uint8_t lpf_val;
+    uint8_t hpf_val;
+    uint8_t op_val;
+    adxl372_set_op_mode(STAND_BY);
+    adxl372_set_lpf_disable(true);
+    adxl372_set_hpf_disable(true);
+    if (adxl372_read_reg(ADI_ADXL372_POWER_CTL, &p_reg) < 0)
+    {
+        NRF_LOG_ERROR("SPI WRITE READ FAIL");
+        return -1;
+    }
+    lpf_val = (p_reg >> PWRCTRL_LPF_DISABLE_POS) & 0x1;
+    hpf_val = (p_reg >> PWRCTRL_HPF_DISABLE_POS) & 0x1;
+    op_val = (p_reg >> PWRCTRL_OPMODE_POS) & 0x3;
+    NRF_LOG_INFO("lpf val = %d (expected: 1)", lpf_val);
+    NRF_LOG_INFO("hpf val = %d (expected: 1)", hpf_val);
+    NRF_LOG_INFO("op val = %d (expected: 0)", op_val);
+    if(lpf_val != 1 || hpf_val != 1 || op_val !=0)
+    {
+        NRF_LOG_ERROR("ADXL WRITE TEST FAIL");
+        return -2;
+    }
+    NRF_LOG_INFO("ADXL WRITE TEST PASS");
+    return 0;
 }
+
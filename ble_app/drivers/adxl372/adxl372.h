@@ -37,17 +37,29 @@
  *
 *******************************************************************************/
 
-#ifndef ADXL372_H_
-#define ADXL372_H_
+#ifndef ADXL372_H
+#define ADXL372_H
 
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h> 
+#include "spi_driver.h"
 #include <nrf_drv_spi.h>
+#include "nrf_drv_gpiote.h"
+#include "nrf_log.h"
 
 #define L_ENDIAN
 
+//ACCEL_SPI_INSTANCE, the SPI_ACCEL_ pins and profile and ADXL_INT1_PIN/ADXL_INT2_PIN come from the board header
+#ifndef ACCEL_SPI_INSTANCE
+#error "ACCEL_SPI_INSTANCE is not defined by the board header"
+#endif
+
+extern const nrf_drv_spi_t accel_spi;
+
+extern nrf_drv_spi_config_t const accel_spi_config;
+
 /* Register address */
 #define ADI_ADXL372_ADI_DEVID           0x00u   /* Analog Devices, Inc., accelerometer ID */
 #define ADI_ADXL372_MST_DEVID          	0x01u   /* Analog Devices MEMS device ID */
@@ -110,6 +122,9 @@
 #define ADI_ADXL372_DEVID_VAL           0xFAu   /* Device ID */
 #define ADI_ADXL372_REVID_VAL           0x02u   /* product revision ID*/
 #define ADI_ADXL372_RESET_CODE          0x52u	/* Writing code 0x52 resets the device */
+#define ADXL372_RESET_MS                1       /* the device ignores the bus until then */
+#define ADXL372_FILTER_SETTLE_16_MS     16      /* FILTER_SETTLE_16, from full bandwidth measurement on to settled samples */
+#define ADXL372_FILTER_SETTLE_370_MS    370     /* FILTER_SETTLE_370 */
 
 /* ADXL372_MEASURE */
 #define MEASURE_AUTOSLEEP_MASK		0xBF
@@ -126,6 +141,10 @@
 #define TIMING_ODR_POS			    5
 #define TIMING_WUR_MASK 		    0xE3
 #define TIMING_WUR_POS 			    2
+#define TIMING_EXT_CLK_MASK         0xFD    /* INT1 is the clock input of the conversions */
+#define TIMING_EXT_CLK_POS          1
+#define TIMING_EXT_SYNC_MASK        0xFE    /* INT2 is the sync input, a sample per rising edge */
+#define TIMING_EXT_SYNC_POS         0
 
 /* ADXL372_POWER_CTL */
 #define PWRCTRL_OPMODE_MASK		    0xFC
@@ -140,11 +159,61 @@
 
 #define INSTAON_THRESH_POS		    5
 
+/* ADXL372_SELF_TEST, the device moves each proof mass electrostatically and
+ * checks the response against its own limits, in full bandwidth measurement
+ * mode. The output is deflected until ST is cleared */
+#define SELF_TEST_ST_MSK            0x01
+#define SELF_TEST_ST_DONE_MSK       0x02
+#define SELF_TEST_USER_ST_MSK       0x04 /* passed, valid once ST_DONE is set */
+#define ADXL372_SELF_TEST_MS        300
+
 /* ADXL372_FIFO_CTL */
 #define FIFO_CTL_SAMP8_POS		    0
 #define FIFO_CTL_MODE_POS		    1
 #define FIFO_CTL_FORMAT_POS		    3
 
+/* Register values for an adxl372_config_t, constant expressions so an image can be
+ * a static const worked out at compile time. The fields are the enums below */
+#define ADXL372_FIFO_SAMPLES_RESET                      0x80
+#define ADXL372_FIFO_SAMPLES_VAL(entries)               ((uint8_t)(((entries) - 1) & 0xFF))
+#define ADXL372_FIFO_CTL_VAL(entries, mode, format)     ((uint8_t)(((mode) << FIFO_CTL_MODE_POS) | \
+                                                            ((format) << FIFO_CTL_FORMAT_POS) | \
+                                                            ((((entries) - 1) > 0xFF) << FIFO_CTL_SAMP8_POS)))
+#define ADXL372_FIELD(val, mask, pos)                   (((val) << (pos)) & (uint8_t) ~(mask)) /* a value too wide for its field stays out of the others */
+#define ADXL372_TIMING_VAL(odr, wur)                    ((uint8_t)(ADXL372_FIELD(odr, TIMING_ODR_MASK, TIMING_ODR_POS) | \
+                                                            ADXL372_FIELD(wur, TIMING_WUR_MASK, TIMING_WUR_POS)))
+#define ADXL372_MEASURE_VAL(bw, low_noise, act_proc, autosleep) \
+                                                        ((uint8_t)(ADXL372_FIELD(bw, MEASURE_BANDWIDTH_MASK, MEASURE_BANDWIDTH_POS) | \
+                                                            ADXL372_FIELD(low_noise, MEASURE_LOW_NOISE_MASK, MEASURE_LOW_NOISE_POS) | \
+                                                            ADXL372_FIELD(act_proc, MEASURE_ACTPROC_MASK, MEASURE_ACTPROC_POS) | \
+                                                            ADXL372_FIELD(autosleep, MEASURE_AUTOSLEEP_MASK, MEASURE_AUTOSLEEP_POS)))
+#define ADXL372_POWER_CTL_VAL(mode, hpf_disable, lpf_disable, filter_settle, instaon_thresh) \
+                                                        ((uint8_t)(ADXL372_FIELD(mode, PWRCTRL_OPMODE_MASK, PWRCTRL_OPMODE_POS) | \
+                                                            ADXL372_FIELD(hpf_disable, PWRCTRL_HPF_DISABLE_MASK, PWRCTRL_HPF_DISABLE_POS) | \
+                                                            ADXL372_FIELD(lpf_disable, PWRCTRL_LPF_DISABLE_MASK, PWRCTRL_LPF_DISABLE_POS) | \
+                                                            ADXL372_FIELD(filter_settle, PWRCTRL_FILTER_SETTLE_MASK, PWRCTRL_FILTER_SETTLE_POS) | \
+                                                            ADXL372_FIELD(instaon_thresh, PWRCTRL_INSTON_THRESH_MASK, INSTAON_THRESH_POS)))
+/* X/Y/Z_THRESH_*_H and _L of an 11 bit threshold, the L register has its low 3 bits on top
+ * of the enable and, for X only, the referenced bit */
+#define THRESH_L_POS                5
+#define THRESH_REF_POS              1
+#define THRESH_EN_POS               0
+#define ADXL372_THRESH_H_VAL(thresh)                    ((uint8_t)((thresh) >> 3))
+#define ADXL372_THRESH_L_VAL(thresh, referenced, enable) ((uint8_t)(((thresh) << THRESH_L_POS) | \
+                                                            (((referenced) & 0x1) << THRESH_REF_POS) | \
+                                                            (((enable) & 0x1) << THRESH_EN_POS)))
+#define ADXL372_WRITE_BURST_MAX     8   /* registers of adxl372_multibyte_write_reg */
+
+
+/* ADXL372_INT1_MAP / ADXL372_INT2_MAP */
+#define INT_MAP_DATA_RDY_MSK        0x01
+#define INT_MAP_FIFO_RDY_MSK        0x02
+#define INT_MAP_FIFO_FULL_MSK       0x04
+#define INT_MAP_FIFO_OVR_MSK        0x08
+#define INT_MAP_INACT_MSK           0x10
+#define INT_MAP_ACT_MSK             0x20
+#define INT_MAP_AWAKE_MSK           0x40
+#define INT_MAP_LOW_MSK             0x80
 
 #define DATA_RDY	  1
 #define FIFO_RDY	  2
@@ -154,9 +223,17 @@
 #define FIFO_FULL_POS 2
 #define FIFO_RDY_POS  1
 
+/* STATUS_2, the activity bits clear when it is read */
+#define STATUS2_INACT_MSK   0x10
+#define STATUS2_ACT_MSK     0x20
+#define STATUS2_ACT2_MSK    0x40 /* the activity2 threshold was crossed, it has no interrupt of its own */
+
 
 #define ADXL_SPI_RNW    1 /* Sets the Read bit R/W */
 
+#define ADXL_ACCEL_DATA_LENGTH  6 /* X_DATA_H..Z_DATA_L */
+#define ADXL372_ID_LENGTH       3 /* ADI_DEVID, MST_DEVID, DEVID */
+
 /*Acceleremoter configuration*/
 #define ACT_VALUE          30     /* Activity threshold value */
 
@@ -164,10 +241,21 @@
 
 #define ACT_TIMER          1    /* Activity timer value in multiples of 3.3ms */
 
-#define INACT_TIMER        1     /* Inactivity timer value in multiples of 26ms */
+#define INACT_TIMER        1     /* Inactivity timer value in multiples of 26ms, 16 bits */
 
-#define ADXL_INT1_PIN     7     //not used currently
-#define ADXL_INT2_PIN     5     //not used currently
+#define ADXL_FIFO_SIZE          512  /* FIFO entries, one entry per axis */
+#define ADXL_FIFO_MAX_SAMPLES   (ADXL_FIFO_SIZE/3) /* xyz samples */
+#define FIFO_SERIES_START_MSK   0x01 /* bit 0 of a fifo entry marks the first axis of a sample */
+
+/* FIFO watermark used by the interrupt driven mode, in FIFO entries.
+ * Must be a multiple of 3 for XYZ_FIFO. 300 entries = 100 samples = 15.6ms at 6400Hz
+ * which leaves ~11ms before the fifo overruns */
+#define ADXL_FIFO_WATERMARK 300
+
+typedef enum {
+    ADXL_INT1 = 0,
+    ADXL_INT2
+} adxl372_int_pin_t;
 
 typedef enum {
     STAND_BY = 0,
@@ -250,34 +338,101 @@ typedef enum {
     LOW_NOISE
 }adxl372_low_noise_t;
 
+/* raw 12 bit counts, converted to mg with ADXL372_COUNTS_TO_MG when the data is offloaded */
 typedef struct {
     int16_t x; 
     int16_t y;
     int16_t z;
 } adxl372_accel_data_t; 
 
+#define ADXL372_MG_PER_LSB              100 /* +-200g full scale */
+#define ADXL372_COUNTS_TO_MG(counts)    ((int32_t)(counts) * ADXL372_MG_PER_LSB)
+#define ADXL372_MG_TO_COUNTS(mg)        ((mg) / ADXL372_MG_PER_LSB)
+
 
 struct adxl372_device {
     fifo_config_t fifo_config;
+    uint32_t fifo_overruns; /* number of fifo reads that saw FIFO_OVR */
+    uint8_t activity_status; /* STATUS_2 bits seen by the fifo reads, kept until the app clears them */
 };
 
+/* Image of the configuration registers, adxl372_apply_config writes it in two
+ * bursts, OFFSET_X..OFFSET_Z and FIFO_SAMPLES..POWER_CTL. The activity
+ * thresholds and timers are not part of it and keep their values */
+typedef struct {
+    uint8_t offset[3];      /* OFFSET_X, OFFSET_Y, OFFSET_Z, figure 36 user offset trim profile */
+    uint8_t fifo_samples;   /* FIFO_SAMPLES to POWER_CTL, contiguous registers in this order */
+    uint8_t fifo_ctl;
+    uint8_t int1_map;
+    uint8_t int2_map;
+    uint8_t timing;
+    uint8_t measure;
+    uint8_t power_ctl;      /* written last, the device leaves standby with everything else set */
+} adxl372_config_t;
+
+/* Trims of the default images until adxl372_set_offset_trim, +10 LSB on y and
+ * +35 LSB on z for Vs=3.3V. Each is the low 4 bits of its OFFSET register */
+#define ADXL372_DEFAULT_OFFSET_TRIM     {0, 2, 5}
+#define ADXL372_OFFSET_TRIM_MAX         0x0F
+
+#define ADXL372_CTL_REG_COUNT   (ADI_ADXL372_POWER_CTL - ADI_ADXL372_FIFO_SAMPLES + 1)
+
+/* called from the GPIOTE interrupt, see adxl372_int_set_callback */
+typedef void (*adxl372_int_callback_t)(adxl372_int_pin_t int_pin);
+
+/* called from the spi interrupt with the number of samples read or the error, see adxl372_queue_fifo_read */
+typedef void (*adxl372_fifo_callback_t)(int16_t result, void *p_context);
+
+/* one adxl372_queue_fifo_read in flight */
+typedef struct {
+    spi_xfer_t xfer;        /* status read, then the data burst */
+    uint8_t status_buf[4];  /* STATUS_1, STATUS_2, FIFO_ENTRIES_2, FIFO_ENTRIES_1 */
+    struct adxl372_device *dev;
+    adxl372_accel_data_t *samples;
+    uint16_t max_samples;
+    uint16_t entries;       /* being burst read */
+    adxl372_fifo_callback_t callback;
+    void *p_context;
+} adxl372_fifo_read_t;
 
-// Register read and write functions
 int8_t adxl372_read_reg( uint8_t reg_addr, uint8_t *reg_data);
 
 int8_t adxl372_write_reg(uint8_t reg_addr, uint8_t reg_data);
 
 int8_t adxl372_multibyte_read_reg( uint8_t reg_addr, uint8_t* reg_data, uint8_t num_bytes);
 
+int8_t adxl372_multibyte_write_reg(uint8_t reg_addr, uint8_t const *reg_data, uint8_t num_bytes);
+
 int8_t adxl372_write_mask(uint8_t reg_addr, uint32_t mask, uint32_t pos, uint8_t val);
-//==================================================================================
+
+int8_t adxl372_apply_config(struct adxl372_device *dev, adxl372_config_t const *config);
+
+int8_t adxl372_config_set_fifo(adxl372_config_t *config, uint16_t fifo_samples, adxl372_fifo_mode_t fifo_mode, adxl372_fifo_format_t fifo_format);
+
+int8_t adxl372_config_fifo_int_default(adxl372_config_t *config, uint16_t watermark);
+
+int8_t adxl372_config_triggered_fifo(adxl372_config_t *config, uint16_t pre_samples);
+
+int8_t adxl372_config_set_rate(adxl372_config_t *config, adxl372_odr_t odr, adxl372_bw_t bw);
+
+int8_t adxl372_config_set_autosleep(adxl372_config_t *config, adxl372_wakeup_rate_t wur);
+
+void adxl372_config_set_ext_sync(adxl372_config_t *config, bool enable);
+
+int8_t adxl372_set_offset_trim(uint8_t const offset[3]);
+
+uint8_t const *adxl372_offset_trim(void);
 
 void adxl372_default_init (void);
 
 void adxl372_default_init_fifo_mode(struct adxl372_device *dev, uint16_t num_samples);
 
+void adxl372_default_init_fifo_int_mode(struct adxl372_device *dev, uint16_t watermark);
+
 void adxl372_reset(void);
 
+void adxl372_reset_start(void);
+
 void adxl372_set_op_mode(adxl372_op_mode_t mode);
 
 void adxl372_set_lpf_disable(bool set);
@@ -288,6 +443,10 @@ void adxl372_set_odr(adxl372_odr_t odr);
 
 void adxl372_set_wakeup_rate(adxl372_wakeup_rate_t wur);
 
+void adxl372_set_ext_clk(bool enable);
+
+void adxl372_set_ext_sync(bool enable);
+
 void adxl372_set_bandwidth(adxl372_bw_t bw);
 
 void adxl372_set_autosleep(bool enable);
@@ -304,20 +463,36 @@ void adxl372_set_inactivity_threshold(uint16_t thresh, bool referenced, bool ena
 
 void adxl372_set_activity_time(uint8_t time);
 
-void adxl372_set_inactivity_time(uint8_t time);
+void adxl372_set_inactivity_time(uint16_t time);
 
 void adxl372_set_filter_settle(adxl372_filter_settle_t mode);
 
+void adxl372_set_interrupts(uint8_t int1_map, uint8_t int2_map);
+
 uint8_t adxl372_get_dev_ID(void);
 
+int8_t adxl372_check_id(void);
+
+int8_t adxl372_queue_id_read(spi_xfer_t *p_xfer, uint8_t *p_rx_buf, spi_xfer_callback_t callback, void *p_context);
+
+int8_t adxl372_id_check(uint8_t const *p_ids);
+
 uint8_t adxl372_get_status_reg(void);
 
 uint8_t adxl372_get_activity_status_reg(void);
 
 void adxl372_get_highest_peak_accel_data(adxl372_accel_data_t* max_peak);
 
+int8_t adxl372_read_max_peak(adxl372_accel_data_t *p_max_peak);
+
+uint16_t adxl372_filter_settle_ms(void);
+
 void adxl372_get_accel_data(adxl372_accel_data_t* accel_data);
 
+int8_t adxl372_queue_accel_read(spi_xfer_t *p_xfer, uint8_t *p_rx_buf, spi_xfer_callback_t callback, void *p_context);
+
+void adxl372_parse_accel_data(uint8_t const *p_raw, adxl372_accel_data_t *accel_data);
+
 void adxl372_set_x_offset(uint8_t offset);
 
 void adxl372_set_y_offset(uint8_t offset);
@@ -326,7 +501,36 @@ void adxl372_set_z_offset(uint8_t offset);
 
 int32_t adxl372_configure_fifo (struct adxl372_device *dev, uint16_t fifo_samples, adxl372_fifo_mode_t fifo_mode, adxl372_fifo_format_t fifo_format);
 
-int8_t adxl372_get_fifo_data(struct adxl372_device *dev, adxl372_accel_data_t *fifo_data);
+int16_t adxl372_get_fifo_data(struct adxl372_device *dev, adxl372_accel_data_t *fifo_data, uint16_t max_samples);
+
+uint16_t adxl372_fifo_unpack(adxl372_fifo_format_t format, uint8_t const *p_raw, uint16_t entries,
+                             adxl372_accel_data_t *samples);
+
+uint16_t adxl372_fifo_unpack_scalar(adxl372_fifo_format_t format, uint8_t const *p_raw, uint16_t entries,
+                                    adxl372_accel_data_t *samples);
+
+int8_t adxl372_queue_fifo_read(adxl372_fifo_read_t *p_read, struct adxl372_device *dev, adxl372_accel_data_t *samples,
+                               uint16_t max_samples, adxl372_fifo_callback_t callback, void *p_context);
+
+uint16_t adxl372_get_fifo_entries(void);
+
+void adxl372_int_init(adxl372_int_pin_t int_pin);
+
+uint32_t adxl372_int_precise(adxl372_int_pin_t int_pin, bool precise);
+
+void adxl372_int_set_callback(adxl372_int_callback_t callback);
+
+bool adxl372_int_pending(adxl372_int_pin_t int_pin);
+
+void adxl372_int_clear(adxl372_int_pin_t int_pin);
+
+void adxl372_arm_activity_wakeup(adxl372_op_mode_t mode);
+
+int8_t adxl372_self_test_set(bool enable);
+
+int8_t adxl372_self_test_result(bool *p_done, bool *p_pass);
+
+int8_t adxl372_test(void);
 
-#endif /* ADXL372_H_ */
+#endif /* ADXL372_H */
 
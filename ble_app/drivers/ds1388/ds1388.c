@@ -3,21 +3,67 @@
 // Author: Gregor Morrison
 // Description: This driver file contains functions for communication
 // with the real-time clock over I2C.
-// This code on its own requires manual setting of the RTC - for
-// autoset functionality, reference "\ble_app\test\ds1388_autoset_test"
+// The time is set at runtime with ds1388_set_time, e.g. from a host
+// provided epoch, and is kept in 24-hour format
 //
 // Referenced code: https://github.com/DelfiSpace/DS1388/blob/master/DS1388.cpp
 //-------------------------------------------
 #include "ds1388.h"
+#include "profiler.h"
+#include "app_timer.h"
+#include "nrf_pt.h"
 
-/* RTC variables. */
-static uint8_t byte;
-// This array holds numerical values corresponding to the 
-// date or time variables as indicated below. Manually change
-// the values in the array to modify the date/time as desired.
-// Note: see the file "ds1388_auto.c" for autosetting the RTC
-static uint8_t time_format =  HOUR_MODE_24; //select either 12-HOUR FORMAT or 24-HOUR FORMAT, if 12-HOUR FORMAT, use together with AM, PM eg: HOUR_MODE_12 | PM
-static uint8_t init_time[8] = {20, 4, 26, 6, 21, 53, 25, 0};
+#define SECONDS_PER_DAY     86400
+#define SETTLE_MS           500
+
+/* Background time read, see ds1388_schedule_get_time. */
+static uint8_t m_time_reg = HUNDRED_SEC_REG;
+static uint8_t m_time_regs[TIME_REG_COUNT];
+static ds1388_data_t* m_p_time_date;
+static twi_xfer_callback_t m_time_callback;
+static void * m_time_context;
+static volatile bool m_time_pending = false;
+
+static nrf_twi_mngr_transfer_t const m_time_transfers[] = {
+    NRF_TWI_MNGR_WRITE(DS1388_ADDRESS, &m_time_reg, sizeof(m_time_reg), NRF_TWI_MNGR_NO_STOP),
+    NRF_TWI_MNGR_READ(DS1388_ADDRESS, m_time_regs, sizeof(m_time_regs), 0)
+};
+
+static void ds1388_time_read_done(ret_code_t result, void * p_user_data);
+
+static nrf_twi_mngr_transaction_t const m_time_transaction = {
+    .callback            = ds1388_time_read_done,
+    .p_user_data         = NULL,
+    .p_transfers         = m_time_transfers,
+    .number_of_transfers = ARRAY_SIZE(m_time_transfers),
+    .p_required_twi_cfg  = NULL
+};
+
+/* Background configuration, see ds1388_config_thread. The control write and
+ * the oscillator stop flag read go out as one transaction. */
+static uint8_t m_config_regs[2] = {CONTROL_REG, (EN_OSCILLATOR | DIS_WD_COUNTER)};
+static uint8_t m_flag_reg = FLAG_REG;
+static uint8_t m_flag;
+static volatile bool m_config_pending;
+static volatile bool m_config_ok;
+static volatile bool m_settling;
+APP_TIMER_DEF(m_settle_timer);
+
+static nrf_twi_mngr_transfer_t const m_config_transfers[] = {
+    NRF_TWI_MNGR_WRITE(DS1388_ADDRESS, m_config_regs, sizeof(m_config_regs), 0),
+    NRF_TWI_MNGR_WRITE(DS1388_ADDRESS, &m_flag_reg, sizeof(m_flag_reg), NRF_TWI_MNGR_NO_STOP),
+    NRF_TWI_MNGR_READ(DS1388_ADDRESS, &m_flag, sizeof(m_flag), 0)
+};
+
+static void ds1388_config_done(ret_code_t result, void * p_user_data);
+
+static nrf_twi_mngr_transaction_t const m_config_transaction = {
+    .callback            = ds1388_config_done,
+    .p_user_data         = NULL,
+    .p_transfers         = m_config_transfers,
+    .number_of_transfers = ARRAY_SIZE(m_config_transfers),
+    .p_required_twi_cfg  = NULL
+};
 
 /**
  * @brief Function for converting decimal number to hexadecimal
@@ -37,10 +83,13 @@ uint8_t hex2dec(uint8_t val) {
 
 /**
  * @brief Function for configuring the ds1388. Writes the appropriate control
- * variables into the control register and then updates the internal RTC
- * registers with the date and time from the init_time[8] array
+ * variables into the control register and leaves the time running, it is
+ * only written by ds1388_set_time. Warns if the oscillator stopped since
+ * the time was last set, e.g. the backup supply ran out
+ * @param settle - waits 500 ms for the RTC after RST is set, only needed after
+ * power-on, the RTC kept running through a warm boot
  */
-void ds1388_config(void)
+void ds1388_config(bool settle)
 {	
     // Prepares target register (CONTROL_REG) and data to be written (EN_OSCILLATOR | DIS_WD_COUNTER)
     // In this case, the RTC oscillator is enabled and the watch dog counter is disabled
@@ -49,55 +98,220 @@ void ds1388_config(void)
     //Sets RST HIGH to enable the RTC
     nrf_gpio_cfg_output(RTC_RST_PIN);
     nrf_gpio_pin_set(RTC_RST_PIN);
-    nrf_delay_ms(500);
+    if (settle)
+        nrf_delay_ms(500);
 
-    m_xfer_done = false;
-    nrf_drv_twi_tx(&twi, DS1388_ADDRESS, reg0, sizeof(reg0), false);// initiates transfer using I2C descriptor above
-    while (m_xfer_done == false);// waits for the transfer to complete
-  
-    // Prepares a multibyte write starting at the target register (HUNDRED_SEC_REG) and
-    // writes the time and date data in successive cycles. The RTC's internal address pointer
-    // automatically increments the write address (see datasheet)
-    uint8_t reg1[9] = {HUNDRED_SEC_REG,
-                        dec2hex(init_time[7]),
-                        dec2hex(init_time[6]),
-                        dec2hex(init_time[5]),
-                        (dec2hex(init_time[4]) | time_format),
-                        dec2hex(init_time[3]),
-                        dec2hex(init_time[2]),
-                        dec2hex(init_time[1]),
-                        dec2hex(init_time[0])
+    nrf_twi_mngr_transfer_t const config_transfers[] = {
+        NRF_TWI_MNGR_WRITE(DS1388_ADDRESS, reg0, sizeof(reg0), 0)
     };
 
-    nrf_drv_twi_tx(&twi, DS1388_ADDRESS, reg1, sizeof(reg1), false);
-    while (m_xfer_done == false);
+    twi_perform(config_transfers, ARRAY_SIZE(config_transfers));
 
+    if (ds1388_readRegister(FLAG_REG) & OSF_FLAG)
+        NRF_LOG_WARNING("RTC time lost, set it before capturing");
     NRF_LOG_INFO("RTC initialized");
 }
 
+static void ds1388_settle_timeout(void * p_context)
+{
+    m_settling = false;
+}
+
+static void ds1388_config_done(ret_code_t result, void * p_user_data)
+{
+    m_config_ok = (result == NRF_SUCCESS);
+    m_config_pending = false;
+}
+
 /**
- * @brief Performs a one-byte RTC internal register read.
+ * @brief Same as ds1388_config but returns at each wait instead of blocking,
+ * resume it until it ends (PT_SCHEDULE) after PT_INIT. The RST settle runs on
+ * an app timer and the control write on the shared bus in the background, so
+ * the caller keeps servicing the sampling in between. Thread context, after
+ * app_timer_init and twi_init
+ * @param pt - protothread state of the configuration
+ * @param settle - waits 500 ms for the RTC after RST is set, see ds1388_config
+ * @return PT_WAITING until the RTC is configured, PT_ENDED then
  */
-uint8_t ds1388_readRegister(uint8_t reg_addr)
+PT_THREAD(ds1388_config_thread(struct pt *pt, bool settle))
 {
-    do
+    static bool timer_created = false;
+    ret_code_t err_code;
+
+    PT_BEGIN(pt);
+    UNUSED_VARIABLE(PT_YIELD_FLAG); //no PT_YIELD, the waits are on the bus and the timer
+
+    nrf_gpio_cfg_output(RTC_RST_PIN);
+    nrf_gpio_pin_set(RTC_RST_PIN);
+    if (settle)
+    {
+        if (!timer_created)
         {
-            __WFE();
-        }while (m_xfer_done == false);
+            err_code = app_timer_create(&m_settle_timer, APP_TIMER_MODE_SINGLE_SHOT, ds1388_settle_timeout);
+            APP_ERROR_CHECK(err_code);
+            timer_created = true;
+        }
+        m_settling = true;
+        err_code = app_timer_start(m_settle_timer, APP_TIMER_TICKS(SETTLE_MS), NULL);
+        APP_ERROR_CHECK(err_code);
+        PT_WAIT_WHILE(pt, m_settling);
+    }
+
+    //the bus queue may be full of the background reads, the write retries at each resume
+    m_config_pending = true;
+    PT_WAIT_UNTIL(pt, twi_schedule(&m_config_transaction) == 0);
+    PT_WAIT_WHILE(pt, m_config_pending);
+
+    if (!m_config_ok)
+    {
+        NRF_LOG_ERROR("RTC config failed");
+    }
+    else if (m_flag & OSF_FLAG)
+    {
+        NRF_LOG_WARNING("RTC time lost, set it before capturing");
+    }
+    NRF_LOG_INFO("RTC initialized");
 
-    m_xfer_done = false;
+    PT_END(pt);
+}
+
+/**
+ * @brief Writes all of the date and time registers in one burst, 24-hour
+ * format, and clears the oscillator stop flag in the same transaction.
+ * The RTC's internal address pointer increments after every byte and the
+ * hundredths restart from the value written, so the time starts the moment
+ * the transaction ends
+ * @return 0 if success, -1 if the transfer failed, -2 if the bus queue is full
+ */
+int8_t ds1388_set_time(ds1388_data_t const* date)
+{
+    uint8_t time_regs[1 + TIME_REG_COUNT] = {HUNDRED_SEC_REG,
+                        dec2hex(date->hundreth),
+                        dec2hex(date->second),
+                        dec2hex(date->minute),
+                        (dec2hex(date->hour) | HOUR_MODE_24),
+                        date->day,
+                        dec2hex(date->date),
+                        dec2hex(date->month),
+                        dec2hex(date->year)
+    };
+    uint8_t flag_reg[2] = {FLAG_REG, 0x00};
+
+    nrf_twi_mngr_transfer_t const set_transfers[] = {
+        NRF_TWI_MNGR_WRITE(DS1388_ADDRESS, time_regs, sizeof(time_regs), 0),
+        NRF_TWI_MNGR_WRITE(DS1388_ADDRESS, flag_reg, sizeof(flag_reg), 0)
+    };
+
+    return twi_perform(set_transfers, ARRAY_SIZE(set_transfers));
+}
+
+/**
+ * @brief Converts a 24-hour time read from the RTC to seconds since
+ * 1970-01-01, the hundredths are left out
+ */
+uint32_t ds1388_to_epoch(ds1388_data_t const* date)
+{
+    //days from civil, years counted from March so the leap day comes last
+    uint32_t year = 2000 + date->year - ((date->month <= 2) ? 1 : 0);
+    uint32_t month = (date->month <= 2) ? date->month + 9 : date->month - 3;
+    uint32_t day_of_year = (153*month + 2)/5 + date->date - 1;
+    uint32_t days = year*365 + year/4 - year/100 + year/400 + day_of_year - 719468;
+
+    return days*SECONDS_PER_DAY + date->hour*3600 + date->minute*60 + date->second;
+}
+
+/**
+ * @brief Converts seconds since 1970-01-01 to the RTC fields, the hundredths
+ * are cleared. Years from 2000 to 2099, like the RTC
+ */
+void ds1388_from_epoch(uint32_t epoch, ds1388_data_t* date)
+{
+    uint32_t days = epoch / SECONDS_PER_DAY;
+    uint32_t second_of_day = epoch % SECONDS_PER_DAY;
+    uint32_t day_of_era, year_of_era, day_of_year, month;
+
+    //civil from days, eras of 400 years starting in March
+    day_of_era = (days + 719468) % 146097;
+    year_of_era = (day_of_era - day_of_era/1460 + day_of_era/36524 - day_of_era/146096) / 365;
+    day_of_year = day_of_era - (365*year_of_era + year_of_era/4 - year_of_era/100);
+    month = (5*day_of_year + 2) / 153;
+
+    date->year     = (year_of_era + ((month < 10) ? 0 : 1)) % 100; //eras are whole centuries
+    date->month    = (month < 10) ? month + 3 : month - 9;
+    date->date     = day_of_year - (153*month + 2)/5 + 1;
+    date->day      = ((days + 3) % 7) + 1; //1970-01-01 was a thursday, monday is 1
+    date->hour     = second_of_day / 3600;
+    date->minute   = (second_of_day / 60) % 60;
+    date->second   = second_of_day % 60;
+    date->hundreth = 0;
+}
 
-    // The descriptor below is used to properly handle the ds1388's read protocol
-    // The ds1388 device address is selected, the register to read is passed and the read byte is returned
-    // See the nrf SDK reference guide for more information on nrf_drv_twi_xfer_desc_t
-    nrf_drv_twi_xfer_desc_t const ds_desc = {NRFX_TWI_XFER_TXRX, DS1388_ADDRESS, sizeof(reg_addr), sizeof(byte), &reg_addr, &byte};
+/**
+ * @brief Performs a one-byte RTC internal register read.
+ */
+uint8_t ds1388_readRegister(uint8_t reg_addr)
+{
+    uint8_t byte = 0;
 
-    nrf_drv_twi_xfer(&twi, &ds_desc, false);
-    
-    while(nrf_drv_twi_is_busy(&twi) == true);
+    ds1388_read_registers(reg_addr, &byte, sizeof(byte));
 
     return byte;
 }
+
+/**
+ * @brief Reads length consecutive registers starting at reg_addr in one TWI transfer.
+ * The RTC's internal address pointer increments after every byte, and the time
+ * registers are latched for the whole transfer so they cannot roll over mid read
+ */
+void ds1388_read_registers(uint8_t reg_addr, uint8_t* data, uint8_t length)
+{
+    // The ds1388's read protocol: the device address is selected, the register
+    // to read is passed and the bytes are returned after a repeated start
+    nrf_twi_mngr_transfer_t const read_transfers[] = {
+        NRF_TWI_MNGR_WRITE(DS1388_ADDRESS, &reg_addr, sizeof(reg_addr), NRF_TWI_MNGR_NO_STOP),
+        NRF_TWI_MNGR_READ(DS1388_ADDRESS, data, length, 0)
+    };
+
+    twi_perform(read_transfers, ARRAY_SIZE(read_transfers));
+}
+
+/*
+ * Converts a snapshot of the time registers from hex to decimal,
+ * returns the hour format as ds1388_get_time does
+ */
+static uint8_t ds1388_decode_time(uint8_t const* regs, ds1388_data_t* date)
+{
+  date->year = hex2dec(regs[YEAR_REG - HUNDRED_SEC_REG]);
+  date->month = hex2dec(regs[MONTH_REG - HUNDRED_SEC_REG]);
+  date->date = hex2dec(regs[DATE_REG - HUNDRED_SEC_REG]);
+  date->day = regs[DAY_REG - HUNDRED_SEC_REG];
+  date->hour = regs[HOUR_REG - HUNDRED_SEC_REG];
+  date->minute = hex2dec(regs[MIN_REG - HUNDRED_SEC_REG]);
+  date->second = hex2dec(regs[SEC_REG - HUNDRED_SEC_REG]);
+  date->hundreth = hex2dec(regs[HUNDRED_SEC_REG - HUNDRED_SEC_REG]);
+
+  if ((date->hour & 0x40) == HOUR_MODE_24)
+  {
+    date->hour = hex2dec(date->hour);
+    return 2;
+  }
+  else
+  { 
+    date->hour = hex2dec(date->hour & 0x1F);
+    return (regs[HOUR_REG - HUNDRED_SEC_REG] & 0x20) >> 5;
+  }
+}
+
+static void ds1388_time_read_done(ret_code_t result, void * p_user_data)
+{
+    if (result == NRF_SUCCESS)
+        ds1388_decode_time(m_time_regs, m_p_time_date);
+    m_time_pending = false;
+
+    if (m_time_callback != NULL)
+        m_time_callback((result == NRF_SUCCESS) ? 0 : -1, m_time_context);
+}
+
 /**
  * @brief Reads all of the date and time registers, converts their hex
  * values to decimal, and then stores them within the date struct. 
@@ -106,40 +320,43 @@ uint8_t ds1388_readRegister(uint8_t reg_addr)
  * 1 if PM mode
  * 2 if 24-hour mode
  */
+PROFILER_PROBE_DEF(m_get_time_probe, "ds1388_get_time");
+
 uint8_t ds1388_get_time(ds1388_data_t* date)
 {
+  uint8_t regs[TIME_REG_COUNT];
   uint8_t ret;
+  PROFILER_START(m_get_time_probe);
   
-  date->year = ds1388_readRegister(YEAR_REG);
-  date->month = ds1388_readRegister(MONTH_REG);
-  date->date = ds1388_readRegister(DATE_REG);
-  date->day = ds1388_readRegister(DAY_REG);
-  date->hour = ds1388_readRegister(HOUR_REG);
-  date->minute = ds1388_readRegister(MIN_REG);
-  date->second = ds1388_readRegister(SEC_REG);
-  date->hundreth = ds1388_readRegister(HUNDRED_SEC_REG);
-  
-  //Time processing 
-  date->year = hex2dec(date->year);
-  date->month = hex2dec(date->month);
-  date->date = hex2dec(date->date);
-  date->minute = hex2dec(date->minute);
-  date->second = hex2dec(date->second);
-  date->hundreth = hex2dec(date->hundreth);
+  //one coherent snapshot of all of the time registers
+  ds1388_read_registers(HUNDRED_SEC_REG, regs, sizeof(regs));
 
-  
-  if ((date->hour & 0x40) == HOUR_MODE_24)
-  {
-    date->hour = hex2dec(date->hour);
-    ret = 2;
-    return ret;
-  }
-  else
-  { 
-    ret = (date->hour & 0x20 )>> 5;
-    date->hour = hex2dec(date->hour & 0x1F);
-    return ret;
-  }
+  ret = ds1388_decode_time(regs, date);
+  PROFILER_STOP(m_get_time_probe);
+
+  return ret;
 }
 
+/**
+ * @brief Schedules the same time register read as ds1388_get_time on the shared
+ * I2C bus and returns immediately. date is filled in from the twi interrupt, so it
+ * must stay valid until callback (may be NULL) has been called or the bus is idle
+ * @return 0 if success, -2 if a time read is already pending or the bus queue is full
+ */
+int8_t ds1388_schedule_get_time(ds1388_data_t* date, twi_xfer_callback_t callback, void * p_context)
+{
+    if (m_time_pending)
+        return -2;
 
+    m_p_time_date = date;
+    m_time_callback = callback;
+    m_time_context = p_context;
+    m_time_pending = true;
+    if (twi_schedule(&m_time_transaction) < 0)
+    {
+        m_time_pending = false;
+        return -2;
+    }
+
+    return 0;
+}
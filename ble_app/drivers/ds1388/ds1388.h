@@ -15,9 +15,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h> 
-#include "nrf_drv_twi.h"	//I2C driver library
+#include "twi_driver.h"	//shared I2C bus
 #include "app_error.h"
-#include "vcnl4040.h"
 #include "nrf_gpio.h"
 #include "nrf_delay.h"
 
@@ -43,6 +42,10 @@
 #define TRICKLE_CHG_REG     0x0A  //trickle charger
 #define FLAG_REG            0x0B  //flags
 #define CONTROL_REG         0x0C  //control
+#define TIME_REG_COUNT      8     //HUNDRED_SEC_REG to YEAR_REG
+
+//Flag Register
+#define OSF_FLAG            0x80  //the oscillator stopped, the time is not valid until set
 
 //Control Register
 #define EN_OSCILLATOR       0x00  
@@ -71,9 +74,22 @@ typedef struct{
 
 uint8_t ds1388_get_time(ds1388_data_t* date);
 
+int8_t ds1388_schedule_get_time(ds1388_data_t* date, twi_xfer_callback_t callback, void * p_context);
+
 uint8_t ds1388_readRegister(uint8_t reg_addr);
 
-void ds1388_config(void);
+void ds1388_read_registers(uint8_t reg_addr, uint8_t* data, uint8_t length);
+
+void ds1388_config(bool settle);
+
+struct pt;
+char ds1388_config_thread(struct pt *pt, bool settle); //PT_THREAD of nrf_pt.h
+
+int8_t ds1388_set_time(ds1388_data_t const* date);
+
+uint32_t ds1388_to_epoch(ds1388_data_t const* date);
+
+void ds1388_from_epoch(uint32_t epoch, ds1388_data_t* date);
 
 uint8_t dec2hex(uint8_t val);
 
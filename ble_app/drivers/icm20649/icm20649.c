@@ -1,57 +1,332 @@
 #include "icm20649.h"
+#include "profiler.h"
+#include "app_util_platform.h"
 
 const nrf_drv_spi_t gyro_spi = NRF_DRV_SPI_INSTANCE(GYRO_SPI_INSTANCE);  
 
 nrf_drv_spi_config_t const gyro_spi_config = {
-        .ss_pin       = SPI_GYRO_CS_PIN,
+        .ss_pin       = SPI_GYRO_CS_PIN, //driven by spi_driver only
         .miso_pin     = SPI_GYRO_MISO_PIN,
         .mosi_pin     = SPI_GYRO_MOSI_PIN,
         .sck_pin      = SPI_GYRO_SCK_PIN,
         .irq_priority = SPI_IRQ_PRIORITY,
         .orc          = 0xFF,
-        .frequency    = NRF_DRV_SPI_FREQ_1M,
+        .frequency    = SPI_GYRO_CONFIG_FREQ,
         .mode         = NRF_DRV_SPI_MODE_0,
         .bit_order    = NRF_DRV_SPI_BIT_ORDER_MSB_FIRST,
 };
 
-void icm20649_default_init(void)
-{
+static uint8_t m_current_bank = ICM20649_BANK_UNKNOWN; /**< last user bank written to REG_BANK_SEL */
+
+//counts to mg/mrad/s scales in ICM20649_SCALE_SHIFT fixed point, worked out at compile time
+#define ICM20649_ACCEL_SCALE(lsb_per_g) ((int32_t)((1000L << ICM20649_SCALE_SHIFT) / (lsb_per_g)))
+#define ICM20649_GYRO_SCALE(dps)        ((int32_t)((dps) * 3.14159265358979 / 180.0 * 1000.0 \
+                                            * (1L << ICM20649_SCALE_SHIFT) / 32768.0 + 0.5))
+
+/* mg per count keyed on ACCEL_CONFIG FS_SEL: +-4g, 8g, 16g, 30g */
+static const int32_t m_accel_scale[4] = {
+    ICM20649_ACCEL_SCALE(8192), ICM20649_ACCEL_SCALE(4096),
+    ICM20649_ACCEL_SCALE(2048), ICM20649_ACCEL_SCALE(1024),
+};
+
+/* mrad/s per count keyed on GYRO_CONFIG_1 FS_SEL: +-500dps, 1000dps, 2000dps, 4000dps */
+static const int32_t m_gyro_scale[4] = {
+    ICM20649_GYRO_SCALE(500), ICM20649_GYRO_SCALE(1000),
+    ICM20649_GYRO_SCALE(2000), ICM20649_GYRO_SCALE(4000),
+};
+
+static uint8_t m_accel_fs_sel = 0; /**< FS_SEL last written to ACCEL_CONFIG, 0 after reset */
+static uint8_t m_gyro_fs_sel = 0;  /**< FS_SEL last written to GYRO_CONFIG_1, 0 after reset */
+static uint16_t m_accel_div = 0;   /**< ACCEL_SMPLRT_DIV of the last rate configuration, 0 in the init images */
+static icm20649_data_t m_bias = {0}; /**< as set, in counts of 2000dps and 30g */
+static icm20649_data_t m_bias_in_use = {0}; /**< m_bias at the full scales and temperature in use, subtracted by icm20649_parse_gyro_accel_data */
+static icm20649_temp_comp_t m_temp_comp = {.ref_temp_cc = ICM20649_TEMP_UNKNOWN}; /**< none until set */
+static volatile int16_t m_temp_cc = ICM20649_TEMP_UNKNOWN; /**< TEMP_OUT of the last register burst */
+static int16_t m_temp_comp_cc = ICM20649_TEMP_UNKNOWN; /**< temperature m_bias_in_use was worked out at */
+static uint8_t m_dmp_mirror[8*ICM20649_DMP_PACKET_MAX]; /**< DMP packets read from the fifo and not parsed yet */
+static uint16_t m_dmp_fill = 0;
+static uint8_t m_dmp_accel[6]; /**< newest DMP accel sample, paired with the gyro ones */
+
+/* the images below are worked out by the field macros at compile time */
+STATIC_ASSERT(((0x7 << ICM20649_DLPFCFG_POS) & (0x3 << ICM20649_FS_SEL_POS)) == 0
+              && ((0x3 << ICM20649_FS_SEL_POS) & ICM20649_FCHOICE_MSK) == 0);
+STATIC_ASSERT(ICM20649_FS_SEL(ICM20649_DLPF_FS_VAL(7, ICM20649_ACCEL_FS_30G)) == ICM20649_ACCEL_FS_30G);
+
+/* icm20649_default_init, the sensors are enabled once they are configured */
+static const icm20649_config_t m_default_config[] = {
     //USER CTRL disable all
-    icm20649_write_reg(0x03, 0x0);
+    {ICM20649_USER_CTRL, 1, {0x0}},
+    //LP_CONFIG disable duty cycle mode, PWR_MGMT 1 select best clk and disable everything else
+    {ICM20649_LP_CONFIG, 2, {0x0, ICM20649_PWR_MGMT_1_CLKSEL_AUTO}},
+    //INT_PIN_CFG INT1 latched until INT_STATUS_1 is read, INT_ENABLE none, INT_ENABLE_1 raw data ready
+    {ICM20649_INT_PIN_CFG, 3, {ICM20649_INT_PIN_CFG_LATCH_MSK, 0x0, ICM20649_INT_RAW_DATA_RDY_MSK}},
+    //GYRO_CONFIG_1 bypass gyro DLPF, 2000dps, GYRO_CONFIG_2 disable self test, no avging
+    {ICM20649_GYRO_CONFIG_1, 2, {ICM20649_FS_VAL(ICM20649_GYRO_FS_2000DPS), 0x0}},
+    //ACCEL_CONFIG bypass accel DLPF, 30g
+    {ICM20649_ACCEL_CONFIG, 1, {ICM20649_FS_VAL(ICM20649_ACCEL_FS_30G)}},
+    //PWR_MGMT 2 enable accel & gyro, leaves userbank 0 selected for the data and fifo registers
+    {ICM20649_PWR_MGMT_2, 1, {0x0}},
+};
 
-    //LP_CONFIG disable duty cycle mode
-    icm20649_write_reg(0x05, 0x0);
+/* icm20649_fifo_init, on top of m_default_config. The first ICM20649_FIFO_RATE_RUNS
+ * are the rates, icm20649_fifo_init_rates writes its own instead */
+#define ICM20649_FIFO_RATE_RUNS 3
+static const icm20649_config_t m_fifo_config[] = {
+    //GYRO_SMPLRT_DIV 1125Hz/(1+0), GYRO_CONFIG_1 gyro DLPF 197Hz, 2000dps
+    {ICM20649_GYRO_SMPLRT_DIV, 2, {0x0, ICM20649_DLPF_FS_VAL(0, ICM20649_GYRO_FS_2000DPS)}},
+    //ACCEL_SMPLRT_DIV_1 and 2 1125Hz/(1+0)
+    {ICM20649_ACCEL_SMPLRT_DIV_1, 2, {0x0, 0x0}},
+    //ACCEL_CONFIG accel DLPF 246Hz, 30g
+    {ICM20649_ACCEL_CONFIG, 1, {ICM20649_DLPF_FS_VAL(0, ICM20649_ACCEL_FS_30G)}},
+    //FIFO_MODE stream, the oldest frames are overwritten if it overflows
+    {ICM20649_FIFO_MODE, 1, {0x0}},
+    {ICM20649_FIFO_EN_2, 1, {ICM20649_FIFO_EN_2_ACCEL_GYRO}},
+    {ICM20649_USER_CTRL, 1, {ICM20649_USER_CTRL_FIFO_EN_MSK}},
+};
 
-    //PWR_MGMT 1 select best clk and disable everything else
-    icm20649_write_reg(0x06, 0x1);
+/* icm20649_dmp_init, on top of m_default_config once the image is loaded */
+static const icm20649_config_t m_dmp_config[] = {
+    //GYRO_SMPLRT_DIV 1125Hz/(1+4), GYRO_CONFIG_1 gyro DLPF 197Hz, 2000dps
+    {ICM20649_GYRO_SMPLRT_DIV, 2, {ICM20649_DMP_SMPLRT_DIV, ICM20649_DLPF_FS_VAL(0, ICM20649_GYRO_FS_2000DPS)}},
+    //ACCEL_SMPLRT_DIV_1 and 2 1125Hz/(1+4)
+    {ICM20649_ACCEL_SMPLRT_DIV_1, 2, {0x0, ICM20649_DMP_SMPLRT_DIV}},
+    //ACCEL_CONFIG accel DLPF 246Hz, 30g
+    {ICM20649_ACCEL_CONFIG, 1, {ICM20649_DLPF_FS_VAL(0, ICM20649_ACCEL_FS_30G)}},
+    //PRGM_START_ADDRH and L
+    {ICM20649_PRGM_START_ADDRH, 2, {ICM20649_DMP_START_ADDR >> 8, ICM20649_DMP_START_ADDR & 0xFF}},
+    //FIFO_EN_2 no raw frames, the DMP writes its packets, FIFO_MODE stream
+    {ICM20649_FIFO_EN_2, 1, {0x0}},
+    {ICM20649_FIFO_MODE, 1, {0x0}},
+};
 
-    //PWR_MGMT 2 enable accel & gyro
-    icm20649_write_reg(0x07, 0x0);
-    
-    //REG BANK SEL select userbank 2
-    icm20649_write_reg(0x7F, 0x20);
+/* icm20649_set_low_power(true), the accel alone and duty cycled. Leaves user bank 0 selected */
+static const icm20649_config_t m_low_power_config[] = {
+    //ACCEL_SMPLRT_DIV_1 and 2, the duty cycle runs at the accel sample rate
+    {ICM20649_ACCEL_SMPLRT_DIV_1, 2, {0x0, ICM20649_LP_ACCEL_SMPLRT_DIV}},
+    //LP_CONFIG cycle the accel, PWR_MGMT 1 low power best clk, PWR_MGMT 2 disable the gyro
+    {ICM20649_LP_CONFIG, 3, {ICM20649_LP_CONFIG_ACCEL_CYCLE,
+                             ICM20649_PWR_MGMT_1_LP_EN_MSK | ICM20649_PWR_MGMT_1_CLKSEL_AUTO,
+                             ICM20649_PWR_MGMT_2_DISABLE_GYRO}},
+};
+
+/* icm20649_set_low_power(false), after the accel divider in use.
+ * LP_CONFIG disable duty cycle mode, PWR_MGMT 1 best clk, PWR_MGMT 2 enable accel & gyro */
+static const icm20649_config_t m_full_power_config =
+    {ICM20649_LP_CONFIG, 3, {0x0, ICM20649_PWR_MGMT_1_CLKSEL_AUTO, 0x0}};
+
+/*
+ * A bias of counts at bias_fs_sel in counts at fs_sel, each step of FS_SEL halves the counts
+ */
+static int16_t icm20649_bias_scale(int16_t bias, uint8_t fs_sel, uint8_t bias_fs_sel)
+{
+    int32_t val;
+
+    if (fs_sel <= bias_fs_sel)
+        val = (int32_t) bias * (1 << (bias_fs_sel - fs_sel));
+    else
+        val = bias / (1 << (fs_sel - bias_fs_sel));
+
+    if (val > INT16_MAX)
+        return INT16_MAX;
+    if (val < INT16_MIN)
+        return INT16_MIN;
+    return (int16_t) val;
+}
 
-    //GYRO_CONFIG_1 bypass gyro DLPF, 2000dps
-    icm20649_write_reg(0x1, 0x4);
+/*
+ * The gyro bias of one axis at a temperature, in counts of 2000dps
+ */
+static int16_t icm20649_gyro_bias_at(int16_t bias, uint8_t axis, int16_t temp_cc)
+{
+    int32_t val = (int32_t) bias + icm20649_temp_comp_bias(&m_temp_comp, axis, temp_cc);
 
-    //GYRO_CONFIG_2 disable self test, no avging
-    icm20649_write_reg(0x2, 0x0);
+    if (val > INT16_MAX)
+        return INT16_MAX;
+    if (val < INT16_MIN)
+        return INT16_MIN;
+    return (int16_t) val;
+}
 
-    //GYRO_CONFIG_2 disable self test, no avging
-    icm20649_write_reg(0x14, 0x6);
+/*
+ * Scales the bias to the full scales and the temperature in use, the samples
+ * are parsed in interrupts
+ */
+static void icm20649_bias_update(void)
+{
+    CRITICAL_REGION_ENTER();
+    m_temp_comp_cc = m_temp_cc;
+    m_bias_in_use.accel_x = icm20649_bias_scale(m_bias.accel_x, m_accel_fs_sel, ICM20649_ACCEL_FS_30G);
+    m_bias_in_use.accel_y = icm20649_bias_scale(m_bias.accel_y, m_accel_fs_sel, ICM20649_ACCEL_FS_30G);
+    m_bias_in_use.accel_z = icm20649_bias_scale(m_bias.accel_z, m_accel_fs_sel, ICM20649_ACCEL_FS_30G);
+    m_bias_in_use.gyro_x = icm20649_bias_scale(icm20649_gyro_bias_at(m_bias.gyro_x, 0, m_temp_comp_cc),
+                                               m_gyro_fs_sel, ICM20649_GYRO_FS_2000DPS);
+    m_bias_in_use.gyro_y = icm20649_bias_scale(icm20649_gyro_bias_at(m_bias.gyro_y, 1, m_temp_comp_cc),
+                                               m_gyro_fs_sel, ICM20649_GYRO_FS_2000DPS);
+    m_bias_in_use.gyro_z = icm20649_bias_scale(icm20649_gyro_bias_at(m_bias.gyro_z, 2, m_temp_comp_cc),
+                                               m_gyro_fs_sel, ICM20649_GYRO_FS_2000DPS);
+    CRITICAL_REGION_EXIT();
+}
 
-    //REG BANK SEL select userbank 0
-    icm20649_write_reg(0x7F, 0x0);
+/*
+ * Keeps the bank cache, the full scales and the bias in use coherent with a
+ * register write in a known user bank
+ */
+static void icm20649_track_write(icm20649_reg_t reg, uint8_t data)
+{
+    if (reg == ICM20649_ACCEL_CONFIG)
+    {
+        m_accel_fs_sel = ICM20649_FS_SEL(data);
+        icm20649_bias_update();
+    }
+    else if (reg == ICM20649_GYRO_CONFIG_1)
+    {
+        m_gyro_fs_sel = ICM20649_FS_SEL(data);
+        icm20649_bias_update();
+    }
+    else if (reg == ICM20649_PWR_MGMT_1 && (data & ICM20649_PWR_MGMT_1_DEVICE_RESET_MSK))
+    {
+        //registers return to their defaults
+        m_current_bank = ICM20649_BANK_UNKNOWN;
+        m_accel_fs_sel = 0;
+        m_gyro_fs_sel = 0;
+        icm20649_bias_update();
+    }
 }
 
+void icm20649_default_init(void)
+{
+    m_accel_div = 0;
+    icm20649_write_config(m_default_config, ARRAY_SIZE(m_default_config));
+}
+
+/*
+ * Writes a register in the currently selected user bank. Writes to REG_BANK_SEL
+ * and device resets are tracked so the bank cache stays coherent
+ * @return 0 if success otherwise -1
+ */
 int8_t icm20649_write_reg(uint8_t address, uint8_t data)
 {
     uint8_t tx_msg[2];
     uint8_t rx_buf[2];
     tx_msg[0] = address;
     tx_msg[1] = data;
+    int8_t ret;
+
+    ret = spi_write_and_read(&gyro_spi, SPI_GYRO_CS_PIN, tx_msg, 2, rx_buf, 2 ); // send 2 bytes
+
+    if (address == ICM20649_REG_BANK_SEL)
+        m_current_bank = (ret < 0) ? ICM20649_BANK_UNKNOWN : (data >> 4) & 0x3;
+    else if (ret == 0 && m_current_bank != ICM20649_BANK_UNKNOWN)
+        icm20649_track_write((icm20649_reg_t)ICM20649_REG(m_current_bank, address), data);
 
-    return spi_write_and_read(&gyro_spi, SPI_GYRO_CS_PIN, tx_msg, 2, rx_buf, 2 ); // send 2 bytes
+    return ret;
+}
+
+/*
+ * Selects a user bank, skipping the write if it is already selected
+ * @param bank - 0 to 3
+ * @return 0 if success, -1 on spi error or -2 if bank is out of range
+ */
+int8_t icm20649_select_bank(uint8_t bank)
+{
+    if (bank > 3)
+        return -2;
+
+    if (bank == m_current_bank)
+        return 0;
+
+    return icm20649_write_reg(ICM20649_REG_BANK_SEL, bank << 4);
+}
+
+/*
+ * Writes a register from the typed register map, switching user bank only if needed.
+ * Full scale changes are tracked for icm20649_convert_data
+ * @return 0 if success otherwise -1
+ */
+int8_t icm20649_write_bank_reg(icm20649_reg_t reg, uint8_t data)
+{
+    int8_t ret;
+
+    ret = icm20649_select_bank(ICM20649_REG_BANK(reg));
+    if (ret < 0)
+        return ret;
+
+    return icm20649_write_reg(ICM20649_REG_ADDR(reg), data);
+}
+
+/*
+ * Writes a configuration image, each run of registers in one burst and a bank
+ * select only where the bank changes, all queued as one batch with a single wait.
+ * The bank of the last run stays selected. A device reset can't be part of it,
+ * the bank selects are worked out beforehand
+ * @param count - runs in config, up to ICM20649_CONFIG_MAX_COUNT
+ * @return 0 if success, -1 on spi error or -2 if a run is empty or too long
+ */
+int8_t icm20649_write_config(icm20649_config_t const * config, uint8_t count)
+{
+    //EasyDMA only reads from ram, the image is in flash
+    uint8_t bank_buf[ICM20649_CONFIG_MAX_COUNT][2];
+    uint8_t data_buf[ICM20649_CONFIG_MAX_COUNT][1 + ICM20649_CONFIG_MAX_LENGTH];
+    spi_xfer_t xfers[2 * ICM20649_CONFIG_MAX_COUNT];
+    uint8_t bank = m_current_bank;
+    uint8_t num_xfers = 0;
+    uint8_t i, j;
+
+    if (count == 0 || count > ICM20649_CONFIG_MAX_COUNT)
+        return -2;
+
+    memset(xfers, 0, sizeof(xfers));
+    for (i = 0; i < count; i++)
+    {
+        if (config[i].length == 0 || config[i].length > ICM20649_CONFIG_MAX_LENGTH)
+            return -2;
+
+        if (ICM20649_REG_BANK(config[i].reg) != bank)
+        {
+            bank = ICM20649_REG_BANK(config[i].reg);
+            bank_buf[i][0] = ICM20649_REG_BANK_SEL;
+            bank_buf[i][1] = bank << 4;
+            xfers[num_xfers].cs_pin = SPI_GYRO_CS_PIN;
+            xfers[num_xfers].p_tx_buf = bank_buf[i];
+            xfers[num_xfers].tx_length = 2;
+            num_xfers++;
+        }
+        data_buf[i][0] = ICM20649_REG_ADDR(config[i].reg);
+        memcpy(&data_buf[i][1], config[i].data, config[i].length);
+        xfers[num_xfers].cs_pin = SPI_GYRO_CS_PIN;
+        xfers[num_xfers].p_tx_buf = data_buf[i];
+        xfers[num_xfers].tx_length = 1 + config[i].length;
+        num_xfers++;
+    }
+
+    if (spi_perform_batch(&gyro_spi, xfers, num_xfers) < 0)
+    {
+        m_current_bank = ICM20649_BANK_UNKNOWN;
+        return -1;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        m_current_bank = ICM20649_REG_BANK(config[i].reg);
+        for (j = 0; j < config[i].length; j++)
+            icm20649_track_write((icm20649_reg_t)(config[i].reg + j), config[i].data[j]);
+    }
+    return 0;
+}
+
+/*
+ * Reads a register from the typed register map, switching user bank only if needed
+ * @return 0 if success otherwise -1
+ */
+int8_t icm20649_read_bank_reg(icm20649_reg_t reg, uint8_t * reg_data)
+{
+    int8_t ret;
+
+    ret = icm20649_select_bank(ICM20649_REG_BANK(reg));
+    if (ret < 0)
+        return ret;
+
+    return icm20649_read_reg(ICM20649_REG_ADDR(reg), reg_data);
 }
 
 int8_t icm20649_read_reg(uint8_t address, uint8_t * reg_data)
@@ -71,71 +346,945 @@ int8_t icm20649_read_reg(uint8_t address, uint8_t * reg_data)
 int8_t icm20649_multibyte_read_reg( uint8_t reg_addr, uint8_t* reg_data, uint8_t num_bytes) 
 {
     uint8_t read_addr;
-    uint8_t buf[257]; 
+
+    read_addr = reg_addr | 0x80; //set MSB to 1 for read
+
+    //runs at SPI_GYRO_BURST_FREQ, only the sensor data registers are rated above 1 MHz
+    //the bytes are DMAed straight into reg_data, it must be in ram
+    return spi_write_then_read(&gyro_spi, SPI_GYRO_CS_PIN, &read_addr, 1, reg_data, num_bytes, true);
+}
+
+PROFILER_PROBE_DEF(m_read_gyro_accel_probe, "icm20649_read_gyro_accel_data");
+
+void icm20649_read_gyro_accel_data(icm20649_data_t *icm20649_data)
+{
+    uint8_t rx_buf[ICM20649_REG_DATA_LENGTH] = {0};
+    PROFILER_START(m_read_gyro_accel_probe);
+
+    //no bank select write unless the cache says another bank is selected
+    if (icm20649_select_bank(ICM20649_REG_BANK(ICM20649_ACCEL_XOUT_H)) < 0)
+        return;
+
+    icm20649_multibyte_read_reg( ICM20649_REG_ADDR(ICM20649_ACCEL_XOUT_H), rx_buf, ICM20649_REG_DATA_LENGTH);
+
+    icm20649_parse_gyro_accel_temp_data(rx_buf, icm20649_data);
+    PROFILER_STOP(m_read_gyro_accel_probe);
+}
+
+/*
+ * Reads the accel and gyro data registers only if a conversion landed since the
+ * last call, so a read never takes the same conversion twice and a caller that
+ * reads faster than the output data rate can tell. INT_STATUS_1 is read first,
+ * which clears its raw data ready and the INT pin latched on it. A conversion
+ * landing between the two reads is taken now and reported once more next call
+ * @return 1 if the data holds a new conversion, 0 if there was none (the data
+ *         is left as it is) or -1 on spi error
+ */
+int8_t icm20649_read_fresh_gyro_accel_data(icm20649_data_t *icm20649_data)
+{
+    uint8_t rx_buf[ICM20649_REG_DATA_LENGTH];
+    uint8_t status;
+
+    if (icm20649_read_bank_reg(ICM20649_INT_STATUS_1, &status) < 0)
+        return -1;
+    if ((status & ICM20649_INT_RAW_DATA_RDY_MSK) == 0)
+        return 0;
+
+    if (icm20649_multibyte_read_reg(ICM20649_REG_ADDR(ICM20649_ACCEL_XOUT_H), rx_buf, ICM20649_REG_DATA_LENGTH) < 0)
+        return -1;
+    icm20649_parse_gyro_accel_temp_data(rx_buf, icm20649_data);
+
+    return 1;
+}
+
+/*
+ * Queues a read of the accel, gyro and temperature data registers without blocking.
+ * The bank can't be switched from a queued transfer, so user bank 0 must already
+ * be selected (icm20649_default_init and icm20649_fifo_init leave bank 0 selected)
+ * @param p_xfer - descriptor, must stay valid until the callback
+ * @param p_rx_buf - ICM20649_REG_DATA_LENGTH bytes, for icm20649_parse_gyro_accel_temp_data
+ * @return 0 if queued, -1 if the queue is full or -2 if bank 0 is not selected
+ */
+int8_t icm20649_queue_read_gyro_accel_data(spi_xfer_t * p_xfer, uint8_t * p_rx_buf, spi_xfer_callback_t callback, void * p_context)
+{
+    static uint8_t read_addr = ICM20649_REG_ADDR(ICM20649_ACCEL_XOUT_H) | 0x80; //in ram for EasyDMA
+
+    if (m_current_bank != ICM20649_REG_BANK(ICM20649_ACCEL_XOUT_H))
+        return -2;
+
+    p_xfer->cs_pin = SPI_GYRO_CS_PIN;
+    p_xfer->p_tx_buf = &read_addr;
+    p_xfer->tx_length = 1;
+    p_xfer->rx_skip = 1;
+    p_xfer->p_rx_buf = p_rx_buf;
+    p_xfer->rx_length = ICM20649_REG_DATA_LENGTH;
+    p_xfer->callback = callback;
+    p_xfer->p_context = p_context;
+    p_xfer->burst = true;
+
+    return spi_queue_xfer(&gyro_spi, p_xfer);
+}
+
+/*
+ * Takes the bias off a big endian register pair, saturated to int16
+ */
+static int16_t icm20649_unbias(uint8_t const * p_raw, int16_t bias)
+{
+    int32_t val = (int16_t)(p_raw[0]<<8 | p_raw[1]) - bias;
+
+    if (val > INT16_MAX)
+        return INT16_MAX;
+    if (val < INT16_MIN)
+        return INT16_MIN;
+    return (int16_t) val;
+}
+
+/*
+ * Unpacks the big endian accel and gyro registers into raw counts, less the
+ * bias of icm20649_set_bias at the last temperature read, e.g. a fifo frame
+ */
+void icm20649_parse_gyro_accel_data(uint8_t const * p_raw, icm20649_data_t * icm20649_data)
+{
+    icm20649_data->accel_x = icm20649_unbias(&p_raw[0], m_bias_in_use.accel_x);
+    icm20649_data->accel_y = icm20649_unbias(&p_raw[2], m_bias_in_use.accel_y);
+    icm20649_data->accel_z = icm20649_unbias(&p_raw[4], m_bias_in_use.accel_z);
+    icm20649_data->gyro_x = icm20649_unbias(&p_raw[6], m_bias_in_use.gyro_x);
+    icm20649_data->gyro_y = icm20649_unbias(&p_raw[8], m_bias_in_use.gyro_y);
+    icm20649_data->gyro_z = icm20649_unbias(&p_raw[10], m_bias_in_use.gyro_z);
+}
+
+/*
+ * Unpacks a burst of the data registers, ICM20649_REG_DATA_LENGTH bytes. The
+ * temperature is kept and moves the gyro bias once it changed by
+ * ICM20649_TEMP_COMP_STEP_CC, before the sample is unpacked with it
+ */
+void icm20649_parse_gyro_accel_temp_data(uint8_t const * p_raw, icm20649_data_t * icm20649_data)
+{
+    int16_t raw = (int16_t)(p_raw[ICM20649_DATA_LENGTH]<<8 | p_raw[ICM20649_DATA_LENGTH + 1]);
+    int16_t temp_cc = ICM20649_TEMP_ROOM_CC + (int16_t)(((int32_t) raw * ICM20649_TEMP_Q16_CC) >> 16);
+    int32_t moved = (int32_t) temp_cc - m_temp_comp_cc;
+
+    m_temp_cc = temp_cc;
+    if (m_temp_comp.ref_temp_cc != ICM20649_TEMP_UNKNOWN
+        && (moved >= ICM20649_TEMP_COMP_STEP_CC || moved <= -ICM20649_TEMP_COMP_STEP_CC))
+    {
+        icm20649_bias_update();
+    }
+    icm20649_parse_gyro_accel_data(p_raw, icm20649_data);
+}
+
+/*
+ * Sets the bias taken off every sample from now on, in raw counts of 2000dps
+ * and 30g, the full scales of the init images, e.g. the per board calibration
+ * kept in the internal flash. It is scaled to the full scales in use whenever
+ * they change. The offset registers of the device are left alone, so the bias
+ * applies whatever was factory trimmed and goes away with a zero bias
+ */
+void icm20649_set_bias(icm20649_data_t const * bias)
+{
+    CRITICAL_REGION_ENTER();
+    m_bias = *bias;
+    CRITICAL_REGION_EXIT();
+    icm20649_bias_update();
+}
+
+/*
+ * Copies the bias taken off every sample, in counts of 2000dps and 30g
+ */
+void icm20649_get_bias(icm20649_data_t * bias)
+{
+    CRITICAL_REGION_ENTER();
+    *bias = m_bias;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Sets the temperature model of the gyro bias, from the calibration kept in
+ * the internal flash. The bias of icm20649_set_bias is the one at
+ * ref_temp_cc, the bias in use follows the temperature of the register bursts
+ * from the next one on. The fifo frames carry no temperature, they take the
+ * bias of the last burst
+ */
+void icm20649_set_temp_comp(icm20649_temp_comp_t const * comp)
+{
+    CRITICAL_REGION_ENTER();
+    m_temp_comp = *comp;
+    CRITICAL_REGION_EXIT();
+    icm20649_bias_update();
+}
+
+void icm20649_get_temp_comp(icm20649_temp_comp_t * comp)
+{
+    CRITICAL_REGION_ENTER();
+    *comp = m_temp_comp;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * How far the gyro bias of an axis moved from the one at the reference temperature
+ * @param axis - 0 to 2 for x, y, z
+ * @param temp_cc - 0.01 C
+ * @return counts of 2000dps, 0 if either temperature is unknown
+ */
+int16_t icm20649_temp_comp_bias(icm20649_temp_comp_t const * comp, uint8_t axis, int16_t temp_cc)
+{
+    int32_t num;
+
+    if (axis > 2 || comp->ref_temp_cc == ICM20649_TEMP_UNKNOWN || temp_cc == ICM20649_TEMP_UNKNOWN)
+        return 0;
+
+    //0.001 counts per C times 0.01 C, fits 32 bits for any int16 pair
+    num = (int32_t) comp->gyro_slope[axis] * ((int32_t) temp_cc - comp->ref_temp_cc);
+    return (int16_t) ((num >= 0) ? (num + 50000)/100000 : (num - 50000)/100000);
+}
+
+/*
+ * @return the die temperature of the last register burst in 0.01 C,
+ *         ICM20649_TEMP_UNKNOWN before the first one
+ */
+int16_t icm20649_temp_cc(void)
+{
+    return m_temp_cc;
+}
+
+/*
+ * @return counts of 1 g at the accel full scale in use
+ */
+int16_t icm20649_accel_lsb_per_g(void)
+{
+    return 8192 >> m_accel_fs_sel;
+}
+
+/*
+ * @return the gyro full scale in use in degrees per second
+ */
+uint16_t icm20649_gyro_fs_dps(void)
+{
+    return 500 << m_gyro_fs_sel;
+}
+
+/*
+ * GYRO_CONFIG_1 or ACCEL_CONFIG of a filter and a range
+ */
+static uint8_t icm20649_dlpf_fs_reg(uint8_t dlpf, uint8_t fs)
+{
+    if (dlpf == ICM20649_DLPF_BYPASS)
+        return ICM20649_FS_VAL(fs);
+
+    return ICM20649_DLPF_FS_VAL(dlpf, fs);
+}
+
+/*
+ * Writes the rate dividers, the low pass filters and the ranges of the gyro and
+ * the accel in one batch, on top of icm20649_default_init or icm20649_fifo_init.
+ * icm20649_convert_data, icm20649_accel_lsb_per_g and icm20649_gyro_fs_dps follow
+ * the new ranges. A fifo in use keeps its frames, which no longer share a rate
+ * with the accel and gyro of different dividers. Leaves user bank 0 selected
+ * @return 0 if success, -1 on spi error or -2 if a field is out of range, nothing is written
+ */
+int8_t icm20649_set_rate_config(icm20649_rate_config_t const * config)
+{
+    icm20649_config_t image[3];
+
+    if ((config->gyro_dlpf > ICM20649_DLPF_MAX && config->gyro_dlpf != ICM20649_DLPF_BYPASS)
+        || (config->accel_dlpf > ICM20649_DLPF_MAX && config->accel_dlpf != ICM20649_DLPF_BYPASS)
+        || config->gyro_fs > ICM20649_GYRO_FS_4000DPS || config->accel_fs > ICM20649_ACCEL_FS_30G
+        || config->accel_div > ICM20649_ACCEL_DIV_MAX)
+    {
+        return -2;
+    }
+
+    //GYRO_SMPLRT_DIV, GYRO_CONFIG_1
+    image[0].reg = ICM20649_GYRO_SMPLRT_DIV;
+    image[0].length = 2;
+    image[0].data[0] = config->gyro_div;
+    image[0].data[1] = icm20649_dlpf_fs_reg(config->gyro_dlpf, config->gyro_fs);
+    //ACCEL_SMPLRT_DIV_1 and 2
+    image[1].reg = ICM20649_ACCEL_SMPLRT_DIV_1;
+    image[1].length = 2;
+    image[1].data[0] = config->accel_div >> 8;
+    image[1].data[1] = config->accel_div & 0xFF;
+    //ACCEL_CONFIG
+    image[2].reg = ICM20649_ACCEL_CONFIG;
+    image[2].length = 1;
+    image[2].data[0] = icm20649_dlpf_fs_reg(config->accel_dlpf, config->accel_fs);
+    if (icm20649_write_config(image, ARRAY_SIZE(image)) < 0)
+        return -1;
+    m_accel_div = config->accel_div;
+
+    return icm20649_select_bank(ICM20649_REG_BANK(ICM20649_ACCEL_XOUT_H));
+}
+
+/*
+ * @return the gyro output data rate a configuration gives, in Hz
+ */
+uint16_t icm20649_gyro_rate_hz(icm20649_rate_config_t const * config)
+{
+    if (config->gyro_dlpf == ICM20649_DLPF_BYPASS)
+        return ICM20649_GYRO_BYPASS_RATE_HZ;
+
+    return ICM20649_BASE_RATE_HZ / (1 + config->gyro_div);
+}
+
+/*
+ * @return the accel output data rate a configuration gives, in Hz
+ */
+uint16_t icm20649_accel_rate_hz(icm20649_rate_config_t const * config)
+{
+    if (config->accel_dlpf == ICM20649_DLPF_BYPASS)
+        return ICM20649_ACCEL_BYPASS_RATE_HZ;
+
+    return ICM20649_BASE_RATE_HZ / (1 + config->accel_div);
+}
+
+/*
+ * Streams accel and gyro frames through the fifo instead of reading the data registers.
+ * Both DLPFs are enabled so accel and gyro run at ICM20649_FIFO_SAMPLE_RATE_HZ and
+ * every fifo frame holds one accel and one gyro sample. Leaves user bank 0 selected
+ */
+void icm20649_fifo_init(void)
+{
+    m_accel_div = 0;
+    icm20649_write_config(m_fifo_config, ARRAY_SIZE(m_fifo_config));
+    icm20649_fifo_reset();
+}
+
+/*
+ * Streams the fifo as icm20649_fifo_init with the gyro and the accel at their own
+ * rates and low pass, e.g. a fast gyro for the rotational metrics next to a slow,
+ * narrow band accel. The gyro paces the fifo: a frame is written per gyro sample and
+ * its accel fields hold the newest accel sample until the next, so the accel rate
+ * can't be above the gyro one. Records of held accel code to zero differences,
+ * impact_codec stores little more than the accel bandwidth. Leaves user bank 0 selected
+ * @return 0 if success, -1 on spi error or -2 if a DLPF is bypassed, the accel is
+ *         faster than the gyro or a field is out of range, the fifo is not started
+ */
+int8_t icm20649_fifo_init_rates(icm20649_rate_config_t const * config)
+{
     int8_t ret;
-    
-    if(num_bytes > 256)
+
+    if (config->gyro_dlpf == ICM20649_DLPF_BYPASS || config->accel_dlpf == ICM20649_DLPF_BYPASS
+        || icm20649_accel_rate_hz(config) > icm20649_gyro_rate_hz(config))
+        return -2;
+
+    ret = icm20649_set_rate_config(config);
+    if (ret < 0)
+        return ret;
+    if (icm20649_write_config(&m_fifo_config[ICM20649_FIFO_RATE_RUNS],
+                              ARRAY_SIZE(m_fifo_config) - ICM20649_FIFO_RATE_RUNS) < 0)
         return -1;
 
-    read_addr = reg_addr | 0x80; //set MSB to 1 for read
-    memset( buf, 0x00, num_bytes + 1);
+    return icm20649_fifo_reset();
+}
 
-    ret = spi_write_and_read(&gyro_spi, SPI_GYRO_CS_PIN, &read_addr, 1, buf, num_bytes + 1 );
+/*
+ * @return the rate of the fifo frames icm20649_fifo_init_rates gives, in Hz
+ */
+uint16_t icm20649_fifo_rate_hz(icm20649_rate_config_t const * config)
+{
+    return icm20649_gyro_rate_hz(config);
+}
+
+/*
+ * Empties the fifo, e.g. at the start of an impact
+ * @return 0 if success otherwise -1
+ */
+int8_t icm20649_fifo_reset(void)
+{
+    int8_t ret;
+
+    ret = icm20649_write_bank_reg(ICM20649_FIFO_RST, ICM20649_FIFO_RST_ALL);
     if (ret < 0)
         return ret;
-    
-    memcpy(reg_data, &buf[1], num_bytes);
 
-    return ret;
+    return icm20649_write_bank_reg(ICM20649_FIFO_RST, 0x0);
 }
 
-void icm20649_read_gyro_accel_data(icm20649_data_t *icm20649_data)
+/*
+ * Reads the number of bytes in the fifo
+ * @return 0 if success otherwise -1
+ */
+int8_t icm20649_get_fifo_count(uint16_t * p_count)
 {
-    uint8_t rx_buf[12] = {0};
+    uint8_t buf[2];
+    int8_t ret;
 
-    //REG BANK SEL select userbank 0
-    icm20649_write_reg(0x7F, 0x0);
+    ret = icm20649_select_bank(ICM20649_REG_BANK(ICM20649_FIFO_COUNTH));
+    if (ret < 0)
+        return ret;
+
+    ret = icm20649_multibyte_read_reg(ICM20649_REG_ADDR(ICM20649_FIFO_COUNTH), buf, sizeof(buf));
+    if (ret < 0)
+        return ret;
 
-    icm20649_multibyte_read_reg( 0x2D, rx_buf, 12);
+    *p_count = ((buf[0] & 0x1F) << 8) | buf[1];
 
-    icm20649_data->accel_x = rx_buf[0]<<8 | rx_buf[1];
-    icm20649_data->accel_y = rx_buf[2]<<8 | rx_buf[3];
-    icm20649_data->accel_z = rx_buf[4]<<8 | rx_buf[5];
-    icm20649_data->gyro_x = rx_buf[6]<<8 | rx_buf[7];
-    icm20649_data->gyro_y = rx_buf[8]<<8 | rx_buf[9];
-    icm20649_data->gyro_z = rx_buf[10]<<8 | rx_buf[11];
-    
+    return 0;
+}
+
+/*
+ * Drains whole frames from the fifo in one burst read straight into samples,
+ * then unpacks them in place. Frames beyond max_samples stay in the fifo.
+ * @param samples - receives the frames oldest first, must be in RAM
+ * @return the number of samples, -1 on spi error or -2 if the fifo overflowed
+ *         (it is reset since frames are no longer aligned)
+ */
+int16_t icm20649_read_fifo(icm20649_data_t * samples, uint16_t max_samples)
+{
+    static uint8_t read_addr = ICM20649_REG_ADDR(ICM20649_FIFO_R_W) | 0x80; //in ram for EasyDMA
+    uint8_t raw[ICM20649_DATA_LENGTH];
+    uint8_t int_status;
+    uint16_t count;
+    uint16_t num_samples;
+    int8_t ret;
+
+    ret = icm20649_read_bank_reg(ICM20649_INT_STATUS_2, &int_status);
+    if (ret < 0)
+        return ret;
+    if (int_status & 0x1F)
+    {
+        icm20649_fifo_reset();
+        return -2;
+    }
+
+    ret = icm20649_get_fifo_count(&count);
+    if (ret < 0)
+        return ret;
+
+    num_samples = count / ICM20649_DATA_LENGTH;
+    if (num_samples > max_samples)
+        num_samples = max_samples;
+    if (num_samples == 0)
+        return 0;
+
+    //FIFO_R_W does not auto increment, the whole burst comes from the fifo
+    ret = spi_write_then_read(&gyro_spi, SPI_GYRO_CS_PIN, &read_addr, 1,
+                              (uint8_t *) samples, num_samples * ICM20649_DATA_LENGTH, true);
+    if (ret < 0)
+        return ret;
+
+    for (uint16_t i = 0; i < num_samples; i++)
+    {
+        memcpy(raw, &samples[i], sizeof(raw));
+        icm20649_parse_gyro_accel_data(raw, &samples[i]);
+    }
+
+    return num_samples;
 }
 
+/*
+ * Writes the DMP memory in bursts of ICM20649_DMP_MEM_CHUNK, the DMP must be
+ * stopped. Leaves user bank 0 selected
+ * @return 0 if success otherwise -1
+ */
+int8_t icm20649_dmp_write_mem(uint16_t address, uint8_t const * p_data, uint16_t length)
+{
+    uint8_t tx_buf[1 + ICM20649_DMP_MEM_CHUNK];
+    uint8_t rx_buf[1 + ICM20649_DMP_MEM_CHUNK];
+    uint16_t chunk;
+
+    while (length > 0)
+    {
+        chunk = MIN(length, ICM20649_DMP_MEM_CHUNK);
+        chunk = MIN(chunk, 0x100 - (address & 0xFF));
+        if (icm20649_write_bank_reg(ICM20649_MEM_BANK_SEL, address >> 8) < 0
+            || icm20649_write_bank_reg(ICM20649_MEM_START_ADDR, address & 0xFF) < 0)
+            return -1;
+
+        //the image is in flash, EasyDMA sends it from ram
+        tx_buf[0] = ICM20649_REG_ADDR(ICM20649_MEM_R_W);
+        memcpy(&tx_buf[1], p_data, chunk);
+        if (spi_write_and_read(&gyro_spi, SPI_GYRO_CS_PIN, tx_buf, 1 + chunk, rx_buf, 1 + chunk) < 0)
+            return -1;
+        address += chunk;
+        p_data += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+/*
+ * Reads the DMP memory in bursts of ICM20649_DMP_MEM_CHUNK. Leaves user bank 0 selected
+ * @param p_data - must be in RAM
+ * @return 0 if success otherwise -1
+ */
+int8_t icm20649_dmp_read_mem(uint16_t address, uint8_t * p_data, uint16_t length)
+{
+    static uint8_t read_addr = ICM20649_REG_ADDR(ICM20649_MEM_R_W) | 0x80; //in ram for EasyDMA
+    uint16_t chunk;
+
+    while (length > 0)
+    {
+        chunk = MIN(length, ICM20649_DMP_MEM_CHUNK);
+        chunk = MIN(chunk, 0x100 - (address & 0xFF));
+        if (icm20649_write_bank_reg(ICM20649_MEM_BANK_SEL, address >> 8) < 0
+            || icm20649_write_bank_reg(ICM20649_MEM_START_ADDR, address & 0xFF) < 0)
+            return -1;
+        if (spi_write_then_read(&gyro_spi, SPI_GYRO_CS_PIN, &read_addr, 1, p_data, chunk, false) < 0)
+            return -1;
+        address += chunk;
+        p_data += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+static int8_t icm20649_dmp_write_be(uint16_t address, uint32_t value, uint8_t length)
+{
+    uint8_t buf[4];
+
+    for (uint8_t i = 0; i < length; i++)
+        buf[i] = (uint8_t)(value >> (8*(length - 1 - i)));
+    return icm20649_dmp_write_mem(address, buf, length);
+}
+
+/*
+ * Loads the DMP image and checks it back, sets up the sensors at the rate
+ * the image integrates at (ICM20649_DMP_RATE_HZ, 2000dps and 30g) and its
+ * outputs: accel, gyro and game rotation vector packets at that rate, the
+ * gyro calibration at rest and the step detector. The DMP then runs on its
+ * own, icm20649_dmp_read_fifo drains its packets. After icm20649_default_init,
+ * instead of icm20649_fifo_init. Leaves user bank 0 selected
+ * @param p_image - the InvenSense DMP3 image, loaded at ICM20649_DMP_LOAD_ADDR
+ * @return 0 if success, -1 on spi error or -2 if the image did not read back
+ */
+int8_t icm20649_dmp_init(uint8_t const * p_image, uint16_t image_size, icm20649_dmp_t * p_dmp)
+{
+    uint8_t verify[ICM20649_DMP_MEM_CHUNK];
+    uint16_t address = ICM20649_DMP_LOAD_ADDR;
+    uint16_t chunk;
+    uint8_t pll;
+    uint32_t acc_g;
+    uint64_t gyro_sf;
+
+    memset(p_dmp, 0, sizeof(icm20649_dmp_t));
+    m_dmp_fill = 0;
+
+    //DMP stopped, out of low power while its memory is written
+    if (icm20649_write_bank_reg(ICM20649_USER_CTRL, 0x0) < 0
+        || icm20649_write_bank_reg(ICM20649_PWR_MGMT_1, ICM20649_PWR_MGMT_1_CLKSEL_AUTO) < 0)
+        return -1;
+    if (icm20649_dmp_write_mem(ICM20649_DMP_LOAD_ADDR, p_image, image_size) < 0)
+        return -1;
+    for (uint16_t pos = 0; pos < image_size; pos += chunk)
+    {
+        chunk = MIN(image_size - pos, ICM20649_DMP_MEM_CHUNK);
+        chunk = MIN(chunk, 0x100 - (address & 0xFF));
+        if (icm20649_dmp_read_mem(address, verify, chunk) < 0)
+            return -1;
+        if (memcmp(verify, &p_image[pos], chunk) != 0)
+        {
+            NRF_LOG_ERROR("icm20649 dmp image differs at 0x%x", address);
+            return -2;
+        }
+        address += chunk;
+    }
+
+    m_accel_div = ICM20649_DMP_SMPLRT_DIV;
+    if (icm20649_write_config(m_dmp_config, ARRAY_SIZE(m_dmp_config)) < 0)
+        return -1;
+
+    //the gyro scale of the integration follows the trim of the sample clock, as the eMD works it out
+    if (icm20649_read_bank_reg(ICM20649_TIMEBASE_CORRECTION_PLL, &pll) < 0)
+        return -1;
+    gyro_sf = 264446880937391ULL * (1 << 4) * (1 + ICM20649_DMP_SMPLRT_DIV) / (1270 + (int8_t) pll) / 100000ULL;
+    //30g is counted as 32g, 1024 counts per g
+    acc_g = 32768 / icm20649_accel_lsb_per_g();
+    if (icm20649_dmp_write_be(ICM20649_DMP_GYRO_SF, (uint32_t) MIN(gyro_sf, INT32_MAX), 4) < 0
+        || icm20649_dmp_write_be(ICM20649_DMP_ACC_SCALE, acc_g << 24, 4) < 0
+        || icm20649_dmp_write_be(ICM20649_DMP_ACC_SCALE2, 0x100000 / acc_g, 4) < 0
+        || icm20649_dmp_write_be(ICM20649_DMP_ODR_ACCEL, 0, 2) < 0
+        || icm20649_dmp_write_be(ICM20649_DMP_ODR_GYRO, 0, 2) < 0
+        || icm20649_dmp_write_be(ICM20649_DMP_ODR_QUAT6, 0, 2) < 0
+        || icm20649_dmp_write_be(ICM20649_DMP_DATA_OUT_CTL1, ICM20649_DMP_HEADERS, 2) < 0
+        || icm20649_dmp_write_be(ICM20649_DMP_DATA_OUT_CTL2, ICM20649_DMP_HDR2_GYRO_ACCURACY, 2) < 0
+        || icm20649_dmp_write_be(ICM20649_DMP_DATA_RDY_STATUS, 0x0003, 2) < 0
+        || icm20649_dmp_write_be(ICM20649_DMP_MOTION_EVENT_CTL,
+                                 ICM20649_DMP_MOTION_GYRO_CAL | ICM20649_DMP_MOTION_PEDOMETER, 2) < 0)
+        return -1;
+
+    if (icm20649_fifo_reset() < 0
+        || icm20649_write_bank_reg(ICM20649_USER_CTRL, ICM20649_USER_CTRL_DMP_RST_MSK) < 0
+        || icm20649_write_bank_reg(ICM20649_USER_CTRL, ICM20649_USER_CTRL_DMP_EN_MSK | ICM20649_USER_CTRL_FIFO_EN_MSK) < 0)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Drops the packets read so far and resets the fifo, the DMP starts its next packet at the front
+ * @return -2
+ */
+static int16_t icm20649_dmp_resync(icm20649_dmp_t * p_dmp)
+{
+    m_dmp_fill = 0;
+    p_dmp->resyncs++;
+    icm20649_fifo_reset();
+    return -2;
+}
+
+static int32_t icm20649_be32(uint8_t const * p)
+{
+    return (int32_t)(((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3]);
+}
+
+/*
+ * Drains the DMP packets from the fifo. A packet with a gyro sample gives one
+ * sample with the newest accel one, unpacked and unbiased as the fifo frames
+ * of icm20649_read_fifo, the other packets only update p_dmp. The fifo is
+ * read into a mirror and a packet split by the read waits there for the next
+ * one, the packets left once max_samples are taken too
+ * @param samples - receives the samples oldest first
+ * @return the number of samples, -1 on spi error or -2 if the fifo overflowed
+ *         or a packet was not understood (it is reset, packets are no longer aligned)
+ */
+int16_t icm20649_dmp_read_fifo(icm20649_data_t * samples, uint16_t max_samples, icm20649_dmp_t * p_dmp)
+{
+    static uint8_t read_addr = ICM20649_REG_ADDR(ICM20649_FIFO_R_W) | 0x80; //in ram for EasyDMA
+    uint8_t raw[ICM20649_DATA_LENGTH];
+    uint8_t const * p;
+    uint16_t header, header2;
+    uint16_t length, pos = 0;
+    uint16_t count;
+    uint16_t num_samples = 0;
+    uint8_t int_status;
+    int8_t ret;
+
+    ret = icm20649_read_bank_reg(ICM20649_INT_STATUS_2, &int_status);
+    if (ret < 0)
+        return ret;
+    if (int_status & 0x1F)
+        return icm20649_dmp_resync(p_dmp);
+
+    ret = icm20649_get_fifo_count(&count);
+    if (ret < 0)
+        return ret;
+    count = MIN(count, sizeof(m_dmp_mirror) - m_dmp_fill);
+    if (count > 0)
+    {
+        ret = spi_write_then_read(&gyro_spi, SPI_GYRO_CS_PIN, &read_addr, 1, &m_dmp_mirror[m_dmp_fill], count, true);
+        if (ret < 0)
+            return ret;
+        m_dmp_fill += count;
+    }
+
+    while (num_samples < max_samples && m_dmp_fill - pos >= 2)
+    {
+        p = &m_dmp_mirror[pos];
+        header = (p[0] << 8) | p[1];
+        if (header & ~(ICM20649_DMP_HEADERS | ICM20649_DMP_HDR_HEADER2))
+            return icm20649_dmp_resync(p_dmp);
+        length = 2 + ICM20649_DMP_FOOTER_LENGTH;
+        length += (header & ICM20649_DMP_HDR_HEADER2) ? 2 : 0;
+        length += (header & ICM20649_DMP_HDR_ACCEL) ? 6 : 0;
+        length += (header & ICM20649_DMP_HDR_GYRO) ? 12 : 0;
+        length += (header & ICM20649_DMP_HDR_QUAT6) ? 12 : 0;
+        length += (header & ICM20649_DMP_HDR_STEP) ? 4 : 0;
+        header2 = 0;
+        if ((header & ICM20649_DMP_HDR_HEADER2) && m_dmp_fill - pos >= 4)
+        {
+            header2 = (p[2] << 8) | p[3];
+            if (header2 & ~(ICM20649_DMP_HDR2_ACCEL_ACCURACY | ICM20649_DMP_HDR2_GYRO_ACCURACY))
+                return icm20649_dmp_resync(p_dmp);
+            length += (header2 & ICM20649_DMP_HDR2_ACCEL_ACCURACY) ? 2 : 0;
+            length += (header2 & ICM20649_DMP_HDR2_GYRO_ACCURACY) ? 2 : 0;
+        }
+        else if (header & ICM20649_DMP_HDR_HEADER2)
+        {
+            break;
+        }
+        if (m_dmp_fill - pos < length)
+            break;
+
+        p += (header & ICM20649_DMP_HDR_HEADER2) ? 4 : 2;
+        if (header & ICM20649_DMP_HDR_ACCEL)
+        {
+            memcpy(m_dmp_accel, p, sizeof(m_dmp_accel));
+            p += 6;
+        }
+        if (header & ICM20649_DMP_HDR_GYRO)
+        {
+            memcpy(raw, m_dmp_accel, sizeof(m_dmp_accel));
+            memcpy(&raw[6], p, 6);
+            icm20649_parse_gyro_accel_data(raw, &samples[num_samples++]);
+            for (uint8_t i = 0; i < 3; i++)
+                p_dmp->gyro_bias[i] = (int16_t)((p[6 + 2*i] << 8) | p[7 + 2*i]);
+            p += 12;
+        }
+        if (header & ICM20649_DMP_HDR_QUAT6)
+        {
+            for (uint8_t i = 0; i < 3; i++)
+                p_dmp->quat[i] = icm20649_be32(&p[4*i]);
+            p_dmp->quat_valid = true;
+            p += 12;
+        }
+        if (header & ICM20649_DMP_HDR_STEP)
+        {
+            p_dmp->steps++;
+            p += 4;
+        }
+        if (header2 & ICM20649_DMP_HDR2_ACCEL_ACCURACY)
+            p += 2;
+        if (header2 & ICM20649_DMP_HDR2_GYRO_ACCURACY)
+            p_dmp->accuracy = MIN(p[1], 3);
+        p_dmp->packets++;
+        pos += length;
+    }
+
+    m_dmp_fill -= pos;
+    memmove(m_dmp_mirror, &m_dmp_mirror[pos], m_dmp_fill);
+    return num_samples;
+}
+
+/*
+ * The newest game rotation vector as w x y z in Q14, rotating earth frame
+ * vectors into the sensor frame as the ahrs library does (the DMP gives the
+ * inverse rotation). The heading drifts, nothing observes it
+ * @return false if the DMP has not given one yet
+ */
+bool icm20649_dmp_quaternion_q14(icm20649_dmp_t const * p_dmp, int16_t q[4])
+{
+    uint64_t sum = 0;
+    uint32_t w_sq, w = 0;
+
+    if (!p_dmp->quat_valid)
+        return false;
+
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        sum += (uint64_t)((int64_t) p_dmp->quat[i] * p_dmp->quat[i]);
+        q[i + 1] = (int16_t) -(p_dmp->quat[i] >> 16);
+    }
+    //w^2 in Q28, its integer square root in Q14
+    w_sq = (sum >= (1ULL << 60)) ? 0 : (uint32_t)(((1ULL << 60) - sum) >> 32);
+    for (uint32_t bit = 1u << 30; bit > 0; bit >>= 2)
+    {
+        if (w_sq >= w + bit)
+        {
+            w_sq -= w + bit;
+            w = (w >> 1) + bit;
+        }
+        else
+        {
+            w >>= 1;
+        }
+    }
+    q[0] = (int16_t) MIN(w, INT16_MAX);
+
+    return true;
+}
+
+/*
+ * Scales raw counts by a fixed point scale, rounded and saturated to int16
+ */
+static int16_t icm20649_scale_counts(int16_t counts, int32_t scale)
+{
+    int32_t val = (counts * scale + (1L << (ICM20649_SCALE_SHIFT - 1))) >> ICM20649_SCALE_SHIFT;
+
+    if (val > INT16_MAX)
+        return INT16_MAX;
+    if (val < INT16_MIN)
+        return INT16_MIN;
+    return (int16_t) val;
+}
+
+/*
+ * Converts raw counts in place to mg and mrad/s using the configured full scale ranges.
+ * Integer only so it can run anywhere, but raw counts are cheaper to store and the
+ * conversion is best left until the data is offloaded. Rates above ~1877dps saturate
+ */
 void icm20649_convert_data(icm20649_data_t * data)
 {
-    float deg2rad = 3.1415/180.0;
+    int32_t accel_scale = m_accel_scale[m_accel_fs_sel];
+    int32_t gyro_scale = m_gyro_scale[m_gyro_fs_sel];
+
+    data->accel_x = icm20649_scale_counts(data->accel_x, accel_scale);
+    data->accel_y = icm20649_scale_counts(data->accel_y, accel_scale);
+    data->accel_z = icm20649_scale_counts(data->accel_z, accel_scale);
+    data->gyro_x = icm20649_scale_counts(data->gyro_x, gyro_scale);
+    data->gyro_y = icm20649_scale_counts(data->gyro_y, gyro_scale);
+    data->gyro_z = icm20649_scale_counts(data->gyro_z, gyro_scale);
+}
+
+
+/*
+ * Puts the icm20649 into sleep mode (a few uA, the registers keep their
+ * values) or back into the clock selected by icm20649_default_init.
+ * The gyro output is valid ICM20649_WAKEUP_MS after waking up
+ * @return 0 if success otherwise -1
+ */
+int8_t icm20649_set_sleep(bool sleep)
+{
+    uint8_t pwr_mgmt_1 = ICM20649_PWR_MGMT_1_CLKSEL_AUTO;
+
+    if (sleep)
+        pwr_mgmt_1 |= ICM20649_PWR_MGMT_1_SLEEP_MSK;
+
+    return icm20649_write_bank_reg(ICM20649_PWR_MGMT_1, pwr_mgmt_1);
+}
+
+/*
+ * Keeps only the accel running, duty cycled at ~51Hz in low power mode, or
+ * turns the gyro back on at the full rate. The gyro is by far the largest
+ * current of the icm20649, its output is valid about ICM20649_WAKEUP_MS after
+ * it is turned back on. The fifo keeps the frames of the accel in low power
+ * @return 0 if success otherwise -1
+ */
+int8_t icm20649_set_low_power(bool low_power)
+{
+    icm20649_config_t image[2];
+
+    if (low_power)
+        return icm20649_write_config(m_low_power_config, ARRAY_SIZE(m_low_power_config));
+
+    //ACCEL_SMPLRT_DIV_1 and 2 back to the rate in use
+    image[0].reg = ICM20649_ACCEL_SMPLRT_DIV_1;
+    image[0].length = 2;
+    image[0].data[0] = m_accel_div >> 8;
+    image[0].data[1] = m_accel_div & 0xFF;
+    image[1] = m_full_power_config;
+    return icm20649_write_config(image, ARRAY_SIZE(image));
+}
+
+/*
+ * Reads WHO_AM_I, the quick check of a warm boot. The bank cache starts
+ * unknown so the read selects bank 0 whatever the device was left in
+ * @return 0 if success otherwise -1 if the spi failed or -2 if the id is wrong
+ */
+int8_t icm20649_check_id(void)
+{
+    uint8_t who_am_i = 0;
+    int8_t ret;
+
+    ret = icm20649_read_bank_reg(ICM20649_WHO_AM_I, &who_am_i);
+    if (ret < 0)
+        return ret;
 
-    data->accel_x = ((float) data->accel_x/1024.0)*1000;
-    data->accel_y = ((float) data->accel_y/1024.0)*1000;
-    data->accel_z = ((float) data->accel_z/1024.0)*1000;
-    data->gyro_x = ((float) data->gyro_x / 32767.0) * 2000.0 * deg2rad *1000;
-    data->gyro_y = ((float) data->gyro_y / 32767.0) * 2000.0 * deg2rad *1000;
-    data->gyro_z = ((float) data->gyro_z / 32767.0) * 2000.0 * deg2rad *1000;
+    if (who_am_i != ICM20649_WHO_AM_I_VAL)
+    {
+        NRF_LOG_ERROR("icm20649 who_am_i 0x%x", who_am_i);
+        return -2;
+    }
+    return 0;
 }
 
+/*
+ * Queues the WHO_AM_I read of icm20649_check_id without blocking, e.g. to check
+ * the icm20649 while the other buses are checked. The bank is unknown so user
+ * bank 0 is selected first in the same batch, the callback only runs for the read
+ * @param p_read - descriptor, the id is in who_am_i once the callback ran
+ * @return 0 if queued otherwise -1
+ */
+int8_t icm20649_queue_id_read(icm20649_id_read_t * p_read, spi_xfer_callback_t callback, void * p_context)
+{
+    static uint8_t bank_sel[2] = {ICM20649_REG_BANK_SEL, 0}; //in ram for EasyDMA
+    static uint8_t read_addr = ICM20649_REG_ADDR(ICM20649_WHO_AM_I) | 0x80;
+
+    memset(p_read->xfers, 0, sizeof(p_read->xfers));
+    p_read->xfers[0].cs_pin = SPI_GYRO_CS_PIN;
+    p_read->xfers[0].p_tx_buf = bank_sel;
+    p_read->xfers[0].tx_length = sizeof(bank_sel);
+    p_read->xfers[1].cs_pin = SPI_GYRO_CS_PIN;
+    p_read->xfers[1].p_tx_buf = &read_addr;
+    p_read->xfers[1].tx_length = 1;
+    p_read->xfers[1].rx_skip = 1;
+    p_read->xfers[1].p_rx_buf = &p_read->who_am_i;
+    p_read->xfers[1].rx_length = 1;
+    p_read->xfers[1].callback = callback;
+    p_read->xfers[1].p_context = p_context;
+
+    if (spi_queue_batch(&gyro_spi, p_read->xfers, ARRAY_SIZE(p_read->xfers)) < 0)
+        return -1;
+
+    //anything queued after it runs with bank 0 selected
+    m_current_bank = ICM20649_REG_BANK(ICM20649_WHO_AM_I);
+    return 0;
+}
 
-void icm20649_test(void)
+/*
+ * Turns the self test of every accel and gyro axis on or off, the averaging
+ * in GYRO_CONFIG_2 and ACCEL_CONFIG_2 is kept. Each output moves by its
+ * response while it is on, ICM20649_SELF_TEST_SETTLE_MS after the switch
+ * @return 0 if success otherwise -1
+ */
+int8_t icm20649_self_test_set(bool enable)
+{
+    uint8_t gyro_config_2, accel_config_2;
+
+    if (icm20649_read_bank_reg(ICM20649_GYRO_CONFIG_2, &gyro_config_2) < 0
+        || icm20649_read_bank_reg(ICM20649_ACCEL_CONFIG_2, &accel_config_2) < 0)
+        return -1;
+
+    gyro_config_2 &= ~ICM20649_GYRO_CTEN_MSK;
+    accel_config_2 &= ~ICM20649_ACCEL_ST_EN_MSK;
+    if (enable)
+    {
+        gyro_config_2 |= ICM20649_GYRO_CTEN_MSK;
+        accel_config_2 |= ICM20649_ACCEL_ST_EN_MSK;
+    }
+    if (icm20649_write_bank_reg(ICM20649_GYRO_CONFIG_2, gyro_config_2) < 0
+        || icm20649_write_bank_reg(ICM20649_ACCEL_CONFIG_2, accel_config_2) < 0)
+        return -1;
+
+    return icm20649_select_bank(ICM20649_REG_BANK(ICM20649_ACCEL_XOUT_H));
+}
+
+/*
+ * Works out the self test response each axis should show at the ranges in
+ * use from the factory codes in user bank 1, as the InvenSense reference code
+ * does: 2620 * 1.01^(code - 1) counts at the smallest range, halved for each
+ * range step up. An axis with a code of 0 was not trimmed and is left at 0
+ * @param p_expected - counts of each axis, positive
+ * @return 0 if success otherwise -1
+ */
+int8_t icm20649_self_test_expected(icm20649_data_t * p_expected)
+{
+    static const icm20649_reg_t codes[6] = {
+        ICM20649_SELF_TEST_X_ACCEL, ICM20649_SELF_TEST_Y_ACCEL, ICM20649_SELF_TEST_Z_ACCEL,
+        ICM20649_SELF_TEST_X_GYRO, ICM20649_SELF_TEST_Y_GYRO, ICM20649_SELF_TEST_Z_GYRO,
+    };
+    int16_t * p_axis = &p_expected->accel_x;
+    uint32_t otp;
+    uint8_t code;
+
+    for (uint8_t i = 0; i < ARRAY_SIZE(codes); i++)
+    {
+        if (icm20649_read_bank_reg(codes[i], &code) < 0)
+            return -1;
+
+        //Q8, below 2^24 for every code
+        otp = (code == 0) ? 0 : (uint32_t) ICM20649_SELF_TEST_OTP_BASE << 8;
+        for (uint8_t j = 1; j < code; j++)
+            otp = (otp*101)/100;
+        otp >>= 8 + ((i < 3) ? m_accel_fs_sel : m_gyro_fs_sel);
+        p_axis[i] = (int16_t) MIN(otp, INT16_MAX);
+    }
+
+    return icm20649_select_bank(ICM20649_REG_BANK(ICM20649_ACCEL_XOUT_H));
+}
+
+/*
+ * Self test, reads WHO_AM_I and checks a write to PWR_MGMT_1
+ * @return 0 if success otherwise -1 if the spi failed or -2 if a value is wrong
+ */
+int8_t icm20649_test(void)
 {
     NRF_LOG_INFO(" ICM20649 TEST measurement mode");
 
     /*********TEST READ******************/
     uint8_t who_am_i = 0x0;
-    icm20649_read_reg(0x0, &who_am_i);
-    NRF_LOG_INFO("who_am_i = 0x%x (0xE1)", who_am_i );
-    if(who_am_i == 0xE1)
+    if (icm20649_read_bank_reg(ICM20649_WHO_AM_I, &who_am_i) < 0)
     {
-        NRF_LOG_INFO("READ SUCCESSFUL");
+        NRF_LOG_ERROR("SPI WRITE READ FAIL");
+        return -1;
     }
-    else
+    NRF_LOG_INFO("who_am_i = 0x%x (0xE1)", who_am_i );
+    if(who_am_i != ICM20649_WHO_AM_I_VAL)
     {
-        NRF_LOG_INFO("VAL ERROR"); 
+        NRF_LOG_ERROR("VAL ERROR");
+        return -2;
     }
+    NRF_LOG_INFO("READ SUCCESSFUL");
     /********************************************/
 
     
@@ -143,24 +1292,20 @@ void icm20649_test(void)
 
     uint8_t write_read;
     //PWR_MGMT 1 select best clk and disable everything else
-    icm20649_write_reg(0x06, 0x1);
-
-    icm20649_read_reg(0x06, &write_read);
-
-    NRF_LOG_INFO("write_read = 0x%x (0x1)", write_read );
-    if(write_read == 0x1)
+    if (icm20649_write_bank_reg(ICM20649_PWR_MGMT_1, ICM20649_PWR_MGMT_1_CLKSEL_AUTO) < 0
+        || icm20649_read_bank_reg(ICM20649_PWR_MGMT_1, &write_read) < 0)
     {
-        NRF_LOG_INFO("WRITE SUCCESSFUL");
+        NRF_LOG_ERROR("SPI WRITE READ FAIL");
+        return -1;
     }
-    else
+
+    NRF_LOG_INFO("write_read = 0x%x (0x1)", write_read );
+    if(write_read != 0x1)
     {
-        NRF_LOG_INFO("VAL ERROR"); 
-        while(1)
-        {
-          __WFE();
-        }
-        
+        NRF_LOG_ERROR("VAL ERROR");
+        return -2;
     }
+    NRF_LOG_INFO("WRITE SUCCESSFUL");
     /********************************************/
-
-}
\ No newline at end of file
+    return 0;
+}
@@ -10,7 +10,241 @@
 #include "nrf_log.h"
 
 
-#define GYRO_SPI_INSTANCE 2 /**< SPI instance index. */
+//GYRO_SPI_INSTANCE and the SPI_GYRO_ pins and profile come from the board header
+#ifndef GYRO_SPI_INSTANCE
+#error "GYRO_SPI_INSTANCE is not defined by the board header"
+#endif
+
+/*
+ * Typed register map. The user bank is kept above the 7 bit address so the
+ * driver can select the bank a register lives in before accessing it
+ */
+#define ICM20649_REG(bank, addr)    (((bank) << 8) | (addr))
+#define ICM20649_REG_BANK(reg)      ((uint8_t)((reg) >> 8))
+#define ICM20649_REG_ADDR(reg)      ((uint8_t)((reg) & 0x7F))
+
+#define ICM20649_REG_BANK_SEL   0x7F /**< same address in every user bank */
+#define ICM20649_BANK_UNKNOWN   0xFF /**< bank cache is invalid, e.g. before init or after a device reset */
+
+typedef enum
+{
+    //user bank 0
+    ICM20649_WHO_AM_I           = ICM20649_REG(0, 0x00),
+    ICM20649_USER_CTRL          = ICM20649_REG(0, 0x03),
+    ICM20649_LP_CONFIG          = ICM20649_REG(0, 0x05),
+    ICM20649_PWR_MGMT_1         = ICM20649_REG(0, 0x06),
+    ICM20649_PWR_MGMT_2         = ICM20649_REG(0, 0x07),
+    ICM20649_INT_PIN_CFG        = ICM20649_REG(0, 0x0F),
+    ICM20649_INT_ENABLE         = ICM20649_REG(0, 0x10),
+    ICM20649_INT_ENABLE_1       = ICM20649_REG(0, 0x11),
+    ICM20649_INT_ENABLE_2       = ICM20649_REG(0, 0x12),
+    ICM20649_INT_ENABLE_3       = ICM20649_REG(0, 0x13),
+    ICM20649_INT_STATUS         = ICM20649_REG(0, 0x19),
+    ICM20649_INT_STATUS_1       = ICM20649_REG(0, 0x1A),
+    ICM20649_INT_STATUS_2       = ICM20649_REG(0, 0x1B), /**< FIFO overflow, cleared on read */
+    ICM20649_INT_STATUS_3       = ICM20649_REG(0, 0x1C),
+    ICM20649_ACCEL_XOUT_H       = ICM20649_REG(0, 0x2D), /**< first of the accel and gyro data registers */
+    ICM20649_GYRO_XOUT_H        = ICM20649_REG(0, 0x33),
+    ICM20649_TEMP_OUT_H         = ICM20649_REG(0, 0x39),
+    ICM20649_FIFO_EN_1          = ICM20649_REG(0, 0x66),
+    ICM20649_FIFO_EN_2          = ICM20649_REG(0, 0x67),
+    ICM20649_FIFO_RST           = ICM20649_REG(0, 0x68),
+    ICM20649_FIFO_MODE          = ICM20649_REG(0, 0x69),
+    ICM20649_FIFO_COUNTH        = ICM20649_REG(0, 0x70),
+    ICM20649_FIFO_COUNTL        = ICM20649_REG(0, 0x71),
+    ICM20649_FIFO_R_W           = ICM20649_REG(0, 0x72),
+    ICM20649_DATA_RDY_STATUS    = ICM20649_REG(0, 0x74),
+    ICM20649_FIFO_CFG           = ICM20649_REG(0, 0x76),
+    ICM20649_MEM_START_ADDR     = ICM20649_REG(0, 0x7C), /**< DMP memory address within the bank of MEM_BANK_SEL */
+    ICM20649_MEM_R_W            = ICM20649_REG(0, 0x7D), /**< DMP memory data, the address increments */
+    ICM20649_MEM_BANK_SEL       = ICM20649_REG(0, 0x7E), /**< 256 byte bank of the DMP memory */
+
+    //user bank 1
+    ICM20649_SELF_TEST_X_GYRO   = ICM20649_REG(1, 0x02),
+    ICM20649_SELF_TEST_Y_GYRO   = ICM20649_REG(1, 0x03),
+    ICM20649_SELF_TEST_Z_GYRO   = ICM20649_REG(1, 0x04),
+    ICM20649_SELF_TEST_X_ACCEL  = ICM20649_REG(1, 0x0E),
+    ICM20649_SELF_TEST_Y_ACCEL  = ICM20649_REG(1, 0x0F),
+    ICM20649_SELF_TEST_Z_ACCEL  = ICM20649_REG(1, 0x10),
+    ICM20649_XA_OFFS_H          = ICM20649_REG(1, 0x14),
+    ICM20649_YA_OFFS_H          = ICM20649_REG(1, 0x17),
+    ICM20649_ZA_OFFS_H          = ICM20649_REG(1, 0x1A),
+    ICM20649_TIMEBASE_CORRECTION_PLL = ICM20649_REG(1, 0x28),
+
+    //user bank 2
+    ICM20649_GYRO_SMPLRT_DIV    = ICM20649_REG(2, 0x00),
+    ICM20649_GYRO_CONFIG_1      = ICM20649_REG(2, 0x01),
+    ICM20649_GYRO_CONFIG_2      = ICM20649_REG(2, 0x02),
+    ICM20649_XG_OFFS_USRH       = ICM20649_REG(2, 0x03),
+    ICM20649_YG_OFFS_USRH       = ICM20649_REG(2, 0x05),
+    ICM20649_ZG_OFFS_USRH       = ICM20649_REG(2, 0x07),
+    ICM20649_ODR_ALIGN_EN       = ICM20649_REG(2, 0x09),
+    ICM20649_ACCEL_SMPLRT_DIV_1 = ICM20649_REG(2, 0x10),
+    ICM20649_ACCEL_SMPLRT_DIV_2 = ICM20649_REG(2, 0x11),
+    ICM20649_ACCEL_INTEL_CTRL   = ICM20649_REG(2, 0x12),
+    ICM20649_ACCEL_WOM_THR      = ICM20649_REG(2, 0x13),
+    ICM20649_ACCEL_CONFIG       = ICM20649_REG(2, 0x14),
+    ICM20649_ACCEL_CONFIG_2     = ICM20649_REG(2, 0x15),
+    ICM20649_PRGM_START_ADDRH   = ICM20649_REG(2, 0x50), /**< DMP program start, then PRGM_START_ADDRL */
+    ICM20649_FSYNC_CONFIG       = ICM20649_REG(2, 0x52),
+    ICM20649_TEMP_CONFIG        = ICM20649_REG(2, 0x53),
+    ICM20649_MOD_CTRL_USR       = ICM20649_REG(2, 0x54),
+
+    //user bank 3
+    ICM20649_I2C_MST_ODR_CONFIG = ICM20649_REG(3, 0x00),
+    ICM20649_I2C_MST_CTRL       = ICM20649_REG(3, 0x01),
+    ICM20649_I2C_MST_DELAY_CTRL = ICM20649_REG(3, 0x02),
+    ICM20649_I2C_SLV0_ADDR      = ICM20649_REG(3, 0x03),
+    ICM20649_I2C_SLV0_REG       = ICM20649_REG(3, 0x04),
+    ICM20649_I2C_SLV0_CTRL      = ICM20649_REG(3, 0x05),
+    ICM20649_I2C_SLV0_DO        = ICM20649_REG(3, 0x06),
+} icm20649_reg_t;
+
+#define ICM20649_DATA_LENGTH    12   /**< accel xyz + gyro xyz, 2 bytes each, a fifo frame */
+#define ICM20649_REG_DATA_LENGTH 14  /**< the data registers read in one burst, TEMP_OUT follows the gyro */
+#define ICM20649_WHO_AM_I_VAL   0xE1
+
+#define ICM20649_PWR_MGMT_1_DEVICE_RESET_MSK  0x80
+#define ICM20649_PWR_MGMT_1_SLEEP_MSK         0x40
+#define ICM20649_PWR_MGMT_1_LP_EN_MSK         0x20
+#define ICM20649_PWR_MGMT_1_CLKSEL_AUTO       0x01 /**< best available clock */
+#define ICM20649_INT_PIN_CFG_LATCH_MSK        0x20 /**< INT1 held until INT_STATUS_1 is read */
+#define ICM20649_INT_RAW_DATA_RDY_MSK         0x01 /**< RAW_DATA_0_RDY of INT_ENABLE_1 and INT_STATUS_1 */
+#define ICM20649_PWR_MGMT_2_DISABLE_GYRO      0x07 /**< gyro x/y/z off, the accel stays on */
+#define ICM20649_LP_CONFIG_ACCEL_CYCLE        0x20 /**< accel duty cycled at its sample rate */
+#define ICM20649_LP_ACCEL_SMPLRT_DIV          21   /**< 1125Hz/(1+21), ~51Hz accel duty cycle of icm20649_set_low_power */
+#define ICM20649_WAKEUP_MS          35 /**< gyro start up time after leaving sleep */
+#define ICM20649_FS_SEL(config)     (((config) >> ICM20649_FS_SEL_POS) & 0x3) /**< FS_SEL field of ACCEL_CONFIG and GYRO_CONFIG_1 */
+/* GYRO_CONFIG_1 and ACCEL_CONFIG share their layout: DLPFCFG, FS_SEL and FCHOICE, which enables the DLPF */
+#define ICM20649_DLPFCFG_POS        3
+#define ICM20649_FS_SEL_POS         1
+#define ICM20649_FCHOICE_MSK        0x01
+#define ICM20649_FS_VAL(fs)         ((uint8_t)(((fs) & 0x3) << ICM20649_FS_SEL_POS)) /**< DLPF bypassed */
+#define ICM20649_DLPF_FS_VAL(dlpf, fs) ((uint8_t)((((dlpf) & 0x7) << ICM20649_DLPFCFG_POS) | ICM20649_FS_VAL(fs) | \
+                                                  ICM20649_FCHOICE_MSK))
+#define ICM20649_GYRO_CTEN_MSK      0x38 /**< X/Y/ZGYRO_CTEN of GYRO_CONFIG_2, the gyro self test */
+#define ICM20649_ACCEL_ST_EN_MSK    0x1C /**< AX/AY/AZ_ST_EN_REG of ACCEL_CONFIG_2, the accel self test */
+#define ICM20649_SELF_TEST_OTP_BASE 2620 /**< counts of the self test response of code 1 at the smallest ranges */
+#define ICM20649_SELF_TEST_SETTLE_MS 20  /**< the outputs move to the response after the self test is switched */
+#define ICM20649_FIFO_RST_ALL       0x1F /**< FIFO_RST of every fifo, held until it is written back to 0 */
+#define ICM20649_SCALE_SHIFT        14 /**< fraction bits of the fixed point conversion scales */
+#define ICM20649_USER_CTRL_FIFO_EN_MSK  0x40
+#define ICM20649_FIFO_EN_2_ACCEL_GYRO   0x1E /**< accel and gyro x/y/z, one ICM20649_DATA_LENGTH frame per sample */
+#define ICM20649_FIFO_SAMPLE_RATE_HZ    1125 /**< accel and gyro rate set by icm20649_fifo_init, the fastest frames of icm20649_fifo_init_rates */
+
+/* Digital motion processor. The InvenSense DMP3 image is licensed and not in
+ * the repo, the board code links it in and icm20649_dmp_init loads it. The DMP
+ * then fuses the accel and gyro into a game rotation vector and writes it to
+ * the fifo with the accel and gyro samples, as packets of a 2 byte header whose
+ * bits give the data that follows in their order, then a 2 byte footer.
+ * Addresses and bits as in the InvenSense eMD for the DMP3 image */
+#define ICM20649_USER_CTRL_DMP_EN_MSK   0x80
+#define ICM20649_USER_CTRL_DMP_RST_MSK  0x08
+#define ICM20649_DMP_LOAD_ADDR      0x90   /**< DMP memory the image is loaded at */
+#define ICM20649_DMP_START_ADDR     0x1000 /**< PRGM_START_ADDR of the image */
+#define ICM20649_DMP_MEM_CHUNK      16     /**< bytes per MEM_R_W burst, a burst never crosses a bank */
+#define ICM20649_DMP_SMPLRT_DIV     4      /**< accel and gyro at 1125Hz/(1+4), the rate the image integrates at */
+#define ICM20649_DMP_RATE_HZ        225
+#define ICM20649_DMP_DATA_OUT_CTL1  (4*16)      /**< header bits the DMP writes, 2 bytes */
+#define ICM20649_DMP_DATA_OUT_CTL2  (4*16 + 2)  /**< header2 bits the DMP writes, 2 bytes */
+#define ICM20649_DMP_MOTION_EVENT_CTL (4*16 + 14)
+#define ICM20649_DMP_DATA_RDY_STATUS (8*16 + 10) /**< sensors the DMP waits for, 2 bytes */
+#define ICM20649_DMP_ODR_QUAT6      (10*16 + 12) /**< divider of each output from ICM20649_DMP_RATE_HZ, 2 bytes */
+#define ICM20649_DMP_ODR_GYRO       (11*16 + 10)
+#define ICM20649_DMP_ODR_ACCEL      (11*16 + 14)
+#define ICM20649_DMP_GYRO_SF        (19*16)     /**< gyro integration scale, 4 bytes */
+#define ICM20649_DMP_ACC_SCALE      (30*16)     /**< accel full scale, 4 bytes */
+#define ICM20649_DMP_ACC_SCALE2     (79*16 + 4)
+#define ICM20649_DMP_HDR_ACCEL      0x8000 /**< 6 bytes, counts as in the data registers */
+#define ICM20649_DMP_HDR_GYRO       0x4000 /**< 6 bytes of counts then 6 of the bias the DMP removed */
+#define ICM20649_DMP_HDR_QUAT6      0x0800 /**< 12 bytes, x y z in Q30, w makes it a unit quaternion */
+#define ICM20649_DMP_HDR_STEP       0x0010 /**< 4 bytes, DMP time of a step */
+#define ICM20649_DMP_HDR_HEADER2    0x0008 /**< a 2 byte header2 follows the header */
+#define ICM20649_DMP_HDR2_ACCEL_ACCURACY 0x4000 /**< 2 bytes, after the data of the header */
+#define ICM20649_DMP_HDR2_GYRO_ACCURACY  0x2000 /**< 2 bytes */
+#define ICM20649_DMP_HEADERS        (ICM20649_DMP_HDR_ACCEL | ICM20649_DMP_HDR_GYRO | ICM20649_DMP_HDR_QUAT6 | \
+                                     ICM20649_DMP_HDR_STEP)
+#define ICM20649_DMP_FOOTER_LENGTH  2
+#define ICM20649_DMP_PACKET_MAX     (2 + 2 + 6 + 12 + 12 + 4 + 2 + 2 + ICM20649_DMP_FOOTER_LENGTH)
+#define ICM20649_DMP_MOTION_GYRO_CAL 0x0100 /**< the DMP tracks the gyro bias at rest */
+#define ICM20649_DMP_MOTION_PEDOMETER 0x0002
+
+#define ICM20649_TEMP_UNKNOWN       INT16_MIN /**< no TEMP_OUT read yet, or a bias kept without its temperature */
+#define ICM20649_TEMP_ROOM_CC       2100 /**< 0.01 C at TEMP_OUT 0 */
+#define ICM20649_TEMP_Q16_CC        19629 /**< 0.01 C per TEMP_OUT count in Q16, 333.87 counts per C */
+#define ICM20649_TEMP_COMP_STEP_CC  10 /**< change of temperature that rescales the bias in use */
+
+#define ICM20649_BASE_RATE_HZ       1125 /**< internal rate the sample rate dividers count down from */
+#define ICM20649_GYRO_BYPASS_RATE_HZ  9000 /**< gyro output rate with its DLPF bypassed, the divider is ignored */
+#define ICM20649_ACCEL_BYPASS_RATE_HZ 4500 /**< accel output rate with its DLPF bypassed, the divider is ignored */
+#define ICM20649_DLPF_BYPASS        0xFF /**< icm20649_rate_config_t dlpf value, FCHOICE cleared */
+#define ICM20649_DLPF_MAX           7    /**< DLPFCFG 0 is the widest filter (~200Hz), 7 the narrowest */
+#define ICM20649_ACCEL_DIV_MAX      0x0FFF /**< ACCEL_SMPLRT_DIV is 12 bits */
+
+#define ICM20649_CONFIG_MAX_LENGTH  4 /**< registers in one icm20649_config_t */
+#define ICM20649_CONFIG_MAX_COUNT   6 /**< icm20649_config_t per icm20649_write_config */
+
+/* Run of contiguous registers in one user bank, written in one burst by icm20649_write_config.
+ * Static const tables of them are the configuration images of the init functions */
+typedef struct {
+    icm20649_reg_t reg;         /**< first register of the run */
+    uint8_t length;
+    uint8_t data[ICM20649_CONFIG_MAX_LENGTH];
+} icm20649_config_t;
+
+/* Full scale of GYRO_CONFIG_1 and ACCEL_CONFIG, FS_SEL values */
+typedef enum {
+    ICM20649_GYRO_FS_500DPS = 0,
+    ICM20649_GYRO_FS_1000DPS,
+    ICM20649_GYRO_FS_2000DPS,
+    ICM20649_GYRO_FS_4000DPS
+} icm20649_gyro_fs_t;
+
+typedef enum {
+    ICM20649_ACCEL_FS_4G = 0,
+    ICM20649_ACCEL_FS_8G,
+    ICM20649_ACCEL_FS_16G,
+    ICM20649_ACCEL_FS_30G
+} icm20649_accel_fs_t;
+
+/* Rate, low pass and range of the gyro and the accel, written by icm20649_set_rate_config.
+ * With a DLPF on each sensor runs at ICM20649_BASE_RATE_HZ/(1 + div), bypassed it runs
+ * unfiltered at its bypass rate whatever the divider */
+typedef struct {
+    uint8_t gyro_div;               /**< GYRO_SMPLRT_DIV */
+    uint8_t gyro_dlpf;              /**< GYRO_DLPFCFG up to ICM20649_DLPF_MAX or ICM20649_DLPF_BYPASS */
+    icm20649_gyro_fs_t gyro_fs;
+    uint16_t accel_div;             /**< ACCEL_SMPLRT_DIV, up to ICM20649_ACCEL_DIV_MAX */
+    uint8_t accel_dlpf;             /**< ACCEL_DLPFCFG up to ICM20649_DLPF_MAX or ICM20649_DLPF_BYPASS */
+    icm20649_accel_fs_t accel_fs;
+} icm20649_rate_config_t;
+
+/* Drift of the gyro bias with the die temperature, e.g. inside a helmet over
+ * a game, fitted per device by the calibration: the bias of icm20649_set_bias
+ * holds at ref_temp_cc and moves by gyro_slope for every degree from it */
+typedef struct {
+    int16_t ref_temp_cc;            /**< 0.01 C, ICM20649_TEMP_UNKNOWN leaves the bias as set */
+    int16_t gyro_slope[3];          /**< 0.001 counts of 2000dps per C, x y z */
+} icm20649_temp_comp_t;
+
+/* What icm20649_default_init writes, and what icm20649_fifo_init adds to it */
+#define ICM20649_RATE_CONFIG_DEFAULT {                                                    \
+    .gyro_div = 0, .gyro_dlpf = ICM20649_DLPF_BYPASS, .gyro_fs = ICM20649_GYRO_FS_2000DPS,    \
+    .accel_div = 0, .accel_dlpf = ICM20649_DLPF_BYPASS, .accel_fs = ICM20649_ACCEL_FS_30G }
+#define ICM20649_RATE_CONFIG_FIFO {                                                       \
+    .gyro_div = 0, .gyro_dlpf = 0, .gyro_fs = ICM20649_GYRO_FS_2000DPS,                       \
+    .accel_div = 0, .accel_dlpf = 0, .accel_fs = ICM20649_ACCEL_FS_30G }
+
+/* What icm20649_dmp_read_fifo keeps from the DMP packets between reads */
+typedef struct {
+    int32_t quat[3];                /**< x y z of the newest game rotation vector in Q30, sensor frame */
+    bool quat_valid;                /**< a quaternion was read since icm20649_dmp_init */
+    int16_t gyro_bias[3];           /**< bias the DMP removes from the gyro, its own estimate */
+    uint8_t accuracy;               /**< 0 to 3 of the gyro calibration */
+    uint32_t steps;                 /**< steps detected */
+    uint32_t packets;
+    uint32_t resyncs;               /**< fifo resets after a packet of unknown layout or an overflow */
+} icm20649_dmp_t;
 
 extern const nrf_drv_spi_t gyro_spi;
 
@@ -25,12 +259,54 @@ typedef struct{
     int16_t gyro_z;
 } icm20649_data_t;
 
+/* A queued WHO_AM_I read, must stay valid until its callback */
+typedef struct {
+    spi_xfer_t xfers[2];            /**< REG_BANK_SEL to bank 0, then WHO_AM_I */
+    uint8_t who_am_i;
+} icm20649_id_read_t;
+
 void icm20649_default_init(void);
 int8_t icm20649_write_reg(uint8_t address, uint8_t data);
 int8_t icm20649_read_reg(uint8_t address, uint8_t * reg_data);
+int8_t icm20649_select_bank(uint8_t bank);
+int8_t icm20649_write_bank_reg(icm20649_reg_t reg, uint8_t data);
+int8_t icm20649_read_bank_reg(icm20649_reg_t reg, uint8_t * reg_data);
+int8_t icm20649_write_config(icm20649_config_t const * config, uint8_t count);
 int8_t icm20649_multibyte_read_reg( uint8_t reg_addr, uint8_t* reg_data, uint8_t num_bytes);
 void icm20649_read_gyro_accel_data(icm20649_data_t *icm20649_data);
+int8_t icm20649_read_fresh_gyro_accel_data(icm20649_data_t *icm20649_data);
+int8_t icm20649_queue_read_gyro_accel_data(spi_xfer_t * p_xfer, uint8_t * p_rx_buf, spi_xfer_callback_t callback, void * p_context);
+void icm20649_parse_gyro_accel_data(uint8_t const * p_raw, icm20649_data_t * icm20649_data);
+void icm20649_parse_gyro_accel_temp_data(uint8_t const * p_raw, icm20649_data_t * icm20649_data);
 void icm20649_convert_data(icm20649_data_t * data);
-void icm20649_test(void);
+void icm20649_set_bias(icm20649_data_t const * bias);
+void icm20649_get_bias(icm20649_data_t * bias);
+void icm20649_set_temp_comp(icm20649_temp_comp_t const * comp);
+void icm20649_get_temp_comp(icm20649_temp_comp_t * comp);
+int16_t icm20649_temp_comp_bias(icm20649_temp_comp_t const * comp, uint8_t axis, int16_t temp_cc);
+int16_t icm20649_temp_cc(void);
+int16_t icm20649_accel_lsb_per_g(void);
+uint16_t icm20649_gyro_fs_dps(void);
+int8_t icm20649_set_rate_config(icm20649_rate_config_t const * config);
+uint16_t icm20649_gyro_rate_hz(icm20649_rate_config_t const * config);
+uint16_t icm20649_accel_rate_hz(icm20649_rate_config_t const * config);
+void icm20649_fifo_init(void);
+int8_t icm20649_fifo_init_rates(icm20649_rate_config_t const * config);
+uint16_t icm20649_fifo_rate_hz(icm20649_rate_config_t const * config);
+int8_t icm20649_fifo_reset(void);
+int8_t icm20649_get_fifo_count(uint16_t * p_count);
+int16_t icm20649_read_fifo(icm20649_data_t * samples, uint16_t max_samples);
+int8_t icm20649_dmp_write_mem(uint16_t address, uint8_t const * p_data, uint16_t length);
+int8_t icm20649_dmp_read_mem(uint16_t address, uint8_t * p_data, uint16_t length);
+int8_t icm20649_dmp_init(uint8_t const * p_image, uint16_t image_size, icm20649_dmp_t * p_dmp);
+int16_t icm20649_dmp_read_fifo(icm20649_data_t * samples, uint16_t max_samples, icm20649_dmp_t * p_dmp);
+bool icm20649_dmp_quaternion_q14(icm20649_dmp_t const * p_dmp, int16_t q[4]);
+int8_t icm20649_set_sleep(bool sleep);
+int8_t icm20649_set_low_power(bool low_power);
+int8_t icm20649_check_id(void);
+int8_t icm20649_queue_id_read(icm20649_id_read_t * p_read, spi_xfer_callback_t callback, void * p_context);
+int8_t icm20649_self_test_set(bool enable);
+int8_t icm20649_self_test_expected(icm20649_data_t * p_expected);
+int8_t icm20649_test(void);
 
 #endif /* ICM20649_H */
@@ -1,11 +1,56 @@
 //-------------------------------------------
 // Title: mt25ql256aba.c
 // Author: UBC Capstone Team 48 - 2019/2020
-// Description: This is verison of the flash driver is depreciated and is used 
-// for running older breadboard prototype test programs. Please see mt25ql256aba_pcb
+// Description: mt25ql256aba flash driver for every board, the spi instance,
+// pins and bus profile come from the board header (board_config)
+// This requires setting up spi_instance_init in your program's main file
 //-------------------------------------------
 #include "mt25ql256aba.h"
-#include "spi_driver.h"
+#include "energy_profiler.h"
+
+const nrf_drv_spi_t flash_spi = NRF_DRV_SPI_INSTANCE(FLASH_SPI_INSTANCE);
+
+nrf_drv_spi_config_t const flash_spi_config = {
+        .ss_pin       = SPI_FLASH_CS_PIN, //driven by spi_driver only, so a full page program can span several transfers
+        .miso_pin     = SPI_FLASH_MISO_PIN,
+        .mosi_pin     = SPI_FLASH_MOSI_PIN,
+        .sck_pin      = SPI_FLASH_SCK_PIN,
+        .irq_priority = SPI_IRQ_PRIORITY,
+        .orc          = 0xFF,
+        .frequency    = SPI_FLASH_CONFIG_FREQ,
+        .mode         = NRF_DRV_SPI_MODE_0,
+        .bit_order    = NRF_DRV_SPI_BIT_ORDER_MSB_FIRST,
+    };
+
+static uint8_t m_write_buf[1 + MT25QL256ABA_4BYTE_ADDRESS_SIZE + MT25QL256ABA_PAGE_SIZE]; //in ram for EasyDMA, not on the stack
+static energy_state_t m_suspended_state = ENERGY_STATE_SLEEP; //the program or erase to count again on resume, sleep for none
+
+static int8_t mt25ql256aba_enter_4byte_address_mode(void);
+
+//the mt25ql256aba with its 4-byte commands until mt25ql256aba_detect finds another part
+static mt25ql256aba_part_t m_part = {
+    .ids = {MT25QL256ABA_MANUFACTURER_ID, MT25QL256ABA_MEMORY_TYPE, MT25QL256ABA_MEMORY_CAPACITY},
+    .size = MT25QL256ABA_FLASH_SIZE,
+    .page_size = MT25QL256ABA_PAGE_SIZE,
+    .read_cmd = MT25QL256ABA_4BYTE_FAST_READ,
+    .program_cmd = MT25QL256ABA_4BYTE_PAGE_PROGRAM,
+    .erase_cmd = {MT25QL256ABA_4BYTE_ERASE_4KB_SUBSECTOR, MT25QL256ABA_4BYTE_ERASE_32KB_SUBSECTOR,
+                  MT25QL256ABA_4BYTE_SECTOR_ERASE},
+    .enter_4byte = 0,
+    .flag_status = true,
+    .suspend_cmd = MT25QL256ABA_PROGRAM_ERASE_SUSPEND,
+    .resume_cmd = MT25QL256ABA_PROGRAM_ERASE_RESUME,
+};
+
+/*
+ * The flash is busy for the energy profiler from a program or erase command
+ * until a status read sees it ready
+ */
+static void mt25ql256aba_ready(void)
+{
+    ENERGY_EXIT(ENERGY_STATE_FLASH_PROGRAM);
+    ENERGY_EXIT(ENERGY_STATE_FLASH_ERASE);
+}
 
 /*
  * Read from an mt25ql256aba register
@@ -14,44 +59,26 @@
  * @param address_size  - the size of the address in bytes (either 
  *                          0 for no address or
  *                          3 or 4 bytes address mode)
- * @param reg_data      - a pointer to store the register data
- * @param rx_num_bytes  - max number is 251 for 3 byte address mode
- *                          or 250 for 4 byte address mode
+ * @param reg_data      - a pointer to store the register data, read in place
+ * @param rx_num_bytes  - the number of bytes to read
  * @return 0            - if success otherwise -1
  */
-int8_t mt25ql256aba_read_op(uint8_t command_code, uint8_t* address, uint8_t address_size, uint8_t* reg_data, uint8_t rx_num_bytes) 
+int8_t mt25ql256aba_read_op(uint8_t command_code, uint8_t* address, uint8_t address_size, uint8_t* reg_data, uint16_t rx_num_bytes) 
 {
     uint8_t DQ0[5];
-    uint8_t DQ1[257]; 
-    int8_t ret = 0;
 
-    if(1 + address_size + rx_num_bytes > 255)
-        return -1;
     if(address_size == 0 || address_size == 3 || address_size == 4)
     {
         DQ0[0] = command_code;
         memcpy(DQ0 + 1, address, address_size);
 
-        memset(DQ1, 0x00, rx_num_bytes + address_size + 1);
-
-        //Include a starting byte while DQ0 to transfers to slave 
-        ret = flash_spi_write_and_read(SPI_MT25QL256ABA_CS_PIN,
-                                       DQ0,
-                                       (1 + address_size),
-                                       DQ1,
-                                       (rx_num_bytes + 1 + address_size)
-                                       );
-        if (ret < 0)
-            return ret;
-    
-        memcpy(reg_data, (DQ1 + 1 + address_size), rx_num_bytes);
-    }
-    else
-    {
-        return -2;
+        //reg_data only receives the bytes after the command and address
+        return spi_write_then_read(&flash_spi, SPI_FLASH_CS_PIN,
+                                   DQ0, (1 + address_size),
+                                   reg_data, rx_num_bytes, true);
     }
 
-    return ret;
+    return -2;
 }
 
 /*
@@ -62,18 +89,16 @@ int8_t mt25ql256aba_read_op(uint8_t command_code, uint8_t* address, uint8_t addr
  *                          0 for no address or
  *                          3 or 4 bytes address mode)
  * @param data          - pointer to data to write to
- * @param data_size     - the size of data in bytes (MAX 251 bytes 
- *                         for 3 byte address mode or MAX 250 
- *                         bytes for 4)
+ * @param data_size     - the size of data in bytes (MAX MT25QL256ABA_PAGE_SIZE)
  * @return 0            - if success otherwise -1
  */
-int8_t mt25ql256aba_write_op(uint8_t command_code, uint8_t* address, uint8_t address_size, uint8_t* data, uint8_t data_size)
+int8_t mt25ql256aba_write_op(uint8_t command_code, uint8_t* address, uint8_t address_size, uint8_t const* data, uint16_t data_size)
 {
-    uint8_t DQ0[256];
+    uint8_t* DQ0 = m_write_buf;
     int8_t ret = 0;
     //uint8_t DQ1; //output contains no valuable data
 
-    if((1 + address_size + data_size) > 255)
+    if(data_size > MT25QL256ABA_PAGE_SIZE)
         return -1;
     if(address_size == 0 || address_size == 3 || address_size == 4)
     {
@@ -81,8 +106,16 @@ int8_t mt25ql256aba_write_op(uint8_t command_code, uint8_t* address, uint8_t add
         memcpy((DQ0 + 1), address, address_size);
         memcpy((DQ0 + 1 + address_size), data, data_size);
 
-        ret = flash_spi_write_and_read(SPI_MT25QL256ABA_CS_PIN, DQ0,
-                 1 + address_size + data_size, NULL, 0);
+        //commands without data stay on the config frequency,
+        //a full page is longer than one EasyDMA transfer, cs stays low across the chunks
+        if (data_size > 0)
+            ret = spi_burst_read(&flash_spi, SPI_FLASH_CS_PIN, DQ0,
+                                       (1 + address_size + data_size),
+                                       NULL, 0);
+        else
+            ret = spi_write_and_read(&flash_spi, SPI_FLASH_CS_PIN, DQ0,
+                                       (1 + address_size),
+                                       NULL, 0);
     }   
     else{
         return -2;
@@ -106,3 +139,780 @@ int8_t mt25ql256aba_write_disable(void)
 
     return ret;
 }
+
+void mt25ql256aba_read_flag_reg(flag_reg_t *flag_reg)
+{
+    uint8_t flag_register;
+    mt25ql256aba_read_op(MT25QL256ABA_READ_FLAG_STATUS_REGISTER, NULL, 0, &flag_register, sizeof(flag_register));
+    flag_reg->program_erase_controller = flag_register >> 7;
+    flag_reg->erase_suspend = (flag_register >> 6) & 0x1;
+    flag_reg->program = (flag_register >> 4) & 0x1; 
+    flag_reg->program_suspend = (flag_register >> 2) & 0x1;
+    flag_reg->byte_addressing = flag_register & 0x1;
+    flag_reg->erase = (flag_register >> 5) & 0x1; 
+    flag_reg->protection = (flag_register >> 1) & 0x1;
+    /*
+    NRF_LOG_INFO("");
+    NRF_LOG_INFO("CHECKING FLAG REG.....");
+    NRF_LOG_INFO("program_erase controller %d, erase %d, program %d", 
+                    program_erase_controller, erase, program);
+    NRF_LOG_INFO("protection %d, byte %d",protection, byte_addressing);
+    */
+}
+
+void mt25ql256aba_check_write_in_progress_flag(void)
+{
+    uint8_t flash_ready; 
+
+    do{
+       mt25ql256aba_read_op(MT25QL256ABA_READ_STATUS_REGISTER, NULL, 0, &flash_ready, sizeof(flash_ready));
+       flash_ready = flash_ready & 0x1;
+    }while(flash_ready == 1);
+    mt25ql256aba_ready();
+}
+
+/*
+ * Reads the status register once instead of waiting like
+ * mt25ql256aba_check_write_in_progress_flag
+ * @param p_in_progress - true while a program or erase is running
+ * @return 0 if success otherwise -1
+ */
+int8_t mt25ql256aba_write_in_progress(bool* p_in_progress)
+{
+    uint8_t status;
+    int8_t ret;
+
+    ret = mt25ql256aba_read_op(MT25QL256ABA_READ_STATUS_REGISTER, NULL, 0, &status, sizeof(status));
+    if (ret < 0)
+        return ret;
+
+    *p_in_progress = (status & 0x1);
+    if (!*p_in_progress)
+        mt25ql256aba_ready();
+
+    return 0;
+}
+
+void mt25ql256aba_erase_subsector(uint32_t address)
+{
+    NRF_LOG_INFO("");
+    NRF_LOG_INFO("ERASING SUBSECTOR....");
+    mt25ql256aba_erase_block(address, MT25QL256ABA_SUBSECTOR_4KB_SIZE);
+}
+
+void mt25ql256aba_reset_device(void)
+{
+    NRF_LOG_INFO("");
+    NRF_LOG_INFO("RESETING DEVICE....");
+    mt25ql256aba_check_write_in_progress_flag();
+    mt25ql256aba_read_op(MT25QL256ABA_RESET_ENABLE, NULL, 0, NULL, 0);
+    mt25ql256aba_read_op(MT25QL256ABA_RESET_MEMORY, NULL, 0, NULL, 0);
+    //the reset leaves the 3-byte address mode
+    (void) mt25ql256aba_enter_4byte_address_mode();
+}
+
+void mt25ql256aba_bulk_erase(void)
+{
+    NRF_LOG_INFO("");
+    NRF_LOG_INFO("PERFORMING BULK ERASE");
+    mt25ql256aba_check_write_in_progress_flag();
+    mt25ql256aba_write_enable();
+    if (mt25ql256aba_write_op(MT25QL256ABA_BULK_ERASE, NULL, 0, NULL, 0) == 0)
+        ENERGY_ENTER(ENERGY_STATE_FLASH_ERASE);
+}
+
+/*
+ * Programs up to one full page with a single page program command of the
+ * part, with a 4-byte address.
+ * Waits for the previous program or erase to finish, but not for this one
+ * @param address - flash address
+ * @param data    - data to program
+ * @param length  - 1 to MT25QL256ABA_PAGE_SIZE bytes, must not cross a page boundary
+ *                  (the flash wraps to the start of the page)
+ * @return 0 if success, -1 on spi error, -2 if the page boundary is crossed
+ */
+int8_t mt25ql256aba_page_program(uint32_t address, uint8_t const* data, uint16_t length)
+{
+    uint8_t write_enable = MT25QL256ABA_WRITE_ENABLE;
+    int8_t ret;
+    spi_xfer_t xfers[2] = {
+        {.cs_pin = SPI_FLASH_CS_PIN, .p_tx_buf = &write_enable, .tx_length = 1},
+        {.cs_pin = SPI_FLASH_CS_PIN, .p_tx_buf = m_write_buf,
+         .tx_length = 1 + MT25QL256ABA_4BYTE_ADDRESS_SIZE + length, .burst = true},
+    };
+
+    if(length == 0 || (address % MT25QL256ABA_PAGE_SIZE) + length > MT25QL256ABA_PAGE_SIZE)
+        return -2;
+
+    mt25ql256aba_check_write_in_progress_flag();
+
+    m_write_buf[0] = m_part.program_cmd;
+    convert_address_to_4byte_address(address, &m_write_buf[1]);
+    memcpy(&m_write_buf[1 + MT25QL256ABA_4BYTE_ADDRESS_SIZE], data, length);
+
+    //the write enable and the program go out back to back with one wait for both
+    ret = spi_perform_batch(&flash_spi, xfers, ARRAY_SIZE(xfers));
+    if (ret == 0)
+        ENERGY_ENTER(ENERGY_STATE_FLASH_PROGRAM);
+
+    return ret;
+}
+
+static void mt25ql256aba_fast_read_command(uint32_t address, uint8_t* command)
+{
+    command[0] = m_part.read_cmd;
+    convert_address_to_4byte_address(address, &command[1]);
+    memset(&command[1 + MT25QL256ABA_4BYTE_ADDRESS_SIZE], 0xFF, MT25QL256ABA_FAST_READ_DUMMY_BYTES);
+}
+
+/*
+ * Reads any length straight into data with one fast read command,
+ * chained EasyDMA transfers under a single cs assertion. The flash streams
+ * across page and sector boundaries, so one call can read many pages
+ * @param address - flash address, the read wraps at the end of the 32MB
+ * @param data    - destination, receives exactly length bytes
+ * @param length  - number of bytes to read
+ * @return 0 if success otherwise -1
+ */
+int8_t mt25ql256aba_read(uint32_t address, uint8_t* data, uint32_t length)
+{
+    uint8_t DQ0[MT25QL256ABA_FAST_READ_COMMAND_SIZE];
+
+    mt25ql256aba_check_write_in_progress_flag();
+
+    mt25ql256aba_fast_read_command(address, DQ0);
+
+    //the dummy byte is dropped with the command and address
+    return spi_write_then_read(&flash_spi, SPI_FLASH_CS_PIN, DQ0, sizeof(DQ0), data, length, true);
+}
+
+/*
+ * Queues a fast read without blocking, e.g. to read the next chunk of an
+ * offload into a second buffer while the first one is sent.
+ * Does not check for a running program or erase, suspend it or wait for it first
+ * @param p_read  - descriptor, must stay valid until the callback
+ * @param address - flash address
+ * @param data    - destination, receives exactly length bytes
+ * @param length  - number of bytes to read
+ * @return 0 if queued otherwise -1
+ */
+int8_t mt25ql256aba_queue_read(mt25ql256aba_read_xfer_t* p_read, uint32_t address, uint8_t* data, uint32_t length,
+                               spi_xfer_callback_t callback, void* p_context)
+{
+    mt25ql256aba_fast_read_command(address, p_read->command);
+
+    p_read->xfer.cs_pin = SPI_FLASH_CS_PIN;
+    p_read->xfer.p_tx_buf = p_read->command;
+    p_read->xfer.tx_length = sizeof(p_read->command);
+    p_read->xfer.rx_skip = sizeof(p_read->command);
+    p_read->xfer.p_rx_buf = data;
+    p_read->xfer.rx_length = length;
+    p_read->xfer.callback = callback;
+    p_read->xfer.p_context = p_context;
+    p_read->xfer.burst = true;
+
+    return spi_queue_xfer(&flash_spi, &p_read->xfer);
+}
+
+/*
+ * @return the erase_cmd of a 4KB, 32KB or 64KB block, 0 for any other size
+ */
+static uint8_t mt25ql256aba_erase_command(uint32_t size)
+{
+    switch (size)
+    {
+        case MT25QL256ABA_SUBSECTOR_4KB_SIZE:
+            return m_part.erase_cmd[0];
+        case MT25QL256ABA_SUBSECTOR_32KB_SIZE:
+            return m_part.erase_cmd[1];
+        case MT25QL256ABA_SECTOR_SIZE:
+            return m_part.erase_cmd[2];
+        default:
+            return 0;
+    }
+}
+
+/*
+ * @return true if mt25ql256aba_erase_block takes size on the part fitted,
+ * every part takes 4KB and 64KB, not all of them 32KB
+ */
+bool mt25ql256aba_erase_supported(uint32_t size)
+{
+    return mt25ql256aba_erase_command(size) != 0;
+}
+
+/*
+ * Starts a 4KB, 32KB or 64KB erase with the erase commands of the part,
+ * waits for the previous program or erase to finish, but not for this one
+ * @param address - any address in the block, the block is aligned to size
+ * @param size    - MT25QL256ABA_SUBSECTOR_4KB_SIZE, MT25QL256ABA_SUBSECTOR_32KB_SIZE
+ *                  or MT25QL256ABA_SECTOR_SIZE, see mt25ql256aba_erase_supported
+ * @return 0 if success, -1 on spi error, -2 for any other size
+ */
+int8_t mt25ql256aba_erase_block(uint32_t address, uint32_t size)
+{
+    uint8_t addr_buf[MT25QL256ABA_4BYTE_ADDRESS_SIZE];
+    uint8_t command_code = mt25ql256aba_erase_command(size);
+    int8_t ret;
+
+    if (command_code == 0)
+        return -2;
+
+    mt25ql256aba_check_write_in_progress_flag();
+    ret = mt25ql256aba_write_enable();
+    if (ret < 0)
+        return ret;
+
+    convert_address_to_4byte_address(address, addr_buf);
+
+    ret = mt25ql256aba_write_op(command_code, addr_buf, sizeof(addr_buf), NULL, 0);
+    if (ret == 0)
+        ENERGY_ENTER(ENERGY_STATE_FLASH_ERASE);
+
+    return ret;
+}
+
+/*
+ * Suspends a running program or erase so the flash can be read (or, during
+ * an erase, programmed outside the block being erased). Waits for the
+ * suspend to take effect, a few tens of us. A part that can't suspend, or
+ * has no flag status register to tell a suspend from the end, is waited
+ * for instead
+ * @param p_suspended - false if nothing was running or it finished before the suspend,
+ *                      otherwise mt25ql256aba_resume must be called later
+ * @return 0 if success otherwise -1
+ */
+int8_t mt25ql256aba_suspend(bool* p_suspended)
+{
+    bool in_progress;
+    uint8_t flag_register;
+    int8_t ret;
+
+    *p_suspended = false;
+    ret = mt25ql256aba_write_in_progress(&in_progress);
+    if (ret < 0 || !in_progress)
+        return ret;
+
+    if (m_part.suspend_cmd == 0 || !m_part.flag_status)
+    {
+        mt25ql256aba_check_write_in_progress_flag();
+        return 0;
+    }
+
+    ret = mt25ql256aba_write_op(m_part.suspend_cmd, NULL, 0, NULL, 0);
+    if (ret < 0)
+        return ret;
+
+    do{
+        ret = mt25ql256aba_read_op(MT25QL256ABA_READ_FLAG_STATUS_REGISTER, NULL, 0, &flag_register, sizeof(flag_register));
+        if (ret < 0)
+            return ret;
+    }while((flag_register & MT25QL256ABA_FLAG_READY_MSK) == 0);
+
+    *p_suspended = (flag_register & (MT25QL256ABA_FLAG_ERASE_SUSPEND_MSK | MT25QL256ABA_FLAG_PROGRAM_SUSPEND_MSK)) != 0;
+    if (*p_suspended)
+    {
+        m_suspended_state = (flag_register & MT25QL256ABA_FLAG_ERASE_SUSPEND_MSK)
+                          ? ENERGY_STATE_FLASH_ERASE : ENERGY_STATE_FLASH_PROGRAM;
+        mt25ql256aba_ready();
+    }
+
+    return 0;
+}
+
+/*
+ * Resumes the program or erase suspended by mt25ql256aba_suspend
+ * @return 0 if success otherwise -1
+ */
+int8_t mt25ql256aba_resume(void)
+{
+    int8_t ret = mt25ql256aba_write_op(m_part.resume_cmd, NULL, 0, NULL, 0);
+
+    if (ret == 0)
+        ENERGY_ENTER(m_suspended_state);
+    m_suspended_state = ENERGY_STATE_SLEEP;
+
+    return ret;
+}
+
+/*
+ * Enters deep power-down, the device ignores every command but the release
+ * until mt25ql256aba_release_deep_power_down. A program or erase must have finished
+ * @return 0 if success otherwise -1
+ */
+int8_t mt25ql256aba_deep_power_down(void)
+{
+    return mt25ql256aba_write_op(MT25QL256ABA_ENTER_DEEP_POWER_DOWN, NULL, 0, NULL, 0);
+}
+
+/*
+ * Leaves deep power-down and waits tRDP. A device that is not powered down
+ * ignores the command, so it is safe on every boot
+ * @return 0 if success otherwise -1
+ */
+int8_t mt25ql256aba_release_deep_power_down(void)
+{
+    int8_t ret = mt25ql256aba_release_deep_power_down_start();
+
+    nrf_delay_us(MT25QL256ABA_RELEASE_DEEP_POWER_DOWN_US);
+    return ret;
+}
+
+/*
+ * Sends the release without waiting, the caller leaves
+ * MT25QL256ABA_RELEASE_DEEP_POWER_DOWN_US before the next command
+ * @return 0 if success otherwise -1
+ */
+int8_t mt25ql256aba_release_deep_power_down_start(void)
+{
+    return mt25ql256aba_write_op(MT25QL256ABA_RELEASE_DEEP_POWER_DOWN, NULL, 0, NULL, 0);
+}
+
+/*
+ * One command polled on the bus after spi_panic_takeover, the reply is read
+ * after the command bytes. Both buffers must be in RAM
+ * @return 0 if success otherwise -1
+ */
+static int8_t mt25ql256aba_panic_op(uint8_t const* command, uint16_t command_size, uint8_t* reply, uint16_t reply_size)
+{
+    spi_xfer_t xfer = {
+        .cs_pin     = SPI_FLASH_CS_PIN,
+        .p_tx_buf   = command,
+        .tx_length  = command_size,
+        .rx_skip    = command_size,
+        .p_rx_buf   = reply,
+        .rx_length  = reply_size,
+        .burst      = true,
+    };
+
+    return spi_panic_xfer(&flash_spi, &xfer);
+}
+
+/*
+ * Polls the flag status register until the program or erase controller is
+ * ready, the status register on a part without one (p_flags then reads 0)
+ * @return 0 if ready, -1 on spi error or if it stays busy for MT25QL256ABA_PANIC_READY_POLLS reads
+ */
+static int8_t mt25ql256aba_panic_ready(uint8_t* p_flags)
+{
+    uint8_t command = m_part.flag_status ? MT25QL256ABA_READ_FLAG_STATUS_REGISTER
+                                         : MT25QL256ABA_READ_STATUS_REGISTER;
+    uint8_t reg;
+    uint32_t polls;
+
+    for (polls = 0; polls < MT25QL256ABA_PANIC_READY_POLLS; polls++)
+    {
+        if (mt25ql256aba_panic_op(&command, 1, &reg, 1) < 0)
+            return -1;
+        if (!m_part.flag_status && (reg & 0x1) == 0)
+        {
+            *p_flags = 0;
+            return 0;
+        }
+        if (m_part.flag_status && (reg & MT25QL256ABA_FLAG_READY_MSK))
+        {
+            *p_flags = reg;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Programs one page from a fault handler, with the interrupts disabled and
+ * the spi polled after spi_panic_takeover instead of queued. Whatever state
+ * the flash was left in: releases deep power-down, suspends a running erase
+ * and resumes it afterwards, lets a running or suspended program finish (no
+ * other program is allowed until it does), then waits for this program.
+ * The block being erased must not hold the page. No energy profiler state is
+ * kept, the chip resets next. A few hundred us at the burst frequency
+ * @param address - flash address
+ * @param data    - data to program, in RAM
+ * @param length  - 1 to MT25QL256ABA_PAGE_SIZE bytes, must not cross a page boundary
+ * @return 0 if success, -1 on spi error or if the flash stays busy, -2 if the page boundary is crossed
+ */
+int8_t mt25ql256aba_panic_page_program(uint32_t address, uint8_t const* data, uint16_t length)
+{
+    uint8_t command[1];
+    uint8_t flags;
+    bool erase_suspended;
+
+    if(length == 0 || (address % MT25QL256ABA_PAGE_SIZE) + length > MT25QL256ABA_PAGE_SIZE)
+        return -2;
+
+    spi_panic_takeover(&flash_spi);
+
+    command[0] = MT25QL256ABA_RELEASE_DEEP_POWER_DOWN;
+    if (mt25ql256aba_panic_op(command, 1, NULL, 0) < 0)
+        return -1;
+    nrf_delay_us(MT25QL256ABA_RELEASE_DEEP_POWER_DOWN_US);
+
+    if (!m_part.flag_status || m_part.suspend_cmd == 0)
+    {
+        //nothing to tell a suspend by, the running program or erase is waited for
+        if (mt25ql256aba_panic_ready(&flags) < 0)
+            return -1;
+        flags = 0;
+    }
+    else
+    {
+        command[0] = MT25QL256ABA_READ_FLAG_STATUS_REGISTER;
+        if (mt25ql256aba_panic_op(command, 1, &flags, 1) < 0)
+            return -1;
+    }
+    if (m_part.flag_status && m_part.suspend_cmd != 0 && (flags & MT25QL256ABA_FLAG_READY_MSK) == 0)
+    {
+        command[0] = m_part.suspend_cmd;
+        if (mt25ql256aba_panic_op(command, 1, NULL, 0) < 0 || mt25ql256aba_panic_ready(&flags) < 0)
+            return -1;
+    }
+    if (flags & MT25QL256ABA_FLAG_PROGRAM_SUSPEND_MSK)
+    {
+        command[0] = m_part.resume_cmd;
+        if (mt25ql256aba_panic_op(command, 1, NULL, 0) < 0 || mt25ql256aba_panic_ready(&flags) < 0)
+            return -1;
+    }
+    erase_suspended = (flags & MT25QL256ABA_FLAG_ERASE_SUSPEND_MSK) != 0;
+
+    command[0] = MT25QL256ABA_WRITE_ENABLE;
+    if (mt25ql256aba_panic_op(command, 1, NULL, 0) < 0)
+        return -1;
+    m_write_buf[0] = m_part.program_cmd;
+    convert_address_to_4byte_address(address, &m_write_buf[1]);
+    memcpy(&m_write_buf[1 + MT25QL256ABA_4BYTE_ADDRESS_SIZE], data, length);
+    if (mt25ql256aba_panic_op(m_write_buf, 1 + MT25QL256ABA_4BYTE_ADDRESS_SIZE + length, NULL, 0) < 0
+        || mt25ql256aba_panic_ready(&flags) < 0)
+        return -1;
+
+    if (erase_suspended)
+    {
+        command[0] = m_part.resume_cmd;
+        return mt25ql256aba_panic_op(command, 1, NULL, 0);
+    }
+
+    return 0;
+}
+
+/*
+ * converts an address to the big endian 4 byte address sent on the bus
+ * @param address - 4 byte flash address
+ * @param address_tx_buffer - 4 byte address stored in a buffer
+ * @return none
+ */
+void convert_address_to_4byte_address(uint32_t address, uint8_t* address_tx_buffer)
+{
+    address_tx_buffer[0] = (address >> 24) & 0xFF; //high address value
+    address_tx_buffer[1] = (address >> 16) & 0xFF;
+    address_tx_buffer[2] = (address >> 8) & 0xFF;
+    address_tx_buffer[3] = address & 0xFF; //low address value
+}
+
+/*
+ * Puts a part whose commands take a 3-byte address into 4-byte address mode,
+ * nothing to do on one with the 4-byte commands
+ * @return 0 if success otherwise -1
+ */
+static int8_t mt25ql256aba_enter_4byte_address_mode(void)
+{
+    if (m_part.enter_4byte == 0)
+        return 0;
+    if (m_part.enter_4byte == 2 && mt25ql256aba_write_enable() < 0)
+        return -1;
+    return mt25ql256aba_read_op(MT25QL256ABA_ENTER_4BYTE_ADDRESS_MODE, NULL, 0, NULL, 0);
+}
+
+/*
+ * Reads from the SFDP space, READ SFDP always takes a 3-byte address and one dummy byte
+ * @return 0 if success otherwise -1
+ */
+static int8_t mt25ql256aba_read_sfdp(uint32_t address, uint8_t* data, uint16_t length)
+{
+    uint8_t command[5];
+
+    command[0] = MT25QL256ABA_READ_SFDP;
+    command[1] = (address >> 16) & 0xFF;
+    command[2] = (address >> 8) & 0xFF;
+    command[3] = address & 0xFF;
+    command[4] = 0; //dummy
+
+    return spi_write_then_read(&flash_spi, SPI_FLASH_CS_PIN, command, sizeof(command), data, length, true);
+}
+
+/*
+ * @return dword n (1 based, as numbered by JESD216) of an SFDP table as read
+ */
+static uint32_t mt25ql256aba_sfdp_dword(uint8_t const* table, uint8_t n)
+{
+    uint8_t const* p = &table[(n - 1)*4];
+
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * Finds a parameter table in the SFDP headers, the last revision listed wins
+ * @param p_pointer - the SFDP address of the table
+ * @param p_dwords  - its length
+ * @return 0 if found, -1 on spi error, -2 if the part does not have it
+ */
+static int8_t mt25ql256aba_sfdp_find(uint8_t headers, uint16_t id, uint32_t* p_pointer, uint8_t* p_dwords)
+{
+    uint8_t header[8];
+    uint8_t i;
+    int8_t ret = -2;
+
+    for (i = 0; i < headers; i++)
+    {
+        //the 8 byte sfdp header, then one 8 byte header per table
+        if (mt25ql256aba_read_sfdp(8 + i*8, header, sizeof(header)) < 0)
+            return -1;
+        if ((header[0] | (header[7] << 8)) != id)
+            continue;
+        *p_dwords = header[3];
+        *p_pointer = header[4] | (header[5] << 8) | ((uint32_t)header[6] << 16);
+        ret = 0;
+    }
+
+    return ret;
+}
+
+/*
+ * Reads the JEDEC id and the SFDP tables (JESD216) of the part fitted and
+ * picks its commands: the 1-1-1 fast read, page program and 4KB/32KB/64KB
+ * erases with a 4-byte address from the 4-byte address instruction table, or
+ * the 3-byte ones with the part put into 4-byte address mode, the page size,
+ * erase suspend and whether the flag status register is there. The spim only
+ * drives one data line so the dual and quad reads are never picked. The part
+ * must hold at least MT25QL256ABA_FLASH_SIZE, a larger one only has its first
+ * MT25QL256ABA_FLASH_SIZE bytes used. On an error the previous part is kept
+ * @return 0 if success otherwise -1 if the spi failed or -2 if the part can't be used
+ */
+int8_t mt25ql256aba_detect(void)
+{
+    mt25ql256aba_part_t part;
+    uint8_t bfpt[MT25QL256ABA_SFDP_BFPT_DWORDS*4];
+    uint8_t bait[2*4];
+    uint8_t header[8];
+    uint32_t pointer;
+    uint32_t dword;
+    uint8_t headers;
+    uint8_t dwords;             //of the bfpt
+    uint8_t bait_dwords;
+    uint8_t exponent;
+    uint8_t i;
+    bool bait_read;
+    int8_t ret;
+
+    memset(&part, 0, sizeof(part));
+    memset(bfpt, 0, sizeof(bfpt));
+    memset(bait, 0, sizeof(bait));
+    if (mt25ql256aba_read_op(MT25QL256ABA_READ_ID, NULL, 0, part.ids, sizeof(part.ids)) < 0
+        || mt25ql256aba_read_sfdp(0, header, sizeof(header)) < 0)
+        return -1;
+    if (mt25ql256aba_sfdp_dword(header, 1) != MT25QL256ABA_SFDP_SIGNATURE)
+    {
+        NRF_LOG_ERROR("flash 0x%x 0x%x 0x%x has no sfdp", part.ids[0], part.ids[1], part.ids[2]);
+        return -2;
+    }
+
+    //NPH is 0 based, the headers are looked at up to MT25QL256ABA_SFDP_MAX_HEADERS
+    headers = header[6] + 1;
+    if (headers > MT25QL256ABA_SFDP_MAX_HEADERS)
+        headers = MT25QL256ABA_SFDP_MAX_HEADERS;
+    ret = mt25ql256aba_sfdp_find(headers, MT25QL256ABA_SFDP_BFPT_ID, &pointer, &dwords);
+    if (ret < 0)
+        return ret;
+    if (dwords < 9)
+        return -2;
+    if (dwords > MT25QL256ABA_SFDP_BFPT_DWORDS)
+        dwords = MT25QL256ABA_SFDP_BFPT_DWORDS;
+    if (mt25ql256aba_read_sfdp(pointer, bfpt, dwords*4) < 0)
+        return -1;
+    bait_read = false;
+    ret = mt25ql256aba_sfdp_find(headers, MT25QL256ABA_SFDP_4BAIT_ID, &pointer, &bait_dwords);
+    if (ret == -1)
+        return -1;
+    if (ret == 0 && bait_dwords >= 2)
+    {
+        if (mt25ql256aba_read_sfdp(pointer, bait, sizeof(bait)) < 0)
+            return -1;
+        bait_read = true;
+    }
+
+    //density, bit 31 set for 2^N bits otherwise N+1 bits
+    dword = mt25ql256aba_sfdp_dword(bfpt, 2);
+    if (dword & 0x80000000)
+        part.size = ((dword & 0x7FFFFFFF) >= 35) ? 0xFFFFFFFF : (uint32_t)(1ULL << ((dword & 0x7FFFFFFF) - 3));
+    else
+        part.size = (dword >> 3) + 1;
+
+    //erase types 1 to 4, a size exponent and the 3-byte opcode each
+    for (i = 0; i < 4; i++)
+    {
+        dword = mt25ql256aba_sfdp_dword(bfpt, 8 + i/2);
+        exponent = (dword >> ((i % 2)*16)) & 0xFF;
+        if (exponent == 12)
+            part.erase_cmd[0] = (dword >> ((i % 2)*16 + 8)) & 0xFF;
+        else if (exponent == 15)
+            part.erase_cmd[1] = (dword >> ((i % 2)*16 + 8)) & 0xFF;
+        else if (exponent == 16)
+            part.erase_cmd[2] = (dword >> ((i % 2)*16 + 8)) & 0xFF;
+        else
+            continue;
+        //the 4-byte erase of the same type, bits 9 to 12 of the table, opcodes in its dword 2
+        if (bait_read && (mt25ql256aba_sfdp_dword(bait, 1) & (1 << (9 + i))))
+        {
+            dword = mt25ql256aba_sfdp_dword(bait, 2) >> (i*8);
+            part.erase_cmd[exponent == 12 ? 0 : exponent - 14] = dword & 0xFF;
+        }
+    }
+
+    //before JESD216A the page size is not listed, 256 bytes then
+    part.page_size = MT25QL256ABA_PAGE_SIZE;
+    if (dwords >= 11)
+        part.page_size = 1 << ((mt25ql256aba_sfdp_dword(bfpt, 11) >> 4) & 0xF);
+    if (dwords >= 13 && (mt25ql256aba_sfdp_dword(bfpt, 12) & 0x80000000) == 0)
+    {
+        dword = mt25ql256aba_sfdp_dword(bfpt, 13);
+        part.suspend_cmd = (dword >> 24) & 0xFF;
+        part.resume_cmd = (dword >> 16) & 0xFF;
+    }
+    if (dwords >= 14)
+        part.flag_status = (mt25ql256aba_sfdp_dword(bfpt, 14) & 0x08) != 0;
+
+    //4-byte fast read (0Ch) and page program (12h) listed
+    dword = mt25ql256aba_sfdp_dword(bait, 1);
+    if (bait_read && (dword & 0x02) && (dword & 0x40))
+    {
+        part.read_cmd = MT25QL256ABA_4BYTE_FAST_READ;
+        part.program_cmd = MT25QL256ABA_4BYTE_PAGE_PROGRAM;
+    }
+    else
+    {
+        part.read_cmd = MT25QL256ABA_FAST_READ;
+        part.program_cmd = MT25QL256ABA_PAGE_PROGRAM;
+        //how 4-byte address mode is entered, B7h or write enable then B7h
+        dword = (dwords >= 16) ? mt25ql256aba_sfdp_dword(bfpt, 16) >> 24 : 0;
+        if (dword & 0x01)
+            part.enter_4byte = 1;
+        else if (dword & 0x02)
+            part.enter_4byte = 2;
+        else if (((mt25ql256aba_sfdp_dword(bfpt, 1) >> 17) & 0x3) != 0)
+            part.enter_4byte = 1; //3 or 4 address bytes, the part takes B7h
+    }
+
+    if (part.size < MT25QL256ABA_FLASH_SIZE || part.erase_cmd[0] == 0 || part.erase_cmd[2] == 0
+        || part.page_size < MT25QL256ABA_PAGE_SIZE || (part.read_cmd == MT25QL256ABA_FAST_READ && part.enter_4byte == 0))
+    {
+        NRF_LOG_ERROR("flash 0x%x 0x%x 0x%x can't be used", part.ids[0], part.ids[1], part.ids[2]);
+        return -2;
+    }
+
+    m_part = part;
+    if (mt25ql256aba_enter_4byte_address_mode() < 0)
+        return -1;
+    NRF_LOG_INFO("flash 0x%x 0x%x 0x%x, %d KB, read 0x%x program 0x%x",
+                 part.ids[0], part.ids[1], part.ids[2], part.size/1024, part.read_cmd, part.program_cmd);
+    NRF_LOG_INFO("flash erase 0x%x 0x%x 0x%x, suspend 0x%x, flag status %d",
+                 part.erase_cmd[0], part.erase_cmd[1], part.erase_cmd[2], part.suspend_cmd, part.flag_status);
+    return 0;
+}
+
+/*
+ * @return the part the commands are picked for
+ */
+mt25ql256aba_part_t const* mt25ql256aba_part(void)
+{
+    return &m_part;
+}
+
+/*
+ * Startup test, reads and logs the three id bytes, then the SFDP tables of
+ * the part fitted when it is not the mt25ql256aba
+ * @return 0 if success otherwise -1 if the spi failed or -2 if the part can't be used
+ */
+int8_t mt25ql256aba_startup_test(void)
+{
+    uint8_t val[3];
+
+    NRF_LOG_INFO("");
+    NRF_LOG_INFO("PERFORMING FLASH TEST....");
+    if (mt25ql256aba_read_op(MT25QL256ABA_READ_ID, NULL, 0, val, sizeof(val)) < 0)
+    {
+        NRF_LOG_INFO("FLASH READ TEST FAIL");
+        return -1;
+    }
+
+    NRF_LOG_INFO("1: device id = 0x%x (0x20)", val[0]);
+    NRF_LOG_INFO("2:memory type = 0x%x (0xBA)", val[1]);
+    NRF_LOG_INFO("3:memory capacity = 0x%x (0x19)", val[2]);
+    if(val[0] != m_part.ids[0] || val[1] != m_part.ids[1] || val[2] != m_part.ids[2])
+    {
+        if (mt25ql256aba_detect() < 0)
+        {
+            NRF_LOG_INFO("FLASH READ TEST FAIL");
+            return -2;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Reads the three id bytes without the delays of the startup test, the quick
+ * check of a warm boot. Ids that are not the ones of the part known read its
+ * SFDP tables
+ * @return 0 if success otherwise -1 if the spi failed or -2 if the part can't be used
+ */
+int8_t mt25ql256aba_check_id(void)
+{
+    uint8_t val[MT25QL256ABA_ID_LENGTH];
+    int8_t ret;
+
+    ret = mt25ql256aba_read_op(MT25QL256ABA_READ_ID, NULL, 0, val, sizeof(val));
+    if (ret < 0)
+        return ret;
+    if (val[0] == m_part.ids[0] && val[1] == m_part.ids[1] && val[2] == m_part.ids[2])
+        return 0;
+
+    return mt25ql256aba_detect();
+}
+
+/*
+ * Queues the id read of mt25ql256aba_check_id without blocking, e.g. right
+ * behind the accel check on the instance they share
+ * @param p_xfer   - descriptor, must stay valid until the callback
+ * @param p_rx_buf - MT25QL256ABA_ID_LENGTH bytes, for mt25ql256aba_id_check
+ * @return 0 if queued otherwise -1
+ */
+int8_t mt25ql256aba_queue_id_read(spi_xfer_t* p_xfer, uint8_t* p_rx_buf, spi_xfer_callback_t callback, void* p_context)
+{
+    static uint8_t command = MT25QL256ABA_READ_ID; //in ram for EasyDMA
+
+    p_xfer->cs_pin = SPI_FLASH_CS_PIN;
+    p_xfer->p_tx_buf = &command;
+    p_xfer->tx_length = 1;
+    p_xfer->rx_skip = 1;
+    p_xfer->p_rx_buf = p_rx_buf;
+    p_xfer->rx_length = MT25QL256ABA_ID_LENGTH;
+    p_xfer->callback = callback;
+    p_xfer->p_context = p_context;
+    p_xfer->burst = true;
+
+    return spi_queue_xfer(&flash_spi, p_xfer);
+}
+
+/*
+ * @param p_ids - manufacturer id, memory type and capacity as read
+ * @return 0 if they are the ones of the part known (the mt25ql256aba until
+ * mt25ql256aba_detect found another) otherwise -2
+ */
+int8_t mt25ql256aba_id_check(uint8_t const* p_ids)
+{
+    if (p_ids[0] != m_part.ids[0] || p_ids[1] != m_part.ids[1] || p_ids[2] != m_part.ids[2])
+    {
+        NRF_LOG_ERROR("flash ids 0x%x 0x%x 0x%x", p_ids[0], p_ids[1], p_ids[2]);
+        return -2;
+    }
+    return 0;
+}
+
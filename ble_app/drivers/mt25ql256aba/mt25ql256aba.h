@@ -3,6 +3,19 @@
 
 #include "stdint.h"
 #include "stdbool.h"
+#include "boards.h"
+#include "spi_driver.h"
+#include "nrf_log.h"
+#include "nrf_delay.h"
+
+//FLASH_SPI_INSTANCE and the SPI_FLASH_ pins and profile come from the board header
+#ifndef FLASH_SPI_INSTANCE
+#error "FLASH_SPI_INSTANCE is not defined by the board header"
+#endif
+
+extern const nrf_drv_spi_t flash_spi;
+
+extern nrf_drv_spi_config_t const flash_spi_config;
 
 //Software Reset Option
 #define MT25QL256ABA_RESET_ENABLE                            0x66
@@ -10,10 +23,26 @@
 
 //READ ID Operations
 #define MT25QL256ABA_READ_ID                                 0x9E //or 0x9F
+#define MT25QL256ABA_MANUFACTURER_ID                         0x20
+#define MT25QL256ABA_MEMORY_TYPE                             0xBA
+#define MT25QL256ABA_MEMORY_CAPACITY                         0x19 //256Mb
+#define MT25QL256ABA_ID_LENGTH                               3 //manufacturer id, memory type and capacity
+
+//SFDP (JEDEC JESD216) Operations, always a 3-byte address and 8 dummy clocks
+#define MT25QL256ABA_READ_SFDP                               0x5A
+#define MT25QL256ABA_SFDP_SIGNATURE                          0x50444653 //"SFDP"
+#define MT25QL256ABA_SFDP_BFPT_ID                            0xFF00 //basic flash parameter table
+#define MT25QL256ABA_SFDP_4BAIT_ID                           0xFF84 //4-byte address instruction table
+#define MT25QL256ABA_SFDP_MAX_HEADERS                        8 //parameter headers looked at
+#define MT25QL256ABA_SFDP_BFPT_DWORDS                        16 //JESD216B, longer tables are cut, older ones are shorter
+#define MT25QL256ABA_ENTER_4BYTE_ADDRESS_MODE                0xB7
 
 //READ MEMORY Operations
 #define MT25QL256ABA_READ                                    0x03
 #define MT25QL256ABA_FAST_READ                               0x0B
+#define MT25QL256ABA_4BYTE_READ                              0x13
+#define MT25QL256ABA_4BYTE_FAST_READ                         0x0C
+#define MT25QL256ABA_FAST_READ_DUMMY_BYTES                   1 //8 dummy clocks, nonvolatile config default
 
 //WRITE Operations
 #define MT25QL256ABA_WRITE_ENABLE                            0x06
@@ -35,22 +64,115 @@
 
 //PROGRAM Operations
 #define MT25QL256ABA_PAGE_PROGRAM                        0x02
+#define MT25QL256ABA_4BYTE_PAGE_PROGRAM                  0x12
+
+//SUSPEND/RESUME Operations
+#define MT25QL256ABA_PROGRAM_ERASE_SUSPEND               0x75
+#define MT25QL256ABA_PROGRAM_ERASE_RESUME                0x7A
+
+//DEEP POWER-DOWN Operations
+#define MT25QL256ABA_ENTER_DEEP_POWER_DOWN               0xB9
+#define MT25QL256ABA_RELEASE_DEEP_POWER_DOWN             0xAB
+#define MT25QL256ABA_RELEASE_DEEP_POWER_DOWN_US          30 //tRDP, commands are ignored until then
 
 //ERASE Operations
 #define MT25QL256ABA_ERASE_32KB_SUBSECTOR                0x52
 #define MT25QL256ABA_ERASE_4KB_SUBSECTOR                 0x20
 #define MT25QL256ABA_SECTOR_ERASE                        0xD8
 #define MT25QL256ABA_BULK_ERASE                          0xC7 // or 0x60
+#define MT25QL256ABA_4BYTE_ERASE_4KB_SUBSECTOR           0x21
+#define MT25QL256ABA_4BYTE_ERASE_32KB_SUBSECTOR          0x5C
+#define MT25QL256ABA_4BYTE_SECTOR_ERASE                  0xDC
+
+#define MT25QL256ABA_SUBSECTOR_4KB_SIZE                  0x1000
+#define MT25QL256ABA_SUBSECTOR_32KB_SIZE                 0x8000
+#define MT25QL256ABA_SECTOR_SIZE                         0x10000
+#define MT25QL256ABA_FLASH_SIZE                          0x2000000
+#define MT25QL256ABA_BENCH_ADDRESS                       0x1FE0000 //the sector the flash benches erase, below the crash log and out of every log
 
+#define MT25QL256ABA_PAGE_SIZE                           256
+#define MT25QL256ABA_4BYTE_ADDRESS_SIZE                  4
+
+//Every read, program and erase uses the 4-BYTE commands, so addresses are a
+//flat 0 to MT25QL256ABA_FLASH_SIZE - 1 space in either address mode
+//and the segments below never need to be selected
 #define MT25QL256ABA_LOW_128MBIT_SEGMENT_ADDRESS_START    0x00000000
 #define MT25QL256ABA_LOW_128MBIT_SEGMENT_ADDRESS_END      0x00FFFFFF
 #define MT25QL256ABA_HIGH_128MBIT_SEGMENT_ADDRESS_START   0x01000000
 #define MT25QL256ABA_HIGH_128MBIT_SEGMENT_ADDRESS_END     0x01FFFFFF
 
+#define MT25QL256ABA_FAST_READ_COMMAND_SIZE (1 + MT25QL256ABA_4BYTE_ADDRESS_SIZE + MT25QL256ABA_FAST_READ_DUMMY_BYTES)
+
+//FLAG STATUS REGISTER bits
+#define MT25QL256ABA_FLAG_READY_MSK                      0x80
+#define MT25QL256ABA_FLAG_ERASE_SUSPEND_MSK              0x40
+#define MT25QL256ABA_FLAG_PROGRAM_SUSPEND_MSK            0x04
+
+//Flag status reads before mt25ql256aba_panic_page_program gives up on a busy flash,
+//above the longest page program (tPP max 1.8 ms) at a few us a read
+#define MT25QL256ABA_PANIC_READY_POLLS                   4000
+
+typedef struct{
+    uint8_t program_erase_controller;
+    uint8_t erase_suspend;
+    uint8_t program;
+    uint8_t program_suspend;
+    uint8_t byte_addressing;
+    uint8_t erase;
+    uint8_t protection;
+}flag_reg_t;
+
+//The part fitted, the mt25ql256aba until mt25ql256aba_detect has read the
+//SFDP tables of another one. Every address is sent as 4 bytes: with the
+//4-byte commands, or with the 3-byte ones once the part is in 4-byte address mode
+typedef struct{
+    uint8_t ids[MT25QL256ABA_ID_LENGTH];
+    uint32_t size;              //bytes, only the first MT25QL256ABA_FLASH_SIZE are used
+    uint16_t page_size;         //programs never cross one, at least MT25QL256ABA_PAGE_SIZE
+    uint8_t read_cmd;           //1-1-1 fast read, MT25QL256ABA_FAST_READ_DUMMY_BYTES after the address
+    uint8_t program_cmd;
+    uint8_t erase_cmd[3];       //4KB, 32KB and 64KB erase, 0 if the part has none of that size
+    uint8_t enter_4byte;        //0 if the commands take 4 address bytes as they are, 1 B7h, 2 WREN then B7h
+    bool flag_status;           //READ FLAG STATUS REGISTER bit 7 polls the program/erase controller
+    uint8_t suspend_cmd;        //0 if a program or erase can't be suspended
+    uint8_t resume_cmd;
+}mt25ql256aba_part_t;
+
+//a queued fast read, must stay valid until its callback
+typedef struct{
+    spi_xfer_t xfer;
+    uint8_t command[MT25QL256ABA_FAST_READ_COMMAND_SIZE];
+}mt25ql256aba_read_xfer_t;
+
 
-int8_t mt25ql256aba_read_op(uint8_t command_code, uint8_t* address, uint8_t address_size, uint8_t* reg_data, uint8_t rx_num_bytes);
-int8_t mt25ql256aba_write_op(uint8_t command_code, uint8_t* address, uint8_t address_size, uint8_t* data, uint8_t data_size);
+int8_t mt25ql256aba_read_op(uint8_t command_code, uint8_t* address, uint8_t address_size, uint8_t* reg_data, uint16_t rx_num_bytes);
+int8_t mt25ql256aba_write_op(uint8_t command_code, uint8_t* address, uint8_t address_size, uint8_t const* data, uint16_t data_size);
 int8_t mt25ql256aba_write_disable(void);
 int8_t mt25ql256aba_write_enable(void);
+void mt25ql256aba_check_write_in_progress_flag(void);
+int8_t mt25ql256aba_write_in_progress(bool* p_in_progress);
+void convert_address_to_4byte_address(uint32_t address, uint8_t* address_tx_buffer);
+void mt25ql256aba_bulk_erase(void);
+void mt25ql256aba_reset_device(void);
+void mt25ql256aba_erase_subsector(uint32_t address);
+void mt25ql256aba_read_flag_reg(flag_reg_t *flag_reg);
+int8_t mt25ql256aba_startup_test(void);
+int8_t mt25ql256aba_check_id(void);
+int8_t mt25ql256aba_queue_id_read(spi_xfer_t* p_xfer, uint8_t* p_rx_buf, spi_xfer_callback_t callback, void* p_context);
+int8_t mt25ql256aba_id_check(uint8_t const* p_ids);
+int8_t mt25ql256aba_detect(void);
+mt25ql256aba_part_t const* mt25ql256aba_part(void);
+bool mt25ql256aba_erase_supported(uint32_t size);
+int8_t mt25ql256aba_page_program(uint32_t address, uint8_t const* data, uint16_t length);
+int8_t mt25ql256aba_read(uint32_t address, uint8_t* data, uint32_t length);
+int8_t mt25ql256aba_queue_read(mt25ql256aba_read_xfer_t* p_read, uint32_t address, uint8_t* data, uint32_t length,
+                               spi_xfer_callback_t callback, void* p_context);
+int8_t mt25ql256aba_erase_block(uint32_t address, uint32_t size);
+int8_t mt25ql256aba_suspend(bool* p_suspended);
+int8_t mt25ql256aba_resume(void);
+int8_t mt25ql256aba_deep_power_down(void);
+int8_t mt25ql256aba_release_deep_power_down(void);
+int8_t mt25ql256aba_release_deep_power_down_start(void);
+int8_t mt25ql256aba_panic_page_program(uint32_t address, uint8_t const* data, uint16_t length);
 
 #endif //MT25QL256ABA_H
\ No newline at end of file
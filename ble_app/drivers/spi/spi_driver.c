@@ -1,147 +1,725 @@
 //-------------------------------------------
 // Title: spi_driver.c
 // Author: UBC Capstone Team 48 - 2019/2020
-// Description: This is verison of the spi driver is depreciated and is used 
-// for running older breadboard prototype test programs. Please see spi_pcb
+// Description: spi driver shared by every board and device driver.
+// Every spi instance has its own transaction queue and completion context
+// so transfers on different instances can run at the same time.
+// Each instance also has a bus profile: register access runs at the
+// config frequency and data bursts at the burst frequency. More devices
+// are added to an instance with their own profile by spi_device_add, each
+// transaction then programs the clock, mode and pins of its device. Devices
+// sharing MOSI/MISO/SCK (PCB rev2) only switch the clock and mode, devices
+// on pins of their own (the accel and flash of PCB rev1) switch the pin
+// select registers as well, a few register writes instead of an uninit and
+// init of the instance, and their transactions interleave in its queue.
+// The chip selects belong to spi_driver alone: the ss_pin of each config
+// names the cs pin of its device and is set up here, the nrf driver never
+// sees it (the nRF52832 spim has no cs of its own, nrf_drv_spi would drive it
+// as a gpio around every EasyDMA chunk). A transaction drives its cs once,
+// low before the first chunk and high after the last one.
+// Initialize each instance with spi_instance_init in your program's main file
 //-------------------------------------------
 #include "spi_driver.h"
-#include "nrf_drv_spi.h"
-#include "nrf_gpio.h"
-#include "sdk_errors.h"
-
-//currently unused 
-//#include "nrf_delay.h"
-//#include "app_error.h"
-//#include "nrf_log.h"
-//#include "nrf_log_ctrl.h"
-//#include "nrf_log_default_backends.h"
-
-#define SPI_INSTANCE  0 /**< SPI instance index. */
-static const nrf_drv_spi_t spi = NRF_DRV_SPI_INSTANCE(SPI_INSTANCE); 
-static volatile bool m_transfer_completed = true; /**< A flag to inform about completed transfer. */
-
-#ifdef USE_FLASH
-#define SPI2_INSTANCE  2
-static const nrf_drv_spi_t flash_spi = NRF_DRV_SPI_INSTANCE(SPI2_INSTANCE); 
-static volatile bool m_flash_transfer_completed = true; /**< A flag to inform about completed transfer. */
-#endif 
+#include "app_util_platform.h"
+#include "profiler.h"
+#include "trace.h"
 
-/**
- * @brief SPI event handler.
- * 
- * @param event
- * @
+/* Bus profile of one device of an instance, picked by the cs pin of each transaction */
+typedef struct {
+    uint8_t cs_pin;
+    uint8_t sck_pin;
+    uint8_t mosi_pin;
+    uint8_t miso_pin;
+    nrf_drv_spi_mode_t mode;
+    nrf_drv_spi_frequency_t frequency;          /**< for register access */
+    nrf_drv_spi_frequency_t burst_frequency;    /**< for transactions with burst set */
+} spi_device_t;
+
+typedef struct {
+    nrf_drv_spi_t const * spi;
+    spi_xfer_t * p_head;    /**< transaction in progress */
+    spi_xfer_t * p_tail;
+    uint32_t offset;        /**< bytes of p_head already transferred */
+    uint16_t chunk_length;  /**< length of the EasyDMA transfer in progress */
+    volatile bool busy;     /**< a transaction is in progress or completing */
+    nrf_drv_spi_frequency_t config_frequency;   /**< from nrf_drv_spi_config_t, for register access */
+    nrf_drv_spi_frequency_t burst_frequency;    /**< for transactions with burst set */
+    nrf_drv_spi_frequency_t current_frequency;  /**< programmed in the peripheral */
+    nrf_drv_spi_mode_t config_mode;             /**< from nrf_drv_spi_config_t */
+    nrf_drv_spi_mode_t current_mode;            /**< programmed in the peripheral */
+    nrf_drv_spi_bit_order_t bit_order;
+    spi_device_t config;                        /**< pins of nrf_drv_spi_config_t */
+    spi_device_t const * p_current_pins;        /**< device whose pins are selected */
+    spi_device_t devices[SPI_MAX_DEVICES];
+    uint8_t num_devices;
+    uint8_t device;         /**< devices index of p_head, SPI_MAX_DEVICES for the instance's own */
+    uint32_t errors;        /**< transactions that failed since spi_instance_init */
+    uint32_t xfers[SPI_MAX_DEVICES + 1];        /**< transactions finished per device, the instance's own last */
+    uint32_t bytes[SPI_MAX_DEVICES + 1];        /**< bytes clocked per device */
+} spi_instance_ctx_t;
+
+typedef struct {
+    volatile uint8_t remaining; /**< transactions of the batch not finished */
+    volatile int8_t result;     /**< -1 once any of them failed */
+} spi_blocking_ctx_t;
+
+static spi_instance_ctx_t m_spi_ctx[SPI_INSTANCE_COUNT];
+
+RAMFUNC static uint32_t spi_xfer_length(spi_xfer_t const * p_xfer)
+{
+    uint32_t rx_end = p_xfer->rx_skip + p_xfer->rx_length;
+
+    return (p_xfer->tx_length > rx_end) ? p_xfer->tx_length : rx_end;
+}
+
+/*
+ * Reprograms the bus clock, only called between transactions
  */
-void spi_event_handler(nrf_drv_spi_evt_t const * p_event, void *  p_context)
+RAMFUNC static void spi_set_frequency(spi_instance_ctx_t * p_ctx, nrf_drv_spi_frequency_t frequency)
 {
-    switch(p_event->type){
-        case NRF_DRV_SPI_EVENT_DONE:
-            m_transfer_completed = true;
-            break;
-        default:
-            break;
+    if (frequency == p_ctx->current_frequency)
+        return;
+
+#ifdef SPIM_PRESENT
+    if (p_ctx->spi->use_easy_dma)
+        nrf_spim_frequency_set(p_ctx->spi->u.spim.p_reg, (nrf_spim_frequency_t) frequency);
+#endif
+#ifdef SPI_PRESENT
+    if (!p_ctx->spi->use_easy_dma)
+        nrf_spi_frequency_set(p_ctx->spi->u.spi.p_reg, (nrf_spi_frequency_t) frequency);
+#endif
+
+    p_ctx->current_frequency = frequency;
+}
+
+/*
+ * Reprograms the clock polarity and phase, only called between transactions
+ * so the sck idle level changes with every cs high
+ */
+RAMFUNC static void spi_set_mode(spi_instance_ctx_t * p_ctx, nrf_drv_spi_mode_t mode)
+{
+    if (mode == p_ctx->current_mode)
+        return;
+
+#ifdef SPIM_PRESENT
+    if (p_ctx->spi->use_easy_dma)
+        nrf_spim_configure(p_ctx->spi->u.spim.p_reg, (nrf_spim_mode_t) mode, (nrf_spim_bit_order_t) p_ctx->bit_order);
+#endif
+#ifdef SPI_PRESENT
+    if (!p_ctx->spi->use_easy_dma)
+        nrf_spi_configure(p_ctx->spi->u.spi.p_reg, (nrf_spi_mode_t) mode, (nrf_spi_bit_order_t) p_ctx->bit_order);
+#endif
+
+    p_ctx->current_mode = mode;
+}
+
+RAMFUNC static uint32_t spi_psel(uint8_t pin)
+{
+    return (pin == NRF_DRV_SPI_PIN_NOT_USED) ? NRF_SPIM_PIN_NOT_CONNECTED : pin;
+}
+
+/*
+ * Connects the peripheral to the pins of a device, the pin select registers
+ * only take a new value with the peripheral disabled. Only called between
+ * transactions, the pins let go keep their idle level as gpio outputs
+ */
+RAMFUNC static void spi_set_pins(spi_instance_ctx_t * p_ctx, spi_device_t const * p_pins)
+{
+    spi_device_t const * p_current = p_ctx->p_current_pins;
+
+    if (p_pins->sck_pin == p_current->sck_pin && p_pins->mosi_pin == p_current->mosi_pin
+        && p_pins->miso_pin == p_current->miso_pin)
+    {
+        p_ctx->p_current_pins = p_pins;
+        return;
+    }
+
+#ifdef SPIM_PRESENT
+    if (p_ctx->spi->use_easy_dma)
+    {
+        nrf_spim_disable(p_ctx->spi->u.spim.p_reg);
+        nrf_spim_pins_set(p_ctx->spi->u.spim.p_reg, spi_psel(p_pins->sck_pin),
+                          spi_psel(p_pins->mosi_pin), spi_psel(p_pins->miso_pin));
+        nrf_spim_enable(p_ctx->spi->u.spim.p_reg);
+    }
+#endif
+#ifdef SPI_PRESENT
+    if (!p_ctx->spi->use_easy_dma)
+    {
+        nrf_spi_disable(p_ctx->spi->u.spi.p_reg);
+        nrf_spi_pins_set(p_ctx->spi->u.spi.p_reg, spi_psel(p_pins->sck_pin),
+                         spi_psel(p_pins->mosi_pin), spi_psel(p_pins->miso_pin));
+        nrf_spi_enable(p_ctx->spi->u.spi.p_reg);
+    }
+#endif
+
+    p_ctx->p_current_pins = p_pins;
+}
+
+/*
+ * Selects the bus profile of the transaction about to start, its device's
+ * if the cs pin has one otherwise the instance's
+ */
+RAMFUNC static void spi_select_profile(spi_instance_ctx_t * p_ctx, spi_xfer_t const * p_xfer)
+{
+    spi_device_t const * p_device;
+    uint8_t i;
+
+    for (i = 0; i < p_ctx->num_devices; i++)
+    {
+        p_device = &p_ctx->devices[i];
+        if (p_device->cs_pin == p_xfer->cs_pin)
+        {
+            spi_set_pins(p_ctx, p_device);
+            spi_set_mode(p_ctx, p_device->mode);
+            spi_set_frequency(p_ctx, p_xfer->burst ? p_device->burst_frequency : p_device->frequency);
+            p_ctx->device = i;
+            return;
+        }
+    }
+
+    p_ctx->device = SPI_MAX_DEVICES;
+    spi_set_pins(p_ctx, &p_ctx->config);
+    spi_set_mode(p_ctx, p_ctx->config_mode);
+    spi_set_frequency(p_ctx, p_xfer->burst ? p_ctx->burst_frequency : p_ctx->config_frequency);
+}
+
+/*
+ * Bounds of the EasyDMA chunk of a transaction from offset on.
+ * The tx and rx part of a chunk are clamped separately, the spim clocks out
+ * the orc byte once tx runs out. A chunk ends at rx_skip so the bytes after it
+ * land at the start of p_rx_buf
+ * @return the length of the chunk, *p_tx_left bytes of it go out from
+ * &p_tx_buf[offset] and *p_rx_left come in at &p_rx_buf[*p_rx_pos]
+ */
+RAMFUNC static uint16_t spi_chunk_bounds(spi_xfer_t const * p_xfer, uint32_t offset,
+                                         uint32_t * p_tx_left, uint32_t * p_rx_left, uint32_t * p_rx_pos)
+{
+    uint32_t remaining = spi_xfer_length(p_xfer) - offset;
+    uint32_t rx_pos = (offset > p_xfer->rx_skip) ? (offset - p_xfer->rx_skip) : 0;
+    uint32_t tx_left = (p_xfer->tx_length > offset) ? (p_xfer->tx_length - offset) : 0;
+    uint32_t rx_left = 0;
+    uint16_t length;
+
+    if (offset < p_xfer->rx_skip && remaining > p_xfer->rx_skip - offset)
+        remaining = p_xfer->rx_skip - offset;
+    else if (offset >= p_xfer->rx_skip && p_xfer->rx_length > rx_pos)
+        rx_left = p_xfer->rx_length - rx_pos;
+
+    length = (remaining > SPI_MAX_XFER_LENGTH) ? SPI_MAX_XFER_LENGTH : remaining;
+    *p_tx_left = (tx_left > length) ? length : tx_left;
+    *p_rx_left = (rx_left > length) ? length : rx_left;
+    *p_rx_pos = rx_pos;
+    return length;
+}
+
+/*
+ * Starts the next EasyDMA chunk of the transaction at the head of the queue
+ * @return 0 if started otherwise -1
+ */
+RAMFUNC static int8_t spi_start_chunk(spi_instance_ctx_t * p_ctx)
+{
+    spi_xfer_t * p_xfer = p_ctx->p_head;
+    uint32_t offset = p_ctx->offset;
+    uint32_t tx_left, rx_left, rx_pos;
+    ret_code_t err_code;
+
+    p_ctx->chunk_length = spi_chunk_bounds(p_xfer, offset, &tx_left, &rx_left, &rx_pos);
+
+    if (p_ctx->offset == 0)
+    {
+        spi_select_profile(p_ctx, p_xfer);
+        nrf_gpio_pin_clear(p_xfer->cs_pin);
+    }
+
+    err_code = nrf_drv_spi_transfer(p_ctx->spi,
+                                    (tx_left > 0) ? &p_xfer->p_tx_buf[offset] : NULL, tx_left,
+                                    (rx_left > 0) ? &p_xfer->p_rx_buf[rx_pos] : NULL, rx_left);
+    if (err_code != NRF_SUCCESS)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Pops the finished transaction and runs its callback, then starts the
+ * next queued transaction. The instance stays busy while the callback runs
+ * so a transaction queued from the callback is started here
+ */
+RAMFUNC static void spi_finish_xfer(spi_instance_ctx_t * p_ctx, int8_t result)
+{
+    spi_xfer_t * p_done;
+    bool idle;
+
+    while (true)
+    {
+        p_done = p_ctx->p_head;
+        nrf_gpio_pin_set(p_done->cs_pin);
+        //offset is what was clocked, nothing for a transaction that failed to start
+        p_ctx->xfers[p_ctx->device]++;
+        p_ctx->bytes[p_ctx->device] += p_ctx->offset;
+        if (result < 0)
+        {
+            p_ctx->errors++;
+            TRACE(TRACE_ID_SPI_ERROR, p_done->cs_pin, result);
+        }
+
+        CRITICAL_REGION_ENTER();
+        p_ctx->p_head = p_done->p_next;
+        if (p_ctx->p_head == NULL)
+            p_ctx->p_tail = NULL;
+        CRITICAL_REGION_EXIT();
+        p_ctx->offset = 0;
+
+        if (p_done->callback != NULL)
+            p_done->callback(result, p_done->p_context);
+
+        CRITICAL_REGION_ENTER();
+        idle = (p_ctx->p_head == NULL);
+        if (idle)
+            p_ctx->busy = false;
+        CRITICAL_REGION_EXIT();
+
+        if (idle || spi_start_chunk(p_ctx) == 0)
+            return;
+
+        //a transaction that fails to start completes with an error right away
+        result = -1;
     }
 }
 
-#ifdef USE_FLASH
 /**
  * @brief SPI event handler.
  * 
  * @param event
- * @
+ * @param p_context - spi_instance_ctx_t of the instance, set by spi_instance_init
  */
-void flash_spi_event_handler(nrf_drv_spi_evt_t const * p_event, void *  p_context)
+RAMFUNC void spi_event_handler(nrf_drv_spi_evt_t const * p_event, void *  p_context)
 {
+    spi_instance_ctx_t * p_ctx = (spi_instance_ctx_t *) p_context;
+
     switch(p_event->type){
         case NRF_DRV_SPI_EVENT_DONE:
-            m_flash_transfer_completed = true;
+            p_ctx->offset += p_ctx->chunk_length;
+            if (p_ctx->offset < spi_xfer_length(p_ctx->p_head))
+            {
+                if (spi_start_chunk(p_ctx) == 0)
+                    break;
+                spi_finish_xfer(p_ctx, -1);
+            }
+            else
+            {
+                spi_finish_xfer(p_ctx, 0);
+            }
             break;
         default:
             break;
     }
 }
-#endif
 
-void spi_init (void)
-{
-    nrf_drv_spi_config_t const spi_config = {
-        .ss_pin       = NRFX_SPIM_PIN_NOT_USED,
-        .miso_pin     = SPI_MISO_PIN,
-        .mosi_pin     = SPI_MOSI_PIN,
-        .sck_pin      = SPI_SCK_PIN,
-        .irq_priority = SPI_IRQ_PRIORITY,
-        .orc          = 0xFF,
-        .frequency    = NRF_DRV_SPI_FREQ_1M,
-        .mode         = NRF_DRV_SPI_MODE_0,
-        .bit_order    = NRF_DRV_SPI_BIT_ORDER_MSB_FIRST,
-    };
-    ret_code_t err_code = nrf_drv_spi_init(&spi, &spi_config, spi_event_handler, NULL);
-    APP_ERROR_CHECK(err_code);
-    nrf_gpio_cfg_output(SPI_ICM20649_CS_PIN);
-    nrf_gpio_cfg_output(SPI_ADXL372_CS_PIN);
-    nrf_gpio_pin_clear(SPI_ADXL372_CS_PIN);
-    nrf_gpio_pin_clear(SPI_ICM20649_CS_PIN);
-    nrf_gpio_pin_set(SPI_ADXL372_CS_PIN);
-    nrf_gpio_pin_set(SPI_ICM20649_CS_PIN);
-}
-
-#ifdef USE_FLASH
-void flash_spi_init(void)
-{
-    nrf_drv_spi_config_t const spi_config = {
-        .ss_pin       = NRFX_SPIM_PIN_NOT_USED,
-        .miso_pin     = FLASH_SPI_MISO_PIN,
-        .mosi_pin     = FLASH_SPI_MOSI_PIN,
-        .sck_pin      = FLASH_SPI_SCK_PIN,
-        .irq_priority = SPI_IRQ_PRIORITY,
-        .orc          = 0xFF,
-        .frequency    = NRF_DRV_SPI_FREQ_1M,
-        .mode         = NRF_DRV_SPI_MODE_0,
-        .bit_order    = NRF_DRV_SPI_BIT_ORDER_MSB_FIRST,
-    };
-    ret_code_t err_code = nrf_drv_spi_init(&flash_spi, &spi_config, flash_spi_event_handler, NULL);
-    APP_ERROR_CHECK(err_code);
-    nrf_gpio_pin_clear(SPI_MT25QL256ABA_CS_PIN);
-    nrf_gpio_pin_set(SPI_MT25QL256ABA_CS_PIN);
-    nrf_gpio_cfg_output(SPI_MT25QL256ABA_CS_PIN);
+/*
+ * @brief Initializes a spi instance with its own completion context
+ * use instead of nrf_drv_spi_init
+ * @param config - config->frequency is used for register access, config->ss_pin
+ *                 is set up as the cs pin of the instance's own device
+ * @param burst_frequency - used for transactions with burst set (data reads and writes)
+ */
+ret_code_t spi_instance_init(nrf_drv_spi_t const * spi, nrf_drv_spi_config_t const * config, nrf_drv_spi_frequency_t burst_frequency)
+{
+    spi_instance_ctx_t * p_ctx = &m_spi_ctx[spi->inst_idx];
+    nrf_drv_spi_config_t driver_config = *config;
+
+    memset(p_ctx, 0, sizeof(spi_instance_ctx_t));
+    p_ctx->spi = spi;
+    p_ctx->config_frequency = config->frequency;
+    p_ctx->burst_frequency = burst_frequency;
+    p_ctx->current_frequency = config->frequency;
+    p_ctx->config_mode = config->mode;
+    p_ctx->current_mode = config->mode;
+    p_ctx->bit_order = config->bit_order;
+    p_ctx->config.cs_pin = config->ss_pin;
+    p_ctx->config.sck_pin = config->sck_pin;
+    p_ctx->config.mosi_pin = config->mosi_pin;
+    p_ctx->config.miso_pin = config->miso_pin;
+    p_ctx->p_current_pins = &p_ctx->config;
+
+    if (config->ss_pin != NRF_DRV_SPI_PIN_NOT_USED)
+        spi_cfg_cs_pins(config->ss_pin);
+    driver_config.ss_pin = NRF_DRV_SPI_PIN_NOT_USED;
+
+    return nrf_drv_spi_init(spi, &driver_config, spi_event_handler, p_ctx);
 }
-#endif
 
-int8_t spi_write_and_read (uint8_t cs_pin, uint8_t* tx_msg, uint8_t tx_length, uint8_t* rx_msg, uint8_t rx_length)
+/*
+ * @brief Adds a device behind its own cs line to an initialized instance, with
+ * the bus profile of its own config, and sets up its cs pin. Pins of the config
+ * that differ from the instance's are set up as nrf_drv_spi_init does and
+ * switched in for each of its transactions. The instance must be idle, the
+ * device is kept until spi_instance_init runs again
+ * @param config - cs (ss_pin), pins, mode and register access frequency, the bit order is the instance's
+ * @return 0 if success otherwise -2 if the config has no cs pin or the instance has SPI_MAX_DEVICES already
+ */
+int8_t spi_device_add(nrf_drv_spi_t const * spi, nrf_drv_spi_config_t const * config, nrf_drv_spi_frequency_t burst_frequency)
 {
-    m_transfer_completed = false;
+    spi_instance_ctx_t * p_ctx = &m_spi_ctx[spi->inst_idx];
+    spi_device_t * p_device;
 
-    nrf_gpio_pin_clear(cs_pin);
-    ret_code_t err_code = nrf_drv_spi_transfer(&spi, tx_msg , tx_length, rx_msg, rx_length);
-    //set the cs_pin here??
-    if (err_code != NRF_SUCCESS)
-        return -1;
+    if (config->ss_pin == NRF_DRV_SPI_PIN_NOT_USED || p_ctx->num_devices >= SPI_MAX_DEVICES)
+        return -2;
 
-    while(!m_transfer_completed)
+    p_device = &p_ctx->devices[p_ctx->num_devices++];
+    p_device->cs_pin = config->ss_pin;
+    p_device->sck_pin = config->sck_pin;
+    p_device->mosi_pin = config->mosi_pin;
+    p_device->miso_pin = config->miso_pin;
+    p_device->mode = config->mode;
+    p_device->frequency = config->frequency;
+    p_device->burst_frequency = burst_frequency;
+
+    //idle levels while the peripheral is on other pins, the sck one follows the clock polarity
+    if (config->sck_pin != p_ctx->config.sck_pin)
     {
-        __WFE();
+        if (config->mode == NRF_DRV_SPI_MODE_0 || config->mode == NRF_DRV_SPI_MODE_1)
+            nrf_gpio_pin_clear(config->sck_pin);
+        else
+            nrf_gpio_pin_set(config->sck_pin);
+        nrf_gpio_cfg(config->sck_pin, NRF_GPIO_PIN_DIR_OUTPUT, NRF_GPIO_PIN_INPUT_CONNECT,
+                     NRF_GPIO_PIN_NOPULL, NRF_GPIO_PIN_S0S1, NRF_GPIO_PIN_NOSENSE);
     }
-    nrf_gpio_pin_set(cs_pin);
+    if (config->mosi_pin != p_ctx->config.mosi_pin && config->mosi_pin != NRF_DRV_SPI_PIN_NOT_USED)
+    {
+        nrf_gpio_pin_clear(config->mosi_pin);
+        nrf_gpio_cfg_output(config->mosi_pin);
+    }
+    if (config->miso_pin != p_ctx->config.miso_pin && config->miso_pin != NRF_DRV_SPI_PIN_NOT_USED)
+        nrf_gpio_cfg_input(config->miso_pin, NRF_GPIO_PIN_NOPULL);
+    spi_cfg_cs_pins(config->ss_pin);
 
     return 0;
 }
 
-#ifdef USE_FLASH
-int8_t flash_spi_write_and_read (uint8_t cs_pin, uint8_t* tx_msg, uint8_t tx_length, uint8_t* rx_msg, uint8_t rx_length)
+/*
+ * @brief Changes the burst frequency, takes effect from the next transaction.
+ * Devices added with spi_device_add keep their own
+ */
+void spi_set_burst_frequency(nrf_drv_spi_t const * spi, nrf_drv_spi_frequency_t burst_frequency)
 {
-    m_flash_transfer_completed = false;
+    m_spi_ctx[spi->inst_idx].burst_frequency = burst_frequency;
+}
 
-    nrf_gpio_pin_clear(cs_pin);
-    ret_code_t err_code = nrf_drv_spi_transfer(&flash_spi, tx_msg , tx_length, rx_msg, rx_length);
-    if (err_code != NRF_SUCCESS)
+/*
+ * @brief Programs the instance's own pins, mode and burst frequency for transfers
+ * started outside the queue, e.g. by PPI. The instance must be idle, the next
+ * queued transaction selects its own profile again
+ */
+void spi_select_burst_frequency(nrf_drv_spi_t const * spi)
+{
+    spi_instance_ctx_t * p_ctx = &m_spi_ctx[spi->inst_idx];
+
+    spi_set_pins(p_ctx, &p_ctx->config);
+    spi_set_mode(p_ctx, p_ctx->config_mode);
+    spi_set_frequency(p_ctx, p_ctx->burst_frequency);
+}
+
+/*
+ * @brief Waits for the queue to drain and uninitializes the instance
+ * (e.g. to hand it to devices on other pins without spi_device_add)
+ */
+void spi_instance_uninit(nrf_drv_spi_t const * spi)
+{
+    spi_wait_idle(spi);
+    nrf_drv_spi_uninit(spi);
+}
+
+/*
+ * @brief Queues a transaction without blocking, it starts right away when the instance is idle.
+ * Safe to call from a spi_xfer_callback_t
+ * @return 0 if queued otherwise -1
+ */
+RAMFUNC int8_t spi_queue_xfer(nrf_drv_spi_t const * spi, spi_xfer_t * p_xfer)
+{
+    return spi_queue_batch(spi, p_xfer, 1);
+}
+
+/*
+ * @brief Queues count transactions back to back without blocking, no transaction
+ * queued meanwhile from another context gets between them and each one starts
+ * from the spi interrupt as the previous one finishes. Safe to call from a
+ * spi_xfer_callback_t
+ * @param p_xfers - array of count descriptors, each keeps its own cs pin and callback
+ * @return 0 if queued otherwise -1 if any of them is empty, then none is queued
+ */
+int8_t spi_queue_batch(nrf_drv_spi_t const * spi, spi_xfer_t * p_xfers, uint8_t count)
+{
+    spi_instance_ctx_t * p_ctx = &m_spi_ctx[spi->inst_idx];
+    bool start;
+    uint8_t i;
+
+    if (count == 0)
         return -1;
+    for (i = 0; i < count; i++)
+    {
+        if (spi_xfer_length(&p_xfers[i]) == 0)
+            return -1;
+        p_xfers[i].p_next = (i + 1 < count) ? &p_xfers[i + 1] : NULL;
+    }
+
+    CRITICAL_REGION_ENTER();
+    if (p_ctx->p_head == NULL)
+        p_ctx->p_head = &p_xfers[0];
+    else
+        p_ctx->p_tail->p_next = &p_xfers[0];
+    p_ctx->p_tail = &p_xfers[count - 1];
+    start = !p_ctx->busy;
+    if (start)
+        p_ctx->busy = true;
+    CRITICAL_REGION_EXIT();
+
+    if (start && spi_start_chunk(p_ctx) < 0)
+    {
+        spi_finish_xfer(p_ctx, -1);
+    }
+
+    return 0;
+}
+
+/*
+ * @return the transactions of the instance that failed since spi_instance_init,
+ * whichever device they were for
+ */
+uint32_t spi_error_count(nrf_drv_spi_t const * spi)
+{
+    return m_spi_ctx[spi->inst_idx].errors;
+}
+
+/*
+ * @brief Transactions finished and bytes clocked for one device of an instance
+ * since spi_instance_init, failed ones included
+ * @param cs_pin - the ss_pin of the device's config, the instance's own or one added
+ * @return 0 if success otherwise -2 if the instance has no device on cs_pin
+ */
+int8_t spi_device_counts(nrf_drv_spi_t const * spi, uint8_t cs_pin, uint32_t * p_xfers, uint32_t * p_bytes)
+{
+    spi_instance_ctx_t const * p_ctx = &m_spi_ctx[spi->inst_idx];
+    uint8_t i;
 
-    while(!m_flash_transfer_completed)
+    for (i = 0; i < p_ctx->num_devices; i++)
+    {
+        if (p_ctx->devices[i].cs_pin == cs_pin)
+            break;
+    }
+    if (i == p_ctx->num_devices)
+    {
+        if (p_ctx->config.cs_pin != cs_pin)
+            return -2;
+        i = SPI_MAX_DEVICES;
+    }
+
+    *p_xfers = p_ctx->xfers[i];
+    *p_bytes = p_ctx->bytes[i];
+    return 0;
+}
+
+bool spi_is_idle(nrf_drv_spi_t const * spi)
+{
+    return !m_spi_ctx[spi->inst_idx].busy;
+}
+
+void spi_wait_idle(nrf_drv_spi_t const * spi)
+{
+    while(!spi_is_idle(spi))
     {
         __WFE();
     }
+}
+
+/*
+ * @brief Sets up a cs pin as an idle high output, without the low pulse a
+ * gpio that powers up low gives when it is set after the direction. Called by
+ * spi_instance_init and spi_device_add, and to take a pin back from gpiote
+ */
+void spi_cfg_cs_pins(uint8_t cs_pin)
+{
     nrf_gpio_pin_set(cs_pin);
+    nrf_gpio_cfg_output(cs_pin);
+}
 
-    return 0;
+/*
+ * @brief Takes an instance away from its queue for a fault handler, with the
+ * interrupts disabled: masks the instance's interrupt, stops the transfer in
+ * progress and raises every cs of the instance. A device cut off mid command
+ * drops it, a page program cut off on a byte boundary programs what it got.
+ * The queued transactions never complete, the instance only runs
+ * spi_panic_xfer until the next reset
+ */
+void spi_panic_takeover(nrf_drv_spi_t const * spi)
+{
+    spi_instance_ctx_t * p_ctx = &m_spi_ctx[spi->inst_idx];
+    uint8_t i;
+
+#ifdef SPIM_PRESENT
+    if (spi->use_easy_dma)
+    {
+        uint32_t polls = SPI_PANIC_POLLS;
+
+        nrf_spim_int_disable(spi->u.spim.p_reg, NRF_SPIM_INT_END_MASK);
+        if (p_ctx->busy)
+        {
+            nrf_spim_event_clear(spi->u.spim.p_reg, NRF_SPIM_EVENT_STOPPED);
+            nrf_spim_task_trigger(spi->u.spim.p_reg, NRF_SPIM_TASK_STOP);
+            while (!nrf_spim_event_check(spi->u.spim.p_reg, NRF_SPIM_EVENT_STOPPED) && --polls > 0)
+                ;
+        }
+    }
+#endif
+
+    if (p_ctx->config.cs_pin != NRF_DRV_SPI_PIN_NOT_USED)
+        nrf_gpio_pin_set(p_ctx->config.cs_pin);
+    for (i = 0; i < p_ctx->num_devices; i++)
+        nrf_gpio_pin_set(p_ctx->devices[i].cs_pin);
+
+    p_ctx->busy = true;
+    p_ctx->p_head = NULL;
+    p_ctx->p_tail = NULL;
+    p_ctx->offset = 0;
 }
+
+/*
+ * @brief Runs one transaction by polling the peripheral, after
+ * spi_panic_takeover, in the bus profile of its cs pin. The callback is not
+ * called. EasyDMA only, the buffers must be in RAM
+ * @return 0 if success otherwise -1 if a chunk did not end or the instance has no EasyDMA
+ */
+int8_t spi_panic_xfer(nrf_drv_spi_t const * spi, spi_xfer_t const * p_xfer)
+{
+#ifdef SPIM_PRESENT
+    spi_instance_ctx_t * p_ctx = &m_spi_ctx[spi->inst_idx];
+    NRF_SPIM_Type * p_reg = spi->u.spim.p_reg;
+    uint32_t length = spi_xfer_length(p_xfer);
+    uint32_t offset = 0;
+    uint32_t tx_left, rx_left, rx_pos, polls;
+    int8_t ret = 0;
+
+    if (!spi->use_easy_dma)
+        return -1;
+
+    spi_select_profile(p_ctx, p_xfer);
+    nrf_gpio_pin_clear(p_xfer->cs_pin);
+    while (offset < length)
+    {
+        p_ctx->chunk_length = spi_chunk_bounds(p_xfer, offset, &tx_left, &rx_left, &rx_pos);
+        nrf_spim_tx_buffer_set(p_reg, (tx_left > 0) ? &p_xfer->p_tx_buf[offset] : NULL, tx_left);
+        nrf_spim_rx_buffer_set(p_reg, (rx_left > 0) ? &p_xfer->p_rx_buf[rx_pos] : NULL, rx_left);
+        nrf_spim_event_clear(p_reg, NRF_SPIM_EVENT_END);
+        nrf_spim_task_trigger(p_reg, NRF_SPIM_TASK_START);
+        for (polls = SPI_PANIC_POLLS; !nrf_spim_event_check(p_reg, NRF_SPIM_EVENT_END) && polls > 0; polls--)
+            ;
+        if (polls == 0)
+        {
+            ret = -1;
+            break;
+        }
+        offset += p_ctx->chunk_length;
+    }
+    nrf_gpio_pin_set(p_xfer->cs_pin);
+
+    return ret;
+#else
+    return -1;
 #endif
+}
+
+static void spi_blocking_xfer_handler(int8_t result, void * p_context)
+{
+    spi_blocking_ctx_t * p_blocking = (spi_blocking_ctx_t *) p_context;
+
+    if (result < 0)
+        p_blocking->result = result;
+    p_blocking->remaining--;
+}
+
+/*
+ * @brief Queues a batch with spi_queue_batch and sleeps once until all of it is done,
+ * the callbacks of the descriptors are replaced. Must not be called from a
+ * spi_xfer_callback_t or any interrupt at or above SPI_IRQ_PRIORITY
+ * @return 0 if success otherwise -1 if any transaction failed
+ */
+int8_t spi_perform_batch(nrf_drv_spi_t const * spi, spi_xfer_t * p_xfers, uint8_t count)
+{
+    spi_blocking_ctx_t blocking = {.remaining = count, .result = 0};
+    uint8_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        p_xfers[i].callback = spi_blocking_xfer_handler;
+        p_xfers[i].p_context = &blocking;
+    }
+
+    if (spi_queue_batch(spi, p_xfers, count) < 0)
+        return -1;
+
+    while(blocking.remaining > 0)
+    {
+        __WFE();
+    }
+
+    return blocking.result;
+}
+
+/*
+ * @brief Queues a transaction and sleeps until it is done.
+ * Must not be called from a spi_xfer_callback_t or any interrupt
+ * at or above SPI_IRQ_PRIORITY
+ */
+static int8_t spi_xfer_blocking(nrf_drv_spi_t const* spi, uint8_t cs_pin, uint8_t* tx_msg, uint16_t tx_length, uint16_t rx_skip, uint8_t* rx_msg, uint32_t rx_length, bool burst)
+{
+    spi_xfer_t xfer = {
+        .cs_pin     = cs_pin,
+        .p_tx_buf   = tx_msg,
+        .tx_length  = tx_length,
+        .rx_skip    = rx_skip,
+        .p_rx_buf   = rx_msg,
+        .rx_length  = rx_length,
+        .burst      = burst,
+    };
+
+    return spi_perform_batch(spi, &xfer, 1);
+}
+
+PROFILER_PROBE_DEF(m_write_and_read_probe, "spi_write_and_read");
+
+int8_t spi_write_and_read (nrf_drv_spi_t const* spi, uint8_t cs_pin, uint8_t* tx_msg, uint8_t tx_length, uint8_t* rx_msg, uint8_t rx_length)
+{
+    int8_t ret;
+
+    PROFILER_SCOPE(m_write_and_read_probe)
+    {
+        ret = spi_xfer_blocking(spi, cs_pin, tx_msg, tx_length, 0, rx_msg, rx_length, false);
+    }
+
+    return ret;
+}
+
+/*
+ * @brief Writes tx_msg and reads rx_length bytes with a single cs assertion.
+ * Transfers longer than SPI_MAX_XFER_LENGTH are chained EasyDMA transfers,
+ * cs stays low over all of them.
+ * Like spi_write_and_read the first tx_length bytes of rx_msg are clocked in during the write.
+ * Runs at the instance's burst frequency, rx_length can be 0 for a burst write
+ * @return 0 if success otherwise -1
+ */
+int8_t spi_burst_read (nrf_drv_spi_t const* spi, uint8_t cs_pin, uint8_t* tx_msg, uint16_t tx_length, uint8_t* rx_msg, uint16_t rx_length)
+{
+    return spi_xfer_blocking(spi, cs_pin, tx_msg, tx_length, 0, rx_msg, rx_length, true);
+}
+
+/*
+ * @brief Writes tx_msg then reads rx_length bytes straight into rx_msg with a single cs assertion,
+ * nothing is clocked into rx_msg during the write, also with a single cs assertion
+ * @param burst - run at the instance's burst frequency instead of the config frequency
+ * @return 0 if success otherwise -1
+ */
+int8_t spi_write_then_read (nrf_drv_spi_t const* spi, uint8_t cs_pin, uint8_t* tx_msg, uint16_t tx_length, uint8_t* rx_msg, uint32_t rx_length, bool burst)
+{
+    return spi_xfer_blocking(spi, cs_pin, tx_msg, tx_length, tx_length, rx_msg, rx_length, burst);
+}
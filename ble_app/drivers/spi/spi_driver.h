@@ -4,6 +4,15 @@
 #include "stdint.h"
 #include "string.h"
 #include "boards.h"
+#include "nrf_drv_spi.h"
+#include "nrf_gpio.h"
+#include "sdk_errors.h"
+//currently unused 
+//#include "nrf_delay.h"
+//#include "app_error.h"
+//#include "nrf_log.h"
+//#include "nrf_log_ctrl.h"
+//#include "nrf_log_default_backends.h"
 
 
 // <i> Priorities 0,2 (nRF51) and 0,1,4,5 (nRF52) are reserved for SoftDevice
@@ -15,12 +24,70 @@
 // <5=> 5 
 // <6=> 6 
 // <7=> 7 
+// An app can raise it in its sdk_config.h, e.g. to run sensor reads ahead of the SoftDevice events
+#ifndef SPI_IRQ_PRIORITY
 #define SPI_IRQ_PRIORITY 6
+#endif
 
-void spi_init (void);
-void flash_spi_init(void);
-int8_t spi_write_and_read ( uint8_t cs_pin, uint8_t* tx_msg, uint8_t tx_length, uint8_t* rx_msg, uint8_t rx_length);
-int8_t flash_spi_write_and_read (uint8_t cs_pin, uint8_t* tx_msg, uint8_t tx_length, uint8_t* rx_msg, uint8_t rx_length);
+// Largest single EasyDMA transfer (MAXCNT is 8 bits on the nRF52832)
+#define SPI_MAX_XFER_LENGTH ((1 << SPIM0_EASYDMA_MAXCNT_SIZE) - 1)
 
+// Number of SPIM instances on the nRF52832
+#define SPI_INSTANCE_COUNT 3
 
-#endif //SPI_DRIVER_H
\ No newline at end of file
+// Devices with their own bus profile on one instance, see spi_device_add
+#define SPI_MAX_DEVICES 4
+
+// Polls of one EasyDMA chunk before spi_panic_xfer gives up, above 255 bytes at 125 kHz
+#define SPI_PANIC_POLLS 2000000
+
+/**
+ * @brief Called from the spi interrupt when a queued transaction finishes
+ * @param result 0 if success otherwise -1
+ */
+typedef void (*spi_xfer_callback_t)(int8_t result, void * p_context);
+
+/**
+ * @brief One queued spi transaction. cs_pin, the ss_pin of the instance's config
+ * or of a device added to it, is held low for the whole transaction,
+ * lengths above SPI_MAX_XFER_LENGTH are split into chained EasyDMA transfers.
+ * The first rx_skip bytes clocked in are dropped (e.g. during a command and address),
+ * p_rx_buf receives the rx_length bytes after them.
+ * The descriptor and both buffers must stay valid until the callback runs.
+ */
+typedef struct spi_xfer_s {
+    uint8_t cs_pin;
+    uint8_t const * p_tx_buf;
+    uint16_t tx_length;
+    uint16_t rx_skip;
+    uint8_t * p_rx_buf;
+    uint32_t rx_length;
+    spi_xfer_callback_t callback; /**< may be NULL */
+    void * p_context;
+    bool burst;                   /**< clock at the instance's burst frequency instead of the config frequency */
+    struct spi_xfer_s * p_next; /**< used by the queue */
+} spi_xfer_t;
+
+ret_code_t spi_instance_init(nrf_drv_spi_t const * spi, nrf_drv_spi_config_t const * config, nrf_drv_spi_frequency_t burst_frequency);
+void spi_set_burst_frequency(nrf_drv_spi_t const * spi, nrf_drv_spi_frequency_t burst_frequency);
+void spi_select_burst_frequency(nrf_drv_spi_t const * spi);
+void spi_instance_uninit(nrf_drv_spi_t const * spi);
+int8_t spi_device_add(nrf_drv_spi_t const * spi, nrf_drv_spi_config_t const * config, nrf_drv_spi_frequency_t burst_frequency);
+int8_t spi_queue_xfer(nrf_drv_spi_t const * spi, spi_xfer_t * p_xfer);
+int8_t spi_queue_batch(nrf_drv_spi_t const * spi, spi_xfer_t * p_xfers, uint8_t count);
+int8_t spi_perform_batch(nrf_drv_spi_t const * spi, spi_xfer_t * p_xfers, uint8_t count);
+uint32_t spi_error_count(nrf_drv_spi_t const * spi);
+int8_t spi_device_counts(nrf_drv_spi_t const * spi, uint8_t cs_pin, uint32_t * p_xfers, uint32_t * p_bytes);
+bool spi_is_idle(nrf_drv_spi_t const * spi);
+void spi_wait_idle(nrf_drv_spi_t const * spi);
+void spi_panic_takeover(nrf_drv_spi_t const * spi);
+int8_t spi_panic_xfer(nrf_drv_spi_t const * spi, spi_xfer_t const * p_xfer);
+
+void spi_cfg_cs_pins(uint8_t cs_pin);
+void spi_event_handler(nrf_drv_spi_evt_t const * p_event, void *  p_context);
+int8_t spi_write_and_read (const nrf_drv_spi_t* spi, uint8_t cs_pin, uint8_t* tx_msg, uint8_t tx_length, uint8_t* rx_msg, uint8_t rx_length);
+int8_t spi_burst_read (const nrf_drv_spi_t* spi, uint8_t cs_pin, uint8_t* tx_msg, uint16_t tx_length, uint8_t* rx_msg, uint16_t rx_length);
+int8_t spi_write_then_read (const nrf_drv_spi_t* spi, uint8_t cs_pin, uint8_t* tx_msg, uint16_t tx_length, uint8_t* rx_msg, uint32_t rx_length, bool burst);
+
+
+#endif //SPI_DRIVER_H
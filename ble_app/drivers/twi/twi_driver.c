@@ -0,0 +1,215 @@
+//-------------------------------------------
+// Title: twi_driver.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Shared I2C bus for the VCNL4040 and DS1388.
+// Transactions from both drivers go through one nrf_twi_mngr queue, so
+// a proximity or RTC read can be scheduled from the sampling loop and
+// complete in the background while the SPI sensors are being read.
+// The manager has no timeout of its own, a slave that stretches the clock
+// or holds SDA low leaves it busy for good and a twi_perform asleep on it
+// never returns. twi_supervise, from the perform's wait and from the app's
+// supervisor, abandons the transaction that held the bus TWI_TIMEOUT_MS
+// without progress: the TWI is reinitialized with the bus clear (nine SCL
+// pulses and a STOP), the transaction fails with NRF_ERROR_TIMEOUT and the
+// ones queued behind it are started again.
+// Initialize the bus with twi_init in your program's main file
+//-------------------------------------------
+#include "twi_driver.h"
+#include "nrf_log.h"
+#include "app_timer.h"
+#include "trace.h"
+
+NRF_TWI_MNGR_DEF(m_twi_mngr, TWI_QUEUE_SIZE, TWI_INSTANCE_ID);
+
+static uint32_t m_errors; /**< performed transactions that failed */
+static uint32_t m_scheduled; /**< transactions queued by twi_schedule */
+static uint32_t m_performed; /**< transactions run by twi_perform */
+static uint32_t m_perform_starts; /**< twi_perform calls, counted before their transaction is queued */
+static uint32_t m_timeouts; /**< transactions abandoned by twi_supervise */
+static nrf_twi_mngr_transaction_t const * m_watched; /**< on the bus at m_watched_ticks */
+static uint32_t m_watched_starts; /**< m_scheduled + m_perform_starts then */
+static uint32_t m_watched_ticks;
+
+static void twi_bus_init(bool clear_bus)
+{
+    ret_code_t err_code;
+    // Initializes the I2C connection to 400 kHz,
+    // using the SDA and SCL pins for the board
+    // (see README to change which board/platform is in use)
+
+    const nrf_drv_twi_config_t twi_config = {
+       .scl                = I2C_SCL,
+       .sda                = I2C_SDA,
+       .frequency          = NRF_DRV_TWI_FREQ_400K,
+       .interrupt_priority = TWI_IRQ_PRIORITY,
+       .clear_bus_init     = clear_bus
+    };
+
+    err_code = nrf_twi_mngr_init(&m_twi_mngr, &twi_config);
+    APP_ERROR_CHECK(err_code);
+}
+
+/*
+ * Sleeps between events while a transaction is performed, a hung one is
+ * abandoned from here, the app timer interrupts wake it
+ */
+static void twi_wait_event(void)
+{
+    __WFE();
+    twi_supervise();
+}
+
+/**
+ * @brief initialization.
+ */
+void twi_init(void)
+{
+    twi_bus_init(false);
+}
+
+/*
+ * Abandons the transaction on the bus: the manager is reinitialized with the
+ * bus cleared, the transaction ends with NRF_ERROR_TIMEOUT and the queue,
+ * which the manager only starts from a schedule or a finished transaction,
+ * is scheduled again in order. Its callback runs from the caller instead of
+ * the twi interrupt
+ */
+static void twi_recover(void)
+{
+    nrf_twi_mngr_transaction_t const * p_hung;
+    nrf_twi_mngr_transaction_t const * queued[TWI_QUEUE_SIZE];
+    uint8_t count = 0;
+
+    CRITICAL_REGION_ENTER();
+    p_hung = m_twi_mngr.p_nrf_twi_mngr_cb->p_current_transaction;
+    nrf_twi_mngr_uninit(&m_twi_mngr);
+    while (count < TWI_QUEUE_SIZE && nrf_queue_pop(m_twi_mngr.p_queue, &queued[count]) == NRF_SUCCESS)
+        count++;
+    //a schedule from an interrupt meanwhile would start on the uninitialized TWI
+    twi_bus_init(true);
+    CRITICAL_REGION_EXIT();
+
+    m_timeouts++;
+    TRACE(TRACE_ID_TWI_ERROR, 1, NRF_ERROR_TIMEOUT);
+    if (p_hung != NULL && p_hung->callback != NULL)
+        p_hung->callback(NRF_ERROR_TIMEOUT, p_hung->p_user_data);
+    for (uint8_t i = 0; i < count; i++)
+        (void) nrf_twi_mngr_schedule(&m_twi_mngr, queued[i]);
+}
+
+/*
+ * @brief Abandons a transaction that kept the bus TWI_TIMEOUT_MS without the
+ * manager moving on, see twi_recover. Progress is another transaction on the
+ * bus or one more queued, a descriptor scheduled again is queued again. The
+ * hang is found by the first call TWI_TIMEOUT_MS after one that saw it.
+ * Thread context, any task, e.g. the main loop as well as the waits here
+ */
+void twi_supervise(void)
+{
+    nrf_twi_mngr_transaction_t const * p_current;
+    uint32_t starts;
+    uint32_t now = app_timer_cnt_get();
+    bool hung = false;
+
+    CRITICAL_REGION_ENTER();
+    p_current = m_twi_mngr.p_nrf_twi_mngr_cb->p_current_transaction;
+    starts = m_scheduled + m_perform_starts;
+    if (p_current == NULL || p_current != m_watched || starts != m_watched_starts)
+    {
+        m_watched = p_current;
+        m_watched_starts = starts;
+        m_watched_ticks = now;
+    }
+    else if (app_timer_cnt_diff_compute(now, m_watched_ticks) >= APP_TIMER_TICKS(TWI_TIMEOUT_MS))
+    {
+        //another caller sees a new transaction until this one has recovered
+        m_watched = NULL;
+        hung = true;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (hung)
+        twi_recover();
+}
+
+/*
+ * @brief Queues a transaction behind any already scheduled, its callback runs
+ * from the twi interrupt. The descriptor, its transfers and their buffers
+ * must stay valid until then
+ * @return 0 if success, -2 if the queue is full
+ */
+int8_t twi_schedule(nrf_twi_mngr_transaction_t const * p_transaction)
+{
+    if (nrf_twi_mngr_schedule(&m_twi_mngr, p_transaction) != NRF_SUCCESS)
+        return -2;
+    m_scheduled++;
+
+    return 0;
+}
+
+/*
+ * @brief Queues the transfers as one transaction and sleeps until it is done.
+ * Must not be called from a transaction callback or any interrupt
+ * at or above TWI_IRQ_PRIORITY
+ * @return 0 if success, -1 if the transaction failed (e.g. slave NACK), -2 if the queue is full
+ */
+int8_t twi_perform(nrf_twi_mngr_transfer_t const * p_transfers, uint8_t number_of_transfers)
+{
+    ret_code_t err_code;
+
+    m_perform_starts++;
+    err_code = nrf_twi_mngr_perform(&m_twi_mngr, NULL, p_transfers, number_of_transfers, twi_wait_event);
+    if (err_code == NRF_ERROR_NO_MEM)
+        return -2;
+    m_performed++;
+    if (err_code != NRF_SUCCESS)
+    {
+        //the sampling may be waiting on the bus, the log would stall it further
+        TRACE(TRACE_ID_TWI_ERROR, 0, err_code);
+        m_errors++;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * @return the twi_perform transactions that failed since startup, a scheduled
+ * transaction reports its result to its own callback
+ */
+uint32_t twi_error_count(void)
+{
+    return m_errors;
+}
+
+/*
+ * Transactions that went on the bus since startup, the background ones of
+ * twi_schedule and the blocking ones of twi_perform, failed ones included
+ */
+void twi_xfer_counts(uint32_t *p_scheduled, uint32_t *p_performed)
+{
+    *p_scheduled = m_scheduled;
+    *p_performed = m_performed;
+}
+
+bool twi_is_idle(void)
+{
+    return nrf_twi_mngr_is_idle(&m_twi_mngr);
+}
+
+void twi_wait_idle(void)
+{
+    while(!twi_is_idle())
+    {
+        __WFE();
+        twi_supervise();
+    }
+}
+
+/*
+ * @return the transactions twi_supervise abandoned since startup
+ */
+uint32_t twi_timeout_count(void)
+{
+    return m_timeouts;
+}
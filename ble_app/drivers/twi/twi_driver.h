@@ -0,0 +1,53 @@
+//-------------------------------------------
+// Title: twi_driver.h
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Shared I2C bus for the VCNL4040 and DS1388, built on the
+// SDK's TWI transaction manager (nrf_twi_mngr). Drivers either schedule
+// transactions that finish in the background with a callback, or perform
+// them and sleep until they are done. A transaction that does not finish
+// within TWI_TIMEOUT_MS, e.g. a slave holding SDA low, is abandoned by
+// twi_supervise: the bus is cleared and the next ones go on.
+//-------------------------------------------
+#ifndef TWI_DRIVER_H
+#define TWI_DRIVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "boards.h"
+#include "nrf_twi_mngr.h"
+#include "app_util_platform.h"
+#include "app_error.h"
+
+// TWI instance ID
+#define TWI_INSTANCE_ID 1
+
+// Maximum number of transactions waiting behind the one in progress
+#define TWI_QUEUE_SIZE 4
+
+// Longest a transaction may keep the bus before twi_supervise abandons it, a
+// whole queue at 400 kHz takes a few ms
+#define TWI_TIMEOUT_MS 20
+
+// An app can set it in its sdk_config.h, e.g. to match SPI_IRQ_PRIORITY
+#ifndef TWI_IRQ_PRIORITY
+#define TWI_IRQ_PRIORITY APP_IRQ_PRIORITY_HIGH
+#endif
+
+/**
+ * @brief Called from the twi interrupt when a scheduled transaction finishes
+ * @param result 0 if success otherwise -1
+ */
+typedef void (*twi_xfer_callback_t)(int8_t result, void * p_context);
+
+void twi_init(void);
+
+int8_t twi_schedule(nrf_twi_mngr_transaction_t const * p_transaction);
+int8_t twi_perform(nrf_twi_mngr_transfer_t const * p_transfers, uint8_t number_of_transfers);
+uint32_t twi_error_count(void);
+void twi_xfer_counts(uint32_t *p_scheduled, uint32_t *p_performed);
+bool twi_is_idle(void);
+void twi_wait_idle(void);
+void twi_supervise(void);
+uint32_t twi_timeout_count(void);
+
+#endif //TWI_DRIVER_H
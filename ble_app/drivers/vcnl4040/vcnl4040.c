@@ -7,49 +7,205 @@
 // Referenced code: https://github.com/sparkfun/SparkFun_VCNL4040_Arduino_Library/blob/master/src/SparkFun_VCNL4040_Arduino_Library.cpp
 //-------------------------------------------
 #include "vcnl4040.h"
+#include "nrf_pt.h"
+#include "sensor_int.h"
 
-// Proximity sensor configuration register values
-static uint8_t ps_conf1_data =	(0 << 7) | (0 << 6) | (0 << 5) | (0 << 4) | (1 << 3) | (1 << 2) | (1 << 1) | (0 << 0);
-static uint8_t ps_conf2_data =	(0 << 7) | (0 << 6) | (0 << 5) | (0 << 4) | (1 << 3) | (0 << 2) | (0 << 1) | (0 << 0);
-static uint8_t ps_conf3_data =	(0 << 7) | (0 << 6) | (0 << 5) | (1 << 4) | (0 << 3) | (0 << 2) | (0 << 1) | (0 << 0);
-static uint8_t ps_ms_data =		(0 << 7) | (0 << 6) | (0 << 5) | (0 << 4) | (0 << 3) | (1 << 2) | (1 << 1) | (1 << 0);
- 
-/* Indicates if operation on I2C has ended. */
-volatile bool m_xfer_done = false;
+// Proximity sensor configuration register values: 1/40 duty, one reading per interrupt, 8T integration,
+// 16 bit output, smart persistence, 200 mA LED
+static const uint8_t ps_conf1_data = VCNL4040_PS_CONF1_VAL(VCNL4040_PS_DUTY_40, 0, VCNL4040_PS_IT_8T, 0);
+static const uint8_t ps_conf2_data = VCNL4040_PS_CONF2_VAL(1, 0);
+static const uint8_t ps_conf3_data = VCNL4040_PS_CONF3_VAL(0, 1, 0);
+static const uint8_t ps_ms_data = VCNL4040_PS_MS_VAL(0, VCNL4040_LED_I_200MA);
+
+// PS_CONF1 of each vcnl4040_rate_t, 8T integration and the sensor on
+static const uint8_t m_rate_conf1[VCNL4040_RATES] = {
+    [VCNL4040_RATE_SLOW] = VCNL4040_PS_CONF1_VAL(VCNL4040_PS_DUTY_320, 2, VCNL4040_PS_IT_8T, 0),
+    [VCNL4040_RATE_FAST] = VCNL4040_PS_CONF1_VAL(VCNL4040_PS_DUTY_40, 1, VCNL4040_PS_IT_8T, 0),
+};
 
-/* TWI instance. */
-const nrf_drv_twi_t twi = NRF_DRV_TWI_INSTANCE(TWI_INSTANCE_ID);
+// the fields at their widest cover their bits of the datasheet, none overlap
+STATIC_ASSERT(VCNL4040_PS_CONF1_VAL(3, 3, 7, 1) == 0xFF);
+STATIC_ASSERT(VCNL4040_PS_CONF2_VAL(1, 3) == 0x0B);
+STATIC_ASSERT(VCNL4040_PS_CONF3_VAL(3, 1, 1) == 0x78);
+STATIC_ASSERT(VCNL4040_PS_MS_VAL(1, 7) == 0x47);
+ 
+/* Register read by every proximity sample. */
+static uint8_t m_ps_data_reg = VCNL4040_PS_DATA;
 
 /* Buffer for samples read from proximity sensor. */
-static uint8_t m_sample_lsb;
-static uint8_t m_sample_msb;
-static uint16_t m_sample;
+static uint8_t m_sample[2];
 
 volatile uint16_t prox_val = 0;
 
-/**
- * @brief TWI events handler.
+/* Background proximity read, see vcnl4040_schedule_read. */
+static twi_xfer_callback_t m_read_callback;
+static void * m_read_context;
+static volatile bool m_read_pending = false;
+
+static nrf_twi_mngr_transfer_t const m_read_transfers[] = {
+    NRF_TWI_MNGR_WRITE(VCNL4040_ADDR, &m_ps_data_reg, sizeof(m_ps_data_reg), NRF_TWI_MNGR_NO_STOP),
+    NRF_TWI_MNGR_READ(VCNL4040_ADDR, m_sample, sizeof(m_sample), 0)
+};
+
+static void vcnl4040_read_done(ret_code_t result, void * p_user_data);
+
+static nrf_twi_mngr_transaction_t const m_read_transaction = {
+    .callback            = vcnl4040_read_done,
+    .p_user_data         = NULL,
+    .p_transfers         = m_read_transfers,
+    .number_of_transfers = ARRAY_SIZE(m_read_transfers),
+    .p_required_twi_cfg  = NULL
+};
+
+/* Wear state updated by the INT_FLAG read each interrupt schedules. */
+static uint8_t m_int_flag_reg = VCNL4040_INT_FLAG;
+static uint8_t m_int_flag[2];
+static volatile bool m_worn = false;
+static volatile bool m_int_flag_read_needed = false;
+static volatile uint32_t m_transitions = 0;
+
+static nrf_twi_mngr_transfer_t const m_int_flag_transfers[] = {
+    NRF_TWI_MNGR_WRITE(VCNL4040_ADDR, &m_int_flag_reg, sizeof(m_int_flag_reg), NRF_TWI_MNGR_NO_STOP),
+    NRF_TWI_MNGR_READ(VCNL4040_ADDR, m_int_flag, sizeof(m_int_flag), 0)
+};
+
+static void vcnl4040_int_flag_done(ret_code_t result, void * p_user_data);
+
+static nrf_twi_mngr_transaction_t const m_int_flag_transaction = {
+    .callback            = vcnl4040_int_flag_done,
+    .p_user_data         = NULL,
+    .p_transfers         = m_int_flag_transfers,
+    .number_of_transfers = ARRAY_SIZE(m_int_flag_transfers),
+    .p_required_twi_cfg  = NULL
+};
+
+/* Background id read, see vcnl4040_schedule_id_read. */
+static uint8_t m_id_reg = VCNL4040_ID;
+static uint8_t m_id[2];
+static twi_xfer_callback_t m_id_callback;
+static void * m_id_context;
+static volatile bool m_id_pending = false;
+
+static nrf_twi_mngr_transfer_t const m_id_transfers[] = {
+    NRF_TWI_MNGR_WRITE(VCNL4040_ADDR, &m_id_reg, sizeof(m_id_reg), NRF_TWI_MNGR_NO_STOP),
+    NRF_TWI_MNGR_READ(VCNL4040_ADDR, m_id, sizeof(m_id), 0)
+};
+
+static void vcnl4040_id_done(ret_code_t result, void * p_user_data);
+
+static nrf_twi_mngr_transaction_t const m_id_transaction = {
+    .callback            = vcnl4040_id_done,
+    .p_user_data         = NULL,
+    .p_transfers         = m_id_transfers,
+    .number_of_transfers = ARRAY_SIZE(m_id_transfers),
+    .p_required_twi_cfg  = NULL
+};
+
+/* Background rate change, see vcnl4040_rate_set. */
+static uint8_t m_rate_reg[3];
+static vcnl4040_rate_t m_rate = VCNL4040_RATE_FAST;
+static vcnl4040_rate_t m_rate_next;
+static volatile bool m_rate_pending = false;
+
+static nrf_twi_mngr_transfer_t const m_rate_transfers[] = {
+    NRF_TWI_MNGR_WRITE(VCNL4040_ADDR, m_rate_reg, sizeof(m_rate_reg), 0)
+};
+
+static void vcnl4040_rate_done(ret_code_t result, void * p_user_data);
+
+static nrf_twi_mngr_transaction_t const m_rate_transaction = {
+    .callback            = vcnl4040_rate_done,
+    .p_user_data         = NULL,
+    .p_transfers         = m_rate_transfers,
+    .number_of_transfers = ARRAY_SIZE(m_rate_transfers),
+    .p_required_twi_cfg  = NULL
+};
+
+/* Background configuration, see vcnl4040_config_thread. */
+static uint8_t m_conf3_reg[3];
+static uint8_t m_conf1_reg[3];
+static volatile bool m_config_pending;
+static volatile bool m_config_ok;
+
+static nrf_twi_mngr_transfer_t const m_config_transfers[] = {
+    NRF_TWI_MNGR_WRITE(VCNL4040_ADDR, m_conf3_reg, sizeof(m_conf3_reg), 0),
+    NRF_TWI_MNGR_WRITE(VCNL4040_ADDR, m_conf1_reg, sizeof(m_conf1_reg), 0)
+};
+
+static void vcnl4040_config_done(ret_code_t result, void * p_user_data);
+
+static nrf_twi_mngr_transaction_t const m_config_transaction = {
+    .callback            = vcnl4040_config_done,
+    .p_user_data         = NULL,
+    .p_transfers         = m_config_transfers,
+    .number_of_transfers = ARRAY_SIZE(m_config_transfers),
+    .p_required_twi_cfg  = NULL
+};
+
+/*
+ * the LSB and MSB of the data are concatenated to give full 16-bit data
+ */
+static uint16_t vcnl4040_sample_value(void)
+{
+    return (((uint16_t)m_sample[1]) << 8) | m_sample[0];
+}
+
+static void vcnl4040_read_done(ret_code_t result, void * p_user_data)
+{
+    if (result == NRF_SUCCESS)
+        prox_val = vcnl4040_sample_value();
+    m_read_pending = false;
+
+    if (m_read_callback != NULL)
+        m_read_callback((result == NRF_SUCCESS) ? 0 : -1, m_read_context);
+}
+
+/*
+ * The flags are in the upper byte. A failed read is retried by vcnl4040_is_worn
+ * while the INT pin is still held low
  */
-void twi_handler(nrf_drv_twi_evt_t const * p_event, void * p_context)
+static void vcnl4040_int_flag_done(ret_code_t result, void * p_user_data)
 {
-    // Should specific errors occur in I2C communication (such as slave NACK),
-    // corresponding error message is printed to serial
-    switch (p_event->type)
+    if (result != NRF_SUCCESS)
     {
-        case NRF_DRV_TWI_EVT_DONE:
-            m_xfer_done = true;
-            break;
-        case NRF_DRV_TWI_EVT_DATA_NACK:
-            NRF_LOG_INFO("\r\nDATA NACK ERROR");
-            break;
-        case NRF_DRV_TWI_EVT_ADDRESS_NACK:
-            NRF_LOG_INFO("\r\nADDRESS NACK ERROR");
-            break;
-        default:
-            break;
+        m_int_flag_read_needed = true;
+        return;
     }
+
+    if (m_int_flag[1] & (VCNL4040_PS_IF_CLOSE_MSK | VCNL4040_PS_IF_AWAY_MSK))
+        m_transitions++;
+    if (m_int_flag[1] & VCNL4040_PS_IF_CLOSE_MSK)
+        m_worn = true;
+    else if (m_int_flag[1] & VCNL4040_PS_IF_AWAY_MSK)
+        m_worn = false;
+}
+
+static void vcnl4040_id_done(ret_code_t result, void * p_user_data)
+{
+    m_id_pending = false;
+
+    if (m_id_callback != NULL)
+        m_id_callback((result == NRF_SUCCESS) ? 0 : -1, m_id_context);
+}
+
+static void vcnl4040_rate_done(ret_code_t result, void * p_user_data)
+{
+    if (result == NRF_SUCCESS)
+        m_rate = m_rate_next;
+    m_rate_pending = false;
+}
+
+static void vcnl4040_schedule_int_flag_read(void)
+{
+    m_int_flag_read_needed = (twi_schedule(&m_int_flag_transaction) < 0);
 }
 
+static void vcnl4040_int_handler(uint32_t pin)
+{
+    // the flags are read in the background, the twi interrupt runs
+    // at a higher priority than this handler
+    vcnl4040_schedule_int_flag_read();
+}
 
 /**
  * @brief Function for setting active mode on VCNL4040 proximity sensor
@@ -59,40 +215,145 @@ void vcnl4040_config(void)
 
     NRF_LOG_INFO("Configuring VCNL...");
 
-	uint8_t reg1[3] = {VCNL4040_PS_CONF3, ps_conf3_data, ps_ms_data};
-    m_xfer_done = false;
-    nrf_drv_twi_tx(&twi, VCNL4040_ADDR, reg1, sizeof(reg1), false);
-    while (m_xfer_done == false);
-	
+    uint8_t reg1[3] = {VCNL4040_PS_CONF3, ps_conf3_data, ps_ms_data};
     uint8_t reg2[3] = {VCNL4040_PS_CONF1, ps_conf1_data, ps_conf2_data};
-    m_xfer_done = false;
-    nrf_drv_twi_tx(&twi, VCNL4040_ADDR, reg2, sizeof(reg2), false);
-    while (m_xfer_done == false);
+    nrf_twi_mngr_transfer_t const config_transfers[] = {
+        NRF_TWI_MNGR_WRITE(VCNL4040_ADDR, reg1, sizeof(reg1), 0),
+        NRF_TWI_MNGR_WRITE(VCNL4040_ADDR, reg2, sizeof(reg2), 0)
+    };
+
+    twi_perform(config_transfers, ARRAY_SIZE(config_transfers));
     NRF_LOG_INFO("VCNL CONFIG DONE")
 }
 
+static void vcnl4040_config_done(ret_code_t result, void * p_user_data)
+{
+    m_config_ok = (result == NRF_SUCCESS);
+    m_config_pending = false;
+}
+
+/**
+ * @brief Same as vcnl4040_config but returns while the writes are on the bus,
+ * resume it until it ends (PT_SCHEDULE) after PT_INIT. Thread context, after
+ * twi_init
+ * @param pt - protothread state of the configuration
+ * @return PT_WAITING until the sensor is configured, PT_ENDED then
+ */
+PT_THREAD(vcnl4040_config_thread(struct pt *pt))
+{
+    PT_BEGIN(pt);
+    UNUSED_VARIABLE(PT_YIELD_FLAG); //no PT_YIELD, the waits are on the bus and the timer
+
+    m_conf3_reg[0] = VCNL4040_PS_CONF3;
+    m_conf3_reg[1] = ps_conf3_data;
+    m_conf3_reg[2] = ps_ms_data;
+    m_conf1_reg[0] = VCNL4040_PS_CONF1;
+    m_conf1_reg[1] = ps_conf1_data;
+    m_conf1_reg[2] = ps_conf2_data;
+    //the bus queue may be full of the background reads, the writes retry at each resume
+    m_config_pending = true;
+    PT_WAIT_UNTIL(pt, twi_schedule(&m_config_transaction) == 0);
+    PT_WAIT_WHILE(pt, m_config_pending);
+
+    if (!m_config_ok)
+        NRF_LOG_ERROR("VCNL config failed");
+    NRF_LOG_INFO("VCNL CONFIG DONE");
+
+    PT_END(pt);
+}
+
 /**
- * @brief initialization.
+ * @brief Programs PS_THDH to PROX_THRESHOLD and PS_THDL to PROX_OFF_THRESHOLD
+ * and enables the close and away interrupts on VCNL4040_INT_PIN, so putting the
+ * helmet on or taking it off is signalled by a GPIOTE event instead of polling.
+ * The initial wear state comes from one proximity read, the sensor starts at
+ * VCNL4040_RATE_FAST. Call after vcnl4040_config and twi_init
  */
-void twi_init (void)
-{
-    ret_code_t err_code;
-    // Initializes the I2C connection to 400 kHz,
-    // using the SDA and SCL pins for the board
-    // (see README to change which board/platform is in use)
-
-    const nrf_drv_twi_config_t twi_config = {
-       .scl                = I2C_SCL,
-       .sda                = I2C_SDA,
-       .frequency          = NRF_DRV_TWI_FREQ_400K,
-       .interrupt_priority = APP_IRQ_PRIORITY_HIGH,
-       .clear_bus_init     = false
+void vcnl4040_int_init(void)
+{
+    // the three command registers in one bus transaction
+    uint8_t thdl_reg[3] = {VCNL4040_PS_THDL, PROX_OFF_THRESHOLD & 0xFF, PROX_OFF_THRESHOLD >> 8};
+    uint8_t thdh_reg[3] = {VCNL4040_PS_THDH, PROX_THRESHOLD & 0xFF, PROX_THRESHOLD >> 8};
+    uint8_t conf1_reg[3] = {VCNL4040_PS_CONF1, m_rate_conf1[VCNL4040_RATE_FAST],
+                            ps_conf2_data | VCNL4040_PS_CONF2_VAL(0, VCNL4040_PS_INT_CLOSE_AWAY)};
+    nrf_twi_mngr_transfer_t const int_transfers[] = {
+        NRF_TWI_MNGR_WRITE(VCNL4040_ADDR, thdl_reg, sizeof(thdl_reg), 0),
+        NRF_TWI_MNGR_WRITE(VCNL4040_ADDR, thdh_reg, sizeof(thdh_reg), 0),
+        NRF_TWI_MNGR_WRITE(VCNL4040_ADDR, conf1_reg, sizeof(conf1_reg), 0)
     };
 
-    err_code = nrf_drv_twi_init(&twi, &twi_config, twi_handler, NULL);
-    APP_ERROR_CHECK(err_code);
+    twi_perform(int_transfers, ARRAY_SIZE(int_transfers));
+
+    // clears any flag raised while configuring
+    twi_perform(m_int_flag_transfers, ARRAY_SIZE(m_int_flag_transfers));
+    if (twi_perform(m_read_transfers, ARRAY_SIZE(m_read_transfers)) == 0)
+        prox_val = vcnl4040_sample_value();
+    m_worn = (prox_val > PROX_THRESHOLD);
+    m_int_flag_read_needed = false;
+    m_rate = VCNL4040_RATE_FAST;
+
+    // a sensor_int line on the PORT event, the wear changes need no precise timing
+    APP_ERROR_CHECK_BOOL(sensor_int_add(VCNL4040_INT_PIN, false, NRF_GPIO_PIN_PULLUP, vcnl4040_int_handler) == 0);
+}
+
+/**
+ * @brief Returns the wear state last signalled by the proximity interrupt.
+ * Cheap enough to call every loop iteration, the bus is only used when a
+ * flag read has to be retried
+ */
+bool vcnl4040_is_worn(void)
+{
+    if (m_int_flag_read_needed && !nrf_gpio_pin_read(VCNL4040_INT_PIN))
+    {
+        vcnl4040_schedule_int_flag_read();
+    }
+
+    return m_worn;
+}
+
+/**
+ * @brief Returns the count of the close and away interrupts since the boot, a
+ * change of it is a change of the wear state, or one that was undone in between
+ */
+uint32_t vcnl4040_transitions(void)
+{
+    return m_transitions;
+}
+
+/**
+ * @brief Writes the duty and persistence of a measurement rate to PS_CONF1 on
+ * the shared I2C bus and returns immediately, the thresholds and the interrupts
+ * are kept. Thread context, after vcnl4040_int_init
+ * @return 0 if success or the rate is already set, -2 if a change is pending
+ * or the bus queue is full, to be retried
+ */
+int8_t vcnl4040_rate_set(vcnl4040_rate_t rate)
+{
+    if (m_rate_pending)
+        return -2;
+    if (rate == m_rate || rate >= VCNL4040_RATES)
+        return 0;
+
+    m_rate_reg[0] = VCNL4040_PS_CONF1;
+    m_rate_reg[1] = m_rate_conf1[rate];
+    m_rate_reg[2] = ps_conf2_data | VCNL4040_PS_CONF2_VAL(0, VCNL4040_PS_INT_CLOSE_AWAY);
+    m_rate_next = rate;
+    m_rate_pending = true;
+    if (twi_schedule(&m_rate_transaction) < 0)
+    {
+        m_rate_pending = false;
+        return -2;
+    }
+
+    return 0;
+}
 
-    nrf_drv_twi_enable(&twi);
+/**
+ * @brief Returns the measurement rate the sensor runs at
+ */
+vcnl4040_rate_t vcnl4040_rate_get(void)
+{
+    return m_rate;
 }
 
 /**
@@ -110,34 +371,82 @@ void twi_init (void)
  */
 void vcnl4040_read_sensor_data(void)
 {
-    m_xfer_done = false;
+    // The VCNL4040's read protocol: the device address is selected, the (16-bit)
+    // register to read is passed and the (16-bit) data is returned after a repeated start
+    do
+    {
+        if (twi_perform(m_read_transfers, ARRAY_SIZE(m_read_transfers)) == 0)
+            prox_val = vcnl4040_sample_value();
+        //NRF_LOG_INFO("Proximity: %d", prox_val);
+    } while(prox_val <= PROX_THRESHOLD);
+}
+
+/**
+ * @brief Schedules one proximity read on the shared I2C bus and returns immediately.
+ * When it finishes the value is available from vcnl4040_get_proximity and
+ * callback (may be NULL) is called from the twi interrupt
+ * @return 0 if success, -2 if a read is already pending or the bus queue is full
+ */
+int8_t vcnl4040_schedule_read(twi_xfer_callback_t callback, void * p_context)
+{
+    if (m_read_pending)
+        return -2;
+
+    m_read_callback = callback;
+    m_read_context = p_context;
+    m_read_pending = true;
+    if (twi_schedule(&m_read_transaction) < 0)
+    {
+        m_read_pending = false;
+        return -2;
+    }
+
+    return 0;
+}
 
-    while(prox_val <= PROX_THRESHOLD){
-        uint8_t reg3[2] = {VCNL4040_PS_DATA, VCNL4040_ADDR};
-        uint8_t reg4[2] = {m_sample_lsb, m_sample_msb};
-        uint8_t *p_ret = reg4;
+/**
+ * @brief Schedules a read of the ID register on the shared I2C bus and returns
+ * immediately, vcnl4040_id_check checks it once callback (may be NULL) was called
+ * @return 0 if success, -2 if an id read is already pending or the bus queue is full
+ */
+int8_t vcnl4040_schedule_id_read(twi_xfer_callback_t callback, void * p_context)
+{
+    if (m_id_pending)
+        return -2;
 
+    memset(m_id, 0, sizeof(m_id));
+    m_id_callback = callback;
+    m_id_context = p_context;
+    m_id_pending = true;
+    if (twi_schedule(&m_id_transaction) < 0)
+    {
+        m_id_pending = false;
+        return -2;
+    }
 
-        // The descriptor below is used to properly handle the VCNL4040's read protocol
-        // The device address is selected, the (16-bit) register to read is passed and the (16-bit) data is returned
-        // See the nrf SDK reference guide for more information on nrf_drv_twi_xfer_desc_t
-        nrf_drv_twi_xfer_desc_t const vcnl_desc = {NRFX_TWI_XFER_TXRX, VCNL4040_ADDR, sizeof(reg3), sizeof(reg4), reg3, p_ret};
-        nrf_drv_twi_xfer(&twi, &vcnl_desc, false);
-        while(nrf_drv_twi_is_busy(&twi) == true);
+    return 0;
+}
 
-        m_sample_lsb = *p_ret; // the LSB of the returned data is stored
-        p_ret++;               // the returned data pointer is incremented to point to the MSB data
-        m_sample_msb = *p_ret; // the MSB of the returned data is stored
+/**
+ * @brief Checks the id of the last vcnl4040_schedule_id_read
+ * @return 0 if it is the vcnl4040 one otherwise -2
+ */
+int8_t vcnl4040_id_check(void)
+{
+    uint16_t id = (((uint16_t)m_id[1]) << 8) | m_id[0];
 
-        m_sample = (((m_sample_msb) << 8) | (m_sample_lsb)); // the LSB and MSB of the data are concatenated to give full 16-bit data
-        prox_val = m_sample;
-        //NRF_LOG_INFO("Proximity: %d", m_sample);
+    if (id != VCNL4040_ID_VAL)
+    {
+        NRF_LOG_ERROR("vcnl4040 id 0x%x", id);
+        return -2;
     }
+    return 0;
+}
 
-    uint8_t reg3[2] = {VCNL4040_PS_DATA, VCNL4040_ADDR};
-    uint8_t reg4[2] = {m_sample_lsb, m_sample_msb};
-    uint8_t *p_ret = reg4;
-    nrf_drv_twi_xfer_desc_t const vcnl_desc = {NRFX_TWI_XFER_TXRX, VCNL4040_ADDR, sizeof(reg3), sizeof(reg4), reg3, p_ret};
-    nrf_drv_twi_xfer(&twi, &vcnl_desc, false);
-    while(nrf_drv_twi_is_busy(&twi) == true);
+/**
+ * @brief Returns the most recent proximity value read from the sensor
+ */
+uint16_t vcnl4040_get_proximity(void)
+{
+    return prox_val;
 }
@@ -16,8 +16,9 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h> 
-#include "nrf_drv_twi.h"	//I2C driver library
+#include "twi_driver.h"	//shared I2C bus
 #include "app_error.h"
+#include "nrf_drv_gpiote.h"
 #include "nrf_delay.h"
 #include "boards.h"
 
@@ -25,11 +26,17 @@
 #include "nrf_log_ctrl.h"
 #include "nrf_log_default_backends.h"
 
-// TWI instance ID
-#define TWI_INSTANCE_ID 1
-
 #define PROX_THRESHOLD 5000
 
+// Proximity below which the helmet counts as taken off again.
+// The gap to PROX_THRESHOLD is the hysteresis of the wear detection
+#define PROX_OFF_THRESHOLD 3000
+
+//VCNL4040_INT_PIN, the proximity interrupt line, comes from the board header
+#ifndef VCNL4040_INT_PIN
+#error "VCNL4040_INT_PIN is not defined by the board header"
+#endif
+
 // Proximity sensor address
 #define VCNL4040_ADDR 0x60U //U >> 1
 
@@ -44,20 +51,87 @@
 #define VCNL4040_PS_CONF2 0x03U //Upper
 #define VCNL4040_PS_CONF3 0x04U //Lower
 #define VCNL4040_PS_MS 0x04U //Upper
+#define VCNL4040_PS_THDL 0x06U
+#define VCNL4040_PS_THDH 0x07U
 #define VCNL4040_PS_DATA 0x08U
+#define VCNL4040_INT_FLAG 0x0BU //Upper
+#define VCNL4040_ID 0x0CU
+#define VCNL4040_ID_VAL 0x0186U //ID_M (version) and ID_L
+
+// PS_CONF1 fields
+#define VCNL4040_PS_DUTY_POS 6U //IRED on/off duty, 0 is 1/40
+#define VCNL4040_PS_PERS_POS 4U //readings past a threshold before the interrupt, 0 is 1
+#define VCNL4040_PS_IT_POS 1U //integration time, VCNL4040_PS_IT_8T the longest
+#define VCNL4040_PS_SD_POS 0U //1 shuts the proximity sensor down
+#define VCNL4040_PS_DUTY_40 0U
+#define VCNL4040_PS_DUTY_320 3U
+#define VCNL4040_PS_IT_8T 7U
+// PS_CONF2 fields
+#define VCNL4040_PS_HD_POS 3U //1 is a 16 bit output
+#define VCNL4040_PS_INT_POS 0U
+// PS_CONF3 fields
+#define VCNL4040_PS_MPS_POS 5U //pulses per reading
+#define VCNL4040_PS_SMART_PERS_POS 4U
+#define VCNL4040_PS_AF_POS 3U //active force mode
+// PS_MS fields
+#define VCNL4040_PS_MS_POS 6U //1 is the logic output mode
+#define VCNL4040_LED_I_POS 0U
+#define VCNL4040_LED_I_200MA 7U
+
+// Command register bytes of the fields, each value masked to its width
+#define VCNL4040_PS_CONF1_VAL(duty, pers, it, sd) ((uint8_t)((((duty) & 0x3) << VCNL4040_PS_DUTY_POS) | \
+                                                             (((pers) & 0x3) << VCNL4040_PS_PERS_POS) | \
+                                                             (((it) & 0x7) << VCNL4040_PS_IT_POS) | \
+                                                             (((sd) & 0x1) << VCNL4040_PS_SD_POS)))
+#define VCNL4040_PS_CONF2_VAL(hd, int_sel) ((uint8_t)((((hd) & 0x1) << VCNL4040_PS_HD_POS) | \
+                                                      (((int_sel) & 0x3) << VCNL4040_PS_INT_POS)))
+#define VCNL4040_PS_CONF3_VAL(mps, smart_pers, af) ((uint8_t)((((mps) & 0x3) << VCNL4040_PS_MPS_POS) | \
+                                                              (((smart_pers) & 0x1) << VCNL4040_PS_SMART_PERS_POS) | \
+                                                              (((af) & 0x1) << VCNL4040_PS_AF_POS)))
+#define VCNL4040_PS_MS_VAL(ms, led_i) ((uint8_t)((((ms) & 0x1) << VCNL4040_PS_MS_POS) | \
+                                                 (((led_i) & 0x7) << VCNL4040_LED_I_POS)))
+
+// PS_CONF2 interrupt selection
+#define VCNL4040_PS_INT_CLOSE_AWAY 0x03U
+// INT_FLAG bits, reading the register clears them and releases the INT pin
+#define VCNL4040_PS_IF_AWAY_MSK 0x01U
+#define VCNL4040_PS_IF_CLOSE_MSK 0x02U
 
 #define NORMAL_MODE 0U
 
-extern const nrf_drv_twi_t twi;
+// Measurement rates of the wear detection, the PS_CONF1 duty and persistence of each.
+// With the 8T integration a reading takes about 40 ms at 1/40 and 320 ms at 1/320,
+// smart persistence confirms a reading past a threshold right away so the slow rate
+// still signals a change well under a second, with an eighth of the LED current
+typedef enum {
+    VCNL4040_RATE_SLOW = 0,     //1/320, 3 readings past a threshold, while the wear state holds
+    VCNL4040_RATE_FAST,         //1/40, 2 readings, around the head going on or off
+    VCNL4040_RATES
+} vcnl4040_rate_t;
 
-extern volatile bool m_xfer_done;
+void vcnl4040_config(void);
 
-void twi_init(void);
+struct pt;
+char vcnl4040_config_thread(struct pt *pt); //PT_THREAD of nrf_pt.h
 
-void twi_handler(nrf_drv_twi_evt_t const * p_event, void * p_context);
+void vcnl4040_read_sensor_data(void);
 
-void vcnl4040_config(void);
+int8_t vcnl4040_schedule_read(twi_xfer_callback_t callback, void * p_context);
 
-void vcnl4040_read_sensor_data(void);
+uint16_t vcnl4040_get_proximity(void);
+
+int8_t vcnl4040_schedule_id_read(twi_xfer_callback_t callback, void * p_context);
+
+int8_t vcnl4040_id_check(void);
+
+void vcnl4040_int_init(void);
+
+bool vcnl4040_is_worn(void);
+
+uint32_t vcnl4040_transitions(void);
+
+int8_t vcnl4040_rate_set(vcnl4040_rate_t rate);
+
+vcnl4040_rate_t vcnl4040_rate_get(void);
 
 #endif // VCNL4040_H
\ No newline at end of file
@@ -0,0 +1,1051 @@
+/**
+ * Copyright (c) 2015 - 2018, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/**
+ * @brief Sideline gateway main file.
+ *
+ * The gateway scans for the helmets, follows the impact summary each one advertises and offloads
+ * the unsynced ones over up to NRF_SDH_BLE_CENTRAL_LINK_COUNT links at a time, the most severe first:
+ * a free link goes to the helmet with the highest advertised peak, then the most events. Every piece
+ * of offload stream goes out on the uart tagged with the helmet's address (gateway_uart.h) and each
+ * event received whole is acked so the helmet moves its watermark on.
+ *
+ * The uart is slower than the links together, so it is what paces them. Over the L2CAP channel a
+ * link only gets credits for an rx buffer once the uart fifo has room for the whole SDU, the buffers
+ * going to the most severe links first, and a helmet that is held back waits without losing data.
+ * A helmet without the channel falls back to the notifications, which cannot be held back: once
+ * they overrun the fifo the link is dropped without acking and the helmet resumes later from its
+ * watermark.
+ *
+ * A helmet that stores an impact while no central is connected advertises it to the gateway that acked its
+ * events last, with high duty directed advertising: the report puts the helmet up for a connect at once,
+ * without the wait after its last offload. The roster keeps the service handles of each helmet it has
+ * offloaded, its next link starts without the service discovery.
+ *
+ * The roster, the links and the acks are kept in the BLE events. The main loop only drains the uart
+ * fifo, posts the rx buffers the fifo has room for and drops the links that are done or stalled.
+ *
+ * Built with ESB_OFFLOAD_ENABLED 1 a helmet is asked for the offload over ESB (esb_offload.h) when
+ * no other one is sending that way: the helmet drops the link and sends in radio timeslots, the
+ * main loop moves its payloads to the uart and the helmet takes its watermark from the radio acks.
+ * The scan and the connects wait for the session, the links up already carry on.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "nordic_common.h"
+#include "nrf.h"
+#include "app_error.h"
+#include "app_util_platform.h"
+#include "ble.h"
+#include "ble_err.h"
+#include "ble_hci.h"
+#include "ble_advdata.h"
+#include "ble_db_discovery.h"
+#include "nrf_sdh.h"
+#include "nrf_sdh_ble.h"
+#include "app_timer.h"
+#include "nrf_ble_gatt.h"
+#include "nrf_pwr_mgmt.h"
+
+#include "nrf_log.h"
+#include "nrf_log_ctrl.h"
+#include "nrf_log_default_backends.h"
+
+#include "ble_ios.h"
+#include "ble_ios_c.h"
+#include "serial_offload.h"
+#include "gateway_uart.h"
+#include "summary_relay.h"
+#if ESB_OFFLOAD_ENABLED
+#include "esb_offload.h"
+#endif
+
+
+#define APP_BLE_OBSERVER_PRIO           3                                       /**< Application's BLE observer priority. You shouldn't need to modify this value. */
+#define APP_BLE_CONN_CFG_TAG            1                                       /**< A tag identifying the SoftDevice BLE configuration. */
+
+#define LINK_COUNT                      NRF_SDH_BLE_CENTRAL_LINK_COUNT          /**< Helmets offloaded at the same time, indexed by connection handle. */
+#define ROSTER_SIZE                     64                                      /**< Helmets followed, a squad and the opponents in range. */
+
+#define SCAN_INTERVAL                   MSEC_TO_UNITS(100, UNIT_0_625_MS)       /**< Scan interval (100 ms). */
+#define SCAN_WINDOW                     MSEC_TO_UNITS(50, UNIT_0_625_MS)        /**< Scan window (50 ms), the links get the rest of the radio. */
+#define CONNECT_TIMEOUT                 MSEC_TO_UNITS(2000, UNIT_10_MS)         /**< Time to reach a helmet before trying another (2 seconds). */
+
+#define CONN_INTERVAL                   MSEC_TO_UNITS(15, UNIT_1_25_MS)         /**< Connection interval (15 ms), shared out between the links. */
+#define SLAVE_LATENCY                   0                                       /**< Slave latency. */
+#define CONN_SUP_TIMEOUT                MSEC_TO_UNITS(4000, UNIT_10_MS)         /**< Connection supervisory time-out (4 seconds). */
+
+#define CLOCK_INTERVAL                  APP_TIMER_TICKS(1000)                   /**< Resolution of the roster and link times (1 second). */
+#define HELMET_STALE_S                  5                                       /**< A helmet not heard for this long is out of range and not connected to. */
+#define HELMET_RETRY_S                  10                                      /**< Wait after a failed connect or an offload that was cut short. */
+#define HELMET_SYNCED_S                 30                                      /**< Wait after a whole offload, the next connect only brings the events since. */
+#define LINK_IDLE_S                     10                                      /**< A link with no offload data for this long is dropped. */
+
+#define HELMET_NONE                     0xFF                                    /**< No roster entry. */
+#define LINK_NONE                       0xFF                                    /**< No link. */
+
+#define DEAD_BEEF                       0xDEADBEEF                              /**< Value used as error code on stack dump, can be used to identify stack location on stack unwind. */
+
+
+/**@brief A helmet heard advertising. */
+typedef struct {
+    ble_gap_addr_t addr;
+    ble_ios_adv_summary_t summary;                                              /**< As last advertised. */
+    uint32_t seen_s;                                                            /**< m_now_s of the last advertisement. */
+    uint32_t retry_s;                                                           /**< Not connected to before this m_now_s. */
+    uint8_t link;                                                               /**< Connection handle of its link or LINK_NONE. */
+    bool used;
+    bool handles_known;                                                         /**< A discovery found handles, the next link reuses them. */
+    ble_ios_c_handles_t handles;
+} helmet_t;
+
+/**@brief An offload in progress. */
+typedef struct {
+    uint8_t helmet;                                                             /**< Roster index or HELMET_NONE when the link is free. */
+    bool l2cap;                                                                 /**< The stream comes over the channel, paced by the rx buffers. */
+    bool esb;                                                                   /**< The helmet was asked for the offload over ESB. */
+    bool acking;                                                                /**< Every frame so far came whole, the events can be acked. */
+    bool done;                                                                  /**< The end frame came. */
+    bool disconnecting;
+    uint32_t events;                                                            /**< Events received whole. */
+    uint32_t last_rx_s;                                                         /**< m_now_s of the last offload data. */
+} link_t;
+
+NRF_BLE_GATT_DEF(m_gatt);                                                       /**< GATT module instance. */
+BLE_DB_DISCOVERY_ARRAY_DEF(m_db_disc, LINK_COUNT);                              /**< Database discovery module instances. */
+BLE_IOS_C_ARRAY_DEF(m_ios_c, LINK_COUNT);                                       /**< Impact Offload Service client instances. */
+APP_TIMER_DEF(m_clock_timer_id);                                                /**< Ticks m_now_s. */
+
+static helmet_t m_roster[ROSTER_SIZE];                                          /**< Helmets heard advertising. */
+static link_t m_links[LINK_COUNT];                                              /**< Offloads, indexed by connection handle. */
+static uint8_t m_connecting = HELMET_NONE;                                      /**< Helmet being connected to, one at a time. */
+static uint8_t m_esb_helmet = HELMET_NONE;                                      /**< Helmet sending over ESB, one at a time. */
+static volatile uint32_t m_now_s = 0;                                           /**< Seconds since the reset. */
+static summary_relay_t m_relay;                                                 /**< Severe hits heard, each is logged once. */
+
+static uint8_t m_scan_data[BLE_GAP_SCAN_BUFFER_MIN];                            /**< Buffer the SoftDevice writes the advertising reports to. */
+static ble_data_t m_scan_buffer = {m_scan_data, sizeof(m_scan_data)};
+
+/**@brief Parameters of the scan between the connects. */
+static ble_gap_scan_params_t const m_scan_params =
+{
+    .active        = 0,
+    .filter_policy = BLE_GAP_SCAN_FP_ACCEPT_ALL,
+    .scan_phys     = BLE_GAP_PHY_1MBPS,
+    .interval      = SCAN_INTERVAL,
+    .window        = SCAN_WINDOW,
+    .timeout       = BLE_GAP_SCAN_TIMEOUT_UNLIMITED,
+};
+
+/**@brief Parameters of the scan that connects to a helmet. */
+static ble_gap_scan_params_t const m_connect_params =
+{
+    .active        = 0,
+    .filter_policy = BLE_GAP_SCAN_FP_ACCEPT_ALL,
+    .scan_phys     = BLE_GAP_PHY_1MBPS,
+    .interval      = SCAN_INTERVAL,
+    .window        = SCAN_INTERVAL,
+    .timeout       = CONNECT_TIMEOUT,
+};
+
+/**@brief Connection parameters of every link, also the answer to a helmet's update request that allows them. */
+static ble_gap_conn_params_t const m_conn_params =
+{
+    .min_conn_interval = CONN_INTERVAL,
+    .max_conn_interval = CONN_INTERVAL,
+    .slave_latency     = SLAVE_LATENCY,
+    .conn_sup_timeout  = CONN_SUP_TIMEOUT,
+};
+
+
+/**@brief Callback function for asserts in the SoftDevice.
+ *
+ * @details This function will be called in case of an assert in the SoftDevice.
+ *
+ * @warning This handler is an example only and does not fit a final product. You need to analyze
+ *          how your product is supposed to react in case of Assert.
+ * @warning On assert from the SoftDevice, the system can only recover on reset.
+ *
+ * @param[in] line_num   Line number of the failing ASSERT call.
+ * @param[in] file_name  File name of the failing ASSERT call.
+ */
+void assert_nrf_callback(uint16_t line_num, const uint8_t * p_file_name)
+{
+    app_error_handler(DEAD_BEEF, line_num, p_file_name);
+}
+
+
+/**@brief Function for handling the clock timer timeout, the only time base of the roster. */
+static void clock_timeout_handler(void * p_context)
+{
+    UNUSED_PARAMETER(p_context);
+    m_now_s++;
+}
+
+
+/**@brief Function for the Timer initialization.
+ *
+ * @details Initializes the timer module and starts the clock of the roster.
+ */
+static void timers_init(void)
+{
+    ret_code_t err_code = app_timer_init();
+    APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_create(&m_clock_timer_id, APP_TIMER_MODE_REPEATED, clock_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_start(m_clock_timer_id, CLOCK_INTERVAL, NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for starting the scan, a scan already running is left alone. */
+static void scan_start(void)
+{
+    ret_code_t err_code;
+
+    if (m_esb_helmet != HELMET_NONE)
+    {
+        return;
+    }
+    err_code = sd_ble_gap_scan_start(&m_scan_params, &m_scan_buffer);
+    if (err_code != NRF_ERROR_INVALID_STATE)
+    {
+        APP_ERROR_CHECK(err_code);
+    }
+}
+
+
+/**@brief Function for ordering two helmets for a link.
+ *
+ * @return True if p_a is offloaded before p_b, the higher peak first and then the more events.
+ */
+static bool helmet_before(helmet_t const * p_a, helmet_t const * p_b)
+{
+    if (p_a->summary.peak_g_x10 != p_b->summary.peak_g_x10)
+    {
+        return p_a->summary.peak_g_x10 > p_b->summary.peak_g_x10;
+    }
+    return p_a->summary.impact_count > p_b->summary.impact_count;
+}
+
+
+/**@brief Function for finding a helmet in the roster.
+ *
+ * @details A helmet not in it yet takes a free entry or, once the roster is full, the one heard least
+ *          recently that is not being offloaded.
+ *
+ * @return The entry or NULL if every one is busy.
+ */
+static helmet_t * helmet_find(ble_gap_addr_t const * p_addr)
+{
+    helmet_t * p_oldest = NULL;
+    uint8_t    i;
+
+    for (i = 0; i < ROSTER_SIZE; i++)
+    {
+        helmet_t * p_helmet = &m_roster[i];
+
+        if (!p_helmet->used)
+        {
+            if (p_oldest == NULL || p_oldest->used)
+            {
+                p_oldest = p_helmet;
+            }
+            continue;
+        }
+        if (p_helmet->addr.addr_type == p_addr->addr_type
+            && memcmp(p_helmet->addr.addr, p_addr->addr, BLE_GAP_ADDR_LEN) == 0)
+        {
+            return p_helmet;
+        }
+        if (p_helmet->link == LINK_NONE && i != m_connecting && i != m_esb_helmet
+            && (p_oldest == NULL || (p_oldest->used && p_helmet->seen_s < p_oldest->seen_s)))
+        {
+            p_oldest = p_helmet;
+        }
+    }
+
+    if (p_oldest != NULL)
+    {
+        memset(p_oldest, 0, sizeof(helmet_t));
+        p_oldest->addr = *p_addr;
+        p_oldest->link = LINK_NONE;
+        p_oldest->used = true;
+    }
+    return p_oldest;
+}
+
+
+/**@brief Function for connecting to the next helmet.
+ *
+ * @details Runs whenever the roster or the links change. While a link is free and no connect is
+ *          pending, the most severe unsynced helmet in range is connected to, the scan making way
+ *          for the connect.
+ */
+static void connect_next(void)
+{
+    helmet_t * p_best = NULL;
+    uint8_t    used   = 0;
+    uint8_t    i;
+    ret_code_t err_code;
+
+    if (m_connecting != HELMET_NONE || m_esb_helmet != HELMET_NONE)
+    {
+        return;
+    }
+    for (i = 0; i < LINK_COUNT; i++)
+    {
+        if (m_links[i].helmet != HELMET_NONE)
+        {
+            used++;
+        }
+    }
+    if (used == LINK_COUNT)
+    {
+        return;
+    }
+
+    for (i = 0; i < ROSTER_SIZE; i++)
+    {
+        helmet_t const * p_helmet = &m_roster[i];
+
+        if (!p_helmet->used || p_helmet->link != LINK_NONE
+            || (p_helmet->summary.flags & BLE_IOS_ADV_FLAG_UNSYNCED) == 0
+            || m_now_s < p_helmet->retry_s || m_now_s - p_helmet->seen_s > HELMET_STALE_S)
+        {
+            continue;
+        }
+        if (p_best == NULL || helmet_before(p_helmet, p_best))
+        {
+            p_best = &m_roster[i];
+        }
+    }
+    if (p_best == NULL)
+    {
+        return;
+    }
+
+    (void) sd_ble_gap_scan_stop();
+    err_code = sd_ble_gap_connect(&p_best->addr, &m_connect_params, &m_conn_params, APP_BLE_CONN_CFG_TAG);
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Connect to %02x%02x failed: 0x%x", p_best->addr.addr[1], p_best->addr.addr[0], err_code);
+        p_best->retry_s = m_now_s + HELMET_RETRY_S;
+        scan_start();
+        return;
+    }
+    m_connecting = p_best - m_roster;
+}
+
+
+/**@brief Function for the uart fifo room the L2CAP rx buffers posted hold, one packet for each. */
+static uint32_t links_rx_reserved(void)
+{
+    uint32_t reserved = 0;
+    uint8_t  i;
+
+    for (i = 0; i < LINK_COUNT; i++)
+    {
+        reserved += ble_ios_c_l2cap_rx_posted(&m_ios_c[i]) * GATEWAY_UART_PACKET_SIZE(BLE_IOS_C_L2CAP_RX_MTU);
+    }
+    return reserved;
+}
+
+
+/**@brief Function for posting the L2CAP rx buffers the uart fifo has room for.
+ *
+ * @details Every buffer posted can bring a whole SDU, so the fifo has to have room for one more
+ *          packet per buffer already posted on any link. The buffers go out one link at a time,
+ *          the most severe helmet first. Called from the BLE events and from the main loop with
+ *          them masked, the rx buffers of a link are not reentrant.
+ */
+static void links_rx_post(void)
+{
+    uint8_t  visited = 0;
+    uint32_t reserved;
+    uint8_t  best;
+    uint8_t  i;
+
+    CRITICAL_REGION_ENTER();
+
+    reserved = links_rx_reserved();
+
+    for (;;)
+    {
+        best = LINK_NONE;
+        for (i = 0; i < LINK_COUNT; i++)
+        {
+            if ((visited & (1 << i)) != 0 || m_links[i].helmet == HELMET_NONE || !m_links[i].l2cap)
+            {
+                continue;
+            }
+            if (best == LINK_NONE
+                || helmet_before(&m_roster[m_links[i].helmet], &m_roster[m_links[best].helmet]))
+            {
+                best = i;
+            }
+        }
+        if (best == LINK_NONE)
+        {
+            break;
+        }
+        visited |= (1 << best);
+
+        while (ble_ios_c_l2cap_rx_posted(&m_ios_c[best]) < BLE_IOS_C_L2CAP_RX_BUFS
+               && gateway_uart_space() >= reserved + GATEWAY_UART_PACKET_SIZE(BLE_IOS_C_L2CAP_RX_MTU)
+               && ble_ios_c_l2cap_rx_post(&m_ios_c[best]) == NRF_SUCCESS)
+        {
+            reserved += GATEWAY_UART_PACKET_SIZE(BLE_IOS_C_L2CAP_RX_MTU);
+        }
+    }
+
+    CRITICAL_REGION_EXIT();
+}
+
+
+/**@brief Function for dropping the links that are done or stalled, called from the main loop. */
+static void links_process(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < LINK_COUNT; i++)
+    {
+        link_t * p_link = &m_links[i];
+
+        if (p_link->helmet == HELMET_NONE || p_link->disconnecting)
+        {
+            continue;
+        }
+        //the last ack has to reach the helmet before the link goes
+        if ((p_link->done && ble_ios_c_write_idle(&m_ios_c[i])) || m_now_s - p_link->last_rx_s > LINK_IDLE_S)
+        {
+            p_link->disconnecting = true;
+            (void) sd_ble_gap_disconnect(i, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+        }
+    }
+}
+
+
+/**@brief Function for starting the offload once the link has its path.
+ *
+ * @param[in] p_ios_c  Client of the link.
+ * @param[in] notify   The stream comes over the notifications, they are enabled first.
+ */
+static void offload_start(ble_ios_c_t * p_ios_c, bool notify)
+{
+    ret_code_t err_code = NRF_SUCCESS;
+
+    if (notify)
+    {
+        err_code = ble_ios_c_notif_enable(p_ios_c);
+    }
+    if (err_code == NRF_SUCCESS)
+    {
+        err_code = ble_ios_c_start(p_ios_c);
+    }
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Offload start failed: 0x%x", err_code);
+        (void) sd_ble_gap_disconnect(p_ios_c->conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+    }
+}
+
+
+#if ESB_OFFLOAD_ENABLED
+/**@brief Function for asking a helmet for the offload over ESB when no other one is sending that way.
+ *
+ * @details The session listens on the helmet's address before the command goes, the helmet drops the link.
+ *
+ * @return True if the helmet was asked.
+ */
+static bool esb_start(ble_ios_c_t * p_ios_c, link_t * p_link)
+{
+    if (m_esb_helmet != HELMET_NONE || esb_offload_rx_start(m_roster[p_link->helmet].addr.addr) != 0)
+    {
+        return false;
+    }
+    if (ble_ios_c_esb_start(p_ios_c) != NRF_SUCCESS)
+    {
+        esb_offload_stop();
+        return false;
+    }
+    p_link->esb  = true;
+    m_esb_helmet = p_link->helmet;
+    (void) sd_ble_gap_scan_stop();
+    return true;
+}
+
+
+/**@brief Function for moving the ESB payloads to the uart while it has room, called from the main loop.
+ *
+ * @details The payloads the uart has no room for wait in the session, which stops acking once full so the
+ *          helmet waits too. The BLE events are masked around each send, they queue packets as well. A
+ *          session the helmet ended leaves it synced, one that went quiet is retried later from its watermark.
+ */
+static void esb_process(void)
+{
+    uint8_t    data[ESB_OFFLOAD_DATA_SIZE];
+    uint8_t    length;
+    bool       sent = true;
+    helmet_t * p_helmet;
+
+    if (m_esb_helmet == HELMET_NONE)
+    {
+        return;
+    }
+    p_helmet = &m_roster[m_esb_helmet];
+
+    while (sent)
+    {
+        sent = false;
+        CRITICAL_REGION_ENTER();
+        if (gateway_uart_space() >= links_rx_reserved() + GATEWAY_UART_PACKET_SIZE(ESB_OFFLOAD_DATA_SIZE)
+            && esb_offload_rx_get(data, &length))
+        {
+            sent = (gateway_uart_send(p_helmet->addr.addr, data, length) == 0);
+        }
+        CRITICAL_REGION_EXIT();
+    }
+
+    if (!esb_offload_rx_done())
+    {
+        return;
+    }
+    if (esb_offload_failed())
+    {
+        NRF_LOG_WARNING("Helmet %02x%02x went quiet over ESB", p_helmet->addr.addr[1], p_helmet->addr.addr[0]);
+        p_helmet->retry_s = m_now_s + HELMET_RETRY_S;
+    }
+    else
+    {
+        NRF_LOG_INFO("Helmet %02x%02x done over ESB", p_helmet->addr.addr[1], p_helmet->addr.addr[0]);
+        p_helmet->summary.flags &= ~BLE_IOS_ADV_FLAG_UNSYNCED;
+        p_helmet->retry_s = m_now_s + HELMET_SYNCED_S;
+    }
+    esb_offload_stop();
+    m_esb_helmet = HELMET_NONE;
+    scan_start();
+    connect_next();
+}
+#endif
+
+
+/**@brief Function for handling the Impact Offload Service client events.
+ *
+ * @details Forwards the stream to the uart and acks every event that came whole, an event after a
+ *          frame that did not is left for the next offload to resend.
+ */
+static void ios_c_evt_handler(ble_ios_c_t * p_ios_c, ble_ios_c_evt_t const * p_evt)
+{
+    link_t *   p_link;
+    helmet_t * p_helmet;
+
+    if (p_evt->conn_handle >= LINK_COUNT || m_links[p_evt->conn_handle].helmet == HELMET_NONE)
+    {
+        return;
+    }
+    p_link   = &m_links[p_evt->conn_handle];
+    p_helmet = &m_roster[p_link->helmet];
+
+    switch (p_evt->evt_type)
+    {
+        case BLE_IOS_C_EVT_DISCOVERY_COMPLETE:
+            ble_ios_c_handles_get(p_ios_c, &p_helmet->handles);
+            p_helmet->handles_known = true;
+#if ESB_OFFLOAD_ENABLED
+            if (esb_start(p_ios_c, p_link))
+            {
+                break;
+            }
+#endif
+            if (ble_ios_c_l2cap_open(p_ios_c) != NRF_SUCCESS)
+            {
+                offload_start(p_ios_c, true);
+            }
+            break;
+
+        case BLE_IOS_C_EVT_L2CAP_OPEN:
+            p_link->l2cap = true;
+            links_rx_post();
+            offload_start(p_ios_c, false);
+            break;
+
+        case BLE_IOS_C_EVT_L2CAP_REFUSED:
+            offload_start(p_ios_c, true);
+            break;
+
+        case BLE_IOS_C_EVT_DATA:
+            p_link->last_rx_s = m_now_s;
+            if (gateway_uart_send(p_helmet->addr.addr, p_evt->params.data.p_data, p_evt->params.data.len) < 0)
+            {
+                //only the notifications can overrun, the helmet resends from its watermark
+                NRF_LOG_WARNING("Helmet %02x%02x overran the uart", p_helmet->addr.addr[1], p_helmet->addr.addr[0]);
+                p_link->acking = false;
+                p_link->disconnecting = true;
+                (void) sd_ble_gap_disconnect(p_evt->conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+            }
+            else if (p_link->l2cap)
+            {
+                links_rx_post();
+            }
+            break;
+
+        case BLE_IOS_C_EVT_FRAME:
+            if (!p_evt->params.frame.crc_ok)
+            {
+                NRF_LOG_WARNING("Helmet %02x%02x sent a bad frame", p_helmet->addr.addr[1], p_helmet->addr.addr[0]);
+                p_link->acking = false;
+            }
+            else if (p_evt->params.frame.type == SERIAL_OFFLOAD_FRAME_EVENT)
+            {
+                p_link->events++;
+                if (p_link->acking && ble_ios_c_ack(p_ios_c, p_evt->params.frame.value + 1) != NRF_SUCCESS)
+                {
+                    p_link->acking = false;
+                }
+            }
+            else if (p_evt->params.frame.type == SERIAL_OFFLOAD_FRAME_END)
+            {
+                p_link->done = true;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/**@brief Function for handling the database discovery events.
+ *
+ * @details A connected device without the Impact Offload Service is not a helmet, it is dropped.
+ */
+static void db_disc_handler(ble_db_discovery_evt_t * p_evt)
+{
+    if (p_evt->conn_handle >= LINK_COUNT)
+    {
+        return;
+    }
+
+    switch (p_evt->evt_type)
+    {
+        case BLE_DB_DISCOVERY_COMPLETE:
+            ble_ios_c_on_db_disc_evt(&m_ios_c[p_evt->conn_handle], p_evt);
+            break;
+
+        case BLE_DB_DISCOVERY_SRV_NOT_FOUND:
+        case BLE_DB_DISCOVERY_ERROR:
+            NRF_LOG_WARNING("No offload service on link %d", p_evt->conn_handle);
+            (void) sd_ble_gap_disconnect(p_evt->conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/**@brief Function for taking an advertising report into the roster.
+ *
+ * @details The time sync beacons share the company id, they are told apart by the length. Directed advertising
+ *          to the gateway carries no data, it is a helmet with a new impact that is connected to next. A severe
+ *          hit after the summary is the helmet's own or one it relays from a teammate out of the gateway's range
+ *          (summary_relay.h), it is logged the first time it is heard.
+ */
+static void on_adv_report(ble_gap_evt_adv_report_t const * p_report)
+{
+    ble_ios_adv_summary_t summary;
+    summary_relay_entry_t relay;
+    helmet_t *            p_helmet;
+    uint8_t const *       p_data;
+    uint16_t              offset = 0;
+    uint16_t              length;
+
+    length = ble_advdata_search(p_report->data.p_data, p_report->data.len, &offset,
+                                BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA);
+    p_data = &p_report->data.p_data[offset];
+    if (p_report->type.connectable && p_report->type.directed)
+    {
+        p_helmet = helmet_find(&p_report->peer_addr);
+        if (p_helmet != NULL)
+        {
+            p_helmet->summary.flags |= BLE_IOS_ADV_FLAG_UNSYNCED;
+            p_helmet->seen_s        = m_now_s;
+            p_helmet->retry_s       = m_now_s;
+        }
+    }
+    else if (p_report->type.connectable
+        && (length == sizeof(uint16_t) + sizeof(summary) || length == sizeof(uint16_t) + sizeof(summary) + sizeof(relay))
+        && uint16_decode(p_data) == BLE_IOS_ADV_COMPANY_ID)
+    {
+        memcpy(&summary, &p_data[sizeof(uint16_t)], sizeof(summary));
+        if (length > sizeof(uint16_t) + sizeof(summary))
+        {
+            memcpy(&relay, &p_data[sizeof(uint16_t) + sizeof(summary)], sizeof(relay));
+            if (summary_relay_heard(&m_relay, &relay, m_now_s))
+            {
+                NRF_LOG_WARNING("Severe hit %d.%d g on helmet %02x%02x %d s ago, %d hops",
+                                relay.peak_g_x10/10, relay.peak_g_x10%10, relay.origin[1], relay.origin[0],
+                                relay.age_s, relay.hops);
+            }
+        }
+        p_helmet = helmet_find(&p_report->peer_addr);
+        if (p_helmet != NULL)
+        {
+            p_helmet->summary = summary;
+            p_helmet->seen_s  = m_now_s;
+        }
+    }
+
+    //the scan pauses on every report, an error only means it was stopped meanwhile
+    (void) sd_ble_gap_scan_start(NULL, &m_scan_buffer);
+}
+
+
+/**@brief Function for handling BLE events.
+ *
+ * @param[in]   p_ble_evt   Bluetooth stack event.
+ * @param[in]   p_context   Unused.
+ */
+static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
+{
+    ble_gap_evt_t const * p_gap_evt = &p_ble_evt->evt.gap_evt;
+    uint16_t              conn_handle = p_gap_evt->conn_handle;
+    link_t *              p_link;
+    helmet_t *            p_helmet;
+    ret_code_t            err_code;
+
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_GAP_EVT_ADV_REPORT:
+            on_adv_report(&p_gap_evt->params.adv_report);
+            connect_next();
+            break;
+
+        case BLE_GAP_EVT_CONNECTED:
+            if (m_connecting == HELMET_NONE || conn_handle >= LINK_COUNT)
+            {
+                (void) sd_ble_gap_disconnect(conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+                break;
+            }
+            p_helmet = &m_roster[m_connecting];
+            NRF_LOG_INFO("Helmet %02x%02x connected, peak %d", p_helmet->addr.addr[1], p_helmet->addr.addr[0],
+                         p_helmet->summary.peak_g_x10);
+
+            p_link = &m_links[conn_handle];
+            memset(p_link, 0, sizeof(link_t));
+            p_link->helmet    = m_connecting;
+            p_link->acking    = true;
+            p_link->last_rx_s = m_now_s;
+            p_helmet->link    = conn_handle;
+            m_connecting      = HELMET_NONE;
+
+            // The offload rate is set by the PHY, the helmet asks for 2M too.
+            ble_gap_phys_t const phys =
+            {
+                .rx_phys = BLE_GAP_PHY_2MBPS,
+                .tx_phys = BLE_GAP_PHY_2MBPS,
+            };
+            (void) sd_ble_gap_phy_update(conn_handle, &phys);
+
+            if (p_helmet->handles_known
+                && ble_ios_c_handles_assign(&m_ios_c[conn_handle], conn_handle, &p_helmet->handles) == NRF_SUCCESS)
+            {
+                NRF_LOG_DEBUG("Handles reused, no discovery");
+            }
+            else
+            {
+                memset(&m_db_disc[conn_handle], 0, sizeof(ble_db_discovery_t));
+                err_code = ble_db_discovery_start(&m_db_disc[conn_handle], conn_handle);
+                APP_ERROR_CHECK(err_code);
+            }
+
+            scan_start();
+            connect_next();
+            break;
+
+        case BLE_GAP_EVT_TIMEOUT:
+            if (p_gap_evt->params.timeout.src == BLE_GAP_TIMEOUT_SRC_CONN && m_connecting != HELMET_NONE)
+            {
+                m_roster[m_connecting].retry_s = m_now_s + HELMET_RETRY_S;
+                m_connecting = HELMET_NONE;
+                scan_start();
+                connect_next();
+            }
+            break;
+
+        case BLE_GAP_EVT_DISCONNECTED:
+            if (conn_handle >= LINK_COUNT || m_links[conn_handle].helmet == HELMET_NONE)
+            {
+                break;
+            }
+            p_link   = &m_links[conn_handle];
+            p_helmet = &m_roster[p_link->helmet];
+            NRF_LOG_INFO("Helmet %02x%02x disconnected, %d events", p_helmet->addr.addr[1], p_helmet->addr.addr[0],
+                         p_link->events);
+
+            if (p_link->esb)
+            {
+                // The helmet went over to ESB, esb_process sets when it is tried again.
+            }
+            else if (p_link->done && p_link->acking)
+            {
+                // Synced until it advertises new events.
+                p_helmet->summary.flags &= ~BLE_IOS_ADV_FLAG_UNSYNCED;
+                p_helmet->retry_s = m_now_s + HELMET_SYNCED_S;
+            }
+            else
+            {
+                p_helmet->retry_s = m_now_s + HELMET_RETRY_S;
+            }
+            // Handles a new firmware moved get no data at all, the next link discovers them again.
+            if (!p_link->esb && !p_link->done && p_link->events == 0)
+            {
+                p_helmet->handles_known = false;
+            }
+            p_helmet->link = LINK_NONE;
+            p_link->helmet = HELMET_NONE;
+            connect_next();
+            break;
+
+        case BLE_GAP_EVT_CONN_PARAM_UPDATE_REQUEST:
+        {
+            // The links keep the same interval while the helmets offload so they share the radio evenly,
+            // a helmet done offloading gets the long interval it asks for.
+            ble_gap_conn_params_t params = p_gap_evt->params.conn_param_update_request.conn_params;
+            if (params.min_conn_interval <= CONN_INTERVAL && params.max_conn_interval >= CONN_INTERVAL)
+            {
+                params = m_conn_params;
+            }
+            err_code = sd_ble_gap_conn_param_update(conn_handle, &params);
+            if (err_code != NRF_SUCCESS)
+            {
+                NRF_LOG_WARNING("Connection parameters update failed: 0x%x", err_code);
+            }
+        } break;
+
+        case BLE_GAP_EVT_PHY_UPDATE_REQUEST:
+        {
+            ble_gap_phys_t const phys =
+            {
+                .rx_phys = BLE_GAP_PHY_AUTO,
+                .tx_phys = BLE_GAP_PHY_AUTO,
+            };
+            err_code = sd_ble_gap_phy_update(conn_handle, &phys);
+            APP_ERROR_CHECK(err_code);
+        } break;
+
+        case BLE_GATTC_EVT_TIMEOUT:
+            // Disconnect on GATT Client timeout event.
+            NRF_LOG_DEBUG("GATT Client Timeout.");
+            err_code = sd_ble_gap_disconnect(p_ble_evt->evt.gattc_evt.conn_handle,
+                                             BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+            APP_ERROR_CHECK(err_code);
+            break;
+
+        default:
+            // No implementation needed.
+            break;
+    }
+}
+
+
+/**@brief Function for initializing the BLE stack.
+ *
+ * @details Initializes the SoftDevice and the BLE event interrupt.
+ */
+static void ble_stack_init(void)
+{
+    ret_code_t err_code;
+
+    err_code = nrf_sdh_enable_request();
+    APP_ERROR_CHECK(err_code);
+
+    // Configure the BLE stack using the default settings.
+    // Fetch the start address of the application RAM.
+    uint32_t ram_start = 0;
+    err_code = nrf_sdh_ble_default_cfg_set(APP_BLE_CONN_CFG_TAG, &ram_start);
+    APP_ERROR_CHECK(err_code);
+
+    // One L2CAP channel per link for the offload, the gateway only receives on it.
+    ble_cfg_t ble_cfg;
+    memset(&ble_cfg, 0, sizeof(ble_cfg));
+    ble_cfg.conn_cfg.conn_cfg_tag                        = APP_BLE_CONN_CFG_TAG;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.ch_count      = 1;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.rx_mps        = BLE_IOS_C_L2CAP_RX_MPS;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.tx_mps        = BLE_L2CAP_MPS_MIN;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.rx_queue_size = BLE_IOS_C_L2CAP_RX_BUFS;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.tx_queue_size = 1;
+    err_code = sd_ble_cfg_set(BLE_CONN_CFG_L2CAP, &ble_cfg, ram_start);
+    APP_ERROR_CHECK(err_code);
+
+    // Enable BLE stack.
+    err_code = nrf_sdh_ble_enable(&ram_start);
+    APP_ERROR_CHECK(err_code);
+
+    // Let a connection event run on past NRF_SDH_BLE_GAP_EVENT_LENGTH while the helmet has data to send.
+    ble_opt_t opt;
+    memset(&opt, 0, sizeof(opt));
+    opt.common_opt.conn_evt_ext.enable = 1;
+    err_code = sd_ble_opt_set(BLE_COMMON_OPT_CONN_EVT_EXT, &opt);
+    APP_ERROR_CHECK(err_code);
+
+    // Register a handler for BLE events.
+    NRF_SDH_BLE_OBSERVER(m_ble_observer, APP_BLE_OBSERVER_PRIO, ble_evt_handler, NULL);
+}
+
+
+/**@brief Function for initializing the GATT module, the largest ATT MTU for the notification fallback. */
+static void gatt_init(void)
+{
+    ret_code_t err_code = nrf_ble_gatt_init(&m_gatt, NULL);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = nrf_ble_gatt_att_mtu_central_set(&m_gatt, NRF_SDH_BLE_GATT_MAX_MTU_SIZE);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for initializing the database discovery and a service client per link. */
+static void services_init(void)
+{
+    ble_gap_addr_t addr;
+    ret_code_t     err_code;
+    uint8_t        i;
+
+    err_code = ble_db_discovery_init(db_disc_handler);
+    APP_ERROR_CHECK(err_code);
+
+    for (i = 0; i < LINK_COUNT; i++)
+    {
+        m_links[i].helmet = HELMET_NONE;
+        err_code = ble_ios_c_init(&m_ios_c[i], ios_c_evt_handler);
+        APP_ERROR_CHECK(err_code);
+    }
+
+    err_code = sd_ble_gap_addr_get(&addr);
+    APP_ERROR_CHECK(err_code);
+    summary_relay_init(&m_relay, addr.addr);
+}
+
+
+/**@brief Function for initializing the uart to the host. */
+static void uart_init(void)
+{
+    if (gateway_uart_init() != 0)
+    {
+        APP_ERROR_CHECK(NRF_ERROR_INTERNAL);
+    }
+}
+
+
+/**@brief Function for initializing the nrf log module.
+ */
+static void log_init(void)
+{
+    ret_code_t err_code = NRF_LOG_INIT(NULL);
+    APP_ERROR_CHECK(err_code);
+
+    NRF_LOG_DEFAULT_BACKENDS_INIT();
+}
+
+
+/**@brief Function for initializing power management.
+ */
+static void power_management_init(void)
+{
+    ret_code_t err_code;
+    err_code = nrf_pwr_mgmt_init();
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for handling the idle state (main loop).
+ *
+ * @details If there is no pending log operation, then sleep until next the next event occurs.
+ */
+static void idle_state_handle(void)
+{
+    if (NRF_LOG_PROCESS() == false)
+    {
+        nrf_pwr_mgmt_run();
+    }
+}
+
+
+/**@brief Function for application main entry.
+ */
+int main(void)
+{
+    // Initialize.
+    log_init();
+    timers_init();
+    power_management_init();
+    uart_init();
+    ble_stack_init();
+    gatt_init();
+    services_init();
+
+    // Start execution.
+    NRF_LOG_INFO("Gateway started.");
+    scan_start();
+
+    // Enter main loop, the uart and the timer wake it.
+    for (;;)
+    {
+        links_process();
+        links_rx_post();
+#if ESB_OFFLOAD_ENABLED
+        esb_process();
+#endif
+        if (gateway_uart_process() != 0)
+        {
+            NRF_LOG_WARNING("Uart transfer failed");
+        }
+        idle_state_handle();
+    }
+}
+
+
+/**
+ * @}
+ */
@@ -0,0 +1,294 @@
+//-------------------------------------------
+// Title: calibration.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Offset calibration of the adxl372 and the icm20649 from the
+// sums of the running capture, see calibration.h. The search steps every axis
+// at once, each axis stops once its mean crosses gravity or its trims run out,
+// and keeps the trim that left the smallest mean.
+//-------------------------------------------
+#include <stdlib.h>
+#include <string.h>
+#include "app_timer.h"
+#include "task_manager.h"
+
+#include "calibration.h"
+#include "capture.h"
+#include "device_config.h"
+
+typedef struct {
+    int32_t accel_x10[3];           //tenths of a count
+    int32_t icm_accel[3];
+    int32_t gyro[3];
+} calibration_mean_t;
+
+static int32_t calibration_div_round(int64_t num, int64_t den)
+{
+    return (int32_t) ((num >= 0) ? (num + den/2)/den : (num - den/2)/den);
+}
+
+static int16_t calibration_sat16(int32_t val)
+{
+    return (int16_t) ((val > INT16_MAX) ? INT16_MAX : (val < INT16_MIN) ? INT16_MIN : val);
+}
+
+// The rms of an axis against a limit, n^2 var = n sq - sum^2 without a division
+static bool calibration_still(uint64_t sq_sum, int32_t sum, uint32_t n, uint32_t max_rms)
+{
+    int64_t var_n2 = (int64_t) (sq_sum*n) - (int64_t) sum*sum;
+
+    return var_n2 <= (int64_t) max_rms*max_rms*n*n;
+}
+
+// Waits for the sums from the last restart in the cli task, the capture
+// keeps running from the interrupts meanwhile
+// returns 0 if success, -1 on a timeout, -4 if the board moved
+static int8_t calibration_measure(uint32_t gyro_samples, calibration_mean_t *p_mean)
+{
+    capture_calibration_t sums;
+    uint32_t start = app_timer_cnt_get();
+
+    for (;;)
+    {
+        task_yield();
+        capture_calibrate_sums(&sums);
+        if (sums.accel_samples >= CALIBRATION_ACCEL_SAMPLES && sums.gyro_samples >= gyro_samples
+            && sums.gyro_samples > 0)
+        {
+            break;
+        }
+        if (capture_since_us(start) > CALIBRATION_MEASURE_TIMEOUT_MS*1000UL)
+            return -1;
+    }
+
+    for (int j = 0; j < 3; ++j)
+    {
+        if (!calibration_still(sums.accel_sq_sum[j], sums.accel_sum[j], sums.accel_samples, CALIBRATION_ACCEL_NOISE_MAX)
+            || !calibration_still(sums.gyro_sq_sum[j], sums.gyro_sum[j], sums.gyro_samples, CALIBRATION_GYRO_NOISE_MAX))
+        {
+            return -4;
+        }
+        p_mean->accel_x10[j] = calibration_div_round((int64_t) sums.accel_sum[j]*10, sums.accel_samples);
+        p_mean->icm_accel[j] = calibration_div_round(sums.icm_accel_sum[j], sums.gyro_samples);
+        p_mean->gyro[j] = calibration_div_round(sums.gyro_sum[j], sums.gyro_samples);
+    }
+
+    return 0;
+}
+
+// Fits the gyro drift between the bias at the reference temperature of the model
+// in use and the one just measured, if the two temperatures are far enough apart
+static bool calibration_fit_slope(icm20649_temp_comp_t const *p_old, int16_t const old_bias[3],
+                                  int16_t const bias[3], int16_t temp_cc, int16_t slope[3])
+{
+    int32_t span;
+
+    memcpy(slope, p_old->gyro_slope, 3*sizeof(int16_t));
+    if (p_old->ref_temp_cc == ICM20649_TEMP_UNKNOWN || temp_cc == ICM20649_TEMP_UNKNOWN)
+        return false;
+    span = (int32_t) temp_cc - p_old->ref_temp_cc;
+    if (abs(span) < CALIBRATION_TEMP_SPAN_CC)
+        return false;
+
+    //counts per 0.01 C to 0.001 counts per C
+    for (int j = 0; j < 3; ++j)
+        slope[j] = calibration_sat16(calibration_div_round((int64_t) (bias[j] - old_bias[j])*100000, span));
+    return true;
+}
+
+// Writes the signed trims to the accel through the running capture
+static int8_t calibration_write_trims(int8_t const trim[3])
+{
+    uint8_t offset[3];
+
+    for (int j = 0; j < 3; ++j)
+        offset[j] = (uint8_t) trim[j] & ADXL372_OFFSET_TRIM_MAX;
+    (void) adxl372_set_offset_trim(offset);
+
+    return capture_calibrate_rewrite();
+}
+
+// Steps the trims towards gravity on every axis, leaves the best ones in trim
+static int8_t calibration_search(int32_t const expected_x10[3], int8_t trim[3], uint8_t *p_steps)
+{
+    calibration_mean_t mean;
+    int8_t best[3];
+    int8_t polarity[3] = {1, 1, 1};     //a higher code reads higher, until a step shows otherwise
+    int32_t best_abs[3] = {INT32_MAX, INT32_MAX, INT32_MAX};
+    int32_t prev[3] = {0};
+    bool reversed[3] = {false};
+    bool done[3] = {false};
+    bool all_done;
+    int8_t ret;
+
+    memcpy(best, trim, sizeof(best));
+    for (*p_steps = 0; ; )
+    {
+        ret = calibration_measure(0, &mean);
+        if (ret < 0)
+            return ret;
+
+        all_done = true;
+        for (int j = 0; j < 3; ++j)
+        {
+            int32_t r = mean.accel_x10[j] - expected_x10[j];
+            int32_t r_abs = (r < 0) ? -r : r;
+            int8_t next;
+
+            if (done[j])
+                continue;
+            if (r_abs < best_abs[j])
+            {
+                best_abs[j] = r_abs;
+                best[j] = trim[j];
+            }
+            if (r == 0 || (*p_steps > 0 && (r > 0) != (prev[j] > 0)))
+            {
+                //on gravity or across it, the best of the two sides is kept
+                done[j] = true;
+                continue;
+            }
+            if (*p_steps > 0 && r_abs > ((prev[j] < 0) ? -prev[j] : prev[j]) && !reversed[j])
+            {
+                //the step went away from gravity, the code counts the other way
+                polarity[j] = -polarity[j];
+                reversed[j] = true;
+                trim[j] = best[j];
+            }
+            prev[j] = r;
+
+            next = trim[j] - ((r > 0) ? polarity[j] : -polarity[j]);
+            if (next < CALIBRATION_TRIM_MIN || next > CALIBRATION_TRIM_MAX)
+            {
+                done[j] = true;
+                continue;
+            }
+            trim[j] = next;
+            all_done = false;
+        }
+        if (all_done || *p_steps >= CALIBRATION_MAX_STEPS)
+            break;
+
+        ++*p_steps;
+        ret = calibration_write_trims(trim);
+        if (ret < 0)
+            return ret;
+    }
+
+    memcpy(trim, best, sizeof(best));
+    return 0;
+}
+
+/**
+ * @brief Calibrates both sensors with the board at rest, cli task context.
+ * The capture runs the game profile meanwhile, takes no impacts, and goes
+ * back to its profile after. On success the trims and the bias are in use,
+ * calibration_save() keeps them; on a failure the ones before are restored
+ * @param up_axis - adxl372 axis pointing up, 0 to 2 for x, y, z
+ * @param up_negative - its negative side points up
+ * @return 0 if success, -1 on spi error or a timeout, -2 if the axis is
+ * invalid, -3 if an impact is being recorded or a replay runs, -4 if the board moved
+ */
+int8_t calibration_run(uint8_t up_axis, bool up_negative, calibration_result_t *p_result)
+{
+    sampling_profile_t const *p_restore = capture_profile();
+    int32_t expected_x10[3] = {0};
+    uint8_t old_offset[3];
+    icm20649_data_t old_bias;
+    icm20649_data_t bias;
+    icm20649_temp_comp_t old_comp;
+    icm20649_temp_comp_t comp;
+    calibration_mean_t mean;
+    int8_t trim[3];
+    int16_t *p_bias_accel = &bias.accel_x;
+    int16_t *p_bias_gyro = &bias.gyro_x;
+    int32_t up_counts;
+    int8_t ret;
+
+    if (up_axis > 2)
+        return -2;
+    expected_x10[up_axis] = (up_negative ? -10 : 10)*ADXL372_MG_TO_COUNTS(1000);
+
+    ret = capture_profile_set(sampling_profile_get(SAMPLING_PROFILE_GAME));
+    if (ret < 0)
+        return (ret == -3) ? -3 : -1;
+    if (capture_calibrate_begin() < 0)
+    {
+        (void) capture_profile_set(p_restore);
+        return -3;
+    }
+
+    memcpy(old_offset, adxl372_offset_trim(), sizeof(old_offset));
+    icm20649_get_bias(&old_bias);
+    icm20649_get_temp_comp(&old_comp);
+    for (int j = 0; j < 3; ++j)
+        trim[j] = (int8_t) (old_offset[j] << 4) >> 4;
+
+    memset(p_result, 0, sizeof(*p_result));
+    ret = calibration_search(expected_x10, trim, &p_result->steps);
+    if (ret == 0)
+        ret = calibration_write_trims(trim);
+    if (ret == 0)
+        ret = calibration_measure(CALIBRATION_GYRO_SAMPLES, &mean);
+
+    if (ret < 0)
+    {
+        (void) adxl372_set_offset_trim(old_offset);
+        (void) capture_calibrate_rewrite();
+        capture_calibrate_end();
+        (void) capture_profile_set(p_restore);
+        return ret;
+    }
+
+    //the means are of samples with the old bias at the temperature of the measure taken off
+    bias = old_bias;
+    comp.ref_temp_cc = icm20649_temp_cc();
+    p_result->icm_up_axis = 0;
+    for (int j = 1; j < 3; ++j)
+    {
+        if (abs(mean.icm_accel[j]) > abs(mean.icm_accel[p_result->icm_up_axis]))
+            p_result->icm_up_axis = j;
+    }
+    up_counts = icm20649_accel_lsb_per_g();
+    if (mean.icm_accel[p_result->icm_up_axis] < 0)
+        up_counts = -up_counts;
+    for (int j = 0; j < 3; ++j)
+    {
+        int32_t gravity = (j == p_result->icm_up_axis) ? up_counts : 0;
+
+        p_bias_accel[j] = calibration_sat16(p_bias_accel[j] + mean.icm_accel[j] - gravity);
+        p_bias_gyro[j] = calibration_sat16(p_bias_gyro[j] + mean.gyro[j]
+                                           + icm20649_temp_comp_bias(&old_comp, j, comp.ref_temp_cc));
+        p_result->accel_offset[j] = adxl372_offset_trim()[j];
+        p_result->accel_residual_x10[j] = mean.accel_x10[j] - expected_x10[j];
+        p_result->icm_accel_bias[j] = p_bias_accel[j];
+        p_result->icm_gyro_bias[j] = p_bias_gyro[j];
+    }
+    p_result->icm_temp_cc = comp.ref_temp_cc;
+    p_result->icm_slope_fitted = calibration_fit_slope(&old_comp, &old_bias.gyro_x, p_result->icm_gyro_bias,
+                                                       comp.ref_temp_cc, comp.gyro_slope);
+    memcpy(p_result->icm_gyro_temp_slope, comp.gyro_slope, sizeof(p_result->icm_gyro_temp_slope));
+    //both at once, the bias in use follows the next burst's temperature
+    icm20649_set_bias(&bias);
+    icm20649_set_temp_comp(&comp);
+
+    capture_calibrate_end();
+    return (capture_profile_set(p_restore) < 0) ? -1 : 0;
+}
+
+/*
+ * Keeps the trims and the bias of a calibration in the device config for the
+ * next boot, thread context
+ * @return 0 if the write is queued, -1 if FDS refused it
+ */
+int8_t calibration_save(calibration_result_t const *p_result)
+{
+    device_config_t config = *device_config_get();
+
+    memcpy(config.accel_offset, p_result->accel_offset, sizeof(config.accel_offset));
+    memcpy(config.icm_accel_bias, p_result->icm_accel_bias, sizeof(config.icm_accel_bias));
+    memcpy(config.icm_gyro_bias, p_result->icm_gyro_bias, sizeof(config.icm_gyro_bias));
+    config.icm_bias_temp_cc = p_result->icm_temp_cc;
+    memcpy(config.icm_gyro_temp_slope, p_result->icm_gyro_temp_slope, sizeof(config.icm_gyro_temp_slope));
+
+    return device_config_save(&config);
+}
@@ -0,0 +1,49 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Offset calibration of imu_pcb_rev1_app, run from the cli task with the
+ * board at rest on one of its faces. The sums come from the fifo bursts and
+ * the gyro reads of the running capture (capture_calibrate_begin), at the
+ * game profile's rate whatever profile runs. The adxl372 OFFSET trims are
+ * searched for by writing a trim and measuring the mean it leaves on each
+ * axis, until the mean crosses what gravity alone would read: the trim steps
+ * of figure 36 are not even, so each step is measured rather than worked
+ * out. The icm20649 bias is the mean of its gyro and of its accel less 1 g on
+ * the axis that reads the most of it, and is taken off in software
+ * (icm20649_set_bias). The gyro bias is kept with the die temperature it was
+ * measured at, and a calibration at least CALIBRATION_TEMP_SPAN_CC away from
+ * the last one fits the drift between the two into the per device
+ * temperature model (icm20649_set_temp_comp), a closer one keeps the drift
+ * fitted before. The results go to the device config for the next boot.
+ * A mean that spreads more than the noise of a sensor at rest means the board
+ * moved, and nothing is kept */
+#define CALIBRATION_ACCEL_SAMPLES       4096    //adxl372 samples per measurement, 0.64 s at 6400 Hz
+#define CALIBRATION_GYRO_SAMPLES        256     //icm20649 reads of the final measurement, one per fifo burst
+#define CALIBRATION_ACCEL_NOISE_MAX     8       //counts rms, about 0.8 g
+#define CALIBRATION_GYRO_NOISE_MAX      100     //counts rms, about 6 dps at 2000 dps full scale
+#define CALIBRATION_MEASURE_TIMEOUT_MS  10000
+#define CALIBRATION_MAX_STEPS           24      //trim writes of the search, every code both ways and some
+#define CALIBRATION_TRIM_MIN            (-8)    //OFFSET_x is 4 bit two's complement
+#define CALIBRATION_TRIM_MAX            7
+#define CALIBRATION_TEMP_SPAN_CC        500     //0.01 C between two calibrations that fit the drift, 5 C
+
+typedef struct {
+    uint8_t accel_offset[3];        //adxl372 OFFSET_X..OFFSET_Z written
+    int32_t accel_residual_x10[3];  //mean left with them against gravity, in tenths of a count
+    int16_t icm_accel_bias[3];
+    int16_t icm_gyro_bias[3];       //at icm_temp_cc
+    int16_t icm_temp_cc;            //0.01 C
+    int16_t icm_gyro_temp_slope[3]; //0.001 counts per C
+    bool icm_slope_fitted;          //from this calibration and the last one, otherwise the one kept
+    uint8_t icm_up_axis;            //0 to 2, the icm20649 axis that read gravity
+    uint8_t steps;                  //trim writes of the search
+} calibration_result_t;
+
+int8_t calibration_run(uint8_t up_axis, bool up_negative, calibration_result_t *p_result);
+
+int8_t calibration_save(calibration_result_t const *p_result);
+
+#endif //CALIBRATION_H
@@ -0,0 +1,1388 @@
+//-------------------------------------------
+// Title: capture.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Interrupt driven impact capture for imu_pcb_rev1_app.
+// Every adxl372 fifo watermark queues a fifo read and an icm20649 register
+// read, the fifo burst is filtered and checked by the trigger in the spi
+// interrupt and kept in a pre-trigger ring until an impact starts. The
+// records of the impact are packed straight into a chain of blocks from the
+// capture pool, the thread gets the chain through app_scheduler once the
+// impact is quiet or the longest of the sampling profile and computes its
+// metrics there. The profile sets the adxl372 rate and watermark, the trigger
+// and the capture window, and changes with the sensor bursts held off.
+// A capture takes as many blocks as it has records, so a burst of short
+// impacts can wait for the flash while a long one still fits.
+// Nothing here blocks or logs. The accel and the flash are two devices of
+// spim instance 0, each transaction switches in the pins of its device, so
+// the fifo reads interleave with the flash transactions of the thread in
+// the queue and the fifo is never held off while an impact is committed.
+// A replay feeds a recorded trace to the same burst handler from the
+// thread, the sensor bursts are read and dropped so neither path sees
+// the other's samples. A calibration takes the sensor bursts from the
+// pipeline the same way and only sums them. accel_decimate takes the
+// sensor bursts as the trigger saw them, filtered or not by the profile,
+// down to the live and activity rates for the outputs that are enabled,
+// the live stream takes one of them and the activity log always takes the
+// activity rate with the peak the trigger saw in between. The bursts and
+// the decimated samples reach those stages through sample_bus, each fifo
+// burst is read straight into a block of its pool. Each capture
+// keeps the largest icm20649 counts of its records, the thread steps the
+// ranges of an autorange profile from them before the next impact.
+// The filter, the trigger, the window and the records are capture_core's,
+// this file is its hal on the sensors, the timers and the scheduler
+//-------------------------------------------
+#include <string.h>
+#include "app_scheduler.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "app_error.h"
+#include "nrf_delay.h"
+
+#include "capture.h"
+#include "capture_core.h"
+#include "mono_time.h"
+#include "hf_clock.h"
+#include "spi_driver.h"
+#include "icm20649.h"
+#include "mt25ql256aba.h"
+#include "impact_trigger.h"
+#include "profiler.h"
+#include "stack_watch.h"
+#include "cpu_load.h"
+#include "energy_profiler.h"
+#include "impact_record.h"
+#include "accel_decimate.h"
+#include "live_stream.h"
+#include "activity_log.h"
+#include "sample_bus.h"
+#include "watchdog.h"
+
+//one of the longest captures can record while another is committed, checked for every profile
+STATIC_ASSERT(2*(PRE_TRIGGER_SAMPLES + IMPACT_MAX_SAMPLES) <= CAPTURE_POOL_BLOCKS*RECORD_BLOCK_RECORDS);
+STATIC_ASSERT(CAPTURE_POOL_BLOCKS <= UINT8_MAX); //nrf_balloc keeps 8 bit counts
+
+RECORD_BLOCK_POOL_DEF(m_record_pool, CAPTURE_POOL_BLOCKS);
+WATCHDOG_STAGE_DEF(m_capture_stage, "capture", CAPTURE_STALL_MS);
+static capture_buf_t m_capture_bufs[CAPTURE_BUF_COUNT];
+static capture_core_t m_core;               //filter, trigger, pre-trigger window and the capture recording
+
+static struct adxl372_device m_adxl_dev;
+static adxl372_fifo_read_t m_fifo_read;
+static sample_bus_block_t *m_read_block;    //the fifo read goes into, from the pool or m_spare_block
+static adxl372_accel_data_t m_spare_buf[ADXL_FIFO_MAX_SAMPLES];
+static sample_bus_block_t m_spare_block = {.samples = m_spare_buf};  //read into while the pool is held
+static volatile bool m_read_busy = false;   //fifo read queued and not finished
+static uint32_t m_flash_ticks;              //app timer count at capture_flash_acquire()
+static uint32_t m_flash_hold_max_us;
+//a reset can leave the flash powered down, the first access releases it
+static capture_flash_power_t m_flash_power = CAPTURE_FLASH_ASLEEP;
+static uint32_t m_flash_wake_ticks;         //app timer count at the release
+
+static spi_xfer_t m_gyro_xfer;
+static uint8_t m_gyro_buf[ICM20649_REG_DATA_LENGTH];
+static icm20649_data_t m_gyro_data;         //newest icm20649 read, stored with the accel samples
+static volatile bool m_gyro_busy = false;
+static icm20649_rate_config_t m_icm_config; //of the profile, with the ranges in use
+static uint8_t m_range;                     //IMPACT_RECORD_RANGE of m_icm_config, given to each capture
+
+static accel_decimate_t m_decimate;
+static accel_decimate_output_t m_stream_output;  //decimator output the live stream takes
+
+static pipeline_stats_t *m_stats;
+static capture_done_handler_t m_open_handler;
+static capture_done_handler_t m_done_handler;
+static sampling_profile_t const *m_profile;
+static volatile bool m_held = false;        //no fifo read is started, the sensor is being reconfigured
+static volatile bool m_replaying = false;   //the bursts come from capture_replay_burst()
+static capture_replay_stats_t m_replay_stats;
+static volatile bool m_calibrating = false; //the sensor bursts are summed into m_calibration
+static capture_calibration_t m_calibration;
+static uint8_t m_calibrate_skip;            //bursts left to drop before summing
+
+//stage latencies of the execution model, built with make PROFILER=1
+PROFILER_PROBE_DEF(m_burst_probe, "capture watermark to burst done");
+PROFILER_PROBE_DEF(m_handoff_probe, "capture close to thread");
+PROFILER_PROBE_DEF(m_flash_hold_probe, "capture flash hold");
+STACK_WATCH_DEF(m_int_stack, "accel int");                 //built with make STACK_WATCH=1
+STACK_WATCH_DEF(m_burst_stack, "accel burst");
+CPU_LOAD_DEF(m_int_load, "accel int");                     //built with make CPU_LOAD=1, the default
+CPU_LOAD_DEF(m_burst_load, "accel burst");
+static bool m_read_requested = false;       //watermark seen and its burst not processed yet
+static uint32_t m_request_ticks;            //app timer count of the request of that burst
+static uint32_t m_drain_max_ticks;          //longest request to burst done since the last retune
+static uint32_t m_drain_ticks;              //period of the partial drains, retuned
+static uint16_t m_watermark;                //fifo entries in use, the profile's until retuned
+APP_TIMER_DEF(m_drain_timer_id);            //partial drains while a capture records
+APP_TIMER_DEF(m_tune_timer_id);
+static uint32_t m_samples_read;             //accel samples drained since the start, the arrival count of the newest
+static uint32_t m_burst_sample;             //arrival count in front of the burst being processed
+static bool m_stamped = false;              //the last watermark edge pairs an arrival count with its time
+static bool m_stamping = false;             //INT1 is on a GPIOTE IN channel latching the timebase TIMER
+static uint32_t m_edge_sample;              //arrival count of the sample that raised that edge
+static uint64_t m_edge_us;                  //mono_time_us() of the edge, latched in hardware
+static uint32_t m_sample_ns;                //sample period, fitted between two edges
+#if PROFILER_ENABLED
+static uint32_t m_request_cycles;
+static uint32_t m_flash_cycles;
+#endif
+
+static void capture_read_start(void);
+static void capture_read_request(void);
+static void capture_autorange(capture_buf_t const *p_buf);
+static void capture_watermark_tune(void);
+
+// One instance for both, the accel on its pins and the flash switched in
+// with its pins, clock and mode for each of its transactions
+static void spi_accel_flash_init(void)
+{
+    ret_code_t err_code = spi_instance_init(&accel_spi, &accel_spi_config, SPI_ACCEL_BURST_FREQ);
+    APP_ERROR_CHECK(err_code);
+    APP_ERROR_CHECK_BOOL(spi_device_add(&accel_spi, &flash_spi_config, SPI_FLASH_BURST_FREQ) == 0);
+}
+
+// returns app timer ticks in microseconds
+static uint32_t capture_ticks_us(uint32_t ticks)
+{
+    return ((uint64_t)ticks * 1000000 * (APP_TIMER_CONFIG_RTC_FREQUENCY + 1)) / APP_TIMER_CLOCK_FREQ;
+}
+
+// returns the microseconds since an app_timer_cnt_get() count, the counter wraps after 512 s
+uint32_t capture_since_us(uint32_t start_ticks)
+{
+    return capture_ticks_us(app_timer_cnt_diff_compute(app_timer_cnt_get(), start_ticks));
+}
+
+/*
+ * @return the resultant in mg that starts an impact now, the adaptive trigger
+ * of the profile moves it with the activity
+ */
+uint16_t capture_trigger_onset_mg(void)
+{
+    return impact_trigger_onset(&m_core.trigger)*ADXL372_MG_PER_LSB;
+}
+
+// Runs the open handler in thread context with a streamed capture
+static void capture_open_sched_handler(void * p_event_data, uint16_t event_size)
+{
+    m_open_handler(*(capture_buf_t **) p_event_data);
+}
+
+// Runs the closed capture handler in thread context
+static void capture_done_sched_handler(void * p_event_data, uint16_t event_size)
+{
+    capture_buf_t *p_buf = *(capture_buf_t **) p_event_data;
+
+    PROFILER_SINCE(m_handoff_probe, p_buf->close_cycles);
+    capture_autorange(p_buf);
+    capture_watermark_tune();
+    m_done_handler(p_buf);
+}
+
+// Runs the periodic retune in thread context
+static void capture_tune_sched_handler(void * p_event_data, uint16_t event_size)
+{
+    capture_watermark_tune();
+}
+
+// returns the mono_time_us() of the sample with an arrival count, from the
+// last watermark edge and the fitted period, or now without an edge to go by
+static uint64_t capture_sample_us(uint32_t sample)
+{
+    if (!m_stamped)
+    {
+        return mono_time_us();
+    }
+    return (uint64_t) ((int64_t) m_edge_us + (int64_t) (int32_t) (sample - m_edge_sample)*m_sample_ns/1000);
+}
+
+// Claims a free capture buffer for the impact capture_core opens, the records
+// are reset there. returns NULL if every buffer is still held by the thread
+static capture_buf_t *capture_open(uint16_t trigger_index)
+{
+    capture_buf_t *p_buf = NULL;
+    ret_code_t err_code;
+    uint8_t i;
+
+    for (i = 0; i < CAPTURE_BUF_COUNT; i++)
+    {
+        if (!m_capture_bufs[i].in_use)
+        {
+            p_buf = &m_capture_bufs[i];
+            break;
+        }
+    }
+    if (p_buf == NULL)
+    {
+        return NULL;
+    }
+
+    p_buf->in_use = true;
+    record_chain_init(&p_buf->chain, &m_record_pool);
+    p_buf->start_ticks = app_timer_cnt_get();
+    p_buf->replay = m_replaying;
+    p_buf->p_profile = m_profile;
+    p_buf->range = m_range;
+    p_buf->stream = m_profile->stream && !m_replaying;
+    //the sample the trigger fired on, a replay is timed as it runs
+    p_buf->start_us = m_replaying ? mono_time_us() : capture_sample_us(m_burst_sample + 1 + trigger_index);
+
+    if (!p_buf->replay)
+    {
+        activity_log_impact();
+        //the fifo is drained below the watermark until the capture closes, an open
+        //capture reaches its quiet end and the thread a few ms sooner
+        err_code = app_timer_start(m_drain_timer_id, m_drain_ticks, NULL);
+        APP_ERROR_CHECK(err_code);
+        //the edges latched while it records time its samples, the TIMER is
+        //a few percent off on HFINT. The trigger's edge is already in
+        if (m_stamping)
+        {
+            hf_clock_request(HF_CLOCK_USER_CAPTURE);
+        }
+    }
+    if (p_buf->stream)
+    {
+        //the thread runs the handler after the pre-trigger window is recorded
+        err_code = app_sched_event_put(&p_buf, sizeof(p_buf), capture_open_sched_handler);
+        APP_ERROR_CHECK(err_code);
+    }
+
+    return p_buf;
+}
+
+// Hands the buffer capture_core closed to the thread
+static void capture_close(capture_buf_t *p_buf)
+{
+    ret_code_t err_code;
+
+    p_buf->close_us = mono_time_us();
+    if (!p_buf->replay)
+    {
+        err_code = app_timer_stop(m_drain_timer_id);
+        APP_ERROR_CHECK(err_code);
+        hf_clock_release(HF_CLOCK_USER_CAPTURE);
+    }
+    if (p_buf->replay)
+    {
+        m_replay_stats.closed++;
+    }
+    else
+    {
+        pipeline_stats_capture(m_stats, p_buf->count, p_buf->dropped,
+                               p_buf->count + p_buf->dropped - p_buf->pre_trigger,
+                               capture_since_us(p_buf->start_ticks));
+        m_stats->record_gaps += p_buf->gaps;
+        m_stats->captures_chained += p_buf->chained;
+    }
+
+    PROFILER_MARK(p_buf->close_cycles);
+    err_code = app_sched_event_put(&p_buf, sizeof(p_buf), capture_done_sched_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+// Counts the samples of an impact no capture buffer was free for
+static void capture_lost(uint16_t num_samples)
+{
+    m_stats->samples_dropped += num_samples;
+}
+
+static capture_core_hal_t const m_core_hal = {
+    .open = capture_open,
+    .close = capture_close,
+    .lost = capture_lost,
+};
+
+// Adds a fifo burst and the newest gyro read to the calibration sums, spi interrupt
+static void capture_calibrate_burst(adxl372_accel_data_t const *samples, uint16_t num_samples)
+{
+    int16_t const *gyro = &m_gyro_data.gyro_x;
+    int16_t const *icm_accel = &m_gyro_data.accel_x;
+
+    if (m_calibrate_skip > 0)
+    {
+        m_calibrate_skip--;
+        return;
+    }
+
+    for (uint16_t i = 0; i < num_samples; ++i)
+    {
+        int16_t const axis[3] = {samples[i].x, samples[i].y, samples[i].z};
+
+        for (int j = 0; j < 3; ++j)
+        {
+            m_calibration.accel_sum[j] += axis[j];
+            m_calibration.accel_sq_sum[j] += (int32_t) axis[j]*axis[j];
+        }
+    }
+    m_calibration.accel_samples += num_samples;
+
+    for (int j = 0; j < 3; ++j)
+    {
+        m_calibration.icm_accel_sum[j] += icm_accel[j];
+        m_calibration.gyro_sum[j] += gyro[j];
+        m_calibration.gyro_sq_sum[j] += (int32_t) gyro[j]*gyro[j];
+    }
+    m_calibration.gyro_samples++;
+}
+
+RAMFUNC static void gyro_read_done(int8_t result, void *p_context)
+{
+    if (result == 0)
+    {
+        icm20649_parse_gyro_accel_temp_data(m_gyro_buf, &m_gyro_data);
+    }
+    m_gyro_busy = false;
+}
+
+// Gets the decimated samples of a burst and publishes them at the rate of the output, spi interrupt
+static void decimate_handler(accel_decimate_output_t output, adxl372_accel_data_t const *samples,
+                             uint16_t num_samples)
+{
+    //the bus only reads the samples of a block that is not from its pool
+    sample_bus_block_t block = {
+        .samples = (adxl372_accel_data_t *) samples,
+        .count = num_samples,
+        .gyro = m_gyro_data,
+    };
+
+    sample_bus_publish(&block, (sample_bus_rate_t) (SAMPLE_BUS_LIVE + output));
+}
+
+// Full rate bursts as the trigger saw them, spi interrupt
+static void decimate_sub_handler(sample_bus_block_t *p_block, void *p_context)
+{
+    accel_decimate_block(&m_decimate, p_block->samples, p_block->count);
+}
+
+// Activity rate samples with the peak the trigger saw since the last ones, spi interrupt
+static void activity_sub_handler(sample_bus_block_t *p_block, void *p_context)
+{
+    activity_log_samples(p_block->samples, p_block->count, impact_trigger_peak_take(&m_core.trigger));
+}
+
+// Samples at the rate of the stream, spi interrupt
+static void stream_sub_handler(sample_bus_block_t *p_block, void *p_context)
+{
+    if (live_stream_active())
+    {
+        live_stream_push(p_block->samples, p_block->count, &p_block->gyro);
+    }
+}
+
+SAMPLE_BUS_SUB_DEF(m_decimate_sub, SAMPLE_BUS_FULL, SAMPLE_BUS_IN_PLACE, decimate_sub_handler, NULL);
+SAMPLE_BUS_SUB_DEF(m_activity_sub, SAMPLE_BUS_ACTIVITY, SAMPLE_BUS_IN_PLACE, activity_sub_handler, NULL);
+SAMPLE_BUS_SUB_DEF(m_stream_sub, SAMPLE_BUS_LIVE, SAMPLE_BUS_IN_PLACE, stream_sub_handler, NULL);
+
+RAMFUNC static void fifo_read_done(int16_t result, void *p_context)
+{
+    sample_bus_block_t *p_block = m_read_block;
+    uint32_t drain_ticks;
+
+    STACK_WATCH_ENTER(m_burst_stack);
+    CPU_LOAD_ENTER(m_burst_load);
+    WATCHDOG_BEAT(m_capture_stage);
+    if (m_adxl_dev.fifo_overruns != m_stats->fifo_overruns)
+    {
+        //samples were lost, the filter history and the pre-trigger window no longer line up
+        m_stats->fifo_overruns = m_adxl_dev.fifo_overruns;
+        m_stamped = false;
+        if (!m_replaying)
+        {
+            capture_core_gap(&m_core);
+            accel_decimate_reset(&m_decimate);
+            live_stream_gap();
+            activity_log_gap();
+        }
+    }
+    if (result > 0)
+    {
+        m_burst_sample = m_samples_read;
+        m_samples_read += (uint16_t) result;
+    }
+    if (result > 0 && m_calibrating)
+    {
+        capture_calibrate_burst(p_block->samples, (uint16_t) result);
+    }
+    else if (result > 0 && !m_replaying)
+    {
+        capture_core_burst(&m_core, p_block->samples, (uint16_t) result, &m_gyro_data);
+        p_block->count = (uint16_t) result;
+        p_block->gyro = m_gyro_data;
+        sample_bus_publish(p_block, SAMPLE_BUS_FULL);
+    }
+    sample_bus_release(p_block);
+    if (m_read_requested)
+    {
+        PROFILER_SINCE(m_burst_probe, m_request_cycles);
+        m_read_requested = false;
+        drain_ticks = app_timer_cnt_diff_compute(app_timer_cnt_get(), m_request_ticks);
+        if (drain_ticks > m_drain_max_ticks)
+        {
+            m_drain_max_ticks = drain_ticks;
+        }
+    }
+    m_read_busy = false;
+
+    //the pin stays high without a new edge while the fifo is still over the watermark
+    if (adxl372_int_pending(ADXL_INT1))
+    {
+        capture_read_request();
+    }
+    CPU_LOAD_EXIT(m_burst_load);
+    STACK_WATCH_EXIT(m_burst_stack);
+}
+
+// Queues the fifo and gyro reads unless a read is running, the watermark
+// is checked again once it finishes
+RAMFUNC static void capture_read_start(void)
+{
+    bool start;
+
+    CRITICAL_REGION_ENTER();
+    start = !m_read_busy;
+    if (start)
+    {
+        m_read_busy = true;
+    }
+    CRITICAL_REGION_EXIT();
+    if (!start)
+    {
+        return;
+    }
+
+    adxl372_int_clear(ADXL_INT1);
+    //the gyro has its own spim instance, its read finishes alongside the fifo one
+    if (!m_gyro_busy)
+    {
+        m_gyro_busy = true;
+        if (icm20649_queue_read_gyro_accel_data(&m_gyro_xfer, m_gyro_buf, gyro_read_done, NULL) < 0)
+        {
+            m_gyro_busy = false;
+        }
+    }
+    m_read_block = sample_bus_alloc();
+    if (m_read_block == NULL)
+    {
+        m_read_block = &m_spare_block;
+    }
+    if (adxl372_queue_fifo_read(&m_fifo_read, &m_adxl_dev, m_read_block->samples, ADXL_FIFO_MAX_SAMPLES,
+                                fifo_read_done, NULL) < 0)
+    {
+        sample_bus_release(m_read_block);
+        m_read_busy = false;
+    }
+}
+
+// Starts the read of a watermark, the time it takes to process it counts from here
+// even if it queues behind a flash transaction
+RAMFUNC static void capture_read_request(void)
+{
+    if (m_held)
+    {
+        //capture_profile_set() checks the watermark once the sensor is back
+        return;
+    }
+    if (!m_read_requested)
+    {
+        m_read_requested = true;
+        m_request_ticks = app_timer_cnt_get();
+        PROFILER_MARK(m_request_cycles);
+    }
+    capture_read_start();
+}
+
+// Asks the thread for a retune between impacts, app timer interrupt
+static void capture_tune_timeout_handler(void *p_context)
+{
+    UNUSED_PARAMETER(p_context);
+    //a full queue skips one, the next comes CAPTURE_TUNE_MS later
+    (void) app_sched_event_put(NULL, 0, capture_tune_sched_handler);
+}
+
+// Drains whatever whole samples are in the fifo while a capture records, the
+// read finds fewer than one sample and comes back with -3 if the watermark
+// burst just took them. App timer interrupt
+static void capture_drain_timeout_handler(void *p_context)
+{
+    UNUSED_PARAMETER(p_context);
+    capture_read_request();
+}
+
+#if TRIGGER_STAMP_ENABLED
+// Pairs the watermark edge PPI latched with the arrival count of the sample that
+// raised it, the fifo held the watermark exactly with no read running. Two
+// edges in a row fit the period of the accel's own clock
+RAMFUNC static void capture_stamp_edge(void)
+{
+    uint64_t edge_us = mono_time_stamp_us();
+    uint32_t edge_sample = m_samples_read + (m_watermark + 2)/3;
+    uint32_t nominal_ns = 1000000000/sampling_profile_rate_hz(m_profile);
+    uint32_t sample_ns;
+
+    if (m_stamped && edge_sample != m_edge_sample && edge_us > m_edge_us)
+    {
+        sample_ns = (uint32_t) (((edge_us - m_edge_us)*1000)/(edge_sample - m_edge_sample));
+        //further off is a latch of another edge, the accel's clock is within a few percent
+        if (sample_ns > nominal_ns - nominal_ns/16 && sample_ns < nominal_ns + nominal_ns/16)
+        {
+            m_sample_ns = sample_ns;
+        }
+    }
+    m_edge_us = edge_us;
+    m_edge_sample = edge_sample;
+    m_stamped = true;
+}
+#endif
+
+RAMFUNC static void capture_int_handler(adxl372_int_pin_t int_pin)
+{
+    STACK_WATCH_ENTER(m_int_stack);
+    CPU_LOAD_ENTER(m_int_load);
+    if (int_pin == ADXL_INT1)
+    {
+#if TRIGGER_STAMP_ENABLED
+        if (m_stamping && !m_read_busy && !m_held)
+        {
+            capture_stamp_edge();
+        }
+#endif
+        capture_read_request();
+    }
+    CPU_LOAD_EXIT(m_int_load);
+    STACK_WATCH_EXIT(m_int_stack);
+}
+
+// returns 0 if the capture can run the profile, -2 if its rate, fifo or
+// window do not fit the pre-trigger buffer, the record pool or the record deltas
+// below the gap marker, or the chain window is longer than the pre-trigger one.
+// A streamed capture only has to hold its backlog between the commit polls
+static int8_t capture_profile_check(sampling_profile_t const *p_profile)
+{
+    uint32_t rate_hz = sampling_profile_rate_hz(p_profile);
+    uint32_t pre_trigger = sampling_profile_samples(p_profile, p_profile->pre_trigger_ms*1000);
+    uint32_t max_samples = sampling_profile_samples(p_profile, p_profile->max_duration_ms*1000);
+    uint32_t chain = sampling_profile_samples(p_profile, p_profile->chain_ms*1000);
+
+    if (p_profile->stream && max_samples > sampling_profile_samples(p_profile, CAPTURE_STREAM_BACKLOG_MS*1000))
+        max_samples = sampling_profile_samples(p_profile, CAPTURE_STREAM_BACKLOG_MS*1000);
+
+    if (rate_hz > SAMPLING_PROFILE_BASE_HZ || SAMPLING_PROFILE_BASE_HZ/rate_hz >= IMPACT_RECORD_DELTA_GAP)
+        return -2;
+    if (p_profile->filter && rate_hz != ACCEL_FILTER_RATE_HZ)
+        return -2;
+    if (rate_hz < ACCEL_DECIMATE_LIVE_HZ)
+        return -2;
+    if (p_profile->watermark / 3 == 0 || p_profile->watermark > ADXL_FIFO_SIZE)
+        return -2;
+    if (p_profile->release_mg > p_profile->threshold_mg || pre_trigger > PRE_TRIGGER_SAMPLES)
+        return -2;
+    if (p_profile->threshold_max_mg != 0 && p_profile->threshold_max_mg < p_profile->threshold_mg)
+        return -2;
+    if (chain > pre_trigger)
+        return -2;
+    if (2*(pre_trigger + max_samples) > CAPTURE_POOL_BLOCKS*RECORD_BLOCK_RECORDS)
+        return -2;
+
+    return 0;
+}
+
+// Writes the rate of the profile and a watermark, the accel leaves standby
+// streaming into an empty fifo. returns 0 if success, -1 on spi error, -2 if
+// the rate or the watermark is invalid
+static int8_t capture_accel_config(sampling_profile_t const *p_profile, uint16_t watermark)
+{
+    adxl372_config_t config;
+
+    if (adxl372_config_fifo_int_default(&config, watermark) < 0
+        || adxl372_config_set_rate(&config, p_profile->odr, p_profile->bandwidth) < 0)
+    {
+        return -2;
+    }
+
+    //the samples in the fifo go, the arrival count no longer lines up with the edges
+    m_stamped = false;
+    return adxl372_apply_config(&m_adxl_dev, &config);
+}
+
+// Writes the rate and the watermark of the profile, the accel leaves standby
+// streaming into an empty fifo, and the icm20649 rates of the profile. returns 0
+// if success, -1 on spi error, -2 if the rate or the watermark is invalid
+static int8_t capture_sensor_config(sampling_profile_t const *p_profile)
+{
+    int8_t ret;
+
+    ret = capture_accel_config(p_profile, p_profile->watermark);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    m_watermark = p_profile->watermark;
+    m_stats->watermark = m_watermark;
+
+    //the profile starts from its own ranges
+    ret = icm20649_set_rate_config(&p_profile->icm);
+    if (ret == 0)
+    {
+        m_icm_config = p_profile->icm;
+        m_range = IMPACT_RECORD_RANGE(m_icm_config.gyro_fs, m_icm_config.accel_fs);
+    }
+    return ret;
+}
+
+#if TRIGGER_STAMP_ENABLED
+// Moves INT1 to a GPIOTE IN channel whose edge latches the timebase TIMER for a
+// profile that times its samples to the edges, or back to the PORT event for
+// one that does not. Thread context with the fifo reads held off or before the
+// interrupt runs, the caller checks adxl372_int_pending() afterwards
+static void capture_stamp_config(sampling_profile_t const *p_profile)
+{
+    m_stamping = p_profile->stamp && mono_time_stamp_start(adxl372_int_precise(ADXL_INT1, true)) == 0;
+    if (!m_stamping)
+    {
+        mono_time_stamp_stop();
+        (void) adxl372_int_precise(ADXL_INT1, false);
+    }
+    //the latch may be of an edge from before the switch
+    m_stamped = false;
+}
+#endif
+
+// Works the windows of the profile out in its samples and starts the
+// filter, the trigger and the pre-trigger window over with them
+static void capture_profile_apply(sampling_profile_t const *p_profile)
+{
+    capture_core_window_t window = {
+        .max_samples = sampling_profile_samples(p_profile, p_profile->max_duration_ms*1000),
+        .quiet_samples = sampling_profile_samples(p_profile, p_profile->quiet_ms*1000),
+        .chain_samples = sampling_profile_samples(p_profile, p_profile->chain_ms*1000),
+        .pre_trigger_samples = sampling_profile_samples(p_profile, p_profile->pre_trigger_ms*1000),
+        .delta = SAMPLING_PROFILE_BASE_HZ / sampling_profile_rate_hz(p_profile),
+        .filter = p_profile->filter,
+    };
+
+    m_profile = p_profile;
+    m_sample_ns = 1000000000/sampling_profile_rate_hz(p_profile);
+
+    capture_core_window_set(&m_core, &window);
+    //the outputs keep their rates, only the first decimation changes
+    APP_ERROR_CHECK_BOOL(accel_decimate_rate_set(&m_decimate, sampling_profile_rate_hz(p_profile)) == 0);
+    impact_trigger_init(&m_core.trigger, ADXL372_MG_TO_COUNTS(p_profile->threshold_mg),
+                        ADXL372_MG_TO_COUNTS(p_profile->release_mg),
+                        sampling_profile_samples(p_profile, p_profile->min_duration_us));
+    impact_trigger_adapt_set(&m_core.trigger, ADXL372_MG_TO_COUNTS(p_profile->threshold_max_mg));
+}
+
+/*
+ * Brings up the accel and gyro spi instances and both sensors, the accel
+ * streams into its fifo at the rate of the profile until capture_start().
+ * Thread context, before the flash is used
+ * @param stats - capture counters, updated from the interrupts
+ * @param open_handler - gets each capture of a streaming profile in thread context as it opens
+ * @param done_handler - gets each closed capture in thread context
+ * @param p_profile - sampling profile to start with, the game profile if it can't run
+ */
+void capture_init(pipeline_stats_t *stats, capture_done_handler_t open_handler,
+                  capture_done_handler_t done_handler, sampling_profile_t const *p_profile)
+{
+    ret_code_t err_code;
+
+    m_stats = stats;
+    m_open_handler = open_handler;
+    m_done_handler = done_handler;
+    if (p_profile == NULL || capture_profile_check(p_profile) < 0)
+    {
+        p_profile = sampling_profile_get(SAMPLING_PROFILE_GAME);
+    }
+
+    spi_accel_flash_init();
+    err_code = spi_instance_init(&gyro_spi, &gyro_spi_config, SPI_GYRO_BURST_FREQ);
+    APP_ERROR_CHECK(err_code);
+
+    //the gyro is set up during the accel's reset
+    adxl372_reset_start();
+    icm20649_default_init();
+    mono_time_sleep_ms(ADXL372_RESET_MS);
+    APP_ERROR_CHECK_BOOL(capture_sensor_config(p_profile) == 0);
+
+    capture_core_init(&m_core, &m_core_hal);
+    sample_bus_init();
+    sample_bus_subscribe(&m_decimate_sub);
+    sample_bus_subscribe(&m_activity_sub);
+    sample_bus_enable(&m_stream_sub, false);
+    sample_bus_subscribe(&m_stream_sub);
+    APP_ERROR_CHECK_BOOL(accel_decimate_init(&m_decimate, sampling_profile_rate_hz(p_profile), decimate_handler) == 0);
+    capture_profile_apply(p_profile);
+    accel_decimate_enable(&m_decimate, ACCEL_DECIMATE_ACTIVITY, true);
+    live_stream_init();
+    err_code = nrf_balloc_init(&m_record_pool);
+    APP_ERROR_CHECK(err_code);
+    m_drain_ticks = APP_TIMER_TICKS(CAPTURE_DRAIN_MS);
+    err_code = app_timer_create(&m_drain_timer_id, APP_TIMER_MODE_REPEATED, capture_drain_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+    err_code = app_timer_create(&m_tune_timer_id, APP_TIMER_MODE_REPEATED, capture_tune_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+// Rewrites the accel with the profile once the fifo reads are held off
+// (m_held set by the caller) and lets them go again
+static int8_t capture_profile_write(sampling_profile_t const *p_profile)
+{
+    int8_t ret;
+
+    //the reads in flight finish in the spi interrupts, the burst may still open a capture
+    while (m_read_busy || m_gyro_busy)
+    {
+    }
+    if (m_core.p_capture != NULL)
+    {
+        capture_core_close(&m_core);
+    }
+    ret = capture_sensor_config(p_profile);
+    if (ret == 0)
+    {
+        capture_profile_apply(p_profile);
+#if TRIGGER_STAMP_ENABLED
+        capture_stamp_config(p_profile);
+#endif
+        //the stream keeps its rate, the decimators started over
+        live_stream_gap();
+        activity_log_gap();
+    }
+    m_held = false;
+
+    if (adxl372_int_pending(ADXL_INT1))
+    {
+        capture_read_request();
+    }
+
+    return ret;
+}
+
+// One range step of a sensor from the peak of the capture read at fs
+static uint8_t capture_range_step(uint8_t fs, uint16_t peak, uint8_t fs_max)
+{
+    if (peak >= CAPTURE_ICM_SATURATED_COUNTS && fs < fs_max)
+    {
+        return fs + 1;
+    }
+    if (peak < CAPTURE_ICM_UNDERUSED_COUNTS && fs > 0)
+    {
+        return fs - 1;
+    }
+    return fs;
+}
+
+// Steps the icm20649 ranges of an autorange profile from the peaks of a
+// closed capture, thread context. The fifo reads are held off for the write,
+// the accel fifo keeps filling meanwhile so no sample is lost. A switch that
+// finds an impact being recorded is left to the next capture
+static void capture_autorange(capture_buf_t const *p_buf)
+{
+    icm20649_rate_config_t config;
+    uint8_t range;
+    bool held = false;
+
+    if (p_buf->replay || !m_profile->autorange || p_buf->p_profile != m_profile || live_stream_active())
+    {
+        return;
+    }
+    range = IMPACT_RECORD_RANGE(capture_range_step(IMPACT_RECORD_GYRO_FS(p_buf->range), p_buf->gyro_peak,
+                                                   ICM20649_GYRO_FS_4000DPS),
+                                capture_range_step(IMPACT_RECORD_ACCEL_FS(p_buf->range), p_buf->icm_accel_peak,
+                                                   ICM20649_ACCEL_FS_30G));
+    if (range == m_range)
+    {
+        return;
+    }
+
+    CRITICAL_REGION_ENTER();
+    if (!m_replaying && !m_calibrating && !m_held && m_core.p_capture == NULL)
+    {
+        m_held = true;
+        held = true;
+    }
+    CRITICAL_REGION_EXIT();
+    if (!held)
+    {
+        return;
+    }
+
+    //the burst of a read in flight may still open a capture, it keeps its range
+    while (m_read_busy || m_gyro_busy)
+    {
+    }
+    if (m_core.p_capture == NULL)
+    {
+        config = m_icm_config;
+        config.gyro_fs = IMPACT_RECORD_GYRO_FS(range);
+        config.accel_fs = IMPACT_RECORD_ACCEL_FS(range);
+        if (icm20649_set_rate_config(&config) == 0)
+        {
+            m_icm_config = config;
+            m_range = range;
+            m_stats->icm_range_switches++;
+        }
+        //the last read is of the old range, the records have no gyro data until the next one
+        memset(&m_gyro_data, 0, sizeof(m_gyro_data));
+    }
+    m_held = false;
+
+    if (adxl372_int_pending(ADXL_INT1))
+    {
+        capture_read_request();
+    }
+}
+
+// Retunes the fifo from the longest drain since the last retune, thread
+// context. Between impacts the watermark goes as deep as the fifo still holds
+// the samples arriving over that drain, or over the longest flash hold queued
+// in front of it, and the partial drains of a capture are spaced
+// CAPTURE_DRAIN_LOAD of it apart. The accel is only rewritten for a step of
+// CAPTURE_WATERMARK_STEP, its fifo starts over empty
+static void capture_watermark_tune(void)
+{
+    uint32_t rate_hz = sampling_profile_rate_hz(m_profile);
+    uint32_t drain_ticks, drain_us, latency_us, headroom;
+    uint16_t watermark;
+    bool held = false;
+
+    CRITICAL_REGION_ENTER();
+    drain_ticks = m_drain_max_ticks;
+    m_drain_max_ticks = 0;
+    CRITICAL_REGION_EXIT();
+    if (drain_ticks == 0)
+    {
+        return;
+    }
+
+    drain_us = capture_ticks_us(drain_ticks);
+    if (drain_us > m_stats->max_drain_us)
+    {
+        m_stats->max_drain_us = drain_us;
+    }
+    m_drain_ticks = MAX(APP_TIMER_TICKS(CAPTURE_DRAIN_MS), CAPTURE_DRAIN_LOAD*drain_ticks);
+
+    //half as long again as the longest seen, the fifo must hold what arrives meanwhile
+    latency_us = MAX(drain_us + drain_us/2, CAPTURE_FLASH_HOLD_MAX_MS*1000);
+    headroom = 3*(uint32_t) (((uint64_t) rate_hz*latency_us + 999999)/1000000);
+    watermark = (headroom + CAPTURE_WATERMARK_MIN < ADXL_FIFO_SIZE) ? ADXL_FIFO_SIZE - headroom : CAPTURE_WATERMARK_MIN;
+    watermark -= watermark % 3;
+    if (watermark + CAPTURE_WATERMARK_STEP > m_watermark && watermark < m_watermark + CAPTURE_WATERMARK_STEP)
+    {
+        return;
+    }
+
+    //the rewrite leaves a gap in the stream
+    CRITICAL_REGION_ENTER();
+    if (!m_replaying && !m_calibrating && !m_held && m_core.p_capture == NULL && !live_stream_active())
+    {
+        m_held = true;
+        held = true;
+    }
+    CRITICAL_REGION_EXIT();
+    if (!held)
+    {
+        return;
+    }
+
+    //the burst of a read in flight may still open a capture, it is retuned after that one
+    while (m_read_busy || m_gyro_busy)
+    {
+    }
+    if (m_core.p_capture == NULL)
+    {
+        if (capture_accel_config(m_profile, watermark) == 0)
+        {
+            m_watermark = watermark;
+            m_stats->watermark = watermark;
+        }
+        //the samples in the fifo are lost, the filter history and the window with them
+        capture_core_reset(&m_core);
+        accel_decimate_reset(&m_decimate);
+        activity_log_gap();
+    }
+    m_held = false;
+
+    if (adxl372_int_pending(ADXL_INT1))
+    {
+        capture_read_request();
+    }
+}
+
+/*
+ * Switches the sampling profile while the capture runs, thread context. No
+ * fifo read is started while the accel is rewritten, the fifo starts over
+ * empty and the samples in it are lost
+ * @return 0 if success, -1 on spi error (the old rate may be left), -2 if the
+ * profile can't run, -3 if an impact is being recorded, a replay or a calibration runs
+ */
+int8_t capture_profile_set(sampling_profile_t const *p_profile)
+{
+    int8_t ret = 0;
+
+    if (p_profile == NULL || capture_profile_check(p_profile) < 0)
+    {
+        return -2;
+    }
+
+    CRITICAL_REGION_ENTER();
+    if (m_replaying || m_calibrating || m_held || m_core.p_capture != NULL)
+    {
+        ret = -3;
+    }
+    else
+    {
+        m_held = true;
+    }
+    CRITICAL_REGION_EXIT();
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    return capture_profile_write(p_profile);
+}
+
+/*
+ * Sampling profile the capture runs
+ */
+sampling_profile_t const *capture_profile(void)
+{
+    return m_profile;
+}
+
+/*
+ * Starts the live stream of the sensor bursts at rate_hz, restarts it at a
+ * new one or stops it with 0, thread context. The frames are taken with
+ * live_stream_peek(). The stream runs at the rate of an accel_decimate output
+ * whatever the profile, a profile switch keeps it
+ * @return 0 if success, -2 if rate_hz is not ACCEL_DECIMATE_LIVE_HZ or ACCEL_DECIMATE_ACTIVITY_HZ
+ */
+int8_t capture_stream_set(uint16_t rate_hz)
+{
+    accel_decimate_output_t output = ACCEL_DECIMATE_LIVE;
+
+    if (rate_hz == ACCEL_DECIMATE_LIVE_HZ)
+    {
+        output = ACCEL_DECIMATE_LIVE;
+    }
+    else if (rate_hz == ACCEL_DECIMATE_ACTIVITY_HZ)
+    {
+        output = ACCEL_DECIMATE_ACTIVITY;
+    }
+    else if (rate_hz != 0)
+    {
+        return -2;
+    }
+
+    //the bursts are decimated in the spi interrupt
+    CRITICAL_REGION_ENTER();
+    //the activity output stays on for the activity log
+    if (live_stream_active() && m_stream_output != ACCEL_DECIMATE_ACTIVITY)
+    {
+        accel_decimate_enable(&m_decimate, m_stream_output, false);
+    }
+    live_stream_stop();
+    sample_bus_enable(&m_stream_sub, false);
+    if (rate_hz != 0)
+    {
+        m_stream_output = output;
+        accel_decimate_enable(&m_decimate, output, true);
+        (void) live_stream_start(rate_hz);
+        sample_bus_rate_set(&m_stream_sub, (sample_bus_rate_t) (SAMPLE_BUS_LIVE + output));
+        sample_bus_enable(&m_stream_sub, true);
+    }
+    CRITICAL_REGION_EXIT();
+
+    return 0;
+}
+
+/*
+ * Enables the fifo watermark interrupt, sampling runs from the interrupts from here on
+ */
+void capture_start(void)
+{
+    ret_code_t err_code;
+
+    adxl372_int_set_callback(capture_int_handler);
+    adxl372_int_init(ADXL_INT1);
+#if TRIGGER_STAMP_ENABLED
+    //the watermark edge latches the timebase TIMER through GPIOTE and PPI
+    capture_stamp_config(m_profile);
+#endif
+    //capture_init left the sensors measuring, they stay in it
+    ENERGY_ENTER(ENERGY_STATE_SAMPLING);
+    //a burst that stops coming is a hung spi bus or sensor, every profile keeps the watermark coming
+    watchdog_stage_start(&m_capture_stage);
+    err_code = app_timer_start(m_tune_timer_id, APP_TIMER_TICKS(CAPTURE_TUNE_MS), NULL);
+    APP_ERROR_CHECK(err_code);
+    //the watermark was likely reached before the interrupt was enabled
+    if (adxl372_int_pending(ADXL_INT1))
+    {
+        capture_read_request();
+    }
+}
+
+/*
+ * Returns a closed capture buffer once it is committed and gives its record
+ * blocks still in the chain back to the pool, thread context
+ */
+void capture_buf_release(capture_buf_t *p_buf)
+{
+    record_chain_free(&p_buf->chain);
+    p_buf->in_use = false;
+}
+
+// Sends the flash the release from deep power-down if it is in it, the
+// caller holds the flash
+static void capture_flash_release_start(void)
+{
+    if (m_flash_power != CAPTURE_FLASH_ASLEEP)
+    {
+        return;
+    }
+    //an spi error shows in the access itself
+    (void) mt25ql256aba_release_deep_power_down_start();
+    m_flash_wake_ticks = app_timer_cnt_get();
+    m_flash_power = CAPTURE_FLASH_WAKING;
+}
+
+/*
+ * Starts timing one flash access, thread context. The flash transactions go
+ * through the spim instance 0 queue alongside the fifo reads, the accel is
+ * never held off but keep each access under CAPTURE_FLASH_HOLD_MAX_MS
+ * (e.g. one page program or one offload piece) to bound the queueing
+ */
+void capture_flash_acquire(void)
+{
+    uint32_t wake_us;
+
+    m_flash_ticks = app_timer_cnt_get();
+    capture_flash_release_start();
+    if (m_flash_power == CAPTURE_FLASH_WAKING)
+    {
+        //the count is a tick behind at worst, the rest of tRDP is waited out
+        wake_us = capture_since_us(m_flash_wake_ticks);
+        wake_us = (wake_us > CAPTURE_FLASH_TICK_US) ? wake_us - CAPTURE_FLASH_TICK_US : 0;
+        if (wake_us < MT25QL256ABA_RELEASE_DEEP_POWER_DOWN_US)
+        {
+            nrf_delay_us(MT25QL256ABA_RELEASE_DEEP_POWER_DOWN_US - wake_us);
+        }
+        m_flash_power = CAPTURE_FLASH_AWAKE;
+    }
+    //an erase of the activity log would hold up the access, activity_log_step resumes it,
+    //an spi error shows in the access itself
+    (void) activity_log_preempt();
+    PROFILER_MARK(m_flash_cycles);
+}
+
+/*
+ * Ends the access started by capture_flash_acquire(), thread context
+ */
+void capture_flash_release(void)
+{
+    uint32_t hold_us = capture_since_us(m_flash_ticks);
+
+    if (hold_us > m_flash_hold_max_us)
+    {
+        m_flash_hold_max_us = hold_us;
+    }
+    PROFILER_SINCE(m_flash_hold_probe, m_flash_cycles);
+}
+
+/*
+ * Releases the flash from deep power-down without waiting for it, thread
+ * context. Call it ahead of an access that is coming, the next
+ * capture_flash_acquire() only waits for what is left of tRDP
+ */
+void capture_flash_wake(void)
+{
+    capture_flash_release_start();
+}
+
+/*
+ * Puts the flash in deep power-down until the next access, thread context with
+ * no program or erase running or suspended on it. One being released is left
+ * awake, an access is on its way
+ * @return 0 if success otherwise -1
+ */
+int8_t capture_flash_sleep(void)
+{
+    int8_t ret = 0;
+
+    if (m_flash_power == CAPTURE_FLASH_AWAKE)
+    {
+        ret = mt25ql256aba_deep_power_down();
+        if (ret == 0)
+        {
+            m_flash_power = CAPTURE_FLASH_ASLEEP;
+        }
+    }
+    return ret;
+}
+
+/*
+ * @return whether the flash is in deep power-down or on its way out of it
+ */
+capture_flash_power_t capture_flash_power(void)
+{
+    return m_flash_power;
+}
+
+/*
+ * Longest flash access since startup, past CAPTURE_FLASH_HOLD_MAX_MS a fifo
+ * read can queue behind it long enough to overrun
+ */
+uint32_t capture_flash_hold_max_us(void)
+{
+    return m_flash_hold_max_us;
+}
+
+/*
+ * Most record blocks taken from the capture pool at once since startup, out of
+ * CAPTURE_POOL_BLOCKS
+ */
+uint8_t capture_pool_max_blocks(void)
+{
+    return nrf_balloc_max_utilization_get(&m_record_pool);
+}
+
+/*
+ * @return true while an impact is being recorded, from its trigger to its close
+ */
+bool capture_recording(void)
+{
+    return m_core.p_capture != NULL;
+}
+
+/*
+ * Takes the pipeline from the sensors for a replay, thread context. The fifo
+ * is still read on every watermark but its bursts are dropped, the filter,
+ * the trigger and the pre-trigger window start over and the replay counters
+ * are cleared
+ * @return 0 if success, -2 if an impact is being recorded, a replay or a calibration is running
+ */
+int8_t capture_replay_begin(void)
+{
+    int8_t ret = 0;
+
+    CRITICAL_REGION_ENTER();
+    if (m_replaying || m_calibrating || m_core.p_capture != NULL)
+    {
+        ret = -2;
+    }
+    else
+    {
+        m_replaying = true;
+    }
+    CRITICAL_REGION_EXIT();
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    //no fifo burst is processed from here on, the spi interrupt checks the flag first
+    capture_core_reset(&m_core);
+    memset(&m_replay_stats, 0, sizeof(m_replay_stats));
+
+    return 0;
+}
+
+/*
+ * Runs one burst of a recorded trace through the filter, the trigger and the
+ * capture as a fifo burst would be, thread context between capture_replay_begin()
+ * and capture_replay_end(). A capture it closes reaches the done handler with
+ * replay set. The samples are filtered in place
+ * @param gyro - icm20649 sample stored with the burst, as the newest read is for a fifo burst
+ */
+void capture_replay_burst(adxl372_accel_data_t *samples, uint16_t num_samples, icm20649_data_t const *gyro)
+{
+    uint32_t start, cycles;
+
+    if (!m_replaying || num_samples == 0)
+    {
+        return;
+    }
+
+    start = DWT->CYCCNT;
+    capture_core_burst(&m_core, samples, num_samples, gyro);
+    cycles = DWT->CYCCNT - start;
+
+    m_replay_stats.bursts++;
+    m_replay_stats.burst_cycles += cycles;
+    if (cycles > m_replay_stats.burst_max_cycles)
+    {
+        m_replay_stats.burst_max_cycles = cycles;
+    }
+}
+
+/*
+ * Closes a capture the trace ended in and hands the pipeline back to the
+ * sensors, thread context. The filter, the trigger and the pre-trigger window
+ * start over so the first live burst does not run on from the trace
+ */
+void capture_replay_end(void)
+{
+    if (!m_replaying)
+    {
+        return;
+    }
+
+    if (m_core.p_capture != NULL)
+    {
+        capture_core_close(&m_core);
+    }
+    capture_core_reset(&m_core);
+    //the peak of the trace is not the activity's
+    (void) impact_trigger_peak_take(&m_core.trigger);
+    m_replaying = false;
+}
+
+/*
+ * Counters of the last replay, the done handler adds the thread stages of the
+ * replayed captures it gets
+ */
+capture_replay_stats_t *capture_replay_stats(void)
+{
+    return &m_replay_stats;
+}
+
+/*
+ * Takes the pipeline from the trigger for a calibration, thread context. The
+ * fifo bursts and the gyro reads are summed from here on, see
+ * capture_calibrate_sums(), and no impact is captured until capture_calibrate_end()
+ * @return 0 if success, -2 if an impact is being recorded, a replay or a calibration is running
+ */
+int8_t capture_calibrate_begin(void)
+{
+    int8_t ret = 0;
+
+    CRITICAL_REGION_ENTER();
+    if (m_replaying || m_calibrating || m_core.p_capture != NULL)
+    {
+        ret = -2;
+    }
+    else
+    {
+        memset(&m_calibration, 0, sizeof(m_calibration));
+        m_calibrate_skip = CAPTURE_CALIBRATE_SETTLE_BURSTS;
+        m_calibrating = true;
+    }
+    CRITICAL_REGION_EXIT();
+
+    return ret;
+}
+
+/*
+ * Clears the sums and drops the next CAPTURE_CALIBRATE_SETTLE_BURSTS bursts,
+ * e.g. once new offsets are written, thread context
+ */
+void capture_calibrate_restart(void)
+{
+    CRITICAL_REGION_ENTER();
+    memset(&m_calibration, 0, sizeof(m_calibration));
+    m_calibrate_skip = CAPTURE_CALIBRATE_SETTLE_BURSTS;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Writes the accel again with the offset trims of adxl372_set_offset_trim(),
+ * thread context while a calibration runs, and restarts the sums
+ * @return 0 if success, -1 on spi error, -2 if no calibration is running
+ */
+int8_t capture_calibrate_rewrite(void)
+{
+    int8_t ret = 0;
+
+    CRITICAL_REGION_ENTER();
+    if (!m_calibrating || m_held)
+    {
+        ret = -2;
+    }
+    else
+    {
+        m_held = true;
+    }
+    CRITICAL_REGION_EXIT();
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    ret = capture_profile_write(m_profile);
+    capture_calibrate_restart();
+
+    return ret;
+}
+
+/*
+ * Turns the self test of both sensors on or off while a calibration runs,
+ * thread context. The fifo and gyro reads are held off for the register
+ * writes, the icm20649 is switched to other banks for them, and the sums
+ * restart. The adxl372 runs its own test from here, see adxl372_self_test_result()
+ * @param p_expected - the icm20649 responses of its factory codes, read under
+ *                     the same hold, or NULL
+ * @return 0 if success, -1 on spi error, -2 if no calibration is running
+ */
+int8_t capture_calibrate_self_test(bool enable, icm20649_data_t *p_expected)
+{
+    int8_t ret = 0;
+
+    CRITICAL_REGION_ENTER();
+    if (!m_calibrating || m_held)
+    {
+        ret = -2;
+    }
+    else
+    {
+        m_held = true;
+    }
+    CRITICAL_REGION_EXIT();
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    while (m_read_busy || m_gyro_busy)
+    {
+    }
+    ret = adxl372_self_test_set(enable);
+    if (icm20649_self_test_set(enable) < 0 || (p_expected != NULL && icm20649_self_test_expected(p_expected) < 0))
+    {
+        ret = -1;
+    }
+    m_held = false;
+    capture_calibrate_restart();
+
+    if (adxl372_int_pending(ADXL_INT1))
+    {
+        capture_read_request();
+    }
+
+    return ret;
+}
+
+/*
+ * Copies the sums so far, thread context
+ */
+void capture_calibrate_sums(capture_calibration_t *p_sums)
+{
+    CRITICAL_REGION_ENTER();
+    *p_sums = m_calibration;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Hands the sensor bursts back to the trigger, thread context. The filter,
+ * the trigger and the pre-trigger window start over
+ */
+void capture_calibrate_end(void)
+{
+    if (!m_calibrating)
+    {
+        return;
+    }
+
+    capture_core_reset(&m_core);
+    m_calibrating = false;
+}
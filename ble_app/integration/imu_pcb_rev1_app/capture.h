@@ -0,0 +1,221 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "adxl372.h"
+#include "icm20649.h"
+#include "ds1388.h"
+#include "record_block.h"
+#include "impact_codec.h"
+#include "pipeline_stats.h"
+#include "sampling_profile.h"
+
+/* Interrupt driven impact capture of the PCB Revision 1 production firmware.
+ * The adxl372 fifo watermark (INT1) queues the fifo read from the GPIOTE interrupt
+ * and the burst is filtered, run through the trigger and stored from the spi
+ * interrupt, both at SPI_IRQ_PRIORITY, so the radio events, the log and the cli
+ * never hold up sampling. A closed capture is handed to the thread through app_scheduler.
+ * accel and flash are two devices of spim instance 0 on separate pins, switched
+ * in per transaction, so the fifo reads go on between the flash transactions of
+ * the thread. capture_flash_acquire() and capture_flash_release() time each access,
+ * the acquire suspends an erase of the activity log running under it.
+ * capture_flash_sleep() puts the flash in deep power-down (0xB9) while the
+ * thread has nothing for it, the next acquire releases it (0xAB) and waits
+ * out tRDP, or capture_flash_wake() releases it ahead of the access.
+ * The sampling profile sets the adxl372 rate, the trigger and the capture
+ * window, capture_profile_set() switches it between impacts.
+ * A replay runs a recorded trace through the same filter, trigger and capture
+ * from thread context, the fifo bursts read meanwhile are dropped. A
+ * calibration sums the raw fifo bursts and gyro reads instead of capturing,
+ * the background self test (self_test.h) measures through the same sums.
+ * capture_stream_set() also decimates the sensor bursts into live_stream
+ * frames with accel_decimate, alongside the capture, at its live or
+ * activity rate. The activity rate also feeds activity_log, always.
+ * With the autorange of the profile the icm20649 ranges are stepped between
+ * impacts from the peaks of the one that closed, one step per impact, held
+ * while the live stream runs as its frames carry no range.
+ * A capture of a streaming profile is also handed to the thread as it opens,
+ * its full record blocks can be stored and freed while it goes on recording
+ * into the tail one, so it is bounded by the flash instead of the pool.
+ * A capture that went quiet waits the chain window of the profile before it
+ * closes, the samples meanwhile go to the pre-trigger ring. A trigger in the
+ * window puts them back in the capture and it goes on recording, so a second
+ * hit right after the first is one event with one header and no dead zone.
+ * Without one the capture closes and the ring already holds the window in
+ * front of the next impact.
+ * Between impacts the fifo is read in large bursts at the watermark of the
+ * profile. While a capture records it is also drained every CAPTURE_DRAIN_MS
+ * of whatever whole samples are in it (FIFO_ENTRIES), so the trigger sees the
+ * end of the impact and the alert goes out without waiting a watermark.
+ * Both depths are retuned from the measured drains, request to burst done with
+ * the spi queueing: after each impact and every CAPTURE_TUNE_MS the watermark
+ * goes as deep as the fifo still holds the samples arriving over the longest
+ * drain, fewer wakeups while armed, and the partial drains are spaced out when
+ * they take long. A retuned watermark rewrites the accel between impacts, the
+ * profile's own one comes back with the profile.
+ * Built with TRIGGER_STAMP_ENABLED the rising edge of INT1 of a profile with
+ * stamp set goes through a GPIOTE IN event and PPI to a capture task of the timebase TIMER, so the
+ * instant the fifo reached the watermark is latched in hardware however late
+ * the interrupt runs. An edge with no read running is the arrival of the
+ * watermark's last sample, the samples drained before it are counted, so every
+ * sample has its time from the last edge and the period fitted between two.
+ * A capture is timed from the sample the trigger fired on instead of the
+ * burst that found it, to the sample. An overrun or a rewrite of the accel
+ * waits for the next edge, a capture opened meanwhile is timed as it opens.
+ * The other profiles leave INT1 on the low power PORT event (sensor_int).
+ * The crystal (hf_clock) is held while such a capture records, the TIMER
+ * runs from HFINT between the impacts */
+#define CAPTURE_SAMPLE_RATE_HZ      6400 //the game profile's adxl372 rate
+#define CAPTURE_THRESHOLD_MG        10000 //resultant that starts an impact in the game profile
+#define CAPTURE_THRESHOLD_COUNTS    ADXL372_MG_TO_COUNTS(CAPTURE_THRESHOLD_MG) //samples are kept as raw counts
+#define CAPTURE_THRESHOLD_MAX_MG    20000 //the game profile's trigger rises up to this in high activity drills
+#define CAPTURE_GYRO_FS_DPS         2000 //the game profile's starting range, a capture keeps the one it was read at
+#define CAPTURE_ICM_SATURATED_COUNTS 32000 //an icm20649 peak at or above this clipped, the range steps up
+#define CAPTURE_ICM_UNDERUSED_COUNTS 8192 //a peak below a quarter of the scale fits half the next range down
+#define CAPTURE_POOL_BLOCKS         128 //record blocks shared by all captures, two of the longest ones, checked in capture.c
+#define CAPTURE_BUF_COUNT           4 //one records while the others wait for the flash, the records are in the pool
+#define CAPTURE_FLASH_HOLD_MAX_MS   10 //the fifo fills from the watermark to full in about 11 ms
+#define CAPTURE_FLASH_TICK_US       31 //an app timer tick, the resolution of the wake time
+#define CAPTURE_CALIBRATE_SETTLE_BURSTS 4 //fifo bursts dropped after a calibration restart, the accel settles from a rewrite
+#define CAPTURE_STREAM_BACKLOG_MS   40 //records a streamed capture holds in the pool between the commit polls, checked in capture.c
+#define CAPTURE_DRAIN_MS            4 //fifo drained at most this often below the watermark while a capture records, about 26 samples at 6400 Hz
+#define CAPTURE_DRAIN_LOAD          4 //the partial drains come at least this many of the longest drain apart, the bus is mostly free
+#define CAPTURE_TUNE_MS             10000 //the watermark is retuned at least this often from the drains measured meanwhile
+#define CAPTURE_WATERMARK_MIN       48 //fifo entries, the shallowest a retune goes with long drains, 16 samples
+#define CAPTURE_WATERMARK_STEP      30 //fifo entries, a retune closer than this to the watermark in use is not written
+#define CAPTURE_STALL_MS            1000 //longest without a fifo burst before the watchdog resets, low-power's watermark is 200 ms
+
+//trigger and capture window of the game profile, its pre-trigger window sizes
+//the buffer of every profile, tools/pipeline_sim runs its traces with the same values
+#define IMPACT_RELEASE_G_THRESHOLD 7000 //in milli-g's, hysteresis below CAPTURE_THRESHOLD_MG
+#define IMPACT_RELEASE_COUNTS ADXL372_MG_TO_COUNTS(IMPACT_RELEASE_G_THRESHOLD)
+#define IMPACT_MIN_DURATION_US 300 //resultant has to stay above release this long to trigger
+#define IMPACT_MIN_SAMPLES ((IMPACT_MIN_DURATION_US*CAPTURE_SAMPLE_RATE_HZ + 999999)/1000000)
+#define IMPACT_MAX_DURATION 120 //in milliseconds, a capture is cut off after this long
+#define IMPACT_MAX_SAMPLES ((IMPACT_MAX_DURATION*CAPTURE_SAMPLE_RATE_HZ)/1000)
+#define IMPACT_QUIET_MS 10 //in milliseconds, a capture ends once the resultant stayed below release this long
+#define IMPACT_QUIET_SAMPLES ((IMPACT_QUIET_MS*CAPTURE_SAMPLE_RATE_HZ)/1000)
+#define PRE_TRIGGER_MS 20 //in milliseconds, samples kept before the trigger
+#define PRE_TRIGGER_SAMPLES ((PRE_TRIGGER_MS*CAPTURE_SAMPLE_RATE_HZ)/1000)
+#define IMPACT_CHAIN_MS 20 //in milliseconds, a trigger this soon after the quiet end extends the capture, at most PRE_TRIGGER_MS
+#define IMPACT_CHAIN_SAMPLES ((IMPACT_CHAIN_MS*CAPTURE_SAMPLE_RATE_HZ)/1000)
+
+/* One impact in ram, recorded from the interrupts and owned by the thread once closed */
+typedef struct {
+    record_chain_t chain;   //records, the thread may free the stored blocks before the release
+    uint32_t count;         //records captured
+    uint32_t pre_trigger;   //records from before the trigger
+    uint32_t dropped;       //samples that arrived with the pool empty
+    uint32_t gaps;          //records marked IMPACT_RECORD_DELTA_GAP
+    uint32_t chained;       //triggers after the first that extended it
+    bool gap;               //samples were lost since the last record, the next one is marked
+    uint32_t start_ticks;   //app timer count at the trigger
+    uint16_t onset;         //trigger onset in counts when it fired, the adaptive one moves between impacts
+    uint32_t close_cycles;  //cycle count at the close, for the handoff probe
+    uint64_t start_us;      //mono_time_us() of the sample the trigger fired on, the thread gets the wall clock from it
+    uint64_t close_us;      //mono_time_us() at the close
+    bool replay;            //from a replayed trace, timed but not stored
+    uint8_t range;          //IMPACT_RECORD_RANGE of the icm20649 counts of the records
+    uint16_t gyro_peak;     //largest gyro count of the records, any axis and sign
+    uint16_t icm_accel_peak; //largest icm20649 accel count of the records
+    sampling_profile_t const *p_profile; //recorded with, the same for its metrics and storage
+    bool stream;            //handed to the thread at the open, only the blocks before the tail are its until closed
+    volatile bool closed;   //no more records are added
+    volatile bool in_use;   //recording, or closed and not released yet
+} capture_buf_t;
+
+typedef enum {
+    CAPTURE_FLASH_AWAKE,
+    CAPTURE_FLASH_ASLEEP,   //deep power-down, or not known since the reset
+    CAPTURE_FLASH_WAKING,   //released, tRDP may not have passed
+} capture_flash_power_t;
+
+/* DWT cycles of the stages a replayed trace went through, the bursts are
+ * counted by capture_replay_burst() and the done handler fills in the thread
+ * stages of each capture it gets with replay set */
+typedef struct {
+    uint32_t bursts;
+    uint32_t burst_max_cycles;      //filter, trigger and record of one burst
+    uint64_t burst_cycles;
+    uint32_t closed;                //captures the trace closed
+    uint32_t timed;                 //of them through the done handler
+    uint32_t records;               //of the last capture
+    uint32_t metrics_cycles;        //metrics and location of the last capture
+    uint32_t encode_cycles[IMPACT_CODEC_KINDS]; //each codec over the last capture
+    uint32_t encoded_bytes[IMPACT_CODEC_KINDS];
+    uint32_t peak_mg;
+    uint32_t duration_us;
+    uint32_t hic15;
+} capture_replay_stats_t;
+
+/* Sums of the raw samples read since capture_calibrate_restart(), for the
+ * mean and the spread of each axis. The icm20649 is read once per fifo burst */
+typedef struct {
+    uint32_t accel_samples;
+    int32_t accel_sum[3];           //adxl372 x, y, z
+    uint64_t accel_sq_sum[3];
+    uint32_t gyro_samples;
+    int32_t icm_accel_sum[3];       //icm20649 accel x, y, z
+    int32_t gyro_sum[3];            //icm20649 gyro x, y, z
+    uint64_t gyro_sq_sum[3];
+} capture_calibration_t;
+
+/* called in thread context with a closed capture, hand it back with capture_buf_release(),
+ * and with a streamed one as it opens */
+typedef void (*capture_done_handler_t)(capture_buf_t *p_buf);
+
+void capture_init(pipeline_stats_t *stats, capture_done_handler_t open_handler,
+                  capture_done_handler_t done_handler, sampling_profile_t const *p_profile);
+
+int8_t capture_profile_set(sampling_profile_t const *p_profile);
+
+sampling_profile_t const *capture_profile(void);
+
+int8_t capture_stream_set(uint16_t rate_hz);
+
+void capture_start(void);
+
+void capture_buf_release(capture_buf_t *p_buf);
+
+void capture_flash_acquire(void);
+
+void capture_flash_release(void);
+
+void capture_flash_wake(void);
+
+int8_t capture_flash_sleep(void);
+
+capture_flash_power_t capture_flash_power(void);
+
+uint32_t capture_flash_hold_max_us(void);
+
+uint8_t capture_pool_max_blocks(void);
+
+bool capture_recording(void);
+
+uint32_t capture_since_us(uint32_t start_ticks);
+
+uint16_t capture_trigger_onset_mg(void);
+
+int8_t capture_replay_begin(void);
+
+void capture_replay_burst(adxl372_accel_data_t *samples, uint16_t num_samples, icm20649_data_t const *gyro);
+
+void capture_replay_end(void);
+
+capture_replay_stats_t *capture_replay_stats(void);
+
+int8_t capture_calibrate_begin(void);
+
+void capture_calibrate_restart(void);
+
+int8_t capture_calibrate_rewrite(void);
+
+int8_t capture_calibrate_self_test(bool enable, icm20649_data_t *p_expected);
+
+void capture_calibrate_sums(capture_calibration_t *p_sums);
+
+void capture_calibrate_end(void);
+
+#endif //CAPTURE_H
@@ -0,0 +1,378 @@
+//-------------------------------------------
+// Title: capture_core.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: The capture and commit glue of imu_pcb_rev1_app that
+// needs no hardware. Each burst runs through the filter and the trigger
+// into the pre-trigger ring until an impact starts, its records are packed
+// into the buffer the hal gives out until the impact is quiet, chained or
+// the longest of the window, and the buffer goes back to the hal. The
+// commit steps take the metrics, the summary and the page encoding of a
+// capture from here, so tools/pipeline_sim runs the same code as the device
+//-------------------------------------------
+#include <string.h>
+#include "app_util.h"
+
+#include "capture_core.h"
+#include "impact_record.h"
+#include "impact_location.h"
+#include "profiler.h"
+
+// returns the larger of peak and the magnitudes of three axes
+static uint16_t capture_core_axes_peak(int16_t const *axes, uint16_t peak)
+{
+    uint16_t mag;
+    uint8_t j;
+
+    for (j = 0; j < 3; j++)
+    {
+        mag = (axes[j] < 0) ? (uint16_t) -(int32_t) axes[j] : (uint16_t) axes[j];
+        if (mag > peak)
+        {
+            peak = mag;
+        }
+    }
+    return peak;
+}
+
+// Packs accel samples into the recording chain with the same gyro sample,
+// the ones the pool has no room for are counted and the record after them
+// carries the gap marker
+RAMFUNC static void capture_core_push(capture_core_t *core, adxl372_accel_data_t const *samples,
+                                      uint16_t num_samples, icm20649_data_t const *gyro)
+{
+    capture_buf_t *p_buf = core->p_capture;
+    impact_record_t *record;
+    uint8_t delta;
+    uint16_t i;
+
+    p_buf->gyro_peak = capture_core_axes_peak(&gyro->gyro_x, p_buf->gyro_peak);
+    p_buf->icm_accel_peak = capture_core_axes_peak(&gyro->accel_x, p_buf->icm_accel_peak);
+    for (i = 0; i < num_samples; i++)
+    {
+        record = record_chain_append(&p_buf->chain);
+        if (record == NULL)
+        {
+            p_buf->dropped += num_samples - i;
+            p_buf->gap = true;
+            return;
+        }
+        //fifo samples are back to back, one adxl372 sample period apart
+        if (p_buf->count == 0)
+        {
+            delta = 0;
+        }
+        else if (p_buf->gap)
+        {
+            delta = IMPACT_RECORD_DELTA_GAP;
+            p_buf->gaps++;
+        }
+        else
+        {
+            delta = core->window.delta;
+        }
+        p_buf->gap = false;
+        impact_record_pack(record, &samples[i], gyro, delta);
+        p_buf->count++;
+    }
+}
+
+// Starts recording into the buffer the hal gives out with the pre-trigger window in front,
+// the gyro is not kept before the trigger so those records have no icm20649 data
+// returns false if every buffer is still held by the thread
+static bool capture_core_open(capture_core_t *core, uint16_t trigger_index)
+{
+    static icm20649_data_t const no_gyro_data = {0};
+    capture_buf_t *p_buf;
+    uint16_t num_samples;
+
+    p_buf = core->p_hal->open(trigger_index);
+    if (p_buf == NULL)
+    {
+        return false;
+    }
+
+    p_buf->count = 0;
+    p_buf->dropped = 0;
+    p_buf->gaps = 0;
+    p_buf->chained = 0;
+    p_buf->gap = false;
+    p_buf->onset = impact_trigger_onset(&core->trigger);
+    p_buf->gyro_peak = 0;
+    p_buf->icm_accel_peak = 0;
+    p_buf->closed = false;
+
+    core->p_capture = p_buf;
+    num_samples = sample_ring_copy_out(&core->pre_trigger_ring, core->pre_trigger_window,
+                                       core->window.pre_trigger_samples);
+    capture_core_push(core, core->pre_trigger_window, num_samples, &no_gyro_data);
+    p_buf->pre_trigger = p_buf->count;
+    core->since_trigger = 0;
+
+    return true;
+}
+
+// Waits out the chain window of a quiet capture, the trigger looks for the
+// next onset and the samples go to the pre-trigger ring meanwhile
+static void capture_core_chain_wait(capture_core_t *core)
+{
+    core->chaining = true;
+    core->chain_since = 0;
+    impact_trigger_rearm(&core->trigger);
+    sample_ring_reset(&core->pre_trigger_ring);
+}
+
+// Extends the quiet capture with the samples read since it went quiet, up to
+// the one the new trigger fired on, the ones the ring lost to a long final
+// burst or a fifo overrun are a gap. They have the newest gyro read
+static void capture_core_chain(capture_core_t *core, adxl372_accel_data_t const *samples, uint16_t num_samples,
+                               icm20649_data_t const *gyro)
+{
+    uint16_t num_kept;
+
+    sample_ring_push(&core->pre_trigger_ring, samples, num_samples);
+    num_kept = sample_ring_copy_out(&core->pre_trigger_ring, core->pre_trigger_window,
+                                    core->window.pre_trigger_samples);
+    if (num_kept < core->chain_since + num_samples)
+    {
+        core->p_capture->gap = true;
+    }
+    capture_core_push(core, core->pre_trigger_window, num_kept, gyro);
+    core->since_trigger += core->chain_since + num_samples;
+    core->p_capture->chained++;
+    core->chaining = false;
+}
+
+/*
+ * Starts waiting for an impact with no capture open, the trigger is set up
+ * by the owner and the window by capture_core_window_set()
+ * @param p_hal - buffers of the captures, kept for the life of the core
+ */
+void capture_core_init(capture_core_t *core, capture_core_hal_t const *p_hal)
+{
+    core->p_hal = p_hal;
+    core->p_capture = NULL;
+    core->chaining = false;
+    core->since_trigger = 0;
+    core->chain_since = 0;
+    accel_filter_init(&core->accel_filter);
+}
+
+/*
+ * Takes the windows of a sampling profile, no capture may be open. The
+ * filter history and the pre-trigger window start over
+ */
+void capture_core_window_set(capture_core_t *core, capture_core_window_t const *p_window)
+{
+    core->window = *p_window;
+    accel_filter_reset(&core->accel_filter);
+    sample_ring_init(&core->pre_trigger_ring, core->pre_trigger_buf, core->window.pre_trigger_samples);
+}
+
+/*
+ * Starts the filter history, the trigger and the pre-trigger window over
+ */
+void capture_core_reset(capture_core_t *core)
+{
+    accel_filter_reset(&core->accel_filter);
+    sample_ring_reset(&core->pre_trigger_ring);
+    impact_trigger_rearm(&core->trigger);
+}
+
+/*
+ * Samples were lost before the next burst, the filter history and the
+ * pre-trigger window no longer line up. An open capture marks its next record
+ */
+void capture_core_gap(capture_core_t *core)
+{
+    accel_filter_reset(&core->accel_filter);
+    if (core->p_capture == NULL)
+    {
+        sample_ring_reset(&core->pre_trigger_ring);
+        impact_trigger_rearm(&core->trigger);
+    }
+    else
+    {
+        core->p_capture->gap = true;
+        if (core->chaining)
+        {
+            //the samples after the gap are the window of the next impact
+            sample_ring_reset(&core->pre_trigger_ring);
+        }
+    }
+}
+
+/*
+ * Runs one fifo burst through the filter and the trigger and records it,
+ * spi interrupt or the thread of a replay. The samples are filtered in place
+ */
+RAMFUNC void capture_core_burst(capture_core_t *core, adxl372_accel_data_t *samples, uint16_t num_samples,
+                                icm20649_data_t const *gyro)
+{
+    if (core->window.filter)
+    {
+        accel_filter_block(&core->accel_filter, samples, num_samples);
+    }
+    capture_core_record(core, samples, num_samples, gyro,
+                        impact_trigger_update(&core->trigger, samples, num_samples));
+}
+
+/*
+ * Records a burst the trigger went over, into the pre-trigger ring or the
+ * open capture, opening, chaining or closing it on the way
+ * @param trigger_index - impact_trigger_update() of the burst
+ */
+RAMFUNC void capture_core_record(capture_core_t *core, adxl372_accel_data_t const *samples, uint16_t num_samples,
+                                 icm20649_data_t const *gyro, int16_t trigger_index)
+{
+    capture_core_window_t const *window = &core->window;
+
+    if (core->p_capture == NULL)
+    {
+        if (trigger_index < 0)
+        {
+            sample_ring_push(&core->pre_trigger_ring, samples, num_samples);
+            return;
+        }
+        //freeze the pre-trigger window and record the rest of the triggering burst
+        sample_ring_push(&core->pre_trigger_ring, samples, trigger_index);
+        if (!capture_core_open(core, (uint16_t) trigger_index))
+        {
+            //every buffer is waiting for the flash, the impact is lost
+            core->p_hal->lost(num_samples - trigger_index);
+            impact_trigger_rearm(&core->trigger);
+            return;
+        }
+        samples += trigger_index;
+        num_samples -= trigger_index;
+    }
+    else if (core->chaining)
+    {
+        if (trigger_index < 0)
+        {
+            sample_ring_push(&core->pre_trigger_ring, samples, num_samples);
+            core->chain_since += num_samples;
+            if (core->chain_since >= window->chain_samples
+                || core->since_trigger + core->chain_since >= window->max_samples)
+            {
+                capture_core_close(core);
+            }
+            return;
+        }
+        capture_core_chain(core, samples, trigger_index, gyro);
+        samples += trigger_index;
+        num_samples -= trigger_index;
+    }
+
+    capture_core_push(core, samples, num_samples, gyro);
+    core->since_trigger += num_samples;
+    //the trigger stays active and counts the quiet samples at the end of the impact
+    if (core->since_trigger >= window->max_samples)
+    {
+        capture_core_close(core);
+    }
+    else if (core->trigger.quiet >= window->quiet_samples)
+    {
+        if (window->chain_samples > 0)
+        {
+            capture_core_chain_wait(core);
+        }
+        else
+        {
+            capture_core_close(core);
+        }
+    }
+}
+
+/*
+ * Closes the open capture and hands it to the hal, the window in front of
+ * the next impact starts after it. A capture that waited for a chained
+ * trigger already has that window in the ring
+ */
+void capture_core_close(capture_core_t *core)
+{
+    capture_buf_t *p_buf = core->p_capture;
+
+    core->p_capture = NULL;
+    p_buf->closed = true;
+    if (!core->chaining)
+    {
+        impact_trigger_rearm(&core->trigger);
+        sample_ring_reset(&core->pre_trigger_ring);
+    }
+    core->chaining = false;
+    core->p_hal->close(p_buf);
+}
+
+/*
+ * Starts the metrics of a capture, its records are added a block at a time.
+ * The record deltas count periods of the base rate whatever the profile
+ * sampled at, the gyro counts are of the range the capture was read at and
+ * the time above the trigger is timed against the onset it fired at
+ */
+void capture_core_metrics_init(capture_buf_t const *p_buf, impact_metrics_t *p_metrics)
+{
+    impact_metrics_init(p_metrics, SAMPLING_PROFILE_BASE_HZ, p_buf->onset, IMPACT_RECORD_GYRO_FS_DPS(p_buf->range));
+}
+
+/*
+ * Works the event summary out from the metrics of every record of a capture.
+ * No orientation estimate in this firmware, 0xFF marks the summary fields as unknown
+ */
+void capture_core_summary_fill(impact_metrics_t const *p_metrics, event_store_summary_t *p_summary)
+{
+    static impact_location_mount_t const mount = IMPACT_LOCATION_MOUNT_IDENTITY;
+
+    memset(p_summary, 0xFF, sizeof(event_store_summary_t));
+    p_summary->location     = impact_location_classify(mount, p_metrics->peak_vector, p_summary->direction);
+    p_summary->peak_g_x10   = MIN(impact_metrics_peak_mg(p_metrics)/100, EVENT_STORE_PEAK_UNKNOWN - 1);
+    p_summary->duration_ms  = MIN(impact_metrics_duration_us(p_metrics)/1000, UINT16_MAX);
+    p_summary->clip_points  = p_metrics->clip_points;
+    p_summary->clipped_adxl = MIN(p_metrics->clipped_adxl, EVENT_STORE_CLIP_UNKNOWN - 1);
+    p_summary->clipped_icm  = MIN(p_metrics->clipped_icm, EVENT_STORE_CLIP_UNKNOWN - 1);
+}
+
+/*
+ * Starts the encoding of an event with an empty chunk
+ * @param kind - IMPACT_CODEC_NIBBLE for IMPACT_CODEC_ENCODING, IMPACT_CODEC_PACKED for raw records
+ */
+void capture_core_encode_init(capture_core_encoder_t *encoder, impact_codec_kind_t kind)
+{
+    encoder->kind = kind;
+    impact_codec_init(&encoder->codec);
+    encoder->next_record = 0;
+    encoder->fill = 0;
+}
+
+/*
+ * Encodes records of the capture into the chunk until it holds room bytes,
+ * the overshoot of the last record stays buffered for the next page. Each
+ * block goes to the metrics whole once it is encoded, in the order the
+ * capture recorded it, and back to the pool. A capture that is still
+ * recording only gives up the blocks before its tail
+ * @param room - event_store_append_room(), so an append never programs more than one page
+ */
+void capture_core_encode(capture_core_encoder_t *encoder, capture_buf_t *p_buf, impact_metrics_t *p_metrics,
+                         uint32_t room)
+{
+    record_chain_t *chain = &p_buf->chain;
+    impact_record_t const *record;
+
+    while (chain->p_head != NULL && encoder->fill < room)
+    {
+        //the capture interrupt appends to the tail block until the capture closes
+        if (!p_buf->closed && chain->p_head->p_next == NULL)
+        {
+            break;
+        }
+        record = &chain->p_head->records[encoder->next_record];
+        encoder->fill += impact_codec_encode_with(encoder->kind, &encoder->codec, record,
+                                                  &encoder->chunk[encoder->fill]);
+        encoder->next_record++;
+        if (encoder->next_record == chain->p_head->count)
+        {
+            impact_metrics_add_block(p_metrics, chain->p_head->records, chain->p_head->count);
+            record_chain_free_head(chain);
+            encoder->next_record = 0;
+        }
+    }
+}
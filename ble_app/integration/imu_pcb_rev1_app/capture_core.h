@@ -0,0 +1,91 @@
+#ifndef CAPTURE_CORE_H
+#define CAPTURE_CORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "capture.h"
+#include "accel_filter.h"
+#include "impact_trigger.h"
+#include "sample_ring.h"
+#include "impact_metrics.h"
+#include "impact_codec.h"
+#include "event_store.h"
+#include "mt25ql256aba.h"
+
+/* The part of the capture and of the commit steps that does not touch the
+ * sensors, the timers or the scheduler: the filter, the trigger and the
+ * pre-trigger window of each burst, the records packed into a capture buffer
+ * from the trigger to the quiet end or a chained trigger, and the metrics,
+ * summary and page encoding of a closed capture. capture.c and main.c run it
+ * on the device and tools/pipeline_sim on the host, each behind its own
+ * capture_core_hal_t. The hal claims a free buffer and sets its own fields
+ * (chain, times, profile), the core resets the record counters and the
+ * onset, and gets it back once closed to hand it to the thread.
+ * capture_core_burst() is capture_core_record() after the filter and the
+ * trigger, the sim calls the three itself to time them apart */
+typedef struct {
+    capture_buf_t *(*open)(uint16_t trigger_index); //a free buffer with an empty chain, NULL if every one is held
+    void (*close)(capture_buf_t *p_buf);            //closed, hand it to the thread
+    void (*lost)(uint16_t num_samples);             //of an impact no buffer was free for
+} capture_core_hal_t;
+
+/* Windows of the sampling profile in its samples */
+typedef struct {
+    uint32_t max_samples;           //from the trigger on
+    uint32_t quiet_samples;
+    uint32_t chain_samples;         //0 closes a capture as soon as it is quiet
+    uint16_t pre_trigger_samples;   //at most PRE_TRIGGER_SAMPLES
+    uint8_t delta;                  //record delta of one sample period
+    bool filter;                    //the bursts go through accel_filter first
+} capture_core_window_t;
+
+typedef struct {
+    capture_core_hal_t const *p_hal;
+    capture_core_window_t window;
+    capture_buf_t *p_capture;       //recording, NULL while waiting for an impact
+    uint32_t since_trigger;         //samples read from the trigger on, stored or dropped
+    bool chaining;                  //p_capture went quiet and waits for a trigger to extend it
+    uint32_t chain_since;           //samples read into the pre-trigger ring while it waits
+    accel_filter_t accel_filter;
+    impact_trigger_t trigger;       //set up by the owner with the thresholds of the profile
+    sample_ring_t pre_trigger_ring;
+    adxl372_accel_data_t pre_trigger_buf[PRE_TRIGGER_SAMPLES];
+    adxl372_accel_data_t pre_trigger_window[PRE_TRIGGER_SAMPLES]; //copied out at the trigger
+} capture_core_t;
+
+/* Page encoding of a closed or streamed capture, the records of each block go
+ * to the metrics once the block is encoded and freed */
+typedef struct {
+    impact_codec_kind_t kind;
+    impact_codec_t codec;
+    uint16_t next_record;           //in the head block of the chain, the blocks before are freed
+    uint16_t fill;
+    uint8_t chunk[MT25QL256ABA_PAGE_SIZE + IMPACT_CODEC_MAX_RECORD_SIZE];
+} capture_core_encoder_t;
+
+void capture_core_init(capture_core_t *core, capture_core_hal_t const *p_hal);
+
+void capture_core_window_set(capture_core_t *core, capture_core_window_t const *p_window);
+
+void capture_core_reset(capture_core_t *core);
+
+void capture_core_gap(capture_core_t *core);
+
+void capture_core_burst(capture_core_t *core, adxl372_accel_data_t *samples, uint16_t num_samples,
+                        icm20649_data_t const *gyro);
+
+void capture_core_record(capture_core_t *core, adxl372_accel_data_t const *samples, uint16_t num_samples,
+                         icm20649_data_t const *gyro, int16_t trigger_index);
+
+void capture_core_close(capture_core_t *core);
+
+void capture_core_metrics_init(capture_buf_t const *p_buf, impact_metrics_t *p_metrics);
+
+void capture_core_summary_fill(impact_metrics_t const *p_metrics, event_store_summary_t *p_summary);
+
+void capture_core_encode_init(capture_core_encoder_t *encoder, impact_codec_kind_t kind);
+
+void capture_core_encode(capture_core_encoder_t *encoder, capture_buf_t *p_buf, impact_metrics_t *p_metrics,
+                         uint32_t room);
+
+#endif //CAPTURE_CORE_H
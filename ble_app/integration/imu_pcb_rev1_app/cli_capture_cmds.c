@@ -0,0 +1,1310 @@
+//-------------------------------------------
+// Title: cli_capture_cmds.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: CLI commands for imu_pcb_rev1_app, they run in the cli task
+// below the capture interrupts and only read what the pipeline keeps in ram
+//   capture stats          capture and commit counters, profiler probes
+//   capture status         stored events, the flash free and its wear, the event store
+//                          cache, the longest flash access and its power state, the battery and
+//                          the record pool peak
+//   capture sync           time sync to the gateway and the current reference time
+//   capture query <from> <to> [min g]
+//                          the stored events between two epochs at or above a peak,
+//                          from their headers only
+//   capture replay <id>    runs a stored event back through the filter, trigger,
+//                          metrics and codec, with the cycles of each stage
+//   profile                the sampling profiles, the one running marked
+//   profile set <name>     switches the sampling profile and saves it for the next boot
+//   config                 the device config in use and whether it came from the flash
+//   config offset <x> <y> <z>
+//                          writes the adxl372 offset trims and saves them for the next boot
+//   config key <hex|clear> saves the AES-128 key of the stored events for the next boot
+//   calibrate [+x|-x|+y|-y|+z|-z]
+//                          measures the adxl372 trims and the icm20649 bias with the board at
+//                          rest, the given adxl372 axis up (+z by default), and saves them
+//   stream [<Hz>|off]      the live stream rate and its dropped frames, or starts it at
+//                          400 or 25 Hz, the frames go to a central that listens on the
+//                          offload data characteristic
+//   activity               the wear state and the activity log: its next page and the
+//                          pages written, left out or waiting and the seconds dropped
+//   selftest               the sensor self test runs, fails and drops and the last results
+//   selftest run           runs the self test at the next idle, worn or not, without the wait
+//   ram                    the RAM of the app by section and the high-water marks of
+//                          the main stack, the watched interrupts and the thread stacks
+//   bus                    busy time of each bus and its transactions and bytes per device
+//   bus reset              starts a new window, e.g. after a profile switch
+//   rtc get                the ds1388 time and the monotonic time's anchor to it
+//   rtc set <epoch>[.frac] sets the ds1388 to seconds since 1970-01-01 UTC, e.g. date +%s.%N
+//   energy                 time in each power state, the average current and mAh per day
+//   energy current <state> <uA>
+//                          replaces the datasheet current of a state with a measured one
+//   energy reset           clears the times, e.g. before timing one firmware change
+//   cpu                    busy share of the last second, its 10 s average and peak, in
+//                          total and per capture interrupt, SoftDevice event and idle stage
+//   cpu reset              clears the windows, e.g. before trying an added feature
+//   latency                trigger to alert time of each stage: last, longest and its
+//                          histogram, and the alerts past the budget
+//   latency budget <ms>    moves the budget the alerts are warned against
+//   latency reset          clears the times and the counts
+// The rtc commands wait on the i2c bus, behind the capture's own time reads. The
+// query and the replay read the flash one bounded hold at a time and yield to
+// the idle task between them, as does the calibration while the sums come in
+//-------------------------------------------
+#include <stdlib.h>
+#include <string.h>
+#include "nrf_cli.h"
+#include "task_manager.h"
+
+#include "cli_capture_cmds.h"
+#include "capture.h"
+#include "sampling_profile.h"
+#include "device_config.h"
+#include "calibration.h"
+#include "accel_decimate.h"
+#include "live_stream.h"
+#include "activity_log.h"
+#include "vcnl4040.h"
+#include "impact_record.h"
+#include "impact_codec.h"
+#include "sample_bus.h"
+#include "profiler.h"
+#include "stack_watch.h"
+#include "battery_monitor.h"
+#include "energy_profiler.h"
+#include "cpu_load.h"
+#include "bus_stats.h"
+#include "exposure_stats.h"
+#include "latency_budget.h"
+#include "self_test.h"
+#include "event_crypt.h"
+#include "radio_window.h"
+#include "hf_clock.h"
+#include "mono_time.h"
+#include "spi_driver.h"
+#include "twi_driver.h"
+#include "adxl372.h"
+#include "icm20649.h"
+#include "mt25ql256aba.h"
+
+static pipeline_stats_t const *m_p_stats;
+static event_store_t *m_p_store;
+static time_sync_t *m_p_time_sync;
+
+#define RTC_EPOCH_MIN   946684800  //2000-01-01, the ds1388 keeps two year digits
+#define RTC_EPOCH_MAX   4102444799u//2099-12-31 23:59:59
+#define REPLAY_READ_SIZE        256 //coded bytes per flash hold of a replay
+#define REPLAY_CYCLES_PER_US    64
+#define REPLAY_DRAIN_MS         2000//longest wait for the idle task to time the closed captures
+
+void cli_capture_init(pipeline_stats_t const *stats, event_store_t *store, time_sync_t *time_sync)
+{
+    m_p_stats = stats;
+    m_p_store = store;
+    m_p_time_sync = time_sync;
+}
+
+static void cmd_capture(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    if ((argc == 1) || nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s %s: command not found\r\n", argv[0], argv[1]);
+}
+
+static void cmd_capture_stats(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    sample_bus_stats_t bus;
+
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "captures: %u, samples: %u, dropped: %u, fifo overruns: %u, record gaps: %u\r\n",
+                    m_p_stats->captures, m_p_stats->samples_captured,
+                    m_p_stats->samples_dropped, m_p_stats->fifo_overruns, m_p_stats->record_gaps);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "chained triggers: %u, trigger onset: %u mg\r\n",
+                    m_p_stats->captures_chained, capture_trigger_onset_mg());
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "rate: %u Hz last, %u Hz min\r\n",
+                    m_p_stats->last_rate_hz, m_p_stats->min_rate_hz);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "commits: %u, %u ms last, %u ms max, %u erase stalls\r\n",
+                    m_p_stats->commits, m_p_stats->last_commit_ms,
+                    m_p_stats->max_commit_ms, m_p_stats->erase_stalls);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "fifo: %u entry watermark, %u us longest drain\r\n",
+                    m_p_stats->watermark, m_p_stats->max_drain_us);
+    sample_bus_stats(&bus);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "sample bus: %u published, %u copies, %u pool empty, %u sched full, %u blocks held at most\r\n",
+                    bus.published, bus.copies, bus.pool_empty, bus.sched_full, bus.refs_max);
+
+#if PROFILER_ENABLED
+    //the probes go to the log, the cli prints it as well
+    profiler_dump();
+#endif
+}
+
+static void cmd_capture_status(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    uint32_t hits, misses;
+    uint32_t dropped, moved;
+
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "events: %u stored, %u acked, %u oldest held\r\n",
+                    event_store_count(m_p_store), event_store_acked(m_p_store), event_store_oldest(m_p_store));
+    if (event_store_read_only(m_p_store))
+        nrf_cli_fprintf(p_cli, NRF_CLI_WARNING, "store of version %u: read only, formatted once every event is acked\r\n",
+                        m_p_store->version);
+    event_store_retain_stats(m_p_store, &dropped, &moved);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "retention: %u reclaimed before the offload, %u pinned ones moved\r\n",
+                    dropped, moved);
+    //the ring erases its sectors in order, the last and the first sector bound the wear of all
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "flash: %u KB free, %u to %u erases per sector\r\n",
+                    event_store_free(m_p_store)/1024,
+                    event_store_sector_erases(m_p_store, EVENT_STORE_RING_SECTORS - 1),
+                    event_store_sector_erases(m_p_store, 0));
+    event_store_cache_stats(m_p_store, &hits, &misses);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "index cache: %u hits, %u flash reads\r\n", hits, misses);
+    event_store_cache_block_stats(m_p_store, &hits, &misses);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "sample cache: %u hits, %u flash reads\r\n", hits, misses);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "flash hold: %u us max, %u ms allowed, %s\r\n",
+                    capture_flash_hold_max_us(), CAPTURE_FLASH_HOLD_MAX_MS,
+                    (capture_flash_power() == CAPTURE_FLASH_AWAKE) ? "awake" : "in deep power-down");
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "radio: %u erase and commit steps held back for a radio event\r\n",
+                    radio_window_deferrals());
+    if (battery_monitor_percent() != BATTERY_MONITOR_PERCENT_UNKNOWN)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "battery: %u mV, %u%%%s\r\n", battery_monitor_mv(),
+                        battery_monitor_percent(), battery_monitor_low() ? ", low" : "");
+    }
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "record pool: %u of %u blocks max\r\n",
+                    capture_pool_max_blocks(), CAPTURE_POOL_BLOCKS);
+}
+
+static void cmd_capture_sync(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    time_sync_status_t status;
+    ds1388_data_t date;
+    uint64_t ref_us;
+    uint32_t us;
+
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    time_sync_get_status(m_p_time_sync, &status);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "sync: %s, %u points, drift %d ppb, last %u ms ago\r\n",
+                    status.synced ? "locked" : "none", status.num_points, status.drift_ppb, status.age_ms);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "references: %u accepted, %u dropped\r\n",
+                    status.accepted, status.rejected);
+    if (time_sync_ticks_to_ref_us(m_p_time_sync, app_timer_cnt_get(), &ref_us) == 0)
+    {
+        time_sync_to_ds1388(ref_us, &date, &us);
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "reference: 20%02u-%02u-%02u %02u:%02u:%02u.%06u UTC\r\n",
+                        date.year, date.month, date.date, date.hour, date.minute, date.second, us);
+    }
+}
+
+static void cmd_capture_query(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    event_store_header_t header;
+    event_store_query_t query;
+    uint32_t from_s, to_s, min_g = 0;
+    uint32_t id, found = 0;
+    char *p_end;
+    int8_t ret;
+
+    if (nrf_cli_help_requested(p_cli) || argc < 3 || argc > 4)
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    from_s = strtoul(argv[1], &p_end, 10);
+    if (p_end == argv[1] || *p_end != '\0')
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s: not an epoch\r\n", argv[1]);
+        return;
+    }
+    to_s = strtoul(argv[2], &p_end, 10);
+    if (p_end == argv[2] || *p_end != '\0' || to_s < from_s)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s: not an epoch after %u\r\n", argv[2], from_s);
+        return;
+    }
+    if (argc == 4)
+    {
+        min_g = strtoul(argv[3], &p_end, 10);
+        if (p_end == argv[3] || *p_end != '\0' || min_g >= EVENT_STORE_PEAK_UNKNOWN/10)
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s: not a peak in g\r\n", argv[3]);
+            return;
+        }
+    }
+
+    capture_flash_acquire();
+    ret = event_store_query_init(m_p_store, &query, from_s, to_s, min_g*10);
+    capture_flash_release();
+    while (ret >= 0 && !event_store_query_done(&query))
+    {
+        capture_flash_acquire();
+        ret = event_store_query_next(m_p_store, &query, &id, &header);
+        capture_flash_release();
+        if (ret > 0)
+        {
+            found++;
+            if (header.summary.peak_g_x10 == EVENT_STORE_PEAK_UNKNOWN)
+                nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "event %u: epoch %u, peak unknown\r\n", id, header.time.s);
+            else
+                nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "event %u: epoch %u, %u.%u g, %u ms, location %u\r\n",
+                                id, header.time.s, header.summary.peak_g_x10/10, header.summary.peak_g_x10%10,
+                                header.summary.duration_ms, header.summary.location);
+            if (header.summary.clipped_adxl != EVENT_STORE_CLIP_UNKNOWN &&
+                (header.summary.clipped_adxl != 0 || header.summary.clipped_icm != 0))
+                nrf_cli_fprintf(p_cli, NRF_CLI_WARNING, "  clipped: %u adxl372, %u icm20649 records\r\n",
+                                header.summary.clipped_adxl, header.summary.clipped_icm);
+        }
+        //the offload and the commit go on between the holds
+        task_yield();
+    }
+    if (ret < 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "query: flash read failed\r\n");
+        return;
+    }
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%u events\r\n", found);
+}
+
+/*
+ * Decodes a stored event a fifo watermark of the running profile at a time and hands each
+ * burst to the capture as if the adxl372 had read it, the trace was filtered
+ * once when it was recorded and goes through the filter again. The record
+ * time deltas are not replayed, the samples are taken back to back
+ * @return 0 if success, -1 on spi error, -2 if the coded stream is corrupt
+ */
+static int8_t replay_event(uint32_t id, uint32_t num_bytes, uint32_t *p_records)
+{
+    static uint8_t in[REPLAY_READ_SIZE];
+    static adxl372_accel_data_t burst[ADXL_FIFO_MAX_SAMPLES];
+    //the watermark counts fifo entries, an xyz sample takes three
+    uint16_t burst_size = MIN(MAX(capture_profile()->watermark / 3, 1), ADXL_FIFO_MAX_SAMPLES);
+    icm20649_data_t gyro = {0};
+    impact_codec_t codec;
+    impact_record_t record;
+    uint32_t offset = 0, pos = 0, fill = 0, n;
+    uint16_t count = 0;
+    uint8_t used, delta;
+    int8_t ret;
+
+    impact_codec_init(&codec);
+    while (offset < num_bytes || fill > 0)
+    {
+        //a record is never split across two reads, top up before it could run out
+        if (offset < num_bytes && fill < IMPACT_CODEC_MAX_RECORD_SIZE)
+        {
+            memmove(in, &in[pos], fill);
+            pos = 0;
+            n = MIN(sizeof(in) - fill, num_bytes - offset);
+            capture_flash_acquire();
+            ret = event_store_read_samples(m_p_store, id, offset, &in[fill], n);
+            capture_flash_release();
+            if (ret < 0)
+            {
+                return (ret == -1) ? -1 : -2;
+            }
+            offset += n;
+            fill += n;
+        }
+        if (impact_codec_decode(&codec, &in[pos], fill, &record, &used) < 0)
+        {
+            return -2;
+        }
+        pos += used;
+        fill -= used;
+        impact_record_unpack(&record, &burst[count], &gyro, &delta);
+        (*p_records)++;
+        if (++count == burst_size)
+        {
+            capture_replay_burst(burst, count, &gyro);
+            count = 0;
+            //the commit and offload of live events go on between the bursts
+            task_yield();
+        }
+    }
+    capture_replay_burst(burst, count, &gyro);
+
+    return 0;
+}
+
+static void cmd_capture_replay(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    capture_replay_stats_t const *stats = capture_replay_stats();
+    event_store_header_t header;
+    uint32_t id, records = 0, start_ticks;
+    char *p_end;
+    uint8_t range, kind;
+    bool coded, fused;
+    int8_t ret;
+
+    if (nrf_cli_help_requested(p_cli) || argc != 2)
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    id = strtoul(argv[1], &p_end, 10);
+    if (p_end == argv[1] || *p_end != '\0')
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s: not an event id\r\n", argv[1]);
+        return;
+    }
+    capture_flash_acquire();
+    ret = event_store_get_header(m_p_store, id, &header);
+    capture_flash_release();
+    if (ret < 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "event %u: %s\r\n", id,
+                        (ret == -2) ? "not stored" : "header read failed");
+        return;
+    }
+    //the trigger only sees the adxl372 counts, the icm20649 range of the event does not matter
+    if (impact_codec_encoding_parse(header.encoding, &coded, &range, &fused) < 0 || !coded || header.sample_size != 1)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "event %u: encoding %u can't be replayed\r\n", id, header.encoding);
+        return;
+    }
+    if (capture_replay_begin() < 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "replay: an impact is being recorded, try again\r\n");
+        return;
+    }
+
+    ret = replay_event(id, header.sample_count, &records);
+    capture_replay_end();
+    //the done handler times the captures the trace closed from the idle task
+    start_ticks = app_timer_cnt_get();
+    while (stats->timed < stats->closed)
+    {
+        if (app_timer_cnt_diff_compute(app_timer_cnt_get(), start_ticks) > APP_TIMER_TICKS(REPLAY_DRAIN_MS))
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_WARNING, "replay: %u of %u captures not timed after %u ms\r\n",
+                            stats->closed - stats->timed, stats->closed, REPLAY_DRAIN_MS);
+            break;
+        }
+        task_yield();
+    }
+    if (ret < 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "replay: %s after %u records\r\n",
+                        (ret == -1) ? "flash read failed" : "corrupt coded stream", records);
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "event %u: %u records in %u bursts, %u captures closed\r\n",
+                    id, records, stats->bursts, stats->closed);
+    if (stats->bursts > 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "burst (filter, trigger, capture): %u us mean, %u us max\r\n",
+                        (uint32_t) (stats->burst_cycles/stats->bursts/REPLAY_CYCLES_PER_US),
+                        stats->burst_max_cycles/REPLAY_CYCLES_PER_US);
+    }
+    if (stats->timed > 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "last capture: %u records, %u mg, %u us, HIC15 %u\r\n",
+                        stats->records, stats->peak_mg, stats->duration_us, stats->hic15);
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "metrics and location: %u us\r\n",
+                        stats->metrics_cycles/REPLAY_CYCLES_PER_US);
+        for (kind = 0; kind < IMPACT_CODEC_KINDS && stats->records > 0; kind++)
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "codec %s: %u.%02u bytes and %u cycles per sample\r\n",
+                            impact_codec_name((impact_codec_kind_t) kind),
+                            stats->encoded_bytes[kind]/stats->records,
+                            (stats->encoded_bytes[kind]%stats->records)*100/stats->records,
+                            stats->encode_cycles[kind]/stats->records);
+        }
+    }
+}
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_sub_capture)
+{
+    NRF_CLI_CMD(stats,  NULL, "'capture stats' prints the capture and commit counters", cmd_capture_stats),
+    NRF_CLI_CMD(status, NULL, "'capture status' prints the stored events, the flash free and wear, the index cache, the flash bus hold, the battery and the record pool peak", cmd_capture_status),
+    NRF_CLI_CMD(sync,   NULL, "'capture sync' prints the time sync to the gateway", cmd_capture_sync),
+    NRF_CLI_CMD(query,  NULL, "'capture query <from epoch> <to epoch> [min g]' lists the stored events of a time range at or above a peak", cmd_capture_query),
+    NRF_CLI_CMD(replay, NULL, "'capture replay <id>' runs a stored event through the trigger, metrics and every codec and prints the time of each stage and the size of each codec", cmd_capture_replay),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+NRF_CLI_CMD_REGISTER(capture, &m_sub_capture, "Commands for the impact capture pipeline", cmd_capture);
+
+static void cmd_profile(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    sampling_profile_t const *p_profile;
+
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if (argc > 1)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s %s: command not found\r\n", argv[0], argv[1]);
+        return;
+    }
+
+    for (int i = 0; i < SAMPLING_PROFILE_COUNT; ++i)
+    {
+        p_profile = sampling_profile_get((sampling_profile_id_t) i);
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%c %u %-10s %4u Hz, %s, trigger %u-%u g for %u us, %u ms max, %s%s\r\n",
+                        (p_profile == capture_profile()) ? '*' : ' ', i, p_profile->name,
+                        sampling_profile_rate_hz(p_profile), p_profile->filter ? "cfc 1000" : "unfiltered",
+                        p_profile->threshold_mg/1000, (p_profile->threshold_max_mg > p_profile->threshold_mg) ?
+                            p_profile->threshold_max_mg/1000 : p_profile->threshold_mg/1000,
+                        p_profile->min_duration_us, p_profile->max_duration_ms,
+                        (p_profile->encoding == EVENT_STORE_ENCODING_RAW) ? "raw" : "coded",
+                        p_profile->stream ? ", streamed" : "");
+    }
+}
+
+static void cmd_profile_set(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    sampling_profile_id_t id;
+    int8_t ret;
+
+    if (nrf_cli_help_requested(p_cli) || argc != 2)
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if (sampling_profile_find(argv[1], &id) < 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s: no such profile\r\n", argv[1]);
+        return;
+    }
+
+    ret = capture_profile_set(sampling_profile_get(id));
+    if (ret < 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "profile %s: %s\r\n", argv[1],
+                        (ret == -3) ? "an impact is being recorded, try again" :
+                        (ret == -2) ? "can't run on this capture" : "accel write failed");
+        return;
+    }
+    if (sampling_profile_save(id) < 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_WARNING, "profile %s: running but not saved\r\n", argv[1]);
+        return;
+    }
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "profile %s\r\n", argv[1]);
+}
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_sub_profile)
+{
+    NRF_CLI_CMD(set, NULL, "'profile set <game|practice|low-power|lab|collision>' switches the sampling profile and saves it", cmd_profile_set),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+NRF_CLI_CMD_REGISTER(profile, &m_sub_profile, "'profile' lists the sampling profiles, the running one marked", cmd_profile);
+
+static void cmd_config(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    device_config_t const *p_config = device_config_get();
+    sampling_profile_t const *p_profile = sampling_profile_get((sampling_profile_id_t) p_config->profile);
+
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if (argc > 1)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s %s: command not found\r\n", argv[0], argv[1]);
+        return;
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "config: version %u, %s\r\n", p_config->version,
+                    device_config_stored() ? "stored" : "defaults, nothing saved yet");
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "accel offset: x %u y %u z %u\r\n",
+                    p_config->accel_offset[0], p_config->accel_offset[1], p_config->accel_offset[2]);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "icm accel bias: x %d y %d z %d\r\n",
+                    p_config->icm_accel_bias[0], p_config->icm_accel_bias[1], p_config->icm_accel_bias[2]);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "icm gyro bias: x %d y %d z %d\r\n",
+                    p_config->icm_gyro_bias[0], p_config->icm_gyro_bias[1], p_config->icm_gyro_bias[2]);
+    if (p_config->icm_bias_temp_cc != ICM20649_TEMP_UNKNOWN)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "icm gyro drift: x %d y %d z %d 0.001 counts/C from %s%d.%02d C\r\n",
+                        p_config->icm_gyro_temp_slope[0], p_config->icm_gyro_temp_slope[1],
+                        p_config->icm_gyro_temp_slope[2], (p_config->icm_bias_temp_cc < 0) ? "-" : "",
+                        abs(p_config->icm_bias_temp_cc)/100, abs(p_config->icm_bias_temp_cc) % 100);
+    }
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "profile at boot: %s\r\n",
+                    (p_profile != NULL) ? p_profile->name : "invalid, game");
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "data key: %s\r\n",
+                    event_crypt_key_set(p_config->data_key) ? "set, events stored enciphered" : "none");
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "store nonce: 0x%08x\r\n", event_store_nonce(m_p_store));
+}
+
+static void cmd_config_offset(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    device_config_t config = *device_config_get();
+    uint8_t offset[3];
+    unsigned long value;
+    char *p_end;
+    int8_t ret;
+
+    if (nrf_cli_help_requested(p_cli) || argc != 4)
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        value = strtoul(argv[i + 1], &p_end, 0);
+        if (*p_end != '\0' || value > ADXL372_OFFSET_TRIM_MAX)
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s: not a trim, 0 to %u\r\n", argv[i + 1], ADXL372_OFFSET_TRIM_MAX);
+            return;
+        }
+        offset[i] = (uint8_t) value;
+    }
+
+    //the trims go out with the image of the running profile
+    (void) adxl372_set_offset_trim(offset);
+    ret = capture_profile_set(capture_profile());
+    if (ret < 0)
+    {
+        (void) adxl372_set_offset_trim(config.accel_offset);
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "config offset: %s\r\n",
+                        (ret == -3) ? "an impact is being recorded, try again" : "accel write failed");
+        return;
+    }
+    memcpy(config.accel_offset, offset, sizeof(config.accel_offset));
+    if (device_config_save(&config) < 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_WARNING, "config offset: written but not saved\r\n");
+        return;
+    }
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "accel offset: x %u y %u z %u\r\n", offset[0], offset[1], offset[2]);
+}
+
+static void cmd_config_key(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    device_config_t config = *device_config_get();
+    uint8_t key[EVENT_CRYPT_KEY_SIZE];
+    char digits[3] = { 0 };
+    char *p_end;
+
+    if (nrf_cli_help_requested(p_cli) || argc != 2)
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if (strcmp(argv[1], "clear") == 0)
+    {
+        memset(key, 0, sizeof(key));
+    }
+    else
+    {
+        if (strlen(argv[1]) != 2*EVENT_CRYPT_KEY_SIZE)
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s: not a key, %u hex digits\r\n", argv[1], 2*EVENT_CRYPT_KEY_SIZE);
+            return;
+        }
+        for (int i = 0; i < EVENT_CRYPT_KEY_SIZE; ++i)
+        {
+            memcpy(digits, &argv[1][2*i], 2);
+            key[i] = (uint8_t) strtoul(digits, &p_end, 16);
+            if (*p_end != '\0')
+            {
+                nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s: not a key, %u hex digits\r\n", argv[1], 2*EVENT_CRYPT_KEY_SIZE);
+                return;
+            }
+        }
+    }
+
+    //the store takes the key at boot, the events already stored keep the one they were stored with
+    memcpy(config.data_key, key, sizeof(config.data_key));
+    if (device_config_save(&config) < 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "config key: not saved\r\n");
+        return;
+    }
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "data key %s, reset to use it\r\n",
+                    event_crypt_key_set(key) ? "saved" : "cleared");
+}
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_sub_config)
+{
+    NRF_CLI_CMD(offset, NULL, "'config offset <x> <y> <z>' writes the adxl372 offset trims (figure 36) and saves them", cmd_config_offset),
+    NRF_CLI_CMD(key, NULL, "'config key <32 hex digits|clear>' saves the AES-128 key the events are stored with from the next boot", cmd_config_key),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+NRF_CLI_CMD_REGISTER(config, &m_sub_config, "'config' prints the device config in use", cmd_config);
+
+static void cmd_calibrate(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    static char const axes[] = "xyz";
+    calibration_result_t result;
+    char const *p_axis = "+z";
+    char const *p_found;
+    int8_t ret;
+
+    if (nrf_cli_help_requested(p_cli) || argc > 2)
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if (argc == 2)
+    {
+        p_axis = argv[1];
+    }
+    p_found = (strlen(p_axis) == 2) ? strchr(axes, p_axis[1]) : NULL;
+    if ((p_axis[0] != '+' && p_axis[0] != '-') || p_found == NULL)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s: not an axis, +x -x +y -y +z or -z\r\n", p_axis);
+        return;
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "calibrating with %s up, keep the board still\r\n", p_axis);
+    ret = calibration_run((uint8_t) (p_found - axes), p_axis[0] == '-', &result);
+    if (ret < 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "calibrate: %s\r\n",
+                        (ret == -4) ? "the board moved, try again" :
+                        (ret == -3) ? "an impact is being recorded, try again" : "sensor read failed");
+        return;
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "accel offset: x %u y %u z %u after %u steps\r\n",
+                    result.accel_offset[0], result.accel_offset[1], result.accel_offset[2], result.steps);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "accel residual: x %d y %d z %d tenths of a count\r\n",
+                    result.accel_residual_x10[0], result.accel_residual_x10[1], result.accel_residual_x10[2]);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "icm accel bias: x %d y %d z %d, gravity on %c\r\n",
+                    result.icm_accel_bias[0], result.icm_accel_bias[1], result.icm_accel_bias[2],
+                    axes[result.icm_up_axis]);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "icm gyro bias: x %d y %d z %d\r\n",
+                    result.icm_gyro_bias[0], result.icm_gyro_bias[1], result.icm_gyro_bias[2]);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "icm gyro drift: x %d y %d z %d 0.001 counts/C at %s%d.%02d C, %s\r\n",
+                    result.icm_gyro_temp_slope[0], result.icm_gyro_temp_slope[1], result.icm_gyro_temp_slope[2],
+                    (result.icm_temp_cc < 0) ? "-" : "", abs(result.icm_temp_cc)/100, abs(result.icm_temp_cc) % 100,
+                    result.icm_slope_fitted ? "fitted" : "kept, calibrate again 5 C away to fit it");
+    if (calibration_save(&result) < 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_WARNING, "calibrate: in use but not saved\r\n");
+    }
+}
+
+NRF_CLI_CMD_REGISTER(calibrate, NULL, "'calibrate [+x|-x|+y|-y|+z|-z]' measures the accel trims and the icm20649 bias at rest and saves them", cmd_calibrate);
+
+static void cmd_stream(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    unsigned long rate_hz = 0;
+    char *p_end;
+    int8_t ret;
+
+    if (nrf_cli_help_requested(p_cli) || argc > 2)
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if (argc == 2 && strcmp(argv[1], "off") != 0)
+    {
+        rate_hz = strtoul(argv[1], &p_end, 0);
+        if (*p_end != '\0' || (rate_hz != ACCEL_DECIMATE_LIVE_HZ && rate_hz != ACCEL_DECIMATE_ACTIVITY_HZ))
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s: not a rate, %u or %u Hz\r\n", argv[1], ACCEL_DECIMATE_LIVE_HZ,
+                            ACCEL_DECIMATE_ACTIVITY_HZ);
+            return;
+        }
+    }
+    if (argc == 2)
+    {
+        ret = capture_stream_set((uint16_t) rate_hz);
+        if (ret < 0)
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "stream: %lu Hz refused (%d)\r\n", rate_hz, ret);
+            return;
+        }
+    }
+
+    if (live_stream_active())
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "live stream: %u Hz, %u frames dropped\r\n",
+                        live_stream_rate(), live_stream_dropped());
+    }
+    else
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "live stream: off, %u frames dropped\r\n", live_stream_dropped());
+    }
+}
+
+NRF_CLI_CMD_REGISTER(stream, NULL, "'stream [<Hz>|off]' prints the live stream or starts it at a rate, it goes to the offload data characteristic", cmd_stream);
+
+static void cmd_activity(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    activity_log_stats_t stats;
+
+    if (nrf_cli_help_requested(p_cli) || argc > 1)
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    activity_log_stats(&stats);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "activity: %s (proximity %s, %u changes), page %u next at 0x%08x\r\n",
+                    vcnl4040_is_worn() ? "worn" : "not worn",
+                    (vcnl4040_rate_get() == VCNL4040_RATE_FAST) ? "fast" : "slow", vcnl4040_transitions(),
+                    stats.seq, stats.append_addr);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "pages: %u written, %u not worn, %u queued, %u seconds dropped\r\n",
+                    stats.pages_written, stats.pages_unworn, stats.pages_queued, stats.seconds_dropped);
+}
+
+NRF_CLI_CMD_REGISTER(activity, NULL, "'activity' prints the wear state and the activity log counters", cmd_activity);
+
+static void self_test_result_print(nrf_cli_t const * p_cli, char const *name, self_test_result_t const *p_result)
+{
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%s: at %u, adxl372 %s, icm20649 %s",
+                    name, p_result->time_s,
+                    !(p_result->flags & SELF_TEST_ADXL_DONE) ? "not done" :
+                    (p_result->flags & SELF_TEST_ADXL_PASS) ? "pass" : "fail",
+                    (p_result->flags & SELF_TEST_ICM_PASS) ? "pass" : "fail");
+    if (p_result->icm_failed != 0)
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, " (axes 0x%02x)", p_result->icm_failed);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "\r\n  response %d %d %d  %d %d %d of %d %d %d  %d %d %d\r\n",
+                    p_result->response[0], p_result->response[1], p_result->response[2],
+                    p_result->response[3], p_result->response[4], p_result->response[5],
+                    p_result->expected[0], p_result->expected[1], p_result->expected[2],
+                    p_result->expected[3], p_result->expected[4], p_result->expected[5]);
+}
+
+static void cmd_selftest(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    self_test_health_t const *p_health = self_test_health();
+
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if (argc > 1)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s %s: command not found\r\n", argv[0], argv[1]);
+        return;
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "self test: %s, %u runs, %u adxl372 fails, %u icm20649 fails, %u dropped\r\n",
+                    self_test_running() ? "running" : "waiting", p_health->runs, p_health->adxl_fails,
+                    p_health->icm_fails, p_health->dropped);
+    if (p_health->runs == 0)
+        return;
+    self_test_result_print(p_cli, "last", &p_health->last);
+    if (p_health->last_fail.flags != 0 || p_health->last_fail.time_s != 0)
+        self_test_result_print(p_cli, "last fail", &p_health->last_fail);
+}
+
+static void cmd_selftest_run(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    if (nrf_cli_help_requested(p_cli) || argc > 1)
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    self_test_request();
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "self test: runs once the capture is idle\r\n");
+}
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_sub_selftest)
+{
+    NRF_CLI_CMD(run, NULL, "'selftest run' runs the sensor self test at the next idle, worn or not", cmd_selftest_run),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+NRF_CLI_CMD_REGISTER(selftest, &m_sub_selftest, "'selftest' prints the sensor self test counts and the last results", cmd_selftest);
+
+static void cmd_ram(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    stack_watch_ram_t ram;
+    stack_watch_ctx_t const *p_ctx;
+
+    if (nrf_cli_help_requested(p_cli) || argc > 1)
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    stack_watch_ram_get(&ram);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "ram: %u bytes, %u data and bss, %u heap, %u stack\r\n",
+                    ram.total, ram.data_bss, ram.heap, ram.stack);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "main stack: %u of %u bytes used at most, %u spare\r\n",
+                    ram.stack_used, ram.stack, ram.stack - ram.stack_used);
+    for (p_ctx = stack_watch_first(); p_ctx != NULL; p_ctx = p_ctx->p_next)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "  %-12s %5u bytes at most over %u entries\r\n",
+                        p_ctx->name, p_ctx->max_bytes, p_ctx->count);
+    }
+    //the idle task takes the id after the last of the created tasks
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "tasks: cli %u, idle %u of %u bytes used at most\r\n",
+                    task_stack_max_usage_get(p_cli->p_ctx->task_id),
+                    task_stack_max_usage_get(TASK_MANAGER_CONFIG_MAX_TASKS), TASK_MANAGER_CONFIG_STACK_SIZE);
+}
+
+NRF_CLI_CMD_REGISTER(ram, NULL, "'ram' prints the RAM by section and the high-water marks of the stacks", cmd_ram);
+
+static void bus_device_print(nrf_cli_t const * p_cli, char const *name, nrf_drv_spi_t const *spi, uint8_t cs_pin)
+{
+    uint32_t xfers;
+    uint32_t bytes;
+
+    if (spi_device_counts(spi, cs_pin, &xfers, &bytes) == 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "  %-6s %9u transactions, %10u bytes\r\n", name, xfers, bytes);
+    }
+}
+
+static void cmd_bus(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    bus_stats_snapshot_t snapshot;
+    uint32_t scheduled;
+    uint32_t performed;
+
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if (argc > 1)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s %s: command not found\r\n", argv[0], argv[1]);
+        return;
+    }
+
+    bus_stats_snapshot(&snapshot);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%u ms since the reset\r\n", (uint32_t) (snapshot.window_us / 1000));
+    for (int i = 0; i < BUS_STATS_COUNT; ++i)
+    {
+        uint32_t permille = (snapshot.window_us == 0) ? 0
+                          : (uint32_t) ((snapshot.busy_us[i] * 1000) / snapshot.window_us);
+
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%-12s %3u.%u%% busy, %u ms\r\n",
+                        bus_stats_name((bus_stats_bus_t) i), permille/10, permille%10,
+                        (uint32_t) (snapshot.busy_us[i] / 1000));
+    }
+    //the device counts run from the boot, the busy time from the reset
+    bus_device_print(p_cli, "accel", &accel_spi, accel_spi_config.ss_pin);
+    bus_device_print(p_cli, "flash", &accel_spi, flash_spi_config.ss_pin);
+    bus_device_print(p_cli, "gyro", &gyro_spi, gyro_spi_config.ss_pin);
+    twi_xfer_counts(&scheduled, &performed);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "  twi    %9u scheduled, %u blocking, %u timed out\r\n", scheduled, performed,
+                    twi_timeout_count());
+}
+
+static void cmd_bus_reset(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    bus_stats_reset();
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "bus: window restarted\r\n");
+}
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_sub_bus)
+{
+    NRF_CLI_CMD(reset, NULL, "'bus reset' starts a new window of busy time", cmd_bus_reset),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+NRF_CLI_CMD_REGISTER(bus, &m_sub_bus, "'bus' prints the busy time of the spi and i2c buses and the transactions per device", cmd_bus);
+
+static void exposure_set_print(nrf_cli_t const * p_cli, char const *name, exposure_set_t const *p_set)
+{
+    uint32_t mean = (p_set->events == 0) ? 0 : p_set->peak_sum_g_x10/p_set->events;
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%s: %u events, mean %u.%u g, max %u.%u g, %u rad/s^2, HIC15 %u\r\n",
+                    name, p_set->events, mean/10, mean%10, p_set->max_peak_g_x10/10, p_set->max_peak_g_x10%10,
+                    p_set->max_alpha, p_set->max_hic15);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "  over %u g: %u, over %u rad/s^2: %u, over HIC15 %u: %u\r\n",
+                    EXPOSURE_STATS_LINEAR_LIMIT_G_X10/10, p_set->over_linear,
+                    EXPOSURE_STATS_ROT_LIMIT_RAD_S2, p_set->over_rotational,
+                    EXPOSURE_STATS_HIC15_LIMIT, p_set->over_hic15);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "  g per %u:", EXPOSURE_STATS_LINEAR_BIN_G);
+    for (int i = 0; i < EXPOSURE_STATS_LINEAR_BINS; ++i)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, " %u", p_set->linear[i]);
+    }
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "\r\n  rad/s^2 per %u:", EXPOSURE_STATS_ROT_BIN_RAD_S2);
+    for (int i = 0; i < EXPOSURE_STATS_ROT_BINS; ++i)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, " %u", p_set->rotational[i]);
+    }
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "\r\n");
+}
+
+static void cmd_exposure(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    exposure_stats_t const *p_stats = exposure_stats_get();
+
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if (argc > 1)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s %s: command not found\r\n", argv[0], argv[1]);
+        return;
+    }
+
+    exposure_set_print(p_cli, "session", &p_stats->session);
+    exposure_set_print(p_cli, "lifetime", &p_stats->lifetime);
+}
+
+static void cmd_exposure_session(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    exposure_stats_session_reset();
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "exposure: session started\r\n");
+}
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_sub_exposure)
+{
+    NRF_CLI_CMD(session, NULL, "'exposure session' clears the session set, like BLE_IOS_CMD_SESSION", cmd_exposure_session),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+NRF_CLI_CMD_REGISTER(exposure, &m_sub_exposure, "'exposure' prints the impact exposure of the session and the lifetime", cmd_exposure);
+
+static void cmd_latency(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    latency_budget_stats_t const *p_stats = latency_budget_get();
+
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if (argc > 1)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s %s: command not found\r\n", argv[0], argv[1]);
+        return;
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "alerts: %u timed, %u sent, %u past the %u ms budget\r\n",
+                    p_stats->events, p_stats->sent, p_stats->over_budget, p_stats->budget_ms);
+    for (int i = 0; i < LATENCY_BUDGET_STAGES; ++i)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%s: %u us last, %u us max, ms bins:",
+                        latency_budget_stage_name((latency_budget_stage_t) i), p_stats->last_us[i], p_stats->max_us[i]);
+        for (int j = 0; j < LATENCY_BUDGET_BINS; ++j)
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, " %u", p_stats->hist[i][j]);
+        }
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "\r\n");
+    }
+}
+
+static void cmd_latency_budget(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    uint32_t budget_ms;
+    char *p_end;
+
+    if (nrf_cli_help_requested(p_cli) || argc != 2)
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    budget_ms = strtoul(argv[1], &p_end, 10);
+    if (*p_end != '\0' || budget_ms == 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s: not a budget in ms\r\n", argv[1]);
+        return;
+    }
+
+    latency_budget_budget_set(budget_ms);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "latency: %u ms budget\r\n", budget_ms);
+}
+
+static void cmd_latency_reset(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    latency_budget_reset();
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "latency: cleared\r\n");
+}
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_sub_latency)
+{
+    NRF_CLI_CMD(budget, NULL, "'latency budget <ms>' sets the trigger to alert time past which an alert is warned of, until the next boot", cmd_latency_budget),
+    NRF_CLI_CMD(reset,  NULL, "'latency reset' clears the stage times and the counts", cmd_latency_reset),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+NRF_CLI_CMD_REGISTER(latency, &m_sub_latency, "'latency' prints the time of each stage from a trigger to its alert on air", cmd_latency);
+
+static void cmd_rtc(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    if ((argc == 1) || nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s %s: command not found\r\n", argv[0], argv[1]);
+}
+
+static void cmd_rtc_get(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    ds1388_data_t date;
+    mono_time_status_t status;
+    uint64_t mono_us, wall_us;
+
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    (void) ds1388_get_time(&date);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "rtc: 20%02u-%02u-%02u %02u:%02u:%02u.%02u UTC, epoch %u\r\n",
+                    date.year, date.month, date.date, date.hour, date.minute, date.second,
+                    date.hundreth, ds1388_to_epoch(&date));
+
+    mono_time_get_status(&status);
+    mono_us = mono_time_us();
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "mono: %u.%06u s%s\r\n", (uint32_t) (mono_us / 1000000),
+                    (uint32_t) (mono_us % 1000000), status.refined ? ", refined by the timebase" : "");
+    if (mono_time_wall_us(mono_us, &wall_us) < 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "mono: no anchor yet\r\n");
+        return;
+    }
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "mono: epoch %u.%06u, anchored %u s ago of every %u s, rate %d ppb\r\n",
+                    (uint32_t) (wall_us / 1000000), (uint32_t) (wall_us % 1000000), status.anchor_age_s,
+                    status.anchor_period_s, status.rate_ppb);
+}
+
+static void cmd_rtc_set(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    ds1388_data_t date;
+    uint32_t epoch;
+    char *p_end;
+
+    if (nrf_cli_help_requested(p_cli) || argc != 2)
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    epoch = strtoul(argv[1], &p_end, 10);
+    if (p_end == argv[1] || (*p_end != '\0' && *p_end != '.')
+        || epoch < RTC_EPOCH_MIN || epoch > RTC_EPOCH_MAX)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s: not an epoch between 2000 and 2099\r\n", argv[1]);
+        return;
+    }
+    ds1388_from_epoch(epoch, &date);
+    //the first two digits of the fraction are the hundredths, the rest is truncated
+    if (*p_end == '.' && p_end[1] >= '0' && p_end[1] <= '9')
+    {
+        date.hundreth = (p_end[1] - '0') * 10;
+        if (p_end[2] >= '0' && p_end[2] <= '9')
+            date.hundreth += p_end[2] - '0';
+    }
+
+    if (ds1388_set_time(&date) < 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "rtc: write failed\r\n");
+        return;
+    }
+    //the main loop anchors again, the fit starts over from there
+    mono_time_anchor_reset();
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "rtc: set to 20%02u-%02u-%02u %02u:%02u:%02u.%02u UTC\r\n",
+                    date.year, date.month, date.date, date.hour, date.minute, date.second, date.hundreth);
+}
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_sub_rtc)
+{
+    NRF_CLI_CMD(get, NULL, "'rtc get' prints the time of the ds1388", cmd_rtc_get),
+    NRF_CLI_CMD(set, NULL, "'rtc set <epoch>[.fraction]' sets the ds1388 to seconds since 1970-01-01 UTC", cmd_rtc_set),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+NRF_CLI_CMD_REGISTER(rtc, &m_sub_rtc, "Commands for the ds1388 real time clock", cmd_rtc);
+
+#if ENERGY_PROFILER_ENABLED
+static void cmd_energy(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    energy_snapshot_t snapshot;
+    uint32_t average_ua;
+    uint32_t seconds;
+
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if (argc > 1)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s %s: command not found\r\n", argv[0], argv[1]);
+        return;
+    }
+
+    energy_profiler_snapshot(&snapshot);
+    seconds = (uint32_t) (snapshot.total_ticks / ENERGY_TICK_HZ);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%u s since the reset\r\n", seconds);
+    for (int i = 0; i < ENERGY_STATE_COUNT; ++i)
+    {
+        uint32_t permille = (snapshot.total_ticks == 0) ? 0
+                          : (uint32_t) ((snapshot.ticks[i] * 1000) / snapshot.total_ticks);
+
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%-8s %3u.%u%% at %5u uA, %5u uA average\r\n",
+                        energy_profiler_state_name((energy_state_t) i), permille/10, permille%10,
+                        snapshot.current_ua[i], energy_profiler_state_ua(&snapshot, (energy_state_t) i));
+    }
+    //mAh per day is the average uA times 24 h over 1000
+    average_ua = energy_profiler_average_ua(&snapshot);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "average: %u uA, %u.%03u mAh/day\r\n",
+                    average_ua, (average_ua*24)/1000, (average_ua*24)%1000);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "hfxo: %u starts, %s\r\n", hf_clock_starts(),
+                    hf_clock_running() ? "running" : "stopped");
+}
+
+static void cmd_energy_reset(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    energy_profiler_reset();
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "energy: times cleared\r\n");
+}
+
+static void cmd_energy_current(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    uint32_t current_ua;
+    char *p_end;
+    int i;
+
+    if (nrf_cli_help_requested(p_cli) || argc != 3)
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    for (i = 0; i < ENERGY_STATE_COUNT; ++i)
+    {
+        if (strcmp(argv[1], energy_profiler_state_name((energy_state_t) i)) == 0)
+            break;
+    }
+    current_ua = strtoul(argv[2], &p_end, 10);
+    if (i == ENERGY_STATE_COUNT || p_end == argv[2] || *p_end != '\0')
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s %s: not a state and a current in uA\r\n", argv[1], argv[2]);
+        return;
+    }
+
+    (void) energy_profiler_current_set((energy_state_t) i, current_ua);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "energy: %s at %u uA\r\n", argv[1], current_ua);
+}
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_sub_energy)
+{
+    NRF_CLI_CMD(current, NULL, "'energy current <sleep|cpu|sampling|program|erase|radio|hfxo> <uA>' sets the current of a power state, e.g. measured on a board", cmd_energy_current),
+    NRF_CLI_CMD(reset,   NULL, "'energy reset' clears the time in each power state", cmd_energy_reset),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+NRF_CLI_CMD_REGISTER(energy, &m_sub_energy, "'energy' prints the time in each power state, the average current and mAh per day", cmd_energy);
+#endif
+
+#if CPU_LOAD_ENABLED
+static void cpu_load_print(nrf_cli_t const * p_cli, char const *name, cpu_load_t const *p_load)
+{
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "  %-12s %3u.%u%% last, %3u.%u%% average, %3u.%u%% peak\r\n", name,
+                    p_load->last/10, p_load->last%10, p_load->average/10, p_load->average%10,
+                    p_load->peak/10, p_load->peak%10);
+}
+
+static void cmd_cpu(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    cpu_load_src_t const *p_src;
+    cpu_load_t total;
+    cpu_load_t load;
+    cpu_load_t other;
+
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if (argc > 1)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s %s: command not found\r\n", argv[0], argv[1]);
+        return;
+    }
+
+    cpu_load_get(&total);
+    if (total.windows == 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "cpu: no %u ms window closed yet\r\n", CPU_LOAD_WINDOW_MS);
+        return;
+    }
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "cpu: over %u windows of %u ms, %u.%u%% headroom at the peak\r\n",
+                    total.windows, CPU_LOAD_WINDOW_MS, (1000 - total.peak)/10, (1000 - total.peak)%10);
+    cpu_load_print(p_cli, "busy", &total);
+    //the sources overlap where an interrupt preempted a stage, the rest is a rough figure
+    other = total;
+    for (p_src = cpu_load_first(); p_src != NULL; p_src = p_src->p_next)
+    {
+        cpu_load_src_get(p_src, &load);
+        cpu_load_print(p_cli, p_src->name, &load);
+        other.last = (other.last > load.last) ? other.last - load.last : 0;
+        other.average = (other.average > load.average) ? other.average - load.average : 0;
+    }
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "  %-12s %3u.%u%% last, %3u.%u%% average\r\n", "other",
+                    other.last/10, other.last%10, other.average/10, other.average%10);
+}
+
+static void cmd_cpu_reset(nrf_cli_t const * p_cli, size_t argc, char **argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    cpu_load_reset();
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "cpu: windows cleared\r\n");
+}
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_sub_cpu)
+{
+    NRF_CLI_CMD(reset, NULL, "'cpu reset' clears the load windows and the counts of every source", cmd_cpu_reset),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+NRF_CLI_CMD_REGISTER(cpu, &m_sub_cpu, "'cpu' prints the cpu load of the last second, its 10 s average and peak, per interrupt and idle loop stage", cmd_cpu);
+#endif
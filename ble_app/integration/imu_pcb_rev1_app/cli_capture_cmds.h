@@ -0,0 +1,17 @@
+#ifndef CLI_CAPTURE_CMDS_H
+#define CLI_CAPTURE_CMDS_H
+
+#include "event_store.h"
+#include "pipeline_stats.h"
+#include "time_sync.h"
+
+/* CLI access to the running capture pipeline: the capture commands. They only
+ * read counters kept in ram, the flash and the sensors stay with the capture,
+ * but for the query that reads the event headers between the thread's flash holds
+ * and the replay that reads a stored event back into the capture.
+ * The profile commands list and switch the sampling profile.
+ * The rtc commands read and set the ds1388 over the shared i2c bus, the
+ * energy commands print and tune the energy_profiler estimate */
+void cli_capture_init(pipeline_stats_t const *stats, event_store_t *store, time_sync_t *time_sync);
+
+#endif //CLI_CAPTURE_CMDS_H
@@ -0,0 +1,148 @@
+//-------------------------------------------
+// Title: known_gateway.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: The address of the gateway the helmet reconnects to with
+// directed advertising, see known_gateway.h, kept in an FDS record that is
+// only written when another gateway takes over.
+//-------------------------------------------
+#include <stddef.h>
+#include <string.h>
+#include "fds.h"
+#include "app_util.h"
+
+#include "known_gateway.h"
+
+#define KNOWN_GATEWAY_RECORD_WORDS  BYTES_TO_WORDS(sizeof(known_gateway_record_t))
+
+static known_gateway_record_t m_gateway = {
+    .version = KNOWN_GATEWAY_VERSION,
+    .size = sizeof(known_gateway_record_t),
+};
+static bool m_known = false;
+static uint32_t m_saved[KNOWN_GATEWAY_RECORD_WORDS];    //FDS reads the data until the write completes
+static volatile bool m_fds_ready = false;
+static volatile bool m_save_retry = false;              //the write is redone once the garbage collection is done
+
+static ret_code_t known_gateway_write(void);
+
+static void fds_evt_handler(fds_evt_t const * p_evt)
+{
+    switch (p_evt->id)
+    {
+        case FDS_EVT_INIT:
+            m_fds_ready = (p_evt->result == FDS_SUCCESS);
+            break;
+
+        case FDS_EVT_GC:
+            if (m_save_retry)
+            {
+                m_save_retry = false;
+                (void) known_gateway_write();
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Writes m_saved over the gateway record, or a new one if there is none,
+// returns FDS_SUCCESS if the write or the garbage collection before it is queued
+static ret_code_t known_gateway_write(void)
+{
+    fds_record_t const record = {
+        .file_id = KNOWN_GATEWAY_FILE_ID,
+        .key = KNOWN_GATEWAY_RECORD_KEY,
+        .data = {.p_data = m_saved, .length_words = KNOWN_GATEWAY_RECORD_WORDS},
+    };
+    fds_record_desc_t desc;
+    fds_find_token_t token;
+    ret_code_t err_code;
+
+    memset(&token, 0, sizeof(token));
+    if (fds_record_find(KNOWN_GATEWAY_FILE_ID, KNOWN_GATEWAY_RECORD_KEY, &desc, &token) == FDS_SUCCESS)
+        err_code = fds_record_update(&desc, &record);
+    else
+        err_code = fds_record_write(NULL, &record);
+    if (err_code == FDS_ERR_NO_SPACE_IN_FLASH && !m_save_retry)
+    {
+        err_code = fds_gc();
+        m_save_retry = (err_code == FDS_SUCCESS);
+    }
+
+    return err_code;
+}
+
+/*
+ * Registers with FDS, before device_config_init() mounts it
+ * @return 0 if success, -1 if FDS is out of users
+ */
+int8_t known_gateway_init(void)
+{
+    return (fds_register(fds_evt_handler) == FDS_SUCCESS) ? 0 : -1;
+}
+
+/*
+ * Reads the gateway record, after device_config_init(). A record of another
+ * version is dropped, the helmet then waits for a gateway to ack again
+ * @return 0 if success or there is no record, -1 if FDS is not mounted
+ */
+int8_t known_gateway_load(void)
+{
+    fds_flash_record_t flash_record;
+    fds_record_desc_t desc;
+    fds_find_token_t token;
+    known_gateway_record_t const *p_stored;
+    uint32_t size;
+
+    if (!m_fds_ready)
+        return -1;
+
+    memset(&token, 0, sizeof(token));
+    if (fds_record_find(KNOWN_GATEWAY_FILE_ID, KNOWN_GATEWAY_RECORD_KEY, &desc, &token) != FDS_SUCCESS)
+        return 0;
+    if (fds_record_open(&desc, &flash_record) != FDS_SUCCESS)
+        return 0;
+    p_stored = (known_gateway_record_t const *) flash_record.p_data;
+    size = flash_record.p_header->length_words*sizeof(uint32_t);
+    if (size >= sizeof(known_gateway_record_t) && p_stored->version == KNOWN_GATEWAY_VERSION)
+    {
+        m_gateway.addr = p_stored->addr;
+        m_known = true;
+    }
+    (void) fds_record_close(&desc);
+
+    return 0;
+}
+
+/*
+ * Remembers the central that acked events as the gateway, thread context.
+ * The same gateway again writes nothing
+ * @return 0 if success or unchanged, -1 if the write could not be queued
+ */
+int8_t known_gateway_set(ble_gap_addr_t const *p_addr)
+{
+    if (m_known && m_gateway.addr.addr_type == p_addr->addr_type
+        && memcmp(m_gateway.addr.addr, p_addr->addr, BLE_GAP_ADDR_LEN) == 0)
+        return 0;
+
+    m_gateway.addr = *p_addr;
+    m_known = true;
+    if (!m_fds_ready)
+        return -1;
+    memset(m_saved, 0, sizeof(m_saved));
+    memcpy(m_saved, &m_gateway, sizeof(m_gateway));
+
+    return (known_gateway_write() == FDS_SUCCESS) ? 0 : -1;
+}
+
+/*
+ * @param p_addr - the gateway's address, untouched if there is none
+ * @return true if a gateway has acked events on this helmet
+ */
+bool known_gateway_get(ble_gap_addr_t *p_addr)
+{
+    if (m_known)
+        *p_addr = m_gateway.addr;
+    return m_known;
+}
@@ -0,0 +1,34 @@
+#ifndef KNOWN_GATEWAY_H
+#define KNOWN_GATEWAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ble_gap.h"
+
+/* The gateway imu_pcb_rev1_app reconnects to fast. The links are not paired,
+ * the helmet remembers the address of the last central that acked its events
+ * instead, in one FDS record registered before device_config_init() like
+ * exposure_stats. An impact stored while no central is connected is then
+ * advertised to that address alone with high duty directed advertising for
+ * KNOWN_GATEWAY_DIRECTED_MS, which a scanning gateway connects to in a few
+ * ms, before the undirected advertising of the summary resumes */
+#define KNOWN_GATEWAY_FILE_ID       0x4B47  //FDS file of the gateway record
+#define KNOWN_GATEWAY_RECORD_KEY    0x0001
+#define KNOWN_GATEWAY_VERSION       1
+#define KNOWN_GATEWAY_DIRECTED_MS   1280    //BLE_GAP_ADV_TIMEOUT_HIGH_DUTY_MAX, the longest the spec allows
+
+typedef struct {
+    uint16_t version;               //KNOWN_GATEWAY_VERSION
+    uint16_t size;                  //bytes of the struct
+    ble_gap_addr_t addr;
+} known_gateway_record_t;
+
+int8_t known_gateway_init(void);
+
+int8_t known_gateway_load(void);
+
+int8_t known_gateway_set(ble_gap_addr_t const *p_addr);
+
+bool known_gateway_get(ble_gap_addr_t *p_addr);
+
+#endif //KNOWN_GATEWAY_H
@@ -0,0 +1,2708 @@
+/**
+ * Copyright (c) 2015 - 2018, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * @brief PCB Revision 1 production firmware.
+ *
+ * Interrupt driven impact capture (capture.c), the flash event store, the Impact
+ * Offload Service and the uart cli in one image. The execution model:
+ *
+ * - Priority 0, 1 and 4: the SoftDevice, the radio preempts everything below.
+ * - Priority 2 (SPI_IRQ_PRIORITY, TWI_IRQ_PRIORITY, GPIOTE): the capture. The fifo watermark
+ *   queues the spi reads and each burst is filtered and run through the trigger in the spi
+ *   interrupt. Nothing here waits or logs, a burst has to finish well within the ~11 ms the
+ *   fifo takes from the watermark to full.
+ * - Priority 6 (APP_IRQ_PRIORITY_LOW): SoftDevice event dispatch, app_timer, uart, the
+ *   SAADC of the battery monitor and the radio notification of the energy profiler. Short
+ *   handlers that only post to the app_scheduler queue or set flags.
+ * - Thread, idle task: app_scheduler events (metrics, commit and erase steps), the offload, the
+ *   live stream, the activity log and its read, the RTC set and the sampling profile from the offload control point and the log. Every flash access is one capture_flash_acquire() hold of at most
+ *   CAPTURE_FLASH_HOLD_MAX_MS, the fifo reads queue between its spi transactions. The flash is put in deep
+ *   power-down once the erase steps run out of work with no commit, offload or activity read left.
+ *   The erase and commit steps go between the radio events (radio_window.h), a step that would run
+ *   into one is posted again as it ends.
+ * - Thread, cli task: the uart cli, preempted by the idle task only at task_yield(). The rtc
+ *   commands wait on the i2c bus like the RTC set.
+ *
+ * Built with make PROFILER=1 'capture stats' prints the worst case of each stage
+ * (capture watermark to burst done, capture close to thread, capture flash hold, commit
+ * step, erase step, offload step), take them with a central offloading over BLE.
+ * Built with make ENERGY=1, the default, 'energy' prints the time in each power state and the
+ * average current and mAh per day they come to.
+ * Built with make WATCHDOG=1, the default, the WDT is only fed while the capture bursts, a commit
+ * steps and the radio loop sends, see watchdog.h. A hung i2c transaction is abandoned by
+ * twi_supervise instead. After a watchdog reset the event store mounts from where it stood.
+ * Built with make CRASH_LOG=1, the default, a HardFault or a fatal error writes a crash record to the
+ * top of the flash before the reset, see crash_log.h, tools/crash_decode prints them from a flash image.
+ * Built with make FW_UPDATE=1 on a chip with the secure bootloader, a central stages a new image in bank 1 over
+ * the update characteristic while the capture goes on, see fw_stage.h, and the swap waits for the helmet to be idle.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "nordic_common.h"
+#include "nrf.h"
+#include "app_error.h"
+#include "ble.h"
+#include "ble_err.h"
+#include "ble_hci.h"
+#include "ble_srv_common.h"
+#include "ble_advdata.h"
+#include "ble_conn_params.h"
+#include "nrf_sdh.h"
+#include "nrf_sdh_ble.h"
+#include "boards.h"
+#include "app_timer.h"
+#include "app_scheduler.h"
+#include "ble_ios.h"
+#include "nrf_ble_gatt.h"
+#include "nrf_ble_qwr.h"
+#include "nrf_pwr_mgmt.h"
+#include "nrf_cli.h"
+#include "nrf_cli_uart.h"
+#include "task_manager.h"
+#include "nrf_queue.h"
+
+#include "nrf_log.h"
+#include "nrf_log_ctrl.h"
+#include "nrf_log_default_backends.h"
+
+#include "mt25ql256aba.h"
+#include "twi_driver.h"
+#include "ds1388.h"
+#include "event_store.h"
+#include "time_sync.h"
+#include "mono_time.h"
+#include "hf_clock.h"
+#include "impact_record.h"
+#include "impact_codec.h"
+#include "impact_metrics.h"
+#include "impact_location.h"
+#include "pipeline_stats.h"
+#include "capture.h"
+#include "capture_core.h"
+#include "sampling_profile.h"
+#include "device_config.h"
+#include "live_stream.h"
+#include "activity_log.h"
+#include "vcnl4040.h"
+#include "cli_capture_cmds.h"
+#include "profiler.h"
+#include "stack_watch.h"
+#include "boot_check.h"
+#include "watchdog.h"
+#include "crash_log.h"
+#include "battery_monitor.h"
+#include "energy_profiler.h"
+#include "cpu_load.h"
+#include "bus_stats.h"
+#include "exposure_stats.h"
+#include "latency_budget.h"
+#include "self_test.h"
+#include "known_gateway.h"
+#include "event_crypt.h"
+#include "adxl372.h"
+#include "icm20649.h"
+#include "ble_radio_notification.h"
+#include "radio_window.h"
+#include "nrf_pt.h"
+#if ESB_OFFLOAD_ENABLED
+#include "esb_offload.h"
+#endif
+#include "summary_relay.h"
+#if FW_STAGE_ENABLED
+#include "fw_stage.h"
+#endif
+#if NFC_SUMMARY_ENABLED
+#include "nfc_summary.h"
+#if SPI_ACCEL_MOSI_PIN == 9 || SPI_ACCEL_MOSI_PIN == 10 || SPI_ACCEL_MISO_PIN == 9 || SPI_ACCEL_MISO_PIN == 10
+#error "The accel spi of this board is on the NFC antenna pins P0.09 and P0.10"
+#endif
+#endif
+#if TRIGGER_STAMP_ENABLED
+#include "timebase.h"
+#endif
+
+
+#define DEVICE_NAME                     "nRF52832-MDK"                          /**< Name of device. Will be included in the advertising data. */
+#define APP_ADV_SHORT_NAME_LEN          6                                       /**< Of the name while a relayed hit fills the advertising data. */
+
+#define APP_BLE_OBSERVER_PRIO           3                                       /**< Application's BLE observer priority. You shouldn't need to modify this value. */
+#define APP_BLE_CONN_CFG_TAG            1                                       /**< A tag identifying the SoftDevice BLE configuration. */
+
+#define APP_ADV_INTERVAL                64                                      /**< The advertising interval of the fast bursts (in units of 0.625 ms; this value corresponds to 40 ms). */
+#define APP_ADV_UNSYNCED_INTERVAL       MSEC_TO_UNITS(250, UNIT_0_625_MS)       /**< Between the bursts while events wait for the gateway (250 ms). */
+#define APP_ADV_SLOW_INTERVAL           MSEC_TO_UNITS(1000, UNIT_0_625_MS)      /**< Synced and worn (1 s), inside the gateway's HELMET_STALE_S. */
+#define ADV_FAST_BURST_S                30                                      /**< Fast advertising after the boot and after an impact is stored. */
+#define ADV_OFF_HEAD_S                  60                                      /**< Synced and off the head this long, the advertising stops. */
+#define PROX_FAST_HOLD_S                10                                      /**< The proximity sensor reads fast this long after the start and after the head goes on or off. */
+#define APP_ADV_DURATION                BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED   /**< The advertising time-out (in units of seconds). When set to 0, we will never time out. */
+
+
+#define OFFLOAD_MIN_CONN_INTERVAL       MSEC_TO_UNITS(7.5, UNIT_1_25_MS)        /**< Minimum connection interval while offloading (7.5 ms), short so an offload gets many connection events. */
+#define OFFLOAD_MAX_CONN_INTERVAL       MSEC_TO_UNITS(15, UNIT_1_25_MS)         /**< Maximum connection interval while offloading (15 ms). */
+#define OFFLOAD_SLAVE_LATENCY           0                                       /**< Slave latency while offloading. */
+#define IDLE_MIN_CONN_INTERVAL          MSEC_TO_UNITS(100, UNIT_1_25_MS)        /**< Minimum connection interval between offloads (100 ms). */
+#define IDLE_MAX_CONN_INTERVAL          MSEC_TO_UNITS(200, UNIT_1_25_MS)        /**< Maximum connection interval between offloads (200 ms). */
+#define IDLE_SLAVE_LATENCY              4                                       /**< Slave latency between offloads, the radio wakes about once a second while an alert can still go out on any event. */
+#define CONN_SUP_TIMEOUT                MSEC_TO_UNITS(6000, UNIT_10_MS)         /**< Connection supervisory time-out (6 seconds), above twice the idle interval times the latency. */
+
+#define FIRST_CONN_PARAMS_UPDATE_DELAY  APP_TIMER_TICKS(1000)                   /**< Time from initiating event (connect or start of notification) to first time sd_ble_gap_conn_param_update is called (1 second), the central usually opens with a slow interval. */
+#define NEXT_CONN_PARAMS_UPDATE_DELAY   APP_TIMER_TICKS(5000)                   /**< Time between each call to sd_ble_gap_conn_param_update after the first call (5 seconds). */
+#define MAX_CONN_PARAMS_UPDATE_COUNT    3                                       /**< Number of attempts before giving up the connection parameter negotiation. */
+
+#define SCHED_MAX_EVENT_DATA_SIZE       sizeof(capture_buf_t *)                 /**< Closed captures are queued by pointer. */
+#define SCHED_QUEUE_SIZE                10                                      /**< Closed captures, commit and erase steps, app timer events and the steps posted as a radio event ends. */
+
+#define ERASE_POLL_MS                   50                                      /**< Period of the background erase steps while there is space to erase. */
+#define ERASE_STEP_HOLD_US              1500                                    /**< Longest flash hold of an erase step, a status poll and a sector erase or an activity log page. */
+#define COMMIT_STEP_HOLD_US             1000                                    /**< Longest flash hold of a commit step, a status poll and one page program. */
+#define RADIO_RETRY_MS                  3                                       /**< Retry of a step held back for a radio event that does not end, past RADIO_WINDOW_LATE_US. */
+#define RETAIN_PIN_PEAK_G_X10           800                                     /**< Events at or above 80 g are kept until offloaded, with the flash full the ring reclaims the unsent ones below. */
+#define COMMIT_POLL_TICKS               APP_TIMER_MIN_TIMEOUT_TICKS             /**< Wait before polling a page program of a commit again, about 150 us against the 120 us typical tPP. */
+#define COMMIT_STREAM_POLL_MS           10                                      /**< Wait of a streamed commit for the next blocks of its capture, well inside CAPTURE_STREAM_BACKLOG_MS. */
+#define EXPOSURE_SAVE_MS                600000                                  /**< Period of the lifetime exposure save (10 minutes), only a changed record is written. */
+#define RTC_ANCHOR_READS                64                                      /**< Reads of the RTC waiting for its hundredths to turn over, 10 ms is about 35 of them. */
+#define COMMIT_STALL_MS                 3000                                    /**< Longest between two steps of a commit before the watchdog resets, an inline erase of a few subsectors included. */
+#define RADIO_STALL_MS                  2000                                    /**< Longest between two passes of the radio loop while it has something to send. */
+
+#define DEAD_BEEF                       0xDEADBEEF                              /**< Value used as error code on stack dump, can be used to identify stack location on stack unwind. */
+
+// The metrics fill the preview of the event header point for point.
+STATIC_ASSERT(IMPACT_METRICS_PREVIEW_POINTS == EVENT_STORE_PREVIEW_POINTS);
+
+
+BLE_IOS_DEF(m_ios);                                                             /**< Impact Offload Service instance. */
+TIME_SYNC_DEF(m_time_sync);                                                     /**< Offset and drift against the sideline gateway. */
+NRF_BLE_GATT_DEF(m_gatt);                                                       /**< GATT module instance. */
+NRF_BLE_QWR_DEF(m_qwr);                                                         /**< Context for the Queued Write module.*/
+APP_TIMER_DEF(m_erase_timer_id);                                                /**< Paces the background erase of offloaded events. */
+APP_TIMER_DEF(m_commit_timer_id);                                               /**< Polls the page program a commit step waits for. */
+APP_TIMER_DEF(m_exposure_timer_id);                                             /**< Paces the saves of the lifetime exposure. */
+NRF_CLI_UART_DEF(cli_uart, 0, 256, 16);                                         /**< The cli shares the uart pins with the log. */
+NRF_CLI_DEF(m_cli_uart, "imu_cli:~$ ", &cli_uart.transport, '\r', 4);
+NRF_QUEUE_DEF(capture_buf_t *, m_commit_queue, CAPTURE_BUF_COUNT, NRF_QUEUE_MODE_NO_OVERFLOW); /**< Captures closed while another one is stored. */
+
+/**@brief Progress of storing one closed capture, one flash page per scheduler event. */
+typedef enum
+{
+    COMMIT_IDLE,
+    COMMIT_BEGIN,
+    COMMIT_WRITING,
+    COMMIT_DROPPING                                                             /**< A streamed event failed, its capture records on until it closes. */
+} commit_state_t;
+
+typedef struct
+{
+    commit_state_t state;
+    capture_buf_t * p_buf;                                                      /**< Capture being stored. */
+    uint32_t start_ticks;
+    bool synced;                                                                /**< time is the gateway reference at the trigger rather than the rtc. */
+    event_store_time_t time;
+    event_store_summary_t summary;
+    impact_metrics_t metrics;
+    uint16_t encoding;                                                          /**< IMPACT_CODEC_ENCODING or raw records, from the sampling profile. */
+    capture_core_encoder_t encoder;                                             /**< Chunk filled while the page before it programs. */
+    uint32_t polls;                                                             /**< Steps that found the flash still programming. */
+    uint64_t metrics_us;                                                        /**< mono_time_us() the metrics were ready, for the alert latency. */
+    int8_t error;                                                               /**< Of a dropped streamed event, reported once its capture closes. */
+} commit_t;
+
+/**@brief Read of the activity log a central asked for with BLE_IOS_CMD_ACTIVITY, one page frame at a time. */
+typedef struct
+{
+    bool active;
+    bool end_sent;                                                              /**< The frame being sent is the end frame. */
+    activity_log_cursor_t cursor;
+    uint32_t pages;                                                             /**< Page frames sent. */
+    uint16_t frame_len;                                                         /**< A frame being sent if non zero, the live stream waits for it. */
+    uint8_t frame[ACTIVITY_LOG_FRAME_SIZE];
+} activity_read_t;
+
+/**@brief Advertising intervals, from the impacts, the ack watermark and the proximity sensor. */
+enum
+{
+    ADV_MODE_FAST,                                                              /**< APP_ADV_INTERVAL, a burst after the boot or an impact. */
+    ADV_MODE_UNSYNCED,                                                          /**< APP_ADV_UNSYNCED_INTERVAL while events wait to be acked. */
+    ADV_MODE_SLOW,                                                              /**< APP_ADV_SLOW_INTERVAL, synced and worn. */
+    ADV_MODE_OFF                                                                /**< Synced and off the head for ADV_OFF_HEAD_S. */
+};
+
+static uint16_t m_conn_handle = BLE_CONN_HANDLE_INVALID;                        /**< Handle of the current connection. */
+static bool m_conn_fast = false;                                                /**< The offload connection parameters are requested, the idle ones otherwise. */
+static uint16_t m_conn_interval;                                                /**< Interval the connection runs at, in 1.25 ms units. */
+static ble_gap_addr_t m_peer_addr;                                              /**< Of the current or last central, the known gateway once it acks. */
+static event_store_t m_event_store;                                             /**< Impact events stored in the flash, read by the Impact Offload Service. */
+static event_store_cache_t m_event_store_cache;                                 /**< Index pages and headers of the event store, repeated queries and offloads skip the flash. */
+static event_crypt_t m_event_crypt;                                             /**< Key of the stored samples, from the device config. */
+static bool m_encrypt = false;                                                  /**< A key is set, the events are stored enciphered. */
+static pipeline_stats_t m_pipeline_stats;                                       /**< Capture and commit counters, served by the Impact Offload Service. */
+static commit_t m_commit;
+static activity_read_t m_activity_read;
+static pt_t m_sensors_pt;                                                       /**< Start of the i2c sensors, see sensors_start_thread. */
+static pt_t m_sensor_pt;                                                        /**< Configuration of the sensor being started. */
+static bool m_sensors_ready = false;                                            /**< The RTC and the proximity sensor are configured. */
+static uint32_t m_prox_transitions = UINT32_MAX;                                /**< vcnl4040_transitions() the fast reads last started at, none before the start. */
+static uint64_t m_prox_fast_end_us;                                             /**< mono_time_us() the fast reads end. */
+
+PROFILER_PROBE_DEF(m_commit_step_probe, "commit step");                         /**< Thread stages of the execution model, built with make PROFILER=1. */
+PROFILER_PROBE_DEF(m_erase_step_probe, "erase step");
+PROFILER_PROBE_DEF(m_offload_step_probe, "offload step");
+WATCHDOG_STAGE_DEF(m_commit_stage, "commit", COMMIT_STALL_MS);                 /**< Stages the watchdog is fed by, with the capture's, built with make WATCHDOG=1, the default. */
+WATCHDOG_STAGE_DEF(m_radio_stage, "radio", RADIO_STALL_MS);
+STACK_WATCH_DEF(m_ble_stack, "ble evt");                                        /**< The observers of a SoftDevice event, built with make STACK_WATCH=1. */
+CPU_LOAD_DEF(m_ble_load, "ble evt");                                            /**< The cpu load sources of the idle loop and the SoftDevice events, built with make CPU_LOAD=1, the default. */
+CPU_LOAD_DEF(m_sched_load, "scheduler");
+CPU_LOAD_DEF(m_offload_load, "offload");
+CPU_LOAD_DEF(m_stream_load, "stream");
+CPU_LOAD_DEF(m_activity_load, "activity");
+CPU_LOAD_DEF(m_log_load, "log");
+
+static uint8_t m_adv_handle = BLE_GAP_ADV_SET_HANDLE_NOT_SET;                   /**< Advertising handle used to identify an advertising set. */
+static uint8_t m_enc_advdata[2][BLE_GAP_ADV_SET_DATA_SIZE_MAX];                 /**< Buffers for storing an encoded advertising set, the SoftDevice keeps one while the other is updated. */
+static uint8_t m_enc_scan_response_data[2][BLE_GAP_ADV_SET_DATA_SIZE_MAX];      /**< Buffers for storing an encoded scan data. */
+static uint8_t m_adv_buf;                                                       /**< Index of the buffers the SoftDevice advertises from. */
+static ble_ios_adv_summary_t m_adv_summary;                                     /**< Impact summary in the advertising data. */
+static bool m_adv_directed = false;                                             /**< The set is configured for directed advertising to the known gateway. */
+static uint8_t m_adv_mode = ADV_MODE_FAST;                                      /**< Interval the set is configured with, see advertising_policy_process. */
+static volatile bool m_adv_burst_request = true;                                /**< An impact was stored, a burst of fast advertising follows. The boot starts with one. */
+#if ADV_POLICY_ENABLED
+static uint64_t m_adv_burst_end_us;                                             /**< mono_time_us() the burst ends. */
+static uint64_t m_worn_us;                                                      /**< mono_time_us() the head was last seen. */
+#endif
+static volatile bool m_adv_directed_request = false;                            /**< An impact was stored with no central connected. */
+static volatile bool m_adv_directed_end = false;                                /**< The directed advertising timed out or the gateway connected. */
+#if SUMMARY_RELAY_ENABLED
+static summary_relay_t m_relay;                                                 /**< Severe hits of the team forwarded in the advertising data. */
+static summary_relay_entry_t m_adv_relay;                                       /**< Hit after the summary in the advertising data. */
+#endif
+static bool m_adv_relaying = false;                                             /**< m_adv_relay is in the advertising data, never without SUMMARY_RELAY. */
+#if NFC_SUMMARY_ENABLED
+static nfc_summary_t m_nfc_summary;                                             /**< Status on the NFC tag. */
+static event_store_time_t m_severe_time;                                        /**< Of the last severe hit since the reset, s is 0 if none. */
+static uint16_t m_severe_peak_g_x10;
+#endif
+
+/**@brief Structs that contain pointers to the encoded advertising data. */
+static ble_gap_adv_data_t m_adv_data[2] =
+{
+    {
+        .adv_data      = {.p_data = m_enc_advdata[0],            .len = BLE_GAP_ADV_SET_DATA_SIZE_MAX},
+        .scan_rsp_data = {.p_data = m_enc_scan_response_data[0], .len = BLE_GAP_ADV_SET_DATA_SIZE_MAX},
+    },
+    {
+        .adv_data      = {.p_data = m_enc_advdata[1],            .len = BLE_GAP_ADV_SET_DATA_SIZE_MAX},
+        .scan_rsp_data = {.p_data = m_enc_scan_response_data[1], .len = BLE_GAP_ADV_SET_DATA_SIZE_MAX},
+    },
+};
+
+/**@brief Connection parameters while an offload runs. */
+static ble_gap_conn_params_t m_offload_conn_params =
+{
+    .min_conn_interval = OFFLOAD_MIN_CONN_INTERVAL,
+    .max_conn_interval = OFFLOAD_MAX_CONN_INTERVAL,
+    .slave_latency     = OFFLOAD_SLAVE_LATENCY,
+    .conn_sup_timeout  = CONN_SUP_TIMEOUT,
+};
+
+/**@brief Connection parameters between offloads, also the preferred ones the connection opens with. */
+static ble_gap_conn_params_t m_idle_conn_params =
+{
+    .min_conn_interval = IDLE_MIN_CONN_INTERVAL,
+    .max_conn_interval = IDLE_MAX_CONN_INTERVAL,
+    .slave_latency     = IDLE_SLAVE_LATENCY,
+    .conn_sup_timeout  = CONN_SUP_TIMEOUT,
+};
+
+
+/**@brief Function for assert macro callback.
+ *
+ * @details This function will be called in case of an assert in the SoftDevice.
+ *
+ * @warning This handler is an example only and does not fit a final product. You need to analyze
+ *          how your product is supposed to react in case of Assert.
+ * @warning On assert from the SoftDevice, the system can only recover on reset.
+ *
+ * @param[in] line_num    Line number of the failing ASSERT call.
+ * @param[in] p_file_name File name of the failing ASSERT call.
+ */
+void assert_nrf_callback(uint16_t line_num, const uint8_t * p_file_name)
+{
+    app_error_handler(DEAD_BEEF, line_num, p_file_name);
+}
+
+/**@brief Function for the GAP initialization.
+ *
+ * @details This function sets up all the necessary GAP (Generic Access Profile) parameters of the
+ *          device including the device name, appearance, and the preferred connection parameters.
+ */
+static void gap_params_init(void)
+{
+    ret_code_t              err_code;
+    ble_gap_conn_sec_mode_t sec_mode;
+
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&sec_mode);
+
+    err_code = sd_ble_gap_device_name_set(&sec_mode,
+                                          (const uint8_t *)DEVICE_NAME,
+                                          strlen(DEVICE_NAME));
+    APP_ERROR_CHECK(err_code);
+
+    err_code = sd_ble_gap_ppcp_set(&m_idle_conn_params);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for handling events from the GATT module.
+ *
+ * @details The Impact Offload Service sends notifications as long as the negotiated ATT MTU allows.
+ */
+static void gatt_evt_handler(nrf_ble_gatt_t * p_gatt, nrf_ble_gatt_evt_t const * p_evt)
+{
+    if (p_evt->evt_id == NRF_BLE_GATT_EVT_ATT_MTU_UPDATED)
+    {
+        // The ATT opcode and handle take 3 bytes of every notification.
+        m_ios.max_data_len = MIN(p_evt->params.att_mtu_effective - 3, BLE_IOS_MAX_DATA_LEN);
+        NRF_LOG_INFO("ATT MTU %d, %d bytes per notification", p_evt->params.att_mtu_effective, m_ios.max_data_len);
+    }
+    else if (p_evt->evt_id == NRF_BLE_GATT_EVT_DATA_LENGTH_UPDATED)
+    {
+        NRF_LOG_INFO("Data length %d", p_evt->params.data_length);
+    }
+}
+
+
+/**@brief Function for initializing the GATT module.
+ *
+ * @details The module negotiates NRF_SDH_BLE_GATT_MAX_MTU_SIZE and NRF_SDH_BLE_GAP_DATA_LENGTH on connect.
+ */
+static void gatt_init(void)
+{
+    ret_code_t err_code = nrf_ble_gatt_init(&m_gatt, gatt_evt_handler);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = nrf_ble_gatt_att_mtu_periph_set(&m_gatt, NRF_SDH_BLE_GATT_MAX_MTU_SIZE);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for encoding the advertising and scan response data.
+ *
+ * @details The advertising data carries the name and the impact summary, manufacturer specific data
+ *          of BLE_IOS_ADV_COMPANY_ID, so a scanner doesn't need the scan response to read it. A relayed hit
+ *          follows the summary, the 31 bytes then hold the short name and no appearance.
+ */
+static void advertising_encode(ble_gap_adv_data_t * p_adv_data)
+{
+    ret_code_t                err_code;
+    ble_advdata_t             advdata;
+    ble_advdata_t             srdata;
+    ble_advdata_manuf_data_t  manuf_data;
+    uint8_t                   manuf[sizeof(ble_ios_adv_summary_t) + sizeof(summary_relay_entry_t)];
+
+    ble_uuid_t adv_uuids[] = {{IOS_UUID_SERVICE, m_ios.uuid_type}};
+
+    memcpy(manuf, &m_adv_summary, sizeof(m_adv_summary));
+    manuf_data.company_identifier = BLE_IOS_ADV_COMPANY_ID;
+    manuf_data.data.p_data        = manuf;
+    manuf_data.data.size          = sizeof(m_adv_summary);
+
+    // Build and set advertising data.
+    memset(&advdata, 0, sizeof(advdata));
+
+    advdata.name_type             = BLE_ADVDATA_FULL_NAME;
+    advdata.include_appearance    = true;
+    advdata.flags                 = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
+    advdata.p_manuf_specific_data = &manuf_data;
+#if SUMMARY_RELAY_ENABLED
+    if (m_adv_relaying)
+    {
+        memcpy(&manuf[sizeof(m_adv_summary)], &m_adv_relay, sizeof(m_adv_relay));
+        manuf_data.data.size       += sizeof(m_adv_relay);
+        advdata.name_type           = BLE_ADVDATA_SHORT_NAME;
+        advdata.short_name_len      = APP_ADV_SHORT_NAME_LEN;
+        advdata.include_appearance  = false;
+    }
+#endif
+
+
+    memset(&srdata, 0, sizeof(srdata));
+    srdata.uuids_complete.uuid_cnt = sizeof(adv_uuids) / sizeof(adv_uuids[0]);
+    srdata.uuids_complete.p_uuids  = adv_uuids;
+
+    p_adv_data->adv_data.len = BLE_GAP_ADV_SET_DATA_SIZE_MAX;
+    err_code = ble_advdata_encode(&advdata, p_adv_data->adv_data.p_data, &p_adv_data->adv_data.len);
+    APP_ERROR_CHECK(err_code);
+
+    p_adv_data->scan_rsp_data.len = BLE_GAP_ADV_SET_DATA_SIZE_MAX;
+    err_code = ble_advdata_encode(&srdata, p_adv_data->scan_rsp_data.p_data, &p_adv_data->scan_rsp_data.len);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for configuring the undirected advertising of the summary, the set must not be advertising.
+ */
+static void advertising_configure(void)
+{
+    ret_code_t           err_code;
+    ble_gap_adv_params_t adv_params;
+
+    // Set advertising parameters.
+    memset(&adv_params, 0, sizeof(adv_params));
+
+    adv_params.primary_phy     = BLE_GAP_PHY_1MBPS;
+    adv_params.duration        = APP_ADV_DURATION;
+    adv_params.properties.type = BLE_GAP_ADV_TYPE_CONNECTABLE_SCANNABLE_UNDIRECTED;
+    adv_params.p_peer_addr     = NULL;
+    adv_params.filter_policy   = BLE_GAP_ADV_FP_ANY;
+    adv_params.interval        = (m_adv_mode == ADV_MODE_SLOW) ? APP_ADV_SLOW_INTERVAL :
+                                 (m_adv_mode == ADV_MODE_UNSYNCED) ? APP_ADV_UNSYNCED_INTERVAL : APP_ADV_INTERVAL;
+
+    err_code = sd_ble_gap_adv_set_configure(&m_adv_handle, &m_adv_data[m_adv_buf], &adv_params);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for getting the battery level of the advertised summary.
+ *
+ * @details Unknown until the first reading, and on a board without a VBAT input for good.
+ */
+static uint8_t adv_battery_level(void)
+{
+    uint8_t percent = battery_monitor_percent();
+
+    return (percent == BATTERY_MONITOR_PERCENT_UNKNOWN) ? BLE_IOS_ADV_BATTERY_UNKNOWN : percent;
+}
+
+
+/**@brief Function for initializing the Advertising functionality.
+ *
+ * @details Encodes the required advertising data and passes it to the stack.
+ *          Also builds a structure to be passed to the stack when starting advertising.
+ */
+static void advertising_init(void)
+{
+    ble_ios_adv_summary_get(&m_ios, adv_battery_level(), &m_adv_summary);
+    advertising_encode(&m_adv_data[m_adv_buf]);
+    advertising_configure();
+}
+
+
+/**@brief Function for handling Queued Write Module errors.
+ *
+ * @details A pointer to this function will be passed to each service which may need to inform the
+ *          application about an error.
+ *
+ * @param[in]   nrf_error   Error code containing information about what went wrong.
+ */
+static void nrf_qwr_error_handler(uint32_t nrf_error)
+{
+    APP_ERROR_HANDLER(nrf_error);
+}
+
+
+/**@brief Function for handling the alert of the Impact Offload Service going out, stamps its latency.
+ *
+ * @details Called from the context that queued the alert and from the BLE event of its tx complete.
+ */
+static void ios_alert_handler(ble_ios_alert_evt_t evt)
+{
+    latency_budget_probe((evt == BLE_IOS_ALERT_QUEUED) ? LATENCY_BUDGET_QUEUED : LATENCY_BUDGET_SENT);
+}
+
+
+/**@brief Function for initializing services that will be used by the application.
+ */
+static void services_init(void)
+{
+    ret_code_t         err_code;
+    nrf_ble_qwr_init_t qwr_init = {0};
+
+    // Initialize Queued Write Module.
+    qwr_init.error_handler = nrf_qwr_error_handler;
+
+    err_code = nrf_ble_qwr_init(&m_qwr, &qwr_init);
+    APP_ERROR_CHECK(err_code);
+
+    // Initialize the Impact Offload Service, it serves the capture pipeline counters, the exposure and the alert latency too.
+    err_code = ble_ios_init(&m_ios, &m_event_store, &m_pipeline_stats, exposure_stats_get(), latency_budget_get());
+    APP_ERROR_CHECK(err_code);
+    ble_ios_alert_handler_set(&m_ios, ios_alert_handler);
+}
+
+
+/**@brief Function for handling the Connection Parameters Module.
+ *
+ * @details This function will be called for all events in the Connection Parameters Module that
+ *          are passed to the application.
+ *
+ * @note All this function does is to disconnect. This could have been done by simply
+ *       setting the disconnect_on_fail config parameter, but instead we use the event
+ *       handler mechanism to demonstrate its use.
+ *
+ * @param[in] p_evt  Event received from the Connection Parameters Module.
+ */
+static void on_conn_params_evt(ble_conn_params_evt_t * p_evt)
+{
+    ret_code_t err_code;
+
+    if (p_evt->evt_type == BLE_CONN_PARAMS_EVT_FAILED)
+    {
+        err_code = sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_CONN_INTERVAL_UNACCEPTABLE);
+        APP_ERROR_CHECK(err_code);
+    }
+}
+
+
+/**@brief Function for handling a Connection Parameters error.
+ *
+ * @param[in] nrf_error  Error code containing information about what went wrong.
+ */
+static void conn_params_error_handler(uint32_t nrf_error)
+{
+    APP_ERROR_HANDLER(nrf_error);
+}
+
+
+/**@brief Function for initializing the Connection Parameters module.
+ */
+static void conn_params_init(void)
+{
+    ret_code_t             err_code;
+    ble_conn_params_init_t cp_init;
+
+    memset(&cp_init, 0, sizeof(cp_init));
+
+    cp_init.p_conn_params                  = NULL;
+    cp_init.first_conn_params_update_delay = FIRST_CONN_PARAMS_UPDATE_DELAY;
+    cp_init.next_conn_params_update_delay  = NEXT_CONN_PARAMS_UPDATE_DELAY;
+    cp_init.max_conn_params_update_count   = MAX_CONN_PARAMS_UPDATE_COUNT;
+    cp_init.start_on_notify_cccd_handle    = BLE_GATT_HANDLE_INVALID;
+    cp_init.disconnect_on_fail             = false;
+    cp_init.evt_handler                    = on_conn_params_evt;
+    cp_init.error_handler                  = conn_params_error_handler;
+
+    err_code = ble_conn_params_init(&cp_init);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for following the offload with the connection parameters.
+ *
+ * @details Asks for the short interval once an offload or the live stream starts and for the long one
+ *          with slave latency once it ends, so the radio only runs at the offload rate while there is
+ *          data to send. A central still busy with the last update is asked again on the next pass.
+ *          The crystal is held over the short interval, the SoftDevice would start it for every event.
+ *          The gateway opens its links at the offload interval, a reconnect that starts offloading
+ *          straight away keeps it without an update procedure.
+ */
+static void conn_params_process(void)
+{
+    bool       fast = ble_ios_offload_active(&m_ios) || live_stream_active();
+    ret_code_t err_code = NRF_SUCCESS;
+
+    if (m_conn_handle == BLE_CONN_HANDLE_INVALID || fast == m_conn_fast)
+    {
+        return;
+    }
+    if (!fast || m_conn_interval < m_offload_conn_params.min_conn_interval
+        || m_conn_interval > m_offload_conn_params.max_conn_interval)
+    {
+        err_code = ble_conn_params_change_conn_params(m_conn_handle,
+                                                      fast ? &m_offload_conn_params : &m_idle_conn_params);
+    }
+    if (err_code == NRF_SUCCESS)
+    {
+        m_conn_fast = fast;
+        if (fast)
+        {
+            hf_clock_request(HF_CLOCK_USER_RADIO);
+        }
+        else
+        {
+            hf_clock_release(HF_CLOCK_USER_RADIO);
+        }
+    }
+}
+
+
+/**@brief Function for starting advertising, unless advertising_policy_process has it off.
+ */
+static void advertising_start(void)
+{
+    ret_code_t           err_code;
+
+    if (m_adv_mode == ADV_MODE_OFF)
+    {
+        return;
+    }
+    err_code = sd_ble_gap_adv_start(m_adv_handle, APP_BLE_CONN_CFG_TAG);
+    APP_ERROR_CHECK(err_code);
+
+}
+
+
+#if SUMMARY_RELAY_ENABLED
+/**@brief Function for the time of the relayed hits, in seconds. */
+static uint32_t relay_now_s(void)
+{
+    return (uint32_t)(mono_time_us() / 1000000);
+}
+
+
+/**@brief Function for taking up the hit a teammate relays, called by time_sync with the scan reports.
+ *
+ * @details Only the advertising data of a helmet with a relayed hit after its summary is read, the time sync
+ *          beacons of the gateway are shorter. A hit heard first goes out in the advertising data in its turn.
+ *
+ * @param[in]   p_report   Advertising report of another device.
+ */
+static void relay_report_handler(ble_gap_evt_adv_report_t const * p_report)
+{
+    summary_relay_entry_t entry;
+    uint8_t const *       p_data;
+    uint16_t              offset = 0;
+    uint16_t              length;
+    bool                  heard;
+
+    length = ble_advdata_search(p_report->data.p_data, p_report->data.len, &offset,
+                                BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA);
+    p_data = &p_report->data.p_data[offset];
+    if (length != sizeof(uint16_t) + sizeof(ble_ios_adv_summary_t) + sizeof(entry)
+        || uint16_decode(p_data) != BLE_IOS_ADV_COMPANY_ID)
+    {
+        return;
+    }
+    memcpy(&entry, &p_data[sizeof(uint16_t) + sizeof(ble_ios_adv_summary_t)], sizeof(entry));
+
+    CRITICAL_REGION_ENTER();
+    heard = summary_relay_heard(&m_relay, &entry, relay_now_s());
+    CRITICAL_REGION_EXIT();
+    if (heard)
+    {
+        NRF_LOG_INFO("Relaying %d.%d g of %02x%02x, heard %d hops away", entry.peak_g_x10/10, entry.peak_g_x10%10,
+                     entry.origin[1], entry.origin[0], entry.hops);
+    }
+}
+
+
+/**@brief Function for starting the relay of severe hits with the device's address as the origin of its own.
+ */
+static void relay_init(void)
+{
+    ble_gap_addr_t addr;
+    ret_code_t     err_code;
+
+    err_code = sd_ble_gap_addr_get(&addr);
+    APP_ERROR_CHECK(err_code);
+    summary_relay_init(&m_relay, addr.addr);
+    time_sync_report_handler_set(&m_time_sync, relay_report_handler);
+}
+#endif
+
+
+/**@brief Function for updating the impact summary in the advertising data when it changes.
+ *
+ * @details Called from the main loop, it changes when an event is stored or the central acks one, and the relayed
+ *          hit every SUMMARY_RELAY_ROTATE_S while there are some.
+ *          The SoftDevice may be advertising from the current buffers, so the data is encoded in the
+ *          other ones and handed over.
+ */
+static void advertising_update(void)
+{
+    ble_ios_adv_summary_t summary;
+    bool                  changed;
+    ret_code_t            err_code;
+#if SUMMARY_RELAY_ENABLED
+    summary_relay_entry_t relay;
+    bool                  relaying;
+#endif
+
+    // A directed set carries no data, the summary goes in once the undirected advertising is back.
+    if (m_adv_directed)
+    {
+        return;
+    }
+    ble_ios_adv_summary_get(&m_ios, adv_battery_level(), &summary);
+    changed = (memcmp(&summary, &m_adv_summary, sizeof(summary)) != 0);
+#if SUMMARY_RELAY_ENABLED
+    CRITICAL_REGION_ENTER();
+    relaying = summary_relay_next(&m_relay, relay_now_s(), &relay);
+    CRITICAL_REGION_EXIT();
+    if (relaying != m_adv_relaying || (relaying && memcmp(&relay, &m_adv_relay, sizeof(relay)) != 0))
+    {
+        changed        = true;
+        m_adv_relaying = relaying;
+        if (relaying)
+        {
+            m_adv_relay = relay;
+        }
+    }
+#endif
+    if (!changed)
+    {
+        return;
+    }
+    m_adv_summary = summary;
+    m_adv_buf ^= 1;
+    advertising_encode(&m_adv_data[m_adv_buf]);
+
+    err_code = sd_ble_gap_adv_set_configure(&m_adv_handle, &m_adv_data[m_adv_buf], NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for advertising a stored impact to the known gateway, called from the main loop.
+ *
+ * @details An impact stored while no central is connected switches the set to high duty directed advertising
+ *          to the gateway for KNOWN_GATEWAY_DIRECTED_MS, a scanning gateway connects within a few ms instead of
+ *          waiting for the next undirected advertisement and reading the summary first. Once it timed out or
+ *          the gateway connected the set goes back to the undirected advertising, started again if no central
+ *          is connected.
+ */
+static void advertising_directed_process(void)
+{
+    ble_gap_adv_params_t adv_params;
+    ble_gap_addr_t       gateway;
+    ret_code_t           err_code;
+
+    if (m_adv_directed_request)
+    {
+        m_adv_directed_request = false;
+        if (!m_adv_directed && m_conn_handle == BLE_CONN_HANDLE_INVALID && known_gateway_get(&gateway)
+#if ESB_OFFLOAD_ENABLED
+            && esb_offload_role() == ESB_OFFLOAD_IDLE
+#endif
+           )
+        {
+            memset(&adv_params, 0, sizeof(adv_params));
+            adv_params.primary_phy     = BLE_GAP_PHY_1MBPS;
+            adv_params.duration        = KNOWN_GATEWAY_DIRECTED_MS / 10;
+            adv_params.properties.type = BLE_GAP_ADV_TYPE_CONNECTABLE_NONSCANNABLE_DIRECTED_HIGH_DUTY_CYCLE;
+            adv_params.p_peer_addr     = &gateway;
+            adv_params.filter_policy   = BLE_GAP_ADV_FP_ANY;
+
+            (void) sd_ble_gap_adv_stop(m_adv_handle);
+            m_adv_directed     = true;
+            m_adv_directed_end = false;
+            err_code = sd_ble_gap_adv_set_configure(&m_adv_handle, NULL, &adv_params);
+            if (err_code == NRF_SUCCESS)
+            {
+                err_code = sd_ble_gap_adv_start(m_adv_handle, APP_BLE_CONN_CFG_TAG);
+            }
+            if (err_code == NRF_SUCCESS)
+            {
+                NRF_LOG_INFO("Impact advertised to the gateway");
+            }
+            else
+            {
+                // No timeout will come, the undirected advertising is restored below.
+                NRF_LOG_WARNING("Directed advertising failed: 0x%x", err_code);
+                m_adv_directed_end = true;
+            }
+        }
+    }
+
+    if (m_adv_directed && m_adv_directed_end)
+    {
+        m_adv_directed_end = false;
+        m_adv_directed     = false;
+        (void) sd_ble_gap_adv_stop(m_adv_handle);
+        advertising_configure();
+        if (m_conn_handle == BLE_CONN_HANDLE_INVALID && m_adv_mode != ADV_MODE_OFF
+#if ESB_OFFLOAD_ENABLED
+            && esb_offload_role() == ESB_OFFLOAD_IDLE
+#endif
+           )
+        {
+            err_code = sd_ble_gap_adv_start(m_adv_handle, APP_BLE_CONN_CFG_TAG);
+            // A disconnect may have started it meanwhile.
+            if (err_code != NRF_ERROR_INVALID_STATE)
+            {
+                APP_ERROR_CHECK(err_code);
+            }
+        }
+    }
+}
+
+
+/**@brief Function for following the device state with the advertising interval, called from the main loop.
+ *
+ * @details Advertises at APP_ADV_INTERVAL for ADV_FAST_BURST_S after the boot and after an impact is stored, so a
+ *          central finds the helmet quickly when there is news, then at APP_ADV_UNSYNCED_INTERVAL while events wait
+ *          to be acked and at APP_ADV_SLOW_INTERVAL once the gateway has them all. A synced helmet off the head for
+ *          ADV_OFF_HEAD_S stops advertising unless it relays a hit, the proximity sensor or an impact starts it
+ *          again. The interval only
+ *          changes while no central is connected and no directed advertising runs, a change is made when it is
+ *          next possible; the battery readings run the loop every BATTERY_MONITOR_PERIOD_MS at least. Built with
+ *          ADV_POLICY=0 it stays at APP_ADV_INTERVAL.
+ */
+static void advertising_policy_process(void)
+{
+#if ADV_POLICY_ENABLED
+    uint64_t   now_us = mono_time_us();
+    uint8_t    mode;
+    ret_code_t err_code;
+
+    if (m_adv_burst_request)
+    {
+        m_adv_burst_request = false;
+        m_adv_burst_end_us  = now_us + ADV_FAST_BURST_S * 1000000ULL;
+    }
+    // Worn until the proximity sensor is started, it reads off the head before.
+    if (!m_sensors_ready || vcnl4040_is_worn())
+    {
+        m_worn_us = now_us;
+    }
+
+    if (now_us < m_adv_burst_end_us)
+    {
+        mode = ADV_MODE_FAST;
+    }
+    else if (m_adv_summary.flags & BLE_IOS_ADV_FLAG_UNSYNCED)
+    {
+        mode = ADV_MODE_UNSYNCED;
+    }
+    else if (now_us - m_worn_us < ADV_OFF_HEAD_S * 1000000ULL || m_adv_relaying)
+    {
+        mode = ADV_MODE_SLOW;
+    }
+    else
+    {
+        mode = ADV_MODE_OFF;
+    }
+    if (mode == m_adv_mode || m_adv_directed || m_conn_handle != BLE_CONN_HANDLE_INVALID)
+    {
+        return;
+    }
+#if ESB_OFFLOAD_ENABLED
+    if (esb_offload_role() != ESB_OFFLOAD_IDLE)
+    {
+        return;
+    }
+#endif
+
+    NRF_LOG_DEBUG("Advertising mode %d", mode);
+    (void) sd_ble_gap_adv_stop(m_adv_handle);
+    m_adv_mode = mode;
+    advertising_configure();
+    if (mode != ADV_MODE_OFF)
+    {
+        err_code = sd_ble_gap_adv_start(m_adv_handle, APP_BLE_CONN_CFG_TAG);
+        // A central that just went may have started it meanwhile.
+        if (err_code != NRF_ERROR_INVALID_STATE)
+        {
+            APP_ERROR_CHECK(err_code);
+        }
+    }
+#endif
+}
+
+
+#if NFC_SUMMARY_ENABLED
+/**@brief Function for updating the status on the NFC tag when it changes.
+ *
+ * @details Called from the main loop like advertising_update, an event closing, an ack or a battery reading
+ *          changes it. A trainer's phone reads it off the tag without a BLE connection.
+ */
+static void nfc_update(void)
+{
+    nfc_summary_t summary;
+
+    memset(&summary, 0, sizeof(summary));
+    summary.stored            = event_store_count(&m_event_store) - event_store_oldest(&m_event_store);
+    summary.unsynced          = event_store_count(&m_event_store) - event_store_acked(&m_event_store);
+    summary.severe_time       = m_severe_time;
+    summary.severe_peak_g_x10 = m_severe_peak_g_x10;
+    summary.battery           = battery_monitor_percent();
+    if (summary.battery == BATTERY_MONITOR_PERCENT_UNKNOWN)
+    {
+        summary.battery = NFC_SUMMARY_BATTERY_UNKNOWN;
+    }
+    if (memcmp(&summary, &m_nfc_summary, sizeof(summary)) == 0)
+    {
+        return;
+    }
+    if (nfc_summary_set(&summary) == 0)
+    {
+        m_nfc_summary = summary;
+    }
+}
+#endif
+
+
+/**@brief Function for handling BLE events.
+ *
+ * @param[in]   p_ble_evt   Bluetooth stack event.
+ * @param[in]   p_context   Unused.
+ */
+static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
+{
+    ret_code_t err_code;
+
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_GAP_EVT_CONNECTED:
+            NRF_LOG_INFO("Connected");
+            m_conn_handle   = p_ble_evt->evt.gap_evt.conn_handle;
+            m_conn_fast     = false;
+            m_conn_interval = p_ble_evt->evt.gap_evt.params.connected.conn_params.max_conn_interval;
+            m_peer_addr     = p_ble_evt->evt.gap_evt.params.connected.peer_addr;
+            if (m_adv_directed)
+            {
+                m_adv_directed_end = true;
+            }
+            err_code = nrf_ble_qwr_conn_handle_assign(&m_qwr, m_conn_handle);
+            APP_ERROR_CHECK(err_code);
+            // Ask for the 2M PHY straight away, the central falls back to 1M if it can't.
+            {
+                ble_gap_phys_t const phys =
+                {
+                    .rx_phys = BLE_GAP_PHY_2MBPS,
+                    .tx_phys = BLE_GAP_PHY_2MBPS,
+                };
+                err_code = sd_ble_gap_phy_update(m_conn_handle, &phys);
+                APP_ERROR_CHECK(err_code);
+            }
+            break;
+
+        case BLE_GAP_EVT_DISCONNECTED:
+            NRF_LOG_INFO("Disconnected");
+            m_conn_handle = BLE_CONN_HANDLE_INVALID;
+            hf_clock_release(HF_CLOCK_USER_RADIO);
+#if ESB_OFFLOAD_ENABLED
+            // The radio is the ESB session's until the offload is done, esb_process advertises again.
+            if (esb_offload_role() != ESB_OFFLOAD_IDLE)
+            {
+                break;
+            }
+#endif
+            advertising_start();
+            break;
+
+        case BLE_GAP_EVT_ADV_SET_TERMINATED:
+            // The directed advertising to the gateway timed out, advertising_directed_process restores the set.
+            if (m_adv_directed)
+            {
+                m_adv_directed_end = true;
+            }
+            break;
+
+        case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+            m_conn_interval = p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params.max_conn_interval;
+            break;
+
+        case BLE_GAP_EVT_SEC_PARAMS_REQUEST:
+            // Pairing not supported
+            err_code = sd_ble_gap_sec_params_reply(m_conn_handle,
+                                                   BLE_GAP_SEC_STATUS_PAIRING_NOT_SUPP,
+                                                   NULL,
+                                                   NULL);
+            APP_ERROR_CHECK(err_code);
+            break;
+
+        case BLE_GAP_EVT_PHY_UPDATE:
+            NRF_LOG_INFO("PHY tx %d rx %d", p_ble_evt->evt.gap_evt.params.phy_update.tx_phy,
+                         p_ble_evt->evt.gap_evt.params.phy_update.rx_phy);
+            break;
+
+        case BLE_GAP_EVT_PHY_UPDATE_REQUEST:
+        {
+            NRF_LOG_DEBUG("PHY update request.");
+            ble_gap_phys_t const phys =
+            {
+                .rx_phys = BLE_GAP_PHY_AUTO,
+                .tx_phys = BLE_GAP_PHY_AUTO,
+            };
+            err_code = sd_ble_gap_phy_update(p_ble_evt->evt.gap_evt.conn_handle, &phys);
+            APP_ERROR_CHECK(err_code);
+        } break;
+
+        case BLE_GATTS_EVT_SYS_ATTR_MISSING:
+            // No system attributes have been stored.
+            err_code = sd_ble_gatts_sys_attr_set(m_conn_handle, NULL, 0, 0);
+            APP_ERROR_CHECK(err_code);
+            break;
+
+        case BLE_GATTC_EVT_TIMEOUT:
+            // Disconnect on GATT Client timeout event.
+            NRF_LOG_DEBUG("GATT Client Timeout.");
+            err_code = sd_ble_gap_disconnect(p_ble_evt->evt.gattc_evt.conn_handle,
+                                             BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+            APP_ERROR_CHECK(err_code);
+            break;
+
+        case BLE_GATTS_EVT_TIMEOUT:
+            // Disconnect on GATT Server timeout event.
+            NRF_LOG_DEBUG("GATT Server Timeout.");
+            err_code = sd_ble_gap_disconnect(p_ble_evt->evt.gatts_evt.conn_handle,
+                                             BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+            APP_ERROR_CHECK(err_code);
+            break;
+
+        default:
+            // No implementation needed.
+            break;
+    }
+}
+
+
+#if STACK_WATCH_ENABLED || CPU_LOAD_ENABLED
+/**@brief Function for marking the stack and the cycle count at the first observer of a SoftDevice event.
+ */
+static void ble_stack_enter(ble_evt_t const * p_ble_evt, void * p_context)
+{
+    STACK_WATCH_ENTER(m_ble_stack);
+    CPU_LOAD_ENTER(m_ble_load);
+}
+
+
+/**@brief Function for measuring the stack and the cycles the observers of a SoftDevice event used, after the last.
+ */
+static void ble_stack_exit(ble_evt_t const * p_ble_evt, void * p_context)
+{
+    CPU_LOAD_EXIT(m_ble_load);
+    STACK_WATCH_EXIT(m_ble_stack);
+}
+#endif
+
+
+/**@brief Function for initializing the BLE stack.
+ *
+ * @details Initializes the SoftDevice and the BLE event interrupt.
+ */
+static void ble_stack_init(void)
+{
+    ret_code_t err_code;
+
+    err_code = nrf_sdh_enable_request();
+    APP_ERROR_CHECK(err_code);
+
+    // Configure the BLE stack using the default settings.
+    // Fetch the start address of the application RAM.
+    uint32_t ram_start = 0;
+    err_code = nrf_sdh_ble_default_cfg_set(APP_BLE_CONN_CFG_TAG, &ram_start);
+    APP_ERROR_CHECK(err_code);
+
+    // Queue more notifications per connection than the default so the offload can fill a connection event,
+    // the Impact Offload Service keeps one of them free for alerts.
+    ble_cfg_t ble_cfg;
+    memset(&ble_cfg, 0, sizeof(ble_cfg));
+    ble_cfg.conn_cfg.conn_cfg_tag                            = APP_BLE_CONN_CFG_TAG;
+    ble_cfg.conn_cfg.params.gatts_conn_cfg.hvn_tx_queue_size = BLE_IOS_HVN_TX_QUEUE_SIZE;
+    err_code = sd_ble_cfg_set(BLE_CONN_CFG_GATTS, &ble_cfg, ram_start);
+    APP_ERROR_CHECK(err_code);
+
+#if BLE_IOS_L2CAP_ENABLED
+    // One L2CAP channel a gateway can open for the offload, the Impact Offload Service only sends on it.
+    memset(&ble_cfg, 0, sizeof(ble_cfg));
+    ble_cfg.conn_cfg.conn_cfg_tag                        = APP_BLE_CONN_CFG_TAG;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.ch_count      = 1;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.rx_mps        = BLE_L2CAP_MPS_MIN;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.tx_mps        = BLE_IOS_L2CAP_MPS;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.rx_queue_size = 1;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.tx_queue_size = BLE_IOS_L2CAP_TX_QUEUE_SIZE;
+    err_code = sd_ble_cfg_set(BLE_CONN_CFG_L2CAP, &ble_cfg, ram_start);
+    APP_ERROR_CHECK(err_code);
+#endif
+
+    // Enable BLE stack.
+    err_code = nrf_sdh_ble_enable(&ram_start);
+    APP_ERROR_CHECK(err_code);
+
+    // Dispatch the SoftDevice events below the capture interrupts.
+    err_code = sd_nvic_SetPriority(SD_EVT_IRQn, APP_IRQ_PRIORITY_LOW);
+    APP_ERROR_CHECK(err_code);
+
+    // Let a connection event run on past NRF_SDH_BLE_GAP_EVENT_LENGTH while there is data to send.
+    ble_opt_t opt;
+    memset(&opt, 0, sizeof(opt));
+    opt.common_opt.conn_evt_ext.enable = 1;
+    err_code = sd_ble_opt_set(BLE_COMMON_OPT_CONN_EVT_EXT, &opt);
+    APP_ERROR_CHECK(err_code);
+
+    // Register a handler for BLE events.
+    NRF_SDH_BLE_OBSERVER(m_ble_observer, APP_BLE_OBSERVER_PRIO, ble_evt_handler, NULL);
+#if STACK_WATCH_ENABLED || CPU_LOAD_ENABLED
+    // Every observer of an event runs between the first and the last priority.
+    NRF_SDH_BLE_OBSERVER(m_ble_stack_enter, 0, ble_stack_enter, NULL);
+    NRF_SDH_BLE_OBSERVER(m_ble_stack_exit, NRF_SDH_BLE_OBSERVER_PRIO_LEVELS - 1, ble_stack_exit, NULL);
+#endif
+}
+
+
+/**@brief Function for pairing the RTC with the monotonic time, blocks on the i2c bus for about 10 ms.
+ *
+ * @details The RTC is read until its hundredths turn over, the monotonic time taken before that read is then
+ *          the start of the hundredth to the length of one read. An RTC that does not count is not paired.
+ */
+static void rtc_anchor(void)
+{
+    ds1388_data_t date;
+    uint64_t mono_us;
+    uint8_t hundreth;
+    uint8_t reads = 0;
+
+    (void) ds1388_get_time(&date);
+    hundreth = date.hundreth;
+    do
+    {
+        mono_us = mono_time_us();
+        (void) ds1388_get_time(&date);
+    } while (date.hundreth == hundreth && ++reads < RTC_ANCHOR_READS);
+    if (date.hundreth == hundreth)
+    {
+        NRF_LOG_WARNING("RTC not counting, no anchor");
+        return;
+    }
+    mono_time_anchor((uint64_t) ds1388_to_epoch(&date) * 1000000 + (uint64_t) date.hundreth * 10000, mono_us);
+}
+
+
+/**@brief Function for pairing the RTC with the monotonic time again once the anchor period passed.
+ *
+ * @details The period grows while the fitted rate holds, see mono_time.h.
+ */
+static void rtc_anchor_process(void)
+{
+    mono_time_status_t status;
+
+    if (!m_sensors_ready)
+    {
+        return;
+    }
+    mono_time_get_status(&status);
+    if (!status.anchored || status.anchor_age_s >= status.anchor_period_s)
+    {
+        rtc_anchor();
+    }
+}
+
+
+/**@brief Function for the wall clock time of a monotonic time.
+ *
+ * @details From the RTC anchors, only before the first one the RTC is read, blocking on the i2c bus, and the
+ *          time is that of the read.
+ */
+static void wall_time_get(uint64_t mono_us, event_store_time_t * p_time)
+{
+    ds1388_data_t date;
+    uint64_t wall_us;
+
+    if (mono_time_wall_us(mono_us, &wall_us) < 0)
+    {
+        (void) ds1388_get_time(&date);
+        event_store_time_from_ds1388(&date, p_time);
+        return;
+    }
+    p_time->s  = (uint32_t) (wall_us / 1000000);
+    // Whole hundredths as the RTC gives them, only a synced time carries the microseconds.
+    p_time->us = (uint32_t) (((wall_us % 1000000) / 10000) * 10000);
+}
+
+
+/**@brief Function for the time an activity log page starts at.
+ */
+static uint32_t activity_time_get(void)
+{
+    event_store_time_t time;
+
+    wall_time_get(mono_time_us(), &time);
+    return time.s;
+}
+
+
+#if CRASH_LOG_ENABLED
+/**@brief Function for filling the pipeline counters of a crash record, from the fault handler.
+ */
+static void crash_counters_get(uint32_t * p_counters)
+{
+    p_counters[CRASH_LOG_COUNTER_CAPTURES]      = m_pipeline_stats.captures;
+    p_counters[CRASH_LOG_COUNTER_DROPPED]       = m_pipeline_stats.samples_dropped;
+    p_counters[CRASH_LOG_COUNTER_FIFO_OVERRUNS] = m_pipeline_stats.fifo_overruns;
+    p_counters[CRASH_LOG_COUNTER_COMMITS]       = m_pipeline_stats.commits;
+    p_counters[CRASH_LOG_COUNTER_EVENTS]        = event_store_count(&m_event_store);
+    p_counters[CRASH_LOG_COUNTER_COMMIT_STATE]  = m_commit.state;
+    p_counters[CRASH_LOG_COUNTER_SPI_ERRORS]    = spi_error_count(&flash_spi);
+    p_counters[CRASH_LOG_COUNTER_TWI_TIMEOUTS]  = twi_timeout_count();
+}
+
+
+/**@brief Function for logging the crash record of the last boot.
+ *
+ * @details Only after a reset the fault handlers end with, the record is otherwise from an earlier boot.
+ */
+static void crash_report(void)
+{
+    crash_log_record_t record;
+
+    if ((boot_check_reset_reason() & (POWER_RESETREAS_SREQ_Msk | POWER_RESETREAS_LOCKUP_Msk)) == 0
+        || !crash_log_last(&record))
+    {
+        return;
+    }
+    if (record.kind == CRASH_LOG_HARDFAULT)
+    {
+        NRF_LOG_ERROR("Crash %d: HardFault at 0x%08x, lr 0x%08x, cfsr 0x%08x", record.seq, record.pc, record.lr,
+                      record.cfsr);
+    }
+    else
+    {
+        NRF_LOG_ERROR("Crash %d: error 0x%x (fault id 0x%x) line %d at 0x%08x", record.seq, record.err_code,
+                      record.id, record.line, record.pc);
+    }
+}
+#endif
+
+
+/**@brief Function for handling a HardFault, called by the stack check of hardfault_handler_gcc.c.
+ *
+ * @details The crash record goes to the flash first, nothing is logged, then the chip resets.
+ *
+ * @param[in] p_stack_address The stacked registers, NULL if the main stack overflowed.
+ */
+void HardFault_c_handler(uint32_t * p_stack_address)
+{
+#if CRASH_LOG_ENABLED
+    crash_log_fault(p_stack_address);
+#endif
+    NRF_BREAKPOINT_COND;
+    NVIC_SystemReset();
+}
+
+
+/**@brief Function for handling a fatal error, in place of the weak one of app_error_weak.c.
+ *
+ * @details The crash record goes to the flash before the final flush of the log, which waits on the uart.
+ */
+void app_error_fault_handler(uint32_t id, uint32_t pc, uint32_t info)
+{
+    __disable_irq();
+#if CRASH_LOG_ENABLED
+    crash_log_error(id, pc, info);
+#endif
+    NRF_LOG_ERROR("Fatal error, fault id 0x%x at 0x%08x", id, pc);
+    NRF_LOG_FINAL_FLUSH();
+    NRF_BREAKPOINT_COND;
+#ifndef DEBUG
+    NVIC_SystemReset();
+#else
+    app_error_save_and_stop(id, pc, info);
+#endif
+}
+
+
+/**@brief Function for keeping where the event store stands over a watchdog reset, after each step that changes it.
+ */
+static void flash_retain(void)
+{
+    event_store_resume_t resume;
+
+    event_store_resume_get(&m_event_store, &resume);
+    (void) watchdog_retain(&resume, sizeof(resume));
+}
+
+
+/**@brief Function for initializing the flash, the event store read by the Impact Offload Service and the activity log.
+ *
+ * @details After a watchdog reset the store is mounted from where it stood, see flash_retain.
+ */
+static void flash_init(void)
+{
+    event_store_resume_t resume;
+    char const * p_stage;
+    uint16_t restarts;
+    int8_t ret;
+
+    capture_flash_acquire();
+    if (watchdog_restarted(&p_stage, &restarts))
+    {
+        // The stage is kept in a static buffer, the deferred log can take the pointer.
+        NRF_LOG_WARNING("Watchdog restart %d, stalled stage: %s", restarts, (p_stage[0] != '\0') ? p_stage : "none");
+    }
+    // The activity log erases too, the store finishes its erase before one of its own.
+    event_store_erase_owner_set(&m_event_store, activity_log_finish_erase);
+    // A format draws the nonce of the cipher from the SoftDevice's random pool.
+    event_store_nonce_set(&m_event_store, event_crypt_nonce_new);
+    if (watchdog_restore(&resume, sizeof(resume)))
+    {
+        ret = event_store_init_resume(&m_event_store, &resume);
+    }
+    else
+    {
+        ret = event_store_init(&m_event_store);
+    }
+    if (ret < 0)
+    {
+        NRF_LOG_ERROR("Event store init failed");
+    }
+    flash_retain();
+    event_store_cache_init(&m_event_store, &m_event_store_cache);
+    event_store_retain_set(&m_event_store, RETAIN_PIN_PEAK_G_X10);
+    m_encrypt = event_crypt_key_set(device_config_get()->data_key);
+    if (m_encrypt)
+    {
+        event_crypt_init(&m_event_crypt, device_config_get()->data_key);
+        event_store_cipher_set(&m_event_store, event_crypt_apply, &m_event_crypt);
+    }
+    if (activity_log_init(activity_time_get) < 0)
+    {
+        NRF_LOG_ERROR("Activity log init failed");
+    }
+#if CRASH_LOG_ENABLED
+    if (crash_log_init(crash_counters_get) < 0)
+    {
+        NRF_LOG_ERROR("Crash log init failed");
+    }
+    crash_report();
+#endif
+    capture_flash_release();
+    NRF_LOG_INFO("%d impact events stored", event_store_count(&m_event_store));
+}
+
+
+/**@brief Function for starting the background erase, a no-op while it is running.
+ */
+static void erase_kick(void)
+{
+    ret_code_t err_code = app_timer_start(m_erase_timer_id, APP_TIMER_TICKS(ERASE_POLL_MS), NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for putting the flash in deep power-down once nothing is waiting for it.
+ *
+ * @details Called when the background erase has run out of work. A commit, an offload or an activity log read
+ *          keeps it awake until the erase steps after them, the next capture_flash_acquire() releases it.
+ */
+static void flash_sleep(void)
+{
+    if (m_commit.state != COMMIT_IDLE || ble_ios_offload_active(&m_ios) || m_activity_read.active)
+    {
+        return;
+    }
+    if (capture_flash_sleep() < 0)
+    {
+        NRF_LOG_ERROR("Flash deep power-down failed");
+    }
+}
+
+
+static void erase_radio_done(void);
+
+
+/**@brief Function for running one background erase step of the offloaded events, or of the activity log.
+ *
+ * @details Deferred while a capture is stored or offloaded, both are behind on the flash otherwise. The activity
+ *          log only steps once the event store has nothing to erase, and the store waits for an erase of the
+ *          log, the flash runs one erase at a time.
+ */
+static void erase_step_handler(void * p_event_data, uint16_t event_size)
+{
+    int8_t ret;
+
+    UNUSED_PARAMETER(p_event_data);
+    UNUSED_PARAMETER(event_size);
+
+    if (m_commit.state != COMMIT_IDLE || ble_ios_offload_active(&m_ios))
+    {
+        erase_kick();
+        return;
+    }
+    // A step that would run into a radio event waits for it to end, the timer retries if it does not come.
+    if (!radio_window_clear(ERASE_STEP_HOLD_US))
+    {
+        radio_window_defer(erase_radio_done);
+        erase_kick();
+        return;
+    }
+    PROFILER_START(m_erase_step_probe);
+    capture_flash_acquire();
+    ret = activity_log_erasing() ? 0 : event_store_erase_step(&m_event_store);
+    if (ret == 0)
+    {
+        ret = activity_log_step();
+    }
+    capture_flash_release();
+    flash_retain();
+    PROFILER_STOP(m_erase_step_probe);
+    if (ret < 0)
+    {
+        NRF_LOG_ERROR("Background erase or activity log write failed");
+    }
+    else if (ret > 0)
+    {
+        erase_kick();
+    }
+    else
+    {
+        flash_sleep();
+    }
+}
+
+
+/**@brief Function for handling the erase timer timeout, posts the erase step to the scheduler.
+ */
+static void erase_timeout_handler(void * p_context)
+{
+    ret_code_t err_code;
+
+    UNUSED_PARAMETER(p_context);
+
+    err_code = app_sched_event_put(NULL, 0, erase_step_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for posting the erase step held back for a radio event, from the radio notification once it ends.
+ */
+static void erase_radio_done(void)
+{
+    erase_timeout_handler(NULL);
+}
+
+
+static void commit_step_handler(void * p_event_data, uint16_t event_size);
+
+static volatile bool m_exposure_save_due = false;                               /**< Set by the exposure timer, taken by exposure_process. */
+
+/**@brief Function for handling the exposure timer timeout, the save runs from the main loop.
+ */
+static void exposure_timeout_handler(void * p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    m_exposure_save_due = true;
+}
+
+
+/**@brief Function for handling the commit timer timeout, posts the commit step that waited for the flash.
+ */
+static void commit_timeout_handler(void * p_context)
+{
+    ret_code_t err_code;
+
+    UNUSED_PARAMETER(p_context);
+
+    err_code = app_sched_event_put(NULL, 0, commit_step_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for posting the commit step held back for a radio event, from the radio notification once it ends.
+ */
+static void commit_radio_done(void)
+{
+    commit_timeout_handler(NULL);
+}
+
+
+/**@brief Function for the Timer initialization.
+ *
+ * @details Initializes the timer module, the erase, commit and exposure timers, the monotonic time, the watchdog
+ *          and the time sync that extends the app timer count.
+ */
+static void timers_init(void)
+{
+    ret_code_t err_code = app_timer_init();
+    APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_create(&m_erase_timer_id, APP_TIMER_MODE_SINGLE_SHOT, erase_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_create(&m_commit_timer_id, APP_TIMER_MODE_SINGLE_SHOT, commit_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_create(&m_exposure_timer_id, APP_TIMER_MODE_REPEATED, exposure_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+    err_code = app_timer_start(m_exposure_timer_id, APP_TIMER_TICKS(EXPOSURE_SAVE_MS), NULL);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = mono_time_init();
+    APP_ERROR_CHECK(err_code);
+#if WATCHDOG_ENABLED
+    // The reset reason is boot_check's, read before the SoftDevice takes POWER.
+    err_code = watchdog_init(boot_check_reset_reason());
+    APP_ERROR_CHECK(err_code);
+#endif
+#if TRIGGER_STAMP_ENABLED
+    // The timebase TIMER brings the monotonic time under the RTC1 tick, and the capture latches the accel
+    // watermark edges in it. Nothing has taken a PPI channel yet.
+    timebase_start();
+    APP_ERROR_CHECK_BOOL(mono_time_refine_start() == 0);
+#endif
+
+    err_code = time_sync_init(&m_time_sync);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for working out the metrics and the event summary of a closed capture.
+ */
+static void capture_summarize(capture_buf_t const * p_buf, impact_metrics_t * p_metrics,
+                              event_store_summary_t * p_summary)
+{
+    record_block_t const * block;
+
+    capture_core_metrics_init(p_buf, p_metrics);
+    for (block = p_buf->chain.p_head; block != NULL; block = block->p_next)
+    {
+        impact_metrics_add_block(p_metrics, block->records, block->count);
+    }
+    capture_core_summary_fill(p_metrics, p_summary);
+}
+
+
+/**@brief Function for starting to store a capture, closed or streamed.
+ *
+ * @details The metrics and the impact location are worked out by the commit steps as they
+ *          encode the records rather than in the capture interrupts, the event is written
+ *          one page per scheduler event and gets its summary in the header at the commit.
+ */
+static void commit_start(capture_buf_t * p_buf)
+{
+    commit_t * commit = &m_commit;
+    ret_code_t err_code;
+    uint64_t ref_us;
+
+    commit->p_buf       = p_buf;
+    commit->start_ticks = app_timer_cnt_get();
+    commit->state       = COMMIT_BEGIN;
+    watchdog_stage_start(&m_commit_stage);
+    commit->encoding    = p_buf->p_profile->encoding;
+
+    capture_core_metrics_init(p_buf, &commit->metrics);
+    memset(&commit->summary, 0xFF, sizeof(event_store_summary_t));
+    // Synced to the gateway the trigger count gives the time to the microsecond, the rtc only to 10 ms.
+    commit->synced = (time_sync_ticks_to_ref_us(&m_time_sync, p_buf->start_ticks, &ref_us) == 0);
+    if (commit->synced)
+    {
+        commit->time.s  = ref_us / 1000000;
+        commit->time.us = (ref_us % 1000000) | EVENT_STORE_TIME_SYNCED;
+    }
+
+    err_code = app_sched_event_put(NULL, 0, commit_step_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for appending about one flash page of the capture to its event.
+ *
+ * @details The event is opened by the first step and committed by the last one. Each record
+ *          block goes back to the pool once encoded. A step fills the chunk that completes the
+ *          page being collected while the page before it programs, and only appends it once
+ *          the status says the program is done, so no step spins on the flash. A streamed
+ *          capture that is still recording only gives up the blocks before its tail, the
+ *          commit catches up with it and waits for more. The flash must be acquired.
+ *
+ * @return 3 while waiting for a streamed capture to record more, 2 while the flash is still
+ *         programming, 1 while there is more to store, 0 once committed, -1 on spi error,
+ *         -2 or -3 if the event store refused the event.
+ */
+static int8_t commit_step(uint32_t * p_event_id)
+{
+    commit_t * commit = &m_commit;
+    capture_buf_t * p_buf = commit->p_buf;
+    record_chain_t * chain = &p_buf->chain;
+    event_store_t * store = &m_event_store;
+    event_store_preview_t preview;
+    int8_t ret;
+
+    if (commit->state == COMMIT_DROPPING)
+    {
+        // The blocks of the failed event go back to the pool as the capture fills them.
+        while (chain->p_head != NULL && (p_buf->closed || chain->p_head->p_next != NULL))
+        {
+            record_chain_free_head(chain);
+        }
+        return p_buf->closed ? commit->error : 3;
+    }
+    if (commit->state == COMMIT_BEGIN)
+    {
+        // The encoding id also tells the reader the icm20649 range of the records, and if they are
+        // enciphered: raw records then take the ranged id, the raw one has every bit set.
+        uint16_t encoding = impact_codec_encoding(commit->encoding == IMPACT_CODEC_ENCODING, p_buf->range, false);
+
+        if (m_encrypt)
+        {
+            if (encoding == IMPACT_CODEC_ENCODING_RAW)
+            {
+                encoding = IMPACT_CODEC_ENCODING_RAW_RANGED | IMPACT_RECORD_RANGE_DEFAULT;
+            }
+            encoding |= EVENT_STORE_ENCODING_ENCRYPTED;
+        }
+        ret = event_store_begin(store, &commit->time, &commit->summary,
+                                (commit->encoding == IMPACT_CODEC_ENCODING) ? 1 : IMPACT_RECORD_SIZE, encoding);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        capture_core_encode_init(&commit->encoder, (commit->encoding == IMPACT_CODEC_ENCODING) ?
+                                 IMPACT_CODEC_NIBBLE : IMPACT_CODEC_PACKED);
+        commit->polls       = 0;
+        commit->state       = COMMIT_WRITING;
+        return 1;
+    }
+
+    // The chunk stops once it fills the page, the overshoot of the last record stays buffered
+    // in the next one, so an append never programs more than one page.
+    capture_core_encode(&commit->encoder, p_buf, &commit->metrics, event_store_append_room(store));
+    ret = event_store_append_busy(store);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    if (ret > 0)
+    {
+        commit->polls++;
+        return 2;
+    }
+    if (commit->encoder.fill > 0)
+    {
+        // A coded event counts bytes as its samples, a raw one whole records.
+        ret = event_store_append(store, commit->encoder.chunk, (commit->encoding == IMPACT_CODEC_ENCODING) ?
+                                 commit->encoder.fill : commit->encoder.fill/IMPACT_RECORD_SIZE);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        commit->encoder.fill = 0;
+    }
+    if (!p_buf->closed && (chain->p_head == NULL || chain->p_head->p_next == NULL))
+    {
+        return 3;
+    }
+    if (chain->p_head != NULL)
+    {
+        return 1;
+    }
+
+    capture_core_summary_fill(&commit->metrics, &commit->summary);
+    commit->metrics_us = mono_time_us();
+    NRF_LOG_INFO("IMPACT: PEAK %d mg, DURATION %d us, HIC15 %d, HIC36 %d",
+                 impact_metrics_peak_mg(&commit->metrics),
+                 impact_metrics_duration_us(&commit->metrics),
+                 commit->metrics.hic15, commit->metrics.hic36);
+    NRF_LOG_INFO("LOCATION: %s (%d, %d, %d)/127", impact_location_name(commit->summary.location),
+                 commit->summary.direction[0], commit->summary.direction[1], commit->summary.direction[2]);
+    event_store_set_summary(store, &commit->summary);
+    // The metrics kept the preview of the resultant as they went, whatever the length of the capture.
+    preview.point_us = impact_metrics_preview(&commit->metrics, preview.g);
+    event_store_set_preview(store, &preview);
+    ret = event_store_commit(store, p_event_id);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    pipeline_stats_commit(&m_pipeline_stats, capture_since_us(commit->start_ticks)/1000, store->erase_stalls);
+    return 0;
+}
+
+
+/**@brief Function for finishing a commit, alerts the central and starts the next pending capture.
+ */
+static void commit_finish(int8_t ret, uint32_t event_id)
+{
+    commit_t * commit = &m_commit;
+    capture_buf_t * p_pending;
+    ble_ios_alert_t alert;
+    int8_t alert_ret;
+
+    if (ret == 0)
+    {
+        NRF_LOG_INFO("Impact stored as event %d, %d program polls", event_id, commit->polls);
+        exposure_stats_add(commit->summary.peak_g_x10, commit->metrics.peak_alpha, commit->metrics.hic15);
+#if NFC_SUMMARY_ENABLED
+        if (commit->summary.peak_g_x10 >= NFC_SUMMARY_SEVERE_G_X10)
+        {
+            m_severe_time       = commit->time;
+            m_severe_peak_g_x10 = commit->summary.peak_g_x10;
+        }
+#endif
+        alert.event_id    = event_id;
+        alert.time        = commit->time;
+        alert.peak_g_x10  = commit->summary.peak_g_x10;
+        alert.duration_ms = commit->summary.duration_ms;
+        // The alert is timed from the trigger until its notification is on air.
+        latency_budget_start(commit->p_buf->start_us, commit->p_buf->close_us, commit->metrics_us);
+        // -2 only means nobody is listening, the central can read the event later.
+        alert_ret = ble_ios_alert_send(&m_ios, &alert);
+        if (alert_ret < 0)
+        {
+            latency_budget_cancel();
+        }
+        if (alert_ret == -1)
+        {
+            NRF_LOG_ERROR("Impact alert failed");
+        }
+        // With no central the known gateway is called in, advertising_directed_process runs in the main loop.
+        if (m_conn_handle == BLE_CONN_HANDLE_INVALID)
+        {
+            m_adv_directed_request = true;
+        }
+        m_adv_burst_request = true;
+#if SUMMARY_RELAY_ENABLED
+        CRITICAL_REGION_ENTER();
+        (void) summary_relay_add_own(&m_relay, event_id, commit->summary.peak_g_x10, relay_now_s());
+        CRITICAL_REGION_EXIT();
+#endif
+    }
+    else
+    {
+        NRF_LOG_ERROR("Impact store failed (%d), dropped", ret);
+    }
+
+    capture_buf_release(commit->p_buf);
+    commit->p_buf = NULL;
+    commit->state = COMMIT_IDLE;
+    watchdog_stage_stop(&m_commit_stage);
+    erase_kick();
+
+    if (nrf_queue_pop(&m_commit_queue, &p_pending) == NRF_SUCCESS)
+    {
+        commit_start(p_pending);
+    }
+}
+
+
+/**@brief Function for running one commit step with the flash on the bus.
+ */
+static void commit_step_handler(void * p_event_data, uint16_t event_size)
+{
+    ret_code_t err_code;
+    uint32_t event_id = 0;
+    int8_t ret;
+
+    UNUSED_PARAMETER(p_event_data);
+    UNUSED_PARAMETER(event_size);
+
+    WATCHDOG_BEAT(m_commit_stage);
+    if (m_commit.state == COMMIT_BEGIN && !m_commit.synced)
+    {
+        wall_time_get(m_commit.p_buf->start_us, &m_commit.time);
+    }
+    // The page program and its status polls go between the radio events, the fifo reads queue behind
+    // the hold and a radio event on top of it would stretch their wait past the fifo's headroom.
+    if (!radio_window_clear(COMMIT_STEP_HOLD_US))
+    {
+        radio_window_defer(commit_radio_done);
+        err_code = app_timer_start(m_commit_timer_id, APP_TIMER_TICKS(RADIO_RETRY_MS), NULL);
+        APP_ERROR_CHECK(err_code);
+        return;
+    }
+    PROFILER_START(m_commit_step_probe);
+    capture_flash_acquire();
+    ret = commit_step(&event_id);
+    capture_flash_release();
+    PROFILER_STOP(m_commit_step_probe);
+    flash_retain();
+
+    if (ret < 0 && !m_commit.p_buf->closed)
+    {
+        // The capture still records into its buffer, it is only released once closed.
+        m_commit.error = ret;
+        m_commit.state = COMMIT_DROPPING;
+        ret = 3;
+    }
+    if (ret > 2)
+    {
+        err_code = app_timer_start(m_commit_timer_id, APP_TIMER_TICKS(COMMIT_STREAM_POLL_MS), NULL);
+        APP_ERROR_CHECK(err_code);
+    }
+    else if (ret > 1)
+    {
+        // The flash is programming the page before, the thread sleeps or runs other events meanwhile.
+        err_code = app_timer_start(m_commit_timer_id, COMMIT_POLL_TICKS, NULL);
+        APP_ERROR_CHECK(err_code);
+    }
+    else if (ret > 0)
+    {
+        err_code = app_sched_event_put(NULL, 0, commit_step_handler);
+        APP_ERROR_CHECK(err_code);
+    }
+    else
+    {
+        commit_finish(ret, event_id);
+    }
+}
+
+
+/**@brief Function for timing the thread stages of a replayed capture, it is not stored.
+ *
+ * @details The metrics, location and codec run as for a commit, the output of every codec is only
+ *          counted, so their cost on the device is compared on the same records. The commit of a live
+ *          capture may be in between its steps, this has its own metrics and codec state.
+ */
+static void replay_process(capture_buf_t * p_buf)
+{
+    static impact_metrics_t metrics;
+    capture_replay_stats_t * stats = capture_replay_stats();
+    event_store_summary_t summary;
+    record_block_t const * block;
+    impact_codec_t codec;
+    uint8_t out[IMPACT_CODEC_MAX_RECORD_SIZE];
+    uint32_t start;
+    uint32_t bytes;
+    uint16_t i;
+    uint8_t kind;
+
+    start = DWT->CYCCNT;
+    capture_summarize(p_buf, &metrics, &summary);
+    stats->metrics_cycles = DWT->CYCCNT - start;
+
+    for (kind = 0; kind < IMPACT_CODEC_KINDS; kind++)
+    {
+        bytes = 0;
+        start = DWT->CYCCNT;
+        impact_codec_init(&codec);
+        for (block = p_buf->chain.p_head; block != NULL; block = block->p_next)
+        {
+            for (i = 0; i < block->count; i++)
+            {
+                bytes += impact_codec_encode_with((impact_codec_kind_t) kind, &codec, &block->records[i], out);
+            }
+        }
+        stats->encode_cycles[kind] = DWT->CYCCNT - start;
+        stats->encoded_bytes[kind] = bytes;
+    }
+
+    stats->records     = p_buf->count;
+    stats->peak_mg     = impact_metrics_peak_mg(&metrics);
+    stats->duration_us = impact_metrics_duration_us(&metrics);
+    stats->hic15       = metrics.hic15;
+    stats->timed++;
+    NRF_LOG_INFO("REPLAY: PEAK %d mg, DURATION %d us, HIC15 %d, location %s", stats->peak_mg,
+                 stats->duration_us, stats->hic15, impact_location_name(summary.location));
+
+    capture_buf_release(p_buf);
+}
+
+
+/**@brief Function for storing a capture once the one being stored is committed.
+ *
+ * @details Captures waiting for the commit are in m_commit_queue, it has room for every
+ *          capture buffer.
+ */
+static void commit_enqueue(capture_buf_t * p_buf)
+{
+    ret_code_t err_code;
+
+    // The flash leaves deep power-down while the commit gets going.
+    capture_flash_wake();
+    if (m_commit.state != COMMIT_IDLE)
+    {
+        err_code = nrf_queue_push(&m_commit_queue, &p_buf);
+        APP_ERROR_CHECK(err_code);
+        return;
+    }
+    commit_start(p_buf);
+}
+
+
+/**@brief Function for handling a capture of a streaming profile as it opens, called from the scheduler.
+ */
+static void capture_open_handler(capture_buf_t * p_buf)
+{
+    commit_enqueue(p_buf);
+}
+
+
+/**@brief Function for handling a closed capture, called from the scheduler.
+ *
+ * @details Replayed ones are timed right away and never stored, streamed ones are with the
+ *          commit since they opened.
+ */
+static void capture_done_handler(capture_buf_t * p_buf)
+{
+    if (p_buf->replay)
+    {
+        replay_process(p_buf);
+        return;
+    }
+    if (!p_buf->stream)
+    {
+        commit_enqueue(p_buf);
+    }
+}
+
+
+/**@brief Function for sending the next offload notifications with the flash on the bus.
+ *
+ * @details Waits for a running commit so the event being written is not read back half done.
+ *          An ack lets the background erase reclaim the events it covers. The end of a notification offload logs
+ *          how often the tx queue ran dry, near 0 it kept every connection event full, and how many sample
+ *          pieces the flash had read ahead.
+ */
+static void offload_process(void)
+{
+    static bool running = false;
+    uint32_t acked = event_store_acked(&m_event_store);
+    uint32_t notifications;
+    uint32_t underruns;
+    uint32_t read_ahead;
+    int8_t ret;
+
+    if (running && !m_ios.offload.active)
+    {
+        running = false;
+        ble_ios_offload_stats(&m_ios, &notifications, &underruns, &read_ahead);
+        if (notifications > 0)
+        {
+            NRF_LOG_INFO("Impact offload done, %u notifications, tx queue ran dry %u times, %u pieces read ahead",
+                         notifications, underruns, read_ahead);
+        }
+    }
+    if (!ble_ios_offload_active(&m_ios) || m_commit.state != COMMIT_IDLE)
+    {
+        return;
+    }
+    // Sleeps once the SoftDevice tx queue is full, BLE_GATTS_EVT_HVN_TX_COMPLETE or BLE_L2CAP_EVT_CH_TX wakes it to send more.
+    PROFILER_START(m_offload_step_probe);
+    capture_flash_acquire();
+    ret = ble_ios_offload_process(&m_ios);
+    capture_flash_release();
+    PROFILER_STOP(m_offload_step_probe);
+    running = running || m_ios.offload.active;
+    if (ret < 0)
+    {
+        NRF_LOG_ERROR("Impact offload stopped");
+    }
+    if (event_store_acked(&m_event_store) != acked)
+    {
+        erase_kick();
+        // The central that acks is a gateway, the next impact is advertised to it.
+        if (known_gateway_set(&m_peer_addr) < 0)
+        {
+            NRF_LOG_WARNING("Gateway address not stored");
+        }
+    }
+}
+
+
+#if ESB_OFFLOAD_ENABLED
+/**@brief Function for starting the offload over ESB a gateway asked for, and for going back to BLE once it is done.
+ *
+ * @details The link is dropped and advertising waits while the radio session runs, offload_process sends the
+ *          payloads. A session that got no ack for ESB_OFFLOAD_TIMEOUT_MS ends the same way, the ack watermark keeps
+ *          what the gateway has. The last acks are stored before the session closes.
+ */
+static void esb_process(void)
+{
+    ble_gap_addr_t addr;
+    uint32_t       first_id;
+    ret_code_t     err_code;
+
+    if (ble_ios_esb_get(&m_ios, &first_id) && esb_offload_role() == ESB_OFFLOAD_IDLE)
+    {
+        err_code = sd_ble_gap_addr_get(&addr);
+        APP_ERROR_CHECK(err_code);
+        if (esb_offload_tx_start(addr.addr) == 0)
+        {
+            NRF_LOG_INFO("ESB offload started");
+            ble_ios_esb_offload_start(&m_ios, first_id);
+            if (m_conn_handle != BLE_CONN_HANDLE_INVALID)
+            {
+                (void) sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+            }
+        }
+        else
+        {
+            NRF_LOG_ERROR("ESB offload refused");
+        }
+    }
+
+    if (esb_offload_role() != ESB_OFFLOAD_TX || m_commit.state != COMMIT_IDLE ||
+        !(esb_offload_tx_done() || esb_offload_failed()))
+    {
+        return;
+    }
+    offload_process();
+    esb_offload_stop();
+    ble_ios_offload_stop(&m_ios);
+    NRF_LOG_INFO("ESB offload %s, acked up to %u", esb_offload_tx_done() ? "done" : "failed",
+                 event_store_acked(&m_event_store));
+    if (m_conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        advertising_start();
+    }
+}
+#endif
+
+
+/**@brief Function for sending the live stream frames and following the rate a central wrote to the offload control point.
+ *
+ * @details The frames are filled from the spi interrupt and sent here whole, cut into notifications. One
+ *          that can't go out (no central listens or an offload runs) is dropped, the sequence number shows
+ *          the gap. A full tx queue leaves the frame for the next pass, BLE_GATTS_EVT_HVN_TX_COMPLETE wakes it.
+ *          The frames wait while a frame of the activity log read is half sent.
+ */
+static void live_stream_process(void)
+{
+    uint8_t const * p_frame;
+    uint16_t        length;
+    uint16_t        rate_hz;
+    int8_t          ret;
+
+    if (ble_ios_stream_get(&m_ios, &rate_hz))
+    {
+        ret = capture_stream_set(rate_hz);
+        if (ret < 0)
+        {
+            NRF_LOG_ERROR("Live stream at %u Hz refused (%d)", rate_hz, ret);
+        }
+        else if (rate_hz > 0)
+        {
+            NRF_LOG_INFO("Live stream at %u Hz", rate_hz);
+        }
+    }
+    while (m_activity_read.frame_len == 0 && live_stream_peek(&p_frame, &length))
+    {
+        ret = ble_ios_live_send(&m_ios, p_frame, length);
+        if (ret == -3)
+        {
+            return;
+        }
+        live_stream_pop();
+    }
+}
+
+
+/**@brief Function for starting the i2c sensors behind the capture, the RTC and then the proximity sensor.
+ *
+ * @details Resumed from the main loop, the 500 ms RTC settle after power-on and the bus writes don't hold the
+ *          accelerometer fifo up. The boot counts as passed once both are up.
+ */
+static PT_THREAD(sensors_start_thread(pt_t * pt))
+{
+    PT_BEGIN(pt);
+    UNUSED_VARIABLE(PT_YIELD_FLAG);
+
+    //the rtc kept running through a warm boot, only power-on waits for it
+    PT_SPAWN(pt, &m_sensor_pt, ds1388_config_thread(&m_sensor_pt, boot_check_full_test()));
+    rtc_anchor();
+    //the wear state of the activity log follows the proximity interrupt
+    PT_SPAWN(pt, &m_sensor_pt, vcnl4040_config_thread(&m_sensor_pt));
+    vcnl4040_int_init();
+    m_sensors_ready = true;
+    boot_check_passed();
+
+    PT_END(pt);
+}
+
+
+/**@brief Function for resuming the start of the i2c sensors until it ends.
+ *
+ * @return true while the sensors start.
+ */
+static bool sensors_start_process(void)
+{
+    if (!m_sensors_ready)
+    {
+        (void) sensors_start_thread(&m_sensors_pt);
+    }
+    return !m_sensors_ready;
+}
+
+
+/**@brief Function for logging the seconds of activity the capture summed, with the wear state.
+ *
+ * @details A page filled for the flash is written by the background erase steps. Held off until the RTC the pages
+ *          are timed by and the proximity sensor are up.
+ */
+static void activity_process(void)
+{
+    if (!m_sensors_ready)
+    {
+        return;
+    }
+    if (activity_log_process(vcnl4040_is_worn()))
+    {
+        erase_kick();
+    }
+}
+
+
+/**@brief Function for reading the proximity fast around the head going on or off, and slow while it stays.
+ *
+ * @details The wear changes are signalled within a second at either rate, the slow one saves most of the current of
+ *          the proximity LED. A rate the bus can't take yet is written on a later pass.
+ */
+static void proximity_rate_process(void)
+{
+    uint64_t now_us;
+    uint32_t transitions;
+
+    if (!m_sensors_ready)
+    {
+        return;
+    }
+    now_us = mono_time_us();
+    transitions = vcnl4040_transitions();
+    if (transitions != m_prox_transitions)
+    {
+        m_prox_transitions = transitions;
+        m_prox_fast_end_us = now_us + PROX_FAST_HOLD_S * 1000000ULL;
+    }
+    (void) vcnl4040_rate_set((now_us < m_prox_fast_end_us) ? VCNL4040_RATE_FAST : VCNL4040_RATE_SLOW);
+}
+
+
+#if FW_STAGE_ENABLED
+/**@brief Function for writing the firmware update a central stages to bank 1, and for swapping to it once idle.
+ *
+ * @details The chunks and the bootloader settings go through the SoftDevice between the radio events, the capture
+ *          goes on meanwhile. The swap waits for no impact being recorded or stored and no offload, live stream or
+ *          activity read, so the reset through the bootloader loses nothing the event store does not hold.
+ *
+ * @return true while the stage has flash work left or a swap waits.
+ */
+static bool fw_update_process(void)
+{
+    int8_t ret = fw_stage_process();
+
+    if (!fw_stage_swap_pending())
+    {
+        return ret > 0;
+    }
+    if (capture_recording() || m_commit.state != COMMIT_IDLE || !nrf_queue_is_empty(&m_commit_queue) ||
+        ble_ios_offload_active(&m_ios) || live_stream_active() || m_activity_read.active)
+    {
+        return true;
+    }
+    fw_stage_swap();
+    return false;
+}
+#endif
+
+
+/**@brief Function for running the self test of the sensors while the device is idle off the head.
+ *
+ * @details Held off until the proximity sensor is up. Idle is no commit, offload, live stream or activity read,
+ *          the test takes the pipeline from the trigger for a few seconds.
+ *
+ * @return true while a test runs.
+ */
+static bool self_test_step(void)
+{
+    bool idle;
+
+    if (!m_sensors_ready)
+    {
+        return false;
+    }
+    idle = m_commit.state == COMMIT_IDLE && !ble_ios_offload_active(&m_ios) && !live_stream_active() &&
+           !m_activity_read.active;
+    return self_test_process(idle, vcnl4040_is_worn());
+}
+
+
+/**@brief Function for starting the exposure session a central asked for and saving the lifetime exposure.
+ *
+ * @details Runs where the commits add to the exposure. The save is timed by the exposure timer, FDS writes the
+ *          record in the background.
+ */
+static void exposure_process(void)
+{
+    if (ble_ios_session_get(&m_ios))
+    {
+        exposure_stats_session_reset();
+        NRF_LOG_INFO("Exposure session started");
+    }
+    if (m_exposure_save_due)
+    {
+        m_exposure_save_due = false;
+        if (exposure_stats_save() < 0)
+        {
+            NRF_LOG_ERROR("Exposure not saved");
+        }
+    }
+}
+
+
+/**@brief Function for reading the activity log back to a central that wrote BLE_IOS_CMD_ACTIVITY.
+ *
+ * @details Each page goes out as a frame on the data characteristic between the live stream frames, an end frame
+ *          closes the read. The headers are read in bounded holds and not while a capture is committed. A frame
+ *          that can't go out (the central left or an offload started) ends the read.
+ */
+static void activity_read_process(void)
+{
+    activity_log_page_t page;
+    uint32_t            from_s;
+    int8_t              ret;
+
+    if (ble_ios_activity_get(&m_ios, &from_s))
+    {
+        activity_log_cursor_init(&m_activity_read.cursor, from_s);
+        m_activity_read.active = true;
+        m_activity_read.end_sent = false;
+        m_activity_read.pages = 0;
+        m_activity_read.frame_len = 0;
+    }
+    if (!m_activity_read.active)
+    {
+        return;
+    }
+
+    if (m_activity_read.frame_len == 0)
+    {
+        if (ble_ios_live_busy(&m_ios) || m_commit.state != COMMIT_IDLE)
+        {
+            return;
+        }
+        if (activity_log_cursor_done(&m_activity_read.cursor))
+        {
+            m_activity_read.frame_len = activity_log_frame(NULL, m_activity_read.frame);
+            m_activity_read.end_sent = true;
+        }
+        else
+        {
+            capture_flash_acquire();
+            ret = activity_log_cursor_next(&m_activity_read.cursor, &page);
+            capture_flash_release();
+            if (ret < 0)
+            {
+                NRF_LOG_ERROR("Activity log read failed");
+                m_activity_read.active = false;
+                return;
+            }
+            if (ret == 0)
+            {
+                return;
+            }
+            m_activity_read.frame_len = activity_log_frame(&page, m_activity_read.frame);
+        }
+    }
+
+    ret = ble_ios_live_send(&m_ios, m_activity_read.frame, m_activity_read.frame_len);
+    if (ret == -3)
+    {
+        return;
+    }
+    m_activity_read.frame_len = 0;
+    if (ret < 0)
+    {
+        NRF_LOG_WARNING("Activity log read stopped after %u pages", m_activity_read.pages);
+        m_activity_read.active = false;
+    }
+    else if (m_activity_read.end_sent)
+    {
+        NRF_LOG_INFO("Activity log read, %u pages", m_activity_read.pages);
+        m_activity_read.active = false;
+    }
+    else
+    {
+        m_activity_read.pages++;
+    }
+}
+
+
+/**@brief Function for setting the RTC to the time a central wrote to the offload control point.
+ *
+ * @details The control point is written in the BLE event interrupt, the i2c write waits for the bus here. The
+ *          time is kept until the RTC is configured.
+ */
+static void rtc_set_process(void)
+{
+    ds1388_data_t date;
+    uint32_t epoch;
+    uint8_t hundreth;
+
+    if (!m_sensors_ready || !ble_ios_time_get(&m_ios, &epoch, &hundreth))
+    {
+        return;
+    }
+    ds1388_from_epoch(epoch, &date);
+    date.hundreth = hundreth;
+    if (ds1388_set_time(&date) < 0)
+    {
+        NRF_LOG_ERROR("RTC set failed");
+        return;
+    }
+    // A rate fitted across the set would be the step, not the clock.
+    mono_time_anchor_reset();
+    rtc_anchor();
+    NRF_LOG_INFO("RTC set to %u", epoch);
+}
+
+
+/**@brief Function for switching to the sampling profile a central wrote to the offload control point.
+ *
+ * @details The switch waits for the end of an impact being recorded, the request is kept
+ *          until then. The profile is saved for the next boot once it runs.
+ */
+static void profile_set_process(void)
+{
+    static bool pending = false;
+    static uint8_t id;
+    sampling_profile_t const * p_profile;
+    int8_t ret;
+
+    if (ble_ios_profile_get(&m_ios, &id))
+    {
+        pending = true;
+    }
+    if (!pending)
+    {
+        return;
+    }
+    p_profile = sampling_profile_get((sampling_profile_id_t) id);
+    ret = capture_profile_set(p_profile);
+    if (ret == -3)
+    {
+        return;
+    }
+    pending = false;
+    if (ret < 0)
+    {
+        NRF_LOG_ERROR("Sampling profile %d refused (%d)", id, ret);
+        return;
+    }
+    if (sampling_profile_save((sampling_profile_id_t) id) < 0)
+    {
+        NRF_LOG_ERROR("Sampling profile not saved");
+    }
+    NRF_LOG_INFO("Sampling profile %s", p_profile->name);
+}
+
+
+/**@brief Function for initializing the log and the uart cli that prints it.
+ */
+static void log_init(void)
+{
+    ret_code_t err_code = NRF_LOG_INIT(app_timer_cnt_get);
+    APP_ERROR_CHECK(err_code);
+
+    nrf_drv_uart_config_t uart_config = NRF_DRV_UART_DEFAULT_CONFIG;
+    uart_config.pseltxd = TX_PIN_NUMBER;
+    uart_config.pselrxd = RX_PIN_NUMBER;
+    uart_config.hwfc    = NRF_UART_HWFC_DISABLED;
+    APP_ERROR_CHECK(nrf_cli_init(&m_cli_uart, &uart_config, true, true, NRF_LOG_SEVERITY_INFO));
+}
+
+
+/**@brief Function for handling a new battery reading.
+ *
+ * @details Called from the SAADC interrupt by the battery monitor, the advertising picks the level up
+ *          from the main loop. Only the crossings of the low battery threshold are logged.
+ */
+static void battery_handler(uint16_t mv, uint8_t percent)
+{
+    static bool low = false;
+
+    if (battery_monitor_low() == low)
+    {
+        return;
+    }
+    low = !low;
+    if (low)
+    {
+        NRF_LOG_WARNING("Battery low, %u mV %u%%.", mv, percent);
+    }
+    else
+    {
+        NRF_LOG_INFO("Battery recovered, %u mV %u%%.", mv, percent);
+    }
+}
+
+
+/**@brief Function for handling the radio notification.
+ *
+ * @details The active signal comes NRF_RADIO_NOTIFICATION_DISTANCE_800US ahead of each radio
+ *          event, the energy profiler trims that lead from the interval. The radio window follows
+ *          the events for the erase and commit steps and posts the ones held back as an event ends.
+ */
+static void radio_notification_handler(bool radio_active)
+{
+    radio_window_notify(radio_active);
+    if (radio_active)
+    {
+        ENERGY_ENTER(ENERGY_STATE_RADIO);
+    }
+    else
+    {
+        ENERGY_EXIT(ENERGY_STATE_RADIO);
+    }
+}
+
+
+/**@brief Function for initializing the radio notification the radio window and the energy profiler follow the radio with.
+ */
+static void radio_notification_init(void)
+{
+    ret_code_t err_code;
+
+    err_code = ble_radio_notification_init(APP_IRQ_PRIORITY_LOW, NRF_RADIO_NOTIFICATION_DISTANCE_800US,
+                                           radio_notification_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for initializing power management.
+ */
+static void power_management_init(void)
+{
+    ret_code_t err_code;
+    err_code = nrf_pwr_mgmt_init();
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for beating the radio stage of the watchdog once a pass of its loop, watched while it has
+ *        something to send.
+ */
+static void radio_stage_beat(void)
+{
+    bool active = ble_ios_offload_active(&m_ios) || live_stream_active() || m_activity_read.active;
+
+    WATCHDOG_BEAT(m_radio_stage);
+    if (active && !m_radio_stage.started)
+    {
+        watchdog_stage_start(&m_radio_stage);
+    }
+    else if (!active && m_radio_stage.started)
+    {
+        watchdog_stage_stop(&m_radio_stage);
+    }
+}
+
+
+/**@brief Function for the idle task, runs the scheduler, the start of the i2c sensors, the offload, the live stream, the activity log and its read and their connection parameters, the RTC set, the exposure, the self test, the i2c bus timeout and the log.
+ */
+static void idle_task(void * p_context)
+{
+    bool logged = false;
+
+    UNUSED_PARAMETER(p_context);
+
+    advertising_start();
+
+    for (;;)
+    {
+        CPU_LOAD_SCOPE(m_sched_load)
+        {
+            app_sched_execute();
+        }
+        (void) sensors_start_process();
+        CPU_LOAD_SCOPE(m_offload_load)
+        {
+            offload_process();
+        }
+#if ESB_OFFLOAD_ENABLED
+        esb_process();
+#endif
+        CPU_LOAD_SCOPE(m_stream_load)
+        {
+            live_stream_process();
+        }
+        CPU_LOAD_SCOPE(m_activity_load)
+        {
+            activity_process();
+        }
+        proximity_rate_process();
+        rtc_anchor_process();
+        exposure_process();
+        (void) self_test_step();
+        activity_read_process();
+        conn_params_process();
+        advertising_update();
+        advertising_directed_process();
+        advertising_policy_process();
+#if NFC_SUMMARY_ENABLED
+        nfc_update();
+#endif
+        rtc_set_process();
+        profile_set_process();
+#if FW_STAGE_ENABLED
+        (void) fw_update_process();
+#endif
+        radio_stage_beat();
+        twi_supervise();
+#if ENERGY_PROFILER_ENABLED
+        energy_profiler_process();
+#endif
+#if CPU_LOAD_ENABLED
+        cpu_load_process();
+#endif
+        CPU_LOAD_SCOPE(m_log_load)
+        {
+            logged = NRF_LOG_PROCESS();
+        }
+        if (logged == false)
+        {
+            ENERGY_EXIT(ENERGY_STATE_CPU);
+#if CPU_LOAD_ENABLED
+            cpu_load_sleep();
+#endif
+            nrf_pwr_mgmt_run();
+#if CPU_LOAD_ENABLED
+            cpu_load_wake();
+#endif
+            ENERGY_ENTER(ENERGY_STATE_CPU);
+        }
+        task_yield();
+    }
+}
+
+
+/**@brief Function for application main entry.
+ */
+int main(void)
+{
+    device_config_t const * p_config;
+    icm20649_data_t icm_bias;
+    icm20649_temp_comp_t icm_temp_comp;
+
+    //the main stack is painted before anything has run deep on it
+    stack_watch_init();
+    //first, the reset reason is cleared once read and the SoftDevice keeps POWER to itself
+    (void) boot_check_init();
+    //the code left in flash runs through the cache, the SoftDevice is not up to restrict the NVMC yet
+    profiler_icache_enable(PROFILER_ENABLED);
+
+    // Initialize.
+    timers_init();
+    log_init();
+    APP_SCHED_INIT(SCHED_MAX_EVENT_DATA_SIZE, SCHED_QUEUE_SIZE);
+    power_management_init();
+    ble_stack_init();
+    // The crystal runs only on request from here on, the SoftDevice starts it for the radio itself.
+    APP_ERROR_CHECK_BOOL(hf_clock_init() == 0);
+    // FDS writes through the SoftDevice, the device config is read before the sensors start.
+    APP_ERROR_CHECK_BOOL(exposure_stats_init() == 0);
+    APP_ERROR_CHECK_BOOL(self_test_init() == 0);
+    APP_ERROR_CHECK_BOOL(known_gateway_init() == 0);
+    if (device_config_init() < 0)
+    {
+        NRF_LOG_ERROR("Device config storage failed, defaults in use");
+    }
+    if (exposure_stats_load() < 0)
+    {
+        NRF_LOG_ERROR("Lifetime exposure not read, counting from zero");
+    }
+    if (self_test_load() < 0)
+    {
+        NRF_LOG_ERROR("Self test health not read, counting from zero");
+    }
+    if (known_gateway_load() < 0)
+    {
+        NRF_LOG_ERROR("Gateway address not read, advertising undirected only");
+    }
+    p_config = device_config_get();
+    if (adxl372_set_offset_trim(p_config->accel_offset) < 0)
+    {
+        NRF_LOG_ERROR("Accel offset trims out of range, defaults in use");
+    }
+    icm_bias.accel_x = p_config->icm_accel_bias[0];
+    icm_bias.accel_y = p_config->icm_accel_bias[1];
+    icm_bias.accel_z = p_config->icm_accel_bias[2];
+    icm_bias.gyro_x = p_config->icm_gyro_bias[0];
+    icm_bias.gyro_y = p_config->icm_gyro_bias[1];
+    icm_bias.gyro_z = p_config->icm_gyro_bias[2];
+    icm20649_set_bias(&icm_bias);
+    icm_temp_comp.ref_temp_cc = p_config->icm_bias_temp_cc;
+    memcpy(icm_temp_comp.gyro_slope, p_config->icm_gyro_temp_slope, sizeof(icm_temp_comp.gyro_slope));
+    icm20649_set_temp_comp(&icm_temp_comp);
+#if ENERGY_PROFILER_ENABLED
+    energy_profiler_init();
+#endif
+#if CPU_LOAD_ENABLED
+    cpu_load_init();
+#endif
+    radio_notification_init();
+    //the RTC of the battery monitor runs from the LFCLK the SoftDevice has started
+    if (battery_monitor_init(battery_handler) < 0)
+    {
+        APP_ERROR_HANDLER(NRF_ERROR_INTERNAL);
+    }
+    gap_params_init();
+    gatt_init();
+    services_init();
+#if FW_STAGE_ENABLED
+    // Bank 1 of the bootloader is the flash between the app and FDS, written through the SoftDevice too.
+    if (fw_stage_init() < 0)
+    {
+        NRF_LOG_ERROR("Firmware update storage failed, updates off");
+    }
+#endif
+#if SUMMARY_RELAY_ENABLED
+    relay_init();
+#endif
+    advertising_init();
+    conn_params_init();
+    APP_ERROR_CHECK(time_sync_scan_start(&m_time_sync));
+
+    // The replay times its stages with the cycle counter in every build.
+    profiler_init();
+    twi_init();
+    //the RTC and the proximity sensor start from the main loop, see sensors_start_thread
+    PT_INIT(&m_sensors_pt);
+    pipeline_stats_init(&m_pipeline_stats);
+    capture_init(&m_pipeline_stats, capture_open_handler, capture_done_handler, sampling_profile_get((sampling_profile_id_t) p_config->profile));
+    flash_init();
+    erase_kick();
+    //bus busy time from PPI gated timers, the accel and the flash share one SPIM
+    APP_ERROR_CHECK_BOOL(bus_stats_init() == 0);
+#if NFC_SUMMARY_ENABLED
+    //TIMER4 senses the NFC field, the tag publishes the status from here on
+    APP_ERROR_CHECK_BOOL(nfc_summary_init() == 0);
+#else
+    APP_ERROR_CHECK_BOOL(bus_stats_spim_add(BUS_STATS_ACCEL_FLASH, accel_spi.u.spim.p_reg) == 0);
+#endif
+#if !ESB_OFFLOAD_ENABLED
+    //their timers are ESB's in an image that has it
+    APP_ERROR_CHECK_BOOL(bus_stats_spim_add(BUS_STATS_GYRO, gyro_spi.u.spim.p_reg) == 0);
+    APP_ERROR_CHECK_BOOL(bus_stats_twim_add(BUS_STATS_TWI, NRFX_CONCAT_2(NRF_TWIM, TWI_INSTANCE_ID)) == 0);
+#endif
+
+    cli_capture_init(&m_pipeline_stats, &m_event_store, &m_time_sync);
+    APP_ERROR_CHECK(nrf_cli_task_create(&m_cli_uart));
+
+    // Start execution.
+    NRF_LOG_INFO("PCB Revision 1 impact capture started, %s profile.", capture_profile()->name);
+    capture_start();
+
+    task_manager_start(idle_task, NULL);
+}
+
+
+/**
+ * @}
+ */
@@ -0,0 +1,125 @@
+//-------------------------------------------
+// Title: sampling_profile.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: The sampling profiles of imu_pcb_rev1_app, the one in use is
+// kept over a reset by the device config record (device_config).
+//-------------------------------------------
+#include <string.h>
+#include "app_util.h"
+
+#include "sampling_profile.h"
+#include "capture.h"
+#include "impact_codec.h"
+#include "event_store.h"
+#include "device_config.h"
+
+static const sampling_profile_t m_profiles[SAMPLING_PROFILE_COUNT] = {
+    //the compile time window of capture.h, what tools/pipeline_sim runs
+    [SAMPLING_PROFILE_GAME] = {
+        .name = "game", .odr = ODR_6400HZ, .bandwidth = BW_3200HZ, .watermark = ADXL_FIFO_WATERMARK,
+        .filter = true, .threshold_mg = CAPTURE_THRESHOLD_MG, .threshold_max_mg = CAPTURE_THRESHOLD_MAX_MG,
+        .release_mg = IMPACT_RELEASE_G_THRESHOLD,
+        .min_duration_us = IMPACT_MIN_DURATION_US, .max_duration_ms = IMPACT_MAX_DURATION,
+        .quiet_ms = IMPACT_QUIET_MS, .pre_trigger_ms = PRE_TRIGGER_MS, .chain_ms = IMPACT_CHAIN_MS,
+        .encoding = IMPACT_CODEC_ENCODING, .icm = ICM20649_RATE_CONFIG_DEFAULT, .autorange = true,
+        .stamp = true,
+    },
+    [SAMPLING_PROFILE_PRACTICE] = {
+        .name = "practice", .odr = ODR_3200HZ, .bandwidth = BW_1600HZ, .watermark = ADXL_FIFO_WATERMARK,
+        .filter = false, .threshold_mg = 15000, .threshold_max_mg = 25000, .release_mg = 10000,
+        .min_duration_us = 600, .max_duration_ms = 120,
+        .quiet_ms = 10, .pre_trigger_ms = 20, .chain_ms = 20, .encoding = IMPACT_CODEC_ENCODING,
+        .icm = ICM20649_RATE_CONFIG_DEFAULT, .autorange = true, .stamp = true,
+    },
+    //the fifo fills from the watermark to full in 12.5 ms, as long as at 6400 Hz,
+    //the gyro is read once per 200 ms burst so it runs slow behind a 24 Hz low pass
+    [SAMPLING_PROFILE_LOW_POWER] = {
+        .name = "low-power", .odr = ODR_800HZ, .bandwidth = BW_400HZ, .watermark = 480,
+        .filter = false, .threshold_mg = 20000, .release_mg = 14000,
+        .min_duration_us = 2500, .max_duration_ms = 100,
+        .quiet_ms = 10, .pre_trigger_ms = 20, .chain_ms = 20, .encoding = IMPACT_CODEC_ENCODING,
+        .icm = {.gyro_div = 10, .gyro_dlpf = 4, .gyro_fs = ICM20649_GYRO_FS_2000DPS,
+                .accel_div = 10, .accel_dlpf = 4, .accel_fs = ICM20649_ACCEL_FS_30G},
+        .autorange = true,
+    },
+    //unfiltered records as read at fixed ranges, to compare against a reference sensor on a drop rig,
+    //one event per drop
+    [SAMPLING_PROFILE_LAB] = {
+        .name = "lab", .odr = ODR_6400HZ, .bandwidth = BW_3200HZ, .watermark = ADXL_FIFO_WATERMARK,
+        .filter = false, .threshold_mg = 5000, .release_mg = 3500,
+        .min_duration_us = IMPACT_MIN_DURATION_US, .max_duration_ms = IMPACT_MAX_DURATION,
+        .quiet_ms = 20, .pre_trigger_ms = PRE_TRIGGER_MS, .encoding = EVENT_STORE_ENCODING_RAW,
+        .icm = ICM20649_RATE_CONFIG_DEFAULT, .autorange = false, .stamp = true,
+    },
+    //the game trigger, a longer quiet keeps the hits of one collision or fall in one event
+    [SAMPLING_PROFILE_COLLISION] = {
+        .name = "collision", .odr = ODR_6400HZ, .bandwidth = BW_3200HZ, .watermark = ADXL_FIFO_WATERMARK,
+        .filter = true, .threshold_mg = CAPTURE_THRESHOLD_MG, .threshold_max_mg = CAPTURE_THRESHOLD_MAX_MG,
+        .release_mg = IMPACT_RELEASE_G_THRESHOLD,
+        .min_duration_us = IMPACT_MIN_DURATION_US, .max_duration_ms = 1000,
+        .quiet_ms = 100, .pre_trigger_ms = PRE_TRIGGER_MS, .chain_ms = IMPACT_CHAIN_MS,
+        .encoding = IMPACT_CODEC_ENCODING, .icm = ICM20649_RATE_CONFIG_DEFAULT, .autorange = true, .stream = true,
+        .stamp = true,
+    },
+};
+
+/*
+ * @return the profile, NULL if the id is invalid
+ */
+sampling_profile_t const *sampling_profile_get(sampling_profile_id_t id)
+{
+    return (id < SAMPLING_PROFILE_COUNT) ? &m_profiles[id] : NULL;
+}
+
+/*
+ * Looks a profile up by its name for the cli
+ * @return 0 if success, -2 if there is no such profile
+ */
+int8_t sampling_profile_find(char const *name, sampling_profile_id_t *p_id)
+{
+    for (int i = 0; i < SAMPLING_PROFILE_COUNT; ++i)
+    {
+        if (strcmp(name, m_profiles[i].name) == 0)
+        {
+            *p_id = (sampling_profile_id_t) i;
+            return 0;
+        }
+    }
+
+    return -2;
+}
+
+/*
+ * @return the adxl372 output data rate of the profile in Hz
+ */
+uint32_t sampling_profile_rate_hz(sampling_profile_t const *p_profile)
+{
+    return 400UL << p_profile->odr;
+}
+
+/*
+ * @return the samples of the profile in a time, rounded up
+ */
+uint32_t sampling_profile_samples(sampling_profile_t const *p_profile, uint32_t us)
+{
+    return (uint32_t) (((uint64_t) us*sampling_profile_rate_hz(p_profile) + 999999)/1000000);
+}
+
+/*
+ * Keeps the profile for the next boot in the device config, thread context.
+ * The write finishes in the background, a failed one only loses the choice
+ * over a reset
+ * @return 0 if the write is queued, -1 if FDS refused it, -2 if the id is invalid
+ */
+int8_t sampling_profile_save(sampling_profile_id_t id)
+{
+    device_config_t config = *device_config_get();
+
+    if (id >= SAMPLING_PROFILE_COUNT)
+        return -2;
+    if (config.profile == id && device_config_stored())
+        return 0;
+
+    config.profile = id;
+    return device_config_save(&config);
+}
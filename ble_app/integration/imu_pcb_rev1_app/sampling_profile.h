@@ -0,0 +1,76 @@
+#ifndef SAMPLING_PROFILE_H
+#define SAMPLING_PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "adxl372.h"
+#include "icm20649.h"
+
+/* Named sets of the adxl372 rate, bandwidth and fifo watermark, the icm20649
+ * rates and low pass filters, the trigger
+ * and capture window and the storage format of the events, switched at run
+ * time from the cli or the control point of the Impact Offload Service.
+ * Record deltas keep counting periods of SAMPLING_PROFILE_BASE_HZ whatever the
+ * rate, so the metrics and tools/offload_decode time a slower profile's events
+ * without a format change: a rate has to be above base / IMPACT_RECORD_DELTA_GAP,
+ * the delta that marks lost samples.
+ * The profile trades the icm20649 rates and low pass for noise against the
+ * once a burst read and starts from its ranges. With autorange the capture
+ * steps them up after an impact that saturated them and down after one that
+ * used little of them, the records keep raw counts and the event carries the
+ * ranges they were read at in its encoding (impact_codec_encoding()).
+ * The trigger of a profile with threshold_max_mg follows the activity
+ * between the impacts (impact_trigger_adapt_set()), so a running drill does
+ * not fill the flash with foot strikes, and comes back to threshold_mg at rest.
+ * The CFC 1000 low pass is only defined at 6400 Hz, a slower profile relies on
+ * the adxl372 bandwidth alone. A profile with stream set has its captures
+ * stored while they record, its window is then bounded by the flash rather
+ * than the record pool. A profile with stamp set keeps the watermark
+ * interrupt on a GPIOTE IN channel to time its samples to the edge
+ * (TRIGGER_STAMP_ENABLED), one without leaves it on the PORT event that draws
+ * next to nothing, its events are timed to the burst. The profile in use is kept in the device config
+ * record (device_config) and comes back at boot, the game profile until one
+ * has been saved */
+#define SAMPLING_PROFILE_BASE_HZ        6400    //unit of the record deltas, ACCEL_FILTER_RATE_HZ
+
+typedef enum {
+    SAMPLING_PROFILE_GAME = 0,      //full rate and the CFC 1000 low pass, coded
+    SAMPLING_PROFILE_PRACTICE,      //half rate, only the harder hits
+    SAMPLING_PROFILE_LOW_POWER,     //800 Hz and long fifo bursts, severe hits only
+    SAMPLING_PROFILE_LAB,           //full rate unfiltered, low threshold, raw records
+    SAMPLING_PROFILE_COLLISION,     //game rate streamed to the flash, a second for multi hit collisions and falls
+    SAMPLING_PROFILE_COUNT
+} sampling_profile_id_t;
+
+typedef struct {
+    char const *name;
+    adxl372_odr_t odr;
+    adxl372_bw_t bandwidth;         //at most half the rate
+    uint16_t watermark;             //fifo entries, 3 per xyz sample, capture retunes it from the drain times
+    bool filter;                    //CFC 1000 low pass, 6400 Hz only
+    uint16_t threshold_mg;          //resultant that starts an impact
+    uint16_t threshold_max_mg;      //the trigger raises it up to this with the activity between impacts, 0 keeps it fixed
+    uint16_t release_mg;            //hysteresis below the threshold
+    uint16_t min_duration_us;       //above release this long to trigger
+    uint16_t max_duration_ms;       //a capture is cut off after this long
+    uint16_t quiet_ms;              //below release this long ends a capture
+    uint16_t pre_trigger_ms;        //kept before the trigger
+    uint16_t chain_ms;              //a trigger this soon after the quiet end extends the capture, at most pre_trigger_ms
+    uint16_t encoding;              //IMPACT_CODEC_ENCODING or EVENT_STORE_ENCODING_RAW
+    icm20649_rate_config_t icm;     //gyro and accel rate, low pass and starting ranges
+    bool autorange;                 //the icm20649 ranges follow the impacts
+    bool stream;                    //captures are stored while they record
+    bool stamp;                     //samples are timed to the latched watermark edges, INT1 on a GPIOTE IN channel
+} sampling_profile_t;
+
+sampling_profile_t const *sampling_profile_get(sampling_profile_id_t id);
+
+int8_t sampling_profile_find(char const *name, sampling_profile_id_t *p_id);
+
+uint32_t sampling_profile_rate_hz(sampling_profile_t const *p_profile);
+
+uint32_t sampling_profile_samples(sampling_profile_t const *p_profile, uint32_t us);
+
+int8_t sampling_profile_save(sampling_profile_id_t id);
+
+#endif //SAMPLING_PROFILE_H
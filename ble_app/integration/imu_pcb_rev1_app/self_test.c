@@ -0,0 +1,396 @@
+//-------------------------------------------
+// Title: self_test.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Background self test of the adxl372 and the icm20649 while
+// the helmet is idle off the head, see self_test.h. One run is a protothread
+// stepped from the storage loop: means with the tests off, on and off again,
+// then the verdict, its log line and the FDS health record.
+//-------------------------------------------
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fds.h"
+#include "app_timer.h"
+#include "app_util.h"
+#include "nrf_pt.h"
+#include "nrf_log.h"
+
+#include "self_test.h"
+#include "capture.h"
+#include "sampling_profile.h"
+#include "mono_time.h"
+
+#define SELF_TEST_RECORD_WORDS  BYTES_TO_WORDS(sizeof(self_test_health_t))
+#define SELF_TEST_WAITING       1   //self_test_measure() has not got its reads yet
+
+/* icm20649 means of one phase, accel x y z then gyro x y z */
+typedef struct {
+    int32_t axis[6];
+} self_test_mean_t;
+
+static self_test_health_t m_health = {
+    .version = SELF_TEST_VERSION,
+    .size = sizeof(self_test_health_t),
+};
+static uint32_t m_saved[SELF_TEST_RECORD_WORDS];    //FDS reads the data until the write completes
+static volatile bool m_fds_ready = false;
+static volatile bool m_save_retry = false;          //the write is redone once the garbage collection is done
+
+static pt_t m_pt;
+static bool m_running = false;
+static bool m_requested = false;    //from the cli, runs at the next idle pass worn or not
+static bool m_ran = false;          //a run finished since the boot
+static uint64_t m_idle_since_us;    //mono_time_us() the device went idle off the head
+static uint64_t m_last_us;          //of the last run that finished
+static sampling_profile_t const *m_restore;
+static bool m_enabled;              //the tests are on
+static uint32_t m_start;            //app timer count of the phase
+static uint32_t m_st_start;         //of the switch on, the adxl372 test runs from there
+static int8_t m_ret;
+static self_test_mean_t m_off[2];
+static self_test_mean_t m_on;
+static icm20649_data_t m_expected;
+static bool m_adxl_done;
+static bool m_adxl_pass;
+
+static ret_code_t self_test_write(void);
+
+static void fds_evt_handler(fds_evt_t const * p_evt)
+{
+    switch (p_evt->id)
+    {
+        case FDS_EVT_INIT:
+            m_fds_ready = (p_evt->result == FDS_SUCCESS);
+            break;
+
+        case FDS_EVT_GC:
+            if (m_save_retry)
+            {
+                m_save_retry = false;
+                (void) self_test_write();
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Writes m_saved over the health record, or a new one if there is none,
+// returns FDS_SUCCESS if the write or the garbage collection before it is queued
+static ret_code_t self_test_write(void)
+{
+    fds_record_t const record = {
+        .file_id = SELF_TEST_FILE_ID,
+        .key = SELF_TEST_RECORD_KEY,
+        .data = {.p_data = m_saved, .length_words = SELF_TEST_RECORD_WORDS},
+    };
+    fds_record_desc_t desc;
+    fds_find_token_t token;
+    ret_code_t err_code;
+
+    memset(&token, 0, sizeof(token));
+    if (fds_record_find(SELF_TEST_FILE_ID, SELF_TEST_RECORD_KEY, &desc, &token) == FDS_SUCCESS)
+        err_code = fds_record_update(&desc, &record);
+    else
+        err_code = fds_record_write(NULL, &record);
+    if (err_code == FDS_ERR_NO_SPACE_IN_FLASH && !m_save_retry)
+    {
+        err_code = fds_gc();
+        m_save_retry = (err_code == FDS_SUCCESS);
+    }
+
+    return err_code;
+}
+
+static uint32_t self_test_inc32(uint32_t count)
+{
+    return (count < UINT32_MAX) ? count + 1 : count;
+}
+
+// Takes the icm20649 means once SELF_TEST_ICM_READS reads were summed since the
+// last restart of the sums, returns SELF_TEST_WAITING until then, 0 or -1 on a timeout
+static int8_t self_test_measure(self_test_mean_t *p_mean)
+{
+    capture_calibration_t sums;
+
+    capture_calibrate_sums(&sums);
+    if (sums.gyro_samples < SELF_TEST_ICM_READS)
+        return (capture_since_us(m_start) > SELF_TEST_MEASURE_TIMEOUT_MS*1000UL) ? -1 : SELF_TEST_WAITING;
+
+    for (int j = 0; j < 3; ++j)
+    {
+        p_mean->axis[j] = sums.icm_accel_sum[j] / (int32_t) sums.gyro_samples;
+        p_mean->axis[3 + j] = sums.gyro_sum[j] / (int32_t) sums.gyro_samples;
+    }
+    return 0;
+}
+
+// Switches the tests and starts the settle of the outputs, -1 on a bus error
+static int8_t self_test_switch(bool enable)
+{
+    int8_t ret = capture_calibrate_self_test(enable, enable ? &m_expected : NULL);
+
+    m_enabled = enable;
+    m_start = app_timer_cnt_get();
+    return (ret < 0) ? -1 : 0;
+}
+
+// Hands the pipeline back to the capture in the profile it ran, whatever
+// the run got to
+static void self_test_end(void)
+{
+    if (m_enabled)
+        (void) self_test_switch(false);
+    capture_calibrate_end();
+    (void) capture_profile_set(m_restore);
+}
+
+// The verdict of a run whose means are in, -4 if the helmet moved
+static int8_t self_test_judge(self_test_result_t *p_result)
+{
+    int16_t const *p_expected = &m_expected.accel_x;
+    int32_t off, response, expected;
+    uint64_t wall_us;
+
+    memset(p_result, 0, sizeof(*p_result));
+    if (mono_time_wall_us(mono_time_us(), &wall_us) == 0)
+        p_result->time_s = (uint32_t) (wall_us / 1000000);
+    if (m_adxl_done)
+        p_result->flags |= SELF_TEST_ADXL_DONE;
+    if (m_adxl_done && m_adxl_pass)
+        p_result->flags |= SELF_TEST_ADXL_PASS;
+
+    for (int i = 0; i < 6; ++i)
+    {
+        expected = p_expected[i];
+        p_result->expected[i] = (int16_t) expected;
+        off = (m_off[0].axis[i] + m_off[1].axis[i]) / 2;
+        response = abs(m_on.axis[i] - off);
+        p_result->response[i] = (int16_t) MIN(response, INT16_MAX);
+        //an axis without a factory code has nothing to be held to
+        if (expected == 0)
+            continue;
+        if (abs(m_off[0].axis[i] - m_off[1].axis[i])*100 > expected*SELF_TEST_MOVED_PCT)
+            return -4;
+        if (response*100 < expected*((i < 3) ? SELF_TEST_ACCEL_MIN_PCT : SELF_TEST_GYRO_MIN_PCT)
+            || (i < 3 && response*100 > expected*SELF_TEST_ACCEL_MAX_PCT))
+        {
+            p_result->icm_failed |= 1U << i;
+        }
+    }
+    if (p_result->icm_failed == 0)
+        p_result->flags |= SELF_TEST_ICM_PASS;
+    return 0;
+}
+
+// Counts a finished run into the health record and saves it
+static void self_test_record(self_test_result_t const *p_result)
+{
+    bool adxl_ok = (p_result->flags & SELF_TEST_ADXL_PASS) != 0;
+    bool icm_ok = (p_result->flags & SELF_TEST_ICM_PASS) != 0;
+
+    m_health.runs = self_test_inc32(m_health.runs);
+    if (!adxl_ok)
+        m_health.adxl_fails = self_test_inc32(m_health.adxl_fails);
+    if (!icm_ok)
+        m_health.icm_fails = self_test_inc32(m_health.icm_fails);
+    m_health.last = *p_result;
+    if (adxl_ok && icm_ok)
+    {
+        NRF_LOG_INFO("Self test passed");
+    }
+    else
+    {
+        m_health.last_fail = *p_result;
+        NRF_LOG_ERROR("Self test failed: adxl372 %s, icm20649 axes 0x%02x",
+                      adxl_ok ? "ok" : (p_result->flags & SELF_TEST_ADXL_DONE) ? "out of limits" : "did not finish",
+                      p_result->icm_failed);
+    }
+
+    if (m_fds_ready)
+    {
+        memcpy(m_saved, &m_health, sizeof(m_health));
+        if (self_test_write() != FDS_SUCCESS)
+            NRF_LOG_ERROR("Self test health not saved");
+    }
+}
+
+// One run, the pipeline is the test's from the begin to self_test_end()
+static PT_THREAD(self_test_thread(pt_t * pt))
+{
+    self_test_result_t result;
+
+    PT_BEGIN(pt);
+    UNUSED_VARIABLE(PT_YIELD_FLAG);
+
+    m_enabled = false;
+    m_restore = capture_profile();
+    if (capture_profile_set(sampling_profile_get(SAMPLING_PROFILE_GAME)) < 0)
+    {
+        m_ret = -3;
+        PT_EXIT(pt);
+    }
+    if (capture_calibrate_begin() < 0)
+    {
+        (void) capture_profile_set(m_restore);
+        m_ret = -3;
+        PT_EXIT(pt);
+    }
+
+    //the tests off, on and off again, the outputs settle from each switch before their sums start
+    m_start = app_timer_cnt_get();
+    PT_WAIT_UNTIL(pt, (m_ret = self_test_measure(&m_off[0])) != SELF_TEST_WAITING);
+    if (m_ret == 0)
+    {
+        m_ret = self_test_switch(true);
+        m_st_start = m_start;
+    }
+    if (m_ret < 0)
+    {
+        self_test_end();
+        PT_EXIT(pt);
+    }
+    PT_WAIT_UNTIL(pt, capture_since_us(m_start) >= ICM20649_SELF_TEST_SETTLE_MS*1000UL);
+    capture_calibrate_restart();
+    m_start = app_timer_cnt_get();
+    PT_WAIT_UNTIL(pt, (m_ret = self_test_measure(&m_on)) != SELF_TEST_WAITING);
+    //the adxl372 test ends on its own, a read error reads as not done
+    m_adxl_done = false;
+    PT_WAIT_UNTIL(pt, m_ret < 0 || adxl372_self_test_result(&m_adxl_done, &m_adxl_pass) < 0 || m_adxl_done
+                      || capture_since_us(m_st_start) > 3*ADXL372_SELF_TEST_MS*1000UL);
+    if (m_ret == 0)
+        m_ret = self_test_switch(false);
+    if (m_ret < 0)
+    {
+        self_test_end();
+        PT_EXIT(pt);
+    }
+    PT_WAIT_UNTIL(pt, capture_since_us(m_start) >= ICM20649_SELF_TEST_SETTLE_MS*1000UL);
+    capture_calibrate_restart();
+    m_start = app_timer_cnt_get();
+    PT_WAIT_UNTIL(pt, (m_ret = self_test_measure(&m_off[1])) != SELF_TEST_WAITING);
+    self_test_end();
+    if (m_ret < 0)
+        PT_EXIT(pt);
+
+    m_ret = self_test_judge(&result);
+    if (m_ret == 0)
+        self_test_record(&result);
+
+    PT_END(pt);
+}
+
+/*
+ * Registers with FDS, before device_config_init() mounts it
+ * @return 0 if success, -1 if FDS is out of users
+ */
+int8_t self_test_init(void)
+{
+    return (fds_register(fds_evt_handler) == FDS_SUCCESS) ? 0 : -1;
+}
+
+/*
+ * Reads the health record, after device_config_init(). A record of another
+ * version is dropped and the counts start from zero
+ * @return 0 if success or there is no record, -1 if FDS is not mounted
+ */
+int8_t self_test_load(void)
+{
+    fds_flash_record_t flash_record;
+    fds_record_desc_t desc;
+    fds_find_token_t token;
+    self_test_health_t const *p_stored;
+    uint32_t size;
+
+    if (!m_fds_ready)
+        return -1;
+
+    memset(&token, 0, sizeof(token));
+    if (fds_record_find(SELF_TEST_FILE_ID, SELF_TEST_RECORD_KEY, &desc, &token) != FDS_SUCCESS)
+        return 0;
+    if (fds_record_open(&desc, &flash_record) != FDS_SUCCESS)
+        return 0;
+    p_stored = (self_test_health_t const *) flash_record.p_data;
+    size = flash_record.p_header->length_words*sizeof(uint32_t);
+    if (size >= offsetof(self_test_health_t, runs) && p_stored->version == SELF_TEST_VERSION)
+    {
+        size = MIN(MIN(size, p_stored->size), sizeof(self_test_health_t)) - offsetof(self_test_health_t, runs);
+        memcpy(&m_health.runs, &p_stored->runs, size);
+    }
+    (void) fds_record_close(&desc);
+
+    return 0;
+}
+
+/*
+ * Starts a run once it is due or steps the one running, thread context, once
+ * per pass of the storage loop
+ * @param idle - no commit, offload, live stream or activity read
+ * @param worn - the proximity sensor sees the head
+ * @return true while a run is in progress, the loop polls it meanwhile
+ */
+bool self_test_process(bool idle, bool worn)
+{
+    uint64_t now_us = mono_time_us();
+
+    if (m_running)
+    {
+        if (PT_SCHEDULE(self_test_thread(&m_pt)))
+            return true;
+        m_running = false;
+        //a run that met a capture or a moving helmet waits for the next quiet spell
+        if (m_ret == -3 || m_ret == -4)
+        {
+            m_health.dropped = self_test_inc32(m_health.dropped);
+            m_idle_since_us = now_us;
+            return false;
+        }
+        if (m_ret < 0)
+            m_health.dropped = self_test_inc32(m_health.dropped);
+        m_ran = true;
+        m_last_us = now_us;
+        return false;
+    }
+
+    if (!idle || (worn && !m_requested))
+    {
+        m_idle_since_us = now_us;
+        return false;
+    }
+    if (!m_requested && (now_us - m_idle_since_us < SELF_TEST_OFF_HEAD_S*1000000ULL
+                         || (m_ran && now_us - m_last_us < SELF_TEST_PERIOD_S*1000000ULL)))
+    {
+        return false;
+    }
+
+    m_requested = false;
+    m_running = true;
+    m_ret = 0;
+    PT_INIT(&m_pt);
+    return true;
+}
+
+/*
+ * Runs a test at the next idle pass of self_test_process(), worn or not
+ */
+void self_test_request(void)
+{
+    m_requested = true;
+}
+
+/*
+ * @return true while a run holds the pipeline or waits for its start
+ */
+bool self_test_running(void)
+{
+    return m_running || m_requested;
+}
+
+/*
+ * @return the counts and the last results, as kept in the health record
+ */
+self_test_health_t const *self_test_health(void)
+{
+    return &m_health;
+}
@@ -0,0 +1,79 @@
+#ifndef SELF_TEST_H
+#define SELF_TEST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Background self test of imu_pcb_rev1_app, the built in tests of the
+ * sensors run in the field instead of the id and register checks of
+ * adxl372_test() and icm20649_test() at boot, so a part that degrades is
+ * found before it misses an impact, without a boot delay and never during
+ * play. self_test_process() is called from the storage loop with whether the
+ * device is idle (no commit, offload, stream or activity read) and worn; a
+ * test starts once the device was idle and off the head for
+ * SELF_TEST_OFF_HEAD_S, first after the boot and then every
+ * SELF_TEST_PERIOD_S. There is no charger sense on the board, off the head
+ * and idle stands for docked. It runs through the calibration sums of the
+ * capture (capture_calibrate_begin) in the game profile, the adxl372 test
+ * needs full bandwidth measurement, for a few seconds; no impact is captured
+ * meanwhile, as in a calibration.
+ * The adxl372 checks its own response (SELF_TEST). The icm20649 response is
+ * the mean of its outputs with the test on less the mean of those before and
+ * after, against the response of its factory codes
+ * (icm20649_self_test_expected): the accel passes between 50 and 150 % of it
+ * and the gyro above 50 %, the InvenSense limits. Means before and after that
+ * differ by more than SELF_TEST_MOVED_PCT of the response, or a capture that
+ * holds the pipeline, drop the run and it is tried again after the next wait
+ * off the head. Each run is logged and kept with the counts in one FDS
+ * record, the health record the cli prints, registered before
+ * device_config_init() like exposure_stats */
+#define SELF_TEST_FILE_ID           0x5354  //FDS file of the health record
+#define SELF_TEST_RECORD_KEY        0x0001
+#define SELF_TEST_VERSION           1
+#define SELF_TEST_OFF_HEAD_S        300     //idle and not worn this long before a run
+#define SELF_TEST_PERIOD_S          86400   //between two runs that finished
+#define SELF_TEST_ICM_READS         32      //icm20649 reads per mean, one per fifo burst
+#define SELF_TEST_MEASURE_TIMEOUT_MS 5000
+#define SELF_TEST_MOVED_PCT         25
+#define SELF_TEST_ACCEL_MIN_PCT     50
+#define SELF_TEST_ACCEL_MAX_PCT     150
+#define SELF_TEST_GYRO_MIN_PCT      50
+
+/* self_test_result_t flags */
+#define SELF_TEST_ADXL_DONE         0x01    //the adxl372 test ran to its end
+#define SELF_TEST_ADXL_PASS         0x02
+#define SELF_TEST_ICM_PASS          0x04    //every icm20649 axis with a factory code
+
+typedef struct {
+    uint32_t time_s;                //epoch of the run, 0 without the rtc
+    uint8_t flags;
+    uint8_t icm_failed;             //bit per axis, accel x y z then gyro x y z
+    uint16_t reserved;
+    int16_t response[6];            //icm20649 counts at the ranges in use, accel then gyro
+    int16_t expected[6];            //of the factory codes, 0 for an axis without one
+} self_test_result_t;
+
+typedef struct {
+    uint16_t version;               //SELF_TEST_VERSION
+    uint16_t size;                  //bytes of the struct
+    uint32_t runs;                  //that finished
+    uint32_t adxl_fails;
+    uint32_t icm_fails;
+    uint32_t dropped;               //the helmet moved, a capture held the pipeline or a bus error
+    self_test_result_t last;
+    self_test_result_t last_fail;   //time_s 0 and no flags if none failed
+} self_test_health_t;
+
+int8_t self_test_init(void);
+
+int8_t self_test_load(void);
+
+bool self_test_process(bool idle, bool worn);
+
+void self_test_request(void);
+
+bool self_test_running(void);
+
+self_test_health_t const *self_test_health(void);
+
+#endif //SELF_TEST_H
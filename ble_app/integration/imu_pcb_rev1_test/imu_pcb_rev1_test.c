@@ -7,15 +7,53 @@
 // and configure them to their default states
 // note: the flash memory is cleared first on startup
 // high impact storage mode
-// 1. Proximity sensor detection
+// 1. Proximity sensor detection, the vcnl4040 PS_THDH/PS_THDL interrupt
+// signals helmet on and off so sampling only runs while it is worn
+// While off head the icm20649 sleeps and the adxl372 drops to wake up mode
 // 2. high impact detection
 // 3. Store a separate impact events to flash
 // 4. Serially outputs the impact data via physical UART connection
 // 
+// By default the adxl372 streams into its fifo and INT1 wakes the cpu on the
+// fifo watermark so a whole burst is drained at once (USE_ADXL_FIFO_INT_MODE)
+// the last PRE_TRIGGER_MS of samples are kept in a ring buffer and stored
+// in front of every impact so the onset is not lost
+// With USE_ACTIVITY_WAKEUP the adxl372 rests in instant on mode and its
+// activity interrupt (INT2) wakes the cpu from System ON sleep to start sampling.
+// The wake up reads the MAXPEAK of the hit, which the fifo only sees once the
+// filters settled, and drains the first samples without the watermark; the gap
+// from the edge to them is timed and a hit over the trigger before them counted
+// With USE_TIERED_TRIGGER a moderate hit only wakes it for a summary record of
+// its peak, the activity2 threshold escalates to the full capture with the gyro
+// With USE_ADXL_AUTOSLEEP the adxl372 rests on its own instead: looped activity and
+// inactivity detection drop it to wake up mode after a quiet spell and bring it back
+// on activity, the cpu sleeps while its AWAKE pin (INT2) is low
+// With USE_GYRO_DUTY_CYCLE the icm20649 rests too, accel only and duty cycled, the
+// activity that ends a rest turns the gyro back on
+// With USE_DEEP_SLEEP the board enters System OFF after DEEP_SLEEP_OFF_HEAD_MS
+// off head, the vcnl4040 close interrupt wakes it with a warm boot
+// 
+// The device moves through OFF_HEAD, ARMED, CAPTURING, COMMITTING and OFFLOADING
+// (device_state_t) and the cpu sleeps in nrf_pwr_mgmt_run() between events
+// The state changes and errors of the sampling and commit paths go to the binary
+// trace (libraries/trace) instead of the log, drained over RTT before each sleep
+// 
+// With USE_SUMMARY_LOG_MODE it only logs the per window peaks, hit counts and
+// cumulative exposure from the adxl372 peak detect fifo all session long
+// 
+// With USE_TRIGGERED_FIFO_MODE the adxl372 holds the impact window in its own
+// fifo (triggered mode): the samples before its activity event and the ones
+// after it, so the cpu and the spi bus stay idle until an impact and the fifo
+// is drained once per event
+// 
 // This program can also run in continuous sampling mode by uncomment USE_CONT_SAMPLE_MODE
 // Continuous sampling mode
-// 1. samples accel, gyro, proximity, and rtc sensors
-// 2. Does not use flash
+// 1. drains the adxl372 fifo on its watermark at CONT_SAMPLE_RATE_HZ and reads the
+// icm20649 once per burst
+// 2. decimates the accel to CONT_STREAM_RATE_HZ with accel_decimate and sends it with
+// the gyro in live_stream frames
+// over the uart as serial_offload frames for tools/offload_decode (USE_BINARY_OFFLOAD)
+// 3. Does not use flash or the proximity sensor, it streams until reset
 // 
 //-------------------------------------------
 
@@ -34,14 +72,42 @@
 
 //sensor drivers
 #include "spi_driver.h"
+#include "twi_driver.h"
 #include "adxl372.h"
 #include "icm20649.h"
 #include "vcnl4040.h"
 #include "ds1388.h"
 #include "mt25ql256aba.h"
+#include "sample_ring.h"
+#include "imu_sampler.h"
+#include "event_store.h"
+#include "impact_record.h"
+#include "impact_codec.h"
+#include "record_reader.h"
+#include "impact_metrics.h"
+#include "accel_filter.h"
+#include "impact_trigger.h"
+#include "imu_align.h"
+#include "accel_fusion.h"
+#include "timebase.h"
+#include "ahrs.h"
+#include "impact_location.h"
+#include "summary_log.h"
+#include "sample_clock.h"
+#include "serial_offload.h"
+#include "accel_decimate.h"
+#include "live_stream.h"
+#include "profiler.h"
+#include "trace.h"
+#include "pipeline_stats.h"
+#include "boot_check.h"
+#include "sensor_health.h"
+#include "deep_sleep.h"
+#include "factory_test.h"
 
 //app_timer
 #include "app_timer.h"
+#include "nrf_pwr_mgmt.h"
 #include "nrf_drv_clock.h"
 
 
@@ -53,31 +119,422 @@
 //for error logging
 #include "app_error.h"
 
-//Uncomment to use continuous sampling mode and disable impact storage mode
+//Uncomment to use continuous sampling mode and disable impact storage mode, the
+//samples are streamed as binary frames (requires USE_ADXL_FIFO_INT_MODE and USE_BINARY_OFFLOAD)
 //#define USE_CONT_SAMPLE_MODE
 
-//keep in small since there is limited ram space
-#define MAX_SAMPLE_BUF_LENGTH 500 
-#define IMPACT_G_THRESHOLD 10000 //in milli-g's
-#define IMPACT_DURATION 100 //in milliseconds
+//Uncomment to log one summary_log record per SUMMARY_WINDOW_S instead of capturing the
+//impacts at full rate, a few bytes of flash per window and the cpu sleeps in between
+//(requires USE_ADXL_FIFO_INT_MODE)
+//#define USE_SUMMARY_LOG_MODE
 
-typedef struct{
-    adxl372_accel_data_t adxl_data;
-    icm20649_data_t icm_data;
-    ds1388_data_t ds_data;
-    uint8_t padding[6]; //to align with 32byte
-}impact_sample_t;
+//Uncomment to let the adxl372 fifo hold each impact window in triggered mode instead of
+//draining every watermark into the pre-trigger ring, the window is the fifo, about 27 ms
+//at 6400 Hz with TRIGGERED_PRE_MS of it before the activity (requires USE_ADXL_FIFO_INT_MODE)
+//#define USE_TRIGGERED_FIFO_MODE
+
+//Comment out to poll adxl372_get_accel_data() for every sample instead of
+//draining the adxl372 fifo on its watermark interrupt
+#define USE_ADXL_FIFO_INT_MODE
+
+//Comment out to read the icm20649 data registers once per adxl372 fifo burst
+//instead of draining every icm20649 sample from its fifo (requires USE_ADXL_FIFO_INT_MODE)
+#define USE_ICM_FIFO
+
+//Comment out to keep the adxl372 streaming at full bandwidth between impacts
+//instead of resting in ADXL_REST_MODE until activity (requires USE_ADXL_FIFO_INT_MODE)
+#define USE_ACTIVITY_WAKEUP
+
+//Comment out to read the polled samples back to back as fast as the spi allows
+//instead of at SAMPLE_CLOCK_HZ from the TIMER+PPI sample clock (only without USE_ADXL_FIFO_INT_MODE,
+//the fifo is already filled at the adxl372 output data rate)
+#define USE_SAMPLE_CLOCK
+
+//Uncomment to clock the adxl372 conversions from the sample clock instead of its own
+//oscillator: the timer drives ADXL_INT2_PIN as the adxl372 external sync at SAMPLE_CLOCK_HZ,
+//half a period ahead of each clocked read, so every accel read is a fresh sample taken
+//on the nRF52 clock like the gyro read beside it (requires USE_SAMPLE_CLOCK without
+//USE_ADXL_FIFO_INT_MODE, INT2 is then an input of the adxl372)
+//#define USE_ADXL_EXT_SYNC
+
+//Comment out to skip timing the accel and gyro burst reads at each bus frequency on startup
+#define SPI_THROUGHPUT_REPORT
+
+//Comment out to store the packed impact records as they are instead of
+//delta coding them with impact_codec before they are written to flash
+#define USE_SAMPLE_COMPRESSION
+
+//Comment out to keep the raw adxl372 samples instead of running each fifo burst
+//through the CFC 1000 accel_filter low pass before the trigger sees it (requires USE_ADXL_FIFO_INT_MODE)
+#define USE_ACCEL_FILTER
+
+//Comment out to skip tracking the icm20649 orientation between impacts and storing
+//the quaternion at the trigger in the event header (requires USE_ICM_FIFO). Built with
+//make ICM_DMP_IMAGE=<file> (USE_ICM_DMP) the icm20649 DMP tracks it instead of ahrs on
+//the cpu, the file defines icm20649_dmp_image[] and icm20649_dmp_image_size from the
+//InvenSense DMP3 image, which is licensed and not in the repo
+#define USE_ORIENTATION
+
+//Uncomment to store the fused accel_fusion channel in the icm20649 accel fields of the
+//records instead of the icm20649 counts: the icm20649 below its clip, the adxl372 mapped
+//onto it above, blended between the two. The adxl372 fields are kept for the trigger and
+//the metrics (requires USE_ICM_FIFO, a sample of both sensors for every record)
+//#define USE_FUSED_ACCEL
+
+//Comment out to stay in System ON sleep while off head instead of entering System OFF
+//after DEEP_SLEEP_OFF_HEAD_MS, the event store and the counters are kept in retained ram
+#define USE_DEEP_SLEEP
+
+//Uncomment to rest on two adxl372 thresholds: the activity one (TIER_SUMMARY_G_THRESHOLD)
+//wakes a summary tier that leaves the gyro unread and only logs the peak of the hit as a
+//summary_log record, the activity2 one (IMPACT_G_THRESHOLD) escalates the wake up to the
+//full capture and flash commit (requires USE_ACTIVITY_WAKEUP)
+//#define USE_TIERED_TRIGGER
+
+//Uncomment to let the adxl372 manage its own power instead of USE_ACTIVITY_WAKEUP: it
+//drops to wake up mode after AUTOSLEEP_INACT_MS below AUTOSLEEP_INACT_G_THRESHOLD and
+//goes back to full bandwidth above AUTOSLEEP_ACT_G_THRESHOLD, the cpu is not polling
+//it in between. A hit that wakes it is only seen from the full rate on (requires USE_ADXL_FIFO_INT_MODE)
+//#define USE_ADXL_AUTOSLEEP
+
+//Uncomment to keep the icm20649 accel only and duty cycled while the adxl372 rests. The
+//activity that ends a rest (the summary tier with USE_TIERED_TRIGGER) turns the gyro back
+//on, the records keep a zero gyro until its start up, timed once at boot, is over. The
+//icm20649 INT pin is not routed on rev1, its own wake on motion can't wake the cpu
+//(requires USE_ACTIVITY_WAKEUP, no USE_ORIENTATION between impacts)
+//#define USE_GYRO_DUTY_CYCLE
+
+//Uncomment to run the full sensor self tests on every boot instead of only after
+//power-on, a watchdog or lockup reset, warm boots otherwise only read the sensor ids
+//#define USE_FULL_SELF_TEST
+
+//Uncomment for the production test: every sensor is checked at once on its bus by
+//factory_test, in well under a second, and the result is logged as the two FACTORY
+//lines of factory_test_report. The serial self tests and the spi throughput report
+//are skipped, a failed sensor is left out like one that failed its self test
+//#define USE_FACTORY_TEST
+
+//Uncomment to offload each stored impact as a binary serial_offload frame for
+//tools/offload_decode instead of printing it with NRF_LOG_INFO. The uart log backend
+//owns the same UARTE, set NRF_LOG_BACKEND_UART_ENABLED 0 and NRF_LOG_BACKEND_RTT_ENABLED 1
+//#define USE_BINARY_OFFLOAD
+
+#ifdef USE_CONT_SAMPLE_MODE
+#if !defined(USE_ADXL_FIFO_INT_MODE) || !defined(USE_BINARY_OFFLOAD)
+#error "USE_CONT_SAMPLE_MODE streams the adxl372 fifo bursts over the uart, define USE_ADXL_FIFO_INT_MODE and USE_BINARY_OFFLOAD"
+#endif
+#undef USE_ICM_FIFO         //the icm20649 data registers are read once per fifo burst
+#undef USE_ORIENTATION
+#undef USE_ACTIVITY_WAKEUP  //streams all along, never rests
+#endif
+
+#if defined(USE_ORIENTATION) && !(defined(USE_ADXL_FIFO_INT_MODE) && defined(USE_ICM_FIFO))
+#undef USE_ORIENTATION //the icm20649 fifo is only drained in fifo int mode
+#endif
+#if defined(USE_FUSED_ACCEL) && !(defined(USE_ADXL_FIFO_INT_MODE) && defined(USE_ICM_FIFO))
+#undef USE_FUSED_ACCEL //the icm20649 is read once per burst or per impact, too few pairs
+#endif
+
+#if defined(USE_SUMMARY_LOG_MODE) && !defined(USE_ADXL_FIFO_INT_MODE)
+#error "USE_SUMMARY_LOG_MODE drains the adxl372 fifo, define USE_ADXL_FIFO_INT_MODE"
+#endif
+
+#ifdef USE_TRIGGERED_FIFO_MODE
+#if !defined(USE_ADXL_FIFO_INT_MODE) || defined(USE_CONT_SAMPLE_MODE) || defined(USE_SUMMARY_LOG_MODE)
+#error "USE_TRIGGERED_FIFO_MODE drains the adxl372 fifo once per impact, define USE_ADXL_FIFO_INT_MODE only"
+#endif
+#undef USE_ICM_FIFO         //the icm20649 data registers are read once per impact
+#undef USE_ORIENTATION
+#undef USE_ACTIVITY_WAKEUP  //the fifo waits for the activity, the adxl372 keeps measuring
+#endif
+
+#ifdef USE_ADXL_AUTOSLEEP
+#if !defined(USE_ADXL_FIFO_INT_MODE) || defined(USE_CONT_SAMPLE_MODE) || defined(USE_SUMMARY_LOG_MODE) \
+    || defined(USE_TRIGGERED_FIFO_MODE) || defined(USE_TIERED_TRIGGER)
+#error "USE_ADXL_AUTOSLEEP drains the adxl372 fifo while it is awake, define USE_ADXL_FIFO_INT_MODE only"
+#endif
+#undef USE_ACTIVITY_WAKEUP  //the adxl372 rests by itself
+#endif
+
+#ifdef USE_ADXL_EXT_SYNC
+#if defined(USE_ADXL_FIFO_INT_MODE) || !defined(USE_SAMPLE_CLOCK)
+#error "USE_ADXL_EXT_SYNC clocks the polled adxl372 reads, define USE_SAMPLE_CLOCK without USE_ADXL_FIFO_INT_MODE"
+#endif
+#undef USE_ACTIVITY_WAKEUP  //INT2 is the sync input
+#endif
+
+#if defined(USE_TIERED_TRIGGER) && !defined(USE_ACTIVITY_WAKEUP)
+#error "USE_TIERED_TRIGGER wakes on the adxl372 activity thresholds, define USE_ACTIVITY_WAKEUP"
+#endif
+
+#ifdef USE_GYRO_DUTY_CYCLE
+#if !defined(USE_ADXL_FIFO_INT_MODE) || !defined(USE_ACTIVITY_WAKEUP)
+#error "USE_GYRO_DUTY_CYCLE wakes the gyro on the adxl372 activity, define USE_ADXL_FIFO_INT_MODE and USE_ACTIVITY_WAKEUP"
+#endif
+#undef USE_ORIENTATION      //the gyro is off between impacts
+#endif
+
+#ifdef USE_FACTORY_TEST
+#undef SPI_THROUGHPUT_REPORT //factory_test times the buses
+#undef USE_FULL_SELF_TEST
+#endif
+
+#if defined(USE_BINARY_OFFLOAD) && NRF_LOG_BACKEND_UART_ENABLED
+#error "USE_BINARY_OFFLOAD needs the uart, move the log to RTT in sdk_config.h"
+#endif
+
+//keep in small since there is limited ram space, the two capture buffers of 940
+//packed records take the same ram as the 500 x 32 byte samples and the mirror used before
+#define MAX_SAMPLE_BUF_LENGTH 940
+#define IMPACT_G_THRESHOLD 10000 //in milli-g's, resultant that starts an impact
+#define IMPACT_THRESHOLD_COUNTS ADXL372_MG_TO_COUNTS(IMPACT_G_THRESHOLD) //samples are kept as raw counts
+#define IMPACT_RELEASE_G_THRESHOLD 7000 //in milli-g's, hysteresis below IMPACT_G_THRESHOLD
+#define IMPACT_RELEASE_COUNTS ADXL372_MG_TO_COUNTS(IMPACT_RELEASE_G_THRESHOLD)
+//per axis for the adxl372 activity detection, a resultant of IMPACT_G_THRESHOLD puts at
+//least 1/sqrt(3) of it on one axis, the trigger checks the resultant afterwards
+#define IMPACT_AXIS_COUNTS ((IMPACT_THRESHOLD_COUNTS*577)/1000)
+#define IMPACT_MIN_DURATION_US 300 //resultant has to stay above release this long to trigger
+#define IMPACT_MIN_SAMPLES ((IMPACT_MIN_DURATION_US*ADXL_SAMPLE_RATE_HZ + 999999)/1000000)
+#define IMPACT_MAX_DURATION 120 //in milliseconds, a capture is cut off after this long
+#define IMPACT_QUIET_MS 10 //in milliseconds, a capture ends once the resultant stayed below release this long
+#define IMPACT_QUIET_SAMPLES ((IMPACT_QUIET_MS*ADXL_SAMPLE_RATE_HZ)/1000)
+#define ADXL_SAMPLE_RATE_HZ 6400 //matches adxl372_set_odr(ODR_6400HZ)
+#define CONT_SAMPLE_ODR ODR_6400HZ //adxl372 rate of USE_CONT_SAMPLE_MODE
+#define CONT_SAMPLE_BW BW_3200HZ //at most half of CONT_SAMPLE_ODR
+#define CONT_SAMPLE_RATE_HZ 6400 //matches CONT_SAMPLE_ODR
+#define CONT_STREAM_RATE_HZ ACCEL_DECIMATE_LIVE_HZ //live_stream rate, the accel_decimate live output
+#if defined(USE_CONT_SAMPLE_MODE) && defined(USE_ACCEL_FILTER) && CONT_SAMPLE_RATE_HZ != ACCEL_FILTER_RATE_HZ
+#undef USE_ACCEL_FILTER //the CFC 1000 coefficients are only valid at ACCEL_FILTER_RATE_HZ
+#endif
+//head x (front), y (left) and z (up) axes in adxl372 axes, for the impact location
+#define SENSOR_TO_HEAD IMPACT_LOCATION_MOUNT_IDENTITY
+#define PRE_TRIGGER_MS 20 //in milliseconds, samples kept before the trigger
+#define PRE_TRIGGER_SAMPLES ((PRE_TRIGGER_MS*ADXL_SAMPLE_RATE_HZ)/1000)
+#define ADXL_REST_MODE INSTANT_ON //INSTANT_ON or WAKE_UP
+#define ACTIVITY_TIMEOUT_MS 1000 //rest again if no impact is seen after waking up
+#define ACTIVITY_TIMEOUT_SAMPLES ((ACTIVITY_TIMEOUT_MS*ADXL_SAMPLE_RATE_HZ)/1000)
+#define HANDOFF_SAMPLES IMPACT_MIN_SAMPLES //first samples after a wake up, drained without waiting for the watermark
+#define HANDOFF_MARGIN_MS 4 //past the adxl372 filter settling the first samples are waited for
+#define AUTOSLEEP_ACT_G_THRESHOLD 1500 //in milli-g's, referenced, motion that keeps the adxl372 awake
+#define AUTOSLEEP_ACT_COUNTS ADXL372_MG_TO_COUNTS(AUTOSLEEP_ACT_G_THRESHOLD)
+#define AUTOSLEEP_INACT_G_THRESHOLD 1000 //in milli-g's, referenced, below this counts as quiet
+#define AUTOSLEEP_INACT_COUNTS ADXL372_MG_TO_COUNTS(AUTOSLEEP_INACT_G_THRESHOLD)
+#define AUTOSLEEP_INACT_MS 20000 //quiet this long puts the adxl372 to sleep
+#define AUTOSLEEP_INACT_TIME (AUTOSLEEP_INACT_MS/26) //TIME_INACT, 26 ms periods at 6400 Hz
+#define AUTOSLEEP_WUR WUR_52MS //activity check rate while asleep
+#define ERASE_POLL_MS 50 //how often a background flash erase is checked while resting
+#define DEEP_SLEEP_OFF_HEAD_MS 300000 //off head this long enters System OFF, at most 512 s of app_timer
+#define SUMMARY_WINDOW_S 60 //summary log window, one record each
+#define SUMMARY_HIT_G_THRESHOLD 3000 //in milli-g's, excursions over this are counted as hits
+#define SUMMARY_HIT_COUNTS ADXL372_MG_TO_COUNTS(SUMMARY_HIT_G_THRESHOLD)
+#define SUMMARY_EXPOSURE_LIMIT_G 2000 //session sum of the hit peaks in g that flags the exposure
+#define SUMMARY_EXPOSURE_LIMIT_COUNTS ((SUMMARY_EXPOSURE_LIMIT_G*1000UL)/ADXL372_MG_PER_LSB)
+#define SUMMARY_FIFO_WATERMARK 96 //peak entries, 32 hits between drains
+#define TRIGGERED_PRE_MS 5 //in milliseconds, kept by the adxl372 fifo before its activity event
+#define TRIGGERED_PRE_SAMPLES ((TRIGGERED_PRE_MS*ADXL_SAMPLE_RATE_HZ)/1000)
+#define TRIGGERED_POST_US (((ADXL_FIFO_MAX_SAMPLES - TRIGGERED_PRE_SAMPLES)*1000000UL)/ADXL_SAMPLE_RATE_HZ)
+#define TRIGGERED_ACT_COUNTS IMPACT_AXIS_COUNTS
+#define TIER_SUMMARY_G_THRESHOLD 4000 //in milli-g's, per axis activity that wakes the summary tier
+#define TIER_SUMMARY_COUNTS ADXL372_MG_TO_COUNTS(TIER_SUMMARY_G_THRESHOLD)
+#define TIER_SUMMARY_MS 100 //awake this long without the activity2 makes a moderate hit
+#define TIER_SUMMARY_SAMPLES ((TIER_SUMMARY_MS*ADXL_SAMPLE_RATE_HZ)/1000)
+#define SAMPLE_CLOCK_HZ ADXL_SAMPLE_RATE_HZ //clocked sample rate, must divide ADXL_SAMPLE_RATE_HZ
+#define CLOCKED_SAMPLES ((IMPACT_MAX_DURATION*SAMPLE_CLOCK_HZ)/1000)
+#define CLOCKED_ACCEL_LENGTH (ADXL_ACCEL_DATA_LENGTH + 1) //command byte + xyz
+#define CLOCKED_GYRO_LENGTH (ICM20649_DATA_LENGTH + 1)
+#define CODEC_CHUNK_SIZE (MT25QL256ABA_PAGE_SIZE + IMPACT_CODEC_MAX_RECORD_SIZE) //coded bytes staged per flash access
+#define CAPTURE_BUF_COUNT 2 //must stay 2, see capture_buf_other
+#define RAW_RECORDS_PER_STEP (MT25QL256ABA_PAGE_SIZE/IMPACT_RECORD_SIZE) //uncompressed records per flash access
+
+//One impact sample set in RAM, its timestamp and summary for the event header and its
+//metrics, computed as the records come in. Two of them ping-pong: one records the next
+//impact while the other is committed to flash
+typedef struct {
+    impact_record_t records[MAX_SAMPLE_BUF_LENGTH];
+    uint32_t count;
+    uint32_t pre_trigger;   //records from before the trigger
+    uint32_t dropped;       //samples that arrived with records full
+    uint32_t start_ticks;   //app timer count at the trigger
+    ds1388_data_t rtc_data;
+    event_store_summary_t summary;
+    impact_metrics_t metrics;
+} capture_buf_t;
+
+capture_buf_t g_capture_bufs[CAPTURE_BUF_COUNT];
+capture_buf_t* g_capture = &g_capture_bufs[0]; //records the next impact
+
+//background commit of the other capture buffer, done a flash page at a time
+typedef enum {
+    COMMIT_IDLE = 0,    /**< nothing to commit */
+    COMMIT_BEGIN,       /**< a capture buffer was handed over, the event is not open yet */
+    COMMIT_WRITING,     /**< the event is open and being appended to */
+    COMMIT_RAM_ONLY     /**< the flash is out, the capture is printed from ram instead */
+} commit_state_t;
+
+typedef struct {
+    commit_state_t state;
+    capture_buf_t const* p_buf;
+    uint32_t next_record;   /**< first record of p_buf not encoded yet */
+    uint32_t start_ticks;   /**< app timer count when p_buf was handed over */
+#ifdef USE_SAMPLE_COMPRESSION
+    impact_codec_t codec;
+    uint8_t chunk[CODEC_CHUNK_SIZE];
+    uint16_t fill;
+#endif
+} flash_commit_t;
+
+flash_commit_t g_commit;
+//events from here on are committed but not output over uart yet
+uint32_t g_offload_next_id;
+
+//impact events kept on flash across resets
+event_store_t g_event_store;
+//resultant onset/release trigger, active from the trigger until the capture ends
+impact_trigger_t g_impact_trigger;
+//capture and commit counters since startup
+pipeline_stats_t g_pipeline_stats;
+//error counts of the sensors, one that keeps failing is left out of the capture until it answers again
+sensor_health_t g_sensor_health;
+#if defined(USE_SUMMARY_LOG_MODE) || defined(USE_TIERED_TRIGGER)
+//the windows of USE_SUMMARY_LOG_MODE, or the moderate hits of USE_TIERED_TRIGGER
+summary_log_t g_summary_log;
+ds1388_data_t g_summary_rtc; //end of the first window of the queued records
+#endif
+
+#ifdef USE_DEEP_SLEEP
+//kept over System OFF, the wake up takes the store back instead of mounting it again
+typedef struct {
+    event_store_t event_store;
+    uint32_t offload_next_id;
+    pipeline_stats_t pipeline_stats;
+} retained_state_t;
+
+STATIC_ASSERT(sizeof(retained_state_t) <= DEEP_SLEEP_RETAINED_SIZE);
+
+volatile bool g_off_head_timeout = false;
+#endif
 
-//Variable to temporary store the sample set in RAM and to transfer over to flash
-impact_sample_t g_sample_set_buf[MAX_SAMPLE_BUF_LENGTH];
-impact_sample_t g_flash_output_buf[MAX_SAMPLE_BUF_LENGTH];
-uint32_t g_buf_index = 0;
+#ifdef USE_ADXL_FIFO_INT_MODE
+struct adxl372_device g_adxl_dev;
+//one fifo burst of xyz samples, the fifo can fill past the watermark before it is drained
+adxl372_accel_data_t g_fifo_burst_buf[ADXL_FIFO_MAX_SAMPLES];
+//timebase stamp taken right before g_fifo_burst_buf was read, only runs while capturing
+uint32_t g_fifo_burst_us;
+#ifdef USE_ACCEL_FILTER
+accel_filter_t g_accel_filter;
+#endif
+
+//pre-trigger window, runs continuously until an impact is detected
+adxl372_accel_data_t g_pre_trigger_buf[PRE_TRIGGER_SAMPLES];
+sample_ring_t g_pre_trigger_ring;
+
+#ifdef USE_ICM_FIFO
+//icm20649 samples drained with each adxl372 fifo burst, a burst spans
+//ADXL_FIFO_MAX_SAMPLES/ADXL_SAMPLE_RATE_HZ so this holds about twice that
+#define ICM_FIFO_MAX_SAMPLES ((2*ADXL_FIFO_MAX_SAMPLES*ICM20649_FIFO_SAMPLE_RATE_HZ)/ADXL_SAMPLE_RATE_HZ + 1)
+icm20649_data_t g_icm_fifo_buf[ICM_FIFO_MAX_SAMPLES];
+//the gyro paces the fifo at 1125Hz/(1+ICM_GYRO_FIFO_DIV) for the rotational metrics, the
+//low-g accel only needs a fraction of that: its fields repeat between its own samples
+//and the repeats code to nothing in the stored records
+#define ICM_GYRO_FIFO_DIV   0
+#ifdef USE_FUSED_ACCEL
+#define ICM_ACCEL_FIFO_DIV  ICM_GYRO_FIFO_DIV //the fusion blends every record
+#define ICM_ACCEL_FIFO_DLPF 0
+#else
+#define ICM_ACCEL_FIFO_DIV  3 //281Hz
+#define ICM_ACCEL_FIFO_DLPF 2 //~111Hz, under half of it
+#endif
+STATIC_ASSERT(ICM_ACCEL_FIFO_DIV >= ICM_GYRO_FIFO_DIV);
+static const icm20649_rate_config_t g_icm_fifo_rates = {
+    .gyro_div = ICM_GYRO_FIFO_DIV, .gyro_dlpf = 0, .gyro_fs = ICM20649_GYRO_FS_2000DPS,
+    .accel_div = ICM_ACCEL_FIFO_DIV, .accel_dlpf = ICM_ACCEL_FIFO_DLPF, .accel_fs = ICM20649_ACCEL_FS_30G,
+};
+//interpolates g_icm_fifo_buf onto the adxl372 sample times
+imu_align_t g_imu_align;
+#endif
+#ifdef USE_FUSED_ACCEL
+//adxl372 onto icm20649 fit of the fused channel, refitted after each impact
+accel_fusion_t g_accel_fusion;
+#endif
+#ifdef USE_ORIENTATION
+//runs on every icm20649 fifo sample, before and during impacts
+ahrs_t g_ahrs;
+#endif
+#ifdef USE_ICM_DMP
+extern const uint8_t icm20649_dmp_image[];
+extern const uint16_t icm20649_dmp_image_size;
+//the quaternion and the features of the DMP packets, while the DMP runs the fifo holds its packets
+icm20649_dmp_t g_icm_dmp;
+bool g_dmp_running = false;
+#endif
+
+#ifdef USE_ACTIVITY_WAKEUP
+//true while the adxl372 rests until activity
+bool g_adxl_armed = false;
+//the switch of the adxl372 to full bandwidth at the wake ups, timed from the activity edge
+typedef struct {
+    uint32_t wakes;
+    uint32_t last_gap_us;       //activity edge to HANDOFF_SAMPLES in the fifo
+    uint32_t max_gap_us;
+    uint32_t timeouts;          //no samples within the filter settling and HANDOFF_MARGIN_MS
+    uint32_t missed;            //wake ups whose MAXPEAK was over the trigger and none fired
+    adxl372_accel_data_t peak;  //MAXPEAK at the wake up, the hit before the fifo ran
+    bool triggered;             //since the wake up
+    bool drain;                 //the first samples are in, drained without the watermark
+} adxl_handoff_t;
+adxl_handoff_t g_adxl_handoff;
+//app timer count at the adxl372 activity edge, taken in the gpiote interrupt
+volatile uint32_t g_wake_ticks;
+#endif
+#ifdef USE_TIERED_TRIGGER
+//the activity2 was seen since the adxl372 woke up, the rest of the wake up is captured in full
+bool g_tier_escalated = false;
+//summary tier samples since the wake up
+uint32_t g_tier_samples;
+#endif
+#ifdef USE_TRIGGERED_FIFO_MODE
+//app timer count at the adxl372 activity event, taken in the gpiote interrupt
+volatile uint32_t g_triggered_ticks;
+#endif
+#ifdef USE_GYRO_DUTY_CYCLE
+//gyro start up out of the icm20649 low power mode, timed at boot by gyro_startup_measure
+uint32_t g_gyro_startup_us = ICM20649_WAKEUP_MS*1000;
+//the start up of the gyro woken by gyro_duty_wake is over, set by its timer
+volatile bool g_gyro_started = false;
+//the icm20649 fifo was started over once the gyro was up
+bool g_gyro_ready = false;
+#endif
+#endif
+
+//wear and power state, only OFF_HEAD changes which sensors are powered
+typedef enum {
+    DEVICE_OFF_HEAD = 0,    /**< not worn, icm20649 asleep and adxl372 in wake up mode */
+    DEVICE_ARMED,           /**< worn, waiting for an impact */
+    DEVICE_CAPTURING,       /**< sampling an impact until it is quiet or IMPACT_MAX_DURATION */
+    DEVICE_COMMITTING,      /**< storing the impact to flash, fifo mode commits in the background instead */
+    DEVICE_OFFLOADING       /**< reading the impact back out over uart */
+} device_state_t;
+
+device_state_t g_device_state = DEVICE_ARMED;
 
 //Variable to know when the sampling is finished
 bool g_measurement_done = false;
+volatile bool g_summary_window_done = false;
 
 //variable that enables reading the rtc at the beginning of every high impact
 bool g_record_timestamp = false;
+//app timer count at the last polled sample, for the record time delta
+uint32_t g_last_sample_ticks;
+//part of a sample period the deltas so far left out, in APP_TIMER_CLOCK_FREQ units
+uint32_t g_last_sample_carry;
+APP_TIMER_DEF(m_erase_poll_timer_id);/**< Wakes the cpu to check a background flash erase */
+APP_TIMER_DEF(m_summary_timer_id);/**< Ends each summary log window */
+#ifdef USE_DEEP_SLEEP
+APP_TIMER_DEF(m_off_head_timer_id);/**< Ends the System ON sleep of an off head helmet */
+#endif
+#ifdef USE_GYRO_DUTY_CYCLE
+APP_TIMER_DEF(m_gyro_startup_timer_id);/**< Ends the start up of the gyro woken from low power */
+#endif
 APP_TIMER_DEF(m_measurement_timer_id);/**< Handler for measurement timer 
                                          used for the impact duration */ 
 
@@ -85,19 +542,79 @@ APP_TIMER_DEF(m_measurement_timer_id);/**< Handler for measurement timer
 void log_init(void);
 void lfclk_request(void);
 static void create_timers(void);
-static void spi_ret_check(int8_t ret);
+static void spi_ret_check(sensor_id_t sensor, int8_t ret);
 void spi_accel_init(void);
 void spi_gyro_init(void);
-void spi_flash_init(void);
-void spi_accel_uninit(void);
 void spi_gyro_uninit(void);
-void spi_flash_uninit(void);
 void adxl372_init(void);
 void sample_impact_data (adxl372_accel_data_t* high_g_data, icm20649_data_t* low_g_gyro_data, ds1388_data_t* rtc_data);
-void flash_store_samples(uint32_t* flash_addr);
-void flash_retrieve_samples(uint32_t* flash_addr);
-void serial_debug_output_flash_data(void);
-void serial_output_flash_data(void);
+void sample_clocked_impact(ds1388_data_t* rtc_data);
+void accel_sync_start(void);
+void record_event_timestamp(ds1388_data_t* rtc_data);
+void device_set_state(device_state_t state);
+void sensors_sleep(void);
+void sensors_wake(void);
+void wait_until_worn(void);
+uint16_t adxl372_wait_for_fifo_burst(void);
+void sample_stream_restart(void);
+void sample_pre_trigger_window(ds1388_data_t* rtc_data);
+void sample_impact_fifo_burst (adxl372_accel_data_t const* samples, uint16_t num_samples, icm20649_data_t* low_g_gyro_data, ds1388_data_t* rtc_data);
+bool adxl372_rest_until_activity(void);
+void adxl372_handoff_wait(void);
+void adxl372_handoff_check(void);
+uint32_t gyro_startup_measure(void);
+void gyro_duty_rest(void);
+void gyro_duty_wake(void);
+bool gyro_duty_ready(void);
+int8_t flash_background_step_from_accel(void);
+void spi_throughput_report(void);
+void orientation_update(int16_t num_icm_samples);
+void ahrs_cycle_report(void);
+bool sensors_check_id(void);
+void accel_configure(void);
+void adxl372_activity_wakeup_config(void);
+void adxl372_autosleep_config(void);
+bool adxl372_wait_awake(void);
+void accel_retry_wait(void);
+void gyro_retry(void);
+void flash_retry(void);
+int16_t gyro_read_fifo(void);
+void gyro_fifo_init(void);
+uint16_t gyro_fifo_rate_hz(void);
+void gyro_read_fresh(icm20649_data_t* data);
+void health_log(void);
+void cpu_sleep(void);
+void deep_sleep_off_head(void);
+bool deep_sleep_woke(void);
+void serial_output_capture(capture_buf_t const* p_buf);
+void serial_output_record(uint32_t index, impact_record_t const* record, uint32_t* p_sample_periods);
+void summary_log_run(void);
+void cont_sample_run(void);
+void summary_drain_peaks(void);
+void summary_log_store(void);
+void tier_arm(void);
+bool tier_summary_burst(uint16_t num_samples);
+void tier_summary_add(void);
+void tier_summary_store(void);
+void serial_output_summary(uint32_t event_id, event_store_header_t const* header);
+void triggered_fifo_run(void);
+void triggered_fifo_arm(void);
+bool triggered_fifo_wait(void);
+void triggered_fifo_capture(void);
+capture_buf_t* capture_buf_other(void);
+void capture_push(adxl372_accel_data_t const* accel, icm20649_data_t const* gyro, uint8_t delta);
+void capture_count_drops(uint32_t num_samples);
+void capture_reset(void);
+void capture_close(void);
+void capture_end(uint32_t duration_us);
+void flash_commit_start(void);
+int8_t flash_commit_step(void);
+void flash_commit_finish_from_accel(void);
+bool flash_offload_pending(void);
+void flash_offload(void);
+void flash_retrieve_samples(uint32_t event_id);
+void serial_output_flash_data(uint32_t event_id);
+uint32_t app_timer_since_us(uint32_t start_ticks);
 
 /**@brief Timeout handler for the measurement timer.
  */
@@ -106,390 +623,2271 @@ static void measurement_timer_handler(void * p_context)
     g_measurement_done = true;
 }
 
-//================================================================//
-// NOTE: These two functions below are ONLY for PCB REV1
-// Due to the limition number of spi/twi peripherals (3)
-// accel and flash have separate pin config and will require
-// uninitializing one inorder to switch between devices.
-// In PCB REV2 we will have the same MOSI, MISO, CLK and
-// separate cs pins to switch between devices
+static void erase_poll_timer_handler(void * p_context)
+{
+    //only wakes the cpu, the erase is checked in thread context
+}
+
+static void summary_timer_handler(void * p_context)
+{
+    g_summary_window_done = true;
+}
 
-// Switch to accel spi instance from flash spi instance 
-// MUST BE CALLED before a accel cmd and when flash
-// is initialized already! 
-void spi_switch_to_accel_from_flash(void)
+#ifdef USE_DEEP_SLEEP
+static void off_head_timer_handler(void * p_context)
 {
-    spi_flash_uninit();
-    spi_accel_init();
+    g_off_head_timeout = true;
 }
+#endif
 
-// Switch to flash spi instance from accel spi instance
-// MUST BE CALLED before a flash command and when accel
-// is initialized already! 
-void spi_switch_to_flash_from_accel(void)
+#ifdef USE_GYRO_DUTY_CYCLE
+static void gyro_startup_timer_handler(void * p_context)
 {
-    spi_accel_uninit();
-    spi_flash_init();
+    g_gyro_started = true;
 }
-//================================================================//
+#endif
+
 
 int main (void)
 {
+    bool full_test;
+    bool woke;
+
     // Initialize.
     SystemInit();
+    //first, the reset reason is cleared once read
+    full_test = boot_check_init();
+#ifdef USE_FULL_SELF_TEST
+    full_test = true;
+#endif
     log_init();
+#if TRACE_ENABLED
+    trace_init();
+#endif
+    profiler_icache_enable(PROFILER_ENABLED);
+#if PROFILER_ENABLED
+    profiler_init();
+#endif
+#ifdef USE_BINARY_OFFLOAD
+    if (serial_offload_init() < 0)
+    {
+        NRF_LOG_ERROR("SERIAL OFFLOAD INIT FAILED");
+    }
+#endif
     spi_accel_init();
     spi_gyro_init();
     twi_init();
+    //left powered down by a deep sleep, a no-op otherwise
+    mt25ql256aba_release_deep_power_down();
+    woke = deep_sleep_woke();
 
     //for app_timer
     lfclk_request();
 
+#ifdef SPI_THROUGHPUT_REPORT
+    //before the adxl372 fifo is enabled, the accel burst runs over the fifo data register.
+    //Skipped waking from a deep sleep, the helmet is being put on
+    if (!woke)
+        spi_throughput_report();
+#endif
+
+#ifdef USE_FACTORY_TEST
+    factory_test_result_t factory_result;
+
+    //replaces the self tests, the ids were just read
+    (void) factory_test_run(&factory_result);
+    factory_test_report(&factory_result);
+    full_test = false;
+#else
+    //a warm boot after a passed full test only reads the ids, a wrong one runs the full tests
+    //and keeps asking for them on the next boots until they pass
+    if (!full_test && !sensors_check_id())
+    {
+        full_test = true;
+        boot_check_request_full_test();
+    }
+#endif
+    NRF_LOG_INFO("BOOT: reset reason 0x%x, %s self test", boot_check_reset_reason(), full_test ? "full" : "id");
+
+    //a failed self test leaves the sensor out, it is retried while capturing without it
+    sensor_health_init(&g_sensor_health);
+#ifdef USE_FACTORY_TEST
+    if (factory_result.failed & (1 << FACTORY_TEST_ACCEL))
+        sensor_health_take_out(&g_sensor_health, SENSOR_ACCEL);
+    if (factory_result.failed & (1 << FACTORY_TEST_GYRO))
+        sensor_health_take_out(&g_sensor_health, SENSOR_GYRO);
+    if (factory_result.failed & (1 << FACTORY_TEST_FLASH))
+        sensor_health_take_out(&g_sensor_health, SENSOR_FLASH);
+#endif
+
     //init accel
-    adxl372_test();
-#ifdef USE_CONT_SAMPLING_MODE
-    adxl372_default_init();
+    if (full_test && adxl372_test() < 0)
+        sensor_health_take_out(&g_sensor_health, SENSOR_ACCEL);
+    impact_trigger_init(&g_impact_trigger, IMPACT_THRESHOLD_COUNTS, IMPACT_RELEASE_COUNTS, IMPACT_MIN_SAMPLES);
+    if (!woke)
+        pipeline_stats_init(&g_pipeline_stats);
+#ifdef USE_TIERED_TRIGGER
+    summary_log_init(&g_summary_log, SUMMARY_EXPOSURE_LIMIT_COUNTS);
 #endif
-#ifndef USE_CONT_SAMPLING_MODE
-    adxl372_init();
+#ifdef USE_ADXL_FIFO_INT_MODE
+    sample_ring_init(&g_pre_trigger_ring, g_pre_trigger_buf, PRE_TRIGGER_SAMPLES);
+#ifdef USE_ACCEL_FILTER
+    accel_filter_init(&g_accel_filter);
+#endif
+    accel_configure();
+    adxl372_int_init(ADXL_INT1);
+#if defined(USE_ACTIVITY_WAKEUP) || defined(USE_ADXL_AUTOSLEEP)
+    adxl372_int_init(ADXL_INT2);
+#endif
+#else
+    accel_configure();
 #endif
 
     //init gyro
-    icm20649_test();
+    if (full_test && icm20649_test() < 0)
+        sensor_health_take_out(&g_sensor_health, SENSOR_GYRO);
     icm20649_default_init();
+#ifdef USE_ICM_FIFO
+    gyro_fifo_init();
+#ifdef USE_ADXL_FIFO_INT_MODE
+    imu_align_init(&g_imu_align, ADXL_SAMPLE_RATE_HZ, gyro_fifo_rate_hz());
+#endif
+#ifdef USE_FUSED_ACCEL
+    accel_fusion_init(&g_accel_fusion);
+#endif
+#ifdef USE_ORIENTATION
+    ahrs_init(&g_ahrs, gyro_fifo_rate_hz(), icm20649_gyro_fs_dps(), AHRS_BETA);
+#ifdef DEBUG
+    ahrs_cycle_report();
+#endif
+#endif
+#endif
 
-    spi_switch_to_flash_from_accel();
-    mt25ql256aba_startup_test();
-    mt25ql256aba_bulk_erase();
+    if (full_test && mt25ql256aba_startup_test() < 0)
+        sensor_health_take_out(&g_sensor_health, SENSOR_FLASH);
+    //recovers the stored events instead of erasing the chip
+    if (sensor_health_ok(&g_sensor_health, SENSOR_FLASH) && !woke)
+        spi_ret_check(SENSOR_FLASH, event_store_init(&g_event_store));
+    NRF_LOG_INFO("EVENT STORE: %d events", event_store_count(&g_event_store));
+    if (!woke)
+        g_offload_next_id = event_store_count(&g_event_store);
+    capture_reset();
 
-    spi_switch_to_accel_from_flash();
 
     vcnl4040_config();
+#ifndef USE_CONT_SAMPLE_MODE
+    vcnl4040_int_init();
+#endif
     NRF_LOG_INFO("CONFIG RTC");
-    ds1388_config();
+    ds1388_config(full_test);
+    //a sensor that failed its test gets the full tests again on the next boot
+    if (full_test && sensor_health_ok(&g_sensor_health, SENSOR_ACCEL)
+        && sensor_health_ok(&g_sensor_health, SENSOR_GYRO) && sensor_health_ok(&g_sensor_health, SENSOR_FLASH))
+    {
+        boot_check_passed();
+    }
 
     app_timer_init();
     create_timers();
+    APP_ERROR_CHECK(nrf_pwr_mgmt_init());
+#ifdef USE_GYRO_DUTY_CYCLE
+    if (sensor_health_ok(&g_sensor_health, SENSOR_GYRO))
+        g_gyro_startup_us = gyro_startup_measure();
+    NRF_LOG_INFO("GYRO START UP: %d us", g_gyro_startup_us);
+#endif
+
+#ifdef USE_SUMMARY_LOG_MODE
+    summary_log_run();
+#endif
+#ifdef USE_TRIGGERED_FIFO_MODE
+    triggered_fifo_run();
+#endif
 
 #ifndef USE_CONT_SAMPLE_MODE
-    icm20649_data_t low_g_gyro_data;
+#if defined(USE_ADXL_FIFO_INT_MODE) || !defined(USE_SAMPLE_CLOCK)
+    icm20649_data_t low_g_gyro_data = {0};
+#endif
+    bool impact_detected;
+#ifdef USE_ADXL_FIFO_INT_MODE
+    uint16_t num_samples;
+    int16_t trigger_index;
+#ifdef USE_ACTIVITY_WAKEUP
+    uint32_t awake_samples = 0;
+#endif
+#else
     adxl372_accel_data_t high_g_data;
-    ds1388_data_t rtc_data;
-    uint32_t flash_addr = MT25QL256ABA_LOW_128MBIT_SEGMENT_ADDRESS_START;
+#endif
 
     while(1){
-        vcnl4040_read_sensor_data();
+        if (!vcnl4040_is_worn())
+        {
+#ifdef USE_TIERED_TRIGGER
+            //the moderate hits of the time worn
+            if (g_summary_log.count > 0)
+                tier_summary_store();
+#endif
+            device_set_state(DEVICE_OFF_HEAD);
+            wait_until_worn();
+        }
+        device_set_state(DEVICE_ARMED);
+        gyro_retry();
+        flash_retry();
+        if (!sensor_health_ok(&g_sensor_health, SENSOR_ACCEL))
+        {
+            //nothing to trigger on until the accel answers again
+            accel_retry_wait();
+            continue;
+        }
+#ifdef USE_ADXL_FIFO_INT_MODE
+#ifdef USE_ACTIVITY_WAKEUP
+        if (g_adxl_armed)
+        {
+#ifdef USE_TIERED_TRIGGER
+            tier_arm();
+#endif
+            if (!adxl372_rest_until_activity())
+            {
+                //taken off while resting
+                continue;
+            }
+            awake_samples = 0;
+        }
+#endif
+#ifdef USE_ADXL_AUTOSLEEP
+        if (!adxl372_wait_awake())
+        {
+            //taken off while the adxl372 was asleep
+            continue;
+        }
+#endif
+        num_samples = adxl372_wait_for_fifo_burst();
+#ifdef USE_TIERED_TRIGGER
+        if (tier_summary_burst(num_samples))
+        {
+            continue;
+        }
+#endif
+#ifdef USE_ORIENTATION
+        //keep the orientation current, it is stored as it is at the trigger
+        orientation_update(gyro_read_fifo());
+#endif
+        trigger_index = impact_trigger_update(&g_impact_trigger, g_fifo_burst_buf, num_samples);
+        impact_detected = (trigger_index >= 0);
+        if (!impact_detected)
+        {
+            sample_ring_push(&g_pre_trigger_ring, g_fifo_burst_buf, num_samples);
+            //one page of the previous impact per burst, or its readback once committed
+            if (g_commit.state != COMMIT_IDLE || flash_offload_pending())
+            {
+                flash_background_step_from_accel();
+            }
+#ifdef USE_ACTIVITY_WAKEUP
+            awake_samples += num_samples;
+            if (awake_samples >= ACTIVITY_TIMEOUT_SAMPLES)
+            {
+                g_adxl_armed = true;
+            }
+#endif
+        }
+#else
         adxl372_get_accel_data(&high_g_data);
+        //IMPACT_MIN_SAMPLES is counted in polled samples here
+        impact_detected = (impact_trigger_update(&g_impact_trigger, &high_g_data, 1) >= 0);
+#endif
 
         //NRF_LOG_INFO("%d, %d, %d", high_g_data.x, high_g_data.y, high_g_data.z);
 
         g_record_timestamp = false;
-        if(high_g_data.x >= IMPACT_G_THRESHOLD|| high_g_data.y >= IMPACT_G_THRESHOLD
-                || high_g_data.z >= IMPACT_G_THRESHOLD)
+        if(impact_detected)
         {
+            device_set_state(DEVICE_CAPTURING);
+#ifdef USE_ACTIVITY_WAKEUP
+            g_adxl_handoff.triggered = true;
+#endif
 #ifdef DEBUG
             NRF_LOG_INFO("");
             NRF_LOG_INFO("BEGIN MEASUREMENT");
 #endif
             app_timer_start(m_measurement_timer_id,
-                             APP_TIMER_TICKS(IMPACT_DURATION),
+                             APP_TIMER_TICKS(IMPACT_MAX_DURATION),
                              measurement_timer_handler);
-            while(g_measurement_done == false)
+            g_capture->start_ticks = app_timer_cnt_get();
+#ifdef USE_ADXL_FIFO_INT_MODE
+#ifdef USE_ORIENTATION
+#ifdef USE_ICM_DMP
+            if (g_dmp_running)
+            {
+                icm20649_dmp_quaternion_q14(&g_icm_dmp, g_capture->summary.orientation);
+            }
+            else
+#endif
+            ahrs_quaternion_q14(&g_ahrs, g_capture->summary.orientation);
+#endif
+#ifdef USE_GYRO_DUTY_CYCLE
+            //a gyro up since before the trigger is aligned from here on
+            (void) gyro_duty_ready();
+#endif
+#ifdef USE_ICM_FIFO
+            //only keep icm20649 samples from the trigger on, both fifos are
+            //dated from here and the triggering burst was read just before
+            if (sensor_health_ok(&g_sensor_health, SENSOR_GYRO))
+                spi_ret_check(SENSOR_GYRO, icm20649_fifo_reset());
+            timebase_start();
+            g_fifo_burst_us = timebase_now_us();
+            imu_align_start(&g_imu_align, g_fifo_burst_us);
+#endif
+            //freeze the pre-trigger window and append the rest of the triggering burst
+            sample_ring_push(&g_pre_trigger_ring, g_fifo_burst_buf, trigger_index);
+            sample_pre_trigger_window(&g_capture->rtc_data);
+            sample_impact_fifo_burst(&g_fifo_burst_buf[trigger_index], num_samples - trigger_index,
+                                     &low_g_gyro_data, &g_capture->rtc_data);
+#endif
+#if !defined(USE_ADXL_FIFO_INT_MODE) && defined(USE_SAMPLE_CLOCK)
+            sample_clocked_impact(&g_capture->rtc_data);
+#else
+            //the trigger stays active and counts the quiet samples at the end of the impact
+            while(g_measurement_done == false && g_impact_trigger.quiet < IMPACT_QUIET_SAMPLES
+                  && sensor_health_ok(&g_sensor_health, SENSOR_ACCEL))
             {
-                sample_impact_data(&high_g_data, &low_g_gyro_data, &rtc_data);
+#ifdef USE_ADXL_FIFO_INT_MODE
+                num_samples = adxl372_wait_for_fifo_burst();
+                impact_trigger_update(&g_impact_trigger, g_fifo_burst_buf, num_samples);
+                sample_impact_fifo_burst(g_fifo_burst_buf, num_samples, &low_g_gyro_data, &g_capture->rtc_data);
+                //keep committing the previous impact between bursts
+                if (g_commit.state != COMMIT_IDLE)
+                {
+                    flash_background_step_from_accel();
+                }
+#else
+                //IMPACT_QUIET_SAMPLES is counted in polled samples here
+                sample_impact_data(&high_g_data, &low_g_gyro_data, &g_capture->rtc_data);
+                impact_trigger_update(&g_impact_trigger, &high_g_data, 1);
+#endif
             }
+#endif
             app_timer_stop(m_measurement_timer_id);
+#if defined(USE_ADXL_FIFO_INT_MODE) && defined(USE_ICM_FIFO)
+            timebase_stop();
+#endif
             //reset for next impact
             g_measurement_done = false;
-            spi_switch_to_flash_from_accel();
-            flash_store_samples(&flash_addr);
-            flash_retrieve_samples(&flash_addr);
-            serial_output_flash_data();
-            spi_switch_to_accel_from_flash();
+            capture_end(app_timer_since_us(g_capture->start_ticks));
+#ifdef USE_ADXL_FIFO_INT_MODE
+            //the ring still holds the window before this trigger, the capture's bursts went
+            //past it, a trigger right after would take those stale samples as its own
+            sample_ring_reset(&g_pre_trigger_ring);
+            //the commit runs between the next fifo bursts or while resting
+#ifdef USE_ACTIVITY_WAKEUP
+            g_adxl_armed = true;
+#endif
+#else
+            //polled sampling keeps the cpu busy, store the impact before sampling again
+            device_set_state(DEVICE_COMMITTING);
+            flash_commit_finish_from_accel();
+            device_set_state(DEVICE_OFFLOADING);
+            flash_offload();
+#endif
 
         }
     }
 #endif
 
 #ifdef USE_CONT_SAMPLE_MODE
-    adxl372_accel_data_t accel_data;
-    icm20649_data_t gyro_data;
-    ds1388_data_t ds_data;
-    while(1)
-    {
-        vcnl4040_read_sensor_data();
-        icm20649_read_gyro_accel_data(&gyro_data);
-        icm20649_convert_data(&gyro_data);
-        adxl372_get_accel_data(&accel_data);
-        ds1388_get_time(&ds_data);
-
-        NRF_LOG_INFO("accel x = %d, accel y = %d, accel z = %d mG",
-                        accel_data.x, accel_data.y, accel_data.z);
-        NRF_LOG_RAW_INFO("accel x = %d, accel y = %d, accel z = %d, gyro x = %d, gyro y = %d, gyro z = %d \r\n", 
-        gyro_data.accel_x, gyro_data.accel_y, gyro_data.accel_z,
-        gyro_data.gyro_x, gyro_data.gyro_y, gyro_data.gyro_z );
-        
-        NRF_LOG_INFO("      Date: %d, Day:    %d, Hour:   %d, Minute: %d, Second: %d, Hundreth: %d",
-                    ds_data.date, ds_data.day,
-                    ds_data.hour, ds_data.minute,
-                    ds_data.second, ds_data.hundreth);       
-        
-        nrf_delay_ms(1000);
-    }
+    cont_sample_run();
 #endif
 
     return 0;
 }
 
-void sample_impact_data (adxl372_accel_data_t* high_g_data, icm20649_data_t* low_g_gyro_data, ds1388_data_t* rtc_data)
+#ifdef USE_CONT_SAMPLE_MODE
+accel_decimate_t g_cont_decimate;
+icm20649_data_t g_cont_gyro; //newest icm20649 read, streamed with the decimated accel
+
+static void cont_decimate_handler(accel_decimate_output_t output, adxl372_accel_data_t const* samples,
+                                  uint16_t num_samples)
 {
-    if(g_record_timestamp == false)
-    {
-        ds1388_get_time(rtc_data);
-        g_sample_set_buf[g_buf_index].ds_data = *rtc_data;
-        g_record_timestamp = true;
-    }
-    adxl372_get_accel_data(high_g_data);
-    icm20649_read_gyro_accel_data(low_g_gyro_data);
-    icm20649_convert_data(low_g_gyro_data);
-    if (g_buf_index < MAX_SAMPLE_BUF_LENGTH)
-    {
-        g_sample_set_buf[g_buf_index].adxl_data = *high_g_data;
-        g_sample_set_buf[g_buf_index].icm_data = *low_g_gyro_data;
-        g_buf_index++;
-    }
+    live_stream_push(samples, num_samples, &g_cont_gyro);
 }
 
-void flash_store_samples(uint32_t* flash_addr)
+// Streams the accel and gyro at CONT_STREAM_RATE_HZ over the uart, never returns.
+// accel_decimate filters each fifo burst down and live_stream frames it with the
+// icm20649 read that follows it, the frames go out between the bursts while the
+// uart sends the last chunk. A fifo overrun or an accel retry restarts the
+// decimator and flags the next frame, a frame the uart refused or the queue had
+// no room for shows as a gap in the sequence numbers
+void cont_sample_run(void)
 {
-    uint8_t flash_addr_buf[3]= {0};
-    uint8_t sample_size_bytes = sizeof(impact_sample_t);
-    uint8_t *sample_byte_ptr;
-    int8_t ret;
+    uint8_t const* p_frame;
+    uint16_t length;
+    uint16_t num_samples;
+    uint32_t fifo_overruns = g_adxl_dev.fifo_overruns;
 
-    NRF_LOG_INFO("");
-    NRF_LOG_INFO("BEGIN STORE SAMPLES...");
-    //store one impact sample set to flash
-    for (int i = 0; i < g_buf_index; ++i)
+    memset(&g_cont_gyro, 0, sizeof(g_cont_gyro));
+    APP_ERROR_CHECK_BOOL(accel_decimate_init(&g_cont_decimate, CONT_SAMPLE_RATE_HZ, cont_decimate_handler) == 0);
+    accel_decimate_enable(&g_cont_decimate, ACCEL_DECIMATE_LIVE, true);
+    live_stream_init();
+    APP_ERROR_CHECK_BOOL(live_stream_start(CONT_STREAM_RATE_HZ) == 0);
+    NRF_LOG_INFO("CONT: streaming %d Hz of the %d Hz accel", CONT_STREAM_RATE_HZ, CONT_SAMPLE_RATE_HZ);
+
+    while(1)
     {
-#ifdef DEBUG
-        NRF_LOG_INFO("");
-        NRF_LOG_INFO("WRITE: ID: %d, addr: 0x%03x", i, *flash_addr);
-#endif
+        gyro_retry();
+        if (!sensor_health_ok(&g_sensor_health, SENSOR_ACCEL))
+        {
+            accel_retry_wait();
+            accel_decimate_reset(&g_cont_decimate);
+            live_stream_gap();
+            continue;
+        }
+        num_samples = adxl372_wait_for_fifo_burst();
+        if (g_adxl_dev.fifo_overruns != fifo_overruns)
+        {
+            fifo_overruns = g_adxl_dev.fifo_overruns;
+            accel_decimate_reset(&g_cont_decimate);
+            live_stream_gap();
+        }
+        gyro_read_fresh(&g_cont_gyro);
+        accel_decimate_block(&g_cont_decimate, g_fifo_burst_buf, num_samples);
 
-        mt25ql256aba_check_write_in_progress_flag();
-        convert_4byte_address_to_3byte_address(*flash_addr, flash_addr_buf);
-        sample_byte_ptr = (uint8_t*) &g_sample_set_buf[i];
-        mt25ql256aba_write_enable();
-        ret = mt25ql256aba_write_op(MT25QL256ABA_PAGE_PROGRAM, 
-                              flash_addr_buf,
-                              sizeof(flash_addr_buf), 
-                              sample_byte_ptr,
-                              sample_size_bytes);
-        mt25ql256aba_write_disable();
-        *flash_addr = *flash_addr + sample_size_bytes; 
-        spi_ret_check(ret);
+        while (live_stream_peek(&p_frame, &length))
+        {
+            (void) serial_offload_write(p_frame, length);
+            live_stream_pop();
+        }
     }
 }
-
-void flash_retrieve_samples(uint32_t* flash_addr)
-{
-    uint8_t sample_size_bytes = sizeof(impact_sample_t);
-    uint32_t addr32 = *flash_addr-sample_size_bytes*g_buf_index;
-    uint8_t addr[3] = {0};
-    uint8_t *sample_byte_ptr;
-
-#ifdef DEBUG
-    NRF_LOG_INFO("");
-    NRF_LOG_INFO("BEGIN RETRIEVE SAMPLES");
-#endif
-    for(int i = 0; i < g_buf_index; ++i) 
-    {
-        mt25ql256aba_check_write_in_progress_flag();
-        convert_4byte_address_to_3byte_address(addr32, addr);
-        sample_byte_ptr = (uint8_t*) &g_flash_output_buf[i];
-        mt25ql256aba_read_op(MT25QL256ABA_READ,
-                              addr,
-                              sizeof(addr),
-                              sample_byte_ptr,
-                              sample_size_bytes);
-#ifdef DEBUG
-        NRF_LOG_INFO("READ: ID: %d, addr: 0x%03x, OUTPUT: %d (%d)",
-                       i, addr32, g_flash_output_buf[i].adxl_data.x,
-                        g_sample_set_buf[i].adxl_data.x);
 #endif
-        addr32 = addr32 + sample_size_bytes;
-    }
-}
 
-void serial_output_flash_data(void)
-{
-    NRF_LOG_INFO("\r\n===================IMPACT DATA OUTPUT===================");
-    for (int i = 0; i < g_buf_index; ++i)
-    {
-        NRF_LOG_INFO("");
-        NRF_LOG_INFO("ID = %d", i);
-        NRF_LOG_INFO("accel x= %d, accel y = %d,  accel z= %d mG's",
-                        g_flash_output_buf[i].adxl_data.x, 
-                        g_flash_output_buf[i].adxl_data.y,
-                        g_flash_output_buf[i].adxl_data.z);
-        NRF_LOG_INFO("      accel x = %d, accel y = %d, accel z = %d mG's",
-                            g_flash_output_buf[i].icm_data.accel_x,
-                            g_flash_output_buf[i].icm_data.accel_y,
-                            g_flash_output_buf[i].icm_data.accel_z);
-        NRF_LOG_INFO("      gyro x = %d, gyro y = %d, gyro z = %d mrad/s", 
-                            g_flash_output_buf[i].icm_data.gyro_x,
-                            g_flash_output_buf[i].icm_data.gyro_y,
-                            g_flash_output_buf[i].icm_data.gyro_z);
-        if(i == 0)
-        {
-            NRF_LOG_INFO("      date: %d day: %d",
-                            g_flash_output_buf[i].ds_data.date,
-                            g_flash_output_buf[i].ds_data.day);
-            NRF_LOG_INFO("      Year: %d Month: %d Hour: %d ",
-                                g_flash_output_buf[i].ds_data.year,
-                                g_flash_output_buf[i].ds_data.month,
-                                g_flash_output_buf[i].ds_data.hour);
-            NRF_LOG_INFO("      Minute: %d, Second: %d, Hundreth: %d",
-                            g_flash_output_buf[i].ds_data.minute,
-                            g_flash_output_buf[i].ds_data.second,
-                            g_flash_output_buf[i].ds_data.hundreth); 
-        }
-    }
-    g_buf_index = 0; //reset buf index
-    memset(g_flash_output_buf, 0x00, sizeof(g_flash_output_buf));
-    NRF_LOG_INFO("\r\n====================DATA OUTPUT FINISH==================");
-}
+#ifdef USE_SUMMARY_LOG_MODE
 
-//depreciated
-void serial_debug_output_flash_data(void)
+// Logs the session in SUMMARY_WINDOW_S windows, never returns. The adxl372 peak detect
+// fifo keeps only the peak of each excursion over SUMMARY_HIT_COUNTS and the MAXPEAK
+// registers the highest sample since they were read, so the cpu only wakes at the fifo
+// watermark and at the end of each window. The records are stored when
+// SUMMARY_LOG_RECORDS_PER_EVENT are queued or the helmet is taken off
+void summary_log_run(void)
 {
-    NRF_LOG_INFO("\r\n===================IMPACT DATA OUTPUT===================");
-    for (int i = 0; i < g_buf_index; ++i)
-    {
-        NRF_LOG_INFO("");
-        NRF_LOG_INFO("ID = %d", i);
+    adxl372_accel_data_t max_peak;
+    bool worn;
 
-        if(g_flash_output_buf[i].adxl_data.x != g_sample_set_buf[i].adxl_data.x ||
-            g_flash_output_buf[i].adxl_data.y != g_sample_set_buf[i].adxl_data.y ||
-            g_flash_output_buf[i].adxl_data.z != g_sample_set_buf[i].adxl_data.z)
+    summary_log_init(&g_summary_log, SUMMARY_EXPOSURE_LIMIT_COUNTS);
+    //the gyro is not logged
+    if (sensor_health_ok(&g_sensor_health, SENSOR_GYRO))
+        spi_ret_check(SENSOR_GYRO, icm20649_set_sleep(true));
+    adxl372_set_activity_threshold(SUMMARY_HIT_COUNTS, false, true);
+    adxl372_set_op_mode(FULL_BW_MEASUREMENT);
+    adxl372_configure_fifo(&g_adxl_dev, SUMMARY_FIFO_WATERMARK, STREAMED, XYZ_PEAK_FIFO);
+    //restarts the max peak for the first window
+    adxl372_get_highest_peak_accel_data(&max_peak);
+    APP_ERROR_CHECK(app_timer_start(m_summary_timer_id, APP_TIMER_TICKS(SUMMARY_WINDOW_S*1000), NULL));
+
+    while(1)
+    {
+        cpu_sleep();
+        if (adxl372_int_pending(ADXL_INT1))
         {
-            NRF_LOG_INFO("accel x= %d (%d) accel y = %d (%d),  accel z= %d(%d) mG's",
-                            g_flash_output_buf[i].adxl_data.x, g_sample_set_buf[i].adxl_data.x, 
-                            g_flash_output_buf[i].adxl_data.y, g_sample_set_buf[i].adxl_data.y,
-                            g_flash_output_buf[i].adxl_data.z, g_sample_set_buf[i].adxl_data.z);
+            adxl372_int_clear(ADXL_INT1);
+            summary_drain_peaks();
         }
-        if(g_flash_output_buf[i].icm_data.accel_x != g_sample_set_buf[i].icm_data.accel_x ||
-            g_flash_output_buf[i].icm_data.accel_y != g_sample_set_buf[i].icm_data.accel_y||
-            g_flash_output_buf[i].icm_data.accel_z != g_sample_set_buf[i].icm_data.accel_z)
+        if (!g_summary_window_done)
         {
-            NRF_LOG_INFO("      accel x = %d (%d), accel y = %d (%d), accel z = %d (%d) mG's",
-                                g_flash_output_buf[i].icm_data.accel_x, g_sample_set_buf[i].icm_data.accel_x,
-                                g_flash_output_buf[i].icm_data.accel_y, g_sample_set_buf[i].icm_data.accel_y,
-                                g_flash_output_buf[i].icm_data.accel_z, g_sample_set_buf[i].icm_data.accel_z);
+            continue;
         }
-        if(g_flash_output_buf[i].icm_data.gyro_x != g_sample_set_buf[i].icm_data.gyro_x ||
-            g_flash_output_buf[i].icm_data.gyro_y != g_sample_set_buf[i].icm_data.gyro_y ||
-            g_flash_output_buf[i].icm_data.gyro_z != g_sample_set_buf[i].icm_data.gyro_z)
+        g_summary_window_done = false;
+
+        summary_drain_peaks();
+        adxl372_get_highest_peak_accel_data(&max_peak);
+        summary_log_add_max(&g_summary_log, &max_peak);
+        if (g_summary_log.count == 0)
         {
-            NRF_LOG_INFO("      gyro x = %d (%d), gyro y = %d (%d), gyro z = %d (%d) mrad/s", 
-                                g_flash_output_buf[i].icm_data.gyro_x, g_sample_set_buf[i].icm_data.gyro_x,
-                                g_flash_output_buf[i].icm_data.gyro_y, g_sample_set_buf[i].icm_data.gyro_y,
-                                g_flash_output_buf[i].icm_data.gyro_z, g_sample_set_buf[i].icm_data.gyro_z);
+            record_event_timestamp(&g_summary_rtc);
         }
-
-        if(g_flash_output_buf[i].ds_data.date!= g_sample_set_buf[i].ds_data.date ||
-            g_flash_output_buf[i].ds_data.day != g_sample_set_buf[i].ds_data.day)
+#ifdef DEBUG
+        NRF_LOG_INFO("SUMMARY: WINDOW %d, PEAK %d mg, %d HITS, EXPOSURE %d g", g_summary_log.window,
+                     ADXL372_COUNTS_TO_MG(g_summary_log.window_peak), g_summary_log.window_hits,
+                     (g_summary_log.exposure*ADXL372_MG_PER_LSB)/1000);
+#endif
+        //the flash is retried once per window, the gyro stays asleep here
+        flash_retry();
+        worn = vcnl4040_is_worn();
+        if (summary_log_close_window(&g_summary_log) || (!worn && g_summary_log.count > 0))
         {
-            NRF_LOG_INFO("      date: %d (%d) day: %d(%d)",
-                            g_flash_output_buf[i].ds_data.date, g_sample_set_buf[i].ds_data.date,
-                            g_flash_output_buf[i].ds_data.day,  g_sample_set_buf[i].ds_data.day);
+            summary_log_store();
         }
-        if(g_flash_output_buf[i].ds_data.year!= g_sample_set_buf[i].ds_data.year ||
-            g_flash_output_buf[i].ds_data.month != g_sample_set_buf[i].ds_data.month ||
-            g_flash_output_buf[i].ds_data.hour != g_sample_set_buf[i].ds_data.hour)
+        if (g_summary_log.flagged)
         {
-            NRF_LOG_INFO("      Year: %d (%d) Month: %d(%d) Hour: %d(%d) ",
-                            g_flash_output_buf[i].ds_data.year, g_sample_set_buf[i].ds_data.year,
-                            g_flash_output_buf[i].ds_data.month, g_sample_set_buf[i].ds_data.month,
-                            g_flash_output_buf[i].ds_data.hour, g_sample_set_buf[i].ds_data.hour);
+            NRF_LOG_INFO("SUMMARY: EXPOSURE LIMIT REACHED, %d g", (g_summary_log.exposure*ADXL372_MG_PER_LSB)/1000);
         }
-        if(g_flash_output_buf[i].ds_data.minute != g_sample_set_buf[i].ds_data.minute||
-            g_flash_output_buf[i].ds_data.second != g_sample_set_buf[i].ds_data.second ||
-            g_flash_output_buf[i].ds_data.hundreth != g_sample_set_buf[i].ds_data.hundreth)
-        NRF_LOG_INFO("      Minute: %d (%d), Second: %d (%d), Hundreth: %d (%d)",
-                        g_flash_output_buf[i].ds_data.minute,g_sample_set_buf[i].ds_data.minute,
-                        g_flash_output_buf[i].ds_data.second, g_sample_set_buf[i].ds_data.second,
-                        g_flash_output_buf[i].ds_data.hundreth, g_sample_set_buf[i].ds_data.hundreth); 
     }
-    //g_buf_index = 0; //reset buf index
-    memset(g_flash_output_buf, 0x00, sizeof(g_flash_output_buf));
-    NRF_LOG_INFO("\r\n====================DATA OUTPUT FINISH==================");
 }
 
-
-void adxl372_init(void)
+// Adds the hits waiting in the peak detect fifo to the window
+void summary_drain_peaks(void)
 {
-    //initialize device settings
-    /* set up measurement mode */
-    adxl372_reset();
-    adxl372_set_op_mode(STAND_BY);
-    //Please refer to figure 36 User offset trim profile for more info
-    //For ADXL372 Vs=3.3V, x_offset = 0, y_offset=2, z_offset=5 
-    adxl372_set_x_offset(0);
-    adxl372_set_y_offset(2); //+10 LSB
-    adxl372_set_z_offset(5); //+35 LSB
-    adxl372_set_hpf_disable(true);
-    adxl372_set_lpf_disable(true);
-    adxl372_set_bandwidth(BW_3200HZ);
-    adxl372_set_odr(ODR_6400HZ);
-    adxl372_set_filter_settle(FILTER_SETTLE_16);
-    adxl372_set_instaon_threshold(ADXL_INSTAON_HIGH_THRESH); //sets to 30g
-    adxl372_write_mask(ADI_ADXL372_MEASURE, MEASURE_LOW_NOISE_MASK, MEASURE_LOW_NOISE_POS, LOW_NOISE);
-    adxl372_set_op_mode(INSTANT_ON);
+    int16_t num_peaks;
 
+    num_peaks = adxl372_get_fifo_data(&g_adxl_dev, g_fifo_burst_buf, ADXL_FIFO_MAX_SAMPLES);
+    sensor_health_report(&g_sensor_health, SENSOR_ACCEL, num_peaks != -1);
+    if (num_peaks > 0)
+    {
+        summary_log_add_hits(&g_summary_log, g_fifo_burst_buf, num_peaks);
+    }
 }
+#endif
 
-
-
-void log_init(void)
+#if defined(USE_SUMMARY_LOG_MODE) || defined(USE_TIERED_TRIGGER)
+// Stores the queued window records as one event, with the flash out they are printed instead
+void summary_log_store(void)
 {
-    ret_code_t err_code = NRF_LOG_INIT(NULL);
-    APP_ERROR_CHECK(err_code);
+    event_store_time_t time;
 
-    NRF_LOG_DEFAULT_BACKENDS_INIT();
+    if (!sensor_health_ok(&g_sensor_health, SENSOR_FLASH))
+    {
+        for (uint16_t i = 0; i < g_summary_log.count; i++)
+        {
+            summary_log_record_t const* record = &g_summary_log.records[i];
+            NRF_LOG_INFO("SUMMARY (RAM ONLY): WINDOW %d, PEAK %d mg, %d HITS, EXPOSURE %d g", record->window,
+                         ADXL372_COUNTS_TO_MG(record->peak), record->hits,
+                         (record->exposure*ADXL372_MG_PER_LSB)/1000);
+        }
+        summary_log_clear(&g_summary_log);
+        return;
+    }
+    twi_wait_idle();
+    event_store_time_from_ds1388(&g_summary_rtc, &time);
+    spi_ret_check(SENSOR_FLASH, event_store_begin(&g_event_store, &time, NULL, sizeof(summary_log_record_t),
+                                                  SUMMARY_LOG_ENCODING));
+    spi_ret_check(SENSOR_FLASH, event_store_append(&g_event_store, g_summary_log.records, g_summary_log.count));
+    spi_ret_check(SENSOR_FLASH, event_store_commit(&g_event_store, NULL));
+    summary_log_clear(&g_summary_log);
 }
+#endif
 
-void spi_accel_init(void)
+#ifdef USE_TRIGGERED_FIFO_MODE
+static void triggered_int_handler(adxl372_int_pin_t int_pin)
 {
-    ret_code_t err_code = nrf_drv_spi_init(&accel_spi, &accel_spi_config, spi_event_handler, NULL);
-    APP_ERROR_CHECK(err_code);
-
+    if (int_pin == ADXL_INT1)
+    {
+        g_triggered_ticks = app_timer_cnt_get();
+    }
 }
 
-void spi_gyro_init(void)
+// Captures the impacts from windows the adxl372 fifo holds on its own, never returns.
+// The cpu only wakes for the activity event, the flash work between impacts and the
+// vcnl4040, the window is drained in one burst once the fifo is full behind the event.
+// The activity is per axis so the trigger runs over the drained window and a window
+// without an impact in it is dropped, an impact longer than the window is cut off
+void triggered_fifo_run(void)
 {
-    ret_code_t err_code = nrf_drv_spi_init(&gyro_spi, &gyro_spi_config, spi_event_handler, NULL);
-    APP_ERROR_CHECK(err_code);
-}
+    adxl372_int_set_callback(triggered_int_handler);
+    NRF_LOG_INFO("TRIGGERED: %d of %d samples before the activity at %d mg per axis", TRIGGERED_PRE_SAMPLES,
+                 ADXL_FIFO_MAX_SAMPLES, ADXL372_COUNTS_TO_MG(TRIGGERED_ACT_COUNTS));
 
+    while(1)
+    {
+        if (!vcnl4040_is_worn())
+        {
+            device_set_state(DEVICE_OFF_HEAD);
+            wait_until_worn();
+        }
+        device_set_state(DEVICE_ARMED);
+        gyro_retry();
+        flash_retry();
+        if (!sensor_health_ok(&g_sensor_health, SENSOR_ACCEL))
+        {
+            accel_retry_wait();
+            continue;
+        }
+        if (triggered_fifo_wait())
+        {
+            triggered_fifo_capture();
+        }
+    }
+}
 
-void spi_flash_init(void)
+// Empties the fifo and arms it for the next activity event, the activity
+// status is read out so the next event asserts INT1 again
+void triggered_fifo_arm(void)
 {
-    ret_code_t err_code = nrf_drv_spi_init(&flash_spi, &flash_spi_config, spi_event_handler, NULL);
-    APP_ERROR_CHECK(err_code);
+    adxl372_config_t config;
+
+    adxl372_set_activity_threshold(TRIGGERED_ACT_COUNTS, false, true);
+    //a single sample over the threshold starts the window, the trigger checks the duration
+    adxl372_set_activity_time(0);
+    APP_ERROR_CHECK_BOOL(adxl372_config_triggered_fifo(&config, TRIGGERED_PRE_SAMPLES) == 0);
+    spi_ret_check(SENSOR_ACCEL, adxl372_apply_config(&g_adxl_dev, &config));
+    adxl372_get_activity_status_reg();
+    adxl372_int_clear(ADXL_INT1);
 }
 
-void spi_accel_uninit(void)
+// Sleeps until the adxl372 activity event, the flash work of the last impacts
+// runs meanwhile: committing the records, their readback and refilling the pre-erased pool
+// returns false if the helmet was taken off instead, the fifo stays armed
+bool triggered_fifo_wait(void)
 {
-    nrf_drv_spi_uninit(&accel_spi);
+    int8_t flash_state = 1;
+
+    while(!adxl372_int_pending(ADXL_INT1) && vcnl4040_is_worn())
+    {
+        if (flash_state > 0)
+        {
+            flash_state = flash_background_step_from_accel();
+            if (g_commit.state != COMMIT_IDLE || flash_offload_pending())
+            {
+                continue;
+            }
+            if (flash_state > 0)
+            {
+                app_timer_start(m_erase_poll_timer_id, APP_TIMER_TICKS(ERASE_POLL_MS), NULL);
+            }
+        }
+        cpu_sleep();
+    }
+    app_timer_stop(m_erase_poll_timer_id);
+
+    return adxl372_int_pending(ADXL_INT1);
+}
+
+// Waits out the rest of the window after the activity event, drains it and arms
+// the fifo again before the samples are looked at, so the next impact is held
+// while this one is captured and committed
+void triggered_fifo_capture(void)
+{
+    uint32_t since_us = app_timer_since_us(g_triggered_ticks);
+    icm20649_data_t low_g_gyro_data = {0};
+    int16_t num_samples;
+    int16_t trigger_index;
+
+    adxl372_int_clear(ADXL_INT1);
+    if (since_us < TRIGGERED_POST_US)
+    {
+        //the fifo fills behind the event at the output data rate, one tick more for the rounding
+        g_measurement_done = false;
+        app_timer_start(m_measurement_timer_id, APP_TIMER_TICKS((TRIGGERED_POST_US - since_us + 999)/1000) + 1, NULL);
+        while (!g_measurement_done)
+        {
+            cpu_sleep();
+        }
+        g_measurement_done = false;
+    }
+
+    num_samples = adxl372_get_fifo_data(&g_adxl_dev, g_fifo_burst_buf, ADXL_FIFO_MAX_SAMPLES);
+    sensor_health_report(&g_sensor_health, SENSOR_ACCEL, num_samples != -1);
+    triggered_fifo_arm();
+    if (num_samples <= 0)
+    {
+        TRACE(TRACE_ID_FIFO_ERROR, 0, num_samples);
+        return;
+    }
+    g_pipeline_stats.fifo_overruns = g_adxl_dev.fifo_overruns;
+
+    //every window starts the filter and the trigger over, the samples before the event settle the filter
+    sample_stream_restart();
+#ifdef USE_ACCEL_FILTER
+    accel_filter_block(&g_accel_filter, g_fifo_burst_buf, (uint16_t) num_samples);
+#endif
+    trigger_index = impact_trigger_update(&g_impact_trigger, g_fifo_burst_buf, num_samples);
+    TRACE(TRACE_ID_FIFO_TRIGGER, num_samples, trigger_index);
+    if (trigger_index < 0)
+    {
+        //over the per axis threshold but not the resultant or not for long enough
+        impact_trigger_rearm(&g_impact_trigger);
+        return;
+    }
+
+    device_set_state(DEVICE_CAPTURING);
+    //the trigger is dated as the activity event, the samples ahead of it are the pre-trigger window
+    g_capture->start_ticks = g_triggered_ticks;
+    sample_ring_push(&g_pre_trigger_ring, g_fifo_burst_buf, trigger_index);
+    sample_pre_trigger_window(&g_capture->rtc_data);
+    sample_impact_fifo_burst(&g_fifo_burst_buf[trigger_index], num_samples - trigger_index,
+                             &low_g_gyro_data, &g_capture->rtc_data);
+    capture_end(((uint32_t) (num_samples - trigger_index)*1000000UL)/ADXL_SAMPLE_RATE_HZ);
+    device_set_state(DEVICE_ARMED);
+}
+#endif
+
+// Moves to a new device state. Entering and leaving DEVICE_OFF_HEAD is where
+// the sensors are put to sleep and woken again, the other states share one power level
+void device_set_state(device_state_t state)
+{
+    if (state == g_device_state)
+        return;
+
+    if (state == DEVICE_OFF_HEAD)
+    {
+        sensors_sleep();
+    }
+    else if (g_device_state == DEVICE_OFF_HEAD)
+    {
+        sensors_wake();
+    }
+    TRACE(TRACE_ID_STATE, g_device_state, state);
+    g_device_state = state;
+}
+
+// The adxl372 keeps measuring at the wake up rate so it can be rearmed without
+// a full init, its interrupts only wake the cpu briefly while off head
+void sensors_sleep(void)
+{
+    if (sensor_health_ok(&g_sensor_health, SENSOR_GYRO))
+        spi_ret_check(SENSOR_GYRO, icm20649_set_sleep(true));
+    adxl372_set_op_mode(WAKE_UP);
+#ifdef USE_ADXL_EXT_SYNC
+    //the sync edges keep the HFCLK running, nothing reads the samples off head
+    sample_clock_sync_stop();
+#endif
+}
+
+void sensors_wake(void)
+{
+    if (sensor_health_ok(&g_sensor_health, SENSOR_GYRO))
+        spi_ret_check(SENSOR_GYRO, icm20649_set_sleep(false));
+#ifdef USE_TRIGGERED_FIFO_MODE
+    //a window of the wake up rate could be left in the fifo
+    triggered_fifo_arm();
+#elif defined(USE_ADXL_FIFO_INT_MODE)
+#ifdef USE_ACTIVITY_WAKEUP
+    //adxl372_rest_until_activity resets the fifo and rearms the adxl372
+    g_adxl_armed = true;
+#else
+    adxl372_set_op_mode(FULL_BW_MEASUREMENT);
+    adxl372_configure_fifo(&g_adxl_dev, ADXL_FIFO_WATERMARK, STREAMED, XYZ_FIFO);
+    sample_stream_restart();
+#endif
+#else
+    adxl372_set_op_mode(FULL_BW_MEASUREMENT);
+#ifdef USE_ADXL_EXT_SYNC
+    accel_sync_start();
+#endif
+#endif
+}
+
+// Sleeps until the vcnl4040 threshold interrupt reports the helmet is worn.
+// With USE_DEEP_SLEEP a helmet left off head for DEEP_SLEEP_OFF_HEAD_MS enters System OFF
+void wait_until_worn(void)
+{
+#ifdef USE_DEEP_SLEEP
+    g_off_head_timeout = false;
+    app_timer_start(m_off_head_timer_id, APP_TIMER_TICKS(DEEP_SLEEP_OFF_HEAD_MS), NULL);
+#endif
+    while (!vcnl4040_is_worn())
+    {
+#ifdef USE_DEEP_SLEEP
+        if (g_off_head_timeout)
+        {
+            //only returns if the helmet was put on while finishing the flash work
+            deep_sleep_off_head();
+            continue;
+        }
+#endif
+        cpu_sleep();
+    }
+#ifdef USE_DEEP_SLEEP
+    app_timer_stop(m_off_head_timer_id);
+#endif
+}
+
+#ifdef USE_DEEP_SLEEP
+// Finishes the pending commit, offload and erase, saves the state and powers down:
+// the flash to deep power-down and the adxl372 to standby (with USE_ACTIVITY_WAKEUP
+// it watches for a hit in WAKE_UP mode instead), the icm20649 already sleeps off head.
+// Only the vcnl4040 INT pin, and the adxl372 INT2 with its activity, wake the board
+// returns if the helmet is put on before the System OFF
+void deep_sleep_off_head(void)
+{
+    retained_state_t state;
+    deep_sleep_wake_pin_t const wake_pins[] = {
+        {VCNL4040_INT_PIN, NRF_GPIO_PIN_PULLUP, NRF_GPIO_PIN_SENSE_LOW},
+#ifdef USE_ACTIVITY_WAKEUP
+        {ADXL_INT2_PIN, NRF_GPIO_PIN_PULLDOWN, NRF_GPIO_PIN_SENSE_HIGH},
+#endif
+    };
+
+    while (flash_background_step_from_accel() > 0)
+    {
+        if (vcnl4040_is_worn())
+        {
+            app_timer_stop(m_erase_poll_timer_id);
+            return;
+        }
+        if (g_commit.state == COMMIT_IDLE && !flash_offload_pending())
+        {
+            //only the erase is left, it does not need the cpu
+            app_timer_start(m_erase_poll_timer_id, APP_TIMER_TICKS(ERASE_POLL_MS), NULL);
+            cpu_sleep();
+        }
+    }
+    app_timer_stop(m_erase_poll_timer_id);
+
+    state.event_store = g_event_store;
+    state.offload_next_id = g_offload_next_id;
+    state.pipeline_stats = g_pipeline_stats;
+    APP_ERROR_CHECK_BOOL(deep_sleep_save(&state, sizeof(state)) == 0);
+
+    if (sensor_health_ok(&g_sensor_health, SENSOR_FLASH))
+        spi_ret_check(SENSOR_FLASH, mt25ql256aba_deep_power_down());
+#ifdef USE_ACTIVITY_WAKEUP
+    adxl372_int_clear(ADXL_INT2);
+    adxl372_arm_activity_wakeup(WAKE_UP);
+#else
+    adxl372_set_op_mode(STAND_BY);
+#endif
+    NRF_LOG_INFO("DEEP SLEEP: %d events, %d offloaded", event_store_count(&g_event_store), g_offload_next_id);
+    deep_sleep_enter(wake_pins, ARRAY_SIZE(wake_pins));
+}
+#endif
+
+// Takes back the state deep_sleep_off_head saved when this boot is its System OFF
+// wake up, the saved block is cleared on every boot
+// returns true if the store, the offload position and the counters were restored
+bool deep_sleep_woke(void)
+{
+#ifdef USE_DEEP_SLEEP
+    retained_state_t state;
+
+    if (!deep_sleep_restore(&state, sizeof(state))
+        || (boot_check_reset_reason() & POWER_RESETREAS_OFF_Msk) == 0)
+    {
+        return false;
+    }
+    g_event_store = state.event_store;
+    g_offload_next_id = state.offload_next_id;
+    g_pipeline_stats = state.pipeline_stats;
+    NRF_LOG_INFO("DEEP SLEEP: woke up, %d events", event_store_count(&g_event_store));
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Schedules the event timestamp read on the i2c bus instead of waiting for it,
+// flash_commit_step waits for the bus to go idle before using it
+void record_event_timestamp(ds1388_data_t* rtc_data)
+{
+    if (ds1388_schedule_get_time(rtc_data, NULL, NULL) < 0)
+    {
+        ds1388_get_time(rtc_data);
+    }
+    g_record_timestamp = true;
+}
+
+// returns the microseconds since an app_timer_cnt_get() count, the counter wraps after 512 s
+uint32_t app_timer_since_us(uint32_t start_ticks)
+{
+    return ((uint64_t)app_timer_cnt_diff_compute(app_timer_cnt_get(), start_ticks) * 1000000
+                * (APP_TIMER_CONFIG_RTC_FREQUENCY + 1)) / APP_TIMER_CLOCK_FREQ;
+}
+
+void sample_impact_data (adxl372_accel_data_t* high_g_data, icm20649_data_t* low_g_gyro_data, ds1388_data_t* rtc_data)
+{
+    uint32_t ticks;
+    uint32_t delta = 0;
+    uint64_t periods;
+
+    if(g_record_timestamp == false)
+    {
+        record_event_timestamp(rtc_data);
+    }
+    //accel and gyro are on separate spi instances so both are read in parallel
+    imu_sample_pair_t pair;
+    int8_t ret;
+    uint8_t failed;
+    if (sensor_health_ok(&g_sensor_health, SENSOR_GYRO))
+    {
+        //each sensor is charged with its own read
+        ret = imu_sampler_read_pair(&pair);
+        failed = (ret < 0) ? imu_sampler_failed() : 0;
+        spi_ret_check(SENSOR_ACCEL, (failed & IMU_SAMPLER_FAILED_ACCEL) ? ret : 0);
+        spi_ret_check(SENSOR_GYRO, (failed & IMU_SAMPLER_FAILED_ICM) ? ret : 0);
+        *high_g_data = pair.accel;
+        *low_g_gyro_data = pair.icm;
+    }
+    else
+    {
+        //accel only, the records keep a zero gyro
+        adxl372_get_accel_data(high_g_data);
+        memset(low_g_gyro_data, 0, sizeof(icm20649_data_t));
+    }
+    //adxl372 sample periods since the previous polled sample, the fraction a delta
+    //drops is carried to the next one so the deltas add up to the elapsed time
+    ticks = app_timer_cnt_get();
+    if (g_capture->count > 0)
+    {
+        periods = (uint64_t)app_timer_cnt_diff_compute(ticks, g_last_sample_ticks) * ADXL_SAMPLE_RATE_HZ
+                    * (APP_TIMER_CONFIG_RTC_FREQUENCY + 1) + g_last_sample_carry;
+        delta = periods / APP_TIMER_CLOCK_FREQ;
+        g_last_sample_carry = periods % APP_TIMER_CLOCK_FREQ;
+    }
+    else
+    {
+        g_last_sample_carry = 0;
+    }
+    g_last_sample_ticks = ticks;
+    if (g_capture->count < MAX_SAMPLE_BUF_LENGTH)
+    {
+        capture_push(high_g_data, low_g_gyro_data,
+                     delta > IMPACT_RECORD_DELTA_MAX ? IMPACT_RECORD_DELTA_MAX : delta);
+    }
+    else
+    {
+        g_capture->dropped++;
+    }
+}
+
+#if !defined(USE_ADXL_FIFO_INT_MODE) && defined(USE_SAMPLE_CLOCK)
+STATIC_ASSERT(CLOCKED_SAMPLES <= MAX_SAMPLE_BUF_LENGTH);
+STATIC_ASSERT(ADXL_SAMPLE_RATE_HZ % SAMPLE_CLOCK_HZ == 0);
+#ifdef USE_ADXL_EXT_SYNC
+//a sample per edge, the adxl372 filters are set for its own rate
+STATIC_ASSERT(SAMPLE_CLOCK_HZ == ADXL_SAMPLE_RATE_HZ);
+#endif
+//the raw reads are staged in the other capture buffer, polled impacts are committed before the next one
+STATIC_ASSERT(CLOCKED_SAMPLES*(CLOCKED_ACCEL_LENGTH + CLOCKED_GYRO_LENGTH) <= sizeof(g_capture_bufs[0].records));
+
+// Samples the impact at exactly SAMPLE_CLOCK_HZ. The sample clock reads the accel
+// and the gyro in hardware for IMPACT_MAX_DURATION while the cpu sleeps, the raw
+// reads are then unpacked into records one sample clock period apart
+void sample_clocked_impact(ds1388_data_t* rtc_data)
+{
+    static uint8_t accel_read_cmd = (ADI_ADXL372_X_DATA_H << 1) | ADXL_SPI_RNW; //in ram for EasyDMA
+    static uint8_t gyro_read_cmd = ICM20649_REG_ADDR(ICM20649_ACCEL_XOUT_H) | 0x80;
+    uint8_t* accel_raw = (uint8_t*) capture_buf_other()->records;
+    uint8_t* gyro_raw = accel_raw + CLOCKED_SAMPLES*CLOCKED_ACCEL_LENGTH;
+    adxl372_accel_data_t accel;
+    icm20649_data_t gyro = {0};
+    uint16_t num_samples;
+    bool gyro_ok = sensor_health_ok(&g_sensor_health, SENSOR_GYRO);
+
+    sample_clock_channel_t const channels[] = {
+        {&accel_spi, SPI_ACCEL_CS_PIN, &accel_read_cmd, 1, accel_raw, CLOCKED_ACCEL_LENGTH},
+        {&gyro_spi, SPI_GYRO_CS_PIN, &gyro_read_cmd, 1, gyro_raw, CLOCKED_GYRO_LENGTH},
+    };
+
+    record_event_timestamp(rtc_data);
+    if (gyro_ok)
+        spi_ret_check(SENSOR_GYRO, icm20649_select_bank(ICM20649_REG_BANK(ICM20649_ACCEL_XOUT_H)));
+    //the gyro channel is last, accel only without it
+    spi_ret_check(SENSOR_ACCEL, sample_clock_start(channels, gyro_ok ? ARRAY_SIZE(channels) : 1,
+                                                   SAMPLE_CLOCK_HZ, CLOCKED_SAMPLES));
+
+    //the measurement timer wakes the cpu at the end of the impact
+    while(g_measurement_done == false)
+    {
+        cpu_sleep();
+    }
+    //the two clocks drift apart a little, let the sample clock finish the window
+    while(sample_clock_count() < CLOCKED_SAMPLES);
+    num_samples = sample_clock_stop();
+
+    capture_count_drops(num_samples);
+    for (int i = 0; i < num_samples && g_capture->count < MAX_SAMPLE_BUF_LENGTH; ++i)
+    {
+        adxl372_parse_accel_data(&accel_raw[i*CLOCKED_ACCEL_LENGTH + 1], &accel);
+        if (gyro_ok)
+            icm20649_parse_gyro_accel_data(&gyro_raw[i*CLOCKED_GYRO_LENGTH + 1], &gyro);
+        capture_push(&accel, &gyro, (g_capture->count > 0) ? ADXL_SAMPLE_RATE_HZ/SAMPLE_CLOCK_HZ : 0);
+    }
+}
+
+#ifdef USE_ADXL_EXT_SYNC
+// (Re)starts the adxl372 external sync from the sample clock, the polled trigger
+// reads get a sample per edge too and sample_clocked_impact reads on the same clock
+void accel_sync_start(void)
+{
+    sample_clock_sync_stop();
+    APP_ERROR_CHECK_BOOL(sample_clock_sync_start(ADXL_INT2_PIN, SAMPLE_CLOCK_HZ) == 0);
+}
+#endif
+#endif
+
+#ifdef USE_ADXL_FIFO_INT_MODE
+// Sleeps until the adxl372 fifo watermark interrupt and then drains the
+// whole fifo into g_fifo_burst_buf in one burst
+// returns the number of xyz samples read
+uint16_t adxl372_wait_for_fifo_burst(void)
+{
+    int16_t ret;
+
+#ifdef USE_ACTIVITY_WAKEUP
+    //the first samples of a wake up go to the trigger as soon as they are in
+    while(!g_adxl_handoff.drain && !adxl372_int_pending(ADXL_INT1))
+    {
+        cpu_sleep();
+    }
+    g_adxl_handoff.drain = false;
+#else
+    while(!adxl372_int_pending(ADXL_INT1))
+    {
+        cpu_sleep();
+    }
+#endif
+    adxl372_int_clear(ADXL_INT1);
+
+    g_fifo_burst_us = timebase_now_us();
+    ret = adxl372_get_fifo_data(&g_adxl_dev, g_fifo_burst_buf, ADXL_FIFO_MAX_SAMPLES);
+    sensor_health_report(&g_sensor_health, SENSOR_ACCEL, ret != -1);
+    if (ret < 0)
+    {
+        TRACE(TRACE_ID_FIFO_ERROR, 0, ret);
+        return 0;
+    }
+#ifdef USE_ACCEL_FILTER
+    accel_filter_block(&g_accel_filter, g_fifo_burst_buf, (uint16_t) ret);
+#endif
+    g_pipeline_stats.fifo_overruns = g_adxl_dev.fifo_overruns;
+
+    return ret;
+}
+
+#ifdef USE_ADXL_AUTOSLEEP
+// Resets the adxl372 into the fifo int mode with looped activity and inactivity
+// detection and autosleep, so it drops to wake up mode after AUTOSLEEP_INACT_MS of quiet
+// and back to full bandwidth on activity by itself. INT2 follows its AWAKE bit, the
+// inactivity also asserts INT1 so the burst wait does not sit out a sparse watermark
+void adxl372_autosleep_config(void)
+{
+    adxl372_config_t config;
+
+    APP_ERROR_CHECK_BOOL(adxl372_config_fifo_int_default(&config, ADXL_FIFO_WATERMARK) == 0
+                         && adxl372_config_set_autosleep(&config, AUTOSLEEP_WUR) == 0);
+    config.int1_map |= INT_MAP_INACT_MSK;
+    config.int2_map = INT_MAP_AWAKE_MSK;
+    adxl372_reset();
+    adxl372_set_activity_threshold(AUTOSLEEP_ACT_COUNTS, true, true);
+    adxl372_set_activity_time(ACT_TIMER);
+    adxl372_set_inactivity_threshold(AUTOSLEEP_INACT_COUNTS, true, true);
+    adxl372_set_inactivity_time(AUTOSLEEP_INACT_TIME);
+    spi_ret_check(SENSOR_ACCEL, adxl372_apply_config(&g_adxl_dev, &config));
+}
+
+// Sleeps while the adxl372 is asleep in wake up mode, doing the flash work meanwhile,
+// until its activity brings it back. The fifo kept filling at the wake up rate, those
+// samples are dropped and the stream starts over at the full rate
+// returns false if the helmet was taken off instead, the adxl372 sleeps on
+bool adxl372_wait_awake(void)
+{
+    uint32_t asleep_ticks;
+    int8_t flash_state = 1;
+
+    //the pending flag only latches the rising edge, the pin level is what is left
+    adxl372_int_clear(ADXL_INT2);
+    if (adxl372_int_pending(ADXL_INT2))
+    {
+        return true;
+    }
+
+    asleep_ticks = app_timer_cnt_get();
+    while(!adxl372_int_pending(ADXL_INT2) && vcnl4040_is_worn())
+    {
+        if (adxl372_int_pending(ADXL_INT1))
+        {
+            //a watermark of sparse samples, or the inactivity that put it to sleep
+            adxl372_int_clear(ADXL_INT1);
+            sensor_health_report(&g_sensor_health, SENSOR_ACCEL,
+                                 adxl372_get_fifo_data(&g_adxl_dev, g_fifo_burst_buf, ADXL_FIFO_MAX_SAMPLES) != -1);
+        }
+        if (flash_state > 0)
+        {
+            flash_state = flash_background_step_from_accel();
+            if (g_commit.state != COMMIT_IDLE || flash_offload_pending())
+            {
+                continue;
+            }
+            if (flash_state > 0)
+            {
+                app_timer_start(m_erase_poll_timer_id, APP_TIMER_TICKS(ERASE_POLL_MS), NULL);
+            }
+        }
+        cpu_sleep();
+    }
+    app_timer_stop(m_erase_poll_timer_id);
+    if (!adxl372_int_pending(ADXL_INT2))
+    {
+        return false;
+    }
+
+    adxl372_int_clear(ADXL_INT1);
+    sensor_health_report(&g_sensor_health, SENSOR_ACCEL,
+                         adxl372_get_fifo_data(&g_adxl_dev, g_fifo_burst_buf, ADXL_FIFO_MAX_SAMPLES) != -1);
+    sample_stream_restart();
+    TRACE(TRACE_ID_AUTOSLEEP_WAKE, 0, app_timer_since_us(asleep_ticks)/1000);
+    return true;
+}
+#endif
+
+#ifdef USE_ACTIVITY_WAKEUP
+// Sets both the instant on and the activity threshold so either ADXL_REST_MODE works
+// and maps activity to INT2. Sampling starts resting until the first activity
+void adxl372_activity_wakeup_config(void)
+{
+    adxl372_set_instaon_threshold(ADXL_INSTAON_LOW_THRESH);
+#ifdef USE_TIERED_TRIGGER
+    adxl372_set_activity_threshold(TIER_SUMMARY_COUNTS, false, true);
+    adxl372_set_activity2_threshold(IMPACT_AXIS_COUNTS, false, true);
+#else
+    adxl372_set_activity_threshold(IMPACT_THRESHOLD_COUNTS, false, true);
+#endif
+    adxl372_set_activity_time(ACT_TIMER);
+    adxl372_set_wakeup_rate(WUR_52MS);
+    adxl372_set_interrupts(INT_MAP_FIFO_FULL_MSK, INT_MAP_ACT_MSK);
+    g_adxl_armed = true;
+}
+
+// returns the squared resultant of a sample in counts
+static uint32_t accel_resultant_sq(adxl372_accel_data_t const *p_accel)
+{
+    return (uint32_t) ((int32_t) p_accel->x*p_accel->x + (int32_t) p_accel->y*p_accel->y
+                       + (int32_t) p_accel->z*p_accel->z);
+}
+
+static void wake_int_handler(adxl372_int_pin_t int_pin)
+{
+    if (int_pin == ADXL_INT2)
+    {
+        g_wake_ticks = app_timer_cnt_get();
+    }
+}
+
+// Puts the adxl372 (and the cpu) to sleep until the adxl372 sees activity
+// the fifo is reset so no stale samples end up in the pre-trigger window,
+// the fifo, odr and bandwidth are written here so the wake up needs at most the op mode
+// returns false if the helmet was taken off instead, the adxl372 stays armed
+bool adxl372_rest_until_activity(void)
+{
+#ifdef USE_GYRO_DUTY_CYCLE
+    gyro_duty_rest();
+#endif
+    adxl372_handoff_check();
+    adxl372_configure_fifo(&g_adxl_dev, ADXL_FIFO_WATERMARK, STREAMED, XYZ_FIFO);
+    sample_stream_restart();
+    adxl372_int_clear(ADXL_INT2);
+    adxl372_int_set_callback(wake_int_handler);
+    adxl372_arm_activity_wakeup(ADXL_REST_MODE);
+
+    //finish the last commit and refill the pre-erased flash pool while resting, the accel bus is idle
+    int8_t flash_state = 1;
+    while(!adxl372_int_pending(ADXL_INT2) && vcnl4040_is_worn())
+    {
+        if (flash_state > 0)
+        {
+            flash_state = flash_background_step_from_accel();
+            if (g_commit.state != COMMIT_IDLE || flash_offload_pending())
+            {
+                //commit and readback steps do not wait on an erase, no need to sleep
+                continue;
+            }
+            if (flash_state > 0)
+            {
+                app_timer_start(m_erase_poll_timer_id, APP_TIMER_TICKS(ERASE_POLL_MS), NULL);
+            }
+        }
+        cpu_sleep();
+    }
+    app_timer_stop(m_erase_poll_timer_id);
+    if (!adxl372_int_pending(ADXL_INT2))
+    {
+        return false;
+    }
+    adxl372_int_clear(ADXL_INT2);
+    adxl372_int_set_callback(NULL);
+    g_adxl_armed = false;
+
+    //in WAKE_UP mode the fifo only runs at full rate in measurement mode, the one write
+    if (ADXL_REST_MODE == WAKE_UP)
+    {
+        adxl372_set_op_mode(FULL_BW_MEASUREMENT);
+    }
+#ifdef USE_GYRO_DUTY_CYCLE
+    //starts up while the adxl372 filters settle
+    gyro_duty_wake();
+#endif
+    adxl372_handoff_wait();
+    TRACE(TRACE_ID_ACTIVITY_WAKE, 0, g_adxl_handoff.last_gap_us);
+    return true;
+}
+
+// Takes the MAXPEAK of the hit that woke the adxl372, which the fifo misses: it only
+// runs once the adxl372 is in full bandwidth and its filters settled. Then waits for
+// the first HANDOFF_SAMPLES, polling, and hands them to the trigger right away instead
+// of after a whole watermark. Their time from the activity edge is the gap the samples
+// don't cover, logged and kept with its longest
+void adxl372_handoff_wait(void)
+{
+    uint32_t timeout_us = (adxl372_filter_settle_ms() + HANDOFF_MARGIN_MS)*1000;
+    uint32_t gap_us;
+
+    g_adxl_handoff.wakes++;
+    g_adxl_handoff.triggered = false;
+    spi_ret_check(SENSOR_ACCEL, adxl372_read_max_peak(&g_adxl_handoff.peak));
+    do
+    {
+        gap_us = app_timer_since_us(g_wake_ticks);
+        if (adxl372_get_fifo_entries() >= 3*HANDOFF_SAMPLES)
+        {
+            g_adxl_handoff.last_gap_us = gap_us;
+            g_adxl_handoff.max_gap_us = MAX(g_adxl_handoff.max_gap_us, gap_us);
+            g_adxl_handoff.drain = true;
+#ifdef DEBUG
+            NRF_LOG_INFO("WAKE: samples %d us after the activity, max %d us, MAXPEAK %d %d %d mg", gap_us,
+                         g_adxl_handoff.max_gap_us, ADXL372_COUNTS_TO_MG(g_adxl_handoff.peak.x),
+                         ADXL372_COUNTS_TO_MG(g_adxl_handoff.peak.y), ADXL372_COUNTS_TO_MG(g_adxl_handoff.peak.z));
+#endif
+            return;
+        }
+    } while (gap_us < timeout_us);
+
+    //the watermark interrupt takes over
+    g_adxl_handoff.last_gap_us = gap_us;
+    g_adxl_handoff.timeouts++;
+    NRF_LOG_WARNING("WAKE: no samples %d us after the activity", gap_us);
+}
+
+// Counts the last wake up as missed if its MAXPEAK was over the trigger and the trigger
+// never fired: the hit was over before the fifo ran
+void adxl372_handoff_check(void)
+{
+    adxl372_accel_data_t const *p_peak = &g_adxl_handoff.peak;
+
+    if (g_adxl_handoff.wakes == 0 || g_adxl_handoff.triggered)
+    {
+        return;
+    }
+    g_adxl_handoff.triggered = true;
+    if (accel_resultant_sq(p_peak) >= (uint32_t) IMPACT_THRESHOLD_COUNTS*IMPACT_THRESHOLD_COUNTS)
+    {
+        g_adxl_handoff.missed++;
+        NRF_LOG_WARNING("WAKE: MAXPEAK %d %d %d mg over the trigger before the samples, %d missed",
+                        ADXL372_COUNTS_TO_MG(p_peak->x), ADXL372_COUNTS_TO_MG(p_peak->y),
+                        ADXL372_COUNTS_TO_MG(p_peak->z), g_adxl_handoff.missed);
+    }
+}
+
+#ifdef USE_GYRO_DUTY_CYCLE
+// Times the gyro start up out of the icm20649 low power mode on the timebase: the gyro
+// data registers stop moving while it is off and follow its noise once it runs again.
+// Leaves the gyro running, the first rest turns it off
+// returns the start up in us, ICM20649_WAKEUP_MS if the output did not move in twice that
+uint32_t gyro_startup_measure(void)
+{
+    icm20649_data_t off;
+    icm20649_data_t on;
+    uint32_t since_us;
+
+    spi_ret_check(SENSOR_GYRO, icm20649_set_low_power(true));
+    //the last sample of the gyro settles in its registers
+    nrf_delay_ms(2);
+    icm20649_read_gyro_accel_data(&off);
+    spi_ret_check(SENSOR_GYRO, icm20649_set_low_power(false));
+    timebase_start();
+    do
+    {
+        icm20649_read_gyro_accel_data(&on);
+        since_us = timebase_now_us();
+        if (on.gyro_x != off.gyro_x || on.gyro_y != off.gyro_y || on.gyro_z != off.gyro_z)
+        {
+            timebase_stop();
+            return since_us;
+        }
+    } while (since_us < 2*ICM20649_WAKEUP_MS*1000);
+    timebase_stop();
+
+    return ICM20649_WAKEUP_MS*1000;
+}
+
+// Turns the gyro off for the rest of the adxl372, the icm20649 accel keeps duty cycling
+void gyro_duty_rest(void)
+{
+    app_timer_stop(m_gyro_startup_timer_id);
+    g_gyro_started = false;
+    g_gyro_ready = false;
+    if (sensor_health_ok(&g_sensor_health, SENSOR_GYRO))
+        spi_ret_check(SENSOR_GYRO, icm20649_set_low_power(true));
+}
+
+// Turns the gyro back on with the activity that ended a rest, gyro_duty_ready tells
+// when the start up timed at boot has passed
+void gyro_duty_wake(void)
+{
+    if (sensor_health_ok(&g_sensor_health, SENSOR_GYRO))
+        spi_ret_check(SENSOR_GYRO, icm20649_set_low_power(false));
+    app_timer_start(m_gyro_startup_timer_id, APP_TIMER_TICKS((g_gyro_startup_us + 999)/1000), NULL);
+}
+
+// Tells whether the gyro woken by gyro_duty_wake is up. The first call past its start up
+// drops the icm20649 fifo frames of the start up and starts the alignment over from there
+// returns false while it is starting up
+bool gyro_duty_ready(void)
+{
+    if (!g_gyro_started)
+    {
+        return false;
+    }
+    if (!g_gyro_ready)
+    {
+        g_gyro_ready = true;
+#ifdef USE_ICM_FIFO
+        spi_ret_check(SENSOR_GYRO, icm20649_fifo_reset());
+        imu_align_start(&g_imu_align, timebase_now_us());
+#endif
+    }
+    return true;
+}
+#endif
+
+#ifdef USE_TIERED_TRIGGER
+// Starts the summary tier of the next wake up, the activity bits and the MAXPEAK
+// registers start over so they only hold the hit that wakes the adxl372
+void tier_arm(void)
+{
+    adxl372_accel_data_t max_peak;
+
+    g_tier_escalated = false;
+    g_tier_samples = 0;
+    //a plain read, adxl372_get_highest_peak_accel_data waits on a sample and the adxl372 may be in standby
+    spi_ret_check(SENSOR_ACCEL, adxl372_read_max_peak(&max_peak));
+    g_adxl_dev.activity_status = 0;
+}
+
+// Takes a fifo burst of the summary tier, its samples only go to the pre-trigger
+// window: the gyro is not read and the trigger does not run. The burst whose status
+// read saw the activity2 escalates, it and the rest of the wake up take the full capture.
+// Without it the wake up ends after TIER_SUMMARY_MS as a moderate hit
+// returns false if the burst is for the full capture
+bool tier_summary_burst(uint16_t num_samples)
+{
+    if (g_tier_escalated)
+    {
+        return false;
+    }
+    if (g_adxl_dev.activity_status & STATUS2_ACT2_MSK)
+    {
+        g_tier_escalated = true;
+        TRACE(TRACE_ID_TIER_ESCALATE, 0, g_tier_samples);
+        return false;
+    }
+    sample_ring_push(&g_pre_trigger_ring, g_fifo_burst_buf, num_samples);
+    if (g_commit.state != COMMIT_IDLE || flash_offload_pending())
+    {
+        flash_background_step_from_accel();
+    }
+    g_tier_samples += num_samples;
+    if (g_tier_samples >= TIER_SUMMARY_SAMPLES)
+    {
+        tier_summary_add();
+        g_adxl_armed = true;
+    }
+    return true;
+}
+
+// Queues a moderate hit as a summary_log record of its own, the peak is the
+// MAXPEAK reading of the wake up. A full batch of records is stored as one event
+void tier_summary_add(void)
+{
+    adxl372_accel_data_t max_peak;
+
+    adxl372_get_highest_peak_accel_data(&max_peak);
+    //the wake up read the peak of the hit before the samples, it may be the larger one
+    if (accel_resultant_sq(&g_adxl_handoff.peak) > accel_resultant_sq(&max_peak))
+    {
+        max_peak = g_adxl_handoff.peak;
+    }
+    if (g_summary_log.count == 0)
+    {
+        record_event_timestamp(&g_summary_rtc);
+    }
+    summary_log_add_hits(&g_summary_log, &max_peak, 1);
+#ifdef DEBUG
+    NRF_LOG_INFO("TIER: MODERATE HIT %d, PEAK %d mg", g_summary_log.window,
+                 ADXL372_COUNTS_TO_MG(g_summary_log.window_peak));
+#endif
+    if (summary_log_close_window(&g_summary_log))
+    {
+        tier_summary_store();
+    }
+}
+
+// Stores the queued moderate hits after the impact being committed, the store has one open event
+void tier_summary_store(void)
+{
+    if (g_commit.state != COMMIT_IDLE)
+    {
+        flash_commit_finish_from_accel();
+    }
+    summary_log_store();
+}
+#endif
+#endif
+
+// Switches to the flash for one step of background flash work and back to the accel.
+// A pending commit goes first, then its readback unless an impact is being captured,
+// then one event_store_erase_step
+// returns 1 while there is more to do, 0 once the pre-erased pool is full
+int8_t flash_background_step_from_accel(void)
+{
+    device_state_t state = g_device_state;
+    int8_t ret = 1;
+
+    if (g_commit.state == COMMIT_RAM_ONLY)
+    {
+        //printed between impacts like the readback
+        if (state != DEVICE_CAPTURING)
+        {
+            device_set_state(DEVICE_OFFLOADING);
+            flash_commit_step();
+            device_set_state(state);
+#ifdef USE_ADXL_FIFO_INT_MODE
+            sample_stream_restart();
+#endif
+        }
+        return 1;
+    }
+    if (!sensor_health_ok(&g_sensor_health, SENSOR_FLASH))
+    {
+        return 0;
+    }
+    if (g_commit.state != COMMIT_IDLE)
+    {
+        flash_commit_step();
+    }
+    else if (flash_offload_pending() && state != DEVICE_CAPTURING)
+    {
+        device_set_state(DEVICE_OFFLOADING);
+        flash_offload();
+        device_set_state(state);
+#ifdef USE_ADXL_FIFO_INT_MODE
+        //the fifo overran during the uart output, start a new window
+        sample_stream_restart();
+#endif
+    }
+    else
+    {
+        ret = event_store_erase_step(&g_event_store);
+    }
+    spi_ret_check(SENSOR_FLASH, ret);
+
+    return ret;
+}
+
+// Forgets the samples seen so far after the fifo was reset or overran: the
+// pre-trigger window, the filter history and any trigger run in progress
+void sample_stream_restart(void)
+{
+    sample_ring_reset(&g_pre_trigger_ring);
+#ifdef USE_ACCEL_FILTER
+    accel_filter_reset(&g_accel_filter);
+#endif
+    impact_trigger_rearm(&g_impact_trigger);
+}
+
+//the longest capture keeps all of its samples
+STATIC_ASSERT(PRE_TRIGGER_SAMPLES + (IMPACT_MAX_DURATION*ADXL_SAMPLE_RATE_HZ)/1000 <= MAX_SAMPLE_BUF_LENGTH);
+
+// Copies the pre-trigger window to the start of the sample set (oldest first)
+// the gyro is not sampled before the trigger so the icm20649 data is zeroed for these samples
+// rtc_data gets the timestamp of the trigger for the event header
+void sample_pre_trigger_window(ds1388_data_t* rtc_data)
+{
+    adxl372_accel_data_t window[PRE_TRIGGER_SAMPLES];
+    icm20649_data_t no_gyro_data = {0};
+    uint16_t num_samples;
+
+    num_samples = sample_ring_copy_out(&g_pre_trigger_ring, window, PRE_TRIGGER_SAMPLES);
+    for (int i = 0; i < num_samples && g_capture->count < MAX_SAMPLE_BUF_LENGTH; ++i)
+    {
+        //fifo samples are back to back, one adxl372 sample period apart
+        capture_push(&window[i], &no_gyro_data, g_capture->count > 0);
+    }
+    g_capture->pre_trigger = g_capture->count;
+
+    record_event_timestamp(rtc_data);
+}
+
+// Stores one fifo burst of accel samples, the newest of which was taken at g_fifo_burst_us.
+// With USE_ICM_FIFO the icm20649 samples are interpolated onto the accel sample times,
+// otherwise the gyro is read once per burst. With USE_FUSED_ACCEL the records keep the
+// fused accel in place of the icm20649 accel, the records without a gyro stay all zero
+void sample_impact_fifo_burst (adxl372_accel_data_t const* samples, uint16_t num_samples, icm20649_data_t* low_g_gyro_data, ds1388_data_t* rtc_data)
+{
+    bool gyro_ok = sensor_health_ok(&g_sensor_health, SENSOR_GYRO);
+    icm20649_data_t const* record_icm = low_g_gyro_data;
+    int16_t num_icm_samples = 0;
+#ifdef USE_ICM_FIFO
+    uint32_t icm_read_us;
+#endif
+#ifdef USE_FUSED_ACCEL
+    icm20649_data_t fused_data;
+    int16_t fused[3];
+    int16_t icm_lsb_per_g = icm20649_accel_lsb_per_g();
+#endif
+
+    if(g_record_timestamp == false)
+    {
+        record_event_timestamp(rtc_data);
+    }
+#ifdef USE_GYRO_DUTY_CYCLE
+    //still starting up, the frames of its fifo are not good yet
+    gyro_ok = gyro_ok && gyro_duty_ready();
+#endif
+#ifdef USE_ICM_FIFO
+    icm_read_us = timebase_now_us();
+    num_icm_samples = gyro_ok ? gyro_read_fifo() : 0;
+    if (num_icm_samples > 0)
+    {
+        imu_align_gyro_burst(&g_imu_align, g_icm_fifo_buf, num_icm_samples, icm_read_us);
+    }
+#ifdef USE_ORIENTATION
+    orientation_update(num_icm_samples);
+#endif
+    imu_align_accel_burst(&g_imu_align, num_samples, g_fifo_burst_us);
+#endif
+    if (!gyro_ok)
+    {
+        //accel only, the records keep a zero gyro
+        memset(low_g_gyro_data, 0, sizeof(icm20649_data_t));
+    }
+    else if (num_icm_samples <= 0)
+    {
+        gyro_read_fresh(low_g_gyro_data);
+    }
+    capture_count_drops(num_samples);
+    for (int i = 0; i < num_samples && g_capture->count < MAX_SAMPLE_BUF_LENGTH; ++i)
+    {
+#ifdef USE_ICM_FIFO
+        //keeps the register read until the first icm20649 fifo sample
+        if (gyro_ok)
+            imu_align_next(&g_imu_align, low_g_gyro_data);
+#endif
+#ifdef USE_FUSED_ACCEL
+        if (gyro_ok)
+        {
+            accel_fusion_sample(&g_accel_fusion, &samples[i], low_g_gyro_data, icm_lsb_per_g, fused);
+            fused_data = *low_g_gyro_data;
+            fused_data.accel_x = fused[0];
+            fused_data.accel_y = fused[1];
+            fused_data.accel_z = fused[2];
+            record_icm = &fused_data;
+        }
+#endif
+        capture_push(&samples[i], record_icm, g_capture->count > 0);
+    }
+}
+#endif
+
+// returns the capture buffer that is not recording, it may still be committing
+capture_buf_t* capture_buf_other(void)
+{
+    return (g_capture == &g_capture_bufs[0]) ? &g_capture_bufs[1] : &g_capture_bufs[0];
+}
+
+// Packs the next record of the impact into the capture buffer and adds it to the metrics,
+// the caller checks there is room
+void capture_push(adxl372_accel_data_t const* accel, icm20649_data_t const* gyro, uint8_t delta)
+{
+    impact_record_t* record = &g_capture->records[g_capture->count];
+
+    impact_record_pack(record, accel, gyro, delta);
+    impact_metrics_add(&g_capture->metrics, record);
+    g_capture->count++;
+}
+
+// Counts the samples of a block about to be pushed that will not fit the capture buffer
+void capture_count_drops(uint32_t num_samples)
+{
+    if (g_capture->count + num_samples > MAX_SAMPLE_BUF_LENGTH)
+    {
+        g_capture->dropped += g_capture->count + num_samples - MAX_SAMPLE_BUF_LENGTH;
+    }
+}
+
+// Completes the event summary once the impact has been captured
+void capture_close(void)
+{
+    static impact_location_mount_t const mount = SENSOR_TO_HEAD;
+    event_store_summary_t* summary = &g_capture->summary;
+
+    summary->location = impact_location_classify(mount, g_capture->metrics.peak_vector, summary->direction);
+    summary->peak_g_x10 = MIN(impact_metrics_peak_mg(&g_capture->metrics)/100, EVENT_STORE_PEAK_UNKNOWN - 1);
+    summary->duration_ms = MIN(impact_metrics_duration_us(&g_capture->metrics)/1000, UINT16_MAX);
+    //the adxl372 keeps streaming, the location is printed with the stored event
+    TRACE(TRACE_ID_CAPTURE_CLOSE, summary->location, g_capture->count);
+}
+
+// Counts and logs the captured impact and hands it to the background commit, the
+// trigger is rearmed for the next one
+// duration_us - trigger to the end of the capture
+void capture_end(uint32_t duration_us)
+{
+    impact_trigger_rearm(&g_impact_trigger);
+    pipeline_stats_capture(&g_pipeline_stats, g_capture->count, g_capture->dropped,
+                           g_capture->count + g_capture->dropped - g_capture->pre_trigger, duration_us);
+    NRF_LOG_INFO("IMPACT: PEAK %d mg, DURATION %d us, HIC15 %d, HIC36 %d",
+                 impact_metrics_peak_mg(&g_capture->metrics),
+                 impact_metrics_duration_us(&g_capture->metrics),
+                 g_capture->metrics.hic15, g_capture->metrics.hic36);
+    NRF_LOG_INFO("ROTATION: PEAK %d mrad/s, %d rad/s^2, BrIC %d/1000",
+                 impact_metrics_peak_omega_mrad(&g_capture->metrics),
+                 g_capture->metrics.peak_alpha,
+                 impact_metrics_bric_x1000(&g_capture->metrics));
+    capture_close();
+#ifdef USE_FUSED_ACCEL
+    //the pairs of the impact spread the fit the most, the next one is fused with it
+    accel_fusion_fit(&g_accel_fusion);
+#endif
+    flash_commit_start();
+}
+
+// Empties the capture buffer for the next impact
+void capture_reset(void)
+{
+    g_capture->count = 0;
+    g_capture->pre_trigger = 0;
+    g_capture->dropped = 0;
+    memset(&g_capture->summary, 0xFF, sizeof(event_store_summary_t));
+    impact_metrics_init(&g_capture->metrics, ADXL_SAMPLE_RATE_HZ, IMPACT_THRESHOLD_COUNTS, icm20649_gyro_fs_dps());
+}
+
+// Hands the finished capture buffer to the flash commit and records the next impact
+// into the other one. If both buffers are full the pending commit is finished first
+void flash_commit_start(void)
+{
+    if (g_commit.state != COMMIT_IDLE)
+    {
+        flash_commit_finish_from_accel();
+    }
+    g_commit.p_buf = g_capture;
+    //ram only while the flash is out, the capture buffer is held until it is printed
+    g_commit.state = sensor_health_ok(&g_sensor_health, SENSOR_FLASH) ? COMMIT_BEGIN : COMMIT_RAM_ONLY;
+    g_commit.start_ticks = app_timer_cnt_get();
+    g_capture = capture_buf_other();
+    capture_reset();
+}
+
+// Appends about one flash page of the capture buffer to its event, the event is
+// opened by the first step and committed by the last one, which frees the buffer.
+// A step that finds the page before still programming returns without waiting,
+// the coded chunk it filled stays for the next one.
+// The flash spi instance must be initialized
+// returns 1 while there is more to commit, 0 once committed
+int8_t flash_commit_step(void)
+{
+    flash_commit_t* commit = &g_commit;
+    capture_buf_t const* p_buf = commit->p_buf;
+    event_store_t* store = &g_event_store;
+    uint32_t event_id;
+    event_store_time_t time;
+    int8_t ret;
+#ifndef USE_SAMPLE_COMPRESSION
+    uint32_t num_records;
+#endif
+#ifdef USE_FUSED_ACCEL
+    bool fused = true;
+#else
+    bool fused = false;
+#endif
+
+    if (commit->state != COMMIT_IDLE && commit->state != COMMIT_RAM_ONLY && !sensor_health_ok(&g_sensor_health, SENSOR_FLASH))
+    {
+        //the flash went out, an open event is dropped when the store is mounted again
+        NRF_LOG_WARNING("FLASH OUT: capture kept in ram");
+        commit->state = COMMIT_RAM_ONLY;
+    }
+    if (commit->state == COMMIT_RAM_ONLY)
+    {
+        serial_output_capture(p_buf);
+        health_log();
+        commit->state = COMMIT_IDLE;
+        return 0;
+    }
+    if (commit->state == COMMIT_BEGIN)
+    {
+        TRACE(TRACE_ID_COMMIT_BEGIN, 0, p_buf->count);
+        //the timestamp may still be in flight on the i2c bus
+        twi_wait_idle();
+        event_store_time_from_ds1388(&p_buf->rtc_data, &time);
+        //store one impact sample set to flash as a new event
+#ifdef USE_SAMPLE_COMPRESSION
+        spi_ret_check(SENSOR_FLASH, event_store_begin(store, &time, &p_buf->summary, 1,
+                                                      impact_codec_encoding(true, IMPACT_RECORD_RANGE_DEFAULT, fused)));
+        impact_codec_init(&commit->codec);
+        commit->fill = 0;
+#else
+        spi_ret_check(SENSOR_FLASH, event_store_begin(store, &time, &p_buf->summary, IMPACT_RECORD_SIZE,
+                                                      impact_codec_encoding(false, IMPACT_RECORD_RANGE_DEFAULT, fused)));
+#endif
+        commit->next_record = 0;
+        commit->state = COMMIT_WRITING;
+    }
+    if (commit->state != COMMIT_WRITING)
+    {
+        return 0;
+    }
+
+#ifdef USE_SAMPLE_COMPRESSION
+    //only up to the end of the page being collected, an append programs one page
+    while (commit->next_record < p_buf->count && commit->fill < event_store_append_room(store))
+    {
+        commit->fill += impact_codec_encode(&commit->codec, &p_buf->records[commit->next_record],
+                                            &commit->chunk[commit->fill]);
+        commit->next_record++;
+    }
+#endif
+    ret = event_store_append_busy(store);
+    spi_ret_check(SENSOR_FLASH, ret);
+    if (ret > 0)
+    {
+        return 1;
+    }
+#ifdef USE_SAMPLE_COMPRESSION
+    if (commit->fill > 0)
+    {
+        spi_ret_check(SENSOR_FLASH, event_store_append(store, commit->chunk, commit->fill));
+        commit->fill = 0;
+    }
+#else
+    num_records = MIN(RAW_RECORDS_PER_STEP, p_buf->count - commit->next_record);
+    spi_ret_check(SENSOR_FLASH, event_store_append(store, &p_buf->records[commit->next_record], num_records));
+    commit->next_record += num_records;
+#endif
+    if (commit->next_record < p_buf->count)
+    {
+        return 1;
+    }
+
+    spi_ret_check(SENSOR_FLASH, event_store_commit(store, &event_id));
+    pipeline_stats_commit(&g_pipeline_stats, app_timer_since_us(commit->start_ticks)/1000, store->erase_stalls);
+    TRACE(TRACE_ID_COMMIT_DONE, store->writer.pages_programmed, event_id);
+    commit->state = COMMIT_IDLE;
+    return 0;
+}
+
+// Switches to the flash and steps the pending commit until it is committed
+void flash_commit_finish_from_accel(void)
+{
+    while (flash_commit_step() > 0);
+}
+
+// returns true if a committed event has not been output over uart yet
+bool flash_offload_pending(void)
+{
+    return sensor_health_ok(&g_sensor_health, SENSOR_FLASH) && g_offload_next_id < event_store_count(&g_event_store);
+}
+
+// Reads the committed events back out over uart and starts erasing the space they used.
+// The flash spi instance must be initialized
+void flash_offload(void)
+{
+    if (!flash_offload_pending())
+    {
+        return;
+    }
+#ifdef USE_BINARY_OFFLOAD
+    uint32_t num_events = 0;
+#endif
+    while (flash_offload_pending())
+    {
+#ifdef USE_BINARY_OFFLOAD
+        //the host checks the data crc of every frame
+        spi_ret_check(SENSOR_FLASH, serial_offload_event(&g_event_store, g_offload_next_id));
+        num_events++;
+#else
+        flash_retrieve_samples(g_offload_next_id);
+        serial_output_flash_data(g_offload_next_id);
+#endif
+        g_offload_next_id++;
+    }
+#ifdef USE_BINARY_OFFLOAD
+    spi_ret_check(SENSOR_FLASH, serial_offload_end(num_events));
+#endif
+    pipeline_stats_log(&g_pipeline_stats);
+    health_log();
+#if PROFILER_ENABLED
+    //driver timings since startup, with the offload reads in them
+    profiler_dump();
+#endif
+    //start erasing the space used by this impact, it does not wait for the erase
+    spi_ret_check(SENSOR_FLASH, event_store_erase_step(&g_event_store));
+}
+
+// Checks the stored event against the crc32 taken while it was appended,
+// the flash is read a page at a time instead of into a second buffer
+void flash_retrieve_samples(uint32_t event_id)
+{
+    int8_t ret;
+
+#ifdef DEBUG
+    NRF_LOG_INFO("");
+    NRF_LOG_INFO("BEGIN RETRIEVE SAMPLES");
+#endif
+    ret = event_store_verify(&g_event_store, event_id);
+    if (ret == -3)
+    {
+        NRF_LOG_ERROR("READ: event %d failed its crc check", event_id);
+        return;
+    }
+    spi_ret_check(SENSOR_FLASH, ret);
+}
+
+// Outputs a stored impact over uart, streamed from flash through a record_reader_t
+// so it does not need the capture buffer. flash_retrieve_samples checks the event first
+void serial_output_flash_data(uint32_t event_id)
+{
+    record_reader_t reader;
+    event_store_header_t const* header = &reader.header;
+    impact_record_t record;
+    ds1388_data_t date;
+    uint32_t sample_periods = 0;
+    int8_t ret;
+
+    spi_ret_check(SENSOR_FLASH, record_reader_open(&reader, &g_event_store, event_id));
+    if (header->encoding == SUMMARY_LOG_ENCODING)
+    {
+        serial_output_summary(event_id, header);
+        return;
+    }
+
+    NRF_LOG_INFO("\r\n===================IMPACT DATA OUTPUT===================");
+    ds1388_from_epoch(header->time.s, &date);
+    NRF_LOG_INFO("      date: %d day: %d",
+                    date.date,
+                    date.day);
+    NRF_LOG_INFO("      Year: %d Month: %d Hour: %d ",
+                        date.year,
+                        date.month,
+                        date.hour);
+    NRF_LOG_INFO("      Minute: %d, Second: %d, Microsecond: %d",
+                    date.minute,
+                    date.second,
+                    header->time.us & EVENT_STORE_TIME_US_MASK);
+    NRF_LOG_INFO("      Location: %s (%d, %d, %d)/127", impact_location_name(header->summary.location),
+                 header->summary.direction[0], header->summary.direction[1], header->summary.direction[2]);
+    for (int i = 0; (ret = record_reader_next(&reader, &record)) > 0; ++i)
+    {
+        serial_output_record(i, &record, &sample_periods);
+    }
+    if (ret < 0)
+    {
+        NRF_LOG_ERROR("READ: event %d could not be decoded (%d)", event_id, ret);
+    }
+    NRF_LOG_INFO("\r\n====================DATA OUTPUT FINISH==================");
+}
+
+// Prints the window records of a summary_log event
+void serial_output_summary(uint32_t event_id, event_store_header_t const* header)
+{
+    summary_log_record_t record;
+
+    NRF_LOG_INFO("\r\n===================SUMMARY DATA OUTPUT==================");
+    for (uint32_t i = 0; i < header->sample_count; ++i)
+    {
+        if (header->sample_size != sizeof(record)
+            || event_store_read_samples(&g_event_store, event_id, i, &record, 1) < 0)
+        {
+            NRF_LOG_ERROR("READ: event %d could not be decoded", event_id);
+            break;
+        }
+        NRF_LOG_INFO("SUMMARY: WINDOW %d, PEAK %d mg, %d HITS, EXPOSURE %d g", record.window,
+                     ADXL372_COUNTS_TO_MG(record.peak), record.hits, (record.exposure*ADXL372_MG_PER_LSB)/1000);
+    }
+}
+
+// Outputs an impact that was never stored over uart straight from its capture
+// buffer, the ram only capture while the flash is out
+void serial_output_capture(capture_buf_t const* p_buf)
+{
+    uint32_t sample_periods = 0;
+
+    //the timestamp may still be in flight on the i2c bus
+    twi_wait_idle();
+    NRF_LOG_INFO("\r\n==============IMPACT DATA OUTPUT (RAM ONLY)==============");
+    NRF_LOG_INFO("      date: %d day: %d",
+                    p_buf->rtc_data.date,
+                    p_buf->rtc_data.day);
+    NRF_LOG_INFO("      Year: %d Month: %d Hour: %d ",
+                        p_buf->rtc_data.year,
+                        p_buf->rtc_data.month,
+                        p_buf->rtc_data.hour);
+    NRF_LOG_INFO("      Minute: %d, Second: %d, Hundreth: %d",
+                    p_buf->rtc_data.minute,
+                    p_buf->rtc_data.second,
+                    p_buf->rtc_data.hundreth);
+    NRF_LOG_INFO("      Location: %s (%d, %d, %d)/127", impact_location_name(p_buf->summary.location),
+                 p_buf->summary.direction[0], p_buf->summary.direction[1], p_buf->summary.direction[2]);
+    for (uint32_t i = 0; i < p_buf->count; ++i)
+    {
+        serial_output_record(i, &p_buf->records[i], &sample_periods);
+    }
+    NRF_LOG_INFO("\r\n====================DATA OUTPUT FINISH==================");
+}
+
+// Outputs one record, sample_periods accumulates the record deltas of the impact
+void serial_output_record(uint32_t index, impact_record_t const* record, uint32_t* p_sample_periods)
+{
+    //samples are stored as raw counts and only converted here
+    adxl372_accel_data_t accel_data;
+    icm20649_data_t icm_data;
+    int32_t icm_accel_mg[3];
+    uint8_t delta;
+
+    impact_record_unpack(record, &accel_data, &icm_data, &delta);
+#ifdef USE_FUSED_ACCEL
+    //the accel fields hold the fused channel, only the gyro is in icm20649 counts
+    icm_accel_mg[0] = icm_data.accel_x*ACCEL_FUSION_MG_PER_LSB;
+    icm_accel_mg[1] = icm_data.accel_y*ACCEL_FUSION_MG_PER_LSB;
+    icm_accel_mg[2] = icm_data.accel_z*ACCEL_FUSION_MG_PER_LSB;
+    icm20649_convert_data(&icm_data);
+#else
+    icm20649_convert_data(&icm_data);
+    icm_accel_mg[0] = icm_data.accel_x;
+    icm_accel_mg[1] = icm_data.accel_y;
+    icm_accel_mg[2] = icm_data.accel_z;
+#endif
+    *p_sample_periods += delta;
+
+    NRF_LOG_INFO("");
+    NRF_LOG_INFO("ID = %d, t = %d us", index, (uint32_t)(((uint64_t)*p_sample_periods * 1000000) / ADXL_SAMPLE_RATE_HZ));
+    NRF_LOG_INFO("accel x= %d, accel y = %d,  accel z= %d mG's",
+                    ADXL372_COUNTS_TO_MG(accel_data.x), 
+                    ADXL372_COUNTS_TO_MG(accel_data.y),
+                    ADXL372_COUNTS_TO_MG(accel_data.z));
+    NRF_LOG_INFO("      accel x = %d, accel y = %d, accel z = %d mG's",
+                        icm_accel_mg[0],
+                        icm_accel_mg[1],
+                        icm_accel_mg[2]);
+    NRF_LOG_INFO("      gyro x = %d, gyro y = %d, gyro z = %d mrad/s", 
+                        icm_data.gyro_x,
+                        icm_data.gyro_y,
+                        icm_data.gyro_z);
+}
+
+
+void adxl372_init(void)
+{
+    //instant on at the 30g threshold, low noise, x_offset = 0, y_offset=2, z_offset=5 for Vs=3.3V
+    static const adxl372_config_t instaon_config = {
+        .offset       = {0, 2, 5},
+        .fifo_samples = ADXL372_FIFO_SAMPLES_RESET,
+        .fifo_ctl     = ADXL372_FIFO_CTL_VAL(1, BYPASSED, XYZ_FIFO),
+        .timing       = ADXL372_TIMING_VAL(ODR_6400HZ, WUR_52MS),
+        .measure      = ADXL372_MEASURE_VAL(BW_3200HZ, LOW_NOISE, DEF, false),
+        .power_ctl    = ADXL372_POWER_CTL_VAL(INSTANT_ON, true, true, FILTER_SETTLE_16, ADXL_INSTAON_HIGH_THRESH),
+    };
+    adxl372_config_t config = instaon_config;
+
+#ifdef USE_ADXL_EXT_SYNC
+    adxl372_config_set_ext_sync(&config, true);
+#endif
+    adxl372_reset();
+    adxl372_apply_config(NULL, &config);
+}
+
+
+
+#ifdef SPI_THROUGHPUT_REPORT
+/*
+ * Times one spi_burst_read on an instance with the DWT cycle counter
+ * @return the number of cpu cycles
+ */
+static uint32_t spi_time_burst_read(nrf_drv_spi_t const * spi, uint8_t cs_pin, uint8_t read_addr, uint8_t * rx_buf, uint16_t rx_length)
+{
+    uint32_t start;
+
+    start = DWT->CYCCNT;
+    spi_ret_check((spi == &gyro_spi) ? SENSOR_GYRO : SENSOR_ACCEL, spi_burst_read(spi, cs_pin, &read_addr, 1, rx_buf, rx_length));
+
+    return DWT->CYCCNT - start;
+}
+
+/*
+ * Logs the throughput of the accel and gyro data reads at every bus frequency
+ * up to the device limit, to pick SPI_ACCEL_BURST_FREQ and SPI_GYRO_BURST_FREQ.
+ * Includes the spi_driver and EasyDMA overhead per transaction
+ */
+void spi_throughput_report(void)
+{
+    static const nrf_drv_spi_frequency_t frequencies[] = {
+        NRF_DRV_SPI_FREQ_1M, NRF_DRV_SPI_FREQ_2M, NRF_DRV_SPI_FREQ_4M, NRF_DRV_SPI_FREQ_8M};
+    static const uint8_t frequencies_mhz[] = {1, 2, 4, 8};
+    static uint8_t rx_buf[ADXL_FIFO_SIZE*2 + 1];
+    uint32_t cycles;
+    uint8_t i;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    NRF_LOG_INFO("SPI THROUGHPUT (bytes per read, us, kB/s)");
+    for (i = 0; i < ARRAY_SIZE(frequencies); i++)
+    {
+        //full fifo burst, longer than one EasyDMA transfer
+        spi_set_burst_frequency(&accel_spi, frequencies[i]);
+        cycles = spi_time_burst_read(&accel_spi, SPI_ACCEL_CS_PIN, (ADI_ADXL372_X_DATA_H << 1) | ADXL_SPI_RNW,
+                                     rx_buf, sizeof(rx_buf));
+        NRF_LOG_INFO("accel %d MHz: %d, %d us, %d kB/s", frequencies_mhz[i], sizeof(rx_buf),
+                     cycles / (SystemCoreClock / 1000000), (uint32_t)(((uint64_t)sizeof(rx_buf) * SystemCoreClock) / cycles / 1000));
+        NRF_LOG_FLUSH();
+
+        //icm20649 sensor registers are rated up to 7 MHz
+        if (frequencies_mhz[i] > 7)
+            continue;
+        spi_set_burst_frequency(&gyro_spi, frequencies[i]);
+        cycles = spi_time_burst_read(&gyro_spi, SPI_GYRO_CS_PIN, ICM20649_REG_ADDR(ICM20649_ACCEL_XOUT_H) | 0x80,
+                                     rx_buf, ICM20649_DATA_LENGTH + 1);
+        NRF_LOG_INFO("gyro %d MHz: %d, %d us, %d kB/s", frequencies_mhz[i], ICM20649_DATA_LENGTH + 1,
+                     cycles / (SystemCoreClock / 1000000), (uint32_t)(((uint64_t)(ICM20649_DATA_LENGTH + 1) * SystemCoreClock) / cycles / 1000));
+        NRF_LOG_FLUSH();
+    }
+
+    spi_set_burst_frequency(&accel_spi, SPI_ACCEL_BURST_FREQ);
+    spi_set_burst_frequency(&gyro_spi, SPI_GYRO_BURST_FREQ);
+}
+#endif
+
+#ifdef USE_ORIENTATION
+// Runs the orientation filter over the samples just drained into g_icm_fifo_buf.
+// A failed or overflowed read is skipped, the filter carries on from the last
+// orientation: the fifo only overflows while resting and the head was still then
+void orientation_update(int16_t num_icm_samples)
+{
+#ifdef USE_ICM_DMP
+    //the DMP keeps it, the quaternion came with the samples
+    if (g_dmp_running)
+    {
+        return;
+    }
+#endif
+    for (int i = 0; i < num_icm_samples; ++i)
+    {
+        ahrs_update(&g_ahrs, &g_icm_fifo_buf[i]);
+    }
+}
+
+#ifdef DEBUG
+// Logs the cpu cost of one orientation filter update, timed with the DWT cycle counter
+void ahrs_cycle_report(void)
+{
+    icm20649_data_t const sample = {1000, -2000, 7000, 150, -80, 40};
+    ahrs_t ahrs;
+    uint32_t cycles;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    ahrs_init(&ahrs, ICM20649_FIFO_SAMPLE_RATE_HZ, icm20649_gyro_fs_dps(), AHRS_BETA);
+    //the first sample only sets the tilt
+    ahrs_update(&ahrs, &sample);
+    cycles = DWT->CYCCNT;
+    ahrs_update(&ahrs, &sample);
+    cycles = DWT->CYCCNT - cycles;
+    NRF_LOG_INFO("AHRS: %d cycles per update, %d per mille of the cpu at %d Hz", cycles,
+                 (uint32_t)(((uint64_t)cycles * ICM20649_FIFO_SAMPLE_RATE_HZ * 1000) / SystemCoreClock),
+                 ICM20649_FIFO_SAMPLE_RATE_HZ);
+}
+#endif
+#endif
+
+void log_init(void)
+{
+    ret_code_t err_code = NRF_LOG_INIT(NULL);
+    APP_ERROR_CHECK(err_code);
+
+    NRF_LOG_DEFAULT_BACKENDS_INIT();
+}
+
+void spi_accel_init(void)
+{
+    ret_code_t err_code = spi_instance_init(&accel_spi, &accel_spi_config, SPI_ACCEL_BURST_FREQ);
+    APP_ERROR_CHECK(err_code);
+    //rev1 has the flash on pins of its own, spi_driver switches them in for each of its transactions
+    APP_ERROR_CHECK_BOOL(spi_device_add(&accel_spi, &flash_spi_config, SPI_FLASH_BURST_FREQ) == 0);
+}
+
+// Quick check of a warm boot, the spi instances must be up
+// @return true if every sensor answered with its id
+bool sensors_check_id(void)
+{
+    if (adxl372_check_id() < 0 || icm20649_check_id() < 0 || mt25ql256aba_check_id() < 0)
+    {
+        NRF_LOG_WARNING("BOOT: id check failed, running the full self tests");
+        return false;
+    }
+    return true;
+}
+
+// Writes the accel registers of the sampling mode, at startup and when the accel
+// answers again. The interrupt pins are only set up once, in main
+void accel_configure(void)
+{
+#ifdef USE_CONT_SAMPLE_MODE
+    adxl372_config_t config;
+
+    //the fifo watermark at the continuous rate instead of the impact one
+    APP_ERROR_CHECK_BOOL(adxl372_config_fifo_int_default(&config, ADXL_FIFO_WATERMARK) == 0
+                         && adxl372_config_set_rate(&config, CONT_SAMPLE_ODR, CONT_SAMPLE_BW) == 0);
+    spi_ret_check(SENSOR_ACCEL, adxl372_apply_config(&g_adxl_dev, &config));
+    sample_stream_restart();
+#elif defined(USE_TRIGGERED_FIFO_MODE)
+    triggered_fifo_arm();
+#elif defined(USE_ADXL_AUTOSLEEP)
+    adxl372_autosleep_config();
+    sample_stream_restart();
+#elif defined(USE_ADXL_FIFO_INT_MODE)
+    adxl372_default_init_fifo_int_mode(&g_adxl_dev, ADXL_FIFO_WATERMARK);
+#ifdef USE_ACTIVITY_WAKEUP
+    adxl372_activity_wakeup_config();
+#endif
+    sample_stream_restart();
+#else
+    adxl372_init();
+#ifdef USE_ADXL_EXT_SYNC
+    accel_sync_start();
+#endif
+#endif
+}
+
+// Sleeps one erase poll while the accel is out, the flash work carries on.
+// The accel is retried when its backoff ran out, a poll is one opportunity
+void accel_retry_wait(void)
+{
+    if (flash_background_step_from_accel() > 0)
+    {
+        app_timer_start(m_erase_poll_timer_id, APP_TIMER_TICKS(ERASE_POLL_MS), NULL);
+    }
+    cpu_sleep();
+    app_timer_stop(m_erase_poll_timer_id);
+    if (sensor_health_retry_due(&g_sensor_health, SENSOR_ACCEL)
+        && sensor_health_report(&g_sensor_health, SENSOR_ACCEL, adxl372_check_id() == 0))
+    {
+        accel_configure();
+    }
+}
+
+// Retries the gyro when its backoff ran out, a pass of the main loop is one opportunity
+void gyro_retry(void)
+{
+    if (sensor_health_retry_due(&g_sensor_health, SENSOR_GYRO)
+        && sensor_health_report(&g_sensor_health, SENSOR_GYRO, icm20649_check_id() == 0))
+    {
+        icm20649_default_init();
+#ifdef USE_ICM_FIFO
+        gyro_fifo_init();
+#endif
+    }
+}
+
+// Retries the flash when its backoff ran out and mounts the store again, the events
+// committed before the outage are kept and an event left open by it is dropped
+void flash_retry(void)
+{
+    if (sensor_health_retry_due(&g_sensor_health, SENSOR_FLASH)
+        && sensor_health_report(&g_sensor_health, SENSOR_FLASH, mt25ql256aba_check_id() == 0))
+    {
+        spi_ret_check(SENSOR_FLASH, event_store_init(&g_event_store));
+        if (g_offload_next_id > event_store_count(&g_event_store))
+        {
+            g_offload_next_id = event_store_count(&g_event_store);
+        }
+    }
+}
+
+#if defined(USE_ADXL_FIFO_INT_MODE) && defined(USE_ICM_FIFO)
+// Drains the icm20649 fifo into g_icm_fifo_buf, nothing is read while the gyro is out
+// @return the number of samples, negative if the read failed or the fifo overflowed
+int16_t gyro_read_fifo(void)
+{
+    int16_t num_samples;
+
+    if (!sensor_health_ok(&g_sensor_health, SENSOR_GYRO))
+    {
+        return 0;
+    }
+#ifdef USE_ICM_DMP
+    if (g_dmp_running)
+    {
+        num_samples = icm20649_dmp_read_fifo(g_icm_fifo_buf, ICM_FIFO_MAX_SAMPLES, &g_icm_dmp);
+    }
+    else
+#endif
+    num_samples = icm20649_read_fifo(g_icm_fifo_buf, ICM_FIFO_MAX_SAMPLES);
+    sensor_health_report(&g_sensor_health, SENSOR_GYRO, num_samples != -1);
+    return num_samples;
+}
+#endif
+
+#ifdef USE_ICM_FIFO
+// Starts the icm20649 fifo after icm20649_default_init, with the DMP packets if the
+// image loads, otherwise with the raw frames at g_icm_fifo_rates and the orientation
+// filtered on the cpu
+void gyro_fifo_init(void)
+{
+#ifdef USE_ICM_DMP
+    g_dmp_running = (icm20649_dmp_init(icm20649_dmp_image, icm20649_dmp_image_size, &g_icm_dmp) == 0);
+    if (g_dmp_running)
+    {
+        return;
+    }
+    NRF_LOG_WARNING("icm20649 DMP did not start, orientation filtered on the cpu");
+    icm20649_default_init();
+#endif
+    spi_ret_check(SENSOR_GYRO, icm20649_fifo_init_rates(&g_icm_fifo_rates));
+}
+
+// Rate of the samples gyro_read_fifo() drains
+uint16_t gyro_fifo_rate_hz(void)
+{
+#ifdef USE_ICM_DMP
+    if (g_dmp_running)
+    {
+        return ICM20649_DMP_RATE_HZ;
+    }
+#endif
+    return icm20649_fifo_rate_hz(&g_icm_fifo_rates);
+}
+#endif
+
+// Reads the icm20649 data registers if a conversion landed since the last read, otherwise
+// data keeps the last one and the read counts as stale, nothing is read while the gyro is out
+void gyro_read_fresh(icm20649_data_t* data)
+{
+    int8_t ret;
+
+    if (!sensor_health_ok(&g_sensor_health, SENSOR_GYRO))
+    {
+        return;
+    }
+    ret = icm20649_read_fresh_gyro_accel_data(data);
+    sensor_health_report(&g_sensor_health, SENSOR_GYRO, ret != -1);
+    if (ret == 0)
+    {
+        g_pipeline_stats.gyro_stale++;
+    }
+}
+
+// Sends the trace and sleeps until the next event, every wait for an interrupt goes through here
+void cpu_sleep(void)
+{
+#if TRACE_ENABLED
+    trace_drain();
+#endif
+    nrf_pwr_mgmt_run();
 }
 
-void spi_flash_uninit(void)
+// Logs the state of each sensor and the error counts of each bus
+void health_log(void)
 {
-    nrf_drv_spi_uninit(&flash_spi);
+    sensor_health_log(&g_sensor_health);
+    NRF_LOG_INFO("BUS ERRORS: accel spi %d, gyro spi %d, twi %d", spi_error_count(&accel_spi),
+                 spi_error_count(&gyro_spi), twi_error_count());
 }
 
+void spi_gyro_init(void)
+{
+    ret_code_t err_code = spi_instance_init(&gyro_spi, &gyro_spi_config, SPI_GYRO_BURST_FREQ);
+    APP_ERROR_CHECK(err_code);
+}
+
+
 /**@brief Function starting the internal LFCLK oscillator.
  *
  * @details This is needed by RTC1 which is used by the Application Timer
@@ -513,11 +2911,38 @@ static void create_timers(void)
                                 APP_TIMER_MODE_SINGLE_SHOT, 
                                 measurement_timer_handler);
     APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_create(&m_erase_poll_timer_id,
+                                APP_TIMER_MODE_SINGLE_SHOT,
+                                erase_poll_timer_handler);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_create(&m_summary_timer_id,
+                                APP_TIMER_MODE_REPEATED,
+                                summary_timer_handler);
+    APP_ERROR_CHECK(err_code);
+#ifdef USE_DEEP_SLEEP
+
+    err_code = app_timer_create(&m_off_head_timer_id,
+                                APP_TIMER_MODE_SINGLE_SHOT,
+                                off_head_timer_handler);
+    APP_ERROR_CHECK(err_code);
+#endif
+#ifdef USE_GYRO_DUTY_CYCLE
+
+    err_code = app_timer_create(&m_gyro_startup_timer_id,
+                                APP_TIMER_MODE_SINGLE_SHOT,
+                                gyro_startup_timer_handler);
+    APP_ERROR_CHECK(err_code);
+#endif
 }
 
-static void spi_ret_check(int8_t ret)
+// Logs a failed driver call and counts it against the sensor. Only the spi errors
+// count, the -2 and -3 of event_store are a full store or a corrupt event
+static void spi_ret_check(sensor_id_t sensor, int8_t ret)
 {
     if (ret < 0){
-        NRF_LOG_INFO("SPI WRITE READ FAIL");
+        TRACE(TRACE_ID_SENSOR_ERROR, sensor, ret);
     }
+    sensor_health_report(&g_sensor_health, sensor, ret != -1);
 }
@@ -9,7 +9,7 @@
 // 4. Data measurement for impact duration (Accel, gyro, RTC)
 // 5. Measurements stored to flash
 // 6. Measurements read back from flash and printed to serial
-// Note: this file uses the legacy SPI drivers and can only be run on the breadboard platform.
+// Note: this file is built for the breadboard platform (board_config/nrf52832_mdk.h).
 // See "imu_pcb_rev1" for a similar file on the PCB Revision 1 platform
 // Note: this file is compatible with RTC autosetting. Use "./autoset.bat" in git bash
 // to autoset the RTC and then program the device.
@@ -43,8 +43,7 @@ int main (void)
     // Initialize.
     log_init();
     NRF_LOG_INFO("SPI start");
-    spi_init();
-    flash_spi_init();
+    spi_sensors_init();
 
     //for app_timer
     lfclk_request();
@@ -59,7 +58,7 @@ int main (void)
     adxl372_startup_test();
 
     // sensor initializations and configures
-    icm20649_init();
+    icm20649_default_init();
     adxl372_init();
     NRF_LOG_INFO("I2C start");
     twi_init();
@@ -91,19 +90,25 @@ int main (void)
             nrf_delay_ms(500);
             adxl372_get_accel_data(&high_g_data);
             // checks if high-g accelerometer has met its threshold value
-            if(abs(high_g_data.x) >= IMPACT_G_THRESHOLD|| abs(high_g_data.y) >= IMPACT_G_THRESHOLD
-                    || abs(high_g_data.z) >= IMPACT_G_THRESHOLD)
+            if(abs(high_g_data.x) >= ADXL372_MG_TO_COUNTS(IMPACT_G_THRESHOLD)
+                    || abs(high_g_data.y) >= ADXL372_MG_TO_COUNTS(IMPACT_G_THRESHOLD)
+                    || abs(high_g_data.z) >= ADXL372_MG_TO_COUNTS(IMPACT_G_THRESHOLD))
             {
                 NRF_LOG_INFO("");
                 NRF_LOG_INFO("BEGIN MEASUREMENT");
                 app_timer_start(m_measurement_timer_id,
                                  APP_TIMER_TICKS(IMPACT_DURATION),
                                  measurement_timer_handler);
+                // the rtc is only read here, samples are timed from the anchor
+                timebase_start();
+                get_time(&g_impact_time);
+                g_impact_start_us = timebase_now_us();
                 while(g_measurement_done == false) // waits for measurement duration to finish
                 {
                     sample_impact_data(&high_g_data, &low_g_gyro_data, &rtc_data);
                 }
                 app_timer_stop(m_measurement_timer_id);
+                timebase_stop();
                 //reset for next impact
                 g_measurement_done = false;
                 mt25ql256aba_store_samples(&flash_addr); // stores the samples in the flash
@@ -123,23 +128,20 @@ int main (void)
 /**
  * @brief Function that samples the accelerometer, gyroscope and real time clock as fast as possible
  * throughout the impact duration.
- * NOTE: this function has been improved on the equivalent version of this code that
- * runs on PCB Revision 1, so that a time stamp is only recorded at the beginning of the data
- * sampling. This allows for nearly 3 times the amount of data to be collected in that version,
- * because it does not need to deal with the relatively slow sample rate of the RTC for each
- * data point
+ * NOTE: the RTC is read once per impact into g_impact_time, each sample only stores the
+ * microseconds since then from the timebase TIMER. Reading the RTC for every sample took
+ * eight TWI transactions and cut the number of samples by nearly 3 times
  */
 void sample_impact_data (adxl372_accel_data_t* high_g_data, icm20649_data_t* low_g_gyro_data, ds1388_data_t* rtc_data)
 {
     adxl372_get_accel_data(high_g_data);
     icm20649_read_gyro_accel_data(low_g_gyro_data);
     icm20649_convert_data(low_g_gyro_data);
-    get_time(rtc_data);
     if (g_buf_index < MAX_SAMPLE_BUF_LENGTH)
     {
         g_sample_set_buf[g_buf_index].adxl_data = *high_g_data;
         g_sample_set_buf[g_buf_index].icm_data = *low_g_gyro_data;
-        g_sample_set_buf[g_buf_index].ds_data = *rtc_data;
+        g_sample_set_buf[g_buf_index].t_us = timebase_since_us(g_impact_start_us);
         g_buf_index++;
     }
 }
@@ -149,70 +151,73 @@ void sample_impact_data (adxl372_accel_data_t* high_g_data, icm20649_data_t* low
  * This data will NOT print if there is a mismatch between
  * the data originally recorded and the final data retrieved
  * from the flash. THEREFORE, if this data prints correctly, then
- * the code has worked properly
+ * the code has worked properly. The retrieved data is read from the
+ * flash again here instead of being mirrored in RAM
  */
 void serial_output_flash_data(void)
 {
+    impact_sample_t block[FLASH_BLOCK_SAMPLES];
+    uint8_t num_samples = 0;
+    uint8_t j = 0;
+
     NRF_LOG_INFO("\r\n===================IMPACT DATA OUTPUT===================");
-    for (int i = 0; i < g_buf_index; ++i)
+    NRF_LOG_INFO("      Month: %d Day: %d Year: 20%d",
+                    g_impact_time.month,
+                    g_impact_time.date,
+                    g_impact_time.year);
+    NRF_LOG_INFO("      Time: %d:%d:%d:%d",
+                    g_impact_time.hour,
+                    g_impact_time.minute,
+                    g_impact_time.second,
+                    g_impact_time.hundreth);
+    for (int i = 0; i < g_buf_index; ++i, ++j)
     {
+        // the samples are streamed back from flash a block at a time
+        if (j == num_samples)
+        {
+            num_samples = mt25ql256aba_read_sample_block(i, block);
+            j = 0;
+        }
         NRF_LOG_INFO("");
         NRF_LOG_INFO("ID = %d", i);
 
         // checks if accelerometer data retrieved from flash memory matches accelerometer initial data
-        if(g_flash_output_buf[i].adxl_data.x == g_sample_set_buf[i].adxl_data.x &&
-            g_flash_output_buf[i].adxl_data.y == g_sample_set_buf[i].adxl_data.y &&
-            g_flash_output_buf[i].adxl_data.z == g_sample_set_buf[i].adxl_data.z)
+        if(block[j].adxl_data.x == g_sample_set_buf[i].adxl_data.x &&
+            block[j].adxl_data.y == g_sample_set_buf[i].adxl_data.y &&
+            block[j].adxl_data.z == g_sample_set_buf[i].adxl_data.z)
         {
             NRF_LOG_INFO("      [High-g]: accel x = %d mg, accel y = %d mg, accel z = %d mg",
-                            g_flash_output_buf[i].adxl_data.x, 
-                            g_flash_output_buf[i].adxl_data.y,
-                            g_flash_output_buf[i].adxl_data.z);
+                            ADXL372_COUNTS_TO_MG(block[j].adxl_data.x),
+                            ADXL372_COUNTS_TO_MG(block[j].adxl_data.y),
+                            ADXL372_COUNTS_TO_MG(block[j].adxl_data.z));
         }
         // checks if gyro acceleration data retrieved from flash memory matches gyro initial data
-        if(g_flash_output_buf[i].icm_data.accel_x == g_sample_set_buf[i].icm_data.accel_x &&
-            g_flash_output_buf[i].icm_data.accel_y == g_sample_set_buf[i].icm_data.accel_y&&
-            g_flash_output_buf[i].icm_data.accel_z == g_sample_set_buf[i].icm_data.accel_z)
+        if(block[j].icm_data.accel_x == g_sample_set_buf[i].icm_data.accel_x &&
+            block[j].icm_data.accel_y == g_sample_set_buf[i].icm_data.accel_y&&
+            block[j].icm_data.accel_z == g_sample_set_buf[i].icm_data.accel_z)
         {
             NRF_LOG_INFO("      [Low-g]: accel x = %d mg, accel y = %d mg, accel z = %d mg",
-                                g_flash_output_buf[i].icm_data.accel_x,
-                                g_flash_output_buf[i].icm_data.accel_y,
-                                g_flash_output_buf[i].icm_data.accel_z);
+                                block[j].icm_data.accel_x,
+                                block[j].icm_data.accel_y,
+                                block[j].icm_data.accel_z);
         }
         // checks if gyro rotational data retrieved from flash memory matches gyro initial data
-        if(g_flash_output_buf[i].icm_data.gyro_x == g_sample_set_buf[i].icm_data.gyro_x &&
-            g_flash_output_buf[i].icm_data.gyro_y == g_sample_set_buf[i].icm_data.gyro_y &&
-            g_flash_output_buf[i].icm_data.gyro_z == g_sample_set_buf[i].icm_data.gyro_z)
+        if(block[j].icm_data.gyro_x == g_sample_set_buf[i].icm_data.gyro_x &&
+            block[j].icm_data.gyro_y == g_sample_set_buf[i].icm_data.gyro_y &&
+            block[j].icm_data.gyro_z == g_sample_set_buf[i].icm_data.gyro_z)
         {
             NRF_LOG_INFO("      [Gyro]: gyro x = %d mrad/s, gyro y = %d mrad/s, gyro z = %d mrad/s", 
-                                g_flash_output_buf[i].icm_data.gyro_x,
-                                g_flash_output_buf[i].icm_data.gyro_y,
-                                g_flash_output_buf[i].icm_data.gyro_z);
+                                block[j].icm_data.gyro_x,
+                                block[j].icm_data.gyro_y,
+                                block[j].icm_data.gyro_z);
         }
 
-        // checks if RTC data retrieved from flash memory matches RTC initial data
-        if(g_flash_output_buf[i].ds_data.date == g_sample_set_buf[i].ds_data.date &&
-            g_flash_output_buf[i].ds_data.day == g_sample_set_buf[i].ds_data.day &&
-            g_flash_output_buf[i].ds_data.year == g_sample_set_buf[i].ds_data.year &&
-            g_flash_output_buf[i].ds_data.month == g_sample_set_buf[i].ds_data.month &&
-            g_flash_output_buf[i].ds_data.hour == g_sample_set_buf[i].ds_data.hour &&
-            g_flash_output_buf[i].ds_data.minute == g_sample_set_buf[i].ds_data.minute&&
-            g_flash_output_buf[i].ds_data.second == g_sample_set_buf[i].ds_data.second &&
-            g_flash_output_buf[i].ds_data.hundreth == g_sample_set_buf[i].ds_data.hundreth)
+        // checks if the sample time retrieved from flash memory matches the initial sample time
+        if(block[j].t_us == g_sample_set_buf[i].t_us)
         {
-            NRF_LOG_INFO("      Month: %d Day: %d Year: 20%d",
-                            g_flash_output_buf[i].ds_data.month,
-                            g_flash_output_buf[i].ds_data.date,
-                            g_flash_output_buf[i].ds_data.year);
-
-            NRF_LOG_INFO("      Time: %d:%d:%d:%d",
-                            g_flash_output_buf[i].ds_data.hour,
-                            g_flash_output_buf[i].ds_data.minute,
-                            g_flash_output_buf[i].ds_data.second,
-                            g_flash_output_buf[i].ds_data.hundreth);
+            NRF_LOG_INFO("      t = %d us", block[j].t_us);
         }
     }
-    memset(g_flash_output_buf, 0x00, sizeof(g_flash_output_buf));
     NRF_LOG_INFO("\r\n====================DATA OUTPUT FINISH==================");
 }
 
@@ -278,54 +283,6 @@ void full_page_read(void)
     }
 }
 
-/**
- * @brief Function that performs a flash read test by checking the
- * Device ID, memory type and memory capacity of the device (all known, constant values).
- * If any of these three values are read incorrectly, read test fails and program stops.
- */
-void mt25ql256aba_startup_test(void)
-{
-    uint8_t val[3]; // three bytes to read
-    int8_t ret;
-
-    NRF_LOG_INFO("");
-    NRF_LOG_INFO("PERFORMING FLASH TEST....");
-    ret = mt25ql256aba_read_op(MT25QL256ABA_READ_ID, NULL, 0, val, sizeof(val)); // performs a read
-    spi_ret_check(ret);
-
-    NRF_LOG_INFO("1: device id = 0x%x (0x20)", val[0]);
-    if(val[0] != 0x20) // if expected device ID is not read, read test fails
-    {
-        NRF_LOG_INFO("FLASH READ TEST FAIL");
-        while(1)
-        {
-            __WFE();
-        }
-    }
-
-    nrf_delay_ms(100);
-    NRF_LOG_INFO("2:memory type = 0x%x (0xBA)", val[1]);
-    if(val[1] != 0xBA) // if expected memory type value is not read, read test fails
-    {
-        NRF_LOG_INFO("FLASH READ TEST FAIL");
-        while(1)
-        {
-            __WFE();
-        }
-    }
-
-    nrf_delay_ms(100);
-    NRF_LOG_INFO("3:memory capacity = 0x%x (0x19)", val[2]);
-    if(val[2]!= 0x19) // if expected memory capacity value is not read, read test fails
-    {
-        NRF_LOG_INFO("FLASH READ TEST FAIL");
-        while(1)
-        {
-            __WFE();
-        }
-    }
-}
-
 /**
  * @brief Function that performs a bulk erase of the entire flash chip
  */
@@ -352,13 +309,13 @@ void mt25ql256aba_check_ready_flag(void)
 
 /**
  * @brief Function that stores all of the samples written to the flash
- * memory over the impact duration
+ * memory over the impact duration. Nothing is read back here, the crc32 of
+ * the samples is kept in g_sample_crc and checked when they are retrieved
  */
 void mt25ql256aba_store_samples(uint32_t* flash_addr)
 {
     uint8_t flash_addr_buf[3]= {0};
-    uint8_t buf[32] = {0};
-    uint8_t out_buf[32] = {0};
+    uint8_t buf[FLASH_SAMPLE_STRIDE] = {0};
     uint8_t buf_size = sizeof(buf);
     uint8_t sample_buf_size = sizeof(impact_sample_t);
     uint8_t flash_addr_buf_size = sizeof(flash_addr_buf);
@@ -380,17 +337,8 @@ void mt25ql256aba_store_samples(uint32_t* flash_addr)
                               buf,
                               buf_size);
         mt25ql256aba_write_disable();
-        mt25ql256aba_check_ready_flag();
-        mt25ql256aba_read_op(MT25QL256ABA_READ, 
-                            flash_addr_buf,
-                            flash_addr_buf_size,
-                            out_buf,
-                            buf_size);
-        memcpy(&g_flash_output_buf[i], out_buf, sample_buf_size);
-        NRF_LOG_INFO("READ:  ID: %d, addr: 0x%03x, OUTPUT: %d (%d)", i, *flash_addr,
-                       g_flash_output_buf[i].adxl_data.x,
-                        g_sample_set_buf[i].adxl_data.x);
-        
+        g_sample_crc = crc32_compute(buf, sample_buf_size, (i > 0) ? &g_sample_crc : NULL);
+
         *flash_addr = *flash_addr + buf_size; 
     }
 }
@@ -407,48 +355,73 @@ void convert_4byte_address_to_3byte_address(uint32_t flash_addr, uint8_t* flash_
     flash_addr_buf[2] = flash_addr_ptr[0]; //low address value
 }
 
+/**
+ * @brief Function that reads up to FLASH_BLOCK_SAMPLES samples from the flash,
+ * starting at sample number first. The samples are stored FLASH_SAMPLE_STRIDE bytes apart from 0x0
+ * @return the number of samples read into block
+ */
+uint8_t mt25ql256aba_read_sample_block(uint32_t first, impact_sample_t* block)
+{
+    uint8_t addr[3] = {0};
+    uint8_t buf[FLASH_BLOCK_SAMPLES*FLASH_SAMPLE_STRIDE];
+    uint8_t num_samples = MIN(FLASH_BLOCK_SAMPLES, g_buf_index - first);
+
+    mt25ql256aba_check_ready_flag();
+    convert_4byte_address_to_3byte_address(first*FLASH_SAMPLE_STRIDE, addr);
+    mt25ql256aba_read_op(MT25QL256ABA_READ, addr, sizeof(addr), buf, num_samples*FLASH_SAMPLE_STRIDE);
+    for (int i = 0; i < num_samples; ++i)
+    {
+        memcpy(&block[i], &buf[i*FLASH_SAMPLE_STRIDE], sizeof(impact_sample_t));
+    }
+    return num_samples;
+}
+
 /**
  * @brief Function that retrieves all of the samples written to the flash
- * memory over the impact duration
+ * memory over the impact duration and checks them against g_sample_crc.
+ * The samples are streamed through a small block, nothing is kept in RAM
  */
 void mt25ql256aba_retrieve_samples(void)
 {
-    uint32_t addr32 = 0x00000000; // initial flash memory address
-    uint8_t addr[3] = {0};
-    uint8_t buf[32] = {0};
-    uint8_t buf_size = sizeof(buf);
-    uint8_t sample_size_bytes = sizeof(impact_sample_t);
-    uint8_t *sample_byte_ptr;
+    impact_sample_t block[FLASH_BLOCK_SAMPLES];
+    uint8_t num_samples;
+    uint32_t crc = 0;
 
     NRF_LOG_INFO("");
     NRF_LOG_INFO("BEGIN RETRIEVE SAMPLES");
-    for(int i = 0; i < g_buf_index; ++i) 
+    for(int i = 0; i < g_buf_index; i += num_samples) 
     {
-        mt25ql256aba_check_ready_flag();
-        convert_4byte_address_to_3byte_address(addr32, addr);
-        sample_byte_ptr = (uint8_t*) &g_flash_output_buf[i];
-        mt25ql256aba_read_op(MT25QL256ABA_READ,
-                              addr,
-                              sizeof(addr),
-                              sample_byte_ptr,
-                              sample_size_bytes);
-        NRF_LOG_INFO("READ: ID: %d, addr: 0x%03x, OUTPUT: %d (%d)", // the value in brackets should match the unbracketted value
-                       i, addr32, g_flash_output_buf[i].adxl_data.x, // if this is working correctly
-                        g_sample_set_buf[i].adxl_data.x);
-        addr32 = addr32 + buf_size;
+        num_samples = mt25ql256aba_read_sample_block(i, block);
+        for (int j = 0; j < num_samples; ++j)
+        {
+            NRF_LOG_INFO("READ: ID: %d, addr: 0x%03x, OUTPUT: %d (%d)", // the value in brackets should match the unbracketted value
+                           i + j, (i + j)*FLASH_SAMPLE_STRIDE, block[j].adxl_data.x, // if this is working correctly
+                            g_sample_set_buf[i + j].adxl_data.x);
+            crc = crc32_compute((uint8_t const*) &block[j], sizeof(impact_sample_t), (i + j > 0) ? &crc : NULL);
+        }
+    }
+    if (g_buf_index > 0 && crc != g_sample_crc)
+    {
+        NRF_LOG_ERROR("READ: crc 0x%08x does not match the stored 0x%08x", crc, g_sample_crc);
     }
 }
 
 /**
- * @brief Function that erases a subsector of the flash memory
+ * @brief Function that erases the subsectors of the flash memory the samples
+ * are stored in, MAX_SAMPLE_BUF_LENGTH samples FLASH_SAMPLE_STRIDE apart from 0x0
  */
 void mt25ql256aba_erase(void)
 {
-    uint8_t addr[3] = {0x00, 0x00, 0x00};
+    uint8_t addr[3];
 
-    mt25ql256aba_check_ready_flag();
-    mt25ql256aba_write_enable();
-    mt25ql256aba_write_op(MT25QL256ABA_ERASE_4KB_SUBSECTOR, addr, sizeof(addr), NULL, 0);
+    for (uint32_t address = 0; address < MAX_SAMPLE_BUF_LENGTH*FLASH_SAMPLE_STRIDE;
+         address += MT25QL256ABA_SUBSECTOR_4KB_SIZE)
+    {
+        convert_4byte_address_to_3byte_address(address, addr);
+        mt25ql256aba_check_ready_flag();
+        mt25ql256aba_write_enable();
+        mt25ql256aba_write_op(MT25QL256ABA_ERASE_4KB_SUBSECTOR, addr, sizeof(addr), NULL, 0);
+    }
     mt25ql256aba_write_disable();
 }
 
@@ -462,6 +435,23 @@ static void spi_ret_check(int8_t ret)
     }
 }
 
+/**
+ * @brief Function for initializing the spi instances of the board and the cs pins.
+ * The gyro shares the accel instance behind its own cs pin
+ */
+static void spi_sensors_init(void)
+{
+    ret_code_t err_code;
+
+    err_code = spi_instance_init(&accel_spi, &accel_spi_config, SPI_ACCEL_BURST_FREQ);
+    APP_ERROR_CHECK(err_code);
+
+    APP_ERROR_CHECK_BOOL(spi_device_add(&accel_spi, &gyro_spi_config, SPI_GYRO_BURST_FREQ) == 0);
+
+    err_code = spi_instance_init(&flash_spi, &flash_spi_config, SPI_FLASH_BURST_FREQ);
+    APP_ERROR_CHECK(err_code);
+}
+
 /********************ADXL FUNCTIONS***************************/
 
 /**
@@ -470,29 +460,18 @@ static void spi_ret_check(int8_t ret)
  */
 void adxl372_init(void)
 {
-    /*
-    GPIO for INT1 pin and INT2 pin,
-    gpio_init();
-    */
+    //instant on at the 30g threshold, low noise, x_offset = 0, y_offset=2, z_offset=5 for Vs=3.3V
+    static const adxl372_config_t instaon_config = {
+        .offset       = {0, 2, 5},
+        .fifo_samples = ADXL372_FIFO_SAMPLES_RESET,
+        .fifo_ctl     = ADXL372_FIFO_CTL_VAL(1, BYPASSED, XYZ_FIFO),
+        .timing       = ADXL372_TIMING_VAL(ODR_6400HZ, WUR_52MS),
+        .measure      = ADXL372_MEASURE_VAL(BW_3200HZ, LOW_NOISE, DEF, false),
+        .power_ctl    = ADXL372_POWER_CTL_VAL(INSTANT_ON, true, true, FILTER_SETTLE_16, ADXL_INSTAON_HIGH_THRESH),
+    };
 
-    //initialize device settings
-    /* set up measurement mode */
     adxl372_reset();
-    adxl372_set_op_mode(STAND_BY);
-    //Please refer to figure 36 User offset trim profile for more info
-    //For ADXL372 Vs=3.3V, x_offset = 0, y_offset=2, z_offset=5 
-    adxl372_set_x_offset(0);
-    adxl372_set_y_offset(2); //+10 LSB
-    adxl372_set_z_offset(5); //+35 LSB
-    adxl372_set_hpf_disable(true);
-    adxl372_set_lpf_disable(true);
-    adxl372_set_bandwidth(BW_3200HZ);
-    adxl372_set_odr(ODR_6400HZ);
-    adxl372_set_filter_settle(FILTER_SETTLE_16);
-    adxl372_set_instaon_threshold(ADXL_INSTAON_HIGH_THRESH); //sets to 30g
-    adxl372_write_mask(ADI_ADXL372_MEASURE, MEASURE_LOW_NOISE_MASK, MEASURE_LOW_NOISE_POS, LOW_NOISE);
-    adxl372_set_op_mode(INSTANT_ON);
-
+    adxl372_apply_config(NULL, &instaon_config);
 }
 
 /**
@@ -612,135 +591,6 @@ void icm20649_write_test(void)
     /********************************************/
 }
 
-/**
- * @brief Function for writing intialization and configure
- * commands to the gyroscope
- */
-void icm20649_init(void)
-{
-    //USER CTRL disable all
-    icm20649_write_reg(0x03, 0x0);
-
-    //LP_CONFIG disable duty cycle mode
-    icm20649_write_reg(0x05, 0x0);
-
-    //PWR_MGMT 1 select best clk and disable everything else
-    icm20649_write_reg(0x06, 0x1);
-
-    //PWR_MGMT 2 enable accel & gyro
-    icm20649_write_reg(0x07, 0x0);
-    
-    //REG BANK SEL select userbank 2
-    icm20649_write_reg(0x7F, 0x20);
-
-    //GYRO_CONFIG_1 bypass gyro DLPF, 2000dps
-    icm20649_write_reg(0x1, 0x4);
-
-    //GYRO_CONFIG_2 disable self test, no avging
-    icm20649_write_reg(0x2, 0x0);
-
-    //GYRO_CONFIG_2 disable self test, no avging
-    icm20649_write_reg(0x14, 0x6);
-
-    //REG BANK SEL select userbank 0
-    icm20649_write_reg(0x7F, 0x0);
-}
-
-/**
- * @brief Function for converting ICM raw recorded values into
- * proper measurements
- */
-void icm20649_convert_data(icm20649_data_t * data)
-{
-    float deg2rad = 3.1415/180.0; // degree to radian conversion constant
-
-    // acquires the acceleration data and converts it to mgs
-    data->accel_x = ((float) data->accel_x/1024.0)*1000;
-    data->accel_y = ((float) data->accel_y/1024.0)*1000;
-    data->accel_z = ((float) data->accel_z/1024.0)*1000;
-    // acquires the rotational data and converts it to mrad/s
-    data->gyro_x = ((float) data->gyro_x / 32767.0) * 2000.0 * deg2rad *1000;
-    data->gyro_y = ((float) data->gyro_y / 32767.0) * 2000.0 * deg2rad *1000;
-    data->gyro_z = ((float) data->gyro_z / 32767.0) * 2000.0 * deg2rad *1000;
-}
-
-/**
- * @brief Function for writing one byte to a single register address
- */
-int8_t icm20649_write_reg(uint8_t address, uint8_t data)
-{
-    uint8_t tx_msg[2];
-    uint8_t rx_buf[2];
-    tx_msg[0] = address;
-    tx_msg[1] = data;
-
-    return spi_write_and_read(SPI_ICM20649_CS_PIN, tx_msg, 2, rx_buf, 2 ); // send 2 bytes (address and data)
-}
-
-/**
- * @brief Function for reading one byte from a single register address
- */
-int8_t icm20649_read_reg(uint8_t address, uint8_t * reg_data)
-{
-    uint8_t reg_addr;
-    int8_t ret;
-    uint8_t rx_buf[2];
-
-    reg_addr = (uint8_t)  ( address | 0x80 ); //set 1st bit for reads
-    ret = spi_write_and_read(SPI_ICM20649_CS_PIN, &reg_addr, 1, rx_buf, 2);
-
-    *reg_data = rx_buf[1];
-
-    return ret; // return the read byte
-}
-
-/**
- * @brief Function for reading up to 256 consecutive bytes from the internal registers
- */
-int8_t icm20649_multibyte_read_reg( uint8_t reg_addr, uint8_t* reg_data, uint8_t num_bytes) 
-{
-    uint8_t read_addr;
-    uint8_t buf[257]; 
-    int8_t ret;
-    
-    if(num_bytes > 256) // if number of bytes is greater than 256, return an error
-        return -1;
-
-    read_addr = reg_addr | 0x80; //set MSB to 1 for read
-    memset( buf, 0x00, num_bytes + 1);
-
-    ret = spi_write_and_read(SPI_ICM20649_CS_PIN, &read_addr, 1, buf, num_bytes + 1 );
-    if (ret < 0)
-        return ret;
-    
-    memcpy(reg_data, &buf[1], num_bytes);
-
-    return ret;
-}
-
-/**
- * @brief Function for reading the gyroscope's data (linear and rotational)
- */
-void icm20649_read_gyro_accel_data(icm20649_data_t *icm20649_data)
-{
-    uint8_t rx_buf[12] = {0};
-
-    //REG BANK SEL select userbank 0
-    icm20649_write_reg(0x7F, 0x0);
-
-    icm20649_multibyte_read_reg( 0x2D, rx_buf, 12); // performs a multibyte read
-
-    // arranges the read data bytes for each measurement to proper values
-    icm20649_data->accel_x = rx_buf[0]<<8 | rx_buf[1];
-    icm20649_data->accel_y = rx_buf[2]<<8 | rx_buf[3];
-    icm20649_data->accel_z = rx_buf[4]<<8 | rx_buf[5];
-    icm20649_data->gyro_x = rx_buf[6]<<8 | rx_buf[7];
-    icm20649_data->gyro_y = rx_buf[8]<<8 | rx_buf[9];
-    icm20649_data->gyro_z = rx_buf[10]<<8 | rx_buf[11];
-    
-
-}
-
 /**
  * @brief Function for initializing the nrf log
  */
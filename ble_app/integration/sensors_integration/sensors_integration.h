@@ -37,6 +37,9 @@
 //adxl372 driver
 #include "adxl372.h"
 
+//icm20649 driver
+#include "icm20649.h"
+
 //app_timer
 #include "app_timer.h"
 #include "nrf_drv_clock.h"
@@ -44,11 +47,19 @@
 //flash driver
 #include "mt25ql256aba.h"
 
+//sample timestamps
+#include "timebase.h"
+
+//stored sample check
+#include "crc32.h"
+
 // TWI instance ID
 #define TWI_INSTANCE_ID     1
 
 #define PROX_THRESHOLD 5000
-#define MAX_SAMPLE_BUF_LENGTH 500 
+#define MAX_SAMPLE_BUF_LENGTH 1000 //the flash readback streams through a block, there is no RAM mirror
+#define FLASH_SAMPLE_STRIDE 32 //bytes between samples on flash
+#define FLASH_BLOCK_SAMPLES 4 //samples read back per flash access, a read is at most 251 bytes
 #define IMPACT_G_THRESHOLD 10000 //in milli-g's
 #define IMPACT_DURATION 100 //in milliseconds
 
@@ -113,19 +124,10 @@ static const nrf_drv_twi_t twi = NRF_DRV_TWI_INSTANCE(TWI_INSTANCE_ID);
 
 // custom data structs
 
-typedef struct{
-    int16_t accel_x;
-    int16_t accel_y;
-    int16_t accel_z;
-    int16_t gyro_x;
-    int16_t gyro_y;
-    int16_t gyro_z;
-} icm20649_data_t;
-
 typedef struct{
     adxl372_accel_data_t adxl_data;
     icm20649_data_t icm_data;
-    ds1388_data_t ds_data;
+    uint32_t t_us; //since g_impact_start_us
     //uint8_t padding[6]; //to align with 32byte
 }impact_sample_t;
 
@@ -133,8 +135,10 @@ volatile uint16_t prox_val = 0;
 //adxl372_accel_data_t g_high_G_buf[MAX_SAMPLE_BUF_LENGTH];
 //icm20649_data_t g_low_G_buf[MAX_SAMPLE_BUF_LENGTH];
 impact_sample_t g_sample_set_buf[MAX_SAMPLE_BUF_LENGTH];
-impact_sample_t g_flash_output_buf[MAX_SAMPLE_BUF_LENGTH];
 uint32_t g_buf_index = 0;
+uint32_t g_sample_crc; //crc32 of the sample set as it was programmed
+ds1388_data_t g_impact_time; //rtc time read once at the start of the impact
+uint32_t g_impact_start_us; //timebase tick of g_impact_time
 
 bool g_measurement_done = false;
 APP_TIMER_DEF(m_measurement_timer_id);/**< Handler for measurement timer 
@@ -144,17 +148,12 @@ APP_TIMER_DEF(m_measurement_timer_id);/**< Handler for measurement timer
 
 void icm20649_read_test(void);
 void icm20649_write_test(void);
-void icm20649_convert_data(icm20649_data_t * data);
-void icm20649_init(void);
-int8_t icm20649_write_reg(uint8_t address, uint8_t data);
-int8_t icm20649_read_reg(uint8_t address, uint8_t * reg_data);
-int8_t icm20649_multibyte_read_reg( uint8_t reg_addr, uint8_t* reg_data, uint8_t num_bytes);
-void icm20649_read_gyro_accel_data(icm20649_data_t *icm20649_data);
 
 void sample_impact_data (adxl372_accel_data_t* high_g_data, icm20649_data_t* low_g_gyro_data, ds1388_data_t* rtc_data);
 void serial_output_impact_data(void);
 void mt25ql256aba_store_samples(uint32_t* flash_addr);
 void mt25ql256aba_retrieve_samples(void);
+uint8_t mt25ql256aba_read_sample_block(uint32_t first, impact_sample_t* block);
 void serial_output_flash_data(void);
 
 void vcnl_config(void);
@@ -176,8 +175,8 @@ uint8_t hex2dec(uint8_t val);
 static void log_init(void);
 static void lfclk_request(void);
 static void create_timers(void);
-void mt25ql256aba_startup_test(void);
 static void spi_ret_check(int8_t ret);
+static void spi_sensors_init(void);
 void adxl372_startup_test(void);
 void mt25ql256aba_erase(void);
 void mt25ql256aba_check_ready_flag(void);
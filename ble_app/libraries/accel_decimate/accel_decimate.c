@@ -0,0 +1,234 @@
+//-------------------------------------------
+// Title: accel_decimate.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Decimates fifo bursts of adxl372 samples to the live and
+// activity rates. Each axis is gathered behind the samples carried from the
+// last burst into a contiguous Q15 block, as many whole output periods as
+// it holds go through the CMSIS-DSP fast FIR decimator, which uses the M4
+// dual 16 bit MACs on the kept samples only, and the rest is carried on.
+// The filter state carries over from burst to burst, reset it whenever the
+// sample stream restarts.
+//-------------------------------------------
+#include <string.h>
+#include "app_util.h"
+#include "accel_decimate.h"
+
+/* Hamming windowed sinc per decimation factor M, fc 0.4/M of the input rate,
+ * 6*M taps (16 at least) in Q15 summing to 32768 for a unity DC gain. The
+ * fast decimator keeps a 32 bit sum, the taps sum to 1.27 in magnitude at
+ * most so a full scale input with ACCEL_DECIMATE_HEADROOM_SHIFT can't overflow it */
+static const q15_t m_coeffs_2[16] = {
+    0, 183, 259, -541, -1665, 0, 6025, 12123, 12123, 6025, 0, -1665, -541, 259, 183, 0,
+};
+
+static const q15_t m_coeffs_4[24] = {
+    58, 30, -50, -223, -455, -577, -333, 495, 1933, 3726, 5388, 6392,
+    6392, 5388, 3726, 1933, 495, -333, -577, -455, -223, -50, 30, 58,
+};
+
+static const q15_t m_coeffs_8[48] = {
+    32, 27, 21, 9, -12, -46, -93, -150, -211, -265, -297, -291,
+    -228, -96, 116, 407, 772, 1193, 1645, 2098, 2516, 2866, 3118, 3253,
+    3253, 3118, 2866, 2516, 2098, 1645, 1193, 772, 407, 116, -96, -228,
+    -291, -297, -265, -211, -150, -93, -46, -12, 9, 21, 27, 32,
+};
+
+static const q15_t m_coeffs_16[96] = {
+    16, 15, 15, 14, 12, 10, 7, 3, -3, -10, -19, -29,
+    -41, -55, -70, -85, -101, -116, -130, -141, -149, -153, -151, -143,
+    -127, -102, -69, -25, 28, 91, 165, 248, 340, 439, 544, 655,
+    768, 883, 996, 1106, 1211, 1308, 1395, 1471, 1534, 1583, 1616, 1630,
+    1630, 1616, 1583, 1534, 1471, 1395, 1308, 1211, 1106, 996, 883, 768,
+    655, 544, 439, 340, 248, 165, 91, 28, -25, -69, -102, -127,
+    -143, -151, -153, -149, -141, -130, -116, -101, -85, -70, -55, -41,
+    -29, -19, -10, -3, 3, 7, 10, 12, 14, 15, 15, 16,
+};
+
+STATIC_ASSERT(sizeof(m_coeffs_16)/sizeof(q15_t) == ACCEL_DECIMATE_MAX_TAPS);
+STATIC_ASSERT(ACCEL_DECIMATE_LIVE_HZ/ACCEL_DECIMATE_ACTIVITY_HZ == ACCEL_DECIMATE_MAX_FACTOR);
+
+static q15_t m_in[ACCEL_DECIMATE_MAX_BLOCK];
+static q15_t m_out[ACCEL_DECIMATE_MAX_BLOCK];
+static adxl372_accel_data_t m_samples[ACCEL_DECIMATE_OUTPUTS][ACCEL_DECIMATE_MAX_BLOCK/2];
+
+// Sets a stage up for a decimation factor, returns 0 if success, -2 if there are no taps for it
+static int8_t stage_init(accel_decimate_stage_t *stage, uint32_t factor)
+{
+    q15_t const *coeffs;
+    uint16_t num_taps;
+
+    switch (factor)
+    {
+        case 1: coeffs = NULL; num_taps = 0; break;
+        case 2: coeffs = m_coeffs_2; num_taps = ARRAY_SIZE(m_coeffs_2); break;
+        case 4: coeffs = m_coeffs_4; num_taps = ARRAY_SIZE(m_coeffs_4); break;
+        case 8: coeffs = m_coeffs_8; num_taps = ARRAY_SIZE(m_coeffs_8); break;
+        case 16: coeffs = m_coeffs_16; num_taps = ARRAY_SIZE(m_coeffs_16); break;
+        default: return -2;
+    }
+
+    stage->factor = (uint8_t) factor;
+    stage->carried = 0;
+    memset(stage->state, 0, sizeof(stage->state));
+    for (uint8_t i = 0; i < 3 && coeffs != NULL; i++)
+    {
+        //the block size only has to be a whole number of output periods, a burst may be shorter
+        arm_fir_decimate_init_q15(&stage->axis[i], num_taps, stage->factor, (q15_t *) coeffs, stage->state[i],
+                                  (ACCEL_DECIMATE_MAX_BLOCK/factor)*factor);
+    }
+
+    return 0;
+}
+
+// Forgets the previous samples of a stage
+static void stage_reset(accel_decimate_stage_t *stage)
+{
+    stage->carried = 0;
+    memset(stage->state, 0, sizeof(stage->state));
+}
+
+// Decimates num_samples into out, at most ACCEL_DECIMATE_MAX_BLOCK less the carry.
+// returns the samples written to out
+static uint16_t stage_block(accel_decimate_stage_t *stage, adxl372_accel_data_t const *samples,
+                            uint16_t num_samples, adxl372_accel_data_t *out)
+{
+    uint16_t total = stage->carried + num_samples;
+    uint16_t used = total - (total % stage->factor);
+    int16_t const *p_axis;
+    int16_t *p_out;
+
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        //x, y and z are the consecutive int16 fields of adxl372_accel_data_t
+        p_axis = &samples[0].x + i;
+        p_out = &out[0].x + i;
+        memcpy(m_in, stage->carry[i], stage->carried*sizeof(q15_t));
+        for (uint16_t n = 0; n < num_samples; n++)
+        {
+            m_in[stage->carried + n] = (q15_t) (p_axis[3*n] << ACCEL_DECIMATE_HEADROOM_SHIFT);
+        }
+        if (used > 0)
+        {
+            arm_fir_decimate_fast_q15(&stage->axis[i], m_in, m_out, used);
+        }
+        memcpy(stage->carry[i], &m_in[used], (total - used)*sizeof(q15_t));
+        for (uint16_t n = 0; n < used/stage->factor; n++)
+        {
+            p_out[3*n] = m_out[n] >> ACCEL_DECIMATE_HEADROOM_SHIFT;
+        }
+    }
+    stage->carried = (uint8_t) (total - used);
+
+    return used/stage->factor;
+}
+
+/*
+ * Sets the decimators up for the adxl372 rate with every output disabled
+ * @param rate_hz - rate of the samples given to accel_decimate_block
+ * @param handler - gets the samples of the enabled outputs
+ * @return 0 if success, -2 if the rate is not ACCEL_DECIMATE_LIVE_HZ times 1, 2, 4, 8 or 16
+ */
+int8_t accel_decimate_init(accel_decimate_t *decimate, uint32_t rate_hz, accel_decimate_handler_t handler)
+{
+    decimate->handler = handler;
+    memset(decimate->enabled, 0, sizeof(decimate->enabled));
+    if (stage_init(&decimate->stage[ACCEL_DECIMATE_ACTIVITY], ACCEL_DECIMATE_LIVE_HZ/ACCEL_DECIMATE_ACTIVITY_HZ) < 0)
+        return -2;
+
+    return accel_decimate_rate_set(decimate, rate_hz);
+}
+
+/*
+ * Changes the adxl372 rate, the outputs stay enabled at their own rates and
+ * the decimators start over
+ * @return 0 if success, -2 if the rate is not ACCEL_DECIMATE_LIVE_HZ times 1, 2, 4, 8 or 16
+ */
+int8_t accel_decimate_rate_set(accel_decimate_t *decimate, uint32_t rate_hz)
+{
+    if (rate_hz < ACCEL_DECIMATE_LIVE_HZ || (rate_hz % ACCEL_DECIMATE_LIVE_HZ) != 0)
+        return -2;
+    if (stage_init(&decimate->stage[ACCEL_DECIMATE_LIVE], rate_hz/ACCEL_DECIMATE_LIVE_HZ) < 0)
+        return -2;
+
+    stage_reset(&decimate->stage[ACCEL_DECIMATE_ACTIVITY]);
+    return 0;
+}
+
+/*
+ * Forgets the previous samples, for when the fifo was reset or overran
+ */
+void accel_decimate_reset(accel_decimate_t *decimate)
+{
+    for (uint8_t i = 0; i < ACCEL_DECIMATE_OUTPUTS; i++)
+    {
+        stage_reset(&decimate->stage[i]);
+    }
+}
+
+/*
+ * Starts or stops an output, same context as accel_decimate_block or with it
+ * held off. The activity output runs the live stage too, a stage that was
+ * idle starts from an empty history
+ */
+void accel_decimate_enable(accel_decimate_t *decimate, accel_decimate_output_t output, bool enable)
+{
+    bool live_ran = decimate->enabled[ACCEL_DECIMATE_LIVE] || decimate->enabled[ACCEL_DECIMATE_ACTIVITY];
+
+    if (output >= ACCEL_DECIMATE_OUTPUTS || decimate->enabled[output] == enable)
+        return;
+
+    if (enable && !live_ran)
+    {
+        stage_reset(&decimate->stage[ACCEL_DECIMATE_LIVE]);
+    }
+    if (enable && output == ACCEL_DECIMATE_ACTIVITY)
+    {
+        stage_reset(&decimate->stage[ACCEL_DECIMATE_ACTIVITY]);
+    }
+    decimate->enabled[output] = enable;
+}
+
+bool accel_decimate_enabled(accel_decimate_t const *decimate, accel_decimate_output_t output)
+{
+    return (output < ACCEL_DECIMATE_OUTPUTS) && decimate->enabled[output];
+}
+
+/*
+ * Runs num_samples consecutive samples at the adxl372 rate through the stages
+ * the enabled outputs need and hands each output what came out of this burst,
+ * at most ADXL_FIFO_MAX_SAMPLES
+ */
+void accel_decimate_block(accel_decimate_t *decimate, adxl372_accel_data_t const *samples, uint16_t num_samples)
+{
+    adxl372_accel_data_t const *live = samples;
+    uint16_t num_live = num_samples;
+    uint16_t num_activity;
+
+    if (!decimate->enabled[ACCEL_DECIMATE_LIVE] && !decimate->enabled[ACCEL_DECIMATE_ACTIVITY])
+        return;
+    if (num_samples > ADXL_FIFO_MAX_SAMPLES)
+        num_samples = ADXL_FIFO_MAX_SAMPLES;
+
+    if (decimate->stage[ACCEL_DECIMATE_LIVE].factor > 1)
+    {
+        live = m_samples[ACCEL_DECIMATE_LIVE];
+        num_live = stage_block(&decimate->stage[ACCEL_DECIMATE_LIVE], samples, num_samples,
+                               m_samples[ACCEL_DECIMATE_LIVE]);
+    }
+    if (num_live == 0)
+        return;
+    if (decimate->enabled[ACCEL_DECIMATE_LIVE])
+    {
+        decimate->handler(ACCEL_DECIMATE_LIVE, live, num_live);
+    }
+
+    if (decimate->enabled[ACCEL_DECIMATE_ACTIVITY])
+    {
+        num_activity = stage_block(&decimate->stage[ACCEL_DECIMATE_ACTIVITY], live, num_live,
+                                   m_samples[ACCEL_DECIMATE_ACTIVITY]);
+        if (num_activity > 0)
+        {
+            decimate->handler(ACCEL_DECIMATE_ACTIVITY, m_samples[ACCEL_DECIMATE_ACTIVITY], num_activity);
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef ACCEL_DECIMATE_H
+#define ACCEL_DECIMATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "arm_math.h"
+#include "adxl372.h"
+
+/* Multi-rate outputs of the adxl372 stream, run on whole fifo bursts next to
+ * the full rate capture. Two cascaded CMSIS-DSP Q15 FIR decimators, which
+ * only compute the samples they keep: the first takes the sample rate down to
+ * ACCEL_DECIMATE_LIVE_HZ for the live stream, the second takes that down to
+ * ACCEL_DECIMATE_ACTIVITY_HZ for the activity log. Each is a Hamming windowed
+ * sinc with its -6 dB point at 0.4 of its output rate (-0.5 dB at 0.2, below
+ * -60 dB from 0.75), so the outputs are low passed to 160 Hz and 10 Hz
+ * whatever the profile's rate. A stage only runs while an
+ * output needs it, with nothing enabled a burst costs nothing. The samples
+ * of a burst that do not make up a whole output period are carried to the
+ * next one, so the outputs keep their phase over any burst size. The counts
+ * are shifted up by ACCEL_DECIMATE_HEADROOM_SHIFT into Q15, leaving room for
+ * the ripple of the window at full scale */
+#define ACCEL_DECIMATE_LIVE_HZ          400
+#define ACCEL_DECIMATE_ACTIVITY_HZ      25
+#define ACCEL_DECIMATE_MAX_FACTOR       16 //6400 Hz to ACCEL_DECIMATE_LIVE_HZ, and 400 Hz to 25 Hz
+#define ACCEL_DECIMATE_MAX_TAPS         (6*ACCEL_DECIMATE_MAX_FACTOR)
+#define ACCEL_DECIMATE_HEADROOM_SHIFT   3
+#define ACCEL_DECIMATE_MAX_BLOCK        (ADXL_FIFO_MAX_SAMPLES + ACCEL_DECIMATE_MAX_FACTOR) //a burst and the carry
+
+typedef enum {
+    ACCEL_DECIMATE_LIVE = 0,
+    ACCEL_DECIMATE_ACTIVITY,
+    ACCEL_DECIMATE_OUTPUTS
+} accel_decimate_output_t;
+
+/* Gets the samples of an output in the context of accel_decimate_block() */
+typedef void (*accel_decimate_handler_t)(accel_decimate_output_t output, adxl372_accel_data_t const *samples,
+                                         uint16_t num_samples);
+
+typedef struct {
+    arm_fir_decimate_instance_q15 axis[3];
+    q15_t state[3][ACCEL_DECIMATE_MAX_TAPS + ACCEL_DECIMATE_MAX_BLOCK - 1];
+    q15_t carry[3][ACCEL_DECIMATE_MAX_FACTOR];
+    uint8_t carried;
+    uint8_t factor;                 //1 passes the samples through
+} accel_decimate_stage_t;
+
+typedef struct {
+    accel_decimate_stage_t stage[ACCEL_DECIMATE_OUTPUTS];
+    accel_decimate_handler_t handler;
+    bool enabled[ACCEL_DECIMATE_OUTPUTS];
+} accel_decimate_t;
+
+int8_t accel_decimate_init(accel_decimate_t *decimate, uint32_t rate_hz, accel_decimate_handler_t handler);
+
+int8_t accel_decimate_rate_set(accel_decimate_t *decimate, uint32_t rate_hz);
+
+void accel_decimate_reset(accel_decimate_t *decimate);
+
+void accel_decimate_enable(accel_decimate_t *decimate, accel_decimate_output_t output, bool enable);
+
+bool accel_decimate_enabled(accel_decimate_t const *decimate, accel_decimate_output_t output);
+
+void accel_decimate_block(accel_decimate_t *decimate, adxl372_accel_data_t const *samples, uint16_t num_samples);
+
+#endif //ACCEL_DECIMATE_H
@@ -0,0 +1,65 @@
+//-------------------------------------------
+// Title: accel_filter.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Low pass filters fifo bursts of adxl372 samples in place.
+// Each axis is gathered into a contiguous Q15 block, run through the
+// CMSIS-DSP biquad cascade, which uses the M4 dual 16 bit MACs, and
+// scattered back. The filter state carries over from burst to burst,
+// reset it whenever the sample stream restarts.
+//-------------------------------------------
+#include <string.h>
+#include "accel_filter.h"
+#include "profiler.h"
+
+/* 4 pole Butterworth, fc 1650 Hz at 6400 Hz, bilinear transform with prewarping.
+ * Per stage {b0, 0, b1, b2, -a1, -a2} in Q14, the unity DC gain is kept by the rounding */
+static const q15_t m_coeffs[6*ACCEL_FILTER_STAGES] = {
+    4470, 0, 8939, 4470, -836, -658,    //Q 0.541
+    6217, 0, 12435, 6217, -1163, -7323, //Q 1.307
+};
+
+static q15_t m_in[ACCEL_FILTER_MAX_BLOCK];
+static q15_t m_out[ACCEL_FILTER_MAX_BLOCK];
+
+void accel_filter_init(accel_filter_t *filter)
+{
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        arm_biquad_cascade_df1_init_q15(&filter->axis[i], ACCEL_FILTER_STAGES, (q15_t *) m_coeffs,
+                                        filter->state[i], ACCEL_FILTER_POST_SHIFT);
+    }
+}
+
+/*
+ * Forgets the previous samples, for when the fifo was reset or overran
+ */
+void accel_filter_reset(accel_filter_t *filter)
+{
+    memset(filter->state, 0, sizeof(filter->state));
+}
+
+/*
+ * Filters num_samples consecutive samples in place, at most ACCEL_FILTER_MAX_BLOCK
+ */
+RAMFUNC void accel_filter_block(accel_filter_t *filter, adxl372_accel_data_t *samples, uint16_t num_samples)
+{
+    int16_t *p_axis;
+
+    if (num_samples > ACCEL_FILTER_MAX_BLOCK)
+        num_samples = ACCEL_FILTER_MAX_BLOCK;
+
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        //x, y and z are the consecutive int16 fields of adxl372_accel_data_t
+        p_axis = &samples[0].x + i;
+        for (uint16_t n = 0; n < num_samples; n++)
+        {
+            m_in[n] = (q15_t) (p_axis[3*n] << ACCEL_FILTER_HEADROOM_SHIFT);
+        }
+        arm_biquad_cascade_df1_q15(&filter->axis[i], m_in, m_out, num_samples);
+        for (uint16_t n = 0; n < num_samples; n++)
+        {
+            p_axis[3*n] = m_out[n] >> ACCEL_FILTER_HEADROOM_SHIFT;
+        }
+    }
+}
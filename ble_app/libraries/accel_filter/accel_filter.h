@@ -0,0 +1,32 @@
+#ifndef ACCEL_FILTER_H
+#define ACCEL_FILTER_H
+
+#include <stdint.h>
+#include "arm_math.h"
+#include "adxl372.h"
+
+/* CFC 1000 style low pass of the adxl372 x/y/z, run on whole fifo bursts
+ * with the CMSIS-DSP Q15 biquad so the trigger, the stored records and the
+ * metrics all see the same filtered data. SAE J211
+ * CFC 1000 is a 4 pole Butterworth with its -3 dB point at 1650 Hz, here as
+ * two cascaded causal biquads for ACCEL_FILTER_RATE_HZ. The counts are
+ * shifted up by ACCEL_FILTER_HEADROOM_SHIFT into Q15, leaving room for the
+ * ~18% step overshoot of the cascade at full scale */
+#define ACCEL_FILTER_RATE_HZ            6400 //coefficients are only valid at this rate
+#define ACCEL_FILTER_STAGES             2
+#define ACCEL_FILTER_POST_SHIFT         1 //coefficients are Q14
+#define ACCEL_FILTER_HEADROOM_SHIFT     3
+#define ACCEL_FILTER_MAX_BLOCK          ADXL_FIFO_MAX_SAMPLES
+
+typedef struct {
+    arm_biquad_casd_df1_inst_q15 axis[3];
+    q15_t state[3][4*ACCEL_FILTER_STAGES];
+} accel_filter_t;
+
+void accel_filter_init(accel_filter_t *filter);
+
+void accel_filter_reset(accel_filter_t *filter);
+
+void accel_filter_block(accel_filter_t *filter, adxl372_accel_data_t *samples, uint16_t num_samples);
+
+#endif //ACCEL_FILTER_H
@@ -0,0 +1,118 @@
+//-------------------------------------------
+// Title: accel_fusion.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Fuses the adxl372 and the icm20649 accel into one wide range
+// channel. The per sample path only converts, blends and adds to the
+// decayed sums of the cross calibration in integers, the 64 bit divisions
+// of the fit are left to accel_fusion_fit() in thread context.
+//-------------------------------------------
+#include <string.h>
+#include "accel_fusion.h"
+
+#define BLEND_ONE           256 //weight of the icm20649 alone
+#define BLEND_LO_COUNTS     (32768*ACCEL_FUSION_BLEND_LO_PCT/100)
+#define BLEND_HI_COUNTS     (32768*ACCEL_FUSION_BLEND_HI_PCT/100)
+#define FIT_MIN_PAIRS       16
+#define FIT_GAIN_MIN        (ACCEL_FUSION_GAIN_UNITY/2) //a fit outside of these is not of the same motion
+#define FIT_GAIN_MAX        (ACCEL_FUSION_GAIN_UNITY*2)
+
+static int32_t abs32(int32_t val)
+{
+    return (val < 0) ? -val : val;
+}
+
+static int16_t sat16(int32_t val)
+{
+    return (int16_t) ((val > INT16_MAX) ? INT16_MAX : (val < INT16_MIN) ? INT16_MIN : val);
+}
+
+/*
+ * Starts with a unity gain, no offset and empty sums
+ */
+void accel_fusion_init(accel_fusion_t *fusion)
+{
+    memset(fusion, 0, sizeof(accel_fusion_t));
+    for (uint8_t j = 0; j < 3; j++)
+        fusion->gain_q16[j] = ACCEL_FUSION_GAIN_UNITY;
+}
+
+/*
+ * Fuses one pair of samples, a pair below the blend goes into the sums of the fit
+ * @param icm           - icm20649 raw counts of the same time, NULL for the adxl372 alone
+ * @param icm_lsb_per_g - icm20649_accel_lsb_per_g() of the counts
+ * @param fused         - x, y, z in ACCEL_FUSION_MG_PER_LSB
+ */
+void accel_fusion_sample(accel_fusion_t *fusion, adxl372_accel_data_t const *adxl, icm20649_data_t const *icm,
+                         int16_t icm_lsb_per_g, int16_t *fused)
+{
+    int32_t adxl_mg[3] = {ADXL372_COUNTS_TO_MG(adxl->x), ADXL372_COUNTS_TO_MG(adxl->y),
+                          ADXL372_COUNTS_TO_MG(adxl->z)};
+    int32_t icm_counts[3] = {0};
+    int32_t weight = 0;
+    int32_t peak = 0;
+    int32_t icm_mg, cal_mg;
+    uint8_t j;
+
+    if (icm != NULL)
+    {
+        icm_counts[0] = icm->accel_x;
+        icm_counts[1] = icm->accel_y;
+        icm_counts[2] = icm->accel_z;
+        for (j = 0; j < 3; j++)
+        {
+            if (abs32(icm_counts[j]) > peak)
+                peak = abs32(icm_counts[j]);
+        }
+        if (peak < BLEND_LO_COUNTS)
+            weight = BLEND_ONE;
+        else if (peak < BLEND_HI_COUNTS)
+            weight = (BLEND_HI_COUNTS - peak) * BLEND_ONE / (BLEND_HI_COUNTS - BLEND_LO_COUNTS);
+    }
+    if (weight == BLEND_ONE)
+    {
+        fusion->n += 1 - (fusion->n >> ACCEL_FUSION_FIT_SHIFT);
+    }
+
+    for (j = 0; j < 3; j++)
+    {
+        icm_mg = icm_counts[j] * 1000 / icm_lsb_per_g;
+        cal_mg = (int32_t) (((int64_t) fusion->gain_q16[j] * adxl_mg[j]) >> 16) + fusion->offset_mg[j];
+        if (weight == BLEND_ONE)
+        {
+            //pairs both sensors read in range, the decay forgets the oldest
+            fusion->sum_x[j] += adxl_mg[j] - (fusion->sum_x[j] >> ACCEL_FUSION_FIT_SHIFT);
+            fusion->sum_y[j] += icm_mg - (fusion->sum_y[j] >> ACCEL_FUSION_FIT_SHIFT);
+            fusion->sum_xx[j] += (int64_t) adxl_mg[j] * adxl_mg[j] - (fusion->sum_xx[j] >> ACCEL_FUSION_FIT_SHIFT);
+            fusion->sum_xy[j] += (int64_t) adxl_mg[j] * icm_mg - (fusion->sum_xy[j] >> ACCEL_FUSION_FIT_SHIFT);
+        }
+        fused[j] = sat16((weight * icm_mg + (BLEND_ONE - weight) * cal_mg) / (BLEND_ONE * ACCEL_FUSION_MG_PER_LSB));
+    }
+}
+
+/*
+ * Refits the gain and offset of each adxl372 axis onto the icm20649 from the
+ * pairs so far, the gain only once they spread enough to tell it
+ */
+void accel_fusion_fit(accel_fusion_t *fusion)
+{
+    int64_t n = fusion->n;
+    int64_t var_n2, cov_n2, gain;
+    int64_t min_spread = (int64_t) ACCEL_FUSION_FIT_MIN_SPREAD_MG * ACCEL_FUSION_FIT_MIN_SPREAD_MG;
+
+    if (n < FIT_MIN_PAIRS)
+        return;
+
+    for (uint8_t j = 0; j < 3; j++)
+    {
+        //n^2 var and n^2 cov without dividing the sums first
+        var_n2 = fusion->sum_xx[j] * n - fusion->sum_x[j] * fusion->sum_x[j];
+        cov_n2 = fusion->sum_xy[j] * n - fusion->sum_x[j] * fusion->sum_y[j];
+        if (var_n2 > min_spread * n * n)
+        {
+            gain = cov_n2 / (var_n2 >> 16);
+            if (gain >= FIT_GAIN_MIN && gain <= FIT_GAIN_MAX)
+                fusion->gain_q16[j] = (int32_t) gain;
+        }
+        fusion->offset_mg[j] = (int32_t) ((fusion->sum_y[j] - ((fusion->gain_q16[j] * fusion->sum_x[j]) >> 16)) / n);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef ACCEL_FUSION_H
+#define ACCEL_FUSION_H
+
+#include <stdint.h>
+#include "adxl372.h"
+#include "icm20649.h"
+
+/* One wide range acceleration from an adxl372 sample and the icm20649 accel
+ * sample of the same time (imu_align): the icm20649 alone while its largest
+ * axis stays below ACCEL_FUSION_BLEND_LO_PCT of its full scale, the adxl372
+ * alone above ACCEL_FUSION_BLEND_HI_PCT, where the icm20649 is about to clip,
+ * and a linear blend of the two in between so the channel has no step at the
+ * handover. The adxl372 is first mapped onto the icm20649, the low noise
+ * reference, with a per axis gain and offset fitted to the pairs both read
+ * below the blend. The sums of the fit decay with a time constant of
+ * 2^ACCEL_FUSION_FIT_SHIFT pairs so they follow the drift of the adxl372.
+ * accel_fusion_sample() runs per sample in the sampling context and only adds
+ * to the sums, accel_fusion_fit() works the gain and offset out of them with
+ * the divisions, e.g. once an impact is captured. The gain keeps its last fit
+ * until the pairs spread over ACCEL_FUSION_FIT_MIN_SPREAD_MG rms, at rest only
+ * the offset can be told. The fused axes are in ACCEL_FUSION_MG_PER_LSB */
+#define ACCEL_FUSION_MG_PER_LSB         10   //int16 spans +-327 g, past the adxl372 range
+#define ACCEL_FUSION_BLEND_LO_PCT       70   //of the icm20649 full scale
+#define ACCEL_FUSION_BLEND_HI_PCT       90
+#define ACCEL_FUSION_FIT_SHIFT          10
+#define ACCEL_FUSION_FIT_MIN_SPREAD_MG  2000
+#define ACCEL_FUSION_GAIN_UNITY         65536 //Q16
+
+typedef struct {
+    int32_t gain_q16[3];        /* icm20649 mg per adxl372 mg, Q16 */
+    int32_t offset_mg[3];       /* added to the scaled adxl372 */
+    int64_t n;                  /* decayed pair count */
+    int64_t sum_x[3];           /* decayed sums of the adxl372 (x) and icm20649 (y) mg */
+    int64_t sum_y[3];
+    int64_t sum_xx[3];
+    int64_t sum_xy[3];
+} accel_fusion_t;
+
+void accel_fusion_init(accel_fusion_t *fusion);
+
+void accel_fusion_sample(accel_fusion_t *fusion, adxl372_accel_data_t const *adxl, icm20649_data_t const *icm,
+                         int16_t icm_lsb_per_g, int16_t *fused);
+
+void accel_fusion_fit(accel_fusion_t *fusion);
+
+#endif //ACCEL_FUSION_H
@@ -0,0 +1,646 @@
+//-------------------------------------------
+// Title: activity_log.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: The per second activity log in the top of the flash. The
+// sampling side only sums, a second costs a few multiplies a sample and
+// one square root, the thread adds the wear state and fills the pages and
+// the flash side programs them between the other flash users, erasing a
+// subsector ahead of them in the background like the event store does.
+//-------------------------------------------
+#include <stddef.h>
+#include <string.h>
+#include "activity_log.h"
+#include "int_sqrt.h"
+#include "event_store.h"
+#include "crash_log.h"
+#include "serial_offload.h"
+#include "spi_driver.h"
+#include "crc32.h"
+#include "app_timer.h"
+#include "app_util.h"
+
+#define FRAME_HEADER_SIZE       9 //sync, type and length
+#define PAGE_HEADER_SIZE        offsetof(activity_log_page_t, records)
+#define TICKS_PER_S             (APP_TIMER_CLOCK_FREQ/(APP_TIMER_CONFIG_RTC_FREQUENCY + 1))
+#define TICKS_GAP               (TICKS_PER_S*3/2) //between two seconds, the samples stopped in between
+#define SUBSECTORS              (ACTIVITY_LOG_SIZE/MT25QL256ABA_SUBSECTOR_4KB_SIZE)
+#define ERASED_WORD             0xFFFFFFFF
+
+STATIC_ASSERT(sizeof(activity_log_record_t) == 4);
+STATIC_ASSERT(sizeof(activity_log_page_t) == MT25QL256ABA_PAGE_SIZE);
+STATIC_ASSERT(ACTIVITY_LOG_ADDRESS >= EVENT_STORE_DATA_END);
+STATIC_ASSERT(ACTIVITY_LOG_END <= MT25QL256ABA_BENCH_ADDRESS);
+STATIC_ASSERT((256 % ACTIVITY_LOG_QUEUE_SECONDS) == 0); //the 8 bit indexes wrap on a whole queue
+STATIC_ASSERT((256 % ACTIVITY_LOG_QUEUE_PAGES) == 0);
+
+typedef struct {
+    activity_log_record_t record;
+    uint32_t ticks;         //app timer count when the second completed
+} activity_log_second_t;
+
+//sampling side, one second being summed
+static int32_t m_sum[3];
+static uint32_t m_sq_sum[3];
+static uint8_t m_samples;
+static uint32_t m_peak_sq;
+static volatile uint8_t m_flags;
+static activity_log_second_t m_seconds[ACTIVITY_LOG_QUEUE_SECONDS];
+static volatile uint8_t m_second_head;  //written by the sampling side
+static volatile uint8_t m_second_tail;  //written by the thread
+static volatile uint32_t m_seconds_dropped;
+
+//thread side, the pages
+static activity_log_time_handler_t m_time_handler;
+static activity_log_page_t m_pages[ACTIVITY_LOG_QUEUE_PAGES];
+static uint8_t m_fill;                  //page filling or opened next, the ones before it are queued
+static uint8_t m_write;                 //oldest queued page
+static bool m_open;
+static bool m_keep;                     //a second of the page filling was worn or had an impact
+static uint8_t m_count;                 //records in the page filling
+static uint32_t m_last_ticks;           //of its last record
+static uint32_t m_seq;
+static uint32_t m_pages_written;
+static uint32_t m_pages_unworn;
+
+//flash side
+static uint32_t m_append_addr;
+static bool m_erased;                   //the subsector of m_append_addr is erased past it
+static bool m_erase_pending;            //the erase of that subsector is running
+static bool m_erase_suspended;
+
+static uint32_t next_page_address(uint32_t address)
+{
+    address += MT25QL256ABA_PAGE_SIZE;
+    return (address >= ACTIVITY_LOG_END) ? ACTIVITY_LOG_ADDRESS : address;
+}
+
+static uint32_t page_crc(activity_log_page_t const *page)
+{
+    return crc32_compute((uint8_t const *) page, offsetof(activity_log_page_t, crc), NULL);
+}
+
+// Queues the second summed so far, or counts it if the thread is behind
+static void activity_log_complete(void)
+{
+    activity_log_second_t *second;
+    uint64_t variance = 0;
+    uint32_t value;
+
+    for (int j = 0; j < 3; ++j)
+    {
+        //n^2 times the variance, the mean is never divided out
+        variance += (uint64_t) ((int64_t) m_samples*m_sq_sum[j] - (int64_t) m_sum[j]*m_sum[j]);
+        m_sum[j] = 0;
+        m_sq_sum[j] = 0;
+    }
+
+    if ((uint8_t) (m_second_head - m_second_tail) < ACTIVITY_LOG_QUEUE_SECONDS)
+    {
+        second = &m_seconds[m_second_head % ACTIVITY_LOG_QUEUE_SECONDS];
+        //10 cg a count
+        value = int_sqrt64(variance*100)/m_samples;
+        second->record.rms_cg = (uint8_t) MIN(value, UINT8_MAX);
+        value = int_sqrt64(m_peak_sq);
+        second->record.peak_g_x10 = (uint16_t) MIN(value, UINT16_MAX);
+        second->record.flags = m_flags;
+        second->ticks = app_timer_cnt_get();
+        m_second_head++;
+    }
+    else
+    {
+        m_seconds_dropped++;
+    }
+    m_samples = 0;
+    m_peak_sq = 0;
+    m_flags = 0;
+}
+
+// Drops the page filling if no second of it matters, queues it otherwise
+// returns true if a page was queued
+static bool activity_log_close(void)
+{
+    activity_log_page_t *page = &m_pages[m_fill % ACTIVITY_LOG_QUEUE_PAGES];
+
+    m_open = false;
+    if (!m_keep)
+    {
+        m_pages_unworn++;
+        return false;
+    }
+    page->crc = page_crc(page);
+    m_fill++;
+    m_seq++;
+
+    return true;
+}
+
+// Starts a page with the second that completed at ticks
+// returns false if every page is still queued for the flash
+static bool activity_log_open(uint32_t ticks)
+{
+    activity_log_page_t *page = &m_pages[m_fill % ACTIVITY_LOG_QUEUE_PAGES];
+    uint32_t lag_s;
+    uint32_t now_s;
+
+    if ((uint8_t) (m_fill - m_write) >= ACTIVITY_LOG_QUEUE_PAGES)
+        return false;
+
+    memset(page, 0xFF, sizeof(activity_log_page_t));
+    page->magic = ACTIVITY_LOG_MAGIC;
+    page->seq = m_seq;
+    now_s = (m_time_handler != NULL) ? m_time_handler() : 0;
+    //the second started a second before it completed, and a while before the thread got it
+    lag_s = app_timer_cnt_diff_compute(app_timer_cnt_get(), ticks)/TICKS_PER_S + 1;
+    page->start_s = (now_s > lag_s) ? now_s - lag_s : 0;
+    m_count = 0;
+    m_keep = false;
+    m_open = true;
+
+    return true;
+}
+
+// Reads the header of the first page of a subsector of the log
+static int8_t subsector_head(uint32_t subsector, activity_log_page_t *page)
+{
+    return mt25ql256aba_read(ACTIVITY_LOG_ADDRESS + subsector*MT25QL256ABA_SUBSECTOR_4KB_SIZE,
+                             (uint8_t *) page, PAGE_HEADER_SIZE);
+}
+
+// Finds the subsector written last from the first page of each, in order
+static int8_t activity_log_scan(uint32_t *p_newest, uint32_t *p_newest_seq, bool *p_found)
+{
+    activity_log_page_t page;
+    int8_t ret;
+
+    *p_found = false;
+    for (uint32_t i = 0; i < SUBSECTORS; ++i)
+    {
+        ret = subsector_head(i, &page);
+        if (ret < 0)
+            return ret;
+        if (page.magic == ACTIVITY_LOG_MAGIC && (!*p_found || (int32_t) (page.seq - *p_newest_seq) > 0))
+        {
+            *p_newest = ACTIVITY_LOG_ADDRESS + i*MT25QL256ABA_SUBSECTOR_4KB_SIZE;
+            *p_newest_seq = page.seq;
+            *p_found = true;
+        }
+    }
+
+    return 0;
+}
+
+// Finds the subsector written last by a binary search from the first one: the
+// subsectors are written in address order, so those written since the first
+// have later sequence numbers and the ones after them are erased or older.
+// The first one being erased (the erase ahead of the append pointer wrapped
+// to it) or a page a reset cut short in the way falls back to the scan
+static int8_t activity_log_search(uint32_t *p_newest, uint32_t *p_newest_seq, bool *p_found)
+{
+    activity_log_page_t page;
+    uint32_t first_seq;
+    uint32_t low = 1;
+    uint32_t high = SUBSECTORS;
+    uint32_t mid;
+    int8_t ret;
+
+    ret = subsector_head(0, &page);
+    if (ret < 0)
+        return ret;
+    if (page.magic != ACTIVITY_LOG_MAGIC)
+        return activity_log_scan(p_newest, p_newest_seq, p_found);
+    first_seq = page.seq;
+    *p_newest_seq = first_seq;
+
+    while (low < high)
+    {
+        mid = low + (high - low)/2;
+        ret = subsector_head(mid, &page);
+        if (ret < 0)
+            return ret;
+        if (page.magic == ACTIVITY_LOG_MAGIC && (int32_t) (page.seq - first_seq) > 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    *p_newest = ACTIVITY_LOG_ADDRESS + (low - 1)*MT25QL256ABA_SUBSECTOR_4KB_SIZE;
+    *p_found = true;
+
+    if (low > 1)
+    {
+        ret = subsector_head(low - 1, &page);
+        if (ret < 0)
+            return ret;
+        *p_newest_seq = page.seq;
+    }
+    //the subsector after the newest is erased or older, a torn one may have hidden newer ones
+    if (low < SUBSECTORS)
+    {
+        ret = subsector_head(low, &page);
+        if (ret < 0)
+            return ret;
+        if (page.magic != ACTIVITY_LOG_MAGIC && page.magic != ERASED_WORD)
+            return activity_log_scan(p_newest, p_newest_seq, p_found);
+    }
+
+    return 0;
+}
+
+// Finds the page after the newest one in the flash, in about 10 reads
+// whatever the fill of the log
+static int8_t activity_log_mount(void)
+{
+    activity_log_page_t page;
+    uint32_t newest = 0;
+    uint32_t newest_seq = 0;
+    bool found = false;
+    uint32_t i;
+    int8_t ret;
+
+    //the first page of each subsector tells which was written last
+    ret = activity_log_search(&newest, &newest_seq, &found);
+    if (ret < 0)
+        return ret;
+
+    m_seq = 0;
+    m_append_addr = ACTIVITY_LOG_ADDRESS;
+    m_erased = false;
+    if (!found)
+        return 0;
+
+    //then its pages, in order
+    for (i = 1; i < ACTIVITY_LOG_SUBSECTOR_PAGES; ++i)
+    {
+        ret = mt25ql256aba_read(newest + MT25QL256ABA_PAGE_SIZE, (uint8_t *) &page, PAGE_HEADER_SIZE);
+        if (ret < 0)
+            return ret;
+        if (page.magic != ACTIVITY_LOG_MAGIC || page.seq != newest_seq + 1)
+            break;
+        newest += MT25QL256ABA_PAGE_SIZE;
+        newest_seq++;
+    }
+    m_seq = newest_seq + 1;
+    m_append_addr = next_page_address(newest);
+
+    //a program cut short by a reset leaves a page that can't be written again
+    while (m_append_addr % MT25QL256ABA_SUBSECTOR_4KB_SIZE != 0)
+    {
+        ret = mt25ql256aba_read(m_append_addr, (uint8_t *) &page, sizeof(page));
+        if (ret < 0)
+            return ret;
+        for (i = 0; i < sizeof(page) && ((uint8_t *) &page)[i] == 0xFF; ++i)
+            ;
+        if (i == sizeof(page))
+        {
+            m_erased = true;
+            break;
+        }
+        m_append_addr = next_page_address(m_append_addr);
+    }
+
+    return 0;
+}
+
+/*
+ * Starts the log over in ram and finds the end of the one in the flash,
+ * while the flash spi instance is otherwise idle
+ * @param time_handler - gives the time a page opens at, NULL if there is no clock
+ * @return 0 if success, -1 on spi error
+ */
+int8_t activity_log_init(activity_log_time_handler_t time_handler)
+{
+    m_time_handler = time_handler;
+    memset(m_sum, 0, sizeof(m_sum));
+    memset(m_sq_sum, 0, sizeof(m_sq_sum));
+    m_samples = 0;
+    m_peak_sq = 0;
+    m_flags = 0;
+    m_second_head = 0;
+    m_second_tail = 0;
+    m_seconds_dropped = 0;
+    m_fill = 0;
+    m_write = 0;
+    m_open = false;
+    m_pages_written = 0;
+    m_pages_unworn = 0;
+    m_erase_pending = false;
+    m_erase_suspended = false;
+
+    return activity_log_mount();
+}
+
+/*
+ * Adds back to back samples of the ACCEL_DECIMATE_ACTIVITY output and the
+ * peak of the full rate samples they come from, sampling context
+ * @param peak_sq - largest squared resultant in counts^2 since the last call
+ */
+void activity_log_samples(adxl372_accel_data_t const *samples, uint16_t num_samples, uint32_t peak_sq)
+{
+    if (peak_sq > m_peak_sq)
+        m_peak_sq = peak_sq;
+
+    for (uint16_t i = 0; i < num_samples; ++i)
+    {
+        int16_t const axis[3] = {samples[i].x, samples[i].y, samples[i].z};
+
+        for (int j = 0; j < 3; ++j)
+        {
+            m_sum[j] += axis[j];
+            m_sq_sum[j] += (uint32_t) ((int32_t) axis[j]*axis[j]);
+        }
+        if (++m_samples == ACTIVITY_LOG_RECORD_SAMPLES)
+            activity_log_complete();
+    }
+}
+
+/*
+ * Flags the second being summed, samples were lost on the way in (e.g. a fifo
+ * overrun or a decimator reset). Sampling context, or with the sampling held
+ */
+void activity_log_gap(void)
+{
+    m_flags |= ACTIVITY_LOG_FLAG_GAP;
+}
+
+/*
+ * Flags the second being summed, the trigger fired. Sampling context
+ */
+void activity_log_impact(void)
+{
+    m_flags |= ACTIVITY_LOG_FLAG_IMPACT;
+}
+
+/*
+ * Puts the completed seconds in the pages, thread context
+ * @param worn - wear state to log with them
+ * @return true if a page was queued for the flash, step it
+ */
+bool activity_log_process(bool worn)
+{
+    activity_log_second_t second;
+    bool queued = false;
+
+    while (m_second_tail != m_second_head)
+    {
+        second = m_seconds[m_second_tail % ACTIVITY_LOG_QUEUE_SECONDS];
+        m_second_tail++;
+        if (worn)
+        {
+            second.record.flags |= ACTIVITY_LOG_FLAG_WORN;
+        }
+        //the records of a page are consecutive seconds
+        if (m_open && app_timer_cnt_diff_compute(second.ticks, m_last_ticks) > TICKS_GAP)
+        {
+            queued |= activity_log_close();
+        }
+        if (!m_open && !activity_log_open(second.ticks))
+        {
+            m_seconds_dropped++;
+            continue;
+        }
+        m_pages[m_fill % ACTIVITY_LOG_QUEUE_PAGES].records[m_count++] = second.record;
+        m_last_ticks = second.ticks;
+        if (second.record.flags & (ACTIVITY_LOG_FLAG_WORN | ACTIVITY_LOG_FLAG_IMPACT))
+        {
+            m_keep = true;
+        }
+        if (m_count == ACTIVITY_LOG_PAGE_RECORDS)
+        {
+            queued |= activity_log_close();
+        }
+    }
+
+    return queued;
+}
+
+/*
+ * Takes the queued pages to the flash one operation at a time, an erase of
+ * the next subsector first when a page starts one. Never waits on the flash:
+ * it resumes a suspended erase or reads the status register once if an erase
+ * is running. Call it while the flash spi instance is initialized and
+ * otherwise idle, and the event store has no erase running
+ * @return 0 if no page is queued, 1 if there is more to do, -1 on spi error
+ */
+int8_t activity_log_step(void)
+{
+    bool in_progress;
+    int8_t ret;
+
+    if (!spi_is_idle(&flash_spi))
+        return 1;
+
+    if (m_erase_suspended)
+    {
+        ret = mt25ql256aba_resume();
+        if (ret < 0)
+            return ret;
+        m_erase_suspended = false;
+        return 1;
+    }
+
+    if (m_erase_pending)
+    {
+        ret = mt25ql256aba_write_in_progress(&in_progress);
+        if (ret < 0)
+            return ret;
+        if (in_progress)
+            return 1;
+        m_erase_pending = false;
+        m_erased = true;
+    }
+
+    if (m_write == m_fill)
+        return 0;
+
+    if (!m_erased)
+    {
+        ret = mt25ql256aba_erase_block(m_append_addr, MT25QL256ABA_SUBSECTOR_4KB_SIZE);
+        if (ret < 0)
+            return ret;
+        m_erase_pending = true;
+        return 1;
+    }
+
+    ret = mt25ql256aba_page_program(m_append_addr, (uint8_t const *) &m_pages[m_write % ACTIVITY_LOG_QUEUE_PAGES],
+                                    sizeof(activity_log_page_t));
+    if (ret < 0)
+        return ret;
+    m_write++;
+    m_pages_written++;
+    m_append_addr = next_page_address(m_append_addr);
+    if (m_append_addr % MT25QL256ABA_SUBSECTOR_4KB_SIZE == 0)
+    {
+        m_erased = false;
+    }
+
+    return (m_write == m_fill) ? 0 : 1;
+}
+
+/*
+ * Suspends the erase of the log so another flash access does not wait for
+ * it, it is resumed by the next activity_log_step. Thread context
+ * @return 0 if success otherwise -1
+ */
+int8_t activity_log_preempt(void)
+{
+    bool suspended;
+    int8_t ret;
+
+    if (!m_erase_pending || m_erase_suspended)
+        return 0;
+
+    ret = mt25ql256aba_suspend(&suspended);
+    if (ret < 0)
+        return ret;
+
+    if (suspended)
+    {
+        m_erase_suspended = true;
+    }
+    else
+    {
+        //finished before the suspend
+        m_erase_pending = false;
+        m_erased = true;
+    }
+
+    return 0;
+}
+
+/*
+ * Resumes the erase of the log if it is suspended and waits for it, so
+ * another user can erase: the flash takes no erase while one is suspended.
+ * The event store calls it through event_store_erase_owner_set. Thread context
+ * @return 0 if success otherwise -1
+ */
+int8_t activity_log_finish_erase(void)
+{
+    int8_t ret;
+
+    if (!m_erase_pending)
+        return 0;
+
+    if (m_erase_suspended)
+    {
+        ret = mt25ql256aba_resume();
+        if (ret < 0)
+            return ret;
+        m_erase_suspended = false;
+    }
+    mt25ql256aba_check_write_in_progress_flag();
+    m_erase_pending = false;
+    m_erased = true;
+
+    return 0;
+}
+
+/*
+ * @return true while an erase of the log runs or is suspended, the event
+ * store must not start one
+ */
+bool activity_log_erasing(void)
+{
+    return m_erase_pending;
+}
+
+void activity_log_stats(activity_log_stats_t *p_stats)
+{
+    p_stats->seq = m_seq;
+    p_stats->append_addr = m_append_addr;
+    p_stats->pages_written = m_pages_written;
+    p_stats->pages_unworn = m_pages_unworn;
+    p_stats->seconds_dropped = m_seconds_dropped;
+    p_stats->pages_queued = (uint8_t) (m_fill - m_write);
+}
+
+/*
+ * Starts a read of the pages in the flash from the oldest, those that end
+ * before from_s are skipped. The pages still in ram are not read
+ * @param from_s - seconds since 1970-01-01 UTC, 0 for every page, also the ones of an unknown time
+ */
+void activity_log_cursor_init(activity_log_cursor_t *cursor, uint32_t from_s)
+{
+    uint32_t subsector = m_append_addr - m_append_addr % MT25QL256ABA_SUBSECTOR_4KB_SIZE;
+
+    cursor->from_s = from_s;
+    if (!m_erased)
+    {
+        //the subsector at the append pointer still holds the oldest pages
+        cursor->address = m_append_addr;
+        cursor->remaining = ACTIVITY_LOG_PAGES;
+        return;
+    }
+    cursor->address = subsector + MT25QL256ABA_SUBSECTOR_4KB_SIZE;
+    if (cursor->address >= ACTIVITY_LOG_END)
+    {
+        cursor->address = ACTIVITY_LOG_ADDRESS;
+    }
+    cursor->remaining = ((m_append_addr + ACTIVITY_LOG_SIZE - cursor->address) % ACTIVITY_LOG_SIZE)
+                        / MT25QL256ABA_PAGE_SIZE;
+}
+
+/*
+ * Reads the headers from the cursor on until one is in the range, at most
+ * ACTIVITY_LOG_SCAN_PAGES of them per call, the page is then read whole.
+ * Erased and corrupt pages are skipped, so are pages the log overwrites
+ * while the cursor runs. Thread context, with the flash otherwise idle
+ * @return 1 if page is the next one, 0 if none was found this call, -1 on spi error
+ */
+int8_t activity_log_cursor_next(activity_log_cursor_t *cursor, activity_log_page_t *page)
+{
+    uint32_t address;
+    int8_t ret;
+
+    for (uint32_t i = 0; i < ACTIVITY_LOG_SCAN_PAGES && cursor->remaining > 0; ++i)
+    {
+        address = cursor->address;
+        cursor->address = next_page_address(address);
+        cursor->remaining--;
+
+        ret = mt25ql256aba_read(address, (uint8_t *) page, PAGE_HEADER_SIZE);
+        if (ret < 0)
+            return ret;
+        if (page->magic != ACTIVITY_LOG_MAGIC)
+            continue;
+        if (cursor->from_s > 0 && page->start_s + ACTIVITY_LOG_PAGE_RECORDS <= cursor->from_s)
+            continue;
+
+        ret = mt25ql256aba_read(address, (uint8_t *) page, sizeof(activity_log_page_t));
+        if (ret < 0)
+            return ret;
+        if (page->crc == page_crc(page))
+            return 1;
+    }
+
+    return 0;
+}
+
+bool activity_log_cursor_done(activity_log_cursor_t const *cursor)
+{
+    return cursor->remaining == 0;
+}
+
+/*
+ * Builds the serial_offload frame of a page, or the end frame of a read of
+ * the log without a payload
+ * @param page - NULL for the end frame
+ * @param frame - ACTIVITY_LOG_FRAME_SIZE bytes
+ * @return the length of the frame
+ */
+uint16_t activity_log_frame(activity_log_page_t const *page, uint8_t *frame)
+{
+    uint32_t sync = SERIAL_OFFLOAD_SYNC;
+    uint32_t length = (page != NULL) ? sizeof(activity_log_page_t) : 0;
+    uint32_t crc;
+
+    memcpy(&frame[0], &sync, sizeof(sync));
+    frame[4] = SERIAL_OFFLOAD_FRAME_ACTIVITY;
+    memcpy(&frame[5], &length, sizeof(length));
+    if (page != NULL)
+    {
+        memcpy(&frame[FRAME_HEADER_SIZE], page, length);
+    }
+    crc = crc32_compute(&frame[4], FRAME_HEADER_SIZE - sizeof(sync) + length, NULL);
+    memcpy(&frame[FRAME_HEADER_SIZE + length], &crc, sizeof(crc));
+
+    return (uint16_t) (FRAME_HEADER_SIZE + length + sizeof(crc));
+}
@@ -0,0 +1,125 @@
+#ifndef ACTIVITY_LOG_H
+#define ACTIVITY_LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "adxl372.h"
+#include "mt25ql256aba.h"
+#include "accel_decimate.h"
+
+/* Low rate log of the activity between the impacts, one record a second
+ * appended to the top ACTIVITY_LOG_SIZE of the flash, between the ring of the
+ * event store and the sector the flash benches erase (MT25QL256ABA_BENCH_ADDRESS),
+ * below the crash log (crash_log.h). A record is the peak resultant of the second at the full
+ * rate, from the trigger, the rms of the ACCEL_DECIMATE_ACTIVITY_HZ samples
+ * about their mean, so gravity and the head's pose drop out and what is left
+ * is the motion below the activity band edge, and flags: the wear state of the
+ * vcnl4040, a gap in the samples and an impact trigger. ACTIVITY_LOG_PAGE_RECORDS
+ * consecutive seconds make a page of one flash page
+ *   magic   uint32   ACTIVITY_LOG_MAGIC
+ *   seq     uint32   page counter, only grows
+ *   start_s uint32   seconds since 1970-01-01 UTC at the start of the first record, 0 if unknown
+ *   records ACTIVITY_LOG_PAGE_RECORDS * activity_log_record_t, erased past the last one
+ *   crc     uint32   crc32 of the bytes before it
+ * which is also the payload of a SERIAL_OFFLOAD_FRAME_ACTIVITY frame, so
+ * tools/offload_decode reads the pages of a flash image or of an offload alike.
+ * A page is closed early when the seconds stop coming (a replay, a calibration,
+ * a profile change), the next one starts at its own time. A page without a worn
+ * or an impact second is not written, the time missing from the log was spent
+ * off the head or switched off. The log is a ring of 4KB subsectors, the one
+ * ahead of the append pointer is erased before its first page so the oldest
+ * pages go 16 at a time once the region is full, 1920KB keep about 128 hours worn.
+ * Three contexts:
+ * - activity_log_samples(), activity_log_gap() and activity_log_impact() run
+ *   with the sampling (an interrupt is fine) and queue the completed seconds.
+ * - activity_log_process() in thread context adds the wear state and fills
+ *   the pages, the page that opens reads the clock through the time handler.
+ * - activity_log_step() programs the filled pages one flash operation a call,
+ *   with the flash otherwise idle, never waiting on an erase. A flash access
+ *   of another user calls activity_log_preempt() first so the erase of the log
+ *   is suspended under it, the next step resumes it. The event store's erase
+ *   and this one must not overlap, step the log only while the store has none
+ *   and give the store activity_log_finish_erase() with
+ *   event_store_erase_owner_set() so it finishes the log's before its own
+ * The seconds not in the flash yet are lost in a reset, the page filling and
+ * the ones queued: a minute, a few if the flash was kept busy */
+#define ACTIVITY_LOG_ADDRESS        0x01E00000
+#define ACTIVITY_LOG_SIZE           0x001E0000 //up to the bench sector
+#define ACTIVITY_LOG_END            (ACTIVITY_LOG_ADDRESS + ACTIVITY_LOG_SIZE)
+#define ACTIVITY_LOG_PAGES          (ACTIVITY_LOG_SIZE/MT25QL256ABA_PAGE_SIZE)
+#define ACTIVITY_LOG_SUBSECTOR_PAGES (MT25QL256ABA_SUBSECTOR_4KB_SIZE/MT25QL256ABA_PAGE_SIZE)
+#define ACTIVITY_LOG_MAGIC          0x56544341 //"ACTV"
+#define ACTIVITY_LOG_PAGE_RECORDS   60
+#define ACTIVITY_LOG_RECORD_SAMPLES ACCEL_DECIMATE_ACTIVITY_HZ //decimated samples in a second
+#define ACTIVITY_LOG_QUEUE_SECONDS  8 //completed seconds waiting for the thread
+#define ACTIVITY_LOG_QUEUE_PAGES    4 //filled pages waiting for the flash, with the one filling
+#define ACTIVITY_LOG_SCAN_PAGES     16 //page headers read per activity_log_cursor_next call, bounds the flash hold
+
+#define ACTIVITY_LOG_FLAG_WORN      0x01 //the vcnl4040 saw the head when the second was logged
+#define ACTIVITY_LOG_FLAG_GAP       0x02 //samples were lost in the second, the rms is of the rest
+#define ACTIVITY_LOG_FLAG_IMPACT    0x04 //the trigger fired in the second
+#define ACTIVITY_LOG_FLAGS_ERASED   0xFF //flags of a record that was never written
+
+typedef struct {
+    uint16_t peak_g_x10;    //peak resultant in 0.1 g, the adxl372 counts
+    uint8_t rms_cg;         //rms about the mean in 0.01 g, saturates at 2.55 g
+    uint8_t flags;          //ACTIVITY_LOG_FLAG_*
+} activity_log_record_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t start_s;
+    activity_log_record_t records[ACTIVITY_LOG_PAGE_RECORDS];
+    uint32_t crc;
+} activity_log_page_t;
+
+typedef struct {
+    uint32_t address;       //flash address of the next page to read
+    uint32_t remaining;     //pages left to look at
+    uint32_t from_s;
+} activity_log_cursor_t;
+
+typedef struct {
+    uint32_t seq;           //of the next page
+    uint32_t append_addr;   //flash address the next page goes to
+    uint32_t pages_written; //since the reset
+    uint32_t pages_unworn;  //not written, no second was worn or had an impact
+    uint32_t seconds_dropped; //the thread was behind, or the flash and every page was queued
+    uint8_t pages_queued;
+} activity_log_stats_t;
+
+// Gives the seconds since 1970-01-01 UTC, 0 if the clock is not known
+typedef uint32_t (*activity_log_time_handler_t)(void);
+
+#define ACTIVITY_LOG_FRAME_SIZE     (9 + sizeof(activity_log_page_t) + 4) //with the sync, type, length and crc of the frame
+
+int8_t activity_log_init(activity_log_time_handler_t time_handler);
+
+void activity_log_samples(adxl372_accel_data_t const *samples, uint16_t num_samples, uint32_t peak_sq);
+
+void activity_log_gap(void);
+
+void activity_log_impact(void);
+
+bool activity_log_process(bool worn);
+
+int8_t activity_log_step(void);
+
+int8_t activity_log_preempt(void);
+
+int8_t activity_log_finish_erase(void);
+
+bool activity_log_erasing(void);
+
+void activity_log_stats(activity_log_stats_t *p_stats);
+
+void activity_log_cursor_init(activity_log_cursor_t *cursor, uint32_t from_s);
+
+int8_t activity_log_cursor_next(activity_log_cursor_t *cursor, activity_log_page_t *page);
+
+bool activity_log_cursor_done(activity_log_cursor_t const *cursor);
+
+uint16_t activity_log_frame(activity_log_page_t const *page, uint8_t *frame);
+
+#endif //ACTIVITY_LOG_H
@@ -0,0 +1,140 @@
+//-------------------------------------------
+// Title: ahrs.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Madgwick IMU orientation filter run on every icm20649 fifo
+// sample between impacts, so the head orientation at the trigger can be
+// stored with the event instead of being reconstructed from the streams.
+//-------------------------------------------
+#include <math.h>
+#include "ahrs.h"
+
+#define AHRS_PI     3.14159265f
+
+static float inv_sqrt(float x)
+{
+    return 1.0f/sqrtf(x);
+}
+
+/*
+ * Tilt from gravity alone, the heading is left at 0
+ */
+static void ahrs_init_from_accel(ahrs_t *ahrs, float ax, float ay, float az)
+{
+    float roll = atan2f(ay, az);
+    float pitch = atan2f(-ax, sqrtf(ay*ay + az*az));
+    float cr = cosf(0.5f*roll);
+    float sr = sinf(0.5f*roll);
+    float cp = cosf(0.5f*pitch);
+    float sp = sinf(0.5f*pitch);
+
+    ahrs->q[0] = cr*cp;
+    ahrs->q[1] = sr*cp;
+    ahrs->q[2] = cr*sp;
+    ahrs->q[3] = -sr*sp;
+    ahrs->initialized = true;
+}
+
+/*
+ * @param rate_hz - rate of the samples handed to ahrs_update
+ * @param gyro_fs_dps - gyro full scale the samples were taken with
+ * @param beta - gradient step, AHRS_BETA
+ */
+void ahrs_init(ahrs_t *ahrs, uint16_t rate_hz, uint16_t gyro_fs_dps, float beta)
+{
+    ahrs->beta = beta;
+    ahrs->dt = 1.0f/rate_hz;
+    ahrs->gyro_scale = (gyro_fs_dps*AHRS_PI)/(180.0f*32768.0f);
+    ahrs_reset(ahrs);
+}
+
+void ahrs_reset(ahrs_t *ahrs)
+{
+    ahrs->q[0] = 1.0f;
+    ahrs->q[1] = 0.0f;
+    ahrs->q[2] = 0.0f;
+    ahrs->q[3] = 0.0f;
+    ahrs->initialized = false;
+}
+
+/*
+ * One filter step with the next fifo sample, the accel scale does not matter
+ */
+void ahrs_update(ahrs_t *ahrs, icm20649_data_t const *sample)
+{
+    float *q = ahrs->q;
+    float gx = sample->gyro_x*ahrs->gyro_scale;
+    float gy = sample->gyro_y*ahrs->gyro_scale;
+    float gz = sample->gyro_z*ahrs->gyro_scale;
+    float ax = sample->accel_x;
+    float ay = sample->accel_y;
+    float az = sample->accel_z;
+    float norm_sq = ax*ax + ay*ay + az*az;
+    float qdot[4];
+    float s[4];
+    float recip_norm;
+    float q0q0, q1q1, q2q2, q3q3;
+
+    if (!ahrs->initialized)
+    {
+        if (norm_sq > 0.0f)
+            ahrs_init_from_accel(ahrs, ax, ay, az);
+        return;
+    }
+
+    //rate of change from the gyro
+    qdot[0] = 0.5f*(-q[1]*gx - q[2]*gy - q[3]*gz);
+    qdot[1] = 0.5f*(q[0]*gx + q[2]*gz - q[3]*gy);
+    qdot[2] = 0.5f*(q[0]*gy - q[1]*gz + q[3]*gx);
+    qdot[3] = 0.5f*(q[0]*gz + q[1]*gy - q[2]*gx);
+
+    //gradient step towards gravity, skipped if the accel reads 0
+    if (norm_sq > 0.0f)
+    {
+        recip_norm = inv_sqrt(norm_sq);
+        ax *= recip_norm;
+        ay *= recip_norm;
+        az *= recip_norm;
+
+        q0q0 = q[0]*q[0];
+        q1q1 = q[1]*q[1];
+        q2q2 = q[2]*q[2];
+        q3q3 = q[3]*q[3];
+
+        s[0] = 4.0f*q[0]*q2q2 + 2.0f*q[2]*ax + 4.0f*q[0]*q1q1 - 2.0f*q[1]*ay;
+        s[1] = 4.0f*q[1]*q3q3 - 2.0f*q[3]*ax + 4.0f*q0q0*q[1] - 2.0f*q[0]*ay - 4.0f*q[1]
+               + 8.0f*q[1]*q1q1 + 8.0f*q[1]*q2q2 + 4.0f*q[1]*az;
+        s[2] = 4.0f*q0q0*q[2] + 2.0f*q[0]*ax + 4.0f*q[2]*q3q3 - 2.0f*q[3]*ay - 4.0f*q[2]
+               + 8.0f*q[2]*q1q1 + 8.0f*q[2]*q2q2 + 4.0f*q[2]*az;
+        s[3] = 4.0f*q1q1*q[3] - 2.0f*q[1]*ax + 4.0f*q2q2*q[3] - 2.0f*q[2]*ay;
+
+        norm_sq = s[0]*s[0] + s[1]*s[1] + s[2]*s[2] + s[3]*s[3];
+        if (norm_sq > 0.0f)
+        {
+            recip_norm = inv_sqrt(norm_sq);
+            for (uint8_t i = 0; i < 4; i++)
+                qdot[i] -= ahrs->beta*s[i]*recip_norm;
+        }
+    }
+
+    for (uint8_t i = 0; i < 4; i++)
+        q[i] += qdot[i]*ahrs->dt;
+
+    recip_norm = inv_sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+    for (uint8_t i = 0; i < 4; i++)
+        q[i] *= recip_norm;
+}
+
+/*
+ * @param q - w, x, y, z in Q14
+ * @return false if no sample has been seen since the reset, q is not written then
+ */
+bool ahrs_quaternion_q14(ahrs_t const *ahrs, int16_t q[4])
+{
+    if (!ahrs->initialized)
+        return false;
+
+    for (uint8_t i = 0; i < 4; i++)
+        q[i] = (int16_t) lrintf(ahrs->q[i]*16384.0f);
+
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef AHRS_H
+#define AHRS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "icm20649.h"
+
+/* Orientation of the icm20649 from its fifo accel and gyro samples, a Madgwick
+ * gradient descent filter without magnetometer in single precision on the FPU.
+ * q rotates earth frame vectors (z up) into the sensor frame, the heading drifts
+ * since nothing observes it. After ahrs_reset the first sample sets the tilt from
+ * gravity, so the filter should be reset when the sample stream had a gap.
+ * One update is about 100 multiplies and adds, two square roots and two divides,
+ * a few hundred cycles on the M4F (the rev1 app logs the measured count with
+ * DEBUG), well under 1% of the 64 MHz cpu at ICM20649_FIFO_SAMPLE_RATE_HZ */
+#define AHRS_BETA   0.04f /* gradient step, sqrt(3/4) x gyro error of ~3 dps */
+
+typedef struct {
+    float q[4];         /* w, x, y, z */
+    float beta;
+    float dt;           /* sample period in s */
+    float gyro_scale;   /* rad/s per gyro count */
+    bool initialized;   /* q holds a valid orientation */
+} ahrs_t;
+
+void ahrs_init(ahrs_t *ahrs, uint16_t rate_hz, uint16_t gyro_fs_dps, float beta);
+
+void ahrs_reset(ahrs_t *ahrs);
+
+void ahrs_update(ahrs_t *ahrs, icm20649_data_t const *sample);
+
+bool ahrs_quaternion_q14(ahrs_t const *ahrs, int16_t q[4]);
+
+#endif //AHRS_H
@@ -0,0 +1,246 @@
+//-------------------------------------------
+// Title: battery_monitor.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Battery voltage without the cpu. The RTC compare starts the
+// SAADC and clears the RTC through one PPI channel, the SAADC averages its
+// burst of conversions in hardware and EasyDMA fills the buffers, so the
+// application only hears of it once a buffer is full. The percent comes from
+// the discharge curve of a LiPo cell, on a board that measures VBAT.
+//-------------------------------------------
+#include <string.h>
+#include "battery_monitor.h"
+#include "nrf_drv_saadc.h"
+#include "nrf_drv_ppi.h"
+#include "app_util.h"
+
+#define BATTERY_MONITOR_CHANNEL         0
+#define BATTERY_MONITOR_SAMPLE_CHANNEL  1   //the cli's one-shot conversions
+#define BATTERY_MONITOR_FULL_SCALE_MV   3600 //gain 1/6 of the 0.6V internal reference
+#define BATTERY_MONITOR_RESOLUTION      NRF_SAADC_RESOLUTION_12BIT
+#define BATTERY_MONITOR_MAX_COUNT       4096
+#define BATTERY_MONITOR_PERIOD_TICKS    ((BATTERY_MONITOR_PERIOD_MS * BATTERY_MONITOR_RTC_HZ) / 1000)
+#define BATTERY_MONITOR_STOP_TIMEOUT    10000 //polls of the driver after an abort
+
+STATIC_ASSERT(BATTERY_MONITOR_PERIOD_TICKS > 0);
+
+typedef struct {
+    uint16_t mv;
+    uint8_t percent;
+} battery_monitor_point_t;
+
+static battery_monitor_handler_t m_handler;
+static nrf_ppi_channel_t m_ppi;
+static nrf_saadc_value_t m_buffers[2][BATTERY_MONITOR_SAMPLES]; //in ram for EasyDMA
+static volatile uint16_t m_mv = 0;
+static volatile uint8_t m_percent = BATTERY_MONITOR_PERCENT_UNKNOWN;
+static volatile bool m_low = false;
+
+static uint16_t battery_monitor_raw_to_mv(int32_t raw)
+{
+    if (raw < 0)
+        raw = 0;
+
+    return (uint16_t) ((raw * BATTERY_MONITOR_FULL_SCALE_MV) / BATTERY_MONITOR_MAX_COUNT);
+}
+
+#if BATTERY_MONITOR_VBAT
+/* Open circuit voltage of a LiPo cell at rest, highest first */
+static const battery_monitor_point_t m_curve[] = {
+    {4200, 100}, {4100, 90}, {4000, 79}, {3900, 68}, {3800, 53}, {3750, 40},
+    {3700, 27}, {3650, 16}, {3600, 10}, {3500, 5}, {3300, 0},
+};
+
+static uint8_t battery_monitor_mv_to_percent(uint16_t mv)
+{
+    uint32_t i;
+
+    if (mv >= m_curve[0].mv)
+        return m_curve[0].percent;
+
+    for (i = 1; i < ARRAY_SIZE(m_curve); ++i)
+    {
+        if (mv >= m_curve[i].mv)
+        {
+            battery_monitor_point_t const *hi = &m_curve[i - 1];
+            battery_monitor_point_t const *lo = &m_curve[i];
+
+            return lo->percent + ((mv - lo->mv) * (hi->percent - lo->percent)) / (hi->mv - lo->mv);
+        }
+    }
+
+    return 0;
+}
+#endif
+
+/*
+ * Queues both buffers and takes the first sample right away, the RTC takes
+ * every sample after it. The first buffer holds the one sample only, so the
+ * reading is there without waiting for a whole buffer
+ * @return 0 if success otherwise -1
+ */
+static int8_t battery_monitor_restart(void)
+{
+    if (nrf_drv_saadc_buffer_convert(m_buffers[0], 1) != NRF_SUCCESS)
+        return -1;
+    if (nrf_drv_saadc_buffer_convert(m_buffers[1], BATTERY_MONITOR_SAMPLES) != NRF_SUCCESS)
+        return -1;
+    if (nrf_drv_saadc_sample() != NRF_SUCCESS)
+        return -1;
+
+    nrf_rtc_task_trigger(BATTERY_MONITOR_RTC, NRF_RTC_TASK_CLEAR);
+    nrf_rtc_task_trigger(BATTERY_MONITOR_RTC, NRF_RTC_TASK_START);
+
+    return (nrf_drv_ppi_channel_enable(m_ppi) == NRF_SUCCESS) ? 0 : -1;
+}
+
+static void battery_monitor_saadc_handler(nrf_drv_saadc_evt_t const * p_event)
+{
+    int32_t sum = 0;
+    uint16_t mv;
+
+    if (p_event->type == NRF_DRV_SAADC_EVT_CALIBRATEDONE)
+    {
+        (void) battery_monitor_restart();
+        return;
+    }
+    if (p_event->type != NRF_DRV_SAADC_EVT_DONE || p_event->data.done.size == 0)
+        return;
+
+    for (uint16_t i = 0; i < p_event->data.done.size; ++i)
+        sum += p_event->data.done.p_buffer[i];
+    mv = battery_monitor_raw_to_mv(sum / p_event->data.done.size);
+    mv = (uint16_t) (((uint32_t) mv * BATTERY_MONITOR_DIVIDER_X10) / 10);
+
+    //back in the queue behind the other buffer, the driver is filling that one
+    (void) nrf_drv_saadc_buffer_convert(p_event->data.done.p_buffer, BATTERY_MONITOR_SAMPLES);
+
+    m_mv = mv;
+#if BATTERY_MONITOR_VBAT
+    m_percent = battery_monitor_mv_to_percent(mv);
+    if (mv < BATTERY_MONITOR_LOW_MV)
+        m_low = true;
+    else if (mv >= BATTERY_MONITOR_LOW_MV + BATTERY_MONITOR_LOW_HYST_MV)
+        m_low = false;
+#endif
+
+    if (m_handler != NULL)
+        m_handler(m_mv, m_percent);
+}
+
+/**
+ * @brief Sets up the SAADC, the RTC and the PPI channel between them and starts
+ * the offset calibration, the monitor samples on its own once it is done.
+ * handler may be NULL, the readings are kept for the getters either way
+ * @return 0 if success otherwise -1
+ */
+int8_t battery_monitor_init(battery_monitor_handler_t handler)
+{
+    ret_code_t err_code;
+    nrf_drv_saadc_config_t saadc_config = NRF_DRV_SAADC_DEFAULT_CONFIG;
+    nrf_saadc_channel_config_t channel_config =
+        NRF_DRV_SAADC_DEFAULT_CHANNEL_CONFIG_SE(BATTERY_MONITOR_INPUT);
+
+    m_handler = handler;
+
+    saadc_config.resolution = BATTERY_MONITOR_RESOLUTION;
+    saadc_config.oversample = BATTERY_MONITOR_OVERSAMPLE;
+    saadc_config.low_power_mode = true;
+    if (nrf_drv_saadc_init(&saadc_config, battery_monitor_saadc_handler) != NRF_SUCCESS)
+        return -1;
+
+    //burst: one SAMPLE task runs every conversion of the oversample
+    channel_config.burst = NRF_SAADC_BURST_ENABLED;
+    channel_config.acq_time = NRF_SAADC_ACQTIME_40US;
+    if (nrf_drv_saadc_channel_init(BATTERY_MONITOR_CHANNEL, &channel_config) != NRF_SUCCESS)
+        return -1;
+
+    err_code = nrf_drv_ppi_init();
+    if (err_code != NRF_SUCCESS && err_code != NRF_ERROR_MODULE_ALREADY_INITIALIZED)
+        return -1;
+    if (nrf_drv_ppi_channel_alloc(&m_ppi) != NRF_SUCCESS)
+        return -1;
+    if (nrf_drv_ppi_channel_assign(m_ppi,
+                                   nrf_rtc_event_address_get(BATTERY_MONITOR_RTC, NRF_RTC_EVENT_COMPARE_0),
+                                   nrf_drv_saadc_sample_task_get()) != NRF_SUCCESS)
+        return -1;
+    if (nrf_drv_ppi_channel_fork_assign(m_ppi,
+                                        nrf_rtc_task_address_get(BATTERY_MONITOR_RTC, NRF_RTC_TASK_CLEAR)) != NRF_SUCCESS)
+        return -1;
+
+    //no interrupt, the compare event only goes to PPI
+    nrf_rtc_task_trigger(BATTERY_MONITOR_RTC, NRF_RTC_TASK_STOP);
+    nrf_rtc_prescaler_set(BATTERY_MONITOR_RTC, BATTERY_MONITOR_RTC_PRESCALER);
+    nrf_rtc_cc_set(BATTERY_MONITOR_RTC, 0, BATTERY_MONITOR_PERIOD_TICKS);
+    nrf_rtc_event_clear(BATTERY_MONITOR_RTC, NRF_RTC_EVENT_COMPARE_0);
+    nrf_rtc_event_enable(BATTERY_MONITOR_RTC, RTC_EVTEN_COMPARE0_Msk);
+
+    return (nrf_drv_saadc_calibrate_offset() == NRF_SUCCESS) ? 0 : -1;
+}
+
+/*
+ * @return battery voltage in mV, the mean of the last buffer, 0 before the first reading
+ */
+uint16_t battery_monitor_mv(void)
+{
+    return m_mv;
+}
+
+/*
+ * @return battery level in percent, BATTERY_MONITOR_PERCENT_UNKNOWN before the
+ * first reading or on a board without a VBAT input
+ */
+uint8_t battery_monitor_percent(void)
+{
+    return m_percent;
+}
+
+/*
+ * @return true from a reading under BATTERY_MONITOR_LOW_MV until one
+ * BATTERY_MONITOR_LOW_HYST_MV above it
+ */
+bool battery_monitor_low(void)
+{
+    return m_low;
+}
+
+/**
+ * @brief One conversion of any input with the monitor's settings, from thread
+ * context. The monitor is held for it and restarts with a fresh reading, the
+ * samples of the buffer it was filling are dropped
+ * @param input - NRF_SAADC_INPUT_AIN0..7 or NRF_SAADC_INPUT_VDD
+ * @param p_mv - voltage on the input in mV, the divider is not applied
+ * @return 0 if success, -1 if the SAADC failed, -2 if the input is invalid
+ */
+int8_t battery_monitor_sample(nrf_saadc_input_t input, uint16_t *p_mv)
+{
+    nrf_saadc_channel_config_t channel_config = NRF_DRV_SAADC_DEFAULT_CHANNEL_CONFIG_SE(input);
+    nrf_saadc_value_t raw;
+    uint32_t timeout = BATTERY_MONITOR_STOP_TIMEOUT;
+    int8_t ret = 0;
+
+    if (input == NRF_SAADC_INPUT_DISABLED || input > NRF_SAADC_INPUT_VDD)
+        return -2;
+
+    (void) nrf_drv_ppi_channel_disable(m_ppi);
+    nrf_rtc_task_trigger(BATTERY_MONITOR_RTC, NRF_RTC_TASK_STOP);
+    nrf_drv_saadc_abort();
+    while (nrf_drv_saadc_is_busy() && --timeout > 0)
+        ;
+    if (timeout == 0)
+        return -1;
+
+    channel_config.burst = NRF_SAADC_BURST_ENABLED;
+    channel_config.acq_time = NRF_SAADC_ACQTIME_40US;
+    if (nrf_drv_saadc_channel_init(BATTERY_MONITOR_SAMPLE_CHANNEL, &channel_config) != NRF_SUCCESS)
+        ret = -1;
+    else if (nrf_drv_saadc_sample_convert(BATTERY_MONITOR_SAMPLE_CHANNEL, &raw) != NRF_SUCCESS)
+        ret = -1;
+    else
+        *p_mv = battery_monitor_raw_to_mv(raw);
+    (void) nrf_drv_saadc_channel_uninit(BATTERY_MONITOR_SAMPLE_CHANNEL);
+
+    if (battery_monitor_restart() < 0)
+        ret = -1;
+
+    return ret;
+}
@@ -0,0 +1,62 @@
+#ifndef BATTERY_MONITOR_H
+#define BATTERY_MONITOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nrf_saadc.h"
+#include "nrf_rtc.h"
+#include "boards.h"
+
+/* Battery voltage measured in the background. An RTC compare starts the SAADC
+ * through PPI every BATTERY_MONITOR_PERIOD_MS and with burst mode that one
+ * sample is BATTERY_MONITOR_OVERSAMPLE conversions averaged by the SAADC
+ * itself. The driver runs the SAADC in its low power mode, started only around
+ * each sample, and EasyDMA moves the results to a double buffer: the handler
+ * is raised from the SAADC interrupt once BATTERY_MONITOR_SAMPLES of them are
+ * in, with their mean. Between the cpu and a conversion there is only the
+ * driver's STARTED and END interrupts, a few instructions per sample. The
+ * first sample is taken as soon as the offset calibration is done, so a
+ * reading is there in milliseconds rather than a whole buffer later.
+ * The board header sets BATTERY_MONITOR_INPUT to the analog input of a divider
+ * on VBAT and BATTERY_MONITOR_DIVIDER_X10 to its ratio where the board has
+ * one. Without it the monitor measures VDD, the regulated supply that tells
+ * nothing of the charge: the mV are kept for the cli, the percent stays
+ * BATTERY_MONITOR_PERCENT_UNKNOWN and the low flag clear. The monitor owns the
+ * SAADC, battery_monitor_sample() converts another input in between for the cli */
+#ifndef BATTERY_MONITOR_RTC
+#define BATTERY_MONITOR_RTC             NRF_RTC2 /* RTC0 is taken by the softdevice, RTC1 by app_timer */
+#endif
+#ifdef BATTERY_MONITOR_INPUT
+#define BATTERY_MONITOR_VBAT            1
+#else
+#define BATTERY_MONITOR_VBAT            0       //no divider on VBAT, the level is unknown
+#define BATTERY_MONITOR_INPUT           NRF_SAADC_INPUT_VDD
+#endif
+#ifndef BATTERY_MONITOR_DIVIDER_X10
+#define BATTERY_MONITOR_DIVIDER_X10     10      //battery voltage over input voltage, in tenths
+#endif
+#ifndef BATTERY_MONITOR_PERIOD_MS
+#define BATTERY_MONITOR_PERIOD_MS       2000
+#endif
+#define BATTERY_MONITOR_SAMPLES         8       //samples averaged per handler call
+#define BATTERY_MONITOR_OVERSAMPLE      NRF_SAADC_OVERSAMPLE_16X
+#define BATTERY_MONITOR_RTC_PRESCALER   4095    //8Hz, the compare counts 125ms ticks
+#define BATTERY_MONITOR_RTC_HZ          (32768 / (BATTERY_MONITOR_RTC_PRESCALER + 1))
+#define BATTERY_MONITOR_LOW_MV          3500    //LiPo under load, about 5% left
+#define BATTERY_MONITOR_LOW_HYST_MV     100     //rise above LOW_MV by this much to clear the low flag
+#define BATTERY_MONITOR_PERCENT_UNKNOWN 0xFF    //no reading yet, or no VBAT input
+
+/* Called from the SAADC interrupt with the mean of the last buffer */
+typedef void (*battery_monitor_handler_t)(uint16_t mv, uint8_t percent);
+
+int8_t battery_monitor_init(battery_monitor_handler_t handler);
+
+uint16_t battery_monitor_mv(void);
+
+uint8_t battery_monitor_percent(void);
+
+bool battery_monitor_low(void);
+
+int8_t battery_monitor_sample(nrf_saadc_input_t input, uint16_t *p_mv);
+
+#endif //BATTERY_MONITOR_H
@@ -0,0 +1,564 @@
+//-------------------------------------------
+// Title: ble_bench.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: BLE Throughput Benchmark Service. Steps the link through
+// the PHY, MTU, DLE and connection interval combinations, keeps the
+// SoftDevice tx queue full of notifications for a fixed time and
+// reports what got through. Everything is sent from ble_bench_process
+// in thread context, the observer and the radio notification only
+// record the link updates and count.
+//-------------------------------------------
+#include <string.h>
+#include "ble_bench.h"
+#include "ble_conn_params.h"
+#include "ble_radio_notification.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "nrf_log.h"
+
+#define LL_HEADERS          7       //L2CAP and ATT headers of a notification in the link layer payload
+#define T_IFS_US            150
+#define CONN_SUP_TIMEOUT    MSEC_TO_UNITS(4000, UNIT_10_MS)
+
+#define MTU_COUNT           2
+#define DLE_COUNT           2
+#define INTERVAL_COUNT      4
+
+STATIC_ASSERT(sizeof(ble_bench_result_t) == 20);
+
+enum {
+    BENCH_IDLE,
+    BENCH_SETUP,    //waiting on the link updates of the combination
+    BENCH_RUN,      //notifying
+    BENCH_DRAIN,    //waiting on the notifications still queued
+    BENCH_RESULT    //the result waits for a tx buffer
+};
+
+enum {
+    REQUEST_PHY = 1 << 0,
+    REQUEST_DLE = 1 << 1,
+    REQUEST_INTERVAL = 1 << 2
+};
+
+static uint8_t const m_phys[] = BLE_BENCH_PHYS;
+static uint16_t const m_mtus[] = BLE_BENCH_MTUS;
+static uint8_t const m_dles[] = BLE_BENCH_DLES;
+static uint16_t const m_intervals[] = BLE_BENCH_INTERVALS;
+
+STATIC_ASSERT(sizeof(m_mtus)/sizeof(m_mtus[0]) == MTU_COUNT);
+STATIC_ASSERT(sizeof(m_dles)/sizeof(m_dles[0]) == DLE_COUNT);
+STATIC_ASSERT(sizeof(m_intervals)/sizeof(m_intervals[0]) == INTERVAL_COUNT);
+STATIC_ASSERT(sizeof(m_phys)*MTU_COUNT*DLE_COUNT*INTERVAL_COUNT == BLE_BENCH_COMBINATIONS);
+
+static ble_bench_t *mp_bench;
+static uint8_t m_data[BLE_BENCH_MAX_DATA_LEN];
+static bool m_data_ready;   //m_data holds the next notification, it was refused for want of a tx buffer
+static uint8_t m_requests;  //REQUEST_ bits the SoftDevice was too busy for so far
+
+static uint8_t bench_phy(uint8_t combination)
+{
+    return m_phys[combination/(MTU_COUNT*DLE_COUNT*INTERVAL_COUNT)];
+}
+
+static uint16_t bench_mtu(uint8_t combination)
+{
+    return m_mtus[combination/(DLE_COUNT*INTERVAL_COUNT)%MTU_COUNT];
+}
+
+static uint8_t bench_dle(uint8_t combination)
+{
+    return m_dles[combination/INTERVAL_COUNT%DLE_COUNT];
+}
+
+static uint16_t bench_interval(uint8_t combination)
+{
+    return m_intervals[combination%INTERVAL_COUNT];
+}
+
+static uint32_t bench_ticks_to_us(uint32_t ticks)
+{
+    return (uint32_t) (((uint64_t) ticks*1000000)/APP_TIMER_CLOCK_FREQ);
+}
+
+/*
+ * Counts the connection events of a run and their radio time, active comes
+ * BLE_BENCH_RADIO_DISTANCE_US ahead of the radio and inactive right after it
+ */
+static void bench_radio_handler(bool radio_active)
+{
+    static bool in_event = false;
+    uint32_t now;
+
+    if (mp_bench == NULL || !mp_bench->measuring)
+    {
+        in_event = false;
+        return;
+    }
+    now = app_timer_cnt_get();
+    if (radio_active)
+    {
+        mp_bench->radio_start = now;
+        in_event = true;
+    }
+    else if (in_event)
+    {
+        mp_bench->events++;
+        mp_bench->radio_ticks += app_timer_cnt_diff_compute(now, mp_bench->radio_start);
+        in_event = false;
+    }
+}
+
+static void on_write(ble_bench_t *p_bench, ble_evt_t const *p_ble_evt)
+{
+    ble_gatts_evt_write_t const *p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
+
+    if (p_evt_write->handle != p_bench->ctrl_handles.value_handle || p_evt_write->len < 1)
+        return;
+
+    switch (p_evt_write->data[0])
+    {
+        case BLE_BENCH_CMD_START:
+            p_bench->start_source = (p_evt_write->len >= 2) ? p_evt_write->data[1] : BLE_BENCH_SOURCE_SYNTHETIC;
+            p_bench->start_combination = (p_evt_write->len >= 3) ? p_evt_write->data[2] : BLE_BENCH_ALL;
+            if (p_bench->start_source == BLE_BENCH_SOURCE_FLASH && p_bench->read == NULL)
+                p_bench->start_source = BLE_BENCH_SOURCE_SYNTHETIC;
+            if (p_bench->start_combination != BLE_BENCH_ALL && p_bench->start_combination >= BLE_BENCH_COMBINATIONS)
+                break;
+            p_bench->start_pending = true;
+            break;
+
+        case BLE_BENCH_CMD_STOP:
+            p_bench->stop_pending = true;
+            break;
+
+        default:
+            break;
+    }
+}
+
+void ble_bench_on_ble_evt(ble_evt_t const *p_ble_evt, void *p_context)
+{
+    ble_bench_t *p_bench = (ble_bench_t *) p_context;
+    uint32_t count;
+
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_GAP_EVT_CONNECTED:
+            p_bench->conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+            p_bench->max_data_len = BLE_GATT_ATT_MTU_DEFAULT - 3;
+            p_bench->phy = BLE_GAP_PHY_1MBPS;
+            p_bench->dle = 27;
+            p_bench->interval = p_ble_evt->evt.gap_evt.params.connected.conn_params.max_conn_interval;
+            (void) nrf_atomic_u32_store(&p_bench->hvn_in_flight, 0);
+            break;
+
+        case BLE_GAP_EVT_DISCONNECTED:
+            p_bench->conn_handle = BLE_CONN_HANDLE_INVALID;
+            p_bench->measuring = false;
+            p_bench->start_pending = false;
+            p_bench->state = BENCH_IDLE;
+            break;
+
+        case BLE_GAP_EVT_PHY_UPDATE:
+            if (p_ble_evt->evt.gap_evt.params.phy_update.status == BLE_HCI_STATUS_CODE_SUCCESS)
+                p_bench->phy = p_ble_evt->evt.gap_evt.params.phy_update.tx_phy;
+            p_bench->phy_pending = false;
+            break;
+
+        case BLE_GAP_EVT_DATA_LENGTH_UPDATE:
+            p_bench->dle = p_ble_evt->evt.gap_evt.params.data_length_update.effective_params.max_tx_octets;
+            p_bench->dle_pending = false;
+            break;
+
+        case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+            p_bench->interval = p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params.max_conn_interval;
+            p_bench->interval_pending = false;
+            break;
+
+        case BLE_GATTS_EVT_WRITE:
+            on_write(p_bench, p_ble_evt);
+            break;
+
+        case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+            //the other services notify on the link too, their completions don't take the count below 0
+            count = p_ble_evt->evt.gatts_evt.params.hvn_tx_complete.count;
+            if (nrf_atomic_u32_fetch_sub_hs(&p_bench->hvn_in_flight, count) < count)
+                (void) nrf_atomic_u32_store(&p_bench->hvn_in_flight, 0);
+            if (p_bench->measuring)
+                p_bench->hvn_done += count;
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*
+ * Adds the service with its data, control point and result characteristics
+ * and starts the radio notification
+ * @param read - reads the flash source, NULL runs every source synthetic
+ * @return NRF_SUCCESS or the error of the SoftDevice
+ */
+uint32_t ble_bench_init(ble_bench_t *p_bench, ble_bench_read_t read)
+{
+    uint32_t err_code;
+    ble_uuid_t ble_uuid;
+    ble_uuid128_t base_uuid = {BENCH_UUID_BASE};
+    ble_add_char_params_t add_char_params;
+
+    memset(p_bench, 0, sizeof(ble_bench_t));
+    p_bench->conn_handle = BLE_CONN_HANDLE_INVALID;
+    p_bench->max_data_len = BLE_GATT_ATT_MTU_DEFAULT - 3;
+    p_bench->read = read;
+    mp_bench = p_bench;
+
+    err_code = sd_ble_uuid_vs_add(&base_uuid, &p_bench->uuid_type);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+
+    ble_uuid.type = p_bench->uuid_type;
+    ble_uuid.uuid = BENCH_UUID_SERVICE;
+    err_code = sd_ble_gatts_service_add(BLE_GATTS_SRVC_TYPE_PRIMARY, &ble_uuid, &p_bench->service_handle);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+
+    memset(&add_char_params, 0, sizeof(add_char_params));
+    add_char_params.uuid              = BENCH_UUID_DATA_CHAR;
+    add_char_params.uuid_type         = p_bench->uuid_type;
+    add_char_params.max_len           = BLE_BENCH_MAX_DATA_LEN;
+    add_char_params.is_var_len        = true;
+    add_char_params.char_props.notify = 1;
+    add_char_params.cccd_write_access = SEC_OPEN;
+    err_code = characteristic_add(p_bench->service_handle, &add_char_params, &p_bench->data_handles);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+
+    memset(&add_char_params, 0, sizeof(add_char_params));
+    add_char_params.uuid                     = BENCH_UUID_CTRL_CHAR;
+    add_char_params.uuid_type                = p_bench->uuid_type;
+    add_char_params.max_len                  = 3;
+    add_char_params.is_var_len               = true;
+    add_char_params.char_props.write         = 1;
+    add_char_params.char_props.write_wo_resp = 1;
+    add_char_params.write_access             = SEC_OPEN;
+    err_code = characteristic_add(p_bench->service_handle, &add_char_params, &p_bench->ctrl_handles);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+
+    memset(&add_char_params, 0, sizeof(add_char_params));
+    add_char_params.uuid              = BENCH_UUID_RESULT_CHAR;
+    add_char_params.uuid_type         = p_bench->uuid_type;
+    add_char_params.init_len          = sizeof(ble_bench_result_t);
+    add_char_params.max_len           = sizeof(ble_bench_result_t);
+    add_char_params.char_props.read   = 1;
+    add_char_params.char_props.notify = 1;
+    add_char_params.read_access       = SEC_OPEN;
+    add_char_params.cccd_write_access = SEC_OPEN;
+    err_code = characteristic_add(p_bench->service_handle, &add_char_params, &p_bench->result_handles);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+
+    return ble_radio_notification_init(BLE_BENCH_RADIO_IRQ_PRIO, BLE_BENCH_RADIO_DISTANCE, bench_radio_handler);
+}
+
+bool ble_bench_active(ble_bench_t const *p_bench)
+{
+    return p_bench->state != BENCH_IDLE;
+}
+
+static uint32_t bench_notify(ble_bench_t *p_bench, uint16_t handle, uint8_t const *data, uint16_t length)
+{
+    ble_gatts_hvx_params_t hvx_params;
+    uint32_t err_code;
+
+    memset(&hvx_params, 0, sizeof(hvx_params));
+    hvx_params.type   = BLE_GATT_HVX_NOTIFICATION;
+    hvx_params.handle = handle;
+    hvx_params.p_data = data;
+    hvx_params.p_len  = &length;
+    err_code = sd_ble_gatts_hvx(p_bench->conn_handle, &hvx_params);
+    if (err_code == NRF_SUCCESS)
+        (void) nrf_atomic_u32_add(&p_bench->hvn_in_flight, 1);
+
+    return err_code;
+}
+
+/*
+ * Asks for the link parameters of the combination that the link doesn't have,
+ * a request the SoftDevice is too busy for is asked again on the next pass
+ */
+static void bench_request(ble_bench_t *p_bench)
+{
+    uint8_t combination = p_bench->combination;
+    uint32_t err_code;
+
+    if (m_requests & REQUEST_PHY)
+    {
+        ble_gap_phys_t const phys =
+        {
+            .tx_phys = bench_phy(combination),
+            .rx_phys = bench_phy(combination),
+        };
+
+        err_code = sd_ble_gap_phy_update(p_bench->conn_handle, &phys);
+        if (err_code != NRF_ERROR_BUSY)
+        {
+            m_requests &= ~REQUEST_PHY;
+            p_bench->phy_pending = (err_code == NRF_SUCCESS);
+        }
+    }
+    if (m_requests & REQUEST_DLE)
+    {
+        ble_gap_data_length_params_t const params =
+        {
+            .max_tx_octets  = bench_dle(combination),
+            .max_rx_octets  = bench_dle(combination),
+            .max_tx_time_us = BLE_GAP_DATA_LENGTH_AUTO,
+            .max_rx_time_us = BLE_GAP_DATA_LENGTH_AUTO,
+        };
+
+        err_code = sd_ble_gap_data_length_update(p_bench->conn_handle, &params, NULL);
+        if (err_code != NRF_ERROR_BUSY)
+        {
+            m_requests &= ~REQUEST_DLE;
+            p_bench->dle_pending = (err_code == NRF_SUCCESS);
+        }
+    }
+    if (m_requests & REQUEST_INTERVAL)
+    {
+        ble_gap_conn_params_t params =
+        {
+            .min_conn_interval = bench_interval(combination),
+            .max_conn_interval = bench_interval(combination),
+            .slave_latency     = 0,
+            .conn_sup_timeout  = CONN_SUP_TIMEOUT,
+        };
+
+        err_code = ble_conn_params_change_conn_params(p_bench->conn_handle, &params);
+        if (err_code != NRF_ERROR_BUSY)
+        {
+            m_requests &= ~REQUEST_INTERVAL;
+            p_bench->interval_pending = (err_code == NRF_SUCCESS);
+        }
+    }
+}
+
+static void bench_setup(ble_bench_t *p_bench)
+{
+    uint8_t combination = p_bench->combination;
+
+    m_requests = 0;
+    if (p_bench->phy != bench_phy(combination))
+        m_requests |= REQUEST_PHY;
+    if (p_bench->dle != bench_dle(combination))
+        m_requests |= REQUEST_DLE;
+    if (p_bench->interval != bench_interval(combination))
+        m_requests |= REQUEST_INTERVAL;
+    p_bench->phy_pending = false;
+    p_bench->dle_pending = false;
+    p_bench->interval_pending = false;
+    bench_request(p_bench);
+
+    p_bench->state = BENCH_SETUP;
+    p_bench->state_ticks = app_timer_cnt_get();
+}
+
+static void bench_run(ble_bench_t *p_bench)
+{
+    p_bench->data_len = MIN(bench_mtu(p_bench->combination) - 3, p_bench->max_data_len);
+    p_bench->hvn_done = 0;
+    p_bench->events = 0;
+    p_bench->radio_ticks = 0;
+    m_data_ready = false;
+
+    p_bench->state = BENCH_RUN;
+    p_bench->state_ticks = app_timer_cnt_get();
+    p_bench->measuring = true;
+}
+
+/*
+ * Queues notifications until the SoftDevice has no tx buffer left
+ * @return 0 if success, -1 if the stack refused one or the flash failed
+ */
+static int8_t bench_fill(ble_bench_t *p_bench)
+{
+    uint32_t err_code;
+    uint16_t i;
+
+    for (;;)
+    {
+        if (!m_data_ready)
+        {
+            if (p_bench->source == BLE_BENCH_SOURCE_FLASH)
+            {
+                if (p_bench->read(p_bench->offset, m_data, p_bench->data_len) < 0)
+                    return -1;
+            }
+            else
+            {
+                for (i = 0; i < p_bench->data_len; i++)
+                    m_data[i] = (uint8_t) (p_bench->offset + i);
+            }
+            m_data_ready = true;
+        }
+
+        err_code = bench_notify(p_bench, p_bench->data_handles.value_handle, m_data, p_bench->data_len);
+        if (err_code == NRF_ERROR_RESOURCES)
+            return 0; //more after the next BLE_GATTS_EVT_HVN_TX_COMPLETE
+        if (err_code != NRF_SUCCESS)
+            return -1;
+        p_bench->offset += p_bench->data_len;
+        m_data_ready = false;
+    }
+}
+
+/*
+ * Fills the result from the counts of the run, the link as it was granted.
+ * Every link layer packet of the peripheral is answered by an empty one of
+ * the central, the radio time past those of the acked packets, the
+ * notification distance and the closing empty exchange of each event is
+ * taken as retransmitted packets of the average size
+ */
+static void bench_result(ble_bench_t *p_bench, uint32_t duration_ticks)
+{
+    ble_bench_result_t *p_result = &p_bench->result;
+    uint32_t duration_us = bench_ticks_to_us(duration_ticks);
+    uint32_t hvn_done = p_bench->hvn_done;
+    uint32_t events = p_bench->events;
+    uint32_t ll_len = p_bench->data_len + LL_HEADERS;
+    uint32_t fragments = (ll_len + p_bench->dle - 1)/p_bench->dle;
+    uint32_t packets = hvn_done*fragments;
+    uint32_t byte_us = (p_bench->phy == BLE_GAP_PHY_2MBPS) ? 4 : 8;
+    uint32_t empty_us = ((p_bench->phy == BLE_GAP_PHY_2MBPS) ? 11 : 10)*byte_us; //preamble, access address, header, crc
+    uint32_t exchange_us = 2*empty_us + 2*T_IFS_US; //a packet and its answer without the payload
+    uint32_t radio_us = bench_ticks_to_us(p_bench->radio_ticks);
+    uint32_t overhead_us = events*(BLE_BENCH_RADIO_DISTANCE_US + exchange_us);
+    uint32_t acked_us = hvn_done*(fragments*exchange_us + ll_len*byte_us);
+    uint32_t extra_us;
+
+    memset(p_result, 0, sizeof(ble_bench_result_t));
+    p_result->combination = p_bench->combination;
+    p_result->phy = p_bench->phy;
+    p_result->dle = p_bench->dle;
+    p_result->mtu = p_bench->data_len + 3;
+    p_result->interval = p_bench->interval;
+    p_result->bytes = hvn_done*p_bench->data_len;
+    p_result->duration_ms = duration_us/1000;
+    if (duration_us > 0)
+        p_result->kbps = (uint16_t) MIN(((uint64_t) p_result->bytes*8*1000)/duration_us, UINT16_MAX);
+    p_result->events = MIN(events, UINT16_MAX);
+    if (events > 0)
+        p_result->packets_x100 = MIN(packets*100/events, UINT16_MAX);
+    if (packets > 0 && radio_us > overhead_us + acked_us)
+    {
+        extra_us = radio_us - overhead_us - acked_us;
+        p_result->retransmits = MIN(extra_us/(acked_us/packets), UINT16_MAX);
+    }
+
+    NRF_LOG_INFO("BENCH %d: phy %d, dle %d, mtu %d, interval %d", p_result->combination, p_result->phy,
+                 p_result->dle, p_result->mtu, p_result->interval);
+    NRF_LOG_INFO("BENCH %d: %d kbps, %d events, %d.%02d packets per event, %d retransmits", p_result->combination,
+                 p_result->kbps, p_result->events, p_result->packets_x100/100, p_result->packets_x100%100,
+                 p_result->retransmits);
+}
+
+/*
+ * Starts and stops the sweep and steps it, called from the main loop
+ * @return 0 if success, -1 if a run failed, the sweep is stopped
+ */
+int8_t ble_bench_process(ble_bench_t *p_bench)
+{
+    uint32_t elapsed;
+    uint32_t err_code;
+
+    if (p_bench->stop_pending)
+    {
+        p_bench->stop_pending = false;
+        p_bench->start_pending = false;
+        p_bench->measuring = false;
+        p_bench->state = BENCH_IDLE;
+    }
+    if (p_bench->conn_handle == BLE_CONN_HANDLE_INVALID)
+        return 0;
+    if (p_bench->start_pending && p_bench->state == BENCH_IDLE)
+    {
+        p_bench->start_pending = false;
+        p_bench->source = p_bench->start_source;
+        p_bench->offset = 0;
+        if (p_bench->start_combination == BLE_BENCH_ALL)
+        {
+            p_bench->combination = 0;
+            p_bench->last = BLE_BENCH_COMBINATIONS - 1;
+        }
+        else
+        {
+            p_bench->combination = p_bench->start_combination;
+            p_bench->last = p_bench->start_combination;
+        }
+        bench_setup(p_bench);
+    }
+
+    elapsed = app_timer_cnt_diff_compute(app_timer_cnt_get(), p_bench->state_ticks);
+    switch (p_bench->state)
+    {
+        case BENCH_SETUP:
+            bench_request(p_bench);
+            if ((m_requests == 0 && !p_bench->phy_pending && !p_bench->dle_pending && !p_bench->interval_pending)
+                || elapsed >= APP_TIMER_TICKS(BLE_BENCH_SETUP_MS))
+                bench_run(p_bench);
+            break;
+
+        case BENCH_RUN:
+            if (elapsed >= APP_TIMER_TICKS(BLE_BENCH_RUN_MS))
+            {
+                p_bench->measuring = false;
+                bench_result(p_bench, elapsed);
+                p_bench->state = BENCH_DRAIN;
+            }
+            else if (bench_fill(p_bench) < 0)
+            {
+                p_bench->measuring = false;
+                p_bench->state = BENCH_IDLE;
+                return -1;
+            }
+            break;
+
+        case BENCH_DRAIN:
+            if (p_bench->hvn_in_flight == 0)
+                p_bench->state = BENCH_RESULT;
+            break;
+
+        case BENCH_RESULT:
+            err_code = bench_notify(p_bench, p_bench->result_handles.value_handle,
+                                    (uint8_t const *) &p_bench->result, sizeof(ble_bench_result_t));
+            if (err_code == NRF_ERROR_RESOURCES)
+                break;
+            //a central without the result notification enabled still reads the last one
+            if (err_code != NRF_SUCCESS)
+            {
+                ble_gatts_value_t value =
+                {
+                    .len     = sizeof(ble_bench_result_t),
+                    .offset  = 0,
+                    .p_value = (uint8_t *) &p_bench->result,
+                };
+                (void) sd_ble_gatts_value_set(p_bench->conn_handle, p_bench->result_handles.value_handle, &value);
+            }
+            if (p_bench->combination < p_bench->last)
+            {
+                p_bench->combination++;
+                bench_setup(p_bench);
+            }
+            else
+            {
+                NRF_LOG_INFO("BENCH done");
+                p_bench->state = BENCH_IDLE;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return 0;
+}
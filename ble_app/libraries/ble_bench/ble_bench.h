@@ -0,0 +1,143 @@
+#ifndef BLE_BENCH_H
+#define BLE_BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ble.h"
+#include "ble_srv_common.h"
+#include "nrf_sdh_ble.h"
+#include "nrf_atomic.h"
+
+/* BLE Throughput Benchmark Service, measures what the link of the board it
+ * runs on really carries so the offload's link parameters come from the
+ * antenna on the PCB rather than from a datasheet. A central enables the
+ * data and result notifications and writes the control point
+ *   BLE_BENCH_CMD_START [uint8 source] [uint8 combination, all if left out]
+ *   BLE_BENCH_CMD_STOP
+ * and the service steps through every combination of PHY, ATT MTU, data
+ * length (DLE) and connection interval in BLE_BENCH_PHYS, _MTUS, _DLES and
+ * _INTERVALS. For each one it asks the central for the link parameters,
+ * waits up to BLE_BENCH_SETUP_MS for the updates, then keeps the SoftDevice tx
+ * queue full of data notifications for BLE_BENCH_RUN_MS, synthetic bytes or,
+ * with BLE_BENCH_SOURCE_FLASH, read from the flash through the app's read
+ * function ahead of every notification. The ATT MTU is only exchanged once a
+ * connection, a smaller one is run by capping the notifications at its MTU - 3.
+ * Once the notifications still queued are out a ble_bench_result_t is
+ * notified on the result characteristic and logged, with the parameters the
+ * central actually granted: a central may refuse any of them.
+ * The connection events are counted from the radio notification (SWI1), the
+ * radio time of each from its active and inactive signals on the app_timer
+ * rtc, so a run of many events averages out the 30 us tick. The SoftDevice
+ * does not count retransmissions, they are estimated from the radio time the
+ * acked packets do not account for, each link layer packet taking its air time
+ * at the PHY, the empty packet of the central and the two interframe spaces.
+ * The connection interval is asked for through ble_conn_params, whose
+ * preferred parameters it sets, the app leaves them alone while
+ * ble_bench_active(); thread context for ble_bench_process */
+#define BLE_BENCH_DEF(_name)                                                    \
+static ble_bench_t _name;                                                       \
+NRF_SDH_BLE_OBSERVER(_name ## _obs,                                             \
+                     BLE_BENCH_BLE_OBSERVER_PRIO,                               \
+                     ble_bench_on_ble_evt, &_name)
+
+#ifndef BLE_BENCH_BLE_OBSERVER_PRIO
+#define BLE_BENCH_BLE_OBSERVER_PRIO 2
+#endif
+
+#define BENCH_UUID_BASE             {0x6B, 0x3A, 0x1F, 0x52, 0x90, 0x4C, 0x2E, 0x8D, \
+                                     0x47, 0x41, 0xC9, 0x30, 0x00, 0x00, 0x7F, 0x48}
+#define BENCH_UUID_SERVICE          0x1700
+#define BENCH_UUID_DATA_CHAR        0x1701
+#define BENCH_UUID_CTRL_CHAR        0x1702
+#define BENCH_UUID_RESULT_CHAR      0x1703
+
+#define BLE_BENCH_CMD_START         0x01
+#define BLE_BENCH_CMD_STOP          0x02
+
+#define BLE_BENCH_SOURCE_SYNTHETIC  0
+#define BLE_BENCH_SOURCE_FLASH      1
+#define BLE_BENCH_ALL               0xFF
+
+#define BLE_BENCH_MAX_DATA_LEN      (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3)
+#define BLE_BENCH_SETUP_MS          3000
+#define BLE_BENCH_RUN_MS            5000
+#define BLE_BENCH_RADIO_IRQ_PRIO    6
+#define BLE_BENCH_RADIO_DISTANCE    NRF_RADIO_NOTIFICATION_DISTANCE_800US
+#define BLE_BENCH_RADIO_DISTANCE_US 800
+
+//the sweep, combination n runs PHY n/(MTUS*DLES*INTERVALS) and so on down to interval n%INTERVALS
+#define BLE_BENCH_PHYS              {BLE_GAP_PHY_1MBPS, BLE_GAP_PHY_2MBPS}
+#define BLE_BENCH_MTUS              {BLE_GATT_ATT_MTU_DEFAULT, NRF_SDH_BLE_GATT_MAX_MTU_SIZE}
+#define BLE_BENCH_DLES              {27, NRF_SDH_BLE_GAP_DATA_LENGTH}
+#define BLE_BENCH_INTERVALS         {MSEC_TO_UNITS(7.5, UNIT_1_25_MS), MSEC_TO_UNITS(15, UNIT_1_25_MS), \
+                                     MSEC_TO_UNITS(30, UNIT_1_25_MS), MSEC_TO_UNITS(50, UNIT_1_25_MS)}
+#define BLE_BENCH_COMBINATIONS      (2*2*2*4)
+
+/* Reads length bytes of the flash source at offset, the function wraps it
+ * @return 0 if success otherwise < 0 */
+typedef int8_t (*ble_bench_read_t)(uint32_t offset, uint8_t *data, uint16_t length);
+
+typedef struct __attribute__((packed)) {
+    uint8_t combination;
+    uint8_t phy;                //BLE_GAP_PHY_1MBPS or BLE_GAP_PHY_2MBPS the link sent on
+    uint8_t dle;                //link layer tx octets granted
+    uint8_t mtu;                //ATT MTU the notifications were cut to
+    uint16_t interval;          //1.25 ms units granted
+    uint16_t kbps;              //data bytes acked, the ATT and L2CAP headers left out
+    uint32_t bytes;
+    uint16_t events;            //connection events of the run
+    uint16_t packets_x100;      //link layer packets acked per connection event
+    uint16_t retransmits;       //estimated, see above
+    uint16_t duration_ms;
+} ble_bench_result_t;
+
+typedef struct {
+    uint16_t service_handle;
+    uint16_t conn_handle;
+    ble_gatts_char_handles_t data_handles;
+    ble_gatts_char_handles_t ctrl_handles;
+    ble_gatts_char_handles_t result_handles;
+    uint8_t uuid_type;
+    uint16_t max_data_len;      //negotiated ATT MTU - 3, set by the app
+    ble_bench_read_t read;
+
+    bool start_pending;
+    bool stop_pending;
+    uint8_t start_source;
+    uint8_t start_combination;
+
+    uint8_t state;
+    uint8_t source;
+    uint8_t combination;
+    uint8_t last;
+    uint16_t data_len;
+    uint32_t offset;
+    uint32_t state_ticks;
+    ble_bench_result_t result;
+
+    //the link as the latest updates left it, written from the observer
+    volatile uint8_t phy;
+    volatile uint8_t dle;
+    volatile uint16_t interval;
+    volatile bool phy_pending;
+    volatile bool dle_pending;
+    volatile bool interval_pending;
+
+    //counted from the observer and the radio notification while a run measures
+    volatile bool measuring;
+    nrf_atomic_u32_t hvn_in_flight;
+    volatile uint32_t hvn_done;
+    volatile uint32_t events;
+    volatile uint32_t radio_ticks;
+    uint32_t radio_start;
+} ble_bench_t;
+
+uint32_t ble_bench_init(ble_bench_t *p_bench, ble_bench_read_t read);
+
+void ble_bench_on_ble_evt(ble_evt_t const *p_ble_evt, void *p_context);
+
+bool ble_bench_active(ble_bench_t const *p_bench);
+
+int8_t ble_bench_process(ble_bench_t *p_bench);
+
+#endif //BLE_BENCH_H
@@ -0,0 +1,1380 @@
+//-------------------------------------------
+// Title: ble_ios.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Impact Offload Service. Frames the stored events like
+// the serial offload and hands them to the SoftDevice as notifications
+// until its tx queue is full, then picks up again on the next
+// BLE_GATTS_EVT_HVN_TX_COMPLETE so every connection event is filled.
+// Once the queue is full the next notification is built ahead, its flash
+// read runs while the radio sends the queued ones, so a completion only
+// hands over a buffer that is ready and the thread goes back to sleep.
+// The samples are read into two piece buffers: while one is framed the
+// flash fills the other with the next piece by a queued fast read, so the
+// SPI transfer overlaps the copying and the crc instead of adding to them.
+// The flash is only read from ble_ios_offload_process in thread
+// context, the observer just records the state changes.
+//-------------------------------------------
+#include <string.h>
+#include "ble_ios.h"
+#include "serial_offload.h"
+#include "crc32.h"
+#include "app_util_platform.h"
+
+#define FRAME_HEADER_SIZE   9 //sync, type and length
+#define CMD_QUERY_LEN       (1 + 2*sizeof(uint32_t) + sizeof(uint16_t)) //opcode, from, to and min peak
+#define CMD_SET_TIME_LEN    (1 + sizeof(uint32_t) + 1) //opcode, epoch and hundredths
+#define CTRL_MAX_LEN        MAX(CMD_QUERY_LEN, CMD_SET_TIME_LEN) //a longer write is refused, the longest command fits
+
+STATIC_ASSERT(sizeof(ble_ios_alert_t) == 16);
+STATIC_ASSERT(sizeof(ble_ios_adv_summary_t) == 6);
+
+enum {
+    STAGE_EVENT_BEGIN,  //next piece opens the frame of next_id or the next query match, or is the end frame
+    STAGE_SAMPLES,      //next piece is samples from next_sample, or the event frame crc
+    STAGE_DONE          //the end frame has been built
+};
+
+enum {
+    AHEAD_NONE,         //no read ahead, or it was used
+    AHEAD_QUEUED,       //on the flash queue, its buffer is not touched until it is done
+    AHEAD_READY,
+    AHEAD_FAILED        //the piece is read again when it is built
+};
+
+/*
+ * Starts a frame in the piece buffer with its sync word, type and payload length
+ */
+static void ios_begin_frame(ble_ios_offload_t *p_offload, uint8_t type, uint32_t length)
+{
+    uint32_t sync = SERIAL_OFFLOAD_SYNC;
+
+    memcpy(p_offload->piece, &sync, sizeof(sync));
+    p_offload->piece[4] = type;
+    memcpy(&p_offload->piece[5], &length, sizeof(length));
+    p_offload->crc = crc32_compute(&p_offload->piece[4], FRAME_HEADER_SIZE - sizeof(sync), NULL);
+    p_offload->piece_len = FRAME_HEADER_SIZE;
+}
+
+/*
+ * Appends bytes to the piece buffer and the frame crc
+ */
+static void ios_piece_append(ble_ios_offload_t *p_offload, void const *data, uint16_t length)
+{
+    memcpy(&p_offload->piece[p_offload->piece_len], data, length);
+    p_offload->crc = crc32_compute(&p_offload->piece[p_offload->piece_len], length, &p_offload->crc);
+    p_offload->piece_len += length;
+}
+
+/*
+ * Builds the end frame in the piece buffer
+ */
+static void ios_end_frame(ble_ios_offload_t *p_offload)
+{
+    ios_begin_frame(p_offload, SERIAL_OFFLOAD_FRAME_END, sizeof(p_offload->num_sent));
+    ios_piece_append(p_offload, &p_offload->num_sent, sizeof(p_offload->num_sent));
+    memcpy(&p_offload->piece[p_offload->piece_len], &p_offload->crc, sizeof(p_offload->crc));
+    p_offload->piece_len += sizeof(p_offload->crc);
+    p_offload->stage = STAGE_DONE;
+}
+
+/*
+ * Builds the summary frame of the next event of the query, its header and
+ * preview, or the end frame once the range is read. Only headers are read,
+ * at most EVENT_STORE_QUERY_SCAN of them a call so the flash is not held
+ * through a long range without a match, the next offload pass goes on
+ * @return 0 if success, 1 if no frame was built and the scan goes on, -1 on spi error
+ */
+static int8_t ios_next_summary(ble_ios_offload_t *p_offload)
+{
+    event_store_header_t header;
+    event_store_preview_t preview;
+    uint32_t id;
+    int8_t ret;
+
+    if (event_store_query_done(&p_offload->query))
+    {
+        ios_end_frame(p_offload);
+        return 0;
+    }
+    ret = event_store_query_next(p_offload->store, &p_offload->query, &id, &header);
+    if (ret < 0)
+        return ret;
+    if (ret == 0)
+        return 1;
+    ret = event_store_get_preview(p_offload->store, id, &preview);
+    if (ret < 0)
+        return ret;
+    ios_begin_frame(p_offload, SERIAL_OFFLOAD_FRAME_SUMMARY, sizeof(header) + sizeof(preview));
+    ios_piece_append(p_offload, &header, sizeof(header));
+    ios_piece_append(p_offload, &preview, sizeof(preview));
+    memcpy(&p_offload->piece[p_offload->piece_len], &p_offload->crc, sizeof(p_offload->crc));
+    p_offload->piece_len += sizeof(p_offload->crc);
+    p_offload->num_sent++;
+
+    return 0;
+}
+
+/*
+ * @return the samples of the next piece of the event being framed, 0 at its end
+ */
+static uint32_t ios_piece_samples(ble_ios_offload_t const *p_offload)
+{
+    uint32_t num_samples;
+
+    if (p_offload->next_sample >= p_offload->sample_count)
+        return 0;
+    num_samples = p_offload->sample_count - p_offload->next_sample;
+    if (num_samples > BLE_IOS_PIECE_SIZE/p_offload->sample_size)
+        num_samples = BLE_IOS_PIECE_SIZE/p_offload->sample_size;
+    return num_samples;
+}
+
+/*
+ * @return the piece buffer the read ahead goes to
+ */
+static uint8_t *ios_ahead_buffer(ble_ios_offload_t *p_offload)
+{
+    return p_offload->buffers[p_offload->piece == p_offload->buffers[0]];
+}
+
+/*
+ * Completion of the read ahead, in the SPI interrupt
+ */
+static void ios_read_ahead_done(int8_t result, void *p_context)
+{
+    ble_ios_offload_t *p_offload = (ble_ios_offload_t *) p_context;
+
+    p_offload->ahead_state = (result < 0) ? AHEAD_FAILED : AHEAD_READY;
+}
+
+/*
+ * Queues the read of the next samples of the event into the other piece
+ * buffer, it runs while this piece is sent. Nothing is queued at the end of
+ * the event or while the flash is busy, the piece is then read when it is built
+ */
+static void ios_read_ahead(ble_ios_offload_t *p_offload)
+{
+    uint32_t num_samples = ios_piece_samples(p_offload);
+
+    if (num_samples == 0)
+        return;
+    p_offload->ahead_id = p_offload->next_id;
+    p_offload->ahead_sample = p_offload->next_sample;
+    p_offload->ahead_count = num_samples;
+    p_offload->ahead_state = AHEAD_QUEUED;
+    if (event_store_queue_read_samples(p_offload->store, p_offload->next_id, p_offload->next_sample,
+                                       ios_ahead_buffer(p_offload), num_samples, &p_offload->ahead_read,
+                                       ios_read_ahead_done, p_offload) != 0)
+        p_offload->ahead_state = AHEAD_NONE;
+}
+
+/*
+ * Builds the next piece of the frame stream, whole samples at a time so raw
+ * events can be read by sample
+ * @return 0 if success, 1 if a query scan built nothing this time, -1 on spi
+ * error, -3 if a header is corrupt
+ */
+static int8_t ios_next_piece(ble_ios_offload_t *p_offload)
+{
+    event_store_header_t header;
+    uint32_t num_samples;
+    int8_t ret;
+
+    p_offload->piece_len = 0;
+    p_offload->piece_pos = 0;
+
+    switch (p_offload->stage)
+    {
+        case STAGE_EVENT_BEGIN:
+            if (p_offload->summaries)
+                return ios_next_summary(p_offload);
+            if (p_offload->next_id >= p_offload->end_id)
+            {
+                ios_end_frame(p_offload);
+                break;
+            }
+            ret = event_store_get_header(p_offload->store, p_offload->next_id, &header);
+            //reclaimed before it was offloaded, or moved to a new id sent later: no frame
+            if (ret == -2)
+            {
+                p_offload->next_id++;
+                break;
+            }
+            if (ret < 0)
+                return ret;
+            ios_begin_frame(p_offload, SERIAL_OFFLOAD_FRAME_EVENT,
+                            sizeof(header) + header.sample_count*header.sample_size);
+            ios_piece_append(p_offload, &header, sizeof(header));
+            p_offload->sample_count = header.sample_count;
+            p_offload->sample_size = header.sample_size;
+            p_offload->next_sample = 0;
+            p_offload->stage = STAGE_SAMPLES;
+            break;
+
+        case STAGE_SAMPLES:
+            num_samples = ios_piece_samples(p_offload);
+            if (num_samples == 0)
+            {
+                memcpy(p_offload->piece, &p_offload->crc, sizeof(p_offload->crc));
+                p_offload->piece_len = sizeof(p_offload->crc);
+                p_offload->next_id++;
+                p_offload->num_sent++;
+                p_offload->stage = STAGE_EVENT_BEGIN;
+                break;
+            }
+            //the other buffer is only used once the read ahead is done with it
+            while (p_offload->ahead_state == AHEAD_QUEUED)
+            {
+            }
+            if (p_offload->ahead_state == AHEAD_READY && p_offload->ahead_id == p_offload->next_id
+                && p_offload->ahead_sample == p_offload->next_sample && p_offload->ahead_count == num_samples)
+            {
+                p_offload->piece = ios_ahead_buffer(p_offload);
+                p_offload->ahead_hits++;
+                //read outside the store's cache, kept for a fetch of the event again
+                event_store_cache_samples(p_offload->store, p_offload->next_id, p_offload->next_sample,
+                                          p_offload->piece, num_samples);
+            }
+            else
+            {
+                ret = event_store_read_samples(p_offload->store, p_offload->next_id, p_offload->next_sample,
+                                               p_offload->piece, num_samples);
+                if (ret < 0)
+                    return ret;
+            }
+            p_offload->ahead_state = AHEAD_NONE;
+            p_offload->piece_len = num_samples*p_offload->sample_size;
+            p_offload->crc = crc32_compute(p_offload->piece, p_offload->piece_len, &p_offload->crc);
+            p_offload->next_sample += num_samples;
+            ios_read_ahead(p_offload);
+            break;
+
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+/*
+ * Fills a notification or SDU buffer from the frame stream
+ * @param p_len - bytes already in the buffer, updated
+ * @return 0 if success, 1 if a query scan stopped it short of max_len and not
+ * at the end, otherwise the error of ios_next_piece
+ */
+static int8_t ios_fill(ble_ios_offload_t *p_offload, uint8_t *buf, uint16_t *p_len, uint16_t max_len)
+{
+    uint16_t length;
+    int8_t ret;
+
+    while (*p_len < max_len)
+    {
+        if (p_offload->piece_pos == p_offload->piece_len)
+        {
+            if (p_offload->stage == STAGE_DONE)
+                break;
+            ret = ios_next_piece(p_offload);
+            if (ret != 0)
+                return ret;
+        }
+        length = p_offload->piece_len - p_offload->piece_pos;
+        if (length > max_len - *p_len)
+            length = max_len - *p_len;
+        memcpy(&buf[*p_len], &p_offload->piece[p_offload->piece_pos], length);
+        *p_len += length;
+        p_offload->piece_pos += length;
+    }
+
+    return 0;
+}
+
+#if BLE_IOS_L2CAP_ENABLED
+/*
+ * Credits an SDU takes, its first PDU also carries the 2 byte SDU length
+ */
+static uint16_t ios_l2cap_credits(ble_ios_l2cap_t const *p_l2cap, uint16_t sdu_len)
+{
+    return (sdu_len + 2 + p_l2cap->tx_mps - 1)/p_l2cap->tx_mps;
+}
+
+/*
+ * Accepts a channel on BLE_IOS_L2CAP_PSM, only one at a time. Nothing is
+ * received on it so no rx buffer or credits are given to the peer
+ */
+static void on_l2cap_setup_request(ble_ios_t *p_ios, ble_l2cap_evt_t const *p_l2cap_evt)
+{
+    ble_l2cap_ch_setup_params_t params;
+    uint16_t local_cid = p_l2cap_evt->local_cid;
+
+    memset(&params, 0, sizeof(params));
+    params.rx_params.rx_mtu = BLE_L2CAP_MTU_MIN;
+    params.rx_params.rx_mps = BLE_L2CAP_MPS_MIN;
+    params.rx_params.sdu_buf.p_data = NULL;
+    if (p_l2cap_evt->params.ch_setup_request.le_psm != BLE_IOS_L2CAP_PSM)
+        params.status = BLE_L2CAP_CH_STATUS_CODE_LE_PSM_NOT_SUPPORTED;
+    else if (p_ios->l2cap.local_cid != BLE_L2CAP_CID_INVALID)
+        params.status = BLE_L2CAP_CH_STATUS_CODE_NO_RESOURCES;
+    else
+        params.status = BLE_L2CAP_CH_STATUS_CODE_SUCCESS;
+
+    //a failed reply times out on the gateway, which falls back to the notifications
+    (void) sd_ble_l2cap_ch_setup(p_l2cap_evt->conn_handle, &local_cid, &params);
+}
+
+/*
+ * Forgets the channel, an offload running over it is stopped
+ */
+static void ios_l2cap_reset(ble_ios_t *p_ios)
+{
+    p_ios->l2cap.local_cid = BLE_L2CAP_CID_INVALID;
+    p_ios->l2cap.credits = 0;
+    p_ios->l2cap.sdu_in_flight = 0;
+    p_ios->l2cap.sdu_len = 0;
+    if (p_ios->offload.l2cap)
+        ble_ios_offload_stop(p_ios);
+}
+
+static void on_l2cap_evt(ble_ios_t *p_ios, ble_evt_t const *p_ble_evt)
+{
+    ble_l2cap_evt_t const *p_l2cap_evt = &p_ble_evt->evt.l2cap_evt;
+    ble_ios_l2cap_t *p_l2cap = &p_ios->l2cap;
+
+    if (p_ble_evt->header.evt_id == BLE_L2CAP_EVT_CH_SETUP_REQUEST)
+    {
+        on_l2cap_setup_request(p_ios, p_l2cap_evt);
+        return;
+    }
+    if (p_l2cap_evt->local_cid != p_l2cap->local_cid && p_ble_evt->header.evt_id != BLE_L2CAP_EVT_CH_SETUP)
+        return;
+
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_L2CAP_EVT_CH_SETUP:
+            p_l2cap->local_cid = p_l2cap_evt->local_cid;
+            p_l2cap->tx_mtu = MIN(p_l2cap_evt->params.ch_setup.tx_params.tx_mtu, BLE_IOS_L2CAP_SDU_SIZE);
+            p_l2cap->tx_mps = p_l2cap_evt->params.ch_setup.tx_params.tx_mps;
+            p_l2cap->credits = p_l2cap_evt->params.ch_setup.tx_params.credits;
+            p_l2cap->sdu_in_flight = 0;
+            p_l2cap->sdu_len = 0;
+            break;
+
+        case BLE_L2CAP_EVT_CH_RELEASED:
+            ios_l2cap_reset(p_ios);
+            break;
+
+        case BLE_L2CAP_EVT_CH_TX:
+            //also wakes the main loop to queue more
+            if (p_l2cap->sdu_in_flight > 0)
+                p_l2cap->sdu_in_flight--;
+            break;
+
+        case BLE_L2CAP_EVT_CH_CREDIT:
+            p_l2cap->credits += p_l2cap_evt->params.credit.credits;
+            break;
+
+        default:
+            break;
+    }
+}
+#endif
+
+/*
+ * @return true if the running offload goes over the L2CAP channel
+ */
+static bool ios_offload_on_l2cap(ble_ios_t const *p_ios)
+{
+#if BLE_IOS_L2CAP_ENABLED
+    return p_ios->offload.l2cap;
+#else
+    return false;
+#endif
+}
+
+static bool ios_offload_on_esb(ble_ios_t const *p_ios)
+{
+#if BLE_IOS_ESB_ENABLED
+    return p_ios->offload.esb;
+#else
+    return false;
+#endif
+}
+
+static void on_write(ble_ios_t *p_ios, ble_evt_t const *p_ble_evt)
+{
+    ble_gatts_evt_write_t const *p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
+    uint32_t first_id = BLE_IOS_RESUME_ID;
+
+    if (p_evt_write->handle == p_ios->data_handles.cccd_handle && p_evt_write->len == 2)
+    {
+        p_ios->notify_enabled = ble_srv_is_notification_enabled(p_evt_write->data);
+        if (!p_ios->notify_enabled && !ios_offload_on_l2cap(p_ios) && !ios_offload_on_esb(p_ios))
+            ble_ios_offload_stop(p_ios);
+    }
+    else if (p_evt_write->handle == p_ios->alert_handles.cccd_handle && p_evt_write->len == 2)
+    {
+        p_ios->alert_enabled = ble_srv_is_notification_enabled(p_evt_write->data);
+    }
+    else if (p_evt_write->handle == p_ios->ctrl_handles.value_handle && p_evt_write->len >= 1)
+    {
+        if (p_evt_write->data[0] == BLE_IOS_CMD_START)
+        {
+            if (p_evt_write->len >= 1 + sizeof(first_id))
+                memcpy(&first_id, &p_evt_write->data[1], sizeof(first_id));
+            p_ios->offload.start_id = first_id;
+            p_ios->offload.query_pending = false;
+            p_ios->offload.start_pending = true;
+        }
+        else if (p_evt_write->data[0] == BLE_IOS_CMD_QUERY && p_evt_write->len >= 1 + 2*sizeof(uint32_t))
+        {
+            memcpy(&p_ios->offload.query_from_s, &p_evt_write->data[1], sizeof(uint32_t));
+            memcpy(&p_ios->offload.query_to_s, &p_evt_write->data[1 + sizeof(uint32_t)], sizeof(uint32_t));
+            p_ios->offload.query_min_peak = 0;
+            if (p_evt_write->len >= CMD_QUERY_LEN)
+                memcpy(&p_ios->offload.query_min_peak, &p_evt_write->data[1 + 2*sizeof(uint32_t)], sizeof(uint16_t));
+            p_ios->offload.start_pending = false;
+            p_ios->offload.query_pending = true;
+        }
+        else if (p_evt_write->data[0] == BLE_IOS_CMD_STOP)
+        {
+            p_ios->offload.start_pending = false;
+            p_ios->offload.query_pending = false;
+            ble_ios_offload_stop(p_ios);
+        }
+        else if (p_evt_write->data[0] == BLE_IOS_CMD_SET_TIME && p_evt_write->len >= 1 + sizeof(uint32_t))
+        {
+            memcpy(&p_ios->time_epoch, &p_evt_write->data[1], sizeof(uint32_t));
+            p_ios->time_hundreth = (p_evt_write->len > 1 + sizeof(uint32_t)) ?
+                                   MIN(p_evt_write->data[1 + sizeof(uint32_t)], 99) : 0;
+            p_ios->time_pending = true;
+        }
+        else if (p_evt_write->data[0] == BLE_IOS_CMD_ACK && p_evt_write->len >= 1 + sizeof(uint32_t))
+        {
+            //only the latest is kept, the watermark never moves back
+            memcpy(&p_ios->ack_count, &p_evt_write->data[1], sizeof(uint32_t));
+            p_ios->ack_pending = true;
+        }
+        else if (p_evt_write->data[0] == BLE_IOS_CMD_PROFILE && p_evt_write->len >= 2)
+        {
+            p_ios->profile_id = p_evt_write->data[1];
+            p_ios->profile_pending = true;
+        }
+        else if (p_evt_write->data[0] == BLE_IOS_CMD_STREAM && p_evt_write->len >= 1 + sizeof(uint16_t))
+        {
+            memcpy(&p_ios->stream_rate_hz, &p_evt_write->data[1], sizeof(uint16_t));
+            p_ios->stream_pending = true;
+        }
+        else if (p_evt_write->data[0] == BLE_IOS_CMD_ACTIVITY)
+        {
+            p_ios->activity_from_s = 0;
+            if (p_evt_write->len >= 1 + sizeof(uint32_t))
+            {
+                memcpy(&p_ios->activity_from_s, &p_evt_write->data[1], sizeof(uint32_t));
+            }
+            p_ios->activity_pending = true;
+        }
+        else if (p_evt_write->data[0] == BLE_IOS_CMD_SESSION)
+        {
+            p_ios->session_pending = true;
+        }
+#if BLE_IOS_ESB_ENABLED
+        else if (p_evt_write->data[0] == BLE_IOS_CMD_ESB)
+        {
+            if (p_evt_write->len >= 1 + sizeof(first_id))
+                memcpy(&first_id, &p_evt_write->data[1], sizeof(first_id));
+            p_ios->esb_start_id = first_id;
+            p_ios->esb_pending = true;
+        }
+#endif
+    }
+}
+
+#if BLE_IOS_FW_UPDATE_ENABLED
+/*
+ * Answers a read of the update characteristic with the stage's status and
+ * a write with the result of its command
+ */
+static void on_fw_update(ble_ios_t *p_ios, ble_evt_t const *p_ble_evt)
+{
+    ble_gatts_evt_rw_authorize_request_t const *p_req = &p_ble_evt->evt.gatts_evt.params.authorize_request;
+    ble_gatts_evt_write_t const *p_write = &p_req->request.write;
+    ble_gatts_rw_authorize_reply_params_t reply;
+    fw_stage_status_t status;
+    uint16_t init_size;
+    uint16_t init_offset;
+    uint32_t image_size;
+    uint32_t image_crc;
+    uint32_t offset;
+    int8_t ret = -2;
+
+    memset(&reply, 0, sizeof(reply));
+    if (p_req->type == BLE_GATTS_AUTHORIZE_TYPE_READ)
+    {
+        if (p_req->request.read.handle != p_ios->fw_update_handles.value_handle)
+            return;
+
+        fw_stage_status(&status);
+        reply.type = BLE_GATTS_AUTHORIZE_TYPE_READ;
+        reply.params.read.gatt_status = BLE_GATT_STATUS_SUCCESS;
+        reply.params.read.update = 1;
+        reply.params.read.len = sizeof(status);
+        reply.params.read.p_data = (uint8_t const *) &status;
+        (void) sd_ble_gatts_rw_authorize_reply(p_ble_evt->evt.gatts_evt.conn_handle, &reply);
+        return;
+    }
+    if (p_req->type != BLE_GATTS_AUTHORIZE_TYPE_WRITE || p_write->handle != p_ios->fw_update_handles.value_handle ||
+        p_write->op != BLE_GATTS_OP_WRITE_REQ)
+        return;
+
+    if (p_write->len >= 1 + sizeof(uint16_t) + 2*sizeof(uint32_t) && p_write->data[0] == BLE_IOS_FW_BEGIN)
+    {
+        memcpy(&init_size, &p_write->data[1], sizeof(uint16_t));
+        memcpy(&image_size, &p_write->data[1 + sizeof(uint16_t)], sizeof(uint32_t));
+        memcpy(&image_crc, &p_write->data[1 + sizeof(uint16_t) + sizeof(uint32_t)], sizeof(uint32_t));
+        ret = fw_stage_begin(init_size, image_size, image_crc);
+    }
+    else if (p_write->len >= 1 + sizeof(uint16_t) && p_write->data[0] == BLE_IOS_FW_INIT)
+    {
+        memcpy(&init_offset, &p_write->data[1], sizeof(uint16_t));
+        ret = fw_stage_init_write(init_offset, &p_write->data[1 + sizeof(uint16_t)], p_write->len - 1 - sizeof(uint16_t));
+    }
+    else if (p_write->len >= 1 + sizeof(uint32_t) && p_write->data[0] == BLE_IOS_FW_DATA)
+    {
+        memcpy(&offset, &p_write->data[1], sizeof(uint32_t));
+        ret = fw_stage_image_write(offset, &p_write->data[1 + sizeof(uint32_t)], p_write->len - 1 - sizeof(uint32_t));
+    }
+    else if (p_write->len >= 1 && p_write->data[0] == BLE_IOS_FW_COMMIT)
+    {
+        ret = fw_stage_commit();
+    }
+    else if (p_write->len >= 1 && p_write->data[0] == BLE_IOS_FW_SWAP)
+    {
+        ret = fw_stage_swap_request();
+    }
+    else if (p_write->len >= 1 && p_write->data[0] == BLE_IOS_FW_ABORT)
+    {
+        fw_stage_abort();
+        ret = 0;
+    }
+
+    reply.type = BLE_GATTS_AUTHORIZE_TYPE_WRITE;
+    reply.params.write.gatt_status = (ret == 0) ? BLE_GATT_STATUS_SUCCESS :
+                                     (ret == -3) ? BLE_IOS_FW_STATUS_BUSY : BLE_IOS_FW_STATUS_REFUSED;
+    reply.params.write.update = 1;
+    reply.params.write.len = p_write->len;
+    reply.params.write.p_data = p_write->data;
+    (void) sd_ble_gatts_rw_authorize_reply(p_ble_evt->evt.gatts_evt.conn_handle, &reply);
+}
+#endif
+
+void ble_ios_on_ble_evt(ble_evt_t const *p_ble_evt, void *p_context)
+{
+    ble_ios_t *p_ios = (ble_ios_t *) p_context;
+
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_GAP_EVT_CONNECTED:
+            p_ios->conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+            p_ios->max_data_len = BLE_GATT_ATT_MTU_DEFAULT - 3;
+            (void) nrf_atomic_u32_store(&p_ios->hvn_in_flight, 0);
+            p_ios->alert_ahead = 0;
+#if BLE_IOS_L2CAP_ENABLED
+            ios_l2cap_reset(p_ios);
+#endif
+            break;
+
+        case BLE_GAP_EVT_DISCONNECTED:
+            p_ios->conn_handle = BLE_CONN_HANDLE_INVALID;
+            p_ios->notify_enabled = false;
+            p_ios->alert_enabled = false;
+            p_ios->alert_pending = false;
+            p_ios->alert_ahead = 0;
+            p_ios->offload.start_pending = false;
+            p_ios->offload.query_pending = false;
+            //an ESB offload carries on without the link
+            if (!ios_offload_on_esb(p_ios))
+                ble_ios_offload_stop(p_ios);
+            //nobody is left to watch the stream
+            p_ios->stream_rate_hz = 0;
+            p_ios->stream_pending = true;
+            p_ios->activity_pending = false;
+            p_ios->live_pos = 0;
+#if BLE_IOS_L2CAP_ENABLED
+            ios_l2cap_reset(p_ios);
+#endif
+            break;
+
+        case BLE_GATTS_EVT_WRITE:
+            on_write(p_ios, p_ble_evt);
+            break;
+
+#if BLE_IOS_FW_UPDATE_ENABLED
+        case BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST:
+            on_fw_update(p_ios, p_ble_evt);
+            break;
+#endif
+
+        case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+            //the alert is out once the notifications queued up to it are, in order
+            if (p_ios->alert_ahead > 0)
+            {
+                if (p_ios->alert_ahead > p_ble_evt->evt.gatts_evt.params.hvn_tx_complete.count)
+                {
+                    p_ios->alert_ahead -= p_ble_evt->evt.gatts_evt.params.hvn_tx_complete.count;
+                }
+                else
+                {
+                    p_ios->alert_ahead = 0;
+                    if (p_ios->alert_handler != NULL)
+                        p_ios->alert_handler(BLE_IOS_ALERT_SENT);
+                }
+            }
+            //also wakes the main loop to queue more, the completions of another service's notifications
+            //on the link don't take the count below 0
+            if (nrf_atomic_u32_fetch_sub_hs(&p_ios->hvn_in_flight, p_ble_evt->evt.gatts_evt.params.hvn_tx_complete.count)
+                <= p_ble_evt->evt.gatts_evt.params.hvn_tx_complete.count)
+            {
+                (void) nrf_atomic_u32_store(&p_ios->hvn_in_flight, 0);
+                //the queue ran dry with more to send, the next connection event may go out short
+                if (p_ios->offload.active && p_ios->offload.stage != STAGE_DONE)
+                    p_ios->offload.underruns++;
+            }
+            break;
+
+        default:
+#if BLE_IOS_L2CAP_ENABLED
+            if (p_ble_evt->header.evt_id >= BLE_L2CAP_EVT_BASE && p_ble_evt->header.evt_id <= BLE_L2CAP_EVT_LAST)
+                on_l2cap_evt(p_ios, p_ble_evt);
+#endif
+            break;
+    }
+}
+
+/*
+ * Hands one notification to the SoftDevice and counts it while it is queued
+ * @return the error of sd_ble_gatts_hvx
+ */
+static uint32_t ios_notify(ble_ios_t *p_ios, uint16_t handle, uint8_t const *data, uint16_t length)
+{
+    ble_gatts_hvx_params_t hvx_params;
+    uint32_t err_code;
+
+    memset(&hvx_params, 0, sizeof(hvx_params));
+    hvx_params.type   = BLE_GATT_HVX_NOTIFICATION;
+    hvx_params.handle = handle;
+    hvx_params.p_data = data;
+    hvx_params.p_len  = &length;
+    err_code = sd_ble_gatts_hvx(p_ios->conn_handle, &hvx_params);
+    if (err_code == NRF_SUCCESS)
+        (void) nrf_atomic_u32_add(&p_ios->hvn_in_flight, 1);
+
+    return err_code;
+}
+
+/*
+ * Sends the pending alert if the SoftDevice has a tx buffer for it
+ * @return 0 if sent or still pending, -1 if the stack refused it
+ */
+static int8_t ios_alert_flush(ble_ios_t *p_ios)
+{
+    uint32_t err_code;
+
+    if (!p_ios->alert_pending)
+        return 0;
+
+    //no tx complete comes in between, the alert is counted queued before it is sent
+    CRITICAL_REGION_ENTER();
+    err_code = ios_notify(p_ios, p_ios->alert_handles.value_handle,
+                          (uint8_t const *) &p_ios->alert, sizeof(ble_ios_alert_t));
+    if (err_code == NRF_SUCCESS)
+    {
+        //the notifications ahead of it and itself
+        p_ios->alert_ahead = p_ios->hvn_in_flight;
+        if (p_ios->alert_handler != NULL)
+            p_ios->alert_handler(BLE_IOS_ALERT_QUEUED);
+    }
+    CRITICAL_REGION_EXIT();
+    if (err_code == NRF_ERROR_RESOURCES)
+        return 0; //retried after the next BLE_GATTS_EVT_HVN_TX_COMPLETE
+    p_ios->alert_pending = false;
+
+    return (err_code == NRF_SUCCESS) ? 0 : -1;
+}
+
+/*
+ * Adds the service with its data, control point and alert characteristics
+ * @param stats - served by the stats characteristic, NULL leaves it out
+ * @param exposure - served by the exposure characteristic, NULL leaves it out
+ * @param latency - served by the latency characteristic, NULL leaves it out
+ * @return NRF_SUCCESS or the error of the SoftDevice call
+ */
+uint32_t ble_ios_init(ble_ios_t *p_ios, event_store_t *store, pipeline_stats_t const *stats,
+                      exposure_stats_t const *exposure, latency_budget_stats_t const *latency)
+{
+    uint32_t err_code;
+    ble_uuid_t ble_uuid;
+    ble_uuid128_t base_uuid = {IOS_UUID_BASE};
+    ble_add_char_params_t add_char_params;
+
+    memset(p_ios, 0, sizeof(ble_ios_t));
+    p_ios->conn_handle = BLE_CONN_HANDLE_INVALID;
+    p_ios->max_data_len = BLE_GATT_ATT_MTU_DEFAULT - 3;
+    p_ios->offload.store = store;
+    p_ios->offload.piece = p_ios->offload.buffers[0];
+#if BLE_IOS_L2CAP_ENABLED
+    p_ios->l2cap.local_cid = BLE_L2CAP_CID_INVALID;
+#endif
+
+    err_code = sd_ble_uuid_vs_add(&base_uuid, &p_ios->uuid_type);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+
+    ble_uuid.type = p_ios->uuid_type;
+    ble_uuid.uuid = IOS_UUID_SERVICE;
+    err_code = sd_ble_gatts_service_add(BLE_GATTS_SRVC_TYPE_PRIMARY, &ble_uuid, &p_ios->service_handle);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+
+    memset(&add_char_params, 0, sizeof(add_char_params));
+    add_char_params.uuid              = IOS_UUID_DATA_CHAR;
+    add_char_params.uuid_type         = p_ios->uuid_type;
+    add_char_params.max_len           = BLE_IOS_MAX_DATA_LEN;
+    add_char_params.is_var_len        = true;
+    add_char_params.char_props.notify = 1;
+    add_char_params.cccd_write_access = SEC_OPEN;
+    err_code = characteristic_add(p_ios->service_handle, &add_char_params, &p_ios->data_handles);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+
+    memset(&add_char_params, 0, sizeof(add_char_params));
+    add_char_params.uuid                     = IOS_UUID_CTRL_CHAR;
+    add_char_params.uuid_type                = p_ios->uuid_type;
+    add_char_params.max_len                  = CTRL_MAX_LEN;
+    add_char_params.is_var_len               = true;
+    add_char_params.char_props.write         = 1;
+    add_char_params.char_props.write_wo_resp = 1;
+    add_char_params.write_access             = SEC_OPEN;
+    err_code = characteristic_add(p_ios->service_handle, &add_char_params, &p_ios->ctrl_handles);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+
+    memset(&add_char_params, 0, sizeof(add_char_params));
+    add_char_params.uuid              = IOS_UUID_ALERT_CHAR;
+    add_char_params.uuid_type         = p_ios->uuid_type;
+    add_char_params.init_len          = sizeof(ble_ios_alert_t);
+    add_char_params.max_len           = sizeof(ble_ios_alert_t);
+    add_char_params.char_props.read   = 1;
+    add_char_params.char_props.notify = 1;
+    add_char_params.read_access       = SEC_OPEN;
+    add_char_params.cccd_write_access = SEC_OPEN;
+    err_code = characteristic_add(p_ios->service_handle, &add_char_params, &p_ios->alert_handles);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+
+    if (stats != NULL)
+    {
+        //user memory, a read always sees the counters as they are now
+        memset(&add_char_params, 0, sizeof(add_char_params));
+        add_char_params.uuid              = IOS_UUID_STATS_CHAR;
+        add_char_params.uuid_type         = p_ios->uuid_type;
+        add_char_params.init_len          = sizeof(pipeline_stats_t);
+        add_char_params.max_len           = sizeof(pipeline_stats_t);
+        add_char_params.p_init_value      = (uint8_t *) stats;
+        add_char_params.is_value_user     = true;
+        add_char_params.char_props.read   = 1;
+        add_char_params.read_access       = SEC_OPEN;
+        err_code = characteristic_add(p_ios->service_handle, &add_char_params, &p_ios->stats_handles);
+        if (err_code != NRF_SUCCESS)
+            return err_code;
+    }
+    if (exposure != NULL)
+    {
+        //user memory as well, one read of up to the ATT MTU takes both sets
+        memset(&add_char_params, 0, sizeof(add_char_params));
+        add_char_params.uuid              = IOS_UUID_EXPOSURE_CHAR;
+        add_char_params.uuid_type         = p_ios->uuid_type;
+        add_char_params.init_len          = sizeof(exposure_stats_t);
+        add_char_params.max_len           = sizeof(exposure_stats_t);
+        add_char_params.p_init_value      = (uint8_t *) exposure;
+        add_char_params.is_value_user     = true;
+        add_char_params.char_props.read   = 1;
+        add_char_params.read_access       = SEC_OPEN;
+        err_code = characteristic_add(p_ios->service_handle, &add_char_params, &p_ios->exposure_handles);
+        if (err_code != NRF_SUCCESS)
+            return err_code;
+    }
+    if (latency != NULL)
+    {
+        memset(&add_char_params, 0, sizeof(add_char_params));
+        add_char_params.uuid              = IOS_UUID_LATENCY_CHAR;
+        add_char_params.uuid_type         = p_ios->uuid_type;
+        add_char_params.init_len          = sizeof(latency_budget_stats_t);
+        add_char_params.max_len           = sizeof(latency_budget_stats_t);
+        add_char_params.p_init_value      = (uint8_t *) latency;
+        add_char_params.is_value_user     = true;
+        add_char_params.char_props.read   = 1;
+        add_char_params.read_access       = SEC_OPEN;
+        err_code = characteristic_add(p_ios->service_handle, &add_char_params, &p_ios->latency_handles);
+        if (err_code != NRF_SUCCESS)
+            return err_code;
+    }
+#if BLE_IOS_FW_UPDATE_ENABLED
+    //both ways go through on_fw_update, a write is answered with the stage's result and a read with its status
+    memset(&add_char_params, 0, sizeof(add_char_params));
+    add_char_params.uuid                = IOS_UUID_FW_UPDATE_CHAR;
+    add_char_params.uuid_type           = p_ios->uuid_type;
+    add_char_params.max_len             = BLE_IOS_MAX_DATA_LEN;
+    add_char_params.is_var_len          = true;
+    add_char_params.is_defered_read     = true;
+    add_char_params.is_defered_write    = true;
+    add_char_params.char_props.read     = 1;
+    add_char_params.char_props.write    = 1;
+    add_char_params.read_access         = SEC_OPEN;
+    add_char_params.write_access        = SEC_OPEN;
+    err_code = characteristic_add(p_ios->service_handle, &add_char_params, &p_ios->fw_update_handles);
+#endif
+
+    return err_code;
+}
+
+/*
+ * Starts the frame stream over from its first frame
+ */
+static void ios_offload_rewind(ble_ios_t *p_ios)
+{
+    ble_ios_offload_t *p_offload = &p_ios->offload;
+
+    p_offload->num_sent = 0;
+    p_offload->stage = STAGE_EVENT_BEGIN;
+    p_offload->piece_len = 0;
+    p_offload->piece_pos = 0;
+    p_offload->tx_len = 0;
+    p_offload->notifications = 0;
+    p_offload->underruns = 0;
+    //a read ahead still queued is waited on before its buffer is used, it just never matches
+    p_offload->ahead_count = 0;
+    p_offload->ahead_hits = 0;
+#if BLE_IOS_L2CAP_ENABLED
+    p_offload->l2cap = p_ios->l2cap.local_cid != BLE_L2CAP_CID_INVALID;
+    p_ios->l2cap.sdu_len = 0;
+#endif
+#if BLE_IOS_ESB_ENABLED
+    p_offload->esb = false;
+#endif
+    p_offload->active = true;
+}
+
+/*
+ * Starts streaming the events from first_id up to the ones stored now,
+ * restarts from first_id if an offload is already running. Thread context only,
+ * a START written to the control point is started by ble_ios_offload_process.
+ * The offload goes over the L2CAP channel if the gateway has opened one. Events
+ * the store has reclaimed are skipped
+ */
+void ble_ios_offload_start(ble_ios_t *p_ios, uint32_t first_id)
+{
+    ble_ios_offload_t *p_offload = &p_ios->offload;
+
+    p_offload->next_id = MAX(first_id, event_store_oldest(p_offload->store));
+    p_offload->end_id = event_store_count(p_offload->store);
+    p_offload->summaries = false;
+    ios_offload_rewind(p_ios);
+}
+
+/*
+ * Starts streaming a summary frame for each event stored from from_s up to
+ * to_s with a peak of at least min_peak_g_x10, then an end frame with their
+ * count. Replaces a running offload, thread context only like
+ * ble_ios_offload_start
+ * @return 0 if success otherwise -1
+ */
+int8_t ble_ios_query_start(ble_ios_t *p_ios, uint32_t from_s, uint32_t to_s, uint16_t min_peak_g_x10)
+{
+    ble_ios_offload_t *p_offload = &p_ios->offload;
+    int8_t ret;
+
+    p_offload->active = false;
+    ret = event_store_query_init(p_offload->store, &p_offload->query, from_s, to_s, min_peak_g_x10);
+    if (ret < 0)
+        return ret;
+    p_offload->summaries = true;
+    ios_offload_rewind(p_ios);
+
+    return 0;
+}
+
+void ble_ios_offload_stop(ble_ios_t *p_ios)
+{
+    p_ios->offload.active = false;
+#if BLE_IOS_ESB_ENABLED
+    p_ios->offload.esb = false;
+#endif
+}
+
+/*
+ * @return true while ble_ios_offload_process has flash work: an offload or a query, or an ack to store,
+ * and for an ESB offload until the app stops it, the gateway's acks come in after the last payload is queued
+ */
+bool ble_ios_offload_active(ble_ios_t const *p_ios)
+{
+    return p_ios->offload.active || p_ios->offload.start_pending || p_ios->offload.query_pending
+        || p_ios->ack_pending || ios_offload_on_esb(p_ios);
+}
+
+/*
+ * Counts of the notification offload running or last run
+ * @param p_notifications - data notifications the SoftDevice took
+ * @param p_underruns - times its tx queue ran empty with more to send, a
+ * connection event that was not filled. Near 0 the offload runs at the link's rate
+ * @param p_read_ahead - sample pieces the flash had read ahead, the others were
+ * read when they were built
+ */
+void ble_ios_offload_stats(ble_ios_t const *p_ios, uint32_t *p_notifications, uint32_t *p_underruns,
+                           uint32_t *p_read_ahead)
+{
+    *p_notifications = p_ios->offload.notifications;
+    *p_underruns = p_ios->offload.underruns;
+    *p_read_ahead = p_ios->offload.ahead_hits;
+}
+
+/*
+ * Stores the last ack the central wrote
+ * @return 0 if success or the ack was out of range, -1 on spi error
+ */
+static int8_t ios_ack_flush(ble_ios_t *p_ios)
+{
+    uint32_t count;
+    int8_t ret;
+
+    if (!p_ios->ack_pending)
+        return 0;
+
+    CRITICAL_REGION_ENTER();
+    count = p_ios->ack_count;
+    p_ios->ack_pending = false;
+    CRITICAL_REGION_EXIT();
+    ret = event_store_ack(p_ios->offload.store, count);
+    if (event_store_acked(p_ios->offload.store) == event_store_count(p_ios->offload.store))
+        p_ios->unsynced_peak_g_x10 = 0;
+
+    return (ret == -1) ? ret : 0;
+}
+
+/*
+ * Takes the time the central wrote with BLE_IOS_CMD_SET_TIME, call from the main loop
+ * @return true once per command
+ */
+bool ble_ios_time_get(ble_ios_t *p_ios, uint32_t *p_epoch, uint8_t *p_hundreth)
+{
+    bool pending;
+
+    CRITICAL_REGION_ENTER();
+    pending = p_ios->time_pending;
+    *p_epoch = p_ios->time_epoch;
+    *p_hundreth = p_ios->time_hundreth;
+    p_ios->time_pending = false;
+    CRITICAL_REGION_EXIT();
+    return pending;
+}
+
+/*
+ * Takes the sampling profile the central wrote with BLE_IOS_CMD_PROFILE, call from the main loop
+ * @return true once per command
+ */
+bool ble_ios_profile_get(ble_ios_t *p_ios, uint8_t *p_id)
+{
+    bool pending;
+
+    CRITICAL_REGION_ENTER();
+    pending = p_ios->profile_pending;
+    *p_id = p_ios->profile_id;
+    p_ios->profile_pending = false;
+    CRITICAL_REGION_EXIT();
+    return pending;
+}
+
+/*
+ * Takes the live stream rate the central wrote with BLE_IOS_CMD_STREAM, or the
+ * 0 of a disconnect, call from the main loop
+ * @return true once per command
+ */
+bool ble_ios_stream_get(ble_ios_t *p_ios, uint16_t *p_rate_hz)
+{
+    bool pending;
+
+    CRITICAL_REGION_ENTER();
+    pending = p_ios->stream_pending;
+    *p_rate_hz = p_ios->stream_rate_hz;
+    p_ios->stream_pending = false;
+    CRITICAL_REGION_EXIT();
+    return pending;
+}
+
+/*
+ * Notifies a whole frame on the data characteristic, cut to the ATT MTU like
+ * the offload. Thread context, call again with the same frame until it is
+ * all queued. A frame is not started while an offload runs or an alert
+ * waits, and one tx buffer is kept free for the alert like the offload does
+ * @return 0 once the frame is queued, -1 if the stack refused a notification,
+ * -2 if the frame can't go out (no central listens or an offload runs) and
+ * should be dropped, -3 if the tx buffers are taken, try again later
+ */
+int8_t ble_ios_live_send(ble_ios_t *p_ios, uint8_t const *frame, uint16_t length)
+{
+    uint32_t err_code;
+    uint16_t chunk;
+
+    if (p_ios->conn_handle == BLE_CONN_HANDLE_INVALID || !p_ios->notify_enabled)
+    {
+        p_ios->live_pos = 0;
+        return -2;
+    }
+    if (p_ios->live_pos == 0 && ble_ios_offload_active(p_ios))
+        return -2;
+
+    while (p_ios->live_pos < length)
+    {
+        if (p_ios->alert_pending || p_ios->hvn_in_flight >= BLE_IOS_HVN_TX_QUEUE_SIZE - 1)
+            return -3; //resumed after the next BLE_GATTS_EVT_HVN_TX_COMPLETE
+        chunk = MIN(length - p_ios->live_pos, p_ios->max_data_len);
+        err_code = ios_notify(p_ios, p_ios->data_handles.value_handle, &frame[p_ios->live_pos], chunk);
+        if (err_code == NRF_ERROR_RESOURCES)
+            return -3;
+        if (err_code != NRF_SUCCESS)
+        {
+            p_ios->live_pos = 0;
+            return -1;
+        }
+        p_ios->live_pos += chunk;
+    }
+    p_ios->live_pos = 0;
+
+    return 0;
+}
+
+/*
+ * @return true while a frame given to ble_ios_live_send() is partly queued,
+ * another one can't start before it is done
+ */
+bool ble_ios_live_busy(ble_ios_t const *p_ios)
+{
+    return p_ios->live_pos != 0;
+}
+
+/*
+ * Takes the start of a read of the activity log the central wrote with
+ * BLE_IOS_CMD_ACTIVITY, call from the main loop
+ * @return true once per command
+ */
+bool ble_ios_activity_get(ble_ios_t *p_ios, uint32_t *p_from_s)
+{
+    bool pending;
+
+    CRITICAL_REGION_ENTER();
+    pending = p_ios->activity_pending;
+    *p_from_s = p_ios->activity_from_s;
+    p_ios->activity_pending = false;
+    CRITICAL_REGION_EXIT();
+    return pending;
+}
+
+/*
+ * Takes a BLE_IOS_CMD_SESSION, call from the main loop
+ * @return true once per command
+ */
+bool ble_ios_session_get(ble_ios_t *p_ios)
+{
+    bool pending;
+
+    CRITICAL_REGION_ENTER();
+    pending = p_ios->session_pending;
+    p_ios->session_pending = false;
+    CRITICAL_REGION_EXIT();
+    return pending;
+}
+
+#if BLE_IOS_ESB_ENABLED
+/*
+ * Takes an offload over ESB the central asked for with BLE_IOS_CMD_ESB, call
+ * from the main loop
+ * @param p_first_id - BLE_IOS_RESUME_ID if the command had no id
+ * @return true once per command
+ */
+bool ble_ios_esb_get(ble_ios_t *p_ios, uint32_t *p_first_id)
+{
+    bool pending;
+
+    CRITICAL_REGION_ENTER();
+    pending = p_ios->esb_pending;
+    *p_first_id = p_ios->esb_start_id;
+    p_ios->esb_pending = false;
+    CRITICAL_REGION_EXIT();
+    return pending;
+}
+
+/*
+ * Starts streaming the events from first_id over the ESB session the app has
+ * started as its PTX, like ble_ios_offload_start. Thread context only
+ * @param first_id - BLE_IOS_RESUME_ID to resume at the ack watermark
+ */
+void ble_ios_esb_offload_start(ble_ios_t *p_ios, uint32_t first_id)
+{
+    ble_ios_offload_start(p_ios, (first_id == BLE_IOS_RESUME_ID) ?
+                                 event_store_acked(p_ios->offload.store) : first_id);
+    p_ios->offload.esb = true;
+}
+
+/*
+ * @return id + 1 of the last event whose frame is all in the payloads queued
+ */
+static uint32_t ios_esb_whole(ble_ios_offload_t const *p_offload)
+{
+    //the crc that closes next_id - 1 is still in the piece
+    if (p_offload->stage == STAGE_EVENT_BEGIN && p_offload->piece_pos < p_offload->piece_len)
+        return p_offload->next_id - 1;
+    return p_offload->next_id;
+}
+
+/*
+ * Stores the last event the gateway acked as the watermark, then queues
+ * payloads until the ESB queue is full, the empty one after the end frame
+ * @return as ble_ios_offload_process
+ */
+static int8_t ios_esb_process(ble_ios_t *p_ios)
+{
+    ble_ios_offload_t *p_offload = &p_ios->offload;
+    uint8_t data[ESB_OFFLOAD_DATA_SIZE];
+    uint16_t length;
+    uint32_t acked;
+    int8_t ret;
+
+    if (esb_offload_tx_acked(&acked) && acked > event_store_acked(p_offload->store))
+    {
+        ret = event_store_ack(p_offload->store, acked);
+        if (ret == -1)
+            return ret;
+        if (event_store_acked(p_offload->store) == event_store_count(p_offload->store))
+            p_ios->unsynced_peak_g_x10 = 0;
+    }
+
+    while (p_offload->active && esb_offload_tx_space() > 0)
+    {
+        length = 0;
+        ret = ios_fill(p_offload, data, &length, sizeof(data));
+        if (ret < 0)
+        {
+            p_offload->active = false;
+            return ret;
+        }
+        //an empty payload ends the session, the scan goes on in the next pass
+        if (ret == 1 && length == 0)
+            break;
+        if (esb_offload_tx_queue(data, length, ios_esb_whole(p_offload)) < 0)
+        {
+            p_offload->active = false;
+            return -1;
+        }
+        //the empty payload after the end frame is queued
+        if (length == 0)
+            p_offload->active = false;
+    }
+
+    return 0;
+}
+#endif
+
+#if BLE_IOS_L2CAP_ENABLED
+/*
+ * Queues SDUs on the L2CAP channel until the SoftDevice runs out of SDU
+ * buffers. A new one is only read from the flash once the peer has the
+ * credits for it, or nothing is queued to wait on
+ * @return as ble_ios_offload_process
+ */
+static int8_t ios_l2cap_process(ble_ios_t *p_ios)
+{
+    ble_ios_offload_t *p_offload = &p_ios->offload;
+    ble_ios_l2cap_t *p_l2cap = &p_ios->l2cap;
+    ble_data_t sdu;
+    uint16_t credits;
+    uint32_t err_code;
+    int8_t ret;
+
+    //let a waiting alert go first, it takes a link layer buffer as well
+    while (p_offload->active && !p_ios->alert_pending && p_l2cap->sdu_in_flight < BLE_IOS_L2CAP_TX_QUEUE_SIZE)
+    {
+        if (p_l2cap->sdu_len == 0)
+        {
+            if (p_l2cap->sdu_in_flight > 0 && p_l2cap->credits < ios_l2cap_credits(p_l2cap, p_l2cap->tx_mtu))
+                break; //resumed after the next BLE_L2CAP_EVT_CH_CREDIT or BLE_L2CAP_EVT_CH_TX
+            ret = ios_fill(p_offload, p_l2cap->sdu[p_l2cap->next_sdu], &p_l2cap->sdu_len, p_l2cap->tx_mtu);
+            if (ret < 0)
+            {
+                p_offload->active = false;
+                return ret;
+            }
+            if (ret == 1 && p_l2cap->sdu_len == 0)
+                break; //the query scan goes on in the next pass
+            if (p_l2cap->sdu_len == 0)
+            {
+                //the end frame is out
+                p_offload->active = false;
+                break;
+            }
+        }
+
+        sdu.p_data = p_l2cap->sdu[p_l2cap->next_sdu];
+        sdu.len = p_l2cap->sdu_len;
+        err_code = sd_ble_l2cap_ch_tx(p_ios->conn_handle, p_l2cap->local_cid, &sdu);
+        if (err_code == NRF_ERROR_RESOURCES)
+            break; //queue full, resumed after the next BLE_L2CAP_EVT_CH_TX
+        if (err_code != NRF_SUCCESS)
+        {
+            p_offload->active = false;
+            return -1;
+        }
+        credits = ios_l2cap_credits(p_l2cap, p_l2cap->sdu_len);
+        CRITICAL_REGION_ENTER();
+        p_l2cap->sdu_in_flight++;
+        p_l2cap->credits = (p_l2cap->credits > credits) ? p_l2cap->credits - credits : 0;
+        CRITICAL_REGION_EXIT();
+        p_l2cap->next_sdu = (p_l2cap->next_sdu + 1) % BLE_IOS_L2CAP_TX_QUEUE_SIZE;
+        p_l2cap->sdu_len = 0;
+    }
+
+    return 0;
+}
+#endif
+
+/*
+ * Queues notifications until the SoftDevice runs out of tx buffers. Call from
+ * the main loop, it returns straight away when there is nothing to send
+ * @return 0 if success, -1 on spi error or if the stack refused a notification,
+ * -2 or -3 if an event could not be read, the offload is stopped on any error
+ * but an ack that could not be stored
+ */
+int8_t ble_ios_offload_process(ble_ios_t *p_ios)
+{
+    ble_ios_offload_t *p_offload = &p_ios->offload;
+    uint32_t err_code;
+    int8_t ret;
+
+    ret = ios_alert_flush(p_ios);
+    if (ret < 0)
+        return ret;
+
+    ret = ios_ack_flush(p_ios);
+    if (ret < 0)
+        return ret;
+
+    if (p_offload->start_pending)
+    {
+        p_offload->start_pending = false;
+        ble_ios_offload_start(p_ios, (p_offload->start_id == BLE_IOS_RESUME_ID) ?
+                                     event_store_acked(p_offload->store) : p_offload->start_id);
+    }
+    if (p_offload->query_pending)
+    {
+        p_offload->query_pending = false;
+        ret = ble_ios_query_start(p_ios, p_offload->query_from_s, p_offload->query_to_s, p_offload->query_min_peak);
+        if (ret < 0)
+            return ret;
+    }
+#if BLE_IOS_ESB_ENABLED
+    if (p_offload->esb)
+        return ios_esb_process(p_ios);
+#endif
+#if BLE_IOS_L2CAP_ENABLED
+    if (p_offload->l2cap)
+        return ios_l2cap_process(p_ios);
+#endif
+
+    //keep a tx buffer free for an alert and let a waiting one go first, after a live frame being sent
+    while (p_offload->active && p_ios->notify_enabled && !p_ios->alert_pending && p_ios->live_pos == 0)
+    {
+        //built before the queue is checked, with the queue full it is the read ahead of the next completion
+        if (p_offload->tx_len == 0)
+        {
+            ret = ios_fill(p_offload, p_offload->tx, &p_offload->tx_len, p_ios->max_data_len);
+            if (ret < 0)
+            {
+                p_offload->active = false;
+                return ret;
+            }
+            if (ret == 1 && p_offload->tx_len == 0)
+                break; //the query scan goes on in the next pass
+            if (p_offload->tx_len == 0)
+            {
+                //the end frame is out
+                p_offload->active = false;
+                break;
+            }
+        }
+        if (p_ios->hvn_in_flight >= BLE_IOS_HVN_TX_QUEUE_SIZE - 1)
+            break;
+
+        err_code = ios_notify(p_ios, p_ios->data_handles.value_handle, p_offload->tx, p_offload->tx_len);
+        if (err_code == NRF_ERROR_RESOURCES)
+            break; //queue full, resumed after the next BLE_GATTS_EVT_HVN_TX_COMPLETE
+        if (err_code != NRF_SUCCESS)
+        {
+            p_offload->active = false;
+            return -1;
+        }
+        p_offload->tx_len = 0;
+        p_offload->notifications++;
+    }
+
+    return 0;
+}
+
+/*
+ * Notifies the summary of an event that has just been stored. Thread context,
+ * it goes out in the next connection event ahead of any queued offload. The
+ * value is also kept for a central that reads the characteristic
+ * @return 0 if sent or queued, -1 on stack error, -2 if no central listens
+ */
+int8_t ble_ios_alert_send(ble_ios_t *p_ios, ble_ios_alert_t const *p_alert)
+{
+    ble_gatts_value_t value;
+
+    if (p_alert->event_id >= event_store_acked(p_ios->offload.store))
+        p_ios->unsynced_peak_g_x10 = MAX(p_ios->unsynced_peak_g_x10, p_alert->peak_g_x10);
+
+    memset(&value, 0, sizeof(value));
+    value.len     = sizeof(ble_ios_alert_t);
+    value.p_value = (uint8_t *) p_alert;
+    if (sd_ble_gatts_value_set(BLE_CONN_HANDLE_INVALID, p_ios->alert_handles.value_handle, &value) != NRF_SUCCESS)
+        return -1;
+
+    if (p_ios->conn_handle == BLE_CONN_HANDLE_INVALID || !p_ios->alert_enabled)
+        return -2;
+
+    memcpy(&p_ios->alert, p_alert, sizeof(ble_ios_alert_t));
+    p_ios->alert_pending = true;
+
+    return ios_alert_flush(p_ios);
+}
+
+/*
+ * Sets the handler called as an alert is queued and sent, from the context
+ * of ble_ios_alert_send(), ble_ios_offload_process() or the BLE events
+ */
+void ble_ios_alert_handler_set(ble_ios_t *p_ios, ble_ios_alert_handler_t handler)
+{
+    p_ios->alert_handler = handler;
+}
+
+/*
+ * Builds the advertised summary, from RAM only so the app can call it every
+ * main loop and update the advertising data when it changes
+ * @param battery - percent or BLE_IOS_ADV_BATTERY_UNKNOWN
+ */
+void ble_ios_adv_summary_get(ble_ios_t const *p_ios, uint8_t battery, ble_ios_adv_summary_t *p_summary)
+{
+    uint32_t count = event_store_count(p_ios->offload.store) - event_store_acked(p_ios->offload.store);
+
+    p_summary->battery = battery;
+    p_summary->flags = (count > 0) ? BLE_IOS_ADV_FLAG_UNSYNCED : 0;
+    p_summary->impact_count = (uint16_t) MIN(count, UINT16_MAX);
+    p_summary->peak_g_x10 = (count > 0) ? p_ios->unsynced_peak_g_x10 : 0;
+}
+
@@ -0,0 +1,331 @@
+#ifndef BLE_IOS_H
+#define BLE_IOS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ble.h"
+#include "ble_srv_common.h"
+#include "nrf_sdh_ble.h"
+#include "nrf_atomic.h"
+#include "event_store.h"
+#include "pipeline_stats.h"
+#include "exposure_stats.h"
+#include "latency_budget.h"
+#ifndef BLE_IOS_ESB_ENABLED
+#define BLE_IOS_ESB_ENABLED         0
+#endif
+#if BLE_IOS_ESB_ENABLED
+#include "esb_offload.h"
+#endif
+#ifndef BLE_IOS_FW_UPDATE_ENABLED
+#define BLE_IOS_FW_UPDATE_ENABLED   0
+#endif
+#if BLE_IOS_FW_UPDATE_ENABLED
+#include "fw_stage.h"
+#endif
+
+/* Impact Offload Service, streams the stored events to a central as back to
+ * back notifications. The data characteristic carries the same frame byte
+ * stream as the binary serial offload (see serial_offload.h), cut into
+ * notifications of up to the negotiated ATT MTU - 3, so tools/offload_decode
+ * reads a capture of either. The central writes the control point
+ *   BLE_IOS_CMD_START [uint32 first event id, the ack watermark if left out]
+ *   BLE_IOS_CMD_STOP
+ *   BLE_IOS_CMD_SET_TIME uint32 seconds since 1970-01-01 UTC [uint8 hundredths]
+ *   BLE_IOS_CMD_ACK uint32 id + 1 of the last event received whole
+ *   BLE_IOS_CMD_QUERY uint32 from, uint32 to seconds [uint16 min peak in 0.1 g]
+ *   BLE_IOS_CMD_PROFILE uint8 sampling profile of the app
+ *   BLE_IOS_CMD_STREAM uint16 live stream rate in Hz, 0 stops it
+ *   BLE_IOS_CMD_ACTIVITY [uint32 from seconds, the whole activity log if left out]
+ *   BLE_IOS_CMD_SESSION, a new exposure session
+ *   BLE_IOS_CMD_ESB [uint32 first event id], an offload over ESB
+ * and an end frame closes every complete offload. A QUERY streams a summary
+ * frame, the event header and its preview without the samples, under 100
+ * bytes so a few go in each notification, for each event stored from
+ * the first time up to the second with at least the peak, found through
+ * event_store_query_init so only the headers in the range are read; the end
+ * frame counts them and the central STARTs from an id to fetch the samples. An ack moves the
+ * offloaded up to watermark of the event store (event_store_ack) and a START
+ * without an id resumes there, so a gateway that acks each event frame once
+ * its crc checks picks up after a disconnect where the link dropped it. The clock set is handed to
+ * the app through ble_ios_time_get(), it writes the rtc in thread context, and
+ * a profile through ble_ios_profile_get(), the service does not check the id,
+ * and a stream rate through ble_ios_stream_get(), a disconnect hands over a 0.
+ * ble_ios_live_send() puts the app's live frames (see live_stream.h) on the
+ * data characteristic between offloads, a frame is only ever whole in the
+ * byte stream so the decoder tells both apart by their type. The app reads
+ * the activity log after ble_ios_activity_get() and sends its pages the same
+ * way, one frame at a time, ble_ios_live_busy() tells it a frame is half out. The alert characteristic
+ * notifies a ble_ios_alert_t as soon as an event is stored, ahead of the bulk
+ * stream: the stream always leaves one SoftDevice tx buffer free and stops
+ * queueing while an alert waits, so an alert is at most a few packets behind.
+ * The stats characteristic reads the app's pipeline_stats_t straight from ram,
+ * the exposure characteristic its exposure_stats_t the same way, and a SESSION
+ * is handed to the app through ble_ios_session_get() to clear the session set.
+ * The latency characteristic serves the app's latency_budget_stats_t as well,
+ * the service calls the app's ble_ios_alert_handler_t as an alert is handed to
+ * the SoftDevice and again at the tx complete of the notifications queued
+ * up to it, so the app times the alert to the air.
+ * Built with BLE_IOS_L2CAP_ENABLED 1 a gateway can also open an LE credit
+ * based L2CAP channel on BLE_IOS_L2CAP_PSM before it writes START: the same
+ * byte stream then goes out as SDUs of up to the channel MTU, without the
+ * ATT header of every notification, and only as far ahead of the peer's
+ * credits as one SDU so the flash is read when it can be sent. A gateway that
+ * cannot open the channel, or whose request is refused, gets the notifications.
+ * The app adds a BLE_CONN_CFG_L2CAP with ch_count 1, rx_mps BLE_L2CAP_MPS_MIN,
+ * tx_mps BLE_IOS_L2CAP_MPS and tx_queue_size BLE_IOS_L2CAP_TX_QUEUE_SIZE.
+ * Built with BLE_IOS_ESB_ENABLED 1 an ESB command is handed to the app through
+ * ble_ios_esb_get(), the app drops the link, starts the radio session
+ * (esb_offload.h) and ble_ios_esb_offload_start(): the same byte stream then
+ * goes out in ESB payloads from ble_ios_offload_process, a disconnect does
+ * not stop it, and the stream ends with an empty payload. The id + 1 of the
+ * last event whose frame the gateway acked on the radio is stored as the ack
+ * watermark, so the next offload resumes after it.
+ * The app advertises a ble_ios_adv_summary_t as manufacturer specific data
+ * of BLE_IOS_ADV_COMPANY_ID so a scanner follows every helmet in range
+ * without connecting: the events past the ack watermark and the highest
+ * alert peak among them, ble_ios_adv_summary_get() builds it from RAM.
+ * Built with BLE_IOS_FW_UPDATE_ENABLED 1 the update characteristic stages a
+ * firmware update in the background (fw_stage.h), written with response:
+ *   BLE_IOS_FW_BEGIN uint16 init packet size, uint32 image size, uint32 image crc32
+ *   BLE_IOS_FW_INIT uint16 offset, init packet bytes
+ *   BLE_IOS_FW_DATA uint32 offset, up to FW_STAGE_CHUNK_SIZE image bytes
+ *   BLE_IOS_FW_COMMIT, BLE_IOS_FW_SWAP, BLE_IOS_FW_ABORT
+ * each answered from the BLE event with the stage's result: a write the
+ * flash is not ready for gets BLE_IOS_FW_STATUS_BUSY and is sent again, so
+ * the central goes at the pace of the flash, any other refusal
+ * BLE_IOS_FW_STATUS_REFUSED. A read returns the fw_stage_status_t, a central
+ * that lost the link sends the image on from its offset. The swap waits for
+ * the app to be idle */
+#define BLE_IOS_DEF(_name)                                                      \
+static ble_ios_t _name;                                                         \
+NRF_SDH_BLE_OBSERVER(_name ## _obs,                                             \
+                     BLE_IOS_BLE_OBSERVER_PRIO,                                 \
+                     ble_ios_on_ble_evt, &_name)
+
+#ifndef BLE_IOS_BLE_OBSERVER_PRIO
+#define BLE_IOS_BLE_OBSERVER_PRIO   2
+#endif
+
+#define IOS_UUID_BASE               {0x6B, 0x3A, 0x1F, 0x52, 0x90, 0x4C, 0x2E, 0x8D, \
+                                     0x47, 0x41, 0xC9, 0x30, 0x00, 0x00, 0x7E, 0x48}
+#define IOS_UUID_SERVICE            0x1600
+#define IOS_UUID_DATA_CHAR          0x1601
+#define IOS_UUID_CTRL_CHAR          0x1602
+#define IOS_UUID_ALERT_CHAR         0x1603
+#define IOS_UUID_STATS_CHAR         0x1604
+#define IOS_UUID_EXPOSURE_CHAR      0x1605
+#define IOS_UUID_LATENCY_CHAR       0x1606
+#define IOS_UUID_FW_UPDATE_CHAR     0x1607
+
+#define BLE_IOS_CMD_START           0x01
+#define BLE_IOS_CMD_STOP            0x02
+#define BLE_IOS_CMD_SET_TIME        0x03
+#define BLE_IOS_CMD_ACK             0x04
+#define BLE_IOS_CMD_QUERY           0x05
+#define BLE_IOS_CMD_PROFILE         0x06
+#define BLE_IOS_CMD_STREAM          0x07
+#define BLE_IOS_CMD_ACTIVITY        0x08
+#define BLE_IOS_CMD_SESSION         0x09
+#define BLE_IOS_CMD_ESB             0x0A
+
+#define BLE_IOS_FW_BEGIN            0x01
+#define BLE_IOS_FW_INIT             0x02
+#define BLE_IOS_FW_DATA             0x03
+#define BLE_IOS_FW_COMMIT           0x04
+#define BLE_IOS_FW_SWAP             0x05
+#define BLE_IOS_FW_ABORT            0x06
+#define BLE_IOS_FW_STATUS_BUSY      (BLE_GATT_STATUS_ATTERR_APP_BEGIN + 0) //ATT error 0x80, write it again
+#define BLE_IOS_FW_STATUS_REFUSED   (BLE_GATT_STATUS_ATTERR_APP_BEGIN + 1) //0x81, out of order or no stage for it
+
+#define BLE_IOS_RESUME_ID           0xFFFFFFFF //start_id of a START without an id
+
+#define BLE_IOS_ADV_COMPANY_ID      0xFFFF //reserved by the Bluetooth SIG for tests, none is assigned
+#define BLE_IOS_ADV_BATTERY_UNKNOWN 0xFF
+#define BLE_IOS_ADV_FLAG_UNSYNCED   0x01 //events are stored past the ack watermark
+
+#define BLE_IOS_MAX_DATA_LEN        (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3) //att opcode and handle
+#define BLE_IOS_PIECE_SIZE          240 //bytes read from the flash at a time
+#ifndef BLE_IOS_HVN_TX_QUEUE_SIZE
+#define BLE_IOS_HVN_TX_QUEUE_SIZE   8 //the hvn_tx_queue_size the app configures, one is kept for the alerts
+#endif
+#if BLE_IOS_HVN_TX_QUEUE_SIZE < 2
+#error "BLE_IOS_HVN_TX_QUEUE_SIZE leaves no notification for the offload"
+#endif
+
+#ifndef BLE_IOS_L2CAP_ENABLED
+#define BLE_IOS_L2CAP_ENABLED       0
+#endif
+#define BLE_IOS_L2CAP_PSM           0x0081 //LE_PSM of the offload channel, dynamic range
+#define BLE_IOS_L2CAP_MPS           (NRF_SDH_BLE_GAP_DATA_LENGTH - 4) //one PDU per link layer packet
+#define BLE_IOS_L2CAP_SDU_SIZE      1024 //largest SDU sent, the peer's MTU can cap it
+#define BLE_IOS_L2CAP_TX_QUEUE_SIZE 3    //SDU buffers, the tx_queue_size the app configures
+
+/* Summary of one stored event, 16 bytes so it fits the default 23 byte MTU */
+typedef struct {
+    uint32_t event_id;
+    event_store_time_t time;
+    uint16_t peak_g_x10;    //peak resultant adxl372 acceleration in 0.1 g
+    uint16_t duration_ms;
+} ble_ios_alert_t;
+
+typedef enum {
+    BLE_IOS_ALERT_QUEUED = 0,   //handed to the SoftDevice
+    BLE_IOS_ALERT_SENT          //its BLE_GATTS_EVT_HVN_TX_COMPLETE
+} ble_ios_alert_evt_t;
+
+typedef void (*ble_ios_alert_handler_t)(ble_ios_alert_evt_t evt);
+
+/* Advertised summary, 6 bytes after the company id so the advertising data
+ * still fits the name and the flags */
+typedef struct {
+    uint8_t battery;        //percent or BLE_IOS_ADV_BATTERY_UNKNOWN
+    uint8_t flags;          //BLE_IOS_ADV_FLAG_*
+    uint16_t impact_count;  //events past the ack watermark, saturates
+    uint16_t peak_g_x10;    //highest alert peak of those sent since the reset, 0 if unknown
+} ble_ios_adv_summary_t;
+
+typedef struct {
+    event_store_t *store;
+    volatile bool start_pending; //written by the control point, started in thread context
+    uint32_t start_id;
+    volatile bool query_pending; //written by the control point, started in thread context
+    uint32_t query_from_s;
+    uint32_t query_to_s;
+    uint16_t query_min_peak;
+    volatile bool active;
+    bool summaries;         //the stream is the summaries of query, not whole events
+    event_store_query_t query;
+    uint8_t stage;
+    uint32_t next_id;       //event being framed
+    uint32_t end_id;        //event count when the offload started
+    uint32_t num_sent;
+    uint32_t sample_count;  //of the event being framed
+    uint16_t sample_size;
+    uint32_t next_sample;
+    uint32_t crc;           //of the frame being built
+    uint8_t *piece;         //one of buffers, the other one takes the read ahead
+    uint8_t buffers[2][BLE_IOS_PIECE_SIZE];
+    uint16_t piece_len;
+    uint16_t piece_pos;
+    mt25ql256aba_read_xfer_t ahead_read;
+    volatile uint8_t ahead_state; //of the read ahead, written by its callback
+    uint32_t ahead_id;      //event, first sample and sample count of the read ahead
+    uint32_t ahead_sample;
+    uint32_t ahead_count;
+    uint32_t ahead_hits;    //sample pieces the read ahead had ready since the start
+    uint8_t tx[BLE_IOS_MAX_DATA_LEN];
+    uint16_t tx_len;        //a notification the stack has not taken yet if non zero, or the next one read ahead
+    uint32_t notifications; //data notifications queued since the start
+    uint32_t underruns;     //completions that left the tx queue empty with more to send
+#if BLE_IOS_L2CAP_ENABLED
+    bool l2cap;             //the offload goes over the L2CAP channel, chosen at the start
+#endif
+#if BLE_IOS_ESB_ENABLED
+    bool esb;               //the offload goes over ESB, after ble_ios_esb_offload_start
+#endif
+} ble_ios_offload_t;
+
+#if BLE_IOS_L2CAP_ENABLED
+typedef struct {
+    uint16_t local_cid;     //BLE_L2CAP_CID_INVALID while no channel is set up
+    uint16_t tx_mtu;        //SDU size, the peer's MTU up to BLE_IOS_L2CAP_SDU_SIZE
+    uint16_t tx_mps;
+    volatile uint16_t credits; //PDUs the peer can still take
+    volatile uint8_t sdu_in_flight; //SDUs the SoftDevice has not sent yet
+    uint8_t next_sdu;       //buffer filled next, they are sent in order
+    uint16_t sdu_len;       //an SDU the stack has not taken yet if non zero
+    uint8_t sdu[BLE_IOS_L2CAP_TX_QUEUE_SIZE][BLE_IOS_L2CAP_SDU_SIZE];
+} ble_ios_l2cap_t;
+#endif
+
+typedef struct {
+    uint16_t service_handle;
+    ble_gatts_char_handles_t data_handles;
+    ble_gatts_char_handles_t ctrl_handles;
+    ble_gatts_char_handles_t alert_handles;
+    ble_gatts_char_handles_t stats_handles;
+    ble_gatts_char_handles_t exposure_handles;
+    ble_gatts_char_handles_t latency_handles;
+#if BLE_IOS_FW_UPDATE_ENABLED
+    ble_gatts_char_handles_t fw_update_handles;
+#endif
+    uint8_t uuid_type;
+    uint16_t conn_handle;
+    bool notify_enabled;
+    bool alert_enabled;
+    volatile bool alert_pending;
+    ble_ios_alert_t alert;
+    ble_ios_alert_handler_t alert_handler;
+    uint32_t alert_ahead;   //tx completes until the queued alert is sent, 0 with none
+    volatile bool time_pending; //written by the control point, taken by ble_ios_time_get
+    uint32_t time_epoch;
+    uint8_t time_hundreth;
+    volatile bool profile_pending; //written by the control point, taken by ble_ios_profile_get
+    uint8_t profile_id;
+    volatile bool stream_pending; //written by the control point or a disconnect, taken by ble_ios_stream_get
+    uint16_t stream_rate_hz;
+    uint16_t live_pos;      //bytes of the live frame being sent that are queued already
+    volatile bool activity_pending; //written by the control point, taken by ble_ios_activity_get
+    uint32_t activity_from_s;
+    volatile bool session_pending; //written by the control point, taken by ble_ios_session_get
+#if BLE_IOS_ESB_ENABLED
+    volatile bool esb_pending; //written by the control point, taken by ble_ios_esb_get
+    uint32_t esb_start_id;
+#endif
+    volatile bool ack_pending; //written by the control point, stored in thread context
+    uint32_t ack_count;
+    uint16_t unsynced_peak_g_x10; //of the alerts past the ack watermark
+    nrf_atomic_u32_t hvn_in_flight; //notifications the SoftDevice has not sent yet
+    uint16_t max_data_len;  //set by the app from the negotiated ATT MTU
+    ble_ios_offload_t offload;
+#if BLE_IOS_L2CAP_ENABLED
+    ble_ios_l2cap_t l2cap;
+#endif
+} ble_ios_t;
+
+uint32_t ble_ios_init(ble_ios_t *p_ios, event_store_t *store, pipeline_stats_t const *stats,
+                      exposure_stats_t const *exposure, latency_budget_stats_t const *latency);
+
+void ble_ios_on_ble_evt(ble_evt_t const *p_ble_evt, void *p_context);
+
+void ble_ios_offload_start(ble_ios_t *p_ios, uint32_t first_id);
+
+int8_t ble_ios_query_start(ble_ios_t *p_ios, uint32_t from_s, uint32_t to_s, uint16_t min_peak_g_x10);
+
+void ble_ios_offload_stop(ble_ios_t *p_ios);
+
+bool ble_ios_offload_active(ble_ios_t const *p_ios);
+
+void ble_ios_offload_stats(ble_ios_t const *p_ios, uint32_t *p_notifications, uint32_t *p_underruns,
+                           uint32_t *p_read_ahead);
+
+int8_t ble_ios_offload_process(ble_ios_t *p_ios);
+
+int8_t ble_ios_alert_send(ble_ios_t *p_ios, ble_ios_alert_t const *p_alert);
+
+void ble_ios_alert_handler_set(ble_ios_t *p_ios, ble_ios_alert_handler_t handler);
+
+bool ble_ios_time_get(ble_ios_t *p_ios, uint32_t *p_epoch, uint8_t *p_hundreth);
+
+bool ble_ios_profile_get(ble_ios_t *p_ios, uint8_t *p_id);
+
+bool ble_ios_stream_get(ble_ios_t *p_ios, uint16_t *p_rate_hz);
+
+int8_t ble_ios_live_send(ble_ios_t *p_ios, uint8_t const *frame, uint16_t length);
+
+bool ble_ios_live_busy(ble_ios_t const *p_ios);
+
+bool ble_ios_activity_get(ble_ios_t *p_ios, uint32_t *p_from_s);
+
+bool ble_ios_session_get(ble_ios_t *p_ios);
+
+#if BLE_IOS_ESB_ENABLED
+bool ble_ios_esb_get(ble_ios_t *p_ios, uint32_t *p_first_id);
+
+void ble_ios_esb_offload_start(ble_ios_t *p_ios, uint32_t first_id);
+#endif
+
+void ble_ios_adv_summary_get(ble_ios_t const *p_ios, uint8_t battery, ble_ios_adv_summary_t *p_summary);
+
+#endif //BLE_IOS_H
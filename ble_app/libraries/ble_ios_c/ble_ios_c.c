@@ -0,0 +1,533 @@
+//-------------------------------------------
+// Title: ble_ios_c.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Impact Offload Service client for the gateway. Finds the
+// service on a helmet, receives its offload stream over the L2CAP channel
+// or the data notifications and follows the frames through it, and
+// queues the control point writes that start and ack the offload.
+//-------------------------------------------
+#include <stddef.h>
+#include <string.h>
+#include "ble_ios_c.h"
+#include "ble_srv_common.h"
+#include "serial_offload.h"
+#include "app_util.h"
+#include "crc32.h"
+
+enum {
+    TRACK_SYNC,
+    TRACK_HEADER,
+    TRACK_PAYLOAD,
+    TRACK_CRC,
+};
+
+#define TRACK_HEADER_SIZE           5 //type and length
+#define TRACK_EVENT_ID_OFFSET       offsetof(event_store_header_t, id)
+
+static void ios_c_evt_send(ble_ios_c_t *p_ios_c, ble_ios_c_evt_t *p_evt)
+{
+    p_evt->conn_handle = p_ios_c->conn_handle;
+    if (p_ios_c->evt_handler != NULL)
+        p_ios_c->evt_handler(p_ios_c, p_evt);
+}
+
+/*
+ * Forgets the link, the uuid type and the handler stay
+ */
+static void ios_c_reset(ble_ios_c_t *p_ios_c)
+{
+    p_ios_c->conn_handle = BLE_CONN_HANDLE_INVALID;
+    p_ios_c->data_handle = BLE_GATT_HANDLE_INVALID;
+    p_ios_c->data_cccd_handle = BLE_GATT_HANDLE_INVALID;
+    p_ios_c->ctrl_handle = BLE_GATT_HANDLE_INVALID;
+    p_ios_c->cmd_head = 0;
+    p_ios_c->cmd_count = 0;
+    p_ios_c->write_busy = false;
+    p_ios_c->local_cid = BLE_L2CAP_CID_INVALID;
+    p_ios_c->rx_posted = 0;
+    memset(&p_ios_c->tracker, 0, sizeof(p_ios_c->tracker));
+}
+
+/*
+ * Sends the write at the head of the queue unless one is in flight, a busy
+ * stack leaves it queued for the next event of the link
+ */
+static void ios_c_cmd_process(ble_ios_c_t *p_ios_c)
+{
+    ble_gattc_write_params_t write_params;
+    ble_ios_c_cmd_t const *cmd;
+
+    if (p_ios_c->write_busy || p_ios_c->cmd_count == 0)
+        return;
+
+    cmd = &p_ios_c->cmd[p_ios_c->cmd_head];
+    memset(&write_params, 0, sizeof(write_params));
+    write_params.write_op = BLE_GATT_OP_WRITE_REQ;
+    write_params.handle   = cmd->handle;
+    write_params.len      = cmd->len;
+    write_params.p_value  = cmd->data;
+    if (sd_ble_gattc_write(p_ios_c->conn_handle, &write_params) == NRF_SUCCESS)
+        p_ios_c->write_busy = true;
+}
+
+/*
+ * Queues a write, an ack behind another ack that is not sent yet replaces it
+ * @return NRF_ERROR_NO_MEM if the queue is full
+ */
+static uint32_t ios_c_cmd_put(ble_ios_c_t *p_ios_c, uint16_t handle, uint8_t const *data, uint8_t len)
+{
+    ble_ios_c_cmd_t *cmd;
+    uint8_t last;
+
+    if (p_ios_c->conn_handle == BLE_CONN_HANDLE_INVALID || handle == BLE_GATT_HANDLE_INVALID)
+        return NRF_ERROR_INVALID_STATE;
+
+    last = (p_ios_c->cmd_head + p_ios_c->cmd_count - 1) % BLE_IOS_C_CMD_QUEUE_SIZE;
+    if (data[0] == BLE_IOS_CMD_ACK && handle == p_ios_c->ctrl_handle
+        && p_ios_c->cmd_count > (p_ios_c->write_busy ? 1 : 0)
+        && p_ios_c->cmd[last].handle == handle && p_ios_c->cmd[last].data[0] == BLE_IOS_CMD_ACK)
+    {
+        cmd = &p_ios_c->cmd[last];
+    }
+    else if (p_ios_c->cmd_count < BLE_IOS_C_CMD_QUEUE_SIZE)
+    {
+        cmd = &p_ios_c->cmd[(p_ios_c->cmd_head + p_ios_c->cmd_count) % BLE_IOS_C_CMD_QUEUE_SIZE];
+        p_ios_c->cmd_count++;
+    }
+    else
+    {
+        return NRF_ERROR_NO_MEM;
+    }
+    cmd->handle = handle;
+    cmd->len = len;
+    memcpy(cmd->data, data, len);
+
+    ios_c_cmd_process(p_ios_c);
+    return NRF_SUCCESS;
+}
+
+static void ios_c_frame_end(ble_ios_c_t *p_ios_c, bool crc_ok)
+{
+    ble_ios_c_tracker_t *tracker = &p_ios_c->tracker;
+    ble_ios_c_evt_t evt;
+
+    evt.evt_type = BLE_IOS_C_EVT_FRAME;
+    evt.params.frame.type = tracker->type;
+    evt.params.frame.crc_ok = crc_ok;
+    evt.params.frame.value = tracker->value;
+    memset(tracker, 0, sizeof(ble_ios_c_tracker_t));
+    ios_c_evt_send(p_ios_c, &evt);
+}
+
+/*
+ * Follows the frames through a piece of the stream, bytes ahead of a sync
+ * word are skipped, a length no event can have starts the search again
+ */
+static void ios_c_track(ble_ios_c_t *p_ios_c, uint8_t const *data, uint16_t len)
+{
+    ble_ios_c_tracker_t *tracker = &p_ios_c->tracker;
+    uint32_t offset, pos, n;
+    uint16_t i = 0;
+
+    while (i < len)
+    {
+        switch (tracker->stage)
+        {
+            case TRACK_SYNC:
+                //the last four bytes, little endian
+                tracker->value = (tracker->value >> 8) | ((uint32_t) data[i++] << 24);
+                if (tracker->value == SERIAL_OFFLOAD_SYNC)
+                {
+                    tracker->stage = TRACK_HEADER;
+                    tracker->pos = 0;
+                }
+                break;
+
+            case TRACK_HEADER:
+                tracker->field[tracker->pos++] = data[i++];
+                if (tracker->pos < TRACK_HEADER_SIZE)
+                    break;
+                tracker->type = tracker->field[0];
+                tracker->length = uint32_decode(&tracker->field[1]);
+                tracker->crc = crc32_compute(tracker->field, TRACK_HEADER_SIZE, NULL);
+                tracker->value = 0;
+                tracker->pos = 0;
+                if (tracker->length > BLE_IOS_C_FRAME_MAX_LEN)
+                    tracker->stage = TRACK_SYNC;
+                else
+                    tracker->stage = (tracker->length > 0) ? TRACK_PAYLOAD : TRACK_CRC;
+                break;
+
+            case TRACK_PAYLOAD:
+                n = MIN(len - i, tracker->length - tracker->pos);
+                tracker->crc = crc32_compute(&data[i], n, &tracker->crc);
+                //the event id of the header, the count of an end frame
+                offset = (tracker->type == SERIAL_OFFLOAD_FRAME_EVENT || tracker->type == SERIAL_OFFLOAD_FRAME_SUMMARY) ?
+                         TRACK_EVENT_ID_OFFSET : 0;
+                for (pos = MAX(tracker->pos, offset); pos < tracker->pos + n && pos < offset + sizeof(uint32_t); pos++)
+                {
+                    tracker->value |= (uint32_t) data[i + pos - tracker->pos] << (8 * (pos - offset));
+                }
+                tracker->pos += n;
+                i += n;
+                if (tracker->pos == tracker->length)
+                {
+                    tracker->stage = TRACK_CRC;
+                    tracker->pos = 0;
+                }
+                break;
+
+            default:
+                tracker->field[tracker->pos++] = data[i++];
+                if (tracker->pos == sizeof(uint32_t))
+                    ios_c_frame_end(p_ios_c, uint32_decode(tracker->field) == tracker->crc);
+                break;
+        }
+    }
+}
+
+static void ios_c_data(ble_ios_c_t *p_ios_c, uint8_t const *data, uint16_t len)
+{
+    ble_ios_c_evt_t evt;
+
+    evt.evt_type = BLE_IOS_C_EVT_DATA;
+    evt.params.data.p_data = data;
+    evt.params.data.len = len;
+    ios_c_evt_send(p_ios_c, &evt);
+    ios_c_track(p_ios_c, data, len);
+    ios_c_cmd_process(p_ios_c);
+}
+
+/*
+ * @return the index of the rx buffer, BLE_IOS_C_L2CAP_RX_BUFS if it is not one
+ */
+static uint8_t ios_c_rx_index(ble_ios_c_t const *p_ios_c, uint8_t const *p_data)
+{
+    uint8_t i;
+
+    for (i = 0; i < BLE_IOS_C_L2CAP_RX_BUFS; i++)
+    {
+        if (p_data == p_ios_c->rx[i])
+            break;
+    }
+    return i;
+}
+
+static void on_l2cap_evt(ble_ios_c_t *p_ios_c, ble_evt_t const *p_ble_evt)
+{
+    ble_l2cap_evt_t const *p_evt = &p_ble_evt->evt.l2cap_evt;
+    ble_ios_c_evt_t evt;
+    uint8_t index;
+
+    if (p_evt->conn_handle != p_ios_c->conn_handle || p_evt->local_cid != p_ios_c->local_cid
+        || p_ios_c->local_cid == BLE_L2CAP_CID_INVALID)
+        return;
+
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_L2CAP_EVT_CH_SETUP:
+            //credits for a whole SDU at a time, the helmet stops once the posted buffers are full
+            (void) sd_ble_l2cap_ch_flow_control(p_ios_c->conn_handle, p_ios_c->local_cid,
+                                                BLE_IOS_C_L2CAP_CREDITS, NULL);
+            evt.evt_type = BLE_IOS_C_EVT_L2CAP_OPEN;
+            ios_c_evt_send(p_ios_c, &evt);
+            break;
+
+        case BLE_L2CAP_EVT_CH_SETUP_REFUSED:
+        case BLE_L2CAP_EVT_CH_RELEASED:
+            p_ios_c->local_cid = BLE_L2CAP_CID_INVALID;
+            p_ios_c->rx_posted = 0;
+            if (p_ble_evt->header.evt_id == BLE_L2CAP_EVT_CH_SETUP_REFUSED)
+            {
+                evt.evt_type = BLE_IOS_C_EVT_L2CAP_REFUSED;
+                ios_c_evt_send(p_ios_c, &evt);
+            }
+            break;
+
+        case BLE_L2CAP_EVT_CH_RX:
+            index = ios_c_rx_index(p_ios_c, p_evt->params.rx.sdu_buf.p_data);
+            if (index < BLE_IOS_C_L2CAP_RX_BUFS)
+                p_ios_c->rx_posted &= ~(1 << index);
+            ios_c_data(p_ios_c, p_evt->params.rx.sdu_buf.p_data,
+                       MIN(p_evt->params.rx.sdu_len, p_evt->params.rx.sdu_buf.len));
+            break;
+
+        case BLE_L2CAP_EVT_CH_SDU_BUF_RELEASED:
+            index = ios_c_rx_index(p_ios_c, p_evt->params.ch_sdu_buf_released.sdu_buf.p_data);
+            if (index < BLE_IOS_C_L2CAP_RX_BUFS)
+                p_ios_c->rx_posted &= ~(1 << index);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*
+ * Registers the service uuid and the discovery of it, the instance is then
+ * assigned to a link by ble_ios_c_on_db_disc_evt
+ * @return the error of sd_ble_uuid_vs_add or ble_db_discovery_evt_register
+ */
+uint32_t ble_ios_c_init(ble_ios_c_t *p_ios_c, ble_ios_c_evt_handler_t evt_handler)
+{
+    ble_uuid128_t base_uuid = {IOS_UUID_BASE};
+    ble_uuid_t ios_uuid;
+    uint32_t err_code;
+
+    memset(p_ios_c, 0, sizeof(ble_ios_c_t));
+    ios_c_reset(p_ios_c);
+    p_ios_c->evt_handler = evt_handler;
+
+    //the type of a base added before is returned again
+    err_code = sd_ble_uuid_vs_add(&base_uuid, &p_ios_c->uuid_type);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+
+    ios_uuid.type = p_ios_c->uuid_type;
+    ios_uuid.uuid = IOS_UUID_SERVICE;
+    return ble_db_discovery_evt_register(&ios_uuid);
+}
+
+void ble_ios_c_on_ble_evt(ble_evt_t const *p_ble_evt, void *p_context)
+{
+    ble_ios_c_t *p_ios_c = (ble_ios_c_t *) p_context;
+
+    if (p_ios_c == NULL || p_ios_c->conn_handle == BLE_CONN_HANDLE_INVALID)
+        return;
+
+    if (p_ble_evt->header.evt_id >= BLE_L2CAP_EVT_BASE && p_ble_evt->header.evt_id <= BLE_L2CAP_EVT_LAST)
+    {
+        on_l2cap_evt(p_ios_c, p_ble_evt);
+        return;
+    }
+
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_GATTC_EVT_HVX:
+            if (p_ble_evt->evt.gattc_evt.conn_handle == p_ios_c->conn_handle
+                && p_ble_evt->evt.gattc_evt.params.hvx.handle == p_ios_c->data_handle)
+            {
+                ios_c_data(p_ios_c, p_ble_evt->evt.gattc_evt.params.hvx.data,
+                           p_ble_evt->evt.gattc_evt.params.hvx.len);
+            }
+            break;
+
+        case BLE_GATTC_EVT_WRITE_RSP:
+            if (p_ble_evt->evt.gattc_evt.conn_handle == p_ios_c->conn_handle && p_ios_c->write_busy)
+            {
+                p_ios_c->cmd_head = (p_ios_c->cmd_head + 1) % BLE_IOS_C_CMD_QUEUE_SIZE;
+                p_ios_c->cmd_count--;
+                p_ios_c->write_busy = false;
+                ios_c_cmd_process(p_ios_c);
+            }
+            break;
+
+        case BLE_GAP_EVT_DISCONNECTED:
+            if (p_ble_evt->evt.gap_evt.conn_handle == p_ios_c->conn_handle)
+                ios_c_reset(p_ios_c);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*
+ * Takes the handles of a discovery of the service and assigns the instance
+ * to its link, pass it the events of the instance's link
+ */
+void ble_ios_c_on_db_disc_evt(ble_ios_c_t *p_ios_c, ble_db_discovery_evt_t const *p_evt)
+{
+    ble_gatt_db_char_t const *p_chars = p_evt->params.discovered_db.charateristics;
+    ble_ios_c_evt_t evt;
+    uint8_t i;
+
+    if (p_evt->evt_type != BLE_DB_DISCOVERY_COMPLETE
+        || p_evt->params.discovered_db.srv_uuid.uuid != IOS_UUID_SERVICE
+        || p_evt->params.discovered_db.srv_uuid.type != p_ios_c->uuid_type)
+        return;
+
+    ios_c_reset(p_ios_c);
+    for (i = 0; i < p_evt->params.discovered_db.char_count; i++)
+    {
+        if (p_chars[i].characteristic.uuid.uuid == IOS_UUID_DATA_CHAR)
+        {
+            p_ios_c->data_handle = p_chars[i].characteristic.handle_value;
+            p_ios_c->data_cccd_handle = p_chars[i].cccd_handle;
+        }
+        else if (p_chars[i].characteristic.uuid.uuid == IOS_UUID_CTRL_CHAR)
+        {
+            p_ios_c->ctrl_handle = p_chars[i].characteristic.handle_value;
+        }
+    }
+    if (p_ios_c->data_handle == BLE_GATT_HANDLE_INVALID || p_ios_c->ctrl_handle == BLE_GATT_HANDLE_INVALID)
+        return;
+
+    p_ios_c->conn_handle = p_evt->conn_handle;
+    evt.evt_type = BLE_IOS_C_EVT_DISCOVERY_COMPLETE;
+    ios_c_evt_send(p_ios_c, &evt);
+}
+
+/*
+ * Copies the handles of the link's service, valid once BLE_IOS_C_EVT_DISCOVERY_COMPLETE came
+ */
+void ble_ios_c_handles_get(ble_ios_c_t const *p_ios_c, ble_ios_c_handles_t *p_handles)
+{
+    p_handles->data_handle = p_ios_c->data_handle;
+    p_handles->data_cccd_handle = p_ios_c->data_cccd_handle;
+    p_handles->ctrl_handle = p_ios_c->ctrl_handle;
+}
+
+/*
+ * Assigns the instance to a link with the handles an earlier discovery of the
+ * same helmet found, BLE_IOS_C_EVT_DISCOVERY_COMPLETE follows at once. Handles
+ * a new firmware moved fail the writes, the app discovers again next time
+ * @return NRF_ERROR_INVALID_PARAM if the data or control point handle is missing
+ */
+uint32_t ble_ios_c_handles_assign(ble_ios_c_t *p_ios_c, uint16_t conn_handle, ble_ios_c_handles_t const *p_handles)
+{
+    ble_ios_c_evt_t evt;
+
+    if (p_handles->data_handle == BLE_GATT_HANDLE_INVALID || p_handles->ctrl_handle == BLE_GATT_HANDLE_INVALID)
+        return NRF_ERROR_INVALID_PARAM;
+
+    ios_c_reset(p_ios_c);
+    p_ios_c->data_handle = p_handles->data_handle;
+    p_ios_c->data_cccd_handle = p_handles->data_cccd_handle;
+    p_ios_c->ctrl_handle = p_handles->ctrl_handle;
+    p_ios_c->conn_handle = conn_handle;
+    evt.evt_type = BLE_IOS_C_EVT_DISCOVERY_COMPLETE;
+    ios_c_evt_send(p_ios_c, &evt);
+
+    return NRF_SUCCESS;
+}
+
+/*
+ * Asks the helmet for the offload channel with the first rx buffer posted,
+ * BLE_IOS_C_EVT_L2CAP_OPEN or BLE_IOS_C_EVT_L2CAP_REFUSED follows
+ * @return the error of sd_ble_l2cap_ch_setup
+ */
+uint32_t ble_ios_c_l2cap_open(ble_ios_c_t *p_ios_c)
+{
+    ble_l2cap_ch_setup_params_t params;
+    uint32_t err_code;
+
+    memset(&params, 0, sizeof(params));
+    params.le_psm = BLE_IOS_L2CAP_PSM;
+    params.rx_params.rx_mtu = BLE_IOS_C_L2CAP_RX_MTU;
+    params.rx_params.rx_mps = BLE_IOS_C_L2CAP_RX_MPS;
+    params.rx_params.sdu_buf.p_data = p_ios_c->rx[0];
+    params.rx_params.sdu_buf.len = sizeof(p_ios_c->rx[0]);
+
+    p_ios_c->local_cid = BLE_L2CAP_CID_INVALID;
+    err_code = sd_ble_l2cap_ch_setup(p_ios_c->conn_handle, &p_ios_c->local_cid, &params);
+    if (err_code != NRF_SUCCESS)
+    {
+        p_ios_c->local_cid = BLE_L2CAP_CID_INVALID;
+        return err_code;
+    }
+    p_ios_c->rx_posted = 1;
+
+    return NRF_SUCCESS;
+}
+
+/*
+ * @return the rx buffers with the SoftDevice, each can bring a whole SDU
+ */
+uint8_t ble_ios_c_l2cap_rx_posted(ble_ios_c_t const *p_ios_c)
+{
+    uint8_t count = 0;
+    uint8_t i;
+
+    for (i = 0; i < BLE_IOS_C_L2CAP_RX_BUFS; i++)
+    {
+        if ((p_ios_c->rx_posted & (1 << i)) != 0)
+            count++;
+    }
+    return count;
+}
+
+/*
+ * Posts one free rx buffer, the helmet gets the credits to fill it. The app
+ * has to have room for a whole BLE_IOS_C_L2CAP_RX_MTU SDU per buffer posted.
+ * Not reentrant, call from the BLE events or with them masked
+ * @return NRF_ERROR_NO_MEM if none is free, otherwise the error of sd_ble_l2cap_ch_rx
+ */
+uint32_t ble_ios_c_l2cap_rx_post(ble_ios_c_t *p_ios_c)
+{
+    ble_data_t sdu_buf;
+    uint32_t err_code;
+    uint8_t i;
+
+    if (p_ios_c->local_cid == BLE_L2CAP_CID_INVALID)
+        return NRF_ERROR_INVALID_STATE;
+    for (i = 0; i < BLE_IOS_C_L2CAP_RX_BUFS && (p_ios_c->rx_posted & (1 << i)) != 0; i++)
+    {
+    }
+    if (i == BLE_IOS_C_L2CAP_RX_BUFS)
+        return NRF_ERROR_NO_MEM;
+
+    sdu_buf.p_data = p_ios_c->rx[i];
+    sdu_buf.len = sizeof(p_ios_c->rx[i]);
+    err_code = sd_ble_l2cap_ch_rx(p_ios_c->conn_handle, p_ios_c->local_cid, &sdu_buf);
+    if (err_code == NRF_SUCCESS)
+        p_ios_c->rx_posted |= 1 << i;
+
+    return err_code;
+}
+
+/*
+ * Queues the write of the data cccd for the offload as notifications
+ * @return NRF_ERROR_NO_MEM if the write queue is full
+ */
+uint32_t ble_ios_c_notif_enable(ble_ios_c_t *p_ios_c)
+{
+    uint8_t cccd[BLE_CCCD_VALUE_LEN];
+
+    uint16_encode(BLE_GATT_HVX_NOTIFICATION, cccd);
+    return ios_c_cmd_put(p_ios_c, p_ios_c->data_cccd_handle, cccd, sizeof(cccd));
+}
+
+/*
+ * Queues a START without an id, the helmet resumes from its ack watermark
+ * @return NRF_ERROR_NO_MEM if the write queue is full
+ */
+uint32_t ble_ios_c_start(ble_ios_c_t *p_ios_c)
+{
+    uint8_t cmd = BLE_IOS_CMD_START;
+
+    return ios_c_cmd_put(p_ios_c, p_ios_c->ctrl_handle, &cmd, sizeof(cmd));
+}
+
+/*
+ * Queues an ESB command without an id, the helmet drops the link and sends
+ * from its ack watermark over ESB to the address built from its BLE address
+ * @return NRF_ERROR_NO_MEM if the write queue is full
+ */
+uint32_t ble_ios_c_esb_start(ble_ios_c_t *p_ios_c)
+{
+    uint8_t cmd = BLE_IOS_CMD_ESB;
+
+    return ios_c_cmd_put(p_ios_c, p_ios_c->ctrl_handle, &cmd, sizeof(cmd));
+}
+
+/*
+ * Queues an ack, count is the id + 1 of the last event received whole
+ * @return NRF_ERROR_NO_MEM if the write queue is full
+ */
+uint32_t ble_ios_c_ack(ble_ios_c_t *p_ios_c, uint32_t count)
+{
+    uint8_t cmd[1 + sizeof(uint32_t)];
+
+    cmd[0] = BLE_IOS_CMD_ACK;
+    uint32_encode(count, &cmd[1]);
+    return ios_c_cmd_put(p_ios_c, p_ios_c->ctrl_handle, cmd, sizeof(cmd));
+}
+
+/*
+ * @return true once every queued write has its response
+ */
+bool ble_ios_c_write_idle(ble_ios_c_t const *p_ios_c)
+{
+    return p_ios_c->cmd_count == 0;
+}
@@ -0,0 +1,146 @@
+#ifndef BLE_IOS_C_H
+#define BLE_IOS_C_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ble.h"
+#include "ble_db_discovery.h"
+#include "nrf_sdh_ble.h"
+#include "ble_ios.h"
+
+/* Impact Offload Service client, the gateway end of ble_ios.h, one instance
+ * per link. Once ble_ios_c_on_db_disc_evt() has the handles of the data and
+ * control point characteristics the app opens the L2CAP channel on
+ * BLE_IOS_L2CAP_PSM with ble_ios_c_l2cap_open(), or enables the data
+ * notifications when the helmet refuses it, and writes START. Both paths hand
+ * the app the same offload byte stream as BLE_IOS_C_EVT_DATA. The channel is
+ * paced by its rx buffers: the SoftDevice only gives the helmet credits for a
+ * buffer the app has posted with ble_ios_c_l2cap_rx_post(), so an app that
+ * has nowhere to put more data holds the helmet back without dropping any.
+ * Notifications cannot be held back, an app that runs out of room stops the
+ * offload instead. The client follows the frames of serial_offload.h through
+ * the stream and raises BLE_IOS_C_EVT_FRAME as each one ends, with its crc
+ * checked, so the app can ack every event received whole. The control point
+ * writes are queued and sent one at a time as write requests, an ack queued
+ * behind another replaces its count. ble_ios_c_esb_start() asks the helmet
+ * for the offload over ESB instead (esb_offload.h), it drops the link. The
+ * app can keep the handles of a helmet with ble_ios_c_handles_get() and give
+ * them to its next link with ble_ios_c_handles_assign() in place of the
+ * discovery, the helmet's attribute table is fixed by its firmware */
+#define BLE_IOS_C_ARRAY_DEF(_name, _cnt)                                        \
+static ble_ios_c_t _name[_cnt];                                                 \
+NRF_SDH_BLE_OBSERVERS(_name ## _obs,                                            \
+                      BLE_IOS_C_BLE_OBSERVER_PRIO,                              \
+                      ble_ios_c_on_ble_evt, &_name, _cnt)
+
+#ifndef BLE_IOS_C_BLE_OBSERVER_PRIO
+#define BLE_IOS_C_BLE_OBSERVER_PRIO 2
+#endif
+
+#define BLE_IOS_C_L2CAP_RX_MTU      BLE_IOS_L2CAP_SDU_SIZE //the largest SDU the helmet sends
+#define BLE_IOS_C_L2CAP_RX_MPS      BLE_IOS_L2CAP_MPS //the rx_mps the app configures
+#define BLE_IOS_C_L2CAP_RX_BUFS     2   //SDU buffers per link, the rx_queue_size the app configures
+#define BLE_IOS_C_L2CAP_CREDITS     ((BLE_IOS_C_L2CAP_RX_MTU + 2 + BLE_IOS_C_L2CAP_RX_MPS - 1) / BLE_IOS_C_L2CAP_RX_MPS) //PDUs of one SDU
+#define BLE_IOS_C_CMD_QUEUE_SIZE    4   //control point writes waiting for the previous one
+#define BLE_IOS_C_CMD_MAX_LEN       6   //command and arguments
+#define BLE_IOS_C_FRAME_MAX_LEN     (EVENT_STORE_DATA_END - EVENT_STORE_DATA_ADDRESS) //longer payloads are bogus
+
+typedef enum {
+    BLE_IOS_C_EVT_DISCOVERY_COMPLETE,   /* the service is found or its handles are assigned */
+    BLE_IOS_C_EVT_L2CAP_OPEN,           /* the channel is set up, the stream comes over it */
+    BLE_IOS_C_EVT_L2CAP_REFUSED,        /* the helmet has no channel, use the notifications */
+    BLE_IOS_C_EVT_DATA,                 /* a piece of the offload stream */
+    BLE_IOS_C_EVT_FRAME,                /* a frame of the stream ended */
+} ble_ios_c_evt_type_t;
+
+typedef struct {
+    uint8_t type;           /* SERIAL_OFFLOAD_FRAME_* */
+    bool crc_ok;
+    uint32_t value;         /* the event id of an event or summary frame, the frame count of an end frame */
+} ble_ios_c_frame_t;
+
+typedef struct {
+    ble_ios_c_evt_type_t evt_type;
+    uint16_t conn_handle;
+    union {
+        struct {
+            uint8_t const *p_data;
+            uint16_t len;
+        } data;
+        ble_ios_c_frame_t frame;
+    } params;
+} ble_ios_c_evt_t;
+
+/* Frame of serial_offload.h being followed through the stream */
+typedef struct {
+    uint8_t stage;
+    uint32_t pos;           /* bytes of the stage so far */
+    uint8_t field[5];       /* type and length or crc being taken */
+    uint8_t type;
+    uint32_t length;
+    uint32_t value;         /* the header id of an event or summary frame, the count of an end frame */
+    uint32_t crc;
+} ble_ios_c_tracker_t;
+
+/* A write request waiting in the queue, to the control point or the cccd */
+typedef struct {
+    uint16_t handle;
+    uint8_t len;
+    uint8_t data[BLE_IOS_C_CMD_MAX_LEN];
+} ble_ios_c_cmd_t;
+
+/* Handles of the service on a helmet */
+typedef struct {
+    uint16_t data_handle;
+    uint16_t data_cccd_handle;
+    uint16_t ctrl_handle;
+} ble_ios_c_handles_t;
+
+typedef struct ble_ios_c_s ble_ios_c_t;
+
+typedef void (*ble_ios_c_evt_handler_t)(ble_ios_c_t *p_ios_c, ble_ios_c_evt_t const *p_evt);
+
+struct ble_ios_c_s {
+    uint16_t conn_handle;
+    uint16_t data_handle;
+    uint16_t data_cccd_handle;
+    uint16_t ctrl_handle;
+    uint8_t uuid_type;
+    ble_ios_c_evt_handler_t evt_handler;
+    ble_ios_c_cmd_t cmd[BLE_IOS_C_CMD_QUEUE_SIZE];
+    uint8_t cmd_head;       /* the write in flight while write_busy */
+    uint8_t cmd_count;
+    bool write_busy;        /* the head write waits for its response */
+    uint16_t local_cid;     /* BLE_L2CAP_CID_INVALID while no channel is set up */
+    uint8_t rx_posted;      /* bit n, rx[n] is with the SoftDevice */
+    uint8_t rx[BLE_IOS_C_L2CAP_RX_BUFS][BLE_IOS_C_L2CAP_RX_MTU];
+    ble_ios_c_tracker_t tracker;
+};
+
+uint32_t ble_ios_c_init(ble_ios_c_t *p_ios_c, ble_ios_c_evt_handler_t evt_handler);
+
+void ble_ios_c_on_ble_evt(ble_evt_t const *p_ble_evt, void *p_context);
+
+void ble_ios_c_on_db_disc_evt(ble_ios_c_t *p_ios_c, ble_db_discovery_evt_t const *p_evt);
+
+void ble_ios_c_handles_get(ble_ios_c_t const *p_ios_c, ble_ios_c_handles_t *p_handles);
+
+uint32_t ble_ios_c_handles_assign(ble_ios_c_t *p_ios_c, uint16_t conn_handle, ble_ios_c_handles_t const *p_handles);
+
+uint32_t ble_ios_c_l2cap_open(ble_ios_c_t *p_ios_c);
+
+uint8_t ble_ios_c_l2cap_rx_posted(ble_ios_c_t const *p_ios_c);
+
+uint32_t ble_ios_c_l2cap_rx_post(ble_ios_c_t *p_ios_c);
+
+uint32_t ble_ios_c_notif_enable(ble_ios_c_t *p_ios_c);
+
+uint32_t ble_ios_c_start(ble_ios_c_t *p_ios_c);
+
+uint32_t ble_ios_c_esb_start(ble_ios_c_t *p_ios_c);
+
+uint32_t ble_ios_c_ack(ble_ios_c_t *p_ios_c, uint32_t count);
+
+bool ble_ios_c_write_idle(ble_ios_c_t const *p_ios_c);
+
+#endif //BLE_IOS_C_H
@@ -0,0 +1,96 @@
+//-------------------------------------------
+// Title: boot_check.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Cold or warm boot from the reset reason and a state byte
+// retained in GPREGRET2, the full sensor self tests only run after
+// power-on, a watchdog or lockup reset, or when asked for.
+//-------------------------------------------
+#include "boot_check.h"
+#include "nrf.h"
+#include "app_error.h"
+#ifdef SOFTDEVICE_PRESENT
+#include "nrf_sdh.h"
+#include "nrf_soc.h"
+#endif
+
+#define BOOT_CHECK_GPREGRET_ID      1     //GPREGRET2 for the softdevice calls
+
+//resets that leave the board as it was, the rest start over
+#define BOOT_CHECK_WARM_RESETS      (POWER_RESETREAS_SREQ_Msk | POWER_RESETREAS_RESETPIN_Msk | \
+                                     POWER_RESETREAS_OFF_Msk | POWER_RESETREAS_LPCOMP_Msk |     \
+                                     POWER_RESETREAS_DIF_Msk | POWER_RESETREAS_NFC_Msk)
+
+static uint32_t m_reset_reason;
+static bool m_full_test = true;
+
+static void boot_check_write(uint8_t state)
+{
+#ifdef SOFTDEVICE_PRESENT
+    if (nrf_sdh_is_enabled())
+    {
+        APP_ERROR_CHECK(sd_power_gpregret_clr(BOOT_CHECK_GPREGRET_ID, 0xFF));
+        APP_ERROR_CHECK(sd_power_gpregret_set(BOOT_CHECK_GPREGRET_ID, state));
+        return;
+    }
+#endif
+    NRF_POWER->GPREGRET2 = state;
+}
+
+/*
+ * Reads and clears the reset reason and decides on the self tests, first
+ * thing in main. A boot that runs them clears the passed flag until
+ * boot_check_passed(), a reset in the middle of the tests repeats them
+ * @return true if the full self tests have to run
+ */
+bool boot_check_init(void)
+{
+    uint8_t state = NRF_POWER->GPREGRET2;
+
+    m_reset_reason = NRF_POWER->RESETREAS;
+    NRF_POWER->RESETREAS = m_reset_reason; //write 1 to clear, the reasons pile up otherwise
+
+    //no reason is a power-on or brownout reset, those also clear the state
+    m_full_test = (state & BOOT_CHECK_MAGIC_MSK) != BOOT_CHECK_MAGIC
+               || (state & BOOT_CHECK_PASSED) == 0
+               || (state & BOOT_CHECK_FULL_REQUESTED) != 0
+               || m_reset_reason == 0
+               || (m_reset_reason & ~BOOT_CHECK_WARM_RESETS) != 0;
+    if (m_full_test)
+    {
+        boot_check_write(BOOT_CHECK_MAGIC);
+    }
+    return m_full_test;
+}
+
+/*
+ * @return true if this boot runs the full self tests, as boot_check_init() returned
+ */
+bool boot_check_full_test(void)
+{
+    return m_full_test;
+}
+
+/*
+ * @return the POWER RESETREAS bits of this boot
+ */
+uint32_t boot_check_reset_reason(void)
+{
+    return m_reset_reason;
+}
+
+/*
+ * Marks the full tests passed, the warm boots from here on only read the ids
+ */
+void boot_check_passed(void)
+{
+    boot_check_write(BOOT_CHECK_MAGIC | BOOT_CHECK_PASSED);
+}
+
+/*
+ * Runs the full tests on the next boot whatever resets, e.g. before a soft
+ * reset from a command or after an id check of a warm boot failed
+ */
+void boot_check_request_full_test(void)
+{
+    boot_check_write(BOOT_CHECK_MAGIC | BOOT_CHECK_FULL_REQUESTED);
+}
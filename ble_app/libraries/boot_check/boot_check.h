@@ -0,0 +1,36 @@
+#ifndef BOOT_CHECK_H
+#define BOOT_CHECK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Decides at boot whether the sensors need their full self tests. A power-on
+ * or brownout reset, a watchdog or a lockup reset run them, so does a boot
+ * asked for with boot_check_request_full_test(). A soft reset, a pin reset or
+ * a wake from System OFF leaves the sensors and the RTC powered with their
+ * registers as they were, once a full test has passed since power-on those
+ * boots only read the sensor ids and skip the RTC settle.
+ * The state is one byte in GPREGRET2, retained over every reset but power-on
+ * and brownout. A .noinit RAM block (see deep_sleep.h) needs a crc to be
+ * trusted, UICR would take a flash write on every change and GPREGRET is
+ * left to a bootloader.
+ * The register images the drivers apply live in flash, there is no other
+ * configuration to carry over a reset.
+ * boot_check_init() reads and clears RESETREAS, it must run before the
+ * SoftDevice is enabled. Later writes go through the SoftDevice when it is */
+#define BOOT_CHECK_MAGIC            0x50  //upper nibble, anything else is a power-on value
+#define BOOT_CHECK_MAGIC_MSK        0xF0
+#define BOOT_CHECK_PASSED           0x01  //full tests passed since power-on
+#define BOOT_CHECK_FULL_REQUESTED   0x02  //run the full tests on the next boot whatever the reset
+
+bool boot_check_init(void);
+
+bool boot_check_full_test(void);
+
+uint32_t boot_check_reset_reason(void);
+
+void boot_check_passed(void);
+
+void boot_check_request_full_test(void);
+
+#endif //BOOT_CHECK_H
@@ -0,0 +1,191 @@
+//-------------------------------------------
+// Title: bus_stats.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Busy time of each bus from a timer gated by the PPI on the
+// SPIM and TWIM start and end events, see bus_stats.h, so the bus that
+// limits the sample rate of a profile shows without timing it in software.
+//-------------------------------------------
+#include <string.h>
+#include "bus_stats.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "nrf_drv_ppi.h"
+#include "nrf_timer.h"
+#include "nrf_spim.h"
+#include "nrf_twim.h"
+
+static NRF_TIMER_Type * const m_timers[BUS_STATS_COUNT] = BUS_STATS_TIMERS;
+static char const * const m_names[BUS_STATS_COUNT] = {"accel/flash", "gyro", "twi"};
+static bool m_watched[BUS_STATS_COUNT];
+static uint32_t m_last_us[BUS_STATS_COUNT];     //timer count at the last fold
+static uint32_t m_last_ticks;                   //app timer count at the last fold
+static bus_stats_snapshot_t m_totals;
+APP_TIMER_DEF(m_fold_timer);
+
+/*
+ * Allocates, connects and enables one PPI channel
+ * @return 0 if success otherwise -1
+ */
+static int8_t bus_stats_connect(uint32_t eep, uint32_t tep)
+{
+    nrf_ppi_channel_t channel;
+
+    if (nrf_drv_ppi_channel_alloc(&channel) != NRF_SUCCESS)
+        return -1;
+    if (nrf_drv_ppi_channel_assign(channel, eep, tep) != NRF_SUCCESS)
+        return -1;
+    if (nrf_drv_ppi_channel_enable(channel) != NRF_SUCCESS)
+        return -1;
+
+    return 0;
+}
+
+static uint32_t bus_stats_timer_read(NRF_TIMER_Type *p_timer)
+{
+    nrf_timer_task_trigger(p_timer, NRF_TIMER_TASK_CAPTURE0);
+    return nrf_timer_cc_read(p_timer, NRF_TIMER_CC_CHANNEL0);
+}
+
+/*
+ * Adds the counts since the last fold to the totals, before the 32 bit
+ * timers or the app timer wrap
+ */
+static void bus_stats_fold(void)
+{
+    uint32_t ticks;
+    uint32_t now;
+
+    CRITICAL_REGION_ENTER();
+    for (int i = 0; i < BUS_STATS_COUNT; i++)
+    {
+        if (!m_watched[i])
+            continue;
+        now = bus_stats_timer_read(m_timers[i]);
+        m_totals.busy_us[i] += now - m_last_us[i];
+        m_last_us[i] = now;
+    }
+    ticks = app_timer_cnt_get();
+    m_totals.window_us += ((uint64_t) app_timer_cnt_diff_compute(ticks, m_last_ticks) * 1000000
+                           * (APP_TIMER_CONFIG_RTC_FREQUENCY + 1)) / APP_TIMER_CLOCK_FREQ;
+    m_last_ticks = ticks;
+    CRITICAL_REGION_EXIT();
+}
+
+static void bus_stats_fold_timeout(void * p_context)
+{
+    bus_stats_fold();
+}
+
+/*
+ * Sets up a gated timer for a bus
+ */
+static void bus_stats_timer_init(bus_stats_bus_t bus)
+{
+    NRF_TIMER_Type *p_timer = m_timers[bus];
+
+    nrf_timer_task_trigger(p_timer, NRF_TIMER_TASK_STOP);
+    nrf_timer_mode_set(p_timer, NRF_TIMER_MODE_TIMER);
+    nrf_timer_bit_width_set(p_timer, NRF_TIMER_BIT_WIDTH_32);
+    nrf_timer_frequency_set(p_timer, NRF_TIMER_FREQ_1MHz);
+    nrf_timer_task_trigger(p_timer, NRF_TIMER_TASK_CLEAR);
+    m_last_us[bus] = 0;
+}
+
+/*
+ * Starts the window and the fold timer, before the buses are added
+ * @return 0 if success otherwise -1
+ */
+int8_t bus_stats_init(void)
+{
+    ret_code_t err_code;
+
+    err_code = nrf_drv_ppi_init();
+    if (err_code != NRF_SUCCESS && err_code != NRF_ERROR_MODULE_ALREADY_INITIALIZED)
+        return -1;
+    if (app_timer_create(&m_fold_timer, APP_TIMER_MODE_REPEATED, bus_stats_fold_timeout) != NRF_SUCCESS)
+        return -1;
+    if (app_timer_start(m_fold_timer, APP_TIMER_TICKS(BUS_STATS_FOLD_MS), NULL) != NRF_SUCCESS)
+        return -1;
+    m_last_ticks = app_timer_cnt_get();
+
+    return 0;
+}
+
+/*
+ * Watches a SPIM bus, its timer runs from STARTED to END
+ * @return 0 if success otherwise -1 if out of PPI channels, -2 if the bus is watched already
+ */
+int8_t bus_stats_spim_add(bus_stats_bus_t bus, NRF_SPIM_Type *p_spim)
+{
+    NRF_TIMER_Type *p_timer;
+
+    if (bus >= BUS_STATS_COUNT || m_watched[bus])
+        return -2;
+
+    p_timer = m_timers[bus];
+    bus_stats_timer_init(bus);
+    if (bus_stats_connect(nrf_spim_event_address_get(p_spim, NRF_SPIM_EVENT_STARTED),
+                          (uint32_t) nrf_timer_task_address_get(p_timer, NRF_TIMER_TASK_START)) < 0
+        || bus_stats_connect(nrf_spim_event_address_get(p_spim, NRF_SPIM_EVENT_END),
+                             (uint32_t) nrf_timer_task_address_get(p_timer, NRF_TIMER_TASK_STOP)) < 0)
+    {
+        return -1;
+    }
+    m_watched[bus] = true;
+
+    return 0;
+}
+
+/*
+ * Watches a TWIM bus, its timer runs from TXSTARTED or RXSTARTED to STOPPED
+ * @return 0 if success otherwise -1 if out of PPI channels, -2 if the bus is watched already
+ */
+int8_t bus_stats_twim_add(bus_stats_bus_t bus, NRF_TWIM_Type *p_twim)
+{
+    NRF_TIMER_Type *p_timer;
+    uint32_t start;
+
+    if (bus >= BUS_STATS_COUNT || m_watched[bus])
+        return -2;
+
+    p_timer = m_timers[bus];
+    start = (uint32_t) nrf_timer_task_address_get(p_timer, NRF_TIMER_TASK_START);
+    bus_stats_timer_init(bus);
+    if (bus_stats_connect((uint32_t) nrf_twim_event_address_get(p_twim, NRF_TWIM_EVENT_TXSTARTED), start) < 0
+        || bus_stats_connect((uint32_t) nrf_twim_event_address_get(p_twim, NRF_TWIM_EVENT_RXSTARTED), start) < 0
+        || bus_stats_connect((uint32_t) nrf_twim_event_address_get(p_twim, NRF_TWIM_EVENT_STOPPED),
+                             (uint32_t) nrf_timer_task_address_get(p_timer, NRF_TIMER_TASK_STOP)) < 0)
+    {
+        return -1;
+    }
+    m_watched[bus] = true;
+
+    return 0;
+}
+
+/*
+ * Copies the window and the busy time of each bus since the last reset
+ */
+void bus_stats_snapshot(bus_stats_snapshot_t *p_snapshot)
+{
+    bus_stats_fold();
+    CRITICAL_REGION_ENTER();
+    *p_snapshot = m_totals;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Starts a new window, e.g. after a profile switch
+ */
+void bus_stats_reset(void)
+{
+    bus_stats_fold();
+    CRITICAL_REGION_ENTER();
+    memset(&m_totals, 0, sizeof(m_totals));
+    CRITICAL_REGION_EXIT();
+}
+
+char const *bus_stats_name(bus_stats_bus_t bus)
+{
+    return (bus < BUS_STATS_COUNT) ? m_names[bus] : "?";
+}
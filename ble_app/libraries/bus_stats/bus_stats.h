@@ -0,0 +1,45 @@
+#ifndef BUS_STATS_H
+#define BUS_STATS_H
+
+#include <stdint.h>
+#include "nrf.h"
+
+/* Busy time of the spi and i2c buses without the cpu. Each bus has a timer
+ * of its own running at 1 MHz only while the bus is busy: PPI starts it on
+ * the SPIM STARTED (TWIM TXSTARTED and RXSTARTED) event and stops it on END
+ * (STOPPED), so the gaps between the EasyDMA chunks and transactions are not
+ * counted and the time a TWIM holds the bus suspended between the write and
+ * read of a register access is. An app timer folds the 32 bit counts and its
+ * own window into 64 bits every BUS_STATS_FOLD_MS, the counts wrap after 71
+ * minutes of busy time and the app timer after 512 s. The transaction counts
+ * per device come from spi_device_counts() and twi_xfer_counts().
+ * TIMER0 is the SoftDevice's and TIMER1 the timebase's, TIMER2 and TIMER3
+ * are the sample clock's so an app using it can't watch the gyro or the twi */
+#define BUS_STATS_TIMERS            {NRF_TIMER4, NRF_TIMER3, NRF_TIMER2}
+#define BUS_STATS_FOLD_MS           60000
+
+typedef enum {
+    BUS_STATS_ACCEL_FLASH = 0,  //the accel and flash SPIM of PCB rev1
+    BUS_STATS_GYRO,
+    BUS_STATS_TWI,
+    BUS_STATS_COUNT
+} bus_stats_bus_t;
+
+typedef struct {
+    uint64_t window_us;                 //since bus_stats_init or bus_stats_reset
+    uint64_t busy_us[BUS_STATS_COUNT];
+} bus_stats_snapshot_t;
+
+int8_t bus_stats_init(void);
+
+int8_t bus_stats_spim_add(bus_stats_bus_t bus, NRF_SPIM_Type *p_spim);
+
+int8_t bus_stats_twim_add(bus_stats_bus_t bus, NRF_TWIM_Type *p_twim);
+
+void bus_stats_snapshot(bus_stats_snapshot_t *p_snapshot);
+
+void bus_stats_reset(void);
+
+char const *bus_stats_name(bus_stats_bus_t bus);
+
+#endif //BUS_STATS_H
@@ -0,0 +1,204 @@
+//-------------------------------------------
+// Title: cpu_load.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Busy cycle accumulators for the idle loop marks and the
+// CPU_LOAD_ENTER and CPU_LOAD_EXIT sources of cpu_load.h, folded every
+// window into rolling percentages of the wall time.
+//-------------------------------------------
+#include <string.h>
+#include "cpu_load.h"
+#include "app_util_platform.h"
+
+#define CPU_LOAD_WINDOW_TICKS   ((uint32_t) (((uint64_t) CPU_LOAD_WINDOW_MS * CPU_LOAD_TICK_HZ) / 1000))
+
+static cpu_load_src_t *m_p_srcs;
+static uint32_t m_busy;             //cycles of the window so far, thread awake and sources asleep
+static uint32_t m_wake_cycles;      //counter at the thread's last wake, or the last fold
+static bool m_asleep;
+static uint8_t m_depth;             //sources entered, only the outermost is added while asleep
+static uint32_t m_window_start;     //RTC1 tick the open window started at
+static uint16_t m_permille[CPU_LOAD_WINDOWS];
+static uint8_t m_index;             //slot of the next window closed
+static uint8_t m_windows;
+
+static uint32_t cpu_load_now(void)
+{
+    return NRF_RTC1->COUNTER;
+}
+
+/*
+ * Starts the cycle counter as profiler_init does and the first window with
+ * the thread awake. The app_timer has to be running
+ */
+void cpu_load_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    m_asleep = false;
+    cpu_load_reset();
+}
+
+/*
+ * Drops the closed windows and the counts of every source, the open window
+ * starts over from now
+ */
+void cpu_load_reset(void)
+{
+    cpu_load_src_t *p_src;
+
+    CRITICAL_REGION_ENTER();
+    m_busy = 0;
+    m_wake_cycles = DWT->CYCCNT;
+    m_window_start = cpu_load_now();
+    memset(m_permille, 0, sizeof(m_permille));
+    m_index = 0;
+    m_windows = 0;
+    for (p_src = m_p_srcs; p_src != NULL; p_src = p_src->p_next)
+    {
+        p_src->cycles = 0;
+        p_src->count = 0;
+        memset(p_src->permille, 0, sizeof(p_src->permille));
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * The thread is going to sleep, right before nrf_pwr_mgmt_run() or the WFE
+ */
+void cpu_load_sleep(void)
+{
+    CRITICAL_REGION_ENTER();
+    m_busy += DWT->CYCCNT - m_wake_cycles;
+    m_asleep = true;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * The thread woke up, right after nrf_pwr_mgmt_run() returns. The interrupts
+ * that woke it were counted by their sources
+ */
+void cpu_load_wake(void)
+{
+    CRITICAL_REGION_ENTER();
+    m_wake_cycles = DWT->CYCCNT;
+    m_asleep = false;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Starts a source, from thread or interrupt context. Use the CPU_LOAD_ENTER
+ * or CPU_LOAD_SCOPE macro so a build without the load drops the call
+ */
+void cpu_load_enter(cpu_load_src_t *p_src)
+{
+    //a preempting source puts the depth back before this one goes on
+    m_depth++;
+    p_src->entry_cycles = DWT->CYCCNT;
+}
+
+/*
+ * Ends a source and adds its cycles, to the busy time too if it ran while
+ * the thread slept and no other source is around it
+ */
+void cpu_load_exit(cpu_load_src_t *p_src)
+{
+    uint32_t cycles = DWT->CYCCNT - p_src->entry_cycles;
+
+    CRITICAL_REGION_ENTER();
+    if (!p_src->registered)
+    {
+        p_src->p_next = m_p_srcs;
+        m_p_srcs = p_src;
+        p_src->registered = 1;
+    }
+    p_src->cycles += cycles;
+    p_src->count++;
+    m_depth--;
+    if (m_asleep && m_depth == 0)
+        m_busy += cycles;
+    CRITICAL_REGION_EXIT();
+}
+
+static uint16_t cpu_load_permille(uint32_t cycles, uint64_t window_cycles)
+{
+    uint64_t permille = ((uint64_t) cycles * 1000) / window_cycles;
+
+    return (permille > 1000) ? 1000 : (uint16_t) permille;
+}
+
+/*
+ * Closes the open window once CPU_LOAD_WINDOW_MS have passed, from the idle
+ * loop at least every 512 s, the RTC1 wrap. Thread context, awake
+ */
+void cpu_load_process(void)
+{
+    uint32_t now = cpu_load_now();
+    uint32_t ticks = (now - m_window_start) & CPU_LOAD_TICK_MASK;
+    uint64_t window_cycles;
+    cpu_load_src_t *p_src;
+
+    if (ticks < CPU_LOAD_WINDOW_TICKS)
+        return;
+
+    window_cycles = ((uint64_t) ticks * CPU_LOAD_CLOCK_HZ) / CPU_LOAD_TICK_HZ;
+    CRITICAL_REGION_ENTER();
+    m_busy += DWT->CYCCNT - m_wake_cycles;
+    m_wake_cycles = DWT->CYCCNT;
+    m_permille[m_index] = cpu_load_permille(m_busy, window_cycles);
+    m_busy = 0;
+    for (p_src = m_p_srcs; p_src != NULL; p_src = p_src->p_next)
+    {
+        p_src->permille[m_index] = cpu_load_permille(p_src->cycles, window_cycles);
+        p_src->cycles = 0;
+    }
+    CRITICAL_REGION_EXIT();
+    m_window_start = now;
+    m_index = (m_index + 1) % CPU_LOAD_WINDOWS;
+    if (m_windows < CPU_LOAD_WINDOWS)
+        m_windows++;
+}
+
+static void cpu_load_summary(uint16_t const *p_permille, cpu_load_t *p_load)
+{
+    uint32_t sum = 0;
+    uint8_t i;
+
+    memset(p_load, 0, sizeof(*p_load));
+    p_load->windows = m_windows;
+    if (m_windows == 0)
+        return;
+
+    p_load->last = p_permille[(m_index + CPU_LOAD_WINDOWS - 1) % CPU_LOAD_WINDOWS];
+    for (i = 0; i < m_windows; i++)
+    {
+        sum += p_permille[i];
+        if (p_permille[i] > p_load->peak)
+            p_load->peak = p_permille[i];
+    }
+    p_load->average = (uint16_t) (sum / m_windows);
+}
+
+/*
+ * The load of the whole cpu over the closed windows, in permille
+ */
+void cpu_load_get(cpu_load_t *p_load)
+{
+    cpu_load_summary(m_permille, p_load);
+}
+
+/*
+ * The share of one source over the closed windows, in permille
+ */
+void cpu_load_src_get(cpu_load_src_t const *p_src, cpu_load_t *p_load)
+{
+    cpu_load_summary(p_src->permille, p_load);
+}
+
+/*
+ * @return the last source registered, NULL if none exited yet
+ */
+cpu_load_src_t const *cpu_load_first(void)
+{
+    return m_p_srcs;
+}
@@ -0,0 +1,88 @@
+#ifndef CPU_LOAD_H
+#define CPU_LOAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nrf.h"
+
+/* CPU load over rolling windows, so the headroom left by the capture, the
+ * metrics and the radio is known before an added feature starts dropping
+ * samples. The DWT cycle counter only runs while the core is awake: the
+ * thread's busy time is the cycles from cpu_load_wake(), after the idle
+ * loop's nrf_pwr_mgmt_run() returns, to cpu_load_sleep() before it is called
+ * again, and the wall time of a window is taken from RTC1. A handler defined
+ * with CPU_LOAD_DEF and wrapped in CPU_LOAD_ENTER and CPU_LOAD_EXIT, or a
+ * thread stage in CPU_LOAD_SCOPE, gets its own share: its cycles count
+ * towards it wherever it ran, and towards the busy time when it ran while the
+ * thread slept. A source's share takes in the interrupts that preempted it,
+ * only the outermost source is added to the busy time. Interrupts no source
+ * wraps (the SoftDevice's own, the app_timer, the uart) are seen only while
+ * the thread is awake, the load is a lower bound by their time asleep.
+ * cpu_load_process() closes a window every CPU_LOAD_WINDOW_MS into the
+ * percentages of the last window, the average and the peak of the last
+ * CPU_LOAD_WINDOWS, from the idle loop. A source registers itself on its
+ * first exit, cpu_load_first() and p_next walk them.
+ * Built with CPU_LOAD_ENABLED 0 (make CPU_LOAD=0) the macros compile to nothing */
+#ifndef CPU_LOAD_ENABLED
+#define CPU_LOAD_ENABLED            0
+#endif
+#define CPU_LOAD_WINDOW_MS          1000
+#define CPU_LOAD_WINDOWS            10      //the rolling average and peak are over 10 s
+#define CPU_LOAD_CLOCK_HZ           64000000
+#define CPU_LOAD_TICK_HZ            32768   //RTC1 at APP_TIMER_CONFIG_RTC_FREQUENCY 0
+#define CPU_LOAD_TICK_MASK          0x00FFFFFF
+
+typedef struct cpu_load_src_s {
+    char const *name;
+    struct cpu_load_src_s *p_next;          //registered sources, NULL for the last
+    uint8_t registered;
+    uint32_t entry_cycles;
+    uint32_t cycles;                        //in the window being counted
+    uint32_t count;                         //entries since the reset
+    uint16_t permille[CPU_LOAD_WINDOWS];    //of the closed windows
+} cpu_load_src_t;
+
+typedef struct {
+    uint16_t last;          //permille of the last window
+    uint16_t average;       //over the windows closed, up to CPU_LOAD_WINDOWS
+    uint16_t peak;
+    uint8_t windows;
+} cpu_load_t;
+
+#if CPU_LOAD_ENABLED
+#define CPU_LOAD_DEF(_src, _label)  cpu_load_src_t _src = {.name = _label}
+#define CPU_LOAD_ENTER(_src)        cpu_load_enter(&_src)
+#define CPU_LOAD_EXIT(_src)         cpu_load_exit(&_src)
+//counts the block that follows, a return or break out of it is not counted
+#define CPU_LOAD_SCOPE(_src)                                                    \
+    for (uint8_t _src ## _once = (cpu_load_enter(&_src), 1);                   \
+         _src ## _once;                                                         \
+         cpu_load_exit(&_src), _src ## _once = 0)
+#else
+#define CPU_LOAD_DEF(_src, _label)  extern cpu_load_src_t _src
+#define CPU_LOAD_ENTER(_src)
+#define CPU_LOAD_EXIT(_src)
+#define CPU_LOAD_SCOPE(_src)
+#endif
+
+void cpu_load_init(void);
+
+void cpu_load_reset(void);
+
+void cpu_load_sleep(void);
+
+void cpu_load_wake(void);
+
+void cpu_load_enter(cpu_load_src_t *p_src);
+
+void cpu_load_exit(cpu_load_src_t *p_src);
+
+void cpu_load_process(void);
+
+void cpu_load_get(cpu_load_t *p_load);
+
+void cpu_load_src_get(cpu_load_src_t const *p_src, cpu_load_t *p_load);
+
+cpu_load_src_t const *cpu_load_first(void);
+
+#endif //CPU_LOAD_H
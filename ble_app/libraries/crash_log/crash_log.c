@@ -0,0 +1,245 @@
+//-------------------------------------------
+// Title: crash_log.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Crash records of the HardFault and app error handlers in
+// the top 64KB of the flash, written by polling the spi from the fault
+// itself into a slot crash_log_init() left blank.
+//-------------------------------------------
+#include <stddef.h>
+#include <string.h>
+#include "crash_log.h"
+#include "mt25ql256aba.h"
+#include "mono_time.h"
+#include "app_error.h"
+#include "app_util.h"
+#include "crc32.h"
+#include "nrf.h"
+
+#define SLOTS                   (CRASH_LOG_SIZE/CRASH_LOG_RECORD_SIZE)
+#define CRASH_LOG_HEADER_SIZE   offsetof(crash_log_record_t, kind)
+#define BASIC_FRAME_WORDS       8
+#define ERASED_BYTE             0xFF
+
+STATIC_ASSERT(sizeof(crash_log_record_t) == CRASH_LOG_RECORD_SIZE);
+STATIC_ASSERT(CRASH_LOG_RECORD_SIZE == MT25QL256ABA_PAGE_SIZE);
+STATIC_ASSERT(CRASH_LOG_SUBSECTOR_SIZE == MT25QL256ABA_SUBSECTOR_4KB_SIZE);
+STATIC_ASSERT(CRASH_LOG_ADDRESS >= MT25QL256ABA_BENCH_ADDRESS + MT25QL256ABA_SECTOR_SIZE);
+STATIC_ASSERT(CRASH_LOG_END <= MT25QL256ABA_FLASH_SIZE);
+STATIC_ASSERT(CRASH_LOG_COUNTER_COUNT <= CRASH_LOG_COUNTERS);
+
+extern uint32_t __StackTop;
+extern uint32_t __StackLimit;
+
+static crash_log_record_t m_record;        //in RAM for EasyDMA and off a stack that may have overflowed
+static crash_log_counters_handler_t m_counters_handler = NULL;
+static uint32_t m_next_address = 0;         //blank slot of the next record, 0 before crash_log_init
+static uint32_t m_next_seq;
+static uint32_t m_last_address = 0;         //newest record, 0 if there is none
+static volatile bool m_writing = false;
+
+static uint32_t crash_log_crc(crash_log_record_t const *p_record)
+{
+    return crc32_compute((uint8_t const *) p_record + CRASH_LOG_HEADER_SIZE,
+                         sizeof(crash_log_record_t) - CRASH_LOG_HEADER_SIZE, NULL);
+}
+
+static bool crash_log_blank(uint32_t address)
+{
+    uint16_t i;
+
+    if (mt25ql256aba_read(address, (uint8_t *) &m_record, sizeof(m_record)) < 0)
+        return false;
+    for (i = 0; i < sizeof(m_record); i++)
+    {
+        if (((uint8_t const *) &m_record)[i] != ERASED_BYTE)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Finds the newest record and leaves the slot after it blank, erasing the
+ * subsector ahead when the ring comes round to it. Thread context with the
+ * flash to itself, once before the fault handlers can write
+ * @param counters_handler - fills the counters of a record, may be NULL
+ * @return 0 if success otherwise -1 on a flash error
+ */
+int8_t crash_log_init(crash_log_counters_handler_t counters_handler)
+{
+    uint32_t header[CRASH_LOG_HEADER_SIZE/sizeof(uint32_t)];
+    uint32_t address, newest_seq = 0;
+    uint16_t slot, checked;
+
+    m_next_address = 0;
+    m_last_address = 0;
+    m_counters_handler = counters_handler;
+
+    for (address = CRASH_LOG_ADDRESS; address < CRASH_LOG_END; address += CRASH_LOG_RECORD_SIZE)
+    {
+        if (mt25ql256aba_read(address, (uint8_t *) header, sizeof(header)) < 0)
+            return -1;
+        if (header[0] == CRASH_LOG_MAGIC && (m_last_address == 0 || (int32_t) (header[1] - newest_seq) > 0))
+        {
+            m_last_address = address;
+            newest_seq = header[1];
+        }
+    }
+
+    //past a torn slot to the next blank one, a slot that starts a subsector is erased instead
+    slot = (m_last_address == 0) ? 0 : ((m_last_address - CRASH_LOG_ADDRESS)/CRASH_LOG_RECORD_SIZE + 1) % SLOTS;
+    for (checked = 0; checked < SLOTS; checked++, slot = (slot + 1) % SLOTS)
+    {
+        address = CRASH_LOG_ADDRESS + slot*CRASH_LOG_RECORD_SIZE;
+        if (crash_log_blank(address))
+            break;
+        if ((address % CRASH_LOG_SUBSECTOR_SIZE) == 0)
+        {
+            if (mt25ql256aba_erase_block(address, CRASH_LOG_SUBSECTOR_SIZE) < 0)
+                return -1;
+            //the fault path must not find it erasing
+            mt25ql256aba_check_write_in_progress_flag();
+            break;
+        }
+    }
+    if (checked == SLOTS)
+        return -1;
+
+    m_next_seq = newest_seq + 1;
+    m_next_address = address;
+    return 0;
+}
+
+/*
+ * Reads the newest record, thread context with the flash to itself
+ * @return true if there is one and it is intact
+ */
+bool crash_log_last(crash_log_record_t *p_record)
+{
+    if (m_last_address == 0)
+        return false;
+    if (mt25ql256aba_read(m_last_address, (uint8_t *) p_record, sizeof(*p_record)) < 0)
+        return false;
+    return p_record->magic == CRASH_LOG_MAGIC && p_record->crc == crash_log_crc(p_record);
+}
+
+/*
+ * Starts the record, with the interrupts disabled
+ * @return false if no record can be written, before crash_log_init or in a fault of a fault
+ */
+static bool crash_log_begin(uint8_t kind)
+{
+    uint64_t mono_us, wall_us;
+
+    if (m_writing || m_next_address == 0)
+        return false;
+    m_writing = true;
+
+    memset(&m_record, 0, sizeof(m_record));
+    m_record.magic = CRASH_LOG_MAGIC;
+    m_record.seq = m_next_seq;
+    m_record.kind = kind;
+    mono_us = mono_time_us();
+    m_record.uptime_ms = (uint32_t) (mono_us/1000);
+    if (mono_time_wall_us(mono_us, &wall_us) == 0)
+        m_record.time_s = (uint32_t) (wall_us/1000000);
+    m_record.cfsr = SCB->CFSR;
+    m_record.hfsr = SCB->HFSR;
+    m_record.mmfar = SCB->MMFAR;
+    m_record.bfar = SCB->BFAR;
+    return true;
+}
+
+/*
+ * Copies the stack from address up, to the top of the main stack or for a
+ * task stack below it to its limit
+ */
+static void crash_log_stack(uint32_t address)
+{
+    uint32_t top = (address >= (uint32_t) &__StackLimit) ? (uint32_t) &__StackTop : (uint32_t) &__StackLimit;
+    uint8_t i;
+
+    for (i = 0; i < CRASH_LOG_STACK_WORDS && address + sizeof(uint32_t) <= top; i++, address += sizeof(uint32_t))
+        m_record.stack[i] = *(uint32_t const *) address;
+    m_record.stack_words = i;
+}
+
+static void crash_log_finish(void)
+{
+    if (m_counters_handler != NULL)
+        m_counters_handler(m_record.counters);
+    m_record.crc = crash_log_crc(&m_record);
+    (void) mt25ql256aba_panic_page_program(m_next_address, (uint8_t const *) &m_record, sizeof(m_record));
+    m_next_address = 0;
+}
+
+/*
+ * Writes the record of a HardFault, from its handler
+ * @param p_frame - the stacked r0-r3, r12, lr, pc and psr, NULL if the main stack overflowed
+ */
+void crash_log_fault(uint32_t const *p_frame)
+{
+    if (!crash_log_begin(CRASH_LOG_HARDFAULT))
+        return;
+
+    if (p_frame != NULL)
+    {
+        m_record.r0 = p_frame[0];
+        m_record.r1 = p_frame[1];
+        m_record.r2 = p_frame[2];
+        m_record.r3 = p_frame[3];
+        m_record.r12 = p_frame[4];
+        m_record.lr = p_frame[5];
+        m_record.pc = p_frame[6];
+        m_record.psr = p_frame[7];
+        m_record.sp = (uint32_t) p_frame;
+        crash_log_stack((uint32_t) &p_frame[BASIC_FRAME_WORDS]);
+    }
+    crash_log_finish();
+}
+
+/*
+ * Writes the record of a fatal error, from app_error_fault_handler with the
+ * interrupts disabled
+ * @param id   - NRF_FAULT_ID_ of the error
+ * @param pc   - where it was raised, 0 if unknown
+ * @param info - error_info_t of NRF_FAULT_ID_SDK_ERROR, assert_info_t of
+ *               NRF_FAULT_ID_SDK_ASSERT, kept as it is for the others
+ */
+void crash_log_error(uint32_t id, uint32_t pc, uint32_t info)
+{
+    uint8_t const *p_file = NULL;
+    size_t length;
+    uint32_t sp;
+
+    if (!crash_log_begin(CRASH_LOG_APP_ERROR))
+        return;
+
+    m_record.id = id;
+    m_record.pc = pc;
+    m_record.err_code = info;
+    if (id == NRF_FAULT_ID_SDK_ERROR)
+    {
+        m_record.err_code = ((error_info_t const *) info)->err_code;
+        m_record.line = (uint16_t) ((error_info_t const *) info)->line_num;
+        p_file = ((error_info_t const *) info)->p_file_name;
+    }
+    else if (id == NRF_FAULT_ID_SDK_ASSERT)
+    {
+        m_record.err_code = 0;
+        m_record.line = ((assert_info_t const *) info)->line_num;
+        p_file = ((assert_info_t const *) info)->p_file_name;
+    }
+    if (p_file != NULL)
+    {
+        //the end of the path is the file name
+        length = strlen((char const *) p_file);
+        if (length >= CRASH_LOG_FILE_SIZE)
+            p_file += length - (CRASH_LOG_FILE_SIZE - 1);
+        strncpy(m_record.file, (char const *) p_file, CRASH_LOG_FILE_SIZE - 1);
+    }
+
+    sp = (__get_CONTROL() & CONTROL_SPSEL_Msk) ? __get_PSP() : __get_MSP();
+    m_record.sp = sp;
+    crash_log_stack(sp);
+    crash_log_finish();
+}
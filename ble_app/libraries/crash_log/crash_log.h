@@ -0,0 +1,100 @@
+#ifndef CRASH_LOG_H
+#define CRASH_LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Post-mortem record of a HardFault or a fatal app error in the top 64KB of
+ * the flash, above the activity log, so a failure in the field can be
+ * diagnosed from the flash without reproducing it. The fault handler writes
+ * the record itself before anything else: the stacked registers, the fault
+ * status registers, the words on the stack above the frame and the pipeline
+ * counters the app fills in from its counters handler, one flash page. The
+ * spi is polled, the interrupts are off: mt25ql256aba_panic_page_program()
+ * takes the bus from whatever transfer was running, wakes the flash, suspends
+ * an erase and programs the page in a few hundred us, so the fault path never
+ * waits on the log's final flush over the uart. A fault in the write itself
+ * writes nothing more.
+ * The region is a ring of 4KB subsectors of 16 records. crash_log_init() finds
+ * the newest record and makes sure the slot after it is blank, erasing the
+ * subsector ahead while the app boots, so the fault path never erases. A record
+ * carries a sequence number that only grows and a crc32 of what follows it,
+ * the newest intact one is the last crash. tools/crash_decode prints the
+ * records of a flash image with the names of CRASH_LOG_COUNTER_LIST, so new
+ * counters go at the end
+ *   magic  uint32   CRASH_LOG_MAGIC
+ *   seq    uint32
+ *   crc    uint32   crc32 of the rest of the record
+ *   ...    see crash_log_record_t, little endian */
+#define CRASH_LOG_ADDRESS           0x01FF0000
+#define CRASH_LOG_SIZE              0x00010000
+#define CRASH_LOG_END               (CRASH_LOG_ADDRESS + CRASH_LOG_SIZE)
+#define CRASH_LOG_RECORD_SIZE       256 //one flash page
+#define CRASH_LOG_SUBSECTOR_SIZE    0x1000
+#define CRASH_LOG_MAGIC             0x48535243 //"CRSH"
+#define CRASH_LOG_FILE_SIZE         16 //end of the file name of an app error, with its terminator
+#define CRASH_LOG_COUNTERS          8
+#define CRASH_LOG_STACK_WORDS       31
+
+#define CRASH_LOG_HARDFAULT         1
+#define CRASH_LOG_APP_ERROR         2
+
+#define CRASH_LOG_COUNTER_LIST(X)                                                       \
+    X(CRASH_LOG_COUNTER_CAPTURES)       /* pipeline_stats_t captures */                 \
+    X(CRASH_LOG_COUNTER_DROPPED)        /* samples_dropped */                           \
+    X(CRASH_LOG_COUNTER_FIFO_OVERRUNS)  /* fifo_overruns */                             \
+    X(CRASH_LOG_COUNTER_COMMITS)        /* commits */                                   \
+    X(CRASH_LOG_COUNTER_EVENTS)         /* events in the store */                       \
+    X(CRASH_LOG_COUNTER_COMMIT_STATE)   /* commit state machine of the app */           \
+    X(CRASH_LOG_COUNTER_SPI_ERRORS)     /* failed transactions of the flash instance */ \
+    X(CRASH_LOG_COUNTER_TWI_TIMEOUTS)   /* i2c transfers abandoned */
+
+#define CRASH_LOG_COUNTER_ENUM(_id) _id,
+typedef enum {
+    CRASH_LOG_COUNTER_LIST(CRASH_LOG_COUNTER_ENUM)
+    CRASH_LOG_COUNTER_COUNT
+} crash_log_counter_t;
+#undef CRASH_LOG_COUNTER_ENUM
+
+/* One page, the frame fields are 0 for an app error but the pc */
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t crc;
+    uint8_t kind;           /* CRASH_LOG_HARDFAULT or CRASH_LOG_APP_ERROR */
+    uint8_t stack_words;    /* of stack, fewer near the top of the stack */
+    uint16_t line;          /* of an app error or assert */
+    uint32_t uptime_ms;     /* mono_time_us() */
+    uint32_t time_s;        /* seconds since 1970-01-01 UTC, 0 if the clock was not anchored */
+    uint32_t id;            /* NRF_FAULT_ID_ of an app error */
+    uint32_t err_code;      /* of NRF_FAULT_ID_SDK_ERROR, the info word of the others */
+    char file[CRASH_LOG_FILE_SIZE];
+    uint32_t r0;
+    uint32_t r1;
+    uint32_t r2;
+    uint32_t r3;
+    uint32_t r12;
+    uint32_t lr;
+    uint32_t pc;
+    uint32_t psr;
+    uint32_t sp;            /* the stacked frame, or the stack pointer of an app error, 0 for a stack overflow */
+    uint32_t cfsr;
+    uint32_t hfsr;
+    uint32_t mmfar;
+    uint32_t bfar;
+    uint32_t counters[CRASH_LOG_COUNTERS];      /* crash_log_counter_t */
+    uint32_t stack[CRASH_LOG_STACK_WORDS];      /* from the end of the basic frame up */
+} crash_log_record_t;
+
+/* Fills the counters of the record, from the fault handler: reads only */
+typedef void (*crash_log_counters_handler_t)(uint32_t *p_counters);
+
+int8_t crash_log_init(crash_log_counters_handler_t counters_handler);
+
+bool crash_log_last(crash_log_record_t *p_record);
+
+void crash_log_fault(uint32_t const *p_frame);
+
+void crash_log_error(uint32_t id, uint32_t pc, uint32_t info);
+
+#endif //CRASH_LOG_H
@@ -0,0 +1,117 @@
+//-------------------------------------------
+// Title: deep_sleep.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: System OFF with a GPIO sense wake up, and a block of
+// application state kept in retained RAM over it.
+//-------------------------------------------
+#include <string.h>
+#include "deep_sleep.h"
+#include "nrf.h"
+#include "app_error.h"
+#include "crc32.h"
+#include "nrf_pwr_mgmt.h"
+#ifdef SOFTDEVICE_PRESENT
+#include "nrf_sdh.h"
+#include "nrf_soc.h"
+#endif
+
+//nRF52832, RAM[n] powers two 4 kB sections from the start of the data RAM
+#define DEEP_SLEEP_RAM_BASE             0x20000000
+#define DEEP_SLEEP_RAM_SECTION_SIZE     0x1000
+#define DEEP_SLEEP_RAM_SECTIONS_PER_BLOCK 2
+
+typedef struct {
+    uint32_t magic;
+    uint16_t size;
+    uint16_t reserved;
+    uint32_t crc;           /* crc32 of size bytes of data */
+    uint8_t data[DEEP_SLEEP_RETAINED_SIZE];
+} deep_sleep_block_t;
+
+//neither zeroed nor copied at startup, see .noinit in ble_app_blinky_gcc_nrf52.ld
+static deep_sleep_block_t m_block __attribute__((section(".noinit")));
+
+/*
+ * Copies the state into the retained block, the last save before
+ * deep_sleep_enter() is the one restored
+ * @return 0 if success otherwise -2 if it does not fit
+ */
+int8_t deep_sleep_save(void const *p_state, uint16_t size)
+{
+    if (size > DEEP_SLEEP_RETAINED_SIZE)
+        return -2;
+
+    memcpy(m_block.data, p_state, size);
+    m_block.size = size;
+    m_block.reserved = 0;
+    m_block.crc = crc32_compute(m_block.data, size, NULL);
+    m_block.magic = DEEP_SLEEP_MAGIC;
+    return 0;
+}
+
+/*
+ * Takes the saved state back after a wake up and invalidates the block
+ * @return true if a block of this size was saved and is intact, p_state is left alone otherwise
+ */
+bool deep_sleep_restore(void *p_state, uint16_t size)
+{
+    bool valid = m_block.magic == DEEP_SLEEP_MAGIC && m_block.size == size
+              && size <= DEEP_SLEEP_RETAINED_SIZE
+              && m_block.crc == crc32_compute(m_block.data, size, NULL);
+
+    if (valid)
+        memcpy(p_state, m_block.data, size);
+    m_block.magic = 0;
+    return valid;
+}
+
+/*
+ * Keeps the RAM sections holding the block powered in System OFF
+ */
+static void deep_sleep_retain_block(void)
+{
+    uint32_t start = ((uint32_t) &m_block - DEEP_SLEEP_RAM_BASE) / DEEP_SLEEP_RAM_SECTION_SIZE;
+    uint32_t end = ((uint32_t) &m_block + sizeof(m_block) - 1 - DEEP_SLEEP_RAM_BASE) / DEEP_SLEEP_RAM_SECTION_SIZE;
+
+    for (uint32_t section = start; section <= end; section++)
+    {
+        uint32_t index = section / DEEP_SLEEP_RAM_SECTIONS_PER_BLOCK;
+        uint32_t mask = (section % DEEP_SLEEP_RAM_SECTIONS_PER_BLOCK) ? POWER_RAM_POWERSET_S1RETENTION_Msk
+                                                                      : POWER_RAM_POWERSET_S0RETENTION_Msk;
+#ifdef SOFTDEVICE_PRESENT
+        if (nrf_sdh_is_enabled())
+        {
+            APP_ERROR_CHECK(sd_power_ram_power_set(index, mask));
+            continue;
+        }
+#endif
+        NRF_POWER->RAM[index].POWERSET = mask;
+    }
+}
+
+/*
+ * Enters System OFF, the given pins wake the chip with a reset. The SENSE of
+ * every other pin is cleared so a GPIOTE port event left on one does not
+ * wake it at once. A wake up pin already at its level resets straight away.
+ * Does not return, the state to keep has to be saved first
+ */
+void deep_sleep_enter(deep_sleep_wake_pin_t const *p_pins, uint8_t num_pins)
+{
+    for (uint32_t pin = 0; pin < NUMBER_OF_PINS; pin++)
+    {
+        nrf_gpio_cfg_sense_set(pin, NRF_GPIO_PIN_NOSENSE);
+    }
+    for (uint8_t i = 0; i < num_pins; i++)
+    {
+        nrf_gpio_cfg_sense_input(p_pins[i].pin, p_pins[i].pull, p_pins[i].sense);
+    }
+    deep_sleep_retain_block();
+
+    //runs the shutdown handlers, flushes the log and enters System OFF
+    nrf_pwr_mgmt_shutdown(NRF_PWR_MGMT_SHUTDOWN_GOTO_SYSOFF);
+    while (1)
+    {
+        //only reached if a shutdown handler holds off the System OFF
+        __WFE();
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef DEEP_SLEEP_H
+#define DEEP_SLEEP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nrf_gpio.h"
+
+/* System OFF deep sleep with a GPIO sense wake up. Only the wake up pins keep
+ * their SENSE, the sensors driving them stay powered and everything else is
+ * off: the cpu, the clocks, the app_timer RTC and the RAM but the section
+ * holding the saved state. The wake up is a reset, the application boots
+ * again (boot_check counts POWER_RESETREAS_OFF as a warm boot) and takes its
+ * state back with deep_sleep_restore() instead of rebuilding it.
+ * The state is copied into a block in the .noinit section of the linker
+ * script, it is not zeroed at startup and its RAM section is retained
+ * through System OFF. A magic and a crc32 tell a saved block from the random
+ * RAM of a power-on, a restore invalidates it so it is only taken back once */
+#define DEEP_SLEEP_MAGIC            0x534C4550 //"SLEP"
+#define DEEP_SLEEP_RETAINED_SIZE    1024       //bytes of application state a save can hold
+
+typedef struct {
+    uint32_t pin;
+    nrf_gpio_pin_pull_t pull;
+    nrf_gpio_pin_sense_t sense;     /* level that wakes the chip */
+} deep_sleep_wake_pin_t;
+
+int8_t deep_sleep_save(void const *p_state, uint16_t size);
+
+bool deep_sleep_restore(void *p_state, uint16_t size);
+
+void deep_sleep_enter(deep_sleep_wake_pin_t const *p_pins, uint8_t num_pins);
+
+#endif //DEEP_SLEEP_H
@@ -0,0 +1,175 @@
+//-------------------------------------------
+// Title: device_config.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: The FDS record of the per board calibration and settings of
+// device_config.h and its RAM copy, read at boot and rewritten whole on a save.
+//-------------------------------------------
+#include <stddef.h>
+#include <string.h>
+#include "fds.h"
+#include "nrf_pwr_mgmt.h"
+#include "app_util.h"
+
+#include "device_config.h"
+#include "adxl372.h"
+#include "icm20649.h"
+
+#define DEVICE_CONFIG_WORDS     BYTES_TO_WORDS(sizeof(device_config_t))
+
+static const device_config_t m_defaults = {
+    .version = DEVICE_CONFIG_VERSION,
+    .size = sizeof(device_config_t),
+    .accel_offset = ADXL372_DEFAULT_OFFSET_TRIM,
+    .profile = 0,
+    .icm_bias_temp_cc = ICM20649_TEMP_UNKNOWN,
+};
+
+static device_config_t m_config;
+static uint32_t m_saved[DEVICE_CONFIG_WORDS];   //FDS reads the data until the write completes
+static bool m_stored = false;
+static volatile bool m_fds_ready = false;
+static volatile ret_code_t m_fds_init_result;
+static volatile bool m_save_retry = false;      //the write is redone once the garbage collection is done
+
+static ret_code_t device_config_write(void);
+
+static void fds_evt_handler(fds_evt_t const * p_evt)
+{
+    switch (p_evt->id)
+    {
+        case FDS_EVT_INIT:
+            m_fds_init_result = p_evt->result;
+            m_fds_ready = true;
+            break;
+
+        case FDS_EVT_GC:
+            if (m_save_retry)
+            {
+                m_save_retry = false;
+                (void) device_config_write();
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Writes m_saved over the config record, or a new one if there is none,
+// returns FDS_SUCCESS if the write or the garbage collection before it is queued
+static ret_code_t device_config_write(void)
+{
+    fds_record_t const record = {
+        .file_id = DEVICE_CONFIG_FILE_ID,
+        .key = DEVICE_CONFIG_RECORD_KEY,
+        .data = {.p_data = m_saved, .length_words = DEVICE_CONFIG_WORDS},
+    };
+    fds_record_desc_t desc;
+    fds_find_token_t token;
+    ret_code_t err_code;
+
+    memset(&token, 0, sizeof(token));
+    if (fds_record_find(DEVICE_CONFIG_FILE_ID, DEVICE_CONFIG_RECORD_KEY, &desc, &token) == FDS_SUCCESS)
+    {
+        err_code = fds_record_update(&desc, &record);
+    }
+    else
+    {
+        err_code = fds_record_write(NULL, &record);
+    }
+    if (err_code == FDS_ERR_NO_SPACE_IN_FLASH && !m_save_retry)
+    {
+        //the old copies of the record fill the pages
+        err_code = fds_gc();
+        m_save_retry = (err_code == FDS_SUCCESS);
+    }
+
+    return err_code;
+}
+
+// Copies the stored record over the defaults, the fields it has and no more
+static void device_config_load(void const *p_data, uint32_t length_words)
+{
+    device_config_t const *p_stored = (device_config_t const *) p_data;
+    uint32_t size = length_words*sizeof(uint32_t);
+
+    if (size < offsetof(device_config_t, accel_offset) || p_stored->version != DEVICE_CONFIG_VERSION)
+        return;
+
+    size = MIN(MIN(size, p_stored->size), sizeof(m_config));
+    memcpy(&m_config, p_stored, size);
+    m_config.size = sizeof(m_config);
+    m_stored = true;
+}
+
+/**
+ * @brief Mounts FDS and reads the config record, thread context after the
+ * SoftDevice is enabled. Waits for the FDS init, which needs its flash events
+ * @return 0 if success, -1 if FDS could not be mounted (the defaults are then in use)
+ */
+int8_t device_config_init(void)
+{
+    fds_flash_record_t flash_record;
+    fds_record_desc_t desc;
+    fds_find_token_t token;
+
+    m_config = m_defaults;
+
+    if (fds_register(fds_evt_handler) != FDS_SUCCESS || fds_init() != FDS_SUCCESS)
+        return -1;
+    while (!m_fds_ready)
+    {
+        nrf_pwr_mgmt_run();
+    }
+    if (m_fds_init_result != FDS_SUCCESS)
+        return -1;
+
+    memset(&token, 0, sizeof(token));
+    if (fds_record_find(DEVICE_CONFIG_FILE_ID, DEVICE_CONFIG_RECORD_KEY, &desc, &token) != FDS_SUCCESS)
+        return 0;
+    if (fds_record_open(&desc, &flash_record) != FDS_SUCCESS)
+        return 0;
+    device_config_load(flash_record.p_data, flash_record.p_header->length_words);
+    (void) fds_record_close(&desc);
+
+    return 0;
+}
+
+/*
+ * @return the config in use, the stored one or the defaults
+ */
+device_config_t const *device_config_get(void)
+{
+    return &m_config;
+}
+
+/*
+ * @return true if the config in use came from the flash, false if it is the defaults
+ */
+bool device_config_stored(void)
+{
+    return m_stored;
+}
+
+/*
+ * Makes the config the one in use and keeps it for the next boot, thread
+ * context. The write finishes in the background, a failed one only loses the
+ * change over a reset
+ * @return 0 if the write is queued, -1 if FDS refused it
+ */
+int8_t device_config_save(device_config_t const *p_config)
+{
+    m_config = *p_config;
+    m_config.version = DEVICE_CONFIG_VERSION;
+    m_config.size = sizeof(m_config);
+    if (!m_fds_ready || m_fds_init_result != FDS_SUCCESS)
+        return -1;
+
+    memset(m_saved, 0, sizeof(m_saved));
+    memcpy(m_saved, &m_config, sizeof(m_config));
+    if (device_config_write() != FDS_SUCCESS)
+        return -1;
+
+    m_stored = true;
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef DEVICE_CONFIG_H
+#define DEVICE_CONFIG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Per board calibration and settings, one FDS record in the pages at the top
+ * of the application flash, read once at boot into a RAM copy that the rest
+ * of the firmware takes its values from, so a board is calibrated without a
+ * rebuild. The record is the struct as it is stored: fields are only added at
+ * the end, a shorter record from an older build keeps the defaults of the
+ * fields it does not have, and DEVICE_CONFIG_VERSION changes only when a
+ * field changes its meaning, which drops the stored record for the defaults.
+ * device_config_init() owns the FDS init, other FDS users of the same image
+ * register before it. A save rewrites the whole record in the background,
+ * FDS leaves the old copy behind and a garbage collection makes room once
+ * its pages fill */
+#define DEVICE_CONFIG_FILE_ID           0x4443  //FDS file of the config record
+#define DEVICE_CONFIG_RECORD_KEY        0x0001
+#define DEVICE_CONFIG_VERSION           1
+
+typedef struct {
+    uint16_t version;               //DEVICE_CONFIG_VERSION
+    uint16_t size;                  //bytes of the record as it was saved
+    uint8_t accel_offset[3];        //adxl372 OFFSET_X..OFFSET_Z trims
+    uint8_t profile;                //sampling profile at boot
+    int16_t icm_accel_bias[3];      //icm20649 accel counts taken off every sample
+    int16_t icm_gyro_bias[3];       //icm20649 gyro counts taken off every sample
+    int16_t icm_bias_temp_cc;       //die temperature of the gyro bias in 0.01 C, ICM20649_TEMP_UNKNOWN if not kept
+    int16_t icm_gyro_temp_slope[3]; //gyro bias drift in 0.001 counts per C, icm20649_temp_comp_t
+    uint8_t data_key[16];           //AES-128 key of the stored events, event_crypt.h, all zero to store them in the clear
+} device_config_t;
+
+int8_t device_config_init(void);
+
+device_config_t const *device_config_get(void);
+
+bool device_config_stored(void);
+
+int8_t device_config_save(device_config_t const *p_config);
+
+#endif //DEVICE_CONFIG_H
@@ -0,0 +1,230 @@
+//-------------------------------------------
+// Title: energy_profiler.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Per power state time accumulators for the ENERGY_ENTER and
+// ENERGY_EXIT marks of energy_profiler.h, and the charge estimate from the
+// current of each state, so a firmware change can be compared in mAh per
+// day without a power analyzer on the helmet.
+//-------------------------------------------
+#include "energy_profiler.h"
+#include "nrf.h"
+#include "app_util.h"
+#include "app_util_platform.h"
+
+#define ENERGY_US_TO_TICKS(_us)     ((uint32_t) (((uint64_t) (_us) * ENERGY_TICK_HZ + 999999) / 1000000))
+
+typedef struct {
+    char const *name;
+    uint32_t default_ua;
+    uint32_t max_ticks;     /* longest interval, 0 if unbounded */
+    uint32_t lead_ticks;    /* trimmed from every interval */
+} energy_state_desc_t;
+
+typedef struct {
+    bool open;
+    uint32_t start;         /* tick the open interval was last folded at */
+    uint32_t run;           /* ticks of the open interval so far */
+    uint64_t ticks;
+} energy_state_acc_t;
+
+static const energy_state_desc_t m_desc[ENERGY_STATE_COUNT] = {
+    [ENERGY_STATE_SLEEP]         = {"sleep",    ENERGY_SLEEP_UA,         0, 0},
+    [ENERGY_STATE_CPU]           = {"cpu",      ENERGY_CPU_UA,           0, 0},
+    [ENERGY_STATE_SAMPLING]      = {"sampling", ENERGY_SAMPLING_UA,      0, 0},
+    [ENERGY_STATE_FLASH_PROGRAM] = {"program",  ENERGY_FLASH_PROGRAM_UA, ENERGY_US_TO_TICKS(ENERGY_FLASH_PROGRAM_MAX_US), 0},
+    [ENERGY_STATE_FLASH_ERASE]   = {"erase",    ENERGY_FLASH_ERASE_UA,   ENERGY_US_TO_TICKS(ENERGY_FLASH_ERASE_MAX_US), 0},
+    [ENERGY_STATE_RADIO]         = {"radio",    ENERGY_RADIO_UA,         0, ENERGY_US_TO_TICKS(ENERGY_RADIO_LEAD_US)},
+    [ENERGY_STATE_HFXO]          = {"hfxo",     ENERGY_HFXO_UA,          0, 0},
+};
+
+static energy_state_acc_t m_acc[ENERGY_STATE_COUNT];
+static uint32_t m_current_ua[ENERGY_STATE_COUNT];
+static uint32_t m_last;         /* tick the total was last folded at */
+static uint64_t m_total_ticks;
+
+static uint32_t energy_now(void)
+{
+    return NRF_RTC1->COUNTER;
+}
+
+/*
+ * Adds the ticks of an open interval since it was last folded, up to the
+ * longest the state can last. Interrupts masked by the caller
+ */
+static void energy_fold(energy_state_t state, uint32_t now)
+{
+    energy_state_acc_t *acc = &m_acc[state];
+    uint32_t ticks = (now - acc->start) & ENERGY_TICK_MASK;
+
+    acc->start = now;
+    if (m_desc[state].max_ticks != 0 && acc->run + ticks > m_desc[state].max_ticks)
+        ticks = (acc->run < m_desc[state].max_ticks) ? m_desc[state].max_ticks - acc->run : 0;
+    acc->run += ticks;
+    acc->ticks += ticks;
+}
+
+/*
+ * Starts counting from now with the cpu awake, the datasheet currents and
+ * every state but the cpu closed. The app_timer has to be running
+ */
+void energy_profiler_init(void)
+{
+    for (int i = 0; i < ENERGY_STATE_COUNT; ++i)
+        m_current_ua[i] = m_desc[i].default_ua;
+
+    energy_profiler_reset();
+    energy_profiler_enter(ENERGY_STATE_CPU);
+}
+
+/*
+ * Clears the times, the states that are entered stay entered and count from
+ * now. The currents are kept
+ */
+void energy_profiler_reset(void)
+{
+    CRITICAL_REGION_ENTER();
+    uint32_t now = energy_now();
+
+    for (int i = 0; i < ENERGY_STATE_COUNT; ++i)
+    {
+        m_acc[i].start = now;
+        m_acc[i].run = 0;
+        m_acc[i].ticks = 0;
+    }
+    m_last = now;
+    m_total_ticks = 0;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Opens an interval of the state, from thread or interrupt context. Use the
+ * ENERGY_ENTER macro so a build without the profiler drops the call
+ */
+void energy_profiler_enter(energy_state_t state)
+{
+    if (state == ENERGY_STATE_SLEEP || state >= ENERGY_STATE_COUNT)
+        return;
+
+    CRITICAL_REGION_ENTER();
+    if (!m_acc[state].open)
+    {
+        m_acc[state].open = true;
+        m_acc[state].start = energy_now();
+        m_acc[state].run = 0;
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Closes the interval of the state, from thread or interrupt context. Use the
+ * ENERGY_EXIT macro so a build without the profiler drops the call
+ */
+void energy_profiler_exit(energy_state_t state)
+{
+    energy_state_acc_t *acc;
+
+    if (state == ENERGY_STATE_SLEEP || state >= ENERGY_STATE_COUNT)
+        return;
+    acc = &m_acc[state];
+
+    CRITICAL_REGION_ENTER();
+    if (acc->open)
+    {
+        energy_fold(state, energy_now());
+        //the state started this much after the interval was opened
+        acc->ticks -= MIN(m_desc[state].lead_ticks, acc->run);
+        acc->open = false;
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Folds the open intervals and the total in, call from the idle loop at least
+ * once per RTC wrap (512 s)
+ */
+void energy_profiler_process(void)
+{
+    CRITICAL_REGION_ENTER();
+    uint32_t now = energy_now();
+
+    for (int i = 0; i < ENERGY_STATE_COUNT; ++i)
+    {
+        if (m_acc[i].open)
+            energy_fold((energy_state_t) i, now);
+    }
+    m_total_ticks += (now - m_last) & ENERGY_TICK_MASK;
+    m_last = now;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Copies the times so far and the currents, sleep is the time the cpu was not awake
+ * @param p_snapshot - filled in
+ */
+void energy_profiler_snapshot(energy_snapshot_t *p_snapshot)
+{
+    energy_profiler_process();
+
+    CRITICAL_REGION_ENTER();
+    p_snapshot->total_ticks = m_total_ticks;
+    for (int i = 0; i < ENERGY_STATE_COUNT; ++i)
+    {
+        p_snapshot->ticks[i] = m_acc[i].ticks;
+        p_snapshot->current_ua[i] = m_current_ua[i];
+    }
+    CRITICAL_REGION_EXIT();
+
+    p_snapshot->ticks[ENERGY_STATE_SLEEP] = (p_snapshot->total_ticks > p_snapshot->ticks[ENERGY_STATE_CPU])
+                                          ? p_snapshot->total_ticks - p_snapshot->ticks[ENERGY_STATE_CPU] : 0;
+}
+
+/*
+ * Replaces the current of a state, e.g. with one measured on a board
+ * @return 0 if success, -2 if the state is invalid
+ */
+int8_t energy_profiler_current_set(energy_state_t state, uint32_t current_ua)
+{
+    if (state >= ENERGY_STATE_COUNT)
+        return -2;
+
+    m_current_ua[state] = current_ua;
+
+    return 0;
+}
+
+/*
+ * @return the share of the state in the average current in uA, its current
+ * weighted by the fraction of the time it was in
+ */
+uint32_t energy_profiler_state_ua(energy_snapshot_t const *p_snapshot, energy_state_t state)
+{
+    if (state >= ENERGY_STATE_COUNT || p_snapshot->total_ticks == 0)
+        return 0;
+
+    return (uint32_t) ((p_snapshot->ticks[state] * p_snapshot->current_ua[state]) / p_snapshot->total_ticks);
+}
+
+/*
+ * @return the average current since the reset in uA, 24 of them times this
+ * over 1000 is the mAh per day
+ */
+uint32_t energy_profiler_average_ua(energy_snapshot_t const *p_snapshot)
+{
+    uint64_t charge = 0;
+
+    if (p_snapshot->total_ticks == 0)
+        return 0;
+
+    for (int i = 0; i < ENERGY_STATE_COUNT; ++i)
+        charge += p_snapshot->ticks[i] * p_snapshot->current_ua[i];
+
+    return (uint32_t) (charge / p_snapshot->total_ticks);
+}
+
+/*
+ * @return the name of the state for the cli, NULL if invalid
+ */
+char const *energy_profiler_state_name(energy_state_t state)
+{
+    return (state < ENERGY_STATE_COUNT) ? m_desc[state].name : NULL;
+}
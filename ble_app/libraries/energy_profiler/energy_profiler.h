@@ -0,0 +1,104 @@
+#ifndef ENERGY_PROFILER_H
+#define ENERGY_PROFILER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Time spent in each power state, counted in RTC1 ticks of the app_timer, and
+ * the charge it costs from a current per state. The cpu is awake or asleep,
+ * sleep is whatever time the cpu state is not entered, and the other states
+ * draw on top of either: sampling while the sensors measure, flash program and
+ * erase while the flash is busy, radio during the SoftDevice radio events,
+ * hfxo while the app holds the crystal (hf_clock).
+ * ENERGY_ENTER and ENERGY_EXIT mark a state from thread or interrupt context,
+ * a state entered twice counts once and an exit of a state that is not entered
+ * does nothing, so a driver can close both flash states whenever it sees the
+ * flash ready. Some ends are only seen late, an interval is cut to the longest
+ * the state can last (ENERGY_*_MAX_US), and an interval whose start is
+ * signalled ahead of time (the radio notification) is trimmed by that lead.
+ * The RTC wraps after 512 s: energy_profiler_process() folds the open
+ * intervals in and has to run more often than that, from the idle loop.
+ * The currents are datasheet figures to start from, energy_profiler_current_set()
+ * replaces them with ones measured on a board, and the estimate is the charge
+ * over the whole time since the reset, as an average current.
+ * Built with ENERGY_PROFILER_ENABLED 0 (the default, imu_pcb_rev1_app turns
+ * it on unless made with ENERGY=0) the macros compile to nothing */
+#ifndef ENERGY_PROFILER_ENABLED
+#define ENERGY_PROFILER_ENABLED         0
+#endif
+#define ENERGY_TICK_HZ                  32768 //RTC1 at APP_TIMER_CONFIG_RTC_FREQUENCY 0
+#define ENERGY_TICK_MASK                0x00FFFFFF
+
+//defaults of the current per state, in uA
+#ifndef ENERGY_SLEEP_UA
+#define ENERGY_SLEEP_UA                 20    //System ON idle with the RTC, flash and rtc chip in standby
+#endif
+#ifndef ENERGY_CPU_UA
+#define ENERGY_CPU_UA                   3700  //nRF52832 running from flash at 64 MHz with the DC/DC
+#endif
+#ifndef ENERGY_SAMPLING_UA
+#define ENERGY_SAMPLING_UA              3200  //adxl372 measuring and icm20649 accel and gyro in low noise mode
+#endif
+#ifndef ENERGY_FLASH_PROGRAM_UA
+#define ENERGY_FLASH_PROGRAM_UA         15000 //mt25ql256aba page program
+#endif
+#ifndef ENERGY_FLASH_ERASE_UA
+#define ENERGY_FLASH_ERASE_UA           15000 //mt25ql256aba sector erase
+#endif
+#ifndef ENERGY_RADIO_UA
+#define ENERGY_RADIO_UA                 7000  //radio tx at 0 dBm or rx with the DC/DC
+#endif
+#ifndef ENERGY_HFXO_UA
+#define ENERGY_HFXO_UA                  250   //64 MHz crystal oscillator over HFINT
+#endif
+
+#define ENERGY_FLASH_PROGRAM_MAX_US     1800    //tPP max, the driver sees the end at its next access
+#define ENERGY_FLASH_ERASE_MAX_US       1000000 //tSE max of a 64KB sector
+#define ENERGY_RADIO_LEAD_US            800     //NRF_RADIO_NOTIFICATION_DISTANCE_800US
+
+typedef enum {
+    ENERGY_STATE_SLEEP = 0,     /* the rest of the time, not entered */
+    ENERGY_STATE_CPU,
+    ENERGY_STATE_SAMPLING,
+    ENERGY_STATE_FLASH_PROGRAM,
+    ENERGY_STATE_FLASH_ERASE,
+    ENERGY_STATE_RADIO,
+    ENERGY_STATE_HFXO,
+    ENERGY_STATE_COUNT
+} energy_state_t;
+
+typedef struct {
+    uint64_t total_ticks;                   /* since the reset */
+    uint64_t ticks[ENERGY_STATE_COUNT];
+    uint32_t current_ua[ENERGY_STATE_COUNT];
+} energy_snapshot_t;
+
+#if ENERGY_PROFILER_ENABLED
+#define ENERGY_ENTER(_state)    energy_profiler_enter(_state)
+#define ENERGY_EXIT(_state)     energy_profiler_exit(_state)
+#else
+#define ENERGY_ENTER(_state)
+#define ENERGY_EXIT(_state)
+#endif
+
+void energy_profiler_init(void);
+
+void energy_profiler_reset(void);
+
+void energy_profiler_enter(energy_state_t state);
+
+void energy_profiler_exit(energy_state_t state);
+
+void energy_profiler_process(void);
+
+void energy_profiler_snapshot(energy_snapshot_t *p_snapshot);
+
+int8_t energy_profiler_current_set(energy_state_t state, uint32_t current_ua);
+
+uint32_t energy_profiler_state_ua(energy_snapshot_t const *p_snapshot, energy_state_t state);
+
+uint32_t energy_profiler_average_ua(energy_snapshot_t const *p_snapshot);
+
+char const *energy_profiler_state_name(energy_state_t state);
+
+#endif //ENERGY_PROFILER_H
@@ -0,0 +1,452 @@
+//-------------------------------------------
+// Title: esb_offload.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Enhanced ShockBurst burst offload in SoftDevice radio
+// timeslots. ESB is set up again at the start of every timeslot and
+// stopped before its end, the payload queues live here so nothing is
+// lost in between. The timeslot signals run above everything, the ESB
+// events in SWI3 and the caller in thread context: the tx queue is
+// only popped by the ESB events, the rx ring only pushed by them, and
+// what ESB still holds when a timeslot ends goes to a carry the thread
+// empties before the next one receives.
+//-------------------------------------------
+#include <stddef.h>
+#include <string.h>
+#include "esb_offload.h"
+#include "nrf_esb.h"
+#include "nrf_soc.h"
+#include "nrf_sdh_soc.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+
+#define TICKS_TIMEOUT   APP_TIMER_TICKS(ESB_OFFLOAD_TIMEOUT_MS)
+#define QUEUE_MASK      (ESB_OFFLOAD_QUEUE_SIZE - 1)
+#define RX_QUEUE_MASK   (ESB_OFFLOAD_RX_QUEUE_SIZE - 1)
+
+STATIC_ASSERT(NRF_ESB_MAX_PAYLOAD_LENGTH >= ESB_OFFLOAD_PAYLOAD_SIZE);
+STATIC_ASSERT((ESB_OFFLOAD_QUEUE_SIZE & QUEUE_MASK) == 0);
+STATIC_ASSERT((ESB_OFFLOAD_RX_QUEUE_SIZE & RX_QUEUE_MASK) == 0);
+
+//the ESB radio interrupt, the SoftDevice hands it over as a timeslot signal
+void RADIO_IRQHandler(void);
+
+typedef struct {
+    uint8_t length;         //with the sequence byte
+    uint8_t data[ESB_OFFLOAD_PAYLOAD_SIZE];
+    uint32_t tag;
+} esb_slot_t;
+
+static volatile esb_offload_role_t m_role = ESB_OFFLOAD_IDLE;
+static volatile bool m_session_open = false;
+static volatile bool m_failed;
+static uint8_t m_base_addr[4];
+static uint8_t m_prefix;
+static nrf_radio_request_t m_request;
+static nrf_radio_signal_callback_return_param_t m_return;
+static volatile uint32_t m_last_ticks;  //of the last ack or payload
+
+//tx, the thread pushes and the ESB events pop
+static esb_slot_t m_queue[ESB_OFFLOAD_QUEUE_SIZE];
+static volatile uint32_t m_head;
+static volatile uint32_t m_tail;
+static volatile bool m_in_flight;
+static volatile uint8_t m_sent_seq;
+static volatile bool m_acked_new;
+static volatile uint32_t m_acked_tag;
+static uint8_t m_seq;
+static bool m_end_queued;
+
+//rx, the ESB events push, the end of a timeslot fills the carry and the thread pops both
+static esb_slot_t m_rx[ESB_OFFLOAD_RX_QUEUE_SIZE];
+static volatile uint32_t m_rx_head;
+static volatile uint32_t m_rx_tail;
+static esb_slot_t m_carry[NRF_ESB_RX_FIFO_SIZE];
+static volatile uint8_t m_carry_count;
+static volatile uint8_t m_carry_pos;
+static uint8_t m_rx_seq;
+static bool m_rx_end;
+
+static void esb_offload_on_soc_evt(uint32_t evt_id, void *p_context);
+
+NRF_SDH_SOC_OBSERVER(m_esb_offload_soc_obs, ESB_OFFLOAD_SOC_OBSERVER_PRIO, esb_offload_on_soc_evt, NULL);
+
+/*
+ * Hands the payload at the tail to ESB once the last one is acked. From the
+ * start of a timeslot, the ESB events or the thread with them masked
+ */
+static void esb_offload_tx_next(void)
+{
+    nrf_esb_payload_t payload;
+    esb_slot_t const *p_slot;
+
+    if (m_in_flight || m_tail == m_head)
+        return;
+    p_slot = &m_queue[m_tail & QUEUE_MASK];
+    memset(&payload, 0, offsetof(nrf_esb_payload_t, data));
+    payload.length = p_slot->length;
+    memcpy(payload.data, p_slot->data, p_slot->length);
+    if (nrf_esb_write_payload(&payload) != NRF_SUCCESS)
+        return;
+    m_sent_seq = p_slot->data[0];
+    m_in_flight = true;
+    (void) nrf_esb_start_tx();
+}
+
+// Takes the payloads ESB received into the rx ring while it has room, the rest wait in ESB
+static void esb_offload_rx_take(void)
+{
+    nrf_esb_payload_t payload;
+    esb_slot_t *p_slot;
+
+    while (m_rx_head - m_rx_tail < ESB_OFFLOAD_RX_QUEUE_SIZE
+           && nrf_esb_read_rx_payload(&payload) == NRF_SUCCESS)
+    {
+        p_slot = &m_rx[m_rx_head & RX_QUEUE_MASK];
+        p_slot->length = payload.length;
+        memcpy(p_slot->data, payload.data, payload.length);
+        m_rx_head++;
+        m_last_ticks = app_timer_cnt_get();
+    }
+}
+
+static void esb_offload_esb_handler(nrf_esb_evt_t const *p_event)
+{
+    switch (p_event->evt_id)
+    {
+        case NRF_ESB_EVENT_TX_SUCCESS:
+            //a payload sent again from the start of a timeslot may be acked twice, only the first pops it
+            if (m_in_flight && m_tail != m_head && m_queue[m_tail & QUEUE_MASK].data[0] == m_sent_seq)
+            {
+                m_acked_tag = m_queue[m_tail & QUEUE_MASK].tag;
+                m_acked_new = true;
+                m_tail++;
+            }
+            m_last_ticks = app_timer_cnt_get();
+            m_in_flight = false;
+            esb_offload_tx_next();
+            break;
+
+        case NRF_ESB_EVENT_TX_FAILED:
+            //out of retransmits, it stays at the head of the ESB fifo and goes again
+            m_in_flight = false;
+            (void) nrf_esb_flush_tx();
+            esb_offload_tx_next();
+            break;
+
+        case NRF_ESB_EVENT_RX_RECEIVED:
+            esb_offload_rx_take();
+            break;
+    }
+}
+
+// Sets ESB up for the role at the start of a timeslot
+static void esb_offload_slot_start(void)
+{
+    nrf_esb_config_t config = NRF_ESB_DEFAULT_CONFIG;
+
+    config.mode = (m_role == ESB_OFFLOAD_TX) ? NRF_ESB_MODE_PTX : NRF_ESB_MODE_PRX;
+    config.event_handler = esb_offload_esb_handler;
+    config.payload_length = ESB_OFFLOAD_PAYLOAD_SIZE;
+    config.retransmit_count = ESB_OFFLOAD_RETRANSMITS;
+    config.tx_mode = NRF_ESB_TXMODE_MANUAL;
+    config.event_irq_priority = APP_IRQ_PRIORITY_HIGH;
+    if (nrf_esb_init(&config) != NRF_SUCCESS
+        || nrf_esb_set_base_address_0(m_base_addr) != NRF_SUCCESS
+        || nrf_esb_set_prefixes(&m_prefix, 1) != NRF_SUCCESS
+        || nrf_esb_set_rf_channel(ESB_OFFLOAD_RF_CHANNEL) != NRF_SUCCESS)
+        return;
+
+    //the end of the last timeslot took the payload in the air back
+    m_in_flight = false;
+    if (m_role == ESB_OFFLOAD_TX)
+        esb_offload_tx_next();
+    else if (m_carry_pos == m_carry_count)
+    {
+        //the carry is empty, so the ring stays in order
+        m_carry_count = 0;
+        m_carry_pos = 0;
+        (void) nrf_esb_start_rx();
+    }
+}
+
+// Stops ESB before the timeslot ends, what it received and acked goes to the carry
+static void esb_offload_slot_end(void)
+{
+    nrf_esb_payload_t payload;
+
+    if (m_role == ESB_OFFLOAD_RX && m_carry_count == 0)
+    {
+        (void) nrf_esb_stop_rx();
+        while (m_carry_count < NRF_ESB_RX_FIFO_SIZE && nrf_esb_read_rx_payload(&payload) == NRF_SUCCESS)
+        {
+            m_carry[m_carry_count].length = payload.length;
+            memcpy(m_carry[m_carry_count].data, payload.data, payload.length);
+            m_carry_count++;
+        }
+    }
+    (void) nrf_esb_disable();
+    m_in_flight = false;
+}
+
+static nrf_radio_signal_callback_return_param_t *esb_offload_signal(uint8_t signal_type)
+{
+    m_return.callback_action = NRF_RADIO_SIGNAL_CALLBACK_ACTION_NONE;
+
+    switch (signal_type)
+    {
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_START:
+            //TIMER0 counts the timeslot in us from 0
+            NRF_TIMER0->EVENTS_COMPARE[0] = 0;
+            NRF_TIMER0->CC[0] = ESB_OFFLOAD_SLOT_US - ESB_OFFLOAD_SLOT_MARGIN_US;
+            NRF_TIMER0->INTENSET = TIMER_INTENSET_COMPARE0_Msk;
+            NVIC_EnableIRQ(TIMER0_IRQn);
+            esb_offload_slot_start();
+            break;
+
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_RADIO:
+            RADIO_IRQHandler();
+            break;
+
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_TIMER0:
+            NRF_TIMER0->EVENTS_COMPARE[0] = 0;
+            NRF_TIMER0->INTENCLR = TIMER_INTENCLR_COMPARE0_Msk;
+            esb_offload_slot_end();
+            if (m_role != ESB_OFFLOAD_IDLE)
+            {
+                m_return.callback_action = NRF_RADIO_SIGNAL_CALLBACK_ACTION_REQUEST_AND_END;
+                m_return.params.request.p_next = &m_request;
+            }
+            else
+                m_return.callback_action = NRF_RADIO_SIGNAL_CALLBACK_ACTION_END;
+            break;
+
+        default:
+            break;
+    }
+
+    return &m_return;
+}
+
+static void esb_offload_on_soc_evt(uint32_t evt_id, void *p_context)
+{
+    switch (evt_id)
+    {
+        case NRF_EVT_RADIO_BLOCKED:
+        case NRF_EVT_RADIO_CANCELED:
+            //the SoftDevice needed the radio, ask again
+            if (m_role != ESB_OFFLOAD_IDLE)
+                (void) sd_radio_request(&m_request);
+            break;
+
+        case NRF_EVT_RADIO_SIGNAL_CALLBACK_INVALID_RETURN:
+            m_failed = true;
+            break;
+
+        case NRF_EVT_RADIO_SESSION_CLOSED:
+            m_session_open = false;
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*
+ * Opens the radio session for a role and asks for the first timeslot
+ * @param addr - the helmet's BLE address, the ESB address is built from it
+ * @return 0 if success, -1 if the SoftDevice refused, -2 if a session is still open
+ */
+static int8_t esb_offload_start(esb_offload_role_t role, uint8_t const *addr)
+{
+    if (m_role != ESB_OFFLOAD_IDLE || m_session_open)
+        return -2;
+
+    memcpy(m_base_addr, addr, sizeof(m_base_addr));
+    m_prefix = addr[4] ^ addr[5];
+    m_head = m_tail = 0;
+    m_in_flight = false;
+    m_acked_new = false;
+    m_seq = 0;
+    m_end_queued = false;
+    m_rx_head = m_rx_tail = 0;
+    m_carry_count = m_carry_pos = 0;
+    m_rx_seq = 0;
+    m_rx_end = false;
+    m_failed = false;
+    m_last_ticks = app_timer_cnt_get();
+
+    memset(&m_request, 0, sizeof(m_request));
+    m_request.request_type = NRF_RADIO_REQ_TYPE_EARLIEST;
+    m_request.params.earliest.hfclk = NRF_RADIO_HFCLK_CFG_XTAL_GUARANTEED;
+    m_request.params.earliest.priority = NRF_RADIO_PRIORITY_NORMAL;
+    m_request.params.earliest.length_us = ESB_OFFLOAD_SLOT_US;
+    m_request.params.earliest.timeout_us = ESB_OFFLOAD_REQUEST_TIMEOUT_US;
+
+    if (sd_radio_session_open(esb_offload_signal) != NRF_SUCCESS)
+        return -1;
+    m_session_open = true;
+    m_role = role;
+    if (sd_radio_request(&m_request) != NRF_SUCCESS)
+    {
+        esb_offload_stop();
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Starts sending to the gateway listening on the helmet's address
+ * @return as esb_offload_start
+ */
+int8_t esb_offload_tx_start(uint8_t const *addr)
+{
+    return esb_offload_start(ESB_OFFLOAD_TX, addr);
+}
+
+/*
+ * @return payloads that can be queued
+ */
+uint8_t esb_offload_tx_space(void)
+{
+    return ESB_OFFLOAD_QUEUE_SIZE - (m_head - m_tail);
+}
+
+/*
+ * Queues a payload of the offload stream, an empty one ends the session
+ * @param tag - handed back by esb_offload_tx_acked() once the gateway has the payload
+ * @return 0 if success, -2 if too long or nothing is sending, -3 if the queue is full
+ */
+int8_t esb_offload_tx_queue(uint8_t const *data, uint8_t length, uint32_t tag)
+{
+    esb_slot_t *p_slot;
+
+    if (m_role != ESB_OFFLOAD_TX || length > ESB_OFFLOAD_DATA_SIZE || m_end_queued)
+        return -2;
+    if (esb_offload_tx_space() == 0)
+        return -3;
+
+    p_slot = &m_queue[m_head & QUEUE_MASK];
+    p_slot->data[0] = m_seq++;
+    memcpy(&p_slot->data[1], data, length);
+    p_slot->length = length + 1;
+    p_slot->tag = tag;
+    m_end_queued = (length == 0);
+
+    //with the ESB events masked, the timeslot only starts and ends with none in the air
+    NVIC_DisableIRQ(ESB_EVT_IRQ);
+    m_head++;
+    if (m_tail + 1 == m_head)
+        esb_offload_tx_next();
+    NVIC_EnableIRQ(ESB_EVT_IRQ);
+
+    return 0;
+}
+
+/*
+ * Takes the tag of the last payload the gateway acked
+ * @return true if one was acked since the last call
+ */
+bool esb_offload_tx_acked(uint32_t *p_tag)
+{
+    bool acked;
+
+    CRITICAL_REGION_ENTER();
+    acked = m_acked_new;
+    *p_tag = m_acked_tag;
+    m_acked_new = false;
+    CRITICAL_REGION_EXIT();
+    return acked;
+}
+
+/*
+ * @return true once the empty payload that ends the session is acked
+ */
+bool esb_offload_tx_done(void)
+{
+    return m_end_queued && m_tail == m_head;
+}
+
+/*
+ * Starts listening for a helmet
+ * @return as esb_offload_start
+ */
+int8_t esb_offload_rx_start(uint8_t const *addr)
+{
+    return esb_offload_start(ESB_OFFLOAD_RX, addr);
+}
+
+/*
+ * Takes the data of the next payload received in order, copies dropped
+ * @param data - ESB_OFFLOAD_DATA_SIZE bytes
+ * @return true if there was one
+ */
+bool esb_offload_rx_get(uint8_t *data, uint8_t *p_length)
+{
+    esb_slot_t const *p_slot;
+
+    for (;;)
+    {
+        if (m_rx_tail != m_rx_head)
+            p_slot = &m_rx[m_rx_tail & RX_QUEUE_MASK];
+        else if (m_carry_pos != m_carry_count)
+            p_slot = &m_carry[m_carry_pos];
+        else
+            return false;
+
+        if (p_slot->length > 0 && p_slot->data[0] == m_rx_seq && !m_rx_end)
+        {
+            m_rx_seq++;
+            *p_length = p_slot->length - 1;
+            memcpy(data, &p_slot->data[1], *p_length);
+            m_rx_end = (*p_length == 0);
+        }
+        else
+            *p_length = 0;
+
+        if (m_rx_tail != m_rx_head)
+            m_rx_tail++;
+        else
+            m_carry_pos++;
+        if (*p_length > 0)
+            return true;
+    }
+}
+
+/*
+ * @return true once the helmet ended the session, or went quiet for ESB_OFFLOAD_TIMEOUT_MS
+ * and everything received is taken
+ */
+bool esb_offload_rx_done(void)
+{
+    if (m_rx_end)
+        return true;
+    return m_rx_tail == m_rx_head && m_carry_pos == m_carry_count && esb_offload_failed();
+}
+
+/*
+ * @return true if the session got no ack or payload for ESB_OFFLOAD_TIMEOUT_MS
+ */
+bool esb_offload_failed(void)
+{
+    if (m_role == ESB_OFFLOAD_TX && m_tail == m_head)
+        return m_failed;
+    return m_failed || app_timer_cnt_diff_compute(app_timer_cnt_get(), m_last_ticks) > TICKS_TIMEOUT;
+}
+
+/*
+ * Closes the session, the timeslot running ends with ESB stopped. A new
+ * one can start once the SoftDevice has closed it
+ */
+void esb_offload_stop(void)
+{
+    if (m_role == ESB_OFFLOAD_IDLE)
+        return;
+    m_role = ESB_OFFLOAD_IDLE;
+    (void) sd_radio_session_close();
+}
+
+esb_offload_role_t esb_offload_role(void)
+{
+    return m_role;
+}
@@ -0,0 +1,77 @@
+#ifndef ESB_OFFLOAD_H
+#define ESB_OFFLOAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Burst offload over Enhanced ShockBurst at 2 Mbps, for a sideline gateway
+ * that pulls a helmet's store faster than a BLE link: no connection events,
+ * no ATT header, payloads of up to 252 bytes acked by the radio itself. The
+ * radio stays the SoftDevice's, ESB runs in the timeslots of a radio session
+ * (sd_radio_session_open), ESB_OFFLOAD_SLOT_US each and requested again as
+ * each one ends, so a helmet that dropped its link and stopped advertising
+ * gets them back to back and the BLE links of the gateway keep theirs.
+ * The helmet is the PTX, the gateway the PRX, both on the address built
+ * from the helmet's BLE address so two gateways never take each other's.
+ * The helmet sends the same byte stream as the other offloads (serial_offload.h)
+ * in payloads of a sequence byte and up to ESB_OFFLOAD_DATA_SIZE bytes, in
+ * manual tx mode so exactly one is in the air: the next goes once ESB has
+ * the ack of the last, a payload still in the air when a timeslot ends is
+ * sent again in the next one and the gateway drops the copy by its sequence.
+ * A payload that ran out of retransmits is retried the same way, after
+ * ESB_OFFLOAD_TIMEOUT_MS without an ack the session fails. An empty payload
+ * ends the session. The gateway takes a payload into its ring only while it
+ * has room, past that the payloads wait in ESB's rx fifo and once it is full
+ * ESB stops acking and the helmet waits, so a full uart on the gateway paces
+ * the helmet without losing data. What ESB holds when a timeslot ends is
+ * carried over and the next timeslot only listens once it is taken.
+ * Each payload queued carries a tag, the helmet takes the tag of the last one
+ * acked for its ack watermark since nothing else acks an ESB offload.
+ * ESB takes TIMER2, TIMER3 on the nRF52832, PPI channels 7 to 13 and SWI3 for
+ * the session, an image that has ESB_OFFLOAD_ENABLED leaves them to it and
+ * builds nrf_esb with ESB_EVT_IRQ on SWI3_EGU3, SWI0 stays the app_timer's
+ * and SWI1 the radio notification's;
+ * thread context for all calls */
+#define ESB_OFFLOAD_PAYLOAD_SIZE    252 //NRF_ESB_MAX_PAYLOAD_LENGTH the image builds with
+#define ESB_OFFLOAD_DATA_SIZE       (ESB_OFFLOAD_PAYLOAD_SIZE - 1) //after the sequence byte
+#define ESB_OFFLOAD_QUEUE_SIZE      8   //payloads, a power of two
+#define ESB_OFFLOAD_RX_QUEUE_SIZE   32  //payloads, a power of two
+#define ESB_OFFLOAD_SLOT_US         10000 //fits between the connection events of the gateway's other links
+#define ESB_OFFLOAD_SLOT_MARGIN_US  1000 //ESB is stopped this long before the timeslot ends
+#define ESB_OFFLOAD_REQUEST_TIMEOUT_US 100000
+#define ESB_OFFLOAD_TIMEOUT_MS      3000
+#define ESB_OFFLOAD_RETRANSMITS     15
+#ifndef ESB_OFFLOAD_RF_CHANNEL
+#define ESB_OFFLOAD_RF_CHANNEL      60  //2460 MHz
+#endif
+#define ESB_OFFLOAD_SOC_OBSERVER_PRIO 1
+
+typedef enum {
+    ESB_OFFLOAD_IDLE = 0,
+    ESB_OFFLOAD_TX,
+    ESB_OFFLOAD_RX,
+} esb_offload_role_t;
+
+int8_t esb_offload_tx_start(uint8_t const *addr);
+
+uint8_t esb_offload_tx_space(void);
+
+int8_t esb_offload_tx_queue(uint8_t const *data, uint8_t length, uint32_t tag);
+
+bool esb_offload_tx_acked(uint32_t *p_tag);
+
+bool esb_offload_tx_done(void);
+
+int8_t esb_offload_rx_start(uint8_t const *addr);
+
+bool esb_offload_rx_get(uint8_t *data, uint8_t *p_length);
+
+bool esb_offload_rx_done(void);
+
+bool esb_offload_failed(void);
+
+void esb_offload_stop(void);
+
+esb_offload_role_t esb_offload_role(void);
+
+#endif //ESB_OFFLOAD_H
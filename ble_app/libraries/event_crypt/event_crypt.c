@@ -0,0 +1,89 @@
+//-------------------------------------------
+// Title: event_crypt.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: AES-128 counter mode keystream for the samples of the
+// stored events, through the SoftDevice's ECB, and the random nonce a
+// store format draws from the SoftDevice's random pool.
+//-------------------------------------------
+#include <string.h>
+#include "event_crypt.h"
+#include "app_error.h"
+#include "nrf_soc.h"
+
+/*
+ * Keeps the key of the cipher, the context to give event_store_cipher_set()
+ */
+void event_crypt_init(event_crypt_t *crypt, uint8_t const key[EVENT_CRYPT_KEY_SIZE])
+{
+    memcpy(crypt->key, key, EVENT_CRYPT_KEY_SIZE);
+}
+
+/*
+ * Tells a key from the all zero one that stands for none
+ */
+bool event_crypt_key_set(uint8_t const key[EVENT_CRYPT_KEY_SIZE])
+{
+    uint8_t i;
+
+    for (i = 0; i < EVENT_CRYPT_KEY_SIZE; i++)
+        if (key[i] != 0)
+            return true;
+    return false;
+}
+
+/*
+ * Draws the nonce of a new store format from the SoftDevice's random pool,
+ * waiting for the pool to hold enough bytes, an event_store_nonce_t. The
+ * SoftDevice has to be enabled
+ */
+uint32_t event_crypt_nonce_new(void)
+{
+    uint32_t nonce;
+    uint8_t available;
+
+    do
+    {
+        APP_ERROR_CHECK(sd_rand_application_bytes_available_get(&available));
+    } while (available < sizeof(nonce));
+    APP_ERROR_CHECK(sd_rand_application_vector_get((uint8_t *) &nonce, sizeof(nonce)));
+
+    return nonce;
+}
+
+static void put_le32(uint8_t *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/*
+ * XORs the samples of an event with the keystream from the byte offset on,
+ * enciphering and deciphering alike, an event_store_cipher_t
+ * @param p_context - the event_crypt_t
+ * @param nonce - of the store format
+ */
+void event_crypt_apply(void *p_context, uint32_t nonce, uint32_t id, event_store_time_t const *time,
+                       uint32_t offset, uint8_t *data, uint32_t length)
+{
+    event_crypt_t const *crypt = (event_crypt_t const *) p_context;
+    nrf_ecb_hal_data_t ecb;
+    uint32_t block = offset/EVENT_CRYPT_BLOCK_SIZE;
+    uint32_t skip = offset % EVENT_CRYPT_BLOCK_SIZE;
+    uint32_t i;
+
+    memcpy(ecb.key, crypt->key, EVENT_CRYPT_KEY_SIZE);
+    put_le32(&ecb.cleartext[0], id ^ nonce);
+    put_le32(&ecb.cleartext[4], time->s);
+    put_le32(&ecb.cleartext[8], time->us);
+    while (length > 0)
+    {
+        put_le32(&ecb.cleartext[12], block);
+        APP_ERROR_CHECK(sd_ecb_block_encrypt(&ecb));
+        for (i = skip; i < EVENT_CRYPT_BLOCK_SIZE && length > 0; i++, length--)
+            *data++ ^= ecb.ciphertext[i];
+        skip = 0;
+        block++;
+    }
+}
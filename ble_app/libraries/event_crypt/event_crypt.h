@@ -0,0 +1,37 @@
+#ifndef EVENT_CRYPT_H
+#define EVENT_CRYPT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "event_store.h"
+
+/* AES-128 in counter mode for the samples of the events, the cipher the app
+ * gives event_store_cipher_set(). The block cipher is the ECB peripheral run
+ * through the SoftDevice, sd_ecb_block_encrypt() takes about 7 us a block, so
+ * enciphering a page costs no more than copying it. The counter block is the
+ * event id XOR the nonce of the store format, the event time in s and us and
+ * the index of the 16 byte block in the samples, each a little endian
+ * uint32_t. A format starts the ids again, the nonce it draws with
+ * event_crypt_nonce_new() (event_store_nonce_set) keeps the keystream of its
+ * events apart from the ones before it even on a device whose clock was
+ * never set. A store formatted before the nonce has 0, its events keep their
+ * keystream. Counter mode needs no padding and deciphers with the same call,
+ * the host decoder does it in software with the nonce from the superblock of
+ * a flash image or the one 'config' prints */
+#define EVENT_CRYPT_KEY_SIZE    16
+#define EVENT_CRYPT_BLOCK_SIZE  16
+
+typedef struct {
+    uint8_t key[EVENT_CRYPT_KEY_SIZE];
+} event_crypt_t;
+
+void event_crypt_init(event_crypt_t *crypt, uint8_t const key[EVENT_CRYPT_KEY_SIZE]);
+
+bool event_crypt_key_set(uint8_t const key[EVENT_CRYPT_KEY_SIZE]);
+
+uint32_t event_crypt_nonce_new(void);
+
+void event_crypt_apply(void *p_context, uint32_t nonce, uint32_t id, event_store_time_t const *time,
+                       uint32_t offset, uint8_t *data, uint32_t length);
+
+#endif //EVENT_CRYPT_H
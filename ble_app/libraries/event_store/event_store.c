@@ -0,0 +1,2180 @@
+//-------------------------------------------
+// Title: event_store.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Persistent log structured store of impact events on the
+// mt25ql256aba. Events are appended one after another round a ring of the
+// whole array, packed across the pages, and never erased in place, the index maps an event id to its
+// ring address so any event is found with one read. The ring is only
+// erased over events that were acked or fall below the retention peak, a
+// pinned one is copied forward to free the ring behind it. On boot the append pointer is
+// recovered from the last index entry instead of erasing the chip.
+// Not interrupt safe, call from thread context with the flash spi instance initialized.
+//-------------------------------------------
+#include <stddef.h>
+#include <string.h>
+#include "event_store.h"
+#include "crc32.h"
+#include "app_util.h"
+
+#define EVENT_STORE_ERASED_WORD 0xFFFFFFFF
+#define EVENT_STORE_SUMMARY_END_V6  offsetof(event_store_header_t, summary.clip_points) //a header before version 7 stops at the duration
+#define EVENT_STORE_HEADER_SIZE_V6  (EVENT_STORE_SUMMARY_END_V6 + 2*sizeof(uint32_t)) //and its data_crc and header_crc follow
+
+//the offload frames carry the header as it is, tools/offload_decode depends on the layout
+STATIC_ASSERT(sizeof(event_store_header_t) == 56);
+STATIC_ASSERT(sizeof(event_store_preview_t) == 36);
+STATIC_ASSERT(EVENT_STORE_HEADER_SIZE_V6 == 48);
+//an ack log word holds a count and its complement in 16 bits each, of a watermark at most this far behind
+STATIC_ASSERT(EVENT_STORE_MAX_EVENTS + EVENT_STORE_INDEX_SUBSECTOR_ENTRIES < 0xFFFF);
+//an index erase frees whole ids, an index page never spans the end of the ring
+STATIC_ASSERT(EVENT_STORE_MAX_EVENTS % EVENT_STORE_INDEX_SUBSECTOR_ENTRIES == 0);
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nonce;         /* erased in a store formatted before it, read as 0 */
+} event_store_superblock_t;
+
+static uint32_t event_store_align_page(uint32_t address)
+{
+    return (address + MT25QL256ABA_PAGE_SIZE - 1) & ~(uint32_t)(MT25QL256ABA_PAGE_SIZE - 1);
+}
+
+static uint32_t event_store_align_event(uint32_t address)
+{
+    return (address + EVENT_STORE_EVENT_ALIGN - 1) & ~(uint32_t)(EVENT_STORE_EVENT_ALIGN - 1);
+}
+
+static uint32_t event_store_index_address(uint32_t id)
+{
+    return EVENT_STORE_INDEX_ADDRESS + (id % EVENT_STORE_MAX_EVENTS)*sizeof(uint32_t);
+}
+
+static uint32_t event_store_ack_address(uint32_t slot)
+{
+    return EVENT_STORE_ACK_ADDRESS + slot*sizeof(uint32_t);
+}
+
+/*
+ * @return the ack log word of a count, the count and its complement so a word a reset cut
+ * short never reads as a count: a program only clears bits, the halves no longer match
+ */
+static uint32_t event_store_ack_encode(uint32_t count)
+{
+    return ((~count & 0xFFFF) << 16) | (count & 0xFFFF);
+}
+
+/*
+ * @return true if an ack log word holds a whole count, the words of older builds hold the bare count
+ */
+static bool event_store_ack_decode(uint32_t word, uint32_t *p_count)
+{
+    *p_count = word & 0xFFFF;
+    return (word >> 16) == 0 || (word >> 16) == (~word & 0xFFFF);
+}
+
+/*
+ * @return the flash address of a ring address
+ */
+static uint32_t event_store_flash_address(uint32_t address)
+{
+    return EVENT_STORE_DATA_ADDRESS + (address - EVENT_STORE_DATA_ADDRESS) % EVENT_STORE_RING_SIZE;
+}
+
+/*
+ * Reads from a ring address, in two reads if it runs past the end of the flash
+ * @return 0 if success otherwise -1
+ */
+static int8_t event_store_read(uint32_t address, void *data, uint32_t length)
+{
+    uint32_t flash_address = event_store_flash_address(address);
+    uint32_t first = MIN(length, EVENT_STORE_DATA_END - flash_address);
+    int8_t ret;
+
+    ret = mt25ql256aba_read(flash_address, (uint8_t *) data, first);
+    if (ret < 0 || first == length)
+        return ret;
+
+    return mt25ql256aba_read(EVENT_STORE_DATA_ADDRESS, (uint8_t *) data + first, length - first);
+}
+
+/*
+ * Programs at a ring address a page at a time, a header and a preview of a
+ * packed event can start anywhere in a page and run into the next one
+ * @return 0 if success otherwise -1
+ */
+static int8_t event_store_program(uint32_t address, void const *data, uint32_t length)
+{
+    uint8_t const *p_data = (uint8_t const *) data;
+    uint32_t chunk;
+    int8_t ret;
+
+    while (length > 0)
+    {
+        chunk = MIN(length, MT25QL256ABA_PAGE_SIZE - address % MT25QL256ABA_PAGE_SIZE);
+        ret = mt25ql256aba_page_program(event_store_flash_address(address), p_data, chunk);
+        if (ret < 0)
+            return ret;
+        address += chunk;
+        p_data += chunk;
+        length -= chunk;
+    }
+
+    return 0;
+}
+
+static uint32_t event_store_header_crc(event_store_header_t const *header)
+{
+    return crc32_compute((uint8_t const *) header, offsetof(event_store_header_t, header_crc), NULL);
+}
+
+static uint32_t event_store_data_size(event_store_header_t const *header)
+{
+    return header->sample_count * header->sample_size;
+}
+
+/*
+ * @return the size of an event header in the flash of the store's version
+ */
+static uint32_t event_store_header_size(event_store_t const *store)
+{
+    return (store->version >= 7) ? sizeof(event_store_header_t) : EVENT_STORE_HEADER_SIZE_V6;
+}
+
+/*
+ * @return the offset of the samples from the header in the flash of the store's version,
+ * the preview sits between them from version 6 on
+ */
+static uint32_t event_store_data_offset(event_store_t const *store)
+{
+    return event_store_header_size(store) + ((store->version >= 6) ? sizeof(event_store_preview_t) : 0);
+}
+
+/*
+ * Suspends a background erase so a read or a commit does not wait for it,
+ * it is resumed by the next event_store_erase_step
+ * @return 0 if success otherwise -1
+ */
+static int8_t event_store_preempt_erase(event_store_t *store)
+{
+    bool suspended;
+    int8_t ret;
+
+    if (store->erase_pending == 0 || store->erase_suspended)
+        return 0;
+
+    ret = mt25ql256aba_suspend(&suspended);
+    if (ret < 0)
+        return ret;
+
+    if (suspended)
+    {
+        store->erase_suspended = true;
+    }
+    else
+    {
+        //finished before the suspend
+        store->erased_until += store->erase_pending;
+        store->erase_pending = 0;
+    }
+
+    return 0;
+}
+
+/*
+ * Empties the cache
+ */
+static void event_store_cache_reset(event_store_cache_t *cache)
+{
+    uint32_t i;
+
+    memset(cache, 0, sizeof(event_store_cache_t));
+    for (i = 0; i < EVENT_STORE_CACHE_INDEX_PAGES; i++)
+        cache->index[i].page = EVENT_STORE_CACHE_EMPTY;
+    for (i = 0; i < EVENT_STORE_CACHE_HEADERS; i++)
+        cache->headers[i].id = EVENT_STORE_CACHE_EMPTY;
+    for (i = 0; i < EVENT_STORE_CACHE_BLOCKS; i++)
+        cache->blocks[i].id = EVENT_STORE_CACHE_EMPTY;
+}
+
+/*
+ * Reads the index entry of an event from its cached page, the least recently
+ * used page is replaced by a one page read on a miss. Call with no erase running
+ * @return 0 if success otherwise -1
+ */
+static int8_t event_store_index_get(event_store_t *store, uint32_t id, uint32_t *p_address)
+{
+    event_store_cache_t *cache = store->cache;
+    event_store_index_cache_t *entry;
+    uint32_t page = id / EVENT_STORE_INDEX_PAGE_ENTRIES;
+    uint32_t i;
+    int8_t ret;
+
+    if (cache == NULL)
+        return mt25ql256aba_read(event_store_index_address(id), (uint8_t *) p_address, sizeof(uint32_t));
+
+    entry = &cache->index[0];
+    for (i = 0; i < EVENT_STORE_CACHE_INDEX_PAGES; i++)
+    {
+        if (cache->index[i].page == page)
+        {
+            entry = &cache->index[i];
+            entry->used = ++cache->clock;
+            cache->hits++;
+            *p_address = entry->entries[id % EVENT_STORE_INDEX_PAGE_ENTRIES];
+            return 0;
+        }
+        if (cache->index[i].used < entry->used)
+            entry = &cache->index[i];
+    }
+
+    cache->misses++;
+    entry->page = EVENT_STORE_CACHE_EMPTY;
+    ret = mt25ql256aba_read(event_store_index_address(page * EVENT_STORE_INDEX_PAGE_ENTRIES),
+                            (uint8_t *) entry->entries, sizeof(entry->entries));
+    if (ret < 0)
+        return ret;
+    entry->page = page;
+    entry->used = ++cache->clock;
+    *p_address = entry->entries[id % EVENT_STORE_INDEX_PAGE_ENTRIES];
+
+    return 0;
+}
+
+/*
+ * Writes an index entry just programmed through to its page if it is cached
+ */
+static void event_store_index_put(event_store_t *store, uint32_t id, uint32_t address)
+{
+    uint32_t page = id / EVENT_STORE_INDEX_PAGE_ENTRIES;
+    uint32_t i;
+
+    if (store->cache == NULL)
+        return;
+    for (i = 0; i < EVENT_STORE_CACHE_INDEX_PAGES; i++)
+    {
+        if (store->cache->index[i].page == page)
+            store->cache->index[i].entries[id % EVENT_STORE_INDEX_PAGE_ENTRIES] = address;
+    }
+}
+
+/*
+ * @return the cached header of an event, NULL if it is not cached
+ */
+static event_store_header_cache_t *event_store_header_find(event_store_t *store, uint32_t id)
+{
+    event_store_cache_t *cache = store->cache;
+    uint32_t i;
+
+    if (cache == NULL)
+        return NULL;
+    for (i = 0; i < EVENT_STORE_CACHE_HEADERS; i++)
+    {
+        if (cache->headers[i].id == id)
+        {
+            cache->headers[i].used = ++cache->clock;
+            cache->hits++;
+            return &cache->headers[i];
+        }
+    }
+    cache->misses++;
+
+    return NULL;
+}
+
+/*
+ * Keeps a checked header in place of the least recently used one
+ */
+static void event_store_header_put(event_store_t *store, uint32_t id, uint32_t address,
+                                   event_store_header_t const *header)
+{
+    event_store_cache_t *cache = store->cache;
+    event_store_header_cache_t *entry;
+    uint32_t i;
+
+    if (cache == NULL)
+        return;
+    entry = &cache->headers[0];
+    for (i = 1; i < EVENT_STORE_CACHE_HEADERS; i++)
+    {
+        if (cache->headers[i].used < entry->used)
+            entry = &cache->headers[i];
+    }
+    entry->id = id;
+    entry->used = ++cache->clock;
+    entry->address = address;
+    entry->header = *header;
+}
+
+/*
+ * Drops the cached header and sample blocks of an event
+ */
+static void event_store_header_drop(event_store_t *store, uint32_t id)
+{
+    uint32_t i;
+
+    if (store->cache == NULL)
+        return;
+    for (i = 0; i < EVENT_STORE_CACHE_HEADERS; i++)
+    {
+        if (store->cache->headers[i].id == id)
+            store->cache->headers[i].id = EVENT_STORE_CACHE_EMPTY;
+    }
+    for (i = 0; i < EVENT_STORE_CACHE_BLOCKS; i++)
+    {
+        if (store->cache->blocks[i].id == id)
+            store->cache->blocks[i].id = EVENT_STORE_CACHE_EMPTY;
+    }
+}
+
+/*
+ * Drops the cached sample blocks of the events reclaimed, below oldest_id
+ */
+static void event_store_blocks_reclaim(event_store_t *store)
+{
+    uint32_t i;
+
+    if (store->cache == NULL)
+        return;
+    for (i = 0; i < EVENT_STORE_CACHE_BLOCKS; i++)
+    {
+        if (store->cache->blocks[i].id != EVENT_STORE_CACHE_EMPTY && store->cache->blocks[i].id < store->oldest_id)
+            store->cache->blocks[i].id = EVENT_STORE_CACHE_EMPTY;
+    }
+}
+
+/*
+ * @return the cached block of an event, NULL if it is not cached
+ */
+static event_store_block_cache_t *event_store_block_find(event_store_cache_t *cache, uint32_t id, uint32_t block)
+{
+    uint32_t i;
+
+    for (i = 0; i < EVENT_STORE_CACHE_BLOCKS; i++)
+    {
+        if (cache->blocks[i].id == id && cache->blocks[i].block == block)
+            return &cache->blocks[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * @return the least recently used block, to be replaced
+ */
+static event_store_block_cache_t *event_store_block_lru(event_store_cache_t *cache)
+{
+    event_store_block_cache_t *entry = &cache->blocks[0];
+    uint32_t i;
+
+    for (i = 1; i < EVENT_STORE_CACHE_BLOCKS; i++)
+    {
+        if (cache->blocks[i].used < entry->used)
+            entry = &cache->blocks[i];
+    }
+
+    return entry;
+}
+
+/*
+ * @return true if the cached blocks of an event hold length bytes of its samples at offset
+ */
+static bool event_store_blocks_held(event_store_cache_t *cache, uint32_t id, uint32_t offset, uint32_t length)
+{
+    event_store_block_cache_t *entry;
+    uint32_t end = offset + length;
+    uint32_t block;
+    uint32_t from;
+    uint32_t to;
+
+    while (offset < end)
+    {
+        block = offset / EVENT_STORE_CACHE_BLOCK_SIZE;
+        from = offset % EVENT_STORE_CACHE_BLOCK_SIZE;
+        to = (end - block*EVENT_STORE_CACHE_BLOCK_SIZE < EVENT_STORE_CACHE_BLOCK_SIZE)
+           ? end - block*EVENT_STORE_CACHE_BLOCK_SIZE : EVENT_STORE_CACHE_BLOCK_SIZE;
+        entry = event_store_block_find(cache, id, block);
+        if (entry == NULL || from < entry->from || to > entry->to)
+            return false;
+        offset = block*EVENT_STORE_CACHE_BLOCK_SIZE + to;
+    }
+
+    return true;
+}
+
+/*
+ * Reads length bytes of the samples of an event at offset through the
+ * cache, a block that misses is read whole into the least recently used one
+ * @param address - ring address of the event
+ * @param size    - bytes of its samples
+ * @return 0 if success otherwise -1
+ */
+static int8_t event_store_blocks_read(event_store_t *store, uint32_t id, uint32_t address, uint32_t size,
+                                      uint32_t offset, uint8_t *data, uint32_t length)
+{
+    event_store_cache_t *cache = store->cache;
+    event_store_block_cache_t *entry;
+    uint32_t end = offset + length;
+    uint32_t block;
+    uint32_t from;
+    uint32_t to;
+    uint32_t num_bytes;
+    int8_t ret;
+
+    while (offset < end)
+    {
+        block = offset / EVENT_STORE_CACHE_BLOCK_SIZE;
+        from = offset % EVENT_STORE_CACHE_BLOCK_SIZE;
+        to = (end - block*EVENT_STORE_CACHE_BLOCK_SIZE < EVENT_STORE_CACHE_BLOCK_SIZE)
+           ? end - block*EVENT_STORE_CACHE_BLOCK_SIZE : EVENT_STORE_CACHE_BLOCK_SIZE;
+        entry = event_store_block_find(cache, id, block);
+        if (entry != NULL && from >= entry->from && to <= entry->to)
+        {
+            cache->block_hits++;
+        }
+        else
+        {
+            cache->block_misses++;
+            if (entry == NULL)
+                entry = event_store_block_lru(cache);
+            num_bytes = (size - block*EVENT_STORE_CACHE_BLOCK_SIZE < EVENT_STORE_CACHE_BLOCK_SIZE)
+                      ? size - block*EVENT_STORE_CACHE_BLOCK_SIZE : EVENT_STORE_CACHE_BLOCK_SIZE;
+            entry->id = EVENT_STORE_CACHE_EMPTY;
+            ret = event_store_read(address + event_store_data_offset(store) + block*EVENT_STORE_CACHE_BLOCK_SIZE,
+                                   entry->data, num_bytes);
+            if (ret < 0)
+                return ret;
+            entry->id = id;
+            entry->block = block;
+            entry->from = 0;
+            entry->to = (uint16_t) num_bytes;
+        }
+        entry->used = ++cache->clock;
+        memcpy(data, &entry->data[from], to - from);
+        data += to - from;
+        offset = block*EVENT_STORE_CACHE_BLOCK_SIZE + to;
+    }
+
+    return 0;
+}
+
+/*
+ * Reads the header at a ring address in the layout of the store's version and
+ * checks its crc. The header of an older store comes back in the current
+ * layout with the clip counts erased and the crc of that layout, a reader
+ * and the offload frames see one kind of header
+ * @return 0 if success, -1 on spi error, -2 if the event was moved to a new id, -3 if it is no header
+ */
+static int8_t event_store_read_any_header(event_store_t const *store, uint32_t address, event_store_header_t *header)
+{
+    uint8_t raw[EVENT_STORE_HEADER_SIZE_V6];
+    uint32_t crc;
+    bool valid;
+    int8_t ret;
+
+    if (store->version >= 7)
+    {
+        ret = event_store_read(address, header, sizeof(event_store_header_t));
+        if (ret < 0)
+            return ret;
+        valid = (header->header_crc == event_store_header_crc(header));
+    }
+    else
+    {
+        ret = event_store_read(address, raw, sizeof(raw));
+        if (ret < 0)
+            return ret;
+        memset(header, 0xFF, sizeof(event_store_header_t));
+        memcpy(header, raw, EVENT_STORE_SUMMARY_END_V6);
+        memcpy(&header->data_crc, &raw[EVENT_STORE_SUMMARY_END_V6], sizeof(uint32_t));
+        memcpy(&crc, &raw[EVENT_STORE_SUMMARY_END_V6 + sizeof(uint32_t)], sizeof(uint32_t));
+        valid = (crc == crc32_compute(raw, EVENT_STORE_SUMMARY_END_V6 + sizeof(uint32_t), NULL));
+        header->header_crc = event_store_header_crc(header);
+    }
+
+    if (header->magic == EVENT_STORE_HEADER_MOVED)
+        return -2;
+    if (header->magic != EVENT_STORE_HEADER_MAGIC || !valid)
+        return -3;
+
+    return 0;
+}
+
+/*
+ * Reads the header at a ring address and checks it is the committed header of event id
+ * @return 0 if success, -1 on spi error, -2 if the event was moved to a new id, -3 if it is not
+ */
+static int8_t event_store_read_header(event_store_t const *store, uint32_t address, uint32_t id,
+                                      event_store_header_t *header)
+{
+    int8_t ret;
+
+    ret = event_store_read_any_header(store, address, header);
+    if (ret < 0)
+        return ret;
+    if (header->id != id)
+        return -3;
+
+    return 0;
+}
+
+/*
+ * Reads the index entry and the header of an event, from the cache if they are in it
+ * @return 0 if success, -1 on spi error, -2 if there is no such event or it
+ * was reclaimed or moved, -3 if the header is corrupt
+ */
+static int8_t event_store_locate(event_store_t *store, uint32_t id, uint32_t *p_address, event_store_header_t *header)
+{
+    event_store_header_cache_t *cached;
+    int8_t ret;
+
+    if (id >= store->event_count || id < store->oldest_id)
+        return -2;
+
+    cached = event_store_header_find(store, id);
+    if (cached != NULL)
+    {
+        *p_address = cached->address;
+        *header = cached->header;
+        return 0;
+    }
+
+    ret = event_store_preempt_erase(store);
+    if (ret < 0)
+        return ret;
+
+    ret = event_store_index_get(store, id, p_address);
+    if (ret < 0)
+        return ret;
+
+    ret = event_store_read_header(store, *p_address, id, header);
+    if (ret < 0)
+        return ret;
+    event_store_header_put(store, id, *p_address, header);
+
+    return 0;
+}
+
+static uint32_t event_store_align_subsector(uint32_t address)
+{
+    return (address + MT25QL256ABA_SUBSECTOR_4KB_SIZE - 1) & ~(uint32_t)(MT25QL256ABA_SUBSECTOR_4KB_SIZE - 1);
+}
+
+/*
+ * Checks if an event opened at a ring address left nothing behind: the
+ * header and preview and the rest of the page its first samples go to read
+ * erased, up to end at most
+ * @return 0 if success otherwise -1
+ */
+static int8_t event_store_head_erased(uint32_t address, uint32_t end, bool *p_erased)
+{
+    static uint32_t page[MT25QL256ABA_PAGE_SIZE/sizeof(uint32_t)];
+    uint32_t length;
+    int8_t ret;
+
+    end = MIN(end, event_store_align_page(address + EVENT_STORE_DATA_OFFSET + 1));
+    *p_erased = true;
+    while (address < end)
+    {
+        length = MIN(end - address, sizeof(page));
+        ret = event_store_read(address, page, length);
+        if (ret < 0)
+            return ret;
+        for (uint16_t i = 0; i < length/sizeof(page[0]); i++)
+        {
+            if (page[i] != EVENT_STORE_ERASED_WORD)
+                *p_erased = false;
+        }
+        address += length;
+    }
+
+    return 0;
+}
+
+/*
+ * Waits for the background erase, resuming it first if it is suspended, and
+ * for the one of the other eraser set with event_store_erase_owner_set so
+ * the erase that follows is taken
+ * @return 0 if success otherwise -1
+ */
+static int8_t event_store_finish_erase(event_store_t *store)
+{
+    int8_t ret;
+
+    if (store->erase_owner != NULL)
+    {
+        ret = store->erase_owner();
+        if (ret < 0)
+            return ret;
+    }
+
+    if (store->erase_pending == 0)
+        return 0;
+
+    if (store->erase_suspended)
+    {
+        ret = mt25ql256aba_resume();
+        if (ret < 0)
+            return ret;
+        store->erase_suspended = false;
+    }
+    mt25ql256aba_check_write_in_progress_flag();
+    store->erased_until += store->erase_pending;
+    store->erase_pending = 0;
+
+    return 0;
+}
+
+/*
+ * Finds the watermark, the last programmed word of the ack log, or the one
+ * before it if a reset cut the last one short. A word holds the low 16 bits,
+ * the watermark is the nearest count at or below the event count. A watermark
+ * past the event count, left by events that were not committed, is lowered
+ * @return 0 if success otherwise -1
+ */
+static int8_t event_store_mount_acks(event_store_t *store)
+{
+    uint32_t low = 0;
+    uint32_t high = EVENT_STORE_ACK_SLOTS;
+    uint32_t mid;
+    uint32_t slot;
+    uint32_t word;
+    uint32_t count;
+    uint32_t lag;
+    int8_t ret;
+
+    while (low < high)
+    {
+        mid = low + (high - low)/2;
+        ret = mt25ql256aba_read(event_store_ack_address(mid), (uint8_t *) &count, sizeof(count));
+        if (ret < 0)
+            return ret;
+        if (count == EVENT_STORE_ERASED_WORD)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    store->ack_slot = low;
+
+    //the last word can be torn by a reset, the one before it is then the watermark
+    store->acked_count = 0;
+    for (slot = store->ack_slot; slot > 0 && store->ack_slot - slot < 2; slot--)
+    {
+        ret = mt25ql256aba_read(event_store_ack_address(slot - 1), (uint8_t *) &word, sizeof(word));
+        if (ret < 0)
+            return ret;
+        if (event_store_ack_decode(word, &count))
+        {
+            lag = (store->event_count - count) & 0xFFFF;
+            if (lag <= MIN(store->event_count, EVENT_STORE_MAX_EVENTS + EVENT_STORE_INDEX_SUBSECTOR_ENTRIES))
+                store->acked_count = store->event_count - lag;
+            else
+                store->acked_count = store->event_count;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * @return the ring address the ring can be erased up to, a ring ahead of the
+ * first event that is retained, or of the event being written if none is
+ */
+static uint32_t event_store_erase_limit(event_store_t const *store)
+{
+    uint32_t tail = (store->retain_id < store->event_count) ? store->retain_addr : store->append_addr;
+
+    return tail + EVENT_STORE_RING_SIZE;
+}
+
+/*
+ * Marks the events a ring below an erase up to end as reclaimed, call before
+ * starting the erase. The index is read past every event reclaimed, a page at a time
+ * @return 0 if success otherwise -1
+ */
+static int8_t event_store_reclaim(event_store_t *store, uint32_t end)
+{
+    uint32_t address;
+    int8_t ret;
+
+    if (end <= store->reclaimed_until + EVENT_STORE_RING_SIZE)
+        return 0;
+    store->reclaimed_until = end - EVENT_STORE_RING_SIZE;
+
+    while (store->oldest_id < store->event_count)
+    {
+        ret = event_store_index_get(store, store->oldest_id, &address);
+        if (ret < 0)
+            return ret;
+        if (address >= store->reclaimed_until)
+            break;
+        if (store->oldest_id >= store->acked_count)
+            store->dropped++;
+        store->oldest_id++;
+    }
+    //before the erase starts on them
+    event_store_blocks_reclaim(store);
+
+    return 0;
+}
+
+/*
+ * Erases the data subsectors up to end so the page writer can program them,
+ * waits for a background erase if the pool ran out
+ * @return 0 if success, -1 on spi error, -3 if the store is full
+ */
+static int8_t event_store_erase_ahead(event_store_t *store, uint32_t end)
+{
+    int8_t ret;
+
+    //the subsector end is in the ring too, below it an event that was not acked would be erased
+    if (event_store_align_subsector(end) > event_store_erase_limit(store))
+        return -3;
+    if (store->erased_until < end)
+        store->erase_stalls++;
+
+    if (store->erased_until < end)
+    {
+        ret = event_store_finish_erase(store);
+        if (ret < 0)
+            return ret;
+    }
+
+    while (store->erased_until < end)
+    {
+        ret = event_store_reclaim(store, store->erased_until + MT25QL256ABA_SUBSECTOR_4KB_SIZE);
+        if (ret < 0)
+            return ret;
+        ret = mt25ql256aba_erase_block(event_store_flash_address(store->erased_until),
+                                       MT25QL256ABA_SUBSECTOR_4KB_SIZE);
+        if (ret < 0)
+            return ret;
+        store->erased_until += MT25QL256ABA_SUBSECTOR_4KB_SIZE;
+    }
+
+    return 0;
+}
+
+/*
+ * Finds the append pointer past the last event and finishes a commit a reset
+ * cut short. An event is committed by two programs, its header once the
+ * samples are in and then its index entry, so after a reset
+ * - a header that is missing or torn fails its crc, the event is not counted
+ *   and the rest of its subsector is skipped
+ * - a whole header without its index entry is the next event, complete: the
+ *   entry is programmed now and the event kept
+ * - a torn index entry reads as a corrupt event, the pointer follows the
+ *   event before it and the header there if it is whole
+ * @return 0 if success otherwise -1
+ */
+static int8_t event_store_mount_append(event_store_t *store)
+{
+    event_store_header_t header;
+    uint32_t address = EVENT_STORE_DATA_ADDRESS;
+    int8_t ret;
+
+    store->append_addr = EVENT_STORE_DATA_ADDRESS;
+    if (store->event_count > 0)
+    {
+        ret = event_store_locate(store, store->event_count - 1, &address, &header);
+        if (ret == -1)
+            return ret;
+        if (ret == 0)
+        {
+            store->append_addr = event_store_align_event(address + event_store_data_offset(store) + event_store_data_size(&header));
+        }
+        else
+        {
+            //the torn event was appended right after the one before it
+            if (store->event_count > 1)
+            {
+                ret = event_store_locate(store, store->event_count - 2, &address, &header);
+                if (ret == -1)
+                    return ret;
+                if (ret == 0)
+                    address = event_store_align_event(address + event_store_data_offset(store) + event_store_data_size(&header));
+            }
+            ret = event_store_read_header(store, address, store->event_count - 1, &header);
+            if (ret == -1)
+                return ret;
+            if (ret == 0)
+                store->append_addr = event_store_align_event(address + event_store_data_offset(store) + event_store_data_size(&header));
+            else
+                store->append_addr = event_store_align_event(address + event_store_data_offset(store));
+        }
+    }
+
+    //a header is only programmed once the index entry it takes was erased
+    ret = event_store_read_header(store, store->append_addr, store->event_count, &header);
+    if (ret == -1)
+        return ret;
+    if (ret == 0)
+    {
+        NRF_LOG_WARNING("Event %u recovered after a reset", store->event_count);
+        ret = mt25ql256aba_page_program(event_store_index_address(store->event_count),
+                                        (uint8_t const *) &store->append_addr, sizeof(uint32_t));
+        if (ret < 0)
+            return ret;
+        if (store->acked_count == store->event_count)
+            store->unacked_addr = store->append_addr;
+        store->event_count++;
+        store->append_addr = event_store_align_event(store->append_addr + event_store_data_offset(store) + event_store_data_size(&header));
+    }
+
+    return 0;
+}
+
+/*
+ * @return 1 if the index holds count events, 0 if it does not, -1 on spi error.
+ * At the start of an index subsector not erased yet the entry of the ring
+ * before is there, the count is then searched
+ */
+static int8_t event_store_count_check(uint32_t count)
+{
+    uint32_t address;
+    int8_t ret;
+
+    if (count > 0)
+    {
+        ret = mt25ql256aba_read(event_store_index_address(count - 1), (uint8_t *) &address, sizeof(address));
+        if (ret < 0)
+            return ret;
+        if (address == EVENT_STORE_ERASED_WORD)
+            return 0;
+    }
+    ret = mt25ql256aba_read(event_store_index_address(count), (uint8_t *) &address, sizeof(address));
+    if (ret < 0)
+        return ret;
+    if (address != EVENT_STORE_ERASED_WORD)
+        return 0;
+    return 1;
+}
+
+/*
+ * Finds the event count in the index ring. The entries hold ring addresses,
+ * which only grow: from the first entry on they grow up to the newest, the
+ * erased subsector or the older entries of the ring before follow, all lower.
+ * The id of the newest is in its header, a torn entry or header is passed
+ * over to the one before it, up to EVENT_STORE_MOUNT_PROBES. A store whose
+ * index did not come round yet has its ids in place whatever the headers hold
+ * @return 0 if success otherwise -1
+ */
+static int8_t event_store_mount_count(event_store_t *store)
+{
+    event_store_header_t header;
+    uint32_t first;
+    uint32_t address;
+    uint32_t low = 1;
+    uint32_t high = EVENT_STORE_MAX_EVENTS;
+    uint32_t mid;
+    uint32_t probe;
+    uint32_t slot;
+    int8_t ret;
+
+    store->event_count = 0;
+    ret = mt25ql256aba_read(event_store_index_address(0), (uint8_t *) &first, sizeof(first));
+    if (ret < 0)
+        return ret;
+    if (first == EVENT_STORE_ERASED_WORD)
+    {
+        //empty, or the ring came round to the first subsector and has not begun an event in it
+        ret = mt25ql256aba_read(event_store_index_address(EVENT_STORE_MAX_EVENTS - 1),
+                                (uint8_t *) &address, sizeof(address));
+        if (ret < 0 || address == EVENT_STORE_ERASED_WORD)
+            return ret;
+        low = EVENT_STORE_MAX_EVENTS;
+    }
+    //a torn entry is above the one before it, a program only clears bits
+    while (low < high)
+    {
+        mid = low + (high - low)/2;
+        ret = mt25ql256aba_read(event_store_index_address(mid), (uint8_t *) &address, sizeof(address));
+        if (ret < 0)
+            return ret;
+        if (address == EVENT_STORE_ERASED_WORD || address < first)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    store->event_count = low;
+
+    for (probe = 1; probe <= EVENT_STORE_MOUNT_PROBES; probe++)
+    {
+        slot = (low + EVENT_STORE_MAX_EVENTS - probe) % EVENT_STORE_MAX_EVENTS;
+        ret = mt25ql256aba_read(event_store_index_address(slot), (uint8_t *) &address, sizeof(address));
+        if (ret < 0)
+            return ret;
+        if (address < EVENT_STORE_DATA_ADDRESS || address == EVENT_STORE_ERASED_WORD)
+            continue;
+        ret = event_store_read_any_header(store, address, &header);
+        if (ret == -1)
+            return ret;
+        if (ret == 0 && header.id % EVENT_STORE_MAX_EVENTS == slot)
+        {
+            store->event_count = header.id + probe;
+            return 0;
+        }
+    }
+    NRF_LOG_WARNING("Event store index: no header near entry %u, ids from 0", low);
+
+    return 0;
+}
+
+/*
+ * Finds the first event whose index entry is still held, the ones of the
+ * ring before in the subsector past the newest entry were erased for it
+ * @return 0 if success otherwise -1
+ */
+static int8_t event_store_mount_first(event_store_t const *store, uint32_t *p_first)
+{
+    uint32_t count = store->event_count;
+    uint32_t next = (count + EVENT_STORE_INDEX_SUBSECTOR_ENTRIES - 1) & ~(EVENT_STORE_INDEX_SUBSECTOR_ENTRIES - 1);
+    uint32_t address;
+    int8_t ret;
+
+    //the subsector of the next event was erased when its first one was begun, unless none was yet
+    if (count % EVENT_STORE_INDEX_SUBSECTOR_ENTRIES == 0)
+    {
+        ret = mt25ql256aba_read(event_store_index_address(count), (uint8_t *) &address, sizeof(address));
+        if (ret < 0)
+            return ret;
+        if (address == EVENT_STORE_ERASED_WORD)
+            next += EVENT_STORE_INDEX_SUBSECTOR_ENTRIES;
+    }
+    *p_first = (next > EVENT_STORE_MAX_EVENTS) ? next - EVENT_STORE_MAX_EVENTS : 0;
+
+    return 0;
+}
+
+/*
+ * Mounts the store, formatting the flash if it does not hold one or one of a
+ * version before EVENT_STORE_VERSION_READ_MIN, see Older stores.
+ * The event count is found with a binary search of the index and the
+ * append pointer from the header of the last event, see
+ * event_store_mount_append for an event a reset cut short. The erases
+ * ahead of the append pointer before the reset are not known, the events a
+ * ring below the most the background erase could have reached are taken as
+ * reclaimed
+ * @param p_resume - where the store stood before a warm reset, NULL if not known
+ * @return 0 if success otherwise -1
+ */
+static int8_t event_store_mount(event_store_t *store, event_store_resume_t const *p_resume)
+{
+    event_store_superblock_t superblock;
+    uint32_t address;
+    uint32_t first;
+    uint32_t low;
+    uint32_t high;
+    uint32_t mid;
+    uint32_t end;
+    bool erased;
+    bool resumed = false;
+    event_store_erase_owner_t erase_owner = store->erase_owner;
+    event_store_nonce_t nonce_source = store->nonce_source;
+    int8_t ret;
+
+    memset(store, 0, sizeof(event_store_t));
+    //set before the first mount they cover the erases and the format of the mount too
+    store->erase_owner = erase_owner;
+    store->nonce_source = nonce_source;
+
+    ret = mt25ql256aba_read(EVENT_STORE_SUPERBLOCK_ADDRESS, (uint8_t *) &superblock, sizeof(superblock));
+    if (ret < 0)
+        return ret;
+    if (superblock.magic != EVENT_STORE_MAGIC || superblock.version < EVENT_STORE_VERSION_READ_MIN
+        || superblock.version > EVENT_STORE_VERSION)
+        return event_store_format(store);
+    store->version = superblock.version;
+    if (event_store_read_only(store))
+        NRF_LOG_WARNING("Event store version %u: read only until its events are offloaded", store->version);
+    store->nonce = (superblock.nonce == EVENT_STORE_ERASED_WORD) ? 0 : superblock.nonce;
+
+    if (p_resume != NULL)
+    {
+        ret = event_store_count_check(p_resume->event_count);
+        if (ret < 0)
+            return ret;
+        resumed = (ret == 1);
+        if (resumed)
+            store->event_count = p_resume->event_count;
+    }
+    if (!resumed)
+    {
+        ret = event_store_mount_count(store);
+        if (ret < 0)
+            return ret;
+    }
+
+    ret = event_store_mount_acks(store);
+    if (ret < 0)
+        return ret;
+    ret = event_store_mount_first(store, &first);
+    if (ret < 0)
+        return ret;
+    //the headers past the watermark are read again by the erase step, the
+    //events an index erase took before the watermark was moved up are gone
+    store->retain_id = MAX(store->acked_count, first);
+    if (store->retain_id < store->event_count)
+    {
+        ret = mt25ql256aba_read(event_store_index_address(store->retain_id),
+                                (uint8_t *) &store->unacked_addr, sizeof(uint32_t));
+        if (ret < 0)
+            return ret;
+    }
+    store->retain_addr = store->unacked_addr;
+
+    ret = event_store_mount_append(store);
+    if (ret < 0)
+        return ret;
+
+    //the rest of a subsector in use is erased unless an event was not committed,
+    //the following subsectors are erased before use
+    store->erased_until = event_store_align_subsector(store->append_addr);
+    if (store->append_addr != store->erased_until)
+    {
+        ret = event_store_head_erased(store->append_addr, store->erased_until, &erased);
+        if (ret < 0)
+            return ret;
+        if (!erased)
+            store->append_addr = store->erased_until;
+    }
+
+    //the erase step stops at a sector past EVENT_STORE_ERASE_AHEAD and never past the limit
+    end = MIN(store->erased_until + EVENT_STORE_ERASE_AHEAD + MT25QL256ABA_SECTOR_SIZE, event_store_erase_limit(store));
+    //a step started at most one more sector erase after the resume was kept, an inline one only a subsector
+    if (resumed && p_resume->erased_until >= store->erased_until)
+        end = MIN(p_resume->erased_until + p_resume->erase_pending + MT25QL256ABA_SECTOR_SIZE, end);
+    if (end > EVENT_STORE_RING_SIZE)
+        store->reclaimed_until = end - EVENT_STORE_RING_SIZE;
+    //index addresses grow with the id, find the first event at or past it
+    low = first;
+    high = store->event_count;
+    while (low < high)
+    {
+        mid = low + (high - low)/2;
+        ret = mt25ql256aba_read(event_store_index_address(mid), (uint8_t *) &address, sizeof(address));
+        if (ret < 0)
+            return ret;
+        if (address < store->reclaimed_until)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    store->oldest_id = low;
+
+    return 0;
+}
+
+/*
+ * Mounts the store, see event_store_mount
+ * @return 0 if success otherwise -1
+ */
+int8_t event_store_init(event_store_t *store)
+{
+    return event_store_mount(store, NULL);
+}
+
+/*
+ * Mounts the store after a warm reset, see Warm restart. The resume is
+ * checked against the flash, a stale or foreign one is a plain mount
+ * @return 0 if success otherwise -1
+ */
+int8_t event_store_init_resume(event_store_t *store, event_store_resume_t const *p_resume)
+{
+    return event_store_mount(store, p_resume);
+}
+
+/*
+ * Where the store stands for event_store_init_resume() after a reset, keep
+ * it after every step that appends, commits or erases
+ */
+void event_store_resume_get(event_store_t const *store, event_store_resume_t *p_resume)
+{
+    p_resume->event_count = store->event_count;
+    p_resume->erased_until = store->erased_until;
+    p_resume->erase_pending = store->erase_pending;
+}
+
+/*
+ * Deletes every event: erases the superblock and index sectors and writes a new superblock
+ * @return 0 if success otherwise -1
+ */
+int8_t event_store_format(event_store_t *store)
+{
+    event_store_superblock_t superblock = {
+        .magic = EVENT_STORE_MAGIC,
+        .version = EVENT_STORE_VERSION,
+    };
+    event_store_cache_t *cache;
+    event_store_cipher_t cipher;
+    void *p_cipher_context;
+    event_store_erase_owner_t erase_owner;
+    event_store_nonce_t nonce_source;
+    uint32_t address;
+    int8_t ret;
+
+    NRF_LOG_INFO("FORMATTING EVENT STORE");
+    //an erased nonce reads as 0, a drawn one that reads erased is the same
+    superblock.nonce = (store->nonce_source != NULL) ? store->nonce_source() : 0;
+    ret = event_store_finish_erase(store);
+    if (ret < 0)
+        return ret;
+    for (address = EVENT_STORE_SUPERBLOCK_ADDRESS; address < EVENT_STORE_DATA_ADDRESS; address += MT25QL256ABA_SECTOR_SIZE)
+    {
+        ret = mt25ql256aba_erase_block(address, MT25QL256ABA_SECTOR_SIZE);
+        if (ret < 0)
+            return ret;
+    }
+
+    ret = mt25ql256aba_page_program(EVENT_STORE_SUPERBLOCK_ADDRESS, (uint8_t const *) &superblock, sizeof(superblock));
+    if (ret < 0)
+        return ret;
+
+    cache = store->cache;
+    cipher = store->cipher;
+    p_cipher_context = store->p_cipher_context;
+    erase_owner = store->erase_owner;
+    nonce_source = store->nonce_source;
+    memset(store, 0, sizeof(event_store_t));
+    store->version = EVENT_STORE_VERSION;
+    store->append_addr = EVENT_STORE_DATA_ADDRESS;
+    store->erased_until = EVENT_STORE_DATA_ADDRESS;
+    store->nonce = (superblock.nonce == EVENT_STORE_ERASED_WORD) ? 0 : superblock.nonce;
+    //a cache, a cipher, an erase owner and a nonce source the app gave the store stay with it, the cache emptied
+    if (cache != NULL)
+        event_store_cache_init(store, cache);
+    event_store_cipher_set(store, cipher, p_cipher_context);
+    event_store_erase_owner_set(store, erase_owner);
+    event_store_nonce_set(store, nonce_source);
+
+    return 0;
+}
+
+/*
+ * Converts a time read from the ds1388 in 24-hour format
+ */
+void event_store_time_from_ds1388(ds1388_data_t const *date, event_store_time_t *time)
+{
+    time->s = ds1388_to_epoch(date);
+    time->us = date->hundreth * 10000;
+}
+
+/*
+ * Gives up the copy of a pinned event, its pages are programmed and never
+ * used, a reset skips them like those of an event that was not committed
+ * @return 0 if success otherwise -1
+ */
+static int8_t event_store_move_abort(event_store_t *store)
+{
+    int8_t ret;
+
+    store->moving = false;
+    store->event_open = false;
+    ret = event_store_preempt_erase(store);
+    if (ret < 0)
+        return ret;
+    ret = flash_page_writer_flush(&store->writer);
+    store->append_addr = event_store_align_event(flash_page_writer_address(&store->writer));
+
+    return ret;
+}
+
+// Enciphers the samples of the open event as the page writer takes them
+static void event_store_writer_cipher(void *p_context, uint32_t offset, uint8_t *data, uint16_t length)
+{
+    event_store_t *store = (event_store_t *) p_context;
+
+    store->cipher(store->p_cipher_context, store->nonce, store->header.id, &store->header.time, offset, data, length);
+}
+
+/*
+ * Frees the index entry of the next event. Before the first event of an
+ * index subsector the ring came round to, the subsector is erased and the
+ * events of the ring before whose entries it held are reclaimed, a
+ * watermark left below them is moved up to the oldest event so the ack log
+ * keeps it in 16 bits
+ * @return 0 if success, -1 on spi error, -3 if one of them is retained
+ */
+static int8_t event_store_index_erase(event_store_t *store)
+{
+    uint32_t first = store->event_count + EVENT_STORE_INDEX_SUBSECTOR_ENTRIES - EVENT_STORE_MAX_EVENTS;
+    uint32_t address;
+    int8_t ret;
+
+    if (store->event_count < EVENT_STORE_MAX_EVENTS || store->event_count % EVENT_STORE_INDEX_SUBSECTOR_ENTRIES != 0)
+        return 0;
+    if (first > store->retain_id)
+        return -3;
+
+    //erased already by a begin that was not committed
+    ret = mt25ql256aba_read(event_store_index_address(store->event_count), (uint8_t *) &address, sizeof(address));
+    if (ret < 0)
+        return ret;
+    if (address != EVENT_STORE_ERASED_WORD)
+    {
+        ret = event_store_finish_erase(store);
+        if (ret < 0)
+            return ret;
+        ret = mt25ql256aba_erase_block(event_store_index_address(store->event_count), MT25QL256ABA_SUBSECTOR_4KB_SIZE);
+        if (ret < 0)
+            return ret;
+    }
+
+    if (store->oldest_id < first)
+    {
+        if (store->acked_count < first)
+            store->dropped += first - MAX(store->oldest_id, store->acked_count);
+        store->oldest_id = first;
+        event_store_blocks_reclaim(store);
+    }
+    if (store->acked_count < store->oldest_id)
+        return event_store_ack(store, store->oldest_id);
+
+    return 0;
+}
+
+/*
+ * Opens a new event at the append pointer, the header is written by
+ * event_store_commit. A pinned event being moved is given up, it is copied again later
+ * @param time        - of the event
+ * @param summary     - results computed for the event, NULL leaves them erased
+ * @param sample_size - bytes per sample, 1 for an encoded byte stream
+ * @param encoding    - EVENT_STORE_ENCODING_RAW or the id of the encoding, only stored for the reader,
+ *                      with EVENT_STORE_ENCODING_ENCRYPTED the samples are enciphered
+ * @return 0 if success, -1 on spi error, -2 if an event is already open or
+ * it is to be enciphered without a cipher, -3 if the store is full or read only
+ */
+int8_t event_store_begin(event_store_t *store, event_store_time_t const *time,
+                         event_store_summary_t const *summary, uint16_t sample_size, uint16_t encoding)
+{
+    int8_t ret;
+
+    if (store->moving)
+    {
+        ret = event_store_move_abort(store);
+        if (ret < 0)
+            return ret;
+    }
+    if (store->event_open || (EVENT_STORE_ENCRYPTED(encoding) && store->cipher == NULL))
+        return -2;
+    if (store->append_addr > EVENT_STORE_RING_ADDRESS_MAX || event_store_read_only(store))
+        return -3;
+
+    ret = event_store_index_erase(store);
+    if (ret < 0)
+        return ret;
+
+    ret = event_store_preempt_erase(store);
+    if (ret < 0)
+        return ret;
+
+    ret = event_store_erase_ahead(store, store->append_addr + EVENT_STORE_DATA_OFFSET);
+    if (ret < 0)
+        return ret;
+
+    memset(&store->header, 0xFF, sizeof(event_store_header_t));
+    memset(&store->preview, 0xFF, sizeof(event_store_preview_t));
+    store->header.magic = EVENT_STORE_HEADER_MAGIC;
+    store->header.id = store->event_count;
+    store->header.time = *time;
+    store->header.sample_count = 0;
+    store->header.sample_size = sample_size;
+    store->header.encoding = encoding;
+    if (summary != NULL)
+        store->header.summary = *summary;
+
+    //leave the header erased, it is programmed last
+    flash_page_writer_init(&store->writer, store->append_addr + EVENT_STORE_DATA_OFFSET);
+    flash_page_writer_set_wrap(&store->writer, EVENT_STORE_DATA_ADDRESS, EVENT_STORE_RING_SIZE);
+    if (EVENT_STORE_ENCRYPTED(encoding))
+        flash_page_writer_set_cipher(&store->writer, event_store_writer_cipher, store);
+    store->event_open = true;
+
+    return 0;
+}
+
+/*
+ * Appends samples to the open event
+ * @return 0 if success, -1 on spi error, -2 if no event is open, -3 if the store is full
+ */
+int8_t event_store_append(event_store_t *store, void const *samples, uint32_t num_samples)
+{
+    uint32_t num_bytes = num_samples * store->header.sample_size;
+    int8_t ret;
+
+    if (!store->event_open)
+        return -2;
+    if (num_bytes == 0)
+        return 0;
+
+    ret = event_store_preempt_erase(store);
+    if (ret < 0)
+        return ret;
+
+    ret = event_store_erase_ahead(store, flash_page_writer_address(&store->writer) + num_bytes);
+    if (ret < 0)
+        return ret;
+
+    store->header.data_crc = crc32_compute((uint8_t const *) samples, num_bytes,
+                                           (store->header.sample_count > 0) ? &store->header.data_crc : NULL);
+    store->header.sample_count += num_samples;
+
+    return flash_page_writer_append(&store->writer, samples, num_bytes);
+}
+
+/*
+ * Sets the results of the open event, e.g. of one stored while it was still
+ * being recorded, they go into the header programmed by event_store_commit
+ */
+void event_store_set_summary(event_store_t *store, event_store_summary_t const *summary)
+{
+    store->header.summary = *summary;
+}
+
+/*
+ * Sets the preview of the open event, programmed next to its header by event_store_commit
+ */
+void event_store_set_preview(event_store_t *store, event_store_preview_t const *preview)
+{
+    store->preview = *preview;
+}
+
+/*
+ * Polls the page the open event programmed last, once and without waiting,
+ * so the caller can prepare its next append while the flash programs
+ * @return 1 while it is programming, 0 once an append of up to
+ * event_store_append_room bytes starts without waiting on it,
+ * -1 on spi error, -2 if no event is open
+ */
+int8_t event_store_append_busy(event_store_t *store)
+{
+    bool busy;
+    int8_t ret;
+
+    if (!store->event_open)
+        return -2;
+
+    ret = flash_page_writer_busy(&store->writer, &busy);
+    if (ret < 0)
+        return ret;
+
+    return busy ? 1 : 0;
+}
+
+/*
+ * @return the bytes that complete the page being collected, more than these
+ * plus a page would program two pages in one append
+ */
+uint32_t event_store_append_room(event_store_t const *store)
+{
+    return flash_page_writer_room(&store->writer);
+}
+
+/*
+ * Programs the last page, the preview, the header and then the index entry of the open event.
+ * An event is only found after a reset once its index entry is programmed
+ * @param p_id - id of the committed event, may be NULL
+ * @return 0 if success, -1 on spi error, -2 if no event is open
+ */
+int8_t event_store_commit(event_store_t *store, uint32_t *p_id)
+{
+    uint32_t address = store->append_addr;
+    int8_t ret;
+
+    if (!store->event_open)
+        return -2;
+
+    ret = event_store_preempt_erase(store);
+    if (ret < 0)
+        return ret;
+    store->event_open = false;
+
+    ret = flash_page_writer_flush(&store->writer);
+    //never program over the pages of this event again, even if it fails
+    store->append_addr = event_store_align_event(flash_page_writer_address(&store->writer));
+    if (ret < 0)
+        return ret;
+
+    if (store->header.sample_count == 0)
+        store->header.data_crc = 0;
+    store->header.header_crc = event_store_header_crc(&store->header);
+    //the header was left erased, the preview goes in ahead of the header that commits it
+    ret = event_store_program(address + sizeof(event_store_header_t), &store->preview, sizeof(event_store_preview_t));
+    if (ret < 0)
+        return ret;
+    ret = event_store_program(address, &store->header, sizeof(event_store_header_t));
+    if (ret < 0)
+        return ret;
+
+    ret = mt25ql256aba_page_program(event_store_index_address(store->event_count),
+                                    (uint8_t const *) &address, sizeof(address));
+    if (ret < 0)
+        return ret;
+    event_store_index_put(store, store->event_count, address);
+
+    if (p_id != NULL)
+        *p_id = store->event_count;
+    if (store->acked_count == store->event_count)
+        store->unacked_addr = address;
+    if (store->retain_id == store->event_count)
+        store->retain_addr = address;
+    store->event_count++;
+
+    return 0;
+}
+
+uint32_t event_store_count(event_store_t const *store)
+{
+    return store->event_count;
+}
+
+/*
+ * Moves the offloaded up to watermark: a host has every event below count, an
+ * offload that resumes starts there. A count at or below the watermark is
+ * ignored so acks that arrive late or twice do not move it back.
+ * One word is programmed, the ack log is erased inline once every EVENT_STORE_ACK_SLOTS acks
+ * @return 0 if success, -1 on spi error, -2 if count is past the stored events
+ */
+int8_t event_store_ack(event_store_t *store, uint32_t count)
+{
+    uint32_t word;
+    int8_t ret;
+
+    if (count > store->event_count)
+        return -2;
+    if (count <= store->acked_count)
+        return 0;
+
+    if (store->ack_slot >= EVENT_STORE_ACK_SLOTS)
+    {
+        //an erase cannot start while another one is suspended
+        ret = event_store_finish_erase(store);
+        if (ret < 0)
+            return ret;
+        ret = mt25ql256aba_erase_block(EVENT_STORE_ACK_ADDRESS, MT25QL256ABA_SUBSECTOR_4KB_SIZE);
+        if (ret < 0)
+            return ret;
+        store->ack_slot = 0;
+    }
+    else
+    {
+        ret = event_store_preempt_erase(store);
+        if (ret < 0)
+            return ret;
+    }
+
+    word = event_store_ack_encode(count);
+    ret = mt25ql256aba_page_program(event_store_ack_address(store->ack_slot), (uint8_t const *) &word, sizeof(word));
+    if (ret < 0)
+        return ret;
+    store->ack_slot++;
+    store->acked_count = count;
+
+    //the ring can be reclaimed up to the next event that was not acked
+    if (count < store->event_count)
+    {
+        ret = event_store_index_get(store, count, &store->unacked_addr);
+        if (ret < 0)
+            return ret;
+    }
+    if (store->retain_id < count)
+    {
+        //the event being moved was offloaded, its copy would be sent again
+        if (store->moving)
+        {
+            ret = event_store_move_abort(store);
+            if (ret < 0)
+                return ret;
+        }
+        store->retain_id = count;
+        store->retain_addr = store->unacked_addr;
+        store->retain_pinned = false;
+        if (store->lookahead_id <= count)
+            store->lookahead_found = false;
+    }
+
+    return 0;
+}
+
+/*
+ * @return true while a store of an older version is mounted, see Older stores
+ */
+bool event_store_read_only(event_store_t const *store)
+{
+    return store->version < EVENT_STORE_VERSION;
+}
+
+uint32_t event_store_acked(event_store_t const *store)
+{
+    return store->acked_count;
+}
+
+/*
+ * @return the first event still held, those below it were acked and reclaimed
+ */
+uint32_t event_store_oldest(event_store_t const *store)
+{
+    return store->oldest_id;
+}
+
+/*
+ * @return the bytes the next events can take before the ring reaches the
+ * first event that is retained
+ */
+uint32_t event_store_free(event_store_t const *store)
+{
+    if (event_store_read_only(store))
+        return 0;
+    return event_store_erase_limit(store) - store->append_addr;
+}
+
+/*
+ * Gives a mounted store an empty cache to keep index pages, headers and
+ * sample blocks in, a store without one reads them from the flash every time
+ */
+void event_store_cache_init(event_store_t *store, event_store_cache_t *cache)
+{
+    event_store_cache_reset(cache);
+    store->cache = cache;
+}
+
+/*
+ * Gives a mounted store the cipher of the events begun with
+ * EVENT_STORE_ENCODING_ENCRYPTED, NULL takes it away
+ */
+void event_store_cipher_set(event_store_t *store, event_store_cipher_t cipher, void *p_context)
+{
+    store->cipher = cipher;
+    store->p_cipher_context = p_context;
+}
+
+/*
+ * Gives the store the other user of the flash that erases, its erase is
+ * finished before each one of the store that is waited on. The background
+ * erase of event_store_erase_step is left to the caller: step the store only
+ * while the other has no erase running
+ */
+void event_store_erase_owner_set(event_store_t *store, event_store_erase_owner_t erase_owner)
+{
+    store->erase_owner = erase_owner;
+}
+
+/*
+ * Gives the store the source of the nonce a format draws for the cipher, set
+ * before the mount so the format of a blank flash draws one too
+ */
+void event_store_nonce_set(event_store_t *store, event_store_nonce_t nonce_source)
+{
+    store->nonce_source = nonce_source;
+}
+
+/*
+ * @return the nonce of the format the events are enciphered under
+ */
+uint32_t event_store_nonce(event_store_t const *store)
+{
+    return store->nonce;
+}
+
+/*
+ * Counts the index entries and headers found in the cache and read from the
+ * flash since it was given to the store
+ */
+void event_store_cache_stats(event_store_t const *store, uint32_t *p_hits, uint32_t *p_misses)
+{
+    *p_hits = (store->cache != NULL) ? store->cache->hits : 0;
+    *p_misses = (store->cache != NULL) ? store->cache->misses : 0;
+}
+
+/*
+ * Counts the sample blocks found in the cache and read from the flash since
+ * it was given to the store
+ */
+void event_store_cache_block_stats(event_store_t const *store, uint32_t *p_hits, uint32_t *p_misses)
+{
+    *p_hits = (store->cache != NULL) ? store->cache->block_hits : 0;
+    *p_misses = (store->cache != NULL) ? store->cache->block_misses : 0;
+}
+
+/*
+ * Keeps samples of an event read outside the cache, e.g. by
+ * event_store_queue_read_samples, in its blocks. A block that already holds
+ * bytes of the event next to or over them grows, otherwise it holds these
+ * @param samples - as read, enciphered if the event is
+ */
+void event_store_cache_samples(event_store_t *store, uint32_t id, uint32_t first_sample,
+                               void const *samples, uint32_t num_samples)
+{
+    event_store_cache_t *cache = store->cache;
+    event_store_block_cache_t *entry;
+    event_store_header_t header;
+    uint8_t const *data = (uint8_t const *) samples;
+    uint32_t address;
+    uint32_t offset;
+    uint32_t end;
+    uint32_t block;
+    uint32_t from;
+    uint32_t to;
+
+    if (cache == NULL || event_store_locate(store, id, &address, &header) < 0
+        || first_sample + num_samples > header.sample_count)
+        return;
+
+    offset = first_sample*header.sample_size;
+    end = offset + num_samples*header.sample_size;
+    while (offset < end)
+    {
+        block = offset / EVENT_STORE_CACHE_BLOCK_SIZE;
+        from = offset % EVENT_STORE_CACHE_BLOCK_SIZE;
+        to = (end - block*EVENT_STORE_CACHE_BLOCK_SIZE < EVENT_STORE_CACHE_BLOCK_SIZE)
+           ? end - block*EVENT_STORE_CACHE_BLOCK_SIZE : EVENT_STORE_CACHE_BLOCK_SIZE;
+        entry = event_store_block_find(cache, id, block);
+        if (entry == NULL)
+            entry = event_store_block_lru(cache);
+        memcpy(&entry->data[from], data, to - from);
+        if (entry->id == id && entry->block == block && from <= entry->to && to >= entry->from)
+        {
+            if (from < entry->from)
+                entry->from = (uint16_t) from;
+            if (to > entry->to)
+                entry->to = (uint16_t) to;
+        }
+        else
+        {
+            entry->id = id;
+            entry->block = block;
+            entry->from = (uint16_t) from;
+            entry->to = (uint16_t) to;
+        }
+        entry->used = ++cache->clock;
+        data += to - from;
+        offset = block*EVENT_STORE_CACHE_BLOCK_SIZE + to;
+    }
+}
+
+/*
+ * Erases of a data sector since the store was formatted, the ring erases
+ * them in order so the count follows from the ring address erased up to.
+ * A reset can erase the pool ahead of the append pointer once more
+ * @param sector - 64KB sector of the event region, below EVENT_STORE_RING_SECTORS
+ */
+uint32_t event_store_sector_erases(event_store_t const *store, uint32_t sector)
+{
+    uint32_t erased = store->erased_until + store->erase_pending - EVENT_STORE_DATA_ADDRESS;
+    uint32_t offset = sector*MT25QL256ABA_SECTOR_SIZE;
+
+    if (erased <= offset)
+        return 0;
+    return (erased - offset - 1)/EVENT_STORE_RING_SIZE + 1;
+}
+
+/*
+ * Keeps the events at or above a peak until they are acked and lets the ring
+ * reclaim the ones below it that were not, see the flash layout, call it once
+ * the store is mounted. The default of 0 keeps every event until it is acked
+ * @param pin_peak_g_x10 - in 0.1 g, EVENT_STORE_PEAK_UNKNOWN pins only the
+ *                         events stored without a peak
+ */
+void event_store_retain_set(event_store_t *store, uint16_t pin_peak_g_x10)
+{
+    store->pin_peak_g_x10 = pin_peak_g_x10;
+    store->retain_pinned = false;
+    store->lookahead_found = false;
+}
+
+/*
+ * Counts the events reclaimed before they were acked and the pinned events
+ * moved to a new id since the store was mounted. A moved event is reclaimed
+ * before its ack too, it is in both counts
+ */
+void event_store_retain_stats(event_store_t const *store, uint32_t *p_dropped, uint32_t *p_moved)
+{
+    *p_dropped = store->dropped;
+    *p_moved = store->moved;
+}
+
+static bool event_store_pinned(event_store_t const *store, event_store_header_t const *header)
+{
+    return header->summary.peak_g_x10 >= store->pin_peak_g_x10;
+}
+
+/*
+ * Reads up to EVENT_STORE_QUERY_SCAN headers from retain_id on and moves it
+ * past the events that are not pinned, moved, reclaimed or corrupt, the
+ * ring is held at the first pinned one. Past that one it looks for an event
+ * that is not pinned, which moving the pinned ones would let the ring reclaim
+ * @return 1 if a header was read, 0 if there was none to read, -1 on spi error
+ */
+static int8_t event_store_retain_scan(event_store_t *store)
+{
+    event_store_header_t header;
+    uint32_t address;
+    uint32_t scanned;
+    int8_t ret;
+
+    for (scanned = 0; scanned < EVENT_STORE_QUERY_SCAN; scanned++)
+    {
+        if (!store->retain_pinned && store->retain_id < store->event_count)
+        {
+            ret = event_store_locate(store, store->retain_id, &address, &header);
+            if (ret == -1)
+                return ret;
+            if (ret == 0 && event_store_pinned(store, &header))
+            {
+                store->retain_pinned = true;
+                continue;
+            }
+            store->retain_id++;
+            if (store->lookahead_id <= store->retain_id)
+                store->lookahead_found = false;
+            if (store->retain_id < store->event_count)
+            {
+                ret = event_store_index_get(store, store->retain_id, &store->retain_addr);
+                if (ret < 0)
+                    return ret;
+            }
+        }
+        else if (store->retain_pinned && !store->lookahead_found
+                 && MAX(store->lookahead_id, store->retain_id + 1) < store->event_count)
+        {
+            store->lookahead_id = MAX(store->lookahead_id, store->retain_id + 1);
+            ret = event_store_locate(store, store->lookahead_id, &address, &header);
+            if (ret == -1)
+                return ret;
+            if (ret == 0 && !event_store_pinned(store, &header))
+                store->lookahead_found = true;
+            else
+                store->lookahead_id++;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return (scanned > 0) ? 1 : 0;
+}
+
+/*
+ * Copies the pinned event at retain_id to a new id once the ring comes
+ * within EVENT_STORE_ERASE_AHEAD of it, EVENT_STORE_MOVE_PAGES a call, and
+ * marks the old header moved once the copy is committed
+ * @return 1 while it copies, 0 if the event does not need moving or the
+ * store has no room for the copy, -1 on spi error, -3 if the store is full
+ */
+static int8_t event_store_move_step(event_store_t *store)
+{
+    static uint8_t buf[MT25QL256ABA_PAGE_SIZE];
+    event_store_header_t header;
+    uint32_t address;
+    uint32_t span;
+    uint32_t num_samples;
+    uint32_t pages;
+    uint32_t word = EVENT_STORE_HEADER_MOVED;
+    int8_t ret;
+
+    ret = event_store_locate(store, store->retain_id, &address, &header);
+    if (ret == -1)
+        return ret;
+    if (ret < 0)
+    {
+        //read again by the next scan
+        store->retain_pinned = false;
+        return (store->moving) ? event_store_move_abort(store) : 1;
+    }
+
+    if (!store->moving)
+    {
+        span = event_store_align_event(EVENT_STORE_DATA_OFFSET + event_store_data_size(&header)) + MT25QL256ABA_SUBSECTOR_4KB_SIZE;
+        if (store->event_open || header.sample_size == 0 || header.sample_size > sizeof(buf)
+            || (EVENT_STORE_ENCRYPTED(header.encoding) && store->cipher == NULL)
+            || event_store_free(store) >= span + EVENT_STORE_ERASE_AHEAD || event_store_free(store) < span)
+            return 0;
+        ret = event_store_begin(store, &header.time, &header.summary, header.sample_size, header.encoding);
+        if (ret < 0)
+            return ret;
+        store->moving = true;
+        store->move_sample = 0;
+        ret = event_store_read(address + sizeof(header), &store->preview, sizeof(event_store_preview_t));
+        if (ret < 0)
+        {
+            event_store_move_abort(store);
+            return ret;
+        }
+        return 1;
+    }
+
+    for (pages = 0; pages < EVENT_STORE_MOVE_PAGES && store->move_sample < header.sample_count; pages++)
+    {
+        num_samples = MIN(header.sample_count - store->move_sample, sizeof(buf)/header.sample_size);
+        ret = event_store_read_samples(store, store->retain_id, store->move_sample, buf, num_samples);
+        //the copy is enciphered again under its own id by the append
+        if (ret == 0 && EVENT_STORE_ENCRYPTED(header.encoding))
+            store->cipher(store->p_cipher_context, store->nonce, header.id, &header.time,
+                          store->move_sample*header.sample_size, buf, num_samples*header.sample_size);
+        if (ret == 0)
+            ret = event_store_append(store, buf, num_samples);
+        if (ret < 0)
+        {
+            event_store_move_abort(store);
+            return ret;
+        }
+        store->move_sample += num_samples;
+    }
+    if (store->move_sample < header.sample_count)
+        return 1;
+
+    store->moving = false;
+    ret = event_store_commit(store, NULL);
+    if (ret < 0)
+        return ret;
+    //the copy is in, a reset before the old header is marked keeps both
+    ret = mt25ql256aba_page_program(event_store_flash_address(address), (uint8_t const *) &word, sizeof(word));
+    if (ret < 0)
+        return ret;
+    event_store_header_drop(store, store->retain_id);
+    store->retain_pinned = false;
+    store->moved++;
+
+    return 1;
+}
+
+/*
+ * Moves retain_id on or out of the way once the erase pool is full
+ * @return 1 while it reads headers or copies an event, 0 if there is nothing
+ * to do, -1 on spi error, -3 if the store is full
+ */
+static int8_t event_store_retain_step(event_store_t *store)
+{
+    int8_t ret;
+
+    //0 pins every event, the ring is held at the watermark
+    if (store->pin_peak_g_x10 == 0)
+        return 0;
+
+    ret = event_store_retain_scan(store);
+    if (ret != 0)
+        return ret;
+    if (!store->retain_pinned || !store->lookahead_found)
+        return 0;
+
+    return event_store_move_step(store);
+}
+
+/*
+ * Keeps EVENT_STORE_ERASE_AHEAD bytes erased ahead of the append pointer,
+ * reclaiming the acked events and those retention lets go a ring below it. Never waits on the flash: it
+ * resumes a suspended erase or reads the status register once if an erase is
+ * running, otherwise starts the largest erase that fits the alignment and the
+ * events that are retained. With the pool full it reads the headers for
+ * retention and copies a pinned event out of the way. A store of an older
+ * version is formatted by the step once every event is acked, an inline erase
+ * of the superblock and index sectors.
+ * Call it while the flash spi instance is initialized and otherwise idle
+ * @return 0 if the pool is full, 1 if an erase is running or retention has
+ * work left, -1 on spi error, -3 if a pinned event could not be copied
+ */
+int8_t event_store_erase_step(event_store_t *store)
+{
+    bool in_progress;
+    uint32_t limit;
+    uint32_t size;
+    int8_t ret;
+
+    if (!spi_is_idle(&flash_spi))
+        return 1;
+
+    //an older store takes no erase, it is formatted once a host has all of it
+    if (event_store_read_only(store))
+        return (store->acked_count < store->event_count) ? 0 : event_store_format(store);
+
+    if (store->erase_suspended)
+    {
+        ret = mt25ql256aba_resume();
+        if (ret < 0)
+            return ret;
+        store->erase_suspended = false;
+        return 1;
+    }
+
+    if (store->erase_pending > 0)
+    {
+        ret = mt25ql256aba_write_in_progress(&in_progress);
+        if (ret < 0)
+            return ret;
+        if (in_progress)
+            return 1;
+        store->erased_until += store->erase_pending;
+        store->erase_pending = 0;
+    }
+
+    limit = event_store_erase_limit(store);
+    if (limit - store->erased_until < MT25QL256ABA_SUBSECTOR_4KB_SIZE
+        || store->erased_until - store->append_addr >= EVENT_STORE_ERASE_AHEAD)
+        return event_store_retain_step(store);
+
+    //the ring is sector aligned, an aligned erase never runs past its end
+    if (store->erased_until % MT25QL256ABA_SECTOR_SIZE == 0 && limit - store->erased_until >= MT25QL256ABA_SECTOR_SIZE)
+        size = MT25QL256ABA_SECTOR_SIZE;
+    else if (store->erased_until % MT25QL256ABA_SUBSECTOR_32KB_SIZE == 0
+             && mt25ql256aba_erase_supported(MT25QL256ABA_SUBSECTOR_32KB_SIZE)
+             && limit - store->erased_until >= MT25QL256ABA_SUBSECTOR_32KB_SIZE)
+        size = MT25QL256ABA_SUBSECTOR_32KB_SIZE;
+    else
+        size = MT25QL256ABA_SUBSECTOR_4KB_SIZE;
+
+    ret = event_store_reclaim(store, store->erased_until + size);
+    if (ret < 0)
+        return ret;
+    ret = mt25ql256aba_erase_block(event_store_flash_address(store->erased_until), size);
+    if (ret < 0)
+        return ret;
+    store->erase_pending = size;
+
+    return 1;
+}
+
+/*
+ * Reads the header of an event, one index read and one header read
+ * @return 0 if success, -1 on spi error, -2 if there is no such event,
+ * -3 if the header is corrupt
+ */
+int8_t event_store_get_header(event_store_t *store, uint32_t id, event_store_header_t *header)
+{
+    uint32_t address;
+
+    return event_store_locate(store, id, &address, header);
+}
+
+/*
+ * Reads the preview of an event, one read past its header
+ * @return 0 if success, -1 on spi error, -2 if there is no such event,
+ * -3 if the header is corrupt
+ */
+int8_t event_store_get_preview(event_store_t *store, uint32_t id, event_store_preview_t *preview)
+{
+    event_store_header_t header;
+    uint32_t address;
+    int8_t ret;
+
+    ret = event_store_locate(store, id, &address, &header);
+    if (ret < 0)
+        return ret;
+    //version 5 stored none, it reads erased
+    if (store->version < 6)
+    {
+        memset(preview, 0xFF, sizeof(event_store_preview_t));
+        return 0;
+    }
+
+    return event_store_read(address + event_store_header_size(store), preview, sizeof(event_store_preview_t));
+}
+
+/*
+ * Finds the first event stored at or after a time by a binary search of the
+ * headers held, a corrupt header is passed over to the next one
+ * @param p_id - set to the event, or to the event count if none is that late
+ * @return 0 if success otherwise -1
+ */
+int8_t event_store_find_time(event_store_t *store, uint32_t time_s, uint32_t *p_id)
+{
+    event_store_header_t header;
+    uint32_t low = store->oldest_id;
+    uint32_t high = store->event_count;
+    uint32_t mid;
+    uint32_t probe;
+    int8_t ret;
+
+    while (low < high)
+    {
+        mid = low + (high - low)/2;
+        for (probe = mid; probe < high; probe++)
+        {
+            ret = event_store_get_header(store, probe, &header);
+            if (ret == -1)
+                return ret;
+            if (ret == 0)
+                break;
+        }
+        if (probe < high && header.time.s < time_s)
+            low = probe + 1;
+        else
+            high = mid;
+    }
+    *p_id = low;
+
+    return 0;
+}
+
+/*
+ * Sets up a query of the events from from_s up to to_s with a peak of at
+ * least min_peak_g_x10, 0 for all of them
+ * @return 0 if success otherwise -1
+ */
+int8_t event_store_query_init(event_store_t *store, event_store_query_t *query,
+                              uint32_t from_s, uint32_t to_s, uint16_t min_peak_g_x10)
+{
+    int8_t ret;
+
+    query->min_peak_g_x10 = min_peak_g_x10;
+    ret = event_store_find_time(store, from_s, &query->next_id);
+    if (ret < 0)
+        return ret;
+
+    return event_store_find_time(store, to_s, &query->end_id);
+}
+
+/*
+ * Reads the headers of the query range until one matches, at most
+ * EVENT_STORE_QUERY_SCAN of them per call. Reclaimed events and corrupt
+ * headers are skipped, the samples are never read
+ * @return 1 if header is the next match, 0 if none was found this call,
+ * -1 on spi error
+ */
+int8_t event_store_query_next(event_store_t *store, event_store_query_t *query,
+                              uint32_t *p_id, event_store_header_t *header)
+{
+    uint32_t scanned;
+    int8_t ret;
+
+    for (scanned = 0; scanned < EVENT_STORE_QUERY_SCAN && query->next_id < query->end_id; scanned++)
+    {
+        ret = event_store_get_header(store, query->next_id, header);
+        if (ret == -1)
+            return ret;
+        query->next_id++;
+        if (ret == 0 && header->summary.peak_g_x10 >= query->min_peak_g_x10)
+        {
+            *p_id = query->next_id - 1;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * @return true once every event of the query range has been read
+ */
+bool event_store_query_done(event_store_query_t const *query)
+{
+    return query->next_id >= query->end_id;
+}
+
+/*
+ * Checks the samples of an event against the data_crc in its header,
+ * the flash is read a page at a time so no copy of the event is needed in RAM.
+ * Enciphered samples are deciphered first
+ * @return 0 if the samples match, -1 on spi error, -2 if there is no such event
+ * or it is enciphered and the store has no cipher, -3 if the header or the samples are corrupt
+ */
+int8_t event_store_verify(event_store_t *store, uint32_t id)
+{
+    static uint8_t page[MT25QL256ABA_PAGE_SIZE];
+    event_store_header_t header;
+    uint32_t address;
+    uint32_t size;
+    uint32_t num_bytes;
+    uint32_t crc = 0;
+    int8_t ret;
+
+    ret = event_store_locate(store, id, &address, &header);
+    if (ret < 0)
+        return ret;
+    if (EVENT_STORE_ENCRYPTED(header.encoding) && store->cipher == NULL)
+        return -2;
+
+    size = event_store_data_size(&header);
+    for (uint32_t offset = 0; offset < size; offset += num_bytes)
+    {
+        num_bytes = (size - offset < sizeof(page)) ? size - offset : sizeof(page);
+        ret = event_store_read(address + event_store_data_offset(store) + offset, page, num_bytes);
+        if (ret < 0)
+            return ret;
+        if (EVENT_STORE_ENCRYPTED(header.encoding))
+            store->cipher(store->p_cipher_context, store->nonce, id, &header.time, offset, page, num_bytes);
+        crc = crc32_compute(page, num_bytes, (offset > 0) ? &crc : NULL);
+    }
+
+    if (crc != header.data_crc)
+        return -3;
+
+    return 0;
+}
+
+/*
+ * Reads num_samples samples of an event starting at first_sample, through the
+ * sample blocks of the cache if the store has one
+ * @return 0 if success, -1 on spi error, -2 if there is no such event, it was
+ * reclaimed or the samples are out of range, -3 if the header is corrupt
+ */
+int8_t event_store_read_samples(event_store_t *store, uint32_t id,
+                                uint32_t first_sample, void *samples, uint32_t num_samples)
+{
+    event_store_header_t header;
+    uint32_t address;
+    int8_t ret;
+
+    ret = event_store_locate(store, id, &address, &header);
+    if (ret < 0)
+        return ret;
+
+    if (first_sample + num_samples > header.sample_count)
+        return -2;
+
+    if (store->cache != NULL)
+        return event_store_blocks_read(store, id, address, event_store_data_size(&header),
+                                       first_sample*header.sample_size, (uint8_t *) samples,
+                                       num_samples*header.sample_size);
+
+    return event_store_read(address + event_store_data_offset(store) + first_sample*header.sample_size,
+                            samples, num_samples*header.sample_size);
+}
+
+/*
+ * Queues the read of num_samples samples of an event like
+ * event_store_read_samples without waiting for it, e.g. the next piece of an
+ * offload read into a second buffer while the first one is sent. A background
+ * erase is suspended first; the flash queue runs in order, so a program or
+ * erase started after this call waits for the read
+ * @param p_read - descriptor, samples and p_read must stay valid until the callback
+ * @return 0 if queued, 1 if the flash is busy, the samples wrap the end of
+ * the ring or they are all in the cache, read them with event_store_read_samples, -1 on spi error, -2 if
+ * there is no such event or the samples are out of range, -3 if the header is corrupt
+ */
+int8_t event_store_queue_read_samples(event_store_t *store, uint32_t id, uint32_t first_sample,
+                                      void *samples, uint32_t num_samples, mt25ql256aba_read_xfer_t *p_read,
+                                      spi_xfer_callback_t callback, void *p_context)
+{
+    event_store_header_t header;
+    uint32_t address;
+    uint32_t length;
+    bool busy;
+    int8_t ret;
+
+    ret = event_store_preempt_erase(store);
+    if (ret < 0)
+        return ret;
+    ret = event_store_locate(store, id, &address, &header);
+    if (ret < 0)
+        return ret;
+
+    if (first_sample + num_samples > header.sample_count)
+        return -2;
+
+    length = num_samples*header.sample_size;
+    if (store->cache != NULL
+        && event_store_blocks_held(store->cache, id, first_sample*header.sample_size, length))
+        return 1;
+    address = event_store_flash_address(address + event_store_data_offset(store) + first_sample*header.sample_size);
+    if (address + length > EVENT_STORE_DATA_END)
+        return 1;
+    ret = mt25ql256aba_write_in_progress(&busy);
+    if (ret < 0)
+        return ret;
+    if (busy)
+        return 1;
+
+    return mt25ql256aba_queue_read(p_read, address, (uint8_t *) samples, length, callback, p_context);
+}
@@ -0,0 +1,385 @@
+#ifndef EVENT_STORE_H
+#define EVENT_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "mt25ql256aba.h"
+#include "ds1388.h"
+#include "flash_page_writer.h"
+
+/* Flash layout
+ * 0x00000000 superblock, marks a formatted store
+ * 0x00001000 index, one 32 bit event address per event id, written in id order round a ring
+ * 0x0003F000 ack log, the offloaded up to watermark, one 16 bit count and its complement per ack
+ * 0x00040000 events, each an event_store_header_t and event_store_preview_t followed by its samples
+ * Events are packed: each starts on the word after the one before it, not on
+ * a page, so a short event or one with only its summary takes its own bytes
+ * and shares its pages, and the flash and the erases an event costs follow
+ * its size. The index holds the byte address. The pages are programmed in
+ * parts, a header and preview can run into the next page and are programmed
+ * a page at a time. Stores of page aligned events mount as they are, the
+ * next event goes in right after the last one
+ * 0x01E00000 the top 2 MB are not the store's, see activity_log.h and crash_log.h
+ * The event region is a ring: events are addressed by a ring address that
+ * only grows, the flash address is its offset into the region modulo
+ * EVENT_STORE_RING_SIZE, so an event can run past the end of the region into
+ * its start. The writes go round the whole array instead of starting over at
+ * the low sectors, every data sector is erased once per pass and the erase
+ * count of each follows from the ring address erased up to. Flash is
+ * reclaimed from the acked events first: nothing is erased a ring ahead of the
+ * first event past the watermark that is retained, the store is full when the
+ * next event would reach it. Reclaimed events read as missing,
+ * event_store_oldest() is the first one still held
+ * Retention: with event_store_retain_set() only the events at or above a peak
+ * are pinned until they are acked, the ones below it that were not offloaded
+ * are reclaimed oldest first once the ring comes round to them, while the
+ * pinned ones are kept. event_store_erase_step reads the headers
+ * past the watermark to find the first pinned event. When the ring comes
+ * within EVENT_STORE_ERASE_AHEAD of it and an unpinned event lies ahead of it,
+ * the step copies it to a new id at the append pointer, EVENT_STORE_MOVE_PAGES
+ * a step, then programs the magic of the old header to
+ * EVENT_STORE_HEADER_MOVED so it reads as missing and the ring goes past it.
+ * A new event aborts a copy, the pages it took are skipped like those of an
+ * event a reset cut short. A reset between the commit of the copy and the
+ * mark leaves both, the event is offloaded twice
+ * The index is a ring of EVENT_STORE_MAX_EVENTS entries, an event's entry is
+ * its id modulo that. Before the first event of an index subsector is begun
+ * the subsector is erased, the events of the ring before whose entries it held
+ * are reclaimed, so the store holds up to EVENT_STORE_MAX_EVENTS - 1024 events
+ * at once and takes events for as long as the oldest ones are acked or
+ * let go by retention. A store full of events that are retained refuses the
+ * next one. The ring addresses in the index only grow, so mount finds the newest
+ * entry where they drop and its id in its header. Each erase of the index acks
+ * up to the oldest event if it was let go before it was offloaded, the ack
+ * log keeps 16 bits of a count and a watermark more than 64k events behind
+ * would not decode
+ * The ack log takes the last subsector of the index, which no store ever
+ * filled, so older stores mount with their watermark at 0. Each ack programs
+ * the next erased word, the last one is the watermark, and the subsector is
+ * only erased when it is full. A reset before the next word is programmed
+ * leaves the watermark at 0, the events are then sent again. A word a reset
+ * cut short fails its complement and the one before it stands, a torn count
+ * never acks events that were not offloaded, which the ring would reclaim.
+ * An event is committed by programming its header once the samples are in and
+ * then its index entry, boot finishes a commit that only got its header in
+ * Data sectors ahead of the append pointer are erased in the background by
+ * event_store_erase_step, an append only erases inline once that pool runs out.
+ * An append returns once its page program is started, event_store_append_busy()
+ * tells a caller stepping the commit when the next append would not wait on it.
+ * Encryption: an event begun with EVENT_STORE_ENCODING_ENCRYPTED in its
+ * encoding has its samples run through the cipher set with
+ * event_store_cipher_set() as they land in the page buffer, the header and
+ * the preview stay in the clear for the queries. The cipher is a stream one
+ * keyed by the event id and time and the nonce a format draws from the source
+ * set with event_store_nonce_set() before the mount, kept in the superblock
+ * (event_crypt.h), the data_crc is of the clear
+ * samples so it also tells a reader with the wrong key. Offload sends the
+ * samples as stored, a moved event is deciphered and ciphered again under its
+ * new id, one that can't be for want of a cipher is not moved
+ * Warm restart: an app keeps event_store_resume_get() in RAM that survives
+ * a reset (watchdog.h) after each step, event_store_init_resume() then takes
+ * the event count without the search once the index agrees with it, and
+ * writes off only the events the erase could have reached since, one step
+ * past the erase it kept, instead of EVENT_STORE_ERASE_AHEAD past the append
+ * pointer. Anything that disagrees falls back to event_store_init()
+ * Older stores: a store of a version from EVENT_STORE_VERSION_READ_MIN on
+ * mounts read only instead of being formatted, so an update does not lose the
+ * events a host has not offloaded yet. Its headers and previews read in the
+ * layout of their version and come back in the current one, the clip counts
+ * erased and the preview erased before version 6. It takes no events, begin
+ * refuses them as for a full store, and no erases, the acks still move the
+ * watermark. Once every event is acked event_store_erase_step() formats it to
+ * EVENT_STORE_VERSION. The stores before it ran the ring into the top 2 MB
+ * the activity and crash logs took, they are formatted at the mount */
+#define EVENT_STORE_SUPERBLOCK_ADDRESS  0x00000000
+#define EVENT_STORE_INDEX_ADDRESS       0x00001000
+#define EVENT_STORE_ACK_ADDRESS         0x0003F000
+#define EVENT_STORE_ACK_SLOTS           (MT25QL256ABA_SUBSECTOR_4KB_SIZE/sizeof(uint32_t))
+#define EVENT_STORE_DATA_ADDRESS        0x00040000
+#define EVENT_STORE_DATA_END            0x01E00000 //the top 2 MB is the activity log and the crash log
+#define EVENT_STORE_RING_SIZE           (EVENT_STORE_DATA_END - EVENT_STORE_DATA_ADDRESS)
+#define EVENT_STORE_RING_SECTORS        (EVENT_STORE_RING_SIZE/MT25QL256ABA_SECTOR_SIZE)
+#define EVENT_STORE_RING_ADDRESS_MAX    (0xFFFFFFFF - EVENT_STORE_RING_SIZE) //ring addresses run out past here, after 135 passes
+#define EVENT_STORE_MAX_EVENTS          ((EVENT_STORE_ACK_ADDRESS - EVENT_STORE_INDEX_ADDRESS)/sizeof(uint32_t)) //index entries, a ring
+#define EVENT_STORE_INDEX_SUBSECTOR_ENTRIES (MT25QL256ABA_SUBSECTOR_4KB_SIZE/sizeof(uint32_t)) //index entries an index erase frees
+#define EVENT_STORE_MOUNT_PROBES        4  //headers read back from the newest index entry for its id
+
+#define EVENT_STORE_ERASE_AHEAD         0x20000 //pre-erased bytes kept ahead of the append pointer
+#define EVENT_STORE_EVENT_ALIGN         4  //events start on a word so the moved mark is one program in a page
+
+#ifndef EVENT_STORE_CACHE_INDEX_PAGES
+#define EVENT_STORE_CACHE_INDEX_PAGES   2  //index pages kept in ram, 64 event addresses each
+#endif
+#ifndef EVENT_STORE_CACHE_HEADERS
+#define EVENT_STORE_CACHE_HEADERS       8  //checked event headers kept in ram
+#endif
+#ifndef EVENT_STORE_CACHE_BLOCKS
+#define EVENT_STORE_CACHE_BLOCKS        8  //blocks of the samples of recent events kept in ram
+#endif
+#define EVENT_STORE_CACHE_BLOCK_SIZE    MT25QL256ABA_PAGE_SIZE //bytes of the samples per block, counted from the first sample
+#define EVENT_STORE_INDEX_PAGE_ENTRIES  (MT25QL256ABA_PAGE_SIZE/sizeof(uint32_t))
+#define EVENT_STORE_CACHE_EMPTY         0xFFFFFFFF //page or id of an unused cache entry
+
+#define EVENT_STORE_MAGIC               0x48494D55 //"HIMU"
+#define EVENT_STORE_VERSION             7 //2 added event_store_summary_t to the header, 3 event_store_time_t, 4 the ring, 5 the activity log, 6 the preview, 7 the clip counts
+#define EVENT_STORE_VERSION_READ_MIN    5 //oldest version mounted read only, see Older stores
+#define EVENT_STORE_HEADER_MAGIC        0x45564E54 //"EVNT"
+#define EVENT_STORE_HEADER_MOVED        0x00000000 //magic programmed over the header of an event copied to a new id
+#define EVENT_STORE_ENCODING_RAW        0xFFFF //samples are stored as given, the erased value so older events read as raw
+#define EVENT_STORE_ENCODING_ENCRYPTED  0x8000 //flag of an encoding other than raw, the samples are stored enciphered
+#define EVENT_STORE_ENCRYPTED(encoding) ((encoding) != EVENT_STORE_ENCODING_RAW && ((encoding) & EVENT_STORE_ENCODING_ENCRYPTED))
+
+#define EVENT_STORE_PEAK_UNKNOWN        0xFFFF //event_store_summary_t.peak_g_x10 of an event stored without it, matches any query
+#define EVENT_STORE_CLIP_UNKNOWN        0xFFFF //event_store_summary_t.clipped_adxl of an event stored without the clip counts
+#define EVENT_STORE_PREVIEW_POINTS      32
+#define EVENT_STORE_PREVIEW_NONE        0xFF //event_store_preview_t.g of a point past the end of the event, or of one stored without a preview
+#define EVENT_STORE_DATA_OFFSET         (sizeof(event_store_header_t) + sizeof(event_store_preview_t)) //of the samples from the header
+#define EVENT_STORE_QUERY_SCAN          16 //headers read per event_store_query_next call, bounds the flash hold
+#define EVENT_STORE_MOVE_PAGES          2  //pages of a pinned event copied per event_store_erase_step
+
+#define EVENT_STORE_TIME_SYNCED         0x80000000 //event_store_time_t.us flag, the time is the gateway reference, see time_sync.h
+#define EVENT_STORE_TIME_US_MASK        0x000FFFFF
+
+/* Time of an event, converted from the ds1388 fields once when the event is
+ * opened so readers compare and sort events with integer ops */
+typedef struct {
+    uint32_t s;             /* seconds since 1970-01-01 UTC */
+    uint32_t us;            /* into the second, whole hundredths from the ds1388, with EVENT_STORE_TIME_SYNCED */
+} event_store_time_t;
+
+/* Enciphers or deciphers the samples of an event in place, offset counts the
+ * bytes from its first sample, nonce is the one of the store format. Thread
+ * context, the flash is held meanwhile */
+typedef void (*event_store_cipher_t)(void *p_context, uint32_t nonce, uint32_t id, event_store_time_t const *time,
+                                     uint32_t offset, uint8_t *data, uint32_t length);
+
+/* Draws a random nonce for a new format of the store */
+typedef uint32_t (*event_store_nonce_t)(void);
+
+/* Resumes and waits out the erase another user of the flash left running or
+ * suspended, the flash takes no erase while one is suspended.
+ * @return 0 if success otherwise -1 */
+typedef int8_t (*event_store_erase_owner_t)(void);
+
+/* Results the writer computed on the device when the event closed, so a reader
+ * does not need the samples for them. Bytes the writer leaves out stay erased (0xFF) */
+typedef struct {
+    int16_t orientation[4]; /* w, x, y, z quaternion of the sensor at the trigger, Q14 */
+    int8_t direction[3];    /* unit vector to the impact location in the head frame, x127 */
+    uint8_t location;       /* impact_location_t */
+    uint16_t peak_g_x10;    /* peak resultant acceleration in 0.1 g, below EVENT_STORE_PEAK_UNKNOWN */
+    uint16_t duration_ms;   /* time above the trigger threshold */
+    uint32_t clip_points;   /* bit per preview point holding a record with an axis at full scale */
+    uint16_t clipped_adxl;  /* records with an adxl372 axis at full scale, below EVENT_STORE_CLIP_UNKNOWN */
+    uint16_t clipped_icm;   /* records with an icm20649 accel or gyro axis at full scale */
+} event_store_summary_t;
+
+/* Written at the start of every event once its samples are programmed */
+typedef struct {
+    uint32_t magic;
+    uint32_t id;
+    event_store_time_t time;
+    uint32_t sample_count;
+    uint16_t sample_size;   /* bytes per sample */
+    uint16_t encoding;      /* EVENT_STORE_ENCODING_RAW or an id chosen by the writer, e.g. a codec */
+    event_store_summary_t summary;
+    uint32_t data_crc;      /* crc32 of the samples */
+    uint32_t header_crc;    /* crc32 of the fields above */
+} event_store_header_t;
+
+/* Resultant acceleration of the event at a low rate, so a reader sees the
+ * shape of an impact before it asks for the samples. Programmed right after
+ * the header at the commit and sent with it in the summary frames, outside
+ * the header crc. An event stored without one reads erased */
+typedef struct {
+    uint32_t point_us;      /* time each point spans, the first starts at the first sample */
+    uint8_t g[EVENT_STORE_PREVIEW_POINTS]; /* peak resultant over the point in g, up to 254 */
+} event_store_preview_t;
+
+/* Cursor over the events of a time range at or above a peak, set up by
+ * event_store_query_init from two binary searches of the headers so only the
+ * headers in the range are read. Ids are in time order unless the clock was
+ * set back or a pinned event was moved, its copy keeps its time, the search
+ * then lands on either side of the step */
+typedef struct {
+    uint32_t next_id;
+    uint32_t end_id;        /* first event at or past the end of the range */
+    uint16_t min_peak_g_x10;
+} event_store_query_t;
+
+/* Least recently used copies of index pages and event headers, so the lists
+ * and summaries a gateway asks for again are served without the spi bus. The
+ * app gives the store one with event_store_cache_init() once it is mounted, it
+ * stays out of event_store_t so a store saved over System OFF stays small. A
+ * committed header never changes and an index entry is only programmed once,
+ * by event_store_commit which writes it through to a cached page, so only a
+ * format empties the cache. Reclaimed events are refused before it is looked up
+ * The samples of the recent events are kept too, as stored (enciphered if they
+ * are), in blocks of EVENT_STORE_CACHE_BLOCK_SIZE keyed by the event id and the
+ * block index, so a gateway that fetches an event again, e.g. the full event
+ * after its preview or an offload resumed after a dropped link, is sent it
+ * from ram. A read that misses takes in the whole blocks it spans, a read
+ * queued on the spi bus is only looked up: the reader hands what it got to
+ * event_store_cache_samples(), a block then holds the part of it that was
+ * read. The blocks of an event are dropped once it is reclaimed or moved */
+typedef struct {
+    uint32_t page;          /* index page number, EVENT_STORE_CACHE_EMPTY if unused */
+    uint32_t used;          /* cache clock of the last hit */
+    uint32_t entries[EVENT_STORE_INDEX_PAGE_ENTRIES];
+} event_store_index_cache_t;
+
+typedef struct {
+    uint32_t id;            /* EVENT_STORE_CACHE_EMPTY if unused */
+    uint32_t used;
+    uint32_t address;
+    event_store_header_t header;
+} event_store_header_cache_t;
+
+typedef struct {
+    uint32_t id;            /* EVENT_STORE_CACHE_EMPTY if unused */
+    uint32_t block;         /* the samples from block*EVENT_STORE_CACHE_BLOCK_SIZE bytes on */
+    uint32_t used;
+    uint16_t from;          /* bytes of the block held, from and up to */
+    uint16_t to;
+    uint8_t data[EVENT_STORE_CACHE_BLOCK_SIZE];
+} event_store_block_cache_t;
+
+typedef struct {
+    event_store_index_cache_t index[EVENT_STORE_CACHE_INDEX_PAGES];
+    event_store_header_cache_t headers[EVENT_STORE_CACHE_HEADERS];
+    event_store_block_cache_t blocks[EVENT_STORE_CACHE_BLOCKS];
+    uint32_t clock;
+    uint32_t hits;          /* index entries and headers found in ram */
+    uint32_t misses;        /* read from the flash */
+    uint32_t block_hits;    /* sample blocks found in ram */
+    uint32_t block_misses;  /* read from the flash */
+} event_store_cache_t;
+
+/* Where the store stood, see Warm restart */
+typedef struct {
+    uint32_t event_count;
+    uint32_t erased_until;  /* ring address */
+    uint32_t erase_pending; /* erase running at erased_until, 0 if none */
+} event_store_resume_t;
+
+typedef struct {
+    uint32_t version;       /* of the store mounted, below EVENT_STORE_VERSION it is read only */
+    uint32_t event_count;   /* also the id of the next event */
+    uint32_t append_addr;   /* word aligned ring address of the next event */
+    uint32_t erased_until;  /* flash from append_addr up to here is erased, a ring address */
+    uint32_t erase_pending; /* size of the erase running at erased_until, 0 if none */
+    bool erase_suspended;   /* erase_pending is suspended until the next event_store_erase_step */
+    bool event_open;        /* between event_store_begin and event_store_commit */
+    uint32_t erase_stalls;  /* appends that waited for or ran an erase since the store was mounted */
+    uint32_t acked_count;   /* events below this id have been offloaded and acknowledged */
+    uint32_t ack_slot;      /* next erased word of the ack log */
+    uint32_t unacked_addr;  /* ring address of event acked_count while there is one, the ring is not reclaimed past it */
+    uint32_t reclaimed_until; /* events starting below this ring address were erased */
+    uint32_t oldest_id;     /* first event that was not reclaimed */
+    uint16_t pin_peak_g_x10; /* events at or above it are kept until acked, 0 keeps every one */
+    uint32_t retain_id;     /* first event the ring is held at: not acked and pinned or not read yet */
+    uint32_t retain_addr;   /* its ring address while retain_id is below event_count */
+    bool retain_pinned;     /* retain_id was read and is pinned */
+    uint32_t lookahead_id;  /* next event past retain_id read for one that is not pinned */
+    bool lookahead_found;   /* lookahead_id is not pinned, moving the pinned ones before it frees the ring */
+    bool moving;            /* the open event is the copy of retain_id */
+    uint32_t move_sample;   /* next sample of retain_id to copy */
+    uint32_t dropped;       /* events reclaimed before they were acked since the store was mounted, the moved ones too */
+    uint32_t moved;         /* pinned events copied to a new id since the store was mounted */
+    event_store_header_t header; /* of the open event */
+    event_store_preview_t preview; /* of the open event */
+    flash_page_writer_t writer;
+    event_store_cache_t *cache; /* NULL without one */
+    event_store_cipher_t cipher; /* NULL without one, events are then stored in the clear */
+    void *p_cipher_context;
+    event_store_erase_owner_t erase_owner; /* NULL if the store is the flash's only eraser */
+    event_store_nonce_t nonce_source; /* NULL formats with a nonce of 0 */
+    uint32_t nonce;         /* of the format, 0 for a store formatted before the nonce */
+} event_store_t;
+
+int8_t event_store_init(event_store_t *store);
+
+int8_t event_store_init_resume(event_store_t *store, event_store_resume_t const *p_resume);
+
+void event_store_resume_get(event_store_t const *store, event_store_resume_t *p_resume);
+
+int8_t event_store_format(event_store_t *store);
+
+void event_store_time_from_ds1388(ds1388_data_t const *date, event_store_time_t *time);
+
+int8_t event_store_begin(event_store_t *store, event_store_time_t const *time,
+                         event_store_summary_t const *summary, uint16_t sample_size, uint16_t encoding);
+
+int8_t event_store_append(event_store_t *store, void const *samples, uint32_t num_samples);
+
+void event_store_set_summary(event_store_t *store, event_store_summary_t const *summary);
+
+void event_store_set_preview(event_store_t *store, event_store_preview_t const *preview);
+
+int8_t event_store_append_busy(event_store_t *store);
+
+uint32_t event_store_append_room(event_store_t const *store);
+
+int8_t event_store_commit(event_store_t *store, uint32_t *p_id);
+
+uint32_t event_store_count(event_store_t const *store);
+
+int8_t event_store_ack(event_store_t *store, uint32_t count);
+
+uint32_t event_store_acked(event_store_t const *store);
+
+bool event_store_read_only(event_store_t const *store);
+
+uint32_t event_store_oldest(event_store_t const *store);
+
+uint32_t event_store_free(event_store_t const *store);
+
+uint32_t event_store_sector_erases(event_store_t const *store, uint32_t sector);
+
+int8_t event_store_erase_step(event_store_t *store);
+
+void event_store_retain_set(event_store_t *store, uint16_t pin_peak_g_x10);
+
+void event_store_retain_stats(event_store_t const *store, uint32_t *p_dropped, uint32_t *p_moved);
+
+void event_store_cache_init(event_store_t *store, event_store_cache_t *cache);
+
+void event_store_cipher_set(event_store_t *store, event_store_cipher_t cipher, void *p_context);
+
+void event_store_erase_owner_set(event_store_t *store, event_store_erase_owner_t erase_owner);
+
+void event_store_nonce_set(event_store_t *store, event_store_nonce_t nonce_source);
+
+uint32_t event_store_nonce(event_store_t const *store);
+
+void event_store_cache_stats(event_store_t const *store, uint32_t *p_hits, uint32_t *p_misses);
+
+void event_store_cache_block_stats(event_store_t const *store, uint32_t *p_hits, uint32_t *p_misses);
+
+void event_store_cache_samples(event_store_t *store, uint32_t id, uint32_t first_sample,
+                               void const *samples, uint32_t num_samples);
+
+int8_t event_store_get_header(event_store_t *store, uint32_t id, event_store_header_t *header);
+
+int8_t event_store_get_preview(event_store_t *store, uint32_t id, event_store_preview_t *preview);
+
+int8_t event_store_find_time(event_store_t *store, uint32_t time_s, uint32_t *p_id);
+
+int8_t event_store_query_init(event_store_t *store, event_store_query_t *query,
+                              uint32_t from_s, uint32_t to_s, uint16_t min_peak_g_x10);
+
+int8_t event_store_query_next(event_store_t *store, event_store_query_t *query,
+                              uint32_t *p_id, event_store_header_t *header);
+
+bool event_store_query_done(event_store_query_t const *query);
+
+int8_t event_store_verify(event_store_t *store, uint32_t id);
+
+int8_t event_store_read_samples(event_store_t *store, uint32_t id,
+                                uint32_t first_sample, void *samples, uint32_t num_samples);
+
+int8_t event_store_queue_read_samples(event_store_t *store, uint32_t id, uint32_t first_sample,
+                                      void *samples, uint32_t num_samples, mt25ql256aba_read_xfer_t *p_read,
+                                      spi_xfer_callback_t callback, void *p_context);
+
+#endif //EVENT_STORE_H
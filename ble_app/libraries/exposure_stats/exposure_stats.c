@@ -0,0 +1,208 @@
+//-------------------------------------------
+// Title: exposure_stats.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: The session and lifetime impact exposure of exposure_stats.h,
+// added to as events are committed, and the FDS record of the lifetime set.
+//-------------------------------------------
+#include <stddef.h>
+#include <string.h>
+#include "fds.h"
+#include "app_util.h"
+
+#include "exposure_stats.h"
+
+typedef struct {
+    uint16_t version;
+    uint16_t size;                  //bytes of the record as it was saved
+    exposure_set_t lifetime;
+} exposure_record_t;
+
+#define EXPOSURE_RECORD_WORDS   BYTES_TO_WORDS(sizeof(exposure_record_t))
+
+STATIC_ASSERT(sizeof(exposure_stats_t) == 148);
+
+static exposure_stats_t m_stats = {
+    .version = EXPOSURE_STATS_VERSION,
+    .size = sizeof(exposure_stats_t),
+};
+static uint32_t m_saved[EXPOSURE_RECORD_WORDS]; //FDS reads the data until the write completes
+static bool m_dirty = false;                    //the lifetime set changed since the last save
+static volatile bool m_fds_ready = false;
+static volatile bool m_save_retry = false;      //the write is redone once the garbage collection is done
+
+static ret_code_t exposure_stats_write(void);
+
+static void fds_evt_handler(fds_evt_t const * p_evt)
+{
+    switch (p_evt->id)
+    {
+        case FDS_EVT_INIT:
+            m_fds_ready = (p_evt->result == FDS_SUCCESS);
+            break;
+
+        case FDS_EVT_GC:
+            if (m_save_retry)
+            {
+                m_save_retry = false;
+                (void) exposure_stats_write();
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Writes m_saved over the lifetime record, or a new one if there is none,
+// returns FDS_SUCCESS if the write or the garbage collection before it is queued
+static ret_code_t exposure_stats_write(void)
+{
+    fds_record_t const record = {
+        .file_id = EXPOSURE_STATS_FILE_ID,
+        .key = EXPOSURE_STATS_RECORD_KEY,
+        .data = {.p_data = m_saved, .length_words = EXPOSURE_RECORD_WORDS},
+    };
+    fds_record_desc_t desc;
+    fds_find_token_t token;
+    ret_code_t err_code;
+
+    memset(&token, 0, sizeof(token));
+    if (fds_record_find(EXPOSURE_STATS_FILE_ID, EXPOSURE_STATS_RECORD_KEY, &desc, &token) == FDS_SUCCESS)
+    {
+        err_code = fds_record_update(&desc, &record);
+    }
+    else
+    {
+        err_code = fds_record_write(NULL, &record);
+    }
+    if (err_code == FDS_ERR_NO_SPACE_IN_FLASH && !m_save_retry)
+    {
+        err_code = fds_gc();
+        m_save_retry = (err_code == FDS_SUCCESS);
+    }
+
+    return err_code;
+}
+
+static uint16_t exposure_inc16(uint16_t count)
+{
+    return (count < UINT16_MAX) ? count + 1 : count;
+}
+
+static void exposure_set_add(exposure_set_t *p_set, uint16_t peak_g_x10, uint32_t peak_alpha, uint32_t hic15)
+{
+    uint32_t bin;
+
+    if (p_set->events < UINT32_MAX)
+        p_set->events++;
+    if (p_set->peak_sum_g_x10 <= UINT32_MAX - peak_g_x10)
+        p_set->peak_sum_g_x10 += peak_g_x10;
+    p_set->max_peak_g_x10 = MAX(p_set->max_peak_g_x10, peak_g_x10);
+    p_set->max_hic15 = MAX(p_set->max_hic15, MIN(hic15, UINT16_MAX));
+    p_set->max_alpha = MAX(p_set->max_alpha, peak_alpha);
+    if (peak_g_x10 >= EXPOSURE_STATS_LINEAR_LIMIT_G_X10)
+        p_set->over_linear = exposure_inc16(p_set->over_linear);
+    if (peak_alpha >= EXPOSURE_STATS_ROT_LIMIT_RAD_S2)
+        p_set->over_rotational = exposure_inc16(p_set->over_rotational);
+    if (hic15 >= EXPOSURE_STATS_HIC15_LIMIT)
+        p_set->over_hic15 = exposure_inc16(p_set->over_hic15);
+
+    bin = MIN(peak_g_x10/(EXPOSURE_STATS_LINEAR_BIN_G*10), EXPOSURE_STATS_LINEAR_BINS - 1);
+    p_set->linear[bin] = exposure_inc16(p_set->linear[bin]);
+    bin = MIN(peak_alpha/EXPOSURE_STATS_ROT_BIN_RAD_S2, EXPOSURE_STATS_ROT_BINS - 1);
+    p_set->rotational[bin] = exposure_inc16(p_set->rotational[bin]);
+}
+
+/*
+ * Registers with FDS, before device_config_init() mounts it
+ * @return 0 if success, -1 if FDS is out of users
+ */
+int8_t exposure_stats_init(void)
+{
+    return (fds_register(fds_evt_handler) == FDS_SUCCESS) ? 0 : -1;
+}
+
+/*
+ * Reads the lifetime record, after device_config_init(). A record of another
+ * version is dropped and the lifetime counts from zero, like a board without one
+ * @return 0 if success or there is no record, -1 if FDS is not mounted
+ */
+int8_t exposure_stats_load(void)
+{
+    fds_flash_record_t flash_record;
+    fds_record_desc_t desc;
+    fds_find_token_t token;
+    exposure_record_t const *p_stored;
+    uint32_t size;
+
+    if (!m_fds_ready)
+        return -1;
+
+    memset(&token, 0, sizeof(token));
+    if (fds_record_find(EXPOSURE_STATS_FILE_ID, EXPOSURE_STATS_RECORD_KEY, &desc, &token) != FDS_SUCCESS)
+        return 0;
+    if (fds_record_open(&desc, &flash_record) != FDS_SUCCESS)
+        return 0;
+    p_stored = (exposure_record_t const *) flash_record.p_data;
+    size = flash_record.p_header->length_words*sizeof(uint32_t);
+    if (size >= offsetof(exposure_record_t, lifetime) && p_stored->version == EXPOSURE_STATS_VERSION)
+    {
+        size = MIN(MIN(size, p_stored->size), sizeof(exposure_record_t)) - offsetof(exposure_record_t, lifetime);
+        memcpy(&m_stats.lifetime, &p_stored->lifetime, size);
+    }
+    (void) fds_record_close(&desc);
+
+    return 0;
+}
+
+/*
+ * Counts a committed event in both sets, thread context
+ */
+void exposure_stats_add(uint16_t peak_g_x10, uint32_t peak_alpha, uint32_t hic15)
+{
+    exposure_set_add(&m_stats.session, peak_g_x10, peak_alpha, hic15);
+    exposure_set_add(&m_stats.lifetime, peak_g_x10, peak_alpha, hic15);
+    m_dirty = true;
+}
+
+/*
+ * Starts a new session, e.g. at the start of a game
+ */
+void exposure_stats_session_reset(void)
+{
+    memset(&m_stats.session, 0, sizeof(m_stats.session));
+}
+
+/*
+ * Keeps the lifetime set for the next boot if it changed, thread context.
+ * The write finishes in the background, one FDS refuses is tried again on
+ * the next call
+ * @return 0 if the write is queued or there was nothing to write, -1 if FDS refused it
+ */
+int8_t exposure_stats_save(void)
+{
+    exposure_record_t *p_record = (exposure_record_t *) m_saved;
+
+    if (!m_dirty)
+        return 0;
+    if (!m_fds_ready)
+        return -1;
+
+    memset(m_saved, 0, sizeof(m_saved));
+    p_record->version = EXPOSURE_STATS_VERSION;
+    p_record->size = sizeof(exposure_record_t);
+    p_record->lifetime = m_stats.lifetime;
+    if (exposure_stats_write() != FDS_SUCCESS)
+        return -1;
+
+    m_dirty = false;
+    return 0;
+}
+
+/*
+ * @return the stats as the exposure characteristic serves them
+ */
+exposure_stats_t const *exposure_stats_get(void)
+{
+    return &m_stats;
+}
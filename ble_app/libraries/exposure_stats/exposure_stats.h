@@ -0,0 +1,68 @@
+#ifndef EXPOSURE_STATS_H
+#define EXPOSURE_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Head impact exposure of the wearer, kept in ram as each event is committed
+ * so a gateway reads it in one read instead of offloading every event to
+ * work it out: a histogram of the resultant peaks in EXPOSURE_STATS_LINEAR_BIN_G
+ * bins and of the rotational peaks in EXPOSURE_STATS_ROT_BIN_RAD_S2 bins, the
+ * last bin of each open ended, the events at or over the thresholds below and
+ * the highest values seen. The session set counts from the boot or from
+ * exposure_stats_session_reset(), the lifetime set is kept in one FDS record
+ * that exposure_stats_save() rewrites when it changed, the app calls it on a
+ * timer rather than on every event so the FDS pages wear slowly; a reset
+ * loses at most the events of one period. The record is the set with a
+ * version and size in front, like device_config.h, which owns the FDS init:
+ * exposure_stats_init() registers before it and exposure_stats_load() reads
+ * the record after it. The ble_ios exposure characteristic serves
+ * exposure_stats_t straight from ram, little endian, 148 bytes. The counters
+ * saturate rather than wrap. The thresholds are the 50% concussion risk
+ * values of Zhang et al. 2004 for the linear and rotational peaks, and the
+ * HIC15 a helmet standard passes below */
+#define EXPOSURE_STATS_FILE_ID              0x4845  //FDS file of the lifetime record
+#define EXPOSURE_STATS_RECORD_KEY           0x0001
+#define EXPOSURE_STATS_VERSION              1
+#define EXPOSURE_STATS_LINEAR_BIN_G         10
+#define EXPOSURE_STATS_LINEAR_BINS          16      //the last one from 150 g up
+#define EXPOSURE_STATS_ROT_BIN_RAD_S2       1000
+#define EXPOSURE_STATS_ROT_BINS             8       //the last one from 7000 rad/s^2 up
+#define EXPOSURE_STATS_LINEAR_LIMIT_G_X10   820
+#define EXPOSURE_STATS_ROT_LIMIT_RAD_S2     5900
+#define EXPOSURE_STATS_HIC15_LIMIT          250
+
+typedef struct {
+    uint32_t events;
+    uint32_t peak_sum_g_x10;        //the mean peak is the sum over the events
+    uint16_t max_peak_g_x10;
+    uint16_t max_hic15;
+    uint32_t max_alpha;             //rad/s^2, 0 without the gyro
+    uint16_t over_linear;           //events at or over EXPOSURE_STATS_LINEAR_LIMIT_G_X10
+    uint16_t over_rotational;       //at or over EXPOSURE_STATS_ROT_LIMIT_RAD_S2
+    uint16_t over_hic15;            //at or over EXPOSURE_STATS_HIC15_LIMIT
+    uint16_t reserved;
+    uint16_t linear[EXPOSURE_STATS_LINEAR_BINS];
+    uint16_t rotational[EXPOSURE_STATS_ROT_BINS];
+} exposure_set_t;
+
+typedef struct {
+    uint16_t version;               //EXPOSURE_STATS_VERSION
+    uint16_t size;                  //bytes of the struct
+    exposure_set_t session;
+    exposure_set_t lifetime;
+} exposure_stats_t;
+
+int8_t exposure_stats_init(void);
+
+int8_t exposure_stats_load(void);
+
+void exposure_stats_add(uint16_t peak_g_x10, uint32_t peak_alpha, uint32_t hic15);
+
+void exposure_stats_session_reset(void);
+
+int8_t exposure_stats_save(void);
+
+exposure_stats_t const *exposure_stats_get(void);
+
+#endif //EXPOSURE_STATS_H
@@ -0,0 +1,146 @@
+//-------------------------------------------
+// Title: factory_test.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Checks every sensor in parallel for the production test.
+// The id reads go out on all the buses at once from their queued driver
+// calls, the completions are timed and joined like the imu_sampler pair.
+//-------------------------------------------
+#include <string.h>
+#include "factory_test.h"
+#include "adxl372.h"
+#include "icm20649.h"
+#include "mt25ql256aba.h"
+#include "vcnl4040.h"
+#include "ds1388.h"
+#include "timebase.h"
+#include "app_util_platform.h"
+#include "nrf_log.h"
+
+typedef struct {
+    spi_xfer_t accel_xfer;
+    spi_xfer_t flash_xfer;
+    icm20649_id_read_t gyro_read;
+    uint8_t accel_ids[ADXL372_ID_LENGTH];
+    uint8_t flash_ids[MT25QL256ABA_ID_LENGTH];
+    ds1388_data_t rtc_time;
+    factory_test_result_t result;
+    volatile uint8_t pending;   //checks still on their bus
+    volatile bool running;      //a check done after the timeout is dropped
+} factory_test_t;
+
+static factory_test_t m_test;
+
+//the callback context of a check
+#define FACTORY_TEST_CONTEXT(check) ((void *)(uintptr_t)(check))
+
+/*
+ * Runs from the spi or twi interrupt once per check, p_context is its factory_test_check_t
+ */
+static void factory_test_done(int8_t result, void *p_context)
+{
+    factory_test_check_t check = (factory_test_check_t)(uintptr_t) p_context;
+
+    CRITICAL_REGION_ENTER();
+    if (m_test.running)
+    {
+        m_test.result.done_us[check] = timebase_now_us();
+        m_test.result.result[check] = (result < 0) ? -1 : 0;
+        m_test.pending--;
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * A check that could not be queued completes right away with a bus error
+ */
+static void factory_test_start(factory_test_check_t check, int8_t ret)
+{
+    if (ret < 0)
+        factory_test_done(-1, FACTORY_TEST_CONTEXT(check));
+}
+
+/*
+ * Queues all the checks and waits until they are done or FACTORY_TEST_TIMEOUT_MS
+ * passed, then checks the ids that were read
+ * @return 0 if every check passed otherwise -2
+ */
+int8_t factory_test_run(factory_test_result_t *p_result)
+{
+    uint8_t i;
+
+    memset(&m_test.result, 0, sizeof(m_test.result));
+    for (i = 0; i < FACTORY_TEST_CHECKS; i++)
+        m_test.result.result[i] = -1;
+    m_test.pending = FACTORY_TEST_CHECKS;
+    m_test.running = true;
+
+    timebase_start();
+    //the twi is the slowest bus, it goes first
+    factory_test_start(FACTORY_TEST_PROX,
+                       vcnl4040_schedule_id_read(factory_test_done, FACTORY_TEST_CONTEXT(FACTORY_TEST_PROX)));
+    factory_test_start(FACTORY_TEST_RTC,
+                       ds1388_schedule_get_time(&m_test.rtc_time, factory_test_done, FACTORY_TEST_CONTEXT(FACTORY_TEST_RTC)));
+    factory_test_start(FACTORY_TEST_GYRO,
+                       icm20649_queue_id_read(&m_test.gyro_read, factory_test_done, FACTORY_TEST_CONTEXT(FACTORY_TEST_GYRO)));
+    factory_test_start(FACTORY_TEST_ACCEL,
+                       adxl372_queue_id_read(&m_test.accel_xfer, m_test.accel_ids,
+                                             factory_test_done, FACTORY_TEST_CONTEXT(FACTORY_TEST_ACCEL)));
+    factory_test_start(FACTORY_TEST_FLASH,
+                       mt25ql256aba_queue_id_read(&m_test.flash_xfer, m_test.flash_ids,
+                                                  factory_test_done, FACTORY_TEST_CONTEXT(FACTORY_TEST_FLASH)));
+
+    //nothing else wakes the cpu before the timeout, the run is short enough to poll
+    while (m_test.pending > 0 && timebase_now_us() < FACTORY_TEST_TIMEOUT_MS*1000UL)
+        ;
+
+    CRITICAL_REGION_ENTER();
+    m_test.running = false;
+    m_test.result.total_us = timebase_now_us();
+    CRITICAL_REGION_EXIT();
+    timebase_stop();
+
+    if (m_test.result.result[FACTORY_TEST_ACCEL] == 0)
+        m_test.result.result[FACTORY_TEST_ACCEL] = adxl372_id_check(m_test.accel_ids);
+    if (m_test.result.result[FACTORY_TEST_FLASH] == 0)
+        m_test.result.result[FACTORY_TEST_FLASH] = mt25ql256aba_id_check(m_test.flash_ids);
+    //another flash part passes when its sfdp tables fit the event store
+    if (m_test.result.result[FACTORY_TEST_FLASH] == -2)
+        m_test.result.result[FACTORY_TEST_FLASH] = mt25ql256aba_detect();
+    if (m_test.result.result[FACTORY_TEST_GYRO] == 0 && m_test.gyro_read.who_am_i != ICM20649_WHO_AM_I_VAL)
+    {
+        NRF_LOG_ERROR("icm20649 who_am_i 0x%x", m_test.gyro_read.who_am_i);
+        m_test.result.result[FACTORY_TEST_GYRO] = -2;
+    }
+    if (m_test.result.result[FACTORY_TEST_PROX] == 0)
+        m_test.result.result[FACTORY_TEST_PROX] = vcnl4040_id_check();
+
+    for (i = 0; i < FACTORY_TEST_CHECKS; i++)
+    {
+        if (m_test.result.result[i] < 0)
+            m_test.result.failed |= 1 << i;
+    }
+
+    *p_result = m_test.result;
+    return (p_result->failed == 0) ? 0 : -2;
+}
+
+/*
+ * Logs the result in two fixed lines for the test fixture to match:
+ *   FACTORY: PASS|FAIL, failed 0x<factory_test_check_t bits> in <us> us
+ *   FACTORY: done at accel <us> flash <us> gyro <us> prox <us> rtc <us> us
+ */
+void factory_test_report(factory_test_result_t const *p_result)
+{
+    if (p_result->failed == 0)
+    {
+        NRF_LOG_INFO("FACTORY: PASS, failed 0x%02x in %d us", p_result->failed, p_result->total_us);
+    }
+    else
+    {
+        NRF_LOG_ERROR("FACTORY: FAIL, failed 0x%02x in %d us", p_result->failed, p_result->total_us);
+    }
+    NRF_LOG_INFO("FACTORY: done at accel %d flash %d gyro %d prox %d rtc %d us",
+                 p_result->done_us[FACTORY_TEST_ACCEL], p_result->done_us[FACTORY_TEST_FLASH],
+                 p_result->done_us[FACTORY_TEST_GYRO], p_result->done_us[FACTORY_TEST_PROX],
+                 p_result->done_us[FACTORY_TEST_RTC]);
+}
@@ -0,0 +1,41 @@
+#ifndef FACTORY_TEST_H
+#define FACTORY_TEST_H
+
+#include <stdint.h>
+
+/* Production check of every sensor at once. The id reads of the adxl372, the
+ * mt25ql256aba, the icm20649, the vcnl4040 and the ds1388 are all queued up
+ * front, each on the bus its driver uses, so the spim instances and the twi
+ * run them in parallel and the ones sharing a bus follow each other without
+ * a gap (on PCB rev1 the flash is behind the accel on the same instance,
+ * spi_driver switches its pins in). Nothing waits on a fixed delay: the run
+ * takes as long as the slowest bus, well under a millisecond. Each check is
+ * timed with timebase from the start of the run to its completion, a check
+ * not done within FACTORY_TEST_TIMEOUT_MS fails as a bus error.
+ * The register write checks and the self tests of the drivers are left out,
+ * what is checked is that every part is fitted, answers on its bus and is
+ * the right part. Thread context while nothing else uses the sensors,
+ * timebase must not be running */
+#define FACTORY_TEST_TIMEOUT_MS     50
+
+typedef enum {
+    FACTORY_TEST_ACCEL = 0,     //adxl372 ids
+    FACTORY_TEST_FLASH,         //mt25ql256aba ids, or the sfdp tables of another part
+    FACTORY_TEST_GYRO,          //icm20649 WHO_AM_I
+    FACTORY_TEST_PROX,          //vcnl4040 ID
+    FACTORY_TEST_RTC,           //ds1388 time registers, it has no id
+    FACTORY_TEST_CHECKS
+} factory_test_check_t;
+
+typedef struct {
+    int8_t result[FACTORY_TEST_CHECKS];     //0 pass, -1 the bus failed or timed out, -2 wrong id
+    uint32_t done_us[FACTORY_TEST_CHECKS];  //from the start of the run
+    uint32_t total_us;
+    uint8_t failed;                         //bit per factory_test_check_t
+} factory_test_result_t;
+
+int8_t factory_test_run(factory_test_result_t *p_result);
+
+void factory_test_report(factory_test_result_t const *p_result);
+
+#endif //FACTORY_TEST_H
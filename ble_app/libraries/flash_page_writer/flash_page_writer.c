@@ -0,0 +1,164 @@
+//-------------------------------------------
+// Title: flash_page_writer.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Page aggregating writer for the mt25ql256aba.
+// Every PAGE PROGRAM costs a write enable, the command and a status
+// poll, so appended data is packed into 256 byte pages and each page
+// is programmed once. Requires the flash spi instance to be initialized.
+//-------------------------------------------
+#include <string.h>
+#include "flash_page_writer.h"
+
+/*
+ * Starts writing at address, which does not need to be page aligned
+ * (e.g. after a flush). The flash from address to the end of its page must be erased
+ */
+void flash_page_writer_init(flash_page_writer_t *writer, uint32_t address)
+{
+    writer->page_address = address - (address % MT25QL256ABA_PAGE_SIZE);
+    writer->start = address % MT25QL256ABA_PAGE_SIZE;
+    writer->fill = writer->start;
+    writer->pages_programmed = 0;
+    writer->programming = false;
+    writer->wrap_start = 0;
+    writer->wrap_size = 0;
+    writer->offset = 0;
+    writer->cipher = NULL;
+    writer->p_cipher_context = NULL;
+    memset(writer->page, 0xFF, sizeof(writer->page));
+}
+
+/*
+ * Programs the addresses from start + size on at their offset into the ring
+ * from start, call after flash_page_writer_init
+ */
+void flash_page_writer_set_wrap(flash_page_writer_t *writer, uint32_t start, uint32_t size)
+{
+    writer->wrap_start = start;
+    writer->wrap_size = size;
+}
+
+/*
+ * Transforms the bytes appended from here on, e.g. encrypts them, call
+ * after flash_page_writer_init
+ */
+void flash_page_writer_set_cipher(flash_page_writer_t *writer, flash_page_writer_cipher_t cipher, void *p_context)
+{
+    writer->cipher = cipher;
+    writer->p_cipher_context = p_context;
+}
+
+/*
+ * Programs the bytes of the page buffer that are not in flash yet
+ * @return 0 if success otherwise the mt25ql256aba_page_program error
+ */
+static int8_t flash_page_writer_program(flash_page_writer_t *writer)
+{
+    uint32_t address = writer->page_address;
+    int8_t ret;
+
+    if (writer->fill == writer->start)
+        return 0;
+
+    //a page never straddles the end of the ring
+    if (writer->wrap_size > 0 && address >= writer->wrap_start + writer->wrap_size)
+        address = writer->wrap_start + (address - writer->wrap_start) % writer->wrap_size;
+    ret = mt25ql256aba_page_program(address + writer->start,
+                                    &writer->page[writer->start],
+                                    writer->fill - writer->start);
+    if (ret < 0)
+        return ret;
+
+    writer->start = writer->fill;
+    writer->pages_programmed++;
+    writer->programming = true;
+
+    return 0;
+}
+
+/*
+ * Appends data, programming every page that fills up
+ * @return 0 if success otherwise -1 (the data of the failed page is dropped)
+ */
+int8_t flash_page_writer_append(flash_page_writer_t *writer, void const *data, uint32_t length)
+{
+    uint8_t const *p_data = (uint8_t const *) data;
+    uint16_t chunk;
+    int8_t ret = 0;
+
+    while (length > 0)
+    {
+        chunk = MT25QL256ABA_PAGE_SIZE - writer->fill;
+        if (chunk > length)
+            chunk = length;
+
+        memcpy(&writer->page[writer->fill], p_data, chunk);
+        if (writer->cipher != NULL)
+            writer->cipher(writer->p_cipher_context, writer->offset, &writer->page[writer->fill], chunk);
+        writer->offset += chunk;
+        writer->fill += chunk;
+        p_data += chunk;
+        length -= chunk;
+
+        if (writer->fill == MT25QL256ABA_PAGE_SIZE)
+        {
+            ret = flash_page_writer_program(writer);
+            writer->page_address += MT25QL256ABA_PAGE_SIZE;
+            writer->start = 0;
+            writer->fill = 0;
+            memset(writer->page, 0xFF, sizeof(writer->page));
+            if (ret < 0)
+                return ret;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Programs a partially filled page, later appends continue in the same page
+ * @return 0 if success otherwise -1
+ */
+int8_t flash_page_writer_flush(flash_page_writer_t *writer)
+{
+    return flash_page_writer_program(writer);
+}
+
+/*
+ * Reads the status register once, without waiting, if a page this writer
+ * started may still be programming. An append or flush started while busy
+ * waits for the program in mt25ql256aba_page_program
+ * @param p_busy - true while the last page is programming
+ * @return 0 if success otherwise -1
+ */
+int8_t flash_page_writer_busy(flash_page_writer_t *writer, bool *p_busy)
+{
+    int8_t ret;
+
+    if (writer->programming)
+    {
+        ret = mt25ql256aba_write_in_progress(&writer->programming);
+        if (ret < 0)
+            return ret;
+    }
+    *p_busy = writer->programming;
+
+    return 0;
+}
+
+/*
+ * @return the bytes that fill the page buffer, an append of up to these plus
+ * less than a page more programs a single page
+ */
+uint16_t flash_page_writer_room(flash_page_writer_t const *writer)
+{
+    return MT25QL256ABA_PAGE_SIZE - writer->fill;
+}
+
+/*
+ * @return the address the next appended byte is written to, before any wrap
+ */
+uint32_t flash_page_writer_address(flash_page_writer_t const *writer)
+{
+    return writer->page_address + writer->fill;
+}
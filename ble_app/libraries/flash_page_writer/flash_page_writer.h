@@ -0,0 +1,53 @@
+#ifndef FLASH_PAGE_WRITER_H
+#define FLASH_PAGE_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "mt25ql256aba.h"
+
+/* Collects appended data in RAM and programs the mt25ql256aba one
+ * full page at a time instead of once per sample. A partial page is
+ * only programmed by flash_page_writer_flush, the remaining bytes of
+ * that page stay erased so the next append continues in it. With a wrap set
+ * the addresses go on growing past the end of a ring of the flash and are
+ * programmed at their offset into it, e.g. for the event_store ring.
+ * A page program returns as soon as it is started, flash_page_writer_busy()
+ * reads the status once so a caller can fill the next page meanwhile and only
+ * append, with flash_page_writer_room() bytes or less, once the flash is done.
+ * With a cipher set the appended bytes are transformed in the page buffer as
+ * they are copied in, so the flash gets them without another copy */
+
+/* Transforms bytes in place, offset counts the bytes appended since flash_page_writer_init */
+typedef void (*flash_page_writer_cipher_t)(void *p_context, uint32_t offset, uint8_t *data, uint16_t length);
+
+typedef struct {
+    uint32_t page_address;  /* flash address of page[0], page aligned */
+    uint32_t wrap_start;    /* page aligned start of the ring */
+    uint32_t wrap_size;     /* page multiple, 0 if the addresses are flash addresses */
+    uint16_t start;         /* first byte of page not yet programmed */
+    uint16_t fill;          /* bytes of page holding data */
+    uint32_t pages_programmed;
+    bool programming;       /* a program was started and not seen done yet */
+    uint32_t offset;        /* bytes appended since flash_page_writer_init */
+    flash_page_writer_cipher_t cipher; /* NULL keeps the bytes as appended */
+    void *p_cipher_context;
+    uint8_t page[MT25QL256ABA_PAGE_SIZE];
+} flash_page_writer_t;
+
+void flash_page_writer_init(flash_page_writer_t *writer, uint32_t address);
+
+void flash_page_writer_set_wrap(flash_page_writer_t *writer, uint32_t start, uint32_t size);
+
+void flash_page_writer_set_cipher(flash_page_writer_t *writer, flash_page_writer_cipher_t cipher, void *p_context);
+
+int8_t flash_page_writer_append(flash_page_writer_t *writer, void const *data, uint32_t length);
+
+int8_t flash_page_writer_flush(flash_page_writer_t *writer);
+
+int8_t flash_page_writer_busy(flash_page_writer_t *writer, bool *p_busy);
+
+uint16_t flash_page_writer_room(flash_page_writer_t const *writer);
+
+uint32_t flash_page_writer_address(flash_page_writer_t const *writer);
+
+#endif //FLASH_PAGE_WRITER_H
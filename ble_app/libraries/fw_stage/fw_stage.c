@@ -0,0 +1,505 @@
+//-------------------------------------------
+// Title: fw_stage.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Stages a firmware update in bank 1 of the secure bootloader
+// while the app runs, see fw_stage.h. The writes fill two chunk buffers,
+// the thread erases the pages ahead and writes the chunks in order through
+// the SoftDevice, one flash operation at a time, and the commit rewrites
+// the bootloader settings as a transfer with the whole image in.
+//-------------------------------------------
+#include <stddef.h>
+#include <string.h>
+#include "nrf.h"
+#include "nrf_sdm.h"
+#include "nrf_soc.h"
+#include "nrf_fstorage.h"
+#include "nrf_fstorage_sd.h"
+#include "nrf_dfu_types.h"
+#include "nrf_bootloader_info.h"
+#include "crc32.h"
+#include "app_util.h"
+#include "app_util_platform.h"
+#include "nrf_log.h"
+#include "nrf_log_ctrl.h"
+
+#include "fw_stage.h"
+
+#define BOOTLOADER_ADDRESS      (NRF_UICR->NRFFW[0]) //0xFFFFFFFF without a bootloader
+#define SETTINGS_CRC_SIZE       (offsetof(nrf_dfu_settings_t, init_command) - sizeof(uint32_t))
+
+STATIC_ASSERT(sizeof(fw_stage_status_t) == 16);
+STATIC_ASSERT(CODE_PAGE_SIZE % FW_STAGE_CHUNK_SIZE == 0);
+STATIC_ASSERT(FW_STAGE_INIT_MAX_SIZE <= INIT_COMMAND_MAX_SIZE);
+STATIC_ASSERT(sizeof(nrf_dfu_settings_t) <= FW_STAGE_SETTINGS_SIZE);
+
+enum {
+    CHUNK_FREE,         //taking the writes if it is m_fill
+    CHUNK_FULL,         //waits for the flash
+    CHUNK_WRITING,
+    CHUNK_WRITTEN       //to be read back into the crc
+};
+
+enum {
+    SETTINGS_NONE,
+    SETTINGS_ERASING,
+    SETTINGS_WRITING
+};
+
+typedef struct {
+    uint32_t offset;    //in the image
+    uint8_t data[FW_STAGE_CHUNK_SIZE];
+    uint16_t length;
+    volatile uint8_t state;
+} fw_stage_chunk_t;
+
+static void fw_stage_fs_evt_handler(nrf_fstorage_evt_t *p_evt);
+
+//the range is set at the init, from the bootloader's address
+NRF_FSTORAGE_DEF(nrf_fstorage_t m_fs) = {
+    .evt_handler = fw_stage_fs_evt_handler,
+};
+
+static volatile uint8_t m_state = FW_STAGE_OFF;
+static uint32_t m_bank1;                //flash address of bank 1
+static uint32_t m_room;
+static uint8_t m_init[FW_STAGE_INIT_MAX_SIZE];
+static uint16_t m_init_size;
+static uint16_t m_init_received;
+static uint32_t m_image_size;
+static uint32_t m_image_crc;            //given at the begin
+static uint32_t m_received;
+static fw_stage_chunk_t m_chunks[2];
+static uint8_t m_fill;                  //chunk the writes go into
+static uint8_t m_write;                 //chunk going to the flash next, they alternate
+static uint32_t m_erased;               //image bytes whose pages are erased
+static uint32_t m_verified;             //image bytes read back
+static uint32_t m_flash_crc;            //of the bytes read back
+static volatile bool m_flash_busy;      //an operation is on the fstorage queue
+static volatile bool m_flash_failed;
+static uint8_t m_settings_step;
+static volatile bool m_swap_pending;
+static union {
+    nrf_dfu_settings_t settings;
+    uint32_t words[FW_STAGE_SETTINGS_SIZE/sizeof(uint32_t)];
+} m_settings;
+
+// Flash operation done, SoC event context
+static void fw_stage_fs_evt_handler(nrf_fstorage_evt_t *p_evt)
+{
+    if (p_evt->result != NRF_SUCCESS)
+        m_flash_failed = true;
+    else if (p_evt->id == NRF_FSTORAGE_EVT_WRITE_RESULT && m_chunks[m_write].state == CHUNK_WRITING)
+        m_chunks[m_write].state = CHUNK_WRITTEN;
+    m_flash_busy = false;
+}
+
+static void fw_stage_fail(char const *reason)
+{
+    NRF_LOG_ERROR("Firmware update failed: %s", reason);
+    m_state = FW_STAGE_FAILED;
+}
+
+/*
+ * Puts one erase or write on the fstorage queue
+ * @return 0 if queued, -3 if the queue is full (it is FDS's too), -1 if refused
+ */
+static int8_t fw_stage_flash(bool erase, uint32_t addr, void const *data, uint32_t length)
+{
+    ret_code_t err_code;
+
+    m_flash_busy = true;
+    err_code = erase ? nrf_fstorage_erase(&m_fs, addr, 1, NULL) :
+                       nrf_fstorage_write(&m_fs, addr, data, length, NULL);
+    if (err_code == NRF_SUCCESS)
+        return 0;
+
+    m_flash_busy = false;
+    return (err_code == NRF_ERROR_NO_MEM) ? -3 : -1;
+}
+
+/*
+ * Copies the settings page and makes it a transfer of the staged objects
+ * with both of them in, for the bootloader to execute
+ * @return 0 if success, -1 if the page in flash is not valid
+ */
+static int8_t fw_stage_settings_build(void)
+{
+    nrf_dfu_settings_t *p_settings = &m_settings.settings;
+
+    memcpy(m_settings.words, (void const *) BOOTLOADER_SETTINGS_ADDRESS, sizeof(m_settings.words));
+    //the bootloader restores its backup over a page with a bad crc, the progress would go with it
+    if (p_settings->crc != crc32_compute((uint8_t const *) p_settings + sizeof(uint32_t), SETTINGS_CRC_SIZE, NULL))
+        return -1;
+
+    //an empty bank 1 has no valid init command, so the bootloader checks the signature again at its execute
+    p_settings->bank_1.image_size = 0;
+    p_settings->bank_1.image_crc = 0;
+    p_settings->bank_1.bank_code = NRF_DFU_BANK_INVALID;
+    p_settings->write_offset = m_image_size;
+    memset(&p_settings->progress, 0, sizeof(p_settings->progress));
+    p_settings->progress.command_size = m_init_size;
+    p_settings->progress.command_offset = m_init_size;
+    p_settings->progress.command_crc = crc32_compute(m_init, m_init_size, NULL);
+    p_settings->progress.firmware_image_crc = m_image_crc;
+    p_settings->progress.firmware_image_crc_last = m_image_crc;
+    p_settings->progress.firmware_image_offset = m_image_size;
+    p_settings->progress.firmware_image_offset_last = m_image_size;
+    memset(p_settings->init_command, 0, sizeof(p_settings->init_command));
+    memcpy(p_settings->init_command, m_init, m_init_size);
+    p_settings->crc = crc32_compute((uint8_t const *) p_settings + sizeof(uint32_t), SETTINGS_CRC_SIZE, NULL);
+
+    return 0;
+}
+
+/*
+ * Writes the settings page once every chunk is read back
+ * @return 0 if success or waiting, -1 if failed
+ */
+static int8_t fw_stage_settings_process(void)
+{
+    int8_t ret;
+
+    if (m_verified < m_image_size)
+        return 0;
+
+    switch (m_settings_step)
+    {
+        case SETTINGS_NONE:
+            if (m_flash_crc != m_image_crc)
+            {
+                fw_stage_fail("image crc");
+                return -1;
+            }
+            if (fw_stage_settings_build() < 0)
+            {
+                fw_stage_fail("bootloader settings not valid");
+                return -1;
+            }
+            ret = fw_stage_flash(true, BOOTLOADER_SETTINGS_ADDRESS, NULL, 0);
+            if (ret == 0)
+                m_settings_step = SETTINGS_ERASING;
+            break;
+
+        case SETTINGS_ERASING:
+            ret = fw_stage_flash(false, BOOTLOADER_SETTINGS_ADDRESS, m_settings.words, sizeof(m_settings.words));
+            if (ret == 0)
+                m_settings_step = SETTINGS_WRITING;
+            break;
+
+        default:
+            m_state = FW_STAGE_STAGED;
+            NRF_LOG_INFO("Firmware update staged, %u bytes", m_image_size);
+            return 0;
+    }
+    if (ret == -1)
+        fw_stage_fail("settings write refused");
+
+    return (ret == -1) ? -1 : 0;
+}
+
+/*
+ * One step of the flash work, with the writes held off
+ */
+static int8_t fw_stage_step(void)
+{
+    fw_stage_chunk_t *p_chunk = &m_chunks[m_write];
+    uint32_t end;
+    int8_t ret;
+
+    if (m_flash_busy)
+        return 0;
+    if (m_state != FW_STAGE_RECEIVING && m_state != FW_STAGE_COMMITTING)
+    {
+        //an abort left the chunks to the flash until its last operation was done
+        m_chunks[0].state = CHUNK_FREE;
+        m_chunks[1].state = CHUNK_FREE;
+        return 0;
+    }
+    if (m_flash_failed)
+    {
+        fw_stage_fail("flash operation");
+        return -1;
+    }
+
+    if (p_chunk->state == CHUNK_WRITTEN)
+    {
+        m_flash_crc = crc32_compute((uint8_t const *) (m_bank1 + p_chunk->offset), p_chunk->length, &m_flash_crc);
+        m_verified += p_chunk->length;
+        p_chunk->length = 0;
+        p_chunk->state = CHUNK_FREE;
+        m_write ^= 1;
+        p_chunk = &m_chunks[m_write];
+    }
+    if (p_chunk->state == CHUNK_FULL)
+    {
+        end = p_chunk->offset + p_chunk->length;
+        if (end > m_erased)
+        {
+            ret = fw_stage_flash(true, m_bank1 + m_erased, NULL, 0);
+            if (ret == 0)
+                m_erased += CODE_PAGE_SIZE;
+        }
+        else
+        {
+            //a short last chunk is padded with erased flash to a whole word
+            memset(&p_chunk->data[p_chunk->length], 0xFF, ALIGN_NUM(sizeof(uint32_t), p_chunk->length) - p_chunk->length);
+            p_chunk->state = CHUNK_WRITING;
+            ret = fw_stage_flash(false, m_bank1 + p_chunk->offset, p_chunk->data,
+                                 ALIGN_NUM(sizeof(uint32_t), p_chunk->length));
+            if (ret < 0)
+                p_chunk->state = CHUNK_FULL;
+        }
+        if (ret == -1)
+            fw_stage_fail("flash operation refused");
+
+        return (ret == -1) ? -1 : 0;
+    }
+    if (m_state == FW_STAGE_COMMITTING)
+        return fw_stage_settings_process();
+
+    return 0;
+}
+
+/*
+ * Finds bank 1 from the bootloader settings and takes the flash from it up
+ * to the bootloader for the stage, thread context after the SoftDevice is
+ * enabled. Without a bootloader, or without an app in its bank 0, the stage
+ * stays off
+ * @return 0 if success or off, -1 if fstorage failed
+ */
+int8_t fw_stage_init(void)
+{
+    nrf_dfu_settings_t const *p_settings = (nrf_dfu_settings_t const *) BOOTLOADER_SETTINGS_ADDRESS;
+    uint32_t bank0 = SD_SIZE_GET(MBR_SIZE);
+    uint32_t end;
+
+    if (BOOTLOADER_ADDRESS == 0xFFFFFFFF || p_settings->bank_0.image_size == 0 ||
+        p_settings->bank_0.image_size == 0xFFFFFFFF)
+    {
+        NRF_LOG_INFO("No bootloader, firmware update off");
+        return 0;
+    }
+
+    //as nrf_dfu_bank1_start_addr() and DFU_REGION_END of the bootloader
+    m_bank1 = ALIGN_NUM(CODE_PAGE_SIZE, bank0 + p_settings->bank_0.image_size);
+    end = DFU_REGION_END(BOOTLOADER_ADDRESS);
+    m_room = (end > m_bank1) ? end - m_bank1 : 0;
+    m_fs.start_addr = m_bank1;
+    m_fs.end_addr = BOOTLOADER_SETTINGS_ADDRESS + CODE_PAGE_SIZE;
+    if (nrf_fstorage_init(&m_fs, &nrf_fstorage_sd, NULL) != NRF_SUCCESS)
+        return -1;
+
+    m_state = FW_STAGE_IDLE;
+    NRF_LOG_INFO("Firmware update bank 1 at 0x%x, %u bytes", m_bank1, m_room);
+
+    return 0;
+}
+
+/*
+ * Starts staging an update over any staged before, any context
+ * @param init_size - bytes of the init packet
+ * @param image_size - bytes of the image
+ * @param image_crc - crc32 of the image
+ * @return 0 if success, -2 if off or the image does not fit, -3 if the flash
+ * is still busy with the last stage
+ */
+int8_t fw_stage_begin(uint16_t init_size, uint32_t image_size, uint32_t image_crc)
+{
+    int8_t ret = 0;
+
+    if (init_size == 0 || init_size > FW_STAGE_INIT_MAX_SIZE || image_size == 0 || image_size > m_room)
+        return -2;
+
+    CRITICAL_REGION_ENTER();
+    if (m_state == FW_STAGE_OFF)
+    {
+        ret = -2;
+    }
+    else if (m_flash_busy || m_state == FW_STAGE_COMMITTING)
+    {
+        ret = -3;
+    }
+    else
+    {
+        m_init_size = init_size;
+        m_init_received = 0;
+        m_image_size = image_size;
+        m_image_crc = image_crc;
+        m_received = 0;
+        memset(m_chunks, 0, sizeof(m_chunks));
+        m_fill = 0;
+        m_write = 0;
+        m_erased = 0;
+        m_verified = 0;
+        m_flash_crc = 0;
+        m_flash_failed = false;
+        m_settings_step = SETTINGS_NONE;
+        m_swap_pending = false;
+        m_state = FW_STAGE_RECEIVING;
+    }
+    CRITICAL_REGION_EXIT();
+
+    return ret;
+}
+
+/*
+ * Takes the next bytes of the init packet, any context
+ * @param offset - of the bytes in the packet, where the last write ended
+ * @return 0 if success, -2 if not receiving or out of order
+ */
+int8_t fw_stage_init_write(uint16_t offset, uint8_t const *data, uint16_t length)
+{
+    if (m_state != FW_STAGE_RECEIVING || offset != m_init_received || length > m_init_size - offset)
+        return -2;
+
+    memcpy(&m_init[offset], data, length);
+    m_init_received += length;
+
+    return 0;
+}
+
+/*
+ * Takes the next bytes of the image, any context. The chunk filled is
+ * handed to the thread once full or at the end of the image
+ * @param offset - of the bytes in the image, where the last write ended
+ * @param length - up to FW_STAGE_CHUNK_SIZE
+ * @return 0 if success, -2 if not receiving or out of order, -3 if both
+ * chunks wait for the flash, send it again
+ */
+int8_t fw_stage_image_write(uint32_t offset, uint8_t const *data, uint16_t length)
+{
+    fw_stage_chunk_t *p_chunk = &m_chunks[m_fill];
+    uint16_t room = FW_STAGE_CHUNK_SIZE - p_chunk->length;
+    uint16_t part;
+    bool seal;
+
+    if (m_state != FW_STAGE_RECEIVING || offset != m_received || length > FW_STAGE_CHUNK_SIZE ||
+        length > m_image_size - offset)
+        return -2;
+
+    //the chunk is handed over full or with the end of the image, the next writes need the other one
+    seal = length >= room || offset + length == m_image_size;
+    if ((seal && m_chunks[m_fill ^ 1].state != CHUNK_FREE) || p_chunk->state != CHUNK_FREE)
+        return -3;
+
+    part = MIN(length, room);
+    if (p_chunk->length == 0)
+        p_chunk->offset = offset;
+    memcpy(&p_chunk->data[p_chunk->length], data, part);
+    p_chunk->length += part;
+    if (seal)
+    {
+        p_chunk->state = CHUNK_FULL;
+        m_fill ^= 1;
+        p_chunk = &m_chunks[m_fill];
+        p_chunk->offset = offset + part;
+        p_chunk->length = length - part;
+        memcpy(p_chunk->data, &data[part], length - part);
+        if (p_chunk->length > 0 && offset + length == m_image_size)
+            p_chunk->state = CHUNK_FULL;
+    }
+    m_received += length;
+
+    return 0;
+}
+
+/*
+ * Has the thread write the settings once the last chunk is read back, any
+ * context. STAGED follows, or FAILED if the image crc is off
+ * @return 0 if success, -2 if the init packet or the image is not all in
+ */
+int8_t fw_stage_commit(void)
+{
+    int8_t ret = -2;
+
+    CRITICAL_REGION_ENTER();
+    if (m_state == FW_STAGE_RECEIVING && m_init_received == m_init_size && m_received == m_image_size)
+    {
+        m_state = FW_STAGE_COMMITTING;
+        ret = 0;
+    }
+    CRITICAL_REGION_EXIT();
+
+    return ret;
+}
+
+/*
+ * Drops the stage, any context. A commit runs to its end so the settings
+ * page is not left erased, a staged one is dropped from ram only, the
+ * settings keep it for a DFU client that connects to the bootloader anyway
+ */
+void fw_stage_abort(void)
+{
+    CRITICAL_REGION_ENTER();
+    if (m_state != FW_STAGE_OFF && m_state != FW_STAGE_COMMITTING)
+        m_state = FW_STAGE_IDLE;
+    m_swap_pending = false;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Erases, writes and reads back the chunks and writes the settings, one
+ * flash operation at a time, thread context
+ * @return 1 while there is flash work left, 0 if none, -1 if the stage failed
+ */
+int8_t fw_stage_process(void)
+{
+    int8_t ret;
+
+    if (m_state != FW_STAGE_COMMITTING && m_chunks[0].state == CHUNK_FREE && m_chunks[1].state == CHUNK_FREE)
+        return 0;
+
+    //a begin or an abort from the BLE events does not come between the state and its flash operation
+    CRITICAL_REGION_ENTER();
+    ret = fw_stage_step();
+    CRITICAL_REGION_EXIT();
+    if (ret < 0)
+        return ret;
+
+    return (m_state == FW_STAGE_COMMITTING || m_chunks[0].state != CHUNK_FREE || m_chunks[1].state != CHUNK_FREE) ? 1 : 0;
+}
+
+/*
+ * Asks for the swap of a staged image, any context. The app calls
+ * fw_stage_swap() once it is idle
+ * @return 0 if success, -2 if nothing is staged
+ */
+int8_t fw_stage_swap_request(void)
+{
+    if (m_state != FW_STAGE_STAGED)
+        return -2;
+
+    m_swap_pending = true;
+
+    return 0;
+}
+
+bool fw_stage_swap_pending(void)
+{
+    return m_swap_pending;
+}
+
+/*
+ * Resets into the bootloader to activate the staged image, thread context
+ * with the SoftDevice enabled. Does not return
+ */
+void fw_stage_swap(void)
+{
+    NRF_LOG_WARNING("Resetting into the bootloader for the firmware update");
+    NRF_LOG_FINAL_FLUSH();
+    (void) sd_power_gpregret_clr(0, 0xFFFFFFFF);
+    (void) sd_power_gpregret_set(0, BOOTLOADER_DFU_START);
+    NVIC_SystemReset();
+}
+
+void fw_stage_status(fw_stage_status_t *p_status)
+{
+    CRITICAL_REGION_ENTER();
+    p_status->state = m_state;
+    p_status->swap_pending = m_swap_pending;
+    p_status->init_size = m_init_received;
+    p_status->image_size = m_image_size;
+    p_status->offset = m_received;
+    p_status->room = m_room;
+    CRITICAL_REGION_EXIT();
+}
@@ -0,0 +1,83 @@
+#ifndef FW_STAGE_H
+#define FW_STAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Background firmware update, staged by the running app into bank 1 of the
+ * SDK's secure bootloader (nrf_bootloader, dual bank, s132) while it goes on
+ * capturing. A central hands over the init packet (the signed init command
+ * of an nrfutil package, up to FW_STAGE_INIT_MAX_SIZE bytes) and the image in
+ * order, at any pace; each write is copied into one of two FW_STAGE_CHUNK_SIZE
+ * ram buffers and the thread erases the pages of bank 1 ahead of them and
+ * writes them through the SoftDevice (nrf_fstorage_sd), so the flash work
+ * fits between the radio events and the capture interrupts never wait on it.
+ * A write that finds both buffers busy is refused with -3 and sent again. Each
+ * written chunk is read back into a crc32 of the image. The commit checks it
+ * against the crc of the begin and writes the bootloader settings page as a
+ * transfer that was cut short with the whole image in: the init command is
+ * stored and the data offset and crc at the end of the image. The swap then
+ * resets into the bootloader (GPREGRET BOOTLOADER_DFU_START): a DFU client
+ * that connects with the same package finds both objects there and only
+ * executes them, the bootloader checks the signature of the init command and
+ * the hash of bank 1 and copies it over the app, seconds instead of the whole
+ * transfer. Nothing is trusted from the app, a staged image that does not
+ * match its signature is never activated. The event store, its ack watermark
+ * and the log pointers are in the external flash and the device config in
+ * FDS above bank 1, the update leaves them where they are.
+ * Bank 1 starts on the page after the app (bank_0 of the settings) and ends
+ * below the FDS pages under the bootloader, an image larger than the room is
+ * refused at the begin. Without a bootloader (UICR NRFFW[0] erased) the stage
+ * is off. The bootloader has to be built with
+ * NRF_DFU_SETTINGS_ALLOW_UPDATE_FROM_APP 1 so it keeps the progress the app
+ * wrote instead of restoring its backup. The stage is held in ram, a reset
+ * before the commit starts it over; after a disconnect the central reads the
+ * status and sends the image from its offset.
+ * fw_stage_process() runs in thread context, the writes and the begin, commit
+ * and abort can come from the BLE events */
+#define FW_STAGE_CHUNK_SIZE         256  //bytes written to the flash at a time, divides the page
+#define FW_STAGE_INIT_MAX_SIZE      256  //INIT_COMMAND_MAX_SIZE of the bootloader
+#define FW_STAGE_SETTINGS_SIZE      512  //bytes of the settings page rewritten, the struct and the BLE peer data
+
+typedef enum {
+    FW_STAGE_OFF = 0,       //no bootloader
+    FW_STAGE_IDLE,
+    FW_STAGE_RECEIVING,     //begun, taking the init packet and the image
+    FW_STAGE_COMMITTING,    //all in, the last chunks and the settings are being written
+    FW_STAGE_STAGED,        //ready to swap
+    FW_STAGE_FAILED         //a flash write or the crc failed, begin again
+} fw_stage_state_t;
+
+/* Read by the central to pick up where it left, 16 bytes */
+typedef struct {
+    uint8_t state;          //fw_stage_state_t
+    uint8_t swap_pending;
+    uint16_t init_size;     //init packet bytes received
+    uint32_t image_size;
+    uint32_t offset;        //image bytes received, the next write starts here
+    uint32_t room;          //largest image bank 1 takes, 0 when off
+} fw_stage_status_t;
+
+int8_t fw_stage_init(void);
+
+int8_t fw_stage_begin(uint16_t init_size, uint32_t image_size, uint32_t image_crc);
+
+int8_t fw_stage_init_write(uint16_t offset, uint8_t const *data, uint16_t length);
+
+int8_t fw_stage_image_write(uint32_t offset, uint8_t const *data, uint16_t length);
+
+int8_t fw_stage_commit(void);
+
+void fw_stage_abort(void);
+
+int8_t fw_stage_process(void);
+
+int8_t fw_stage_swap_request(void);
+
+bool fw_stage_swap_pending(void);
+
+void fw_stage_swap(void);
+
+void fw_stage_status(fw_stage_status_t *p_status);
+
+#endif //FW_STAGE_H
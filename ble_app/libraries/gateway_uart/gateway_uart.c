@@ -0,0 +1,129 @@
+//-------------------------------------------
+// Title: gateway_uart.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Packets of helmet offload streams from the gateway to its
+// host over the uart. The packets are written to a fifo from the BLE
+// events and the fifo is sent a chunk at a time by EasyDMA, so receiving
+// from several links never waits on the baud rate.
+//-------------------------------------------
+#include <string.h>
+#include "gateway_uart.h"
+#include "nrf_drv_uart.h"
+#include "app_fifo.h"
+#include "app_util.h"
+#include "crc32.h"
+
+STATIC_ASSERT(IS_POWER_OF_TWO(GATEWAY_UART_FIFO_SIZE));
+
+static nrf_drv_uart_t m_uart = NRF_DRV_UART_INSTANCE(0);
+static app_fifo_t m_fifo;
+static uint8_t m_fifo_buf[GATEWAY_UART_FIFO_SIZE];
+static uint8_t m_chunk[GATEWAY_UART_CHUNK_SIZE]; //in ram for EasyDMA
+static volatile bool m_tx_busy = false;
+
+static void gateway_uart_handler(nrf_drv_uart_event_t * p_event, void * p_context)
+{
+    if (p_event->type == NRF_DRV_UART_EVT_TX_DONE || p_event->type == NRF_DRV_UART_EVT_ERROR)
+    {
+        m_tx_busy = false;
+    }
+}
+
+/*
+ * Initializes the UARTE for the gateway packets, tx only
+ * @return 0 if success otherwise -1
+ */
+int8_t gateway_uart_init(void)
+{
+    nrf_drv_uart_config_t config = NRF_DRV_UART_DEFAULT_CONFIG;
+
+    if (app_fifo_init(&m_fifo, m_fifo_buf, sizeof(m_fifo_buf)) != NRF_SUCCESS)
+        return -1;
+
+    config.pseltxd = GATEWAY_UART_TX_PIN;
+    config.pselrxd = NRF_UART_PSEL_DISCONNECTED;
+    config.baudrate = GATEWAY_UART_BAUDRATE;
+    config.hwfc = NRF_UART_HWFC_DISABLED;
+    config.use_easy_dma = true;
+    if (nrf_drv_uart_init(&m_uart, &config, gateway_uart_handler) != NRF_SUCCESS)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * @return the bytes free in the fifo, GATEWAY_UART_PACKET_SIZE() of a payload fit
+ */
+uint32_t gateway_uart_space(void)
+{
+    uint32_t space = 0;
+
+    (void) app_fifo_write(&m_fifo, NULL, &space);
+    return space;
+}
+
+/*
+ * Queues one packet, whole or not at all. Call from one context only, the
+ * BLE events, the fifo takes a single writer
+ * @return 0 if success, -2 if the fifo cannot take it
+ */
+int8_t gateway_uart_send(uint8_t const *addr, uint8_t const *data, uint16_t length)
+{
+    uint8_t header[4 + GATEWAY_UART_ADDR_SIZE + 2];
+    uint32_t sync = GATEWAY_UART_SYNC;
+    uint32_t size;
+    uint32_t crc;
+
+    if (gateway_uart_space() < GATEWAY_UART_PACKET_SIZE(length))
+        return -2;
+
+    memcpy(header, &sync, sizeof(sync));
+    memcpy(&header[4], addr, GATEWAY_UART_ADDR_SIZE);
+    memcpy(&header[4 + GATEWAY_UART_ADDR_SIZE], &length, sizeof(length));
+    crc = crc32_compute(&header[4], sizeof(header) - sizeof(sync), NULL);
+    crc = crc32_compute(data, length, &crc);
+
+    size = sizeof(header);
+    (void) app_fifo_write(&m_fifo, header, &size);
+    size = length;
+    (void) app_fifo_write(&m_fifo, data, &size);
+    size = sizeof(crc);
+    (void) app_fifo_write(&m_fifo, (uint8_t const *) &crc, &size);
+
+    return 0;
+}
+
+/*
+ * Starts sending the next chunk of the fifo if the uart is idle, call from
+ * the main loop, the end of a transfer wakes it
+ * @return 0 if success otherwise -1
+ */
+int8_t gateway_uart_process(void)
+{
+    uint32_t length = sizeof(m_chunk);
+
+    if (m_tx_busy)
+        return 0;
+    if (app_fifo_read(&m_fifo, m_chunk, &length) != NRF_SUCCESS || length == 0)
+        return 0;
+
+    m_tx_busy = true;
+    if (nrf_drv_uart_tx(&m_uart, m_chunk, (uint8_t) length) != NRF_SUCCESS)
+    {
+        m_tx_busy = false;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * @return true once every queued packet is sent
+ */
+bool gateway_uart_idle(void)
+{
+    uint32_t length = 0;
+
+    (void) app_fifo_read(&m_fifo, NULL, &length);
+    return !m_tx_busy && length == 0;
+}
@@ -0,0 +1,47 @@
+#ifndef GATEWAY_UART_H
+#define GATEWAY_UART_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Uart link of the sideline gateway (integration/imu_gateway) to its host.
+ * Every piece of offload stream received from a helmet goes out as one
+ * packet, all fields little endian
+ *   sync    4 bytes  GATEWAY_UART_SYNC
+ *   addr    6 bytes  ble_gap_addr_t.addr of the helmet
+ *   length  2 bytes  payload bytes
+ *   payload          the helmet's offload stream as received, the frames of
+ *                    serial_offload.h cut anywhere
+ *   crc     4 bytes  crc32 of addr, length and payload
+ * so tools/gateway_split can write the stream of each helmet to a file of its
+ * own for tools/offload_decode. The packets are queued whole in a fifo from
+ * the BLE events and sent by EasyDMA, gateway_uart_process() starts the next
+ * chunk from thread context. gateway_uart_space() is the room left, a packet
+ * takes GATEWAY_UART_PACKET_SIZE of its payload, so the caller can hold a
+ * link back rather than drop its data.
+ * The nRF52832 has no usb device: on the nRF52 DK the interface mcu bridges
+ * TX_PIN_NUMBER to a usb serial port, at the serial offload rate, which is
+ * also what bounds the team wide collection */
+#define GATEWAY_UART_SYNC               0x57474D48 //"HMGW"
+#define GATEWAY_UART_ADDR_SIZE          6   //BLE_GAP_ADDR_LEN
+#define GATEWAY_UART_OVERHEAD           16  //sync, addr, length and crc of one packet
+#define GATEWAY_UART_PACKET_SIZE(_len)  ((_len) + GATEWAY_UART_OVERHEAD)
+
+#ifndef GATEWAY_UART_TX_PIN
+#define GATEWAY_UART_TX_PIN             6  //TX_PIN_NUMBER of the nRF52 DK
+#endif
+#define GATEWAY_UART_BAUDRATE           NRF_UART_BAUDRATE_1000000
+#define GATEWAY_UART_FIFO_SIZE          8192 //bytes, a power of two
+#define GATEWAY_UART_CHUNK_SIZE         240  //bytes per EasyDMA transfer, at most 255 on the nRF52832
+
+int8_t gateway_uart_init(void);
+
+uint32_t gateway_uart_space(void);
+
+int8_t gateway_uart_send(uint8_t const *addr, uint8_t const *data, uint16_t length);
+
+int8_t gateway_uart_process(void);
+
+bool gateway_uart_idle(void);
+
+#endif //GATEWAY_UART_H
@@ -0,0 +1,115 @@
+//-------------------------------------------
+// Title: hf_clock.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: The HFXO crystal requested per user through nrf_drv_clock,
+// from an app timer so the high priority interrupts can ask for it too, and
+// held HF_CLOCK_HOLD_MS past the last release.
+//-------------------------------------------
+#include "hf_clock.h"
+#include "nrf_drv_clock.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "energy_profiler.h"
+
+APP_TIMER_DEF(m_timer_id);
+static volatile uint32_t m_users = 0;       //a bit per hf_clock_user_t
+static bool m_requested = false;            //of nrf_drv_clock, changed by the timer handler only
+static uint32_t m_idle_ticks;               //app timer count at the last release
+static uint32_t m_starts = 0;
+
+// Requests the crystal for a user or releases it once the hold is over,
+// at the app timer's priority
+static void hf_clock_timeout_handler(void *p_context)
+{
+    uint32_t idle;
+
+    UNUSED_PARAMETER(p_context);
+    CRITICAL_REGION_ENTER();
+    if (m_users != 0 && !m_requested)
+    {
+        nrf_drv_clock_hfclk_request(NULL);
+        m_requested = true;
+        m_starts++;
+        ENERGY_ENTER(ENERGY_STATE_HFXO);
+    }
+    else if (m_users == 0 && m_requested)
+    {
+        //a release came during the hold, it runs from that one
+        idle = app_timer_cnt_diff_compute(app_timer_cnt_get(), m_idle_ticks);
+        if (idle + APP_TIMER_MIN_TIMEOUT_TICKS >= APP_TIMER_TICKS(HF_CLOCK_HOLD_MS))
+        {
+            nrf_drv_clock_hfclk_release();
+            m_requested = false;
+            ENERGY_EXIT(ENERGY_STATE_HFXO);
+        }
+        else
+        {
+            (void) app_timer_start(m_timer_id, APP_TIMER_TICKS(HF_CLOCK_HOLD_MS) - idle, NULL);
+        }
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Sets up the clock driver, after the SoftDevice is enabled and app_timer_init
+ * @return 0 if success otherwise -1
+ */
+int8_t hf_clock_init(void)
+{
+    ret_code_t err_code = nrf_drv_clock_init();
+
+    if (err_code != NRF_SUCCESS && err_code != NRF_ERROR_MODULE_ALREADY_INITIALIZED)
+        return -1;
+    if (app_timer_create(&m_timer_id, APP_TIMER_MODE_SINGLE_SHOT, hf_clock_timeout_handler) != NRF_SUCCESS)
+        return -1;
+    return 0;
+}
+
+/*
+ * Asks for the crystal, it runs HF_CLOCK_STARTUP_US or so later. Any context,
+ * a user already counted is counted once
+ */
+void hf_clock_request(hf_clock_user_t user)
+{
+    CRITICAL_REGION_ENTER();
+    m_users |= 1UL << user;
+    //a request that was never let go goes on, the hold ends on its own
+    if (!m_requested)
+        (void) app_timer_start(m_timer_id, APP_TIMER_MIN_TIMEOUT_TICKS, NULL);
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Lets the crystal go for a user, it stops HF_CLOCK_HOLD_MS after the last
+ * one unless requested again. Any context, a user without a request does nothing
+ */
+void hf_clock_release(hf_clock_user_t user)
+{
+    CRITICAL_REGION_ENTER();
+    if (m_users & (1UL << user))
+    {
+        m_users &= ~(1UL << user);
+        if (m_users == 0 && m_requested)
+        {
+            m_idle_ticks = app_timer_cnt_get();
+            (void) app_timer_start(m_timer_id, APP_TIMER_TICKS(HF_CLOCK_HOLD_MS), NULL);
+        }
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * @return true if the crystal runs, for a user or for the SoftDevice's radio
+ */
+bool hf_clock_running(void)
+{
+    return nrf_drv_clock_hfclk_is_running();
+}
+
+/*
+ * @return the times the crystal was started for a user since the reset
+ */
+uint32_t hf_clock_starts(void)
+{
+    return m_starts;
+}
@@ -0,0 +1,40 @@
+#ifndef HF_CLOCK_H
+#define HF_CLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* The 64 MHz crystal oscillator (HFXO) on request of the parts that need its
+ * accuracy, the HFINT RC oscillator the rest of the time. The cpu, the SPIM
+ * and TWIM transfers and their EasyDMA run from either, the SoftDevice starts
+ * the crystal on its own ahead of every radio event. What is left is the
+ * timing the app does on the HFCLK: the timebase TIMER that latches the
+ * sensor edges, a few percent off on HFINT, and the radio bursts of an
+ * offload, where holding the crystal spares the SoftDevice a start per
+ * connection event. Each user requests and releases it from any context,
+ * the SoftDevice calls go through an app timer at the app's low priority
+ * (nrf_drv_clock_hfclk_request() is an SVC, not allowed from the high
+ * priority interrupts). The crystal takes HF_CLOCK_STARTUP_US to run, a
+ * user that needs it at a known time requests it that much earlier, and a
+ * start costs about the charge of HF_CLOCK_HOLD_MS of running, so the last
+ * release only stops it once no user came back for that long */
+#define HF_CLOCK_STARTUP_US         400     //tSTART_HFXO typical on the 32 MHz crystal
+#define HF_CLOCK_HOLD_MS            2
+
+typedef enum {
+    HF_CLOCK_USER_CAPTURE = 0,      /* a capture records, its edge latches time the samples */
+    HF_CLOCK_USER_RADIO,            /* the offload connection interval */
+    HF_CLOCK_USER_COUNT
+} hf_clock_user_t;
+
+int8_t hf_clock_init(void);
+
+void hf_clock_request(hf_clock_user_t user);
+
+void hf_clock_release(hf_clock_user_t user);
+
+bool hf_clock_running(void);
+
+uint32_t hf_clock_starts(void);
+
+#endif //HF_CLOCK_H
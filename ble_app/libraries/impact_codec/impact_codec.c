@@ -0,0 +1,320 @@
+//-------------------------------------------
+// Title: impact_codec.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Delta, zig-zag and nibble varint coding of impact
+// records. The encoder runs between the RAM sample set and the event
+// store, the decoder on the offload path rebuilds the exact records.
+//-------------------------------------------
+#include "impact_codec.h"
+#include <string.h>
+
+#define NIBBLE_DATA_BITS    3
+#define NIBBLE_DATA_MSK     0x7
+#define NIBBLE_MORE_MSK     0x8
+#define BYTE_DATA_BITS      7
+#define BYTE_DATA_MSK       0x7F
+#define BYTE_MORE_MSK       0x80
+
+typedef struct {
+    uint8_t *buf;
+    uint8_t nibbles;
+} nibble_writer_t;
+
+typedef struct {
+    uint8_t const *buf;
+    uint32_t len;       /* bytes available */
+    uint32_t nibbles;
+} nibble_reader_t;
+
+//the channels in coding order
+static void record_to_channels(impact_record_t const *record, int16_t *channels, uint8_t *delta)
+{
+    adxl372_accel_data_t accel;
+    icm20649_data_t icm;
+
+    impact_record_unpack(record, &accel, &icm, delta);
+    channels[0] = accel.x;
+    channels[1] = accel.y;
+    channels[2] = accel.z;
+    channels[3] = icm.accel_x;
+    channels[4] = icm.accel_y;
+    channels[5] = icm.accel_z;
+    channels[6] = icm.gyro_x;
+    channels[7] = icm.gyro_y;
+    channels[8] = icm.gyro_z;
+}
+
+static void channels_to_record(int16_t const *channels, uint8_t delta, impact_record_t *record)
+{
+    adxl372_accel_data_t accel = {channels[0], channels[1], channels[2]};
+    icm20649_data_t icm = {channels[3], channels[4], channels[5],
+                           channels[6], channels[7], channels[8]};
+
+    impact_record_pack(record, &accel, &icm, delta);
+}
+
+static void put_nibble(nibble_writer_t *writer, uint8_t nibble)
+{
+    uint8_t *byte = &writer->buf[writer->nibbles / 2];
+
+    if (writer->nibbles & 1)
+        *byte |= nibble << 4;
+    else
+        *byte = nibble;
+    writer->nibbles++;
+}
+
+static void put_varint(nibble_writer_t *writer, uint32_t val)
+{
+    while (val > NIBBLE_DATA_MSK)
+    {
+        put_nibble(writer, (val & NIBBLE_DATA_MSK) | NIBBLE_MORE_MSK);
+        val >>= NIBBLE_DATA_BITS;
+    }
+    put_nibble(writer, val);
+}
+
+/*
+ * @return 0 if success, -3 if the input ended or -2 if the varint is too long
+ */
+static int8_t get_varint(nibble_reader_t *reader, uint32_t *p_val)
+{
+    uint32_t val = 0;
+    uint8_t shift = 0;
+    uint8_t nibble;
+
+    do {
+        if (reader->nibbles / 2 >= reader->len)
+            return -3;
+        if (shift > 18)
+            return -2;
+        nibble = reader->buf[reader->nibbles / 2];
+        nibble = (reader->nibbles & 1) ? nibble >> 4 : nibble & 0xF;
+        reader->nibbles++;
+
+        val |= (uint32_t) (nibble & NIBBLE_DATA_MSK) << shift;
+        shift += NIBBLE_DATA_BITS;
+    } while (nibble & NIBBLE_MORE_MSK);
+
+    *p_val = val;
+    return 0;
+}
+
+static uint8_t put_byte_varint(uint8_t *out, uint32_t val)
+{
+    uint8_t n = 0;
+
+    while (val > BYTE_DATA_MSK)
+    {
+        out[n++] = (val & BYTE_DATA_MSK) | BYTE_MORE_MSK;
+        val >>= BYTE_DATA_BITS;
+    }
+    out[n++] = val;
+
+    return n;
+}
+
+/*
+ * @return 0 if success, -3 if the input ended or -2 if the varint is too long
+ */
+static int8_t get_byte_varint(uint8_t const *in, uint32_t in_len, uint32_t *p_pos, uint32_t *p_val)
+{
+    uint32_t val = 0;
+    uint8_t shift = 0;
+    uint8_t byte;
+
+    do {
+        if (*p_pos >= in_len)
+            return -3;
+        if (shift > 14)
+            return -2;
+        byte = in[(*p_pos)++];
+        val |= (uint32_t) (byte & BYTE_DATA_MSK) << shift;
+        shift += BYTE_DATA_BITS;
+    } while (byte & BYTE_MORE_MSK);
+
+    *p_val = val;
+    return 0;
+}
+
+static uint32_t zigzag(int32_t val)
+{
+    return ((uint32_t) val << 1) ^ (uint32_t) (val >> 31);
+}
+
+static int32_t unzigzag(uint32_t val)
+{
+    return (int32_t) (val >> 1) ^ -(int32_t) (val & 1);
+}
+
+/*
+ * Starts a stream, the first record is coded against all zeros
+ */
+void impact_codec_init(impact_codec_t *codec)
+{
+    memset(codec, 0, sizeof(impact_codec_t));
+}
+
+/*
+ * Codes one record against the previous one
+ * @param out - at least IMPACT_CODEC_MAX_RECORD_SIZE bytes
+ * @return the number of bytes written to out
+ */
+uint8_t impact_codec_encode(impact_codec_t *codec, impact_record_t const *record, uint8_t *out)
+{
+    nibble_writer_t writer = {out, 0};
+    int16_t channels[IMPACT_CODEC_CHANNELS];
+    uint8_t delta;
+
+    record_to_channels(record, channels, &delta);
+    for (uint8_t i = 0; i < IMPACT_CODEC_CHANNELS; i++)
+    {
+        put_varint(&writer, zigzag((int32_t) channels[i] - codec->prev[i]));
+        codec->prev[i] = channels[i];
+    }
+    put_varint(&writer, delta);
+
+    if (writer.nibbles & 1)
+        put_nibble(&writer, 0); //records are byte aligned
+
+    return writer.nibbles / 2;
+}
+
+/*
+ * Rebuilds the next record of the stream
+ * @param in_len  - bytes available at in, a record is never split by the encoder
+ * @param p_used  - bytes of in taken by the record
+ * @return 0 if success, -3 if in_len ends inside the record (read more and retry),
+ *         -2 if the data is not a valid stream
+ */
+int8_t impact_codec_decode(impact_codec_t *codec, uint8_t const *in, uint32_t in_len,
+                           impact_record_t *record, uint8_t *p_used)
+{
+    nibble_reader_t reader = {in, in_len, 0};
+    int16_t channels[IMPACT_CODEC_CHANNELS];
+    uint32_t val;
+    int8_t ret;
+
+    for (uint8_t i = 0; i < IMPACT_CODEC_CHANNELS; i++)
+    {
+        ret = get_varint(&reader, &val);
+        if (ret < 0)
+            return ret;
+        channels[i] = (int16_t) (codec->prev[i] + unzigzag(val));
+    }
+    ret = get_varint(&reader, &val);
+    if (ret < 0)
+        return ret;
+    if (val > IMPACT_RECORD_DELTA_MAX)
+        return -2;
+
+    //only commit the state once the whole record was read
+    memcpy(codec->prev, channels, sizeof(channels));
+    channels_to_record(channels, (uint8_t) val, record);
+    *p_used = (reader.nibbles + 1) / 2;
+
+    return 0;
+}
+
+/*
+ * Codes one record against the previous one as byte varints, the
+ * IMPACT_CODEC_BYTE candidate
+ * @param out - at least IMPACT_CODEC_MAX_RECORD_SIZE bytes
+ * @return the number of bytes written to out
+ */
+uint8_t impact_codec_byte_encode(impact_codec_t *codec, impact_record_t const *record, uint8_t *out)
+{
+    int16_t channels[IMPACT_CODEC_CHANNELS];
+    uint8_t delta;
+    uint8_t n = 0;
+
+    record_to_channels(record, channels, &delta);
+    for (uint8_t i = 0; i < IMPACT_CODEC_CHANNELS; i++)
+    {
+        n += put_byte_varint(&out[n], zigzag((int32_t) channels[i] - codec->prev[i]));
+        codec->prev[i] = channels[i];
+    }
+    out[n++] = delta;
+
+    return n;
+}
+
+/*
+ * Rebuilds the next record of a byte varint stream, as impact_codec_decode()
+ */
+int8_t impact_codec_byte_decode(impact_codec_t *codec, uint8_t const *in, uint32_t in_len,
+                                impact_record_t *record, uint8_t *p_used)
+{
+    int16_t channels[IMPACT_CODEC_CHANNELS];
+    uint32_t pos = 0;
+    uint32_t val;
+    int8_t ret;
+
+    for (uint8_t i = 0; i < IMPACT_CODEC_CHANNELS; i++)
+    {
+        ret = get_byte_varint(in, in_len, &pos, &val);
+        if (ret < 0)
+            return ret;
+        channels[i] = (int16_t) (codec->prev[i] + unzigzag(val));
+    }
+    if (pos >= in_len)
+        return -3;
+    if (in[pos] > IMPACT_RECORD_DELTA_MAX)
+        return -2;
+
+    memcpy(codec->prev, channels, sizeof(channels));
+    channels_to_record(channels, in[pos], record);
+    *p_used = pos + 1;
+
+    return 0;
+}
+
+/*
+ * @return the short name of a codec for the benchmark output
+ */
+char const *impact_codec_name(impact_codec_kind_t kind)
+{
+    static char const * const names[IMPACT_CODEC_KINDS] = {"packed", "nibble", "byte"};
+
+    return (kind < IMPACT_CODEC_KINDS) ? names[kind] : "unknown";
+}
+
+/*
+ * Event_store encoding id of the records of an event
+ * @param coded - the records go through impact_codec_encode, otherwise they are stored as packed
+ * @param range - IMPACT_RECORD_RANGE of the icm20649 counts
+ * @param fused - the icm20649 accel fields hold the accel_fusion channel
+ */
+uint16_t impact_codec_encoding(bool coded, uint8_t range, bool fused)
+{
+    range &= IMPACT_RECORD_RANGE_MAX;
+    if (range == IMPACT_RECORD_RANGE_DEFAULT && !fused)
+        return coded ? IMPACT_CODEC_ENCODING : IMPACT_CODEC_ENCODING_RAW;
+
+    return (coded ? IMPACT_CODEC_ENCODING_RANGED : IMPACT_CODEC_ENCODING_RAW_RANGED)
+           | (fused ? IMPACT_CODEC_ENCODING_FUSED : 0) | range;
+}
+
+/*
+ * Tells how the records of an event are stored from its encoding id
+ * @return 0 if success, -2 if the encoding is not one of impact records
+ */
+int8_t impact_codec_encoding_parse(uint16_t encoding, bool *p_coded, uint8_t *p_range, bool *p_fused)
+{
+    uint16_t base = encoding & ~(IMPACT_RECORD_RANGE_MAX | IMPACT_CODEC_ENCODING_FUSED);
+
+    if (encoding == IMPACT_CODEC_ENCODING || encoding == IMPACT_CODEC_ENCODING_RAW)
+    {
+        *p_coded = (encoding == IMPACT_CODEC_ENCODING);
+        *p_range = IMPACT_RECORD_RANGE_DEFAULT;
+        *p_fused = false;
+        return 0;
+    }
+    if (base != IMPACT_CODEC_ENCODING_RANGED && base != IMPACT_CODEC_ENCODING_RAW_RANGED)
+        return -2;
+
+    *p_coded = (base == IMPACT_CODEC_ENCODING_RANGED);
+    *p_range = encoding & IMPACT_RECORD_RANGE_MAX;
+    *p_fused = (encoding & IMPACT_CODEC_ENCODING_FUSED) != 0;
+    return 0;
+}
@@ -0,0 +1,120 @@
+#ifndef IMPACT_CODEC_H
+#define IMPACT_CODEC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "impact_record.h"
+
+/* Lossless compression of impact records for flash.
+ * Every record is coded byte aligned as ten nibble varints (3 data bits and a
+ * continuation bit each, low bits first, two nibbles per byte low nibble first):
+ * the adxl372 x, y, z and icm20649 accel and gyro channels as the zig-zag of
+ * their difference from the previous record, then the time delta as is.
+ * Consecutive 6400Hz samples differ by a few counts so most channels take one nibble.
+ * The event_store encoding id of an event also gives the icm20649 range of its
+ * records, the two ids of IMPACT_RECORD_RANGE_DEFAULT are the ones of the events
+ * stored before the range could change, the other ranges are tagged in the low nibble.
+ * Fused records always take a ranged id, whatever the range */
+#define IMPACT_CODEC_ENCODING       1  /* event_store encoding id, IMPACT_RECORD_RANGE_DEFAULT */
+#define IMPACT_CODEC_ENCODING_RAW   0xFFFF /* EVENT_STORE_ENCODING_RAW, uncoded records at IMPACT_RECORD_RANGE_DEFAULT */
+#define IMPACT_CODEC_ENCODING_RANGED 0x0100 /* | the range, coded records at another range */
+#define IMPACT_CODEC_ENCODING_RAW_RANGED 0x0200 /* | the range, uncoded records at another range */
+#define IMPACT_CODEC_ENCODING_FUSED 0x0010 /* with a ranged id, the icm20649 accel fields hold accel_fusion's channel */
+#define IMPACT_CODEC_CHANNELS       9  /* differenced channels, the time delta is the tenth field */
+#define IMPACT_CODEC_MAX_RECORD_SIZE 28 /* 9 x 6 nibbles for 17 bit zig-zags + 2 for the delta, 9 x 3 + 1 bytes as byte varints */
+
+/* The record codecs behind one call, impact_codec_encode_with() and
+ * impact_codec_decode_with() are a switch on the kind inlined at the caller,
+ * so the commit step passes the kind of its profile and the benchmarks loop
+ * over all of them with no function pointer, and a constant kind leaves the
+ * one direct call.
+ *   PACKED  the 17 byte impact_record_t as is, the adxl372 axes 12 bit packed,
+ *           the raw encoding of the event store
+ *   NIBBLE  delta, zig-zag and nibble varints, IMPACT_CODEC_ENCODING
+ *   BYTE    delta, zig-zag and byte varints (7 data bits and a continuation
+ *           bit), byte aligned so cheaper to code but larger for the small
+ *           deltas; a candidate, no encoding id stores it yet
+ * A new codec takes a kind, an encode and a decode with the same state and
+ * limits, a case in both switches and a name; it gets an encoding id in
+ * impact_codec_encoding() and a decoder in libimpact_log once it is stored.
+ * capture replay on the device and pipeline_sim -k on the host give the
+ * bytes and the time per sample of each one */
+typedef enum {
+    IMPACT_CODEC_PACKED = 0,
+    IMPACT_CODEC_NIBBLE,
+    IMPACT_CODEC_BYTE,
+    IMPACT_CODEC_KINDS
+} impact_codec_kind_t;
+
+/* Previous record of the stream, the same state type is used to encode and decode */
+typedef struct {
+    int16_t prev[IMPACT_CODEC_CHANNELS];
+} impact_codec_t;
+
+void impact_codec_init(impact_codec_t *codec);
+
+uint8_t impact_codec_encode(impact_codec_t *codec, impact_record_t const *record, uint8_t *out);
+
+int8_t impact_codec_decode(impact_codec_t *codec, uint8_t const *in, uint32_t in_len,
+                           impact_record_t *record, uint8_t *p_used);
+
+uint8_t impact_codec_byte_encode(impact_codec_t *codec, impact_record_t const *record, uint8_t *out);
+
+int8_t impact_codec_byte_decode(impact_codec_t *codec, uint8_t const *in, uint32_t in_len,
+                                impact_record_t *record, uint8_t *p_used);
+
+char const *impact_codec_name(impact_codec_kind_t kind);
+
+uint16_t impact_codec_encoding(bool coded, uint8_t range, bool fused);
+
+int8_t impact_codec_encoding_parse(uint16_t encoding, bool *p_coded, uint8_t *p_range, bool *p_fused);
+
+/*
+ * Codes one record with the codec of kind, see impact_codec_encode()
+ * @return the number of bytes written to out, 0 for an unknown kind
+ */
+static inline uint8_t impact_codec_encode_with(impact_codec_kind_t kind, impact_codec_t *codec,
+                                               impact_record_t const *record, uint8_t *out)
+{
+    switch (kind)
+    {
+        case IMPACT_CODEC_PACKED:
+            memcpy(out, record, IMPACT_RECORD_SIZE);
+            return IMPACT_RECORD_SIZE;
+        case IMPACT_CODEC_NIBBLE:
+            return impact_codec_encode(codec, record, out);
+        case IMPACT_CODEC_BYTE:
+            return impact_codec_byte_encode(codec, record, out);
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Rebuilds the next record with the codec of kind, see impact_codec_decode()
+ * @return 0 if success, -3 if in_len ends inside the record, -2 if the data
+ *         is not a valid stream or the kind is unknown
+ */
+static inline int8_t impact_codec_decode_with(impact_codec_kind_t kind, impact_codec_t *codec,
+                                              uint8_t const *in, uint32_t in_len,
+                                              impact_record_t *record, uint8_t *p_used)
+{
+    switch (kind)
+    {
+        case IMPACT_CODEC_PACKED:
+            if (in_len < IMPACT_RECORD_SIZE)
+                return -3;
+            memcpy(record, in, IMPACT_RECORD_SIZE);
+            *p_used = IMPACT_RECORD_SIZE;
+            return 0;
+        case IMPACT_CODEC_NIBBLE:
+            return impact_codec_decode(codec, in, in_len, record, p_used);
+        case IMPACT_CODEC_BYTE:
+            return impact_codec_byte_decode(codec, in, in_len, record, p_used);
+        default:
+            return -2;
+    }
+}
+
+#endif //IMPACT_CODEC_H
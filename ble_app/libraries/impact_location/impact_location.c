@@ -0,0 +1,60 @@
+//-------------------------------------------
+// Title: impact_location.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Classifies the impact location from the peak acceleration
+// vector when an event closes, so a dashboard can sort the hits without
+// the waveforms.
+//-------------------------------------------
+#include "impact_location.h"
+#include "int_sqrt.h"
+
+/*
+ * @param mount - sensor to head rotation
+ * @param peak - adxl372 x, y, z in counts at the peak resultant
+ * @param direction - unit vector from the head centre to the location in the head frame, x127
+ */
+impact_location_t impact_location_classify(impact_location_mount_t const mount, int16_t const peak[3],
+                                           int8_t direction[3])
+{
+    int32_t location[3];
+    uint32_t horizontal_sq;
+    uint32_t norm;
+
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        //the head is pushed away from the blow
+        location[i] = -((int32_t) mount[i][0]*peak[0] + (int32_t) mount[i][1]*peak[1]
+                        + (int32_t) mount[i][2]*peak[2]);
+    }
+    //counts are 12 bit, the squares of a signed permutation stay below 2^25
+    horizontal_sq = (uint32_t) (location[0]*location[0] + location[1]*location[1]);
+    norm = int_sqrt32(horizontal_sq + (uint32_t) (location[2]*location[2]));
+    if (norm == 0)
+    {
+        direction[0] = direction[1] = direction[2] = 0;
+        return IMPACT_LOCATION_UNKNOWN;
+    }
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        direction[i] = (int8_t) ((location[i]*127)/(int32_t) norm);
+    }
+
+    if (location[2] > 0 && (uint32_t) (location[2]*location[2]) > horizontal_sq)
+        return IMPACT_LOCATION_CROWN;
+    if ((location[0] < 0 ? -location[0] : location[0]) >= (location[1] < 0 ? -location[1] : location[1]))
+        return (location[0] >= 0) ? IMPACT_LOCATION_FRONT : IMPACT_LOCATION_BACK;
+    return (location[1] >= 0) ? IMPACT_LOCATION_LEFT : IMPACT_LOCATION_RIGHT;
+}
+
+char const *impact_location_name(impact_location_t location)
+{
+    switch (location)
+    {
+        case IMPACT_LOCATION_FRONT: return "FRONT";
+        case IMPACT_LOCATION_BACK:  return "BACK";
+        case IMPACT_LOCATION_LEFT:  return "LEFT";
+        case IMPACT_LOCATION_RIGHT: return "RIGHT";
+        case IMPACT_LOCATION_CROWN: return "CROWN";
+        default:                    return "UNKNOWN";
+    }
+}
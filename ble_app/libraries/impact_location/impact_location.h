@@ -0,0 +1,33 @@
+#ifndef IMPACT_LOCATION_H
+#define IMPACT_LOCATION_H
+
+#include <stdint.h>
+
+/* Where on the head an impact landed, from the linear acceleration at its peak.
+ * The sensor vector is rotated into the head frame (x to the front, y to the
+ * left, z up) with the mounting matrix of the device, the blow lands on the
+ * side the head is pushed away from so the location is the opposite direction.
+ * It is the crown if the location points more up than sideways, otherwise the
+ * side it mostly points to. The 1 g of gravity is ignored, impacts are at least
+ * ten times that */
+typedef enum {
+    IMPACT_LOCATION_FRONT = 0,
+    IMPACT_LOCATION_BACK,
+    IMPACT_LOCATION_LEFT,
+    IMPACT_LOCATION_RIGHT,
+    IMPACT_LOCATION_CROWN,
+    IMPACT_LOCATION_UNKNOWN = 0xFF, /* erased, no peak */
+} impact_location_t;
+
+/* Rows are the head x, y and z axes in sensor axes, e.g. {0, 1, 0} if the head
+ * x axis is the sensor y axis. Usually a signed permutation */
+typedef int8_t impact_location_mount_t[3][3];
+
+#define IMPACT_LOCATION_MOUNT_IDENTITY  {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}
+
+impact_location_t impact_location_classify(impact_location_mount_t const mount, int16_t const peak[3],
+                                           int8_t direction[3]);
+
+char const *impact_location_name(impact_location_t location);
+
+#endif //IMPACT_LOCATION_H
@@ -0,0 +1,345 @@
+//-------------------------------------------
+// Title: impact_metrics.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Peak linear acceleration, impact duration and HIC15/HIC36
+// of the adxl372 resultant and the peak angular velocity, angular
+// acceleration and BrIC of the icm20649 gyro, kept up to date as records
+// are captured. Everything is integer math: the mean over a HIC window
+// comes from the difference of two running integrals and the 2.5 power
+// is a square times an integer square root. A preview of the resultant
+// at a low rate is kept for the event header.
+//-------------------------------------------
+#include <string.h>
+#include "impact_metrics.h"
+#include "int_sqrt.h"
+
+#define MEAN_Q  8 //fractional bits of the mean acceleration in g
+
+/*
+ * HIC of one window
+ * @param integral - resultant counts x sample periods over the window
+ * @param periods - window length in sample periods, not 0
+ */
+static uint32_t hic_of_window(impact_metrics_t const *metrics, uint32_t integral, uint32_t periods)
+{
+    uint64_t mean;
+    uint64_t hic;
+
+    //mean in Q8 g, below 2^17 for the +-200 g range
+    mean = ((uint64_t) integral * ADXL372_MG_PER_LSB << MEAN_Q) / (1000ULL * periods);
+    //mean^2.5 = mean^2 * sqrt(mean << 8)/16 in Q20, the extra sqrt bits only round less
+    hic = (uint64_t) periods * mean * mean * int_sqrt32((uint32_t) (mean << 8));
+
+    return (uint32_t) (hic / ((uint64_t) metrics->rate_hz << (2*MEAN_Q + MEAN_Q/2 + 4)));
+}
+
+/*
+ * Closes a block: records the running integral and checks every window that
+ * ends here against the HIC so far
+ */
+static void metrics_block_boundary(impact_metrics_t *metrics)
+{
+    uint8_t index;
+    uint32_t periods;
+    uint32_t hic;
+
+    for (uint8_t i = 0; i < metrics->ring_count; i++)
+    {
+        index = (metrics->ring_head + IMPACT_METRICS_RING_SIZE - 1 - i) % IMPACT_METRICS_RING_SIZE;
+        periods = metrics->time - metrics->ring_time[index];
+        if (periods > metrics->window36)
+            break; //older boundaries are further away still
+        if (periods == 0)
+            continue;
+        hic = hic_of_window(metrics, metrics->integral - metrics->ring_integral[index], periods);
+        if (hic > metrics->hic36)
+            metrics->hic36 = hic;
+        if (periods <= metrics->window15 && hic > metrics->hic15)
+            metrics->hic15 = hic;
+    }
+
+    metrics->ring_integral[metrics->ring_head] = metrics->integral;
+    metrics->ring_time[metrics->ring_head] = metrics->time;
+    metrics->ring_head = (metrics->ring_head + 1) % IMPACT_METRICS_RING_SIZE;
+    if (metrics->ring_count < IMPACT_METRICS_RING_SIZE)
+        metrics->ring_count++;
+}
+
+static uint16_t abs_counts(int16_t counts)
+{
+    return (counts < 0) ? (uint16_t) -counts : (uint16_t) counts;
+}
+
+static int16_t saturate_counts(int32_t counts)
+{
+    if (counts > INT16_MAX)
+        return INT16_MAX;
+    if (counts < -INT16_MAX)
+        return -INT16_MAX;
+    return (int16_t) counts;
+}
+
+static uint32_t gyro_counts_to_mrad(impact_metrics_t const *metrics, uint32_t counts)
+{
+    return (uint32_t) (((uint64_t) counts * metrics->gyro_scale) >> 16);
+}
+
+/*
+ * Rotational side of impact_metrics_add
+ */
+static void metrics_add_gyro(impact_metrics_t *metrics, icm20649_data_t const *icm)
+{
+    int16_t const gyro[3] = {icm->gyro_x, icm->gyro_y, icm->gyro_z};
+    int16_t diff[3];
+    uint32_t square = 0;
+    uint32_t periods;
+    uint32_t alpha;
+    uint16_t omega;
+
+    if (icm->accel_x == 0 && icm->accel_y == 0 && icm->accel_z == 0
+        && gyro[0] == 0 && gyro[1] == 0 && gyro[2] == 0)
+        return; //no gyro sample with this record
+    if (metrics->gyro_seen && memcmp(gyro, metrics->prev_gyro, sizeof(gyro)) == 0)
+        return; //same sample as the previous record
+
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        square += (uint32_t) ((int32_t) gyro[i]*gyro[i]);
+        if (abs_counts(gyro[i]) > metrics->peak_axis[i])
+            metrics->peak_axis[i] = abs_counts(gyro[i]);
+    }
+    omega = (uint16_t) int_sqrt32(square);
+    if (omega > metrics->peak_omega)
+        metrics->peak_omega = omega;
+
+    periods = metrics->time - metrics->prev_gyro_time;
+    if (metrics->gyro_seen && periods > 0)
+    {
+        square = 0;
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            diff[i] = saturate_counts((int32_t) gyro[i] - metrics->prev_gyro[i]);
+            square += (uint32_t) ((int32_t) diff[i]*diff[i]);
+        }
+        //mrad/s per sample period to rad/s^2
+        alpha = (uint32_t) (((uint64_t) gyro_counts_to_mrad(metrics, int_sqrt32(square))
+                             * metrics->rate_hz) / (1000ULL * periods));
+        if (alpha > metrics->peak_alpha)
+            metrics->peak_alpha = alpha;
+    }
+
+    memcpy(metrics->prev_gyro, gyro, sizeof(gyro));
+    metrics->prev_gyro_time = metrics->time;
+    metrics->gyro_seen = true;
+}
+
+/*
+ * Keeps the peak resultant of the preview point the time is in, merging
+ * pairs of points into points twice as wide while it is past the last one
+ */
+static void metrics_preview_add(impact_metrics_t *metrics, uint16_t resultant, bool clipped)
+{
+    uint32_t point = metrics->time / metrics->preview_periods;
+    uint16_t *preview = metrics->preview;
+    uint32_t clip_points;
+
+    while (point >= IMPACT_METRICS_PREVIEW_POINTS)
+    {
+        clip_points = 0;
+        for (uint8_t i = 0; i < IMPACT_METRICS_PREVIEW_POINTS/2; i++)
+        {
+            preview[i] = (preview[2*i] > preview[2*i + 1]) ? preview[2*i] : preview[2*i + 1];
+            if (metrics->clip_points & (3UL << 2*i))
+                clip_points |= 1UL << i;
+        }
+        memset(&preview[IMPACT_METRICS_PREVIEW_POINTS/2], 0, sizeof(metrics->preview)/2);
+        metrics->clip_points = clip_points;
+        metrics->preview_periods *= 2;
+        point = metrics->time / metrics->preview_periods;
+    }
+    if (resultant > preview[point])
+        preview[point] = resultant;
+    if (clipped)
+        metrics->clip_points |= 1UL << point;
+}
+
+/*
+ * @param rate_hz - adxl372 sample rate, the unit of the record deltas
+ * @param threshold - resultant in counts that starts and ends the impact duration
+ * @param gyro_fs_dps - icm20649 gyro full scale the records were captured with
+ */
+void impact_metrics_init(impact_metrics_t *metrics, uint16_t rate_hz, uint16_t threshold,
+                         uint16_t gyro_fs_dps)
+{
+    memset(metrics, 0, sizeof(impact_metrics_t));
+    metrics->rate_hz = rate_hz;
+    metrics->threshold = threshold;
+    //dps full scale over 32768 counts, in mrad/s
+    metrics->gyro_scale = (uint32_t) (((uint64_t) gyro_fs_dps * 3141593ULL << 16) / (180ULL * 32768 * 1000));
+    metrics->window15 = (uint16_t) ((IMPACT_METRICS_HIC15_MS*(uint32_t) rate_hz)/1000);
+    metrics->window36 = (uint16_t) ((IMPACT_METRICS_HIC36_MS*(uint32_t) rate_hz)/1000);
+    //the ring has to reach back a whole HIC36 window
+    metrics->block_periods = (metrics->window36 + IMPACT_METRICS_RING_SIZE - 2)/(IMPACT_METRICS_RING_SIZE - 1);
+    if (metrics->block_periods == 0)
+        metrics->block_periods = 1;
+    metrics->preview_periods = 1;
+    //a window may start at the first record
+    metrics_block_boundary(metrics);
+}
+
+/*
+ * Adds one sample, the resultant is held over the delta before it
+ * @param clip - IMPACT_RECORD_CLIP_ bits of the record
+ */
+static void metrics_add_sample(impact_metrics_t *metrics, uint16_t resultant, uint8_t delta,
+                               adxl372_accel_data_t const *accel, icm20649_data_t const *icm, uint16_t clip)
+{
+    uint32_t last_boundary;
+
+    metrics->time += delta;
+    metrics->integral += (uint32_t) resultant*delta;
+
+    if (resultant > metrics->peak)
+    {
+        metrics->peak = resultant;
+        metrics->peak_time = metrics->time;
+        metrics->peak_vector[0] = accel->x;
+        metrics->peak_vector[1] = accel->y;
+        metrics->peak_vector[2] = accel->z;
+    }
+    if (resultant > metrics->threshold)
+    {
+        if (!metrics->above_seen)
+            metrics->first_above = metrics->time;
+        metrics->above_seen = true;
+        metrics->last_above = metrics->time;
+    }
+
+    if ((clip & IMPACT_RECORD_CLIP_ADXL) && metrics->clipped_adxl < UINT16_MAX)
+        metrics->clipped_adxl++;
+    if ((clip & IMPACT_RECORD_CLIP_ICM) && metrics->clipped_icm < UINT16_MAX)
+        metrics->clipped_icm++;
+    metrics_preview_add(metrics, resultant, clip != 0);
+    metrics_add_gyro(metrics, icm);
+
+    last_boundary = metrics->ring_time[(metrics->ring_head + IMPACT_METRICS_RING_SIZE - 1) % IMPACT_METRICS_RING_SIZE];
+    if (metrics->time - last_boundary >= metrics->block_periods)
+        metrics_block_boundary(metrics);
+}
+
+/*
+ * Adds the next captured record
+ */
+void impact_metrics_add(impact_metrics_t *metrics, impact_record_t const *record)
+{
+    adxl372_accel_data_t accel;
+    icm20649_data_t icm;
+    uint8_t delta;
+
+    impact_record_unpack(record, &accel, &icm, &delta);
+    metrics_add_sample(metrics, impact_record_resultant(record, NULL), delta, &accel, &icm,
+                       impact_record_clip(&accel, &icm));
+}
+
+/*
+ * Adds the next count captured records, e.g. the ones of a record block
+ */
+void impact_metrics_add_block(impact_metrics_t *metrics, impact_record_t const *records, uint16_t count)
+{
+    impact_record_columns_t columns;
+    uint32_t square[IMPACT_RECORD_COLUMNS_MAX];
+    adxl372_accel_data_t accel;
+    icm20649_data_t icm;
+    uint16_t num;
+    uint16_t i;
+
+    while (count > 0)
+    {
+        num = impact_record_unpack_columns(records, count, &columns);
+        //one axis at a time over the column, 3 x 2048^2 fits easily
+        for (i = 0; i < num; i++)
+            square[i] = (uint32_t) ((int32_t) columns.x[i]*columns.x[i]);
+        for (i = 0; i < num; i++)
+            square[i] += (uint32_t) ((int32_t) columns.y[i]*columns.y[i]);
+        for (i = 0; i < num; i++)
+            square[i] += (uint32_t) ((int32_t) columns.z[i]*columns.z[i]);
+
+        for (i = 0; i < num; i++)
+        {
+            accel.x = columns.x[i];
+            accel.y = columns.y[i];
+            accel.z = columns.z[i];
+            icm.accel_x = columns.icm_accel[0][i];
+            icm.accel_y = columns.icm_accel[1][i];
+            icm.accel_z = columns.icm_accel[2][i];
+            icm.gyro_x = columns.gyro[0][i];
+            icm.gyro_y = columns.gyro[1][i];
+            icm.gyro_z = columns.gyro[2][i];
+            metrics_add_sample(metrics, (uint16_t) int_sqrt32(square[i]), columns.delta[i], &accel, &icm,
+                               columns.clip[i]);
+        }
+        records += num;
+        count -= num;
+    }
+}
+
+uint32_t impact_metrics_peak_mg(impact_metrics_t const *metrics)
+{
+    return (uint32_t) ADXL372_COUNTS_TO_MG(metrics->peak);
+}
+
+/*
+ * @return time between the first and the last sample above threshold, 0 if none was
+ */
+uint32_t impact_metrics_duration_us(impact_metrics_t const *metrics)
+{
+    if (!metrics->above_seen)
+        return 0;
+
+    return (uint32_t) (((uint64_t) (metrics->last_above - metrics->first_above) * 1000000) / metrics->rate_hz);
+}
+
+uint32_t impact_metrics_peak_omega_mrad(impact_metrics_t const *metrics)
+{
+    return gyro_counts_to_mrad(metrics, metrics->peak_omega);
+}
+
+/*
+ * @return BrIC of the per axis peak angular velocities, x1000
+ */
+uint32_t impact_metrics_bric_x1000(impact_metrics_t const *metrics)
+{
+    uint32_t const critical[3] = {IMPACT_METRICS_BRIC_X_MRAD, IMPACT_METRICS_BRIC_Y_MRAD,
+                                  IMPACT_METRICS_BRIC_Z_MRAD};
+    uint32_t square = 0;
+    uint32_t ratio;
+
+    //each ratio is below 2^11 x1000 for the 4000 dps range
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        ratio = (gyro_counts_to_mrad(metrics, metrics->peak_axis[i]) * 1000) / critical[i];
+        square += ratio*ratio;
+    }
+
+    return int_sqrt32(square);
+}
+
+/*
+ * Fills the preview points up to the last record with their peak resultant in
+ * g, rounded and at most 254, and the ones past it with IMPACT_METRICS_PREVIEW_NONE
+ * @param points - IMPACT_METRICS_PREVIEW_POINTS of them
+ * @return time each point spans in us
+ */
+uint32_t impact_metrics_preview(impact_metrics_t const *metrics, uint8_t *points)
+{
+    uint32_t used = metrics->time / metrics->preview_periods + 1;
+    uint32_t g;
+
+    for (uint8_t i = 0; i < IMPACT_METRICS_PREVIEW_POINTS; i++)
+    {
+        g = ((uint32_t) ADXL372_COUNTS_TO_MG(metrics->preview[i]) + 500)/1000;
+        points[i] = (i >= used) ? IMPACT_METRICS_PREVIEW_NONE : (uint8_t) ((g < 254) ? g : 254);
+    }
+
+    return (uint32_t) (((uint64_t) metrics->preview_periods * 1000000) / metrics->rate_hz);
+}
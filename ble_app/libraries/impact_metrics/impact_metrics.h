@@ -0,0 +1,93 @@
+#ifndef IMPACT_METRICS_H
+#define IMPACT_METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "impact_record.h"
+
+/* Injury metrics of one impact, updated record by record as the samples are
+ * captured so no second pass over the event is needed. Time is counted in
+ * adxl372 sample periods from the record deltas. HIC is
+ *   max over t2 - t1 <= window of (t2 - t1) * (mean g over [t1, t2])^2.5
+ * in fixed point, with t1 and t2 taken at block boundaries: the running
+ * integral of the resultant is kept once per block so a window end only has to
+ * look back IMPACT_METRICS_RING_SIZE blocks. Samples after the last boundary
+ * are in the peak and the duration but not yet in the HIC. The block
+ * resolution reads half sine pulses about 2% low at 10 ms and 10% low at 5 ms.
+ * The rotational side keeps the peak icm20649 angular velocity, the peak angular
+ * acceleration differentiated between successive gyro samples and the per axis
+ * peaks for BrIC. Records repeating the last gyro sample (one read per fifo
+ * burst) are not new samples, and all zero icm20649 records (the pre-trigger
+ * window) carry none. BrIC assumes the sensor axes are the head's x, y and z.
+ * The preview keeps the peak resultant of IMPACT_METRICS_PREVIEW_POINTS points
+ * from the first record on, their width doubles and pairs of points merge
+ * whenever the impact outgrows them, so half to all of them are in use at the
+ * end whatever its length.
+ * Records with an axis at its full scale code (impact_record_clip()) are
+ * counted per sensor and marked on the preview point they fall in, the peak
+ * and the HIC of a clipped impact are a lower bound there.
+ * impact_metrics_add_block() takes the records of a block at once: they are
+ * unpacked into columns (impact_record_unpack_columns()) and the resultants
+ * worked out over the contiguous axes before the records are added in order,
+ * with the same results as adding them one by one */
+#define IMPACT_METRICS_RING_SIZE    32
+#define IMPACT_METRICS_HIC15_MS     15
+#define IMPACT_METRICS_HIC36_MS     36
+#define IMPACT_METRICS_BRIC_X_MRAD  66250 /* BrIC critical angular velocities, Takhounts 2013 */
+#define IMPACT_METRICS_BRIC_Y_MRAD  56450
+#define IMPACT_METRICS_BRIC_Z_MRAD  42870
+#define IMPACT_METRICS_PREVIEW_POINTS 32
+#define IMPACT_METRICS_PREVIEW_NONE 0xFF /* impact_metrics_preview() of a point past the last record */
+
+typedef struct {
+    uint16_t rate_hz;           /* adxl372 sample rate, converts periods to time */
+    uint16_t threshold;         /* resultant counts an impact has to exceed for its duration */
+    uint16_t block_periods;     /* HIC time resolution */
+    uint16_t window15;          /* HIC windows in sample periods */
+    uint16_t window36;
+    uint32_t time;              /* sample periods since the first record */
+    uint32_t integral;          /* resultant counts x sample periods, differences survive wrapping */
+    uint16_t peak;              /* peak resultant in counts */
+    uint32_t peak_time;
+    int16_t peak_vector[3];     /* adxl372 x, y, z at the peak */
+    bool above_seen;
+    uint32_t first_above;       /* first and last time the resultant was above threshold */
+    uint32_t last_above;
+    uint32_t ring_integral[IMPACT_METRICS_RING_SIZE];
+    uint32_t ring_time[IMPACT_METRICS_RING_SIZE];
+    uint8_t ring_head;          /* index of the next block boundary */
+    uint8_t ring_count;
+    uint32_t hic15;
+    uint32_t hic36;
+    uint32_t gyro_scale;        /* mrad/s per gyro count in Q16 */
+    bool gyro_seen;
+    int16_t prev_gyro[3];       /* last gyro sample and when it was taken */
+    uint32_t prev_gyro_time;
+    uint16_t peak_omega;        /* peak angular velocity magnitude in counts */
+    uint16_t peak_axis[3];      /* peak absolute angular velocity per axis in counts */
+    uint32_t peak_alpha;        /* peak angular acceleration magnitude in rad/s^2 */
+    uint16_t preview[IMPACT_METRICS_PREVIEW_POINTS]; /* peak resultant in counts per point */
+    uint32_t preview_periods;   /* sample periods per preview point */
+    uint32_t clip_points;       /* bit per preview point with a clipped record */
+    uint16_t clipped_adxl;      /* records with an adxl372 axis clipped, up to UINT16_MAX */
+    uint16_t clipped_icm;       /* records with an icm20649 accel or gyro axis clipped */
+} impact_metrics_t;
+
+void impact_metrics_init(impact_metrics_t *metrics, uint16_t rate_hz, uint16_t threshold,
+                         uint16_t gyro_fs_dps);
+
+void impact_metrics_add(impact_metrics_t *metrics, impact_record_t const *record);
+
+void impact_metrics_add_block(impact_metrics_t *metrics, impact_record_t const *records, uint16_t count);
+
+uint32_t impact_metrics_peak_mg(impact_metrics_t const *metrics);
+
+uint32_t impact_metrics_duration_us(impact_metrics_t const *metrics);
+
+uint32_t impact_metrics_peak_omega_mrad(impact_metrics_t const *metrics);
+
+uint32_t impact_metrics_bric_x1000(impact_metrics_t const *metrics);
+
+uint32_t impact_metrics_preview(impact_metrics_t const *metrics, uint8_t *points);
+
+#endif //IMPACT_METRICS_H
@@ -0,0 +1,197 @@
+//-------------------------------------------
+// Title: impact_record.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Packs one adxl372 and icm20649 sample into a 17 byte
+// record instead of the 32 byte struct. The adxl372 only has 12 bits
+// per axis so its three axes and the time delta share 5 bytes.
+//-------------------------------------------
+#include "impact_record.h"
+#include "profiler.h"
+
+#define ADXL_FIELD_MSK  0xFFF
+
+static void put_int16(uint8_t *dst, int16_t val)
+{
+    dst[0] = (uint8_t) val;
+    dst[1] = (uint8_t) ((uint16_t) val >> 8);
+}
+
+static int16_t get_int16(uint8_t const *src)
+{
+    return (int16_t) (src[0] | (src[1] << 8));
+}
+
+//sign extends a 12 bit field
+static int16_t adxl_field_to_counts(uint64_t word, uint8_t shift)
+{
+    return (int16_t) (((word >> shift) & ADXL_FIELD_MSK) << 4) >> 4;
+}
+
+/*
+ * @param delta - adxl372 sample periods since the previous record, 0 for the first
+ */
+RAMFUNC void impact_record_pack(impact_record_t *record, adxl372_accel_data_t const *accel,
+                        icm20649_data_t const *icm, uint8_t delta)
+{
+    uint64_t word;
+
+    if (delta > IMPACT_RECORD_DELTA_MAX)
+        delta = IMPACT_RECORD_DELTA_MAX;
+
+    word = ((uint64_t) (accel->x & ADXL_FIELD_MSK))
+         | ((uint64_t) (accel->y & ADXL_FIELD_MSK) << 12)
+         | ((uint64_t) (accel->z & ADXL_FIELD_MSK) << 24)
+         | ((uint64_t) delta << 36);
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        record->bytes[i] = (uint8_t) (word >> (8*i));
+    }
+
+    put_int16(&record->bytes[5], icm->accel_x);
+    put_int16(&record->bytes[7], icm->accel_y);
+    put_int16(&record->bytes[9], icm->accel_z);
+    put_int16(&record->bytes[11], icm->gyro_x);
+    put_int16(&record->bytes[13], icm->gyro_y);
+    put_int16(&record->bytes[15], icm->gyro_z);
+}
+
+/*
+ * @param delta - can be NULL
+ */
+void impact_record_unpack(impact_record_t const *record, adxl372_accel_data_t *accel,
+                          icm20649_data_t *icm, uint8_t *delta)
+{
+    uint64_t word = 0;
+
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        word |= (uint64_t) record->bytes[i] << (8*i);
+    }
+    accel->x = adxl_field_to_counts(word, 0);
+    accel->y = adxl_field_to_counts(word, 12);
+    accel->z = adxl_field_to_counts(word, 24);
+    if (delta != NULL)
+        *delta = (uint8_t) (word >> 36) & IMPACT_RECORD_DELTA_MAX;
+
+    icm->accel_x = get_int16(&record->bytes[5]);
+    icm->accel_y = get_int16(&record->bytes[7]);
+    icm->accel_z = get_int16(&record->bytes[9]);
+    icm->gyro_x = get_int16(&record->bytes[11]);
+    icm->gyro_y = get_int16(&record->bytes[13]);
+    icm->gyro_z = get_int16(&record->bytes[15]);
+}
+
+static bool adxl_clipped(int16_t counts)
+{
+    return counts >= IMPACT_RECORD_ADXL_MAX_COUNTS || counts <= IMPACT_RECORD_ADXL_MIN_COUNTS;
+}
+
+static bool icm_clipped(int16_t counts)
+{
+    return counts == INT16_MAX || counts == INT16_MIN;
+}
+
+/*
+ * @return the IMPACT_RECORD_CLIP_ bits of the axes at their full scale code
+ */
+uint16_t impact_record_clip(adxl372_accel_data_t const *accel, icm20649_data_t const *icm)
+{
+    int16_t const axes[9] = {accel->x, accel->y, accel->z, icm->accel_x, icm->accel_y, icm->accel_z,
+                             icm->gyro_x, icm->gyro_y, icm->gyro_z};
+    uint16_t clip = 0;
+
+    for (uint8_t i = 0; i < 9; i++)
+    {
+        if ((i < 3) ? adxl_clipped(axes[i]) : icm_clipped(axes[i]))
+            clip |= 1U << i;
+    }
+    return clip;
+}
+
+/*
+ * Resultant of the adxl372 axes without unpacking the icm20649 fields
+ * @param delta - can be NULL
+ * @return magnitude in adxl372 counts, rounded down
+ */
+uint16_t impact_record_resultant(impact_record_t const *record, uint8_t *delta)
+{
+    uint64_t word = 0;
+    int32_t x, y, z;
+    uint32_t square;
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        word |= (uint64_t) record->bytes[i] << (8*i);
+    }
+    x = adxl_field_to_counts(word, 0);
+    y = adxl_field_to_counts(word, 12);
+    z = adxl_field_to_counts(word, 24);
+    if (delta != NULL)
+        *delta = (uint8_t) (word >> 36) & IMPACT_RECORD_DELTA_MAX;
+
+    //integer square root, 3 x 2048^2 fits easily
+    square = (uint32_t) (x*x + y*y + z*z);
+    while (bit > square)
+        bit >>= 2;
+    while (bit != 0)
+    {
+        if (square >= root + bit)
+        {
+            square -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint16_t) root;
+}
+
+/*
+ * Unpacks consecutive records into the columns in one pass, with the clip
+ * bits of each record and of the block
+ * @return records unpacked, count up to IMPACT_RECORD_COLUMNS_MAX
+ */
+uint16_t impact_record_unpack_columns(impact_record_t const *records, uint16_t count,
+                                      impact_record_columns_t *columns)
+{
+    uint8_t const *bytes;
+    uint64_t word;
+    uint16_t clip;
+
+    if (count > IMPACT_RECORD_COLUMNS_MAX)
+        count = IMPACT_RECORD_COLUMNS_MAX;
+
+    columns->clipped = 0;
+    for (uint16_t i = 0; i < count; i++)
+    {
+        bytes = records[i].bytes;
+        word = (uint64_t) bytes[0] | ((uint64_t) bytes[1] << 8) | ((uint64_t) bytes[2] << 16)
+             | ((uint64_t) bytes[3] << 24) | ((uint64_t) bytes[4] << 32);
+        columns->x[i] = adxl_field_to_counts(word, 0);
+        columns->y[i] = adxl_field_to_counts(word, 12);
+        columns->z[i] = adxl_field_to_counts(word, 24);
+        columns->delta[i] = (uint8_t) (word >> 36) & IMPACT_RECORD_DELTA_MAX;
+        clip = (adxl_clipped(columns->x[i]) ? 0x001 : 0) | (adxl_clipped(columns->y[i]) ? 0x002 : 0)
+             | (adxl_clipped(columns->z[i]) ? 0x004 : 0);
+        for (uint8_t j = 0; j < 3; j++)
+        {
+            columns->icm_accel[j][i] = get_int16(&bytes[5 + 2*j]);
+            columns->gyro[j][i] = get_int16(&bytes[11 + 2*j]);
+            if (icm_clipped(columns->icm_accel[j][i]))
+                clip |= 0x008U << j;
+            if (icm_clipped(columns->gyro[j][i]))
+                clip |= 0x040U << j;
+        }
+        columns->clip[i] = clip;
+        columns->clipped |= clip;
+    }
+    columns->count = count;
+
+    return count;
+}
@@ -0,0 +1,80 @@
+#ifndef IMPACT_RECORD_H
+#define IMPACT_RECORD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "adxl372.h"
+#include "icm20649.h"
+
+/* Packed little endian record of one impact sample, kept in RAM and on flash.
+ * The timestamp lives in the event header, each record only carries the time since
+ * the previous one.
+ *   bytes 0-4:  adxl372 x, y, z as 12 bit counts at bits 0, 12 and 24, then a 4 bit
+ *               delta at bit 36 counting adxl372 sample periods since the previous record,
+ *               IMPACT_RECORD_DELTA_GAP if samples were lost before it
+ *   bytes 5-16: icm20649 accel x, y, z and gyro x, y, z as raw int16 counts
+ * The icm20649 range of the counts is one per event, kept in the event_store
+ * encoding of the event, see impact_codec_encoding(). Fused records hold the
+ * accel_fusion channel in the icm20649 accel fields instead, in
+ * ACCEL_FUSION_MG_PER_LSB, records without icm20649 data stay all zero */
+#define IMPACT_RECORD_SIZE          17
+#define IMPACT_RECORD_DELTA_MAX     0xF /* larger gaps saturate */
+/* Samples were lost before the record, to a fifo overrun or a full record pool,
+ * so the records around it are not back to back and the time of the gap is not
+ * known. A saturated delta reads the same, the sample rates keep below it */
+#define IMPACT_RECORD_DELTA_GAP     IMPACT_RECORD_DELTA_MAX
+
+/* icm20649 full scales of the records of an event, GYRO_FS_SEL in bits 2-3 and ACCEL_FS_SEL in bits 0-1 */
+#define IMPACT_RECORD_RANGE(gyro_fs, accel_fs)  ((uint8_t) (((gyro_fs) << 2) | (accel_fs)))
+#define IMPACT_RECORD_RANGE_DEFAULT     IMPACT_RECORD_RANGE(ICM20649_GYRO_FS_2000DPS, ICM20649_ACCEL_FS_30G)
+#define IMPACT_RECORD_RANGE_MAX         0xF
+#define IMPACT_RECORD_GYRO_FS(range)    ((icm20649_gyro_fs_t) (((range) >> 2) & 0x3))
+#define IMPACT_RECORD_ACCEL_FS(range)   ((icm20649_accel_fs_t) ((range) & 0x3))
+#define IMPACT_RECORD_GYRO_FS_DPS(range)      (500 << IMPACT_RECORD_GYRO_FS(range))
+#define IMPACT_RECORD_ACCEL_LSB_PER_G(range)  (8192 >> IMPACT_RECORD_ACCEL_FS(range))
+
+/* Axes of a record at their full scale code, where a severe hit clips: a bit
+ * per adxl372 axis (+-200 g), then per icm20649 accel and gyro axis at the
+ * range of the event. A clipped axis reads low, the metrics of the samples
+ * around it are a lower bound. Fused accel fields never reach the int16 limits */
+#define IMPACT_RECORD_CLIP_ADXL         0x007
+#define IMPACT_RECORD_CLIP_ICM_ACCEL    0x038
+#define IMPACT_RECORD_CLIP_GYRO         0x1C0
+#define IMPACT_RECORD_CLIP_ICM          (IMPACT_RECORD_CLIP_ICM_ACCEL | IMPACT_RECORD_CLIP_GYRO)
+#define IMPACT_RECORD_ADXL_MAX_COUNTS   2047
+#define IMPACT_RECORD_ADXL_MIN_COUNTS   (-2048)
+
+#define IMPACT_RECORD_COLUMNS_MAX   16 /* records per impact_record_unpack_columns call, a record block fits */
+
+typedef struct {
+    uint8_t bytes[IMPACT_RECORD_SIZE];
+} impact_record_t;
+
+/* Records split into one array per field, so a pass over one axis reads
+ * contiguous counts instead of striding over the 17 byte records */
+typedef struct {
+    uint16_t count;
+    int16_t x[IMPACT_RECORD_COLUMNS_MAX];           /* adxl372 */
+    int16_t y[IMPACT_RECORD_COLUMNS_MAX];
+    int16_t z[IMPACT_RECORD_COLUMNS_MAX];
+    int16_t icm_accel[3][IMPACT_RECORD_COLUMNS_MAX]; /* icm20649 x, y, z */
+    int16_t gyro[3][IMPACT_RECORD_COLUMNS_MAX];
+    uint8_t delta[IMPACT_RECORD_COLUMNS_MAX];
+    uint16_t clip[IMPACT_RECORD_COLUMNS_MAX];       /* IMPACT_RECORD_CLIP_ bits */
+    uint16_t clipped;                               /* the clip bits of the whole block */
+} impact_record_columns_t;
+
+void impact_record_pack(impact_record_t *record, adxl372_accel_data_t const *accel,
+                        icm20649_data_t const *icm, uint8_t delta);
+
+void impact_record_unpack(impact_record_t const *record, adxl372_accel_data_t *accel,
+                          icm20649_data_t *icm, uint8_t *delta);
+
+uint16_t impact_record_clip(adxl372_accel_data_t const *accel, icm20649_data_t const *icm);
+
+uint16_t impact_record_resultant(impact_record_t const *record, uint8_t *delta);
+
+uint16_t impact_record_unpack_columns(impact_record_t const *records, uint16_t count,
+                                      impact_record_columns_t *columns);
+
+#endif //IMPACT_RECORD_H
@@ -0,0 +1,159 @@
+//-------------------------------------------
+// Title: impact_trigger.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Onset/release hysteresis trigger on the squared adxl372
+// resultant with a minimum duration, run over each fifo burst before it
+// is decided whether the burst starts a capture. The onset can follow a
+// running percentile of the burst peaks between the impacts.
+//-------------------------------------------
+#include "impact_trigger.h"
+#include "int_sqrt.h"
+#include "profiler.h"
+
+static uint32_t magnitude_sq(adxl372_accel_data_t const *sample)
+{
+    //12 bit counts, 3 x 2048^2 fits easily
+    return (uint32_t) ((int32_t) sample->x*sample->x + (int32_t) sample->y*sample->y
+                       + (int32_t) sample->z*sample->z);
+}
+
+/*
+ * @param onset_counts - resultant in counts that starts a run
+ * @param release_counts - resultant in counts a run has to stay above, at most onset_counts
+ * @param min_samples - run length that fires the trigger, 1 fires on the first sample over onset
+ */
+void impact_trigger_init(impact_trigger_t *trigger, uint16_t onset_counts, uint16_t release_counts,
+                         uint16_t min_samples)
+{
+    if (release_counts > onset_counts)
+        release_counts = onset_counts;
+    trigger->onset_sq = (uint32_t) onset_counts*onset_counts;
+    trigger->release_sq = (uint32_t) release_counts*release_counts;
+    trigger->min_samples = (min_samples == 0) ? 1 : min_samples;
+    trigger->peak_sq = 0;
+    trigger->adapt = false;
+    trigger->onset_min = onset_counts;
+    trigger->onset_max = onset_counts;
+    trigger->onset = onset_counts;
+    trigger->baseline = 0;
+    impact_trigger_rearm(trigger);
+}
+
+/*
+ * Lets the onset follow the activity between the impacts, from the onset of
+ * impact_trigger_init() up to onset_max_counts. The estimate starts over at 0
+ * so the onset starts at the lower bound
+ * @param onset_max_counts - upper bound in counts, at or below the init onset keeps it fixed
+ */
+void impact_trigger_adapt_set(impact_trigger_t *trigger, uint16_t onset_max_counts)
+{
+    trigger->adapt = onset_max_counts > trigger->onset_min;
+    trigger->onset_max = trigger->adapt ? onset_max_counts : trigger->onset_min;
+    trigger->onset = trigger->onset_min;
+    trigger->onset_sq = (uint32_t) trigger->onset*trigger->onset;
+    trigger->baseline = 0;
+}
+
+/*
+ * @return the onset in counts the trigger compares against now
+ */
+uint16_t impact_trigger_onset(impact_trigger_t const *trigger)
+{
+    return trigger->onset;
+}
+
+// Steps the estimate towards the peak of a burst and works the onset out from it
+static void impact_trigger_adapt(impact_trigger_t *trigger, uint32_t burst_peak_sq)
+{
+    uint32_t peak = int_sqrt32(burst_peak_sq) << IMPACT_TRIGGER_ADAPT_Q;
+    uint32_t onset;
+
+    if (peak > trigger->baseline)
+        trigger->baseline += IMPACT_TRIGGER_ADAPT_UP_STEPS;
+    else if (trigger->baseline > 0)
+        trigger->baseline--;
+
+    onset = (trigger->baseline*IMPACT_TRIGGER_ADAPT_MARGIN) >> IMPACT_TRIGGER_ADAPT_Q;
+    if (onset < trigger->onset_min)
+        onset = trigger->onset_min;
+    else if (onset > trigger->onset_max)
+        onset = trigger->onset_max;
+    if (onset != trigger->onset)
+    {
+        trigger->onset = (uint16_t) onset;
+        trigger->onset_sq = onset*onset;
+    }
+}
+
+/*
+ * Forgets any run in progress and waits for the next onset, for when the
+ * capture has finished or the sample stream restarted
+ */
+void impact_trigger_rearm(impact_trigger_t *trigger)
+{
+    trigger->run = 0;
+    trigger->active = false;
+    trigger->quiet = 0;
+}
+
+/*
+ * Gets the peak since the last call and starts the next one, same context
+ * as impact_trigger_update
+ * @return the largest squared resultant in counts^2, 0 if no sample was run through
+ */
+uint32_t impact_trigger_peak_take(impact_trigger_t *trigger)
+{
+    uint32_t peak_sq = trigger->peak_sq;
+
+    trigger->peak_sq = 0;
+    return peak_sq;
+}
+
+/*
+ * Runs the next num_samples consecutive samples through the trigger
+ * @return index of the sample the firing run started on, 0 if it started in an
+ * earlier burst, or -1 if the trigger did not fire in this burst (or was already active)
+ */
+RAMFUNC int16_t impact_trigger_update(impact_trigger_t *trigger, adxl372_accel_data_t const *samples, uint16_t num_samples)
+{
+    uint32_t square;
+    uint32_t burst_peak_sq = 0;
+    bool was_active = trigger->active;
+    int16_t fired = -1;
+
+    for (uint16_t i = 0; i < num_samples; i++)
+    {
+        square = magnitude_sq(&samples[i]);
+        if (square > trigger->peak_sq)
+            trigger->peak_sq = square;
+        if (square > burst_peak_sq)
+            burst_peak_sq = square;
+
+        if (trigger->active)
+        {
+            if (square > trigger->release_sq)
+                trigger->quiet = 0;
+            else
+                trigger->quiet++;
+            continue;
+        }
+
+        if (trigger->run > 0 ? square > trigger->release_sq : square >= trigger->onset_sq)
+            trigger->run++;
+        else
+            trigger->run = 0;
+
+        if (trigger->run >= trigger->min_samples)
+        {
+            fired = (trigger->run - 1 > i) ? 0 : (int16_t) (i + 1 - trigger->run);
+            trigger->active = true;
+            trigger->quiet = 0;
+        }
+    }
+
+    //the impacts are not part of the baseline, only the bursts before one fires
+    if (trigger->adapt && !was_active && fired < 0)
+        impact_trigger_adapt(trigger, burst_peak_sq);
+
+    return fired;
+}
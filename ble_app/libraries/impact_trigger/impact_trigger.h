@@ -0,0 +1,60 @@
+#ifndef IMPACT_TRIGGER_H
+#define IMPACT_TRIGGER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "adxl372.h"
+
+/* Impact trigger on the adxl372 resultant, evaluated a whole fifo burst at a
+ * time. The squared magnitude x^2 + y^2 + z^2 is compared against squared
+ * thresholds so no square root is taken and oblique or negative hits count
+ * the same as a hit along a positive axis. A run starts on a sample above the
+ * onset threshold and continues while the samples stay above the lower release
+ * threshold, the trigger fires once a run lasts min_samples so single sample
+ * spikes do not start a capture. After firing the trigger stays active and
+ * counts the samples since the resultant last exceeded the release threshold
+ * until it is rearmed. The largest square of every sample run through it is
+ * kept until impact_trigger_peak_take(), for a peak over a time that does not
+ * need an impact.
+ * With impact_trigger_adapt_set() the onset follows the activity between the
+ * impacts: the peak resultant of every burst run through the trigger while it
+ * is not active moves a running IMPACT_TRIGGER_ADAPT_QUANTILE estimate up or
+ * down by a fixed step, the up step IMPACT_TRIGGER_ADAPT_UP_STEPS times the
+ * down one so it settles where that share of the bursts are below it. The
+ * onset is IMPACT_TRIGGER_ADAPT_MARGIN times the estimate within the bounds.
+ * The steps are per burst: with the 100 sample bursts of the game profile a
+ * drill raises the onset by up to 7 g a second and it comes back down by
+ * 0.8 g a second of rest */
+#define IMPACT_TRIGGER_ADAPT_Q          4   //fractional bits of the estimate in counts
+#define IMPACT_TRIGGER_ADAPT_UP_STEPS   9   //up step in down steps, the 90th percentile
+#define IMPACT_TRIGGER_ADAPT_QUANTILE   90
+#define IMPACT_TRIGGER_ADAPT_MARGIN     2   //onset over the estimate
+typedef struct {
+    uint32_t onset_sq;      /* squared thresholds in counts^2 */
+    uint32_t release_sq;
+    uint16_t min_samples;   /* run length needed to fire */
+    uint16_t run;           /* samples in the current run above release */
+    bool active;            /* fired and not rearmed yet */
+    uint32_t quiet;         /* samples since the resultant last exceeded release while active */
+    uint32_t peak_sq;       /* largest square since the last impact_trigger_peak_take, not rearmed */
+    bool adapt;             /* the onset follows the estimate */
+    uint16_t onset_min;     /* bounds of the adaptive onset in counts */
+    uint16_t onset_max;
+    uint16_t onset;         /* onset in counts, the square is onset_sq */
+    uint32_t baseline;      /* running quantile of the burst peaks, counts << IMPACT_TRIGGER_ADAPT_Q */
+} impact_trigger_t;
+
+void impact_trigger_init(impact_trigger_t *trigger, uint16_t onset_counts, uint16_t release_counts,
+                         uint16_t min_samples);
+
+void impact_trigger_rearm(impact_trigger_t *trigger);
+
+void impact_trigger_adapt_set(impact_trigger_t *trigger, uint16_t onset_max_counts);
+
+uint16_t impact_trigger_onset(impact_trigger_t const *trigger);
+
+uint32_t impact_trigger_peak_take(impact_trigger_t *trigger);
+
+int16_t impact_trigger_update(impact_trigger_t *trigger, adxl372_accel_data_t const *samples, uint16_t num_samples);
+
+#endif //IMPACT_TRIGGER_H
@@ -0,0 +1,150 @@
+//-------------------------------------------
+// Title: imu_align.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Resamples the icm20649 fifo samples onto the adxl372 sample
+// times by linear interpolation, so every stored record pairs an accel
+// sample with the gyro reading at the same instant.
+//-------------------------------------------
+#include <string.h>
+#include "imu_align.h"
+
+static uint32_t period_of_rate(uint16_t rate_hz)
+{
+    return (uint32_t) (((1000000UL << IMU_ALIGN_TIME_Q) + rate_hz/2) / rate_hz);
+}
+
+/*
+ * Time of the oldest of num_samples samples whose newest one was taken at read_us
+ */
+static uint32_t burst_first_time(imu_align_t const *align, uint32_t period, uint16_t num_samples, uint32_t read_us)
+{
+    uint32_t read_time = (read_us - align->origin_us) << IMU_ALIGN_TIME_Q;
+
+    return read_time - (uint32_t) (num_samples - 1)*period;
+}
+
+static int16_t lerp(int16_t from, int16_t to, uint32_t offset, uint32_t span)
+{
+    return (int16_t) (from + (int32_t) (((int64_t) (to - from) * offset) / span));
+}
+
+/*
+ * @param accel_rate_hz - adxl372 output data rate
+ * @param gyro_rate_hz - icm20649 fifo sample rate
+ */
+void imu_align_init(imu_align_t *align, uint16_t accel_rate_hz, uint16_t gyro_rate_hz)
+{
+    memset(align, 0, sizeof(imu_align_t));
+    align->accel_period = period_of_rate(accel_rate_hz);
+    align->gyro_period = period_of_rate(gyro_rate_hz);
+}
+
+/*
+ * Starts a new timeline, for when the icm20649 fifo was reset at the start of a capture
+ * @param now_us - timebase_now_us
+ */
+void imu_align_start(imu_align_t *align, uint32_t now_us)
+{
+    align->origin_us = now_us;
+    align->prev_valid = false;
+    align->num_gyro = 0;
+    align->gyro_next = 0;
+    align->accel_time = 0;
+}
+
+/*
+ * Hands over the next icm20649 fifo burst, the samples must stay valid until the
+ * next burst. The newest sample of the previous burst is kept to interpolate from
+ * @param read_us - timebase_now_us taken right before the fifo was read
+ */
+void imu_align_gyro_burst(imu_align_t *align, icm20649_data_t const *samples, uint16_t num_samples, uint32_t read_us)
+{
+    if (num_samples == 0)
+        return;
+
+    if (align->num_gyro > 0)
+    {
+        align->prev = align->gyro[align->num_gyro - 1];
+        align->prev_time = align->gyro_first_time + (uint32_t) (align->num_gyro - 1)*align->gyro_period;
+        align->prev_valid = true;
+    }
+    align->gyro = samples;
+    align->num_gyro = num_samples;
+    align->gyro_first_time = burst_first_time(align, align->gyro_period, num_samples, read_us);
+    align->gyro_next = 0;
+}
+
+/*
+ * Dates the next num_samples accel samples handed to imu_align_next
+ * @param read_us - timebase_now_us taken right before the adxl372 fifo was read
+ */
+void imu_align_accel_burst(imu_align_t *align, uint16_t num_samples, uint32_t read_us)
+{
+    if (num_samples == 0)
+        return;
+
+    align->accel_time = burst_first_time(align, align->accel_period, num_samples, read_us);
+}
+
+/*
+ * Interpolates the gyro at the time of the next accel sample and moves on to the one after
+ * @return false if no gyro sample was handed over yet, gyro is left as it is
+ */
+bool imu_align_next(imu_align_t *align, icm20649_data_t *gyro)
+{
+    uint32_t t = align->accel_time;
+    uint32_t next_time;
+    icm20649_data_t const *next;
+    int16_t const *from;
+    int16_t const *to;
+    int16_t *out;
+
+    align->accel_time += align->accel_period;
+
+    //move prev up to the last gyro sample at or before t, the times are relative so compare differences
+    while (align->gyro_next < align->num_gyro)
+    {
+        next_time = align->gyro_first_time + (uint32_t) align->gyro_next*align->gyro_period;
+        if ((int32_t) (next_time - t) > 0)
+            break;
+        align->prev = align->gyro[align->gyro_next];
+        align->prev_time = next_time;
+        align->prev_valid = true;
+        align->gyro_next++;
+    }
+
+    if (align->gyro_next >= align->num_gyro)
+    {
+        //past the newest gyro sample
+        if (!align->prev_valid)
+            return false;
+        *gyro = align->prev;
+        return true;
+    }
+
+    next = &align->gyro[align->gyro_next];
+    next_time = align->gyro_first_time + (uint32_t) align->gyro_next*align->gyro_period;
+    if (!align->prev_valid || (int32_t) (next_time - align->prev_time) <= 0)
+    {
+        //before the first gyro sample, or the burst stamps overlap
+        *gyro = *next;
+        return true;
+    }
+    if ((int32_t) (t - align->prev_time) < 0)
+    {
+        //the previous burst ran past this accel sample
+        *gyro = align->prev;
+        return true;
+    }
+
+    //icm20649_data_t is six consecutive int16 channels
+    from = &align->prev.accel_x;
+    to = &next->accel_x;
+    out = &gyro->accel_x;
+    for (uint8_t i = 0; i < sizeof(icm20649_data_t)/sizeof(int16_t); i++)
+    {
+        out[i] = lerp(from[i], to[i], t - align->prev_time, next_time - align->prev_time);
+    }
+
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef IMU_ALIGN_H
+#define IMU_ALIGN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "icm20649.h"
+
+/* Puts the icm20649 fifo stream on the adxl372 timeline. Both fifos are
+ * drained in bursts at their own output data rates, each burst is stamped with
+ * the common timebase (timebase_now_us) just before it is read and its samples
+ * are dated back from that stamp at the nominal sample period, the newest one
+ * at the stamp. Each accel sample then gets the icm20649 sample linearly
+ * interpolated between the two gyro samples around it, the last gyro sample of
+ * the previous burst bridges the gap between bursts. Accel samples before the
+ * first or after the newest gyro sample hold the nearest one. Times are kept
+ * in 1/16 us relative to imu_align_start, so a capture may last ~268 s */
+#define IMU_ALIGN_TIME_Q    4
+
+typedef struct {
+    uint32_t origin_us;         /* timebase_now_us at imu_align_start */
+    uint32_t accel_period;      /* nominal sample periods in 1/16 us */
+    uint32_t gyro_period;
+    bool prev_valid;            /* a gyro sample at or before the accel time */
+    icm20649_data_t prev;
+    uint32_t prev_time;
+    icm20649_data_t const *gyro; /* newest gyro burst */
+    uint16_t num_gyro;
+    uint32_t gyro_first_time;   /* time of gyro[0] */
+    uint16_t gyro_next;         /* first sample of the burst after prev */
+    uint32_t accel_time;        /* time of the next accel sample */
+} imu_align_t;
+
+void imu_align_init(imu_align_t *align, uint16_t accel_rate_hz, uint16_t gyro_rate_hz);
+
+void imu_align_start(imu_align_t *align, uint32_t now_us);
+
+void imu_align_gyro_burst(imu_align_t *align, icm20649_data_t const *samples, uint16_t num_samples, uint32_t read_us);
+
+void imu_align_accel_burst(imu_align_t *align, uint16_t num_samples, uint32_t read_us);
+
+bool imu_align_next(imu_align_t *align, icm20649_data_t *gyro);
+
+#endif //IMU_ALIGN_H
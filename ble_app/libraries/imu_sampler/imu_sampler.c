@@ -0,0 +1,176 @@
+//-------------------------------------------
+// Title: imu_sampler.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Reads the adxl372 and the icm20649 at the same time.
+// On PCB rev1 the two sensors are on separate spim instances, so both
+// transfers are queued back to back and run in parallel, the pair
+// completes when the second transfer finishes.
+//-------------------------------------------
+#include "imu_sampler.h"
+#include "app_util_platform.h"
+
+#define IMU_SAMPLER_READY_POLLS     1000 //status reads for DATA_RDY, well over one period at ODR_400HZ
+
+typedef struct {
+    spi_xfer_t accel_xfer;
+    spi_xfer_t icm_xfer;
+    uint8_t accel_buf[ADXL_ACCEL_DATA_LENGTH];
+    uint8_t icm_buf[ICM20649_REG_DATA_LENGTH];
+    imu_sample_pair_t pair;
+    imu_sampler_callback_t callback;
+    volatile uint8_t pending;   /* transfers still in flight */
+    volatile int8_t result;
+    volatile uint8_t failed;    /* IMU_SAMPLER_FAILED_ bits of the pair */
+    volatile bool busy;
+} imu_sampler_t;
+
+typedef struct {
+    volatile bool done;
+    volatile int8_t result;
+    imu_sample_pair_t * p_pair;
+} imu_sampler_blocking_t;
+
+static imu_sampler_t m_sampler;
+static imu_sampler_blocking_t m_blocking;
+
+/*
+ * Runs once per completed transfer on either instance, the last one joins the pair.
+ * p_context is the transfer that completed
+ */
+static void imu_sampler_xfer_handler(int8_t result, void * p_context)
+{
+    bool last;
+
+    CRITICAL_REGION_ENTER();
+    if (result < 0)
+    {
+        m_sampler.result = result;
+        m_sampler.failed |= (p_context == &m_sampler.accel_xfer) ? IMU_SAMPLER_FAILED_ACCEL
+                                                                 : IMU_SAMPLER_FAILED_ICM;
+    }
+    m_sampler.pending--;
+    last = (m_sampler.pending == 0);
+    CRITICAL_REGION_EXIT();
+
+    if (!last)
+        return;
+
+    adxl372_parse_accel_data(m_sampler.accel_buf, &m_sampler.pair.accel);
+    icm20649_parse_gyro_accel_temp_data(m_sampler.icm_buf, &m_sampler.pair.icm);
+
+    m_sampler.busy = false;
+    if (m_sampler.callback != NULL)
+        m_sampler.callback(m_sampler.result, &m_sampler.pair);
+}
+
+/*
+ * Starts an adxl372 and an icm20649 read in parallel.
+ * The callback may start the next pair
+ * @return 0 if started, -1 if a spi transfer could not be queued, -2 if a pair is in progress
+ */
+int8_t imu_sampler_start(imu_sampler_callback_t callback)
+{
+    if (m_sampler.busy)
+        return -2;
+
+    m_sampler.busy = true;
+    m_sampler.callback = callback;
+    m_sampler.result = 0;
+    m_sampler.failed = 0;
+    m_sampler.pending = 2;
+
+    //the icm read is the longer one so it goes first
+    if (icm20649_queue_read_gyro_accel_data(&m_sampler.icm_xfer, m_sampler.icm_buf,
+                                            imu_sampler_xfer_handler, &m_sampler.icm_xfer) < 0)
+    {
+        m_sampler.failed = IMU_SAMPLER_FAILED_ICM;
+        m_sampler.busy = false;
+        return -1;
+    }
+    if (adxl372_queue_accel_read(&m_sampler.accel_xfer, m_sampler.accel_buf,
+                                 imu_sampler_xfer_handler, &m_sampler.accel_xfer) < 0)
+    {
+        //the icm read still completes and joins with the error
+        imu_sampler_xfer_handler(-1, &m_sampler.accel_xfer);
+        return -1;
+    }
+
+    return 0;
+}
+
+bool imu_sampler_is_busy(void)
+{
+    return m_sampler.busy;
+}
+
+static void imu_sampler_blocking_handler(int8_t result, imu_sample_pair_t const * p_pair)
+{
+    *m_blocking.p_pair = *p_pair;
+    m_blocking.result = result;
+    m_blocking.done = true;
+}
+
+/*
+ * Polls the adxl372 status until DATA_RDY, so a pair holds a new conversion
+ * @return 0 once ready, -1 on spi error or if no conversion came
+ */
+static int8_t imu_sampler_wait_accel_ready(void)
+{
+    uint8_t status;
+    uint16_t polls;
+
+    for (polls = 0; polls < IMU_SAMPLER_READY_POLLS; polls++)
+    {
+        if (adxl372_read_reg(ADI_ADXL372_STATUS_1, &status) < 0)
+            return -1;
+        if (status & DATA_RDY)
+            return 0;
+    }
+    return -1;
+}
+
+/*
+ * Waits for a new adxl372 sample, reads a sample pair and sleeps until both
+ * transfers are done. The icm20649 is read as it is, its registers hold the
+ * last conversion of its own output data rate
+ * @return 0 if success otherwise -1, imu_sampler_failed() tells which sensor failed
+ */
+int8_t imu_sampler_read_pair(imu_sample_pair_t * p_pair)
+{
+    int8_t ret;
+
+    if (imu_sampler_is_busy())
+        return -1;
+    if (imu_sampler_wait_accel_ready() < 0)
+    {
+        m_sampler.failed = IMU_SAMPLER_FAILED_ACCEL;
+        return -1;
+    }
+
+    m_blocking.done = false;
+    m_blocking.p_pair = p_pair;
+
+    ret = imu_sampler_start(imu_sampler_blocking_handler);
+    if (ret == -2)
+        return -1;
+
+    //if only the adxl372 read failed to queue the pair still completes
+    //with an error once the icm20649 read is done
+    if (ret < 0 && !m_blocking.done && !imu_sampler_is_busy())
+        return -1;
+
+    while(!m_blocking.done)
+    {
+        __WFE();
+    }
+
+    return m_blocking.result;
+}
+
+/*
+ * @return the IMU_SAMPLER_FAILED_ bits of the sensors whose read failed in the last pair started
+ */
+uint8_t imu_sampler_failed(void)
+{
+    return m_sampler.failed;
+}
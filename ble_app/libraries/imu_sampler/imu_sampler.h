@@ -0,0 +1,33 @@
+#ifndef IMU_SAMPLER_H
+#define IMU_SAMPLER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "adxl372.h"
+#include "icm20649.h"
+
+/* One adxl372 sample and one icm20649 sample read at the same time */
+typedef struct {
+    adxl372_accel_data_t accel; /* raw counts, see ADXL372_COUNTS_TO_MG */
+    icm20649_data_t icm;        /* raw counts, see icm20649_convert_data */
+} imu_sample_pair_t;
+
+/* Bits of imu_sampler_failed(), the sensors whose read failed */
+#define IMU_SAMPLER_FAILED_ACCEL    (1 << 0)
+#define IMU_SAMPLER_FAILED_ICM      (1 << 1)
+
+/**
+ * @brief Called from the spi interrupt once both reads have completed
+ * @param result 0 if both reads succeeded otherwise -1
+ */
+typedef void (*imu_sampler_callback_t)(int8_t result, imu_sample_pair_t const * p_pair);
+
+int8_t imu_sampler_start(imu_sampler_callback_t callback);
+
+bool imu_sampler_is_busy(void);
+
+int8_t imu_sampler_read_pair(imu_sample_pair_t * p_pair);
+
+uint8_t imu_sampler_failed(void);
+
+#endif //IMU_SAMPLER_H
@@ -0,0 +1,55 @@
+//-------------------------------------------
+// Title: int_sqrt.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Floor of the square root of a 32 or 64 bit integer, the one
+// copy the libraries and the host tools share.
+//-------------------------------------------
+#include "int_sqrt.h"
+
+uint32_t int_sqrt32(uint32_t square)
+{
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+
+    while (bit > square)
+        bit >>= 2;
+    while (bit != 0)
+    {
+        if (square >= root + bit)
+        {
+            square -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return root;
+}
+
+uint32_t int_sqrt64(uint64_t square)
+{
+    uint64_t root = 0;
+    uint64_t bit = (uint64_t) 1 << 62;
+
+    while (bit > square)
+        bit >>= 2;
+    while (bit != 0)
+    {
+        if (square >= root + bit)
+        {
+            square -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint32_t) root;
+}
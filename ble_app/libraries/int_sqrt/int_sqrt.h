@@ -0,0 +1,17 @@
+#ifndef INT_SQRT_H
+#define INT_SQRT_H
+
+#include <stdint.h>
+
+/* Integer square roots, the floor of the root, for the resultants, the HIC
+ * power and the norms the metrics, the trigger, the location and the activity
+ * log work out without the fpu. Bit by bit, one compare and subtract per
+ * result bit. The firmware and the host tools link the same code, so their
+ * results match to the bit. int_sqrt32 takes the 32 bit squares of the
+ * sample path, int_sqrt64 the sums that outgrow them */
+
+uint32_t int_sqrt32(uint32_t square);
+
+uint32_t int_sqrt64(uint64_t square);
+
+#endif //INT_SQRT_H
@@ -0,0 +1,158 @@
+//-------------------------------------------
+// Title: latency_budget.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: The trigger to alert stage times of latency_budget.h, one
+// alert at a time from the commit to its tx complete.
+//-------------------------------------------
+#include <string.h>
+#include "app_util.h"
+#include "app_util_platform.h"
+#include "nrf_log.h"
+#include "mono_time.h"
+
+#include "latency_budget.h"
+
+STATIC_ASSERT(sizeof(latency_budget_stats_t) == 160);
+
+static latency_budget_stats_t m_stats = {
+    .version = LATENCY_BUDGET_VERSION,
+    .size = sizeof(latency_budget_stats_t),
+    .budget_ms = LATENCY_BUDGET_MS,
+};
+static uint64_t m_trigger_us;
+static uint64_t m_probe_us;                 //of the last probe the alert passed
+static uint8_t m_next = LATENCY_BUDGET_STAGES; //probe the alert waits for, LATENCY_BUDGET_STAGES with none
+static bool m_late;                         //counted over the budget already
+
+static char const * const m_stage_names[LATENCY_BUDGET_STAGES] = {
+    "close", "metrics", "queued", "sent", "total"
+};
+
+static void latency_budget_count(uint32_t *p_count)
+{
+    if (*p_count < UINT32_MAX)
+        (*p_count)++;
+}
+
+// Adds the time of one stage, its bin is the bit length of the ms
+static void latency_budget_add(latency_budget_stage_t stage, uint64_t from_us, uint64_t to_us)
+{
+    uint32_t us = (to_us > from_us) ? (uint32_t) MIN(to_us - from_us, UINT32_MAX) : 0;
+    uint32_t ms = us/1000;
+    uint8_t bin = 0;
+
+    while (ms > 0 && bin < LATENCY_BUDGET_BINS - 1)
+    {
+        ms >>= 1;
+        bin++;
+    }
+    m_stats.last_us[stage] = us;
+    m_stats.max_us[stage] = MAX(m_stats.max_us[stage], us);
+    if (m_stats.hist[stage][bin] < UINT16_MAX)
+        m_stats.hist[stage][bin]++;
+}
+
+// Counts and warns of the alert once it is past the budget, at the stage that found it
+static void latency_budget_late_check(latency_budget_stage_t stage, uint64_t now_us)
+{
+    uint32_t ms = (uint32_t) ((now_us - m_trigger_us)/1000);
+
+    if (m_late || ms <= m_stats.budget_ms)
+        return;
+
+    m_late = true;
+    latency_budget_count(&m_stats.over_budget);
+    NRF_LOG_WARNING("Alert latency %u ms past the %u ms budget at %s", ms, m_stats.budget_ms,
+                    m_stage_names[stage]);
+}
+
+/*
+ * Clears the times and counts, the budget is kept. An alert being timed
+ * is dropped
+ */
+void latency_budget_reset(void)
+{
+    uint32_t budget_ms = m_stats.budget_ms;
+
+    CRITICAL_REGION_ENTER();
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_stats.version = LATENCY_BUDGET_VERSION;
+    m_stats.size = sizeof(latency_budget_stats_t);
+    m_stats.budget_ms = budget_ms;
+    m_next = LATENCY_BUDGET_STAGES;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Moves the budget, the alert being timed is checked against the new one
+ */
+void latency_budget_budget_set(uint32_t budget_ms)
+{
+    m_stats.budget_ms = budget_ms;
+}
+
+/*
+ * Starts timing the alert of a committed event, thread context before the
+ * alert is handed to the service
+ * @param trigger_us - mono_time_us() of the sample the trigger fired on
+ * @param close_us - of the capture closed
+ * @param metrics_us - of the metrics ready
+ */
+void latency_budget_start(uint64_t trigger_us, uint64_t close_us, uint64_t metrics_us)
+{
+    CRITICAL_REGION_ENTER();
+    latency_budget_count(&m_stats.events);
+    latency_budget_add(LATENCY_BUDGET_CLOSE, trigger_us, close_us);
+    latency_budget_add(LATENCY_BUDGET_METRICS, close_us, metrics_us);
+    m_trigger_us = trigger_us;
+    m_probe_us = metrics_us;
+    m_late = false;
+    m_next = LATENCY_BUDGET_QUEUED;
+    latency_budget_late_check(LATENCY_BUDGET_METRICS, metrics_us);
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Stamps the alert at QUEUED or SENT, any context. A probe the alert is not
+ * waiting for, e.g. of an alert that was not timed, is ignored
+ */
+void latency_budget_probe(latency_budget_stage_t stage)
+{
+    uint64_t now_us = mono_time_us();
+
+    CRITICAL_REGION_ENTER();
+    if (stage == m_next)
+    {
+        latency_budget_add(stage, m_probe_us, now_us);
+        latency_budget_late_check(stage, now_us);
+        m_probe_us = now_us;
+        m_next++;
+        if (stage == LATENCY_BUDGET_SENT)
+        {
+            latency_budget_add(LATENCY_BUDGET_TOTAL, m_trigger_us, now_us);
+            latency_budget_count(&m_stats.sent);
+            m_next = LATENCY_BUDGET_STAGES;
+        }
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Stops timing the alert, it will not be sent: no central listens
+ */
+void latency_budget_cancel(void)
+{
+    CRITICAL_REGION_ENTER();
+    m_next = LATENCY_BUDGET_STAGES;
+    CRITICAL_REGION_EXIT();
+}
+
+char const *latency_budget_stage_name(latency_budget_stage_t stage)
+{
+    return (stage < LATENCY_BUDGET_STAGES) ? m_stage_names[stage] : "?";
+}
+
+latency_budget_stats_t const *latency_budget_get(void)
+{
+    return &m_stats;
+}
@@ -0,0 +1,65 @@
+#ifndef LATENCY_BUDGET_H
+#define LATENCY_BUDGET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Time from an impact to its alert on the central, split at the probes it
+ * passes so a slow alert shows which stage took the time: the trigger latch
+ * (capture_buf_t start_us, timed in hardware), the capture closing, the
+ * metrics of the commit ready, the alert notification handed to the
+ * SoftDevice and its BLE_GATTS_EVT_HVN_TX_COMPLETE. Every probe is a
+ * mono_time_us(), the app hands the first three in at the commit with
+ * latency_budget_start() and the service probes the last two as they happen,
+ * from any context. Each stage and the total keep the last and the longest
+ * time and a histogram in powers of two of a ms: bin 0 under 1 ms, bin n
+ * from 2^(n-1) ms, the last from 256 ms up. An alert that goes past
+ * budget_ms from its trigger is counted and logged as a warning once, at
+ * the probe that found it late, so an alert stuck in a stage is reported
+ * before it is sent. One alert is timed at a time, as the service sends
+ * them: a new one takes the place of one that was never sent and only
+ * events - sent tells of it. The ble_ios latency characteristic serves
+ * latency_budget_stats_t straight from ram, little endian, 160 bytes. The
+ * counts saturate rather than wrap, latency_budget_reset() starts them over */
+#define LATENCY_BUDGET_VERSION      1
+#define LATENCY_BUDGET_BINS         10
+#ifndef LATENCY_BUDGET_MS
+#define LATENCY_BUDGET_MS           500     //trigger to the alert on air
+#endif
+
+typedef enum {
+    LATENCY_BUDGET_CLOSE = 0,   //trigger to the capture closed
+    LATENCY_BUDGET_METRICS,     //capture closed to the metrics ready
+    LATENCY_BUDGET_QUEUED,      //metrics ready to the alert queued in the SoftDevice
+    LATENCY_BUDGET_SENT,        //queued to its tx complete
+    LATENCY_BUDGET_TOTAL,       //trigger to the tx complete
+    LATENCY_BUDGET_STAGES
+} latency_budget_stage_t;
+
+typedef struct {
+    uint16_t version;           //LATENCY_BUDGET_VERSION
+    uint16_t size;              //bytes of the struct
+    uint32_t budget_ms;
+    uint32_t events;            //alerts timed from their trigger on
+    uint32_t sent;              //of them reached the tx complete
+    uint32_t over_budget;       //went past budget_ms, sent or not
+    uint32_t last_us[LATENCY_BUDGET_STAGES];
+    uint32_t max_us[LATENCY_BUDGET_STAGES];
+    uint16_t hist[LATENCY_BUDGET_STAGES][LATENCY_BUDGET_BINS];
+} latency_budget_stats_t;
+
+void latency_budget_reset(void);
+
+void latency_budget_budget_set(uint32_t budget_ms);
+
+void latency_budget_start(uint64_t trigger_us, uint64_t close_us, uint64_t metrics_us);
+
+void latency_budget_probe(latency_budget_stage_t stage);
+
+void latency_budget_cancel(void);
+
+char const *latency_budget_stage_name(latency_budget_stage_t stage);
+
+latency_budget_stats_t const *latency_budget_get(void);
+
+#endif //LATENCY_BUDGET_H
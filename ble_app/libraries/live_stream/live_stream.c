@@ -0,0 +1,298 @@
+//-------------------------------------------
+// Title: live_stream.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: The queue of live frames filled from the decimated accel
+// stream. The producer only copies, the frames are coded and sealed with
+// their sync word and crc by the sender in thread context, so a few hundred
+// Hz cost next to nothing in the sampling interrupt.
+//-------------------------------------------
+#include <string.h>
+#include "live_stream.h"
+#include "serial_offload.h"
+#include "impact_record.h"
+#include "impact_codec.h"
+#include "crc32.h"
+#include "app_util.h"
+#include "app_util_platform.h"
+
+#define FRAME_HEADER_SIZE   9 //sync, type and length
+
+STATIC_ASSERT(sizeof(live_stream_sample_t) == 12);
+STATIC_ASSERT(LIVE_STREAM_FRAME_SAMPLES <= UINT8_MAX);
+STATIC_ASSERT((256 % LIVE_STREAM_QUEUE_FRAMES) == 0); //the 8 bit indexes wrap on a whole queue
+
+/* A sample as queued, the frame is laid out raw or coded once it is sent */
+typedef struct {
+    adxl372_accel_data_t accel;
+    icm20649_data_t icm;
+} queue_sample_t;
+
+typedef struct {
+    live_stream_header_t header;
+    queue_sample_t samples[LIVE_STREAM_FRAME_SAMPLES];
+} queue_frame_t;
+
+static queue_frame_t m_frames[LIVE_STREAM_QUEUE_FRAMES];
+static volatile uint8_t m_head;     //frames completed, written by the producer
+static volatile uint8_t m_tail;     //frames sent, written by the sender
+static uint8_t m_sealed;            //frames the sender has laid out in m_out
+
+static volatile bool m_active = false;
+static uint16_t m_rate_hz;
+static queue_frame_t m_fill;
+static uint32_t m_index;            //output samples since the start
+static uint16_t m_seq;
+static volatile uint32_t m_dropped; //frames that found the queue full
+
+//sender side, thread context
+static uint32_t m_out[(LIVE_STREAM_FRAME_SIZE + 3)/4]; //the frame being sent
+static uint16_t m_out_length;
+static impact_codec_t m_codec;      //state after the last coded frame
+static uint16_t m_coded_seq;        //of the last coded frame
+static uint8_t m_key_in;            //coded frames before the next key frame, 0 forces one
+
+// Starts the frame being filled over
+static void live_stream_restart(void)
+{
+    m_fill.header.count = 0;
+    m_fill.header.first = m_index;
+    m_fill.header.flags = 0;
+}
+
+// Queues the frame being filled, or counts it if the sender is behind
+static void live_stream_complete(void)
+{
+    queue_frame_t *frame;
+
+    m_fill.header.seq = m_seq++;
+    m_fill.header.rate_hz = m_rate_hz;
+    if ((uint8_t) (m_head - m_tail) < LIVE_STREAM_QUEUE_FRAMES)
+    {
+        frame = &m_frames[m_head % LIVE_STREAM_QUEUE_FRAMES];
+        frame->header = m_fill.header;
+        memcpy(frame->samples, m_fill.samples, m_fill.header.count*sizeof(queue_sample_t));
+        m_head++;
+    }
+    else
+    {
+        m_dropped++;
+    }
+    live_stream_restart();
+}
+
+// Codes the samples of a frame after the state of the frame before, or from
+// zero for a key frame. The state only moves on if the frame fits the raw size
+static bool live_stream_code(queue_frame_t const *frame, bool key, uint8_t *out, uint16_t *p_size)
+{
+    impact_codec_t codec = m_codec;
+    impact_record_t record;
+    adxl372_accel_data_t accel;
+    uint8_t coded[IMPACT_CODEC_MAX_RECORD_SIZE];
+    uint16_t size = 0;
+    uint8_t n;
+
+    if (key)
+        impact_codec_init(&codec);
+    for (uint8_t i = 0; i < frame->header.count; ++i)
+    {
+        //the decimated counts stay in the 12 bits of the record
+        accel.x = MAX(MIN(frame->samples[i].accel.x, IMPACT_RECORD_ADXL_MAX_COUNTS), IMPACT_RECORD_ADXL_MIN_COUNTS);
+        accel.y = MAX(MIN(frame->samples[i].accel.y, IMPACT_RECORD_ADXL_MAX_COUNTS), IMPACT_RECORD_ADXL_MIN_COUNTS);
+        accel.z = MAX(MIN(frame->samples[i].accel.z, IMPACT_RECORD_ADXL_MAX_COUNTS), IMPACT_RECORD_ADXL_MIN_COUNTS);
+        impact_record_pack(&record, &accel, &frame->samples[i].icm, 1);
+        n = impact_codec_encode(&codec, &record, coded);
+        if (size + n > frame->header.count*sizeof(live_stream_sample_t))
+            return false;
+        memcpy(&out[size], coded, n);
+        size += n;
+    }
+    m_codec = codec;
+    *p_size = size;
+
+    return true;
+}
+
+// Lays the frame out in m_out, coded if it codes smaller, with its sync word,
+// type, length and crc
+static void live_stream_seal(queue_frame_t const *frame)
+{
+    uint8_t *out = (uint8_t *) m_out;
+    uint8_t *payload = &out[FRAME_HEADER_SIZE];
+    uint8_t *samples = &payload[LIVE_STREAM_HEADER_SIZE];
+    live_stream_sample_t sample;
+    uint32_t sync = SERIAL_OFFLOAD_SYNC;
+    uint32_t length;
+    uint32_t crc;
+    uint16_t size;
+    uint8_t flags = frame->header.flags;
+    bool key;
+
+    //a coded frame only decodes after the one before it was, a drop in the queue breaks the chain
+    key = m_key_in == 0 || frame->header.seq != (uint16_t) (m_coded_seq + 1);
+    if (LIVE_STREAM_KEY_FRAMES > 0 && live_stream_code(frame, key, samples, &size))
+    {
+        flags |= LIVE_STREAM_FLAG_CODED | (key ? LIVE_STREAM_FLAG_KEY : 0);
+        m_key_in = key ? LIVE_STREAM_KEY_FRAMES - 1 : m_key_in - 1;
+        m_coded_seq = frame->header.seq;
+    }
+    else
+    {
+        for (uint8_t i = 0; i < frame->header.count; ++i)
+        {
+            sample.accel_x = frame->samples[i].accel.x;
+            sample.accel_y = frame->samples[i].accel.y;
+            sample.accel_z = frame->samples[i].accel.z;
+            sample.gyro_x = frame->samples[i].icm.gyro_x;
+            sample.gyro_y = frame->samples[i].icm.gyro_y;
+            sample.gyro_z = frame->samples[i].icm.gyro_z;
+            memcpy(&samples[i*sizeof(sample)], &sample, sizeof(sample));
+        }
+        size = frame->header.count*sizeof(live_stream_sample_t);
+        m_key_in = 0;
+    }
+
+    memcpy(&payload[0], &frame->header.seq, sizeof(uint16_t));
+    memcpy(&payload[2], &frame->header.rate_hz, sizeof(uint16_t));
+    memcpy(&payload[4], &frame->header.first, sizeof(uint32_t));
+    payload[8] = frame->header.count;
+    payload[9] = flags;
+
+    length = LIVE_STREAM_HEADER_SIZE + size;
+    memcpy(&out[0], &sync, sizeof(sync));
+    out[4] = SERIAL_OFFLOAD_FRAME_LIVE;
+    memcpy(&out[5], &length, sizeof(length));
+    crc = crc32_compute(&out[4], FRAME_HEADER_SIZE - sizeof(sync) + length, NULL);
+    memcpy(&payload[length], &crc, sizeof(crc));
+    m_out_length = FRAME_HEADER_SIZE + length + sizeof(crc);
+}
+
+void live_stream_init(void)
+{
+    m_active = false;
+    m_head = 0;
+    m_tail = 0;
+    m_sealed = 0;
+    m_dropped = 0;
+}
+
+/*
+ * Starts streaming, or restarts at another rate, with an empty queue.
+ * Thread context, the producer may be running
+ * @param rate_hz - rate of the samples given to live_stream_push
+ * @return 0 if success, -2 if the rate is invalid
+ */
+int8_t live_stream_start(uint16_t rate_hz)
+{
+    if (rate_hz == 0 || rate_hz > LIVE_STREAM_MAX_RATE_HZ)
+        return -2;
+
+    CRITICAL_REGION_ENTER();
+    m_rate_hz = rate_hz;
+    m_index = 0;
+    m_seq = 0;
+    m_tail = m_head;
+    m_sealed = m_head;
+    m_key_in = 0;
+    live_stream_restart();
+    m_active = true;
+    CRITICAL_REGION_EXIT();
+
+    return 0;
+}
+
+/*
+ * Stops the producer, the frames already queued can still be sent
+ */
+void live_stream_stop(void)
+{
+    m_active = false;
+}
+
+bool live_stream_active(void)
+{
+    return m_active;
+}
+
+/*
+ * @return the output rate in Hz, 0 while stopped
+ */
+uint16_t live_stream_rate(void)
+{
+    return m_active ? m_rate_hz : 0;
+}
+
+/*
+ * Tells the stream samples were lost on the way in (e.g. a fifo overrun or
+ * a decimator reset), the next frame carries LIVE_STREAM_FLAG_GAP.
+ * Same context as live_stream_push
+ */
+void live_stream_gap(void)
+{
+    if (!m_active)
+        return;
+
+    //what the frame holds is still good, it goes out flagged
+    m_fill.header.flags |= LIVE_STREAM_FLAG_GAP;
+}
+
+/*
+ * Adds back to back accel samples at the stream rate with the gyro read that
+ * goes with them, any context but only one producer. Does nothing while stopped
+ */
+void live_stream_push(adxl372_accel_data_t const *samples, uint16_t num_samples, icm20649_data_t const *gyro)
+{
+    queue_sample_t *out;
+
+    if (!m_active)
+        return;
+
+    for (uint16_t i = 0; i < num_samples; ++i)
+    {
+        out = &m_fill.samples[m_fill.header.count++];
+        out->accel = samples[i];
+        out->icm = *gyro;
+        m_index++;
+        if (m_fill.header.count == LIVE_STREAM_FRAME_SAMPLES)
+            live_stream_complete();
+    }
+}
+
+/*
+ * Gets the oldest queued frame with its sync word, type, length and crc,
+ * it stays queued until live_stream_pop() and comes back the same from
+ * every peek until then. Thread context
+ * @param p_length - bytes of the frame, at most LIVE_STREAM_FRAME_SIZE
+ * @return false if no frame is queued
+ */
+bool live_stream_peek(uint8_t const **p_frame, uint16_t *p_length)
+{
+    if (m_tail == m_head)
+        return false;
+
+    if (m_sealed == m_tail)
+    {
+        live_stream_seal(&m_frames[m_tail % LIVE_STREAM_QUEUE_FRAMES]);
+        m_sealed++;
+    }
+    *p_frame = (uint8_t const *) m_out;
+    *p_length = m_out_length;
+
+    return true;
+}
+
+/*
+ * Frees the frame live_stream_peek() gave once it is sent
+ */
+void live_stream_pop(void)
+{
+    if (m_tail != m_head)
+        m_tail++;
+}
+
+/*
+ * @return the frames dropped since the reset because the sender was behind
+ */
+uint32_t live_stream_dropped(void)
+{
+    return m_dropped;
+}
@@ -0,0 +1,85 @@
+#ifndef LIVE_STREAM_H
+#define LIVE_STREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "adxl372.h"
+#include "icm20649.h"
+
+/* Continuous accel and gyro stream for live viewing, fed with an output of
+ * accel_decimate at its rate. Every sample goes with the newest icm20649
+ * read, LIVE_STREAM_FRAME_SAMPLES of them go out as one serial_offload
+ * frame of type SERIAL_OFFLOAD_FRAME_LIVE
+ *   seq     uint16   frame counter, a gap means frames were dropped
+ *   rate    uint16   output samples per second
+ *   first   uint32   index of the first sample since live_stream_start
+ *   count   uint8    samples in the frame
+ *   flags   uint8    LIVE_STREAM_FLAG_*
+ *   samples count * live_stream_sample_t, or with LIVE_STREAM_FLAG_CODED
+ *           count impact_codec records
+ * so tools/offload_decode reads the stream over the uart or the data
+ * characteristic of the Impact Offload Service alike. live_stream_push() runs
+ * in the sampling context (an interrupt is fine) and completes frames into a
+ * queue of LIVE_STREAM_QUEUE_FRAMES, the sender takes them in thread context
+ * with live_stream_peek() and live_stream_pop(). A frame that finds the
+ * queue full is dropped and counted, sampling is never held up by the link.
+ * The sender codes the frames with the delta and nibble varint codec of the
+ * event store (impact_codec, a time delta of 1 per sample), which also carries
+ * the icm20649 accel, in about half the bytes of the raw samples without it.
+ * A coded frame is read against the frame before it, so the first frame, the
+ * first after one the queue dropped or sent raw and every
+ * LIVE_STREAM_KEY_FRAMES-th frame are key frames coded from zero: a decoder
+ * that misses a notification skips to the next key frame. A frame that codes
+ * larger than its raw samples goes out raw */
+#define LIVE_STREAM_FRAME_SAMPLES   16 //40 ms at 400 Hz
+#define LIVE_STREAM_QUEUE_FRAMES    4
+#define LIVE_STREAM_MAX_RATE_HZ     1000
+#ifndef LIVE_STREAM_KEY_FRAMES
+#define LIVE_STREAM_KEY_FRAMES      8  //a key frame at least every 320 ms at 400 Hz, 0 sends every frame raw
+#endif
+#define LIVE_STREAM_FLAG_GAP        0x01 //samples were lost before this frame, the decimator restarted
+#define LIVE_STREAM_FLAG_CODED      0x02 //the samples are impact_codec records
+#define LIVE_STREAM_FLAG_KEY        0x04 //coded from zero, not from the frame before
+
+typedef struct {
+    int16_t accel_x;        //adxl372 counts, 100 mg/LSB
+    int16_t accel_y;
+    int16_t accel_z;
+    int16_t gyro_x;         //icm20649 raw
+    int16_t gyro_y;
+    int16_t gyro_z;
+} live_stream_sample_t;
+
+typedef struct {
+    uint16_t seq;
+    uint16_t rate_hz;
+    uint32_t first;
+    uint8_t count;
+    uint8_t flags;
+} live_stream_header_t;
+
+#define LIVE_STREAM_HEADER_SIZE     10 //packed size of live_stream_header_t
+#define LIVE_STREAM_PAYLOAD_SIZE    (LIVE_STREAM_HEADER_SIZE + LIVE_STREAM_FRAME_SAMPLES*sizeof(live_stream_sample_t))
+#define LIVE_STREAM_FRAME_SIZE      (9 + LIVE_STREAM_PAYLOAD_SIZE + 4) //largest, with the sync, type, length and crc
+
+void live_stream_init(void);
+
+int8_t live_stream_start(uint16_t rate_hz);
+
+void live_stream_stop(void);
+
+bool live_stream_active(void);
+
+uint16_t live_stream_rate(void);
+
+void live_stream_gap(void);
+
+void live_stream_push(adxl372_accel_data_t const *samples, uint16_t num_samples, icm20649_data_t const *gyro);
+
+bool live_stream_peek(uint8_t const **p_frame, uint16_t *p_length);
+
+void live_stream_pop(void);
+
+uint32_t live_stream_dropped(void);
+
+#endif //LIVE_STREAM_H
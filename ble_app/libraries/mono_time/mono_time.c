@@ -0,0 +1,353 @@
+//-------------------------------------------
+// Title: mono_time.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: 64 bit monotonic time from the app timer's RTC, refined
+// to the microsecond by the timebase TIMER while it runs, and the wall
+// clock from ds1388 anchors with the rate of the RC LFCLK fitted between
+// them.
+//-------------------------------------------
+#include "mono_time.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "nrf_drv_ppi.h"
+#include "nrf_rtc.h"
+#include "nrf_delay.h"
+#include "timebase.h"
+
+#define TICK_US     ((uint32_t) (((uint64_t) MONO_TIME_TICK_COUNTS * 1000000) / APP_TIMER_CLOCK_FREQ))
+
+APP_TIMER_DEF(m_extend_timer_id);
+APP_TIMER_DEF(m_sleep_timer_id);
+static volatile bool m_sleep_done;
+static uint64_t m_ticks;            //extended count at m_last_cnt
+static uint32_t m_last_cnt;
+static uint64_t m_last_us;          //the refinement never goes back past it
+static bool m_refined = false;
+static nrf_ppi_channel_t m_ppi;
+static nrf_ppi_channel_t m_stamp_ppi;
+static bool m_stamping = false;
+static bool m_anchored = false;
+static uint64_t m_anchor_mono_us;
+static uint64_t m_anchor_wall_us;
+static int32_t m_rate_ppb = 0;
+static bool m_rate_fitted = false;
+static uint32_t m_anchor_period_s = MONO_TIME_ANCHOR_S;
+
+// extends the count, in a critical region
+static uint64_t mono_time_extend(void)
+{
+    uint32_t cnt = app_timer_cnt_get();
+
+    m_ticks += app_timer_cnt_diff_compute(cnt, m_last_cnt);
+    m_last_cnt = cnt;
+    return m_ticks;
+}
+
+static void mono_time_extend_handler(void *p_context)
+{
+    UNUSED_PARAMETER(p_context);
+    (void) mono_time_ticks();
+}
+
+static void mono_time_sleep_handler(void *p_context)
+{
+    UNUSED_PARAMETER(p_context);
+    m_sleep_done = true;
+}
+
+/*
+ * Starts the timer that extends the count, the app timers must be initialized
+ * @return NRF_SUCCESS or the error of the app timer
+ */
+uint32_t mono_time_init(void)
+{
+    uint32_t err_code;
+
+    (void) mono_time_ticks();
+    err_code = app_timer_create(&m_sleep_timer_id, APP_TIMER_MODE_SINGLE_SHOT, mono_time_sleep_handler);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+    err_code = app_timer_create(&m_extend_timer_id, APP_TIMER_MODE_REPEATED, mono_time_extend_handler);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+    return app_timer_start(m_extend_timer_id, APP_TIMER_TICKS(MONO_TIME_EXTEND_MS), NULL);
+}
+
+/*
+ * @return app timer counts since the RTC started, any context
+ */
+uint64_t mono_time_ticks(void)
+{
+    uint64_t ticks;
+
+    CRITICAL_REGION_ENTER();
+    ticks = mono_time_extend();
+    CRITICAL_REGION_EXIT();
+    return ticks;
+}
+
+/*
+ * Extends an earlier app_timer_cnt_get(), e.g. one taken in an interrupt
+ * @param cnt - less than 512 s old
+ * @return its mono_time_ticks()
+ */
+uint64_t mono_time_at(uint32_t cnt)
+{
+    uint64_t ticks;
+
+    CRITICAL_REGION_ENTER();
+    ticks = mono_time_extend() - app_timer_cnt_diff_compute(m_last_cnt, cnt);
+    CRITICAL_REGION_EXIT();
+    return ticks;
+}
+
+uint64_t mono_time_ticks_to_us(uint64_t ticks)
+{
+    //overflows after 17 years at 32768 Hz
+    return (ticks * 1000000) / APP_TIMER_CLOCK_FREQ;
+}
+
+/*
+ * @return microseconds since the RTC started, to the RTC tick or to the
+ * microsecond while refined, any context
+ */
+uint64_t mono_time_us(void)
+{
+    uint64_t ticks, us;
+    uint32_t edge_us, now_us;
+
+    CRITICAL_REGION_ENTER();
+    ticks = mono_time_extend();
+    us = mono_time_ticks_to_us(ticks);
+    if (m_refined)
+    {
+        //no tick between the two counter reads, so the capture is the edge of this count
+        edge_us = nrf_timer_cc_read(TIMEBASE_TIMER, MONO_TIME_CC_CHANNEL);
+        now_us = timebase_now_us();
+        if (app_timer_cnt_get() == m_last_cnt)
+            us += MIN(now_us - edge_us, TICK_US - 1);
+        if (us < m_last_us)
+            us = m_last_us;
+        m_last_us = us;
+    }
+    CRITICAL_REGION_EXIT();
+    return us;
+}
+
+/*
+ * Waits with the cpu asleep instead of nrf_delay_ms(), the LFCLK running and
+ * from thread context below the app timer's interrupt. With the timer not
+ * started the wait is the busy one
+ * @param ms - at least ms, the wake up is on the next RTC tick after it
+ */
+void mono_time_sleep_ms(uint32_t ms)
+{
+    m_sleep_done = false;
+    if (ms == 0 || app_timer_start(m_sleep_timer_id, APP_TIMER_TICKS(ms), NULL) != NRF_SUCCESS)
+    {
+        nrf_delay_ms(ms);
+        return;
+    }
+    //any interrupt wakes it, the flag tells the timer's from the others
+    while (!m_sleep_done)
+        __WFE();
+}
+
+/*
+ * Refines mono_time_us() with the timebase TIMER, which has to be running
+ * until mono_time_refine_stop()
+ * @return 0 if success otherwise -1 if no PPI channel is free
+ */
+int8_t mono_time_refine_start(void)
+{
+    ret_code_t err_code;
+
+    if (m_refined)
+        return 0;
+    err_code = nrf_drv_ppi_init();
+    if (err_code != NRF_SUCCESS && err_code != NRF_ERROR_MODULE_ALREADY_INITIALIZED)
+        return -1;
+    if (nrf_drv_ppi_channel_alloc(&m_ppi) != NRF_SUCCESS)
+        return -1;
+    if (nrf_drv_ppi_channel_assign(m_ppi,
+                                   nrf_rtc_event_address_get(NRF_RTC1, NRF_RTC_EVENT_TICK),
+                                   nrf_timer_task_address_get(TIMEBASE_TIMER,
+                                                              nrf_timer_capture_task_get(MONO_TIME_CC_CHANNEL))) != NRF_SUCCESS
+        || nrf_drv_ppi_channel_enable(m_ppi) != NRF_SUCCESS)
+    {
+        (void) nrf_drv_ppi_channel_free(m_ppi);
+        return -1;
+    }
+    //routes the tick to PPI only, the app timer's interrupts are left as they are
+    nrf_rtc_event_enable(NRF_RTC1, RTC_EVTEN_TICK_Msk);
+
+    CRITICAL_REGION_ENTER();
+    m_last_us = mono_time_ticks_to_us(mono_time_extend());
+    CRITICAL_REGION_EXIT();
+    //the first capture comes with the next tick
+    nrf_timer_cc_write(TIMEBASE_TIMER, MONO_TIME_CC_CHANNEL, timebase_now_us());
+    m_refined = true;
+    return 0;
+}
+
+void mono_time_refine_stop(void)
+{
+    if (!m_refined)
+        return;
+    m_refined = false;
+    nrf_rtc_event_disable(NRF_RTC1, RTC_EVTEN_TICK_Msk);
+    (void) nrf_drv_ppi_channel_disable(m_ppi);
+    (void) nrf_drv_ppi_channel_free(m_ppi);
+}
+
+/*
+ * Latches the timebase TIMER on an event through PPI, e.g. the GPIOTE IN event
+ * of a sensor interrupt, so mono_time_stamp_us() gives the instant of the event
+ * itself however late its interrupt runs. The TIMER has to be running, as for
+ * mono_time_refine_start()
+ * @param event_address - of the event, nrf_drv_gpiote_in_event_addr_get()
+ * @return 0 if success otherwise -1 if no PPI channel is free or no event
+ */
+int8_t mono_time_stamp_start(uint32_t event_address)
+{
+    ret_code_t err_code;
+
+    if (m_stamping)
+        return 0;
+    if (event_address == 0)
+        return -1;
+    err_code = nrf_drv_ppi_init();
+    if (err_code != NRF_SUCCESS && err_code != NRF_ERROR_MODULE_ALREADY_INITIALIZED)
+        return -1;
+    if (nrf_drv_ppi_channel_alloc(&m_stamp_ppi) != NRF_SUCCESS)
+        return -1;
+    if (nrf_drv_ppi_channel_assign(m_stamp_ppi, event_address,
+                                   nrf_timer_task_address_get(TIMEBASE_TIMER,
+                                                              nrf_timer_capture_task_get(MONO_TIME_STAMP_CC_CHANNEL))) != NRF_SUCCESS
+        || nrf_drv_ppi_channel_enable(m_stamp_ppi) != NRF_SUCCESS)
+    {
+        (void) nrf_drv_ppi_channel_free(m_stamp_ppi);
+        return -1;
+    }
+    m_stamping = true;
+    return 0;
+}
+
+/*
+ * Frees the PPI channel of mono_time_stamp_start(), the last latch is kept
+ */
+void mono_time_stamp_stop(void)
+{
+    if (!m_stamping)
+        return;
+    m_stamping = false;
+    (void) nrf_drv_ppi_channel_disable(m_stamp_ppi);
+    (void) nrf_drv_ppi_channel_free(m_stamp_ppi);
+}
+
+/*
+ * @return mono_time_us() at the last event latched, one up to 71 minutes old
+ * (the TIMER wrap), any context
+ */
+uint64_t mono_time_stamp_us(void)
+{
+    uint64_t us;
+    uint32_t age_us;
+
+    CRITICAL_REGION_ENTER();
+    age_us = timebase_now_us() - nrf_timer_cc_read(TIMEBASE_TIMER, MONO_TIME_STAMP_CC_CHANNEL);
+    us = mono_time_us();
+    CRITICAL_REGION_EXIT();
+    return (us > age_us) ? us - age_us : 0;
+}
+
+/*
+ * Pairs the wall clock with the monotonic time, e.g. a ds1388 read right
+ * after its hundredths turned over, and fits the rate against the last anchor
+ * @param wall_us - microseconds since 1970-01-01 UTC
+ * @param mono_us - mono_time_us() at the same moment
+ */
+void mono_time_anchor(uint64_t wall_us, uint64_t mono_us)
+{
+    int64_t span_us, error_us, rate_ppb;
+
+    CRITICAL_REGION_ENTER();
+    if (m_anchored && mono_us > m_anchor_mono_us
+        && mono_us - m_anchor_mono_us >= (uint64_t) MONO_TIME_RATE_MIN_S * 1000000)
+    {
+        span_us = (int64_t) (mono_us - m_anchor_mono_us);
+        error_us = (int64_t) (wall_us - m_anchor_wall_us) - span_us;
+        //bounded before the scaling, a clock set in between is any size
+        if (error_us >= -(span_us / 1000000) * MONO_TIME_RATE_MAX_PPM
+            && error_us <= (span_us / 1000000) * MONO_TIME_RATE_MAX_PPM)
+        {
+            rate_ppb = (error_us * 1000000000LL) / span_us;
+            if (m_rate_fitted && rate_ppb - m_rate_ppb <= MONO_TIME_RATE_STABLE_PPB
+                && m_rate_ppb - rate_ppb <= MONO_TIME_RATE_STABLE_PPB)
+            {
+                m_anchor_period_s = MIN(2*m_anchor_period_s, MONO_TIME_ANCHOR_MAX_S);
+            }
+            else
+            {
+                m_anchor_period_s = MONO_TIME_ANCHOR_S;
+            }
+            m_rate_ppb = (int32_t) rate_ppb;
+            m_rate_fitted = true;
+        }
+        else
+        {
+            m_anchor_period_s = MONO_TIME_ANCHOR_S;
+        }
+    }
+    m_anchor_mono_us = mono_us;
+    m_anchor_wall_us = wall_us;
+    m_anchored = true;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Starts the rate fit over after the wall clock was set, the next anchor only
+ * pairs the two, the rate fitted so far is kept
+ */
+void mono_time_anchor_reset(void)
+{
+    CRITICAL_REGION_ENTER();
+    m_anchored = false;
+    m_anchor_period_s = MONO_TIME_ANCHOR_S;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Converts a monotonic time to the wall clock, any context
+ * @param mono_us - a mono_time_us(), before or after the anchor
+ * @return 0 if success otherwise -1 if there is no anchor yet
+ */
+int8_t mono_time_wall_us(uint64_t mono_us, uint64_t *p_wall_us)
+{
+    int64_t since_us;
+    int8_t ret = -1;
+
+    CRITICAL_REGION_ENTER();
+    if (m_anchored)
+    {
+        since_us = (int64_t) (mono_us - m_anchor_mono_us);
+        //in ms for the correction, months before it overflows
+        *p_wall_us = m_anchor_wall_us + since_us + ((since_us / 1000) * m_rate_ppb) / 1000000;
+        ret = 0;
+    }
+    CRITICAL_REGION_EXIT();
+    return ret;
+}
+
+void mono_time_get_status(mono_time_status_t *p_status)
+{
+    uint64_t now_us = mono_time_us();
+
+    CRITICAL_REGION_ENTER();
+    p_status->anchored = m_anchored;
+    p_status->refined = m_refined;
+    p_status->rate_ppb = m_rate_ppb;
+    p_status->anchor_age_s = m_anchored ? (uint32_t) ((now_us - m_anchor_mono_us) / 1000000) : 0;
+    p_status->anchor_period_s = m_anchor_period_s;
+    CRITICAL_REGION_EXIT();
+}
@@ -0,0 +1,80 @@
+#ifndef MONO_TIME_H
+#define MONO_TIME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nrf_timer.h"
+
+/* Monotonic time of the whole app, from the app timer's RTC1 count extended to
+ * 64 bits, so every subsystem stamps with the same clock and none reads the
+ * ds1388 on the i2c bus for it. mono_time_us() is cheap enough for any
+ * interrupt: a counter read in a critical region, at the 30.5 us of an RTC
+ * tick. While the timebase TIMER
+ * runs for something else, mono_time_refine_start() adds the microseconds
+ * since the last RTC tick: PPI captures the TIMER on every RTC1 TICK event.
+ * A repeated app timer extends the count well within its 512 s wrap, it also
+ * keeps the RTC running with no other timer. mono_time_stamp_start() has the
+ * TIMER latched by an event in hardware, e.g. a sensor interrupt pin through
+ * GPIOTE and PPI, and mono_time_stamp_us() converts the latch to the monotonic
+ * time however late the interrupt ran. The wall clock is the ds1388
+ * paired with the monotonic time at an anchor, mono_time_anchor(). The LFCLK
+ * runs from the RC oscillator, up to 500 ppm off, so the rate between two
+ * anchors MONO_TIME_RATE_MIN_S or more apart is fitted and applied to the
+ * time since the last one. A rate further off than MONO_TIME_RATE_MAX_PPM is
+ * a clock that was set in between, the previous rate is kept. The SoftDevice
+ * calibrates the RC against the crystal as the temperature moves, in between
+ * the rate holds: every fit within MONO_TIME_RATE_STABLE_PPB of the last one
+ * doubles the anchor period from MONO_TIME_ANCHOR_S up to
+ * MONO_TIME_ANCHOR_MAX_S, one that moved more (a temperature step) or a
+ * clock set brings it back, so a long session reads the ds1388 a few times
+ * an hour at most once the rate is known */
+#define MONO_TIME_EXTEND_MS         60000
+#define MONO_TIME_RATE_MIN_S        60
+#define MONO_TIME_RATE_MAX_PPM      1000
+#define MONO_TIME_RATE_STABLE_PPB   2000
+#define MONO_TIME_ANCHOR_S          600
+#define MONO_TIME_ANCHOR_MAX_S      4800
+#define MONO_TIME_CC_CHANNEL        NRF_TIMER_CC_CHANNEL1 /* of TIMEBASE_TIMER, CC0 is timebase_now_us() */
+#define MONO_TIME_STAMP_CC_CHANNEL  NRF_TIMER_CC_CHANNEL2 /* of TIMEBASE_TIMER, latched by the event of mono_time_stamp_start() */
+#define MONO_TIME_TICK_COUNTS       1 /* app timer counts per RTC1 tick */
+
+/* Snapshot for the cli */
+typedef struct {
+    bool anchored;
+    bool refined;
+    int32_t rate_ppb;       /* wall clock rate against the monotonic time, parts per billion */
+    uint32_t anchor_age_s;  /* since the last anchor */
+    uint32_t anchor_period_s; /* until the next one is due */
+} mono_time_status_t;
+
+uint32_t mono_time_init(void);
+
+uint64_t mono_time_ticks(void);
+
+uint64_t mono_time_at(uint32_t cnt);
+
+uint64_t mono_time_ticks_to_us(uint64_t ticks);
+
+uint64_t mono_time_us(void);
+
+void mono_time_sleep_ms(uint32_t ms);
+
+int8_t mono_time_refine_start(void);
+
+void mono_time_refine_stop(void);
+
+int8_t mono_time_stamp_start(uint32_t event_address);
+
+void mono_time_stamp_stop(void);
+
+uint64_t mono_time_stamp_us(void);
+
+void mono_time_anchor(uint64_t wall_us, uint64_t mono_us);
+
+void mono_time_anchor_reset(void);
+
+int8_t mono_time_wall_us(uint64_t mono_us, uint64_t *p_wall_us);
+
+void mono_time_get_status(mono_time_status_t *p_status);
+
+#endif //MONO_TIME_H
@@ -0,0 +1,179 @@
+//-------------------------------------------
+// Title: nfc_summary.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Publishes the status of the helmet as an NDEF Text
+// record on the NFC Type 2 Tag. The text is built without printf, the
+// record is encoded into the buffer the tag is not reading from and
+// handed over, nfc_t2t answers the reader from RAM by itself.
+//-------------------------------------------
+#include <string.h>
+#include "nfc_summary.h"
+#include "nfc_t2t_lib.h"
+#include "nfc_ndef_msg.h"
+#include "nfc_text_rec.h"
+
+#define SECONDS_PER_DAY     86400
+
+static uint8_t const m_lang[] = {'e', 'n'};
+static char m_text[NFC_SUMMARY_TEXT_SIZE];
+static uint8_t m_ndef[2][NFC_SUMMARY_NDEF_SIZE];
+static uint8_t m_ndef_buf;
+static bool m_started = false;
+
+static void nfc_summary_handler(void *p_context, nfc_t2t_event_t event, uint8_t const *p_data, size_t data_length)
+{
+    //the tag answers the reader by itself, nothing to follow
+    (void) p_context;
+    (void) event;
+    (void) p_data;
+    (void) data_length;
+}
+
+static uint32_t text_str(uint32_t pos, char const *str)
+{
+    while (*str != '\0' && pos < sizeof(m_text))
+        m_text[pos++] = *str++;
+    return pos;
+}
+
+/*
+ * Appends a decimal number, zero padded to at least digits
+ */
+static uint32_t text_num(uint32_t pos, uint32_t value, uint8_t digits)
+{
+    char buf[10];
+    uint8_t len = 0;
+
+    do {
+        buf[len++] = '0' + value%10;
+        value /= 10;
+    } while (value > 0 || len < digits);
+    while (len > 0 && pos < sizeof(m_text))
+        m_text[pos++] = buf[--len];
+    return pos;
+}
+
+/*
+ * Civil date of a day count since 1970-01-01
+ */
+static void text_date(uint32_t days, uint32_t *p_year, uint32_t *p_month, uint32_t *p_day)
+{
+    uint32_t z = days + 719468; //days since 0000-03-01
+    uint32_t era = z/146097;
+    uint32_t doe = z - era*146097;
+    uint32_t yoe = (doe - doe/1460 + doe/36524 - doe/146096)/365;
+    uint32_t doy = doe - (365*yoe + yoe/4 - yoe/100);
+    uint32_t mp = (5*doy + 2)/153;
+
+    *p_day = doy - (153*mp + 2)/5 + 1;
+    *p_month = (mp < 10) ? mp + 3 : mp - 9;
+    *p_year = yoe + era*400 + (*p_month <= 2);
+}
+
+/*
+ * Writes the status text
+ * @return its length
+ */
+static uint32_t nfc_summary_text(nfc_summary_t const *p_summary)
+{
+    uint32_t year, month, day, second;
+    uint32_t pos = 0;
+
+    pos = text_num(pos, p_summary->unsynced, 1);
+    pos = text_str(pos, (p_summary->unsynced == 1) ? " impact unsynced of " : " impacts unsynced of ");
+    pos = text_num(pos, p_summary->stored, 1);
+    pos = text_str(pos, ". ");
+
+    if (p_summary->severe_time.s != 0)
+    {
+        text_date(p_summary->severe_time.s/SECONDS_PER_DAY, &year, &month, &day);
+        second = p_summary->severe_time.s%SECONDS_PER_DAY;
+        pos = text_str(pos, "Last severe ");
+        pos = text_num(pos, year, 4);
+        pos = text_str(pos, "-");
+        pos = text_num(pos, month, 2);
+        pos = text_str(pos, "-");
+        pos = text_num(pos, day, 2);
+        pos = text_str(pos, " ");
+        pos = text_num(pos, second/3600, 2);
+        pos = text_str(pos, ":");
+        pos = text_num(pos, second/60%60, 2);
+        pos = text_str(pos, ":");
+        pos = text_num(pos, second%60, 2);
+        pos = text_str(pos, " UTC, ");
+        pos = text_num(pos, p_summary->severe_peak_g_x10/10, 1);
+        pos = text_str(pos, ".");
+        pos = text_num(pos, p_summary->severe_peak_g_x10%10, 1);
+        pos = text_str(pos, " g. ");
+    }
+    else
+        pos = text_str(pos, "No severe hit. ");
+
+    if (p_summary->battery == NFC_SUMMARY_BATTERY_UNKNOWN)
+        pos = text_str(pos, "Battery unknown");
+    else
+    {
+        pos = text_str(pos, "Battery ");
+        pos = text_num(pos, p_summary->battery, 1);
+        pos = text_str(pos, "%");
+    }
+
+    return pos;
+}
+
+/*
+ * Sets the tag up and starts sensing the field with an empty status
+ * @return 0 if success otherwise -1
+ */
+int8_t nfc_summary_init(void)
+{
+    nfc_summary_t summary;
+
+    if (nfc_t2t_setup(nfc_summary_handler, NULL) != NRF_SUCCESS)
+        return -1;
+
+    memset(&summary, 0, sizeof(summary));
+    summary.battery = NFC_SUMMARY_BATTERY_UNKNOWN;
+    if (nfc_summary_set(&summary) < 0)
+        return -1;
+
+    if (nfc_t2t_emulation_start() != NRF_SUCCESS)
+        return -1;
+    m_started = true;
+
+    return 0;
+}
+
+/*
+ * Publishes a new status, a reader already in the field reads it on its next tap.
+ * A tag that only takes a payload while stopped is stopped around it
+ * @return 0 if success, -1 if the record did not encode or the tag refused it
+ */
+int8_t nfc_summary_set(nfc_summary_t const *p_summary)
+{
+    uint32_t text_len = nfc_summary_text(p_summary);
+    uint32_t len = sizeof(m_ndef[0]);
+    uint8_t buf = m_ndef_buf ^ 1;
+    ret_code_t err_code;
+
+    NFC_NDEF_TEXT_RECORD_DESC_DEF(nfc_summary_rec, UTF_8, m_lang, sizeof(m_lang), (uint8_t const *) m_text, text_len);
+    NFC_NDEF_MSG_DEF(nfc_summary_msg, 1);
+
+    if (nfc_ndef_msg_record_add(&NFC_NDEF_MSG(nfc_summary_msg), &NFC_NDEF_TEXT_RECORD_DESC(nfc_summary_rec)) != NRF_SUCCESS
+        || nfc_ndef_msg_encode(&NFC_NDEF_MSG(nfc_summary_msg), m_ndef[buf], &len) != NRF_SUCCESS)
+        return -1;
+    err_code = nfc_t2t_payload_set(m_ndef[buf], len);
+    if (err_code == NRF_ERROR_INVALID_STATE && m_started)
+    {
+        //the tag only takes it between emulations
+        (void) nfc_t2t_emulation_stop();
+        err_code = nfc_t2t_payload_set(m_ndef[buf], len);
+        if (nfc_t2t_emulation_start() != NRF_SUCCESS)
+            err_code = NRF_ERROR_INTERNAL;
+    }
+    if (err_code != NRF_SUCCESS)
+        return -1;
+    m_ndef_buf = buf;
+
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef NFC_SUMMARY_H
+#define NFC_SUMMARY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "event_store.h"
+
+/* Status of the helmet on the NFC Type 2 Tag, so a trainer taps a phone to
+ * it instead of scanning and connecting over BLE. The tag holds one NDEF
+ * Text record any phone shows without an app, e.g.
+ *   "3 impacts unsynced of 12. Last severe 2026-10-15 14:03:22 UTC, 95.3 g. Battery 64%"
+ * nfc_summary_set() encodes a new status into the other of two buffers and
+ * hands it to nfc_t2t, so a reader in the field gets the old one or the new
+ * one whole. Thread context; the NFCT peripheral takes TIMER4 on the nRF52832
+ * for its field detection and the antenna pins P0.09 and P0.10, a board that
+ * routes other signals there can't have it */
+#define NFC_SUMMARY_TEXT_SIZE       128
+#define NFC_SUMMARY_NDEF_SIZE       (NFC_SUMMARY_TEXT_SIZE + 16) //record header, type and language code
+#define NFC_SUMMARY_BATTERY_UNKNOWN 0xFF
+#ifndef NFC_SUMMARY_SEVERE_G_X10
+#define NFC_SUMMARY_SEVERE_G_X10    800 //peak of a severe hit in 0.1 g
+#endif
+
+typedef struct {
+    uint32_t stored;            //events in the store
+    uint32_t unsynced;          //past the ack watermark
+    event_store_time_t severe_time; //of the last severe hit, s is 0 if none since the reset
+    uint16_t severe_peak_g_x10;
+    uint8_t battery;            //percent or NFC_SUMMARY_BATTERY_UNKNOWN
+} nfc_summary_t;
+
+int8_t nfc_summary_init(void);
+
+int8_t nfc_summary_set(nfc_summary_t const *p_summary);
+
+#endif //NFC_SUMMARY_H
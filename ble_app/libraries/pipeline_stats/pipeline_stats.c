@@ -0,0 +1,61 @@
+//-------------------------------------------
+// Title: pipeline_stats.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Running counters of the impact capture pipeline, updated
+// once per capture and once per commit so the sampling path itself only
+// counts its drops.
+//-------------------------------------------
+#include <string.h>
+#include "pipeline_stats.h"
+#include "nrf_log.h"
+
+void pipeline_stats_init(pipeline_stats_t *stats)
+{
+    memset(stats, 0, sizeof(pipeline_stats_t));
+}
+
+/*
+ * Adds a finished capture
+ * @param num_samples - records stored in the capture buffer, pre-trigger window included
+ * @param num_dropped - samples that did not fit the capture buffer
+ * @param num_since_trigger - samples read from the trigger on, stored or dropped
+ * @param duration_us - time from the trigger to the end of the capture
+ */
+void pipeline_stats_capture(pipeline_stats_t *stats, uint32_t num_samples, uint32_t num_dropped,
+                            uint32_t num_since_trigger, uint32_t duration_us)
+{
+    stats->captures++;
+    stats->samples_captured += num_samples;
+    stats->samples_dropped += num_dropped;
+    if (duration_us == 0)
+        return;
+
+    stats->last_rate_hz = (uint32_t) (((uint64_t) num_since_trigger * 1000000) / duration_us);
+    if (stats->min_rate_hz == 0 || stats->last_rate_hz < stats->min_rate_hz)
+        stats->min_rate_hz = stats->last_rate_hz;
+}
+
+/*
+ * Adds a committed event
+ * @param erase_stalls - event_store_t erase_stalls, the store counts them since it was mounted
+ */
+void pipeline_stats_commit(pipeline_stats_t *stats, uint32_t latency_ms, uint32_t erase_stalls)
+{
+    stats->commits++;
+    stats->last_commit_ms = latency_ms;
+    if (latency_ms > stats->max_commit_ms)
+        stats->max_commit_ms = latency_ms;
+    stats->erase_stalls = erase_stalls;
+}
+
+void pipeline_stats_log(pipeline_stats_t const *stats)
+{
+    NRF_LOG_INFO("PIPELINE: %d captures, %d samples, %d dropped, %d fifo overruns",
+                 stats->captures, stats->samples_captured, stats->samples_dropped, stats->fifo_overruns);
+    NRF_LOG_INFO("PIPELINE: %d Hz last, %d Hz min, %d commits, %d ms last, %d ms max, %d erase stalls",
+                 stats->last_rate_hz, stats->min_rate_hz, stats->commits,
+                 stats->last_commit_ms, stats->max_commit_ms, stats->erase_stalls);
+    NRF_LOG_INFO("PIPELINE: %d stale gyro reads, %d icm20649 range switches, %d record gaps, %d chained",
+                 stats->gyro_stale, stats->icm_range_switches, stats->record_gaps, stats->captures_chained);
+    NRF_LOG_INFO("PIPELINE: %d us longest drain, %d entry watermark", stats->max_drain_us, stats->watermark);
+}
@@ -0,0 +1,43 @@
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include <stdint.h>
+
+/* Capture pipeline counters kept in ram since startup, so the field
+ * performance can be read without a debugger: the ble_ios stats
+ * characteristic serves the struct as it is and pipeline_stats_log() prints
+ * it. The rate is the sustained sample rate of the last capture from the
+ * trigger on, dropped samples included, and a drop is a sample that arrived
+ * with the capture buffer already full. A commit is timed from the end of its
+ * capture until the event is committed, an erase stall is an append that had
+ * to wait for or run a flash erase because the pre-erased pool ran out.
+ * All fields are little endian uint32, a central reads them as they are */
+typedef struct {
+    uint32_t captures;          /* impacts captured */
+    uint32_t samples_captured;  /* records stored in the capture buffers */
+    uint32_t samples_dropped;   /* capture buffer full */
+    uint32_t fifo_overruns;     /* adxl372 fifo reads that saw FIFO_OVR */
+    uint32_t last_rate_hz;      /* samples per second of the last capture */
+    uint32_t min_rate_hz;       /* lowest of any capture, 0 before the first one */
+    uint32_t commits;           /* events committed */
+    uint32_t last_commit_ms;    /* capture end to committed */
+    uint32_t max_commit_ms;
+    uint32_t erase_stalls;
+    uint32_t gyro_stale;        /* icm20649 register reads without a new conversion, the last one was kept */
+    uint32_t icm_range_switches; /* icm20649 ranges stepped between impacts by the autorange */
+    uint32_t record_gaps;       /* records marked IMPACT_RECORD_DELTA_GAP, samples were lost in a capture before them */
+    uint32_t captures_chained;  /* triggers in the chain window of a quiet capture that extended it instead of opening one */
+    uint32_t max_drain_us;      /* longest from a fifo read request to its burst processed, spi queueing included */
+    uint32_t watermark;         /* adxl372 fifo entries between the bursts, retuned between impacts */
+} pipeline_stats_t;
+
+void pipeline_stats_init(pipeline_stats_t *stats);
+
+void pipeline_stats_capture(pipeline_stats_t *stats, uint32_t num_samples, uint32_t num_dropped,
+                            uint32_t num_since_trigger, uint32_t duration_us);
+
+void pipeline_stats_commit(pipeline_stats_t *stats, uint32_t latency_ms, uint32_t erase_stalls);
+
+void pipeline_stats_log(pipeline_stats_t const *stats);
+
+#endif //PIPELINE_STATS_H
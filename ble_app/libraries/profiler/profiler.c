@@ -0,0 +1,146 @@
+//-------------------------------------------
+// Title: profiler.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Per probe cycle count accumulators for the DWT timing
+// macros in profiler.h and a log dump of them, so a driver change can be
+// measured on the board instead of estimated.
+//-------------------------------------------
+#include <string.h>
+#include "profiler.h"
+#include "app_util_platform.h"
+#include "nrf_log.h"
+#include "nrf_log_ctrl.h"
+
+static profiler_probe_t *m_p_probes;
+
+static uint8_t hist_bin(uint32_t cycles)
+{
+    uint32_t base = cycles / PROFILER_HIST_BASE_CYCLES;
+    uint8_t bin;
+
+    if (base == 0)
+        return 0;
+    bin = (uint8_t) (32 - __CLZ(base));
+
+    return (bin < PROFILER_HIST_BINS) ? bin : PROFILER_HIST_BINS - 1;
+}
+
+/*
+ * Starts the cycle counter, it is left running. Other DWT users may clear it
+ * but only in between the timed sections
+ */
+void profiler_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/*
+ * Adds one timed section to a probe, safe from interrupt context
+ */
+void profiler_probe_add(profiler_probe_t *probe, uint32_t cycles)
+{
+    CRITICAL_REGION_ENTER();
+    if (!probe->registered)
+    {
+        probe->p_next = m_p_probes;
+        m_p_probes = probe;
+        probe->registered = 1;
+    }
+    probe->count++;
+    probe->total += cycles;
+    if (cycles < probe->min)
+        probe->min = cycles;
+    if (cycles > probe->max)
+        probe->max = cycles;
+    probe->hist[hist_bin(cycles)]++;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Clears the accumulators of every registered probe, they stay registered
+ */
+void profiler_reset(void)
+{
+    profiler_probe_t *probe;
+
+    CRITICAL_REGION_ENTER();
+    for (probe = m_p_probes; probe != NULL; probe = probe->p_next)
+    {
+        probe->count = 0;
+        probe->total = 0;
+        probe->min = UINT32_MAX;
+        probe->max = 0;
+        memset(probe->hist, 0, sizeof(probe->hist));
+    }
+    NRF_NVMC->IHIT = 0;
+    NRF_NVMC->IMISS = 0;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Logs the count, min, mean and max cycles of every registered probe and
+ * its non empty histogram bins as their lower bound in cycles, then the
+ * instruction cache hits and misses if it is profiled
+ */
+void profiler_dump(void)
+{
+    profiler_probe_t *probe;
+    uint32_t mean;
+    uint32_t cycles_per_us = SystemCoreClock / 1000000;
+
+    NRF_LOG_INFO("PROFILER (count, min/mean/max cycles, mean us)");
+    for (probe = m_p_probes; probe != NULL; probe = probe->p_next)
+    {
+        if (probe->count == 0)
+            continue;
+        mean = (uint32_t) (probe->total / probe->count);
+        NRF_LOG_INFO("%s: %d, %d/%d/%d, %d us", probe->name, probe->count,
+                     probe->min, mean, probe->max, mean / cycles_per_us);
+        for (uint8_t i = 0; i < PROFILER_HIST_BINS; i++)
+        {
+            if (probe->hist[i] == 0)
+                continue;
+            NRF_LOG_INFO("  >= %d cycles: %d", (i == 0) ? 0 : PROFILER_HIST_BASE_CYCLES << (i - 1),
+                         probe->hist[i]);
+        }
+        NRF_LOG_FLUSH();
+    }
+    if (NRF_NVMC->ICACHECNF & NVMC_ICACHECNF_CACHEPROFEN_Msk)
+    {
+        uint32_t hits = NRF_NVMC->IHIT;
+        uint32_t misses = NRF_NVMC->IMISS;
+        uint32_t total = hits + misses;
+
+        NRF_LOG_INFO("icache: %d hits, %d misses, %d%% hit", hits, misses,
+                     (total == 0) ? 0 : (uint32_t) (((uint64_t) hits * 100) / total));
+    }
+}
+
+/*
+ * Turns on the NVMC instruction cache, and with profile its hit and miss
+ * counters, from 0. Called at boot before the SoftDevice is enabled, a flash
+ * write or erase through the NVMC invalidates the cache on its own
+ */
+void profiler_icache_enable(bool profile)
+{
+    NRF_NVMC->IHIT = 0;
+    NRF_NVMC->IMISS = 0;
+    NRF_NVMC->ICACHECNF = (NVMC_ICACHECNF_CACHEEN_Enabled << NVMC_ICACHECNF_CACHEEN_Pos) |
+                          ((profile ? NVMC_ICACHECNF_CACHEPROFEN_Enabled : NVMC_ICACHECNF_CACHEPROFEN_Disabled)
+                           << NVMC_ICACHECNF_CACHEPROFEN_Pos);
+}
+
+/*
+ * Gives the instruction cache hits and misses since the last take, the
+ * enable or a reset, and clears them. Both stay 0 unless it is profiled
+ */
+void profiler_icache_take(uint32_t *p_hits, uint32_t *p_misses)
+{
+    CRITICAL_REGION_ENTER();
+    *p_hits = NRF_NVMC->IHIT;
+    *p_misses = NRF_NVMC->IMISS;
+    NRF_NVMC->IHIT = 0;
+    NRF_NVMC->IMISS = 0;
+    CRITICAL_REGION_EXIT();
+}
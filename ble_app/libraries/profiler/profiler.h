@@ -0,0 +1,87 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nrf.h"
+
+/* Cycle counts of code sections from the Cortex-M4 DWT CYCCNT. A probe is
+ * defined once at file scope and timed with PROFILER_START/PROFILER_STOP or
+ * around a block with PROFILER_SCOPE, it keeps the count, min, max and total
+ * cycles and a histogram with log2 bins of PROFILER_HIST_BASE_CYCLES:
+ * bin 0 is below the base, bin n from base << (n - 1), the last bin is open.
+ * A probe registers itself the first time it is hit, profiler_dump() logs every
+ * registered probe. Built with PROFILER_ENABLED 0 (make PROFILER=0, the
+ * default) the macros compile to nothing so the drivers keep their probes in.
+ * PROFILER_MARK/PROFILER_SINCE time a section that starts and ends in different
+ * functions or interrupts, e.g. an interrupt to the thread handling it, the
+ * caller keeps the uint32_t mark.
+ * The counter wraps after 67 s at 64 MHz, a section has to be shorter than that */
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED            0
+#endif
+
+/* RAMFUNC puts a function in the .ramfunc section of the app linker scripts,
+ * in RAM after .data and copied there with it by the startup code, so the
+ * capture interrupts and the sampling kernels take the same cycles whatever
+ * the flash wait states and the instruction cache hold. A call between flash
+ * and RAM goes through a long branch veneer of the linker, a few cycles.
+ * Built with RAMFUNC_ENABLED 0 (make RAMFUNC=0, the default of the apps
+ * without the capture path) the functions stay in flash.
+ * profiler_icache_enable() turns on the NVMC instruction cache for the code
+ * left in flash, with its hit and miss counters if asked for */
+#ifndef RAMFUNC_ENABLED
+#define RAMFUNC_ENABLED             0
+#endif
+#if RAMFUNC_ENABLED
+#define RAMFUNC                     __attribute__((section(".ramfunc"), noinline))
+#else
+#define RAMFUNC
+#endif
+#define PROFILER_HIST_BINS          12
+#define PROFILER_HIST_BASE_CYCLES   64  //1 us at 64 MHz, the last bin starts at 1 ms
+
+typedef struct profiler_probe_s {
+    char const *name;
+    struct profiler_probe_s *p_next;    //registered probes, NULL for the last
+    uint8_t registered;
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t hist[PROFILER_HIST_BINS];
+} profiler_probe_t;
+
+#if PROFILER_ENABLED
+#define PROFILER_PROBE_DEF(_probe, _label)  profiler_probe_t _probe = {.name = _label, .min = UINT32_MAX}
+#define PROFILER_START(_probe)              uint32_t const _probe ## _start = DWT->CYCCNT
+#define PROFILER_STOP(_probe)               profiler_probe_add(&_probe, DWT->CYCCNT - _probe ## _start)
+//times the block that follows, a return or break out of it is not counted
+#define PROFILER_SCOPE(_probe)                                                  \
+    for (uint32_t _probe ## _start = DWT->CYCCNT, _probe ## _once = 1;          \
+         _probe ## _once;                                                       \
+         profiler_probe_add(&_probe, DWT->CYCCNT - _probe ## _start), _probe ## _once = 0)
+#define PROFILER_MARK(_mark)                ((_mark) = DWT->CYCCNT)
+#define PROFILER_SINCE(_probe, _mark)       profiler_probe_add(&_probe, DWT->CYCCNT - (_mark))
+#else
+#define PROFILER_PROBE_DEF(_probe, _label)  extern profiler_probe_t _probe
+#define PROFILER_START(_probe)
+#define PROFILER_STOP(_probe)
+#define PROFILER_SCOPE(_probe)
+#define PROFILER_MARK(_mark)
+#define PROFILER_SINCE(_probe, _mark)
+#endif
+
+void profiler_init(void);
+
+void profiler_probe_add(profiler_probe_t *probe, uint32_t cycles);
+
+void profiler_reset(void);
+
+void profiler_dump(void);
+
+void profiler_icache_enable(bool profile);
+
+void profiler_icache_take(uint32_t *p_hits, uint32_t *p_misses);
+
+#endif //PROFILER_H
@@ -0,0 +1,107 @@
+//-------------------------------------------
+// Title: radio_window.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Follows the SoftDevice radio events from the radio
+// notification and tells the thread whether a flash hold fits before
+// the next one, or runs a handler once the current one is done.
+//-------------------------------------------
+#include <string.h>
+#include "radio_window.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+
+static volatile bool m_active = false;
+static volatile uint32_t m_start_ticks;
+static volatile uint32_t m_period_ticks = 0; //0 while no period is known
+static radio_window_handler_t m_deferred[RADIO_WINDOW_DEFER_MAX];
+static uint32_t m_deferrals = 0;
+
+static uint32_t radio_window_us(uint32_t ticks)
+{
+    return (uint32_t) (((uint64_t) ticks*1000000)/APP_TIMER_CLOCK_FREQ);
+}
+
+/*
+ * Records a radio event starting or ending, interrupt context. The handlers
+ * deferred to the end of the event run here
+ */
+void radio_window_notify(bool radio_active)
+{
+    radio_window_handler_t handlers[RADIO_WINDOW_DEFER_MAX];
+    uint32_t now = app_timer_cnt_get();
+    uint32_t period;
+    uint8_t i;
+
+    if (radio_active)
+    {
+        period = app_timer_cnt_diff_compute(now, m_start_ticks);
+        m_period_ticks = (radio_window_us(period) < RADIO_WINDOW_PERIOD_MAX_US) ? period : 0;
+        m_start_ticks = now;
+        m_active = true;
+        return;
+    }
+    m_active = false;
+
+    CRITICAL_REGION_ENTER();
+    memcpy(handlers, m_deferred, sizeof(handlers));
+    memset(m_deferred, 0, sizeof(m_deferred));
+    CRITICAL_REGION_EXIT();
+    for (i = 0; i < RADIO_WINDOW_DEFER_MAX; i++)
+        if (handlers[i] != NULL)
+            handlers[i]();
+}
+
+/*
+ * Checks a flash hold against the radio events
+ * @param hold_us - longest the hold takes
+ * @return true if the radio is idle and the next event is not expected
+ * before the hold is over, or is already too late to wait for
+ */
+bool radio_window_clear(uint32_t hold_us)
+{
+    uint32_t since_us, period_us;
+
+    if (m_active)
+        return false;
+    if (m_period_ticks == 0)
+        return true;
+
+    since_us = radio_window_us(app_timer_cnt_diff_compute(app_timer_cnt_get(), m_start_ticks));
+    period_us = radio_window_us(m_period_ticks);
+    if (since_us >= period_us + RADIO_WINDOW_LATE_US)
+        return true;
+    //the radio itself starts the distance after the next active signal
+    return since_us + hold_us <= period_us + RADIO_WINDOW_DISTANCE_US;
+}
+
+/*
+ * Runs handler from the radio notification interrupt once the radio event
+ * in progress, or the next one, is done. A handler already waiting is only
+ * run once, one past RADIO_WINDOW_DEFER_MAX is run right away
+ */
+void radio_window_defer(radio_window_handler_t handler)
+{
+    bool queued = false;
+    uint8_t i;
+
+    CRITICAL_REGION_ENTER();
+    for (i = 0; i < RADIO_WINDOW_DEFER_MAX && !queued; i++)
+        if (m_deferred[i] == handler || m_deferred[i] == NULL)
+        {
+            m_deferred[i] = handler;
+            queued = true;
+        }
+    m_deferrals++;
+    CRITICAL_REGION_EXIT();
+
+    if (!queued)
+        handler();
+}
+
+/*
+ * @return the number of deferrals since the reset
+ */
+uint32_t radio_window_deferrals(void)
+{
+    return m_deferrals;
+}
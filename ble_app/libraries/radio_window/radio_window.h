@@ -0,0 +1,39 @@
+#ifndef RADIO_WINDOW_H
+#define RADIO_WINDOW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Where the SoftDevice's radio events fall, from its radio notification, so
+ * the background flash work goes between them. The radio preempts every
+ * interrupt of the app: a flash hold that runs into a radio event stacks the
+ * event on top of the hold for the fifo reads queued behind it on spim 0, and
+ * the event itself is held up by nothing. radio_window_notify() is called from
+ * the radio notification handler, whose active signal comes
+ * RADIO_WINDOW_DISTANCE_US ahead of the radio and inactive right after it. The
+ * next event is expected one period after the last start, the period being
+ * the last gap between two starts: exact for a connection without slave
+ * latency, a hint for advertising and a latency that skips events.
+ * radio_window_clear() tells the thread whether a hold of a given length fits
+ * before the next event, radio_window_defer() runs a handler once the radio is
+ * done, from the radio notification interrupt, so it should only post to the
+ * scheduler. An event that is later than RADIO_WINDOW_LATE_US past the
+ * expected start is not waited for, the radio may be idle for long (a link
+ * that dropped, a latency), the caller keeps its own timer to retry in case
+ * no event comes; thread context except radio_window_notify() */
+#define RADIO_WINDOW_DISTANCE_US    800     //NRF_RADIO_NOTIFICATION_DISTANCE_800US
+#define RADIO_WINDOW_LATE_US        2000
+#define RADIO_WINDOW_PERIOD_MAX_US  4000000 //a longer gap is no period, nothing is expected
+#define RADIO_WINDOW_DEFER_MAX      4
+
+typedef void (*radio_window_handler_t)(void);
+
+void radio_window_notify(bool radio_active);
+
+bool radio_window_clear(uint32_t hold_us);
+
+void radio_window_defer(radio_window_handler_t handler);
+
+uint32_t radio_window_deferrals(void);
+
+#endif //RADIO_WINDOW_H
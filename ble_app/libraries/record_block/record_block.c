@@ -0,0 +1,81 @@
+//-------------------------------------------
+// Title: record_block.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Chains of fixed size impact record blocks allocated from
+// an nrf_balloc pool. Records are appended at the tail, taking a new
+// block when the tail is full, and the blocks are freed from the head
+// once their records are stored.
+//-------------------------------------------
+#include <stddef.h>
+#include "app_util_platform.h"
+#include "record_block.h"
+
+STATIC_ASSERT(sizeof(record_block_t) <= RECORD_BLOCK_SIZE);
+
+/*
+ * Starts an empty chain, its blocks come from p_pool
+ */
+void record_chain_init(record_chain_t *chain, nrf_balloc_t const *p_pool)
+{
+    chain->p_pool = p_pool;
+    chain->p_head = NULL;
+    chain->p_tail = NULL;
+    chain->count = 0;
+}
+
+/*
+ * Reserves the next record at the end of the chain, safe from interrupt context
+ * @return the record to fill in, NULL if the pool is out of blocks
+ */
+impact_record_t *record_chain_append(record_chain_t *chain)
+{
+    record_block_t *block = chain->p_tail;
+
+    if (block == NULL || block->count == RECORD_BLOCK_RECORDS)
+    {
+        block = nrf_balloc_alloc(chain->p_pool);
+        if (block == NULL)
+            return NULL;
+        block->p_next = NULL;
+        block->count = 0;
+        if (chain->p_tail == NULL)
+            chain->p_head = block;
+        else
+            chain->p_tail->p_next = block;
+        chain->p_tail = block;
+    }
+    chain->count++;
+
+    return &block->records[block->count++];
+}
+
+/*
+ * Gives the first block of the chain back to the pool, e.g. once its records are stored.
+ * The count is shared with record_chain_append, which may run in an interrupt
+ */
+void record_chain_free_head(record_chain_t *chain)
+{
+    record_block_t *block = chain->p_head;
+
+    if (block == NULL)
+        return;
+
+    CRITICAL_REGION_ENTER();
+    chain->p_head = block->p_next;
+    if (chain->p_head == NULL)
+        chain->p_tail = NULL;
+    chain->count -= block->count;
+    CRITICAL_REGION_EXIT();
+    nrf_balloc_free(chain->p_pool, block);
+}
+
+/*
+ * Gives every block of the chain back to the pool, the chain is left empty
+ */
+void record_chain_free(record_chain_t *chain)
+{
+    while (chain->p_head != NULL)
+    {
+        record_chain_free_head(chain);
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef RECORD_BLOCK_H
+#define RECORD_BLOCK_H
+
+#include <stdint.h>
+#include "nrf_balloc.h"
+#include "impact_record.h"
+
+/* Impact records kept in a chain of fixed size blocks from an nrf_balloc pool.
+ * A block is at most one flash page, so a capture only holds the ram its records
+ * need and its blocks go back to the pool one by one as they are stored. The
+ * chain is handed from owner to owner (capture, commit) instead of copied.
+ * Define the pool with RECORD_BLOCK_POOL_DEF, nrf_balloc allocates and frees in
+ * a critical region so blocks can be taken in an interrupt and freed in the thread.
+ * The thread may free the head of a chain an interrupt still appends to once
+ * the head is not the tail (p_next is set), the interrupt only touches the tail */
+#define RECORD_BLOCK_SIZE           256 //MT25QL256ABA_PAGE_SIZE
+#define RECORD_BLOCK_RECORDS        ((RECORD_BLOCK_SIZE - sizeof(void *) - sizeof(uint16_t))/IMPACT_RECORD_SIZE)
+
+#define RECORD_BLOCK_POOL_DEF(_name, _num_blocks) NRF_BALLOC_DEF(_name, sizeof(record_block_t), _num_blocks)
+
+typedef struct record_block_s {
+    struct record_block_s *p_next;  /* next block of the chain, NULL for the tail */
+    uint16_t count;                 /* records used */
+    impact_record_t records[RECORD_BLOCK_RECORDS];
+} record_block_t;
+
+typedef struct {
+    nrf_balloc_t const *p_pool;
+    record_block_t *p_head;
+    record_block_t *p_tail;
+    uint32_t count;                 /* records in the chain */
+} record_chain_t;
+
+void record_chain_init(record_chain_t *chain, nrf_balloc_t const *p_pool);
+
+impact_record_t *record_chain_append(record_chain_t *chain);
+
+void record_chain_free_head(record_chain_t *chain);
+
+void record_chain_free(record_chain_t *chain);
+
+#endif //RECORD_BLOCK_H
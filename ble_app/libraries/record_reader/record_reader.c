@@ -0,0 +1,93 @@
+//-------------------------------------------
+// Title: record_reader.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Streams the impact records of a stored event out of the
+// event store a chunk at a time, raw or impact_codec coded, so a caller
+// walks an event of any length without a buffer of its size.
+//-------------------------------------------
+#include <string.h>
+#include "record_reader.h"
+#include "app_util.h"
+
+/*
+ * Starts reading the records of a stored event
+ * @return 0 if success, -1 on spi error, -2 if there is no such event or -3 if its header is corrupt
+ */
+int8_t record_reader_open(record_reader_t *reader, event_store_t *store, uint32_t event_id)
+{
+    uint8_t range;
+    bool fused;
+    int8_t ret;
+
+    reader->store = store;
+    reader->event_id = event_id;
+    reader->offset = 0;
+    reader->fill = 0;
+    reader->pos = 0;
+    impact_codec_init(&reader->codec);
+
+    ret = event_store_get_header(store, event_id, &reader->header);
+    if (ret < 0)
+        return ret;
+    reader->records = (impact_codec_encoding_parse(reader->header.encoding, &reader->coded, &range, &fused) == 0)
+                      && (reader->coded || reader->header.sample_size == IMPACT_RECORD_SIZE);
+    return 0;
+}
+
+/*
+ * @return true if the samples of the event are impact records
+ */
+bool record_reader_has_records(record_reader_t const *reader)
+{
+    return reader->records;
+}
+
+/*
+ * Reads the next record of the event
+ * @return 1 if a record was read, 0 at the end of the event, -1 on spi error or -2 if the event
+ * holds no records or is corrupt
+ */
+int8_t record_reader_next(record_reader_t *reader, impact_record_t *record)
+{
+    uint16_t sample_size = reader->coded ? 1 : IMPACT_RECORD_SIZE;
+    uint16_t record_size = reader->coded ? IMPACT_CODEC_MAX_RECORD_SIZE : IMPACT_RECORD_SIZE;
+    uint32_t num_samples;
+    uint8_t used;
+    int8_t ret;
+
+    if (!reader->records)
+        return -2;
+
+    //top up so a whole record is always buffered
+    if (reader->fill - reader->pos < record_size && reader->offset < reader->header.sample_count)
+    {
+        memmove(reader->chunk, &reader->chunk[reader->pos], reader->fill - reader->pos);
+        reader->fill -= reader->pos;
+        reader->pos = 0;
+        num_samples = MIN((sizeof(reader->chunk) - reader->fill)/sample_size,
+                          reader->header.sample_count - reader->offset);
+        ret = event_store_read_samples(reader->store, reader->event_id, reader->offset,
+                                       &reader->chunk[reader->fill], num_samples);
+        if (ret < 0)
+            return ret;
+        reader->fill += num_samples*sample_size;
+        reader->offset += num_samples;
+    }
+    if (reader->pos >= reader->fill)
+        return 0;
+
+    if (reader->coded)
+    {
+        if (impact_codec_decode(&reader->codec, &reader->chunk[reader->pos], reader->fill - reader->pos,
+                                record, &used) < 0)
+            return -2;
+    }
+    else
+    {
+        memcpy(record, &reader->chunk[reader->pos], IMPACT_RECORD_SIZE);
+        used = IMPACT_RECORD_SIZE;
+    }
+    reader->pos += used;
+
+    return 1;
+}
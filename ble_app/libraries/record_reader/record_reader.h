@@ -0,0 +1,39 @@
+#ifndef RECORD_READER_H
+#define RECORD_READER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "event_store.h"
+#include "impact_record.h"
+#include "impact_codec.h"
+#include "mt25ql256aba.h"
+
+/* Reads the impact records of a stored event back one at a time, a flash
+ * page of samples at a time, decoding the impact_codec encodings on the way.
+ * The chunk is topped up before a record could run past its end, so a coded
+ * record never straddles two reads. An event of other samples (a summary_log
+ * event, a raw one of another size) opens with its header and has no records,
+ * record_reader_next() fails on it. The reader is large, keep it static or in
+ * a context that has the stack for it */
+#define RECORD_READER_CHUNK_SIZE    (MT25QL256ABA_PAGE_SIZE + IMPACT_CODEC_MAX_RECORD_SIZE) //stored bytes staged per flash access
+
+typedef struct {
+    event_store_t *store;
+    uint32_t event_id;
+    event_store_header_t header;
+    uint32_t offset;        /* samples read from flash, coded bytes for impact_codec events */
+    bool records;           /* the samples are impact records, coded or not */
+    bool coded;
+    uint16_t fill;
+    uint16_t pos;
+    impact_codec_t codec;
+    uint8_t chunk[RECORD_READER_CHUNK_SIZE];
+} record_reader_t;
+
+int8_t record_reader_open(record_reader_t *reader, event_store_t *store, uint32_t event_id);
+
+bool record_reader_has_records(record_reader_t const *reader);
+
+int8_t record_reader_next(record_reader_t *reader, impact_record_t *record);
+
+#endif //RECORD_READER_H
@@ -0,0 +1,230 @@
+//-------------------------------------------
+// Title: sample_bus.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Publish and subscribe of the sensor bursts, see
+// sample_bus.h. The blocks are counted references into a static pool,
+// the IN_PLACE subscribers run in the publish call and the THREAD ones
+// from app_scheduler with one reference for all of them, handed over
+// through a lock free fifo.
+//-------------------------------------------
+#include <string.h>
+#include "app_error.h"
+#include "app_scheduler.h"
+#include "app_util_platform.h"
+#include "nordic_common.h"
+#include "nrf_atfifo.h"
+
+#include "sample_bus.h"
+
+static adxl372_accel_data_t m_samples[SAMPLE_BUS_BLOCKS][SAMPLE_BUS_BLOCK_SAMPLES];
+static sample_bus_block_t m_blocks[SAMPLE_BUS_BLOCKS];
+static sample_bus_sub_t *m_subs = NULL;
+static sample_bus_stats_t m_stats;
+static nrf_atomic_flag_t m_sched_pending;  //a drain is in the scheduler queue
+
+//every entry holds a reference, there are never more than the pool
+NRF_ATFIFO_DEF(m_thread_fifo, sample_bus_block_t *, SAMPLE_BUS_BLOCKS);
+
+static bool block_pooled(sample_bus_block_t const *p_block)
+{
+    return p_block >= &m_blocks[0] && p_block < &m_blocks[SAMPLE_BUS_BLOCKS];
+}
+
+// Runs the THREAD subscribers of every queued block and gives back the
+// reference publish took. The flag is cleared first, a block queued while
+// the fifo is drained kicks another drain that may find it empty
+static void sample_bus_sched_handler(void *p_event_data, uint16_t event_size)
+{
+    sample_bus_block_t *p_block;
+    sample_bus_sub_t *p_sub;
+
+    UNUSED_PARAMETER(p_event_data);
+    UNUSED_PARAMETER(event_size);
+    (void) nrf_atomic_flag_clear(&m_sched_pending);
+    while (nrf_atfifo_get_free(m_thread_fifo, &p_block, sizeof(p_block), NULL) == NRF_SUCCESS)
+    {
+        for (p_sub = m_subs; p_sub != NULL; p_sub = p_sub->p_next)
+        {
+            if (p_sub->enabled && p_sub->latency == SAMPLE_BUS_THREAD && p_sub->rate == p_block->rate)
+                p_sub->handler(p_block, p_sub->p_context);
+        }
+        sample_bus_release(p_block);
+    }
+}
+
+// Hands a referenced block to the thread
+static bool sample_bus_queue(sample_bus_block_t *p_block)
+{
+    if (nrf_atfifo_alloc_put(m_thread_fifo, &p_block, sizeof(p_block), NULL) != NRF_SUCCESS)
+        return false;
+
+    if (nrf_atomic_flag_set_fetch(&m_sched_pending) == 0
+        && app_sched_event_put(NULL, 0, sample_bus_sched_handler) != NRF_SUCCESS)
+    {
+        //the block stays queued, the next publish kicks the drain again
+        (void) nrf_atomic_flag_clear(&m_sched_pending);
+        m_stats.sched_full++;
+    }
+    return true;
+}
+
+/*
+ * Empties the pool and the subscriber list, before the producer starts
+ */
+void sample_bus_init(void)
+{
+    ret_code_t err_code;
+
+    memset(m_blocks, 0, sizeof(m_blocks));
+    for (uint8_t i = 0; i < SAMPLE_BUS_BLOCKS; i++)
+        m_blocks[i].samples = m_samples[i];
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_subs = NULL;
+    m_sched_pending = 0;
+    err_code = NRF_ATFIFO_INIT(m_thread_fifo);
+    APP_ERROR_CHECK(err_code);
+}
+
+/*
+ * Adds a subscriber, called in the order they were added. Thread context,
+ * before the first publish
+ */
+void sample_bus_subscribe(sample_bus_sub_t *p_sub)
+{
+    sample_bus_sub_t **pp_tail = &m_subs;
+
+    while (*pp_tail != NULL)
+        pp_tail = &(*pp_tail)->p_next;
+    p_sub->p_next = NULL;
+    *pp_tail = p_sub;
+}
+
+/*
+ * Starts or stops the deliveries to a subscriber, from the next publish on
+ */
+void sample_bus_enable(sample_bus_sub_t *p_sub, bool enable)
+{
+    p_sub->enabled = enable;
+}
+
+/*
+ * Moves a subscriber to another rate, from the next publish on
+ */
+void sample_bus_rate_set(sample_bus_sub_t *p_sub, sample_bus_rate_t rate)
+{
+    p_sub->rate = rate;
+}
+
+/*
+ * Takes a block out of the pool with one reference, the producer's. Only
+ * the producer allocates, a block found free can't be taken from under it
+ * @return the block or NULL if every block is referenced
+ */
+sample_bus_block_t *sample_bus_alloc(void)
+{
+    sample_bus_block_t *p_block = NULL;
+    uint8_t used = 1;
+
+    for (uint8_t i = 0; i < SAMPLE_BUS_BLOCKS; i++)
+    {
+        if (m_blocks[i].refs > 0)
+            used++;
+        else if (p_block == NULL)
+            p_block = &m_blocks[i];
+    }
+    if (p_block != NULL)
+    {
+        (void) nrf_atomic_u32_store(&p_block->refs, 1);
+        m_stats.refs_max = MAX(m_stats.refs_max, used);
+    }
+    else
+    {
+        m_stats.pool_empty++;
+    }
+
+    return p_block;
+}
+
+/*
+ * Hands the samples of a block to the subscribers of rate, the IN_PLACE
+ * ones before it returns. Called by one producer, which keeps its own
+ * reference and releases it after the call
+ * @param p_block - a pool block or one of the producer's, count and gyro set
+ */
+void sample_bus_publish(sample_bus_block_t *p_block, sample_bus_rate_t rate)
+{
+    sample_bus_block_t *p_thread = NULL;
+    sample_bus_sub_t *p_sub;
+    bool thread = false;
+
+    p_block->rate = rate;
+    m_stats.published++;
+    for (p_sub = m_subs; p_sub != NULL; p_sub = p_sub->p_next)
+    {
+        if (!p_sub->enabled || p_sub->rate != rate)
+            continue;
+        if (p_sub->latency == SAMPLE_BUS_IN_PLACE)
+            p_sub->handler(p_block, p_sub->p_context);
+        else
+            thread = true;
+    }
+    if (!thread)
+        return;
+
+    if (block_pooled(p_block))
+    {
+        p_thread = p_block;
+        sample_bus_retain(p_thread);
+    }
+    else
+    {
+        //the producer reuses its own block, the thread gets a copy
+        p_thread = sample_bus_alloc();
+        if (p_thread != NULL)
+        {
+            p_thread->count = MIN(p_block->count, SAMPLE_BUS_BLOCK_SAMPLES);
+            memcpy(p_thread->samples, p_block->samples, p_thread->count*sizeof(adxl372_accel_data_t));
+            p_thread->rate = rate;
+            p_thread->gyro = p_block->gyro;
+            m_stats.copies++;
+        }
+    }
+    if (p_thread != NULL && sample_bus_queue(p_thread))
+        return;
+
+    if (p_thread != NULL)
+        sample_bus_release(p_thread);
+    for (p_sub = m_subs; p_sub != NULL; p_sub = p_sub->p_next)
+    {
+        if (p_sub->enabled && p_sub->rate == rate && p_sub->latency == SAMPLE_BUS_THREAD)
+            p_sub->dropped++;
+    }
+}
+
+/*
+ * Keeps a block out of the pool past the handler, a block that is not from
+ * the pool can't be kept
+ */
+void sample_bus_retain(sample_bus_block_t *p_block)
+{
+    if (!block_pooled(p_block))
+        return;
+    (void) nrf_atomic_u32_add(&p_block->refs, 1);
+}
+
+/*
+ * Gives back a reference, the last one returns the block to the pool
+ */
+void sample_bus_release(sample_bus_block_t *p_block)
+{
+    if (!block_pooled(p_block))
+        return;
+    (void) nrf_atomic_u32_sub_hs(&p_block->refs, 1);
+}
+
+void sample_bus_stats(sample_bus_stats_t *p_stats)
+{
+    CRITICAL_REGION_ENTER();
+    *p_stats = m_stats;
+    CRITICAL_REGION_EXIT();
+}
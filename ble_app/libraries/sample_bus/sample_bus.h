@@ -0,0 +1,107 @@
+#ifndef SAMPLE_BUS_H
+#define SAMPLE_BUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "adxl372.h"
+#include "icm20649.h"
+#include "nrf_atomic.h"
+
+/* Publish and subscribe of the sensor bursts between the stages of the
+ * capture, so a new consumer of the samples is one callback rather than one
+ * more buffer and copy. The producer reads each fifo burst straight into a
+ * block of a small pool (sample_bus_alloc()) and publishes it at a rate: the
+ * full rate bursts as the trigger saw them, or the accel_decimate outputs.
+ * A subscriber gives the rate it needs and its latency:
+ *   IN_PLACE  called in the producer's context (the spi interrupt) with the
+ *             block as it is, before the next burst can be read into it;
+ *             for the stages that keep up with every burst
+ *   THREAD    called from app_scheduler with a reference to the block, which
+ *             stays out of the pool until every reference is released; a
+ *             block published from elsewhere than the pool (a decimator
+ *             output) is copied once into a pool block for all of them.
+ *             The referenced blocks go to the thread through an nrf_atfifo
+ *             of pointers, the scheduler is only kicked when it has no
+ *             drain pending, so a burst of publishes takes one event slot
+ * A handler that needs the block after it returns takes a reference with
+ * sample_bus_retain() and gives it back with sample_bus_release(). The pool
+ * holds SAMPLE_BUS_BLOCKS, the producer falls back to a block of its own when
+ * the references hold them all, its bursts then only go to the IN_PLACE
+ * subscribers and the THREAD ones count a drop.
+ * Subscribers are added before the first publish, enabling and changing the
+ * rate of one is a single write any context can make. There is one producer
+ * at a time, the only one to take blocks from the pool, so the pool and the
+ * references are atomics and no step of a burst disables the interrupts */
+#ifndef SAMPLE_BUS_BLOCKS
+#define SAMPLE_BUS_BLOCKS           3   //one being read, one in the thread and one spare
+#endif
+#define SAMPLE_BUS_BLOCK_SAMPLES    ADXL_FIFO_MAX_SAMPLES
+
+#define SAMPLE_BUS_SUB_DEF(_name, _rate, _latency, _handler, _context)         \
+static sample_bus_sub_t _name = {                                               \
+    .handler = (_handler),                                                      \
+    .p_context = (_context),                                                    \
+    .rate = (_rate),                                                            \
+    .latency = (_latency),                                                      \
+    .enabled = true,                                                            \
+}
+
+typedef enum {
+    SAMPLE_BUS_FULL = 0,        //the bursts at the sample rate of the profile
+    SAMPLE_BUS_LIVE,            //ACCEL_DECIMATE_LIVE
+    SAMPLE_BUS_ACTIVITY,        //ACCEL_DECIMATE_ACTIVITY
+    SAMPLE_BUS_RATES
+} sample_bus_rate_t;
+
+typedef enum {
+    SAMPLE_BUS_IN_PLACE = 0,
+    SAMPLE_BUS_THREAD
+} sample_bus_latency_t;
+
+typedef struct {
+    adxl372_accel_data_t *samples;
+    uint16_t count;
+    uint8_t rate;               //sample_bus_rate_t it was published at
+    nrf_atomic_u32_t refs;      //0 while in the pool, never counted for a block of the producer's
+    icm20649_data_t gyro;       //newest icm20649 read with the samples
+} sample_bus_block_t;
+
+typedef void (*sample_bus_handler_t)(sample_bus_block_t *p_block, void *p_context);
+
+typedef struct sample_bus_sub_s {
+    sample_bus_handler_t handler;
+    void *p_context;
+    volatile uint8_t rate;
+    uint8_t latency;
+    volatile bool enabled;
+    uint32_t dropped;           //THREAD blocks lost to an empty pool or a full queue
+    struct sample_bus_sub_s *p_next;
+} sample_bus_sub_t;
+
+typedef struct {
+    uint32_t published;
+    uint32_t copies;            //blocks copied into the pool for the THREAD subscribers
+    uint32_t pool_empty;        //allocs that found every block referenced
+    uint32_t sched_full;        //kicks the scheduler queue had no room for, the blocks waited for the next publish
+    uint8_t refs_max;           //pool blocks referenced at once
+} sample_bus_stats_t;
+
+void sample_bus_init(void);
+
+void sample_bus_subscribe(sample_bus_sub_t *p_sub);
+
+void sample_bus_enable(sample_bus_sub_t *p_sub, bool enable);
+
+void sample_bus_rate_set(sample_bus_sub_t *p_sub, sample_bus_rate_t rate);
+
+sample_bus_block_t *sample_bus_alloc(void);
+
+void sample_bus_publish(sample_bus_block_t *p_block, sample_bus_rate_t rate);
+
+void sample_bus_retain(sample_bus_block_t *p_block);
+
+void sample_bus_release(sample_bus_block_t *p_block);
+
+void sample_bus_stats(sample_bus_stats_t *p_stats);
+
+#endif //SAMPLE_BUS_H
@@ -0,0 +1,343 @@
+//-------------------------------------------
+// Title: sample_clock.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Fixed rate sampling without the cpu. Per channel one PPI
+// channel starts the SPIM and pulls its chip select low on the clock
+// compare, a second one releases the chip select on SPIM END. The END
+// events of the first channel are counted and the count compare stops
+// the clock. The HFCLK keeps running with the timer, so the EasyDMA
+// transfers are not affected by nRF52 anomaly 109 while the cpu sleeps.
+// The sync output takes the first two PPI channels, they stay connected
+// while reads come and go on the same compare
+//-------------------------------------------
+#include <string.h>
+#include "sample_clock.h"
+#include "nrf_drv_ppi.h"
+#include "nrf_drv_gpiote.h"
+#include "nrf_spim.h"
+#include "nrf_gpio.h"
+#include "nrf_delay.h"
+#include "spi_driver.h"
+
+#define SAMPLE_CLOCK_FREQ_HZ    16000000UL
+#define SAMPLE_CLOCK_SYNC_PPI   2
+#define SAMPLE_CLOCK_PPI_COUNT  (SAMPLE_CLOCK_SYNC_PPI + 2*SAMPLE_CLOCK_MAX_CHANNELS + 1)
+
+static sample_clock_channel_t m_channels[SAMPLE_CLOCK_MAX_CHANNELS];
+static uint8_t m_num_channels = 0;
+static nrf_ppi_channel_t m_ppi[SAMPLE_CLOCK_PPI_COUNT];
+static uint8_t m_num_ppi = 0;
+static uint8_t m_num_sync_ppi = 0;  //m_ppi[0..] of the sync output, the reads come after them
+static uint32_t m_period_us;
+static uint32_t m_sync_rate_hz = 0; //0 without the sync output
+static uint8_t m_sync_pin;
+
+static NRF_SPIM_Type * sample_clock_spim(sample_clock_channel_t const * p_channel)
+{
+    return p_channel->spi->u.spim.p_reg;
+}
+
+/*
+ * Allocates, connects and enables one PPI channel, fork_tep may be 0
+ * @return 0 if success otherwise -1
+ */
+static int8_t sample_clock_connect(uint32_t eep, uint32_t tep, uint32_t fork_tep)
+{
+    nrf_ppi_channel_t channel;
+
+    if (nrf_drv_ppi_channel_alloc(&channel) != NRF_SUCCESS)
+        return -1;
+    m_ppi[m_num_ppi++] = channel;
+
+    if (nrf_drv_ppi_channel_assign(channel, eep, tep) != NRF_SUCCESS)
+        return -1;
+    if (fork_tep != 0 && nrf_drv_ppi_channel_fork_assign(channel, fork_tep) != NRF_SUCCESS)
+        return -1;
+
+    return (nrf_drv_ppi_channel_enable(channel) == NRF_SUCCESS) ? 0 : -1;
+}
+
+/*
+ * Hands the chip select to a GPIOTE task, idle high
+ * @return 0 if success otherwise -1
+ */
+static int8_t sample_clock_cs_init(uint8_t cs_pin)
+{
+    nrf_drv_gpiote_out_config_t cs_config = GPIOTE_CONFIG_OUT_TASK_TOGGLE(true);
+
+    if (!nrf_drv_gpiote_is_init() && nrf_drv_gpiote_init() != NRF_SUCCESS)
+        return -1;
+    if (nrf_drv_gpiote_out_init(cs_pin, &cs_config) != NRF_SUCCESS)
+        return -1;
+    nrf_drv_gpiote_out_task_enable(cs_pin);
+
+    return 0;
+}
+
+/*
+ * Gives the chip select back to the spi driver as a plain gpio
+ */
+static void sample_clock_cs_uninit(uint8_t cs_pin)
+{
+    nrf_drv_gpiote_out_task_disable(cs_pin);
+    nrf_drv_gpiote_out_uninit(cs_pin);
+    spi_cfg_cs_pins(cs_pin);
+}
+
+static int8_t sample_clock_channel_init(sample_clock_channel_t const * p_channel, bool count_reads)
+{
+    NRF_SPIM_Type * p_spim = sample_clock_spim(p_channel);
+    uint32_t count_task = 0;
+
+    //the spi driver does not see these transfers, END must not reach its handler
+    spi_select_burst_frequency(p_channel->spi);
+    nrf_spim_int_disable(p_spim, NRF_SPIM_INT_END_MASK);
+    nrf_spim_event_clear(p_spim, NRF_SPIM_EVENT_END);
+    nrf_spim_tx_buffer_set(p_spim, p_channel->p_tx_buf, p_channel->tx_length);
+    nrf_spim_rx_buffer_set(p_spim, p_channel->p_rx_list, p_channel->rx_length);
+    nrf_spim_tx_list_disable(p_spim);
+    nrf_spim_rx_list_enable(p_spim);
+
+    if (count_reads)
+        count_task = (uint32_t) nrf_timer_task_address_get(SAMPLE_CLOCK_COUNTER, NRF_TIMER_TASK_COUNT);
+
+    if (sample_clock_connect((uint32_t) nrf_timer_event_address_get(SAMPLE_CLOCK_TIMER, NRF_TIMER_EVENT_COMPARE0),
+                             nrf_spim_task_address_get(p_spim, NRF_SPIM_TASK_START),
+                             nrf_drv_gpiote_clr_task_addr_get(p_channel->cs_pin)) < 0)
+        return -1;
+
+    return sample_clock_connect(nrf_spim_event_address_get(p_spim, NRF_SPIM_EVENT_END),
+                                nrf_drv_gpiote_set_task_addr_get(p_channel->cs_pin),
+                                count_task);
+}
+
+/*
+ * Sets up the clock timer at rate_hz, stopped and cleared
+ */
+static void sample_clock_timer_init(uint32_t rate_hz)
+{
+    m_period_us = 1000000UL / rate_hz;
+
+    //sample clock, cleared on every compare
+    nrf_timer_task_trigger(SAMPLE_CLOCK_TIMER, NRF_TIMER_TASK_STOP);
+    nrf_timer_mode_set(SAMPLE_CLOCK_TIMER, NRF_TIMER_MODE_TIMER);
+    nrf_timer_bit_width_set(SAMPLE_CLOCK_TIMER, NRF_TIMER_BIT_WIDTH_32);
+    nrf_timer_frequency_set(SAMPLE_CLOCK_TIMER, NRF_TIMER_FREQ_16MHz);
+    nrf_timer_cc_write(SAMPLE_CLOCK_TIMER, NRF_TIMER_CC_CHANNEL0, SAMPLE_CLOCK_FREQ_HZ / rate_hz);
+    nrf_timer_shorts_enable(SAMPLE_CLOCK_TIMER, NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK);
+    nrf_timer_event_clear(SAMPLE_CLOCK_TIMER, NRF_TIMER_EVENT_COMPARE0);
+    nrf_timer_task_trigger(SAMPLE_CLOCK_TIMER, NRF_TIMER_TASK_CLEAR);
+}
+
+/*
+ * Frees the PPI channels from the first one on
+ */
+static void sample_clock_ppi_free(uint8_t first)
+{
+    for (int i = first; i < m_num_ppi; ++i)
+    {
+        nrf_drv_ppi_channel_disable(m_ppi[i]);
+        nrf_drv_ppi_channel_free(m_ppi[i]);
+    }
+    m_num_ppi = first;
+}
+
+/*
+ * Returns the timers, PPI channels, chip selects and SPIM instances to their idle state.
+ * The sync output carries on, its timer is started again where it stopped
+ */
+static void sample_clock_release(void)
+{
+    nrf_timer_task_trigger(SAMPLE_CLOCK_TIMER, NRF_TIMER_TASK_STOP);
+    if (m_sync_rate_hz == 0)
+        nrf_timer_task_trigger(SAMPLE_CLOCK_TIMER, NRF_TIMER_TASK_SHUTDOWN);
+
+    //a read started by the last compare is over within one period
+    nrf_delay_us(m_period_us + 1);
+
+    sample_clock_ppi_free(m_num_sync_ppi);
+
+    for (int i = 0; i < m_num_channels; ++i)
+    {
+        NRF_SPIM_Type * p_spim = sample_clock_spim(&m_channels[i]);
+
+        nrf_spim_event_clear(p_spim, NRF_SPIM_EVENT_STARTED);
+        nrf_spim_event_clear(p_spim, NRF_SPIM_EVENT_END);
+        nrf_spim_rx_list_disable(p_spim);
+        sample_clock_cs_uninit(m_channels[i].cs_pin);
+    }
+    m_num_channels = 0;
+
+    if (m_sync_rate_hz != 0)
+        nrf_timer_task_trigger(SAMPLE_CLOCK_TIMER, NRF_TIMER_TASK_START);
+}
+
+/**
+ * @brief Starts reading every channel at rate_hz until num_samples reads are in the buffers.
+ * The first read happens one period after the call, read n of a channel lands at
+ * p_rx_list + n*rx_length. Every read has to finish within one period.
+ * The cpu is free (or asleep) while the clock runs. With the sync output running the
+ * reads join its compares, rate_hz has to be its rate, and the output pauses from
+ * the last read to sample_clock_stop
+ * @return 0 if success, -1 if no PPI or GPIOTE channel is left, -2 if the parameters are invalid
+ */
+int8_t sample_clock_start(sample_clock_channel_t const * p_channels, uint8_t num_channels,
+                          uint32_t rate_hz, uint16_t num_samples)
+{
+    ret_code_t err_code;
+
+    if (num_channels == 0 || num_channels > SAMPLE_CLOCK_MAX_CHANNELS || m_num_channels != 0
+        || rate_hz == 0 || rate_hz > SAMPLE_CLOCK_MAX_RATE_HZ || num_samples == 0
+        || (m_sync_rate_hz != 0 && rate_hz != m_sync_rate_hz))
+        return -2;
+    for (int i = 0; i < num_channels; ++i)
+    {
+        if (!p_channels[i].spi->use_easy_dma || !spi_is_idle(p_channels[i].spi))
+            return -2;
+    }
+
+    err_code = nrf_drv_ppi_init();
+    if (err_code != NRF_SUCCESS && err_code != NRF_ERROR_MODULE_ALREADY_INITIALIZED)
+        return -1;
+
+    //the sync output keeps its phase, its timer only pauses while the reads are connected
+    if (m_sync_rate_hz == 0)
+        sample_clock_timer_init(rate_hz);
+    else
+        nrf_timer_task_trigger(SAMPLE_CLOCK_TIMER, NRF_TIMER_TASK_STOP);
+
+    //read counter, stops the clock after the last read
+    nrf_timer_task_trigger(SAMPLE_CLOCK_COUNTER, NRF_TIMER_TASK_STOP);
+    nrf_timer_mode_set(SAMPLE_CLOCK_COUNTER, NRF_TIMER_MODE_COUNTER);
+    nrf_timer_bit_width_set(SAMPLE_CLOCK_COUNTER, NRF_TIMER_BIT_WIDTH_16);
+    nrf_timer_cc_write(SAMPLE_CLOCK_COUNTER, NRF_TIMER_CC_CHANNEL0, num_samples);
+    nrf_timer_event_clear(SAMPLE_CLOCK_COUNTER, NRF_TIMER_EVENT_COMPARE0);
+    nrf_timer_task_trigger(SAMPLE_CLOCK_COUNTER, NRF_TIMER_TASK_CLEAR);
+    nrf_timer_task_trigger(SAMPLE_CLOCK_COUNTER, NRF_TIMER_TASK_START);
+
+    memcpy(m_channels, p_channels, num_channels * sizeof(sample_clock_channel_t));
+    for (int i = 0; i < num_channels; ++i)
+    {
+        if (sample_clock_cs_init(m_channels[i].cs_pin) < 0)
+        {
+            sample_clock_release();
+            return -1;
+        }
+        m_num_channels = i + 1;
+        if (sample_clock_channel_init(&m_channels[i], i == 0) < 0)
+        {
+            sample_clock_release();
+            return -1;
+        }
+    }
+    if (sample_clock_connect((uint32_t) nrf_timer_event_address_get(SAMPLE_CLOCK_COUNTER, NRF_TIMER_EVENT_COMPARE0),
+                             (uint32_t) nrf_timer_task_address_get(SAMPLE_CLOCK_TIMER, NRF_TIMER_TASK_STOP), 0) < 0)
+    {
+        sample_clock_release();
+        return -1;
+    }
+
+    nrf_timer_task_trigger(SAMPLE_CLOCK_TIMER, NRF_TIMER_TASK_START);
+
+    return 0;
+}
+
+/*
+ * @return reads completed so far, the clock has stopped once this reaches num_samples
+ */
+uint16_t sample_clock_count(void)
+{
+    nrf_timer_task_trigger(SAMPLE_CLOCK_COUNTER, nrf_timer_capture_task_get(NRF_TIMER_CC_CHANNEL1));
+
+    return nrf_timer_cc_read(SAMPLE_CLOCK_COUNTER, NRF_TIMER_CC_CHANNEL1);
+}
+
+/**
+ * @brief Stops the clock and hands the spi instances back to the spi driver
+ * @return number of complete reads in every channel's buffer
+ */
+uint16_t sample_clock_stop(void)
+{
+    uint16_t count;
+
+    nrf_timer_task_trigger(SAMPLE_CLOCK_TIMER, NRF_TIMER_TASK_STOP);
+    sample_clock_release();
+    count = sample_clock_count();
+    nrf_timer_task_trigger(SAMPLE_CLOCK_COUNTER, NRF_TIMER_TASK_STOP);
+    nrf_timer_task_trigger(SAMPLE_CLOCK_COUNTER, NRF_TIMER_TASK_SHUTDOWN);
+
+    return count;
+}
+
+/**
+ * @brief Drives sync_pin as a clock output at rate_hz until sample_clock_sync_stop, e.g.
+ * the adxl372 external sync input (adxl372_set_ext_sync). The pin goes high half a period
+ * ahead of every compare, a sample converted on the rising edge is ready for the read
+ * sample_clock_start puts on the compare. The timer counts the HFCLK like the timebase,
+ * the edges keep their place in its time
+ * @return 0 if success, -1 if no PPI or GPIOTE channel is left, -2 if the clock is busy or the rate is invalid
+ */
+int8_t sample_clock_sync_start(uint8_t sync_pin, uint32_t rate_hz)
+{
+    nrf_drv_gpiote_out_config_t sync_config = GPIOTE_CONFIG_OUT_TASK_TOGGLE(false);
+    ret_code_t err_code;
+
+    if (m_sync_rate_hz != 0 || m_num_channels != 0 || rate_hz == 0 || rate_hz > SAMPLE_CLOCK_MAX_RATE_HZ)
+        return -2;
+
+    err_code = nrf_drv_ppi_init();
+    if (err_code != NRF_SUCCESS && err_code != NRF_ERROR_MODULE_ALREADY_INITIALIZED)
+        return -1;
+    if (!nrf_drv_gpiote_is_init() && nrf_drv_gpiote_init() != NRF_SUCCESS)
+        return -1;
+    if (nrf_drv_gpiote_out_init(sync_pin, &sync_config) != NRF_SUCCESS)
+        return -1;
+    nrf_drv_gpiote_out_task_enable(sync_pin);
+
+    sample_clock_timer_init(rate_hz);
+    nrf_timer_cc_write(SAMPLE_CLOCK_TIMER, NRF_TIMER_CC_CHANNEL1, SAMPLE_CLOCK_FREQ_HZ / rate_hz / 2);
+    nrf_timer_event_clear(SAMPLE_CLOCK_TIMER, NRF_TIMER_EVENT_COMPARE1);
+
+    if (sample_clock_connect((uint32_t) nrf_timer_event_address_get(SAMPLE_CLOCK_TIMER, NRF_TIMER_EVENT_COMPARE1),
+                             nrf_drv_gpiote_set_task_addr_get(sync_pin), 0) < 0
+        || sample_clock_connect((uint32_t) nrf_timer_event_address_get(SAMPLE_CLOCK_TIMER, NRF_TIMER_EVENT_COMPARE0),
+                                nrf_drv_gpiote_clr_task_addr_get(sync_pin), 0) < 0)
+    {
+        sample_clock_ppi_free(0);
+        nrf_drv_gpiote_out_task_disable(sync_pin);
+        nrf_drv_gpiote_out_uninit(sync_pin);
+        return -1;
+    }
+    m_num_sync_ppi = m_num_ppi;
+    m_sync_pin = sync_pin;
+    m_sync_rate_hz = rate_hz;
+
+    nrf_timer_task_trigger(SAMPLE_CLOCK_TIMER, NRF_TIMER_TASK_START);
+
+    return 0;
+}
+
+/**
+ * @brief Stops the sync output and leaves its pin driven low, nothing to do without it
+ * @return 0 if success otherwise -2 if the reads are still running
+ */
+int8_t sample_clock_sync_stop(void)
+{
+    if (m_num_channels != 0)
+        return -2;
+    if (m_sync_rate_hz == 0)
+        return 0;
+
+    nrf_timer_task_trigger(SAMPLE_CLOCK_TIMER, NRF_TIMER_TASK_STOP);
+    nrf_timer_task_trigger(SAMPLE_CLOCK_TIMER, NRF_TIMER_TASK_SHUTDOWN);
+    sample_clock_ppi_free(0);
+    m_num_sync_ppi = 0;
+    m_sync_rate_hz = 0;
+
+    nrf_drv_gpiote_out_task_disable(m_sync_pin);
+    nrf_drv_gpiote_out_uninit(m_sync_pin);
+    nrf_gpio_pin_clear(m_sync_pin);
+    nrf_gpio_cfg_output(m_sync_pin);
+
+    return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef SAMPLE_CLOCK_H
+#define SAMPLE_CLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nrf_timer.h"
+#include "nrf_drv_spi.h"
+
+/* Hardware sample clock. A TIMER compare starts the SPIM reads of every channel
+ * through PPI and GPIOTE drives the chip selects, EasyDMA ArrayList moves each
+ * read to the next slot of the channel's buffer. A second TIMER counts the
+ * reads and stops the clock once the buffers are full, so samples land exactly
+ * one period apart no matter what the cpu is doing. The timer can also drive a
+ * pin at the same rate between the reads, a sync output that has a sensor
+ * convert on the same clock as the reads, see sample_clock_sync_start */
+#ifndef SAMPLE_CLOCK_TIMER
+#define SAMPLE_CLOCK_TIMER      NRF_TIMER2 /* TIMER0 is taken by the softdevice, TIMER1 by the timebase */
+#endif
+#ifndef SAMPLE_CLOCK_COUNTER
+#define SAMPLE_CLOCK_COUNTER    NRF_TIMER3
+#endif
+#define SAMPLE_CLOCK_MAX_CHANNELS   2
+#define SAMPLE_CLOCK_MAX_RATE_HZ    32000
+
+/* One spi read repeated on every clock tick */
+typedef struct {
+    nrf_drv_spi_t const * spi;  /* queue must be idle, the clock owns the instance while running */
+    uint8_t cs_pin;
+    uint8_t const * p_tx_buf;   /* same command every sample, in ram for EasyDMA */
+    uint8_t tx_length;
+    uint8_t * p_rx_list;        /* num_samples * rx_length bytes */
+    uint8_t rx_length;          /* bytes per sample, including the ones clocked in during the command */
+} sample_clock_channel_t;
+
+int8_t sample_clock_start(sample_clock_channel_t const * p_channels, uint8_t num_channels,
+                          uint32_t rate_hz, uint16_t num_samples);
+
+uint16_t sample_clock_count(void);
+
+uint16_t sample_clock_stop(void);
+
+int8_t sample_clock_sync_start(uint8_t sync_pin, uint32_t rate_hz);
+
+int8_t sample_clock_sync_stop(void);
+
+#endif //SAMPLE_CLOCK_H
@@ -0,0 +1,84 @@
+//-------------------------------------------
+// Title: sample_ring.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Fixed size ring buffer of adxl372 samples. 
+// The oldest samples are overwritten once the ring is full
+// so it always contains the last `size` samples pushed.
+//-------------------------------------------
+#include <string.h>
+#include "sample_ring.h"
+
+void sample_ring_init(sample_ring_t *ring, adxl372_accel_data_t *buf, uint16_t size)
+{
+    ring->buf = buf;
+    ring->size = size;
+    sample_ring_reset(ring);
+}
+
+void sample_ring_reset(sample_ring_t *ring)
+{
+    ring->head = 0;
+    ring->count = 0;
+}
+
+/*
+ * Pushes samples into the ring, overwriting the oldest when full
+ */
+void sample_ring_push(sample_ring_t *ring, adxl372_accel_data_t const *samples, uint16_t num_samples)
+{
+    uint16_t chunk;
+
+    if (ring->size == 0)
+        return;
+
+    //only the last `size` samples can survive
+    if (num_samples > ring->size)
+    {
+        samples += num_samples - ring->size;
+        num_samples = ring->size;
+    }
+
+    while (num_samples > 0)
+    {
+        chunk = ring->size - ring->head;
+        if (chunk > num_samples)
+            chunk = num_samples;
+
+        memcpy(&ring->buf[ring->head], samples, chunk*sizeof(adxl372_accel_data_t));
+        ring->head = (ring->head + chunk) % ring->size;
+        samples += chunk;
+        num_samples -= chunk;
+
+        ring->count = ((ring->count + chunk) > ring->size) ? ring->size : (ring->count + chunk);
+    }
+}
+
+uint16_t sample_ring_count(sample_ring_t const *ring)
+{
+    return ring->count;
+}
+
+/*
+ * Copies the newest samples out of the ring in chronological order (oldest first)
+ * @param max_samples - size of dst, the newest max_samples are copied if the ring holds more
+ * @return number of samples copied
+ */
+uint16_t sample_ring_copy_out(sample_ring_t const *ring, adxl372_accel_data_t *dst, uint16_t max_samples)
+{
+    uint16_t num_samples = (ring->count < max_samples) ? ring->count : max_samples;
+    uint16_t start;
+    uint16_t chunk;
+
+    if (num_samples == 0)
+        return 0;
+
+    start = (ring->head + ring->size - num_samples) % ring->size;
+    chunk = ring->size - start;
+    if (chunk > num_samples)
+        chunk = num_samples;
+
+    memcpy(dst, &ring->buf[start], chunk*sizeof(adxl372_accel_data_t));
+    memcpy(&dst[chunk], ring->buf, (num_samples - chunk)*sizeof(adxl372_accel_data_t));
+
+    return num_samples;
+}
@@ -0,0 +1,28 @@
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "adxl372.h"
+
+/* Ring buffer of adxl372 samples that always holds the most recent
+ * `size` samples. Used to keep a pre-trigger window while the fifo
+ * is streaming so the onset of an impact is not lost */
+typedef struct {
+    adxl372_accel_data_t *buf;
+    uint16_t size;  /* capacity in samples */
+    uint16_t head;  /* index of the next write */
+    uint16_t count; /* number of valid samples, at most size */
+} sample_ring_t;
+
+void sample_ring_init(sample_ring_t *ring, adxl372_accel_data_t *buf, uint16_t size);
+
+void sample_ring_reset(sample_ring_t *ring);
+
+void sample_ring_push(sample_ring_t *ring, adxl372_accel_data_t const *samples, uint16_t num_samples);
+
+uint16_t sample_ring_count(sample_ring_t const *ring);
+
+uint16_t sample_ring_copy_out(sample_ring_t const *ring, adxl372_accel_data_t *dst, uint16_t max_samples);
+
+#endif //SAMPLE_RING_H
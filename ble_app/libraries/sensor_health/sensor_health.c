@@ -0,0 +1,111 @@
+//-------------------------------------------
+// Title: sensor_health.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Error counts and out of service state of each sensor,
+// a sensor that keeps failing is left out of the capture and retried
+// with an exponential backoff until it answers again.
+//-------------------------------------------
+#include <string.h>
+#include "sensor_health.h"
+#include "nrf_log.h"
+
+static char const * const m_sensor_names[SENSOR_COUNT] = {"accel", "gyro", "flash"};
+
+void sensor_health_init(sensor_health_t *health)
+{
+    memset(health, 0, sizeof(sensor_health_t));
+}
+
+/*
+ * Starts the backoff of a sensor that just went out
+ */
+static void health_go_out(sensor_health_entry_t *entry, sensor_id_t sensor)
+{
+    entry->out = true;
+    entry->outages++;
+    entry->backoff = SENSOR_HEALTH_BACKOFF_MIN;
+    entry->wait = entry->backoff;
+    NRF_LOG_WARNING("HEALTH: %s out after %d errors", m_sensor_names[sensor], entry->errors);
+}
+
+/*
+ * Adds the result of a call to the sensor. While the sensor is out a failure
+ * doubles the backoff and a success puts the sensor back
+ * @return true if the sensor is in service after it
+ */
+bool sensor_health_report(sensor_health_t *health, sensor_id_t sensor, bool ok)
+{
+    sensor_health_entry_t *entry = &health->sensors[sensor];
+
+    if (ok)
+    {
+        entry->consecutive = 0;
+        if (entry->out)
+        {
+            entry->out = false;
+            entry->recoveries++;
+            NRF_LOG_INFO("HEALTH: %s back", m_sensor_names[sensor]);
+        }
+        return true;
+    }
+
+    entry->errors++;
+    if (entry->consecutive < UINT8_MAX)
+        entry->consecutive++;
+    if (entry->out)
+    {
+        entry->backoff = (entry->backoff >= SENSOR_HEALTH_BACKOFF_MAX / 2) ? SENSOR_HEALTH_BACKOFF_MAX : entry->backoff * 2;
+        entry->wait = entry->backoff;
+    }
+    else if (entry->consecutive >= SENSOR_HEALTH_FAIL_LIMIT)
+    {
+        health_go_out(entry, sensor);
+    }
+    return !entry->out;
+}
+
+/*
+ * Takes a sensor out at once, e.g. when its self test failed
+ */
+void sensor_health_take_out(sensor_health_t *health, sensor_id_t sensor)
+{
+    sensor_health_entry_t *entry = &health->sensors[sensor];
+
+    entry->errors++;
+    if (!entry->out)
+        health_go_out(entry, sensor);
+}
+
+bool sensor_health_ok(sensor_health_t const *health, sensor_id_t sensor)
+{
+    return !health->sensors[sensor].out;
+}
+
+/*
+ * Counts one retry opportunity of a sensor that is out, the caller retries
+ * it when this returns true and reports the result
+ * @return true if the backoff has run out
+ */
+bool sensor_health_retry_due(sensor_health_t *health, sensor_id_t sensor)
+{
+    sensor_health_entry_t *entry = &health->sensors[sensor];
+
+    if (!entry->out)
+        return false;
+    if (entry->wait > 0)
+    {
+        entry->wait--;
+        return false;
+    }
+    return true;
+}
+
+void sensor_health_log(sensor_health_t const *health)
+{
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        sensor_health_entry_t const *entry = &health->sensors[i];
+        NRF_LOG_INFO("HEALTH: %s %s, %d errors, %d outages, %d recoveries", m_sensor_names[i],
+                     entry->out ? "out" : "ok", entry->errors, entry->outages, entry->recoveries);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef SENSOR_HEALTH_H
+#define SENSOR_HEALTH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Fault tracking of the sensors so one flaky part degrades the capture
+ * instead of stopping it. Every driver call the application checks is
+ * reported as a success or a failure, SENSOR_HEALTH_FAIL_LIMIT failures in a
+ * row take the sensor out and the application captures without it: accel
+ * only without the gyro, kept in ram and printed without the flash. A sensor
+ * that is out is retried with an exponential backoff counted in retry
+ * opportunities, one per sensor_health_retry_due() call, so the caller picks
+ * the pace (e.g. once per fifo burst or per poll of a resting loop) and the
+ * module needs no clock. The first retry waits SENSOR_HEALTH_BACKOFF_MIN of
+ * them, every failed retry doubles it up to SENSOR_HEALTH_BACKOFF_MAX and a
+ * successful one puts the sensor back. The bus errors are counted by
+ * spi_driver and twi_driver themselves */
+#define SENSOR_HEALTH_FAIL_LIMIT    3     //failures in a row that take a sensor out
+#define SENSOR_HEALTH_BACKOFF_MIN   1     //opportunities skipped before the first retry
+#define SENSOR_HEALTH_BACKOFF_MAX   256
+
+typedef enum {
+    SENSOR_ACCEL = 0,
+    SENSOR_GYRO,
+    SENSOR_FLASH,
+    SENSOR_COUNT
+} sensor_id_t;
+
+typedef struct {
+    uint32_t errors;        /* failed calls since startup */
+    uint32_t outages;       /* times taken out */
+    uint32_t recoveries;    /* retries that brought it back */
+    uint16_t backoff;       /* opportunities between retries while out */
+    uint16_t wait;          /* opportunities left before the next retry */
+    uint8_t consecutive;    /* failures in a row */
+    bool out;
+} sensor_health_entry_t;
+
+typedef struct {
+    sensor_health_entry_t sensors[SENSOR_COUNT];
+} sensor_health_t;
+
+void sensor_health_init(sensor_health_t *health);
+
+bool sensor_health_report(sensor_health_t *health, sensor_id_t sensor, bool ok);
+
+void sensor_health_take_out(sensor_health_t *health, sensor_id_t sensor);
+
+bool sensor_health_ok(sensor_health_t const *health, sensor_id_t sensor);
+
+bool sensor_health_retry_due(sensor_health_t *health, sensor_id_t sensor);
+
+void sensor_health_log(sensor_health_t const *health);
+
+#endif //SENSOR_HEALTH_H
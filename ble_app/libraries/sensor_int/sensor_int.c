@@ -0,0 +1,126 @@
+//-------------------------------------------
+// Title: sensor_int.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: The sensor interrupt lines on the GPIOTE PORT event with
+// SENSE while armed, moved to IN channels only while their timing matters.
+//-------------------------------------------
+#include "sensor_int.h"
+#include "nrf_drv_gpiote.h"
+#include "app_util_platform.h"
+
+typedef struct {
+    uint32_t pin;
+    bool rising;
+    bool precise;               /* on an IN channel */
+    nrf_gpio_pin_pull_t pull;
+    sensor_int_handler_t handler;
+} sensor_int_line_t;
+
+static sensor_int_line_t m_lines[SENSOR_INT_MAX_LINES];
+static uint8_t m_num_lines = 0;
+
+static sensor_int_line_t *sensor_int_find(uint32_t pin)
+{
+    uint8_t i;
+
+    for (i = 0; i < m_num_lines; i++)
+    {
+        if (m_lines[i].pin == pin)
+            return &m_lines[i];
+    }
+    return NULL;
+}
+
+static void sensor_int_gpiote_handler(nrf_drv_gpiote_pin_t pin, nrf_gpiote_polarity_t action)
+{
+    sensor_int_line_t const *p_line = sensor_int_find(pin);
+
+    UNUSED_PARAMETER(action);
+    if (p_line != NULL)
+        p_line->handler(pin);
+}
+
+// Sets the line up in its mode and enables it
+static int8_t sensor_int_enable(sensor_int_line_t const *p_line)
+{
+    nrf_drv_gpiote_in_config_t in_config = GPIOTE_CONFIG_IN_SENSE_LOTOHI(p_line->precise);
+
+    if (!p_line->rising)
+        in_config.sense = NRF_GPIOTE_POLARITY_HITOLO;
+    in_config.pull = p_line->pull;
+    if (nrf_drv_gpiote_in_init(p_line->pin, &in_config, sensor_int_gpiote_handler) != NRF_SUCCESS)
+        return -1;
+    nrf_drv_gpiote_in_event_enable(p_line->pin, true);
+    return 0;
+}
+
+/*
+ * Adds a sensor interrupt line as a PORT event, or sets it up again with a new
+ * handler, e.g. after a reconfiguration of its sensor. Initializes GPIOTE
+ * @param rising - the line is active high, otherwise active low
+ * @param handler - called on the active edge
+ * @return 0 if success, -1 if GPIOTE has no room for it, -3 if SENSOR_INT_MAX_LINES are taken
+ */
+int8_t sensor_int_add(uint32_t pin, bool rising, nrf_gpio_pin_pull_t pull, sensor_int_handler_t handler)
+{
+    sensor_int_line_t *p_line = sensor_int_find(pin);
+
+    if (!nrf_drv_gpiote_is_init() && nrf_drv_gpiote_init() != NRF_SUCCESS)
+        return -1;
+
+    if (p_line != NULL)
+    {
+        nrf_drv_gpiote_in_event_disable(pin);
+        nrf_drv_gpiote_in_uninit(pin);
+    }
+    else
+    {
+        if (m_num_lines == SENSOR_INT_MAX_LINES)
+            return -3;
+        p_line = &m_lines[m_num_lines++];
+    }
+
+    p_line->pin = pin;
+    p_line->rising = rising;
+    p_line->precise = false;
+    p_line->pull = pull;
+    p_line->handler = handler;
+    return sensor_int_enable(p_line);
+}
+
+/*
+ * Moves a line to an IN channel or back to SENSE on the PORT event, thread
+ * context. An edge during the switch can be lost
+ * @param precise - an IN channel, false for SENSE
+ * @return the address of the IN event to route through PPI, 0 for SENSE, a
+ *         line that was never added or no IN channel free (the line is left on SENSE)
+ */
+uint32_t sensor_int_precise(uint32_t pin, bool precise)
+{
+    sensor_int_line_t *p_line = sensor_int_find(pin);
+
+    if (p_line == NULL)
+        return 0;
+    if (p_line->precise != precise)
+    {
+        nrf_drv_gpiote_in_event_disable(pin);
+        nrf_drv_gpiote_in_uninit(pin);
+        p_line->precise = precise;
+        if (sensor_int_enable(p_line) < 0)
+        {
+            p_line->precise = false;
+            (void) sensor_int_enable(p_line);
+        }
+    }
+    return p_line->precise ? nrf_drv_gpiote_in_event_addr_get(pin) : 0;
+}
+
+/*
+ * @return true if the line is on an IN channel
+ */
+bool sensor_int_is_precise(uint32_t pin)
+{
+    sensor_int_line_t const *p_line = sensor_int_find(pin);
+
+    return p_line != NULL && p_line->precise;
+}
@@ -0,0 +1,33 @@
+#ifndef SENSOR_INT_H
+#define SENSOR_INT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nrf_gpio.h"
+
+/* One dispatcher for the interrupt lines of every sensor, the adxl372 INT1
+ * and INT2 and the vcnl4040 INT today, the icm20649 INT once it is wired.
+ * A line is a PORT event by default: the pin has its SENSE set and no GPIOTE
+ * channel, nothing but the sense is powered while the chip is armed or
+ * asleep and the edge wakes the cpu from System ON sleep. The PORT event only
+ * tells that a sensed pin changed, the GPIOTE driver compares the levels and
+ * the handler of the line that moved is called from the GPIOTE interrupt.
+ * sensor_int_precise() moves a line to an IN channel while its timing
+ * matters, e.g. during the capture: the edge is then an event of its own,
+ * clocked from the HFCLK, that PPI can route to a task (a TIMER capture that
+ * latches the instant). The channel draws some tens of uA more than the sense,
+ * the line goes back to SENSE as soon as the precision is not needed. The
+ * handler is the same in both modes. An edge while a line is being switched
+ * can be lost, the owner checks the level afterwards */
+#define SENSOR_INT_MAX_LINES        4
+
+/* Called from the GPIOTE interrupt with the pin of the line */
+typedef void (*sensor_int_handler_t)(uint32_t pin);
+
+int8_t sensor_int_add(uint32_t pin, bool rising, nrf_gpio_pin_pull_t pull, sensor_int_handler_t handler);
+
+uint32_t sensor_int_precise(uint32_t pin, bool precise);
+
+bool sensor_int_is_precise(uint32_t pin);
+
+#endif //SENSOR_INT_H
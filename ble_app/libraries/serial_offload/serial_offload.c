@@ -0,0 +1,211 @@
+//-------------------------------------------
+// Title: serial_offload.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Streams stored impact events over the uart as binary
+// frames instead of formatted log lines. Two chunk buffers ping-pong:
+// EasyDMA sends one while the next is read from the flash, so an
+// offload is bounded by the baud rate rather than by printf.
+// Call from thread context with the flash spi instance initialized.
+//-------------------------------------------
+#include <string.h>
+#include "serial_offload.h"
+#include "nrf_drv_uart.h"
+#include "crc32.h"
+#include "app_error.h"
+#include "app_util.h"
+
+static nrf_drv_uart_t m_uart = NRF_DRV_UART_INSTANCE(0);
+static uint8_t m_chunk[2][SERIAL_OFFLOAD_CHUNK_SIZE]; //in ram for EasyDMA
+static uint8_t m_chunk_index = 0;
+static volatile bool m_tx_busy = false;
+static uint32_t m_crc;
+
+static void serial_offload_handler(nrf_drv_uart_event_t * p_event, void * p_context)
+{
+    if (p_event->type == NRF_DRV_UART_EVT_TX_DONE || p_event->type == NRF_DRV_UART_EVT_ERROR)
+    {
+        m_tx_busy = false;
+    }
+}
+
+static void serial_offload_wait_idle(void)
+{
+    while (m_tx_busy)
+    {
+        __WFE();
+    }
+}
+
+/*
+ * Sends length bytes of the current chunk buffer and switches to the other one,
+ * returns as soon as the transfer is started
+ * @return 0 if success otherwise -1
+ */
+static int8_t serial_offload_send_chunk(uint16_t length)
+{
+    ret_code_t err_code;
+
+    serial_offload_wait_idle();
+    m_tx_busy = true;
+    err_code = nrf_drv_uart_tx(&m_uart, m_chunk[m_chunk_index], length);
+    if (err_code != NRF_SUCCESS)
+    {
+        m_tx_busy = false;
+        return -1;
+    }
+    m_chunk_index ^= 1;
+
+    return 0;
+}
+
+/*
+ * Sends bytes that are already in RAM and adds them to the frame crc
+ * @return 0 if success otherwise -1
+ */
+static int8_t serial_offload_send(void const *data, uint16_t length, bool in_crc)
+{
+    if (in_crc)
+        m_crc = crc32_compute((uint8_t const *) data, length, &m_crc);
+    memcpy(m_chunk[m_chunk_index], data, length);
+
+    return serial_offload_send_chunk(length);
+}
+
+/*
+ * Starts a frame with its sync word, type and payload length
+ * @return 0 if success otherwise -1
+ */
+static int8_t serial_offload_begin_frame(uint8_t type, uint32_t length)
+{
+    uint8_t frame_header[9];
+    uint32_t sync = SERIAL_OFFLOAD_SYNC;
+
+    memcpy(frame_header, &sync, sizeof(sync));
+    frame_header[4] = type;
+    memcpy(&frame_header[5], &length, sizeof(length));
+    m_crc = crc32_compute(&frame_header[4], sizeof(frame_header) - sizeof(sync), NULL);
+
+    return serial_offload_send(frame_header, sizeof(frame_header), false);
+}
+
+/*
+ * Ends a frame with its crc and waits for the uart to finish it
+ * @return 0 if success otherwise -1
+ */
+static int8_t serial_offload_end_frame(void)
+{
+    uint32_t crc = m_crc;
+    int8_t ret;
+
+    ret = serial_offload_send(&crc, sizeof(crc), false);
+    serial_offload_wait_idle();
+
+    return ret;
+}
+
+/*
+ * Initializes the UARTE for the offload, tx only
+ * @return 0 if success otherwise -1
+ */
+int8_t serial_offload_init(void)
+{
+    nrf_drv_uart_config_t config = NRF_DRV_UART_DEFAULT_CONFIG;
+
+    config.pseltxd = SERIAL_OFFLOAD_TX_PIN;
+    config.pselrxd = NRF_UART_PSEL_DISCONNECTED;
+    config.baudrate = SERIAL_OFFLOAD_BAUDRATE;
+    config.hwfc = NRF_UART_HWFC_DISABLED;
+    config.use_easy_dma = true;
+    if (nrf_drv_uart_init(&m_uart, &config, serial_offload_handler) != NRF_SUCCESS)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Sends one stored event as an event frame. The samples are sent as stored,
+ * the host checks them against the data_crc in the header
+ * @return 0 if success, -1 on spi or uart error, -2 if there is no such event,
+ * -3 if its header is corrupt
+ */
+int8_t serial_offload_event(event_store_t *store, uint32_t id)
+{
+    event_store_header_t header;
+    uint32_t chunk_samples;
+    uint32_t num_samples;
+    int8_t ret;
+
+    ret = event_store_get_header(store, id, &header);
+    if (ret < 0)
+        return ret;
+
+    ret = serial_offload_begin_frame(SERIAL_OFFLOAD_FRAME_EVENT,
+                                     sizeof(header) + header.sample_count*header.sample_size);
+    if (ret < 0)
+        return ret;
+    ret = serial_offload_send(&header, sizeof(header), true);
+    if (ret < 0)
+        return ret;
+
+    //whole samples per chunk so raw events can be read by sample
+    chunk_samples = SERIAL_OFFLOAD_CHUNK_SIZE/header.sample_size;
+    for (uint32_t first = 0; first < header.sample_count; first += num_samples)
+    {
+        num_samples = header.sample_count - first;
+        if (num_samples > chunk_samples)
+            num_samples = chunk_samples;
+        //the other chunk is still being sent while this one is read
+        ret = event_store_read_samples(store, id, first, m_chunk[m_chunk_index], num_samples);
+        if (ret < 0)
+            return ret;
+        m_crc = crc32_compute(m_chunk[m_chunk_index], num_samples*header.sample_size, &m_crc);
+        ret = serial_offload_send_chunk(num_samples*header.sample_size);
+        if (ret < 0)
+            return ret;
+    }
+
+    return serial_offload_end_frame();
+}
+
+/*
+ * Sends the end frame so the host knows no event was lost on the way
+ * @return 0 if success otherwise -1
+ */
+int8_t serial_offload_end(uint32_t num_events)
+{
+    int8_t ret;
+
+    ret = serial_offload_begin_frame(SERIAL_OFFLOAD_FRAME_END, sizeof(num_events));
+    if (ret < 0)
+        return ret;
+    ret = serial_offload_send(&num_events, sizeof(num_events), true);
+    if (ret < 0)
+        return ret;
+
+    return serial_offload_end_frame();
+}
+
+/*
+ * Sends a frame that is already built whole, e.g. by live_stream_peek(), and
+ * returns once the last chunk is started so the next frame can be built
+ * meanwhile. The bytes are copied, the frame can be freed on return
+ * @return 0 if success otherwise -1
+ */
+int8_t serial_offload_write(void const *frame, uint16_t length)
+{
+    uint8_t const *p_data = (uint8_t const *) frame;
+    uint16_t chunk;
+    int8_t ret;
+
+    while (length > 0)
+    {
+        chunk = MIN(length, SERIAL_OFFLOAD_CHUNK_SIZE);
+        ret = serial_offload_send(p_data, chunk, false);
+        if (ret < 0)
+            return ret;
+        p_data += chunk;
+        length -= chunk;
+    }
+
+    return 0;
+}
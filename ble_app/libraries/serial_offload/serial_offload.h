@@ -0,0 +1,45 @@
+#ifndef SERIAL_OFFLOAD_H
+#define SERIAL_OFFLOAD_H
+
+#include <stdint.h>
+#include "event_store.h"
+#include "boards.h"
+
+/* Framed binary offload of stored events over the uart, decoded on the host
+ * by tools/offload_decode. All fields are little endian
+ *   sync    4 bytes  SERIAL_OFFLOAD_SYNC
+ *   type    1 byte   SERIAL_OFFLOAD_FRAME_*
+ *   length  4 bytes  payload bytes
+ *   payload          an event frame is the event_store_header_t followed by the
+ *                    samples exactly as stored, still coded if the event is,
+ *                    a summary frame the event_store_header_t and the
+ *                    event_store_preview_t, a live
+ *                    frame the decimated samples of live_stream.h, an
+ *                    activity frame one page of activity_log.h
+ *   crc     4 bytes  crc32 of type, length and payload
+ * The uart log backend owns the same UARTE, so the log has to use RTT instead */
+#define SERIAL_OFFLOAD_SYNC             0x4F464D48 //"HMFO"
+#define SERIAL_OFFLOAD_FRAME_EVENT      0x01
+#define SERIAL_OFFLOAD_FRAME_END        0x02 //payload is the uint32 number of event or summary frames sent
+#define SERIAL_OFFLOAD_FRAME_SUMMARY    0x03 //an event of a query with its preview, without its samples
+#define SERIAL_OFFLOAD_FRAME_LIVE       0x04 //continuous samples, built whole by live_stream
+#define SERIAL_OFFLOAD_FRAME_ACTIVITY   0x05 //an activity_log page, empty at the end of a read of the log
+
+#ifndef SERIAL_OFFLOAD_TX_PIN
+#ifndef TX_PIN_NUMBER
+#error "TX_PIN_NUMBER is not defined by the board header"
+#endif
+#define SERIAL_OFFLOAD_TX_PIN           TX_PIN_NUMBER //the pin of the uart log on the board
+#endif
+#define SERIAL_OFFLOAD_BAUDRATE         NRF_UART_BAUDRATE_1000000
+#define SERIAL_OFFLOAD_CHUNK_SIZE       240 //bytes per EasyDMA transfer, at most 255 on the nRF52832
+
+int8_t serial_offload_init(void);
+
+int8_t serial_offload_event(event_store_t *store, uint32_t id);
+
+int8_t serial_offload_end(uint32_t num_events);
+
+int8_t serial_offload_write(void const *frame, uint16_t length);
+
+#endif //SERIAL_OFFLOAD_H
@@ -0,0 +1,119 @@
+//-------------------------------------------
+// Title: stack_watch.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Main stack painting and the per handler high-water marks of
+// stack_watch.h, with the RAM budget from the linker symbols, so the stack
+// and the capture buffers can be sized from what a board run used.
+//-------------------------------------------
+#include "stack_watch.h"
+#include "app_util_platform.h"
+
+extern uint32_t __data_start__;
+extern uint32_t __bss_end__;
+extern uint32_t __HeapBase;
+extern uint32_t __HeapLimit;
+extern uint32_t __StackLimit;
+extern uint32_t __StackTop;
+
+static stack_watch_ctx_t *m_p_ctxs;
+
+/*
+ * Paints the main stack from its limit up to STACK_WATCH_MARGIN below the
+ * caller. Call first thing in main, before the stack has been deep
+ */
+void __attribute__((noinline)) stack_watch_init(void)
+{
+    uint32_t *p_end = (uint32_t *) ((__get_MSP() - STACK_WATCH_MARGIN) & ~3u);
+
+    for (uint32_t *p = &__StackLimit; p < p_end; p++)
+    {
+        *p = STACK_WATCH_PAINT;
+    }
+}
+
+/*
+ * @return the bytes of the main stack written since stack_watch_init, from
+ * the top down to the deepest word that lost its paint
+ */
+uint32_t stack_watch_main_used(void)
+{
+    uint32_t const *p = &__StackLimit;
+
+    while (p < &__StackTop && *p == STACK_WATCH_PAINT)
+    {
+        p++;
+    }
+    return (uint32_t) &__StackTop - (uint32_t) p;
+}
+
+/*
+ * Fills in the RAM of the app by section and the main stack mark
+ */
+void stack_watch_ram_get(stack_watch_ram_t *p_ram)
+{
+    p_ram->data_bss = (uint32_t) &__bss_end__ - (uint32_t) &__data_start__;
+    p_ram->heap = (uint32_t) &__HeapLimit - (uint32_t) &__HeapBase;
+    p_ram->stack = (uint32_t) &__StackTop - (uint32_t) &__StackLimit;
+    p_ram->stack_used = stack_watch_main_used();
+    p_ram->total = (uint32_t) &__StackTop - (uint32_t) &__data_start__;
+}
+
+/*
+ * Keeps the stack pointer of a handler's entry, a no-op in thread mode where
+ * the tasks run on their own stacks
+ */
+void stack_watch_enter(stack_watch_ctx_t *p_ctx)
+{
+    p_ctx->entry_sp = (__get_IPSR() != 0) ? __get_MSP() : 0;
+}
+
+/*
+ * Finds how deep the handler went since stack_watch_enter and paints the
+ * words below the stack pointer over again
+ */
+void stack_watch_exit(stack_watch_ctx_t *p_ctx)
+{
+    uint32_t *p_sp;
+    uint32_t *p;
+    uint32_t clean = 0;
+    uint32_t used;
+
+    if (p_ctx->entry_sp == 0)
+        return;
+
+    p_sp = (uint32_t *) __get_MSP();
+    p = p_sp;
+    while (p > &__StackLimit && clean < STACK_WATCH_CLEAN_WORDS)
+    {
+        p--;
+        clean = (*p == STACK_WATCH_PAINT) ? clean + 1 : 0;
+    }
+    //the lowest word the handler may have written, above the clean run
+    p += clean;
+    used = p_ctx->entry_sp - (uint32_t) p;
+    for (uint32_t *q = p; q < p_sp; q++)
+    {
+        *q = STACK_WATCH_PAINT;
+    }
+
+    CRITICAL_REGION_ENTER();
+    if (!p_ctx->registered)
+    {
+        p_ctx->p_next = m_p_ctxs;
+        m_p_ctxs = p_ctx;
+        p_ctx->registered = 1;
+    }
+    if (used > p_ctx->max_bytes)
+        p_ctx->max_bytes = used;
+    p_ctx->count++;
+    CRITICAL_REGION_EXIT();
+    p_ctx->entry_sp = 0;
+}
+
+/*
+ * @return the last context registered, NULL if none exited yet
+ */
+stack_watch_ctx_t const *stack_watch_first(void)
+{
+    return m_p_ctxs;
+}
@@ -0,0 +1,70 @@
+#ifndef STACK_WATCH_H
+#define STACK_WATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nrf.h"
+
+/* Stack high-water marks, so the RAM given to the stacks can be sized from a
+ * board run instead of guessed. stack_watch_init() paints the free part of the
+ * main stack with STACK_WATCH_PAINT, stack_watch_main_used() finds the deepest
+ * word ever written over it. The interrupts all run on the main stack, a
+ * handler defined with STACK_WATCH_DEF and wrapped in STACK_WATCH_ENTER and
+ * STACK_WATCH_EXIT gets its own mark: the exit scans down from the handler's
+ * stack pointer to STACK_WATCH_CLEAN_WORDS of paint and repaints what it used,
+ * so each entry is measured afresh. The mark counts from the stack pointer at
+ * STACK_WATCH_ENTER, it leaves out the exception frame and the handler's own
+ * frame above it. It takes in the interrupts that preempted the handler and
+ * what an unwatched one left below it, an upper bound otherwise. A context
+ * registers itself on its first exit, stack_watch_first() and p_next walk them.
+ * The thread tasks keep their own stacks, the task manager marks
+ * those. Built with STACK_WATCH_ENABLED 0 (make STACK_WATCH=0) the handler
+ * macros compile to nothing, the main stack mark stays */
+#ifndef STACK_WATCH_ENABLED
+#define STACK_WATCH_ENABLED         0
+#endif
+#define STACK_WATCH_PAINT           0x5AC5AC5Au
+#define STACK_WATCH_CLEAN_WORDS     8   //untouched paint that ends a handler's use
+#define STACK_WATCH_MARGIN          64  //bytes below the caller of stack_watch_init left unpainted
+
+typedef struct stack_watch_ctx_s {
+    char const *name;
+    struct stack_watch_ctx_s *p_next;   //registered contexts, NULL for the last
+    uint8_t registered;
+    uint32_t entry_sp;                  //0 outside the handler or in thread mode
+    uint32_t max_bytes;
+    uint32_t count;
+} stack_watch_ctx_t;
+
+/* RAM of the app from the linker symbols of nrf_common.ld, in bytes */
+typedef struct {
+    uint32_t data_bss;          //.data, .bss and the .ramfunc code
+    uint32_t heap;
+    uint32_t stack;
+    uint32_t stack_used;        //high-water mark of the main stack
+    uint32_t total;             //from the SoftDevice RAM to the top of RAM
+} stack_watch_ram_t;
+
+#if STACK_WATCH_ENABLED
+#define STACK_WATCH_DEF(_ctx, _label)   stack_watch_ctx_t _ctx = {.name = _label}
+#define STACK_WATCH_ENTER(_ctx)         stack_watch_enter(&_ctx)
+#define STACK_WATCH_EXIT(_ctx)          stack_watch_exit(&_ctx)
+#else
+#define STACK_WATCH_DEF(_ctx, _label)   extern stack_watch_ctx_t _ctx
+#define STACK_WATCH_ENTER(_ctx)
+#define STACK_WATCH_EXIT(_ctx)
+#endif
+
+void stack_watch_init(void);
+
+uint32_t stack_watch_main_used(void);
+
+void stack_watch_ram_get(stack_watch_ram_t *p_ram);
+
+void stack_watch_enter(stack_watch_ctx_t *p_ctx);
+
+void stack_watch_exit(stack_watch_ctx_t *p_ctx);
+
+stack_watch_ctx_t const *stack_watch_first(void);
+
+#endif //STACK_WATCH_H
@@ -0,0 +1,112 @@
+//-------------------------------------------
+// Title: summary_log.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Per window peak, hit count and cumulative exposure records
+// built from the adxl372 peak detect fifo and MAXPEAK registers, for
+// logging a whole practice at a tiny fraction of the full rate capture.
+//-------------------------------------------
+#include <string.h>
+#include "summary_log.h"
+#include "app_util.h"
+
+//stored as it is, tools/offload_decode depends on the layout
+STATIC_ASSERT(sizeof(summary_log_record_t) == 16);
+
+static uint16_t resultant(adxl372_accel_data_t const *sample)
+{
+    uint32_t square = (uint32_t) ((int32_t) sample->x*sample->x + (int32_t) sample->y*sample->y
+                                  + (int32_t) sample->z*sample->z);
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+
+    while (bit > square)
+        bit >>= 2;
+    while (bit != 0)
+    {
+        if (square >= root + bit)
+        {
+            square -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint16_t) root;
+}
+
+/*
+ * @param exposure_limit - session exposure in counts that sets SUMMARY_LOG_FLAG_EXPOSURE
+ */
+void summary_log_init(summary_log_t *log, uint32_t exposure_limit)
+{
+    memset(log, 0, sizeof(summary_log_t));
+    log->exposure_limit = exposure_limit;
+}
+
+/*
+ * Adds the peaks drained from the adxl372 peak detect fifo, one per hit
+ */
+void summary_log_add_hits(summary_log_t *log, adxl372_accel_data_t const *peaks, uint16_t num_peaks)
+{
+    uint16_t peak;
+
+    for (uint16_t i = 0; i < num_peaks; i++)
+    {
+        peak = resultant(&peaks[i]);
+        if (peak > log->window_peak)
+            log->window_peak = peak;
+        if (log->window_hits < UINT16_MAX)
+            log->window_hits++;
+        log->exposure += peak;
+    }
+    if (log->exposure >= log->exposure_limit)
+        log->flagged = true;
+}
+
+/*
+ * Adds the MAXPEAK reading of the window, it also covers samples below the hit threshold
+ */
+void summary_log_add_max(summary_log_t *log, adxl372_accel_data_t const *max_peak)
+{
+    uint16_t peak = resultant(max_peak);
+
+    if (peak > log->window_peak)
+        log->window_peak = peak;
+}
+
+/*
+ * Ends the window and queues its record
+ * @return true if SUMMARY_LOG_RECORDS_PER_EVENT records are waiting, store them and call summary_log_clear
+ */
+bool summary_log_close_window(summary_log_t *log)
+{
+    summary_log_record_t *record;
+
+    if (log->count < SUMMARY_LOG_RECORDS_PER_EVENT)
+    {
+        record = &log->records[log->count++];
+        memset(record, 0xFF, sizeof(summary_log_record_t));
+        record->window = log->window;
+        record->peak = log->window_peak;
+        record->hits = log->window_hits;
+        record->exposure = log->exposure;
+        record->flags = log->flagged ? SUMMARY_LOG_FLAG_EXPOSURE : 0;
+    }
+    log->window++;
+    log->window_peak = 0;
+    log->window_hits = 0;
+
+    return log->count >= SUMMARY_LOG_RECORDS_PER_EVENT;
+}
+
+/*
+ * Drops the queued records once they are stored, the session totals carry on
+ */
+void summary_log_clear(summary_log_t *log)
+{
+    log->count = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef SUMMARY_LOG_H
+#define SUMMARY_LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "adxl372.h"
+
+/* Exposure summary of a whole session at a few bytes per window instead of
+ * full rate impact captures. For every window the app hands over the adxl372
+ * MAXPEAK reading, the highest sample of the window whatever its size, and the
+ * peak FIFO entries, one per excursion over the activity (hit) threshold. The
+ * window record keeps the peak, the number of hits and the running session
+ * exposure, the sum of the hit peaks, so sub-threshold hits that never start
+ * a capture still add up. Records are batched into one event of
+ * SUMMARY_LOG_RECORDS_PER_EVENT, all in adxl372 counts */
+#define SUMMARY_LOG_ENCODING            0x5355 //"SU", event_store encoding of the summary events
+#define SUMMARY_LOG_RECORDS_PER_EVENT   64
+
+#define SUMMARY_LOG_FLAG_EXPOSURE       0x01 //the session exposure has crossed the limit
+
+typedef struct {
+    uint32_t window;        /* window number since summary_log_init */
+    uint16_t peak;          /* highest resultant of the window */
+    uint16_t hits;          /* excursions over the hit threshold */
+    uint32_t exposure;      /* session sum of the hit resultants up to the end of the window */
+    uint8_t flags;          /* SUMMARY_LOG_FLAG_* */
+    uint8_t reserved[3];
+} summary_log_record_t;
+
+typedef struct {
+    uint32_t exposure_limit;
+    uint32_t exposure;
+    uint32_t window;
+    uint16_t window_peak;
+    uint16_t window_hits;
+    bool flagged;
+    uint16_t count;         /* records waiting to be stored */
+    summary_log_record_t records[SUMMARY_LOG_RECORDS_PER_EVENT];
+} summary_log_t;
+
+void summary_log_init(summary_log_t *log, uint32_t exposure_limit);
+
+void summary_log_add_hits(summary_log_t *log, adxl372_accel_data_t const *peaks, uint16_t num_peaks);
+
+void summary_log_add_max(summary_log_t *log, adxl372_accel_data_t const *max_peak);
+
+bool summary_log_close_window(summary_log_t *log);
+
+void summary_log_clear(summary_log_t *log);
+
+#endif //SUMMARY_LOG_H
@@ -0,0 +1,164 @@
+//-------------------------------------------
+// Title: summary_relay.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: The table of severe hits a helmet forwards in its
+// advertising data, see summary_relay.h. Entries are found by origin and
+// event id, expire by the time of the hit and take turns in the payload.
+//-------------------------------------------
+#include <string.h>
+#include "summary_relay.h"
+
+static bool slot_live(summary_relay_t const *p_relay, uint8_t i, uint32_t now_s)
+{
+    return (p_relay->used & (1u << i)) && (now_s - p_relay->slots[i].hit_s) < SUMMARY_RELAY_TTL_S;
+}
+
+// A teammate's hit is forwarded with one hop more, up to SUMMARY_RELAY_MAX_HOPS
+static bool slot_forwarded(summary_relay_t const *p_relay, uint8_t i, uint32_t now_s)
+{
+    summary_relay_entry_t const *entry = &p_relay->slots[i].entry;
+
+    return slot_live(p_relay, i, now_s)
+           && (entry->hops < SUMMARY_RELAY_MAX_HOPS || memcmp(entry->origin, p_relay->own, SUMMARY_RELAY_ORIGIN_LEN) == 0);
+}
+
+/*
+ * Puts an entry in the table. A hit it already holds only takes the fewer
+ * hops, a full table gives up its least severe hit for a more severe one
+ * @return true if the hit is new
+ */
+static bool slot_put(summary_relay_t *p_relay, summary_relay_entry_t const *p_entry, uint32_t hit_s, uint32_t now_s)
+{
+    summary_relay_slot_t *slot;
+    uint8_t free = SUMMARY_RELAY_ENTRIES;
+    uint8_t weakest = SUMMARY_RELAY_ENTRIES;
+
+    for (uint8_t i = 0; i < SUMMARY_RELAY_ENTRIES; i++)
+    {
+        slot = &p_relay->slots[i];
+        if (!slot_live(p_relay, i, now_s))
+        {
+            if (free == SUMMARY_RELAY_ENTRIES)
+                free = i;
+            continue;
+        }
+        if (slot->entry.event_id == p_entry->event_id
+            && memcmp(slot->entry.origin, p_entry->origin, SUMMARY_RELAY_ORIGIN_LEN) == 0)
+        {
+            if (p_entry->hops < slot->entry.hops)
+                slot->entry.hops = p_entry->hops;
+            return false;
+        }
+        if (weakest == SUMMARY_RELAY_ENTRIES || slot->entry.peak_g_x10 < p_relay->slots[weakest].entry.peak_g_x10)
+            weakest = i;
+    }
+
+    if (free == SUMMARY_RELAY_ENTRIES)
+    {
+        if (p_relay->slots[weakest].entry.peak_g_x10 >= p_entry->peak_g_x10)
+        {
+            p_relay->dropped++;
+            return false;
+        }
+        free = weakest;
+        p_relay->dropped++;
+    }
+    p_relay->slots[free].entry = *p_entry;
+    p_relay->slots[free].hit_s = hit_s;
+    p_relay->used |= (1u << free);
+
+    return true;
+}
+
+/*
+ * @param p_own - the low SUMMARY_RELAY_ORIGIN_LEN bytes of the device's address,
+ * the hits it hears back from its teammates are not taken up again
+ */
+void summary_relay_init(summary_relay_t *p_relay, uint8_t const *p_own)
+{
+    memset(p_relay, 0, sizeof(summary_relay_t));
+    memcpy(p_relay->own, p_own, SUMMARY_RELAY_ORIGIN_LEN);
+}
+
+/*
+ * Adds a hit stored on this device, below SUMMARY_RELAY_SEVERE_G_X10 it is not relayed
+ * @return true if it was put in the table
+ */
+bool summary_relay_add_own(summary_relay_t *p_relay, uint32_t event_id, uint16_t peak_g_x10, uint32_t now_s)
+{
+    summary_relay_entry_t entry;
+
+    if (peak_g_x10 < SUMMARY_RELAY_SEVERE_G_X10)
+        return false;
+
+    entry.peak_g_x10 = peak_g_x10;
+    entry.event_id = (uint16_t) event_id;
+    memcpy(entry.origin, p_relay->own, SUMMARY_RELAY_ORIGIN_LEN);
+    entry.hops = 0;
+    entry.age_s = 0;
+
+    return slot_put(p_relay, &entry, now_s, now_s);
+}
+
+/*
+ * Takes up an entry heard in a teammate's advertising data, it is kept with
+ * the hops it was heard with. Entries of this device, past
+ * SUMMARY_RELAY_MAX_HOPS or SUMMARY_RELAY_TTL_S and below
+ * SUMMARY_RELAY_SEVERE_G_X10 are ignored
+ * @return true if the hit was not in the table
+ */
+bool summary_relay_heard(summary_relay_t *p_relay, summary_relay_entry_t const *p_entry, uint32_t now_s)
+{
+    if (p_entry->peak_g_x10 < SUMMARY_RELAY_SEVERE_G_X10 || p_entry->hops > SUMMARY_RELAY_MAX_HOPS
+        || p_entry->age_s >= SUMMARY_RELAY_TTL_S
+        || memcmp(p_entry->origin, p_relay->own, SUMMARY_RELAY_ORIGIN_LEN) == 0)
+        return false;
+
+    if (!slot_put(p_relay, p_entry, now_s - p_entry->age_s, now_s))
+        return false;
+    p_relay->relayed++;
+
+    return true;
+}
+
+/*
+ * The entry to advertise, the same one with the same age until
+ * SUMMARY_RELAY_ROTATE_S passed or it expired, then the next live one that is
+ * not SUMMARY_RELAY_MAX_HOPS away already. A teammate's goes out one hop
+ * further than it was heard
+ * @return false if the table holds no such entry, the summary goes out alone
+ */
+bool summary_relay_next(summary_relay_t *p_relay, uint32_t now_s, summary_relay_entry_t *p_entry)
+{
+    summary_relay_slot_t const *slot;
+    uint8_t i;
+    uint32_t age_s;
+
+    if (!p_relay->advertising || (int32_t)(now_s - p_relay->rotate_s) >= 0
+        || !slot_forwarded(p_relay, p_relay->current, now_s))
+    {
+        p_relay->advertising = false;
+        for (uint8_t n = 1; n <= SUMMARY_RELAY_ENTRIES; n++)
+        {
+            i = (p_relay->current + n) % SUMMARY_RELAY_ENTRIES;
+            if (slot_forwarded(p_relay, i, now_s))
+            {
+                slot = &p_relay->slots[i];
+                age_s = now_s - slot->hit_s;
+                p_relay->out = slot->entry;
+                p_relay->out.age_s = (age_s > UINT8_MAX) ? UINT8_MAX : age_s;
+                if (memcmp(slot->entry.origin, p_relay->own, SUMMARY_RELAY_ORIGIN_LEN) != 0)
+                    p_relay->out.hops++;
+                p_relay->current = i;
+                p_relay->rotate_s = now_s + SUMMARY_RELAY_ROTATE_S;
+                p_relay->advertising = true;
+                break;
+            }
+        }
+        if (!p_relay->advertising)
+            return false;
+    }
+    *p_entry = p_relay->out;
+
+    return true;
+}
@@ -0,0 +1,64 @@
+#ifndef SUMMARY_RELAY_H
+#define SUMMARY_RELAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Store and forward of the severe hits of a team, so an alert reaches a
+ * sideline gateway from a helmet out of its range without any link. Each
+ * helmet appends one summary_relay_entry_t to the impact summary in its
+ * advertising data: a severe hit of its own (hops 0) or one it heard from a
+ * teammate, which it sends on with one hop more up to SUMMARY_RELAY_MAX_HOPS,
+ * and the helmets near it take it up from their scan reports. The entries are
+ * kept by the origin and the event id, so the copies heard from several
+ * teammates and on each advertising channel are one entry, and are dropped
+ * SUMMARY_RELAY_TTL_S after the hit. An entry goes out for
+ * SUMMARY_RELAY_ROTATE_S before the next one, with its age at that moment, so
+ * every live entry is heard in turn.
+ * The gateway keeps the same table to report each relayed hit once.
+ * Hardware independent, the caller keeps summary_relay_heard() and
+ * summary_relay_next() from preempting each other */
+#define SUMMARY_RELAY_ENTRIES       8
+#define SUMMARY_RELAY_MAX_HOPS      3       //a hit is carried this many helmets away from its origin
+#define SUMMARY_RELAY_TTL_S         120     //under the 255 s an age can hold
+#define SUMMARY_RELAY_ROTATE_S      4
+#define SUMMARY_RELAY_ORIGIN_LEN    4       //low bytes of the origin's address, unique enough in a team
+#ifndef SUMMARY_RELAY_SEVERE_G_X10
+#define SUMMARY_RELAY_SEVERE_G_X10  800     //peak of a severe hit in 0.1 g, only those are relayed
+#endif
+
+/* As advertised after the impact summary, 10 bytes with no padding */
+typedef struct {
+    uint16_t peak_g_x10;
+    uint16_t event_id;      //low bits of the origin's event id
+    uint8_t origin[SUMMARY_RELAY_ORIGIN_LEN];
+    uint8_t hops;           //0 from the origin, as heard in the table
+    uint8_t age_s;          //since the hit when it was put in the advertising data
+} summary_relay_entry_t;
+
+typedef struct {
+    summary_relay_entry_t entry;
+    uint32_t hit_s;         //now_s of the hit
+} summary_relay_slot_t;
+
+typedef struct {
+    summary_relay_slot_t slots[SUMMARY_RELAY_ENTRIES];
+    uint8_t used;           //bit per slot
+    uint8_t own[SUMMARY_RELAY_ORIGIN_LEN];
+    uint8_t current;        //slot advertised
+    bool advertising;
+    uint32_t rotate_s;      //now_s the next slot is taken
+    summary_relay_entry_t out;
+    uint32_t relayed;       //entries heard from teammates
+    uint32_t dropped;       //table full of more severe hits
+} summary_relay_t;
+
+void summary_relay_init(summary_relay_t *p_relay, uint8_t const *p_own);
+
+bool summary_relay_add_own(summary_relay_t *p_relay, uint32_t event_id, uint16_t peak_g_x10, uint32_t now_s);
+
+bool summary_relay_heard(summary_relay_t *p_relay, summary_relay_entry_t const *p_entry, uint32_t now_s);
+
+bool summary_relay_next(summary_relay_t *p_relay, uint32_t now_s, summary_relay_entry_t *p_entry);
+
+#endif //SUMMARY_RELAY_H
@@ -0,0 +1,322 @@
+//-------------------------------------------
+// Title: time_sync.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Offset and drift of the app timer against a gateway
+// reference broadcast over BLE. The observer pairs each new beacon with
+// the app timer count at its report and refits the last few pairs, the
+// thread converts app timer counts taken at a trigger to the reference.
+//-------------------------------------------
+#include <string.h>
+#include "time_sync.h"
+#include "ble_advdata.h"
+#include "app_util_platform.h"
+
+#define US_PER_S                1000000
+
+/*
+ * @return the app timer ticks in microseconds, negative for a count before the other
+ */
+static int64_t sync_ticks_to_us(int64_t ticks)
+{
+    return (ticks * US_PER_S * (APP_TIMER_CONFIG_RTC_FREQUENCY + 1)) / APP_TIMER_CLOCK_FREQ;
+}
+
+/*
+ * Extends the app timer count to 64 bits, cnt must be the current count.
+ * Called with interrupts disabled
+ */
+static uint64_t sync_extend(time_sync_t *p_sync, uint32_t cnt)
+{
+    p_sync->local_ticks += app_timer_cnt_diff_compute(cnt, p_sync->last_cnt);
+    p_sync->last_cnt = cnt;
+    return p_sync->local_ticks;
+}
+
+/*
+ * @return nonzero if the last reference is recent enough to convert with
+ */
+static bool sync_valid(time_sync_t const *p_sync, uint64_t local_ticks)
+{
+    return p_sync->num_points > 0
+        && sync_ticks_to_us(local_ticks - p_sync->anchor.local_ticks) < (int64_t)TIME_SYNC_MAX_AGE_S * US_PER_S;
+}
+
+/*
+ * @return the fitted reference at an extended app timer count
+ */
+static uint64_t sync_convert(time_sync_t const *p_sync, uint64_t local_ticks)
+{
+    int64_t dx = sync_ticks_to_us((int64_t)(local_ticks - p_sync->anchor.local_ticks));
+
+    return p_sync->anchor.ref_us + p_sync->offset_us + dx + (dx * p_sync->drift_ppb) / 1000000000;
+}
+
+/*
+ * Least squares fit of the reference minus the local time over the points,
+ * relative to the newest one. The drift keeps its last value until the points
+ * span TIME_SYNC_MIN_SPAN_MS, the offset is fitted from the first point on
+ */
+static void sync_fit(time_sync_t const *p_sync, time_sync_point_t const *p_anchor,
+                     int32_t *p_offset_us, int32_t *p_drift_ppb)
+{
+    double x, y, sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0, min_x = 0;
+    double n = p_sync->num_points;
+    double drift = *p_drift_ppb / 1e9;
+    uint8_t i;
+
+    for (i = 0; i < p_sync->num_points; i++)
+    {
+        x = sync_ticks_to_us((int64_t)(p_sync->points[i].local_ticks - p_anchor->local_ticks));
+        y = (double)(int64_t)(p_sync->points[i].ref_us - p_anchor->ref_us) - x;
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+        if (x < min_x)
+            min_x = x;
+    }
+    if (-min_x >= TIME_SYNC_MIN_SPAN_MS * 1000.0)
+        drift = (n * sum_xy - sum_x * sum_y) / (n * sum_xx - sum_x * sum_x);
+    *p_offset_us = (int32_t)((sum_y - drift * sum_x) / n);
+    *p_drift_ppb = (int32_t)(drift * 1e9);
+}
+
+static void sync_timeout_handler(void *p_context)
+{
+    time_sync_t *p_sync = (time_sync_t *) p_context;
+
+    CRITICAL_REGION_ENTER();
+    (void) sync_extend(p_sync, app_timer_cnt_get());
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Starts the timer that extends the app timer count, app_timer_init must have run
+ * @return the error of app_timer_create or app_timer_start
+ */
+uint32_t time_sync_init(time_sync_t *p_sync)
+{
+    app_timer_id_t const *p_timer_id = p_sync->p_timer_id;
+    uint32_t err_code;
+
+    memset(p_sync, 0, sizeof(time_sync_t));
+    p_sync->p_timer_id = p_timer_id;
+    p_sync->scan_buffer.p_data = p_sync->scan_data;
+    p_sync->scan_buffer.len = sizeof(p_sync->scan_data);
+    p_sync->last_cnt = app_timer_cnt_get();
+
+    err_code = app_timer_create(p_timer_id, APP_TIMER_MODE_REPEATED, sync_timeout_handler);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+    return app_timer_start(*p_timer_id, APP_TIMER_TICKS(TIME_SYNC_EXTEND_MS), p_sync);
+}
+
+/*
+ * Starts the passive scan for the gateway beacons, runs alongside advertising
+ * and a connection, the softdevice must be enabled
+ * @return the error of sd_ble_gap_scan_start
+ */
+uint32_t time_sync_scan_start(time_sync_t *p_sync)
+{
+    ble_gap_scan_params_t scan_params;
+
+    memset(&scan_params, 0, sizeof(scan_params));
+    scan_params.active        = 0;
+    scan_params.filter_policy = BLE_GAP_SCAN_FP_ACCEPT_ALL;
+    scan_params.scan_phys     = BLE_GAP_PHY_1MBPS;
+    scan_params.interval      = TIME_SYNC_SCAN_INTERVAL;
+    scan_params.window        = TIME_SYNC_SCAN_WINDOW;
+    scan_params.timeout       = BLE_GAP_SCAN_TIMEOUT_UNLIMITED;
+
+    return sd_ble_gap_scan_start(&scan_params, &p_sync->scan_buffer);
+}
+
+/*
+ * @param handler - reads the reports of other advertisers, NULL for none
+ */
+void time_sync_report_handler_set(time_sync_t *p_sync, time_sync_report_handler_t handler)
+{
+    p_sync->report_handler = handler;
+}
+
+/*
+ * Pairs a reference with the app timer count it was received at and refits.
+ * Once there is a fit a reference too far from it is dropped, a gateway that
+ * jumped is only followed after TIME_SYNC_WINDOW of them in a row.
+ * Called from one context only, the BLE observer
+ * @param cnt - app_timer_cnt_get() at the report, no older than the last call
+ * @return 0 if success otherwise -2 if the reference was dropped
+ */
+int8_t time_sync_add_point(time_sync_t *p_sync, uint32_t cnt, uint64_t ref_us)
+{
+    time_sync_point_t point;
+    int64_t residual;
+    int32_t offset_us, drift_ppb;
+    bool dropped = false;
+
+    CRITICAL_REGION_ENTER();
+    point.local_ticks = sync_extend(p_sync, cnt);
+    point.ref_us = ref_us;
+    if (!sync_valid(p_sync, point.local_ticks))
+    {
+        //too old to check against, start over
+        p_sync->num_points = 0;
+        p_sync->next_point = 0;
+        p_sync->drift_ppb = 0;
+    }
+    else if (p_sync->num_points >= 3)
+    {
+        residual = (int64_t)(ref_us - sync_convert(p_sync, point.local_ticks));
+        if (residual > TIME_SYNC_MAX_RESIDUAL_US || residual < -TIME_SYNC_MAX_RESIDUAL_US)
+        {
+            if (++p_sync->misses < TIME_SYNC_WINDOW)
+            {
+                dropped = true;
+            }
+            else
+            {
+                p_sync->num_points = 0;
+                p_sync->next_point = 0;
+                p_sync->drift_ppb = 0;
+            }
+        }
+    }
+    if (!dropped)
+    {
+        p_sync->misses = 0;
+        p_sync->points[p_sync->next_point] = point;
+        p_sync->next_point = (p_sync->next_point + 1) % TIME_SYNC_WINDOW;
+        if (p_sync->num_points < TIME_SYNC_WINDOW)
+            p_sync->num_points++;
+    }
+    drift_ppb = p_sync->drift_ppb;
+    CRITICAL_REGION_EXIT();
+
+    if (dropped)
+    {
+        p_sync->rejected++;
+        return -2;
+    }
+
+    //the points only change in this context, fit them with interrupts on
+    sync_fit(p_sync, &point, &offset_us, &drift_ppb);
+
+    CRITICAL_REGION_ENTER();
+    p_sync->anchor = point;
+    p_sync->offset_us = offset_us;
+    p_sync->drift_ppb = drift_ppb;
+    CRITICAL_REGION_EXIT();
+    p_sync->accepted++;
+    return 0;
+}
+
+/*
+ * Converts an app timer count to the gateway reference, any context
+ * @param cnt - app_timer_cnt_get() less than 512 s ago
+ * @return 0 if success otherwise -2 if not synced
+ */
+int8_t time_sync_ticks_to_ref_us(time_sync_t *p_sync, uint32_t cnt, uint64_t *p_ref_us)
+{
+    uint32_t now;
+    uint64_t local_now;
+    int8_t ret = -2;
+
+    CRITICAL_REGION_ENTER();
+    now = app_timer_cnt_get();
+    local_now = sync_extend(p_sync, now);
+    if (sync_valid(p_sync, local_now))
+    {
+        *p_ref_us = sync_convert(p_sync, local_now - app_timer_cnt_diff_compute(now, cnt));
+        ret = 0;
+    }
+    CRITICAL_REGION_EXIT();
+    return ret;
+}
+
+/*
+ * Splits a reference into the calendar fields of the rtc, UTC
+ * @param p_us - microseconds into the second, NULL if not needed
+ */
+void time_sync_to_ds1388(uint64_t ref_us, ds1388_data_t *p_date, uint32_t *p_us)
+{
+    uint32_t us = ref_us % US_PER_S;
+
+    ds1388_from_epoch(ref_us / US_PER_S, p_date);
+    p_date->hundreth = us / 10000;
+    if (p_us != NULL)
+        *p_us = us;
+}
+
+/*
+ * Reads the fit state for the cli
+ */
+void time_sync_get_status(time_sync_t *p_sync, time_sync_status_t *p_status)
+{
+    uint64_t local_now;
+
+    CRITICAL_REGION_ENTER();
+    local_now = sync_extend(p_sync, app_timer_cnt_get());
+    p_status->synced     = sync_valid(p_sync, local_now);
+    p_status->num_points = p_sync->num_points;
+    p_status->drift_ppb  = p_sync->drift_ppb;
+    p_status->age_ms     = (p_sync->num_points > 0) ?
+                           MIN(sync_ticks_to_us(local_now - p_sync->anchor.local_ticks) / 1000, UINT32_MAX) : 0;
+    p_status->accepted   = p_sync->accepted;
+    p_status->rejected   = p_sync->rejected;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Takes the beacon out of an advertising report or hands the report to the
+ * app's handler, the scan resumes once it is read
+ */
+static void on_adv_report(time_sync_t *p_sync, ble_gap_evt_adv_report_t const *p_report)
+{
+    uint32_t cnt = app_timer_cnt_get(); //first, the report latency is the sync error
+    uint16_t offset = 0;
+    uint16_t length;
+    uint8_t const *p_data;
+    uint64_t ref_us;
+    uint8_t sequence;
+
+    length = ble_advdata_search(p_report->data.p_data, p_report->data.len, &offset,
+                                BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA);
+    p_data = &p_report->data.p_data[offset];
+
+    if (length >= TIME_SYNC_BEACON_SIZE
+        && uint16_decode(&p_data[0]) == TIME_SYNC_COMPANY_ID
+        && uint16_decode(&p_data[2]) == TIME_SYNC_BEACON_MAGIC)
+    {
+        sequence = p_data[4];
+        //the same beacon is reported once per advertising channel, only the first counts
+        if (!p_sync->have_sequence || sequence != p_sync->sequence)
+        {
+            ref_us = ((uint64_t)uint32_decode(&p_data[9]) << 32) | uint32_decode(&p_data[5]);
+            p_sync->have_sequence = true;
+            p_sync->sequence = sequence;
+            (void) time_sync_add_point(p_sync, cnt, ref_us);
+        }
+    }
+    else if (p_sync->report_handler != NULL)
+    {
+        p_sync->report_handler(p_report);
+    }
+
+    //the scan pauses on every report, an error only means it was stopped meanwhile
+    (void) sd_ble_gap_scan_start(NULL, &p_sync->scan_buffer);
+}
+
+void time_sync_on_ble_evt(ble_evt_t const *p_ble_evt, void *p_context)
+{
+    time_sync_t *p_sync = (time_sync_t *) p_context;
+
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_GAP_EVT_ADV_REPORT:
+            on_adv_report(p_sync, &p_ble_evt->evt.gap_evt.params.adv_report);
+            break;
+
+        default:
+            break;
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef TIME_SYNC_H
+#define TIME_SYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ble.h"
+#include "nrf_sdh_ble.h"
+#include "app_timer.h"
+#include "ds1388.h"
+
+/* Time sync to a sideline gateway over BLE. The gateway broadcasts
+ * non-connectable advertisements with manufacturer specific data
+ *   company id  uint16 TIME_SYNC_COMPANY_ID
+ *   magic       uint16 TIME_SYNC_BEACON_MAGIC
+ *   sequence    uint8, changes with every new reference
+ *   reference   uint64 microseconds since 1970-01-01 UTC
+ * and every device scans for them, pairing each new reference with the app
+ * timer count at the report. A least squares fit of the last TIME_SYNC_WINDOW
+ * pairs gives the offset and the drift of the 32768 Hz app timer against the
+ * gateway, so any app timer count, e.g. the one taken at a trigger, converts to
+ * the gateway timebase. All devices hear the same packet at the same moment,
+ * whatever the gateway latency is it shifts them all alike, so their events line
+ * up to the report latency and the tick, well under a millisecond.
+ * The app timer counter wraps after 512 s, a repeated app timer extends it to
+ * 64 bits. Counts handed to the conversion must be less than 512 s old.
+ * The scan is the device's only one, time_sync_report_handler_set() lets the
+ * app read the other reports before the scan buffer is handed back */
+#define TIME_SYNC_DEF(_name)                                                    \
+APP_TIMER_DEF(_name ## _timer);                                                 \
+static time_sync_t _name = {.p_timer_id = &_name ## _timer};                    \
+NRF_SDH_BLE_OBSERVER(_name ## _obs,                                             \
+                     TIME_SYNC_BLE_OBSERVER_PRIO,                               \
+                     time_sync_on_ble_evt, &_name)
+
+#ifndef TIME_SYNC_BLE_OBSERVER_PRIO
+#define TIME_SYNC_BLE_OBSERVER_PRIO 2
+#endif
+
+#define TIME_SYNC_COMPANY_ID        0xFFFF //Bluetooth SIG id for tests, the gateway is not a product
+#define TIME_SYNC_BEACON_MAGIC      0x5354 //"TS"
+#define TIME_SYNC_BEACON_SIZE       13
+#define TIME_SYNC_WINDOW            8     //references in the fit, one per broadcast
+#define TIME_SYNC_MIN_SPAN_MS       2000  //the drift is only fitted over a longer span
+#define TIME_SYNC_MAX_RESIDUAL_US   2000  //references further from the fit are dropped as late reports
+#define TIME_SYNC_MAX_AGE_S         300   //unsynced once the last reference is older
+#define TIME_SYNC_EXTEND_MS         60000 //well within the 512 s app timer wrap
+#define TIME_SYNC_SCAN_INTERVAL     MSEC_TO_UNITS(1000, UNIT_0_625_MS)
+#define TIME_SYNC_SCAN_WINDOW       MSEC_TO_UNITS(100, UNIT_0_625_MS) //10% duty, the gateway broadcasts every 100 ms
+
+/* Called from the BLE observer with every report that is not a beacon */
+typedef void (*time_sync_report_handler_t)(ble_gap_evt_adv_report_t const *p_report);
+
+/* One reference and the extended app timer count it was received at */
+typedef struct {
+    uint64_t local_ticks;
+    uint64_t ref_us;
+} time_sync_point_t;
+
+typedef struct {
+    app_timer_id_t const *p_timer_id;
+    uint64_t local_ticks;   /* extended app timer count at last_cnt */
+    uint32_t last_cnt;
+    time_sync_point_t points[TIME_SYNC_WINDOW];
+    uint8_t num_points;
+    uint8_t next_point;     /* oldest point once the window is full */
+    uint8_t misses;         /* references dropped in a row, the fit restarts after TIME_SYNC_WINDOW */
+    bool have_sequence;
+    uint8_t sequence;       /* of the last beacon */
+    time_sync_point_t anchor; /* newest point, the fit is relative to it */
+    int32_t offset_us;      /* fitted reference at the anchor minus the one received */
+    int32_t drift_ppb;      /* fitted rate of the gateway against the app timer, parts per billion */
+    uint32_t accepted;
+    uint32_t rejected;
+    time_sync_report_handler_t report_handler;
+    uint8_t scan_data[BLE_GAP_SCAN_BUFFER_MIN];
+    ble_data_t scan_buffer;
+} time_sync_t;
+
+/* Snapshot for the cli */
+typedef struct {
+    bool synced;
+    uint8_t num_points;
+    int32_t drift_ppb;
+    uint32_t age_ms;        /* since the last accepted reference */
+    uint32_t accepted;
+    uint32_t rejected;
+} time_sync_status_t;
+
+uint32_t time_sync_init(time_sync_t *p_sync);
+
+uint32_t time_sync_scan_start(time_sync_t *p_sync);
+
+void time_sync_report_handler_set(time_sync_t *p_sync, time_sync_report_handler_t handler);
+
+void time_sync_on_ble_evt(ble_evt_t const *p_ble_evt, void *p_context);
+
+int8_t time_sync_add_point(time_sync_t *p_sync, uint32_t cnt, uint64_t ref_us);
+
+int8_t time_sync_ticks_to_ref_us(time_sync_t *p_sync, uint32_t cnt, uint64_t *p_ref_us);
+
+void time_sync_to_ds1388(uint64_t ref_us, ds1388_data_t *p_date, uint32_t *p_us);
+
+void time_sync_get_status(time_sync_t *p_sync, time_sync_status_t *p_status);
+
+#endif //TIME_SYNC_H
@@ -0,0 +1,47 @@
+//-------------------------------------------
+// Title: timebase.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Microsecond sample timestamps from a TIMER peripheral.
+// The ds1388 is only read at the start of an event, samples carry the
+// microseconds since that read.
+//-------------------------------------------
+#include "timebase.h"
+
+/*
+ * Clears and starts the timer. It runs from the HFCLK so it should only
+ * be running while an event is sampled
+ */
+void timebase_start(void)
+{
+    nrf_timer_task_trigger(TIMEBASE_TIMER, NRF_TIMER_TASK_STOP);
+    nrf_timer_mode_set(TIMEBASE_TIMER, NRF_TIMER_MODE_TIMER);
+    nrf_timer_bit_width_set(TIMEBASE_TIMER, NRF_TIMER_BIT_WIDTH_32);
+    nrf_timer_frequency_set(TIMEBASE_TIMER, NRF_TIMER_FREQ_1MHz);
+    nrf_timer_task_trigger(TIMEBASE_TIMER, NRF_TIMER_TASK_CLEAR);
+    nrf_timer_task_trigger(TIMEBASE_TIMER, NRF_TIMER_TASK_START);
+}
+
+void timebase_stop(void)
+{
+    nrf_timer_task_trigger(TIMEBASE_TIMER, NRF_TIMER_TASK_STOP);
+    nrf_timer_task_trigger(TIMEBASE_TIMER, NRF_TIMER_TASK_SHUTDOWN);
+}
+
+/*
+ * @return microseconds since timebase_start
+ */
+uint32_t timebase_now_us(void)
+{
+    nrf_timer_task_trigger(TIMEBASE_TIMER, nrf_timer_capture_task_get(TIMEBASE_CC_CHANNEL));
+
+    return nrf_timer_cc_read(TIMEBASE_TIMER, TIMEBASE_CC_CHANNEL);
+}
+
+/*
+ * @param start_us - an earlier timebase_now_us, e.g. taken right after the rtc was read
+ * @return microseconds since start_us, correct across one timer wrap
+ */
+uint32_t timebase_since_us(uint32_t start_us)
+{
+    return timebase_now_us() - start_us;
+}
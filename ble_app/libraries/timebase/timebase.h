@@ -0,0 +1,23 @@
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <stdint.h>
+#include "nrf_timer.h"
+
+/* Free running 1MHz 32 bit TIMER used to timestamp samples. The rtc is read
+ * once per event and paired with timebase_now_us(), every sample then only needs
+ * a register read instead of a TWI transaction. Wraps after ~71 minutes */
+#ifndef TIMEBASE_TIMER
+#define TIMEBASE_TIMER          NRF_TIMER1 /* TIMER0 is taken by the softdevice */
+#endif
+#define TIMEBASE_CC_CHANNEL     NRF_TIMER_CC_CHANNEL0
+
+void timebase_start(void);
+
+void timebase_stop(void);
+
+uint32_t timebase_now_us(void);
+
+uint32_t timebase_since_us(uint32_t start_us);
+
+#endif //TIMEBASE_H
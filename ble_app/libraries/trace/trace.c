@@ -0,0 +1,83 @@
+//-------------------------------------------
+// Title: trace.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: RAM ring of binary trace entries written from the hot
+// paths, drained to an RTT channel from idle and decoded on the host
+// by tools/trace_decode.
+//-------------------------------------------
+#include "trace.h"
+#include "nrf.h"
+#include "app_util.h"
+#include "app_util_platform.h"
+#include "SEGGER_RTT.h"
+
+#define TRACE_RING_MASK             (TRACE_RING_SIZE - 1)
+
+STATIC_ASSERT((TRACE_RING_SIZE & TRACE_RING_MASK) == 0);
+STATIC_ASSERT(sizeof(trace_entry_t) == 12);
+
+static trace_entry_t m_ring[TRACE_RING_SIZE];
+static volatile uint32_t m_head;    //written by trace_put only
+static volatile uint32_t m_tail;    //written by trace_drain only
+static volatile uint32_t m_dropped;
+static uint8_t m_rtt_buf[TRACE_RTT_BUF_SIZE];
+
+/*
+ * Sets up the RTT channel and adds TRACE_ID_START, entries put before it are
+ * kept and drained after it
+ */
+void trace_init(void)
+{
+    SEGGER_RTT_ConfigUpBuffer(TRACE_RTT_CHANNEL, "trace", m_rtt_buf, sizeof(m_rtt_buf), SEGGER_RTT_MODE_NO_BLOCK_SKIP);
+    trace_put(TRACE_ID_START, 0, TRACE_MAGIC);
+}
+
+/*
+ * Adds one entry, from thread or interrupt context. Use the TRACE macro so a
+ * build without the trace drops the call
+ */
+void trace_put(trace_id_t id, uint16_t a, uint32_t b)
+{
+    trace_entry_t *entry;
+
+    CRITICAL_REGION_ENTER();
+    if (m_head - m_tail < TRACE_RING_SIZE)
+    {
+        entry = &m_ring[m_head & TRACE_RING_MASK];
+        entry->ticks = NRF_RTC1->COUNTER;
+        entry->id = (uint16_t) id;
+        entry->a = a;
+        entry->b = b;
+        m_head++;
+    }
+    else
+    {
+        m_dropped++;
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Copies the entries to the RTT channel, the ones that do not fit stay in the
+ * ring for the next drain. Thread context only, e.g. before nrf_pwr_mgmt_run()
+ */
+void trace_drain(void)
+{
+    uint32_t dropped;
+
+    while (m_tail != m_head)
+    {
+        if (SEGGER_RTT_Write(TRACE_RTT_CHANNEL, &m_ring[m_tail & TRACE_RING_MASK], sizeof(trace_entry_t)) == 0)
+            return;
+        m_tail++;
+    }
+
+    if (m_dropped > 0)
+    {
+        CRITICAL_REGION_ENTER();
+        dropped = m_dropped;
+        m_dropped = 0;
+        CRITICAL_REGION_EXIT();
+        trace_put(TRACE_ID_DROPPED, 0, dropped);
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* Binary trace of the hot paths, for what NRF_LOG cannot print without
+ * stalling the sampling (with NRF_LOG_DEFERRED 0 every call waits on the
+ * uart). TRACE(id, a, b) stores a trace_entry_t with the RTC1 tick of the
+ * app_timer in a RAM ring with the interrupts masked for a few cycles, safe
+ * from any interrupt. Nothing is formatted or sent there: trace_drain(),
+ * called where the cpu would sleep anyway, copies the entries to an RTT up
+ * channel of their own without waiting. A full ring drops the new entries,
+ * the next drain adds a TRACE_ID_DROPPED entry with their count.
+ * The host reads the channel with JLinkRTTLogger -RTTChannel TRACE_RTT_CHANNEL
+ * and tools/trace_decode prints it, it takes the names from TRACE_ID_LIST so
+ * new ids go at the end. The ticks wrap after 512 s, entries further apart
+ * keep their order only. The uart stays with the log and the serial offload.
+ * TRACE_ENABLED is 0 unless the makefile sets it, the rev1 test makefile
+ * builds with TRACE ?= 1 (make TRACE=0 drops it). Built with 0 the macro
+ * compiles to nothing */
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED               0
+#endif
+#define TRACE_RING_SIZE             128   //entries, a power of two
+#define TRACE_RTT_CHANNEL           1     //channel 0 is the log
+#define TRACE_RTT_BUF_SIZE          1024
+#define TRACE_MAGIC                 0x54524331 //"TRC1", b of TRACE_ID_START, the entry format
+#define TRACE_TICK_HZ               32768 //RTC1 at APP_TIMER_CONFIG_RTC_FREQUENCY 0
+#define TRACE_TICK_MASK             0x00FFFFFF
+
+//the meaning of a and b follows each id
+#define TRACE_ID_LIST(X)                                                                \
+    X(TRACE_ID_START)           /* trace_init, b = TRACE_MAGIC */                       \
+    X(TRACE_ID_DROPPED)         /* b = entries lost to a full ring */                   \
+    X(TRACE_ID_STATE)           /* a = device state left, b = entered */                \
+    X(TRACE_ID_SPI_ERROR)       /* a = cs pin of the device, b = transfer result */     \
+    X(TRACE_ID_TWI_ERROR)       /* b = perform error code, a = 1 if abandoned */        \
+    X(TRACE_ID_SENSOR_ERROR)    /* a = sensor_id_t, b = driver return code */           \
+    X(TRACE_ID_FIFO_ERROR)      /* b = adxl372_get_fifo_data return code */             \
+    X(TRACE_ID_ACTIVITY_WAKE)   /* the adxl372 activity ended a rest */                 \
+    X(TRACE_ID_CAPTURE_CLOSE)   /* a = impact_location_t, b = records */                \
+    X(TRACE_ID_COMMIT_BEGIN)    /* b = records handed to the flash commit */            \
+    X(TRACE_ID_COMMIT_DONE)     /* a = page programs, b = event id */                   \
+    X(TRACE_ID_FIFO_TRIGGER)    /* a = window samples, b = trigger index or -1 */       \
+    X(TRACE_ID_TIER_ESCALATE)   /* b = summary tier samples before the activity2 */     \
+    X(TRACE_ID_AUTOSLEEP_WAKE)  /* b = ms asleep in autosleep, modulo 512 s */
+
+#define TRACE_ID_ENUM(_id) _id,
+typedef enum {
+    TRACE_ID_LIST(TRACE_ID_ENUM)
+    TRACE_ID_COUNT
+} trace_id_t;
+#undef TRACE_ID_ENUM
+
+/* 12 bytes, sent as they are in little endian */
+typedef struct {
+    uint32_t ticks;         /* RTC1 counter, TRACE_TICK_MASK bits */
+    uint16_t id;            /* trace_id_t */
+    uint16_t a;
+    uint32_t b;
+} trace_entry_t;
+
+#if TRACE_ENABLED
+#define TRACE(_id, _a, _b)          trace_put((_id), (uint16_t) (_a), (uint32_t) (_b))
+#else
+#define TRACE(_id, _a, _b)
+#endif
+
+void trace_init(void);
+
+void trace_put(trace_id_t id, uint16_t a, uint32_t b);
+
+void trace_drain(void);
+
+#endif //TRACE_H
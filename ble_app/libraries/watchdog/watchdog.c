@@ -0,0 +1,195 @@
+//-------------------------------------------
+// Title: watchdog.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: WDT fed from the heartbeats of the pipeline stages, with the
+// stage that stalled and a block of app state kept in retained RAM over
+// the watchdog reset.
+//-------------------------------------------
+#include <string.h>
+#include "watchdog.h"
+#include "nrf.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "nrf_drv_wdt.h"
+#include "crc32.h"
+#include "nrf_log.h"
+
+typedef struct {
+    uint32_t magic;
+    uint16_t restarts;      /* watchdog resets since power-on */
+    uint16_t size;          /* of data, 0 if nothing is retained */
+    char stalled[WATCHDOG_NAME_SIZE]; /* first stage found late, empty if none was */
+    uint32_t crc;           /* crc32 of size bytes of data */
+    uint8_t data[WATCHDOG_RETAINED_SIZE];
+} watchdog_block_t;
+
+//neither zeroed nor copied at startup, see .noinit in the app's linker script
+static watchdog_block_t m_block __attribute__((section(".noinit")));
+
+APP_TIMER_DEF(m_check_timer_id);
+static nrf_drv_wdt_channel_id m_channel;
+static watchdog_stage_t *m_p_stages = NULL;
+static bool m_stalled = false;          //the feeding stopped, the reset is coming
+static bool m_restarted = false;        //this boot is a watchdog reset
+static bool m_restorable = false;       //the data of the reset is still in the block
+static char m_last_stalled[WATCHDOG_NAME_SIZE];
+
+// Runs two LFCLK cycles before the reset, the stage was recorded by the check
+static void watchdog_event_handler(void)
+{
+}
+
+static void watchdog_stall(watchdog_stage_t const *p_stage)
+{
+    m_stalled = true;
+    strncpy(m_block.stalled, p_stage->name, WATCHDOG_NAME_SIZE - 1);
+    m_block.stalled[WATCHDOG_NAME_SIZE - 1] = '\0';
+    NRF_LOG_ERROR("WATCHDOG: %s stalled, resetting", p_stage->name);
+}
+
+// Feeds the WDT unless a started stage went its limit without a beat
+static void watchdog_check_handler(void *p_context)
+{
+    uint32_t now = app_timer_cnt_get();
+    uint32_t beats;
+
+    UNUSED_PARAMETER(p_context);
+    if (m_stalled)
+        return;
+
+    for (watchdog_stage_t *p_stage = m_p_stages; p_stage != NULL; p_stage = p_stage->p_next)
+    {
+        if (!p_stage->started)
+            continue;
+        beats = p_stage->beats;
+        if (beats != p_stage->seen_beats)
+        {
+            p_stage->seen_beats = beats;
+            p_stage->seen_ticks = now;
+        }
+        else if (app_timer_cnt_diff_compute(now, p_stage->seen_ticks) >= APP_TIMER_TICKS(p_stage->limit_ms))
+        {
+            watchdog_stall(p_stage);
+            return;
+        }
+    }
+    nrf_drv_wdt_channel_feed(m_channel);
+}
+
+/*
+ * Takes the record of a watchdog reset and starts the WDT and its check, the
+ * app timers must be initialized. The WDT cannot be stopped once started
+ * @param reset_reason - RESETREAS of this boot, see boot_check_reset_reason()
+ * @return NRF_SUCCESS or the error of the WDT driver or the app timer
+ */
+uint32_t watchdog_init(uint32_t reset_reason)
+{
+    nrf_drv_wdt_config_t config = NRF_DRV_WDT_DEAFULT_CONFIG;
+    uint32_t err_code;
+
+    //RAM is only kept over the reset if the block was set up by the boot before it
+    m_restarted = (reset_reason & POWER_RESETREAS_DOG_Msk) != 0 && m_block.magic == WATCHDOG_MAGIC;
+    if (m_restarted)
+    {
+        memcpy(m_last_stalled, m_block.stalled, WATCHDOG_NAME_SIZE);
+        m_last_stalled[WATCHDOG_NAME_SIZE - 1] = '\0';
+        m_restorable = m_block.size <= WATCHDOG_RETAINED_SIZE
+                    && m_block.crc == crc32_compute(m_block.data, m_block.size, NULL);
+        m_block.restarts++;
+    }
+    else
+    {
+        m_block.restarts = 0;
+        m_block.size = 0;
+    }
+    m_block.stalled[0] = '\0';
+    m_block.magic = WATCHDOG_MAGIC;
+
+    config.reload_value = WATCHDOG_TIMEOUT_MS;
+    err_code = nrf_drv_wdt_init(&config, watchdog_event_handler);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+    err_code = nrf_drv_wdt_channel_alloc(&m_channel);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+    nrf_drv_wdt_enable();
+
+    err_code = app_timer_create(&m_check_timer_id, APP_TIMER_MODE_REPEATED, watchdog_check_handler);
+    if (err_code != NRF_SUCCESS)
+        return err_code;
+    return app_timer_start(m_check_timer_id, APP_TIMER_TICKS(WATCHDOG_CHECK_MS), NULL);
+}
+
+/*
+ * Watches the stage from now on, it has its limit for the first beat. Any
+ * context below the app timer's interrupt or in it
+ */
+void watchdog_stage_start(watchdog_stage_t *p_stage)
+{
+    CRITICAL_REGION_ENTER();
+    if (!p_stage->registered)
+    {
+        p_stage->registered = 1;
+        p_stage->p_next = m_p_stages;
+        m_p_stages = p_stage;
+    }
+    p_stage->seen_beats = p_stage->beats;
+    p_stage->seen_ticks = app_timer_cnt_get();
+    p_stage->started = true;
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * Stops watching the stage, it waits for work
+ */
+void watchdog_stage_stop(watchdog_stage_t *p_stage)
+{
+    p_stage->started = false;
+}
+
+/*
+ * @param pp_stage - the stage that stalled, "" if the check did not find one
+ * @param p_restarts - watchdog resets in a row since power-on, 1 for the first
+ * @return true if this boot is a watchdog reset, the parameters are left alone otherwise
+ */
+bool watchdog_restarted(char const **pp_stage, uint16_t *p_restarts)
+{
+    if (!m_restarted)
+        return false;
+    *pp_stage = m_last_stalled;
+    *p_restarts = m_block.restarts;
+    return true;
+}
+
+/*
+ * Keeps a copy of the state for the boot after a watchdog reset, the last
+ * one before the reset is the one restored. Thread context
+ * @return 0 if success otherwise -2 if it does not fit
+ */
+int8_t watchdog_retain(void const *p_state, uint16_t size)
+{
+    if (size > WATCHDOG_RETAINED_SIZE)
+        return -2;
+
+    m_restorable = false;
+    m_block.size = 0;
+    memcpy(m_block.data, p_state, size);
+    m_block.crc = crc32_compute(m_block.data, size, NULL);
+    m_block.size = size;
+    return 0;
+}
+
+/*
+ * Takes back the state retained before a watchdog reset, before this boot
+ * retains its own
+ * @return true if this boot is a watchdog reset and a block of this size was
+ * retained intact, p_state is left alone otherwise
+ */
+bool watchdog_restore(void *p_state, uint16_t size)
+{
+    if (!m_restorable || m_block.size != size)
+        return false;
+
+    memcpy(p_state, m_block.data, size);
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Hardware watchdog fed only while every stage of the pipeline makes
+ * progress, so a stage that hangs, on a bus or in a loop, resets the chip
+ * instead of leaving it silent for the rest of the game. A stage is defined
+ * once at file scope and beats each time it moves on, WATCHDOG_BEAT is an
+ * increment any interrupt can afford. Between watchdog_stage_start() and
+ * watchdog_stage_stop() it must beat within its limit, a stopped stage is
+ * waiting for work and is not watched. A stage registers itself the first
+ * time it starts. A repeated app timer checks the started stages every
+ * WATCHDOG_CHECK_MS and feeds the WDT while none is late, the first late one
+ * is recorded and the feeding stops, the WDT resets the chip at most
+ * WATCHDOG_TIMEOUT_MS later. A check timer that stops, e.g. under an
+ * interrupt that never returns, is a reset with no stage recorded.
+ * The WDT runs while the cpu sleeps and pauses while a debugger halts it.
+ * The record is a block in the .noinit section, RAM keeps it over the
+ * watchdog reset. The app also keeps a few bytes of its own state there with
+ * watchdog_retain(), e.g. where the event store was, and takes them back with
+ * watchdog_restore() after a watchdog reset to restart faster. A magic and a
+ * crc32 tell a kept block from the random RAM of a power-on */
+#define WATCHDOG_TIMEOUT_MS         4000 //above the longest limit, a stall is recorded before the reset
+#define WATCHDOG_CHECK_MS           250
+#define WATCHDOG_MAGIC              0x57444F47 //"WDOG"
+#define WATCHDOG_NAME_SIZE          12 //of the stage name kept, with its terminator
+#define WATCHDOG_RETAINED_SIZE      32 //bytes of app state watchdog_retain() can hold
+
+typedef struct watchdog_stage_s {
+    char const *name;
+    uint32_t limit_ms;              /* longest a started stage may go without a beat */
+    struct watchdog_stage_s *p_next;    /* registered stages, NULL for the last */
+    uint8_t registered;
+    volatile bool started;
+    volatile uint32_t beats;
+    uint32_t seen_beats;            /* beats at seen_ticks */
+    uint32_t seen_ticks;            /* app timer count of the last beat the check saw */
+} watchdog_stage_t;
+
+#define WATCHDOG_STAGE_DEF(_stage, _label, _limit_ms)                           \
+    static watchdog_stage_t _stage = {.name = _label, .limit_ms = _limit_ms}
+#define WATCHDOG_BEAT(_stage)       ((_stage).beats++)
+
+uint32_t watchdog_init(uint32_t reset_reason);
+
+void watchdog_stage_start(watchdog_stage_t *p_stage);
+
+void watchdog_stage_stop(watchdog_stage_t *p_stage);
+
+bool watchdog_restarted(char const **pp_stage, uint16_t *p_restarts);
+
+int8_t watchdog_retain(void const *p_state, uint16_t size);
+
+bool watchdog_restore(void *p_state, uint16_t size);
+
+#endif //WATCHDOG_H
@@ -35,13 +35,11 @@
 
 #define NUM_SAMPLES 127 // the number of samples to be logged after read/write tests
 
-#define READ_DONE 0
-#define NOT_READ  -1
-
 #define TEST_FIFO // test the accelerometer using the FIFO buffer
 //#define TEST_REGULAR // test the accelerometer without using the FIFO buffer
 
 static void log_init(void);
+static void spi_accel_init(void);
 
 /**
  * @brief Main function that initializes peripheral, runs write and read tests and then prints data
@@ -49,7 +47,7 @@ static void log_init(void);
 int main (void)
 {
     // Initialize.
-    spi_init();
+    spi_accel_init();
     log_init();
 
     int8_t ret = 0;
@@ -147,22 +145,28 @@ int main (void)
     struct adxl372_device dev;
     adxl372_default_init_fifo_mode(&dev, NUM_SAMPLES); // initialize the accelerometer in FIFO mode
     adxl372_accel_data_t sample_set[NUM_SAMPLES/3]; // declare an instance of a custom struct to hold the data
-    int8_t read_fifo_done = NOT_READ;
+    uint16_t num_samples = 0;
+    int16_t num_read;
 
-    while(1)
+    while(num_samples < NUM_SAMPLES/3)
     {
-        read_fifo_done = adxl372_get_fifo_data(&dev, sample_set); // obtain the data using the FIFO buffer
-
-        if(read_fifo_done == READ_DONE)
+        // obtain the data using the FIFO buffer, whatever complete samples it holds
+        num_read = adxl372_get_fifo_data(&dev, &sample_set[num_samples], NUM_SAMPLES/3 - num_samples);
+        if (num_read == -1) // if -1 is returned, the SPI connection has failed
         {
-            for(int i = 0; i < NUM_SAMPLES/3; ++i) // print X, Y and Z acceleration values
-                NRF_LOG_INFO("sample: %d, X accel = %d mG, Y accel = %d mG, Z accel = %d mG", i,
-                            sample_set[i].x, sample_set[i].y, sample_set[i].z);
-            adxl372_reset(); // reset the accelerometer
+            NRF_LOG_ERROR("SPI WRITE READ FAIL");
             while(1);
         }
-    
+        if (num_read > 0)
+            num_samples += num_read;
     }
+
+    for(int i = 0; i < NUM_SAMPLES/3; ++i) // print X, Y and Z acceleration values
+        NRF_LOG_INFO("sample: %d, X accel = %d mG, Y accel = %d mG, Z accel = %d mG", i,
+                    ADXL372_COUNTS_TO_MG(sample_set[i].x), ADXL372_COUNTS_TO_MG(sample_set[i].y),
+                    ADXL372_COUNTS_TO_MG(sample_set[i].z));
+    adxl372_reset(); // reset the accelerometer
+    while(1);
 #endif
 #ifdef TEST_REGULAR // if the FIFO buffer is not being used
     adxl372_accel_data_t accel_data; // declare an instance of a custom struct to hold the data
@@ -170,13 +174,23 @@ int main (void)
     {
         adxl372_get_accel_data(&accel_data); // obtain the data // print X, Y and Z acceleration values
         NRF_LOG_INFO("X accel = %d mG, Y accel = %d mG, Z accel = %d mG",
-                        accel_data.x, accel_data.y, accel_data.z);
+                        ADXL372_COUNTS_TO_MG(accel_data.x), ADXL372_COUNTS_TO_MG(accel_data.y),
+                        ADXL372_COUNTS_TO_MG(accel_data.z));
         nrf_delay_ms(1000);
     }
 #endif
     return 0;
 }
 
+/**
+ * @brief Function for initializing the accel spi instance from the board header
+ */
+static void spi_accel_init(void)
+{
+    ret_code_t err_code = spi_instance_init(&accel_spi, &accel_spi_config, SPI_ACCEL_BURST_FREQ);
+    APP_ERROR_CHECK(err_code);
+}
+
 /**
  * @brief Function for initializing the nrf log
  */
@@ -41,6 +41,9 @@
  * @brief Blinky Sample Application main file.
  *
  * This file contains the source code for a sample server application using the LED Button service.
+ * It also runs the Impact Offload Service, which streams the events stored in the flash to a central
+ * as back to back notifications over a 247 byte ATT MTU, 251 byte data length, 2M PHY link with
+ * short connection intervals and connection event extension.
  */
 
 #include <stdint.h>
@@ -60,6 +63,7 @@
 #include "app_timer.h"
 #include "app_button.h"
 #include "ble_lbs.h"
+#include "ble_ios.h"
 #include "nrf_ble_gatt.h"
 #include "nrf_ble_qwr.h"
 #include "nrf_pwr_mgmt.h"
@@ -68,6 +72,15 @@
 #include "nrf_log_ctrl.h"
 #include "nrf_log_default_backends.h"
 
+#include "spi_driver.h"
+#include "mt25ql256aba.h"
+#include "event_store.h"
+#include "impact_record.h"
+#include "record_reader.h"
+#if BENCH_ENABLED
+#include "ble_bench.h"
+#endif
+
 
 #ifdef USE_LED
 #define ADVERTISING_LED                 BSP_BOARD_LED_0                         /**< Is on when device is advertising. */
@@ -85,46 +98,79 @@
 #define APP_ADV_DURATION                BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED   /**< The advertising time-out (in units of seconds). When set to 0, we will never time out. */
 
 
-#define MIN_CONN_INTERVAL               MSEC_TO_UNITS(100, UNIT_1_25_MS)        /**< Minimum acceptable connection interval (0.5 seconds). */
-#define MAX_CONN_INTERVAL               MSEC_TO_UNITS(200, UNIT_1_25_MS)        /**< Maximum acceptable connection interval (1 second). */
-#define SLAVE_LATENCY                   0                                       /**< Slave latency. */
-#define CONN_SUP_TIMEOUT                MSEC_TO_UNITS(4000, UNIT_10_MS)         /**< Connection supervisory time-out (4 seconds). */
+#define OFFLOAD_MIN_CONN_INTERVAL       MSEC_TO_UNITS(7.5, UNIT_1_25_MS)        /**< Minimum connection interval while offloading (7.5 ms), short so an offload gets many connection events. */
+#define OFFLOAD_MAX_CONN_INTERVAL       MSEC_TO_UNITS(15, UNIT_1_25_MS)         /**< Maximum connection interval while offloading (15 ms). */
+#define OFFLOAD_SLAVE_LATENCY           0                                       /**< Slave latency while offloading. */
+#define IDLE_MIN_CONN_INTERVAL          MSEC_TO_UNITS(100, UNIT_1_25_MS)        /**< Minimum connection interval between offloads (100 ms). */
+#define IDLE_MAX_CONN_INTERVAL          MSEC_TO_UNITS(200, UNIT_1_25_MS)        /**< Maximum connection interval between offloads (200 ms). */
+#define IDLE_SLAVE_LATENCY              4                                       /**< Slave latency between offloads, the radio wakes about once a second while an alert can still go out on any event. */
+#define CONN_SUP_TIMEOUT                MSEC_TO_UNITS(6000, UNIT_10_MS)         /**< Connection supervisory time-out (6 seconds), above twice the idle interval times the latency. */
 
-#define FIRST_CONN_PARAMS_UPDATE_DELAY  APP_TIMER_TICKS(20000)                  /**< Time from initiating event (connect or start of notification) to first time sd_ble_gap_conn_param_update is called (15 seconds). */
+#define FIRST_CONN_PARAMS_UPDATE_DELAY  APP_TIMER_TICKS(1000)                   /**< Time from initiating event (connect or start of notification) to first time sd_ble_gap_conn_param_update is called (1 second), the central usually opens with a slow interval. */
 #define NEXT_CONN_PARAMS_UPDATE_DELAY   APP_TIMER_TICKS(5000)                   /**< Time between each call to sd_ble_gap_conn_param_update after the first call (5 seconds). */
 #define MAX_CONN_PARAMS_UPDATE_COUNT    3                                       /**< Number of attempts before giving up the connection parameter negotiation. */
 
 #define BUTTON_DETECTION_DELAY          APP_TIMER_TICKS(50)                     /**< Delay from a GPIOTE event until a button is reported as pushed (in number of timer ticks). */
 
+#define ADXL_SAMPLE_RATE_HZ             6400                                    /**< adxl372 output data rate of the PCB Revision 1 captures, converts record deltas to time. */
+
 #define DEAD_BEEF                       0xDEADBEEF                              /**< Value used as error code on stack dump, can be used to identify stack location on stack unwind. */
 
 
 BLE_LBS_DEF(m_lbs);                                                             /**< LED Button Service instance. */
+BLE_IOS_DEF(m_ios);                                                             /**< Impact Offload Service instance. */
 NRF_BLE_GATT_DEF(m_gatt);                                                       /**< GATT module instance. */
 NRF_BLE_QWR_DEF(m_qwr);                                                         /**< Context for the Queued Write module.*/
+#if BENCH_ENABLED
+BLE_BENCH_DEF(m_bench);                                                         /**< BLE Throughput Benchmark Service instance. */
+#endif
 
 static uint16_t m_conn_handle = BLE_CONN_HANDLE_INVALID;                        /**< Handle of the current connection. */
+static bool m_conn_fast = false;                                                /**< The offload connection parameters are requested, the idle ones otherwise. */
+#if BENCH_ENABLED
+static bool m_conn_stale = false;                                               /**< A benchmark changed the connection parameters, they are requested again once it ends. */
+#endif
+static event_store_t m_event_store;                                             /**< Impact events stored in the flash, read by the Impact Offload Service. */
+static event_store_cache_t m_event_store_cache;                                 /**< Index pages and headers of the event store, repeated queries and offloads skip the flash. */
 
 static uint8_t m_adv_handle = BLE_GAP_ADV_SET_HANDLE_NOT_SET;                   /**< Advertising handle used to identify an advertising set. */
-static uint8_t m_enc_advdata[BLE_GAP_ADV_SET_DATA_SIZE_MAX];                    /**< Buffer for storing an encoded advertising set. */
-static uint8_t m_enc_scan_response_data[BLE_GAP_ADV_SET_DATA_SIZE_MAX];         /**< Buffer for storing an encoded scan data. */
+static uint8_t m_enc_advdata[2][BLE_GAP_ADV_SET_DATA_SIZE_MAX];                 /**< Buffers for storing an encoded advertising set, the SoftDevice keeps one while the other is updated. */
+static uint8_t m_enc_scan_response_data[2][BLE_GAP_ADV_SET_DATA_SIZE_MAX];      /**< Buffers for storing an encoded scan data. */
+static uint8_t m_adv_buf;                                                       /**< Index of the buffers the SoftDevice advertises from. */
+static ble_ios_adv_summary_t m_adv_summary;                                     /**< Impact summary in the advertising data. */
 
-/**@brief Struct that contains pointers to the encoded advertising data. */
-static ble_gap_adv_data_t m_adv_data =
+/**@brief Structs that contain pointers to the encoded advertising data. */
+static ble_gap_adv_data_t m_adv_data[2] =
 {
-    .adv_data =
     {
-        .p_data = m_enc_advdata,
-        .len    = BLE_GAP_ADV_SET_DATA_SIZE_MAX
+        .adv_data      = {.p_data = m_enc_advdata[0],            .len = BLE_GAP_ADV_SET_DATA_SIZE_MAX},
+        .scan_rsp_data = {.p_data = m_enc_scan_response_data[0], .len = BLE_GAP_ADV_SET_DATA_SIZE_MAX},
     },
-    .scan_rsp_data =
     {
-        .p_data = m_enc_scan_response_data,
-        .len    = BLE_GAP_ADV_SET_DATA_SIZE_MAX
+        .adv_data      = {.p_data = m_enc_advdata[1],            .len = BLE_GAP_ADV_SET_DATA_SIZE_MAX},
+        .scan_rsp_data = {.p_data = m_enc_scan_response_data[1], .len = BLE_GAP_ADV_SET_DATA_SIZE_MAX},
+    },
+};
 
-    }
+/**@brief Connection parameters while an offload runs. */
+static ble_gap_conn_params_t m_offload_conn_params =
+{
+    .min_conn_interval = OFFLOAD_MIN_CONN_INTERVAL,
+    .max_conn_interval = OFFLOAD_MAX_CONN_INTERVAL,
+    .slave_latency     = OFFLOAD_SLAVE_LATENCY,
+    .conn_sup_timeout  = CONN_SUP_TIMEOUT,
 };
 
+/**@brief Connection parameters between offloads, also the preferred ones the connection opens with. */
+static ble_gap_conn_params_t m_idle_conn_params =
+{
+    .min_conn_interval = IDLE_MIN_CONN_INTERVAL,
+    .max_conn_interval = IDLE_MAX_CONN_INTERVAL,
+    .slave_latency     = IDLE_SLAVE_LATENCY,
+    .conn_sup_timeout  = CONN_SUP_TIMEOUT,
+};
+
+
 /**@brief Function for assert macro callback.
  *
  * @details This function will be called in case of an assert in the SoftDevice.
@@ -173,7 +219,6 @@ static void timers_init(void)
 static void gap_params_init(void)
 {
     ret_code_t              err_code;
-    ble_gap_conn_params_t   gap_conn_params;
     ble_gap_conn_sec_mode_t sec_mode;
 
     BLE_GAP_CONN_SEC_MODE_SET_OPEN(&sec_mode);
@@ -183,57 +228,99 @@ static void gap_params_init(void)
                                           strlen(DEVICE_NAME));
     APP_ERROR_CHECK(err_code);
 
-    memset(&gap_conn_params, 0, sizeof(gap_conn_params));
+    err_code = sd_ble_gap_ppcp_set(&m_idle_conn_params);
+    APP_ERROR_CHECK(err_code);
+}
 
-    gap_conn_params.min_conn_interval = MIN_CONN_INTERVAL;
-    gap_conn_params.max_conn_interval = MAX_CONN_INTERVAL;
-    gap_conn_params.slave_latency     = SLAVE_LATENCY;
-    gap_conn_params.conn_sup_timeout  = CONN_SUP_TIMEOUT;
 
-    err_code = sd_ble_gap_ppcp_set(&gap_conn_params);
-    APP_ERROR_CHECK(err_code);
+/**@brief Function for handling events from the GATT module.
+ *
+ * @details The Impact Offload Service sends notifications as long as the negotiated ATT MTU allows.
+ */
+static void gatt_evt_handler(nrf_ble_gatt_t * p_gatt, nrf_ble_gatt_evt_t const * p_evt)
+{
+    if (p_evt->evt_id == NRF_BLE_GATT_EVT_ATT_MTU_UPDATED)
+    {
+        // The ATT opcode and handle take 3 bytes of every notification.
+        m_ios.max_data_len = MIN(p_evt->params.att_mtu_effective - 3, BLE_IOS_MAX_DATA_LEN);
+#if BENCH_ENABLED
+        m_bench.max_data_len = MIN(p_evt->params.att_mtu_effective - 3, BLE_BENCH_MAX_DATA_LEN);
+#endif
+        NRF_LOG_INFO("ATT MTU %d, %d bytes per notification", p_evt->params.att_mtu_effective, m_ios.max_data_len);
+    }
+    else if (p_evt->evt_id == NRF_BLE_GATT_EVT_DATA_LENGTH_UPDATED)
+    {
+        NRF_LOG_INFO("Data length %d", p_evt->params.data_length);
+    }
 }
 
 
 /**@brief Function for initializing the GATT module.
+ *
+ * @details The module negotiates NRF_SDH_BLE_GATT_MAX_MTU_SIZE and NRF_SDH_BLE_GAP_DATA_LENGTH on connect.
  */
 static void gatt_init(void)
 {
-    ret_code_t err_code = nrf_ble_gatt_init(&m_gatt, NULL);
+    ret_code_t err_code = nrf_ble_gatt_init(&m_gatt, gatt_evt_handler);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = nrf_ble_gatt_att_mtu_periph_set(&m_gatt, NRF_SDH_BLE_GATT_MAX_MTU_SIZE);
     APP_ERROR_CHECK(err_code);
 }
 
 
-/**@brief Function for initializing the Advertising functionality.
+/**@brief Function for encoding the advertising and scan response data.
  *
- * @details Encodes the required advertising data and passes it to the stack.
- *          Also builds a structure to be passed to the stack when starting advertising.
+ * @details The advertising data carries the name and the impact summary, manufacturer specific data
+ *          of BLE_IOS_ADV_COMPANY_ID, so a scanner doesn't need the scan response to read it.
  */
-static void advertising_init(void)
+static void advertising_encode(ble_gap_adv_data_t * p_adv_data)
 {
-    ret_code_t    err_code;
-    ble_advdata_t advdata;
-    ble_advdata_t srdata;
+    ret_code_t                err_code;
+    ble_advdata_t             advdata;
+    ble_advdata_t             srdata;
+    ble_advdata_manuf_data_t  manuf_data;
 
-    ble_uuid_t adv_uuids[] = {{LBS_UUID_SERVICE, m_lbs.uuid_type}};
+    ble_uuid_t adv_uuids[] = {{IOS_UUID_SERVICE, m_ios.uuid_type}};
+
+    manuf_data.company_identifier = BLE_IOS_ADV_COMPANY_ID;
+    manuf_data.data.p_data        = (uint8_t *) &m_adv_summary;
+    manuf_data.data.size          = sizeof(m_adv_summary);
 
     // Build and set advertising data.
     memset(&advdata, 0, sizeof(advdata));
 
-    advdata.name_type          = BLE_ADVDATA_FULL_NAME;
-    advdata.include_appearance = true;
-    advdata.flags              = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
+    advdata.name_type             = BLE_ADVDATA_FULL_NAME;
+    advdata.include_appearance    = true;
+    advdata.flags                 = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
+    advdata.p_manuf_specific_data = &manuf_data;
 
 
     memset(&srdata, 0, sizeof(srdata));
     srdata.uuids_complete.uuid_cnt = sizeof(adv_uuids) / sizeof(adv_uuids[0]);
     srdata.uuids_complete.p_uuids  = adv_uuids;
 
-    err_code = ble_advdata_encode(&advdata, m_adv_data.adv_data.p_data, &m_adv_data.adv_data.len);
+    p_adv_data->adv_data.len = BLE_GAP_ADV_SET_DATA_SIZE_MAX;
+    err_code = ble_advdata_encode(&advdata, p_adv_data->adv_data.p_data, &p_adv_data->adv_data.len);
     APP_ERROR_CHECK(err_code);
 
-    err_code = ble_advdata_encode(&srdata, m_adv_data.scan_rsp_data.p_data, &m_adv_data.scan_rsp_data.len);
+    p_adv_data->scan_rsp_data.len = BLE_GAP_ADV_SET_DATA_SIZE_MAX;
+    err_code = ble_advdata_encode(&srdata, p_adv_data->scan_rsp_data.p_data, &p_adv_data->scan_rsp_data.len);
     APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for initializing the Advertising functionality.
+ *
+ * @details Encodes the required advertising data and passes it to the stack.
+ *          Also builds a structure to be passed to the stack when starting advertising.
+ */
+static void advertising_init(void)
+{
+    ret_code_t    err_code;
+
+    ble_ios_adv_summary_get(&m_ios, BLE_IOS_ADV_BATTERY_UNKNOWN, &m_adv_summary);
+    advertising_encode(&m_adv_data[m_adv_buf]);
 
     ble_gap_adv_params_t adv_params;
 
@@ -247,7 +334,7 @@ static void advertising_init(void)
     adv_params.filter_policy   = BLE_GAP_ADV_FP_ANY;
     adv_params.interval        = APP_ADV_INTERVAL;
 
-    err_code = sd_ble_gap_adv_set_configure(&m_adv_handle, &m_adv_data, &adv_params);
+    err_code = sd_ble_gap_adv_set_configure(&m_adv_handle, &m_adv_data[m_adv_buf], &adv_params);
     APP_ERROR_CHECK(err_code);
 }
 
@@ -289,6 +376,27 @@ static void led_write_handler(uint16_t conn_handle, ble_lbs_t * p_lbs, uint8_t l
 }
 
 
+#if BENCH_ENABLED
+/**@brief Function for reading the flash source of the throughput benchmark.
+ *
+ * @details Reads the event store's ring as it is on the flash, wrapping at its end, so a run
+ *          costs the same spi reads as an offload.
+ */
+static int8_t bench_flash_read(uint32_t offset, uint8_t * p_data, uint16_t length)
+{
+    uint32_t address = EVENT_STORE_DATA_ADDRESS + offset % EVENT_STORE_RING_SIZE;
+    uint32_t first   = MIN(length, EVENT_STORE_DATA_END - address);
+    int8_t   ret     = mt25ql256aba_read(address, p_data, first);
+
+    if (ret < 0 || first == length)
+    {
+        return ret;
+    }
+    return mt25ql256aba_read(EVENT_STORE_DATA_ADDRESS, p_data + first, length - first);
+}
+#endif
+
+
 /**@brief Function for initializing services that will be used by the application.
  */
 static void services_init(void)
@@ -308,6 +416,16 @@ static void services_init(void)
 
     err_code = ble_lbs_init(&m_lbs, &init);
     APP_ERROR_CHECK(err_code);
+
+    // Initialize the Impact Offload Service, there is no capture pipeline to report on here.
+    err_code = ble_ios_init(&m_ios, &m_event_store, NULL, NULL, NULL);
+    APP_ERROR_CHECK(err_code);
+
+#if BENCH_ENABLED
+    // Initialize the BLE Throughput Benchmark Service, its flash source is the event store's ring.
+    err_code = ble_bench_init(&m_bench, bench_flash_read);
+    APP_ERROR_CHECK(err_code);
+#endif
 }
 
 
@@ -328,6 +446,13 @@ static void on_conn_params_evt(ble_conn_params_evt_t * p_evt)
 
     if (p_evt->evt_type == BLE_CONN_PARAMS_EVT_FAILED)
     {
+#if BENCH_ENABLED
+        // The benchmark runs whatever interval the central grants.
+        if (ble_bench_active(&m_bench))
+        {
+            return;
+        }
+#endif
         err_code = sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_CONN_INTERVAL_UNACCEPTABLE);
         APP_ERROR_CHECK(err_code);
     }
@@ -367,6 +492,44 @@ static void conn_params_init(void)
 }
 
 
+/**@brief Function for following the offload with the connection parameters.
+ *
+ * @details Asks for the short interval once an offload starts and for the long one with slave latency
+ *          once it ends, so the radio only runs at the offload rate while there is data to send. A
+ *          central still busy with the last update is asked again on the next pass.
+ */
+static void conn_params_process(void)
+{
+    bool       fast = ble_ios_offload_active(&m_ios);
+    ret_code_t err_code;
+
+#if BENCH_ENABLED
+    if (ble_bench_active(&m_bench))
+    {
+        m_conn_stale = true;
+        return;
+    }
+    if (m_conn_handle == BLE_CONN_HANDLE_INVALID || (fast == m_conn_fast && !m_conn_stale))
+    {
+        return;
+    }
+#else
+    if (m_conn_handle == BLE_CONN_HANDLE_INVALID || fast == m_conn_fast)
+    {
+        return;
+    }
+#endif
+    err_code = ble_conn_params_change_conn_params(m_conn_handle, fast ? &m_offload_conn_params : &m_idle_conn_params);
+    if (err_code == NRF_SUCCESS)
+    {
+        m_conn_fast = fast;
+#if BENCH_ENABLED
+        m_conn_stale = false;
+#endif
+    }
+}
+
+
 /**@brief Function for starting advertising.
  */
 static void advertising_start(void)
@@ -382,6 +545,31 @@ static void advertising_start(void)
 }
 
 
+/**@brief Function for updating the impact summary in the advertising data when it changes.
+ *
+ * @details Called from the main loop, it changes when an event is stored or the central acks one.
+ *          The SoftDevice may be advertising from the current buffers, so the data is encoded in the
+ *          other ones and handed over.
+ */
+static void advertising_update(void)
+{
+    ble_ios_adv_summary_t summary;
+    ret_code_t            err_code;
+
+    ble_ios_adv_summary_get(&m_ios, BLE_IOS_ADV_BATTERY_UNKNOWN, &summary);
+    if (memcmp(&summary, &m_adv_summary, sizeof(summary)) == 0)
+    {
+        return;
+    }
+    m_adv_summary = summary;
+    m_adv_buf ^= 1;
+    advertising_encode(&m_adv_data[m_adv_buf]);
+
+    err_code = sd_ble_gap_adv_set_configure(&m_adv_handle, &m_adv_data[m_adv_buf], NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
+
 /**@brief Function for handling BLE events.
  *
  * @param[in]   p_ble_evt   Bluetooth stack event.
@@ -400,8 +588,22 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
             bsp_board_led_off(ADVERTISING_LED);
 #endif
             m_conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+            m_conn_fast   = false;
+#if BENCH_ENABLED
+            m_conn_stale  = false;
+#endif
             err_code = nrf_ble_qwr_conn_handle_assign(&m_qwr, m_conn_handle);
             APP_ERROR_CHECK(err_code);
+            // Ask for the 2M PHY straight away, the central falls back to 1M if it can't.
+            {
+                ble_gap_phys_t const phys =
+                {
+                    .rx_phys = BLE_GAP_PHY_2MBPS,
+                    .tx_phys = BLE_GAP_PHY_2MBPS,
+                };
+                err_code = sd_ble_gap_phy_update(m_conn_handle, &phys);
+                APP_ERROR_CHECK(err_code);
+            }
 #ifdef USE_LED
             err_code = app_button_enable();
             APP_ERROR_CHECK(err_code);
@@ -430,6 +632,11 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
             APP_ERROR_CHECK(err_code);
             break;
 
+        case BLE_GAP_EVT_PHY_UPDATE:
+            NRF_LOG_INFO("PHY tx %d rx %d", p_ble_evt->evt.gap_evt.params.phy_update.tx_phy,
+                         p_ble_evt->evt.gap_evt.params.phy_update.rx_phy);
+            break;
+
         case BLE_GAP_EVT_PHY_UPDATE_REQUEST:
         {
             NRF_LOG_DEBUG("PHY update request.");
@@ -488,10 +695,39 @@ static void ble_stack_init(void)
     err_code = nrf_sdh_ble_default_cfg_set(APP_BLE_CONN_CFG_TAG, &ram_start);
     APP_ERROR_CHECK(err_code);
 
+    // Queue more notifications per connection than the default so the offload can fill a connection event,
+    // the Impact Offload Service keeps one of them free for alerts.
+    ble_cfg_t ble_cfg;
+    memset(&ble_cfg, 0, sizeof(ble_cfg));
+    ble_cfg.conn_cfg.conn_cfg_tag                            = APP_BLE_CONN_CFG_TAG;
+    ble_cfg.conn_cfg.params.gatts_conn_cfg.hvn_tx_queue_size = BLE_IOS_HVN_TX_QUEUE_SIZE;
+    err_code = sd_ble_cfg_set(BLE_CONN_CFG_GATTS, &ble_cfg, ram_start);
+    APP_ERROR_CHECK(err_code);
+
+#if BLE_IOS_L2CAP_ENABLED
+    // One L2CAP channel a gateway can open for the offload, the Impact Offload Service only sends on it.
+    memset(&ble_cfg, 0, sizeof(ble_cfg));
+    ble_cfg.conn_cfg.conn_cfg_tag                        = APP_BLE_CONN_CFG_TAG;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.ch_count      = 1;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.rx_mps        = BLE_L2CAP_MPS_MIN;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.tx_mps        = BLE_IOS_L2CAP_MPS;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.rx_queue_size = 1;
+    ble_cfg.conn_cfg.params.l2cap_conn_cfg.tx_queue_size = BLE_IOS_L2CAP_TX_QUEUE_SIZE;
+    err_code = sd_ble_cfg_set(BLE_CONN_CFG_L2CAP, &ble_cfg, ram_start);
+    APP_ERROR_CHECK(err_code);
+#endif
+
     // Enable BLE stack.
     err_code = nrf_sdh_ble_enable(&ram_start);
     APP_ERROR_CHECK(err_code);
 
+    // Let a connection event run on past NRF_SDH_BLE_GAP_EVENT_LENGTH while there is data to send.
+    ble_opt_t opt;
+    memset(&opt, 0, sizeof(opt));
+    opt.common_opt.conn_evt_ext.enable = 1;
+    err_code = sd_ble_opt_set(BLE_COMMON_OPT_CONN_EVT_EXT, &opt);
+    APP_ERROR_CHECK(err_code);
+
     // Register a handler for BLE events.
     NRF_SDH_BLE_OBSERVER(m_ble_observer, APP_BLE_OBSERVER_PRIO, ble_evt_handler, NULL);
 }
@@ -547,6 +783,86 @@ static void buttons_init(void)
 #endif
 
 
+/**@brief Function for initializing the flash and the event store read by the Impact Offload Service.
+ */
+static void flash_init(void)
+{
+    ret_code_t err_code = spi_instance_init(&flash_spi, &flash_spi_config, SPI_FLASH_BURST_FREQ);
+    APP_ERROR_CHECK(err_code);
+
+    if (event_store_init(&m_event_store) < 0)
+    {
+        NRF_LOG_ERROR("Event store init failed");
+    }
+    event_store_cache_init(&m_event_store, &m_event_store_cache);
+    NRF_LOG_INFO("%d impact events stored", event_store_count(&m_event_store));
+}
+
+
+/**@brief Function for summarizing a stored event for the alert characteristic.
+ *
+ * @details Walks the records of the event through a record_reader_t for the peak resultant
+ *          acceleration and the time the records span.
+ *
+ * @return 0 if success, -1 on spi error, -2 or -3 if the event can't be read.
+ */
+static int8_t impact_alert_from_event(uint32_t id, ble_ios_alert_t * p_alert)
+{
+    static record_reader_t reader;
+    impact_record_t record;
+    uint32_t periods = 0;
+    uint16_t peak = 0;
+    uint16_t resultant;
+    uint8_t delta;
+    int8_t ret;
+
+    ret = record_reader_open(&reader, &m_event_store, id);
+    if (ret < 0)
+        return ret;
+    while ((ret = record_reader_next(&reader, &record)) > 0)
+    {
+        resultant = impact_record_resultant(&record, &delta);
+        peak = MAX(peak, resultant);
+        periods += delta;
+    }
+    if (ret < 0)
+        return ret;
+
+    p_alert->event_id = id;
+    p_alert->time = reader.header.time;
+    p_alert->peak_g_x10 = (uint16_t) (ADXL372_COUNTS_TO_MG(peak) / 100);
+    p_alert->duration_ms = (uint16_t) MIN(periods * 1000 / ADXL_SAMPLE_RATE_HZ, UINT16_MAX);
+
+    return 0;
+}
+
+
+/**@brief Function for sending the alert of the newest stored event.
+ *
+ * @details A capture app calls ble_ios_alert_send right after event_store_commit. This test app
+ *          doesn't capture, so it alerts the newest event once a central enables alerts.
+ */
+static void impact_alert_latest(void)
+{
+    ble_ios_alert_t alert;
+    uint32_t count = event_store_count(&m_event_store);
+
+    if (count == 0)
+    {
+        return;
+    }
+    if (impact_alert_from_event(count - 1, &alert) < 0)
+    {
+        NRF_LOG_ERROR("Event %d can't be summarized", count - 1);
+        return;
+    }
+    if (ble_ios_alert_send(&m_ios, &alert) == -1)
+    {
+        NRF_LOG_ERROR("Impact alert failed");
+    }
+}
+
+
 static void log_init(void)
 {
     ret_code_t err_code = NRF_LOG_INIT(NULL);
@@ -591,6 +907,7 @@ int main(void)
 #endif
     timers_init();
     power_management_init();
+    flash_init();
     ble_stack_init();
     gap_params_init();
     gatt_init();
@@ -604,8 +921,31 @@ int main(void)
     advertising_start();
 
     // Enter main loop.
+    bool alert_enabled = false;
     for (;;)
     {
+        if (m_ios.alert_enabled != alert_enabled)
+        {
+            alert_enabled = m_ios.alert_enabled;
+            if (alert_enabled)
+            {
+                impact_alert_latest();
+            }
+        }
+
+        // Sleeps once the SoftDevice tx queue is full, BLE_GATTS_EVT_HVN_TX_COMPLETE or BLE_L2CAP_EVT_CH_TX wakes it to send more.
+        if (ble_ios_offload_process(&m_ios) < 0)
+        {
+            NRF_LOG_ERROR("Impact offload stopped");
+        }
+#if BENCH_ENABLED
+        if (ble_bench_process(&m_bench) < 0)
+        {
+            NRF_LOG_ERROR("Throughput benchmark stopped");
+        }
+#endif
+        conn_params_process();
+        advertising_update();
         idle_state_handle();
     }
 }
@@ -0,0 +1,443 @@
+//-------------------------------------------
+// Title: flash_stress.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Endurance and timing stress benchmark of the mt25ql256aba on
+// PCB Revision 1. Programs and erases a test region STRESS_CYCLES times and
+// keeps the distribution of each operation's time, the program and erase
+// fail bits of the flag status register and the bytes that read back wrong.
+// Each cycle erases one 4KB subsector of the region and programs its 16
+// pages, the region's 32KB half and then the whole 64KB sector are erased
+// once per 16 cycles, so every subsector sees all three erase sizes.
+// Results are printed at the end, and a progress line every
+// STRESS_REPORT_EVERY cycles, one line each
+//   STRESS,<op>,<stat>,<value>,<unit>
+//   STRESS,<op>,hist,<from us>,<count>
+// the same grep and compare workflow as perf_bench, over flash lots.
+// Times run from the command to the write in progress flag clearing, the
+// spi transfer of the command is left out, so they are tPP, tSSE and tSE of
+// the datasheet as the erase scheduler and the commit budget see them.
+// Build with CYCLES=<n> for a longer run and BULK=1 to time one bulk
+// erase (tBE) of the whole chip first
+// note: the bench sector below the crash log is worn by this test, BULK=1
+// erases the whole flash, the event store and the logs too
+//-------------------------------------------
+
+//general c libraries
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+//general nrf
+#include "nrf.h"
+#include "nordic_common.h"
+#include "boards.h"
+#include "nrf_delay.h"
+#include "system_nrf52.h"
+
+//flash driver
+#include "spi_driver.h"
+#include "mt25ql256aba.h"
+#include "timebase.h"
+
+//for NRF_LOG()
+#include "nrf_log.h"
+#include "nrf_log_ctrl.h"
+#include "nrf_log_default_backends.h"
+
+//for error logging
+#include "app_error.h"
+
+#ifndef STRESS_CYCLES
+#define STRESS_CYCLES 4096
+#endif
+#ifndef STRESS_BULK_ERASE
+#define STRESS_BULK_ERASE 0
+#endif
+#define STRESS_ADDRESS MT25QL256ABA_BENCH_ADDRESS //the region, as perf_bench
+#define STRESS_SUBSECTORS (MT25QL256ABA_SECTOR_SIZE/MT25QL256ABA_SUBSECTOR_4KB_SIZE)
+#define STRESS_PAGES (MT25QL256ABA_SUBSECTOR_4KB_SIZE/MT25QL256ABA_PAGE_SIZE) //per subsector
+#define STRESS_HALF_ERASE_CYCLE 7 //of every STRESS_SUBSECTORS cycles, the 32KB erase of the half not yet rewritten
+#define STRESS_REPORT_EVERY 256
+#define STRESS_BUCKETS 128 //quarter octaves of us, up to 2^32 us
+#define STRESS_PERMILLES 4
+
+//datasheet maximums, times above them are counted
+#define STRESS_PAGE_PROGRAM_MAX_US 1800
+#define STRESS_SUBSECTOR_ERASE_MAX_US 400000
+#define STRESS_HALF_ERASE_MAX_US 1000000
+#define STRESS_SECTOR_ERASE_MAX_US 1000000
+#define STRESS_BULK_ERASE_MAX_US 460000000
+
+typedef struct {
+    char const *name;               //constant, NRF_LOG keeps the pointer
+    uint32_t max_spec_us;
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t over_spec;             //times above max_spec_us
+    uint32_t flag_errors;           //operations that left a fail bit in the flag status register
+    uint32_t verify_errors;         //bytes that read back wrong after it
+    uint32_t hist[STRESS_BUCKETS];
+} stress_op_t;
+
+typedef enum {
+    STRESS_OP_PAGE_PROGRAM = 0,
+    STRESS_OP_SUBSECTOR_ERASE,
+    STRESS_OP_HALF_ERASE,
+    STRESS_OP_SECTOR_ERASE,
+    STRESS_OP_BULK_ERASE,
+    STRESS_OP_COUNT
+} stress_op_id_t;
+
+void log_init(void);
+void spi_flash_init(void);
+void stress_cycle(uint32_t cycle);
+void stress_erase(stress_op_id_t id, uint32_t address, uint32_t size);
+void stress_program(uint32_t address, uint32_t cycle);
+uint32_t stress_wait(stress_op_id_t id, uint32_t start);
+void stress_verify(stress_op_id_t id, uint32_t address, uint32_t size, uint8_t const* expected);
+void stress_pattern(uint32_t cycle);
+uint8_t stress_bucket(uint32_t us);
+uint32_t stress_bucket_from_us(uint8_t bucket);
+uint32_t stress_percentile(stress_op_t const* p_op, uint32_t permille);
+void stress_report(void);
+static void stress_ret_check(int8_t ret);
+
+static stress_op_t m_ops[STRESS_OP_COUNT] = {
+    [STRESS_OP_PAGE_PROGRAM]    = {.name = "page_program",    .max_spec_us = STRESS_PAGE_PROGRAM_MAX_US},
+    [STRESS_OP_SUBSECTOR_ERASE] = {.name = "subsector_erase", .max_spec_us = STRESS_SUBSECTOR_ERASE_MAX_US},
+    [STRESS_OP_HALF_ERASE]      = {.name = "32kb_erase",      .max_spec_us = STRESS_HALF_ERASE_MAX_US},
+    [STRESS_OP_SECTOR_ERASE]    = {.name = "sector_erase",    .max_spec_us = STRESS_SECTOR_ERASE_MAX_US},
+    [STRESS_OP_BULK_ERASE]      = {.name = "bulk_erase",      .max_spec_us = STRESS_BULK_ERASE_MAX_US},
+};
+static char const * const m_percentile_names[STRESS_PERMILLES] = {"p50", "p90", "p99", "p999"};
+static const uint32_t m_permilles[STRESS_PERMILLES] = {500, 900, 990, 999};
+
+static uint8_t m_pattern[MT25QL256ABA_SUBSECTOR_4KB_SIZE];
+static uint8_t m_read_buf[MT25QL256ABA_SUBSECTOR_4KB_SIZE];
+static uint8_t m_erased[MT25QL256ABA_SUBSECTOR_4KB_SIZE];
+static uint32_t m_subsector_erases[STRESS_SUBSECTORS]; //of any size, the wear of each subsector
+static uint32_t m_program_fails;
+static uint32_t m_erase_fails;
+static uint32_t m_protection_fails;
+static uint32_t m_spi_errors;
+
+int main (void)
+{
+    uint32_t cycle;
+    uint8_t i;
+
+    // Initialize.
+    SystemInit();
+    log_init();
+    spi_flash_init();
+    memset(m_erased, 0xFF, sizeof(m_erased));
+    for (i = 0; i < STRESS_OP_COUNT; i++)
+        m_ops[i].min_us = UINT32_MAX;
+
+    NRF_LOG_INFO("FLASH STRESS START");
+    if (mt25ql256aba_check_id() < 0)
+    {
+        NRF_LOG_ERROR("FLASH ID CHECK FAIL");
+        NRF_LOG_FLUSH();
+        while(1){
+            __WFE();
+        }
+    }
+    //a fail bit left from before the reset would be counted against the first operation
+    stress_ret_check(mt25ql256aba_write_op(MT25QL256ABA_CLEAR_FLAG_STATUS_REGISTER, NULL, 0, NULL, 0));
+
+    timebase_start();
+#if STRESS_BULK_ERASE
+    stress_erase(STRESS_OP_BULK_ERASE, 0, MT25QL256ABA_FLASH_SIZE);
+#endif
+    for (cycle = 0; cycle < STRESS_CYCLES; cycle++)
+    {
+        stress_cycle(cycle);
+        if ((cycle + 1) % STRESS_REPORT_EVERY == 0)
+        {
+            NRF_LOG_RAW_INFO("STRESS,progress,cycles,%u,count\r\n", cycle + 1);
+            NRF_LOG_RAW_INFO("STRESS,progress,fails,%u,count\r\n",
+                             m_program_fails + m_erase_fails + m_protection_fails + m_spi_errors);
+            NRF_LOG_FLUSH();
+        }
+    }
+    timebase_stop();
+
+    stress_report();
+    NRF_LOG_INFO("FLASH STRESS DONE");
+    NRF_LOG_FLUSH();
+
+    while(1){
+        __WFE();
+    }
+}
+
+// One cycle: erase and program one subsector and verify both, then the
+// larger erases when their turn comes. The pattern changes every cycle so
+// each bit is programmed and erased, not just the ones an impact writes
+void stress_cycle(uint32_t cycle)
+{
+    uint32_t subsector = cycle % STRESS_SUBSECTORS;
+    uint32_t address = STRESS_ADDRESS + subsector*MT25QL256ABA_SUBSECTOR_4KB_SIZE;
+
+    stress_erase(STRESS_OP_SUBSECTOR_ERASE, address, MT25QL256ABA_SUBSECTOR_4KB_SIZE);
+    stress_program(address, cycle);
+
+    //the upper half still holds the last pass, the lower half this one
+    if (subsector == STRESS_HALF_ERASE_CYCLE)
+        stress_erase(STRESS_OP_HALF_ERASE, STRESS_ADDRESS + MT25QL256ABA_SUBSECTOR_32KB_SIZE,
+                     MT25QL256ABA_SUBSECTOR_32KB_SIZE);
+    else if (subsector == STRESS_SUBSECTORS - 1)
+        stress_erase(STRESS_OP_SECTOR_ERASE, STRESS_ADDRESS, MT25QL256ABA_SECTOR_SIZE);
+}
+
+// Times one erase and checks it read back erased, a subsector at a time.
+// The bulk erase is not read back, 32MB would take minutes on the bus
+void stress_erase(stress_op_id_t id, uint32_t address, uint32_t size)
+{
+    uint32_t start;
+    uint32_t offset;
+    int8_t ret;
+
+    if (id == STRESS_OP_BULK_ERASE)
+    {
+        mt25ql256aba_check_write_in_progress_flag();
+        ret = mt25ql256aba_write_enable();
+        if (ret == 0)
+            ret = mt25ql256aba_write_op(MT25QL256ABA_BULK_ERASE, NULL, 0, NULL, 0);
+    }
+    else
+    {
+        ret = mt25ql256aba_erase_block(address, size);
+    }
+    start = timebase_now_us();
+    if (ret < 0)
+    {
+        stress_ret_check(ret);
+        return;
+    }
+    (void) stress_wait(id, start);
+
+    if (id == STRESS_OP_BULK_ERASE)
+        return;
+    for (offset = 0; offset < size; offset += MT25QL256ABA_SUBSECTOR_4KB_SIZE)
+    {
+        stress_verify(id, address + offset, MT25QL256ABA_SUBSECTOR_4KB_SIZE, m_erased);
+        m_subsector_erases[(address + offset - STRESS_ADDRESS)/MT25QL256ABA_SUBSECTOR_4KB_SIZE]++;
+    }
+}
+
+// Programs the cycle's pattern into the erased subsector at address, page by
+// page, each timed on its own, then reads the subsector back
+void stress_program(uint32_t address, uint32_t cycle)
+{
+    uint32_t start;
+    uint32_t i;
+    int8_t ret;
+
+    stress_pattern(cycle);
+    for (i = 0; i < STRESS_PAGES; i++)
+    {
+        ret = mt25ql256aba_page_program(address + i*MT25QL256ABA_PAGE_SIZE, &m_pattern[i*MT25QL256ABA_PAGE_SIZE],
+                                        MT25QL256ABA_PAGE_SIZE);
+        start = timebase_now_us();
+        if (ret < 0)
+        {
+            stress_ret_check(ret);
+            continue;
+        }
+        (void) stress_wait(STRESS_OP_PAGE_PROGRAM, start);
+    }
+    stress_verify(STRESS_OP_PAGE_PROGRAM, address, MT25QL256ABA_SUBSECTOR_4KB_SIZE, m_pattern);
+}
+
+// Polls the write in progress flag from start, a status read every few us,
+// then counts the time and the fail bits the operation left
+uint32_t stress_wait(stress_op_id_t id, uint32_t start)
+{
+    stress_op_t *p_op = &m_ops[id];
+    flag_reg_t flags;
+    bool in_progress = true;
+    uint32_t elapsed;
+
+    while (in_progress)
+    {
+        if (mt25ql256aba_write_in_progress(&in_progress) < 0)
+        {
+            m_spi_errors++;
+            in_progress = true;
+        }
+    }
+    elapsed = timebase_since_us(start);
+
+    p_op->count++;
+    p_op->sum_us += elapsed;
+    p_op->min_us = MIN(p_op->min_us, elapsed);
+    p_op->max_us = MAX(p_op->max_us, elapsed);
+    p_op->hist[stress_bucket(elapsed)]++;
+    if (elapsed > p_op->max_spec_us)
+        p_op->over_spec++;
+
+    mt25ql256aba_read_flag_reg(&flags);
+    if (flags.program || flags.erase || flags.protection)
+    {
+        p_op->flag_errors++;
+        m_program_fails += flags.program;
+        m_erase_fails += flags.erase;
+        m_protection_fails += flags.protection;
+        NRF_LOG_WARNING("%s fail, flags program %u erase %u protection %u", p_op->name,
+                        flags.program, flags.erase, flags.protection);
+        //the bits stay set until cleared and would fail the next operation too
+        stress_ret_check(mt25ql256aba_write_op(MT25QL256ABA_CLEAR_FLAG_STATUS_REGISTER, NULL, 0, NULL, 0));
+    }
+
+    return elapsed;
+}
+
+// Reads back size bytes at address, at most a subsector, and counts the ones
+// that differ from expected
+void stress_verify(stress_op_id_t id, uint32_t address, uint32_t size, uint8_t const* expected)
+{
+    uint32_t errors = 0;
+    uint32_t i;
+
+    if (mt25ql256aba_read(address, m_read_buf, size) < 0)
+    {
+        m_spi_errors++;
+        return;
+    }
+    for (i = 0; i < size; i++)
+    {
+        if (m_read_buf[i] != expected[i])
+            errors++;
+    }
+    if (errors != 0)
+    {
+        m_ops[id].verify_errors += errors;
+        NRF_LOG_WARNING("%s verify, %u bytes wrong at 0x%08x", m_ops[id].name, errors, address);
+    }
+}
+
+// A subsector of xorshift bytes seeded by the cycle, different on every pass
+void stress_pattern(uint32_t cycle)
+{
+    uint32_t x = cycle*2654435761UL + 1;
+    uint32_t i;
+
+    for (i = 0; i < sizeof(m_pattern); i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        m_pattern[i] = x;
+    }
+}
+
+// Four buckets per power of two, exact below 4 us, so a p99 is within 19 %
+uint8_t stress_bucket(uint32_t us)
+{
+    uint8_t msb;
+
+    if (us < 4)
+        return us;
+    msb = 31 - __CLZ(us);
+    return msb*4 + ((us >> (msb - 2)) & 0x3);
+}
+
+// @return the smallest time of a bucket, in us
+uint32_t stress_bucket_from_us(uint8_t bucket)
+{
+    uint8_t msb = bucket/4;
+
+    //4 to 7 are never filled, 4 us starts at 8
+    if (bucket < 8)
+        return MIN(bucket, 4);
+    return (4 + (bucket & 0x3)) << (msb - 2);
+}
+
+// @return the top of the bucket that holds the permille, at most the longest time
+uint32_t stress_percentile(stress_op_t const* p_op, uint32_t permille)
+{
+    uint32_t rank = (uint32_t) (((uint64_t) p_op->count*permille + 999)/1000);
+    uint32_t seen = 0;
+    uint32_t top;
+    uint8_t i;
+
+    for (i = 0; i < STRESS_BUCKETS; i++)
+    {
+        seen += p_op->hist[i];
+        if (seen >= rank)
+        {
+            top = (i + 1 < STRESS_BUCKETS) ? stress_bucket_from_us(i + 1) - 1 : UINT32_MAX;
+            return MIN(top, p_op->max_us);
+        }
+    }
+    return p_op->max_us;
+}
+
+// Prints each operation's times, percentiles, fails and histogram, then the wear
+void stress_report(void)
+{
+    stress_op_t const *p_op;
+    uint32_t max_erases = 0;
+    uint8_t i, j;
+
+    NRF_LOG_RAW_INFO("STRESS,cycles,count,%u,count\r\n", STRESS_CYCLES);
+    for (i = 0; i < STRESS_OP_COUNT; i++)
+    {
+        p_op = &m_ops[i];
+        if (p_op->count == 0)
+            continue;
+        NRF_LOG_RAW_INFO("STRESS,%s,count,%u,count\r\n", p_op->name, p_op->count);
+        NRF_LOG_RAW_INFO("STRESS,%s,min,%u,us\r\n", p_op->name, p_op->min_us);
+        NRF_LOG_RAW_INFO("STRESS,%s,mean,%u,us\r\n", p_op->name, (uint32_t) (p_op->sum_us/p_op->count));
+        for (j = 0; j < STRESS_PERMILLES; j++)
+            NRF_LOG_RAW_INFO("STRESS,%s,%s,%u,us\r\n", p_op->name, m_percentile_names[j],
+                             stress_percentile(p_op, m_permilles[j]));
+        NRF_LOG_RAW_INFO("STRESS,%s,max,%u,us\r\n", p_op->name, p_op->max_us);
+        NRF_LOG_RAW_INFO("STRESS,%s,over_spec,%u,count\r\n", p_op->name, p_op->over_spec);
+        NRF_LOG_RAW_INFO("STRESS,%s,flag_errors,%u,count\r\n", p_op->name, p_op->flag_errors);
+        NRF_LOG_RAW_INFO("STRESS,%s,verify_errors,%u,bytes\r\n", p_op->name, p_op->verify_errors);
+        NRF_LOG_FLUSH();
+        for (j = 0; j < STRESS_BUCKETS; j++)
+        {
+            if (p_op->hist[j] == 0)
+                continue;
+            NRF_LOG_RAW_INFO("STRESS,%s,hist,%u,%u\r\n", p_op->name, stress_bucket_from_us(j), p_op->hist[j]);
+            NRF_LOG_FLUSH();
+        }
+    }
+
+    for (i = 0; i < STRESS_SUBSECTORS; i++)
+        max_erases = MAX(max_erases, m_subsector_erases[i]);
+    NRF_LOG_RAW_INFO("STRESS,flags,program_fails,%u,count\r\n", m_program_fails);
+    NRF_LOG_RAW_INFO("STRESS,flags,erase_fails,%u,count\r\n", m_erase_fails);
+    NRF_LOG_RAW_INFO("STRESS,flags,protection_fails,%u,count\r\n", m_protection_fails);
+    NRF_LOG_RAW_INFO("STRESS,spi,errors,%u,count\r\n", m_spi_errors);
+    NRF_LOG_RAW_INFO("STRESS,wear,subsector_erases,%u,count\r\n", max_erases);
+    NRF_LOG_FLUSH();
+}
+
+void log_init(void)
+{
+    ret_code_t err_code = NRF_LOG_INIT(NULL);
+    APP_ERROR_CHECK(err_code);
+
+    NRF_LOG_DEFAULT_BACKENDS_INIT();
+}
+
+void spi_flash_init(void)
+{
+    ret_code_t err_code = spi_instance_init(&flash_spi, &flash_spi_config, SPI_FLASH_BURST_FREQ);
+    APP_ERROR_CHECK(err_code);
+}
+
+static void stress_ret_check(int8_t ret)
+{
+    if (ret < 0){
+        m_spi_errors++;
+        NRF_LOG_INFO("STRESS OPERATION FAIL");
+    }
+}
@@ -18,6 +18,7 @@
 #include "nrf_delay.h"
 
 #include "spi_driver.h"
+#include "icm20649.h"
 
 //for NRF_LOG()
 #include "nrf_log.h"
@@ -27,23 +28,9 @@
 //for error logging
 #include "app_error.h"
 
-// The custom data struct for the sensor
-// Holds acceleration and gyroscope data
-typedef struct{
-    int16_t accel_x;
-    int16_t accel_y;
-    int16_t accel_z;
-    int16_t gyro_x;
-    int16_t gyro_y;
-    int16_t gyro_z;
-} icm20649_data_t;
-
 // Function declarations
 static void log_init(void);
-int8_t icm20649_write_reg(uint8_t address, uint8_t data);
-int8_t icm20649_read_reg(uint8_t address, uint8_t * reg_data);
-int8_t icm20649_multibyte_read_reg( uint8_t reg_addr, uint8_t* reg_data, uint8_t num_bytes);
-void icm20649_read_gyro_accel_data(icm20649_data_t *icm20649_data);
+static void spi_gyro_init(void);
 
 
 
@@ -53,7 +40,7 @@ void icm20649_read_gyro_accel_data(icm20649_data_t *icm20649_data);
 int main (void)
 {
     // Initialize.
-    spi_init(); // initializes the SPI
+    spi_gyro_init(); // initializes the SPI
     log_init(); // initializes the logging function
 
     NRF_LOG_INFO(" ICM20649 TEST measurement mode");
@@ -162,82 +149,12 @@ int main (void)
 }
 
 /**
- * @brief Function for writing one byte to a single register address
- */
-int8_t icm20649_write_reg(uint8_t address, uint8_t data)
-{
-    uint8_t tx_msg[2];
-    uint8_t rx_buf[2];
-    tx_msg[0] = address;
-    tx_msg[1] = data;
-
-    return spi_write_and_read(SPI_ICM20649_CS_PIN, tx_msg, 2, rx_buf, 2 ); // send 2 bytes (address and data)
-}
-
-
-/**
- * @brief Function for reading one byte from a single register address
- */
-int8_t icm20649_read_reg(uint8_t address, uint8_t * reg_data)
-{
-    uint8_t reg_addr;
-    int8_t ret;
-    uint8_t rx_buf[2];
-
-    reg_addr = (uint8_t)  ( address | 0x80 ); //set 1st bit for reads
-    ret = spi_write_and_read(SPI_ICM20649_CS_PIN, &reg_addr, 1, rx_buf, 2);
-
-    *reg_data = rx_buf[1];
-
-    return ret; // return the read byte
-}
-
-
-/**
- * @brief Function for reading up to 256 consecutive bytes from the internal registers
+ * @brief Function for initializing the gyro spi instance from the board header
  */
-int8_t icm20649_multibyte_read_reg( uint8_t reg_addr, uint8_t* reg_data, uint8_t num_bytes) 
+static void spi_gyro_init(void)
 {
-    uint8_t read_addr;
-    uint8_t buf[257]; 
-    int8_t ret;
-    
-    if(num_bytes > 256) // if number of bytes is greater than 256, return an error
-        return -1;
-
-    read_addr = reg_addr | 0x80; //set MSB to 1 for read
-    memset( buf, 0x00, num_bytes + 1);
-
-    ret = spi_write_and_read(SPI_ICM20649_CS_PIN, &read_addr, 1, buf, num_bytes + 1 );
-    if (ret < 0)
-        return ret;
-    
-    memcpy(reg_data, &buf[1], num_bytes);
-
-    return ret;
-}
-
-/**
- * @brief Function for reading the gyroscope's data (linear and rotational)
- */
-void icm20649_read_gyro_accel_data(icm20649_data_t *icm20649_data)
-{
-    uint8_t rx_buf[12] = {0};
-
-    //REG BANK SEL select userbank 0
-    icm20649_write_reg(0x7F, 0x0);
-
-    icm20649_multibyte_read_reg( 0x2D, rx_buf, 12); // performs a multibyte read
-
-    // arranges the read data bytes for each measurement to proper values
-    icm20649_data->accel_x = rx_buf[0]<<8 | rx_buf[1];
-    icm20649_data->accel_y = rx_buf[2]<<8 | rx_buf[3];
-    icm20649_data->accel_z = rx_buf[4]<<8 | rx_buf[5];
-    icm20649_data->gyro_x = rx_buf[6]<<8 | rx_buf[7];
-    icm20649_data->gyro_y = rx_buf[8]<<8 | rx_buf[9];
-    icm20649_data->gyro_z = rx_buf[10]<<8 | rx_buf[11];
-    
-
+    ret_code_t err_code = spi_instance_init(&gyro_spi, &gyro_spi_config, SPI_GYRO_BURST_FREQ);
+    APP_ERROR_CHECK(err_code);
 }
 
 /**
@@ -29,6 +29,7 @@
 #include "mt25ql256aba.h"
 
 static void log_init(void);
+static void spi_flash_init(void);
 static void spi_ret_check(int8_t ret);
 
 // custom data struct
@@ -326,7 +327,7 @@ void exit_4byte_mode(void)
 int main (void)
 {
     //initialize
-    flash_spi_init();
+    spi_flash_init();
     log_init();
 
     NRF_LOG_INFO("");
@@ -364,6 +365,15 @@ static void log_init(void)
     NRF_LOG_DEFAULT_BACKENDS_INIT();
 }
 
+/**
+ * @brief Function for initializing the flash spi instance and its cs pin
+ */
+static void spi_flash_init(void)
+{
+    ret_code_t err_code = spi_instance_init(&flash_spi, &flash_spi_config, SPI_FLASH_BURST_FREQ);
+    APP_ERROR_CHECK(err_code);
+}
+
 /**
  * @brief Function for checking if write/read fail has occurred
  */
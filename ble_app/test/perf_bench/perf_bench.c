@@ -0,0 +1,486 @@
+//-------------------------------------------
+// Title: perf_bench.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Throughput benchmark of the PCB Revision 1 sensors, buses
+// and flash. Runs once at startup and prints every result as one line
+//   PERF,<metric>,<value>,<unit>
+// so a log capture can be grepped and compared between driver changes.
+// Measures
+// 1. the achievable sample rate of each sensor, polled back to back
+// 2. spi bytes/s of each spi instance at each bus frequency
+// 3. twi bytes/s of a ds1388 register read
+// 4. flash page program, erase and sequential read throughput
+// 5. trigger to commit latency of one polled impact capture
+// 6. cpu cycles of the adxl372 fifo unpack kernel against the byte at a time loop
+// note: the bench sector below the crash log is erased for the flash
+// benchmark and the commit, the event store and the logs are left alone
+//-------------------------------------------
+
+//general c libraries
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+//general nrf
+#include "nrf.h"
+#include "nordic_common.h"
+#include "boards.h"
+#include "nrf_delay.h"
+#include "system_nrf52.h"
+
+//sensor drivers
+#include "spi_driver.h"
+#include "twi_driver.h"
+#include "adxl372.h"
+#include "icm20649.h"
+#include "ds1388.h"
+#include "mt25ql256aba.h"
+#include "flash_page_writer.h"
+#include "impact_record.h"
+#include "impact_trigger.h"
+#include "timebase.h"
+#include "profiler.h"
+
+//for NRF_LOG()
+#include "nrf_log.h"
+#include "nrf_log_ctrl.h"
+#include "nrf_log_default_backends.h"
+
+//for error logging
+#include "app_error.h"
+
+#define PERF_SENSOR_READS 1000 //reads per sensor rate
+#define PERF_RTC_READS 100 //the twi reads are slower, fewer of them
+#define PERF_SPI_REPEATS 8 //transfers averaged per bus frequency
+#define PERF_FLASH_ADDRESS MT25QL256ABA_BENCH_ADDRESS //erased by the flash benchmark and the commit
+#define PERF_FLASH_PAGES 16 //pages programmed, then read back in one sequential read
+#define PERF_FLASH_READ_LENGTH (PERF_FLASH_PAGES*MT25QL256ABA_PAGE_SIZE)
+#define PERF_CAPTURE_MS 120 //matches IMPACT_MAX_DURATION of the rev1 integration code
+#define PERF_ACCEL_RATE_HZ 6400 //matches adxl372_default_init
+#define PERF_CAPTURE_SAMPLES ((PERF_CAPTURE_MS*PERF_ACCEL_RATE_HZ)/1000)
+#define PERF_GYRO_DIVIDER 6 //one icm20649 read per this many adxl372 samples, close to its 1125 Hz
+#define PERF_UNPACK_ENTRIES (ADXL_FIFO_MAX_SAMPLES*3) //a full xyz fifo burst
+#define PERF_UNPACK_REPEATS 64 //bursts averaged per unpack
+#define PERF_BURST_REPEATS 256 //bursts timed for the spread of the sampling path
+#define PERF_BURST_ONSET_MG 10000 //the game profile's trigger, it fires in the ramp
+#define PERF_BURST_RELEASE_MG 7000
+
+void log_init(void);
+void spi_accel_init(void);
+void spi_gyro_init(void);
+void spi_flash_init(void);
+void spi_accel_uninit(void);
+void spi_flash_uninit(void);
+void spi_switch_to_accel_from_flash(void);
+void spi_switch_to_flash_from_accel(void);
+void perf_result(char const* metric, uint32_t value, char const* unit);
+uint32_t perf_rate(uint32_t count, uint32_t elapsed_us);
+void bench_sensor_rates(void);
+void bench_spi(void);
+void bench_twi(void);
+void bench_flash(void);
+void bench_trigger_to_commit(void);
+void bench_fifo_unpack(void);
+void bench_burst_path(void);
+void perf_fifo_pattern(uint8_t* raw);
+static void perf_ret_check(int8_t ret);
+
+static const nrf_drv_spi_frequency_t m_frequencies[] = {
+    NRF_DRV_SPI_FREQ_1M, NRF_DRV_SPI_FREQ_2M, NRF_DRV_SPI_FREQ_4M, NRF_DRV_SPI_FREQ_8M};
+//metric names per frequency, NRF_LOG keeps the pointer so they have to be constant
+static char const * const m_accel_metrics[] = {"spi_accel_1mhz", "spi_accel_2mhz", "spi_accel_4mhz", "spi_accel_8mhz"};
+static char const * const m_gyro_metrics[] = {"spi_gyro_1mhz", "spi_gyro_2mhz", "spi_gyro_4mhz", "spi_gyro_8mhz"};
+static char const * const m_flash_metrics[] = {"flash_read_1mhz", "flash_read_2mhz", "flash_read_4mhz", "flash_read_8mhz"};
+
+//the flash benchmark and the capture share this buffer
+static uint8_t m_buf[PERF_CAPTURE_SAMPLES*IMPACT_RECORD_SIZE];
+static adxl372_accel_data_t m_unpack_samples[ADXL_FIFO_MAX_SAMPLES];
+static flash_page_writer_t m_writer;
+static uint32_t m_num_results;
+
+//rev1 accel and flash share the spi pins, see imu_pcb_rev1_test.c
+void spi_switch_to_accel_from_flash(void)
+{
+    spi_flash_uninit();
+    spi_accel_init();
+}
+
+void spi_switch_to_flash_from_accel(void)
+{
+    spi_accel_uninit();
+    spi_flash_init();
+}
+
+int main (void)
+{
+    // Initialize.
+    SystemInit();
+    log_init();
+    //the unpack and burst benchmarks count cycles and cache misses in every build
+    profiler_init();
+    profiler_icache_enable(true);
+    spi_accel_init();
+    spi_gyro_init();
+    twi_init();
+
+    adxl372_default_init();
+    icm20649_default_init();
+    ds1388_config(true);
+
+    NRF_LOG_INFO("PERF BENCH START");
+    perf_result("core_clock", SystemCoreClock, "Hz");
+    bench_sensor_rates();
+    bench_spi();
+    bench_twi();
+    bench_flash();
+    bench_trigger_to_commit();
+    bench_fifo_unpack();
+    bench_burst_path();
+    perf_result("results", m_num_results, "count");
+#if PROFILER_ENABLED
+    //per call timings of the driver probes over the whole run
+    profiler_dump();
+#endif
+    NRF_LOG_INFO("PERF BENCH DONE");
+    NRF_LOG_FLUSH();
+
+    while(1){
+        __WFE();
+    }
+}
+
+// Prints one result line, flushed right away so the lines are never interleaved
+void perf_result(char const* metric, uint32_t value, char const* unit)
+{
+    NRF_LOG_RAW_INFO("PERF,%s,%u,%s\r\n", metric, value, unit);
+    NRF_LOG_FLUSH();
+    m_num_results++;
+}
+
+uint32_t perf_rate(uint32_t count, uint32_t elapsed_us)
+{
+    if (elapsed_us == 0)
+        return 0;
+
+    return (uint32_t) (((uint64_t) count * 1000000) / elapsed_us);
+}
+
+// Back to back reads of each sensor. adxl372_get_accel_data waits on DATA_RDY
+// so it is bound by the output data rate, the raw register read is not
+void bench_sensor_rates(void)
+{
+    adxl372_accel_data_t accel;
+    icm20649_data_t gyro;
+    ds1388_data_t rtc;
+    uint8_t buf[ADXL_ACCEL_DATA_LENGTH];
+    uint32_t start;
+    uint32_t i;
+
+    timebase_start();
+
+    start = timebase_now_us();
+    for (i = 0; i < PERF_SENSOR_READS; i++)
+        adxl372_get_accel_data(&accel);
+    perf_result("adxl372_sample_rate", perf_rate(PERF_SENSOR_READS, timebase_since_us(start)), "Hz");
+
+    start = timebase_now_us();
+    for (i = 0; i < PERF_SENSOR_READS; i++)
+        perf_ret_check(adxl372_multibyte_read_reg(ADI_ADXL372_X_DATA_H, buf, ADXL_ACCEL_DATA_LENGTH));
+    perf_result("adxl372_read_rate", perf_rate(PERF_SENSOR_READS, timebase_since_us(start)), "Hz");
+
+    start = timebase_now_us();
+    for (i = 0; i < PERF_SENSOR_READS; i++)
+        icm20649_read_gyro_accel_data(&gyro);
+    perf_result("icm20649_read_rate", perf_rate(PERF_SENSOR_READS, timebase_since_us(start)), "Hz");
+
+    start = timebase_now_us();
+    for (i = 0; i < PERF_RTC_READS; i++)
+        ds1388_get_time(&rtc);
+    perf_result("ds1388_read_rate", perf_rate(PERF_RTC_READS, timebase_since_us(start)), "Hz");
+
+    timebase_stop();
+}
+
+// Burst reads on each spi instance at every bus frequency up to the device
+// limit, including the spi_driver and EasyDMA overhead per transaction.
+// The flash instance is timed with the sequential read in bench_flash
+void bench_spi(void)
+{
+    static uint8_t rx_buf[ADXL_FIFO_SIZE*2 + 1];
+    uint8_t accel_addr = (ADI_ADXL372_X_DATA_H << 1) | ADXL_SPI_RNW;
+    uint8_t gyro_addr = ICM20649_REG_ADDR(ICM20649_ACCEL_XOUT_H) | 0x80;
+    uint32_t start;
+    uint8_t i, j;
+
+    timebase_start();
+    for (i = 0; i < ARRAY_SIZE(m_frequencies); i++)
+    {
+        //a full fifo burst, longer than one EasyDMA transfer
+        spi_set_burst_frequency(&accel_spi, m_frequencies[i]);
+        start = timebase_now_us();
+        for (j = 0; j < PERF_SPI_REPEATS; j++)
+            perf_ret_check(spi_burst_read(&accel_spi, SPI_ACCEL_CS_PIN, &accel_addr, 1, rx_buf, sizeof(rx_buf)));
+        perf_result(m_accel_metrics[i], perf_rate(PERF_SPI_REPEATS*sizeof(rx_buf), timebase_since_us(start)), "B/s");
+
+        //icm20649 sensor registers are rated up to 7 MHz
+        if (m_frequencies[i] == NRF_DRV_SPI_FREQ_8M)
+            continue;
+        spi_set_burst_frequency(&gyro_spi, m_frequencies[i]);
+        start = timebase_now_us();
+        for (j = 0; j < PERF_SPI_REPEATS; j++)
+            perf_ret_check(spi_burst_read(&gyro_spi, SPI_GYRO_CS_PIN, &gyro_addr, 1, rx_buf, ICM20649_DATA_LENGTH + 1));
+        perf_result(m_gyro_metrics[i], perf_rate(PERF_SPI_REPEATS*(ICM20649_DATA_LENGTH + 1), timebase_since_us(start)), "B/s");
+    }
+    timebase_stop();
+
+    spi_set_burst_frequency(&accel_spi, SPI_ACCEL_BURST_FREQ);
+    spi_set_burst_frequency(&gyro_spi, SPI_GYRO_BURST_FREQ);
+}
+
+// One coherent read of the ds1388 time registers, the same read ds1388_get_time does
+void bench_twi(void)
+{
+    uint8_t regs[YEAR_REG - HUNDRED_SEC_REG + 1];
+    uint32_t start;
+    uint32_t i;
+
+    timebase_start();
+    start = timebase_now_us();
+    for (i = 0; i < PERF_RTC_READS; i++)
+        ds1388_read_registers(HUNDRED_SEC_REG, regs, sizeof(regs));
+    perf_result("twi_ds1388", perf_rate(PERF_RTC_READS*sizeof(regs), timebase_since_us(start)), "B/s");
+    timebase_stop();
+}
+
+// Erase, program and read back PERF_FLASH_ADDRESS. Every program and erase is
+// timed until the write in progress flag clears, not just until the command is sent
+void bench_flash(void)
+{
+    uint32_t start;
+    uint32_t elapsed;
+    uint32_t i;
+
+    spi_switch_to_flash_from_accel();
+    timebase_start();
+
+    start = timebase_now_us();
+    perf_ret_check(mt25ql256aba_erase_block(PERF_FLASH_ADDRESS, MT25QL256ABA_SECTOR_SIZE));
+    mt25ql256aba_check_write_in_progress_flag();
+    perf_result("flash_sector_erase", timebase_since_us(start), "us");
+
+    start = timebase_now_us();
+    perf_ret_check(mt25ql256aba_erase_block(PERF_FLASH_ADDRESS, MT25QL256ABA_SUBSECTOR_4KB_SIZE));
+    mt25ql256aba_check_write_in_progress_flag();
+    perf_result("flash_subsector_erase", timebase_since_us(start), "us");
+
+    for (i = 0; i < MT25QL256ABA_PAGE_SIZE; i++)
+        m_buf[i] = i;
+    start = timebase_now_us();
+    for (i = 0; i < PERF_FLASH_PAGES; i++)
+    {
+        perf_ret_check(mt25ql256aba_page_program(PERF_FLASH_ADDRESS + i*MT25QL256ABA_PAGE_SIZE, m_buf, MT25QL256ABA_PAGE_SIZE));
+        mt25ql256aba_check_write_in_progress_flag();
+    }
+    elapsed = timebase_since_us(start);
+    perf_result("flash_page_program", elapsed/PERF_FLASH_PAGES, "us");
+    perf_result("flash_program", perf_rate(PERF_FLASH_READ_LENGTH, elapsed), "B/s");
+
+    for (i = 0; i < ARRAY_SIZE(m_frequencies); i++)
+    {
+        spi_set_burst_frequency(&flash_spi, m_frequencies[i]);
+        start = timebase_now_us();
+        perf_ret_check(mt25ql256aba_read(PERF_FLASH_ADDRESS, m_buf, PERF_FLASH_READ_LENGTH));
+        perf_result(m_flash_metrics[i], perf_rate(PERF_FLASH_READ_LENGTH, timebase_since_us(start)), "B/s");
+    }
+    spi_set_burst_frequency(&flash_spi, SPI_FLASH_BURST_FREQ);
+
+    timebase_stop();
+    spi_switch_to_accel_from_flash();
+}
+
+// Polled capture of one PERF_CAPTURE_MS impact from the trigger, then the
+// commit of its raw records through the page writer as the event store
+// writes them, into the bench sector so no test event lands in the store.
+// The store erases ahead of its appends, the erase is left out of the time
+void bench_trigger_to_commit(void)
+{
+    impact_record_t* records = (impact_record_t*) m_buf;
+    adxl372_accel_data_t accel;
+    icm20649_data_t gyro;
+    ds1388_data_t rtc;
+    uint32_t capture_us;
+    uint32_t commit_us;
+    uint32_t i;
+
+    spi_switch_to_flash_from_accel();
+    perf_ret_check(mt25ql256aba_erase_block(PERF_FLASH_ADDRESS, MT25QL256ABA_SECTOR_SIZE));
+    mt25ql256aba_check_write_in_progress_flag();
+    flash_page_writer_init(&m_writer, PERF_FLASH_ADDRESS);
+    spi_switch_to_accel_from_flash();
+
+    //the trigger sample
+    adxl372_get_accel_data(&accel);
+    timebase_start();
+    ds1388_get_time(&rtc);
+    for (i = 0; i < PERF_CAPTURE_SAMPLES; i++)
+    {
+        adxl372_get_accel_data(&accel);
+        if (i % PERF_GYRO_DIVIDER == 0)
+            icm20649_read_gyro_accel_data(&gyro);
+        impact_record_pack(&records[i], &accel, &gyro, 1);
+    }
+    capture_us = timebase_now_us();
+
+    spi_switch_to_flash_from_accel();
+    perf_ret_check(flash_page_writer_append(&m_writer, records, PERF_CAPTURE_SAMPLES*IMPACT_RECORD_SIZE));
+    perf_ret_check(flash_page_writer_flush(&m_writer));
+    mt25ql256aba_check_write_in_progress_flag();
+    commit_us = timebase_since_us(capture_us);
+    spi_switch_to_accel_from_flash();
+    timebase_stop();
+
+    perf_result("capture_samples", PERF_CAPTURE_SAMPLES, "count");
+    perf_result("capture", capture_us, "us");
+    perf_result("commit", commit_us, "us");
+    perf_result("trigger_to_commit", capture_us + commit_us, "us");
+}
+
+// DWT cycles of unpacking one full fifo burst, the adxl372_fifo_unpack kernel
+// and the adxl372_fifo_unpack_scalar loop it replaces, on the same entries
+void bench_fifo_unpack(void)
+{
+    uint8_t* raw = m_buf;
+    uint32_t kernel_cycles = 0;
+    uint32_t scalar_cycles = 0;
+    uint32_t start;
+    uint16_t num_samples = 0;
+    uint32_t i;
+
+    perf_fifo_pattern(raw);
+    for (i = 0; i < PERF_UNPACK_REPEATS; i++)
+    {
+        start = DWT->CYCCNT;
+        num_samples = adxl372_fifo_unpack_scalar(XYZ_FIFO, raw, PERF_UNPACK_ENTRIES, m_unpack_samples);
+        scalar_cycles += DWT->CYCCNT - start;
+
+        start = DWT->CYCCNT;
+        num_samples = adxl372_fifo_unpack(XYZ_FIFO, raw, PERF_UNPACK_ENTRIES, m_unpack_samples);
+        kernel_cycles += DWT->CYCCNT - start;
+    }
+
+    perf_result("fifo_unpack_samples", num_samples, "count");
+    perf_result("fifo_unpack_scalar", scalar_cycles/PERF_UNPACK_REPEATS, "cycles");
+    perf_result("fifo_unpack", kernel_cycles/PERF_UNPACK_REPEATS, "cycles");
+}
+
+// DWT cycles of the fixed rate sampling path of the capture interrupt on one
+// full fifo burst: the unpack, the trigger and the record packing, the filter
+// needs the CMSIS-DSP library this bench does not link. The spread from the
+// fastest to the slowest burst is the jitter, timed with the interrupts off so
+// it is the code's own, and the cache misses meanwhile show what the flash
+// cost. Build with RAMFUNC=0 to compare the kernels run from flash
+void bench_burst_path(void)
+{
+    uint8_t* raw = m_buf;
+    impact_record_t* records = (impact_record_t*) &m_buf[PERF_UNPACK_ENTRIES*2];
+    impact_trigger_t trigger;
+    icm20649_data_t gyro = {0};
+    uint32_t min_cycles = UINT32_MAX;
+    uint32_t max_cycles = 0;
+    uint64_t total_cycles = 0;
+    uint32_t cycles;
+    uint32_t hits;
+    uint32_t misses;
+    uint16_t num_samples = 0;
+    uint32_t i;
+
+    perf_fifo_pattern(raw);
+    impact_trigger_init(&trigger, ADXL372_MG_TO_COUNTS(PERF_BURST_ONSET_MG),
+                        ADXL372_MG_TO_COUNTS(PERF_BURST_RELEASE_MG), 2);
+    profiler_icache_take(&hits, &misses);
+    for (i = 0; i < PERF_BURST_REPEATS; i++)
+    {
+        impact_trigger_rearm(&trigger);
+        __disable_irq();
+        cycles = DWT->CYCCNT;
+        num_samples = adxl372_fifo_unpack(XYZ_FIFO, raw, PERF_UNPACK_ENTRIES, m_unpack_samples);
+        (void) impact_trigger_update(&trigger, m_unpack_samples, num_samples);
+        for (uint16_t j = 0; j < num_samples; j++)
+        {
+            impact_record_pack(&records[j], &m_unpack_samples[j], &gyro, 1);
+        }
+        cycles = DWT->CYCCNT - cycles;
+        __enable_irq();
+
+        total_cycles += cycles;
+        if (cycles < min_cycles)
+            min_cycles = cycles;
+        if (cycles > max_cycles)
+            max_cycles = cycles;
+    }
+    profiler_icache_take(&hits, &misses);
+
+    perf_result("burst_path_samples", num_samples, "count");
+    perf_result("burst_path", (uint32_t) (total_cycles/PERF_BURST_REPEATS), "cycles");
+    perf_result("burst_path_min", min_cycles, "cycles");
+    perf_result("burst_path_max", max_cycles, "cycles");
+    perf_result("burst_path_spread", max_cycles - min_cycles, "cycles");
+    perf_result("burst_path_icache_hits", hits, "count");
+    perf_result("burst_path_icache_misses", misses, "count");
+}
+
+// Fills a full xyz fifo burst of raw entries, counts ramping over the range
+// with the series start on x
+void perf_fifo_pattern(uint8_t* raw)
+{
+    for (uint32_t i = 0; i < PERF_UNPACK_ENTRIES; i++)
+    {
+        uint16_t entry = (uint16_t)(((i*37) % 4096) << 4) | ((i % 3 == 0) ? FIFO_SERIES_START_MSK : 0);
+
+        raw[i*2] = entry >> 8;
+        raw[i*2 + 1] = entry & 0xFF;
+    }
+}
+
+void log_init(void)
+{
+    ret_code_t err_code = NRF_LOG_INIT(NULL);
+    APP_ERROR_CHECK(err_code);
+
+    NRF_LOG_DEFAULT_BACKENDS_INIT();
+}
+
+void spi_accel_init(void)
+{
+    ret_code_t err_code = spi_instance_init(&accel_spi, &accel_spi_config, SPI_ACCEL_BURST_FREQ);
+    APP_ERROR_CHECK(err_code);
+}
+
+void spi_gyro_init(void)
+{
+    ret_code_t err_code = spi_instance_init(&gyro_spi, &gyro_spi_config, SPI_GYRO_BURST_FREQ);
+    APP_ERROR_CHECK(err_code);
+}
+
+void spi_flash_init(void)
+{
+    ret_code_t err_code = spi_instance_init(&flash_spi, &flash_spi_config, SPI_FLASH_BURST_FREQ);
+    APP_ERROR_CHECK(err_code);
+}
+
+void spi_accel_uninit(void)
+{
+    spi_instance_uninit(&accel_spi);
+}
+
+void spi_flash_uninit(void)
+{
+    spi_instance_uninit(&flash_spi);
+}
+
+static void perf_ret_check(int8_t ret)
+{
+    if (ret < 0){
+        NRF_LOG_INFO("PERF OPERATION FAIL");
+    }
+}
@@ -78,6 +78,13 @@ extern "C" {
 #define TX_PIN_NUMBER  24
 #define HWFC           false
 
+//===================SPI INSTANCES========
+//Each device driver binds to its instance at compile time. The accel and the
+//flash are two devices of instance 0 on separate pins, see spi_device_add
+#define ACCEL_SPI_INSTANCE      0
+#define GYRO_SPI_INSTANCE       2
+#define FLASH_SPI_INSTANCE      0
+
 //===================SPI PINOUT=========
 //gyro - PIN names are mapped wrong in this PCB rev1.
 //This is corrected in PCB rev2
@@ -93,6 +100,9 @@ extern "C" {
 #define SPI_ACCEL_MISO_PIN            9
 #define SPI_ACCEL_SCK_PIN             11
 #define SPI_ACCEL_CS_PIN              8
+#define ADXL_INT1_PIN                 7     //FIFO watermark interrupt
+#define ADXL_INT2_PIN                 5     //activity/instant on wake up interrupt
+//the icm20649 INT pin is not routed on rev1, its data ready is read from INT_STATUS_1
 
 //flash - pin names are mapped wrong in this PCB rev1
 //This is corrected in PCB rev2
@@ -104,10 +114,29 @@ extern "C" {
 #define SPI_FLASH_SCK_PIN       13
 #define SPI_FLASH_CS_PIN        15
 
+//===================SPI BUS PROFILES========
+//CONFIG is used for register access, BURST for data reads and writes.
+//The nRF52832 SPIM tops out at 8 MHz.
+//adxl372 max 10 MHz
+#define SPI_ACCEL_CONFIG_FREQ   NRF_DRV_SPI_FREQ_1M
+#define SPI_ACCEL_BURST_FREQ    NRF_DRV_SPI_FREQ_8M
+//icm20649 max 1 MHz for all registers, 7 MHz for reading sensor registers
+#define SPI_GYRO_CONFIG_FREQ    NRF_DRV_SPI_FREQ_1M
+#define SPI_GYRO_BURST_FREQ     NRF_DRV_SPI_FREQ_4M
+//mt25ql256aba max 133 MHz
+#define SPI_FLASH_CONFIG_FREQ   NRF_DRV_SPI_FREQ_1M
+#define SPI_FLASH_BURST_FREQ    NRF_DRV_SPI_FREQ_8M
+
 //===================I2C PINOUT========================//
 #define I2C_SCL                 19
 #define I2C_SDA                 20
 #define RTC_RST_PIN             22
+#define VCNL4040_INT_PIN        18    //proximity interrupt, open drain and active low
+
+//===================BATTERY========================//
+//rev1 has no divider on VBAT, the SAADC only sees the regulated VDD.
+//BATTERY_MONITOR_INPUT is left undefined so the battery level reads unknown,
+//a board with a divider defines it and BATTERY_MONITOR_DIVIDER_X10
 
 #ifdef __cplusplus
 }
@@ -77,21 +77,47 @@ extern "C" {
 #define TX_PIN_NUMBER  20
 #define HWFC           false
 
+//===================SPI INSTANCES========================//
+//Each device driver binds to its instance at compile time. The accel and the
+//gyro share one bus on the breadboard, the gyro is added to the accel instance
+//with spi_device_add. The flash has a bus of its own
+#define ACCEL_SPI_INSTANCE      0
+#define GYRO_SPI_INSTANCE       0
+#define FLASH_SPI_INSTANCE      2
+
 //===================SPI PINOUT========================//
-#define SPI_ICM20649_CS_PIN     29
-#define SPI_ADXL372_CS_PIN      30
-#define SPI_MT25QL256ABA_CS_PIN 27
-#define SPI_MOSI_PIN            4
-#define SPI_MISO_PIN            28
-#define SPI_SCK_PIN             3
-#define FLASH_SPI_SCK_PIN       6
-#define FLASH_SPI_MOSI_PIN      8
-#define FLASH_SPI_MISO_PIN      13
+#define SPI_ACCEL_MOSI_PIN      4
+#define SPI_ACCEL_MISO_PIN      28
+#define SPI_ACCEL_SCK_PIN       3
+#define SPI_ACCEL_CS_PIN        30
+#define ADXL_INT1_PIN           7     //FIFO watermark interrupt, not wired on the breadboard
+#define ADXL_INT2_PIN           5     //activity/instant on wake up interrupt, not wired on the breadboard
+
+#define SPI_GYRO_MOSI_PIN       SPI_ACCEL_MOSI_PIN
+#define SPI_GYRO_MISO_PIN       SPI_ACCEL_MISO_PIN
+#define SPI_GYRO_SCK_PIN        SPI_ACCEL_SCK_PIN
+#define SPI_GYRO_CS_PIN         29
+
+#define SPI_FLASH_MOSI_PIN      8
+#define SPI_FLASH_MISO_PIN      13
+#define SPI_FLASH_SCK_PIN       6
+#define SPI_FLASH_CS_PIN        27
+
+//===================SPI BUS PROFILES========================//
+//CONFIG is used for register access, BURST for data reads and writes.
+//The breadboard jumper wires are kept at 1 MHz
+#define SPI_ACCEL_CONFIG_FREQ   NRF_DRV_SPI_FREQ_1M
+#define SPI_ACCEL_BURST_FREQ    NRF_DRV_SPI_FREQ_1M
+#define SPI_GYRO_CONFIG_FREQ    NRF_DRV_SPI_FREQ_1M
+#define SPI_GYRO_BURST_FREQ     NRF_DRV_SPI_FREQ_1M
+#define SPI_FLASH_CONFIG_FREQ   NRF_DRV_SPI_FREQ_1M
+#define SPI_FLASH_BURST_FREQ    NRF_DRV_SPI_FREQ_1M
 
 //===================I2C PINOUT========================//
 // I2C pin assignment
 #define I2C_SDA                 15
 #define I2C_SCL                 16
+#define VCNL4040_INT_PIN        18    //proximity interrupt, open drain and active low, jumpered on the breadboard
 
 
 #ifdef __cplusplus
@@ -134,8 +134,10 @@ STATIC_ASSERT(NRF_ESB_PIPE_COUNT <= 8);
 #define     NRF_ESB_PID_MAX                     3                   //!< The maximum value for PID.
 #define     NRF_ESB_CRC_RESET_VALUE             0xFFFF              //!< The CRC reset value.
 
+#ifndef ESB_EVT_IRQ
 #define     ESB_EVT_IRQ                         SWI0_IRQn           //!< The ESB event IRQ number when running on an nRF5 device.
 #define     ESB_EVT_IRQHandler                  SWI0_IRQHandler     //!< The handler for @ref ESB_EVT_IRQ when running on an nRF5 device.
+#endif
 
 #if defined(NRF52)
 #define ESB_IRQ_PRIORITY_MSK                    0x07                //!< The mask used to enforce a valid IRQ priority.
@@ -0,0 +1,249 @@
+//-------------------------------------------
+// Title: crash_decode.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Command line decoder of the crash records the fault
+// handlers write to the top of the flash (libraries/crash_log). Reads raw
+// flash images, or just the crash log region of one, and prints the
+// intact records oldest first: the fault, the registers with the fault
+// status bits named, the pipeline counters and the stack words above the
+// frame. The pc, the lr and the stack words go through arm-none-eabi-addr2line
+// with the elf of the image that crashed.
+//
+// usage: crash_decode file ...
+//   crash_decode flash.bin
+//   crash_decode helmet*.bin | grep -A3 HardFault
+//-------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include "impact_log.h"
+#include "crash_log.h"
+
+#define SLOTS               (CRASH_LOG_SIZE/CRASH_LOG_RECORD_SIZE)
+#define HEADER_SIZE         offsetof(crash_log_record_t, kind)
+
+//fault ids of nrf_sdm.h and app_error.h
+#define NRF_FAULT_ID_SD_ASSERT      0x00000001
+#define NRF_FAULT_ID_APP_MEMACC     0x00001001
+#define NRF_FAULT_ID_SDK_ERROR      0x00004001
+#define NRF_FAULT_ID_SDK_ASSERT     0x00004002
+
+#define COUNTER_NAME(_id) #_id,
+static char const * const m_counter_names[CRASH_LOG_COUNTER_COUNT] = {
+    CRASH_LOG_COUNTER_LIST(COUNTER_NAME)
+};
+#undef COUNTER_NAME
+
+//SCB->CFSR bits, MemManage, BusFault then UsageFault
+static char const * const m_cfsr_names[32] = {
+    [0] = "IACCVIOL", [1] = "DACCVIOL", [3] = "MUNSTKERR", [4] = "MSTKERR", [5] = "MLSPERR", [7] = "MMARVALID",
+    [8] = "IBUSERR", [9] = "PRECISERR", [10] = "IMPRECISERR", [11] = "UNSTKERR", [12] = "STKERR", [13] = "LSPERR",
+    [15] = "BFARVALID",
+    [16] = "UNDEFINSTR", [17] = "INVSTATE", [18] = "INVPC", [19] = "NOCP", [24] = "UNALIGNED", [25] = "DIVBYZERO",
+};
+
+#define CFSR_MMARVALID      (1u << 7)
+#define CFSR_BFARVALID      (1u << 15)
+#define HFSR_VECTTBL        (1u << 1)
+#define HFSR_FORCED         (1u << 30)
+
+static uint32_t read_u32(uint8_t const *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint32_t field(uint8_t const *raw, size_t offset)
+{
+    return read_u32(&raw[offset]);
+}
+
+#define FIELD(_raw, _name) field(_raw, offsetof(crash_log_record_t, _name))
+
+static char const *fault_name(uint32_t id)
+{
+    switch (id)
+    {
+        case NRF_FAULT_ID_SD_ASSERT:    return "SoftDevice assert";
+        case NRF_FAULT_ID_APP_MEMACC:   return "SoftDevice memory access";
+        case NRF_FAULT_ID_SDK_ERROR:    return "error";
+        case NRF_FAULT_ID_SDK_ASSERT:   return "assert";
+        default:                        return "fault";
+    }
+}
+
+static void print_record(uint8_t const *raw)
+{
+    uint32_t cfsr = FIELD(raw, cfsr);
+    uint32_t hfsr = FIELD(raw, hfsr);
+    uint32_t time_s = FIELD(raw, time_s);
+    uint32_t uptime_ms = FIELD(raw, uptime_ms);
+    uint32_t id = FIELD(raw, id);
+    uint8_t kind = raw[offsetof(crash_log_record_t, kind)];
+    uint8_t stack_words = raw[offsetof(crash_log_record_t, stack_words)];
+    uint16_t line = (uint16_t) (raw[offsetof(crash_log_record_t, line)] | (raw[offsetof(crash_log_record_t, line) + 1] << 8));
+    char file[CRASH_LOG_FILE_SIZE];
+    char when[32] = "clock not set";
+    time_t t = time_s;
+    struct tm tm;
+    unsigned i;
+
+    memcpy(file, &raw[offsetof(crash_log_record_t, file)], sizeof(file));
+    file[sizeof(file) - 1] = '\0';
+    if (time_s != 0 && gmtime_r(&t, &tm) != NULL)
+        strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    printf("crash %u, %s, %u.%03u s after boot\n", FIELD(raw, seq), when, uptime_ms/1000, uptime_ms%1000);
+    if (kind == CRASH_LOG_HARDFAULT)
+    {
+        if (FIELD(raw, sp) == 0)
+            printf("  HardFault with the main stack overflowed, no frame\n");
+        else
+            printf("  HardFault at pc 0x%08x lr 0x%08x\n", FIELD(raw, pc), FIELD(raw, lr));
+    }
+    else if (id == NRF_FAULT_ID_SDK_ERROR)
+    {
+        printf("  error %u (0x%x) at %s:%u pc 0x%08x\n", FIELD(raw, err_code), FIELD(raw, err_code), file, line,
+               FIELD(raw, pc));
+    }
+    else if (id == NRF_FAULT_ID_SDK_ASSERT)
+    {
+        printf("  assert at %s:%u pc 0x%08x\n", file, line, FIELD(raw, pc));
+    }
+    else
+    {
+        printf("  %s 0x%x info 0x%08x pc 0x%08x\n", fault_name(id), id, FIELD(raw, err_code), FIELD(raw, pc));
+    }
+
+    if (kind == CRASH_LOG_HARDFAULT)
+    {
+        printf("  r0 0x%08x r1 0x%08x r2 0x%08x r3 0x%08x r12 0x%08x psr 0x%08x\n", FIELD(raw, r0), FIELD(raw, r1),
+               FIELD(raw, r2), FIELD(raw, r3), FIELD(raw, r12), FIELD(raw, psr));
+    }
+    printf("  sp 0x%08x cfsr 0x%08x hfsr 0x%08x", FIELD(raw, sp), cfsr, hfsr);
+    for (i = 0; i < 32; i++)
+    {
+        if ((cfsr & (1u << i)) && m_cfsr_names[i] != NULL)
+            printf(" %s", m_cfsr_names[i]);
+    }
+    if (hfsr & HFSR_FORCED)
+        printf(" FORCED");
+    if (hfsr & HFSR_VECTTBL)
+        printf(" VECTTBL");
+    printf("\n");
+    if (cfsr & CFSR_MMARVALID)
+        printf("  mmfar 0x%08x\n", FIELD(raw, mmfar));
+    if (cfsr & CFSR_BFARVALID)
+        printf("  bfar 0x%08x\n", FIELD(raw, bfar));
+
+    for (i = 0; i < CRASH_LOG_COUNTER_COUNT; i++)
+    {
+        printf("%s%s %u", (i == 0) ? "  " : ", ", m_counter_names[i] + strlen("CRASH_LOG_COUNTER_"),
+               field(raw, offsetof(crash_log_record_t, counters) + i*4));
+    }
+    printf("\n");
+
+    if (stack_words > CRASH_LOG_STACK_WORDS)
+        stack_words = CRASH_LOG_STACK_WORDS;
+    for (i = 0; i < stack_words; i++)
+    {
+        if (i % 8 == 0)
+            printf("  stack +%02x:", i*4);
+        printf(" %08x", field(raw, offsetof(crash_log_record_t, stack) + i*4));
+        if (i % 8 == 7 || i + 1 == stack_words)
+            printf("\n");
+    }
+}
+
+static int compare_seq(void const *a, void const *b)
+{
+    uint32_t seq_a = FIELD(*(uint8_t const * const *) a, seq);
+    uint32_t seq_b = FIELD(*(uint8_t const * const *) b, seq);
+
+    //the sequence wraps like the device compares it
+    return ((int32_t) (seq_a - seq_b) > 0) - ((int32_t) (seq_a - seq_b) < 0);
+}
+
+// prints the intact records of one crash log region, oldest first
+static int decode_region(char const *name, uint8_t const *region)
+{
+    uint8_t const *records[SLOTS];
+    uint8_t const *raw;
+    unsigned count = 0, torn = 0, i;
+
+    for (i = 0; i < SLOTS; i++)
+    {
+        raw = &region[i*CRASH_LOG_RECORD_SIZE];
+        if (FIELD(raw, magic) != CRASH_LOG_MAGIC)
+            continue;
+        if (FIELD(raw, crc) != crc32_compute(raw + HEADER_SIZE, CRASH_LOG_RECORD_SIZE - HEADER_SIZE, NULL))
+        {
+            torn++;
+            continue;
+        }
+        records[count++] = raw;
+    }
+    qsort(records, count, sizeof(records[0]), compare_seq);
+
+    printf("%s: %u crash records", name, count);
+    if (torn > 0)
+        printf(", %u torn", torn);
+    printf("\n");
+    for (i = 0; i < count; i++)
+        print_record(records[i]);
+    return 0;
+}
+
+static int decode_file(char const *name, FILE *in)
+{
+    static uint8_t region[CRASH_LOG_SIZE];
+    long size;
+
+    if (fseek(in, 0, SEEK_END) != 0 || (size = ftell(in)) < 0)
+    {
+        perror(name);
+        return 1;
+    }
+    //a whole flash image or the region alone
+    if (size >= CRASH_LOG_END)
+        size = CRASH_LOG_ADDRESS;
+    else if (size == CRASH_LOG_SIZE)
+        size = 0;
+    else
+    {
+        fprintf(stderr, "%s: %ld bytes, neither a flash image nor a crash log\n", name, size);
+        return 1;
+    }
+    if (fseek(in, size, SEEK_SET) != 0 || fread(region, 1, sizeof(region), in) != sizeof(region))
+    {
+        perror(name);
+        return 1;
+    }
+    return decode_region(name, region);
+}
+
+int main(int argc, char **argv)
+{
+    int num_errors = 0, i;
+    FILE *in;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s file ...\n", argv[0]);
+        return 1;
+    }
+    for (i = 1; i < argc; i++)
+    {
+        if ((in = fopen(argv[i], "rb")) == NULL)
+        {
+            perror(argv[i]);
+            num_errors++;
+            continue;
+        }
+        num_errors += decode_file(argv[i], in);
+        fclose(in);
+    }
+    return (num_errors > 0) ? 1 : 0;
+}
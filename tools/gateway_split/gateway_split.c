@@ -0,0 +1,186 @@
+//-------------------------------------------
+// Title: gateway_split.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Splits a capture of the sideline gateway's uart
+// (integration/imu_gateway, libraries/gateway_uart) into the offload
+// stream of each helmet, appended to a file named after its address so
+// offload_decode can read them. A packet with a bad crc is skipped and the
+// search goes on from the byte after its sync word.
+//
+// usage: gateway_split [-d dir] [file ...]
+//   -d  writes the helmet files to dir instead of the current directory
+//   stty -F /dev/ttyACM0 1000000 raw && gateway_split -d capture < /dev/ttyACM0
+//   offload_decode -s -e events.csv -o samples.csv capture/*.bin
+//-------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "impact_log.h"
+#include "gateway_uart.h"
+
+#define READ_CHUNK_SIZE     (1024*1024)
+#define BUF_SIZE            (READ_CHUNK_SIZE + GATEWAY_UART_PACKET_SIZE(0xFFFF))
+#define HEADER_SIZE         (4 + GATEWAY_UART_ADDR_SIZE + 2)
+#define MAX_HELMETS         256
+
+typedef struct {
+    uint8_t addr[GATEWAY_UART_ADDR_SIZE];
+    FILE *file;
+    unsigned long bytes;
+} helmet_t;
+
+typedef struct {
+    char const *dir;
+    helmet_t helmets[MAX_HELMETS];
+    int helmet_count;
+    unsigned long packets;
+    unsigned long bad_packets;
+    unsigned long skipped;      //bytes outside of any packet
+} split_t;
+
+static uint32_t get_u32(uint8_t const *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// the file of a helmet, opened for appending the first time it is seen
+static helmet_t *helmet_get(split_t *split, uint8_t const *addr)
+{
+    helmet_t *helmet;
+    char path[4096];
+    int i;
+
+    for (i = 0; i < split->helmet_count; i++)
+    {
+        if (memcmp(split->helmets[i].addr, addr, GATEWAY_UART_ADDR_SIZE) == 0)
+            return &split->helmets[i];
+    }
+    if (split->helmet_count == MAX_HELMETS)
+        return NULL;
+
+    //the address as it is printed, most significant byte first
+    snprintf(path, sizeof(path), "%s/%02x%02x%02x%02x%02x%02x.bin", split->dir,
+             addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
+    helmet = &split->helmets[split->helmet_count];
+    helmet->file = fopen(path, "ab");
+    if (helmet->file == NULL)
+    {
+        perror(path);
+        return NULL;
+    }
+    memcpy(helmet->addr, addr, GATEWAY_UART_ADDR_SIZE);
+    helmet->bytes = 0;
+    split->helmet_count++;
+    return helmet;
+}
+
+// splits the whole packets of buf, returns the bytes used, the rest is an unfinished packet
+static size_t split_packets(split_t *split, uint8_t const *buf, size_t length)
+{
+    helmet_t *helmet;
+    uint32_t payload_length;
+    size_t pos = 0;
+
+    while (length - pos >= HEADER_SIZE)
+    {
+        if (get_u32(&buf[pos]) != GATEWAY_UART_SYNC)
+        {
+            pos++;
+            split->skipped++;
+            continue;
+        }
+        payload_length = buf[pos + HEADER_SIZE - 2] | ((uint32_t) buf[pos + HEADER_SIZE - 1] << 8);
+        if (length - pos < GATEWAY_UART_PACKET_SIZE(payload_length))
+            break;
+        if (crc32_compute(&buf[pos + 4], HEADER_SIZE - 4 + payload_length, NULL)
+            != get_u32(&buf[pos + HEADER_SIZE + payload_length]))
+        {
+            pos++;
+            split->bad_packets++;
+            continue;
+        }
+
+        helmet = helmet_get(split, &buf[pos + 4]);
+        if (helmet != NULL)
+        {
+            fwrite(&buf[pos + HEADER_SIZE], 1, payload_length, helmet->file);
+            helmet->bytes += payload_length;
+        }
+        split->packets++;
+        pos += GATEWAY_UART_PACKET_SIZE(payload_length);
+    }
+    return pos;
+}
+
+static int split_file(split_t *split, FILE *in, uint8_t *buf)
+{
+    size_t length = 0, used, n;
+
+    while ((n = fread(&buf[length], 1, READ_CHUNK_SIZE, in)) > 0)
+    {
+        length += n;
+        used = split_packets(split, buf, length);
+        memmove(buf, &buf[used], length - used);
+        length -= used;
+    }
+    //a packet cut off by the end of the capture
+    split->skipped += length;
+    return ferror(in) ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    static split_t split;
+    uint8_t *buf;
+    FILE *in;
+    int errors = 0, opt, i;
+
+    split.dir = ".";
+    while ((opt = getopt(argc, argv, "d:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd': split.dir = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-d dir] [file ...]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    buf = malloc(BUF_SIZE);
+    if (buf == NULL)
+        return 2;
+
+    if (optind == argc)
+    {
+        errors += split_file(&split, stdin, buf) != 0;
+    }
+    for (i = optind; i < argc; i++)
+    {
+        in = fopen(argv[i], "rb");
+        if (in == NULL)
+        {
+            perror(argv[i]);
+            errors++;
+            continue;
+        }
+        errors += split_file(&split, in, buf) != 0;
+        fclose(in);
+    }
+
+    for (i = 0; i < split.helmet_count; i++)
+    {
+        uint8_t const *addr = split.helmets[i].addr;
+
+        fprintf(stderr, "%02x%02x%02x%02x%02x%02x %lu bytes\n",
+                addr[5], addr[4], addr[3], addr[2], addr[1], addr[0], split.helmets[i].bytes);
+        fclose(split.helmets[i].file);
+    }
+    fprintf(stderr, "%lu packets, %lu with a bad crc, %lu bytes skipped\n",
+            split.packets, split.bad_packets, split.skipped);
+
+    free(buf);
+    return (errors > 0 || split.bad_packets > 0) ? 1 : 0;
+}
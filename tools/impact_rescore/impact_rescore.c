@@ -0,0 +1,488 @@
+//-------------------------------------------
+// Title: impact_rescore.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Works the impact metrics out again on the host from the
+// samples of the stored events, for validating them over a season of
+// dumps. Reads the same flash images and offload captures as
+// offload_decode and writes one csv line per event with the metrics of
+// metrics_batch.c. The duration is timed against a fixed threshold, the
+// device times it against the onset its trigger had adapted to, which is
+// not stored. -c runs the record by record impact_metrics of the device
+// alongside and counts the events whose metrics differ in any bit, -b
+// times both over the events of each file.
+//
+// usage: impact_rescore [-s] [-c] [-b reps] [-T threshold_mg] [-k key[,nonce]] [-o metrics.csv] [file ...]
+//   -s  adds a source column with the input file name
+//   -c  checks every event against the device metrics, a match column is added
+//   -b  times the batch and the device metrics over each file this many times
+//   -T  resultant the duration is timed above, 10000 mg by default as the game profile starts at
+//   -k  the AES-128 key the events were stored with, 32 hex digits as given to 'config key', and
+//       the store nonce 'config' prints for the frames, a flash image has its own
+//   -o  metrics to a file instead of stdout
+//   impact_rescore -s -c -o metrics.csv season/*.bin
+//   impact_rescore -b 20 flash.bin > /dev/null
+//-------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "impact_log.h"
+#include "impact_crypt.h"
+#include "impact_record.h"
+#include "metrics_batch.h"
+
+#define THRESHOLD_MG        10000 //CAPTURE_THRESHOLD_MG
+#define REFERENCE_CHUNK     4096  //records per impact_metrics_add_block call
+
+// one decoded event, its records at first..first + count - 1 of the columns
+typedef struct {
+    uint32_t id;
+    uint32_t first;
+    uint32_t count;
+    uint16_t gyro_fs_dps;
+    int has_peak;
+    double peak_g;
+} event_t;
+
+// the events of one file in columns
+typedef struct {
+    event_t *events;
+    uint32_t num_events;
+    uint32_t events_size;
+    int16_t *x, *y, *z;
+    int16_t *icm_accel[3];
+    int16_t *gyro[3];
+    uint8_t *delta;
+    uint32_t num_records;
+    uint32_t records_size;
+    int failed;             //out of memory, the file is dropped
+    char const *source;
+} store_t;
+
+typedef struct {
+    uint64_t events;
+    uint64_t records;
+    uint64_t batch_ns;
+    uint64_t device_ns;
+} bench_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int grow(void **p_array, size_t size)
+{
+    void *array = realloc(*p_array, size);
+
+    if (array == NULL)
+        return -1;
+    *p_array = array;
+    return 0;
+}
+
+static int store_grow_records(store_t *store)
+{
+    uint32_t size = (store->records_size > 0) ? 2*store->records_size : 64*1024;
+    int failed = 0;
+
+    failed |= grow((void **) &store->x, size * sizeof(int16_t));
+    failed |= grow((void **) &store->y, size * sizeof(int16_t));
+    failed |= grow((void **) &store->z, size * sizeof(int16_t));
+    for (int k = 0; k < 3; k++)
+    {
+        failed |= grow((void **) &store->icm_accel[k], size * sizeof(int16_t));
+        failed |= grow((void **) &store->gyro[k], size * sizeof(int16_t));
+    }
+    failed |= grow((void **) &store->delta, size);
+    if (failed)
+        return -1;
+    store->records_size = size;
+    return 0;
+}
+
+static void event_handler(void *p_context, impact_log_event_t const *event)
+{
+    store_t *store = p_context;
+    event_t *p_event;
+    uint32_t size;
+
+    if (store->failed)
+        return;
+    if (store->num_events == store->events_size)
+    {
+        size = (store->events_size > 0) ? 2*store->events_size : 1024;
+        if (grow((void **) &store->events, size * sizeof(event_t)) < 0)
+        {
+            store->failed = 1;
+            return;
+        }
+        store->events_size = size;
+    }
+    p_event = &store->events[store->num_events++];
+    p_event->id = event->id;
+    p_event->first = store->num_records;
+    p_event->count = 0;
+    p_event->gyro_fs_dps = event->gyro_fs_dps;
+    p_event->has_peak = event->has_peak;
+    p_event->peak_g = event->peak_g;
+}
+
+static void sample_handler(void *p_context, impact_log_event_t const *event, impact_log_sample_t const *sample)
+{
+    store_t *store = p_context;
+    uint32_t i = store->num_records;
+
+    if (store->failed)
+        return;
+    if (i == store->records_size && store_grow_records(store) < 0)
+    {
+        store->failed = 1;
+        return;
+    }
+    store->x[i] = sample->accel.x;
+    store->y[i] = sample->accel.y;
+    store->z[i] = sample->accel.z;
+    store->icm_accel[0][i] = sample->icm.accel_x;
+    store->icm_accel[1][i] = sample->icm.accel_y;
+    store->icm_accel[2][i] = sample->icm.accel_z;
+    store->gyro[0][i] = sample->icm.gyro_x;
+    store->gyro[1][i] = sample->icm.gyro_y;
+    store->gyro[2][i] = sample->icm.gyro_z;
+    store->delta[i] = sample->delta;
+    store->num_records++;
+    store->events[store->num_events - 1].count++;
+}
+
+static void error_handler(void *p_context, char const *message)
+{
+    store_t const *store = p_context;
+
+    fprintf(stderr, "%s: %s\n", store->source, message);
+}
+
+static void event_columns(store_t const *store, event_t const *event, metrics_batch_columns_t *columns)
+{
+    columns->count = event->count;
+    columns->x = &store->x[event->first];
+    columns->y = &store->y[event->first];
+    columns->z = &store->z[event->first];
+    for (int k = 0; k < 3; k++)
+    {
+        columns->icm_accel[k] = &store->icm_accel[k][event->first];
+        columns->gyro[k] = &store->gyro[k][event->first];
+    }
+    columns->delta = &store->delta[event->first];
+}
+
+// packs the records of an event back the way the device holds them
+static impact_record_t *event_records(store_t const *store, event_t const *event)
+{
+    impact_record_t *records = malloc((event->count + 1) * sizeof(impact_record_t));
+    adxl372_accel_data_t accel;
+    icm20649_data_t icm;
+    uint32_t i, r;
+
+    if (records == NULL)
+        return NULL;
+    for (r = 0; r < event->count; r++)
+    {
+        i = event->first + r;
+        accel.x = store->x[i];
+        accel.y = store->y[i];
+        accel.z = store->z[i];
+        icm.accel_x = store->icm_accel[0][i];
+        icm.accel_y = store->icm_accel[1][i];
+        icm.accel_z = store->icm_accel[2][i];
+        icm.gyro_x = store->gyro[0][i];
+        icm.gyro_y = store->gyro[1][i];
+        icm.gyro_z = store->gyro[2][i];
+        impact_record_pack(&records[r], &accel, &icm, store->delta[i]);
+    }
+    return records;
+}
+
+static void device_metrics(impact_record_t const *records, uint32_t count, uint16_t threshold,
+                           uint16_t gyro_fs_dps, metrics_batch_result_t *result)
+{
+    impact_metrics_t metrics;
+    uint32_t num;
+
+    impact_metrics_init(&metrics, ADXL_SAMPLE_RATE_HZ, threshold, gyro_fs_dps);
+    for (uint32_t r = 0; r < count; r += num)
+    {
+        num = (count - r < REFERENCE_CHUNK) ? count - r : REFERENCE_CHUNK;
+        impact_metrics_add_block(&metrics, &records[r], (uint16_t) num);
+    }
+    metrics_batch_result(&metrics, result);
+}
+
+// writes the metrics of every event of a file, checked against the device ones with check
+static int store_report(store_t const *store, metrics_batch_t *batch, FILE *out, int source_column, int check,
+                        uint16_t threshold)
+{
+    metrics_batch_columns_t columns;
+    metrics_batch_result_t result, device;
+    impact_record_t *records;
+    event_t const *event;
+    int errors = 0;
+
+    for (uint32_t e = 0; e < store->num_events; e++)
+    {
+        event = &store->events[e];
+        event_columns(store, event, &columns);
+        if (metrics_batch_run(batch, &columns, ADXL_SAMPLE_RATE_HZ, threshold, event->gyro_fs_dps, &result) < 0)
+        {
+            fprintf(stderr, "%s: event %u: out of memory\n", store->source, event->id);
+            errors++;
+            continue;
+        }
+        if (source_column)
+            fprintf(out, "%s,", store->source);
+        fprintf(out, "%u,%u,%u,%u,%u,%u,%u,%u,", event->id, result.peak_mg, result.duration_us,
+                result.hic15, result.hic36, result.peak_omega_mrad, result.peak_alpha, result.bric_x1000);
+        if (event->has_peak)
+            fprintf(out, "%.1f", event->peak_g);
+        if (check)
+        {
+            records = event_records(store, event);
+            if (records == NULL)
+            {
+                fprintf(stderr, "%s: event %u: out of memory\n", store->source, event->id);
+                errors++;
+                fprintf(out, ",\n");
+                continue;
+            }
+            device_metrics(records, event->count, threshold, event->gyro_fs_dps, &device);
+            free(records);
+            if (memcmp(&result, &device, sizeof(result)) != 0)
+            {
+                fprintf(stderr, "%s: event %u: metrics differ from the device ones\n", store->source, event->id);
+                errors++;
+            }
+            fprintf(out, ",%d", memcmp(&result, &device, sizeof(result)) == 0);
+        }
+        fprintf(out, "\n");
+    }
+    return errors;
+}
+
+// times the batch and the device metrics over every event of a file
+static int store_bench(store_t const *store, metrics_batch_t *batch, uint32_t reps, uint16_t threshold,
+                       bench_t *bench)
+{
+    metrics_batch_columns_t columns;
+    metrics_batch_result_t result;
+    impact_record_t **records;
+    uint64_t t0;
+    int failed = 0;
+
+    records = calloc(store->num_events + 1, sizeof(impact_record_t *));
+    if (records == NULL)
+        return 1;
+    for (uint32_t e = 0; e < store->num_events && !failed; e++)
+        failed = (records[e] = event_records(store, &store->events[e])) == NULL;
+
+    //warms the scratch columns up to the longest event
+    for (uint32_t e = 0; e < store->num_events && !failed; e++)
+    {
+        event_columns(store, &store->events[e], &columns);
+        failed = metrics_batch_run(batch, &columns, ADXL_SAMPLE_RATE_HZ, threshold, 2000, &result) < 0;
+    }
+
+    if (!failed)
+    {
+        t0 = now_ns();
+        for (uint32_t rep = 0; rep < reps; rep++)
+            for (uint32_t e = 0; e < store->num_events; e++)
+            {
+                event_columns(store, &store->events[e], &columns);
+                metrics_batch_run(batch, &columns, ADXL_SAMPLE_RATE_HZ, threshold,
+                                  store->events[e].gyro_fs_dps, &result);
+            }
+        bench->batch_ns += now_ns() - t0;
+
+        t0 = now_ns();
+        for (uint32_t rep = 0; rep < reps; rep++)
+            for (uint32_t e = 0; e < store->num_events; e++)
+                device_metrics(records[e], store->events[e].count, threshold, store->events[e].gyro_fs_dps,
+                               &result);
+        bench->device_ns += now_ns() - t0;
+        bench->events += (uint64_t) store->num_events * reps;
+        bench->records += (uint64_t) store->num_records * reps;
+    }
+
+    for (uint32_t e = 0; e < store->num_events; e++)
+        free(records[e]);
+    free(records);
+    if (failed)
+        fprintf(stderr, "%s: out of memory\n", store->source);
+    return failed;
+}
+
+static void store_free(store_t *store)
+{
+    free(store->events);
+    free(store->x);
+    free(store->y);
+    free(store->z);
+    for (int k = 0; k < 3; k++)
+    {
+        free(store->icm_accel[k]);
+        free(store->gyro[k]);
+    }
+    free(store->delta);
+    memset(store, 0, sizeof(store_t));
+}
+
+// decodes a mapped file into the store, a flash image or an offload capture
+static int store_load(store_t *store, char const *path, impact_log_handlers_t const *handlers)
+{
+    impact_log_stream_t stream;
+    struct stat info;
+    uint32_t decoded, errors = 0;
+    uint8_t *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) < 0 || !S_ISREG(info.st_mode) || info.st_size == 0
+        || (map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+    close(fd);
+
+    if (impact_log_is_flash_image(map, info.st_size))
+    {
+        impact_log_flash_image(handlers, map, info.st_size, &decoded, &errors);
+    }
+    else
+    {
+        impact_log_stream_init(&stream, handlers);
+        if (impact_log_stream_feed(&stream, map, info.st_size) < 0)
+            store->failed = 1;
+        errors = stream.num_errors;
+        impact_log_stream_free(&stream);
+    }
+    munmap(map, info.st_size);
+    if (store->failed)
+    {
+        fprintf(stderr, "%s: out of memory\n", path);
+        errors++;
+    }
+    return errors;
+}
+
+// 32 hex digits to a key, then the nonce of the store after a comma, 0 without one
+static int parse_key(char const *hex, uint8_t key[IMPACT_CRYPT_KEY_SIZE], uint32_t *p_nonce)
+{
+    char digits[3] = {0};
+    char *p_end;
+    size_t length = strcspn(hex, ",");
+
+    *p_nonce = 0;
+    if (length != 2*IMPACT_CRYPT_KEY_SIZE)
+        return -1;
+    if (hex[length] == ',')
+    {
+        *p_nonce = (uint32_t)strtoul(&hex[length + 1], &p_end, 16);
+        if (hex[length + 1] == '\0' || *p_end != '\0')
+            return -1;
+    }
+    for (int i = 0; i < IMPACT_CRYPT_KEY_SIZE; i++)
+    {
+        memcpy(digits, &hex[2*i], 2);
+        key[i] = (uint8_t)strtoul(digits, &p_end, 16);
+        if (*p_end != '\0')
+            return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    impact_log_handlers_t handlers = {event_handler, sample_handler, NULL, NULL, NULL, error_handler, NULL};
+    store_t store;
+    metrics_batch_t batch;
+    bench_t bench = {0, 0, 0, 0};
+    char const *out_path = NULL;
+    uint32_t reps = 0;
+    uint16_t threshold = THRESHOLD_MG / ADXL372_MG_PER_LSB;
+    int source_column = 0, check = 0, num_errors = 0, opt;
+    uint8_t key[IMPACT_CRYPT_KEY_SIZE];
+    FILE *out = stdout;
+
+    while ((opt = getopt(argc, argv, "scb:T:k:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's': source_column = 1; break;
+            case 'c': check = 1; break;
+            case 'b': reps = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'T': threshold = (uint16_t) (strtoul(optarg, NULL, 10) / ADXL372_MG_PER_LSB); break;
+            case 'k':
+                if (parse_key(optarg, key, &handlers.nonce) < 0)
+                {
+                    fprintf(stderr, "%s: -k takes 32 hex digits, then a comma and the store nonce in hex\n", argv[0]);
+                    return 2;
+                }
+                handlers.key = key;
+                break;
+            case 'o': out_path = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-s] [-c] [-b reps] [-T threshold_mg] [-k key[,nonce]] [-o metrics.csv] [file ...]\n",
+                        argv[0]);
+                return 2;
+        }
+    }
+    if (out_path != NULL && (out = fopen(out_path, "w")) == NULL)
+    {
+        perror(out_path);
+        return 2;
+    }
+
+    if (source_column)
+        fprintf(out, "source,");
+    fprintf(out, "event,peak_mg,duration_us,hic15,hic36,peak_omega_mrad,peak_alpha,bric_x1000,stored_peak_g%s\n",
+            check ? ",match" : "");
+
+    metrics_batch_init(&batch);
+    memset(&store, 0, sizeof(store_t));
+    handlers.p_context = &store;
+    for (int i = optind; i < argc; i++)
+    {
+        store.source = argv[i];
+        num_errors += store_load(&store, argv[i], &handlers);
+        if (!store.failed)
+        {
+            num_errors += store_report(&store, &batch, out, source_column, check, threshold);
+            if (reps > 0)
+                num_errors += store_bench(&store, &batch, reps, threshold, &bench);
+        }
+        store_free(&store);
+    }
+    metrics_batch_free(&batch);
+
+    if (bench.events > 0)
+    {
+        fprintf(stderr, "%llu events, %llu records\n", (unsigned long long) bench.events,
+                (unsigned long long) bench.records);
+        fprintf(stderr, "batch:  %8.1f ms %8.1f Mrecords/s\n", bench.batch_ns / 1e6,
+                bench.records * 1e3 / (bench.batch_ns + 1));
+        fprintf(stderr, "device: %8.1f ms %8.1f Mrecords/s\n", bench.device_ns / 1e6,
+                bench.records * 1e3 / (bench.device_ns + 1));
+    }
+    if (out != stdout)
+        fclose(out);
+    return (num_errors > 0) ? 1 : 0;
+}
@@ -0,0 +1,278 @@
+//-------------------------------------------
+// Title: metrics_batch.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Host recomputation of the impact metrics of a whole
+// event, column by column. Follows impact_metrics.c step for step where
+// the order matters and replaces its record loop with passes over the
+// columns where it does not, the results match to the bit.
+//-------------------------------------------
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "metrics_batch.h"
+#include "int_sqrt.h"
+
+#define MEAN_Q  8 //fractional bits of the mean acceleration in g, as impact_metrics.c
+
+static uint32_t hic_of_window(uint16_t rate_hz, uint32_t integral, uint32_t periods)
+{
+    uint64_t mean;
+    uint64_t hic;
+
+    mean = ((uint64_t) integral * ADXL372_MG_PER_LSB << MEAN_Q) / (1000ULL * periods);
+    hic = (uint64_t) periods * mean * mean * int_sqrt32((uint32_t) (mean << 8));
+    return (uint32_t) (hic / ((uint64_t) rate_hz << (2*MEAN_Q + MEAN_Q/2 + 4)));
+}
+
+static uint32_t gyro_counts_to_mrad(uint32_t gyro_scale, uint32_t counts)
+{
+    return (uint32_t) (((uint64_t) counts * gyro_scale) >> 16);
+}
+
+static int16_t saturate_counts(int32_t counts)
+{
+    if (counts > INT16_MAX)
+        return INT16_MAX;
+    if (counts < -INT16_MAX)
+        return -INT16_MAX;
+    return (int16_t) counts;
+}
+
+void metrics_batch_init(metrics_batch_t *batch)
+{
+    memset(batch, 0, sizeof(metrics_batch_t));
+}
+
+void metrics_batch_free(metrics_batch_t *batch)
+{
+    free(batch->resultant);
+    free(batch->time);
+    free(batch->integral);
+    free(batch->bound_time);
+    free(batch->bound_integral);
+    metrics_batch_init(batch);
+}
+
+// grows the scratch columns to count records and the boundary before them
+static int batch_reserve(metrics_batch_t *batch, size_t count)
+{
+    size_t size = count + 1;
+
+    if (size <= batch->size)
+        return 0;
+    metrics_batch_free(batch);
+    batch->resultant = malloc(size * sizeof(uint16_t));
+    batch->time = malloc(size * sizeof(uint32_t));
+    batch->integral = malloc(size * sizeof(uint32_t));
+    batch->bound_time = malloc(size * sizeof(uint32_t));
+    batch->bound_integral = malloc(size * sizeof(uint32_t));
+    if (batch->resultant == NULL || batch->time == NULL || batch->integral == NULL
+        || batch->bound_time == NULL || batch->bound_integral == NULL)
+    {
+        metrics_batch_free(batch);
+        return -1;
+    }
+    batch->size = size;
+    return 0;
+}
+
+// every window between two boundaries up to a HIC36 apart, as the ring pairs them
+static void batch_hic(metrics_batch_t const *batch, uint32_t num_bounds, uint16_t rate_hz,
+                      uint16_t window15, uint16_t window36, metrics_batch_result_t *result)
+{
+    uint32_t const *bound_time = batch->bound_time;
+    uint32_t const *bound_integral = batch->bound_integral;
+    uint32_t periods, hic, oldest;
+
+    result->hic15 = 0;
+    result->hic36 = 0;
+    for (uint32_t j = 1; j < num_bounds; j++)
+    {
+        oldest = (j > IMPACT_METRICS_RING_SIZE) ? j - IMPACT_METRICS_RING_SIZE : 0;
+        for (uint32_t i = j; i-- > oldest; )
+        {
+            periods = bound_time[j] - bound_time[i];
+            if (periods > window36)
+                break;
+            if (periods == 0)
+                continue;
+            hic = hic_of_window(rate_hz, bound_integral[j] - bound_integral[i], periods);
+            if (hic > result->hic36)
+                result->hic36 = hic;
+            if (periods <= window15 && hic > result->hic15)
+                result->hic15 = hic;
+        }
+    }
+}
+
+// angular velocity, acceleration and BrIC of the gyro samples that are new
+static void batch_gyro(metrics_batch_columns_t const *columns, uint32_t const *time, uint16_t rate_hz,
+                       uint32_t gyro_scale, metrics_batch_result_t *result)
+{
+    uint32_t const critical[3] = {IMPACT_METRICS_BRIC_X_MRAD, IMPACT_METRICS_BRIC_Y_MRAD,
+                                  IMPACT_METRICS_BRIC_Z_MRAD};
+    uint32_t peak_axis[3] = {0, 0, 0};
+    uint32_t peak_omega = 0, peak_alpha = 0;
+    int16_t gyro[3], prev[3] = {0, 0, 0};
+    uint32_t prev_time = 0, square, periods, alpha, ratio;
+    int seen = 0;
+
+    for (uint32_t i = 0; i < columns->count; i++)
+    {
+        for (uint8_t k = 0; k < 3; k++)
+            gyro[k] = columns->gyro[k][i];
+        if (columns->icm_accel[0][i] == 0 && columns->icm_accel[1][i] == 0 && columns->icm_accel[2][i] == 0
+            && gyro[0] == 0 && gyro[1] == 0 && gyro[2] == 0)
+            continue;
+        if (seen && memcmp(gyro, prev, sizeof(gyro)) == 0)
+            continue;
+
+        square = 0;
+        for (uint8_t k = 0; k < 3; k++)
+        {
+            square += (uint32_t) ((int32_t) gyro[k]*gyro[k]);
+            if ((uint32_t) abs(gyro[k]) > peak_axis[k])
+                peak_axis[k] = (uint32_t) abs(gyro[k]);
+        }
+        if ((uint16_t) int_sqrt32(square) > peak_omega)
+            peak_omega = (uint16_t) int_sqrt32(square);
+
+        periods = time[i] - prev_time;
+        if (seen && periods > 0)
+        {
+            square = 0;
+            for (uint8_t k = 0; k < 3; k++)
+            {
+                int16_t diff = saturate_counts((int32_t) gyro[k] - prev[k]);
+                square += (uint32_t) ((int32_t) diff*diff);
+            }
+            alpha = (uint32_t) (((uint64_t) gyro_counts_to_mrad(gyro_scale, int_sqrt32(square)) * rate_hz)
+                                / (1000ULL * periods));
+            if (alpha > peak_alpha)
+                peak_alpha = alpha;
+        }
+        memcpy(prev, gyro, sizeof(gyro));
+        prev_time = time[i];
+        seen = 1;
+    }
+
+    result->peak_omega_mrad = gyro_counts_to_mrad(gyro_scale, peak_omega);
+    result->peak_alpha = peak_alpha;
+    square = 0;
+    for (uint8_t k = 0; k < 3; k++)
+    {
+        //the device keeps the per axis peaks in 16 bits
+        ratio = (gyro_counts_to_mrad(gyro_scale, (uint16_t) peak_axis[k]) * 1000) / critical[k];
+        square += ratio*ratio;
+    }
+    result->bric_x1000 = int_sqrt32(square);
+}
+
+// peak resultant of each point, the point width the smallest power of two that fits the event
+static void batch_preview(uint16_t const *resultant, uint32_t const *time, uint32_t count, uint16_t rate_hz,
+                          metrics_batch_result_t *result)
+{
+    uint32_t end_time = (count > 0) ? time[count - 1] : 0;
+    uint32_t shift = 0, start = 0, end, used, g;
+    uint16_t peak;
+
+    while ((end_time >> shift) >= IMPACT_METRICS_PREVIEW_POINTS)
+        shift++;
+    used = (end_time >> shift) + 1;
+    for (uint32_t k = 0; k < IMPACT_METRICS_PREVIEW_POINTS; k++)
+    {
+        for (end = start; end < count && (time[end] >> shift) == k; end++)
+            ;
+        peak = 0;
+        for (uint32_t i = start; i < end; i++)
+            peak = (resultant[i] > peak) ? resultant[i] : peak;
+        start = end;
+        g = ((uint32_t) ADXL372_COUNTS_TO_MG(peak) + 500)/1000;
+        result->preview[k] = (k >= used) ? IMPACT_METRICS_PREVIEW_NONE : (uint8_t) ((g < 254) ? g : 254);
+    }
+    result->preview_us = (uint32_t) (((uint64_t) 1000000 << shift) / rate_hz);
+}
+
+/*
+ * Works out the metrics of one event, same arguments as impact_metrics_init
+ * @return 0 if success otherwise -1 if out of memory
+ */
+int metrics_batch_run(metrics_batch_t *batch, metrics_batch_columns_t const *columns, uint16_t rate_hz,
+                      uint16_t threshold, uint16_t gyro_fs_dps, metrics_batch_result_t *result)
+{
+    uint32_t const count = columns->count;
+    uint16_t window15 = (uint16_t) ((IMPACT_METRICS_HIC15_MS*(uint32_t) rate_hz)/1000);
+    uint16_t window36 = (uint16_t) ((IMPACT_METRICS_HIC36_MS*(uint32_t) rate_hz)/1000);
+    uint16_t block_periods = (window36 + IMPACT_METRICS_RING_SIZE - 2)/(IMPACT_METRICS_RING_SIZE - 1);
+    uint32_t gyro_scale = (uint32_t) (((uint64_t) gyro_fs_dps * 3141593ULL << 16) / (180ULL * 32768 * 1000));
+    uint16_t *resultant;
+    uint32_t *time, *integral;
+    uint32_t num_bounds = 1, t = 0, sum = 0, first = count, last = count;
+    uint16_t peak = 0;
+
+    if (batch_reserve(batch, count) < 0)
+        return -1;
+    resultant = batch->resultant;
+    time = batch->time;
+    integral = batch->integral;
+    if (block_periods == 0)
+        block_periods = 1;
+
+    //independent per record, vectorized, the double sqrt floors to int_sqrt32 of the square
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t square = (uint32_t) ((int32_t) columns->x[i]*columns->x[i])
+                        + (uint32_t) ((int32_t) columns->y[i]*columns->y[i])
+                        + (uint32_t) ((int32_t) columns->z[i]*columns->z[i]);
+        resultant[i] = (uint16_t) sqrt((double) square);
+    }
+
+    //running sums and the block boundaries they close
+    batch->bound_time[0] = 0;
+    batch->bound_integral[0] = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        t += columns->delta[i];
+        sum += (uint32_t) resultant[i]*columns->delta[i];
+        time[i] = t;
+        integral[i] = sum;
+        if (t - batch->bound_time[num_bounds - 1] >= block_periods)
+        {
+            batch->bound_time[num_bounds] = t;
+            batch->bound_integral[num_bounds] = sum;
+            num_bounds++;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+        peak = (resultant[i] > peak) ? resultant[i] : peak;
+    for (uint32_t i = 0; i < count && first == count; i++)
+        if (resultant[i] > threshold)
+            first = i;
+    for (uint32_t i = count; i-- > first && last == count; )
+        if (resultant[i] > threshold)
+            last = i;
+
+    result->peak_mg = (uint32_t) ADXL372_COUNTS_TO_MG(peak);
+    result->duration_us = (first == count) ? 0
+                        : (uint32_t) (((uint64_t) (time[last] - time[first]) * 1000000) / rate_hz);
+    batch_hic(batch, num_bounds, rate_hz, window15, window36, result);
+    batch_gyro(columns, time, rate_hz, gyro_scale, result);
+    batch_preview(resultant, time, count, rate_hz, result);
+    return 0;
+}
+
+/*
+ * The same results from the record by record metrics of the device
+ */
+void metrics_batch_result(impact_metrics_t const *metrics, metrics_batch_result_t *result)
+{
+    result->peak_mg = impact_metrics_peak_mg(metrics);
+    result->duration_us = impact_metrics_duration_us(metrics);
+    result->hic15 = metrics->hic15;
+    result->hic36 = metrics->hic36;
+    result->peak_omega_mrad = impact_metrics_peak_omega_mrad(metrics);
+    result->peak_alpha = metrics->peak_alpha;
+    result->bric_x1000 = impact_metrics_bric_x1000(metrics);
+    result->preview_us = impact_metrics_preview(metrics, result->preview);
+}
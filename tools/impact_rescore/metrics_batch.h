@@ -0,0 +1,65 @@
+#ifndef METRICS_BATCH_H
+#define METRICS_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "impact_metrics.h"
+
+/* The impact metrics of libraries/impact_metrics worked out over a whole event
+ * at once on the host, with the same integer results as adding its records
+ * one by one on the device. The event is held in columns, one array per
+ * field, and every pass that does not depend on the one before is a plain
+ * loop over them the compiler vectorizes (AVX2, NEON): the resultants, the
+ * peak, the threshold crossings and the peak of each preview point. The
+ * integer square roots are libraries/int_sqrt's, as on the device, except in
+ * the resultant pass: there the floor of a double sqrt vectorizes and equals
+ * int_sqrt32 for squares below 2^52.
+ * What stays serial
+ * is cheap: the running time and integral, the HIC block boundaries, which
+ * depend on the deltas before them, and the gyro samples, which are only new
+ * when they differ from the one before. HIC pairs the boundaries the way the
+ * device ring does, each with up to IMPACT_METRICS_RING_SIZE before it */
+
+/* One event, count records of each field */
+typedef struct {
+    uint32_t count;
+    int16_t const *x;           /* adxl372 counts */
+    int16_t const *y;
+    int16_t const *z;
+    int16_t const *icm_accel[3];
+    int16_t const *gyro[3];
+    uint8_t const *delta;       /* adxl372 sample periods since the record before */
+} metrics_batch_columns_t;
+
+typedef struct {
+    uint32_t peak_mg;
+    uint32_t duration_us;
+    uint32_t hic15;
+    uint32_t hic36;
+    uint32_t peak_omega_mrad;
+    uint32_t peak_alpha;        /* rad/s^2 */
+    uint32_t bric_x1000;
+    uint32_t preview_us;
+    uint8_t preview[IMPACT_METRICS_PREVIEW_POINTS];
+} metrics_batch_result_t;
+
+/* Scratch columns, grown to the longest event and reused */
+typedef struct {
+    size_t size;
+    uint16_t *resultant;
+    uint32_t *time;
+    uint32_t *integral;
+    uint32_t *bound_time;       /* HIC block boundaries, from the one before the first record */
+    uint32_t *bound_integral;
+} metrics_batch_t;
+
+void metrics_batch_init(metrics_batch_t *batch);
+
+int metrics_batch_run(metrics_batch_t *batch, metrics_batch_columns_t const *columns, uint16_t rate_hz,
+                      uint16_t threshold, uint16_t gyro_fs_dps, metrics_batch_result_t *result);
+
+void metrics_batch_result(impact_metrics_t const *metrics, metrics_batch_result_t *result);
+
+void metrics_batch_free(metrics_batch_t *batch);
+
+#endif //METRICS_BATCH_H
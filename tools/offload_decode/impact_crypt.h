@@ -0,0 +1,18 @@
+#ifndef IMPACT_CRYPT_H
+#define IMPACT_CRYPT_H
+
+#include <stdint.h>
+
+/* Host side of libraries/event_crypt: AES-128 in counter mode over the
+ * samples of an enciphered event, in software. The counter block is the
+ * event id XOR the nonce of the store format, time s, time us with its flags
+ * and the 16 byte block index of the samples, each little endian, the same
+ * call enciphers and deciphers. A store formatted before the nonce has 0 */
+#define IMPACT_CRYPT_KEY_SIZE   16
+
+void impact_crypt_apply(uint8_t const key[IMPACT_CRYPT_KEY_SIZE], uint32_t nonce, uint32_t id, uint32_t time_s,
+                        uint32_t time_us, uint8_t *data, uint32_t length);
+
+void impact_crypt_block(uint8_t const key[IMPACT_CRYPT_KEY_SIZE], uint8_t const in[16], uint8_t out[16]);
+
+#endif //IMPACT_CRYPT_H
@@ -0,0 +1,1098 @@
+//-------------------------------------------
+// Title: impact_log.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Host decoder of the stored impact events, from the
+// binary offload stream or from a raw flash image. Checks the frame,
+// header and data crcs and hands the decoded events to the caller,
+// and the activity log pages alongside them.
+//-------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "impact_log.h"
+#include "impact_record.h"
+#include "impact_codec.h"
+#include "impact_crypt.h"
+
+#define FRAME_OVERHEAD      (4 + 5 + 4) //sync, type and length, crc
+
+static uint32_t get_u32(uint8_t const *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t get_u16(uint8_t const *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+/*
+ * @return the index entry of an event, the index is a ring
+ */
+static uint32_t image_index(uint8_t const *data, uint32_t id)
+{
+    return get_u32(&data[EVENT_STORE_INDEX_ADDRESS + (id % EVENT_STORE_MAX_EVENTS) * 4]);
+}
+
+static void report(impact_log_handlers_t const *handlers, char const *format, ...)
+{
+    char message[128];
+    va_list args;
+
+    if (handlers->error == NULL)
+        return;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    handlers->error(handlers->p_context, message);
+}
+
+/*
+ * Same crc32 as the nRF5 SDK crc32_compute, table driven. Threads decoding
+ * at the same time may all build the table, with the same values, each only
+ * uses it once the flag says it is whole
+ * @param p_crc NULL starts a new crc, otherwise the result of the previous block
+ */
+uint32_t crc32_compute(uint8_t const *data, uint32_t size, uint32_t const *p_crc)
+{
+    static uint32_t table[256];
+    static int table_ready;
+    uint32_t crc = (p_crc == NULL) ? 0xFFFFFFFF : ~(*p_crc);
+
+    if (!__atomic_load_n(&table_ready, __ATOMIC_ACQUIRE))
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (uint32_t j = 8; j > 0; j--)
+                c = (c >> 1) ^ (0xEDB88320U & ((c & 1) ? 0xFFFFFFFF : 0));
+            __atomic_store_n(&table[i], c, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&table_ready, 1, __ATOMIC_RELEASE);
+    }
+    for (uint32_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void unpack_summary(uint8_t const *summary, impact_log_event_t *event)
+{
+    event->has_orientation = get_u32(&summary[0]) != 0xFFFFFFFF || get_u32(&summary[4]) != 0xFFFFFFFF;
+    for (int i = 0; i < 4; i++)
+        event->orientation[i] = (int16_t)get_u16(&summary[i*2]) / 16384.0; //Q14
+    for (int i = 0; i < 3; i++)
+        event->direction[i] = (int8_t)summary[8 + i] / 127.0;
+    event->location = summary[11];
+    event->has_peak = get_u16(&summary[12]) != EVENT_STORE_PEAK_UNKNOWN;
+    event->peak_g = get_u16(&summary[12]) / 10.0;
+    event->duration_ms = get_u16(&summary[14]);
+}
+
+/*
+ * Unpacks the clip counts a version 7 header adds to the summary
+ */
+static void unpack_clip(uint8_t const *summary, impact_log_event_t *event)
+{
+    event->has_clip = get_u16(&summary[20]) != EVENT_STORE_CLIP_UNKNOWN;
+    event->clip_points = event->has_clip ? get_u32(&summary[16]) : 0;
+    event->clipped_adxl = event->has_clip ? get_u16(&summary[20]) : 0;
+    event->clipped_icm = event->has_clip ? get_u16(&summary[22]) : 0;
+}
+
+/*
+ * The size of an event_store_header_t, the one of the version whose crc it holds.
+ * The frames carry no version, the crc tells the two apart
+ * @return EVENT_HEADER_SIZE or EVENT_HEADER_SIZE_V6, 0 if neither checks
+ */
+static size_t header_size(uint8_t const *data, size_t length)
+{
+    if (length < EVENT_HEADER_SIZE_V6 || get_u32(data) != EVENT_STORE_HEADER_MAGIC)
+        return 0;
+    if (length >= EVENT_HEADER_SIZE
+        && get_u32(&data[EVENT_HEADER_SIZE - 4]) == crc32_compute(data, EVENT_HEADER_SIZE - 4, NULL))
+        return EVENT_HEADER_SIZE;
+    if (get_u32(&data[EVENT_HEADER_SIZE_V6 - 4]) == crc32_compute(data, EVENT_HEADER_SIZE_V6 - 4, NULL))
+        return EVENT_HEADER_SIZE_V6;
+    return 0;
+}
+
+/*
+ * Checks and unpacks an event_store_header_t
+ * @return 0 if success otherwise -1
+ */
+static int decode_header(impact_log_handlers_t const *handlers, uint8_t const *data, size_t length,
+                         impact_log_event_t *event)
+{
+    size_t size = header_size(data, length);
+    uint8_t range;
+    bool coded, fused;
+
+    if (size == 0)
+    {
+        report(handlers, "event: bad header");
+        return -1;
+    }
+    event->id = get_u32(&data[4]);
+    event->gaps = 0;
+    event->rate_hz = 0;
+    event->time_s = get_u32(&data[8]);
+    event->time_us = get_u32(&data[12]) & EVENT_STORE_TIME_US_MASK;
+    event->synced = (get_u32(&data[12]) & EVENT_STORE_TIME_SYNCED) != 0;
+    event->sample_count = get_u32(&data[16]);
+    event->sample_size = get_u16(&data[20]);
+    event->encoding = get_u16(&data[22]);
+    event->encrypted = (event->encoding != EVENT_STORE_ENCODING_RAW
+                        && (event->encoding & EVENT_STORE_ENCODING_ENCRYPTED) != 0);
+    if (event->encrypted)
+        event->encoding &= ~EVENT_STORE_ENCODING_ENCRYPTED;
+    event->data_size = event->sample_count * event->sample_size;
+    //the ranges of the events stored before they could change, or that hold no records
+    if (impact_codec_encoding_parse(event->encoding, &coded, &range, &fused) < 0)
+    {
+        range = IMPACT_RECORD_RANGE_DEFAULT;
+        fused = false;
+    }
+    event->fused = fused;
+    event->gyro_fs_dps = IMPACT_RECORD_GYRO_FS_DPS(range);
+    event->icm_accel_lsb_per_g = IMPACT_RECORD_ACCEL_LSB_PER_G(range);
+    unpack_summary(&data[24], event);
+    event->header_size = size;
+    event->has_clip = 0;
+    if (size == EVENT_HEADER_SIZE)
+        unpack_clip(&data[24], event);
+    event->preview_us = 0;
+    event->preview_count = 0;
+    return 0;
+}
+
+/*
+ * Unpacks an event_store_preview_t, up to the first point past the end of the event
+ */
+static void unpack_preview(uint8_t const *preview, impact_log_event_t *event)
+{
+    if (get_u32(preview) == 0xFFFFFFFF)
+        return; //stored without one
+    event->preview_us = get_u32(preview);
+    for (event->preview_count = 0; event->preview_count < EVENT_PREVIEW_POINTS; event->preview_count++)
+    {
+        if (preview[4 + event->preview_count] == EVENT_PREVIEW_NONE)
+            break;
+        event->preview_g[event->preview_count] = preview[4 + event->preview_count];
+    }
+}
+
+static void emit_record(impact_log_handlers_t const *handlers, impact_log_event_t const *event,
+                        impact_log_sample_t *sample, uint32_t *p_sample_periods, impact_record_t const *record)
+{
+    uint8_t delta;
+
+    impact_record_unpack(record, &sample->accel, &sample->icm, &delta);
+    *p_sample_periods += delta;
+    sample->delta = delta;
+    sample->gap = (sample->index > 0 && delta == IMPACT_RECORD_DELTA_GAP);
+    sample->t_us = (uint32_t)(((uint64_t)*p_sample_periods * 1000000) / ADXL_SAMPLE_RATE_HZ);
+    if (handlers->sample != NULL)
+        handlers->sample(handlers->p_context, event, sample);
+}
+
+/*
+ * Counts the gap markers of the impact records of an event and works out the
+ * rate they came in at, a gap taken as IMPACT_RECORD_DELTA_GAP periods. Stops
+ * at a corrupt record, the decode reports it
+ */
+static void scan_records(impact_log_event_t *event, uint8_t const *samples, bool coded)
+{
+    impact_codec_t codec;
+    impact_record_t record;
+    adxl372_accel_data_t accel;
+    icm20649_data_t icm;
+    uint32_t pos = 0, count = 0, sample_periods = 0;
+    uint8_t used, delta;
+
+    impact_codec_init(&codec);
+    while (coded ? pos < event->data_size : count < event->sample_count)
+    {
+        if (!coded)
+        {
+            memcpy(&record, &samples[count * IMPACT_RECORD_SIZE], IMPACT_RECORD_SIZE);
+        }
+        else
+        {
+            if (impact_codec_decode(&codec, &samples[pos], event->data_size - pos, &record, &used) < 0)
+                break;
+            pos += used;
+        }
+        impact_record_unpack(&record, &accel, &icm, &delta);
+        if (count > 0 && delta == IMPACT_RECORD_DELTA_GAP)
+            event->gaps++;
+        sample_periods += delta;
+        count++;
+    }
+    if (sample_periods > 0)
+        event->rate_hz = (uint32_t)(((uint64_t)(count - 1) * ADXL_SAMPLE_RATE_HZ) / sample_periods);
+}
+
+/*
+ * Decodes the samples of an event whose header is unpacked and whose
+ * samples are all there and in the clear
+ * @return 0 if success otherwise -1
+ */
+static int decode_samples(impact_log_handlers_t const *handlers, uint8_t const *header, uint8_t const *samples,
+                          impact_log_event_t event)
+{
+    impact_log_sample_t sample;
+    impact_log_window_t window;
+    impact_codec_t codec;
+    impact_record_t record;
+    uint32_t pos = 0, sample_periods = 0;
+    uint8_t used, range;
+    bool coded, fused, records;
+
+    if (event.data_size > 0
+        && get_u32(&header[event.header_size - 8]) != crc32_compute(samples, event.data_size, NULL))
+    {
+        report(handlers, "event %u: data crc mismatch%s", event.id, event.encrypted ? ", or the wrong key" : "");
+        return -1;
+    }
+    records = (impact_codec_encoding_parse(event.encoding, &coded, &range, &fused) == 0
+               && (coded || event.sample_size == IMPACT_RECORD_SIZE));
+    if (!records && !(event.encoding == SUMMARY_LOG_ENCODING && event.sample_size == SUMMARY_LOG_RECORD_SIZE))
+    {
+        report(handlers, "event %u: unknown encoding %u", event.id, event.encoding);
+        return -1;
+    }
+    if (records)
+        scan_records(&event, samples, coded);
+    if (handlers->event != NULL)
+        handlers->event(handlers->p_context, &event);
+
+    if (records && coded)
+    {
+        impact_codec_init(&codec);
+        for (sample.index = 0; pos < event.data_size; sample.index++)
+        {
+            if (impact_codec_decode(&codec, &samples[pos], event.data_size - pos, &record, &used) < 0)
+            {
+                report(handlers, "event %u: corrupt record %u", event.id, sample.index);
+                return -1;
+            }
+            pos += used;
+            emit_record(handlers, &event, &sample, &sample_periods, &record);
+        }
+    }
+    else if (event.encoding == SUMMARY_LOG_ENCODING)
+    {
+        for (uint32_t i = 0; i < event.sample_count; i++)
+        {
+            uint8_t const *p = &samples[i * SUMMARY_LOG_RECORD_SIZE];
+            window.window = get_u32(&p[0]);
+            window.peak_mg = ADXL372_COUNTS_TO_MG(get_u16(&p[4]));
+            window.hits = get_u16(&p[6]);
+            window.exposure_g = (uint32_t)(((uint64_t)get_u32(&p[8]) * ADXL372_MG_PER_LSB) / 1000);
+            window.flags = p[12];
+            if (handlers->window != NULL)
+                handlers->window(handlers->p_context, &event, &window);
+        }
+    }
+    else
+    {
+        for (sample.index = 0; sample.index < event.sample_count; sample.index++)
+        {
+            memcpy(&record, &samples[sample.index * IMPACT_RECORD_SIZE], IMPACT_RECORD_SIZE);
+            emit_record(handlers, &event, &sample, &sample_periods, &record);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Decodes one event from its event_store_header_t and its samples
+ * @param length - bytes from header on
+ * @param samples_length - bytes from samples on, the samples of the event may be followed by others
+ * @param preview - the event_store_preview_t, NULL if there is none
+ * @return 0 if success otherwise -1
+ */
+static int decode_event(impact_log_handlers_t const *handlers, uint8_t const *header, size_t length,
+                        uint8_t const *samples, size_t samples_length, uint8_t const *preview)
+{
+    impact_log_event_t event;
+    uint8_t *clear;
+    int ret;
+
+    if (decode_header(handlers, header, length, &event) < 0)
+        return -1;
+    if (preview != NULL)
+        unpack_preview(preview, &event);
+    if ((uint64_t)event.sample_count * event.sample_size > samples_length)
+    {
+        report(handlers, "event %u: %u sample bytes, %u available", event.id, event.data_size,
+               (uint32_t)samples_length);
+        return -1;
+    }
+    if (!event.encrypted || event.data_size == 0)
+        return decode_samples(handlers, header, samples, event);
+
+    if (handlers->key == NULL)
+    {
+        report(handlers, "event %u: enciphered, no key", event.id);
+        return -1;
+    }
+    clear = malloc(event.data_size);
+    if (clear == NULL)
+    {
+        report(handlers, "event %u: out of memory", event.id);
+        return -1;
+    }
+    memcpy(clear, samples, event.data_size);
+    //the counter takes the time word as stored, with its flags
+    impact_crypt_apply(handlers->key, handlers->nonce, event.id, event.time_s, get_u32(&header[12]), clear,
+                       event.data_size);
+    ret = decode_samples(handlers, header, clear, event);
+    free(clear);
+    return ret;
+}
+
+/*
+ * Decodes one event, an event_store_header_t followed by its samples, as sent
+ * in an event frame
+ * @param length bytes from data on, the samples of the event may be followed by others
+ * @return 0 if success otherwise -1
+ */
+int impact_log_decode_event(impact_log_handlers_t const *handlers, uint8_t const *data, size_t length)
+{
+    size_t size = header_size(data, length);
+    size_t samples_length = (length > size) ? length - size : 0;
+
+    //a header that does not check is reported by decode_header
+    return decode_event(handlers, data, length, data + size, samples_length, NULL);
+}
+
+/*
+ * Runs the activity handler for each second of an activity log page, up to
+ * its first erased record
+ * @return 0 if success otherwise -1 if the page is corrupt
+ */
+static int decode_activity(impact_log_handlers_t const *handlers, uint8_t const *page, size_t length)
+{
+    impact_log_activity_t activity;
+    uint8_t const *record;
+    uint32_t start_s;
+
+    if (length != ACTIVITY_LOG_PAGE_SIZE || get_u32(&page[0]) != ACTIVITY_LOG_MAGIC
+        || crc32_compute(page, ACTIVITY_LOG_PAGE_SIZE - 4, NULL) != get_u32(&page[ACTIVITY_LOG_PAGE_SIZE - 4]))
+    {
+        report(handlers, "activity: bad page of %u bytes", (uint32_t)length);
+        return -1;
+    }
+    if (handlers->activity == NULL)
+        return 0;
+
+    memset(&activity, 0, sizeof(activity));
+    activity.seq = get_u32(&page[4]);
+    start_s = get_u32(&page[8]);
+    for (uint32_t i = 0; i < ACTIVITY_LOG_PAGE_RECORDS; i++)
+    {
+        record = &page[12 + i*4];
+        if (record[3] == ACTIVITY_LOG_FLAGS_ERASED)
+            break;
+        activity.time_s = start_s + i;
+        activity.peak_g = get_u16(&record[0]) / 10.0;
+        activity.rms_g = record[2] / 100.0;
+        activity.worn = (record[3] & ACTIVITY_LOG_FLAG_WORN) != 0;
+        activity.gap = (record[3] & ACTIVITY_LOG_FLAG_GAP) != 0;
+        activity.impact = (record[3] & ACTIVITY_LOG_FLAG_IMPACT) != 0;
+        handlers->activity(handlers->p_context, &activity);
+    }
+    return 0;
+}
+
+void impact_log_stream_init(impact_log_stream_t *stream, impact_log_handlers_t const *handlers)
+{
+    memset(stream, 0, sizeof(impact_log_stream_t));
+    stream->handlers = handlers;
+}
+
+void impact_log_stream_free(impact_log_stream_t *stream)
+{
+    free(stream->buf);
+    stream->buf = NULL;
+    stream->buf_length = 0;
+    stream->buf_size = 0;
+}
+
+// decodes the samples of a live frame, a sequence number that does not follow
+// on is reported as lost frames unless it is 0, the stream started over. A
+// coded frame that is not a key frame needs the frame before it decoded
+static void stream_live(impact_log_stream_t *stream, uint8_t const *payload, uint32_t length)
+{
+    impact_log_live_t live;
+    impact_record_t record;
+    uint8_t const *p;
+    uint32_t first;
+    uint32_t pos;
+    uint16_t lost;
+    uint8_t count;
+    uint8_t flags;
+    uint8_t used;
+    uint32_t raw_length;
+    int follows;
+
+    count = (length >= LIVE_STREAM_HEADER_SIZE) ? payload[8] : 0;
+    flags = (length >= LIVE_STREAM_HEADER_SIZE) ? payload[9] : 0;
+    raw_length = LIVE_STREAM_HEADER_SIZE + (uint32_t)count * LIVE_STREAM_SAMPLE_SIZE;
+    if (length < LIVE_STREAM_HEADER_SIZE || get_u16(&payload[2]) == 0
+        || (!(flags & LIVE_STREAM_FLAG_CODED) && length != raw_length))
+    {
+        report(stream->handlers, "live: bad frame of %u bytes", length);
+        stream->num_errors++;
+        stream->live_chained = 0;
+        return;
+    }
+
+    memset(&live, 0, sizeof(live));
+    live.seq = get_u16(&payload[0]);
+    live.rate_hz = get_u16(&payload[2]);
+    live.gap = (flags & LIVE_STREAM_FLAG_GAP) != 0;
+    first = get_u32(&payload[4]);
+    follows = stream->live_started && live.seq == (uint16_t)(stream->live_seq + 1);
+    if (stream->live_started && live.seq != 0 && !follows)
+    {
+        lost = live.seq - stream->live_seq - 1;
+        report(stream->handlers, "live: %u frames lost before frame %u", lost, live.seq);
+        stream->live_lost += lost;
+    }
+    stream->live_started = 1;
+    stream->live_seq = live.seq;
+
+    if (!(flags & LIVE_STREAM_FLAG_CODED))
+    {
+        stream->live_chained = 0;
+        if (stream->handlers->live == NULL)
+            return;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            p = &payload[LIVE_STREAM_HEADER_SIZE + i*LIVE_STREAM_SAMPLE_SIZE];
+            live.index = first + i;
+            live.t_us = (uint32_t)(((uint64_t)live.index * 1000000) / live.rate_hz);
+            live.accel.x = (int16_t)get_u16(&p[0]);
+            live.accel.y = (int16_t)get_u16(&p[2]);
+            live.accel.z = (int16_t)get_u16(&p[4]);
+            live.icm.gyro_x = (int16_t)get_u16(&p[6]);
+            live.icm.gyro_y = (int16_t)get_u16(&p[8]);
+            live.icm.gyro_z = (int16_t)get_u16(&p[10]);
+            stream->handlers->live(stream->handlers->p_context, &live);
+        }
+        return;
+    }
+
+    if (flags & LIVE_STREAM_FLAG_KEY)
+    {
+        impact_codec_init(&stream->live_codec);
+    }
+    else if (!stream->live_chained || !follows)
+    {
+        report(stream->handlers, "live: coded frame %u skipped up to the next key frame", live.seq);
+        stream->live_skipped++;
+        stream->live_chained = 0;
+        return;
+    }
+
+    //the codec state only moves on here, a frame cut short breaks the chain
+    pos = LIVE_STREAM_HEADER_SIZE;
+    stream->live_chained = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (impact_codec_decode(&stream->live_codec, &payload[pos], length - pos, &record, &used) < 0)
+        {
+            report(stream->handlers, "live: bad coded frame %u", live.seq);
+            stream->num_errors++;
+            return;
+        }
+        pos += used;
+        if (stream->handlers->live == NULL)
+            continue;
+        impact_record_unpack(&record, &live.accel, &live.icm, NULL);
+        live.index = first + i;
+        live.t_us = (uint32_t)(((uint64_t)live.index * 1000000) / live.rate_hz);
+        stream->handlers->live(stream->handlers->p_context, &live);
+    }
+    if (pos != length)
+    {
+        report(stream->handlers, "live: %u bytes left over in coded frame %u", length - pos, live.seq);
+        stream->num_errors++;
+        return;
+    }
+    stream->live_chained = 1;
+}
+
+// checks and dispatches one complete frame, frame points at the sync word
+static void stream_frame(impact_log_stream_t *stream, uint8_t const *frame, uint32_t length)
+{
+    uint8_t const *payload = frame + 9;
+    uint32_t crc;
+
+    crc = crc32_compute(frame + 4, 5 + length, NULL);
+    if (crc != get_u32(payload + length))
+    {
+        report(stream->handlers, "frame: crc mismatch, dropped");
+        stream->num_errors++;
+    }
+    else if (frame[4] == SERIAL_OFFLOAD_FRAME_EVENT)
+    {
+        if (impact_log_decode_event(stream->handlers, payload, length) < 0)
+            stream->num_errors++;
+        else
+            stream->num_decoded++;
+        stream->num_events++;
+    }
+    else if (frame[4] == SERIAL_OFFLOAD_FRAME_SUMMARY)
+    {
+        impact_log_event_t event;
+
+        if (decode_header(stream->handlers, payload, length, &event) < 0)
+        {
+            stream->num_errors++;
+        }
+        else
+        {
+            //the summaries of a version 5 device end at the header
+            if (length >= event.header_size + EVENT_PREVIEW_SIZE)
+                unpack_preview(&payload[event.header_size], &event);
+            if (stream->handlers->event != NULL)
+                stream->handlers->event(stream->handlers->p_context, &event);
+            stream->num_decoded++;
+        }
+        stream->num_events++;
+    }
+    else if (frame[4] == SERIAL_OFFLOAD_FRAME_END && length == sizeof(uint32_t))
+    {
+        if (get_u32(payload) != stream->num_events)
+        {
+            report(stream->handlers, "end: %u events sent, %u received", get_u32(payload), stream->num_events);
+            stream->num_errors++;
+        }
+        stream->num_events = 0;
+    }
+    else if (frame[4] == SERIAL_OFFLOAD_FRAME_LIVE)
+    {
+        stream_live(stream, payload, length);
+    }
+    else if (frame[4] == SERIAL_OFFLOAD_FRAME_ACTIVITY && length == 0)
+    {
+        //the end of a read of the log
+        stream->activity_pages = 0;
+    }
+    else if (frame[4] == SERIAL_OFFLOAD_FRAME_ACTIVITY)
+    {
+        if (decode_activity(stream->handlers, payload, length) < 0)
+            stream->num_errors++;
+        else
+            stream->activity_pages++;
+    }
+}
+
+/*
+ * Decodes the whole frames from the start of data
+ * @return the bytes used, the rest is a frame cut short or less than a sync word
+ */
+static size_t stream_parse(impact_log_stream_t *stream, uint8_t const *data, size_t length)
+{
+    size_t pos = 0;
+    uint32_t frame_length;
+
+    while (length - pos >= 4)
+    {
+        if (get_u32(&data[pos]) != SERIAL_OFFLOAD_SYNC)
+        {
+            pos++;
+            continue;
+        }
+        if (length - pos < 9)
+            break;
+        frame_length = get_u32(&data[pos + 5]);
+        if (frame_length > IMPACT_LOG_MAX_FRAME_LENGTH)
+        {
+            //a sync word inside a payload, look for the next one
+            pos++;
+            continue;
+        }
+        if (length - pos < FRAME_OVERHEAD + (size_t)frame_length)
+            break;
+        stream_frame(stream, &data[pos], frame_length);
+        pos += FRAME_OVERHEAD + frame_length;
+    }
+    return pos;
+}
+
+/*
+ * Parses the next bytes of an offload stream, a frame may be split over any
+ * number of calls and the bytes before a sync word are skipped
+ * @return 0 if success otherwise -1 if out of memory
+ */
+int impact_log_stream_feed(impact_log_stream_t *stream, uint8_t const *data, size_t length)
+{
+    size_t pos;
+    uint8_t *buf;
+
+    if (stream->buf_length == 0)
+    {
+        //nothing carried over, the frames are decoded where they are and only the tail is kept
+        pos = stream_parse(stream, data, length);
+        data += pos;
+        length -= pos;
+    }
+    if (stream->buf_length + length > stream->buf_size)
+    {
+        size_t size = (stream->buf_size > 0) ? stream->buf_size : 64*1024;
+        while (size < stream->buf_length + length)
+            size *= 2;
+        buf = realloc(stream->buf, size);
+        if (buf == NULL)
+            return -1;
+        stream->buf = buf;
+        stream->buf_size = size;
+    }
+    memcpy(&stream->buf[stream->buf_length], data, length);
+    stream->buf_length += length;
+    buf = stream->buf;
+
+    pos = stream_parse(stream, buf, stream->buf_length);
+    memmove(buf, &buf[pos], stream->buf_length - pos);
+    stream->buf_length -= pos;
+    return 0;
+}
+
+/*
+ * @return nonzero if the image starts with a formatted event_store superblock
+ */
+int impact_log_is_flash_image(uint8_t const *image, size_t size)
+{
+    return size >= EVENT_STORE_DATA_ADDRESS && get_u32(&image[0]) == EVENT_STORE_MAGIC
+        && get_u32(&image[4]) >= 3 && get_u32(&image[4]) <= EVENT_STORE_VERSION;
+}
+
+/*
+ * Decodes the event at a ring address, an event that runs past the end of the
+ * ring is put back together in a buffer of its own
+ * @param data_end - end of the ring of the store's version
+ * @param version - of the store, the preview sits between the header and the samples from 6 on
+ * @return 0 if success otherwise -1
+ */
+static int flash_image_event(impact_log_handlers_t const *handlers, uint8_t const *image, size_t size,
+                             uint32_t data_end, uint32_t version, uint32_t id, uint32_t address)
+{
+    uint32_t ring_size = data_end - EVENT_STORE_DATA_ADDRESS;
+    uint32_t flash_address = EVENT_STORE_DATA_ADDRESS + (address - EVENT_STORE_DATA_ADDRESS) % ring_size;
+    uint8_t const *header = &image[flash_address];
+    uint8_t const *p_head = header;
+    uint8_t head[EVENT_HEADER_SIZE];
+    uint32_t size_of_header = (version >= 7) ? EVENT_HEADER_SIZE : EVENT_HEADER_SIZE_V6;
+    uint32_t data_offset = (version >= 6) ? size_of_header + EVENT_PREVIEW_SIZE : size_of_header;
+    uint64_t length;
+    uint8_t *event;
+    uint32_t first;
+    int ret;
+
+    if (flash_address >= size)
+    {
+        report(handlers, "index %u: address 0x%08x outside the image", id, address);
+        return -1;
+    }
+    //events are packed so a header can run past the end of the ring, its count is read from a copy
+    if (size >= data_end && data_end - flash_address < size_of_header)
+    {
+        first = data_end - flash_address;
+        memcpy(head, header, first);
+        memcpy(&head[first], &image[EVENT_STORE_DATA_ADDRESS], size_of_header - first);
+        p_head = head;
+    }
+    //an event short of the end decodes in place
+    length = data_offset;
+    if (size - flash_address >= size_of_header && get_u32(p_head) == EVENT_STORE_HEADER_MAGIC)
+        length += (uint64_t)get_u32(&p_head[16]) * get_u16(&p_head[20]);
+    if (flash_address + length <= data_end || size < data_end || length > ring_size)
+    {
+        if (size - flash_address < data_offset)
+            return decode_event(handlers, header, size - flash_address, header, 0, NULL);
+        return decode_event(handlers, header, size - flash_address, header + data_offset,
+                            size - flash_address - data_offset, (version >= 6) ? header + size_of_header : NULL);
+    }
+
+    event = malloc(length);
+    if (event == NULL)
+    {
+        report(handlers, "event %u: out of memory", id);
+        return -1;
+    }
+    first = data_end - flash_address;
+    memcpy(event, header, first);
+    memcpy(&event[first], &image[EVENT_STORE_DATA_ADDRESS], length - first);
+    ret = decode_event(handlers, event, length, event + data_offset, length - data_offset,
+                       (version >= 6) ? event + size_of_header : NULL);
+    free(event);
+    return ret;
+}
+
+typedef struct {
+    uint32_t seq;
+    uint32_t address;
+} activity_page_t;
+
+static int activity_page_compare(void const *a, void const *b)
+{
+    int32_t diff = (int32_t)(((activity_page_t const *)a)->seq - ((activity_page_t const *)b)->seq);
+
+    return (diff > 0) - (diff < 0);
+}
+
+/*
+ * Decodes the activity log pages of an image in the order they were written,
+ * the erased pages are skipped
+ * @return the number of corrupt pages
+ */
+static uint32_t flash_image_activity(impact_log_handlers_t const *handlers, uint8_t const *image)
+{
+    activity_page_t *pages;
+    uint32_t num_pages = 0;
+    uint32_t errors = 0;
+    uint32_t address;
+
+    pages = malloc(ACTIVITY_LOG_SIZE / ACTIVITY_LOG_PAGE_SIZE * sizeof(activity_page_t));
+    if (pages == NULL)
+    {
+        report(handlers, "activity: out of memory");
+        return 1;
+    }
+    for (address = ACTIVITY_LOG_ADDRESS; address < ACTIVITY_LOG_ADDRESS + ACTIVITY_LOG_SIZE; address += ACTIVITY_LOG_PAGE_SIZE)
+    {
+        if (get_u32(&image[address]) != ACTIVITY_LOG_MAGIC)
+            continue;
+        pages[num_pages].seq = get_u32(&image[address + 4]);
+        pages[num_pages].address = address;
+        num_pages++;
+    }
+    qsort(pages, num_pages, sizeof(activity_page_t), activity_page_compare);
+    for (uint32_t i = 0; i < num_pages; i++)
+    {
+        if (decode_activity(handlers, &image[pages[i].address], ACTIVITY_LOG_PAGE_SIZE) < 0)
+            errors++;
+    }
+    free(pages);
+    return errors;
+}
+
+/*
+ * Decodes every event of a raw flash image in id order, up to the newest
+ * index entry. An event that was not committed has an erased header
+ * and is reported and skipped like a corrupt one. The events a ring below the
+ * newest one may have been erased for it, they are skipped with one report.
+ * The activity log pages of a version 5 store follow, if there is a handler
+ * @return 0 if success otherwise -1 if the image is not a formatted store
+ */
+int impact_log_flash_image(impact_log_handlers_t const *handlers, uint8_t const *image, size_t size,
+                           uint32_t *p_decoded, uint32_t *p_errors)
+{
+    impact_log_image_t store;
+    uint32_t id;
+
+    *p_decoded = 0;
+    *p_errors = 0;
+    if (impact_log_image_attach(&store, image, size) < 0)
+    {
+        report(handlers, "image: no event store superblock");
+        return -1;
+    }
+
+    if (store.first > 0)
+        report(handlers, "image: events 0 to %u reclaimed by the ring", store.first - 1);
+    for (id = store.first; id < store.count; id++)
+    {
+        if (image_index(image, id) < EVENT_STORE_DATA_ADDRESS)
+        {
+            report(handlers, "index %u: address 0x%08x outside the image", id, image_index(image, id));
+            (*p_errors)++;
+        }
+        else if (impact_log_image_event(handlers, &store, id) < 0)
+            (*p_errors)++;
+        else
+            (*p_decoded)++;
+    }
+    //the stores before 5 left the top of the flash to the ring
+    if (store.version >= 5 && handlers->activity != NULL && size >= ACTIVITY_LOG_ADDRESS + ACTIVITY_LOG_SIZE)
+        *p_errors += flash_image_activity(handlers, image);
+    return 0;
+}
+
+/*
+ * Finds the event count in the index ring as the store mounts it: the ring
+ * addresses grow from the first entry up to the newest, the id of the newest
+ * is in its header. An index that did not come round has its ids in place
+ */
+static uint32_t image_count(uint8_t const *data, size_t size, uint32_t data_end)
+{
+    uint32_t first = get_u32(&data[EVENT_STORE_INDEX_ADDRESS]), slot = 1, probe, address, offset;
+
+    if (first == 0xFFFFFFFF)
+    {
+        if (image_index(data, EVENT_STORE_MAX_EVENTS - 1) == 0xFFFFFFFF)
+            return 0;
+        slot = EVENT_STORE_MAX_EVENTS;
+    }
+    while (slot < EVENT_STORE_MAX_EVENTS && image_index(data, slot) != 0xFFFFFFFF && image_index(data, slot) >= first)
+        slot++;
+    for (probe = 1; probe <= EVENT_STORE_MOUNT_PROBES; probe++)
+    {
+        address = image_index(data, slot + EVENT_STORE_MAX_EVENTS - probe);
+        if (address < EVENT_STORE_DATA_ADDRESS || address == 0xFFFFFFFF)
+            continue;
+        offset = EVENT_STORE_DATA_ADDRESS + (address - EVENT_STORE_DATA_ADDRESS) % (data_end - EVENT_STORE_DATA_ADDRESS);
+        if (offset + 8 <= size && get_u32(&data[offset]) == EVENT_STORE_HEADER_MAGIC
+            && get_u32(&data[offset + 4]) % EVENT_STORE_MAX_EVENTS == (slot + EVENT_STORE_MAX_EVENTS - probe) % EVENT_STORE_MAX_EVENTS)
+            return get_u32(&data[offset + 4]) + probe;
+    }
+    return slot;
+}
+
+/*
+ * Finds the ack watermark as the store mounts it: the last programmed word of
+ * the ack log, or the one before it if a reset tore the last, holds the low 16
+ * bits of the count. Older stores left the log erased, their watermark is 0
+ */
+static uint32_t image_acked(uint8_t const *data, uint32_t count)
+{
+    uint32_t low = 0, high = EVENT_STORE_ACK_SLOTS, mid, slot, word, lag;
+
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        if (get_u32(&data[EVENT_STORE_ACK_ADDRESS + mid * 4]) == 0xFFFFFFFF)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    for (slot = low; slot > 0 && low - slot < 2; slot--)
+    {
+        word = get_u32(&data[EVENT_STORE_ACK_ADDRESS + (slot - 1) * 4]);
+        //the count and its complement, the words of older builds hold the bare count
+        if ((word >> 16) != 0 && (word >> 16) != (~word & 0xFFFF))
+            continue;
+        lag = (count - word) & 0xFFFF;
+        if (lag <= count && lag <= EVENT_STORE_MAX_EVENTS + EVENT_STORE_INDEX_SUBSECTOR_ENTRIES)
+            return count - lag;
+        return count;
+    }
+    return 0;
+}
+
+/*
+ * @return the word at a ring address of the image, erased if it is past the image.
+ * Events start on a word so a word of a header never runs past the end of the ring
+ */
+static uint32_t image_ring_word(impact_log_image_t const *image, uint32_t address)
+{
+    uint32_t offset = EVENT_STORE_DATA_ADDRESS + (address - EVENT_STORE_DATA_ADDRESS) % (image->data_end - EVENT_STORE_DATA_ADDRESS);
+
+    return (offset + 4 <= image->size) ? get_u32(&image->data[offset]) : 0xFFFFFFFF;
+}
+
+/*
+ * @return 1 if the header of an event is still where its index entry points, otherwise 0
+ */
+static int image_header_held(impact_log_image_t const *image, uint32_t id)
+{
+    uint32_t address = image_index(image->data, id);
+
+    return address >= EVENT_STORE_DATA_ADDRESS && address != 0xFFFFFFFF
+        && image_ring_word(image, address) == EVENT_STORE_HEADER_MAGIC && image_ring_word(image, address + 4) == id;
+}
+
+/*
+ * Takes an image already in memory, reads its superblock and index
+ * @return 0 if success otherwise -2 if the image is not a formatted store
+ */
+int impact_log_image_attach(impact_log_image_t *image, uint8_t const *data, size_t size)
+{
+    uint32_t newest, ring_size, next, data_offset;
+    uint64_t reach;
+
+    memset(image, 0, sizeof(*image));
+    if (!impact_log_is_flash_image(data, size))
+        return -2;
+    image->data = data;
+    image->size = size;
+    image->version = get_u32(&data[4]);
+    image->data_end = (image->version >= 5) ? EVENT_STORE_DATA_END : EVENT_STORE_DATA_END_V4;
+    //a store formatted before the nonce left its word erased
+    image->nonce = (get_u32(&data[8]) == 0xFFFFFFFF) ? 0 : get_u32(&data[8]);
+    ring_size = image->data_end - EVENT_STORE_DATA_ADDRESS;
+
+    image->count = image_count(data, size, image->data_end);
+    image->acked = image_acked(data, image->count);
+    newest = (image->count > 0) ? image_index(data, image->count - 1) : 0;
+    //the entries of the ring before in the subsector past the newest were erased for it
+    next = (image->count + EVENT_STORE_INDEX_SUBSECTOR_ENTRIES - 1) & ~(EVENT_STORE_INDEX_SUBSECTOR_ENTRIES - 1);
+    if (image->count % EVENT_STORE_INDEX_SUBSECTOR_ENTRIES == 0 && image_index(data, image->count) == 0xFFFFFFFF)
+        next += EVENT_STORE_INDEX_SUBSECTOR_ENTRIES;
+    image->first = (next > EVENT_STORE_MAX_EVENTS) ? next - EVENT_STORE_MAX_EVENTS : 0;
+    if (image->first >= image->count)
+        return 0;
+
+    //the erase step keeps EVENT_STORE_ERASE_AHEAD and a sector erased past the
+    //subsector of the append pointer, at the end of the newest event
+    reach = newest;
+    if (image_header_held(image, image->count - 1))
+    {
+        data_offset = (image->version >= 7) ? EVENT_HEADER_SIZE : EVENT_HEADER_SIZE_V6;
+        if (image->version >= 6)
+            data_offset += EVENT_PREVIEW_SIZE;
+        reach += data_offset + (uint64_t)image_ring_word(image, newest + 16) * (image_ring_word(image, newest + 20) & 0xFFFF);
+    }
+    reach += EVENT_STORE_SUBSECTOR_SIZE + EVENT_STORE_ERASE_AHEAD + EVENT_STORE_SECTOR_SIZE;
+    //the addresses only grow, the events the ring took are the first ones. The
+    //erase never runs a ring past an event that was not acked until retention
+    //let it go, then its header is the first thing erased
+    while (image->first < image->count
+           && (uint64_t)image_index(data, image->first) + ring_size < reach
+           && (image->first < image->acked || !image_header_held(image, image->first)))
+        image->first++;
+    return 0;
+}
+
+/*
+ * Maps the flash image at path read only, nothing is read but the index
+ * until an event is asked for
+ * @return 0 if success otherwise -1 if it cannot be mapped or -2 if it is not a formatted store
+ */
+int impact_log_image_open(impact_log_image_t *image, char const *path)
+{
+    struct stat info;
+    void *map;
+    int fd, ret;
+
+    memset(image, 0, sizeof(*image));
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &info) < 0 || !S_ISREG(info.st_mode) || info.st_size == 0
+        || (map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    ret = impact_log_image_attach(image, map, info.st_size);
+    if (ret < 0)
+    {
+        munmap(map, info.st_size);
+        return ret;
+    }
+    image->mapped = 1;
+    return 0;
+}
+
+void impact_log_image_close(impact_log_image_t *image)
+{
+    if (image->mapped)
+        munmap((void *)image->data, image->size);
+    memset(image, 0, sizeof(*image));
+}
+
+/*
+ * Points at the header and preview of an event in the image, put back
+ * together in copy when they run past the end of the ring
+ * @param copy - EVENT_HEADER_SIZE + EVENT_PREVIEW_SIZE bytes
+ * @param p_length - bytes of header and preview from the one returned
+ * @return the header otherwise NULL if the index entry points outside the image
+ */
+static uint8_t const *image_header(impact_log_image_t const *image, uint32_t id, uint8_t *copy, uint32_t *p_length)
+{
+    uint32_t address = image_index(image->data, id);
+    uint32_t ring_size = image->data_end - EVENT_STORE_DATA_ADDRESS;
+    uint32_t size_of_header = (image->version >= 7) ? EVENT_HEADER_SIZE : EVENT_HEADER_SIZE_V6;
+    uint32_t offset, first;
+
+    *p_length = size_of_header + EVENT_PREVIEW_SIZE;
+    if (address < EVENT_STORE_DATA_ADDRESS)
+        return NULL;
+    offset = EVENT_STORE_DATA_ADDRESS + (address - EVENT_STORE_DATA_ADDRESS) % ring_size;
+    if (offset + *p_length <= image->data_end || image->size < image->data_end)
+        return (offset + *p_length <= image->size) ? &image->data[offset] : NULL;
+    //events are packed so a header and its preview can run past the end of the ring
+    first = image->data_end - offset;
+    memcpy(copy, &image->data[offset], first);
+    memcpy(&copy[first], &image->data[EVENT_STORE_DATA_ADDRESS], *p_length - first);
+    return copy;
+}
+
+/*
+ * Unpacks the header and preview of one event from the image, without its
+ * samples or any report
+ * @return 0 if success otherwise -1 if the id is not in the image or the header is corrupt
+ */
+int impact_log_image_header(impact_log_image_t const *image, uint32_t id, impact_log_event_t *event)
+{
+    static impact_log_handlers_t const quiet;
+    uint8_t copy[EVENT_HEADER_SIZE + EVENT_PREVIEW_SIZE];
+    uint8_t const *header;
+    uint32_t length;
+
+    if (id < image->first || id >= image->count || (header = image_header(image, id, copy, &length)) == NULL)
+        return -1;
+    if (decode_header(&quiet, header, length, event) < 0)
+        return -1;
+    if (image->version >= 6)
+        unpack_preview(&header[event->header_size], event);
+    return 0;
+}
+
+/*
+ * Decodes one event of the image with its samples, to the handlers
+ * @return 0 if success otherwise -1
+ */
+int impact_log_image_event(impact_log_handlers_t const *handlers, impact_log_image_t const *image, uint32_t id)
+{
+    impact_log_handlers_t with_nonce = *handlers;
+
+    with_nonce.nonce = image->nonce;
+    if (id >= image->count)
+    {
+        report(handlers, "event %u: not in the image, %u events", id, image->count);
+        return -1;
+    }
+    if (id < image->first)
+    {
+        report(handlers, "event %u: reclaimed by the ring", id);
+        return -1;
+    }
+    return flash_image_event(&with_nonce, image->data, image->size, image->data_end, image->version, id,
+                             image_index(image->data, id));
+}
+
+/*
+ * Finds the first event at or after a time by bisecting the headers, taking
+ * the ids to be in time order as the store writes them. A corrupt header
+ * takes the time of the next readable one
+ * @return the id, image->count if every event is older
+ */
+uint32_t impact_log_image_find(impact_log_image_t const *image, uint32_t time_s)
+{
+    impact_log_event_t event;
+    uint32_t low = image->first, high = image->count, mid, probe;
+
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        for (probe = mid; probe < high && impact_log_image_header(image, probe, &event) < 0; probe++)
+            ;
+        if (probe == high || event.time_s >= time_s)
+            high = mid;
+        else
+            low = probe + 1;
+    }
+    return low;
+}
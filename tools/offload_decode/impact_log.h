@@ -0,0 +1,252 @@
+#ifndef IMPACT_LOG_H
+#define IMPACT_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "adxl372.h"
+#include "icm20649.h"
+#include "impact_codec.h"
+
+/* Host decoder of the stored impact events, used by offload_decode and usable
+ * from any other tool. Events come either from the binary offload stream of
+ * libraries/serial_offload (a uart capture or the concatenated notifications of
+ * the Impact Offload Service), fed in chunks of any size to impact_log_stream_feed(),
+ * or from a raw image of the mt25ql256aba read out whole, walked through the
+ * event_store index by impact_log_flash_image(), the ring addresses of the
+ * index wrapped round the data region. Every frame and event crc is
+ * checked and the samples are decoded whatever their encoding, the results go
+ * to the handlers as they are found so nothing is kept but the frame in progress.
+ * The live frames of libraries/live_stream go to their own handler, sample by
+ * sample, and the frames lost on the way are reported from their sequence.
+ * A coded live frame only decodes after the frame before it, the coded frames
+ * after a lost or bad one are skipped up to the next key frame.
+ * The pages of libraries/activity_log, the activity frames of a stream or the
+ * top of a flash image in page order, go to theirs record by record */
+
+//must match libraries/serial_offload/serial_offload.h
+#define SERIAL_OFFLOAD_SYNC             0x4F464D48
+#define SERIAL_OFFLOAD_FRAME_EVENT      0x01
+#define SERIAL_OFFLOAD_FRAME_END        0x02
+#define SERIAL_OFFLOAD_FRAME_SUMMARY    0x03
+#define SERIAL_OFFLOAD_FRAME_LIVE       0x04
+#define SERIAL_OFFLOAD_FRAME_ACTIVITY   0x05
+#define IMPACT_LOG_MAX_FRAME_LENGTH     (16*1024*1024)
+
+//must match libraries/event_store/event_store.h
+#define EVENT_STORE_MAGIC               0x48494D55
+#define EVENT_STORE_VERSION             7   //3 to 6 are read too, the ring of 4 ran to the end of the flash, 3 had none, 6 added the preview, 7 the clip counts
+#define EVENT_STORE_INDEX_ADDRESS       0x00001000
+#define EVENT_STORE_ACK_ADDRESS         0x0003F000
+#define EVENT_STORE_MAX_EVENTS          ((EVENT_STORE_ACK_ADDRESS - EVENT_STORE_INDEX_ADDRESS) / 4) //index entries, a ring
+#define EVENT_STORE_INDEX_SUBSECTOR_ENTRIES 1024
+#define EVENT_STORE_MOUNT_PROBES        4
+#define EVENT_STORE_DATA_ADDRESS        0x00040000
+#define EVENT_STORE_DATA_END            0x01E00000
+#define EVENT_STORE_DATA_END_V4         0x02000000
+#define EVENT_STORE_ACK_SLOTS           1024 //words of the ack log, a subsector
+#define EVENT_STORE_ERASE_AHEAD         0x00020000
+#define EVENT_STORE_SECTOR_SIZE         0x00010000 //MT25QL256ABA_SECTOR_SIZE, the erase step runs a sector past EVENT_STORE_ERASE_AHEAD
+#define EVENT_STORE_SUBSECTOR_SIZE      0x00001000
+#define EVENT_STORE_HEADER_MAGIC        0x45564E54
+#define EVENT_STORE_ENCODING_RAW        0xFFFF
+#define EVENT_STORE_ENCODING_ENCRYPTED  0x8000 //of an encoding other than raw, see impact_crypt.h
+#define EVENT_STORE_PEAK_UNKNOWN        0xFFFF
+#define EVENT_STORE_CLIP_UNKNOWN        0xFFFF
+#define EVENT_STORE_TIME_SYNCED         0x80000000
+#define EVENT_STORE_TIME_US_MASK        0x000FFFFF
+#define EVENT_HEADER_SIZE               56  //version 7 on, with the clip counts
+#define EVENT_HEADER_SIZE_V6            48
+#define EVENT_PREVIEW_SIZE              36  //event_store_preview_t, after the header in the flash and the summary frames
+#define EVENT_PREVIEW_POINTS            32
+#define EVENT_PREVIEW_NONE              0xFF
+
+//must match libraries/live_stream/live_stream.h
+#define LIVE_STREAM_HEADER_SIZE         10
+#define LIVE_STREAM_SAMPLE_SIZE         12
+#define LIVE_STREAM_FLAG_GAP            0x01
+#define LIVE_STREAM_FLAG_CODED          0x02
+#define LIVE_STREAM_FLAG_KEY            0x04
+
+//must match libraries/activity_log/activity_log.h
+#define ACTIVITY_LOG_ADDRESS            0x01E00000
+#define ACTIVITY_LOG_SIZE               0x001E0000
+#define ACTIVITY_LOG_MAGIC              0x56544341
+#define ACTIVITY_LOG_PAGE_SIZE          256
+#define ACTIVITY_LOG_PAGE_RECORDS       60
+#define ACTIVITY_LOG_FLAG_WORN          0x01
+#define ACTIVITY_LOG_FLAG_GAP           0x02
+#define ACTIVITY_LOG_FLAG_IMPACT        0x04
+#define ACTIVITY_LOG_FLAGS_ERASED       0xFF
+
+//must match libraries/summary_log/summary_log.h
+#define SUMMARY_LOG_ENCODING            0x5355
+#define SUMMARY_LOG_RECORD_SIZE         16
+#define SUMMARY_LOG_FLAG_EXPOSURE       0x01
+
+//must match libraries/accel_fusion/accel_fusion.h
+#define ACCEL_FUSION_MG_PER_LSB         10
+
+#define ADXL_SAMPLE_RATE_HZ             6400 //record deltas count adxl372 sample periods
+
+#define IMPACT_LOG_LOCATION_NONE        0xFF //the writer left the location out
+
+/* event_store_header_t of one event with the summary unpacked */
+typedef struct {
+    uint32_t id;
+    uint32_t time_s;            /* seconds since 1970-01-01 UTC */
+    uint32_t time_us;           /* into the second */
+    int synced;                 /* the time is the gateway reference, otherwise the rtc to the hundredth */
+    uint32_t sample_count;
+    uint16_t sample_size;
+    uint16_t encoding;          /* without EVENT_STORE_ENCODING_ENCRYPTED */
+    int encrypted;              /* the samples were stored enciphered */
+    uint32_t data_size;         /* bytes of samples */
+    uint16_t gyro_fs_dps;       /* icm20649 ranges of the impact records, from the encoding */
+    uint16_t icm_accel_lsb_per_g;
+    int fused;                  /* the icm20649 accel of the records is the fused channel, ACCEL_FUSION_MG_PER_LSB */
+    int has_orientation;
+    double orientation[4];      /* w, x, y, z */
+    uint8_t location;           /* impact_location_t or IMPACT_LOG_LOCATION_NONE */
+    double direction[3];        /* x, y, z in the head frame */
+    int has_peak;
+    double peak_g;              /* peak resultant acceleration */
+    uint32_t duration_ms;       /* above the trigger threshold */
+    uint32_t header_size;       /* EVENT_HEADER_SIZE, EVENT_HEADER_SIZE_V6 from a device before version 7 */
+    int has_clip;               /* the clip counts were stored */
+    uint32_t clipped_adxl;      /* impact records with an adxl372 axis at full scale */
+    uint32_t clipped_icm;       /* impact records with an icm20649 accel or gyro axis at full scale */
+    uint32_t clip_points;       /* bit per preview point holding a clipped record */
+    uint32_t gaps;              /* impact records that samples were lost before */
+    uint32_t rate_hz;           /* impact records per second of the time their deltas span, 0 without two */
+    uint32_t preview_us;        /* time each preview point spans, 0 without a preview */
+    uint32_t preview_count;     /* points up to the end of the event */
+    uint8_t preview_g[EVENT_PREVIEW_POINTS]; /* peak resultant over each point in g */
+} impact_log_event_t;
+
+/* One impact record, the time accumulates the record deltas from the start of the event */
+typedef struct {
+    uint32_t index;
+    uint32_t t_us;
+    int gap;                    /* samples were lost on the device before it, the time of the gap is not known */
+    uint8_t delta;              /* adxl372 sample periods since the record before, as stored */
+    adxl372_accel_data_t accel; /* counts, ADXL372_COUNTS_TO_MG() */
+    icm20649_data_t icm;        /* raw counts at the ranges of the event, fused accel if the event is */
+} impact_log_sample_t;
+
+/* One summary_log_record_t */
+typedef struct {
+    uint32_t window;
+    int32_t peak_mg;
+    uint16_t hits;
+    uint32_t exposure_g;
+    uint8_t flags;
+} impact_log_window_t;
+
+/* One decimated sample of a live frame, the time counts from the start of the stream */
+typedef struct {
+    uint32_t index;
+    uint32_t t_us;
+    uint16_t rate_hz;
+    uint16_t seq;               /* of its frame */
+    int gap;                    /* samples were lost on the device before its frame */
+    adxl372_accel_data_t accel; /* counts, ADXL372_COUNTS_TO_MG() */
+    icm20649_data_t icm;        /* the accel is only streamed in the coded frames, 0 in the raw ones */
+} impact_log_live_t;
+
+/* One second of an activity log page */
+typedef struct {
+    uint32_t seq;               /* of its page */
+    uint32_t time_s;            /* start of the second since 1970-01-01 UTC, from 0 if the page's time is unknown */
+    double peak_g;              /* peak resultant at the full rate */
+    double rms_g;               /* of the activity rate samples about their mean */
+    int worn;
+    int gap;                    /* samples were lost in the second */
+    int impact;                 /* the trigger fired in the second */
+} impact_log_activity_t;
+
+/* Any handler may be NULL. event runs once the header and data crc of an event
+ * are checked, before its samples or windows. The summary frames of a query
+ * only run event, with the sample count of the stored event and no samples.
+ * The preview comes with the summary frames and the flash images of version
+ * 6, an event frame carries none.
+ * live runs for every sample of a live frame, activity for every second of
+ * an activity page. The samples of an enciphered event are deciphered with
+ * the key and the nonce of the store, an event without the key only runs
+ * error. A flash image decodes with the nonce of its own superblock */
+typedef struct {
+    void (*event)(void *p_context, impact_log_event_t const *event);
+    void (*sample)(void *p_context, impact_log_event_t const *event, impact_log_sample_t const *sample);
+    void (*window)(void *p_context, impact_log_event_t const *event, impact_log_window_t const *window);
+    void (*live)(void *p_context, impact_log_live_t const *live);
+    void (*activity)(void *p_context, impact_log_activity_t const *activity);
+    void (*error)(void *p_context, char const *message);
+    void *p_context;
+    uint8_t const *key;         /* AES-128 key of the enciphered events, NULL without one */
+    uint32_t nonce;             /* of the store format the events were sent from, 'config' prints it */
+} impact_log_handlers_t;
+
+typedef struct {
+    impact_log_handlers_t const *handlers;
+    uint8_t *buf;               /* bytes not parsed yet, from a sync word on */
+    size_t buf_length;
+    size_t buf_size;
+    uint32_t num_events;        /* event and summary frames since the last end frame */
+    uint32_t num_decoded;       /* events decoded since impact_log_stream_init */
+    uint32_t num_errors;        /* frames and events dropped since impact_log_stream_init */
+    int live_started;           /* a live frame has been seen */
+    uint16_t live_seq;          /* of the last live frame */
+    uint32_t live_lost;         /* live frames missing from the sequence */
+    uint32_t live_skipped;      /* coded live frames skipped waiting for a key frame */
+    int live_chained;           /* the last live frame was coded and decoded, the next may follow on */
+    impact_codec_t live_codec;  /* state after it */
+    uint32_t activity_pages;    /* activity frames since the last empty one */
+} impact_log_stream_t;
+
+int impact_log_decode_event(impact_log_handlers_t const *handlers, uint8_t const *data, size_t length);
+
+void impact_log_stream_init(impact_log_stream_t *stream, impact_log_handlers_t const *handlers);
+
+int impact_log_stream_feed(impact_log_stream_t *stream, uint8_t const *data, size_t length);
+
+void impact_log_stream_free(impact_log_stream_t *stream);
+
+int impact_log_is_flash_image(uint8_t const *image, size_t size);
+
+int impact_log_flash_image(impact_log_handlers_t const *handlers, uint8_t const *image, size_t size,
+                           uint32_t *p_decoded, uint32_t *p_errors);
+
+/* A flash image for looking events up rather than decoding them all, the
+ * image mapped read only by impact_log_image_open() or one already in memory.
+ * Only the index is read when it is opened, then the pages of the events asked
+ * for, headers and samples decoded in place. The events from first to count - 1
+ * are in the image, the ones before first were reclaimed by the ring: within
+ * reach of the erase ahead of the newest event and either acked or with their
+ * header gone, an event that was not acked is only erased once retention let
+ * it go */
+typedef struct {
+    uint8_t const *data;
+    size_t size;
+    uint32_t version;
+    uint32_t data_end;          /* end of the ring of the version */
+    uint32_t count;             /* events written, the index is a ring of EVENT_STORE_MAX_EVENTS */
+    uint32_t first;             /* oldest event the ring has kept */
+    uint32_t acked;             /* events acked, the watermark of the ack log */
+    uint32_t nonce;             /* of the cipher, from the superblock */
+    int mapped;                 /* unmapped by impact_log_image_close */
+} impact_log_image_t;
+
+int impact_log_image_open(impact_log_image_t *image, char const *path);
+
+int impact_log_image_attach(impact_log_image_t *image, uint8_t const *data, size_t size);
+
+void impact_log_image_close(impact_log_image_t *image);
+
+int impact_log_image_header(impact_log_image_t const *image, uint32_t id, impact_log_event_t *event);
+
+int impact_log_image_event(impact_log_handlers_t const *handlers, impact_log_image_t const *image, uint32_t id);
+
+uint32_t impact_log_image_find(impact_log_image_t const *image, uint32_t time_s);
+
+uint32_t crc32_compute(uint8_t const *data, uint32_t size, uint32_t const *p_crc);
+
+#endif //IMPACT_LOG_H
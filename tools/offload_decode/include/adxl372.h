@@ -0,0 +1,20 @@
+//-------------------------------------------
+// Host stand-in for the adxl372 driver header, only the types and the count
+// conversion used by impact_record and impact_codec
+//-------------------------------------------
+#ifndef ADXL372_H
+#define ADXL372_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    int16_t x;
+    int16_t y;
+    int16_t z;
+} adxl372_accel_data_t;
+
+#define ADXL372_MG_PER_LSB              100 /* +-200g full scale */
+#define ADXL372_COUNTS_TO_MG(counts)    ((int32_t)(counts) * ADXL372_MG_PER_LSB)
+
+#endif //ADXL372_H
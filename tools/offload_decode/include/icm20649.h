@@ -0,0 +1,32 @@
+//-------------------------------------------
+// Host stand-in for the icm20649 driver header, the sample and range types
+//-------------------------------------------
+#ifndef ICM20649_H
+#define ICM20649_H
+
+#include <stdint.h>
+
+typedef struct{
+    int16_t accel_x;
+    int16_t accel_y;
+    int16_t accel_z;
+    int16_t gyro_x;
+    int16_t gyro_y;
+    int16_t gyro_z;
+} icm20649_data_t;
+
+typedef enum {
+    ICM20649_GYRO_FS_500DPS = 0,
+    ICM20649_GYRO_FS_1000DPS,
+    ICM20649_GYRO_FS_2000DPS,
+    ICM20649_GYRO_FS_4000DPS
+} icm20649_gyro_fs_t;
+
+typedef enum {
+    ICM20649_ACCEL_FS_4G = 0,
+    ICM20649_ACCEL_FS_8G,
+    ICM20649_ACCEL_FS_16G,
+    ICM20649_ACCEL_FS_30G
+} icm20649_accel_fs_t;
+
+#endif //ICM20649_H
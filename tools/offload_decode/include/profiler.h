@@ -0,0 +1,10 @@
+//-------------------------------------------
+// Host stand-in for the profiler header, the kernels tagged RAMFUNC are
+// placed like any other function
+//-------------------------------------------
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#define RAMFUNC
+
+#endif //PROFILER_H
@@ -0,0 +1,876 @@
+//-------------------------------------------
+// Title: offload_decode.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Command line decoder of the stored impact events, built
+// on impact_log. Reads binary offload captures (uart or the concatenated
+// ble notifications) or raw flash images, told apart by the event_store
+// superblock, and writes the samples as csv, one line per sample, the
+// icm20649 channels scaled at the ranges each event was recorded with.
+// The gap column marks a sample the device lost samples before, the rate and
+// gaps of an event count them and the rate the records came in at. The
+// preview is the resultant the device kept at a low rate, in g per point.
+// The clip columns count the records with an axis at the full scale of each
+// accelerometer, where the peak is a lower bound, and set a bit per preview
+// point they fall in; they are empty for a device before store version 7.
+//
+// Files are mapped rather than read, a flash image and a capture are decoded
+// where they are. With -j the files are decoded on that many threads, each
+// takes the largest file left, the lines of each file go to the csv files
+// whole but the files come out in the order they finish. -n and -t pick
+// events out of the flash images through the index, only the pages of those
+// events are read; the captures are decoded whole.
+//
+// usage: offload_decode [-s] [-j jobs] [-n first[-last]] [-t from[,to]] [-k key[,nonce]] [-o samples.csv] [-e events.csv] [-w windows.csv] [-l live.csv] [-a activity.csv] [file ...]
+//   -s  adds a source column with the input file name, for files from several helmets
+//   -j  files decoded at the same time, 0 for one per cpu, 1 the default
+//   -n  only the events of these ids from the flash images
+//   -t  only the events stored from and to these times, seconds since 1970 or 2019-11-02T14:05:00 UTC
+//   -k  the AES-128 key the events were stored with, 32 hex digits as given to 'config key', and
+//       the store nonce 'config' prints for the frames, a flash image has its own
+//   -o  samples to a file instead of stdout
+//   -e  one line per event to a csv file instead of comment lines in the samples
+//   -w  summary log windows to a csv file instead of comment lines in the samples
+//   -l  live stream samples to a csv file, the live frames are skipped without it
+//   -a  activity log seconds to a csv file, from the activity frames or the top of a flash image
+//   stty -F /dev/ttyUSB0 1000000 raw && offload_decode < /dev/ttyUSB0
+//   offload_decode -s -e events.csv -o samples.csv helmet*.bin
+//   offload_decode -j 0 -s -e events.csv -o samples.csv team/*.bin
+//   offload_decode -l live.csv < /dev/ttyUSB0
+//   offload_decode -a activity.csv -e events.csv flash.bin
+//   offload_decode -s -t 2019-11-02T14:00:00,2019-11-02T15:00:00 -o samples.csv archive/*.bin
+//-------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "impact_log.h"
+#include "impact_crypt.h"
+
+#define READ_CHUNK_SIZE     (1024*1024)
+#define OUT_BUF_SIZE        (256*1024)
+#define FLASH_IMAGE_SIZE    (32*1024*1024) //mt25ql256aba
+#define MAX_JOBS            64
+
+// buffered csv output, formats the numbers itself since printf is the bottleneck
+typedef struct {
+    FILE *file;     //shared by the outputs of every thread, one fwrite is never mixed with another
+    int owner;      //closes the file
+    size_t length;
+    char buf[OUT_BUF_SIZE];
+} out_t;
+
+typedef struct {
+    out_t *samples;
+    out_t *events;  //NULL for comment lines in samples
+    out_t *windows; //NULL for comment lines in samples
+    out_t *live;    //NULL to skip the live frames
+    out_t *activity; //NULL to skip the activity log
+    char const *source; //NULL without the source column
+} decode_t;
+
+// events picked out of the flash images, all of them unless selected
+typedef struct {
+    int selected;
+    uint32_t first_id;
+    uint32_t last_id;
+    uint32_t from_s;
+    uint32_t to_s;
+} select_t;
+
+static void out_flush(out_t *out)
+{
+    fwrite(out->buf, 1, out->length, out->file);
+    out->length = 0;
+}
+
+// writes the whole lines and keeps the one in progress, the other threads write theirs in between
+static void out_flush_lines(out_t *out)
+{
+    size_t length = out->length;
+
+    while (length > 0 && out->buf[length - 1] != '\n')
+        length--;
+    if (length == 0)
+        length = out->length;
+
+    fwrite(out->buf, 1, length, out->file);
+    memmove(out->buf, &out->buf[length], out->length - length);
+    out->length -= length;
+}
+
+// makes room for at least 256 bytes
+static char *out_reserve(out_t *out)
+{
+    if (out->length > OUT_BUF_SIZE - 256)
+        out_flush_lines(out);
+    return &out->buf[out->length];
+}
+
+static void out_str(out_t *out, char const *str)
+{
+    size_t length = strlen(str);
+
+    if (length > 255)
+    {
+        out_flush(out);
+        fwrite(str, 1, length, out->file);
+        return;
+    }
+    memcpy(out_reserve(out), str, length);
+    out->length += length;
+}
+
+static void out_printf(out_t *out, char const *format, ...)
+{
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(out_reserve(out), 256, format, args);
+    va_end(args);
+    out->length += (length < 256) ? length : 255;
+}
+
+static void out_uint(out_t *out, uint32_t value)
+{
+    char digits[10];
+    char *p = out_reserve(out);
+    int n = 0;
+
+    do
+    {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    while (n > 0)
+        *p++ = digits[--n];
+    out->length = p - out->buf;
+}
+
+static void out_int(out_t *out, int32_t value)
+{
+    if (value < 0)
+    {
+        *out_reserve(out) = '-';
+        out->length++;
+        out_uint(out, (uint32_t)0 - (uint32_t)value);
+    }
+    else
+        out_uint(out, value);
+}
+
+static void out_char(out_t *out, char c)
+{
+    *out_reserve(out) = c;
+    out->length++;
+}
+
+static void out_source(decode_t const *decode, out_t *out)
+{
+    if (decode->source != NULL)
+    {
+        out_str(out, decode->source);
+        out_char(out, ',');
+    }
+}
+
+static char const *location_name(uint8_t location)
+{
+    //must match impact_location_t in libraries/impact_location/impact_location.h
+    static char const *const locations[] = {"front", "back", "left", "right", "crown"};
+
+    return (location < sizeof(locations)/sizeof(locations[0])) ? locations[location] : NULL;
+}
+
+// UTC date of the event, to the microsecond when synced and to the hundredth of the rtc otherwise
+static void format_time(impact_log_event_t const *event, char separator, char *text, size_t size)
+{
+    time_t seconds = event->time_s;
+    struct tm date;
+    size_t length;
+
+    gmtime_r(&seconds, &date);
+    length = strftime(text, size, "%Y-%m-%d", &date);
+    length += snprintf(&text[length], size - length, "%c", separator);
+    length += strftime(&text[length], size - length, "%H:%M:%S", &date);
+    if (event->synced)
+        snprintf(&text[length], size - length, ".%06u", event->time_us);
+    else
+        snprintf(&text[length], size - length, ".%02u", event->time_us / 10000);
+}
+
+static void event_handler(void *p_context, impact_log_event_t const *event)
+{
+    decode_t const *decode = p_context;
+    char time[32];
+    char const *location = location_name(event->location);
+    out_t *out = decode->events;
+
+    if (out == NULL)
+    {
+        //the results the device computed for the event, the ones it left out are erased
+        out = decode->samples;
+        format_time(event, ' ', time, sizeof(time));
+        out_printf(out, "# event %u, %s%s, %u bytes, encoding %u, icm20649 %u dps %u lsb/g%s\n", event->id, time,
+                   event->synced ? " synced" : "", event->data_size, event->encoding, event->gyro_fs_dps,
+                   event->icm_accel_lsb_per_g, event->fused ? ", fused accel" : "");
+        if (event->has_orientation)
+            out_printf(out, "# event %u, orientation %.4f %.4f %.4f %.4f\n", event->id, event->orientation[0],
+                       event->orientation[1], event->orientation[2], event->orientation[3]);
+        if (location != NULL)
+            out_printf(out, "# event %u, location %s, direction %.2f %.2f %.2f\n", event->id, location,
+                       event->direction[0], event->direction[1], event->direction[2]);
+        if (event->has_peak)
+            out_printf(out, "# event %u, peak %.1f g, %u ms\n", event->id, event->peak_g, event->duration_ms);
+        if (event->rate_hz > 0)
+            out_printf(out, "# event %u, %u Hz, %u gaps\n", event->id, event->rate_hz, event->gaps);
+        if (event->has_clip && (event->clipped_adxl > 0 || event->clipped_icm > 0))
+            out_printf(out, "# event %u, clipped %u adxl372 %u icm20649 records, points 0x%08x\n", event->id,
+                       event->clipped_adxl, event->clipped_icm, event->clip_points);
+        if (event->preview_us > 0)
+        {
+            out_printf(out, "# event %u, preview %u us per point, g", event->id, event->preview_us);
+            for (uint32_t i = 0; i < event->preview_count; i++)
+            {
+                out_char(out, ' ');
+                out_uint(out, event->preview_g[i]);
+            }
+            out_char(out, '\n');
+        }
+        return;
+    }
+
+    out_source(decode, out);
+    format_time(event, 'T', time, sizeof(time));
+    out_printf(out, "%u,%s,%d,", event->id, time, event->synced);
+    out_printf(out, "%u,%u,%u,", event->encoding, event->sample_count, event->data_size);
+    if (event->has_orientation)
+        out_printf(out, "%.4f,%.4f,%.4f,%.4f,", event->orientation[0], event->orientation[1],
+                   event->orientation[2], event->orientation[3]);
+    else
+        out_str(out, ",,,,");
+    if (location != NULL)
+        out_printf(out, "%s,%.2f,%.2f,%.2f,", location, event->direction[0], event->direction[1],
+                   event->direction[2]);
+    else
+        out_str(out, ",,,,");
+    if (event->has_peak)
+        out_printf(out, "%.1f,%u,", event->peak_g, event->duration_ms);
+    else
+        out_str(out, ",,");
+    out_printf(out, "%u,%u,%d,", event->gyro_fs_dps, event->icm_accel_lsb_per_g, event->fused);
+    if (event->rate_hz > 0)
+        out_printf(out, "%u,%u,", event->rate_hz, event->gaps);
+    else
+        out_str(out, ",,");
+    //the points in one column, space separated
+    if (event->preview_us > 0)
+    {
+        out_printf(out, "%u,", event->preview_us);
+        for (uint32_t i = 0; i < event->preview_count; i++)
+        {
+            if (i > 0)
+                out_char(out, ' ');
+            out_uint(out, event->preview_g[i]);
+        }
+    }
+    else
+    {
+        out_str(out, ",");
+    }
+    if (event->has_clip)
+        out_printf(out, ",%u,%u,0x%08x", event->clipped_adxl, event->clipped_icm, event->clip_points);
+    else
+        out_str(out, ",,,");
+    out_str(out, "\n");
+}
+
+//the icm20649 counts at the ranges the event was recorded with, or the fused accel
+static int32_t icm_accel_mg(impact_log_event_t const *event, int16_t counts)
+{
+    if (event->fused)
+        return (int32_t)counts * ACCEL_FUSION_MG_PER_LSB;
+    return (int32_t)counts * 1000 / event->icm_accel_lsb_per_g;
+}
+
+static int32_t icm_gyro_mdps(impact_log_event_t const *event, int16_t counts)
+{
+    return (int32_t)(((int64_t)counts * event->gyro_fs_dps * 1000) / 32768);
+}
+
+static void sample_handler(void *p_context, impact_log_event_t const *event, impact_log_sample_t const *sample)
+{
+    decode_t const *decode = p_context;
+    out_t *out = decode->samples;
+
+    out_source(decode, out);
+    out_uint(out, event->id);
+    out_char(out, ',');
+    out_uint(out, sample->index);
+    out_char(out, ',');
+    out_uint(out, sample->t_us);
+    out_char(out, ',');
+    out_int(out, ADXL372_COUNTS_TO_MG(sample->accel.x));
+    out_char(out, ',');
+    out_int(out, ADXL372_COUNTS_TO_MG(sample->accel.y));
+    out_char(out, ',');
+    out_int(out, ADXL372_COUNTS_TO_MG(sample->accel.z));
+    out_char(out, ',');
+    out_int(out, icm_accel_mg(event, sample->icm.accel_x));
+    out_char(out, ',');
+    out_int(out, icm_accel_mg(event, sample->icm.accel_y));
+    out_char(out, ',');
+    out_int(out, icm_accel_mg(event, sample->icm.accel_z));
+    out_char(out, ',');
+    out_int(out, icm_gyro_mdps(event, sample->icm.gyro_x));
+    out_char(out, ',');
+    out_int(out, icm_gyro_mdps(event, sample->icm.gyro_y));
+    out_char(out, ',');
+    out_int(out, icm_gyro_mdps(event, sample->icm.gyro_z));
+    out_char(out, ',');
+    out_uint(out, sample->gap);
+    out_char(out, '\n');
+}
+
+static void window_handler(void *p_context, impact_log_event_t const *event, impact_log_window_t const *window)
+{
+    decode_t const *decode = p_context;
+    out_t *out = decode->windows;
+
+    if (out == NULL)
+    {
+        //one window record per line, the csv columns are for impact samples
+        out_printf(decode->samples, "# event %u, window %u, peak %d mg, %u hits, exposure %u g%s\n", event->id,
+                   window->window, window->peak_mg, window->hits, window->exposure_g,
+                   (window->flags & SUMMARY_LOG_FLAG_EXPOSURE) ? ", over the exposure limit" : "");
+        return;
+    }
+    out_source(decode, out);
+    out_printf(out, "%u,%u,%d,%u,%u,%u\n", event->id, window->window, window->peak_mg, window->hits,
+               window->exposure_g, (window->flags & SUMMARY_LOG_FLAG_EXPOSURE) ? 1 : 0);
+}
+
+static void live_handler(void *p_context, impact_log_live_t const *live)
+{
+    decode_t const *decode = p_context;
+    out_t *out = decode->live;
+
+    out_source(decode, out);
+    out_uint(out, live->index);
+    out_char(out, ',');
+    out_uint(out, live->t_us);
+    out_char(out, ',');
+    out_uint(out, live->rate_hz);
+    out_char(out, ',');
+    out_uint(out, live->gap);
+    out_char(out, ',');
+    out_int(out, ADXL372_COUNTS_TO_MG(live->accel.x));
+    out_char(out, ',');
+    out_int(out, ADXL372_COUNTS_TO_MG(live->accel.y));
+    out_char(out, ',');
+    out_int(out, ADXL372_COUNTS_TO_MG(live->accel.z));
+    out_char(out, ',');
+    out_int(out, live->icm.accel_x);
+    out_char(out, ',');
+    out_int(out, live->icm.accel_y);
+    out_char(out, ',');
+    out_int(out, live->icm.accel_z);
+    out_char(out, ',');
+    out_int(out, live->icm.gyro_x);
+    out_char(out, ',');
+    out_int(out, live->icm.gyro_y);
+    out_char(out, ',');
+    out_int(out, live->icm.gyro_z);
+    out_char(out, '\n');
+}
+
+static void activity_handler(void *p_context, impact_log_activity_t const *activity)
+{
+    decode_t const *decode = p_context;
+    out_t *out = decode->activity;
+
+    out_source(decode, out);
+    out_printf(out, "%u,%u,%.1f,%.2f,%d,%d,%d\n", activity->seq, activity->time_s, activity->peak_g,
+               activity->rms_g, activity->worn, activity->gap, activity->impact);
+}
+
+static void error_handler(void *p_context, char const *message)
+{
+    decode_t const *decode = p_context;
+
+    if (decode->source != NULL)
+        fprintf(stderr, "%s: %s\n", decode->source, message);
+    else
+        fprintf(stderr, "%s\n", message);
+}
+
+static out_t *out_open(char const *path)
+{
+    out_t *out = malloc(sizeof(out_t));
+
+    if (out == NULL)
+        return NULL;
+    out->length = 0;
+    out->owner = 1;
+    out->file = (path == NULL) ? stdout : fopen(path, "w");
+    if (out->file == NULL)
+    {
+        perror(path);
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+// another buffer on the file of out for a thread, NULL for NULL
+static out_t *out_share(out_t const *out, int *p_failed)
+{
+    out_t *shared;
+
+    if (out == NULL)
+        return NULL;
+    shared = malloc(sizeof(out_t));
+    if (shared == NULL)
+    {
+        *p_failed = 1;
+        return NULL;
+    }
+    shared->file = out->file;
+    shared->owner = 0;
+    shared->length = 0;
+    return shared;
+}
+
+static void out_close(out_t *out)
+{
+    if (out == NULL)
+        return;
+    out_flush(out);
+    if (out->owner && out->file != stdout)
+        fclose(out->file);
+    free(out);
+}
+
+// files to decode and the next one a thread takes, largest first
+typedef struct {
+    char **paths;
+    int num_paths;
+    int next;
+    int num_errors;
+    int source_column;
+    decode_t const *main;   //the outputs the threads share the files of
+    impact_log_handlers_t const *handlers;
+    select_t const *select;
+} work_t;
+
+static int is_flash_image(uint8_t const *data, size_t length)
+{
+    return length >= 8 && (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24)) == EVENT_STORE_MAGIC;
+}
+
+// decodes one input that can only be read, returns the number of frames and events dropped or -1 if out of memory
+static int decode_file(FILE *in, impact_log_handlers_t const *handlers, uint8_t *chunk)
+{
+    impact_log_stream_t stream;
+    uint8_t *image;
+    size_t length, got;
+    uint32_t decoded, errors;
+
+    length = fread(chunk, 1, 8, in);
+    if (is_flash_image(chunk, length))
+    {
+        //a flash image, read whole since the index points anywhere in it
+        image = malloc(FLASH_IMAGE_SIZE);
+        if (image == NULL)
+            return -1;
+        memcpy(image, chunk, length);
+        while (length < FLASH_IMAGE_SIZE && (got = fread(&image[length], 1, FLASH_IMAGE_SIZE - length, in)) > 0)
+            length += got;
+        if (impact_log_flash_image(handlers, image, length, &decoded, &errors) < 0)
+            errors++;
+        free(image);
+        return errors;
+    }
+
+    impact_log_stream_init(&stream, handlers);
+    do
+    {
+        if (impact_log_stream_feed(&stream, chunk, length) < 0)
+        {
+            impact_log_stream_free(&stream);
+            return -1;
+        }
+    } while ((length = fread(chunk, 1, READ_CHUNK_SIZE, in)) > 0);
+    impact_log_stream_free(&stream);
+    return stream.num_errors;
+}
+
+// decodes the events of a flash image that fall in the selection, found through the index
+static int decode_selected(uint8_t const *map, size_t length, impact_log_handlers_t const *handlers,
+                           select_t const *select)
+{
+    impact_log_image_t image;
+    uint32_t id, first, end;
+    int errors = 0;
+
+    if (impact_log_image_attach(&image, map, length) < 0)
+    {
+        handlers->error(handlers->p_context, "image: no event store superblock");
+        return 1;
+    }
+    first = (select->first_id > image.first) ? select->first_id : image.first;
+    end = (select->last_id < image.count) ? select->last_id + 1 : image.count;
+    if (impact_log_image_find(&image, select->from_s) > first)
+        first = impact_log_image_find(&image, select->from_s);
+    if (select->to_s < UINT32_MAX && impact_log_image_find(&image, select->to_s + 1) < end)
+        end = impact_log_image_find(&image, select->to_s + 1);
+    for (id = first; id < end; id++)
+        if (impact_log_image_event(handlers, &image, id) < 0)
+            errors++;
+    return errors;
+}
+
+// decodes a mapped input in place, the stream only copies a frame cut at the end
+static int decode_map(uint8_t const *map, size_t length, impact_log_handlers_t const *handlers,
+                      select_t const *select)
+{
+    impact_log_stream_t stream;
+    uint32_t decoded, errors;
+    int result;
+
+    if (is_flash_image(map, length) && select->selected)
+        return decode_selected(map, length, handlers, select);
+    if (is_flash_image(map, length))
+    {
+        if (length > FLASH_IMAGE_SIZE)
+            length = FLASH_IMAGE_SIZE;
+        if (impact_log_flash_image(handlers, map, length, &decoded, &errors) < 0)
+            errors++;
+        return errors;
+    }
+
+    impact_log_stream_init(&stream, handlers);
+    result = impact_log_stream_feed(&stream, map, length);
+    impact_log_stream_free(&stream);
+    return (result < 0) ? -1 : (int)stream.num_errors;
+}
+
+// decodes the file at path, NULL for stdin, mapped if it is a regular file
+static int decode_path(char const *path, impact_log_handlers_t const *handlers, select_t const *select,
+                       uint8_t **p_chunk)
+{
+    struct stat info;
+    void *map;
+    FILE *in;
+    int fd, errors;
+
+    if (path == NULL)
+        in = stdin;
+    else if ((fd = open(path, O_RDONLY)) < 0)
+    {
+        perror(path);
+        return 1;
+    }
+    else if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0
+             && (map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+    {
+        close(fd);
+        madvise(map, info.st_size, MADV_SEQUENTIAL);
+        errors = decode_map(map, info.st_size, handlers, select);
+        munmap(map, info.st_size);
+        goto done;
+    }
+    else if ((in = fdopen(fd, "rb")) == NULL)
+    {
+        //a pipe or a tty, read in chunks
+        perror(path);
+        close(fd);
+        return 1;
+    }
+
+    if (*p_chunk == NULL && (*p_chunk = malloc(READ_CHUNK_SIZE)) == NULL)
+        errors = -1;
+    else
+        errors = decode_file(in, handlers, *p_chunk);
+    if (in != stdin)
+        fclose(in);
+done:
+    if (errors < 0)
+    {
+        fprintf(stderr, "%s: out of memory\n", (path == NULL) ? "-" : path);
+        errors = 1;
+    }
+    return errors;
+}
+
+// a decoding thread, with its own output buffers on the shared files
+static void *work_thread(void *p_arg)
+{
+    work_t *work = p_arg;
+    impact_log_handlers_t handlers = *work->handlers;
+    decode_t decode = {NULL, NULL, NULL, NULL, NULL, NULL};
+    uint8_t *chunk = NULL;
+    int failed = 0, errors = 0, i;
+
+    decode.samples = out_share(work->main->samples, &failed);
+    decode.events = out_share(work->main->events, &failed);
+    decode.windows = out_share(work->main->windows, &failed);
+    decode.live = out_share(work->main->live, &failed);
+    decode.activity = out_share(work->main->activity, &failed);
+    handlers.p_context = &decode;
+
+    while (!failed && (i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->num_paths)
+    {
+        decode.source = work->source_column ? work->paths[i] : NULL;
+        errors += decode_path(work->paths[i], &handlers, work->select, &chunk);
+    }
+    if (failed)
+    {
+        fprintf(stderr, "out of memory\n");
+        errors++;
+    }
+
+    out_close(decode.samples);
+    out_close(decode.events);
+    out_close(decode.windows);
+    out_close(decode.live);
+    out_close(decode.activity);
+    free(chunk);
+    __atomic_fetch_add(&work->num_errors, errors, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static off_t path_size(char const *path)
+{
+    struct stat info;
+
+    return (stat(path, &info) == 0) ? info.st_size : 0;
+}
+
+static int path_larger(void const *p_a, void const *p_b)
+{
+    off_t a = path_size(*(char * const *)p_a), b = path_size(*(char * const *)p_b);
+
+    return (a < b) - (a > b);
+}
+
+// decodes the files on jobs threads, each taking the largest file left
+static int decode_parallel(char **paths, int num_paths, int jobs, int source_column,
+                           decode_t const *decode, impact_log_handlers_t const *handlers, select_t const *select)
+{
+    pthread_t threads[MAX_JOBS];
+    work_t work = {paths, num_paths, 0, 0, source_column, decode, handlers, select};
+    int started;
+
+    //the first lines written belong to the main buffers
+    out_flush(decode->samples);
+    if (decode->events != NULL)
+        out_flush(decode->events);
+    if (decode->windows != NULL)
+        out_flush(decode->windows);
+    if (decode->live != NULL)
+        out_flush(decode->live);
+    if (decode->activity != NULL)
+        out_flush(decode->activity);
+
+    qsort(paths, num_paths, sizeof(char *), path_larger);
+    for (started = 0; started < jobs; started++)
+        if (pthread_create(&threads[started], NULL, work_thread, &work) != 0)
+            break;
+    if (started == 0)
+        work_thread(&work);
+    while (started > 0)
+        pthread_join(threads[--started], NULL);
+    return work.num_errors;
+}
+
+// 32 hex digits to a key, then the nonce of the store after a comma, 0 without one
+static int parse_key(char const *hex, uint8_t key[IMPACT_CRYPT_KEY_SIZE], uint32_t *p_nonce)
+{
+    char digits[3] = {0};
+    char *p_end;
+    size_t length = strcspn(hex, ",");
+
+    *p_nonce = 0;
+    if (length != 2*IMPACT_CRYPT_KEY_SIZE)
+        return -1;
+    if (hex[length] == ',')
+    {
+        *p_nonce = (uint32_t)strtoul(&hex[length + 1], &p_end, 16);
+        if (hex[length + 1] == '\0' || *p_end != '\0')
+            return -1;
+    }
+    for (int i = 0; i < IMPACT_CRYPT_KEY_SIZE; i++)
+    {
+        memcpy(digits, &hex[2*i], 2);
+        key[i] = (uint8_t)strtoul(digits, &p_end, 16);
+        if (*p_end != '\0')
+            return -1;
+    }
+    return 0;
+}
+
+// seconds since 1970 or a UTC date and time, the time of day may be left out
+static int parse_time(char const *text, uint32_t *p_time_s)
+{
+    struct tm date = {0};
+    char *p_end;
+    int used = 0, time_used = 0;
+
+    *p_time_s = (uint32_t)strtoul(text, &p_end, 10);
+    if (p_end != text && *p_end == '\0')
+        return 0;
+    if (sscanf(text, "%d-%d-%d%n", &date.tm_year, &date.tm_mon, &date.tm_mday, &used) != 3)
+        return -1;
+    if (text[used] == 'T'
+        && sscanf(&text[used], "T%d:%d:%d%n", &date.tm_hour, &date.tm_min, &date.tm_sec, &time_used) == 3)
+        used += time_used;
+    if (text[used] != '\0')
+        return -1;
+    date.tm_year -= 1900;
+    date.tm_mon -= 1;
+    *p_time_s = (uint32_t)timegm(&date);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    impact_log_handlers_t handlers = {event_handler, sample_handler, window_handler, NULL, NULL, error_handler, NULL};
+    decode_t decode = {NULL, NULL, NULL, NULL, NULL, NULL};
+    char const *samples_path = NULL, *events_path = NULL, *windows_path = NULL, *live_path = NULL;
+    char const *activity_path = NULL;
+    int source_column = 0, num_errors = 0, jobs = 1, opt, i;
+    uint8_t key[IMPACT_CRYPT_KEY_SIZE];
+    uint8_t *chunk = NULL;
+    select_t select = {0, 0, UINT32_MAX, 0, UINT32_MAX};
+    char *p_end, *p_to;
+
+    while ((opt = getopt(argc, argv, "sj:n:t:k:o:e:w:l:a:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's': source_column = 1; break;
+            case 'j':
+                jobs = atoi(optarg);
+                if (jobs <= 0)
+                    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+                if (jobs > MAX_JOBS)
+                    jobs = MAX_JOBS;
+                break;
+            case 'n':
+                select.selected = 1;
+                select.first_id = (uint32_t)strtoul(optarg, &p_end, 10);
+                select.last_id = (*p_end == '-') ? (uint32_t)strtoul(&p_end[1], &p_end, 10) : select.first_id;
+                if (*p_end != '\0')
+                {
+                    fprintf(stderr, "%s: -n takes an id or first-last\n", argv[0]);
+                    return 2;
+                }
+                break;
+            case 't':
+                select.selected = 1;
+                p_to = strchr(optarg, ',');
+                if (p_to != NULL)
+                    *p_to++ = '\0';
+                if (parse_time(optarg, &select.from_s) < 0 || (p_to != NULL && parse_time(p_to, &select.to_s) < 0))
+                {
+                    fprintf(stderr, "%s: -t takes from[,to], seconds since 1970 or 2019-11-02T14:05:00\n", argv[0]);
+                    return 2;
+                }
+                break;
+            case 'k':
+                if (parse_key(optarg, key, &handlers.nonce) < 0)
+                {
+                    fprintf(stderr, "%s: -k takes 32 hex digits, then a comma and the store nonce in hex\n", argv[0]);
+                    return 2;
+                }
+                handlers.key = key;
+                break;
+            case 'o': samples_path = optarg; break;
+            case 'e': events_path = optarg; break;
+            case 'w': windows_path = optarg; break;
+            case 'l': live_path = optarg; break;
+            case 'a': activity_path = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-s] [-j jobs] [-n first[-last]] [-t from[,to]] [-k key[,nonce]] [-o samples.csv] [-e events.csv] [-w windows.csv] [-l live.csv] [-a activity.csv] [file ...]\n",
+                        argv[0]);
+                return 2;
+        }
+    }
+
+    decode.samples = out_open(samples_path);
+    if (decode.samples == NULL
+        || (events_path != NULL && (decode.events = out_open(events_path)) == NULL)
+        || (windows_path != NULL && (decode.windows = out_open(windows_path)) == NULL)
+        || (live_path != NULL && (decode.live = out_open(live_path)) == NULL)
+        || (activity_path != NULL && (decode.activity = out_open(activity_path)) == NULL))
+        return 2;
+    handlers.p_context = &decode;
+    if (decode.live != NULL)
+        handlers.live = live_handler;
+    if (decode.activity != NULL)
+        handlers.activity = activity_handler;
+
+    if (source_column)
+        out_str(decode.samples, "source,");
+    out_str(decode.samples, "event,sample,t_us,accel_x_mg,accel_y_mg,accel_z_mg,"
+            "icm_accel_x_mg,icm_accel_y_mg,icm_accel_z_mg,icm_gyro_x_mdps,icm_gyro_y_mdps,icm_gyro_z_mdps,gap\n");
+    if (decode.events != NULL)
+    {
+        if (source_column)
+            out_str(decode.events, "source,");
+        out_str(decode.events, "event,timestamp,synced,encoding,sample_count,data_bytes,"
+                "orientation_w,orientation_x,orientation_y,orientation_z,location,direction_x,direction_y,direction_z,"
+                "peak_g,duration_ms,gyro_fs_dps,icm_accel_lsb_per_g,fused,rate_hz,gaps,preview_us,preview_g,"
+                "clipped_adxl,clipped_icm,clip_points\n");
+    }
+    if (decode.windows != NULL)
+    {
+        if (source_column)
+            out_str(decode.windows, "source,");
+        out_str(decode.windows, "event,window,peak_mg,hits,exposure_g,over_limit\n");
+    }
+    if (decode.live != NULL)
+    {
+        if (source_column)
+            out_str(decode.live, "source,");
+        out_str(decode.live, "sample,t_us,rate_hz,gap,accel_x_mg,accel_y_mg,accel_z_mg,"
+                "icm_accel_x,icm_accel_y,icm_accel_z,icm_gyro_x,icm_gyro_y,icm_gyro_z\n");
+    }
+    if (decode.activity != NULL)
+    {
+        if (source_column)
+            out_str(decode.activity, "source,");
+        out_str(decode.activity, "page,time_s,peak_g,rms_g,worn,gap,impact\n");
+    }
+
+    if (jobs > 1 && argc - optind > 1)
+    {
+        num_errors = decode_parallel(&argv[optind], argc - optind, jobs, source_column, &decode, &handlers, &select);
+    }
+    else
+    {
+        for (i = optind; i < argc || i == optind; i++)
+        {
+            if (i == argc)
+                decode.source = source_column ? "-" : NULL;
+            else
+                decode.source = source_column ? argv[i] : NULL;
+            num_errors += decode_path((i == argc) ? NULL : argv[i], &handlers, &select, &chunk);
+        }
+    }
+
+    out_close(decode.samples);
+    out_close(decode.events);
+    out_close(decode.windows);
+    out_close(decode.live);
+    out_close(decode.activity);
+    free(chunk);
+    return (num_errors > 0) ? 1 : 0;
+}
@@ -0,0 +1,42 @@
+//-------------------------------------------
+// Host stand-in for the adxl372 driver header, the sample type, the count
+// conversions, the fifo sizes and the rates used by the capture pipeline
+// libraries and the sampling profiles
+//-------------------------------------------
+#ifndef ADXL372_H
+#define ADXL372_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ADXL_FIFO_SIZE                  512
+#define ADXL_FIFO_MAX_SAMPLES           (ADXL_FIFO_SIZE/3) /* xyz samples */
+#define ADXL_FIFO_WATERMARK             300
+
+typedef enum {
+    ODR_400HZ = 0,
+    ODR_800HZ,
+    ODR_1600HZ,
+    ODR_3200HZ,
+    ODR_6400HZ
+} adxl372_odr_t;
+
+typedef enum {
+    BW_200HZ = 0,
+    BW_400HZ,
+    BW_800HZ,
+    BW_1600HZ,
+    BW_3200HZ
+} adxl372_bw_t;
+
+typedef struct {
+    int16_t x;
+    int16_t y;
+    int16_t z;
+} adxl372_accel_data_t;
+
+#define ADXL372_MG_PER_LSB              100 /* +-200g full scale */
+#define ADXL372_COUNTS_TO_MG(counts)    ((int32_t)(counts) * ADXL372_MG_PER_LSB)
+#define ADXL372_MG_TO_COUNTS(mg)        ((mg) / ADXL372_MG_PER_LSB)
+
+#endif //ADXL372_H
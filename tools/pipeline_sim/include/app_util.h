@@ -0,0 +1,20 @@
+//-------------------------------------------
+// Host stand-in for the nRF5 SDK app_util header, the macros the
+// libraries use
+//-------------------------------------------
+#ifndef APP_UTIL_H
+#define APP_UTIL_H
+
+#include <stdint.h>
+
+#define STATIC_ASSERT(_expr)    _Static_assert(_expr, #_expr)
+#ifndef MIN
+#define MIN(a, b)               ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b)               ((a) < (b) ? (b) : (a))
+#endif
+#define ARRAY_SIZE(_arr)        (sizeof(_arr) / sizeof((_arr)[0]))
+#define UNUSED_PARAMETER(_x)    (void)(_x)
+
+#endif //APP_UTIL_H
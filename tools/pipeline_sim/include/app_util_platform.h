@@ -0,0 +1,11 @@
+//-------------------------------------------
+// Host stand-in for the nRF5 SDK critical regions, the simulation runs the
+// capture and the commit in one thread
+//-------------------------------------------
+#ifndef APP_UTIL_PLATFORM_H
+#define APP_UTIL_PLATFORM_H
+
+#define CRITICAL_REGION_ENTER() {
+#define CRITICAL_REGION_EXIT()  }
+
+#endif //APP_UTIL_PLATFORM_H
@@ -0,0 +1,12 @@
+//-------------------------------------------
+// Host stand-in for the nRF5 SDK crc32 header, the function is the one
+// of offload_decode's libimpact_log.a
+//-------------------------------------------
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+
+uint32_t crc32_compute(uint8_t const *data, uint32_t size, uint32_t const *p_crc);
+
+#endif //CRC32_H
@@ -0,0 +1,23 @@
+//-------------------------------------------
+// Host stand-in for the ds1388 driver header, only the time fields and
+// the epoch conversion event_store links against
+//-------------------------------------------
+#ifndef DS1388_H
+#define DS1388_H
+
+#include <stdint.h>
+
+typedef struct{
+    uint8_t year;
+    uint8_t month;
+    uint8_t date;
+    uint8_t day;
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+    uint8_t hundreth;
+} ds1388_data_t;
+
+uint32_t ds1388_to_epoch(ds1388_data_t const* date);
+
+#endif //DS1388_H
@@ -0,0 +1,37 @@
+//-------------------------------------------
+// Host stand-in for the mt25ql256aba driver header, the geometry and the
+// calls of event_store and flash_page_writer, served by sim_flash.c
+//-------------------------------------------
+#ifndef MT25QL256ABA_H
+#define MT25QL256ABA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spi_driver.h"
+#include "nrf_log.h"
+
+#define MT25QL256ABA_SUBSECTOR_4KB_SIZE     0x1000
+#define MT25QL256ABA_SUBSECTOR_32KB_SIZE    0x8000
+#define MT25QL256ABA_SECTOR_SIZE            0x10000
+#define MT25QL256ABA_FLASH_SIZE             0x2000000
+#define MT25QL256ABA_PAGE_SIZE              256
+
+//a queued read, the simulated flash runs it in the call
+typedef struct{
+    uint32_t address;
+}mt25ql256aba_read_xfer_t;
+
+extern const nrf_drv_spi_t flash_spi;
+
+void mt25ql256aba_check_write_in_progress_flag(void);
+int8_t mt25ql256aba_write_in_progress(bool* p_in_progress);
+int8_t mt25ql256aba_page_program(uint32_t address, uint8_t const* data, uint16_t length);
+int8_t mt25ql256aba_read(uint32_t address, uint8_t* data, uint32_t length);
+int8_t mt25ql256aba_queue_read(mt25ql256aba_read_xfer_t* p_read, uint32_t address, uint8_t* data, uint32_t length,
+                               spi_xfer_callback_t callback, void* p_context);
+int8_t mt25ql256aba_erase_block(uint32_t address, uint32_t size);
+bool mt25ql256aba_erase_supported(uint32_t size);
+int8_t mt25ql256aba_suspend(bool* p_suspended);
+int8_t mt25ql256aba_resume(void);
+
+#endif //MT25QL256ABA_H
@@ -0,0 +1,38 @@
+//-------------------------------------------
+// Host stand-in for the nRF5 SDK block allocator, a stack of free
+// blocks with the same calls and the same limits as the target pool
+//-------------------------------------------
+#ifndef NRF_BALLOC_H
+#define NRF_BALLOC_H
+
+#include <stdint.h>
+#include "app_util.h"
+
+#define NRF_SUCCESS             0
+
+typedef struct {
+    uint32_t free;              /* blocks on the stack */
+    uint32_t max_used;
+} nrf_balloc_cb_t;
+
+typedef struct {
+    nrf_balloc_cb_t *p_cb;
+    void **pp_stack;
+    uint8_t *p_memory;
+    uint32_t block_size;
+    uint32_t num_blocks;
+} nrf_balloc_t;
+
+#define NRF_BALLOC_DEF(_name, _element_size, _pool_size)                                \
+    static uint64_t _name##_memory[(_pool_size) * (((_element_size) + 7) / 8)];          \
+    static void *_name##_stack[_pool_size];                                             \
+    static nrf_balloc_cb_t _name##_cb;                                                  \
+    static const nrf_balloc_t _name = {&_name##_cb, _name##_stack, (uint8_t *) _name##_memory, \
+                                       (((_element_size) + 7) / 8) * 8, (_pool_size)}
+
+uint32_t nrf_balloc_init(nrf_balloc_t const *p_pool);
+void *nrf_balloc_alloc(nrf_balloc_t const *p_pool);
+void nrf_balloc_free(nrf_balloc_t const *p_pool, void *p_element);
+uint8_t nrf_balloc_max_utilization_get(nrf_balloc_t const *p_pool);
+
+#endif //NRF_BALLOC_H
@@ -0,0 +1,18 @@
+//-------------------------------------------
+// Host stand-in for the nRF5 SDK log header, the library logs go to
+// stderr when pipeline_sim runs with -v
+//-------------------------------------------
+#ifndef NRF_LOG_H
+#define NRF_LOG_H
+
+#include <stdio.h>
+
+extern int sim_log_enabled;
+
+#define SIM_LOG(_level, ...)    do { if (sim_log_enabled) { fprintf(stderr, _level ": " __VA_ARGS__); fputc('\n', stderr); } } while (0)
+#define NRF_LOG_ERROR(...)      SIM_LOG("error", __VA_ARGS__)
+#define NRF_LOG_WARNING(...)    SIM_LOG("warning", __VA_ARGS__)
+#define NRF_LOG_INFO(...)       SIM_LOG("info", __VA_ARGS__)
+#define NRF_LOG_DEBUG(...)
+
+#endif //NRF_LOG_H
@@ -0,0 +1,19 @@
+//-------------------------------------------
+// Host stand-in for the spi driver header, the idle check of the flash
+// instance event_store makes and the callback of a queued read
+//-------------------------------------------
+#ifndef SPI_DRIVER_H
+#define SPI_DRIVER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint8_t inst_idx;
+} nrf_drv_spi_t;
+
+typedef void (*spi_xfer_callback_t)(int8_t result, void * p_context);
+
+bool spi_is_idle(nrf_drv_spi_t const * spi);
+
+#endif //SPI_DRIVER_H
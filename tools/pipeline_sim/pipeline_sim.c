@@ -0,0 +1,510 @@
+//-------------------------------------------
+// Title: pipeline_sim.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Host software in the loop run of the imu_pcb_rev1_app
+// capture pipeline. The filter, trigger, pre-trigger ring, record blocks,
+// metrics, location, codec and event store are the firmware's own sources,
+// built natively against the stand-in headers in include/, the sensors are
+// a recorded or synthetic trace (sim_sensor) and the flash is simulated in
+// memory (sim_flash). The burst handling and the encoding and summary of the
+// commit are the app's capture_core, run behind a hal of one capture buffer
+// with the thresholds and windows of capture.h. Every run starts from a blank flash,
+// the first one is checked by decoding the flash image back with
+// libimpact_log, and the host time of each stage is summed per sample.
+//
+// usage: pipeline_sim [-n runs] [-b burst] [-i impacts] [-s seed] [-u] [-k] [-e events.csv] [-o flash.bin] [-v] [file ...]
+//   file  offload captures or flash images, as read by offload_decode, replayed one event
+//         after the other. Without a file the trace is -i synthetic impacts (32) from seed -s (1)
+//   -n  runs of the whole trace, for the benchmark (1)
+//   -b  samples per fifo burst, the watermark of capture.c by default
+//   -u  skips the filter, the stored samples of a recording were filtered on the device
+//   -k  runs every record codec over the records of each stored event besides the store,
+//       and prints the bytes and the time per sample of each one, decoded back to check
+//   -e  one line per event of the first run to a csv file, e.g. to diff a trigger change
+//   -o  flash image of the first run to a file, offload_decode reads it like one from a board
+//   -v  logs of the libraries to stderr
+// Exits 1 if a run fails or the flash of the first one does not decode back, so make check
+// and scripts stop on it
+//   pipeline_sim -n 2000 -i 64
+//   pipeline_sim -i 30000 -s 3   fills the store up to its retain limit, every event still decodes back
+//   pipeline_sim -u -e events.csv helmet.bin
+//   pipeline_sim -u -k helmet.bin
+//-------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "capture_core.h"
+#include "record_block.h"
+#include "impact_location.h"
+#include "sim_flash.h"
+#include "sim_sensor.h"
+
+#define SIM_BASE_EPOCH          1577836800 //2020-01-01 UTC, the time of the first sample of a trace
+#define SIM_DEFAULT_IMPACTS     32
+#define SIM_DEFAULT_SEED        1
+#define SIM_BURST_SAMPLES       (ADXL_FIFO_WATERMARK/3)
+
+typedef enum {
+    SIM_STAGE_FILTER = 0,   /* spi interrupt, every trace sample */
+    SIM_STAGE_TRIGGER,
+    SIM_STAGE_CAPTURE,      /* pre-trigger ring and record packing */
+    SIM_STAGE_COMMIT,       /* thread, metrics, codec, event store and flash of every captured record */
+    SIM_STAGE_ERASE,        /* background erase steps */
+    SIM_STAGE_COUNT
+} sim_stage_t;
+
+static char const * const m_stage_names[SIM_STAGE_COUNT] = {
+    "filter", "trigger", "capture", "commit", "erase",
+};
+
+typedef struct {
+    uint64_t ns[SIM_STAGE_COUNT];
+    uint64_t samples;       /* trace samples through the filter and the trigger */
+    uint64_t records;       /* records captured */
+    uint64_t stored;        /* records of the committed events */
+    uint64_t dropped;       /* samples that arrived with the pool empty */
+    uint32_t captures;
+    uint32_t chained;       /* triggers that extended a quiet capture */
+    uint32_t events;        /* committed */
+    uint32_t store_errors;
+    uint8_t pool_max_blocks;
+    uint64_t codec_ns[IMPACT_CODEC_KINDS];
+    uint64_t codec_bytes[IMPACT_CODEC_KINDS];
+    uint64_t codec_records;
+    uint32_t codec_errors;  /* records that did not decode back the same */
+} sim_totals_t;
+
+typedef struct {
+    uint16_t burst;
+    int filter;
+    int codecs;
+    FILE *events;           /* first run only, NULL otherwise */
+} sim_options_t;
+
+int sim_log_enabled = 0;
+
+RECORD_BLOCK_POOL_DEF(m_record_pool, CAPTURE_POOL_BLOCKS);
+static capture_buf_t m_capture_buf;
+static bool m_pending = false;              //closed and not committed yet
+static uint32_t m_sample_index;             //trace samples before the burst, the clock of the run
+static sim_totals_t *m_totals;              //of the run, for the hal
+
+static capture_core_t m_core;
+static adxl372_accel_data_t m_burst_buf[ADXL_FIFO_MAX_SAMPLES];
+
+static event_store_t m_event_store;
+static capture_core_encoder_t m_encoder;
+
+static uint64_t sim_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// capture_open() of capture.c, the trigger time is the trace sample it fired on.
+// The one buffer is free again by the next burst
+static capture_buf_t *sim_open(uint16_t trigger_index)
+{
+    capture_buf_t *p_buf = &m_capture_buf;
+
+    if (m_pending)
+        return NULL;
+    record_chain_init(&p_buf->chain, &m_record_pool);
+    p_buf->start_ticks = m_sample_index + trigger_index;
+    p_buf->range = IMPACT_RECORD_RANGE_DEFAULT;
+
+    return p_buf;
+}
+
+// capture_close() of capture.c, the commit runs after the burst like the scheduler handoff
+static void sim_close(capture_buf_t *p_buf)
+{
+    m_pending = true;
+    m_totals->captures++;
+    m_totals->chained += p_buf->chained;
+    m_totals->records += p_buf->count;
+    m_totals->dropped += p_buf->dropped;
+}
+
+static void sim_lost(uint16_t num_samples)
+{
+    m_totals->dropped += num_samples;
+}
+
+static capture_core_hal_t const m_sim_hal = {
+    .open = sim_open,
+    .close = sim_close,
+    .lost = sim_lost,
+};
+
+// capture_core_burst() with the filter and the trigger timed apart, the trace has no fifo overruns
+static void sim_burst(adxl372_accel_data_t *samples, uint16_t num_samples, icm20649_data_t const *gyro,
+                      sim_totals_t *totals)
+{
+    int16_t trigger_index;
+    uint64_t t0, t1, t2;
+
+    t0 = sim_now_ns();
+    if (m_core.window.filter)
+        accel_filter_block(&m_core.accel_filter, samples, num_samples);
+    t1 = sim_now_ns();
+    trigger_index = impact_trigger_update(&m_core.trigger, samples, num_samples);
+    t2 = sim_now_ns();
+    capture_core_record(&m_core, samples, num_samples, gyro, trigger_index);
+    totals->ns[SIM_STAGE_FILTER] += t1 - t0;
+    totals->ns[SIM_STAGE_TRIGGER] += t2 - t1;
+    totals->ns[SIM_STAGE_CAPTURE] += sim_now_ns() - t2;
+    totals->samples += num_samples;
+}
+
+// same line for every run of a trace, so two builds can be diffed
+static void sim_event_line(FILE *out, uint32_t id, capture_buf_t const *p_buf, impact_metrics_t const *metrics,
+                           event_store_summary_t const *summary)
+{
+    fprintf(out, "%u,%u.%06u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%s\n", id,
+            SIM_BASE_EPOCH + p_buf->start_ticks/CAPTURE_SAMPLE_RATE_HZ,
+            (uint32_t) (((uint64_t) (p_buf->start_ticks % CAPTURE_SAMPLE_RATE_HZ) * 1000000) / CAPTURE_SAMPLE_RATE_HZ),
+            p_buf->count, p_buf->pre_trigger, p_buf->dropped,
+            impact_metrics_peak_mg(metrics), impact_metrics_duration_us(metrics), metrics->hic15, metrics->hic36,
+            impact_metrics_peak_omega_mrad(metrics), impact_metrics_bric_x1000(metrics),
+            impact_location_name(summary->location));
+}
+
+// every codec over the records of an event, as the commit step would code them
+static void sim_codecs(record_chain_t const *chain, sim_totals_t *totals)
+{
+    static uint8_t out[CAPTURE_POOL_BLOCKS*RECORD_BLOCK_RECORDS*IMPACT_CODEC_MAX_RECORD_SIZE];
+    record_block_t const *block;
+    impact_codec_t codec;
+    impact_record_t record;
+    uint32_t fill, pos;
+    uint64_t t0;
+    uint8_t used;
+
+    for (int kind = 0; kind < IMPACT_CODEC_KINDS; ++kind)
+    {
+        fill = 0;
+        t0 = sim_now_ns();
+        impact_codec_init(&codec);
+        for (block = chain->p_head; block != NULL; block = block->p_next)
+            for (uint16_t i = 0; i < block->count && fill <= sizeof(out) - IMPACT_CODEC_MAX_RECORD_SIZE; i++)
+                fill += impact_codec_encode_with(kind, &codec, &block->records[i], &out[fill]);
+        totals->codec_ns[kind] += sim_now_ns() - t0;
+        totals->codec_bytes[kind] += fill;
+
+        pos = 0;
+        impact_codec_init(&codec);
+        for (block = chain->p_head; block != NULL; block = block->p_next)
+        {
+            for (uint16_t i = 0; i < block->count && pos < fill; i++)
+            {
+                if (impact_codec_decode_with(kind, &codec, &out[pos], fill - pos, &record, &used) < 0
+                    || memcmp(&record, &block->records[i], sizeof(record)) != 0)
+                {
+                    totals->codec_errors++;
+                    break;
+                }
+                pos += used;
+            }
+        }
+    }
+    for (block = chain->p_head; block != NULL; block = block->p_next)
+        totals->codec_records += block->count;
+}
+
+// commit_start() and commit_step() of the app in one go, the flash is never busy
+static void sim_commit(sim_options_t const *opts, sim_totals_t *totals)
+{
+    capture_buf_t *p_buf = &m_capture_buf;
+    impact_metrics_t metrics;
+    event_store_time_t time;
+    event_store_summary_t summary;
+    event_store_preview_t preview;
+    uint64_t start_us, t0, t1;
+    uint32_t id = 0;
+    int8_t ret;
+
+    m_pending = false;
+    //outside the stage times, the commit stage codes as the app does
+    if (opts->codecs)
+        sim_codecs(&p_buf->chain, totals);
+    //the trace is the reference clock, to the microsecond like a synced device
+    start_us = ((uint64_t) p_buf->start_ticks * 1000000) / CAPTURE_SAMPLE_RATE_HZ;
+    time.s = SIM_BASE_EPOCH + start_us / 1000000;
+    time.us = (start_us % 1000000) | EVENT_STORE_TIME_SYNCED;
+
+    t0 = sim_now_ns();
+    capture_core_metrics_init(p_buf, &metrics);
+    memset(&summary, 0xFF, sizeof(event_store_summary_t));
+    ret = event_store_begin(&m_event_store, &time, &summary, 1,
+                            impact_codec_encoding(true, p_buf->range, false));
+    if (ret == 0)
+        capture_core_encode_init(&m_encoder, IMPACT_CODEC_NIBBLE);
+    while (ret == 0 && p_buf->chain.p_head != NULL)
+    {
+        capture_core_encode(&m_encoder, p_buf, &metrics, event_store_append_room(&m_event_store));
+        ret = event_store_append(&m_event_store, m_encoder.chunk, m_encoder.fill);
+        m_encoder.fill = 0;
+    }
+    if (ret == 0)
+    {
+        capture_core_summary_fill(&metrics, &summary);
+        event_store_set_summary(&m_event_store, &summary);
+        preview.point_us = impact_metrics_preview(&metrics, preview.g);
+        event_store_set_preview(&m_event_store, &preview);
+        ret = event_store_commit(&m_event_store, &id);
+    }
+    t1 = sim_now_ns();
+    totals->ns[SIM_STAGE_COMMIT] += t1 - t0;
+
+    if (ret < 0)
+    {
+        totals->store_errors++;
+    }
+    else
+    {
+        totals->events++;
+        totals->stored += p_buf->count;
+        if (opts->events != NULL)
+            sim_event_line(opts->events, id, p_buf, &metrics, &summary);
+    }
+    //capture_buf_release()
+    record_chain_free(&p_buf->chain);
+
+    t0 = sim_now_ns();
+    while (event_store_erase_step(&m_event_store) > 0)
+        ;
+    totals->ns[SIM_STAGE_ERASE] += sim_now_ns() - t0;
+}
+
+// one pass of the trace from a blank flash
+static int sim_run(sim_sensor_t *sensor, sim_options_t const *opts, sim_totals_t *totals)
+{
+    capture_core_window_t const window = {
+        .max_samples = IMPACT_MAX_SAMPLES,
+        .quiet_samples = IMPACT_QUIET_SAMPLES,
+        .chain_samples = IMPACT_CHAIN_SAMPLES,
+        .pre_trigger_samples = PRE_TRIGGER_SAMPLES,
+        .delta = SAMPLING_PROFILE_BASE_HZ / CAPTURE_SAMPLE_RATE_HZ,
+        .filter = opts->filter,
+    };
+    icm20649_data_t gyro;
+    uint16_t num_samples;
+
+    sim_flash_reset();
+    if (event_store_init(&m_event_store) < 0)
+        return -1;
+    while (event_store_erase_step(&m_event_store) > 0)
+        ;
+    (void) nrf_balloc_init(&m_record_pool);
+    m_totals = totals;
+    m_pending = false;
+    m_sample_index = 0;
+    capture_core_init(&m_core, &m_sim_hal);
+    capture_core_window_set(&m_core, &window);
+    impact_trigger_init(&m_core.trigger, CAPTURE_THRESHOLD_COUNTS, IMPACT_RELEASE_COUNTS, IMPACT_MIN_SAMPLES);
+    impact_trigger_adapt_set(&m_core.trigger, ADXL372_MG_TO_COUNTS(CAPTURE_THRESHOLD_MAX_MG));
+    sim_sensor_rewind(sensor);
+
+    //the gyro read finishes alongside the fifo read of the burst
+    while ((num_samples = sim_sensor_fifo_read(sensor, m_burst_buf, opts->burst, &gyro)) > 0)
+    {
+        sim_burst(m_burst_buf, num_samples, &gyro, totals);
+        m_sample_index += num_samples;
+        if (m_pending)
+            sim_commit(opts, totals);
+    }
+    //the trace ended inside an impact
+    if (m_core.p_capture != NULL)
+    {
+        capture_core_close(&m_core);
+        sim_commit(opts, totals);
+    }
+    totals->pool_max_blocks = MAX(totals->pool_max_blocks, nrf_balloc_max_utilization_get(&m_record_pool));
+
+    return 0;
+}
+
+// decodes the flash of the run back, every committed event and record has to be there
+static int sim_check(sim_totals_t const *totals)
+{
+    uint32_t events, errors;
+    uint64_t samples;
+
+    if (sim_flash_decode(&events, &samples, &errors) < 0 || errors > 0
+        || events != totals->events || samples != totals->stored)
+    {
+        fprintf(stderr, "check: %u of %u events and %llu of %llu samples decoded back, %u errors\n",
+                events, totals->events, (unsigned long long) samples, (unsigned long long) totals->stored, errors);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void sim_report(sim_totals_t const *totals, uint32_t runs, uint64_t elapsed_ns)
+{
+    sim_flash_stats_t flash;
+    uint64_t total_ns = 0;
+
+    sim_flash_stats(&flash);
+    printf("%u runs of %llu samples, %u impacts captured and %u stored per run, %llu records, %llu dropped\n",
+           runs, (unsigned long long) (totals->samples / runs), totals->captures / runs, totals->events / runs,
+           (unsigned long long) (totals->records / runs), (unsigned long long) (totals->dropped / runs));
+    printf("%u triggers per run chained to the capture before them\n", totals->chained / runs);
+    printf("%.3f s, %.0f runs per minute, %.1f x real time\n", elapsed_ns / 1e9,
+           runs * 60e9 / elapsed_ns, (totals->samples * 1e9 / CAPTURE_SAMPLE_RATE_HZ) / elapsed_ns);
+    printf("stage       ns/sample  ns/record\n");
+    for (int i = 0; i < SIM_STAGE_COUNT; ++i)
+    {
+        total_ns += totals->ns[i];
+        printf("%-10s %10.1f %10.1f\n", m_stage_names[i],
+               totals->samples ? (double) totals->ns[i] / totals->samples : 0.0,
+               totals->records ? (double) totals->ns[i] / totals->records : 0.0);
+    }
+    printf("%-10s %10.1f %10.1f\n", "total",
+           totals->samples ? (double) total_ns / totals->samples : 0.0,
+           totals->records ? (double) total_ns / totals->records : 0.0);
+    printf("flash of the last run: %u pages, %u bytes programmed, %u blocks erased, %.1f ms busy at the typical times\n",
+           flash.pages_programmed, flash.bytes_programmed, flash.blocks_erased, flash.busy_us / 1000.0);
+    printf("record pool: %u of %u blocks at most\n", totals->pool_max_blocks, CAPTURE_POOL_BLOCKS);
+    if (totals->store_errors > 0)
+        printf("%u events refused by the store\n", totals->store_errors);
+    if (totals->codec_records > 0)
+    {
+        printf("codec    bytes/sample  ns/sample\n");
+        for (int i = 0; i < IMPACT_CODEC_KINDS; ++i)
+            printf("%-8s %12.2f %10.1f\n", impact_codec_name(i),
+                   (double) totals->codec_bytes[i] / totals->codec_records,
+                   (double) totals->codec_ns[i] / totals->codec_records);
+        if (totals->codec_errors > 0)
+            printf("%u records did not decode back\n", totals->codec_errors);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    sim_options_t opts = {SIM_BURST_SAMPLES, 1, 0, NULL};
+    sim_totals_t totals;
+    sim_sensor_t sensor;
+    char const *events_path = NULL, *image_path = NULL;
+    uint32_t runs = 1, impacts = SIM_DEFAULT_IMPACTS, seed = SIM_DEFAULT_SEED;
+    uint64_t start_ns, elapsed_ns = 0;
+    int opt, ret = 0;
+
+    while ((opt = getopt(argc, argv, "n:b:i:s:uke:o:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                runs = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                opts.burst = (uint16_t) strtoul(optarg, NULL, 0);
+                break;
+            case 'i':
+                impacts = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'u':
+                opts.filter = 0;
+                break;
+            case 'k':
+                opts.codecs = 1;
+                break;
+            case 'e':
+                events_path = optarg;
+                break;
+            case 'o':
+                image_path = optarg;
+                break;
+            case 'v':
+                sim_log_enabled = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n runs] [-b burst] [-i impacts] [-s seed] [-u] [-k] [-e events.csv] [-o flash.bin] [-v] [file ...]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (runs == 0 || opts.burst == 0 || opts.burst > ADXL_FIFO_MAX_SAMPLES)
+    {
+        fprintf(stderr, "%s: runs from 1, bursts of 1 to %u samples\n", argv[0], ADXL_FIFO_MAX_SAMPLES);
+        return 2;
+    }
+
+    sim_sensor_init(&sensor, seed);
+    if (optind == argc && sim_sensor_synthetic(&sensor, impacts) < 0)
+    {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+    for (int i = optind; i < argc; ++i)
+    {
+        if (sim_sensor_load(&sensor, argv[i]) < 0)
+        {
+            fprintf(stderr, "%s: could not be read\n", argv[i]);
+            return 1;
+        }
+    }
+    if (sim_flash_init() < 0)
+    {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+    if (events_path != NULL)
+    {
+        opts.events = fopen(events_path, "w");
+        if (opts.events == NULL)
+        {
+            perror(events_path);
+            return 1;
+        }
+        fprintf(opts.events, "event,trigger_s,records,pre_trigger,dropped,peak_mg,duration_us,hic15,hic36,"
+                             "peak_omega_mrad,bric_x1000,location\n");
+    }
+
+    memset(&totals, 0, sizeof(totals));
+    for (uint32_t run = 0; run < runs && ret == 0; ++run)
+    {
+        start_ns = sim_now_ns();
+        ret = sim_run(&sensor, &opts, &totals);
+        elapsed_ns += sim_now_ns() - start_ns;
+        if (run > 0 || ret < 0)
+            continue;
+
+        //the first run is checked and saved, the others are only timed
+        if (sim_check(&totals) < 0)
+        {
+            fprintf(stderr, "%s: check failed\n", argv[0]);
+            ret = -1;
+        }
+        if (image_path != NULL && sim_flash_save(image_path) < 0)
+        {
+            perror(image_path);
+            ret = -1;
+        }
+        if (opts.events != NULL)
+        {
+            fclose(opts.events);
+            opts.events = NULL;
+        }
+    }
+    if (ret < 0)
+    {
+        fprintf(stderr, "%s: run failed\n", argv[0]);
+        return 1;
+    }
+
+    sim_report(&totals, runs, elapsed_ns);
+    sim_sensor_free(&sensor);
+
+    return (totals.codec_errors > 0) ? 1 : 0;
+}
@@ -0,0 +1,229 @@
+//-------------------------------------------
+// Title: sim_flash.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Simulated mt25ql256aba for pipeline_sim, the driver calls
+// event_store and flash_page_writer make, served from a 32MB image in
+// host memory with the program, erase and page boundary rules of the part.
+//-------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim_flash.h"
+#include "impact_log.h"
+
+typedef struct {
+    uint32_t events;
+    uint64_t samples;
+} sim_flash_decode_t;
+
+const nrf_drv_spi_t flash_spi = {0};
+
+static uint8_t *m_image;
+static uint32_t m_dirty_start;  //programmed span since the last reset
+static uint32_t m_dirty_end;
+static sim_flash_stats_t m_stats;
+
+/*
+ * Allocates the image, erased
+ * @return 0 if success otherwise -1
+ */
+int sim_flash_init(void)
+{
+    m_image = malloc(MT25QL256ABA_FLASH_SIZE);
+    if (m_image == NULL)
+        return -1;
+
+    memset(m_image, 0xFF, MT25QL256ABA_FLASH_SIZE);
+    m_dirty_start = MT25QL256ABA_FLASH_SIZE;
+    m_dirty_end = 0;
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    return 0;
+}
+
+/*
+ * Back to a blank device with the counts cleared
+ */
+void sim_flash_reset(void)
+{
+    if (m_dirty_end > m_dirty_start)
+        memset(&m_image[m_dirty_start], 0xFF, m_dirty_end - m_dirty_start);
+    m_dirty_start = MT25QL256ABA_FLASH_SIZE;
+    m_dirty_end = 0;
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+uint8_t const *sim_flash_image(void)
+{
+    return m_image;
+}
+
+void sim_flash_stats(sim_flash_stats_t *p_stats)
+{
+    *p_stats = m_stats;
+}
+
+/*
+ * Writes the image for offload_decode, which reads it like one read out of a board
+ * @return 0 if success otherwise -1
+ */
+int sim_flash_save(char const *path)
+{
+    FILE *out = fopen(path, "wb");
+    size_t written;
+
+    if (out == NULL)
+        return -1;
+    written = fwrite(m_image, 1, MT25QL256ABA_FLASH_SIZE, out);
+    if (fclose(out) != 0 || written != MT25QL256ABA_FLASH_SIZE)
+        return -1;
+
+    return 0;
+}
+
+static void sim_flash_event_handler(void *p_context, impact_log_event_t const *event)
+{
+    ((sim_flash_decode_t *) p_context)->events++;
+}
+
+static void sim_flash_sample_handler(void *p_context, impact_log_event_t const *event, impact_log_sample_t const *sample)
+{
+    ((sim_flash_decode_t *) p_context)->samples++;
+}
+
+static void sim_flash_error_handler(void *p_context, char const *message)
+{
+    fprintf(stderr, "flash: %s\n", message);
+}
+
+/*
+ * Decodes every event of the image, checking the header and sample crcs
+ * @param p_events  - events decoded
+ * @param p_samples - their samples
+ * @param p_errors  - events that failed to decode
+ * @return 0 if the image holds an event store otherwise -1
+ */
+int sim_flash_decode(uint32_t *p_events, uint64_t *p_samples, uint32_t *p_errors)
+{
+    sim_flash_decode_t decode = {0, 0};
+    impact_log_handlers_t handlers = {sim_flash_event_handler, sim_flash_sample_handler, NULL, NULL, NULL,
+                                      sim_flash_error_handler, &decode};
+    uint32_t decoded;
+    int ret;
+
+    ret = impact_log_flash_image(&handlers, m_image, MT25QL256ABA_FLASH_SIZE, &decoded, p_errors);
+    *p_events = decode.events;
+    *p_samples = decode.samples;
+
+    return (ret < 0) ? -1 : 0;
+}
+
+bool spi_is_idle(nrf_drv_spi_t const * spi)
+{
+    return true;
+}
+
+void mt25ql256aba_check_write_in_progress_flag(void)
+{
+}
+
+int8_t mt25ql256aba_write_in_progress(bool* p_in_progress)
+{
+    *p_in_progress = false;
+    return 0;
+}
+
+int8_t mt25ql256aba_page_program(uint32_t address, uint8_t const* data, uint16_t length)
+{
+    if (length == 0 || (address % MT25QL256ABA_PAGE_SIZE) + length > MT25QL256ABA_PAGE_SIZE
+        || address >= MT25QL256ABA_FLASH_SIZE)
+        return -2;
+
+    for (uint16_t i = 0; i < length; ++i)
+        m_image[address + i] &= data[i];
+
+    if (address < m_dirty_start)
+        m_dirty_start = address;
+    if (address + length > m_dirty_end)
+        m_dirty_end = address + length;
+    m_stats.pages_programmed++;
+    m_stats.bytes_programmed += length;
+    m_stats.busy_us += SIM_FLASH_PROGRAM_US;
+
+    return 0;
+}
+
+int8_t mt25ql256aba_read(uint32_t address, uint8_t* data, uint32_t length)
+{
+    //the part wraps at the end of the array
+    for (uint32_t done = 0; done < length; )
+    {
+        uint32_t offset = (address + done) % MT25QL256ABA_FLASH_SIZE;
+        uint32_t chunk = length - done;
+
+        if (chunk > MT25QL256ABA_FLASH_SIZE - offset)
+            chunk = MT25QL256ABA_FLASH_SIZE - offset;
+        memcpy(&data[done], &m_image[offset], chunk);
+        done += chunk;
+    }
+    m_stats.bytes_read += length;
+
+    return 0;
+}
+
+int8_t mt25ql256aba_queue_read(mt25ql256aba_read_xfer_t* p_read, uint32_t address, uint8_t* data, uint32_t length,
+                               spi_xfer_callback_t callback, void* p_context)
+{
+    int8_t ret;
+
+    //done at once, the callback runs before the call returns
+    p_read->address = address;
+    ret = mt25ql256aba_read(address, data, length);
+    if (callback != NULL)
+        callback(ret, p_context);
+
+    return 0;
+}
+
+int8_t mt25ql256aba_erase_block(uint32_t address, uint32_t size)
+{
+    switch (size)
+    {
+        case MT25QL256ABA_SUBSECTOR_4KB_SIZE:
+            m_stats.busy_us += SIM_FLASH_ERASE_4KB_US;
+            break;
+        case MT25QL256ABA_SUBSECTOR_32KB_SIZE:
+            m_stats.busy_us += SIM_FLASH_ERASE_32KB_US;
+            break;
+        case MT25QL256ABA_SECTOR_SIZE:
+            m_stats.busy_us += SIM_FLASH_ERASE_64KB_US;
+            break;
+        default:
+            return -2;
+    }
+    if (address >= MT25QL256ABA_FLASH_SIZE)
+        return -2;
+
+    address &= ~(size - 1);
+    memset(&m_image[address], 0xFF, size);
+    m_stats.blocks_erased++;
+
+    return 0;
+}
+
+bool mt25ql256aba_erase_supported(uint32_t size)
+{
+    return size == MT25QL256ABA_SUBSECTOR_4KB_SIZE || size == MT25QL256ABA_SUBSECTOR_32KB_SIZE
+           || size == MT25QL256ABA_SECTOR_SIZE;
+}
+
+int8_t mt25ql256aba_suspend(bool* p_suspended)
+{
+    *p_suspended = false;
+    return 0;
+}
+
+int8_t mt25ql256aba_resume(void)
+{
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef SIM_FLASH_H
+#define SIM_FLASH_H
+
+#include <stdint.h>
+#include "mt25ql256aba.h"
+
+/* The mt25ql256aba in host memory behind the driver calls of include/mt25ql256aba.h.
+ * A program can only clear bits and an erase sets its whole block to 0xFF, like
+ * the NOR array, but every operation is done by the time the call returns, so
+ * the flash is never busy or suspended. The time the part would have been busy
+ * is added up from the datasheet typicals instead. sim_flash_reset() erases
+ * only the span written since the last reset, so runs can restart from a blank
+ * device thousands of times a minute. sim_flash_decode() reads the image back
+ * with libimpact_log the way offload_decode reads one out of a board */
+#define SIM_FLASH_PROGRAM_US        120     //tPP typical
+#define SIM_FLASH_ERASE_4KB_US      50000   //tSSE typical
+#define SIM_FLASH_ERASE_32KB_US     100000
+#define SIM_FLASH_ERASE_64KB_US     150000  //tSE typical
+
+typedef struct {
+    uint32_t pages_programmed;
+    uint32_t bytes_programmed;
+    uint32_t blocks_erased;
+    uint64_t bytes_read;
+    uint64_t busy_us;           /* modeled program and erase time */
+} sim_flash_stats_t;
+
+int sim_flash_init(void);
+
+void sim_flash_reset(void);
+
+uint8_t const *sim_flash_image(void);
+
+void sim_flash_stats(sim_flash_stats_t *p_stats);
+
+int sim_flash_save(char const *path);
+
+int sim_flash_decode(uint32_t *p_events, uint64_t *p_samples, uint32_t *p_errors);
+
+#endif //SIM_FLASH_H
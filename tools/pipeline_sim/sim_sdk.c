@@ -0,0 +1,117 @@
+//-------------------------------------------
+// Title: sim_sdk.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Host stand-ins of the nRF5 SDK, CMSIS-DSP and driver
+// functions the capture pipeline libraries call, declared by the headers
+// in include/. They keep the arithmetic and the limits of the target ones
+// so a host run stores the same records the device would.
+//-------------------------------------------
+#include <stddef.h>
+#include "arm_math.h"
+#include "nrf_balloc.h"
+#include "ds1388.h"
+
+#define SECONDS_PER_DAY 86400
+
+uint32_t nrf_balloc_init(nrf_balloc_t const *p_pool)
+{
+    for (uint32_t i = 0; i < p_pool->num_blocks; ++i)
+        p_pool->pp_stack[i] = &p_pool->p_memory[i * p_pool->block_size];
+    p_pool->p_cb->free = p_pool->num_blocks;
+    p_pool->p_cb->max_used = 0;
+
+    return NRF_SUCCESS;
+}
+
+void *nrf_balloc_alloc(nrf_balloc_t const *p_pool)
+{
+    nrf_balloc_cb_t *p_cb = p_pool->p_cb;
+
+    if (p_cb->free == 0)
+        return NULL;
+
+    p_cb->free--;
+    if (p_pool->num_blocks - p_cb->free > p_cb->max_used)
+        p_cb->max_used = p_pool->num_blocks - p_cb->free;
+
+    return p_pool->pp_stack[p_cb->free];
+}
+
+void nrf_balloc_free(nrf_balloc_t const *p_pool, void *p_element)
+{
+    p_pool->pp_stack[p_pool->p_cb->free++] = p_element;
+}
+
+uint8_t nrf_balloc_max_utilization_get(nrf_balloc_t const *p_pool)
+{
+    return (uint8_t) p_pool->p_cb->max_used;
+}
+
+void arm_biquad_cascade_df1_init_q15(arm_biquad_casd_df1_inst_q15 *S, uint8_t numStages, q15_t *pCoeffs,
+                                     q15_t *pState, int8_t postShift)
+{
+    S->numStages = numStages;
+    S->pCoeffs = pCoeffs;
+    S->postShift = postShift;
+    S->pState = pState;
+    for (uint32_t i = 0; i < 4U * numStages; ++i)
+        pState[i] = 0;
+}
+
+/*
+ * Direct form I, {b0, 0, b1, b2, a1, a2} per stage and the state {x[n-1],
+ * x[n-2], y[n-1], y[n-2]}, 64 bit accumulator shifted by 15 - postShift and
+ * saturated to 16 bits like the CMSIS-DSP reference code
+ */
+void arm_biquad_cascade_df1_q15(const arm_biquad_casd_df1_inst_q15 *S, q15_t *pSrc, q15_t *pDst, uint32_t blockSize)
+{
+    q15_t const *pCoeffs = S->pCoeffs;
+    q15_t *pState = S->pState;
+    q15_t *pIn = pSrc;
+    int32_t shift = 15 - S->postShift;
+
+    for (int8_t stage = 0; stage < S->numStages; ++stage)
+    {
+        q31_t b0 = pCoeffs[0], b1 = pCoeffs[2], b2 = pCoeffs[3], a1 = pCoeffs[4], a2 = pCoeffs[5];
+        q15_t Xn1 = pState[0], Xn2 = pState[1], Yn1 = pState[2], Yn2 = pState[3];
+
+        for (uint32_t n = 0; n < blockSize; ++n)
+        {
+            q15_t in = pIn[n];
+            q63_t acc = (q63_t) b0 * in + (q63_t) b1 * Xn1 + (q63_t) b2 * Xn2
+                      + (q63_t) a1 * Yn1 + (q63_t) a2 * Yn2;
+
+            acc >>= shift;
+            if (acc > INT16_MAX)
+                acc = INT16_MAX;
+            else if (acc < INT16_MIN)
+                acc = INT16_MIN;
+
+            Xn2 = Xn1;
+            Xn1 = in;
+            Yn2 = Yn1;
+            Yn1 = (q15_t) acc;
+            pDst[n] = Yn1;
+        }
+
+        pState[0] = Xn1;
+        pState[1] = Xn2;
+        pState[2] = Yn1;
+        pState[3] = Yn2;
+        pCoeffs += 6;
+        pState += 4;
+        //every stage after the first filters the output in place
+        pIn = pDst;
+    }
+}
+
+// same days from civil as drivers/ds1388
+uint32_t ds1388_to_epoch(ds1388_data_t const* date)
+{
+    uint32_t year = 2000 + date->year - ((date->month <= 2) ? 1 : 0);
+    uint32_t month = (date->month <= 2) ? date->month + 9 : date->month - 3;
+    uint32_t day_of_year = (153*month + 2)/5 + date->date - 1;
+    uint32_t days = year*365 + year/4 - year/100 + year/400 + day_of_year - 719468;
+
+    return days*SECONDS_PER_DAY + date->hour*3600 + date->minute*60 + date->second;
+}
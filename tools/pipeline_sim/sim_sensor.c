@@ -0,0 +1,282 @@
+//-------------------------------------------
+// Title: sim_sensor.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Sensor traces for pipeline_sim, kept whole in memory and
+// read out in fifo bursts. Recorded traces are decoded by libimpact_log
+// from the same offload captures and flash images offload_decode reads,
+// synthetic ones are generated from a seed so every run of a benchmark or
+// a check sees the same samples.
+//-------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sim_sensor.h"
+#include "impact_log.h"
+
+#define SIM_SENSOR_RATE_HZ          ADXL_SAMPLE_RATE_HZ
+#define SIM_SENSOR_REST_SAMPLES     ((SIM_SENSOR_REST_MS*SIM_SENSOR_RATE_HZ)/1000)
+#define SIM_SENSOR_ADXL_MAX         2047    //12 bit counts
+#define SIM_SENSOR_PI               3.14159265358979
+
+// xorshift32, the same sequence on every host
+static uint32_t sim_sensor_random(sim_sensor_t *sensor)
+{
+    uint32_t x = sensor->seed;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sensor->seed = x;
+
+    return x;
+}
+
+// uniform in [low, high]
+static int32_t sim_sensor_uniform(sim_sensor_t *sensor, int32_t low, int32_t high)
+{
+    return low + (int32_t) (sim_sensor_random(sensor) % (uint32_t) (high - low + 1));
+}
+
+static int16_t sim_sensor_clamp(double value, int32_t limit)
+{
+    if (value > limit)
+        return (int16_t) limit;
+    if (value < -limit - 1)
+        return (int16_t) (-limit - 1);
+    return (int16_t) lround(value);
+}
+
+static int sim_sensor_append(sim_sensor_t *sensor, adxl372_accel_data_t const *accel, icm20649_data_t const *icm)
+{
+    sim_sample_t *samples;
+    uint32_t size;
+
+    if (sensor->count == sensor->size)
+    {
+        size = (sensor->size == 0) ? 65536 : 2*sensor->size;
+        samples = realloc(sensor->samples, size * sizeof(sim_sample_t));
+        if (samples == NULL)
+            return -1;
+        sensor->samples = samples;
+        sensor->size = size;
+    }
+    sensor->samples[sensor->count].accel = *accel;
+    sensor->samples[sensor->count].icm = *icm;
+    sensor->count++;
+
+    return 0;
+}
+
+void sim_sensor_init(sim_sensor_t *sensor, uint32_t seed)
+{
+    memset(sensor, 0, sizeof(sim_sensor_t));
+    //xorshift never leaves 0
+    sensor->seed = (seed == 0) ? 1 : seed;
+}
+
+void sim_sensor_free(sim_sensor_t *sensor)
+{
+    free(sensor->samples);
+    sensor->samples = NULL;
+    sensor->count = 0;
+    sensor->size = 0;
+}
+
+/*
+ * Appends samples of the sensor at rest, 1 g on z and noise
+ * @return 0 if success, -1 out of memory
+ */
+int sim_sensor_rest(sim_sensor_t *sensor, uint32_t num_samples)
+{
+    icm20649_data_t const icm = {0};
+    adxl372_accel_data_t accel;
+
+    for (uint32_t i = 0; i < num_samples; ++i)
+    {
+        accel.x = (int16_t) sim_sensor_uniform(sensor, -SIM_SENSOR_NOISE_COUNTS, SIM_SENSOR_NOISE_COUNTS);
+        accel.y = (int16_t) sim_sensor_uniform(sensor, -SIM_SENSOR_NOISE_COUNTS, SIM_SENSOR_NOISE_COUNTS);
+        accel.z = (int16_t) (SIM_SENSOR_GRAVITY_COUNTS
+                + sim_sensor_uniform(sensor, -SIM_SENSOR_NOISE_COUNTS, SIM_SENSOR_NOISE_COUNTS));
+        if (sim_sensor_append(sensor, &accel, &icm) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Appends half sine impacts, each after SIM_SENSOR_REST_MS at rest, and the
+ * rest after the last one. The angular rate is a half sine of twice the
+ * length about an axis across the direction of the hit
+ * @return 0 if success, -1 out of memory
+ */
+int sim_sensor_synthetic(sim_sensor_t *sensor, uint32_t num_impacts)
+{
+    adxl372_accel_data_t accel;
+    icm20649_data_t icm;
+    double dir[3], norm, peak_g, shape, omega;
+    uint32_t length, n;
+
+    for (uint32_t impact = 0; impact < num_impacts; ++impact)
+    {
+        if (sim_sensor_rest(sensor, SIM_SENSOR_REST_SAMPLES) < 0)
+            return -1;
+
+        do
+        {
+            for (int i = 0; i < 3; ++i)
+                dir[i] = sim_sensor_uniform(sensor, -1000, 1000) / 1000.0;
+            norm = sqrt(dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2]);
+        } while (norm < 0.1);
+        for (int i = 0; i < 3; ++i)
+            dir[i] /= norm;
+        peak_g = sim_sensor_uniform(sensor, SIM_SENSOR_MIN_PEAK_MG, SIM_SENSOR_MAX_PEAK_MG) / 1000.0;
+        length = (uint32_t) (((uint64_t) sim_sensor_uniform(sensor, SIM_SENSOR_MIN_LENGTH_US, SIM_SENSOR_MAX_LENGTH_US)
+                              * SIM_SENSOR_RATE_HZ) / 1000000);
+
+        for (n = 0; n < 2*length; ++n)
+        {
+            shape = (n < length) ? sin(SIM_SENSOR_PI * n / length) : 0.0;
+            omega = sin(SIM_SENSOR_PI * n / (2*length)) * peak_g * SIM_SENSOR_GYRO_DPS_PER_G * 32768.0 / SIM_SENSOR_GYRO_FS_DPS;
+            accel.x = sim_sensor_clamp(dir[0] * shape * peak_g * 1000 / ADXL372_MG_PER_LSB
+                                       + sim_sensor_uniform(sensor, -SIM_SENSOR_NOISE_COUNTS, SIM_SENSOR_NOISE_COUNTS),
+                                       SIM_SENSOR_ADXL_MAX);
+            accel.y = sim_sensor_clamp(dir[1] * shape * peak_g * 1000 / ADXL372_MG_PER_LSB
+                                       + sim_sensor_uniform(sensor, -SIM_SENSOR_NOISE_COUNTS, SIM_SENSOR_NOISE_COUNTS),
+                                       SIM_SENSOR_ADXL_MAX);
+            accel.z = sim_sensor_clamp(dir[2] * shape * peak_g * 1000 / ADXL372_MG_PER_LSB + SIM_SENSOR_GRAVITY_COUNTS
+                                       + sim_sensor_uniform(sensor, -SIM_SENSOR_NOISE_COUNTS, SIM_SENSOR_NOISE_COUNTS),
+                                       SIM_SENSOR_ADXL_MAX);
+            icm.accel_x = sim_sensor_clamp(dir[0] * shape * peak_g * 32768.0 / SIM_SENSOR_ICM_FS_G, INT16_MAX);
+            icm.accel_y = sim_sensor_clamp(dir[1] * shape * peak_g * 32768.0 / SIM_SENSOR_ICM_FS_G, INT16_MAX);
+            icm.accel_z = sim_sensor_clamp(dir[2] * shape * peak_g * 32768.0 / SIM_SENSOR_ICM_FS_G, INT16_MAX);
+            //any axis across the hit, (-y, x, 0) unless the hit is along z
+            icm.gyro_x = sim_sensor_clamp((fabs(dir[2]) < 0.9 ? -dir[1] : 1.0) * omega, INT16_MAX);
+            icm.gyro_y = sim_sensor_clamp((fabs(dir[2]) < 0.9 ? dir[0] : 0.0) * omega, INT16_MAX);
+            icm.gyro_z = 0;
+            if (sim_sensor_append(sensor, &accel, &icm) < 0)
+                return -1;
+        }
+        sensor->impacts++;
+    }
+
+    return sim_sensor_rest(sensor, SIM_SENSOR_REST_SAMPLES);
+}
+
+typedef struct {
+    sim_sensor_t *sensor;
+    int failed;
+} sim_sensor_load_t;
+
+static void sim_sensor_event_handler(void *p_context, impact_log_event_t const *event)
+{
+    sim_sensor_load_t *load = p_context;
+
+    //summary frames of a query carry no samples, summary log events no impact
+    if (event->data_size == 0 || event->encoding == SUMMARY_LOG_ENCODING)
+        return;
+    if (sim_sensor_rest(load->sensor, SIM_SENSOR_REST_SAMPLES) < 0)
+        load->failed = 1;
+    load->sensor->impacts++;
+}
+
+static void sim_sensor_sample_handler(void *p_context, impact_log_event_t const *event, impact_log_sample_t const *sample)
+{
+    sim_sensor_load_t *load = p_context;
+
+    if (sim_sensor_append(load->sensor, &sample->accel, &sample->icm) < 0)
+        load->failed = 1;
+}
+
+static void sim_sensor_error_handler(void *p_context, char const *message)
+{
+    fprintf(stderr, "%s\n", message);
+}
+
+/*
+ * Appends the samples of every event of an offload capture or a flash image,
+ * each after SIM_SENSOR_REST_MS at rest, and the rest after the last one.
+ * The device stored the samples filtered, replay them without the filter to
+ * see the trigger and metrics the device saw
+ * @return number of events loaded, -1 if the file could not be read
+ */
+int sim_sensor_load(sim_sensor_t *sensor, char const *path)
+{
+    sim_sensor_load_t load = {sensor, 0};
+    impact_log_handlers_t handlers = {sim_sensor_event_handler, sim_sensor_sample_handler, NULL, NULL, NULL,
+                                      sim_sensor_error_handler, &load};
+    impact_log_stream_t stream;
+    uint32_t impacts = sensor->impacts;
+    uint32_t decoded, errors;
+    uint8_t *data = NULL, *grown;
+    size_t length = 0, size = 0, got;
+    FILE *in = fopen(path, "rb");
+
+    if (in == NULL)
+        return -1;
+    do
+    {
+        if (length == size)
+        {
+            size = (size == 0) ? 1024*1024 : 2*size;
+            grown = realloc(data, size);
+            if (grown == NULL)
+            {
+                free(data);
+                fclose(in);
+                return -1;
+            }
+            data = grown;
+        }
+        got = fread(&data[length], 1, size - length, in);
+        length += got;
+    } while (got > 0);
+    fclose(in);
+
+    if (impact_log_is_flash_image(data, length))
+    {
+        (void) impact_log_flash_image(&handlers, data, length, &decoded, &errors);
+    }
+    else
+    {
+        impact_log_stream_init(&stream, &handlers);
+        if (impact_log_stream_feed(&stream, data, length) < 0)
+            load.failed = 1;
+        impact_log_stream_free(&stream);
+    }
+    free(data);
+
+    if (load.failed || sim_sensor_rest(sensor, SIM_SENSOR_REST_SAMPLES) < 0)
+        return -1;
+
+    return (int) (sensor->impacts - impacts);
+}
+
+/*
+ * Starts the trace over, for the next run
+ */
+void sim_sensor_rewind(sim_sensor_t *sensor)
+{
+    sensor->next = 0;
+}
+
+/*
+ * Reads the next burst like adxl372_queue_fifo_read() with the icm20649 reading of its last sample
+ * @return samples read, 0 at the end of the trace
+ */
+uint16_t sim_sensor_fifo_read(sim_sensor_t *sensor, adxl372_accel_data_t *samples, uint16_t max_samples,
+                              icm20649_data_t *p_gyro)
+{
+    uint32_t num_samples = sensor->count - sensor->next;
+
+    if (num_samples > max_samples)
+        num_samples = max_samples;
+    for (uint32_t i = 0; i < num_samples; ++i)
+        samples[i] = sensor->samples[sensor->next + i].accel;
+    if (num_samples > 0)
+        *p_gyro = sensor->samples[sensor->next + num_samples - 1].icm;
+    sensor->next += num_samples;
+
+    return (uint16_t) num_samples;
+}
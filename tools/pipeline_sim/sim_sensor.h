@@ -0,0 +1,57 @@
+#ifndef SIM_SENSOR_H
+#define SIM_SENSOR_H
+
+#include <stdint.h>
+#include "adxl372.h"
+#include "icm20649.h"
+
+/* Stand-in for the adxl372 fifo and the icm20649 of the capture: a trace of
+ * accel samples at the adxl372 rate, each with the icm20649 reading taken
+ * alongside it, read out in fifo bursts like the watermark reads of capture.c.
+ * The burst gets the icm20649 reading of its last sample, the newest one the
+ * device would have. A trace is recorded, the samples of every event of an
+ * offload capture or flash image in turn, or synthetic, half sine impacts of
+ * random peak, length and direction. Either way the samples between impacts
+ * are 1 g at rest with a few counts of noise, long enough for the trigger to
+ * go quiet and rearm */
+#define SIM_SENSOR_REST_MS          200     //at rest before and after each impact
+#define SIM_SENSOR_NOISE_COUNTS     2       //peak noise on every axis
+#define SIM_SENSOR_GRAVITY_COUNTS   ADXL372_MG_TO_COUNTS(1000)
+#define SIM_SENSOR_MIN_PEAK_MG      15000   //synthetic impacts, above CAPTURE_THRESHOLD_MG
+#define SIM_SENSOR_MAX_PEAK_MG      150000
+#define SIM_SENSOR_MIN_LENGTH_US    2000
+#define SIM_SENSOR_MAX_LENGTH_US    15000
+#define SIM_SENSOR_GYRO_DPS_PER_G   20      //synthetic angular rate peak per g of peak
+#define SIM_SENSOR_GYRO_FS_DPS      2000    //CAPTURE_GYRO_FS_DPS
+#define SIM_SENSOR_ICM_FS_G         30      //icm20649 accel full scale in icm20649_default_init
+
+typedef struct {
+    adxl372_accel_data_t accel;
+    icm20649_data_t icm;
+} sim_sample_t;
+
+typedef struct {
+    sim_sample_t *samples;
+    uint32_t count;
+    uint32_t size;
+    uint32_t next;          /* first sample of the next burst */
+    uint32_t impacts;       /* events loaded or impacts generated */
+    uint32_t seed;          /* noise and synthetic impacts */
+} sim_sensor_t;
+
+void sim_sensor_init(sim_sensor_t *sensor, uint32_t seed);
+
+void sim_sensor_free(sim_sensor_t *sensor);
+
+int sim_sensor_rest(sim_sensor_t *sensor, uint32_t num_samples);
+
+int sim_sensor_synthetic(sim_sensor_t *sensor, uint32_t num_impacts);
+
+int sim_sensor_load(sim_sensor_t *sensor, char const *path);
+
+void sim_sensor_rewind(sim_sensor_t *sensor);
+
+uint16_t sim_sensor_fifo_read(sim_sensor_t *sensor, adxl372_accel_data_t *samples, uint16_t max_samples,
+                              icm20649_data_t *p_gyro);
+
+#endif //SIM_SENSOR_H
@@ -0,0 +1,141 @@
+//-------------------------------------------
+// Title: trace_decode.c
+// Author: UBC Capstone Team 48 - 2019/2020
+// Description: Command line decoder of the binary trace (libraries/trace)
+// captured from its RTT channel, writes one csv line per entry with the
+// time since the boot it was traced in.
+//
+// usage: trace_decode [file ...]
+//   JLinkRTTLogger -Device NRF52832_XXAA -If SWD -Speed 4000 -RTTChannel 1 trace.bin
+//   trace_decode trace.bin > trace.csv
+//-------------------------------------------
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "trace.h"
+
+#define TRACE_ID_NAME(_id) #_id,
+static char const * const m_id_names[TRACE_ID_COUNT] = {
+    TRACE_ID_LIST(TRACE_ID_NAME)
+};
+#undef TRACE_ID_NAME
+
+//device_state_t of imu_pcb_rev1_test, for TRACE_ID_STATE
+static char const * const m_state_names[] = {"OFF_HEAD", "ARMED", "CAPTURING", "COMMITTING", "OFFLOADING"};
+
+typedef struct {
+    uint64_t ticks;     //since the last TRACE_ID_START, unwrapped
+    uint32_t last;      //TRACE_TICK_MASK bits of the previous entry
+    int started;
+    unsigned long entries;
+    unsigned long dropped;
+} decode_t;
+
+static uint32_t read_u32(uint8_t const *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint16_t read_u16(uint8_t const *p)
+{
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static char const *state_name(uint32_t state)
+{
+    return (state < sizeof(m_state_names)/sizeof(m_state_names[0])) ? m_state_names[state] : "?";
+}
+
+// decodes one entry, the entries are sent in little endian whatever the host
+static void decode_entry(decode_t *decode, uint8_t const *raw)
+{
+    trace_entry_t entry;
+    uint32_t ticks;
+
+    entry.ticks = read_u32(&raw[0]);
+    entry.id = read_u16(&raw[4]);
+    entry.a = read_u16(&raw[6]);
+    entry.b = read_u32(&raw[8]);
+    ticks = entry.ticks & TRACE_TICK_MASK;
+
+    if (entry.id == TRACE_ID_START)
+    {
+        if (entry.b != TRACE_MAGIC)
+            fprintf(stderr, "trace format 0x%08x, expected 0x%08x\n", entry.b, TRACE_MAGIC);
+        decode->ticks = 0;
+        decode->started = 1;
+    }
+    else if (decode->started)
+    {
+        //entries more than one wrap apart are taken as one wrap less
+        decode->ticks += (ticks - decode->last) & TRACE_TICK_MASK;
+    }
+    decode->last = ticks;
+    decode->entries++;
+
+    printf("%.6f,", (double) decode->ticks / TRACE_TICK_HZ);
+    if (entry.id >= TRACE_ID_COUNT)
+    {
+        printf("%u,%u,%u\n", entry.id, entry.a, entry.b);
+        return;
+    }
+    printf("%s,", m_id_names[entry.id] + strlen("TRACE_ID_"));
+    if (entry.id == TRACE_ID_STATE)
+    {
+        printf("%s,%s\n", state_name(entry.a), state_name(entry.b));
+        return;
+    }
+    if (entry.id == TRACE_ID_DROPPED)
+        decode->dropped += entry.b;
+    //the error codes are negative int8_t returns
+    if (entry.id == TRACE_ID_SPI_ERROR || entry.id == TRACE_ID_SENSOR_ERROR || entry.id == TRACE_ID_FIFO_ERROR)
+        printf("%u,%d\n", entry.a, (int32_t) entry.b);
+    else
+        printf("%u,%u\n", entry.a, entry.b);
+}
+
+static int decode_file(FILE *in, decode_t *decode)
+{
+    uint8_t raw[sizeof(trace_entry_t)];
+    size_t length;
+
+    while ((length = fread(raw, 1, sizeof(raw), in)) == sizeof(raw))
+    {
+        decode_entry(decode, raw);
+    }
+    if (length != 0)
+    {
+        fprintf(stderr, "%lu bytes at the end are not a whole entry\n", (unsigned long) length);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    decode_t decode;
+    int num_errors = 0, i;
+    FILE *in;
+
+    memset(&decode, 0, sizeof(decode));
+    printf("t_s,id,a,b\n");
+    for (i = 1; i < argc || i == 1; i++)
+    {
+        if (i == argc)
+        {
+            in = stdin;
+        }
+        else if ((in = fopen(argv[i], "rb")) == NULL)
+        {
+            perror(argv[i]);
+            num_errors++;
+            continue;
+        }
+        num_errors += decode_file(in, &decode);
+        if (in != stdin)
+            fclose(in);
+    }
+    if (decode.dropped > 0)
+        fprintf(stderr, "%lu entries, %lu dropped on the device\n", decode.entries, decode.dropped);
+    return (num_errors > 0) ? 1 : 0;
+}